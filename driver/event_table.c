@@ -176,4 +176,20 @@ const struct ppm_event_info g_event_info[PPM_EVENT_MAX] = {
 	/* PPME_SYSCALL_FCNTL_X */{"fcntl", EC_IO_OTHER, (enum ppm_event_flags)(EF_USES_FD | EF_MODIFIES_STATE), 1, {{"res", PT_FD, PF_DEC} } },
 	/* PPME_SCHEDSWITCHEX_E */{"switch", EC_SCHEDULER, EF_NONE, 5, {{"next", PT_PID, PF_DEC}, {"pgft_maj", PT_UINT32, PF_DEC}, {"pgft_min", PT_UINT32, PF_DEC}, {"next_pgft_maj", PT_UINT32, PF_DEC}, {"next_pgft_min", PT_UINT32, PF_DEC} } },
 	/* PPME_SCHEDSWITCHEX_X */{"NA2", EC_SCHEDULER, EF_UNUSED, 0},
+	/* PPME_SCHEDSWITCH_SUMMARY_E */{"switchsum", EC_SCHEDULER, EF_MODIFIES_STATE, 3, {{"exectime", PT_RELTIME, PF_DEC}, {"vcsw", PT_UINT64, PF_DEC}, {"ivcsw", PT_UINT64, PF_DEC} } },
+	/* PPME_SCHEDSWITCH_SUMMARY_X */{"NA2", EC_SCHEDULER, EF_UNUSED, 0},
+	/* PPME_PROCINFO_E */{"procinfo", EC_PROCESS, EF_MODIFIES_STATE, 2, {{"args", PT_BYTEBUF, PF_NA}, {"cwd", PT_CHARBUF, PF_NA} } },
+	/* PPME_PROCINFO_X */{"NA2", EC_PROCESS, EF_UNUSED, 0},
+	/* PPME_SAMPLING_E */{"sampling", EC_INTERNAL, EF_NONE, 1, {{"ratio", PT_UINT32, PF_DEC} } },
+	/* PPME_SAMPLING_X */{"NA2", EC_INTERNAL, EF_UNUSED, 0},
+	/* PPME_REPEAT_E */{"repeat", EC_OTHER, EF_NONE, 2, {{"count", PT_UINT32, PF_DEC}, {"span", PT_RELTIME, PF_DEC} } },
+	/* PPME_REPEAT_X */{"NA2", EC_OTHER, EF_UNUSED, 0},
+	/* PPME_PROCSTATE_E */{"procstate", EC_PROCESS, EF_MODIFIES_STATE, 11, {{"tid", PT_PID, PF_DEC}, {"pid", PT_PID, PF_DEC}, {"ptid", PT_PID, PF_DEC}, {"comm", PT_CHARBUF, PF_NA}, {"exe", PT_CHARBUF, PF_NA}, {"args", PT_BYTEBUF, PF_NA}, {"cwd", PT_CHARBUF, PF_NA}, {"fdlimit", PT_INT64, PF_DEC}, {"uid", PT_UINT32, PF_DEC}, {"gid", PT_UINT32, PF_DEC}, {"flags", PT_FLAGS32, PF_HEX, clone_flags} } },
+	/* PPME_PROCSTATE_X */{"NA2", EC_PROCESS, EF_UNUSED, 0},
+	/* PPME_FDSTATE_E */{"fdstate", EC_FILE, EF_MODIFIES_STATE, 5, {{"fd", PT_FD, PF_DEC}, {"ino", PT_UINT64, PF_DEC}, {"mode", PT_UINT32, PF_HEX}, {"name", PT_FSPATH, PF_NA}, {"sock", PT_BYTEBUF, PF_NA} } },
+	/* PPME_FDSTATE_X */{"NA2", EC_FILE, EF_UNUSED, 0},
+	/* PPME_RUNQ_E */{"runq", EC_SCHEDULER, EF_NONE, 3, {{"delay", PT_RELTIME, PF_DEC}, {"waits", PT_UINT32, PF_DEC}, {"maxdelay", PT_RELTIME, PF_DEC} } },
+	/* PPME_RUNQ_X */{"NA2", EC_SCHEDULER, EF_UNUSED, 0},
+	/* PPME_PGFAULT_E */{"pgfault", EC_MEMORY, EF_MODIFIES_STATE, 3, {{"maj", PT_UINT64, PF_DEC}, {"min", PT_UINT64, PF_DEC}, {"addr", PT_UINT64, PF_HEX} } },
+	/* PPME_PGFAULT_X */{"NA2", EC_MEMORY, EF_UNUSED, 0},
 };
@@ -100,6 +100,7 @@ const struct ppm_name_value clone_flags[] = {
 	{"CLONE_INVERTED", (1 << 16)},
 	{"NAME_CHANGED", (1 << 17)},
 	{"CLOSED", (1 << 18)},
+	{"CMDLINE_INHERITED", (1 << 19)},
 	{ },
 };
 
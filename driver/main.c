@@ -26,6 +26,8 @@ along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
 #endif
 #include <linux/cdev.h>
 #include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/mutex.h>
 #include <linux/kernel.h>
 #include <linux/kdev_t.h>
 #include <linux/delay.h>
@@ -33,8 +35,11 @@ along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
 #include <linux/sched.h>
 #include <linux/vmalloc.h>
 #include <linux/wait.h>
+#include <linux/poll.h>
 #include <linux/tracepoint.h>
+#include <linux/uaccess.h>
 #include <asm/syscall.h>
+#include <asm/local.h>
 #include <net/sock.h>
 #if defined(__x86_64__)
 #include <asm/unistd_64.h>
@@ -70,16 +75,102 @@ struct ppm_device {
 
 /*
  * The ring descriptor.
- * We have one of these for each CPU.
+ * Each consumer has one of these for each CPU.
  */
 struct ppm_ring_buffer_context {
 	atomic_t state;
 	struct ppm_ring_buffer_info *info;
 	char *buffer;
+	u32 buffer_size;	/* Size of buffer, not including the overflow pages. */
+	int contiguous;		/* If set, buffer comes from the page allocator instead of vmalloc. */
+	struct page **pages;	/* If set, buffer maps these pages twice in a row, see alloc_mirrored_buffer(). */
 	struct timespec last_print_time;
 	u32 nevents;
-	atomic_t preempt_count;
-	char *str_storage;	/* String storage. Size is one page. */
+	u32 cached_tail;	/* Last tail read from info, see ring_freespace(). */
+	struct ppm_detailed_stats *stats;	/* Allocated when the consumer first enables the detailed stats. */
+	struct ppm_syscall_aggr_table *aggr;	/* Allocated when the consumer first enables the syscall aggregation. */
+	char *compact_body;	/* Parameters of the event being encoded in compact form. Allocated when the consumer first enables the compact encoding. */
+	u64 compact_last_ts;	/* Timestamp and tid of the last event written in compact form, which the next one is encoded against. */
+	u64 compact_last_tid;
+	u64 pending_ts;	/* Timestamp of the first event written since the readers were last woken up, 0 if none. See PPM_IOCTL_SET_MAX_DELAY. */
+	struct ppm_ring_buffer_context *aux[PPM_MAX_AUX_RINGS];	/* Auxiliary rings, allocated when the consumer enables them. */
+};
+
+/*
+ * A process reading the events.
+ * Every consumer opens all the devices and gets its own set of ring buffers.
+ * The fillers run once per event and the result is copied to the rings of
+ * the other consumers, which then progress independently: a slow consumer
+ * only causes drops in its own rings.
+ */
+#define PPM_MAX_CONSUMERS 4
+
+struct ppm_consumer {
+	pid_t owner;		/* tgid of the process that opened the devices. 0 if the slot is free. */
+	u32 open_count;		/* Number of devices opened by this consumer. */
+	struct ppm_ring_buffer_context **rings;	/* The rings of this consumer, indexed by CPU. */
+	struct ppm_evt_mask events_mask;
+	struct ppm_tid_exclusion_list excluded_tids;
+	struct ppm_cpu_exclusion_mask excluded_cpus;
+	int has_excluded_cpus;	/* If set, excluded_cpus has at least one CPU. */
+	struct ppm_predicate predicate;
+	u32 wakeup_watermark;
+	u64 max_delay_ns;	/* If set, the readers are woken up once the unread events are this old, even below the watermark. */
+	int detailed_stats;	/* If set, the probes update the stats of the rings. */
+	u32 aggr_flags;		/* PPM_AGGR_* flags. With PPM_AGGR_ENABLED, the probes update the aggregation tables instead of writing events. */
+	int compact_encoding;	/* If set, the events are written to the rings in the compact form. */
+	int exit_only;		/* If set, the enter events of the system calls are written with their exit events. Requires compact_encoding. */
+};
+
+/*
+ * Size of the compact_body scratch area. Together with the largest compact
+ * header, this still fits in the cushion at the end of the ring.
+ */
+#define PPM_COMPACT_BODY_SIZE (2 * PAGE_SIZE - sizeof(struct ppm_evt_hdr))
+#define PPM_COMPACT_MAX_HDR_SIZE 32
+
+/*
+ * Enter time of the system call in progress of a thread, for the syscall
+ * aggregation. Indexed by tid, so two threads can collide on a slot: the
+ * latest one wins and the call of the other one has no latency.
+ */
+#define PPM_AGGR_INFLIGHT_SLOTS 16384 /* Must be a power of two */
+#define PPM_AGGR_MAX_PROBES 16 /* Entries tried in the table before giving up */
+
+struct ppm_aggr_inflight {
+	pid_t tid;
+	u64 enter_ns;
+};
+
+/*
+ * Time of the last context switch summary of a thread. Indexed by tid like
+ * the syscall aggregation slots: the threads that collide on a slot just get
+ * more summaries.
+ */
+#define PPM_SWITCH_SUMMARY_SLOTS 16384 /* Must be a power of two */
+
+struct ppm_switch_summary_slot {
+	pid_t tid;
+	u64 last_ns;
+};
+
+/*
+ * Enter event of the system call in progress of a thread, for the exit only
+ * mode, already in compact form. Indexed by tid like the syscall
+ * aggregation slots. seq is odd while the slot is being written, so a slot
+ * that two CPUs write at the same time is never read half done.
+ */
+#define PPM_ENTER_SLOTS 16384 /* Must be a power of two */
+#define PPM_ENTER_SLOT_BODY_SIZE 104 /* Enough for the enter events of the I/O system calls */
+#define PPM_ENTER_SECTION_SIZE (PPM_ENTER_SLOT_BODY_SIZE + 20) /* Plus the two varints */
+
+struct ppm_enter_slot {
+	atomic_t seq;
+	pid_t tid;
+	u16 type;
+	u16 body_size;
+	u64 ts;
+	char body[PPM_ENTER_SLOT_BODY_SIZE];
 };
 
 /*
@@ -88,6 +179,7 @@ struct ppm_ring_buffer_context {
 static int ppm_open(struct inode *inode, struct file *filp);
 static int ppm_release(struct inode *inode, struct file *filp);
 static long ppm_ioctl(struct file *f, unsigned int cmd, unsigned long arg);
+static unsigned int ppm_poll(struct file *filp, poll_table *wait);
 static int ppm_mmap(struct file *filp, struct vm_area_struct *vma);
 static void record_event(enum ppm_event_type event_type,
 	struct pt_regs *regs,
@@ -95,6 +187,10 @@ static void record_event(enum ppm_event_type event_type,
 	int never_drop,
 	struct task_struct *sched_prev,
 	struct task_struct *sched_next);
+static int check_ring_buffer_size(u32 size);
+static int dump_state(struct ppm_consumer *consumer, struct ppm_state_dump *dump);
+static struct ppm_ring_buffer_context *alloc_ring_buffer(struct ppm_ring_buffer_context **ring, u32 size, int cpu);
+static void free_ring_buffer(struct ppm_ring_buffer_context *ring);
 
 TRACEPOINT_PROBE(syscall_enter_probe, struct pt_regs *regs, long id);
 TRACEPOINT_PROBE(syscall_exit_probe, struct pt_regs *regs, long ret);
@@ -102,9 +198,18 @@ TRACEPOINT_PROBE(syscall_procexit_probe, struct task_struct *p);
 #ifdef CAPTURE_CONTEXT_SWITCHES
 #if (LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 35))
 TRACEPOINT_PROBE(sched_switch_probe, struct rq *rq, struct task_struct *prev, struct task_struct *next);
+TRACEPOINT_PROBE(sched_wakeup_probe, struct rq *rq, struct task_struct *p, int success);
+#elif (LINUX_VERSION_CODE < KERNEL_VERSION(4, 3, 0))
+TRACEPOINT_PROBE(sched_switch_probe, struct task_struct *prev, struct task_struct *next);
+TRACEPOINT_PROBE(sched_wakeup_probe, struct task_struct *p, int success);
 #else
 TRACEPOINT_PROBE(sched_switch_probe, struct task_struct *prev, struct task_struct *next);
+TRACEPOINT_PROBE(sched_wakeup_probe, struct task_struct *p);
 #endif /* (LINUX_VERSION_CODE < KERNEL_VERSION(2,6,35)) */
+#if defined(CONFIG_X86) && (LINUX_VERSION_CODE >= KERNEL_VERSION(3, 13, 0))
+#define CAPTURE_PAGE_FAULT_ADDRESSES
+TRACEPOINT_PROBE(page_fault_probe, unsigned long address, struct pt_regs *regs, unsigned long error_code);
+#endif
 #endif /* CAPTURE_CONTEXT_SWITCHES */
 
 static struct ppm_device *g_ppm_devs;
@@ -115,6 +220,7 @@ static const struct file_operations g_ppm_fops = {
 	.open = ppm_open,
 	.release = ppm_release,
 	.mmap = ppm_mmap,
+	.poll = ppm_poll,
 	.unlocked_ioctl = ppm_ioctl,
 	.owner = THIS_MODULE,
 };
@@ -123,153 +229,527 @@ static const struct file_operations g_ppm_fops = {
  * GLOBALS
  */
 
-static DEFINE_PER_CPU(struct ppm_ring_buffer_context*, g_ring_buffers);
+static DEFINE_PER_CPU(struct ppm_ring_buffer_context *[PPM_MAX_CONSUMERS], g_ring_buffers);
+/*
+ * Reentrancy guard of the rings of each CPU. It's only touched with
+ * preemption disabled, so only an interrupt on the same CPU can race with
+ * it: a local_t is enough, and saves the lock prefix of an atomic_t.
+ */
+static DEFINE_PER_CPU(local_t, g_preempt_count);
+static DEFINE_PER_CPU(char *, g_str_storage);
+static struct ppm_consumer g_consumers[PPM_MAX_CONSUMERS];
 static atomic_t g_open_count;
+static int g_tracepoints_registered;
+static DEFINE_MUTEX(g_open_mutex);
+static unsigned int ring_buf_size = DEFAULT_RING_BUF_SIZE;
+static bool ring_buf_contiguous;
 u32 g_snaplen = RW_SNAPLEN;
+struct ppm_snaplen_policy g_snaplen_policy;
+int g_snaplen_policy_enabled;
+int g_tcp_tuple_elision;
+u32 g_buffer_hash_len;
 u32 g_sampling_ratio = 1;
 static u32 g_sampling_interval;
 static int g_is_dropping;
 static int g_dropping_mode;
+static struct ppm_sampling_policy g_sampling_policy;
+static int g_sampling_policy_enabled;
+static u32 g_aggr_consumers;
+static struct ppm_aggr_inflight *g_aggr_inflight;
+static u64 g_switch_summary_ns;
+static struct ppm_switch_summary_slot *g_switch_summary_slots;
+static u64 g_runq_summary_ns;
+struct ppm_runq_slot *g_runq_slots;
+static u64 g_pgfault_summary_ns;
+struct ppm_pgfault_slot *g_pgfault_slots;
+#ifdef CAPTURE_PAGE_FAULT_ADDRESSES
+static int g_page_fault_registered;
+#endif
+static struct ppm_enter_slot *g_enter_slots;
+static DECLARE_BITMAP(g_ignored_syscalls, SYSCALL_TABLE_SIZE);	/* System calls whose events no consumer wants, see update_ignored_syscalls(). */
+static atomic64_t g_clock_anchor_ns;	/* Monotonic time of the last wall clock reading, see event_timestamp(). */
+static atomic64_t g_clock_offset_ns;	/* Wall clock minus monotonic clock at that reading. */
+
+module_param(ring_buf_size, uint, 0644);
+MODULE_PARM_DESC(ring_buf_size, "Size in bytes of each per-CPU ring buffer. Must be a multiple of the page size. Changes apply to the processes that start capturing afterwards.");
+module_param(ring_buf_contiguous, bool, 0644);
+MODULE_PARM_DESC(ring_buf_contiguous, "Try to allocate the data area of the ring buffers as physically contiguous memory, which the driver writes through the large pages of the kernel linear mapping. Falls back to vmalloc when the allocation fails.");
+
+static inline int consumer_id(struct ppm_consumer *consumer)
+{
+	return consumer - g_consumers;
+}
 
 /*
- * user I/O functions
+ * Return the ring of the given consumer for the given CPU
  */
-static int ppm_open(struct inode *inode, struct file *filp)
+static inline struct ppm_ring_buffer_context *get_consumer_ring(struct ppm_consumer *consumer, int ring_no)
 {
-	int ret;
-	struct ppm_ring_buffer_context *ring;
-	int ring_no = iminor(filp->f_dentry->d_inode);
+	return consumer->rings[ring_no];
+}
+
+/*
+ * Recompute the system calls that the probes can skip right away, because
+ * none of the consumers has the enter or the exit event in its mask.
+ * Must be called with g_open_mutex held, after the masks change.
+ */
+static void update_ignored_syscalls(void)
+{
+	int id;
+	int j;
 
-	ring = per_cpu(g_ring_buffers, ring_no);
+	for (id = 0; id < SYSCALL_TABLE_SIZE; id++) {
+		enum ppm_event_type enter_type = PPME_GENERIC_E;
+		enum ppm_event_type exit_type = PPME_GENERIC_X;
+		int wanted = 0;
 
-	if (atomic_cmpxchg(&ring->state, CS_STOPPED, CS_STARTED) != CS_STOPPED) {
-		pr_info("invalid operation: attempting to open device %d multiple times\n", ring_no);
-		return -EBUSY;
+		if (g_syscall_table[id].flags & UF_USED) {
+			enter_type = g_syscall_table[id].enter_event_type;
+			exit_type = g_syscall_table[id].exit_event_type;
+		}
+
+		for (j = 0; j < PPM_MAX_CONSUMERS; j++) {
+			struct ppm_consumer *consumer = &g_consumers[j];
+
+			if (consumer->owner != 0 &&
+				(PPM_EVT_MASK_ISSET(&consumer->events_mask, enter_type) ||
+				PPM_EVT_MASK_ISSET(&consumer->events_mask, exit_type)))
+				wanted = 1;
+		}
+
+#ifndef __x86_64__
+		/*
+		 * The type of the socketcall events is only known after
+		 * parsing the arguments
+		 */
+		if (id == __NR_socketcall)
+			wanted = 1;
+#endif
+
+		if (wanted)
+			clear_bit(id, g_ignored_syscalls);
+		else
+			set_bit(id, g_ignored_syscalls);
 	}
+}
 
-	g_dropping_mode = 0;
-	g_snaplen = RW_SNAPLEN;
-	g_sampling_ratio = 1;
-	g_sampling_interval = 0;
-	g_is_dropping = 0;
-	ring->info->head = 0;
-	ring->info->tail = 0;
-	ring->nevents = 0;
-	ring->info->n_evts = 0;
-	ring->info->n_drops_buffer = 0;
-	ring->info->n_drops_pf = 0;
-	ring->info->n_preemptions = 0;
-	ring->info->n_context_switches = 0;
-	atomic_set(&ring->preempt_count, 0);
-	getnstimeofday(&ring->last_print_time);
+static void destroy_consumer(struct ppm_consumer *consumer)
+{
+	unsigned int cpu;
+	int id = consumer_id(consumer);
 
 	/*
-	 * The last open device starts the collection
+	 * Hide the rings from the probes, and wait for the ones that are
+	 * still using them before freeing them
 	 */
-	if (atomic_inc_return(&g_open_count) == g_ppm_numdevs) {
-		pr_info("starting capture\n");
+	g_aggr_consumers &= ~(1 << id);
+	consumer->aggr_flags = 0;
 
-		/*
-		 * Enable the tracepoints
-		 */
-		ret = TRACEPOINT_PROBE_REGISTER("sys_exit", (void *) syscall_exit_probe);
-		if (ret) {
-			pr_err("can't create the sys_exit tracepoint\n");
-			return ret;
-		}
+	for_each_online_cpu(cpu)
+		per_cpu(g_ring_buffers, cpu)[id] = NULL;
 
-		ret = TRACEPOINT_PROBE_REGISTER("sys_enter", (void *) syscall_enter_probe);
-		if (ret) {
-			TRACEPOINT_PROBE_UNREGISTER("sys_exit",
-						    (void *) syscall_exit_probe);
+	tracepoint_synchronize_unregister();
 
-			pr_err("can't create the sys_enter tracepoint\n");
+	for_each_online_cpu(cpu)
+		if (consumer->rings[cpu] != NULL)
+			free_ring_buffer(consumer->rings[cpu]);
 
-			return ret;
-		}
+	kfree(consumer->rings);
+	consumer->rings = NULL;
+	consumer->owner = 0;
+	consumer->open_count = 0;
 
-		ret = TRACEPOINT_PROBE_REGISTER("sched_process_exit", (void *) syscall_procexit_probe);
-		if (ret) {
-			TRACEPOINT_PROBE_UNREGISTER("sys_exit",
-						    (void *) syscall_exit_probe);
-			TRACEPOINT_PROBE_UNREGISTER("sys_enter",
-						    (void *) syscall_enter_probe);
+	update_ignored_syscalls();
+}
+
+/*
+ * Find the consumer for the calling process, creating it if this is the
+ * first device the process opens.
+ * Must be called with g_open_mutex held.
+ */
+static struct ppm_consumer *get_consumer(int *err)
+{
+	int j;
+	unsigned int cpu;
+	struct ppm_consumer *consumer = NULL;
 
-			pr_err("can't create the sched_process_exit tracepoint\n");
+	for (j = 0; j < PPM_MAX_CONSUMERS; j++) {
+		if (g_consumers[j].owner == current->tgid)
+			return &g_consumers[j];
 
-			return ret;
+		if (g_consumers[j].owner == 0 && consumer == NULL)
+			consumer = &g_consumers[j];
+	}
+
+	if (consumer == NULL) {
+		pr_info("too many consumers, at most %d processes can capture at the same time\n", PPM_MAX_CONSUMERS);
+		*err = -EBUSY;
+		return NULL;
+	}
+
+	*err = check_ring_buffer_size(ring_buf_size);
+	if (*err)
+		return NULL;
+
+	consumer->rings = kzalloc(nr_cpu_ids * sizeof(struct ppm_ring_buffer_context *), GFP_KERNEL);
+	if (consumer->rings == NULL) {
+		*err = -ENOMEM;
+		return NULL;
+	}
+
+	consumer->owner = current->tgid;
+	consumer->open_count = 0;
+
+	/*
+	 * The rings of a new consumer always get the size currently requested
+	 * through the ring_buf_size module parameter. They are published to the
+	 * probes here, but stay unused until each device is opened.
+	 */
+	for_each_online_cpu(cpu) {
+		if (alloc_ring_buffer(&consumer->rings[cpu], ring_buf_size, cpu) == NULL) {
+			pr_err("can't initialize the ring buffer for CPU %u\n", cpu);
+			destroy_consumer(consumer);
+			*err = -ENOMEM;
+			return NULL;
 		}
+	}
+
+	memset(&consumer->events_mask, 0xff, sizeof(consumer->events_mask));
+	update_ignored_syscalls();
+	consumer->excluded_tids.ntids = 0;
+	consumer->has_excluded_cpus = 0;
+	consumer->predicate.n_clauses = 0;
+	consumer->wakeup_watermark = DEFAULT_WAKEUP_WATERMARK;
+	consumer->max_delay_ns = 0;
+	consumer->detailed_stats = 0;
+	consumer->aggr_flags = 0;
+	consumer->compact_encoding = 0;
+	consumer->exit_only = 0;
+
+	/*
+	 * The fillers run once for all the consumers, so the settings that
+	 * affect them are shared. They go back to the defaults only when
+	 * nobody else is capturing.
+	 */
+	if (atomic_read(&g_open_count) == 0) {
+		g_dropping_mode = 0;
+		g_snaplen = RW_SNAPLEN;
+		g_snaplen_policy_enabled = 0;
+		g_tcp_tuple_elision = 0;
+		g_buffer_hash_len = 0;
+		g_switch_summary_ns = 0;
+		g_runq_summary_ns = 0;
+		g_pgfault_summary_ns = 0;
+		g_sampling_ratio = 1;
+		g_sampling_interval = 0;
+		g_is_dropping = 0;
+		g_sampling_policy_enabled = 0;
+	}
+
+	smp_wmb();
+
+	for_each_online_cpu(cpu)
+		per_cpu(g_ring_buffers, cpu)[consumer_id(consumer)] = consumer->rings[cpu];
+
+	pr_info("new consumer %d for process %d\n", consumer_id(consumer), current->tgid);
+
+	return consumer;
+}
+
+static int register_tracepoints(void)
+{
+	int ret;
+
+	ret = TRACEPOINT_PROBE_REGISTER("sys_exit", (void *) syscall_exit_probe);
+	if (ret) {
+		pr_err("can't create the sys_exit tracepoint\n");
+		return ret;
+	}
+
+	ret = TRACEPOINT_PROBE_REGISTER("sys_enter", (void *) syscall_enter_probe);
+	if (ret) {
+		TRACEPOINT_PROBE_UNREGISTER("sys_exit",
+					    (void *) syscall_exit_probe);
+
+		pr_err("can't create the sys_enter tracepoint\n");
+
+		return ret;
+	}
+
+	ret = TRACEPOINT_PROBE_REGISTER("sched_process_exit", (void *) syscall_procexit_probe);
+	if (ret) {
+		TRACEPOINT_PROBE_UNREGISTER("sys_exit",
+					    (void *) syscall_exit_probe);
+		TRACEPOINT_PROBE_UNREGISTER("sys_enter",
+					    (void *) syscall_enter_probe);
+
+		pr_err("can't create the sched_process_exit tracepoint\n");
+
+		return ret;
+	}
 
 #ifdef CAPTURE_CONTEXT_SWITCHES
-		ret = TRACEPOINT_PROBE_REGISTER("sched_switch", (void *) sched_switch_probe);
-		if (ret) {
-			TRACEPOINT_PROBE_UNREGISTER("sys_exit",
-						    (void *) syscall_exit_probe);
-			TRACEPOINT_PROBE_UNREGISTER("sys_enter",
-						    (void *) syscall_enter_probe);
-			TRACEPOINT_PROBE_UNREGISTER("sched_process_exit",
-						    (void *) syscall_procexit_probe);
+	ret = TRACEPOINT_PROBE_REGISTER("sched_switch", (void *) sched_switch_probe);
+	if (ret) {
+		TRACEPOINT_PROBE_UNREGISTER("sys_exit",
+					    (void *) syscall_exit_probe);
+		TRACEPOINT_PROBE_UNREGISTER("sys_enter",
+					    (void *) syscall_enter_probe);
+		TRACEPOINT_PROBE_UNREGISTER("sched_process_exit",
+					    (void *) syscall_procexit_probe);
 
-			pr_err("can't create the sched_switch tracepoint\n");
+		pr_err("can't create the sched_switch tracepoint\n");
 
-			return ret;
-		}
-#endif
+		return ret;
+	}
+
+	/*
+	 * The new threads are woken up by sched_wakeup_new, the others by
+	 * sched_wakeup. Both have the same arguments.
+	 */
+	ret = TRACEPOINT_PROBE_REGISTER("sched_wakeup", (void *) sched_wakeup_probe);
+	if (ret) {
+		TRACEPOINT_PROBE_UNREGISTER("sys_exit",
+					    (void *) syscall_exit_probe);
+		TRACEPOINT_PROBE_UNREGISTER("sys_enter",
+					    (void *) syscall_enter_probe);
+		TRACEPOINT_PROBE_UNREGISTER("sched_process_exit",
+					    (void *) syscall_procexit_probe);
+		TRACEPOINT_PROBE_UNREGISTER("sched_switch",
+					    (void *) sched_switch_probe);
+
+		pr_err("can't create the sched_wakeup tracepoint\n");
+
+		return ret;
+	}
+
+	ret = TRACEPOINT_PROBE_REGISTER("sched_wakeup_new", (void *) sched_wakeup_probe);
+	if (ret) {
+		TRACEPOINT_PROBE_UNREGISTER("sys_exit",
+					    (void *) syscall_exit_probe);
+		TRACEPOINT_PROBE_UNREGISTER("sys_enter",
+					    (void *) syscall_enter_probe);
+		TRACEPOINT_PROBE_UNREGISTER("sched_process_exit",
+					    (void *) syscall_procexit_probe);
+		TRACEPOINT_PROBE_UNREGISTER("sched_switch",
+					    (void *) sched_switch_probe);
+		TRACEPOINT_PROBE_UNREGISTER("sched_wakeup",
+					    (void *) sched_wakeup_probe);
+
+		pr_err("can't create the sched_wakeup_new tracepoint\n");
+
+		return ret;
 	}
 
+#ifdef CAPTURE_PAGE_FAULT_ADDRESSES
+	/*
+	 * The page fault summaries only need this one for the addresses, so
+	 * they can do without it
+	 */
+	g_page_fault_registered = !TRACEPOINT_PROBE_REGISTER("page_fault_user", (void *) page_fault_probe);
+	if (!g_page_fault_registered)
+		pr_info("can't create the page_fault_user tracepoint, the page fault addresses won't be sampled\n");
+#endif
+#endif
+
 	return 0;
 }
 
+static void unregister_tracepoints(void)
+{
+	TRACEPOINT_PROBE_UNREGISTER("sys_exit",
+				    (void *) syscall_exit_probe);
+
+	TRACEPOINT_PROBE_UNREGISTER("sys_enter",
+				    (void *) syscall_enter_probe);
+
+	TRACEPOINT_PROBE_UNREGISTER("sched_process_exit",
+				    (void *) syscall_procexit_probe);
+#ifdef CAPTURE_CONTEXT_SWITCHES
+	TRACEPOINT_PROBE_UNREGISTER("sched_switch",
+				    (void *) sched_switch_probe);
+	TRACEPOINT_PROBE_UNREGISTER("sched_wakeup",
+				    (void *) sched_wakeup_probe);
+	TRACEPOINT_PROBE_UNREGISTER("sched_wakeup_new",
+				    (void *) sched_wakeup_probe);
+#ifdef CAPTURE_PAGE_FAULT_ADDRESSES
+	if (g_page_fault_registered) {
+		TRACEPOINT_PROBE_UNREGISTER("page_fault_user",
+					    (void *) page_fault_probe);
+		g_page_fault_registered = 0;
+	}
+#endif
+#endif
+}
+
+/*
+ * user I/O functions
+ */
+static int ppm_open(struct inode *inode, struct file *filp)
+{
+	int ret = 0;
+	struct ppm_consumer *consumer;
+	struct ppm_ring_buffer_context *ring;
+	int ring_no = iminor(filp->f_dentry->d_inode);
+
+	mutex_lock(&g_open_mutex);
+
+	consumer = get_consumer(&ret);
+	if (consumer == NULL)
+		goto ppm_open_out;
+
+	ring = get_consumer_ring(consumer, ring_no);
+
+	if (atomic_read(&ring->state) != CS_STOPPED) {
+		pr_info("invalid operation: attempting to open device %d multiple times\n", ring_no);
+		ret = -EBUSY;
+		goto ppm_open_out;
+	}
+
+	/*
+	 * The first consumer that opens all the devices starts the collection
+	 */
+	if (consumer->open_count + 1 == g_ppm_numdevs && !g_tracepoints_registered) {
+		pr_info("starting capture\n");
+
+		ret = register_tracepoints();
+		if (ret)
+			goto ppm_open_out;
+
+		g_tracepoints_registered = 1;
+	}
+
+	filp->private_data = consumer;
+
+	ring->info->head = 0;
+	ring->info->tail = 0;
+	ring->cached_tail = 0;
+	ring->nevents = 0;
+	ring->pending_ts = 0;
+	ring->info->stats.n_evts = 0;
+	ring->info->stats.n_drops_buffer = 0;
+	ring->info->stats.n_drops_pf = 0;
+	ring->info->stats.n_preemptions = 0;
+	ring->info->stats.n_context_switches = 0;
+	ring->info->stats.n_copy_bytes = 0;
+	getnstimeofday(&ring->last_print_time);
+
+	/*
+	 * Make the ring reset visible before the probes start using it
+	 */
+	smp_wmb();
+	atomic_set(&ring->state, CS_STARTED);
+
+	consumer->open_count++;
+	atomic_inc(&g_open_count);
+
+ppm_open_out:
+	/*
+	 * Don't leave an empty consumer behind if its first open failed
+	 */
+	if (consumer != NULL && consumer->open_count == 0)
+		destroy_consumer(consumer);
+
+	mutex_unlock(&g_open_mutex);
+	return ret;
+}
+
 static int ppm_release(struct inode *inode, struct file *filp)
 {
+	struct ppm_consumer *consumer = filp->private_data;
 	struct ppm_ring_buffer_context *ring;
 	int ring_no = iminor(filp->f_dentry->d_inode);
 
-	ring = per_cpu(g_ring_buffers, ring_no);
+	mutex_lock(&g_open_mutex);
+
+	ring = get_consumer_ring(consumer, ring_no);
 
 	if (atomic_xchg(&ring->state, CS_STOPPED) == CS_STOPPED) {
 		pr_info("attempting to close unopened device %d\n", ring_no);
+		mutex_unlock(&g_open_mutex);
 		return -EBUSY;
 	}
 
-	pr_info("closing ring %d, evt:%llu, dr_buf:%llu, dr_pf:%llu, pr:%llu, cs:%llu\n",
+	pr_info("closing ring %d for consumer %d, evt:%llu, dr_buf:%llu, dr_pf:%llu, pr:%llu, cs:%llu\n",
 	       ring_no,
-	       ring->info->n_evts,
-	       ring->info->n_drops_buffer,
-	       ring->info->n_drops_pf,
-	       ring->info->n_preemptions,
-	       ring->info->n_context_switches);
+	       consumer_id(consumer),
+	       ring->info->stats.n_evts,
+	       ring->info->stats.n_drops_buffer,
+	       ring->info->stats.n_drops_pf,
+	       ring->info->stats.n_preemptions,
+	       ring->info->stats.n_context_switches);
 
 	/*
 	 * The last closed device stops event collection
 	 */
-	if (atomic_dec_return(&g_open_count) == 0) {
+	if (atomic_dec_return(&g_open_count) == 0 && g_tracepoints_registered) {
 		pr_info("stopping capture\n");
+		unregister_tracepoints();
+		g_tracepoints_registered = 0;
+	}
 
-		TRACEPOINT_PROBE_UNREGISTER("sys_exit",
-					    (void *) syscall_exit_probe);
+	/*
+	 * The last device closed by a consumer frees its rings. This also
+	 * waits for the probes that are still running.
+	 */
+	if (--consumer->open_count == 0)
+		destroy_consumer(consumer);
 
-		TRACEPOINT_PROBE_UNREGISTER("sys_enter",
-					    (void *) syscall_enter_probe);
+	mutex_unlock(&g_open_mutex);
+	return 0;
+}
 
-		TRACEPOINT_PROBE_UNREGISTER("sched_process_exit",
-					    (void *) syscall_procexit_probe);
-#ifdef CAPTURE_CONTEXT_SWITCHES
-		TRACEPOINT_PROBE_UNREGISTER("sched_switch",
-					    (void *) sched_switch_probe);
-#endif
+/*
+ * Allocate an auxiliary ring of the given size on every CPU of the consumer.
+ * The probes start using the ring of their CPU as soon as they see it, so
+ * each one is published only after it's fully initialized. Once allocated,
+ * the rings stay around until the main rings are freed.
+ */
+static int enable_aux_ring(struct ppm_consumer *consumer, int aux_id, u32 size)
+{
+	unsigned int cpu;
+	int ret = 0;
+
+	if (check_ring_buffer_size(size))
+		return -EINVAL;
+
+	mutex_lock(&g_open_mutex);
+
+	for_each_online_cpu(cpu) {
+		struct ppm_ring_buffer_context *ring = get_consumer_ring(consumer, cpu);
+		struct ppm_ring_buffer_context *aux;
+
+		if (ring->aux[aux_id] != NULL) {
+			if (ring->aux[aux_id]->buffer_size != size) {
+				ret = -EBUSY;
+				break;
+			}
+
+			continue;
+		}
+
+		if (alloc_ring_buffer(&aux, size, cpu) == NULL) {
+			ret = -ENOMEM;
+			break;
+		}
+
+		smp_wmb();
+		ring->aux[aux_id] = aux;
 	}
 
-	return 0;
+	mutex_unlock(&g_open_mutex);
+	return ret;
 }
 
 static long ppm_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 {
+	struct ppm_consumer *consumer = filp->private_data;
+
 	switch (cmd) {
 	case PPM_IOCTL_DISABLE_CAPTURE:
 	{
 		int ring_no = iminor(filp->f_dentry->d_inode);
-		struct ppm_ring_buffer_context *ring = per_cpu(g_ring_buffers, ring_no);
+		struct ppm_ring_buffer_context *ring = get_consumer_ring(consumer, ring_no);
 
 		atomic_set(&(ring->state), CS_INACTIVE);
 
@@ -280,7 +760,7 @@ static long ppm_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 	case PPM_IOCTL_ENABLE_CAPTURE:
 	{
 		int ring_no = iminor(filp->f_dentry->d_inode);
-		struct ppm_ring_buffer_context *ring = per_cpu(g_ring_buffers, ring_no);
+		struct ppm_ring_buffer_context *ring = get_consumer_ring(consumer, ring_no);
 
 		atomic_set(&ring->state, CS_STARTED);
 
@@ -340,235 +820,1854 @@ static long ppm_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 		pr_info("new snaplen: %d\n", g_snaplen);
 		return 0;
 	}
-	default:
-		return -ENOTTY;
-	}
-}
+	case PPM_IOCTL_SET_SNAPLEN_POLICY:
+	{
+		struct ppm_snaplen_policy new_policy;
+		u32 j;
 
-static int ppm_mmap(struct file *filp, struct vm_area_struct *vma)
-{
-	if (vma->vm_pgoff == 0) {
-		int ret;
-		long length = vma->vm_end - vma->vm_start;
-		unsigned long useraddr = vma->vm_start;
-		unsigned long pfn;
-		char *vmalloc_area_ptr;
-		char *orig_vmalloc_area_ptr;
-		int ring_no = iminor(filp->f_dentry->d_inode);
-		struct ppm_ring_buffer_context *ring;
+		if (copy_from_user(&new_policy, (void __user *)arg, sizeof(new_policy)))
+			return -EFAULT;
 
-		pr_info("mmap for CPU %d, start=%lu len=%ld page_size=%lu\n",
-		       ring_no,
-		       useraddr,
-		       length,
-		       PAGE_SIZE);
+		if (new_policy.n_rules > PPM_MAX_SNAPLEN_RULES) {
+			pr_info("invalid number of snaplen rules %u\n", new_policy.n_rules);
+			return -EINVAL;
+		}
+
+		for (j = 0; j < new_policy.n_rules; j++) {
+			struct ppm_snaplen_rule *rule = &new_policy.rules[j];
+
+			if (rule->snaplen > RW_MAX_SNAPLEN ||
+				rule->fd_type > PPM_SNAPLEN_FD_OTHER ||
+				(rule->event_type != PPM_SNAPLEN_ANY_EVENT && rule->event_type >= PPM_EVENT_MAX)) {
+				pr_info("invalid snaplen rule %u\n", j);
+				return -EINVAL;
+			}
+		}
 
 		/*
-		 * Enforce ring buffer size
+		 * Same as for the sampling policy: the fillers read the rules
+		 * without locking, so disable them while they're replaced.
 		 */
-		if (RING_BUF_SIZE < 2 * PAGE_SIZE) {
-			pr_info("Ring buffer size too small (%ld bytes, must be at least %ld bytes\n",
-			       (long)RING_BUF_SIZE,
-			       (long)PAGE_SIZE);
-			return -EIO;
+		mutex_lock(&g_open_mutex);
+		g_snaplen_policy_enabled = 0;
+		smp_wmb();
+		memcpy(&g_snaplen_policy, &new_policy, sizeof(g_snaplen_policy));
+		smp_wmb();
+		g_snaplen_policy_enabled = (new_policy.n_rules != 0);
+		mutex_unlock(&g_open_mutex);
+
+		pr_info("new snaplen policy, %u rules\n", new_policy.n_rules);
+		return 0;
+	}
+	case PPM_IOCTL_SET_EVENT_MASK:
+	{
+		struct ppm_evt_mask new_mask;
+
+		if (copy_from_user(&new_mask, (void __user *)arg, sizeof(new_mask)))
+			return -EFAULT;
+
+		mutex_lock(&g_open_mutex);
+		memcpy(&consumer->events_mask, &new_mask, sizeof(consumer->events_mask));
+		update_ignored_syscalls();
+		mutex_unlock(&g_open_mutex);
+
+		pr_info("new event mask set\n");
+		return 0;
+	}
+	case PPM_IOCTL_SET_EXCLUDED_TIDS:
+	{
+		struct ppm_tid_exclusion_list new_list;
+
+		if (copy_from_user(&new_list, (void __user *)arg, sizeof(new_list)))
+			return -EFAULT;
+
+		if (new_list.ntids > PPM_MAX_EXCLUDED_TIDS) {
+			pr_info("invalid number of excluded tids %u\n", new_list.ntids);
+			return -EINVAL;
 		}
 
-		if (RING_BUF_SIZE / PAGE_SIZE * PAGE_SIZE != RING_BUF_SIZE) {
-			pr_info("Ring buffer size is not a multiple of the page size\n");
-			return -EIO;
+		/*
+		 * The probes read the list without locking. Disable it while
+		 * the entries are replaced, so they never see a partial list.
+		 */
+		mutex_lock(&g_open_mutex);
+		consumer->excluded_tids.ntids = 0;
+		smp_wmb();
+		memcpy(consumer->excluded_tids.tids, new_list.tids, sizeof(consumer->excluded_tids.tids));
+		smp_wmb();
+		consumer->excluded_tids.ntids = new_list.ntids;
+		mutex_unlock(&g_open_mutex);
+
+		pr_info("new excluded tids list, %u entries\n", new_list.ntids);
+		return 0;
+	}
+	case PPM_IOCTL_SET_EXCLUDED_CPUS:
+	{
+		struct ppm_cpu_exclusion_mask new_mask;
+		u32 nexcluded = 0;
+		int j;
+
+		if (copy_from_user(&new_mask, (void __user *)arg, sizeof(new_mask)))
+			return -EFAULT;
+
+		for (j = 0; j < PPM_MAX_EXCLUDED_CPUS / 64; j++)
+			nexcluded += hweight64(new_mask.bits[j]);
+
+		/*
+		 * Like for the excluded tids, the probes never see a partial
+		 * bitmap
+		 */
+		mutex_lock(&g_open_mutex);
+		consumer->has_excluded_cpus = 0;
+		smp_wmb();
+		memcpy(&consumer->excluded_cpus, &new_mask, sizeof(new_mask));
+		smp_wmb();
+		consumer->has_excluded_cpus = (nexcluded != 0);
+		mutex_unlock(&g_open_mutex);
+
+		pr_info("new excluded cpus mask, %u cpus\n", nexcluded);
+		return 0;
+	}
+	case PPM_IOCTL_SET_PREDICATE:
+	{
+		struct ppm_predicate new_pred;
+		u32 j;
+
+		if (copy_from_user(&new_pred, (void __user *)arg, sizeof(new_pred)))
+			return -EFAULT;
+
+		if (new_pred.n_clauses > PPM_MAX_PREDICATE_CLAUSES) {
+			pr_info("invalid number of predicate clauses %u\n", new_pred.n_clauses);
+			return -EINVAL;
+		}
+
+		for (j = 0; j < new_pred.n_clauses; j++) {
+			struct ppm_predicate_clause *clause = &new_pred.clauses[j];
+
+			if (clause->field > PPM_PRED_FIELD_RES ||
+				clause->cmp > PPM_PRED_CMP_GE ||
+				clause->negate > 1) {
+				pr_info("invalid predicate clause %u\n", j);
+				return -EINVAL;
+			}
 		}
 
 		/*
-		 * Retrieve the ring structure for this CPU
+		 * Same as for the excluded tids: the probes read the clauses
+		 * without locking
 		 */
-		ring = per_cpu(g_ring_buffers, ring_no);
+		mutex_lock(&g_open_mutex);
+		consumer->predicate.n_clauses = 0;
+		smp_wmb();
+		memcpy(consumer->predicate.clauses, new_pred.clauses, sizeof(consumer->predicate.clauses));
+		memcpy(&consumer->predicate.res_events, &new_pred.res_events, sizeof(consumer->predicate.res_events));
+		smp_wmb();
+		consumer->predicate.n_clauses = new_pred.n_clauses;
+		mutex_unlock(&g_open_mutex);
 
-		if (length <= PAGE_SIZE) {
-			/*
-			 * When the size requested by the user is smaller than a page, we assume
-			 * she's mapping the ring info structure
-			 */
-			pr_info("mapping the ring info\n");
+		pr_info("new predicate, %u clauses\n", new_pred.n_clauses);
+		return 0;
+	}
+	case PPM_IOCTL_SET_WAKEUP_WATERMARK:
+	{
+		u32 new_watermark = (u32)arg;
 
-			vmalloc_area_ptr = (char *)ring->info;
-			orig_vmalloc_area_ptr = vmalloc_area_ptr;
+		if (new_watermark == 0) {
+			pr_info("invalid wakeup watermark %u\n", new_watermark);
+			return -EINVAL;
+		}
 
-			pfn = vmalloc_to_pfn(vmalloc_area_ptr);
+		consumer->wakeup_watermark = new_watermark;
 
-			ret = remap_pfn_range(vma, useraddr, pfn,
-					      PAGE_SIZE, PAGE_SHARED);
-			if (ret < 0) {
-				pr_info("remap_pfn_range failed (1)\n");
-				return ret;
+		pr_info("new wakeup watermark: %u\n", consumer->wakeup_watermark);
+		return 0;
+	}
+	case PPM_IOCTL_SET_TCP_TUPLE_ELISION:
+	{
+		g_tcp_tuple_elision = arg ? 1 : 0;
+
+		pr_info("tcp tuple elision %s\n", arg ? "enabled" : "disabled");
+		return 0;
+	}
+	case PPM_IOCTL_SET_BUFFER_HASH:
+	{
+		u32 new_len = (u32)arg;
+
+		if (new_len > PPM_MAX_BUFFER_HASH_LEN) {
+			pr_info("invalid buffer hash length %u\n", new_len);
+			return -EINVAL;
+		}
+
+		g_buffer_hash_len = new_len;
+
+		pr_info("new buffer hash length: %u\n", g_buffer_hash_len);
+		return 0;
+	}
+	case PPM_IOCTL_SET_MAX_DELAY:
+	{
+		consumer->max_delay_ns = (u64)(u32)arg * NSEC_PER_USEC;
+
+		pr_info("new max delay: %lluns\n", consumer->max_delay_ns);
+		return 0;
+	}
+	case PPM_IOCTL_SET_SAMPLING_POLICY:
+	{
+		struct ppm_sampling_policy new_policy;
+		int enabled = 0;
+		u32 j;
+
+		if (copy_from_user(&new_policy, (void __user *)arg, sizeof(new_policy)))
+			return -EFAULT;
+
+		if (new_policy.adaptive_threshold > 100) {
+			pr_info("invalid adaptive sampling threshold %u\n", new_policy.adaptive_threshold);
+			return -EINVAL;
+		}
+
+		for (j = 0; j < PPM_EVENT_MAX; j++)
+			if (new_policy.ratios[j] > 1)
+				enabled = 1;
+
+		/*
+		 * Same as for the excluded tids: the probes read the policy
+		 * without locking, so disable it while it's replaced.
+		 */
+		mutex_lock(&g_open_mutex);
+		g_sampling_policy_enabled = 0;
+		smp_wmb();
+		memcpy(&g_sampling_policy, &new_policy, sizeof(g_sampling_policy));
+		smp_wmb();
+		g_sampling_policy_enabled = enabled;
+		mutex_unlock(&g_open_mutex);
+
+		pr_info("new sampling policy, %s, adaptive threshold %u%%\n",
+			enabled ? "enabled" : "disabled",
+			new_policy.adaptive_threshold);
+		return 0;
+	}
+	case PPM_IOCTL_SET_DETAILED_STATS:
+	{
+		unsigned int cpu;
+
+		mutex_lock(&g_open_mutex);
+
+		if (arg == 0) {
+			consumer->detailed_stats = 0;
+			mutex_unlock(&g_open_mutex);
+			pr_info("detailed stats disabled\n");
+			return 0;
+		}
+
+		/*
+		 * (Re)start collecting from zero. Once allocated, the stats stay
+		 * around until the rings are freed, so the probes never see
+		 * them go away.
+		 */
+		consumer->detailed_stats = 0;
+		tracepoint_synchronize_unregister();
+
+		for_each_online_cpu(cpu) {
+			struct ppm_ring_buffer_context *ring = get_consumer_ring(consumer, cpu);
+
+			if (ring->stats == NULL) {
+				ring->stats = vmalloc(sizeof(struct ppm_detailed_stats));
+				if (ring->stats == NULL) {
+					mutex_unlock(&g_open_mutex);
+					pr_err("can't allocate the detailed stats\n");
+					return -ENOMEM;
+				}
 			}
 
+			memset(ring->stats, 0, sizeof(struct ppm_detailed_stats));
+		}
+
+		smp_wmb();
+		consumer->detailed_stats = 1;
+		mutex_unlock(&g_open_mutex);
+
+		pr_info("detailed stats enabled\n");
+		return 0;
+	}
+	case PPM_IOCTL_GET_DETAILED_STATS:
+	{
+		int ring_no = iminor(filp->f_dentry->d_inode);
+		struct ppm_ring_buffer_context *ring = get_consumer_ring(consumer, ring_no);
+
+		if (ring->stats == NULL)
+			return -EINVAL;
+
+		if (copy_to_user((void __user *)arg, ring->stats, sizeof(struct ppm_detailed_stats)))
+			return -EFAULT;
+
+		return 0;
+	}
+	case PPM_IOCTL_SET_SYSCALL_AGGREGATION:
+	{
+		unsigned int cpu;
+		u32 flags = (u32)arg;
+		int id = consumer_id(consumer);
+
+		if (flags & ~(PPM_AGGR_ENABLED | PPM_AGGR_PER_TGID))
+			return -EINVAL;
+
+		mutex_lock(&g_open_mutex);
+
+		/*
+		 * Stop aggregating while the tables are cleared. Like the detailed
+		 * stats, the tables stay around until the rings are freed.
+		 */
+		g_aggr_consumers &= ~(1 << id);
+		consumer->aggr_flags = 0;
+		tracepoint_synchronize_unregister();
+
+		if (!(flags & PPM_AGGR_ENABLED)) {
+			mutex_unlock(&g_open_mutex);
+			pr_info("syscall aggregation disabled\n");
 			return 0;
-		} else if (length == RING_BUF_SIZE * 2) {
-			long mlength;
+		}
 
-			/*
-			 * When the size requested by the user equals the ring buffer size, we map the full
-			 * buffer
-			 */
-			pr_info("mapping the data buffer\n");
+		if (g_aggr_inflight == NULL) {
+			g_aggr_inflight = vmalloc(PPM_AGGR_INFLIGHT_SLOTS * sizeof(struct ppm_aggr_inflight));
+			if (g_aggr_inflight == NULL) {
+				mutex_unlock(&g_open_mutex);
+				pr_err("can't allocate the syscall aggregation slots\n");
+				return -ENOMEM;
+			}
+
+			memset(g_aggr_inflight, 0, PPM_AGGR_INFLIGHT_SLOTS * sizeof(struct ppm_aggr_inflight));
+		}
 
-			vmalloc_area_ptr = (char *)ring->buffer;
-			orig_vmalloc_area_ptr = vmalloc_area_ptr;
+		for_each_online_cpu(cpu) {
+			struct ppm_ring_buffer_context *ring = get_consumer_ring(consumer, cpu);
 
-			/*
-			 * Validate that the buffer access is read only
-			 */
-			if (vma->vm_flags & (VM_WRITE | VM_EXEC)) {
-				pr_info("invalid mmap flags 0x%lx\n", vma->vm_flags);
-				return -EIO;
+			if (ring->aggr == NULL) {
+				ring->aggr = vmalloc(PAGE_ALIGN(sizeof(struct ppm_syscall_aggr_table)));
+				if (ring->aggr == NULL) {
+					mutex_unlock(&g_open_mutex);
+					pr_err("can't allocate the syscall aggregation table\n");
+					return -ENOMEM;
+				}
 			}
 
-			/*
-			 * Map each single page of the buffer
-			 */
-			mlength = length / 2;
+			memset(ring->aggr, 0, PAGE_ALIGN(sizeof(struct ppm_syscall_aggr_table)));
+		}
+
+		smp_wmb();
+		consumer->aggr_flags = flags;
+		g_aggr_consumers |= 1 << id;
+		mutex_unlock(&g_open_mutex);
+
+		pr_info("syscall aggregation enabled%s\n",
+			(flags & PPM_AGGR_PER_TGID) ? ", per process" : "");
+		return 0;
+	}
+	case PPM_IOCTL_SET_COMPACT_ENCODING:
+	{
+		unsigned int cpu;
+		int id = consumer_id(consumer);
+		int ret = 0;
+
+#ifdef PPM_ENABLE_SENTINEL
+		/*
+		 * The compact header has no room for the sentinels
+		 */
+		if (arg)
+			return -EINVAL;
+#endif
+
+		mutex_lock(&g_open_mutex);
 
-			while (mlength > 0) {
-				pfn = vmalloc_to_pfn(vmalloc_area_ptr);
+		/*
+		 * Hide the rings from the probes while the encoding changes. What
+		 * they contain is discarded, since the reader couldn't tell where
+		 * the events in the old format end.
+		 */
+		for_each_online_cpu(cpu)
+			per_cpu(g_ring_buffers, cpu)[id] = NULL;
+
+		tracepoint_synchronize_unregister();
+
+		for_each_online_cpu(cpu) {
+			struct ppm_ring_buffer_context *ring = consumer->rings[cpu];
 
-				ret = remap_pfn_range(vma, useraddr, pfn,
-						      PAGE_SIZE, PAGE_SHARED);
-				if (ret < 0) {
-					pr_info("remap_pfn_range failed (1)\n");
-					return ret;
+			if (arg && ring->compact_body == NULL) {
+				ring->compact_body = vmalloc(PPM_COMPACT_BODY_SIZE);
+				if (ring->compact_body == NULL) {
+					pr_err("can't allocate the compact encoding buffer\n");
+					ret = -ENOMEM;
+					break;
 				}
+			}
+
+			ring->info->tail = ring->info->head;
+			ring->cached_tail = ring->info->tail;
+			ring->compact_last_ts = 0;
+			ring->compact_last_tid = 0;
+		}
+
+		if (ret == 0) {
+			consumer->compact_encoding = arg ? 1 : 0;
+			if (!arg)
+				consumer->exit_only = 0;
+		}
+
+		smp_wmb();
+
+		for_each_online_cpu(cpu)
+			per_cpu(g_ring_buffers, cpu)[id] = consumer->rings[cpu];
+
+		mutex_unlock(&g_open_mutex);
+
+		if (ret == 0)
+			pr_info("compact encoding %s\n", arg ? "enabled" : "disabled");
+
+		return ret;
+	}
+	case PPM_IOCTL_SET_EXIT_ONLY:
+	{
+		mutex_lock(&g_open_mutex);
+
+		if (arg && !consumer->compact_encoding) {
+			mutex_unlock(&g_open_mutex);
+			pr_info("the exit only mode requires the compact encoding\n");
+			return -EINVAL;
+		}
 
-				useraddr += PAGE_SIZE;
-				vmalloc_area_ptr += PAGE_SIZE;
-				mlength -= PAGE_SIZE;
+		/*
+		 * Like the syscall aggregation slots, the enter slots stay
+		 * around until the module is unloaded
+		 */
+		if (arg && g_enter_slots == NULL) {
+			g_enter_slots = vmalloc(PPM_ENTER_SLOTS * sizeof(struct ppm_enter_slot));
+			if (g_enter_slots == NULL) {
+				mutex_unlock(&g_open_mutex);
+				pr_err("can't allocate the enter event slots\n");
+				return -ENOMEM;
 			}
 
-			/*
-			 * Remap a second copy of the buffer pages at the end of the buffer.
-			 * This effectively mirrors the buffer at its end and helps simplify buffer management in userland.
-			 */
-			vmalloc_area_ptr = orig_vmalloc_area_ptr;
-			mlength = length / 2;
+			memset(g_enter_slots, 0, PPM_ENTER_SLOTS * sizeof(struct ppm_enter_slot));
+		}
 
-			while (mlength > 0) {
-				pfn = vmalloc_to_pfn(vmalloc_area_ptr);
+		smp_wmb();
+		consumer->exit_only = arg ? 1 : 0;
+		mutex_unlock(&g_open_mutex);
 
-				ret = remap_pfn_range(vma, useraddr, pfn,
-						      PAGE_SIZE, PAGE_SHARED);
-				if (ret < 0) {
-					pr_info("remap_pfn_range failed (1)\n");
-					return ret;
-				}
+		pr_info("exit only mode %s\n", arg ? "enabled" : "disabled");
+		return 0;
+	}
+	case PPM_IOCTL_GET_FD_TABLE:
+	{
+		struct ppm_fd_table table;
+		struct ppm_fd_entry *entries;
+		int err;
+
+		if (copy_from_user(&table, (void __user *)arg, sizeof(table)))
+			return -EFAULT;
+
+		if (table.max_entries == 0 || table.max_entries > PPM_MAX_FD_TABLE_ENTRIES ||
+			table.start_fd < 0 || table.start_fd > INT_MAX)
+			return -EINVAL;
+
+		entries = vmalloc(table.max_entries * sizeof(struct ppm_fd_entry));
+		if (entries == NULL)
+			return -ENOMEM;
+
+		err = get_fd_table(table.tid, table.start_fd, entries, table.max_entries, &table.n_entries, &table.start_fd);
+
+		if (err == 0 &&
+			(copy_to_user((void __user *)(unsigned long)table.entries, entries, table.n_entries * sizeof(struct ppm_fd_entry)) ||
+			copy_to_user((void __user *)arg, &table, sizeof(table))))
+			err = -EFAULT;
+
+		vfree(entries);
+		return err;
+	}
+	case PPM_IOCTL_DUMP_STATE:
+	{
+		struct ppm_state_dump dump;
+		int err;
+
+#ifdef PPM_ENABLE_SENTINEL
+		/*
+		 * The state events are built without the sentinels
+		 */
+		return -EOPNOTSUPP;
+#endif
+
+		if (copy_from_user(&dump, (void __user *)arg, sizeof(dump)))
+			return -EFAULT;
+
+		if (dump.next_pid < 0 || dump.next_pid >= PID_MAX_LIMIT ||
+			dump.next_fd < -1 || dump.next_fd > INT_MAX)
+			return -EINVAL;
+
+		err = dump_state(consumer, &dump);
 
-				useraddr += PAGE_SIZE;
-				vmalloc_area_ptr += PAGE_SIZE;
-				mlength -= PAGE_SIZE;
+		if (err == 0 && copy_to_user((void __user *)arg, &dump, sizeof(dump)))
+			err = -EFAULT;
+
+		return err;
+	}
+	case PPM_IOCTL_SET_SWITCH_SUMMARY:
+	{
+		u32 interval_ms = (u32)arg;
+
+		mutex_lock(&g_open_mutex);
+
+		if (interval_ms != 0 && g_switch_summary_slots == NULL) {
+			g_switch_summary_slots = vmalloc(PPM_SWITCH_SUMMARY_SLOTS * sizeof(struct ppm_switch_summary_slot));
+			if (g_switch_summary_slots == NULL) {
+				mutex_unlock(&g_open_mutex);
+				pr_err("can't allocate the switch summary slots\n");
+				return -ENOMEM;
 			}
 
-			return 0;
-		} else {
-			pr_info("Invalid mmap size %ld\n", length);
-			return -EIO;
+			memset(g_switch_summary_slots, 0, PPM_SWITCH_SUMMARY_SLOTS * sizeof(struct ppm_switch_summary_slot));
+			smp_wmb();
+		}
+
+		g_switch_summary_ns = (u64)interval_ms * 1000000;
+		mutex_unlock(&g_open_mutex);
+
+		if (interval_ms != 0)
+			pr_info("context switch summaries every %u ms\n", interval_ms);
+		else
+			pr_info("context switch summaries disabled\n");
+
+		return 0;
+	}
+	case PPM_IOCTL_SET_RUNQ_SUMMARY:
+	{
+		u32 interval_ms = (u32)arg;
+
+		mutex_lock(&g_open_mutex);
+
+		if (interval_ms != 0 && g_runq_slots == NULL) {
+			g_runq_slots = vmalloc(PPM_RUNQ_SLOTS * sizeof(struct ppm_runq_slot));
+			if (g_runq_slots == NULL) {
+				mutex_unlock(&g_open_mutex);
+				pr_err("can't allocate the run queue slots\n");
+				return -ENOMEM;
+			}
+
+			memset(g_runq_slots, 0, PPM_RUNQ_SLOTS * sizeof(struct ppm_runq_slot));
+			smp_wmb();
+		}
+
+		g_runq_summary_ns = (u64)interval_ms * 1000000;
+		mutex_unlock(&g_open_mutex);
+
+		if (interval_ms != 0)
+			pr_info("run queue summaries every %u ms\n", interval_ms);
+		else
+			pr_info("run queue summaries disabled\n");
+
+		return 0;
+	}
+	case PPM_IOCTL_SET_PGFAULT_SUMMARY:
+	{
+		u32 interval_ms = (u32)arg;
+
+		mutex_lock(&g_open_mutex);
+
+		if (interval_ms != 0 && g_pgfault_slots == NULL) {
+			g_pgfault_slots = vmalloc(PPM_PGFAULT_SLOTS * sizeof(struct ppm_pgfault_slot));
+			if (g_pgfault_slots == NULL) {
+				mutex_unlock(&g_open_mutex);
+				pr_err("can't allocate the page fault slots\n");
+				return -ENOMEM;
+			}
+
+			memset(g_pgfault_slots, 0, PPM_PGFAULT_SLOTS * sizeof(struct ppm_pgfault_slot));
+			smp_wmb();
 		}
+
+		g_pgfault_summary_ns = (u64)interval_ms * 1000000;
+		mutex_unlock(&g_open_mutex);
+
+		if (interval_ms != 0)
+			pr_info("page fault summaries every %u ms\n", interval_ms);
+		else
+			pr_info("page fault summaries disabled\n");
+
+		return 0;
 	}
+	case PPM_IOCTL_ENABLE_PROCINFO_RING:
+	{
+		int ret;
+
+#ifdef PPM_ENABLE_SENTINEL
+		/*
+		 * The process info events are built without the sentinels
+		 */
+		if (arg)
+			return -EINVAL;
+#endif
+
+		ret = enable_aux_ring(consumer, PPM_AUX_RING_PROCINFO, (u32)arg);
+		if (ret == 0)
+			pr_info("process info ring enabled, size=%u\n", (u32)arg);
+
+		return ret;
+	}
+	case PPM_IOCTL_ENABLE_STATE_RING:
+	{
+		int ret;
+
+		ret = enable_aux_ring(consumer, PPM_AUX_RING_STATE, (u32)arg);
+		if (ret == 0)
+			pr_info("state ring enabled, size=%u\n", (u32)arg);
+
+		return ret;
+	}
+	case PPM_IOCTL_GET_RING_BUF_SIZE:
+	{
+		int ring_no = iminor(filp->f_dentry->d_inode);
+		struct ppm_ring_buffer_context *ring = get_consumer_ring(consumer, ring_no);
+
+		return ring->buffer_size;
+	}
+	case PPM_IOCTL_GET_RING_INFO_VERSION:
+		return PPM_RING_INFO_VERSION;
+	default:
+		return -ENOTTY;
+	}
+}
+
+static unsigned int ppm_poll(struct file *filp, poll_table *wait)
+{
+	u32 head;
+	u32 tail;
+	u32 usedspace;
+	struct ppm_consumer *consumer = filp->private_data;
+	struct ppm_ring_buffer_context *ring;
+	int ring_no = iminor(filp->f_dentry->d_inode);
+
+	ring = get_consumer_ring(consumer, ring_no);
+
+	poll_wait(filp, &g_ppm_devs[ring_no].read_queue, wait);
+
+	head = ring->info->head;
+	tail = ring->info->tail;
+
+	if (tail > head)
+		usedspace = ring->buffer_size + head - tail;
+	else
+		usedspace = head - tail;
+
+	if (usedspace >= min(consumer->wakeup_watermark, ring->buffer_size / 2))
+		return POLLIN | POLLRDNORM;
+
+	return 0;
+}
+
+/*
+ * Page frame of an address in the data area of a ring
+ */
+static inline unsigned long ring_data_pfn(struct ppm_ring_buffer_context *ring, char *addr)
+{
+	if (ring->contiguous)
+		return virt_to_phys(addr) >> PAGE_SHIFT;
+
+	return vmalloc_to_pfn(addr);
+}
+
+/*
+ * Map the info or the data of a ring, depending on the size of the mapping
+ */
+static int map_ring(struct vm_area_struct *vma, struct ppm_ring_buffer_context *ring, int ring_no)
+{
+	int ret;
+	long length = vma->vm_end - vma->vm_start;
+	unsigned long useraddr = vma->vm_start;
+	unsigned long pfn;
+	char *vmalloc_area_ptr;
+	char *orig_vmalloc_area_ptr;
+
+	pr_info("mmap for CPU %d, start=%lu len=%ld page_size=%lu\n",
+	       ring_no,
+	       useraddr,
+	       length,
+	       PAGE_SIZE);
+
+	/*
+	 * Enforce ring buffer size
+	 */
+	if (check_ring_buffer_size(ring->buffer_size))
+		return -EIO;
+
+	if (length <= PAGE_SIZE) {
+		/*
+		 * When the size requested by the user is smaller than a page, we assume
+		 * she's mapping the ring info structure
+		 */
+		pr_info("mapping the ring info\n");
+
+		vmalloc_area_ptr = (char *)ring->info;
+		orig_vmalloc_area_ptr = vmalloc_area_ptr;
+
+		pfn = vmalloc_to_pfn(vmalloc_area_ptr);
+
+		ret = remap_pfn_range(vma, useraddr, pfn,
+				      PAGE_SIZE, PAGE_SHARED);
+		if (ret < 0) {
+			pr_info("remap_pfn_range failed (1)\n");
+			return ret;
+		}
+
+		return 0;
+	} else if (length == (long)ring->buffer_size * 2) {
+		long mlength;
+
+		/*
+		 * When the size requested by the user equals the ring buffer size, we map the full
+		 * buffer
+		 */
+		pr_info("mapping the data buffer\n");
+
+		vmalloc_area_ptr = (char *)ring->buffer;
+		orig_vmalloc_area_ptr = vmalloc_area_ptr;
+
+		/*
+		 * Validate that the buffer access is read only
+		 */
+		if (vma->vm_flags & (VM_WRITE | VM_EXEC)) {
+			pr_info("invalid mmap flags 0x%lx\n", vma->vm_flags);
+			return -EIO;
+		}
+
+		/*
+		 * Map each single page of the buffer
+		 */
+		mlength = length / 2;
+
+		while (mlength > 0) {
+			pfn = ring_data_pfn(ring, vmalloc_area_ptr);
+
+			ret = remap_pfn_range(vma, useraddr, pfn,
+					      PAGE_SIZE, PAGE_SHARED);
+			if (ret < 0) {
+				pr_info("remap_pfn_range failed (1)\n");
+				return ret;
+			}
+
+			useraddr += PAGE_SIZE;
+			vmalloc_area_ptr += PAGE_SIZE;
+			mlength -= PAGE_SIZE;
+		}
+
+		/*
+		 * Remap a second copy of the buffer pages at the end of the buffer.
+		 * This effectively mirrors the buffer at its end and helps simplify buffer management in userland.
+		 */
+		vmalloc_area_ptr = orig_vmalloc_area_ptr;
+		mlength = length / 2;
+
+		while (mlength > 0) {
+			pfn = ring_data_pfn(ring, vmalloc_area_ptr);
+
+			ret = remap_pfn_range(vma, useraddr, pfn,
+					      PAGE_SIZE, PAGE_SHARED);
+			if (ret < 0) {
+				pr_info("remap_pfn_range failed (1)\n");
+				return ret;
+			}
+
+			useraddr += PAGE_SIZE;
+			vmalloc_area_ptr += PAGE_SIZE;
+			mlength -= PAGE_SIZE;
+		}
+
+		return 0;
+	} else {
+		pr_info("Invalid mmap size %ld\n", length);
+		return -EIO;
+	}
+}
+
+static int ppm_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	if (vma->vm_pgoff == 0) {
+		int ring_no = iminor(filp->f_dentry->d_inode);
+		struct ppm_consumer *consumer = filp->private_data;
+
+		return map_ring(vma, get_consumer_ring(consumer, ring_no), ring_no);
+	}
+
+	if (vma->vm_pgoff >= PPM_AUX_RING_MMAP_PGOFF(0) &&
+		vma->vm_pgoff < PPM_AUX_RING_MMAP_PGOFF(PPM_MAX_AUX_RINGS)) {
+		int ring_no = iminor(filp->f_dentry->d_inode);
+		struct ppm_consumer *consumer = filp->private_data;
+		struct ppm_ring_buffer_context *ring = get_consumer_ring(consumer, ring_no);
+		struct ppm_ring_buffer_context *aux = ring->aux[vma->vm_pgoff - PPM_AUX_RING_MMAP_PGOFF(0)];
+
+		if (aux == NULL) {
+			pr_info("auxiliary ring %lu not enabled\n", vma->vm_pgoff - PPM_AUX_RING_MMAP_PGOFF(0));
+			return -EINVAL;
+		}
+
+		return map_ring(vma, aux, ring_no);
+	}
+
+	if (vma->vm_pgoff == PPM_AGGR_MMAP_PGOFF) {
+		int ret;
+		long length = vma->vm_end - vma->vm_start;
+		unsigned long useraddr = vma->vm_start;
+		unsigned long pfn;
+		char *vmalloc_area_ptr;
+		int ring_no = iminor(filp->f_dentry->d_inode);
+		struct ppm_consumer *consumer = filp->private_data;
+		struct ppm_ring_buffer_context *ring = get_consumer_ring(consumer, ring_no);
+
+		/*
+		 * Map the syscall aggregation table of this CPU, read only
+		 */
+		if (ring->aggr == NULL) {
+			pr_info("syscall aggregation not enabled\n");
+			return -EINVAL;
+		}
+
+		if (length > PAGE_ALIGN(sizeof(struct ppm_syscall_aggr_table))) {
+			pr_info("Invalid mmap size %ld\n", length);
+			return -EIO;
+		}
+
+		if (vma->vm_flags & (VM_WRITE | VM_EXEC)) {
+			pr_info("invalid mmap flags 0x%lx\n", vma->vm_flags);
+			return -EIO;
+		}
+
+		vmalloc_area_ptr = (char *)ring->aggr;
+
+		while (length > 0) {
+			pfn = vmalloc_to_pfn(vmalloc_area_ptr);
+
+			ret = remap_pfn_range(vma, useraddr, pfn,
+					      PAGE_SIZE, PAGE_SHARED);
+			if (ret < 0) {
+				pr_info("remap_pfn_range failed (2)\n");
+				return ret;
+			}
+
+			useraddr += PAGE_SIZE;
+			vmalloc_area_ptr += PAGE_SIZE;
+			length -= PAGE_SIZE;
+		}
+
+		return 0;
+	}
+
+	pr_info("invalid pgoff %lu\n", vma->vm_pgoff);
+	return -EIO;
+}
+
+/* Argument list sizes for sys_socketcall */
+#define AL(x) ((x) * sizeof(unsigned long))
+static const unsigned char nas[21] = {
+	AL(0), AL(3), AL(3), AL(3), AL(2), AL(3),
+	AL(3), AL(3), AL(4), AL(4), AL(4), AL(6),
+	AL(6), AL(2), AL(5), AL(5), AL(3), AL(3),
+	AL(4), AL(5), AL(4)
+};
+#undef AL
+
+#ifndef __x86_64__
+static enum ppm_event_type parse_socketcall(struct event_filler_arguments *filler_args, struct pt_regs *regs)
+{
+	unsigned long __user args[2];
+	unsigned long __user *scargs;
+	int socketcall_id;
+
+	syscall_get_arguments(current, regs, 0, 2, args);
+	socketcall_id = args[0];
+	scargs = (unsigned long __user *)args[1];
+
+	if (unlikely(socketcall_id < SYS_SOCKET ||
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 0, 0)
+		socketcall_id > SYS_SENDMMSG))
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 33)
+		socketcall_id > SYS_RECVMMSG))
+#else
+		socketcall_id > SYS_ACCEPT4))
+#endif
+		return PPME_GENERIC_E;
+
+	if (unlikely(ppm_copy_from_user(filler_args->socketcall_args, scargs, nas[socketcall_id])))
+		return PPME_GENERIC_E;
+
+	switch (socketcall_id) {
+	case SYS_SOCKET:
+		return PPME_SOCKET_SOCKET_E;
+	case SYS_BIND:
+		return PPME_SOCKET_BIND_E;
+	case SYS_CONNECT:
+		return PPME_SOCKET_CONNECT_E;
+	case SYS_LISTEN:
+		return PPME_SOCKET_LISTEN_E;
+	case SYS_ACCEPT:
+		return PPME_SOCKET_ACCEPT_E;
+	case SYS_GETSOCKNAME:
+		return PPME_SOCKET_GETSOCKNAME_E;
+	case SYS_GETPEERNAME:
+		return PPME_SOCKET_GETPEERNAME_E;
+	case SYS_SOCKETPAIR:
+		return PPME_SOCKET_SOCKETPAIR_E;
+	case SYS_SEND:
+		return PPME_SOCKET_SEND_E;
+	case SYS_SENDTO:
+		return PPME_SOCKET_SENDTO_E;
+	case SYS_RECV:
+		return PPME_SOCKET_RECV_E;
+	case SYS_RECVFROM:
+		return PPME_SOCKET_RECVFROM_E;
+	case SYS_SHUTDOWN:
+		return PPME_SOCKET_SHUTDOWN_E;
+	case SYS_SETSOCKOPT:
+		return PPME_SOCKET_SETSOCKOPT_E;
+	case SYS_GETSOCKOPT:
+		return PPME_SOCKET_GETSOCKOPT_E;
+	case SYS_SENDMSG:
+		return PPME_SOCKET_SENDMSG_E;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 0, 0)
+	case SYS_SENDMMSG:
+		return PPME_SOCKET_SENDMMSG_E;
+#endif
+	case SYS_RECVMSG:
+		return PPME_SOCKET_RECVMSG_E;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 33)
+	case SYS_RECVMMSG:
+		return PPME_SOCKET_RECVMMSG_E;
+#endif
+	case SYS_ACCEPT4:
+		return PPME_SOCKET_ACCEPT4_E;
+	default:
+		ASSERT(false);
+		return PPME_GENERIC_E;
+	}
+}
+#endif /* __x86_64__ */
+
+static inline int is_excluded_task(struct ppm_consumer *consumer, struct task_struct *task)
+{
+	u32 j;
+	u32 ntids = ACCESS_ONCE(consumer->excluded_tids.ntids);
+
+	smp_rmb();
+
+	for (j = 0; j < ntids; j++) {
+		if (consumer->excluded_tids.tids[j] == task->pid ||
+			consumer->excluded_tids.tids[j] == task->tgid)
+			return 1;
+	}
+
+	return 0;
+}
+
+static inline int is_excluded_cpu(struct ppm_consumer *consumer, int cpu)
+{
+	if (cpu >= PPM_MAX_EXCLUDED_CPUS)
+		return 0;
+
+	smp_rmb();
+
+	return (consumer->excluded_cpus.bits[cpu / 64] >> (cpu % 64)) & 1;
+}
+
+static inline int predicate_clause_matches(const struct ppm_predicate_clause *clause, s64 val)
+{
+	int res;
+
+	switch (clause->cmp) {
+	case PPM_PRED_CMP_EQ:
+		res = (val == clause->value);
+		break;
+	case PPM_PRED_CMP_NE:
+		res = (val != clause->value);
+		break;
+	case PPM_PRED_CMP_LT:
+		res = (val < clause->value);
+		break;
+	case PPM_PRED_CMP_LE:
+		res = (val <= clause->value);
+		break;
+	case PPM_PRED_CMP_GT:
+		res = (val > clause->value);
+		break;
+	case PPM_PRED_CMP_GE:
+		res = (val >= clause->value);
+		break;
+	default:
+		ASSERT(false);
+		return 1;
+	}
+
+	return clause->negate ? !res : res;
+}
+
+/*
+ * Evaluate the predicate of the consumer. The clauses only look at the
+ * task and at the registers, so this costs a few compares per event.
+ */
+static int is_rejected_by_predicate(struct ppm_consumer *consumer,
+	enum ppm_event_type event_type,
+	struct pt_regs *regs,
+	long id)
+{
+	struct ppm_predicate *pred = &consumer->predicate;
+	u32 n_clauses = ACCESS_ONCE(pred->n_clauses);
+	s64 val;
+	u32 j;
+
+	if (g_event_info[event_type].flags & (EF_CREATES_FD | EF_DESTROYS_FD | EF_MODIFIES_STATE))
+		return 0;
+
+#ifndef __x86_64__
+	/*
+	 * The real type of a socketcall event is only known later, and it
+	 * can be one that creates an fd
+	 */
+	if (regs && id == __NR_socketcall)
+		return 0;
+#endif
+
+	smp_rmb();
+
+	for (j = 0; j < n_clauses; j++) {
+		const struct ppm_predicate_clause *clause = &pred->clauses[j];
+
+		switch (clause->field) {
+		case PPM_PRED_FIELD_TID:
+			val = current->pid;
+			break;
+		case PPM_PRED_FIELD_PID:
+			val = current->tgid;
+			break;
+		case PPM_PRED_FIELD_RES:
+			if (regs == NULL ||
+				!PPME_IS_EXIT(event_type) ||
+				!PPM_EVT_MASK_ISSET(&pred->res_events, event_type))
+				continue;
+
+			val = (s64)syscall_get_return_value(current, regs);
+			break;
+		default:
+			ASSERT(false);
+			continue;
+		}
+
+		if (!predicate_clause_matches(clause, val))
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Check if the given consumer wants the event. Drop events must always go through.
+ */
+static inline int consumer_wants_event(struct ppm_consumer *consumer,
+	enum ppm_event_type event_type,
+	struct pt_regs *regs,
+	long id)
+{
+	if (unlikely(consumer->aggr_flags & PPM_AGGR_ENABLED))
+		return 0;
+
+	if (event_type == PPME_DROP_E || event_type == PPME_DROP_X)
+		return 1;
+
+	if (!PPM_EVT_MASK_ISSET(&consumer->events_mask, event_type))
+		return 0;
+
+	if (unlikely(consumer->excluded_tids.ntids != 0) &&
+		is_excluded_task(consumer, current))
+		return 0;
+
+	if (unlikely(consumer->has_excluded_cpus) &&
+		is_excluded_cpu(consumer, smp_processor_id()))
+		return 0;
+
+	if (unlikely(consumer->predicate.n_clauses != 0) &&
+		is_rejected_by_predicate(consumer, event_type, regs, id))
+		return 0;
+
+	return 1;
+}
+
+static inline u32 ring_freespace_from(struct ppm_ring_buffer_context *ring, u32 head, u32 ttail)
+{
+	ASSERT(ttail <= ring->buffer_size);
+	ASSERT(head <= ring->buffer_size);
+
+	if (ttail > head)
+		return ttail - head - 1;
+	else
+		return ring->buffer_size + ttail - head - 1;
+}
+
+/*
+ * The free space is first computed against the last tail we read, which
+ * can only be behind the real one, so the result is never too large. The
+ * tail is read again only when that makes the ring look half full: the
+ * reader writes the tail, and reading it for every event would keep moving
+ * its cache line between the two CPUs.
+ */
+static inline u32 ring_freespace(struct ppm_ring_buffer_context *ring)
+{
+	u32 head = ring->info->head;
+	u32 freespace = ring_freespace_from(ring, head, ring->cached_tail);
+
+	if (freespace < ring->buffer_size / 2) {
+		ring->cached_tail = ring->info->tail;
+		freespace = ring_freespace_from(ring, head, ring->cached_tail);
+	}
+
+	return freespace;
+}
+
+/*
+ * Move the head of the ring past an event whose bytes are all in place
+ * (wrapped around at the end of the buffer, if needed), making it visible
+ * to the reader
+ */
+static inline void publish_event(struct ppm_ring_buffer_context *ring, u32 head, u32 event_size)
+{
+	u32 next = head + event_size;
+
+	if (unlikely(next >= ring->buffer_size))
+		next -= ring->buffer_size;
+
+	/*
+	 * Make sure all the memory has been written in real memory before
+	 * we update the head and the user space process (on another CPU)
+	 * can access the buffer.
+	 */
+	smp_wmb();
+
+	ring->info->head = next;
+
+	++ring->nevents;
+}
+
+/*
+ * Make an event that has been written at the head of the ring visible to
+ * the reader
+ */
+static inline void commit_event(struct ppm_ring_buffer_context *ring, u32 head, u32 event_size)
+{
+	u32 next = head + event_size;
+	u32 buffer_size = ring->buffer_size;
+
+	/*
+	 * If something has been written in the cushion space at the end of
+	 * the buffer, copy it to the beginning. A mirrored buffer has no
+	 * cushion: the data is already there.
+	 * Note, we don't check that the copy fits because we assume that
+	 * filler_callback failed if the space was not enough.
+	 */
+	if (unlikely(next > buffer_size) && ring->pages == NULL)
+		memcpy(ring->buffer, ring->buffer + buffer_size, next - buffer_size);
+
+	publish_event(ring, head, event_size);
+}
+
+/*
+ * Copy len bytes at offset pos from the head of the ring, which can be past
+ * the end of the buffer. The bytes past the end go to the beginning, using
+ * the size of this ring only, so nothing assumes the layout or the cushion
+ * of the ring the data comes from.
+ */
+static inline void ring_write(struct ppm_ring_buffer_context *ring, u32 pos, const void *src, u32 len)
+{
+	u32 buffer_size = ring->buffer_size;
+	u32 first;
+
+	if (pos >= buffer_size)
+		pos -= buffer_size;
+
+	if (ring->pages != NULL || pos + len <= buffer_size) {
+		memcpy(ring->buffer + pos, src, len);
+		return;
+	}
+
+	first = buffer_size - pos;
+	memcpy(ring->buffer + pos, src, first);
+	memcpy(ring->buffer, (const char *)src + first, len - first);
+}
+
+/*
+ * Compact encoding helpers. See the description of the format in
+ * ppm_events_public.h.
+ */
+static inline u32 compact_put_varint(char *p, u64 v)
+{
+	u32 n = 0;
+
+	while (v >= 0x80) {
+		p[n++] = (char)(v | 0x80);
+		v >>= 7;
+	}
+
+	p[n++] = (char)v;
+	return n;
+}
+
+static inline u32 compact_varint_size(u64 v)
+{
+	u32 n = 1;
+
+	while (v >= 0x80) {
+		v >>= 7;
+		n++;
+	}
+
+	return n;
+}
+
+static inline u64 compact_read_param(const char *p, u32 width, int is_signed)
+{
+	u64 v;
+
+	if (width == 8)
+		v = *(u64 *)p;
+	else if (width == 4)
+		v = is_signed ? (u64)(s64)*(s32 *)p : *(u32 *)p;
+	else
+		v = is_signed ? (u64)(s64)*(s16 *)p : *(u16 *)p;
+
+	/*
+	 * Zigzag, so that small negative values get short varints too
+	 */
+	if (is_signed)
+		v = (v << 1) ^ (u64)((s64)v >> 63);
+
+	return v;
+}
+
+/*
+ * Encode the lengths and the parameters of the event that the filler wrote
+ * at hdr. Returns the size of the result, or -1 if it doesn't fit in
+ * PPM_COMPACT_BODY_SIZE. This can only happen with pages larger than 4k,
+ * when parameters with 8k or more of data make the lengths grow.
+ */
+static int compact_encode_params(const struct ppm_evt_hdr *hdr, char *body)
+{
+	const struct ppm_event_info *info = &g_event_info[hdr->type];
+	const u16 *lens = (const u16 *)(hdr + 1);
+	const char *src = (const char *)(lens + info->nparams);
+	char *p = body;
+	char *end = body + PPM_COMPACT_BODY_SIZE;
+	u64 vals[PPM_MAX_EVENT_PARAMS];
+	u32 coded = 0;
+	u32 j;
+
+	for (j = 0; j < info->nparams; j++) {
+		int is_signed;
+		u32 width = ppm_compact_param_width(info->params[j].type, &is_signed);
+		u32 size = lens[j];
+
+		if (width != 0 && lens[j] == width) {
+			vals[j] = compact_read_param(src, width, is_signed);
+
+			if (compact_varint_size(vals[j]) < width) {
+				size = compact_varint_size(vals[j]);
+				coded |= 1 << j;
+			}
+		}
+
+		if (unlikely(p + 3 > end))
+			return -1;
+
+		p += compact_put_varint(p, ((u64)size << 1) | ((coded >> j) & PPM_COMPACT_PARAM_CODED));
+		src += lens[j];
+	}
+
+	src = (const char *)(lens + info->nparams);
+
+	for (j = 0; j < info->nparams; j++) {
+		/*
+		 * A coded parameter is always shorter than the original
+		 */
+		if (unlikely(p + lens[j] > end))
+			return -1;
+
+		if (coded & (1 << j)) {
+			p += compact_put_varint(p, vals[j]);
+		} else {
+			memcpy(p, src, lens[j]);
+			p += lens[j];
+		}
+
+		src += lens[j];
+	}
+
+	return p - body;
+}
+
+/*
+ * Write the compact header of an event in chdr, which must be at least
+ * PPM_COMPACT_MAX_HDR_SIZE bytes, encoding it against the previous event of
+ * the ring. Returns the size of the header.
+ */
+static inline u32 compact_encode_header(struct ppm_ring_buffer_context *ring, char *chdr,
+	u8 flags, u16 type, u64 ts, u64 tid, u32 body_size)
+{
+	u64 ts_val;
+	u32 rest;
+	u32 n = 1;
+
+	/*
+	 * The clock can go backwards when it's adjusted
+	 */
+	if (likely(ts >= ring->compact_last_ts)) {
+		ts_val = ts - ring->compact_last_ts;
+	} else {
+		ts_val = ts;
+		flags |= PPM_COMPACT_ABS_TS;
+	}
+
+	rest = compact_varint_size(type) + compact_varint_size(ts_val) + body_size;
+
+	if (tid != ring->compact_last_tid) {
+		flags |= PPM_COMPACT_TID;
+		rest += compact_varint_size(tid);
+	}
+
+	chdr[0] = flags;
+	n += compact_put_varint(chdr + n, rest);
+	n += compact_put_varint(chdr + n, type);
+	n += compact_put_varint(chdr + n, ts_val);
+
+	if (flags & PPM_COMPACT_TID)
+		n += compact_put_varint(chdr + n, tid);
+
+	return n;
+}
+
+/*
+ * Keep the compact form of the enter event that the filler wrote at hdr in
+ * the slot of the thread. Returns 0 if it doesn't fit, or if another CPU is
+ * writing the slot, in which case the event must be written as usual.
+ */
+static int stash_enter_event(const struct ppm_evt_hdr *hdr, char *body)
+{
+	struct ppm_enter_slot *slot = &g_enter_slots[hdr->tid & (PPM_ENTER_SLOTS - 1)];
+	int body_size;
+	int seq;
+
+	body_size = compact_encode_params(hdr, body);
+	if (body_size < 0 || body_size > PPM_ENTER_SLOT_BODY_SIZE)
+		return 0;
+
+	seq = atomic_read(&slot->seq);
+	if ((seq & 1) || atomic_cmpxchg(&slot->seq, seq, seq + 1) != seq)
+		return 0;
+
+	slot->tid = hdr->tid;
+	slot->type = hdr->type;
+	slot->body_size = body_size;
+	slot->ts = hdr->ts;
+	memcpy(slot->body, body, body_size);
+
+	smp_wmb();
+	atomic_set(&slot->seq, seq + 2);
+	return 1;
+}
+
+/*
+ * Take the enter event of the exit event that the filler wrote at hdr out
+ * of the slot of the thread, and write the section that goes in the compact
+ * form of the exit event in sec. Returns the size of the section, or 0 if
+ * the slot doesn't have the enter event.
+ */
+static u32 take_enter_event(const struct ppm_evt_hdr *hdr, char *sec)
+{
+	struct ppm_enter_slot *slot = &g_enter_slots[hdr->tid & (PPM_ENTER_SLOTS - 1)];
+	u32 body_size;
+	u32 n;
+	int seq;
+
+	seq = atomic_read(&slot->seq);
+	if (seq & 1)
+		return 0;
+
+	smp_rmb();
+
+	if (slot->tid != (pid_t)hdr->tid || slot->type != hdr->type - 1 || slot->ts > hdr->ts)
+		return 0;
+
+	body_size = slot->body_size;
+	if (body_size > PPM_ENTER_SLOT_BODY_SIZE)
+		return 0;
+
+	n = compact_put_varint(sec, hdr->ts - slot->ts);
+	n += compact_put_varint(sec + n, body_size);
+	memcpy(sec + n, slot->body, body_size);
+
+	/*
+	 * Free the slot, so that the enter event is used only once. If the
+	 * sequence changed, what we copied can be a mix of two events.
+	 */
+	if (atomic_cmpxchg(&slot->seq, seq, seq + 1) != seq)
+		return 0;
+
+	slot->tid = 0;
+	smp_wmb();
+	atomic_set(&slot->seq, seq + 2);
+
+	return n + body_size;
+}
+
+/*
+ * Deliver the event that the filler wrote at hdr to the rings in compact
+ * form. The parameters are encoded once, while the header depends on the
+ * previous event of each ring. hdr can be in one of these rings, it's
+ * overwritten only after we're done reading it.
+ * The rings in with_enter also get the enter section in sec.
+ */
+static inline void record_compact_event(struct ppm_ring_buffer_context **rings,
+	u32 compact,
+	const struct ppm_evt_hdr *hdr,
+	u32 with_enter,
+	const char *sec,
+	u32 sec_size,
+	u32 *delivered)
+{
+	int j;
+	u16 type = hdr->type;
+	u64 ts = hdr->ts;
+	u64 tid = hdr->tid;
+	char *body = rings[ffs(compact) - 1]->compact_body;
+	int body_size = compact_encode_params(hdr, body);
+
+	for (j = 0; j < PPM_MAX_CONSUMERS; j++) {
+		struct ppm_ring_buffer_context *cring = rings[j];
+		char chdr[PPM_COMPACT_MAX_HDR_SIZE];
+		u32 hdr_size;
+		u32 chead;
+		u32 esize = 0;
+
+		if (!(compact & (1 << j)))
+			continue;
+
+		if (unlikely(body_size < 0)) {
+			cring->info->stats.n_drops_buffer++;
+			continue;
+		}
+
+		/*
+		 * The cushion only has room for one more header, so the enter
+		 * event is left out of the largest exit events
+		 */
+		if ((with_enter & (1 << j)) && body_size + sec_size <= PPM_COMPACT_BODY_SIZE)
+			esize = sec_size;
+
+		hdr_size = compact_encode_header(cring, chdr, esize ? PPM_COMPACT_ENTER : 0,
+			type, ts, tid, esize + body_size);
+		chead = cring->info->head;
+
+		if (ring_freespace(cring) >= hdr_size + esize + body_size) {
+			ring_write(cring, chead, chdr, hdr_size);
+			ring_write(cring, chead + hdr_size, sec, esize);
+			ring_write(cring, chead + hdr_size + esize, body, body_size);
+			publish_event(cring, chead, hdr_size + esize + body_size);
+			cring->compact_last_ts = ts;
+			cring->compact_last_tid = tid;
+			*delivered |= 1 << j;
+		} else {
+			cring->info->stats.n_drops_buffer++;
+		}
+	}
+}
+
+/*
+ * Return 1 if all the consumers in the mask have the given auxiliary ring
+ * on this CPU
+ */
+static inline int consumers_have_aux_ring(struct ppm_ring_buffer_context **rings, u32 consumers, int aux)
+{
+	int j;
+
+	for (j = 0; j < PPM_MAX_CONSUMERS; j++)
+		if ((consumers & (1 << j)) && rings[j]->aux[aux] == NULL)
+			return 0;
+
+	return 1;
+}
+
+/*
+ * Write the PPME_PROCINFO_E event with the args and cwd that the filler
+ * deferred. It gets the timestamp and tid of the event it belongs to, so
+ * userspace can join them. The args are truncated if the event would not
+ * fit in the overflow pages.
+ */
+static void record_procinfo(struct ppm_ring_buffer_context *aux, u64 ts, u64 tid, struct event_filler_arguments *args)
+{
+	u32 head = aux->info->head;
+	u32 args_len = args->procinfo_args_len;
+	u32 cwd_len = strlen(args->procinfo_cwd) + 1;
+	u32 max_data = 2 * PAGE_SIZE - sizeof(struct ppm_evt_hdr) - 2 * sizeof(u16);
+	u32 event_size;
+	struct ppm_evt_hdr *hdr;
+	u16 *lens;
+
+	aux->info->stats.n_evts++;
+
+	if (unlikely(args_len + cwd_len > max_data))
+		args_len = max_data - cwd_len;
+
+	event_size = sizeof(struct ppm_evt_hdr) + 2 * sizeof(u16) + args_len + cwd_len;
+
+	if (ring_freespace(aux) < event_size) {
+		aux->info->stats.n_drops_buffer++;
+		return;
+	}
+
+	hdr = (struct ppm_evt_hdr *)(aux->buffer + head);
+	hdr->ts = ts;
+	hdr->tid = tid;
+	hdr->len = event_size;
+	hdr->type = PPME_PROCINFO_E;
+
+	lens = (u16 *)(aux->buffer + head + sizeof(struct ppm_evt_hdr));
+	lens[0] = (u16)args_len;
+	lens[1] = (u16)cwd_len;
+
+	memcpy((char *)(lens + 2), args->procinfo_args, args_len);
+	memcpy((char *)(lens + 2) + args_len, args->procinfo_cwd, cwd_len);
+
+	commit_event(aux, head, event_size);
+}
+
+/*
+ * Event timestamps.
+ * The events are stamped with the monotonic clock plus the offset of the
+ * wall clock from it, which the first CPU that notices it's stale measures
+ * again every PPM_CLOCK_ANCHOR_INTERVAL_NS. This is cheaper than reading the
+ * wall clock for every event, and the timestamps of all the CPUs move
+ * together: an NTP step only changes them at the next anchor instead of
+ * reordering the events that userspace merges from the per-CPU rings.
+ */
+#define PPM_CLOCK_ANCHOR_INTERVAL_NS 1000000000ULL
+
+static inline u64 monotonic_ns(void)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 17, 0)
+	return ktime_get_mono_fast_ns();
+#else
+	return ktime_to_ns(ktime_get());
+#endif
+}
+
+static inline u64 event_timestamp(void)
+{
+	u64 now = monotonic_ns();
+	u64 anchor = atomic64_read(&g_clock_anchor_ns);
+
+	if (unlikely((s64)(now - anchor) >= (s64)PPM_CLOCK_ANCHOR_INTERVAL_NS || anchor == 0) &&
+		atomic64_cmpxchg(&g_clock_anchor_ns, anchor, now) == anchor) {
+		struct timespec wall;
+
+		getnstimeofday(&wall);
+		atomic64_set(&g_clock_offset_ns, timespec_to_ns(&wall) - now);
+	}
+
+	return now + atomic64_read(&g_clock_offset_ns);
+}
+
+/*
+ * State dump, see PPM_IOCTL_DUMP_STATE. The state of a thread, or of a
+ * chunk of its fd table, is read where the caller can sleep into a kernel
+ * buffer, which is then copied to the ring with the preemption disabled.
+ * The procstate events fit in the cushion of the ring, so the command line
+ * is truncated like in record_procinfo().
+ */
+#define PPM_STATE_FD_CHUNK 64
+#define PPM_STATE_PROC_PARAMS 11
+#define PPM_STATE_FD_PARAMS 5
+#define PPM_STATE_MAX_EVENT_SIZE (2 * PAGE_SIZE)
+#define PPM_STATE_FD_EVENT_SIZE (sizeof(struct ppm_evt_hdr) + PPM_STATE_FD_PARAMS * sizeof(u16) + \
+	sizeof(s64) + sizeof(u64) + sizeof(u32) + PPM_FD_NAME_LEN + PPM_FDSTATE_SOCK_LEN)
+
+struct ppm_state_param {
+	const void *val;
+	u32 len;
+};
+
+static u32 write_state_event(char *dest, u16 type, u64 ts, u64 tid, const struct ppm_state_param *params, u32 nparams)
+{
+	struct ppm_evt_hdr *hdr = (struct ppm_evt_hdr *)dest;
+	u16 *lens = (u16 *)(dest + sizeof(struct ppm_evt_hdr));
+	char *data = (char *)(lens + nparams);
+	u32 j;
+
+	for (j = 0; j < nparams; j++) {
+		lens[j] = (u16)params[j].len;
+		memcpy(data, params[j].val, params[j].len);
+		data += params[j].len;
+	}
+
+	hdr->ts = ts;
+	hdr->tid = tid;
+	hdr->len = data - dest;
+	hdr->type = type;
+
+	return hdr->len;
+}
+
+/*
+ * Write the PPME_PROCSTATE_E event of a thread to buf, and return its size
+ */
+static u32 state_proc_event(struct ppm_proc_state *state, char *pages, char *buf)
+{
+	struct ppm_state_param params[PPM_STATE_PROC_PARAMS];
+	u32 comm_len = strlen(state->comm) + 1;
+	u32 cwd_len = strlen(state->cwd) + 1;
+	u32 exe_len = strnlen(pages, state->args_len) + 1;
+	u32 args_len = state->args_len - exe_len;
+	u32 fixed_size = sizeof(struct ppm_evt_hdr) + PPM_STATE_PROC_PARAMS * sizeof(u16) +
+		3 * sizeof(s64) + comm_len + exe_len + cwd_len + sizeof(s64) + 3 * sizeof(u32);
+
+	if (unlikely(fixed_size + args_len > PPM_STATE_MAX_EVENT_SIZE))
+		args_len = PPM_STATE_MAX_EVENT_SIZE - fixed_size;
+
+	params[0].val = &state->tid;
+	params[0].len = sizeof(s64);
+	params[1].val = &state->pid;
+	params[1].len = sizeof(s64);
+	params[2].val = &state->ptid;
+	params[2].len = sizeof(s64);
+	params[3].val = state->comm;
+	params[3].len = comm_len;
+	params[4].val = pages;
+	params[4].len = exe_len;
+	params[5].val = pages + exe_len;
+	params[5].len = args_len;
+	params[6].val = state->cwd;
+	params[6].len = cwd_len;
+	params[7].val = &state->fdlimit;
+	params[7].len = sizeof(s64);
+	params[8].val = &state->uid;
+	params[8].len = sizeof(u32);
+	params[9].val = &state->gid;
+	params[9].len = sizeof(u32);
+	params[10].val = &state->flags;
+	params[10].len = sizeof(u32);
+
+	return write_state_event(buf, PPME_PROCSTATE_E, event_timestamp(), state->tid, params, PPM_STATE_PROC_PARAMS);
+}
+
+/*
+ * Write the PPME_FDSTATE_E event of an fd table entry to buf, and return
+ * its size
+ */
+static u32 state_fd_event(const struct ppm_fd_entry *entry, u64 ts, u64 pid, char *buf)
+{
+	struct ppm_state_param params[PPM_STATE_FD_PARAMS];
+	char sock[PPM_FDSTATE_SOCK_LEN];
+
+	params[0].val = &entry->fd;
+	params[0].len = sizeof(s64);
+	params[1].val = &entry->ino;
+	params[1].len = sizeof(u64);
+	params[2].val = &entry->mode;
+	params[2].len = sizeof(u32);
+	params[3].val = entry->name;
+	params[3].len = strnlen(entry->name, PPM_FD_NAME_LEN - 1) + 1;
+	params[4].val = sock;
+	params[4].len = 0;
+
+	if (S_ISSOCK(entry->mode)) {
+		sock[0] = entry->family;
+		sock[1] = entry->type;
+		sock[2] = entry->protocol;
+		memcpy(sock + 3, &entry->sport, sizeof(u16));
+		memcpy(sock + 5, &entry->dport, sizeof(u16));
+		memcpy(sock + 7, entry->saddr, 16);
+		memcpy(sock + 23, entry->daddr, 16);
+		params[4].len = PPM_FDSTATE_SOCK_LEN;
+	}
+
+	return write_state_event(buf, PPME_FDSTATE_E, ts, pid, params, PPM_STATE_FD_PARAMS);
+}
+
+/*
+ * Copy the events in buf to the ring of the consumer on this CPU, or to its
+ * state ring. Nothing is copied, and -ENOSPC returned, if that would leave
+ * less than a quarter of the ring to the live events.
+ */
+static int flush_state_events(struct ppm_consumer *consumer, const char *buf, u32 len)
+{
+	struct ppm_ring_buffer_context *ring;
+	u32 pos = 0;
+	int res = 0;
+
+	ring = get_cpu_var(g_ring_buffers)[consumer_id(consumer)];
+	if (ring->aux[PPM_AUX_RING_STATE] != NULL)
+		ring = ring->aux[PPM_AUX_RING_STATE];
+
+	if (unlikely(local_inc_return(&__get_cpu_var(g_preempt_count)) != 1)) {
+		res = -EBUSY;
+		goto out;
+	}
+
+	if (ring_freespace(ring) < len + ring->buffer_size / 4) {
+		res = -ENOSPC;
+		goto out;
+	}
+
+	while (pos < len) {
+		const struct ppm_evt_hdr *hdr = (const struct ppm_evt_hdr *)(buf + pos);
+		u32 head = ring->info->head;
+
+		ring_write(ring, head, hdr, hdr->len);
+		ring->info->stats.n_evts++;
+		publish_event(ring, head, hdr->len);
+		pos += hdr->len;
+	}
+
+out:
+	local_dec(&__get_cpu_var(g_preempt_count));
+	put_cpu_var(g_ring_buffers);
+	return res;
+}
+
+static inline void state_dump_next_pid(struct ppm_state_dump *dump)
+{
+	dump->next_fd = -1;
+	if (++dump->next_pid >= PID_MAX_LIMIT)
+		dump->next_pid = -1;
+}
+
+static int dump_state(struct ppm_consumer *consumer, struct ppm_state_dump *dump)
+{
+	struct ppm_proc_state state;
+	struct ppm_fd_entry *entries;
+	char *pages;
+	char *buf;
+	u32 bufsize = max_t(u32, PPM_STATE_MAX_EVENT_SIZE, PPM_STATE_FD_CHUNK * PPM_STATE_FD_EVENT_SIZE);
+	s64 fd_pid = -1;	/* Global pid of the process whose fds are being dumped */
+	int err = 0;
+
+	if (consumer->compact_encoding &&
+		get_consumer_ring(consumer, 0)->aux[PPM_AUX_RING_STATE] == NULL)
+		return -EOPNOTSUPP;
+
+	buf = vmalloc(bufsize);
+	entries = vmalloc(PPM_STATE_FD_CHUNK * sizeof(struct ppm_fd_entry));
+	pages = (char *)__get_free_pages(GFP_KERNEL, 1);
+
+	if (buf == NULL || entries == NULL || pages == NULL) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	dump->n_procs = 0;
+	dump->n_fds = 0;
+
+	while (dump->next_pid >= 0) {
+		u32 len = 0;
+
+		if (fatal_signal_pending(current)) {
+			err = -EINTR;
+			break;
+		}
 
-	pr_info("invalid pgoff %lu, must be 0\n", vma->vm_pgoff);
-	return -EIO;
-}
+		cond_resched();
 
-/* Argument list sizes for sys_socketcall */
-#define AL(x) ((x) * sizeof(unsigned long))
-static const unsigned char nas[21] = {
-	AL(0), AL(3), AL(3), AL(3), AL(2), AL(3),
-	AL(3), AL(3), AL(4), AL(4), AL(4), AL(6),
-	AL(6), AL(2), AL(5), AL(5), AL(3), AL(3),
-	AL(4), AL(5), AL(4)
-};
-#undef AL
+		if (dump->next_fd < 0) {
+			if (get_proc_state(dump->next_pid, &state, pages) != 0) {
+				state_dump_next_pid(dump);
+				continue;
+			}
 
-#ifndef __x86_64__
-static enum ppm_event_type parse_socketcall(struct event_filler_arguments *filler_args, struct pt_regs *regs)
-{
-	unsigned long __user args[2];
-	unsigned long __user *scargs;
-	int socketcall_id;
+			len = state_proc_event(&state, pages, buf);
 
-	syscall_get_arguments(current, regs, 0, 2, args);
-	socketcall_id = args[0];
-	scargs = (unsigned long __user *)args[1];
+			err = flush_state_events(consumer, buf, len);
+			if (err)
+				break;
 
-	if (unlikely(socketcall_id < SYS_SOCKET ||
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 0, 0)
-		socketcall_id > SYS_SENDMMSG))
-#elif LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 33)
-		socketcall_id > SYS_RECVMMSG))
-#else
-		socketcall_id > SYS_ACCEPT4))
-#endif
-		return PPME_GENERIC_E;
+			dump->n_procs++;
 
-	if (unlikely(ppm_copy_from_user(filler_args->socketcall_args, scargs, nas[socketcall_id])))
-		return PPME_GENERIC_E;
+			if (state.leader) {
+				dump->next_fd = 0;
+				fd_pid = state.pid;
+			}
+			else
+				state_dump_next_pid(dump);
+		} else {
+			u32 n_entries;
+			int64_t next_fd;
+			u64 ts;
+			u32 j;
+
+			err = get_fd_table(dump->next_pid, dump->next_fd, entries, PPM_STATE_FD_CHUNK, &n_entries, &next_fd);
+			if (err == -ESRCH) {
+				err = 0;
+				state_dump_next_pid(dump);
+				continue;
+			} else if (err) {
+				break;
+			}
 
-	switch (socketcall_id) {
-	case SYS_SOCKET:
-		return PPME_SOCKET_SOCKET_E;
-	case SYS_BIND:
-		return PPME_SOCKET_BIND_E;
-	case SYS_CONNECT:
-		return PPME_SOCKET_CONNECT_E;
-	case SYS_LISTEN:
-		return PPME_SOCKET_LISTEN_E;
-	case SYS_ACCEPT:
-		return PPME_SOCKET_ACCEPT_E;
-	case SYS_GETSOCKNAME:
-		return PPME_SOCKET_GETSOCKNAME_E;
-	case SYS_GETPEERNAME:
-		return PPME_SOCKET_GETPEERNAME_E;
-	case SYS_SOCKETPAIR:
-		return PPME_SOCKET_SOCKETPAIR_E;
-	case SYS_SEND:
-		return PPME_SOCKET_SEND_E;
-	case SYS_SENDTO:
-		return PPME_SOCKET_SENDTO_E;
-	case SYS_RECV:
-		return PPME_SOCKET_RECV_E;
-	case SYS_RECVFROM:
-		return PPME_SOCKET_RECVFROM_E;
-	case SYS_SHUTDOWN:
-		return PPME_SOCKET_SHUTDOWN_E;
-	case SYS_SETSOCKOPT:
-		return PPME_SOCKET_SETSOCKOPT_E;
-	case SYS_GETSOCKOPT:
-		return PPME_SOCKET_GETSOCKOPT_E;
-	case SYS_SENDMSG:
-		return PPME_SOCKET_SENDMSG_E;
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 0, 0)
-	case SYS_SENDMMSG:
-		return PPME_SOCKET_SENDMMSG_E;
-#endif
-	case SYS_RECVMSG:
-		return PPME_SOCKET_RECVMSG_E;
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 33)
-	case SYS_RECVMMSG:
-		return PPME_SOCKET_RECVMMSG_E;
-#endif
-	case SYS_ACCEPT4:
-		return PPME_SOCKET_ACCEPT4_E;
-	default:
-		ASSERT(false);
-		return PPME_GENERIC_E;
+			/*
+			 * When a previous call stopped in the middle of the fds
+			 */
+			if (fd_pid < 0) {
+				struct task_struct *task;
+
+				rcu_read_lock();
+				task = pid_task(find_vpid(dump->next_pid), PIDTYPE_PID);
+				if (task)
+					fd_pid = task->tgid;
+				rcu_read_unlock();
+
+				if (fd_pid < 0) {
+					state_dump_next_pid(dump);
+					continue;
+				}
+			}
+
+			ts = event_timestamp();
+			for (j = 0; j < n_entries; j++)
+				len += state_fd_event(&entries[j], ts, fd_pid, buf + len);
+
+			err = flush_state_events(consumer, buf, len);
+			if (err)
+				break;
+
+			dump->n_fds += n_entries;
+
+			if (next_fd < 0)
+				state_dump_next_pid(dump);
+			else
+				dump->next_fd = next_fd;
+		}
 	}
+
+	/*
+	 * A full ring only pauses the dump
+	 */
+	if (err == -ENOSPC || err == -EBUSY)
+		err = 0;
+
+out:
+	if (pages)
+		free_pages((unsigned long)pages, 1);
+	vfree(entries);
+	vfree(buf);
+	return err;
 }
-#endif /* __x86_64__ */
 
-static inline int drop_event(enum ppm_event_type event_type, int never_drop, struct timespec *ts)
+static inline int drop_event(enum ppm_event_type event_type, int never_drop, u64 ts)
 {
 	if (never_drop)
 		return 0;
 
 	if (g_dropping_mode) {
-		if (ts->tv_nsec >= g_sampling_interval) {
+		u32 nsec = do_div(ts, NSEC_PER_SEC);
+
+		if (nsec >= g_sampling_interval) {
 			if (g_is_dropping == 0) {
 				g_is_dropping = 1;
 				record_event(PPME_DROP_E, NULL, -1, 1, NULL, NULL);
@@ -586,6 +2685,101 @@ static inline int drop_event(enum ppm_event_type event_type, int never_drop, str
 	return 0;
 }
 
+/*
+ * Apply the sampling policy set with PPM_IOCTL_SET_SAMPLING_POLICY.
+ * The decision is made per thread, over time windows of about 16ms: the enter
+ * and exit events of a system call are almost always kept or dropped
+ * together, and the sampled threads change from one window to the next.
+ */
+#define SAMPLING_WINDOW_SHIFT 24
+
+static inline int sample_event(enum ppm_event_type event_type,
+	int never_drop,
+	u64 ts,
+	struct ppm_ring_buffer_context **rings,
+	u32 consumers)
+{
+	u32 ratio;
+	u32 hash;
+	int j;
+
+	if (never_drop)
+		return 0;
+
+	smp_rmb();
+
+	ratio = g_sampling_policy.ratios[event_type];
+	if (ratio <= 1)
+		return 0;
+
+	/*
+	 * In adaptive mode, sample only when all the interested rings are
+	 * filling up. A consumer that is slow on its own doesn't cause
+	 * sampling for the others.
+	 */
+	if (g_sampling_policy.adaptive_threshold != 0) {
+		for (j = 0; j < PPM_MAX_CONSUMERS; j++) {
+			if (consumers & (1 << j)) {
+				struct ppm_ring_buffer_context *ring = rings[j];
+				u32 usedspace = ring->buffer_size - ring_freespace(ring) - 1;
+
+				if ((u64)usedspace * 100 < (u64)g_sampling_policy.adaptive_threshold * ring->buffer_size)
+					return 0;
+			}
+		}
+	}
+
+	hash = ((u32)current->pid ^ ((u32)(ts >> SAMPLING_WINDOW_SHIFT) * 2654435761U)) * 2654435761U;
+
+	return (hash >> 16) % ratio != 0;
+}
+
+/*
+ * Account an event in the detailed stats of the consumers that enabled them
+ */
+static inline void update_detailed_stats(struct ppm_ring_buffer_context **rings,
+	u32 consumers,
+	u32 delivered,
+	enum ppm_event_type event_type,
+	u32 event_size,
+	int filled,
+	u64 filler_ns,
+	u64 record_ns)
+{
+	int j;
+	int bucket;
+	struct ppm_detailed_stats *stats;
+
+	for (j = 0; j < PPM_MAX_CONSUMERS; j++) {
+		if (!(consumers & (1 << j)) || !g_consumers[j].detailed_stats)
+			continue;
+
+		smp_rmb();
+		stats = rings[j]->stats;
+
+		stats->evts[event_type].record_ns += record_ns;
+
+		if (delivered & (1 << j)) {
+			stats->evts[event_type].n_evts++;
+			stats->evts[event_type].n_bytes += event_size;
+		} else {
+			stats->evts[event_type].n_drops++;
+		}
+
+		if (filled) {
+			stats->evts[event_type].filler_ns += filler_ns;
+
+			bucket = fls64(filler_ns);
+			if (bucket > 0)
+				bucket--;
+			if (bucket >= PPM_FILLER_LATENCY_BUCKETS)
+				bucket = PPM_FILLER_LATENCY_BUCKETS - 1;
+
+			stats->filler_latency[bucket]++;
+		}
+	}
+}
+
 static void record_event(enum ppm_event_type event_type,
 	struct pt_regs *regs,
 	long id,
@@ -593,72 +2787,95 @@ static void record_event(enum ppm_event_type event_type,
 	struct task_struct *sched_prev,
 	struct task_struct *sched_next)
 {
-	size_t event_size;
-	int next;
-	u32 freespace;
+	size_t event_size = 0;
+	u32 freespace = 0;
 	u32 usedspace;
 	struct event_filler_arguments args;
-	u32 ttail;
 	u32 head;
-	struct ppm_ring_buffer_context *ring;
+	struct ppm_ring_buffer_context **rings;
+	struct ppm_ring_buffer_context *dest[PPM_MAX_CONSUMERS];
+	struct ppm_ring_buffer_context *ring = NULL;
 	struct ppm_ring_buffer_info *ring_info;
+	u32 buffer_size;
+	u32 consumers = 0;
+	u32 delivered = 0;
+	int stats = 0;
+	int filled = 0;
+	u64 record_start = 0;
+	u64 filler_start = 0;
+	u64 filler_ns = 0;
+	int primary = 0;
+	int j;
 	int drop = 1;
+	int state_event;
 	int32_t cbres = PPM_SUCCESS;
-	struct timespec ts;
-
-	getnstimeofday(&ts);
-
-	if (drop_event(event_type, never_drop, &ts))
-		return;
+	u64 ts;
 
-	ring = get_cpu_var(g_ring_buffers);
-	ring_info = ring->info;
+	rings = get_cpu_var(g_ring_buffers);
 
 	/*
-	 * FROM THIS MOMENT ON, WE HAVE TO BE SUPER FAST
+	 * Find the consumers that want this event, before doing any work
 	 */
-	ring_info->n_evts++;
-	if (sched_prev != NULL) {
-		ASSERT(sched_prev != NULL);
-		ASSERT(sched_next != NULL);
-		ASSERT(regs == NULL);
-		ring_info->n_context_switches++;
+	for (j = 0; j < PPM_MAX_CONSUMERS; j++) {
+		if (rings[j] != NULL &&
+			atomic_read(&rings[j]->state) == CS_STARTED &&
+			consumer_wants_event(&g_consumers[j], event_type, regs, id))
+			consumers |= 1 << j;
 	}
 
-	/*
-	 * Preemption gate
-	 */
-	if (unlikely(atomic_inc_return(&ring->preempt_count) != 1)) {
-		atomic_dec(&ring->preempt_count);
+	if (consumers == 0) {
+		put_cpu_var(g_ring_buffers);
+		return;
+	}
+
+	ts = event_timestamp();
+
+	if (drop_event(event_type, never_drop, ts)) {
 		put_cpu_var(g_ring_buffers);
-		ring_info->n_preemptions++;
-		ASSERT(false);
 		return;
 	}
 
-	if (unlikely(atomic_read(&ring->state) == CS_INACTIVE)) {
-		atomic_dec(&ring->preempt_count);
+	if (unlikely(g_sampling_policy_enabled) &&
+		sample_event(event_type, never_drop, ts, rings, consumers)) {
 		put_cpu_var(g_ring_buffers);
 		return;
 	}
 
 	/*
-	 * Calculate the space currently available in the buffer
+	 * FROM THIS MOMENT ON, WE HAVE TO BE SUPER FAST
 	 */
-	head = ring_info->head;
-	ttail = ring_info->tail;
+	for (j = 0; j < PPM_MAX_CONSUMERS; j++) {
+		if (consumers & (1 << j)) {
+			if (g_consumers[j].detailed_stats)
+				stats = 1;
+
+			rings[j]->info->stats.n_evts++;
+			if (sched_prev != NULL) {
+				ASSERT(sched_prev != NULL);
+				ASSERT(sched_next != NULL);
+				ASSERT(regs == NULL);
+				rings[j]->info->stats.n_context_switches++;
+			}
+		}
+	}
 
-	if (ttail > head)
-		freespace = ttail - head - 1;
-	else
-		freespace = RING_BUF_SIZE + ttail - head - 1;
+	if (unlikely(stats))
+		record_start = sched_clock();
+
+	/*
+	 * Preemption gate
+	 */
+	if (unlikely(local_inc_return(&__get_cpu_var(g_preempt_count)) != 1)) {
+		local_dec(&__get_cpu_var(g_preempt_count));
 
-	usedspace = RING_BUF_SIZE - freespace - 1;
+		for (j = 0; j < PPM_MAX_CONSUMERS; j++)
+			if (consumers & (1 << j))
+				rings[j]->info->stats.n_preemptions++;
 
-	ASSERT(freespace <= RING_BUF_SIZE);
-	ASSERT(usedspace <= RING_BUF_SIZE);
-	ASSERT(ttail <= RING_BUF_SIZE);
-	ASSERT(head <= RING_BUF_SIZE);
+		put_cpu_var(g_ring_buffers);
+		ASSERT(false);
+		return;
+	}
 
 #ifndef __x86_64__
 	/*
@@ -684,6 +2901,46 @@ static void record_event(enum ppm_event_type event_type,
 
 	ASSERT(event_type < PPM_EVENT_MAX);
 
+	/*
+	 * The events that change the state go to the state ring of the
+	 * consumers that have one
+	 */
+	state_event = (g_event_info[event_type].flags & (EF_CREATES_FD | EF_DESTROYS_FD | EF_MODIFIES_STATE)) != 0;
+
+	for (j = 0; j < PPM_MAX_CONSUMERS; j++) {
+		if (consumers & (1 << j)) {
+			if (state_event && rings[j]->aux[PPM_AUX_RING_STATE] != NULL)
+				dest[j] = rings[j]->aux[PPM_AUX_RING_STATE];
+			else
+				dest[j] = rings[j];
+		}
+	}
+
+	/*
+	 * The fillers write into the destination ring with the most free space,
+	 * and the event is then copied to the other consumers
+	 */
+	for (j = 0; j < PPM_MAX_CONSUMERS; j++) {
+		if (consumers & (1 << j)) {
+			u32 fs = ring_freespace(dest[j]);
+
+			if (ring == NULL || fs > freespace) {
+				ring = dest[j];
+				freespace = fs;
+				primary = j;
+			}
+		}
+	}
+
+	ring_info = ring->info;
+	buffer_size = ring->buffer_size;
+	head = ring_info->head;
+	usedspace = buffer_size - freespace - 1;
+
+	ASSERT(freespace <= buffer_size);
+	ASSERT(usedspace <= buffer_size);
+
+
 	/*
 	 * Determine how many arguments this event has
 	 */
@@ -703,7 +2960,7 @@ static void record_event(enum ppm_event_type event_type,
 #ifdef PPM_ENABLE_SENTINEL
 		hdr->sentinel_begin = ring->nevents;
 #endif
-		hdr->ts = timespec_to_ns(&ts);
+		hdr->ts = ts;
 		hdr->tid = current->pid;
 		hdr->type = event_type;
 
@@ -723,7 +2980,15 @@ static void record_event(enum ppm_event_type event_type,
 		args.curarg = 0;
 		args.arg_data_size = args.buffer_size - args.arg_data_offset;
 		args.nevents = ring->nevents;
-		args.str_storage = ring->str_storage;
+		args.str_storage = __get_cpu_var(g_str_storage);
+		args.copy_bytes = 0;
+		args.defer_procinfo = (event_type == PPME_CLONE_X || event_type == PPME_SYSCALL_EXECVE_X) &&
+			consumers_have_aux_ring(rings, consumers, PPM_AUX_RING_PROCINFO);
+		args.procinfo_args = NULL;
+		args.procinfo_cwd = NULL;
+
+		if (unlikely(stats))
+			filler_start = sched_clock();
 
 		/*
 		 * Fire the filler callback
@@ -740,6 +3005,11 @@ static void record_event(enum ppm_event_type event_type,
 			cbres = g_ppm_events[event_type].filler_callback(&args);
 		}
 
+		if (unlikely(stats)) {
+			filler_ns = sched_clock() - filler_start;
+			filled = 1;
+		}
+
 		if (likely(cbres == PPM_SUCCESS)) {
 			/*
 			 * Validate that the filler added the right number of parameters
@@ -758,88 +3028,353 @@ static void record_event(enum ppm_event_type event_type,
 		}
 	}
 
-	if (likely(!drop)) {
-		next = head + event_size;
+	if (likely(!drop)) {
+		u32 compact = 0;
+		u32 exit_only = 0;
+		u32 stashed = 0;
+		u32 with_enter = 0;
+		u32 sec_size = 0;
+		char sec[PPM_ENTER_SECTION_SIZE];
+		int exit_state = state_event;
+
+		/*
+		 * An enter event can only wait for an exit event that goes to
+		 * the same ring
+		 */
+		if (PPME_IS_ENTER(event_type) && event_type + 1 < PPM_EVENT_MAX)
+			exit_state = (g_event_info[event_type + 1].flags & (EF_CREATES_FD | EF_DESTROYS_FD | EF_MODIFIES_STATE)) != 0;
+
+		/*
+		 * Only the main rings use the compact encoding
+		 */
+		for (j = 0; j < PPM_MAX_CONSUMERS; j++) {
+			if ((consumers & (1 << j)) && g_consumers[j].compact_encoding && dest[j] == rings[j]) {
+				compact |= 1 << j;
+				if (g_consumers[j].exit_only &&
+					(!exit_state || rings[j]->aux[PPM_AUX_RING_STATE] == NULL))
+					exit_only |= 1 << j;
+			}
+		}
+
+		/*
+		 * In exit only mode, the enter events of the system calls wait
+		 * in the slot of the thread, and the exit events take them
+		 */
+		if (unlikely(exit_only) && regs != NULL && g_enter_slots != NULL) {
+			struct ppm_evt_hdr *hdr = (struct ppm_evt_hdr *)(ring->buffer + head);
+
+			if (PPME_IS_ENTER(event_type)) {
+				if (stash_enter_event(hdr, rings[ffs(exit_only) - 1]->compact_body)) {
+					stashed = exit_only;
+					delivered |= exit_only;
+				}
+			} else {
+				sec_size = take_enter_event(hdr, sec);
+				if (sec_size != 0)
+					with_enter = exit_only;
+			}
+		}
+
+		/*
+		 * The event is contiguous in the primary ring, even if it
+		 * wrapped around, because the cushion (or the mirror) still
+		 * has a copy of it. The other rings can have a different size
+		 * and layout, so it is written to each of them by their own.
+		 * The rings in compact form are served last, because encoding
+		 * the event in the primary ring overwrites the original.
+		 */
+		if (!(compact & (1 << primary))) {
+			commit_event(ring, head, event_size);
+			delivered |= 1 << primary;
+		}
+
+		for (j = 0; j < PPM_MAX_CONSUMERS; j++) {
+			if (j != primary && (consumers & (1 << j)) && !(compact & (1 << j))) {
+				struct ppm_ring_buffer_context *cring = dest[j];
+				u32 chead = cring->info->head;
+
+				if (ring_freespace(cring) >= event_size) {
+					ring_write(cring, chead, ring->buffer + head, event_size);
+					publish_event(cring, chead, event_size);
+					delivered |= 1 << j;
+				} else {
+					cring->info->stats.n_drops_buffer++;
+				}
+			}
+		}
+
+		compact &= ~stashed;
+
+		if (compact)
+			record_compact_event(rings, compact, (struct ppm_evt_hdr *)(ring->buffer + head),
+				with_enter, sec, sec_size, &delivered);
+	} else {
+		for (j = 0; j < PPM_MAX_CONSUMERS; j++) {
+			if (!(consumers & (1 << j)))
+				continue;
+
+			if (cbres == PPM_SUCCESS) {
+				ASSERT(freespace < sizeof(struct ppm_evt_hdr) + args.arg_data_offset);
+				dest[j]->info->stats.n_drops_buffer++;
+			} else if (cbres == PPM_FAILURE_INVALID_USER_MEMORY) {
+#ifdef _DEBUG
+				pr_info("Invalid read from user for event %d\n", event_type);
+#endif
+				dest[j]->info->stats.n_drops_pf++;
+			} else if (cbres == PPM_FAILURE_BUFFER_FULL) {
+				dest[j]->info->stats.n_drops_buffer++;
+			} else {
+				ASSERT(false);
+			}
+		}
+	}
+
+	if (unlikely(delivered != 0 && args.procinfo_cwd != NULL)) {
+		for (j = 0; j < PPM_MAX_CONSUMERS; j++)
+			if (delivered & (1 << j))
+				record_procinfo(rings[j]->aux[PPM_AUX_RING_PROCINFO], ts, current->pid, &args);
+	}
+
+	if (delivered != 0 && args.copy_bytes != 0) {
+		for (j = 0; j < PPM_MAX_CONSUMERS; j++)
+			if (delivered & (1 << j))
+				dest[j]->info->stats.n_copy_bytes += args.copy_bytes;
+	}
+
+	if (unlikely(stats))
+		update_detailed_stats(rings, consumers, delivered, event_type, event_size, filled, filler_ns, sched_clock() - record_start);
+
+	/*
+	 * Wake up the readers waiting in poll() if there's enough data for
+	 * them, or if the oldest event they haven't been woken up for is older
+	 * than their max delay. This is not done for context switches, because
+	 * they are recorded with the scheduler locks held.
+	 */
+	if (sched_prev == NULL) {
+		struct ppm_device *dev = &g_ppm_devs[smp_processor_id()];
+
+		if (unlikely(waitqueue_active(&dev->read_queue))) {
+			for (j = 0; j < PPM_MAX_CONSUMERS; j++) {
+				if (consumers & (1 << j)) {
+					u32 cused = dest[j]->buffer_size - ring_freespace(dest[j]) - 1;
+					u64 max_delay_ns = g_consumers[j].max_delay_ns;
+
+					if (cused >= min(g_consumers[j].wakeup_watermark, dest[j]->buffer_size / 2) ||
+						(max_delay_ns != 0 && dest[j]->pending_ts != 0 && ts - dest[j]->pending_ts >= max_delay_ns)) {
+						dest[j]->pending_ts = 0;
+						wake_up_interruptible(&dev->read_queue);
+						break;
+					}
+
+					if (dest[j]->pending_ts == 0)
+						dest[j]->pending_ts = ts;
+				}
+			}
+		}
+	}
+
+#ifdef _DEBUG
+	{
+		struct timespec now;
+
+		getnstimeofday(&now);
+		if (now.tv_sec > ring->last_print_time.tv_sec + 1) {
+			pr_info("CPU%d, use:%d%%, ev:%llu, dr_buf:%llu, dr_pf:%llu, pr:%llu, cs:%llu\n",
+			       smp_processor_id(),
+			       (usedspace * 100) / buffer_size,
+			       ring_info->stats.n_evts,
+			       ring_info->stats.n_drops_buffer,
+			       ring_info->stats.n_drops_pf,
+			       ring_info->stats.n_preemptions,
+			       ring->info->stats.n_context_switches);
+
+			ring->last_print_time = now;
+		}
+	}
+#endif
+
+	local_dec(&__get_cpu_var(g_preempt_count));
+	put_cpu_var(g_ring_buffers);
+
+	return;
+}
+
+/*
+ * Syscall aggregation: remember when the current thread entered the system
+ * call, and account it in the tables of the aggregating consumers when it
+ * returns.
+ */
+static inline void aggr_syscall_enter(void)
+{
+	struct ppm_aggr_inflight *slot;
+
+	if (unlikely(g_aggr_inflight == NULL))
+		return;
+
+	slot = &g_aggr_inflight[current->pid & (PPM_AGGR_INFLIGHT_SLOTS - 1)];
+	slot->enter_ns = ktime_to_ns(ktime_get());
+	slot->tid = current->pid;
+}
+
+static inline struct ppm_syscall_aggr_entry *aggr_find_entry(struct ppm_syscall_aggr_table *table,
+	u32 tgid,
+	u16 ppm_sc)
+{
+	u32 hash;
+	u32 j;
+	struct ppm_syscall_aggr_entry *entry;
+
+	if (tgid == 0) {
+		entry = &table->entries[ppm_sc];
+
+		if (unlikely(!entry->used)) {
+			entry->ppm_sc = ppm_sc;
+			smp_wmb();
+			entry->used = 1;
+		}
+
+		return entry;
+	}
+
+	/*
+	 * Only the probes of this CPU write the table, so there is no race in
+	 * claiming a free entry. Userspace skips the entries until used is set.
+	 */
+	hash = (tgid * 2654435761U) ^ ppm_sc;
 
-		if (unlikely(next >= RING_BUF_SIZE)) {
-			/*
-			 * If something has been written in the cushion space at the end of
-			 * the buffer, copy it to the beginning and wrap the head around.
-			 * Note, we don't check that the copy fits because we assume that
-			 * filler_callback failed if the space was not enough.
-			 */
-			if (next > RING_BUF_SIZE) {
-				memcpy(ring->buffer,
-				ring->buffer + RING_BUF_SIZE,
-				next - RING_BUF_SIZE);
-			}
+	for (j = 0; j < PPM_AGGR_MAX_PROBES; j++) {
+		entry = &table->entries[(hash + j) & (PPM_AGGR_TABLE_SIZE - 1)];
 
-			next -= RING_BUF_SIZE;
+		if (entry->used) {
+			if (entry->tgid == tgid && entry->ppm_sc == ppm_sc)
+				return entry;
+			continue;
 		}
 
-		/*
-		 * Make sure all the memory has been written in real memory before
-		 * we update the head and the user space process (on another CPU)
-		 * can access the buffer.
-		 */
+		entry->tgid = tgid;
+		entry->ppm_sc = ppm_sc;
 		smp_wmb();
+		entry->used = 1;
+		return entry;
+	}
 
-		ring_info->head = next;
+	return NULL;
+}
 
-		++ring->nevents;
-	} else {
-		if (cbres == PPM_SUCCESS) {
-			ASSERT(freespace < sizeof(struct ppm_evt_hdr) + args.arg_data_offset);
-			ring_info->n_drops_buffer++;
-		} else if (cbres == PPM_FAILURE_INVALID_USER_MEMORY) {
-#ifdef _DEBUG
-			pr_info("Invalid read from user for event %d\n", event_type);
-#endif
-			ring_info->n_drops_pf++;
-		} else if (cbres == PPM_FAILURE_BUFFER_FULL) {
-			ring_info->n_drops_buffer++;
-		} else {
-			ASSERT(false);
-		}
+static void aggr_syscall_exit(struct pt_regs *regs, long id)
+{
+	struct ppm_ring_buffer_context **rings;
+	struct ppm_syscall_aggr_table *table;
+	struct ppm_syscall_aggr_entry *entry;
+	struct ppm_aggr_inflight *slot;
+	u64 latency = 0;
+	int has_latency = 0;
+	int bucket = 0;
+	long retval;
+	u16 ppm_sc;
+	int j;
+
+	if (unlikely(g_aggr_inflight == NULL))
+		return;
+
+	slot = &g_aggr_inflight[current->pid & (PPM_AGGR_INFLIGHT_SLOTS - 1)];
+	if (slot->tid == current->pid) {
+		latency = ktime_to_ns(ktime_get()) - slot->enter_ns;
+		slot->tid = 0;
+		has_latency = 1;
+
+		bucket = fls64(latency);
+		if (bucket > 0)
+			bucket--;
+		if (bucket >= PPM_AGGR_LATENCY_BUCKETS)
+			bucket = PPM_AGGR_LATENCY_BUCKETS - 1;
 	}
 
-#ifdef _DEBUG
-	if (ts.tv_sec > ring->last_print_time.tv_sec + 1) {
-		pr_info("CPU%d, use:%d%%, ev:%llu, dr_buf:%llu, dr_pf:%llu, pr:%llu, cs:%llu\n",
-		       smp_processor_id(),
-		       (usedspace * 100) / RING_BUF_SIZE,
-		       ring_info->n_evts,
-		       ring_info->n_drops_buffer,
-		       ring_info->n_drops_pf,
-		       ring_info->n_preemptions,
-		       ring->info->n_context_switches);
-
-		ring->last_print_time = ts;
+	ppm_sc = g_syscall_code_routing_table[id];
+	retval = (long)syscall_get_return_value(current, regs);
+
+	rings = get_cpu_var(g_ring_buffers);
+
+	for (j = 0; j < PPM_MAX_CONSUMERS; j++) {
+		struct ppm_consumer *consumer = &g_consumers[j];
+
+		if (!(g_aggr_consumers & (1 << j)) ||
+			rings[j] == NULL ||
+			atomic_read(&rings[j]->state) != CS_STARTED ||
+			!(consumer->aggr_flags & PPM_AGGR_ENABLED))
+			continue;
+
+		if (unlikely(consumer->excluded_tids.ntids != 0) &&
+			is_excluded_task(consumer, current))
+			continue;
+
+		if (unlikely(consumer->has_excluded_cpus) &&
+			is_excluded_cpu(consumer, smp_processor_id()))
+			continue;
+
+		smp_rmb();
+		table = rings[j]->aggr;
+
+		entry = aggr_find_entry(table,
+			(consumer->aggr_flags & PPM_AGGR_PER_TGID) ? current->tgid : 0,
+			ppm_sc);
+		if (entry == NULL) {
+			table->n_overflows++;
+			continue;
+		}
+
+		entry->n_calls++;
+		if (retval < 0)
+			entry->n_errors++;
+
+		if (has_latency) {
+			entry->total_ns += latency;
+			entry->latency[bucket]++;
+		}
 	}
-#endif
 
-	atomic_dec(&ring->preempt_count);
 	put_cpu_var(g_ring_buffers);
-
-	return;
 }
 
-TRACEPOINT_PROBE(syscall_enter_probe, struct pt_regs *regs, long id)
+/*
+ * Return the number that the tables use for the system call of the current
+ * task. 32bit processes running on a 64bit kernel (see the
+ * CONFIG_IA32_EMULATION kernel flag) are mapped to the 64bit numbers, and
+ * get -1 for the system calls that we don't decode.
+ */
+static inline long table_syscall_id(long id)
 {
 #ifdef CONFIG_X86_64
-	/*
-	 * If this is a 32bit process running on a 64bit kernel (see the CONFIG_IA32_EMULATION
-	 * kernel flag), we skip its events.
-	 * XXX Decide what to do about this.
-	 */
-	if (unlikely(test_tsk_thread_flag(current, TIF_IA32)))
-		return;
+	if (unlikely(test_tsk_thread_flag(current, TIF_IA32))) {
+#ifdef CONFIG_IA32_EMULATION
+		if (id >= 0 && id < SYSCALL_TABLE_SIZE)
+			return g_syscall_ia32_64_map[id];
+#endif
+		return -1;
+	}
 #endif
 
+	return id;
+}
+
+TRACEPOINT_PROBE(syscall_enter_probe, struct pt_regs *regs, long id)
+{
+	id = table_syscall_id(id);
+
 	if (likely(id >= 0 && id < SYSCALL_TABLE_SIZE)) {
 		int used = g_syscall_table[id].flags & UF_USED;
 		int never_drop = g_syscall_table[id].flags & UF_NEVER_DROP;
 
+		/*
+		 * Nobody wants the events of this system call, so don't even
+		 * look for the rings
+		 */
+		if (test_bit(id, g_ignored_syscalls) && likely(!g_aggr_consumers))
+			return;
+
+		if (unlikely(g_aggr_consumers))
+			aggr_syscall_enter();
+
 		if (used)
 			record_event(g_syscall_table[id].enter_event_type, regs, id, never_drop, NULL, NULL);
 		else
@@ -849,24 +3384,18 @@ TRACEPOINT_PROBE(syscall_enter_probe, struct pt_regs *regs, long id)
 
 TRACEPOINT_PROBE(syscall_exit_probe, struct pt_regs *regs, long ret)
 {
-	int id;
-
-#ifdef CONFIG_X86_64
-	/*
-     * If this is a 32bit process running on a 64bit kernel (see the CONFIG_IA32_EMULATION
-	 * kernel flag), we skip its events.
-	 * XXX Decide what to do about this.
-	 */
-	if (unlikely(test_tsk_thread_flag(current, TIF_IA32)))
-		return;
-#endif
-
-	id = syscall_get_nr(current, regs);
+	long id = table_syscall_id(syscall_get_nr(current, regs));
 
 	if (likely(id >= 0 && id < SYSCALL_TABLE_SIZE)) {
 		int used = g_syscall_table[id].flags & UF_USED;
 		int never_drop = g_syscall_table[id].flags & UF_NEVER_DROP;
 
+		if (test_bit(id, g_ignored_syscalls) && likely(!g_aggr_consumers))
+			return;
+
+		if (unlikely(g_aggr_consumers))
+			aggr_syscall_exit(regs, id);
+
 		if (used)
 			record_event(g_syscall_table[id].exit_event_type, regs, id, never_drop, NULL, NULL);
 		else
@@ -894,12 +3423,215 @@ TRACEPOINT_PROBE(syscall_procexit_probe, struct task_struct *p)
 #include <linux/udp.h>
 
 #ifdef CAPTURE_CONTEXT_SWITCHES
+/*
+ * Return 1 if the thread leaving the CPU is due for a context switch summary.
+ * The idle threads never are.
+ */
+static inline int switch_summary_due(struct task_struct *prev)
+{
+	struct ppm_switch_summary_slot *slot;
+	u64 now;
+
+	if (unlikely(g_switch_summary_slots == NULL) || prev->pid == 0)
+		return 0;
+
+	smp_rmb();
+	now = sched_clock();
+	slot = &g_switch_summary_slots[prev->pid & (PPM_SWITCH_SUMMARY_SLOTS - 1)];
+
+	if (slot->tid == prev->pid && now - slot->last_ns < g_switch_summary_ns)
+		return 0;
+
+	slot->tid = prev->pid;
+	slot->last_ns = now;
+	return 1;
+}
+
+/*
+ * Get the run queue slot of a thread, and reset it if it belonged to
+ * another thread.
+ */
+static inline struct ppm_runq_slot *runq_slot(pid_t tid, u64 now)
+{
+	struct ppm_runq_slot *slot = &g_runq_slots[tid & (PPM_RUNQ_SLOTS - 1)];
+
+	if (slot->tid != tid) {
+		slot->tid = tid;
+		slot->waits = 0;
+		slot->wait_start_ns = 0;
+		slot->delay_ns = 0;
+		slot->max_delay_ns = 0;
+		slot->last_ns = now;
+	}
+
+	return slot;
+}
+
+/*
+ * Account the wait of the thread getting the CPU, and start the one of the
+ * thread leaving it if it's still runnable, i.e. it was preempted. Return 1
+ * if the thread leaving the CPU is due for a runq event.
+ * The idle threads are never accounted.
+ */
+static inline int runq_switch(struct task_struct *prev, struct task_struct *next)
+{
+	struct ppm_runq_slot *slot;
+	long prev_state;
+	u64 now;
+
+	if (unlikely(g_runq_slots == NULL))
+		return 0;
+
+	smp_rmb();
+	now = monotonic_ns();
+
+	if (next->pid != 0) {
+		slot = &g_runq_slots[next->pid & (PPM_RUNQ_SLOTS - 1)];
+
+		if (slot->tid == next->pid && slot->wait_start_ns != 0) {
+			u64 delay = now - slot->wait_start_ns;
+
+			slot->delay_ns += delay;
+			if (delay > slot->max_delay_ns)
+				slot->max_delay_ns = delay;
+			slot->waits++;
+			slot->wait_start_ns = 0;
+		}
+	}
+
+	if (prev->pid == 0)
+		return 0;
+
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 14, 0))
+	prev_state = READ_ONCE(prev->__state);
+#else
+	prev_state = prev->state;
+#endif
+
+	slot = runq_slot(prev->pid, now);
+
+	if (prev_state == TASK_RUNNING)
+		slot->wait_start_ns = now;
+
+	if (slot->waits == 0 || now - slot->last_ns < g_runq_summary_ns)
+		return 0;
+
+	slot->last_ns = now;
+	return 1;
+}
+
+#if (LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 35))
+TRACEPOINT_PROBE(sched_wakeup_probe, struct rq *rq, struct task_struct *p, int success)
+#elif (LINUX_VERSION_CODE < KERNEL_VERSION(4, 3, 0))
+TRACEPOINT_PROBE(sched_wakeup_probe, struct task_struct *p, int success)
+#else
+TRACEPOINT_PROBE(sched_wakeup_probe, struct task_struct *p)
+#endif
+{
+	u64 now;
+
+	if (g_runq_summary_ns == 0 || unlikely(g_runq_slots == NULL) || p->pid == 0)
+		return;
+
+	smp_rmb();
+	now = monotonic_ns();
+	runq_slot(p->pid, now)->wait_start_ns = now;
+}
+
+/*
+ * Get the page fault slot of a thread, and reset it if it belonged to
+ * another thread.
+ */
+static inline struct ppm_pgfault_slot *pgfault_slot(pid_t tid)
+{
+	struct ppm_pgfault_slot *slot = &g_pgfault_slots[tid & (PPM_PGFAULT_SLOTS - 1)];
+
+	if (slot->tid != tid) {
+		slot->tid = tid;
+		slot->maj_flt = 0;
+		slot->min_flt = 0;
+		slot->addr = 0;
+		slot->last_ns = 0;
+	}
+
+	return slot;
+}
+
+/*
+ * Return 1 if the thread leaving the CPU had page faults since its last
+ * pgfault event, and it's due for a new one. The idle threads never are.
+ */
+static inline int pgfault_summary_due(struct task_struct *prev)
+{
+	struct ppm_pgfault_slot *slot;
+	u64 now;
+
+	if (unlikely(g_pgfault_slots == NULL) || prev->pid == 0)
+		return 0;
+
+	smp_rmb();
+	slot = pgfault_slot(prev->pid);
+
+	if (prev->maj_flt == slot->maj_flt && prev->min_flt == slot->min_flt)
+		return 0;
+
+	now = monotonic_ns();
+	if (slot->last_ns != 0 && now - slot->last_ns < g_pgfault_summary_ns)
+		return 0;
+
+	slot->last_ns = now;
+	return 1;
+}
+
+#ifdef CAPTURE_PAGE_FAULT_ADDRESSES
+/*
+ * Runs in the context of the thread that faulted, before the fault is
+ * handled
+ */
+TRACEPOINT_PROBE(page_fault_probe, unsigned long address, struct pt_regs *regs, unsigned long error_code)
+{
+	if (g_pgfault_summary_ns == 0 || unlikely(g_pgfault_slots == NULL))
+		return;
+
+	smp_rmb();
+	pgfault_slot(current->pid)->addr = address;
+}
+#endif
+
 #if (LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 35))
 TRACEPOINT_PROBE(sched_switch_probe, struct rq *rq, struct task_struct *prev, struct task_struct *next)
 #else
 TRACEPOINT_PROBE(sched_switch_probe, struct task_struct *prev, struct task_struct *next)
 #endif
 {
+	if (g_runq_summary_ns != 0 && runq_switch(prev, next))
+		record_event(PPME_RUNQ_E,
+			NULL,
+			-1,
+			0,
+			prev,
+			next);
+
+	if (g_pgfault_summary_ns != 0 && pgfault_summary_due(prev))
+		record_event(PPME_PGFAULT_E,
+			NULL,
+			-1,
+			0,
+			prev,
+			next);
+
+	if (g_switch_summary_ns != 0) {
+		if (switch_summary_due(prev))
+			record_event(PPME_SCHEDSWITCH_SUMMARY_E,
+				NULL,
+				-1,
+				0,
+				prev,
+				next);
+
+		return;
+	}
+
 	record_event(PPME_SCHEDSWITCH_E,
 		NULL,
 		-1,
@@ -909,87 +3641,243 @@ TRACEPOINT_PROBE(sched_switch_probe, struct task_struct *prev, struct task_struc
 }
 #endif
 
-static struct ppm_ring_buffer_context *alloc_ring_buffer(struct ppm_ring_buffer_context **ring)
+static int check_ring_buffer_size(u32 size)
+{
+	if (size < 2 * PAGE_SIZE) {
+		pr_err("Ring buffer size too small (%u bytes, must be at least %lu bytes)\n",
+		       size,
+		       2 * PAGE_SIZE);
+		return -EINVAL;
+	}
+
+	if (size > MAX_RING_BUF_SIZE) {
+		pr_err("Ring buffer size too big (%u bytes, must be at most %u bytes)\n",
+		       size,
+		       MAX_RING_BUF_SIZE);
+		return -EINVAL;
+	}
+
+	if (size / PAGE_SIZE * PAGE_SIZE != size) {
+		pr_err("Ring buffer size is not a multiple of the page size\n");
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/*
+ * Allocate the data area of a ring on the given node and reset its head and tail.
+ * Note how we allocate 2 additional pages: they are used as additional overflow space for
+ * the event data generation functions, so that they always operate on a contiguous buffer.
+ */
+static void free_mirrored_pages(struct ppm_ring_buffer_context *ring, u32 npages)
+{
+	u32 j;
+
+	for (j = 0; j < npages; j++)
+		__free_page(ring->pages[j]);
+
+	vfree(ring->pages);
+	ring->pages = NULL;
+}
+
+/*
+ * Map the pages of the buffer twice in a row in the vmalloc area, like
+ * userspace does. The events that cross the end of the buffer are then
+ * written in one go to the second copy, which is the beginning of the
+ * buffer, instead of going to the overflow pages and being copied back by
+ * commit_event().
+ */
+static char *alloc_mirrored_buffer(struct ppm_ring_buffer_context *ring, u32 size, int node)
+{
+	u32 npages = size / PAGE_SIZE;
+	struct page **map;
+	char *buffer = NULL;
+	u32 j;
+
+	ring->pages = vmalloc_node(npages * sizeof(struct page *), node);
+	if (ring->pages == NULL)
+		return NULL;
+
+	map = vmalloc(2 * npages * sizeof(struct page *));
+	if (map == NULL) {
+		vfree(ring->pages);
+		ring->pages = NULL;
+		return NULL;
+	}
+
+	for (j = 0; j < npages; j++) {
+		ring->pages[j] = alloc_pages_node(node, GFP_KERNEL | __GFP_ZERO | __GFP_NOWARN, 0);
+		if (ring->pages[j] == NULL)
+			break;
+
+		map[j] = ring->pages[j];
+		map[j + npages] = ring->pages[j];
+	}
+
+	if (j == npages)
+		buffer = vmap(map, 2 * npages, VM_MAP, PAGE_KERNEL);
+
+	vfree(map);
+
+	if (buffer == NULL)
+		free_mirrored_pages(ring, j);
+
+	return buffer;
+}
+
+static int alloc_ring_buffer_data(struct ppm_ring_buffer_context *ring, u32 size, int node)
 {
-	unsigned int j;
+	ring->buffer = NULL;
+	ring->contiguous = 0;
+	ring->pages = NULL;
 
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 0, 0)
 	/*
-	 * Allocate the ring descriptor
+	 * Physically contiguous memory is reached through the linear mapping,
+	 * which the kernel maps with large pages, so the writes of the probes
+	 * don't miss the TLB every 4KB. Rings too big for the page allocator,
+	 * or a fragmented node, get the vmalloc area as usual.
 	 */
-	*ring = vmalloc(sizeof(struct ppm_ring_buffer_context));
-	if (*ring == NULL) {
+	if (ring_buf_contiguous && get_order(size + 2 * PAGE_SIZE) < MAX_ORDER) {
+		ring->buffer = alloc_pages_exact_nid(node, size + 2 * PAGE_SIZE, GFP_KERNEL | __GFP_NOWARN);
+		if (ring->buffer != NULL)
+			ring->contiguous = 1;
+	}
+#endif
+
+	if (ring->buffer == NULL)
+		ring->buffer = alloc_mirrored_buffer(ring, size, node);
+
+	if (ring->buffer == NULL)
+		ring->buffer = vmalloc_node(size + 2 * PAGE_SIZE, node);
+
+	if (ring->buffer == NULL) {
 		pr_err("Error allocating ring memory\n");
-		return NULL;
+		ring->buffer_size = 0;
+		return -ENOMEM;
+	}
+
+	if (ring->pages == NULL)
+		memset(ring->buffer, 0, size + 2 * PAGE_SIZE);
+	ring->buffer_size = size;
+	ring->info->head = 0;
+	ring->info->tail = 0;
+	ring->cached_tail = 0;
+
+	pr_info("CPU buffer initialized, size=%u\n", size);
+
+	return 0;
+}
+
+static void free_ring_buffer_data(struct ppm_ring_buffer_context *ring)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 0, 0)
+	if (ring->contiguous)
+		free_pages_exact(ring->buffer, ring->buffer_size + 2 * PAGE_SIZE);
+	else
+#endif
+	if (ring->pages != NULL) {
+		vunmap(ring->buffer);
+		free_mirrored_pages(ring, ring->buffer_size / PAGE_SIZE);
+	} else {
+		vfree((void *)ring->buffer);
 	}
 
+	ring->buffer = NULL;
+	ring->buffer_size = 0;
+}
+
+static struct ppm_ring_buffer_context *alloc_ring_buffer(struct ppm_ring_buffer_context **ring, u32 size, int cpu)
+{
 	/*
-	 * Allocate the string storage in the ring descriptor
+	 * Everything is allocated on the node of the CPU, which is the one
+	 * that writes the events
 	 */
-	(*ring)->str_storage = (char *)__get_free_page(GFP_USER);
-	if (!(*ring)->str_storage) {
-		pr_err("Error allocating the string storage\n");
-		vfree(*ring);
-		return NULL;
-	}
+	int node = cpu_to_node(cpu);
+	struct ppm_ring_buffer_context *r;
 
 	/*
-	 * Allocate the buffer.
-	 * Note how we allocate 2 additional pages: they are used as additional overflow space for
-	 * the event data generation functions, so that they always operate on a contiguous buffer.
+	 * Allocate the ring descriptor
 	 */
-	(*ring)->buffer = vmalloc(RING_BUF_SIZE + 2 * PAGE_SIZE);
-	if ((*ring)->buffer == NULL) {
+	r = vmalloc_node(sizeof(struct ppm_ring_buffer_context), node);
+	if (r == NULL) {
 		pr_err("Error allocating ring memory\n");
-		free_page((unsigned long)(*ring)->str_storage);
-		vfree(*ring);
 		return NULL;
 	}
 
-	for (j = 0; j < RING_BUF_SIZE + 2 * PAGE_SIZE; j++)
-		(*ring)->buffer[j] = 0;
-
 	/*
 	 * Allocate the buffer info structure
 	 */
-	(*ring)->info = vmalloc(sizeof(struct ppm_ring_buffer_info));
-	if ((*ring)->info == NULL) {
+	r->info = vmalloc_node(sizeof(struct ppm_ring_buffer_info), node);
+	if (r->info == NULL) {
 		pr_err("Error allocating ring memory\n");
-		vfree((void *)(*ring)->buffer);
-		free_page((unsigned long)(*ring)->str_storage);
-		vfree(*ring);
+		vfree(r);
 		return NULL;
 	}
 
-/* for(j = 0; j < (RING_BUF_SIZE / PAGE_SIZE + 1); j += PAGE_SIZE) */
-/* { */
-/* SetPageReserved(vmalloc_to_page(ring) + j); */
-/* } */
+	/*
+	 * Allocate the buffer
+	 */
+	if (alloc_ring_buffer_data(r, size, node)) {
+		vfree(r->info);
+		vfree(r);
+		return NULL;
+	}
 
 	/*
 	 * Initialize the buffer info structure
 	 */
-	atomic_set(&(*ring)->state, CS_STOPPED);
-	(*ring)->info->head = 0;
-	(*ring)->info->tail = 0;
-	(*ring)->nevents = 0;
-	(*ring)->info->n_evts = 0;
-	(*ring)->info->n_drops_buffer = 0;
-	(*ring)->info->n_drops_pf = 0;
-	(*ring)->info->n_preemptions = 0;
-	(*ring)->info->n_context_switches = 0;
-	atomic_set(&(*ring)->preempt_count, 0);
-	getnstimeofday(&(*ring)->last_print_time);
-
-	pr_info("CPU buffer initialized, size=%d\n", RING_BUF_SIZE);
+	atomic_set(&r->state, CS_STOPPED);
+	r->nevents = 0;
+	r->stats = NULL;
+	r->aggr = NULL;
+	r->compact_body = NULL;
+	r->compact_last_ts = 0;
+	r->compact_last_tid = 0;
+	r->pending_ts = 0;
+	memset(r->aux, 0, sizeof(r->aux));
+	r->info->stats.n_evts = 0;
+	r->info->stats.n_drops_buffer = 0;
+	r->info->stats.n_drops_pf = 0;
+	r->info->stats.n_preemptions = 0;
+	r->info->stats.n_context_switches = 0;
+	r->info->stats.n_copy_bytes = 0;
+	r->info->stats.numa_node = node;
+	r->info->stats.placement = 0;
+	if (node != NUMA_NO_NODE)
+		r->info->stats.placement |= PPM_RING_NODE_LOCAL;
+	if (r->contiguous)
+		r->info->stats.placement |= PPM_RING_CONTIGUOUS;
+	getnstimeofday(&r->last_print_time);
 
-	return *ring;
+	/*
+	 * The caller can publish the ring as soon as it's stored, so that only
+	 * happens once it's complete
+	 */
+	*ring = r;
+	return r;
 }
 
 static void free_ring_buffer(struct ppm_ring_buffer_context *ring)
 {
+	int j;
+
+	for (j = 0; j < PPM_MAX_AUX_RINGS; j++)
+		if (ring->aux[j] != NULL)
+			free_ring_buffer(ring->aux[j]);
+
+	if (ring->stats != NULL)
+		vfree(ring->stats);
+
+	if (ring->aggr != NULL)
+		vfree(ring->aggr);
+
+	if (ring->compact_body != NULL)
+		vfree(ring->compact_body);
+
 	vfree(ring->info);
-	vfree((void *)ring->buffer);
-	free_page((unsigned long)ring->str_storage);
+	free_ring_buffer_data(ring);
 	vfree(ring);
 }
 
@@ -1014,6 +3902,18 @@ static void free_ring_buffer(struct ppm_ring_buffer_context *ring)
 /* return len; */
 /* } */
 
+static void free_str_storage(void)
+{
+	unsigned int cpu;
+
+	for_each_online_cpu(cpu) {
+		if (per_cpu(g_str_storage, cpu) != NULL) {
+			free_pages((unsigned long)per_cpu(g_str_storage, cpu), get_order(STR_STORAGE_SIZE));
+			per_cpu(g_str_storage, cpu) = NULL;
+		}
+	}
+}
+
 int init_module(void)
 {
 	dev_t dev;
@@ -1027,24 +3927,44 @@ int init_module(void)
 
 	pr_info("driver loading\n");
 
+	ppm_autofill_init();
+
 	/*
-	 * Initialize the ring buffers array
+	 * Initialize the ring buffers array. The rings are allocated when
+	 * each consumer opens its first device.
 	 */
 	num_cpus = 0;
 	for_each_online_cpu(cpu) {
-		per_cpu(g_ring_buffers, cpu) = NULL;
+		for (j = 0; j < PPM_MAX_CONSUMERS; j++)
+			per_cpu(g_ring_buffers, cpu)[j] = NULL;
+
+		local_set(&per_cpu(g_preempt_count, cpu), 0);
+		per_cpu(g_str_storage, cpu) = NULL;
 		++num_cpus;
 	}
 
+	/*
+	 * Preallocate the fillers scratch storage. The fillers of an event run
+	 * once on its CPU for all the consumers, so one per CPU is enough, and
+	 * it's large enough to never need an allocation while recording.
+	 */
 	for_each_online_cpu(cpu) {
-		pr_info("initializing ring buffer for CPU %u\n", cpu);
+		struct page *page = alloc_pages_node(cpu_to_node(cpu), GFP_KERNEL, get_order(STR_STORAGE_SIZE));
 
-		alloc_ring_buffer(&per_cpu(g_ring_buffers, cpu));
-		if (per_cpu(g_ring_buffers, cpu) == NULL) {
-			pr_err("can't initialize the ring buffer for CPU %u\n", cpu);
+		if (page == NULL) {
+			pr_err("can't allocate the string storage\n");
 			ret = -ENOMEM;
 			goto init_module_err;
 		}
+
+		per_cpu(g_str_storage, cpu) = page_address(page);
+	}
+
+	memset(g_consumers, 0, sizeof(g_consumers));
+
+	if (check_ring_buffer_size(ring_buf_size)) {
+		pr_err("invalid ring_buf_size %u, using the default\n", ring_buf_size);
+		ring_buf_size = DEFAULT_RING_BUF_SIZE;
 	}
 
 	/*
@@ -1109,15 +4029,12 @@ int init_module(void)
 	 * All ok. Final initalizations.
 	 */
 	atomic_set(&g_open_count, 0);
+	g_tracepoints_registered = 0;
 	g_dropping_mode = 0;
 
 	return 0;
 
 init_module_err:
-	for_each_online_cpu(cpu)
-		if (per_cpu(g_ring_buffers, cpu) != NULL)
-			free_ring_buffer(per_cpu(g_ring_buffers, cpu));
-
 	/* remove_proc_entry(PPM_DEVICE_NAME, NULL); */
 
 	for (j = 0; j < n_created_devices; ++j) {
@@ -1134,21 +4051,23 @@ init_module_err:
 	if (g_ppm_devs)
 		kfree(g_ppm_devs);
 
+	free_str_storage();
+
 	return ret;
 }
 
 void cleanup_module(void)
 {
 	int j;
-	int cpu;
 
 	pr_info("driver unloading\n");
 
 	/* remove_proc_entry(PPM_DEVICE_NAME, NULL); */
 
-	for_each_online_cpu(cpu)
-		free_ring_buffer(per_cpu(g_ring_buffers, cpu));
-
+	/*
+	 * The rings are freed when their consumers close the devices, and the
+	 * module can't be unloaded while a device is open
+	 */
 	for (j = 0; j < g_ppm_numdevs; ++j) {
 		device_destroy(g_ppm_class, g_ppm_devs[j].dev);
 		cdev_del(&g_ppm_devs[j].cdev);
@@ -1160,4 +4079,21 @@ void cleanup_module(void)
 	unregister_chrdev_region(MKDEV(g_ppm_major, 0), g_ppm_numdevs);
 
 	kfree(g_ppm_devs);
+
+	if (g_aggr_inflight != NULL)
+		vfree(g_aggr_inflight);
+
+	if (g_switch_summary_slots != NULL)
+		vfree(g_switch_summary_slots);
+
+	if (g_runq_slots != NULL)
+		vfree(g_runq_slots);
+
+	if (g_pgfault_slots != NULL)
+		vfree(g_pgfault_slots);
+
+	if (g_enter_slots != NULL)
+		vfree(g_enter_slots);
+
+	free_str_storage();
 }
@@ -33,6 +33,12 @@ along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
 #define RW_MAX_SNAPLEN (256 * 1024 * 1024)
 /* Make sure to use a power of two constant for this */
 extern u32 g_snaplen;
+extern struct ppm_snaplen_policy g_snaplen_policy;
+extern int g_snaplen_policy_enabled;
+extern int g_tcp_tuple_elision;
+extern u32 g_buffer_hash_len;
+extern struct ppm_runq_slot *g_runq_slots;
+extern struct ppm_pgfault_slot *g_pgfault_slots;
 
 /*
  * Global enums
@@ -43,22 +49,47 @@ enum ppm_capture_state {
 	CS_INACTIVE = 2,	/* Not Capturing but active, returning the packets in the buffer to the user. */
 };
 
-enum syscall_flags {
-	UF_NONE = 0,
-	UF_USED = (1 << 0),
-	UF_NEVER_DROP = (1 << 1),
-};
+/*
+ * Size of the per-CPU scratch storage used by the fillers to stage user
+ * data that can't be copied straight into the ring, e.g. iovec and pollfd
+ * arrays. It holds IOV_MAX iovecs, and never less than two pages because
+ * the deferred process info stages the args and the cwd next to each other.
+ */
+#define STR_STORAGE_SIZE (PAGE_SIZE > 8192 ? 2 * PAGE_SIZE : 16384)
 
 /*
- * Global structs
+ * Run queue waits of a thread since its last runq event, see
+ * PPM_IOCTL_SET_RUNQ_SUMMARY. Indexed by tid like the switch summary slots.
+ * The wakeup of a thread and the context switch that runs it can happen on
+ * different CPUs, so a slot is updated without a lock: a race can at worst
+ * lose a wait.
  */
-struct syscall_evt_pair {
-	int flags;
-	enum ppm_event_type enter_event_type;
-	enum ppm_event_type exit_event_type;
+#define PPM_RUNQ_SLOTS 16384 /* Must be a power of two */
+
+struct ppm_runq_slot {
+	pid_t tid;
+	u32 waits;
+	u64 wait_start_ns; /* When the thread became runnable, 0 if it's not waiting */
+	u64 delay_ns;
+	u64 max_delay_ns;
+	u64 last_ns; /* Of the last runq event of the thread */
 };
 
-#define STR_STORAGE_SIZE PAGE_SIZE
+/*
+ * Page faults of a thread reported by its last pgfault event, see
+ * PPM_IOCTL_SET_PGFAULT_SUMMARY. Indexed by tid like the run queue slots.
+ * The threads that collide on a slot report their faults since they
+ * started.
+ */
+#define PPM_PGFAULT_SLOTS 16384 /* Must be a power of two */
+
+struct ppm_pgfault_slot {
+	pid_t tid;
+	unsigned long maj_flt;
+	unsigned long min_flt;
+	unsigned long addr; /* Of the last fault, 0 if not sampled */
+	u64 last_ns; /* Of the last pgfault event of the thread */
+};
 
 /*
  * Global functions
@@ -69,9 +100,10 @@ long ppm_strncpy_from_user(char *to, const char __user *from, unsigned long n);
 /*
  * Global tables
  */
-#define SYSCALL_TABLE_SIZE 512
-
 extern const struct syscall_evt_pair g_syscall_table[];
 extern const struct ppm_event_info g_event_info[];
 extern const enum ppm_syscall_code g_syscall_code_routing_table[];
+#ifdef CONFIG_IA32_EMULATION
+extern const s16 g_syscall_ia32_64_map[];
+#endif
 extern u32 g_sampling_ratio;
@@ -27,8 +27,10 @@ along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
 #include <linux/tcp.h>
 #include <linux/udp.h>
 #include <linux/file.h>
+#include <linux/fdtable.h>
 #include <linux/futex.h>
 #include <linux/fs_struct.h>
+#include <linux/cred.h>
 #include <linux/uaccess.h>
 #include <linux/version.h>
 
@@ -177,6 +179,8 @@ inline int val_to_ring(struct event_filler_arguments *args, uint64_t val, u16 va
 				if (unlikely(len < 0)) {
 					return PPM_FAILURE_INVALID_USER_MEMORY;
 				}
+
+				args->copy_bytes += len;
 			} else {
 				char *dest = strncpy(args->buffer + args->arg_data_offset,
 								(const char *)(unsigned long)val,
@@ -221,6 +225,7 @@ inline int val_to_ring(struct event_filler_arguments *args, uint64_t val, u16 va
 					}
 
 					len = val_len;
+					args->copy_bytes += len;
 				} else {
 					memcpy(args->buffer + args->arg_data_offset,
 						(void *)(unsigned long)val, val_len);
@@ -591,6 +596,7 @@ u16 fd_to_socktuple(int fd,
 	int ulen,
 	bool use_userdata,
 	bool is_inbound,
+	bool can_elide,
 	char *targetbuf,
 	u16 targetbufsize)
 {
@@ -633,11 +639,24 @@ u16 fd_to_socktuple(int fd,
 		return 0;
 	}
 
+	family = sock->sk->sk_family;
+
+	/*
+	 * The tuple of a connected TCP socket doesn't change after the connect
+	 * or the accept, which carry it, so the sends and the receives can
+	 * leave it out. See PPM_IOCTL_SET_TCP_TUPLE_ELISION.
+	 */
+	if (can_elide && g_tcp_tuple_elision &&
+		sock->type == SOCK_STREAM &&
+		(family == AF_INET || family == AF_INET6) &&
+		sock->sk->sk_state == TCP_ESTABLISHED) {
+		sockfd_put(sock);
+		return 0;
+	}
+
 	err = sock->ops->getname(sock, (struct sockaddr *)&sock_address, &sock_address_len, 0);
 	ASSERT(err == 0);
 
-	family = sock->sk->sk_family;
-
 	/*
 	 * Extract and pack the info, based on the family
 	 */
@@ -815,6 +834,276 @@ u16 fd_to_socktuple(int fd,
 	return size;
 }
 
+/*
+ * Fill the fd table entry of a socket
+ */
+static void socket_to_fd_entry(struct socket *sock, struct ppm_fd_entry *entry)
+{
+	struct sockaddr_storage sock_address;
+	struct sockaddr_storage peer_address;
+	int sock_address_len;
+	int peer_address_len;
+	bool has_peer;
+	struct unix_sock *us;
+
+	entry->family = socket_family_to_scap(sock->sk->sk_family);
+	entry->type = sock->type;
+	entry->protocol = sock->sk->sk_protocol;
+
+	if (sock->ops->getname(sock, (struct sockaddr *)&sock_address, &sock_address_len, 0) != 0)
+		return;
+
+	switch (sock->sk->sk_family) {
+	case AF_INET:
+		has_peer = (sock->ops->getname(sock, (struct sockaddr *)&peer_address, &peer_address_len, 1) == 0);
+
+		memcpy(entry->saddr, &((struct sockaddr_in *) &sock_address)->sin_addr.s_addr, 4);
+		entry->sport = ntohs(((struct sockaddr_in *) &sock_address)->sin_port);
+
+		if (has_peer) {
+			memcpy(entry->daddr, &((struct sockaddr_in *) &peer_address)->sin_addr.s_addr, 4);
+			entry->dport = ntohs(((struct sockaddr_in *) &peer_address)->sin_port);
+		}
+
+		break;
+	case AF_INET6:
+		has_peer = (sock->ops->getname(sock, (struct sockaddr *)&peer_address, &peer_address_len, 1) == 0);
+
+		memcpy(entry->saddr, ((struct sockaddr_in6 *) &sock_address)->sin6_addr.s6_addr, 16);
+		entry->sport = ntohs(((struct sockaddr_in6 *) &sock_address)->sin6_port);
+
+		if (has_peer) {
+			memcpy(entry->daddr, ((struct sockaddr_in6 *) &peer_address)->sin6_addr.s6_addr, 16);
+			entry->dport = ntohs(((struct sockaddr_in6 *) &peer_address)->sin6_port);
+		}
+
+		break;
+	case AF_UNIX:
+		us = unix_sk(sock->sk);
+
+		*(uint64_t *)entry->saddr = (uint64_t)(unsigned long)us;
+		*(uint64_t *)entry->daddr = (uint64_t)(unsigned long)us->peer;
+
+		/*
+		 * The path the socket is bound to, like in /proc/net/unix
+		 */
+		if (sock_address_len > offsetof(struct sockaddr_un, sun_path)) {
+			int len = min_t(int, sock_address_len - offsetof(struct sockaddr_un, sun_path), PPM_FD_NAME_LEN - 1);
+
+			memcpy(entry->name, ((struct sockaddr_un *) &sock_address)->sun_path, len);
+			entry->name[len] = 0;
+
+			/*
+			 * Abstract sockets
+			 */
+			if (len != 0 && entry->name[0] == 0)
+				entry->name[0] = '@';
+		} else {
+			entry->name[0] = 0;
+		}
+
+		break;
+	default:
+		break;
+	}
+}
+
+/*
+ * Fill the fd table entry of an open file
+ */
+static void file_to_fd_entry(struct file *file, unsigned int fd, struct ppm_fd_entry *entry, char *page)
+{
+	struct inode *inode = file->f_path.dentry->d_inode;
+	char *path;
+
+	memset(entry, 0, sizeof(*entry));
+	entry->fd = fd;
+	entry->ino = inode->i_ino;
+	entry->mode = inode->i_mode;
+
+	path = d_path(&file->f_path, page, PAGE_SIZE);
+	if (!IS_ERR(path))
+		strlcpy(entry->name, path, PPM_FD_NAME_LEN);
+
+	if (S_ISSOCK(inode->i_mode) && SOCKET_I(inode)->sk)
+		socket_to_fd_entry(SOCKET_I(inode), entry);
+}
+
+/*
+ * Read the fd table of a thread, see PPM_IOCTL_GET_FD_TABLE. The files are
+ * referenced while the fd table is locked, and their entries are filled
+ * afterwards.
+ */
+int get_fd_table(pid_t tid, int64_t start_fd, struct ppm_fd_entry *entries, u32 max_entries, u32 *n_entries, int64_t *next_fd)
+{
+	struct task_struct *task;
+	struct files_struct *files;
+	struct fdtable *fdt;
+	struct file **fds;
+	char *page;
+	unsigned int fd;
+	u32 n = 0;
+	u32 j;
+
+	*next_fd = -1;
+
+	fds = kmalloc(max_entries * sizeof(struct file *), GFP_KERNEL);
+	if (fds == NULL)
+		return -ENOMEM;
+
+	page = (char *)__get_free_page(GFP_KERNEL);
+	if (page == NULL) {
+		kfree(fds);
+		return -ENOMEM;
+	}
+
+	rcu_read_lock();
+	task = pid_task(find_vpid(tid), PIDTYPE_PID);
+	if (task)
+		get_task_struct(task);
+	rcu_read_unlock();
+
+	if (task == NULL) {
+		free_page((unsigned long)page);
+		kfree(fds);
+		return -ESRCH;
+	}
+
+	task_lock(task);
+	files = task->files;
+	if (files) {
+		rcu_read_lock();
+		fdt = files_fdtable(files);
+
+		for (fd = start_fd; fd < fdt->max_fds; fd++) {
+			struct file *file = fcheck_files(files, fd);
+
+			if (file == NULL || !get_file_rcu(file))
+				continue;
+
+			if (n == max_entries) {
+				fput(file);
+				*next_fd = fd;
+				break;
+			}
+
+			fds[n] = file;
+			entries[n].fd = fd;
+			n++;
+		}
+
+		rcu_read_unlock();
+	}
+	task_unlock(task);
+	put_task_struct(task);
+
+	for (j = 0; j < n; j++) {
+		file_to_fd_entry(fds[j], (unsigned int)entries[j].fd, &entries[j], page);
+		fput(fds[j]);
+	}
+
+	free_page((unsigned long)page);
+	kfree(fds);
+
+	*n_entries = n;
+	return 0;
+}
+
+/*
+ * Read the state of a thread, see PPM_IOCTL_DUMP_STATE. pages are two
+ * pages: the command line is copied at the beginning of the first one, and
+ * the cwd is resolved in the second one. Like in the clone events, the
+ * command line is terminated even if it's empty.
+ * -ESRCH means that the thread doesn't exist.
+ */
+int get_proc_state(pid_t tid, struct ppm_proc_state *state, char *pages)
+{
+	struct task_struct *task;
+	struct mm_struct *mm;
+	const struct cred *cred;
+	struct path pwd;
+	int has_pwd = 0;
+	u32 args_len = 0;
+
+	rcu_read_lock();
+	task = pid_task(find_vpid(tid), PIDTYPE_PID);
+	if (task)
+		get_task_struct(task);
+	rcu_read_unlock();
+
+	if (task == NULL)
+		return -ESRCH;
+
+	state->tid = task->pid;
+	state->pid = task->tgid;
+	state->leader = thread_group_leader(task);
+	state->flags = state->leader ? 0 : (PPM_CL_CLONE_THREAD | PPM_CL_CLONE_FILES);
+	state->fdlimit = (s64)task_rlimit(task, RLIMIT_NOFILE);
+	get_task_comm(state->comm, task);
+
+	rcu_read_lock();
+	state->ptid = task->real_parent->tgid;
+	cred = __task_cred(task);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 5, 0)
+	state->uid = from_kuid_munged(current_user_ns(), cred->euid);
+	state->gid = from_kgid_munged(current_user_ns(), cred->egid);
+#else
+	state->uid = cred->euid;
+	state->gid = cred->egid;
+#endif
+	rcu_read_unlock();
+
+	mm = get_task_mm(task);
+	if (mm) {
+		args_len = mm->arg_end - mm->arg_start;
+		if (args_len > PAGE_SIZE)
+			args_len = PAGE_SIZE;
+
+		if (args_len != 0) {
+			int res = access_process_vm(task, mm->arg_start, pages, args_len, 0);
+
+			args_len = res > 0 ? res : 0;
+		}
+
+		mmput(mm);
+	}
+
+	if (args_len == 0)
+		args_len = 1;
+
+	pages[args_len - 1] = 0;
+	state->args_len = args_len;
+
+	task_lock(task);
+	if (task->fs) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 36)
+		get_fs_pwd(task->fs, &pwd);
+#else
+		read_lock(&task->fs->lock);
+		pwd = task->fs->pwd;
+		path_get(&pwd);
+		read_unlock(&task->fs->lock);
+#endif
+		has_pwd = 1;
+	}
+	task_unlock(task);
+	put_task_struct(task);
+
+	state->cwd = pages + PAGE_SIZE;
+	state->cwd[0] = 0;
+
+	if (has_pwd) {
+		char *path = d_path(&pwd, pages + PAGE_SIZE, PAGE_SIZE);
+
+		if (!IS_ERR(path))
+			state->cwd = path;
+
+		path_put(&pwd);
+	}
+
+	return 0;
+}
+
 int addr_to_kernel(void __user *uaddr, int ulen, struct sockaddr *kaddr)
 {
 	if (unlikely(ulen < 0 || ulen > sizeof(struct sockaddr_storage))) {
@@ -836,14 +1125,241 @@ int addr_to_kernel(void __user *uaddr, int ulen, struct sockaddr *kaddr)
  * Parses the list of buffers of a xreadv or xwritev call, and pushes the size
  * (and optionally the data) to the ring.
  */
-int32_t parse_readv_writev_bufs(struct event_filler_arguments *args, const struct iovec __user *iovsrc, unsigned long iovcnt, int64_t retval, int flags)
+/*
+ * Find the type and, for TCP and UDP sockets, the ports of an fd, for the
+ * snaplen rules.
+ */
+static void get_snaplen_fd_info(int fd, u16 *fd_type, u16 *lport, u16 *rport)
+{
+	struct file *file;
+	struct inode *inode;
+	struct socket *sock;
+	struct sockaddr_storage address;
+	int addrlen;
+
+	*fd_type = PPM_SNAPLEN_FD_OTHER;
+	*lport = 0;
+	*rport = 0;
+
+	file = fget(fd);
+	if (unlikely(file == NULL))
+		return;
+
+	inode = file->f_path.dentry->d_inode;
+
+	if (S_ISREG(inode->i_mode)) {
+		*fd_type = PPM_SNAPLEN_FD_FILE;
+	} else if (S_ISFIFO(inode->i_mode)) {
+		*fd_type = PPM_SNAPLEN_FD_PIPE;
+	} else if (S_ISCHR(inode->i_mode)) {
+		*fd_type = PPM_SNAPLEN_FD_CHARDEV;
+	} else if (S_ISSOCK(inode->i_mode)) {
+		*fd_type = PPM_SNAPLEN_FD_SOCKET;
+
+		sock = SOCKET_I(inode);
+		if (sock->sk && (sock->sk->sk_family == AF_INET || sock->sk->sk_family == AF_INET6)) {
+			/*
+			 * The port is at the same offset in sockaddr_in and
+			 * sockaddr_in6
+			 */
+			if (sock->ops->getname(sock, (struct sockaddr *)&address, &addrlen, 0) == 0)
+				*lport = ntohs(((struct sockaddr_in *)&address)->sin_port);
+
+			if (sock->ops->getname(sock, (struct sockaddr *)&address, &addrlen, 1) == 0)
+				*rport = ntohs(((struct sockaddr_in *)&address)->sin_port);
+		}
+	}
+
+	fput(file);
+}
+
+/*
+ * Return how many bytes of the I/O buffer of the current event on fd go to
+ * the ring, based on the rules set with PPM_IOCTL_SET_SNAPLEN_POLICY. The fd
+ * is looked up only if a rule needs it.
+ */
+u32 get_snaplen(struct event_filler_arguments *args, int fd)
+{
+	u32 j;
+	u16 evt_pair = args->event_type & ~1;
+	bool fd_info_loaded = false;
+	u16 fd_type = PPM_SNAPLEN_FD_OTHER;
+	u16 lport = 0;
+	u16 rport = 0;
+	struct ppm_snaplen_rule *rule;
+
+	if (likely(!g_snaplen_policy_enabled))
+		return g_snaplen;
+
+	for (j = 0; j < g_snaplen_policy.n_rules && j < PPM_MAX_SNAPLEN_RULES; j++) {
+		rule = &g_snaplen_policy.rules[j];
+
+		if (rule->event_type != PPM_SNAPLEN_ANY_EVENT &&
+			(rule->event_type & ~1) != evt_pair)
+			continue;
+
+		if (!fd_info_loaded && (rule->fd_type != PPM_SNAPLEN_FD_ANY || rule->port != 0)) {
+			get_snaplen_fd_info(fd, &fd_type, &lport, &rport);
+			fd_info_loaded = true;
+		}
+
+		if (rule->fd_type != PPM_SNAPLEN_FD_ANY && rule->fd_type != fd_type)
+			continue;
+
+		if (rule->port != 0 && rule->port != lport && rule->port != rport)
+			continue;
+
+		return rule->snaplen;
+	}
+
+	return g_snaplen;
+}
+
+/*
+ * Copy up to len bytes of the data described by an iovec array straight
+ * into the ring as the current PT_BYTEBUF parameter, spanning as many
+ * buffers as needed. If a buffer faults after some data was already copied,
+ * the parameter is truncated there instead of dropping the event.
+ */
+static int32_t iovec_to_ring(struct event_filler_arguments *args, const struct iovec *iov, unsigned long iovcnt, unsigned long len)
 {
+	u16 *psize = (u16 *)(args->buffer + args->curarg * sizeof(u16));
+	char *dest = args->buffer + args->arg_data_offset;
+	unsigned long copied = 0;
+	unsigned long chunk;
+	unsigned long notcopied;
+	unsigned long j;
+
+	if (unlikely(args->curarg >= args->nargs)) {
+		ASSERT(0);
+		return PPM_FAILURE_BUG;
+	}
+
+	if (unlikely(len >= args->arg_data_size))
+		return PPM_FAILURE_BUFFER_FULL;
+
+	for (j = 0; j < iovcnt && copied < len; j++) {
+		chunk = min_t(unsigned long, iov[j].iov_len, len - copied);
+		if (chunk == 0)
+			continue;
+
+		notcopied = ppm_copy_from_user(dest + copied, iov[j].iov_base, chunk);
+		copied += chunk - notcopied;
+
+		if (unlikely(notcopied != 0)) {
+			if (copied == 0)
+				return PPM_FAILURE_INVALID_USER_MEMORY;
+
+			break;
+		}
+	}
+
+	*psize = (u16)copied;
+	args->curarg++;
+	args->arg_data_offset += copied;
+	args->arg_data_size -= copied;
+	args->copy_bytes += copied;
+
+	return PPM_SUCCESS;
+}
+
+/*
+ * Hash up to len bytes of the data described by an iovec array and store the
+ * hash as the current PT_BYTEBUF parameter, see PPM_IOCTL_SET_BUFFER_HASH.
+ * The data is staged a block at a time in the ring, where it would have been
+ * copied, so it's read from the user buffers only once.
+ */
+#define BUFFER_HASH_BLOCK_SIZE 4096
+
+static int32_t buffer_hash_to_ring(struct event_filler_arguments *args, const struct iovec *iov, unsigned long iovcnt, unsigned long len)
+{
+	u16 *psize = (u16 *)(args->buffer + args->curarg * sizeof(u16));
+	u8 *dest = (u8 *)(args->buffer + args->arg_data_offset);
+	unsigned long blocksize = min_t(unsigned long, args->arg_data_size, BUFFER_HASH_BLOCK_SIZE) & ~7UL;
+	unsigned long staged = 0;
+	unsigned long hashed = 0;
+	unsigned long off;
+	unsigned long chunk;
+	unsigned long notcopied = 0;
+	unsigned long j;
+	uint64_t h = PPM_BUFFER_HASH_SEED;
+
+	if (unlikely(args->curarg >= args->nargs)) {
+		ASSERT(0);
+		return PPM_FAILURE_BUG;
+	}
+
+	if (unlikely(blocksize <= PPM_BUFFER_HASH_SIZE))
+		return PPM_FAILURE_BUFFER_FULL;
+
+	for (j = 0; j < iovcnt && notcopied == 0; j++) {
+		off = 0;
+
+		while (off < iov[j].iov_len && hashed + staged < len) {
+			chunk = min_t(unsigned long, iov[j].iov_len - off, len - hashed - staged);
+			chunk = min_t(unsigned long, chunk, blocksize - staged);
+
+			notcopied = ppm_copy_from_user(dest + staged,
+				(const char __user *)iov[j].iov_base + off,
+				chunk);
+			staged += chunk - notcopied;
+			off += chunk - notcopied;
+
+			if (unlikely(notcopied != 0))
+				break;
+
+			if (staged == blocksize) {
+				h = ppm_buffer_hash_update(h, dest, staged);
+				hashed += staged;
+				staged = 0;
+			}
+		}
+	}
+
+	if (unlikely(notcopied != 0 && hashed + staged == 0))
+		return PPM_FAILURE_INVALID_USER_MEMORY;
+
+	h = ppm_buffer_hash_update(h, dest, staged);
+	hashed += staged;
+	h = ppm_buffer_hash_final(h, hashed);
+	memcpy(dest, &h, PPM_BUFFER_HASH_SIZE);
+
+	*psize = PPM_BUFFER_HASH_SIZE;
+	args->curarg++;
+	args->arg_data_offset += PPM_BUFFER_HASH_SIZE;
+	args->arg_data_size -= PPM_BUFFER_HASH_SIZE;
+	args->copy_bytes += hashed;
+
+	return PPM_SUCCESS;
+}
+
+/*
+ * Store the user buffer of a read or a write as the current PT_BYTEBUF
+ * parameter: its first snaplen bytes, or their hash in the buffer hash mode.
+ */
+int32_t data_to_ring(struct event_filler_arguments *args, unsigned long val, unsigned long bufsize, u32 snaplen)
+{
+	u32 hash_len = g_buffer_hash_len;
+	struct iovec iov;
+
+	if (hash_len != 0 && val != 0 && bufsize != 0 && snaplen != 0) {
+		iov.iov_base = (void __user *)val;
+		iov.iov_len = bufsize;
+
+		return buffer_hash_to_ring(args, &iov, 1, min_t(unsigned long, bufsize, hash_len));
+	}
+
+	return val_to_ring(args, val, min_t(unsigned long, bufsize, (unsigned long)snaplen), true);
+}
+
+int32_t parse_readv_writev_bufs(struct event_filler_arguments *args, const struct iovec __user *iovsrc, unsigned long iovcnt, int64_t retval, u32 snaplen, int flags)
+{
+	u32 hash_len = g_buffer_hash_len;
 	int32_t res;
 	const struct iovec *iov;
 	u32 copylen;
 	u32 j;
 	uint64_t size = 0;
-	unsigned long bufsize;
 	char *targetbuf = args->str_storage;
 
 	copylen = iovcnt * sizeof(struct iovec);
@@ -874,18 +1390,24 @@ int32_t parse_readv_writev_bufs(struct event_filler_arguments *args, const struc
 
 	/*
 	 * data
-	 * NOTE: for the moment, we limit our data copy to the first buffer.
-	 * We assume that in the vast majority of the cases g_snaplen is much smaller
-	 * than iov[0].iov_len, and therefore we don't bother complicvating the code.
+	 * Only the iovec array is staged, the data goes from the user buffers
+	 * straight to the ring, up to snaplen bytes across all of them, or
+	 * they are hashed in the buffer hash mode.
 	 */
 	if (flags & PRB_FLAG_PUSH_DATA) {
-		if (retval > 0 && iovcnt > 0) {
-			bufsize = min_t(int64_t, retval, (int64_t)iov[0].iov_len);
-
-			res = val_to_ring(args,
-				(unsigned long)iov[0].iov_base,
-				min(bufsize, (unsigned long)g_snaplen),
-				true);
+		if (hash_len != 0 && retval > 0 && iovcnt > 0 && snaplen != 0) {
+			res = buffer_hash_to_ring(args,
+				iov,
+				iovcnt,
+				(unsigned long)min_t(int64_t, retval, (int64_t)hash_len));
+			if (unlikely(res != PPM_SUCCESS)) {
+				return res;
+			}
+		} else if (retval > 0 && iovcnt > 0) {
+			res = iovec_to_ring(args,
+				iov,
+				iovcnt,
+				(unsigned long)min_t(int64_t, retval, (int64_t)snaplen));
 			if (unlikely(res != PPM_SUCCESS)) {
 				return res;
 			}
@@ -904,6 +1426,128 @@ int32_t parse_readv_writev_bufs(struct event_filler_arguments *args, const struc
  * STANDARD FILLERS
  */
 
+/*
+ * Layout of the autofilled events whose parameters are all fixed size
+ * numbers, computed once by ppm_autofill_init(). Their parameter lengths
+ * never change, so f_sys_autofill() copies them as a block and stores the
+ * values without going through val_to_ring() for each one.
+ */
+struct ppm_autofill_layout {
+	u16 lens[PPM_MAX_AUTOFILL_ARGS];
+	u16 data_size;	/* Sum of lens, 0 if the event doesn't have the fast path */
+	u8 sign_extend;	/* Bit j is set if parameter j is a signed 64 bit number */
+};
+
+static struct ppm_autofill_layout g_autofill_layouts[PPM_EVENT_MAX];
+
+/*
+ * Size of a parameter that val_to_ring() stores as a number, 0 for the
+ * others
+ */
+static u16 scalar_param_size(enum ppm_param_type type)
+{
+	switch (type) {
+	case PT_FLAGS8:
+	case PT_UINT8:
+	case PT_SIGTYPE:
+	case PT_INT8:
+		return sizeof(u8);
+	case PT_FLAGS16:
+	case PT_UINT16:
+	case PT_SYSCALLID:
+	case PT_INT16:
+		return sizeof(u16);
+	case PT_FLAGS32:
+	case PT_UINT32:
+	case PT_INT32:
+		return sizeof(u32);
+	case PT_RELTIME:
+	case PT_ABSTIME:
+	case PT_UINT64:
+	case PT_INT64:
+	case PT_ERRNO:
+	case PT_FD:
+	case PT_PID:
+		return sizeof(u64);
+	default:
+		return 0;
+	}
+}
+
+void ppm_autofill_init(void)
+{
+	u32 type;
+	u32 j;
+
+	for (type = 0; type < PPM_EVENT_MAX; type++) {
+		const struct ppm_event_entry *evinfo = &g_ppm_events[type];
+		struct ppm_autofill_layout *layout = &g_autofill_layouts[type];
+		u16 data_size = 0;
+
+		layout->data_size = 0;
+		layout->sign_extend = 0;
+
+		if (evinfo->filler_callback != PPM_AUTOFILL ||
+			evinfo->n_autofill_args != g_event_info[type].nparams ||
+			evinfo->n_autofill_args > PPM_MAX_AUTOFILL_ARGS)
+			continue;
+
+		for (j = 0; j < evinfo->n_autofill_args; j++) {
+			u16 size = scalar_param_size(g_event_info[type].params[j].type);
+
+			if (size == 0)
+				break;
+
+			layout->lens[j] = size;
+			data_size += size;
+
+			switch (g_event_info[type].params[j].type) {
+			case PT_INT64:
+			case PT_ERRNO:
+			case PT_FD:
+			case PT_PID:
+				layout->sign_extend |= 1 << j;
+				break;
+			default:
+				break;
+			}
+		}
+
+		if (j == evinfo->n_autofill_args)
+			layout->data_size = data_size;
+	}
+}
+
+static inline unsigned long autofill_arg_value(struct event_filler_arguments *args,
+	const struct ppm_event_entry *evinfo,
+	u32 j)
+{
+	unsigned long val;
+
+	if (evinfo->autofill_args[j].id == AF_ID_RETVAL)
+		return (unsigned long)(int64_t)(long)syscall_get_return_value(current, args->regs);
+	else if (evinfo->autofill_args[j].id == AF_ID_USEDEFAULT)
+		return evinfo->autofill_args[j].default_val;
+
+	ASSERT(evinfo->autofill_args[j].id >= 0);
+
+#ifndef __x86_64__
+	if (evinfo->paramtype == APT_SOCK)
+		return args->socketcall_args[evinfo->autofill_args[j].id];
+#endif
+
+	/*
+	 * Regular argument
+	 */
+	syscall_get_arguments(current,
+		args->regs,
+		evinfo->autofill_args[j].id,
+		1,
+		&val);
+
+	return val;
+}
+
 /*
  * AUTOFILLER
  * In simple cases in which extracting an event is just a matter of moving the
@@ -913,63 +1557,65 @@ int32_t parse_readv_writev_bufs(struct event_filler_arguments *args, const struc
  */
 int f_sys_autofill(struct event_filler_arguments *args, const struct ppm_event_entry *evinfo)
 {
+	const struct ppm_autofill_layout *layout = &g_autofill_layouts[args->event_type];
 	int res;
-	unsigned long val;
 	u32 j;
-	int64_t retval;
 
 	ASSERT(evinfo->n_autofill_args <= PPM_MAX_AUTOFILL_ARGS);
 
-	for (j = 0; j < evinfo->n_autofill_args; j++) {
-		if (evinfo->autofill_args[j].id >= 0) {
-#ifdef __x86_64__
-			/*
-			 * Regular argument
-			 */
-			syscall_get_arguments(current,
-				args->regs,
-				evinfo->autofill_args[j].id,
-				1,
-				&val);
-#else
-			if (evinfo->paramtype == APT_SOCK) {
-				val = args->socketcall_args[evinfo->autofill_args[j].id];
-			} else {
-				/*
-				 * Regular argument
-				 */
-				syscall_get_arguments(current,
-					args->regs,
-					evinfo->autofill_args[j].id,
-					1,
-					&val);
-			}
-#endif
+	if (likely(layout->data_size != 0 && args->curarg == 0)) {
+		char *data = args->buffer + args->arg_data_offset;
 
-			res = val_to_ring(args, val, 0, true);
-			if (unlikely(res != PPM_SUCCESS)) {
-				return res;
-			}
-		} else if (evinfo->autofill_args[j].id == AF_ID_RETVAL) {
-			/*
-			 * Return value
-			 */
-			retval = (int64_t)(long)syscall_get_return_value(current, args->regs);
-			res = val_to_ring(args, retval, 0, false);
-			if (unlikely(res != PPM_SUCCESS)) {
-				return res;
-			}
-		} else if (evinfo->autofill_args[j].id == AF_ID_USEDEFAULT) {
-			/*
-			 * Default Value
-			 */
-			res = val_to_ring(args, evinfo->autofill_args[j].default_val, 0, false);
-			if (unlikely(res != PPM_SUCCESS)) {
-				return res;
+		if (unlikely(args->arg_data_size < layout->data_size))
+			return PPM_FAILURE_BUFFER_FULL;
+
+		/*
+		 * The stores truncate the values like val_to_ring() does. Only
+		 * the signed 64 bit numbers need their own case, on 32 bit
+		 * architectures.
+		 */
+		for (j = 0; j < evinfo->n_autofill_args; j++) {
+			unsigned long val = autofill_arg_value(args, evinfo, j);
+
+			switch (layout->lens[j]) {
+			case sizeof(u8):
+				*(u8 *)data = (u8)val;
+				break;
+			case sizeof(u16):
+				*(u16 *)data = (u16)val;
+				break;
+			case sizeof(u32):
+				*(u32 *)data = (u32)val;
+				break;
+			default:
+				if (layout->sign_extend & (1 << j))
+					*(s64 *)data = (s64)(long)val;
+				else
+					*(u64 *)data = (u64)val;
+				break;
 			}
-		} else {
-			ASSERT(false);
+
+			data += layout->lens[j];
 		}
+
+		memcpy(args->buffer, layout->lens, evinfo->n_autofill_args * sizeof(u16));
+		args->curarg = evinfo->n_autofill_args;
+		args->arg_data_offset += layout->data_size;
+		args->arg_data_size -= layout->data_size;
+
+		return add_sentinel(args);
+	}
+
+	for (j = 0; j < evinfo->n_autofill_args; j++) {
+		unsigned long val = autofill_arg_value(args, evinfo, j);
+
+		/*
+		 * The strings and buffers of the arguments are read from user
+		 * memory, the return value and the defaults are numbers
+		 */
+		res = val_to_ring(args, val, 0, evinfo->autofill_args[j].id >= 0);
+		if (unlikely(res != PPM_SUCCESS))
+			return res;
 	}
 
 	return add_sentinel(args);
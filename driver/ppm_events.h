@@ -38,7 +38,12 @@ struct event_filler_arguments {
 	struct pt_regs *regs; /* the registers containing the call arguments */
 	struct task_struct *sched_prev; /* for context switch events, the task that is being schduled out */
 	struct task_struct *sched_next; /* for context switch events, the task that is being schduled in */
-	char *str_storage; /* String storage. Size is one page. */
+	char *str_storage; /* Per-CPU scratch storage. Size is STR_STORAGE_SIZE. */
+	u32 copy_bytes; /* bytes of user memory copied into the event so far */
+	int defer_procinfo; /* if set, clone and execve leave the args and cwd to a PPME_PROCINFO_E event */
+	char *procinfo_args; /* the deferred args and cwd, staged in str_storage by the filler. NULL if there are none */
+	u32 procinfo_args_len;
+	char *procinfo_cwd;
 #ifndef __x86_64__
 	unsigned long socketcall_args[6];
 #endif
@@ -81,6 +86,23 @@ struct ppm_event_entry {
 
 extern const struct ppm_event_entry g_ppm_events[];
 
+/*
+ * State of a thread for PPM_IOCTL_DUMP_STATE, see get_proc_state()
+ */
+struct ppm_proc_state {
+	s64 tid;
+	s64 pid;
+	s64 ptid;
+	char comm[TASK_COMM_LEN];
+	u32 args_len;	/* Length of the command line, at the beginning of the pages */
+	char *cwd;	/* Inside the second page */
+	s64 fdlimit;
+	u32 uid;
+	u32 gid;
+	u32 flags;	/* PPM_CL_* flags */
+	int leader;	/* Set if the thread is the leader of its process */
+};
+
 /*
  * parse_readv_writev_bufs flags
  */
@@ -91,13 +113,18 @@ extern const struct ppm_event_entry g_ppm_events[];
 /*
  * Functions
  */
+void ppm_autofill_init(void);
 int32_t f_sys_autofill(struct event_filler_arguments *args, const struct ppm_event_entry *evinfo);
 int32_t val_to_ring(struct event_filler_arguments *args, uint64_t val, u16 val_len, bool fromuser);
 char *npm_getcwd(char *buf, unsigned long bufsize);
 u16 pack_addr(struct sockaddr *usrsockaddr, int ulen, char *targetbuf, u16 targetbufsize);
-u16 fd_to_socktuple(int fd, struct sockaddr *usrsockaddr, int ulen, bool use_userdata, bool is_inbound, char *targetbuf, u16 targetbufsize);
+u16 fd_to_socktuple(int fd, struct sockaddr *usrsockaddr, int ulen, bool use_userdata, bool is_inbound, bool can_elide, char *targetbuf, u16 targetbufsize);
+int get_fd_table(pid_t tid, int64_t start_fd, struct ppm_fd_entry *entries, u32 max_entries, u32 *n_entries, int64_t *next_fd);
+int get_proc_state(pid_t tid, struct ppm_proc_state *state, char *pages);
 int addr_to_kernel(void __user *uaddr, int ulen, struct sockaddr *kaddr);
-int32_t parse_readv_writev_bufs(struct event_filler_arguments *args, const struct iovec __user *iovsrc, unsigned long iovcnt, int64_t retval, int flags);
+u32 get_snaplen(struct event_filler_arguments *args, int fd);
+int32_t data_to_ring(struct event_filler_arguments *args, unsigned long val, unsigned long bufsize, u32 snaplen);
+int32_t parse_readv_writev_bufs(struct event_filler_arguments *args, const struct iovec __user *iovsrc, unsigned long iovcnt, int64_t retval, u32 snaplen, int flags);
 
 static inline int add_sentinel(struct event_filler_arguments *args)
 {
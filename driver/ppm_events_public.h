@@ -121,6 +121,7 @@ along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
 #define PPM_CL_NAME_CHANGED (1 << 17)	/* libsinsp-specific flag. Set when the thread name changes */
 										/* (for example because execve was called) */
 #define PPM_CL_CLOSED (1 << 18)			/* thread has been closed. */
+#define PPM_CL_CMDLINE_INHERITED (1 << 19)	/* exe and args were left out of the clone event because they're the ones of the parent */
 
 /*
  * Futex Operations
@@ -414,7 +415,23 @@ enum ppm_event_type {
 	PPME_SYSCALL_FCNTL_X = 151,	/* For internal use */
 	PPME_SCHEDSWITCHEX_E = 152,
 	PPME_SCHEDSWITCHEX_X = 153,	/* This should never be called */
-	PPM_EVENT_MAX = 154,
+	PPME_SCHEDSWITCH_SUMMARY_E = 154,
+	PPME_SCHEDSWITCH_SUMMARY_X = 155,	/* This should never be called */
+	PPME_PROCINFO_E = 156,
+	PPME_PROCINFO_X = 157,	/* This should never be called */
+	PPME_SAMPLING_E = 158,	/* Written by libsinsp, never by the driver */
+	PPME_SAMPLING_X = 159,	/* This should never be called */
+	PPME_REPEAT_E = 160,	/* Written by libscap, never by the driver */
+	PPME_REPEAT_X = 161,	/* This should never be called */
+	PPME_PROCSTATE_E = 162,	/* Written by PPM_IOCTL_DUMP_STATE */
+	PPME_PROCSTATE_X = 163,	/* This should never be called */
+	PPME_FDSTATE_E = 164,	/* Written by PPM_IOCTL_DUMP_STATE */
+	PPME_FDSTATE_X = 165,	/* This should never be called */
+	PPME_RUNQ_E = 166,
+	PPME_RUNQ_X = 167,	/* This should never be called */
+	PPME_PGFAULT_E = 168,
+	PPME_PGFAULT_X = 169,	/* This should never be called */
+	PPM_EVENT_MAX = 170,
 };
 /*@}*/
 
@@ -771,6 +788,9 @@ enum ppm_cmp_operator {
 	CO_GT = 5,
 	CO_GE = 6,
 	CO_CONTAINS = 7,
+	CO_IN = 8,
+	CO_STARTSWITH = 9,
+	CO_MATCHES = 10,
 };
 
 /*
@@ -882,6 +902,544 @@ struct ppm_evt_hdr {
 #define PPM_IOCTL_DISABLE_DROPPING_MODE _IO(PPM_IOCTL_MAGIC, 2)
 #define PPM_IOCTL_ENABLE_DROPPING_MODE _IO(PPM_IOCTL_MAGIC, 3)
 #define PPM_IOCTL_SET_SNAPLEN _IO(PPM_IOCTL_MAGIC, 4)
+#define PPM_IOCTL_GET_RING_BUF_SIZE _IO(PPM_IOCTL_MAGIC, 5)
+#define PPM_IOCTL_SET_EVENT_MASK _IO(PPM_IOCTL_MAGIC, 6)
+#define PPM_IOCTL_SET_EXCLUDED_TIDS _IO(PPM_IOCTL_MAGIC, 7)
+#define PPM_IOCTL_SET_WAKEUP_WATERMARK _IO(PPM_IOCTL_MAGIC, 8)
+#define PPM_IOCTL_SET_SAMPLING_POLICY _IO(PPM_IOCTL_MAGIC, 9)
+#define PPM_IOCTL_SET_DETAILED_STATS _IO(PPM_IOCTL_MAGIC, 10)
+#define PPM_IOCTL_GET_DETAILED_STATS _IO(PPM_IOCTL_MAGIC, 11)
+#define PPM_IOCTL_SET_SNAPLEN_POLICY _IO(PPM_IOCTL_MAGIC, 12)
+#define PPM_IOCTL_SET_SYSCALL_AGGREGATION _IO(PPM_IOCTL_MAGIC, 13)
+#define PPM_IOCTL_SET_COMPACT_ENCODING _IO(PPM_IOCTL_MAGIC, 14)
+#define PPM_IOCTL_SET_SWITCH_SUMMARY _IO(PPM_IOCTL_MAGIC, 15)
+#define PPM_IOCTL_ENABLE_PROCINFO_RING _IO(PPM_IOCTL_MAGIC, 16)
+#define PPM_IOCTL_ENABLE_STATE_RING _IO(PPM_IOCTL_MAGIC, 17)
+#define PPM_IOCTL_GET_RING_INFO_VERSION _IO(PPM_IOCTL_MAGIC, 18)
+#define PPM_IOCTL_SET_PREDICATE _IO(PPM_IOCTL_MAGIC, 19)
+#define PPM_IOCTL_SET_EXIT_ONLY _IO(PPM_IOCTL_MAGIC, 20)
+#define PPM_IOCTL_GET_FD_TABLE _IO(PPM_IOCTL_MAGIC, 21)
+#define PPM_IOCTL_DUMP_STATE _IO(PPM_IOCTL_MAGIC, 22)
+#define PPM_IOCTL_SET_MAX_DELAY _IO(PPM_IOCTL_MAGIC, 23)
+#define PPM_IOCTL_SET_TCP_TUPLE_ELISION _IO(PPM_IOCTL_MAGIC, 24)
+#define PPM_IOCTL_SET_RUNQ_SUMMARY _IO(PPM_IOCTL_MAGIC, 25)
+#define PPM_IOCTL_SET_PGFAULT_SUMMARY _IO(PPM_IOCTL_MAGIC, 26)
+#define PPM_IOCTL_SET_EXCLUDED_CPUS _IO(PPM_IOCTL_MAGIC, 27)
+#define PPM_IOCTL_SET_BUFFER_HASH _IO(PPM_IOCTL_MAGIC, 28)
+
+/*
+ * Bitmap of the event types that the driver captures, passed by pointer
+ * to PPM_IOCTL_SET_EVENT_MASK. Bit N corresponds to the ppm_event_type N.
+ * Drop events are always captured, regardless of the mask.
+ */
+struct ppm_evt_mask {
+	uint8_t mask[(PPM_EVENT_MAX + 7) / 8];
+};
+
+#define PPM_EVT_MASK_SET(m, evt) ((m)->mask[(evt) / 8] |= (1 << ((evt) % 8)))
+#define PPM_EVT_MASK_CLEAR(m, evt) ((m)->mask[(evt) / 8] &= ~(1 << ((evt) % 8)))
+#define PPM_EVT_MASK_ISSET(m, evt) ((m)->mask[(evt) / 8] & (1 << ((evt) % 8)))
+
+/*
+ * List of the threads whose events are discarded by the driver, passed by
+ * pointer to PPM_IOCTL_SET_EXCLUDED_TIDS. Each entry is compared with both
+ * the thread id and the process id of the thread generating the event, so
+ * adding a pid excludes all the threads of that process.
+ */
+#define PPM_MAX_EXCLUDED_TIDS 64
+
+struct ppm_tid_exclusion_list {
+	uint32_t ntids;
+	uint32_t reserved;
+	uint64_t tids[PPM_MAX_EXCLUDED_TIDS];
+};
+
+/*
+ * Bitmap of the CPUs whose events are discarded by the driver, passed by
+ * pointer to PPM_IOCTL_SET_EXCLUDED_CPUS. Bit N of bits[N / 64] is CPU N.
+ * It lets a consumer that is pinned to its own CPUs ignore what it does
+ * there. An empty bitmap captures all the CPUs again.
+ */
+#define PPM_MAX_EXCLUDED_CPUS 1024
+
+struct ppm_cpu_exclusion_mask {
+	uint64_t bits[PPM_MAX_EXCLUDED_CPUS / 64];
+};
+
+/*
+ * Per event type sampling policy, passed by pointer to
+ * PPM_IOCTL_SET_SAMPLING_POLICY. The driver keeps 1 in ratios[N] events of
+ * type N. 0 and 1 keep all the events of that type. The events of the system
+ * calls that are flagged as never dropped are always kept.
+ * If adaptive_threshold is not zero, sampling is applied only while the ring
+ * buffer of the CPU is at least adaptive_threshold percent full.
+ */
+struct ppm_sampling_policy {
+	uint16_t ratios[PPM_EVENT_MAX];
+	uint32_t adaptive_threshold;
+	uint32_t reserved;
+};
+
+/*
+ * Detailed statistics of a ring buffer, collected after
+ * PPM_IOCTL_SET_DETAILED_STATS is called with a nonzero argument, and read
+ * by passing a pointer to PPM_IOCTL_GET_DETAILED_STATS.
+ * filler_latency[N] counts the events whose filler ran for 2^N to
+ * 2^(N+1) - 1 nanoseconds. The last bucket also counts the slower ones.
+ * record_ns starts after the driver has found the consumers of the event
+ * and decided not to drop or sample it out, so the difference with
+ * filler_ns is the cost of writing the event to the rings.
+ */
+#define PPM_FILLER_LATENCY_BUCKETS 24
+
+struct ppm_evt_type_stats {
+	uint64_t n_evts; /* Events written to the ring */
+	uint64_t n_bytes; /* Bytes written to the ring */
+	uint64_t n_drops; /* Events lost because the ring was full or the user memory couldn't be read */
+	uint64_t filler_ns; /* Total time spent in the filler */
+	uint64_t record_ns; /* Total time spent in record_event(), filler included */
+};
+
+struct ppm_detailed_stats {
+	struct ppm_evt_type_stats evts[PPM_EVENT_MAX];
+	uint64_t filler_latency[PPM_FILLER_LATENCY_BUCKETS];
+};
+
+/*
+ * Snaplen policy, passed by pointer to PPM_IOCTL_SET_SNAPLEN_POLICY.
+ * When the fillers copy an I/O buffer, the rules are evaluated in order and
+ * the snaplen of the first matching one is used. If no rule matches, the
+ * global snaplen set with PPM_IOCTL_SET_SNAPLEN applies. A rule matches when
+ * all its non wildcard fields match:
+ *  - event_type is either the enter or the exit event of the system call,
+ *    or PPM_SNAPLEN_ANY_EVENT.
+ *  - fd_type is one of the ppm_snaplen_fd_type values.
+ *  - port is compared with both the local and the remote port of TCP and
+ *    UDP sockets. 0 matches any fd.
+ * n_rules = 0 disables the policy.
+ */
+#define PPM_MAX_SNAPLEN_RULES 32
+#define PPM_SNAPLEN_ANY_EVENT 0xffff
+
+enum ppm_snaplen_fd_type {
+	PPM_SNAPLEN_FD_ANY = 0,
+	PPM_SNAPLEN_FD_FILE = 1,
+	PPM_SNAPLEN_FD_SOCKET = 2,
+	PPM_SNAPLEN_FD_PIPE = 3,
+	PPM_SNAPLEN_FD_CHARDEV = 4,
+	PPM_SNAPLEN_FD_OTHER = 5,
+};
+
+struct ppm_snaplen_rule {
+	uint16_t event_type;
+	uint16_t port;
+	uint16_t fd_type; /* enum ppm_snaplen_fd_type */
+	uint16_t reserved;
+	uint32_t snaplen;
+};
+
+struct ppm_snaplen_policy {
+	uint32_t n_rules;
+	uint32_t reserved;
+	struct ppm_snaplen_rule rules[PPM_MAX_SNAPLEN_RULES];
+};
+
+/*
+ * Predicate, passed by pointer to PPM_IOCTL_SET_PREDICATE. The driver
+ * discards the events for which any of the clauses is false, before
+ * running the fillers. A clause compares a field with value as signed 64
+ * bit numbers, and negate inverts the result. The fields are:
+ *  - PPM_PRED_FIELD_TID: the thread id.
+ *  - PPM_PRED_FIELD_PID: the process id.
+ *  - PPM_PRED_FIELD_RES: the return value of the system call, for the exit
+ *    events whose type is set in res_events. The clause is true for the
+ *    other events.
+ * The events of the types that have EF_CREATES_FD, EF_DESTROYS_FD or
+ * EF_MODIFIES_STATE, and drop events, are never discarded.
+ * n_clauses = 0 disables the predicate.
+ */
+#define PPM_MAX_PREDICATE_CLAUSES 16
+
+enum ppm_predicate_field {
+	PPM_PRED_FIELD_TID = 0,
+	PPM_PRED_FIELD_PID = 1,
+	PPM_PRED_FIELD_RES = 2,
+};
+
+enum ppm_predicate_cmp {
+	PPM_PRED_CMP_EQ = 0,
+	PPM_PRED_CMP_NE = 1,
+	PPM_PRED_CMP_LT = 2,
+	PPM_PRED_CMP_LE = 3,
+	PPM_PRED_CMP_GT = 4,
+	PPM_PRED_CMP_GE = 5,
+};
+
+struct ppm_predicate_clause {
+	uint8_t field; /* enum ppm_predicate_field */
+	uint8_t cmp; /* enum ppm_predicate_cmp */
+	uint8_t negate;
+	uint8_t reserved[5];
+	int64_t value;
+};
+
+struct ppm_predicate {
+	uint32_t n_clauses;
+	uint32_t reserved;
+	struct ppm_predicate_clause clauses[PPM_MAX_PREDICATE_CLAUSES];
+	struct ppm_evt_mask res_events;
+};
+
+/*
+ * Fd table of a process, read by passing a pointer to a struct ppm_fd_table
+ * to PPM_IOCTL_GET_FD_TABLE. The driver writes at most max_entries entries,
+ * for the open fds of tid starting from start_fd, in the array pointed by
+ * entries, and sets n_entries. start_fd is then the fd to start from in the
+ * next call, or -1 if the whole table has been read. Each entry has:
+ *  - ino and mode: the inode number and i_mode of the file.
+ *  - name: the path of the file, like the link in /proc/<tid>/fd.
+ *  - for sockets, family is the PPM_AF_* of the socket, and type and
+ *    protocol are the ones passed to socket(). For PPM_AF_INET and
+ *    PPM_AF_INET6, saddr and sport are the local address and port, daddr
+ *    and dport the remote ones, all zeros if there's no peer. The addresses
+ *    are in network byte order, the ports in host byte order. For
+ *    PPM_AF_UNIX, the first 8 bytes of saddr and daddr are the socket and
+ *    its peer, like in the tuples of the events, and name is the path the
+ *    socket is bound to.
+ * -ESRCH means that the thread doesn't exist anymore.
+ */
+#define PPM_MAX_FD_TABLE_ENTRIES 1024
+#define PPM_FD_NAME_LEN 256
+
+struct ppm_fd_entry {
+	int64_t fd;
+	uint64_t ino;
+	uint32_t mode;
+	uint8_t family;
+	uint8_t type;
+	uint8_t protocol;
+	uint8_t reserved;
+	uint16_t sport;
+	uint16_t dport;
+	uint8_t reserved2[4];
+	uint8_t saddr[16];
+	uint8_t daddr[16];
+	char name[PPM_FD_NAME_LEN];
+};
+
+struct ppm_fd_table {
+	int64_t tid;
+	int64_t start_fd;
+	uint32_t max_entries;
+	uint32_t n_entries;
+	uint64_t entries; /* struct ppm_fd_entry __user * */
+};
+
+/*
+ * State dump, started by passing a pointer to a struct ppm_state_dump to
+ * PPM_IOCTL_DUMP_STATE with next_pid set to 0 and next_fd to -1. The driver
+ * writes a PPME_PROCSTATE_E event for each thread, followed, for the
+ * leaders of the processes, by a PPME_FDSTATE_E event for each open fd, in
+ * the ring of the calling CPU, or in its state ring if the consumer has
+ * one. The threads are walked in the pid namespace of the caller, and the
+ * events have the global ids, like the live ones. Each event is stamped
+ * when its state is read, so the live events that change that state
+ * afterwards have later timestamps.
+ * The driver stops before the ring is three quarters full, and sets
+ * next_pid and next_fd to where the dump continues, or next_pid to -1 when
+ * it's over. n_procs and n_fds count the events written by this call.
+ * The fdstate events have the pid of the process as tid, and a sock
+ * parameter that is empty for the fds that aren't sockets, and else has
+ * the family, type and protocol bytes, the u16 sport and dport and the 16
+ * bytes saddr and daddr of the struct ppm_fd_entry, packed.
+ * Not supported if the main rings use the compact encoding and the
+ * consumer has no state ring.
+ */
+#define PPM_FDSTATE_SOCK_LEN 39
+
+struct ppm_state_dump {
+	int64_t next_pid;
+	int64_t next_fd;
+	uint32_t n_procs;
+	uint32_t n_fds;
+};
+
+/*
+ * PPM_IOCTL_SET_MAX_DELAY takes a delay in microseconds. When a reader of
+ * the consumer is waiting in poll(), the next event of a CPU wakes it up if
+ * the ring of that CPU got its first unread event more than that long ago,
+ * even if the ring is still below the wakeup watermark. 0, the default,
+ * only uses the watermark. Readers should also not wait in poll() for
+ * longer than the delay, since a CPU can go idle with events in its ring.
+ */
+
+/*
+ * After PPM_IOCTL_SET_TCP_TUPLE_ELISION is called with a nonzero argument,
+ * the sendto, recvfrom, sendmsg and recvmsg events of connected TCP sockets
+ * have an empty tuple, like when the caller doesn't pass an address. The
+ * tuple is only in the connect and accept events, and readers take it from
+ * their fd table. Like the snaplen, the setting is shared by all the
+ * consumers.
+ */
+
+/*
+ * Buffer hash mode. After PPM_IOCTL_SET_BUFFER_HASH is called with a
+ * nonzero length, the data parameter of the I/O events doesn't hold the
+ * data anymore, but the PPM_BUFFER_HASH_SIZE byte hash of its first length
+ * bytes, at most PPM_MAX_BUFFER_HASH_LEN. The snaplen doesn't limit the
+ * hashed bytes, but the data of the fds whose snaplen is 0 isn't hashed
+ * either. If a buffer faults, the hash covers the bytes read before it.
+ * 0 goes back to copying the data. Like the snaplen, the setting is shared
+ * by all the consumers.
+ * The hash is computed by ppm_buffer_hash_update() over blocks whose length
+ * is a multiple of 8, except the last one, and by ppm_buffer_hash_final(),
+ * so readers can compare it with the hash of data they captured.
+ */
+#define PPM_MAX_BUFFER_HASH_LEN (1024 * 1024)
+#define PPM_BUFFER_HASH_SIZE 8
+#define PPM_BUFFER_HASH_SEED 0x9e3779b97f4a7c15ULL
+
+static inline uint64_t ppm_buffer_hash_rotl(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t ppm_buffer_hash_update(uint64_t h, const uint8_t *p, uint32_t len)
+{
+	uint64_t k;
+	uint32_t j;
+
+	for (;;) {
+		if (len >= 8) {
+			k = (uint64_t)p[0] | ((uint64_t)p[1] << 8) |
+				((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24) |
+				((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40) |
+				((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
+			p += 8;
+			len -= 8;
+		} else if (len > 0) {
+			k = 0;
+			for (j = 0; j < len; j++)
+				k |= (uint64_t)p[j] << (j * 8);
+			len = 0;
+		} else {
+			break;
+		}
+
+		k *= 0x87c37b91114253d5ULL;
+		k = ppm_buffer_hash_rotl(k, 31);
+		k *= 0x4cf5ad432745937fULL;
+		h ^= k;
+		h = ppm_buffer_hash_rotl(h, 27) * 5 + 0x52dce729;
+	}
+
+	return h;
+}
+
+static inline uint64_t ppm_buffer_hash_final(uint64_t h, uint64_t total_len)
+{
+	h ^= total_len;
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+
+	return h;
+}
+
+/*
+ * System call aggregation. After PPM_IOCTL_SET_SYSCALL_AGGREGATION is called
+ * with PPM_AGGR_ENABLED, the probes don't write the events of the caller to
+ * its ring buffers anymore. Instead, they count the system calls and their
+ * latency in one ppm_syscall_aggr_table per CPU, that userspace maps read
+ * only at page offset PPM_AGGR_MMAP_PGOFF of each device.
+ * The counters are updated when the system calls return and are never
+ * reset, readers compute the deltas. Calling the ioctl again clears the
+ * tables, 0 goes back to capturing events.
+ * Without PPM_AGGR_PER_TGID, entries[N] holds the system call with
+ * ppm_syscall_code N. With it, the entries are keyed by (tgid, ppm_sc) in
+ * an open addressing hash table, and the calls that don't fit are counted
+ * in n_overflows.
+ * latency[N] counts the calls that took 2^N to 2^(N+1) - 1 nanoseconds. The
+ * last bucket also counts the slower ones. The calls whose enter event
+ * wasn't seen, like the ones in progress when the mode was enabled, are
+ * counted in n_calls only.
+ */
+#define PPM_AGGR_ENABLED (1 << 0)
+#define PPM_AGGR_PER_TGID (1 << 1)
+
+#define PPM_AGGR_MMAP_PGOFF 1
+#define PPM_AGGR_TABLE_SIZE 1024 /* Must be a power of two, and larger than PPM_SC_MAX */
+#define PPM_AGGR_LATENCY_BUCKETS 32
+
+struct ppm_syscall_aggr_entry {
+	uint32_t tgid; /* 0 without PPM_AGGR_PER_TGID */
+	uint16_t ppm_sc; /* enum ppm_syscall_code */
+	uint16_t used; /* Set once the key fields are valid */
+	uint64_t n_calls;
+	uint64_t n_errors; /* Calls that returned a negative value */
+	uint64_t total_ns; /* Total latency of the calls in the histogram */
+	uint64_t latency[PPM_AGGR_LATENCY_BUCKETS];
+};
+
+struct ppm_syscall_aggr_table {
+	uint64_t n_overflows;
+	uint64_t reserved;
+	struct ppm_syscall_aggr_entry entries[PPM_AGGR_TABLE_SIZE];
+};
+
+/*
+ * Context switch summaries. PPM_IOCTL_SET_SWITCH_SUMMARY takes an interval
+ * in milliseconds. When it's not zero, the driver stops recording a
+ * PPME_SCHEDSWITCH_E event for every context switch. Instead, when a
+ * thread leaves the CPU and it didn't get a summary in the last interval,
+ * it gets a PPME_SCHEDSWITCH_SUMMARY_E event with its total CPU time and
+ * its voluntary and involuntary context switch counts since it started.
+ * 0 goes back to one event per switch. Like the snaplen, this setting is
+ * shared by all the processes capturing.
+ */
+
+/*
+ * Run queue summaries. PPM_IOCTL_SET_RUNQ_SUMMARY takes an interval in
+ * milliseconds. When it's not zero, the driver measures how long each thread
+ * waits to get a CPU, from its wakeup, or from its preemption, to the
+ * context switch that runs it. When a thread that waited leaves the CPU and
+ * it didn't get a summary in the last interval, it gets a PPME_RUNQ_E event
+ * with the total and the longest of its waits since the previous one, and
+ * their number. The events come in addition to the context switch events.
+ * 0 disables the measurements. Like the snaplen, this setting is shared by
+ * all the processes capturing.
+ */
+
+/*
+ * Page fault summaries. PPM_IOCTL_SET_PGFAULT_SUMMARY takes an interval in
+ * milliseconds. When it's not zero and a thread that had page faults leaves
+ * the CPU, if it didn't get a summary in the last interval, it gets a
+ * PPME_PGFAULT_E event with its major and minor faults since the previous
+ * one, or since it started for its first one. The counts are the ones that
+ * the kernel keeps for each thread, so nothing runs on the faults
+ * themselves, except where the page_fault_user tracepoint exists (x86): it
+ * samples the address of the last fault of the thread, which the event
+ * carries too. 0 disables the summaries. Like the snaplen, this setting is
+ * shared by all the processes capturing.
+ */
+
+/*
+ * Auxiliary rings. Next to its main ring, each CPU of a consumer can have
+ * auxiliary rings that carry specific events. Userspace maps auxiliary ring
+ * N at page offset PPM_AUX_RING_MMAP_PGOFF(N) of each device, the same way
+ * as the main ring at offset 0: a mapping of at most one page gets the
+ * ppm_ring_buffer_info, one of twice the ring size gets the data. The
+ * events of all the rings of a CPU are ordered by timestamp, and the ones
+ * with the same timestamp come from the main ring first.
+ */
+#define PPM_AUX_RING_PROCINFO 0
+#define PPM_AUX_RING_STATE 1
+#define PPM_MAX_AUX_RINGS 2
+
+#define PPM_AUX_RING_MMAP_PGOFF(n) (2 + (n))
+
+/*
+ * Deferred process info. PPM_IOCTL_ENABLE_PROCINFO_RING takes a ring size
+ * and allocates the PPM_AUX_RING_PROCINFO auxiliary rings of the caller.
+ * From then on, the clone and execve exit events carry the executable but
+ * empty args and cwd, and are followed by a PPME_PROCINFO_E event with the
+ * same timestamp and tid in the auxiliary ring, with the args and cwd that
+ * they would have had. When the auxiliary ring is full, only the process
+ * info is dropped, and the bulky part of these events doesn't compete with
+ * the others for space in the main ring.
+ * The events are deferred only when all the consumers that receive them
+ * have the auxiliary rings. Once allocated, the rings stay until the
+ * devices are closed.
+ */
+
+/*
+ * State ring. PPM_IOCTL_ENABLE_STATE_RING takes a ring size and allocates
+ * the PPM_AUX_RING_STATE auxiliary rings of the caller. From then on, the
+ * events of the types that have EF_CREATES_FD, EF_DESTROYS_FD or
+ * EF_MODIFIES_STATE, e.g. open, close, clone, execve and procexit, go to
+ * that ring instead of the main one. A burst of I/O that fills the main ring
+ * then drops only I/O events, and the thread and fd tables that userspace
+ * builds stay consistent. Like the process info ring, it can't be disabled.
+ */
+
+/*
+ * Compact event encoding. After PPM_IOCTL_SET_COMPACT_ENCODING is called
+ * with a nonzero argument, the events are written to the ring buffers of
+ * the caller in this format instead of a ppm_evt_hdr followed by the
+ * parameters:
+ *  - 1 byte of PPM_COMPACT_* flags.
+ *  - varint: length of the rest of the event, after this field.
+ *  - varint: event type.
+ *  - varint: timestamp. The difference with the previous event in the ring,
+ *    or the absolute value with PPM_COMPACT_ABS_TS.
+ *  - varint: tid, only with PPM_COMPACT_TID. Otherwise the tid is the one of
+ *    the previous event in the ring.
+ *  - varint per parameter: (length << 1) | PPM_COMPACT_PARAM_CODED.
+ *  - the parameters. The integers of the types for which
+ *    ppm_compact_param_width() is nonzero are stored as varints when the
+ *    parameter has the flag, zigzag encoded if they are signed. Everything
+ *    else is copied as in the normal encoding.
+ * Varints are little endian base 128, 7 bits per byte with the high bit set
+ * on all the bytes but the last one. The state used for the deltas starts
+ * from 0 when the ioctl is called, which also discards the events that are
+ * in the rings.
+ *
+ * Exit only mode. After PPM_IOCTL_SET_EXIT_ONLY is called with a nonzero
+ * argument, which requires the compact encoding, the enter events of the
+ * system calls are not written to the rings of the caller anymore. The
+ * driver keeps their compact parameters in a slot of the thread, and the
+ * exit event carries them. It then has PPM_COMPACT_ENTER, and after the
+ * tid:
+ *  - varint: latency, the timestamp of the exit event minus the one of the
+ *    enter event.
+ *  - varint: length of the enter parameters.
+ *  - the lengths and the parameters of the enter event, encoded like the
+ *    ones of the exit event that follow.
+ * The enter event has the previous event type and the same tid, and readers
+ * expand it right before the exit event. The enter events that are too
+ * large for a slot are written as usual. The slots are indexed by tid, so
+ * when two threads collide on one, the exit of the first has no enter
+ * event. Disabling the compact encoding disables this mode too.
+ */
+#define PPM_COMPACT_ABS_TS (1 << 0)
+#define PPM_COMPACT_TID (1 << 1)
+#define PPM_COMPACT_ENTER (1 << 2)
+
+#define PPM_COMPACT_PARAM_CODED 1
+
+static inline uint32_t ppm_compact_param_width(enum ppm_param_type type, int *is_signed)
+{
+	*is_signed = 0;
+
+	switch (type) {
+	case PT_INT64:
+	case PT_ERRNO:
+	case PT_FD:
+	case PT_PID:
+		*is_signed = 1;
+		return 8;
+	case PT_UINT64:
+	case PT_RELTIME:
+		return 8;
+	case PT_INT32:
+		*is_signed = 1;
+		return 4;
+	case PT_UINT32:
+	case PT_FLAGS32:
+		return 4;
+	case PT_INT16:
+		*is_signed = 1;
+		return 2;
+	case PT_UINT16:
+	case PT_FLAGS16:
+	case PT_SYSCALLID:
+		return 2;
+	default:
+		return 0;
+	}
+}
 
 
 /*!
@@ -892,6 +1450,24 @@ struct ppm_syscall_desc {
 	char *name; /**< System call name, e.g. 'open'. */
 };
 
+/*
+ * The events of each native system call, indexed by its number. Shared
+ * with userspace, where the eBPF engine of libscap uses its own copy.
+ */
+#define SYSCALL_TABLE_SIZE 512
+
+enum syscall_flags {
+	UF_NONE = 0,
+	UF_USED = (1 << 0),
+	UF_NEVER_DROP = (1 << 1),
+};
+
+struct syscall_evt_pair {
+	int flags;
+	enum ppm_event_type enter_event_type;
+	enum ppm_event_type exit_event_type;
+};
+
 extern const struct ppm_name_value socket_families[];
 extern const struct ppm_name_value file_flags[];
 extern const struct ppm_name_value clone_flags[];
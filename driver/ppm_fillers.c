@@ -88,6 +88,9 @@ static int f_sys_prlimit_e(struct event_filler_arguments *args);
 static int f_sys_prlimit_x(struct event_filler_arguments *args);
 #ifdef CAPTURE_CONTEXT_SWITCHES
 static int f_sched_switch_e(struct event_filler_arguments *args);
+static int f_sched_switch_summary_e(struct event_filler_arguments *args);
+static int f_sched_runq_e(struct event_filler_arguments *args);
+static int f_sched_pgfault_e(struct event_filler_arguments *args);
 #endif
 static int f_sched_drop(struct event_filler_arguments *args);
 static int f_sched_fcntl_e(struct event_filler_arguments *args);
@@ -241,6 +244,9 @@ const struct ppm_event_entry g_ppm_events[PPM_EVENT_MAX] = {
 	[PPME_SYSCALL_PRLIMIT_X] = {f_sys_prlimit_x},
 #ifdef CAPTURE_CONTEXT_SWITCHES
 	[PPME_SCHEDSWITCH_E] = {f_sched_switch_e},
+	[PPME_SCHEDSWITCH_SUMMARY_E] = {f_sched_switch_summary_e},
+	[PPME_RUNQ_E] = {f_sched_runq_e},
+	[PPME_PGFAULT_E] = {f_sched_pgfault_e},
 #endif
 	[PPME_DROP_E] = {f_sched_drop},
 	[PPME_DROP_X] = {f_sched_drop},
@@ -435,6 +441,7 @@ static int f_sys_read_x(struct event_filler_arguments *args)
 	int res;
 	int64_t retval;
 	unsigned long bufsize;
+	unsigned long fd;
 	unsigned int snaplen;
 
 	/*
@@ -465,33 +472,15 @@ static int f_sys_read_x(struct event_filler_arguments *args)
 	}
 
 	/*
-	 * Determine the snaplen by checking the fd type.
-	 * (note: not implemeted yet)
+	 * Determine the snaplen by checking the fd
 	 */
-	snaplen = g_snaplen;
-#if 0
-	{
-		int fd;
-		int err, fput_needed;
-		struct socket *sock;
-
-		syscall_get_arguments(current, args->regs, 0, 1, &val);
-		fd = (int)val;
-
-		sock = ppm_sockfd_lookup_light(fd, &err, &fput_needed);
-		if (sock) {
-			snaplen = g_snaplen;
-			fput_light(sock->file, fput_needed);
-		} else {
-			snaplen = RW_SNAPLEN;
-		}
-	}
-#endif
+	syscall_get_arguments(current, args->regs, 0, 1, &fd);
+	snaplen = get_snaplen(args, (int)fd);
 
 	/*
 	 * Copy the buffer
 	 */
-	res = val_to_ring(args, val, min_t(unsigned long, bufsize, (unsigned long)snaplen), true);
+	res = data_to_ring(args, val, bufsize, snaplen);
 	if (unlikely(res != PPM_SUCCESS))
 		return res;
 
@@ -504,6 +493,7 @@ static int f_sys_write_x(struct event_filler_arguments *args)
 	int res;
 	int64_t retval;
 	unsigned long bufsize;
+	unsigned long fd;
 	unsigned int snaplen;
 
 	/*
@@ -521,34 +511,16 @@ static int f_sys_write_x(struct event_filler_arguments *args)
 	bufsize = val;
 
 	/*
-	 * Determine the snaplen by checking the fd type.
-	 * (note: not implemeted yet)
+	 * Determine the snaplen by checking the fd
 	 */
-	snaplen = g_snaplen;
-#if 0
-	{
-		int fd;
-		int err, fput_needed;
-		struct socket *sock;
-
-		syscall_get_arguments(current, args->regs, 0, 1, &val);
-		fd = (int)val;
-
-		sock = ppm_sockfd_lookup_light(fd, &err, &fput_needed);
-		if (sock) {
-			snaplen = g_snaplen;
-			fput_light(sock->file, fput_needed);
-		} else {
-			snaplen = RW_SNAPLEN;
-		}
-	}
-#endif
+	syscall_get_arguments(current, args->regs, 0, 1, &fd);
+	snaplen = get_snaplen(args, (int)fd);
 
 	/*
 	 * Copy the buffer
 	 */
 	syscall_get_arguments(current, args->regs, 1, 1, &val);
-	res = val_to_ring(args, val, min_t(unsigned long, bufsize, (unsigned long)snaplen), true);
+	res = data_to_ring(args, val, bufsize, snaplen);
 	if (unlikely(res != PPM_SUCCESS))
 		return res;
 
@@ -610,17 +582,140 @@ static inline u32 clone_flags_to_scap(unsigned long flags)
 	return res;
 }
 
+/*
+ * Copy the command line of the current process straight into the ring as
+ * the exe and args parameters. The two are consecutive in the event, so the
+ * whole block goes in with a single copy and is then split at the first
+ * terminator.
+ */
+static int cmdline_to_ring(struct event_filler_arguments *args, struct mm_struct *mm)
+{
+	u16 *psize = (u16 *)(args->buffer + args->curarg * sizeof(u16));
+	char *dest = args->buffer + args->arg_data_offset;
+	unsigned long args_len;
+	unsigned long exe_len;
+
+	if (unlikely(args->curarg + 2 > args->nargs)) {
+		ASSERT(0);
+		return PPM_FAILURE_BUG;
+	}
+
+	args_len = mm->arg_end - mm->arg_start;
+
+	if (args_len > PAGE_SIZE)
+		args_len = PAGE_SIZE;
+
+	if (unlikely(args_len + 1 >= args->arg_data_size))
+		return PPM_FAILURE_BUFFER_FULL;
+
+	if (unlikely(ppm_copy_from_user(dest, (const void __user *)mm->arg_start, args_len)))
+		return PPM_FAILURE_INVALID_USER_MEMORY;
+
+	/*
+	 * Make sure that exe is terminated even for an empty command line
+	 */
+	if (args_len == 0)
+		args_len = 1;
+
+	dest[args_len - 1] = 0;
+
+	exe_len = strnlen(dest, args_len) + 1;
+
+	psize[0] = (u16)exe_len;
+	psize[1] = (u16)(args_len - exe_len);
+	args->curarg += 2;
+	args->arg_data_offset += args_len;
+	args->arg_data_size -= args_len;
+	args->copy_bytes += args_len;
+
+	return PPM_SUCCESS;
+}
+
+/*
+ * Like cmdline_to_ring(), but only exe goes into the ring, with empty args.
+ * The command line is staged at the beginning of the scratch storage for
+ * the PPME_PROCINFO_E event that follows.
+ */
+static int cmdline_to_procinfo(struct event_filler_arguments *args, struct mm_struct *mm)
+{
+	unsigned long args_len;
+	unsigned long exe_len;
+	int res;
+
+	args_len = mm->arg_end - mm->arg_start;
+
+	if (args_len > PAGE_SIZE)
+		args_len = PAGE_SIZE;
+
+	if (unlikely(ppm_copy_from_user(args->str_storage, (const void __user *)mm->arg_start, args_len)))
+		return PPM_FAILURE_INVALID_USER_MEMORY;
+
+	if (args_len == 0)
+		args_len = 1;
+
+	args->str_storage[args_len - 1] = 0;
+
+	exe_len = strnlen(args->str_storage, args_len) + 1;
+
+	res = val_to_ring(args, (uint64_t)(long)args->str_storage, 0, false);
+	if (unlikely(res != PPM_SUCCESS))
+		return res;
+
+	res = val_to_ring(args, 0, 0, false);
+	if (unlikely(res != PPM_SUCCESS))
+		return res;
+
+	args->procinfo_args = args->str_storage + exe_len;
+	args->procinfo_args_len = args_len - exe_len;
+
+	return PPM_SUCCESS;
+}
+
+/*
+ * True if the other side of a clone, i.e. the caller in the child and the
+ * child in the caller, still has the same command line area. A new thread
+ * is compared with its main thread, whose command line userspace uses.
+ * Then exe and args are the ones that userspace already has, and they're
+ * left out of the event.
+ */
+static int clone_cmdline_inherited(int64_t retval, struct mm_struct *mm)
+{
+	struct task_struct *other;
+	int res = 0;
+
+	rcu_read_lock();
+
+	if (retval != 0)
+		other = pid_task(find_vpid((pid_t)retval), PIDTYPE_PID);
+	else if (!thread_group_leader(current))
+		other = current->group_leader;
+	else
+		other = rcu_dereference(current->real_parent);
+
+	if (other) {
+		task_lock(other);
+		if (other->mm == mm ||
+			(other->mm &&
+			other->mm->arg_start == mm->arg_start &&
+			other->mm->arg_end == mm->arg_end))
+			res = 1;
+		task_unlock(other);
+	}
+
+	rcu_read_unlock();
+
+	return res;
+}
+
 static int f_proc_startupdate(struct event_filler_arguments *args)
 {
 	unsigned long val;
 	int res = 0;
-	unsigned int exe_len = 0;
-	unsigned int args_len = 0;
 	struct mm_struct *mm = current->mm;
 	int64_t retval;
-	const char *argstr;
 	int ptid;
 	char *spwd;
+	u32 cmdline_flags = 0;
 
 	/*
 	 * Make sure the operation was successful
@@ -632,51 +727,47 @@ static int f_proc_startupdate(struct event_filler_arguments *args)
 
 	if (likely(retval >= 0)) {
 		if (unlikely(!mm)) {
-			args->str_storage[0] = 0;
 			pr_info("f_proc_startupdate drop, mm=NULL\n");
 			return PPM_FAILURE_BUG;
 		}
 
 		if (unlikely(!mm->arg_end)) {
-			args->str_storage[0] = 0;
 			pr_info("f_proc_startupdate drop, mm->arg_end=NULL\n");
 			return PPM_FAILURE_BUG;
 		}
 
-		args_len = mm->arg_end - mm->arg_start;
-
-		if (args_len > PAGE_SIZE)
-			args_len = PAGE_SIZE;
+		/*
+		 * exe and args. A clone copies the image of the caller, so unless
+		 * one of the two already changed it, they're only flagged.
+		 */
+		if (args->event_type == PPME_CLONE_X && clone_cmdline_inherited(retval, mm)) {
+			cmdline_flags = PPM_CL_CMDLINE_INHERITED;
 
-		if (unlikely(ppm_copy_from_user(args->str_storage, (const void __user *)mm->arg_start, args_len)))
-			return PPM_FAILURE_INVALID_USER_MEMORY;
+			res = val_to_ring(args, (uint64_t)(long)"", 0, false);
+			if (unlikely(res != PPM_SUCCESS))
+				return res;
 
-		args->str_storage[args_len - 1] = 0;
+			res = val_to_ring(args, 0, 0, false);
+		} else if (args->defer_procinfo) {
+			res = cmdline_to_procinfo(args, mm);
+		} else {
+			res = cmdline_to_ring(args, mm);
+		}
 
-		exe_len = strnlen(args->str_storage, args_len);
-		if (exe_len < args_len)
-			++exe_len;
+		if (unlikely(res != PPM_SUCCESS))
+			return res;
 	} else {
 		/*
 		 * The call failed. Return empty strings for exe and args
 		 */
-		*args->str_storage = 0;
-		argstr = "";
-	}
-
-	/*
-	 * exe
-	 */
-	res = val_to_ring(args, (uint64_t)(long)args->str_storage, 0, false);
-	if (unlikely(res != PPM_SUCCESS))
-		return res;
+		res = val_to_ring(args, (uint64_t)(long)"", 0, false);
+		if (unlikely(res != PPM_SUCCESS))
+			return res;
 
-	/*
-	 * Args
-	 */
-	res = val_to_ring(args, (int64_t)(long)args->str_storage + exe_len, args_len - exe_len, false);
-	if (unlikely(res != PPM_SUCCESS))
-		return res;
+		res = val_to_ring(args, 0, 0, false);
+		if (unlikely(res != PPM_SUCCESS))
+			return res;
+	}
 
 	/*
 	 * tid
@@ -705,11 +796,21 @@ static int f_proc_startupdate(struct event_filler_arguments *args)
 		return res;
 
 	/*
-	 * cwd
+	 * cwd. When the process info is deferred, it goes after the staged
+	 * command line.
 	 */
-	spwd = npm_getcwd(args->str_storage, STR_STORAGE_SIZE - 1);
-	if (spwd == NULL)
+	if (args->procinfo_args != NULL) {
+		spwd = npm_getcwd(args->str_storage + PAGE_SIZE, PAGE_SIZE - 1);
+		if (spwd == NULL)
+			spwd = "";
+
+		args->procinfo_cwd = spwd;
 		spwd = "";
+	} else {
+		spwd = npm_getcwd(args->str_storage, STR_STORAGE_SIZE - 1);
+		if (spwd == NULL)
+			spwd = "";
+	}
 
 	res = val_to_ring(args, (uint64_t)(long)spwd, 0, false);
 	if (unlikely(res != PPM_SUCCESS))
@@ -738,7 +839,7 @@ static int f_proc_startupdate(struct event_filler_arguments *args)
 		 * flags
 		 */
 		syscall_get_arguments(current, args->regs, 0, 1, &val);
-		res = val_to_ring(args, (uint64_t)clone_flags_to_scap(val), 0, false);
+		res = val_to_ring(args, (uint64_t)(clone_flags_to_scap(val) | cmdline_flags), 0, false);
 		if (unlikely(res != PPM_SUCCESS))
 			return res;
 
@@ -891,6 +992,7 @@ static int f_sys_connect_x(struct event_filler_arguments *args)
 					val,
 					true,
 					false,
+					false,
 					targetbuf,
 					STR_STORAGE_SIZE);
 			}
@@ -1029,6 +1131,7 @@ static int f_sys_accept_x(struct event_filler_arguments *args)
 		0,
 		false,
 		true,
+		false,
 		targetbuf,
 		STR_STORAGE_SIZE);
 
@@ -1173,6 +1276,7 @@ static int f_sys_sendto_e(struct event_filler_arguments *args)
 				val,
 				true,
 				false,
+				true,
 				targetbuf,
 				STR_STORAGE_SIZE);
 		}
@@ -1197,6 +1301,7 @@ static int f_sys_send_x(struct event_filler_arguments *args)
 	int res;
 	int64_t retval;
 	unsigned long bufsize;
+	unsigned int snaplen;
 
 	/*
 	 * res
@@ -1206,6 +1311,16 @@ static int f_sys_send_x(struct event_filler_arguments *args)
 	if (unlikely(res != PPM_SUCCESS))
 		return res;
 
+	/*
+	 * Determine the snaplen by checking the fd
+	 */
+#ifdef __x86_64__
+	syscall_get_arguments(current, args->regs, 0, 1, &val);
+	snaplen = get_snaplen(args, (int)val);
+#else
+	snaplen = get_snaplen(args, (int)args->socketcall_args[0]);
+#endif
+
 	/*
 	 * data
 	 */
@@ -1229,7 +1344,7 @@ static int f_sys_send_x(struct event_filler_arguments *args)
 		bufsize = retval;
 	}
 
-	res = val_to_ring(args, val, min_t(unsigned long, bufsize, (unsigned long)g_snaplen), true);
+	res = data_to_ring(args, val, bufsize, snaplen);
 	if (unlikely(res != PPM_SUCCESS))
 		return res;
 
@@ -1296,6 +1411,7 @@ static int f_sys_recv_x_common(struct event_filler_arguments *args, int64_t *ret
 	int res;
 	unsigned long val;
 	unsigned long bufsize;
+	unsigned int snaplen;
 
 	/*
 	 * res
@@ -1305,6 +1421,16 @@ static int f_sys_recv_x_common(struct event_filler_arguments *args, int64_t *ret
 	if (unlikely(res != PPM_SUCCESS))
 		return res;
 
+	/*
+	 * Determine the snaplen by checking the fd
+	 */
+#ifdef __x86_64__
+	syscall_get_arguments(current, args->regs, 0, 1, &val);
+	snaplen = get_snaplen(args, (int)val);
+#else
+	snaplen = get_snaplen(args, (int)args->socketcall_args[0]);
+#endif
+
 	/*
 	 * data
 	 */
@@ -1328,7 +1454,7 @@ static int f_sys_recv_x_common(struct event_filler_arguments *args, int64_t *ret
 		bufsize = *retval;
 	}
 
-	res = val_to_ring(args, val, min_t(unsigned long, bufsize, (unsigned long)g_snaplen), true);
+	res = data_to_ring(args, val, bufsize, snaplen);
 	if (unlikely(res != PPM_SUCCESS))
 		return res;
 
@@ -1414,6 +1540,7 @@ static int f_sys_recvfrom_x(struct event_filler_arguments *args)
 					addrlen,
 					true,
 					true,
+					true,
 					targetbuf,
 					STR_STORAGE_SIZE);
 			}
@@ -1479,7 +1606,7 @@ static int f_sys_sendmsg_e(struct event_filler_arguments *args)
 	iov = (const struct iovec __user *)mh.msg_iov;
 	iovcnt = mh.msg_iovlen;
 
-	res = parse_readv_writev_bufs(args, iov, iovcnt, g_snaplen, PRB_FLAG_PUSH_SIZE);
+	res = parse_readv_writev_bufs(args, iov, iovcnt, 0, 0, PRB_FLAG_PUSH_SIZE);
 	if (unlikely(res != PPM_SUCCESS))
 		return res;
 
@@ -1503,6 +1630,7 @@ static int f_sys_sendmsg_e(struct event_filler_arguments *args)
 				addrlen,
 				true,
 				false,
+				true,
 				targetbuf,
 				STR_STORAGE_SIZE);
 		}
@@ -1527,6 +1655,7 @@ static int f_sys_sendmsg_x(struct event_filler_arguments *args)
 	const struct iovec __user *iov;
 	unsigned long iovcnt;
 	struct msghdr mh;
+	unsigned int snaplen;
 
 	/*
 	 * res
@@ -1554,7 +1683,17 @@ static int f_sys_sendmsg_x(struct event_filler_arguments *args)
 	iov = (const struct iovec __user *)mh.msg_iov;
 	iovcnt = mh.msg_iovlen;
 
-	res = parse_readv_writev_bufs(args, iov, iovcnt, g_snaplen, PRB_FLAG_PUSH_DATA);
+	/*
+	 * Determine the snaplen by checking the fd
+	 */
+#ifdef __x86_64__
+	syscall_get_arguments(current, args->regs, 0, 1, &val);
+	snaplen = get_snaplen(args, (int)val);
+#else
+	snaplen = get_snaplen(args, (int)args->socketcall_args[0]);
+#endif
+
+	res = parse_readv_writev_bufs(args, iov, iovcnt, LLONG_MAX, snaplen, PRB_FLAG_PUSH_DATA);
 	if (unlikely(res != PPM_SUCCESS))
 		return res;
 
@@ -1589,6 +1728,7 @@ static int f_sys_recvmsg_x(struct event_filler_arguments *args)
 	const struct iovec __user *iov;
 	unsigned long iovcnt;
 	struct msghdr mh;
+	unsigned int snaplen;
 	char *targetbuf = args->str_storage;
 	int fd;
 	struct sockaddr __user *usrsockaddr;
@@ -1623,7 +1763,17 @@ static int f_sys_recvmsg_x(struct event_filler_arguments *args)
 	iov = (const struct iovec __user *)mh.msg_iov;
 	iovcnt = mh.msg_iovlen;
 
-	res = parse_readv_writev_bufs(args, iov, iovcnt, retval, PRB_FLAG_PUSH_ALL);
+	/*
+	 * Determine the snaplen by checking the fd
+	 */
+#ifdef __x86_64__
+	syscall_get_arguments(current, args->regs, 0, 1, &val);
+	snaplen = get_snaplen(args, (int)val);
+#else
+	snaplen = get_snaplen(args, (int)args->socketcall_args[0]);
+#endif
+
+	res = parse_readv_writev_bufs(args, iov, iovcnt, retval, snaplen, PRB_FLAG_PUSH_ALL);
 	if (unlikely(res != PPM_SUCCESS))
 		return res;
 
@@ -1661,6 +1811,7 @@ static int f_sys_recvmsg_x(struct event_filler_arguments *args)
 					addrlen,
 					true,
 					true,
+					true,
 					targetbuf,
 					STR_STORAGE_SIZE);
 			}
@@ -2244,6 +2395,7 @@ static int f_sys_readv_x(struct event_filler_arguments *args)
 	int res;
 	const struct iovec __user *iov;
 	unsigned long iovcnt;
+	unsigned int snaplen;
 
 	/*
 	 * res
@@ -2260,7 +2412,13 @@ static int f_sys_readv_x(struct event_filler_arguments *args)
 	iov = (const struct iovec __user *)val;
 	syscall_get_arguments(current, args->regs, 2, 1, &iovcnt);
 
-	res = parse_readv_writev_bufs(args, iov, iovcnt, retval, PRB_FLAG_PUSH_ALL);
+	/*
+	 * Determine the snaplen by checking the fd
+	 */
+	syscall_get_arguments(current, args->regs, 0, 1, &val);
+	snaplen = get_snaplen(args, (int)val);
+
+	res = parse_readv_writev_bufs(args, iov, iovcnt, retval, snaplen, PRB_FLAG_PUSH_ALL);
 	if (unlikely(res != PPM_SUCCESS))
 		return res;
 
@@ -2273,7 +2431,6 @@ static int f_sys_writev_e(struct event_filler_arguments *args)
 	int res;
 	const struct iovec __user *iov;
 	unsigned long iovcnt;
-	unsigned int snaplen;
 
 	/*
 	 * fd
@@ -2290,34 +2447,7 @@ static int f_sys_writev_e(struct event_filler_arguments *args)
 	iov = (const struct iovec __user *)val;
 	syscall_get_arguments(current, args->regs, 2, 1, &iovcnt);
 
-	/*
-	 * Determine the snaplen by checking the fd type.
-	 * (note: not implemeted yet)
-	 */
-	snaplen = g_snaplen;
-#if 0
-	{
-		int fd;
-		int err, fput_needed;
-		struct socket *sock;
-
-		syscall_get_arguments(current, args->regs, 0, 1, &val);
-		fd = (int)val;
-
-		sock = ppm_sockfd_lookup_light(fd, &err, &fput_needed);
-		if (sock) {
-			snaplen = g_snaplen;
-			fput_light(sock->file, fput_needed);
-		} else {
-			snaplen = RW_SNAPLEN;
-		}
-	}
-#endif
-
-	/*
-	 * Copy the buffer
-	 */
-	res = parse_readv_writev_bufs(args, iov, iovcnt, snaplen, PRB_FLAG_PUSH_SIZE);
+	res = parse_readv_writev_bufs(args, iov, iovcnt, 0, 0, PRB_FLAG_PUSH_SIZE);
 	if (unlikely(res != PPM_SUCCESS))
 		return res;
 
@@ -2331,6 +2461,7 @@ static int f_sys_writev_pwritev_x(struct event_filler_arguments *args)
 	int64_t retval;
 	const struct iovec __user *iov;
 	unsigned long iovcnt;
+	unsigned long fd;
 	unsigned int snaplen;
 
 	/*
@@ -2349,33 +2480,15 @@ static int f_sys_writev_pwritev_x(struct event_filler_arguments *args)
 	syscall_get_arguments(current, args->regs, 2, 1, &iovcnt);
 
 	/*
-	 * Determine the snaplen by checking the fd type.
-	 * (note: not implemeted yet)
+	 * Determine the snaplen by checking the fd
 	 */
-	snaplen = g_snaplen;
-#if 0
-	{
-		int fd;
-		int err, fput_needed;
-		struct socket *sock;
-
-		syscall_get_arguments(current, args->regs, 0, 1, &val);
-		fd = (int)val;
-
-		sock = ppm_sockfd_lookup_light(fd, &err, &fput_needed);
-		if (sock) {
-			snaplen = g_snaplen;
-			fput_light(sock->file, fput_needed);
-		} else {
-			snaplen = RW_SNAPLEN;
-		}
-	}
-#endif
+	syscall_get_arguments(current, args->regs, 0, 1, &fd);
+	snaplen = get_snaplen(args, (int)fd);
 
 	/*
 	 * Copy the buffer
 	 */
-	res = parse_readv_writev_bufs(args, iov, iovcnt, snaplen, PRB_FLAG_PUSH_DATA);
+	res = parse_readv_writev_bufs(args, iov, iovcnt, LLONG_MAX, snaplen, PRB_FLAG_PUSH_DATA);
 	if (unlikely(res != PPM_SUCCESS))
 		return res;
 
@@ -2422,6 +2535,7 @@ static int f_sys_preadv_x(struct event_filler_arguments *args)
 	int res;
 	const struct iovec __user *iov;
 	unsigned long iovcnt;
+	unsigned int snaplen;
 
 	/*
 	 * res
@@ -2438,7 +2552,13 @@ static int f_sys_preadv_x(struct event_filler_arguments *args)
 	iov = (const struct iovec __user *)val;
 	syscall_get_arguments(current, args->regs, 2, 1, &iovcnt);
 
-	res = parse_readv_writev_bufs(args, iov, iovcnt, retval, PRB_FLAG_PUSH_ALL);
+	/*
+	 * Determine the snaplen by checking the fd
+	 */
+	syscall_get_arguments(current, args->regs, 0, 1, &val);
+	snaplen = get_snaplen(args, (int)val);
+
+	res = parse_readv_writev_bufs(args, iov, iovcnt, retval, snaplen, PRB_FLAG_PUSH_ALL);
 	if (unlikely(res != PPM_SUCCESS))
 		return res;
 
@@ -2456,7 +2576,6 @@ static int f_sys_pwritev_e(struct event_filler_arguments *args)
 #endif
 	const struct iovec __user *iov;
 	unsigned long iovcnt;
-	unsigned int snaplen;
 
 	/*
 	 * fd
@@ -2473,34 +2592,7 @@ static int f_sys_pwritev_e(struct event_filler_arguments *args)
 	iov = (const struct iovec __user *)val;
 	syscall_get_arguments(current, args->regs, 2, 1, &iovcnt);
 
-	/*
-	 * Determine the snaplen by checking the fd type.
-	 * (note: not implemeted yet)
-	 */
-	snaplen = g_snaplen;
-#if 0
-	{
-		int fd;
-		int err, fput_needed;
-		struct socket *sock;
-
-		syscall_get_arguments(current, args->regs, 0, 1, &val);
-		fd = (int)val;
-
-		sock = ppm_sockfd_lookup_light(fd, &err, &fput_needed);
-		if (sock) {
-			snaplen = g_snaplen;
-			fput_light(sock->file, fput_needed);
-		} else {
-			snaplen = RW_SNAPLEN;
-		}
-	}
-#endif
-
-	/*
-	 * Copy the buffer
-	 */
-	res = parse_readv_writev_bufs(args, iov, iovcnt, snaplen, PRB_FLAG_PUSH_SIZE);
+	res = parse_readv_writev_bufs(args, iov, iovcnt, 0, 0, PRB_FLAG_PUSH_SIZE);
 	if (unlikely(res != PPM_SUCCESS))
 		return res;
 
@@ -2808,6 +2900,154 @@ static int f_sched_switch_e(struct event_filler_arguments *args)
 	return add_sentinel(args);
 }
 
+static int f_sched_switch_summary_e(struct event_filler_arguments *args)
+{
+	int res;
+	struct task_struct *prev = args->sched_prev;
+
+	if (prev == NULL) {
+		ASSERT(false);
+		return -1;
+	}
+
+	/*
+	 * exectime
+	 */
+	res = val_to_ring(args, prev->se.sum_exec_runtime, 0, false);
+	if (unlikely(res != PPM_SUCCESS))
+		return res;
+
+	/*
+	 * vcsw
+	 */
+	res = val_to_ring(args, prev->nvcsw, 0, false);
+	if (unlikely(res != PPM_SUCCESS))
+		return res;
+
+	/*
+	 * ivcsw
+	 */
+	res = val_to_ring(args, prev->nivcsw, 0, false);
+	if (unlikely(res != PPM_SUCCESS))
+		return res;
+
+	return add_sentinel(args);
+}
+
+/*
+ * The waits are taken from the run queue slot of the thread, which starts
+ * counting again
+ */
+static int f_sched_runq_e(struct event_filler_arguments *args)
+{
+	int res;
+	struct task_struct *prev = args->sched_prev;
+	struct ppm_runq_slot *slot;
+	u64 delay = 0;
+	u32 waits = 0;
+	u64 max_delay = 0;
+
+	if (prev == NULL) {
+		ASSERT(false);
+		return -1;
+	}
+
+	slot = &g_runq_slots[prev->pid & (PPM_RUNQ_SLOTS - 1)];
+
+	if (slot->tid == prev->pid) {
+		delay = slot->delay_ns;
+		waits = slot->waits;
+		max_delay = slot->max_delay_ns;
+
+		slot->delay_ns = 0;
+		slot->waits = 0;
+		slot->max_delay_ns = 0;
+	}
+
+	/*
+	 * delay
+	 */
+	res = val_to_ring(args, delay, 0, false);
+	if (unlikely(res != PPM_SUCCESS))
+		return res;
+
+	/*
+	 * waits
+	 */
+	res = val_to_ring(args, waits, 0, false);
+	if (unlikely(res != PPM_SUCCESS))
+		return res;
+
+	/*
+	 * maxdelay
+	 */
+	res = val_to_ring(args, max_delay, 0, false);
+	if (unlikely(res != PPM_SUCCESS))
+		return res;
+
+	return add_sentinel(args);
+}
+
+/*
+ * The faults are the difference between the counters of the thread and the
+ * ones in its page fault slot, which are moved forward
+ */
+static int f_sched_pgfault_e(struct event_filler_arguments *args)
+{
+	int res;
+	struct task_struct *prev = args->sched_prev;
+	struct ppm_pgfault_slot *slot;
+	unsigned long maj_flt;
+	unsigned long min_flt;
+	unsigned long addr = 0;
+
+	if (prev == NULL) {
+		ASSERT(false);
+		return -1;
+	}
+
+	maj_flt = prev->maj_flt;
+	min_flt = prev->min_flt;
+	slot = &g_pgfault_slots[prev->pid & (PPM_PGFAULT_SLOTS - 1)];
+
+	if (slot->tid == prev->pid) {
+		unsigned long last_maj_flt = slot->maj_flt;
+		unsigned long last_min_flt = slot->min_flt;
+
+		addr = slot->addr;
+
+		slot->maj_flt = maj_flt;
+		slot->min_flt = min_flt;
+		slot->addr = 0;
+
+		maj_flt -= last_maj_flt;
+		min_flt -= last_min_flt;
+	}
+
+	/*
+	 * maj
+	 */
+	res = val_to_ring(args, maj_flt, 0, false);
+	if (unlikely(res != PPM_SUCCESS))
+		return res;
+
+	/*
+	 * min
+	 */
+	res = val_to_ring(args, min_flt, 0, false);
+	if (unlikely(res != PPM_SUCCESS))
+		return res;
+
+	/*
+	 * addr
+	 */
+	res = val_to_ring(args, addr, 0, false);
+	if (unlikely(res != PPM_SUCCESS))
+		return res;
+
+	return add_sentinel(args);
+}
+
 #if 0
 static int f_sched_switchex_e(struct event_filler_arguments *args)
 {
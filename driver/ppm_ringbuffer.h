@@ -23,20 +23,64 @@ along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
 #include <linux/types.h>
 #endif
 
-static const __u32 RING_BUF_SIZE = 1024 * 1024;
+/*
+ * Default size of the per-CPU ring buffers. It can be changed at module load
+ * time (or through sysfs, before the capture starts) with the ring_buf_size
+ * module parameter. The size must be a multiple of the page size.
+ */
+static const __u32 DEFAULT_RING_BUF_SIZE = 1024 * 1024;
+static const __u32 MAX_RING_BUF_SIZE = 256 * 1024 * 1024;
 static const __u32 MIN_USERSPACE_READ_SIZE = 128 * 1024;
 
 /*
- * This gets mapped to user level, so we want to keep it as clean as possible
+ * Default amount of data that must be in a ring buffer before a reader
+ * waiting in poll() is woken up. It can be changed with
+ * PPM_IOCTL_SET_WAKEUP_WATERMARK.
  */
-struct ppm_ring_buffer_info {
-	volatile __u32 head;
-	volatile __u32 tail;
+static const __u32 DEFAULT_WAKEUP_WATERMARK = 1;
+
+/*
+ * Ring statistics, updated by the driver
+ */
+struct ppm_ring_buffer_stats {
 	volatile __u64 n_evts;			/* Total number of events that were received by the driver. */
 	volatile __u64 n_drops_buffer;		/* Number of dropped events (buffer full). */
 	volatile __u64 n_drops_pf;		/* Number of dropped events (page faults). */
 	volatile __u64 n_preemptions;		/* Number of preemptions. */
 	volatile __u64 n_context_switches;	/* Number of received context switch events. */
+	volatile __u64 n_copy_bytes;		/* Bytes of user memory copied into the ring. */
+	volatile __s32 numa_node;		/* NUMA node the ring was allocated on, -1 if not known. */
+	volatile __u32 placement;		/* PPM_RING_* flags describing how the ring was allocated. */
 };
 
+/*
+ * Layout of ppm_ring_buffer_info, returned by PPM_IOCTL_GET_RING_INFO_VERSION.
+ * Drivers without the ioctl use version 1, where head, tail and the stats
+ * are packed together: head at offset 0, tail at offset 4 and the stats at
+ * offset 8.
+ */
+#define PPM_RING_INFO_VERSION 2
+#define PPM_RING_INFO_LINE_SIZE 64
+
+/*
+ * This gets mapped to user level, so we want to keep it as clean as possible.
+ * head is only written by the driver and tail only by the reader, so they
+ * are on different cache lines: otherwise every tail update of the reader
+ * would take the line away from the CPU writing the events. The stats are
+ * on a third line, since the reader seldom looks at them.
+ */
+struct ppm_ring_buffer_info {
+	volatile __u32 head;
+	__u8 head_pad[PPM_RING_INFO_LINE_SIZE - sizeof(__u32)];
+	volatile __u32 tail;
+	__u8 tail_pad[PPM_RING_INFO_LINE_SIZE - sizeof(__u32)];
+	struct ppm_ring_buffer_stats stats;
+};
+
+/*
+ * Ring placement flags
+ */
+#define PPM_RING_NODE_LOCAL (1 << 0)	/* The ring is on the node of its CPU. */
+#define PPM_RING_CONTIGUOUS (1 << 1)	/* The data area is physically contiguous and the driver writes it through the large pages of the kernel linear mapping. */
+
 #endif /* PPM_H_ */
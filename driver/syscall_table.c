@@ -28,6 +28,9 @@ along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
 #include <asm/syscall.h>
 #include <net/sock.h>
 #include <asm/unistd.h>
+#ifdef CONFIG_IA32_EMULATION
+#include <asm/ia32_unistd.h>
+#endif
 
 #include "ppm_ringbuffer.h"
 #include "ppm_events_public.h"
@@ -517,3 +520,43 @@ const enum ppm_syscall_code g_syscall_code_routing_table[SYSCALL_TABLE_SIZE] = {
 	[__NR_pwrite64] = PPM_SC_PWRITE64,
 #endif /* __x86_64__ */
 };
+
+#ifdef CONFIG_IA32_EMULATION
+/*
+ * 32BIT COMPAT SYSCALL MAP
+ * The system calls of the 32bit processes running on a 64bit kernel, mapped
+ * to the 64bit numbers so that they use the tables above. Only the calls
+ * whose arguments are decoded the same way in both ABIs are here: the
+ * fillers read them as 64bit values, so negative integers, like AT_FDCWD,
+ * and pointers to compat structures would come out wrong. The others are -1
+ * and their events are not captured.
+ */
+const s16 g_syscall_ia32_64_map[SYSCALL_TABLE_SIZE] = {
+	[0 ... SYSCALL_TABLE_SIZE - 1] = -1,
+	[__NR_ia32_read] = __NR_read,
+	[__NR_ia32_write] = __NR_write,
+	[__NR_ia32_open] = __NR_open,
+	[__NR_ia32_close] = __NR_close,
+	[__NR_ia32_creat] = __NR_creat,
+	[__NR_ia32_link] = __NR_link,
+	[__NR_ia32_unlink] = __NR_unlink,
+	[__NR_ia32_execve] = __NR_execve,
+	[__NR_ia32_chdir] = __NR_chdir,
+	[__NR_ia32_fchdir] = __NR_fchdir,
+	[__NR_ia32_mkdir] = __NR_mkdir,
+	[__NR_ia32_rmdir] = __NR_rmdir,
+	[__NR_ia32_dup] = __NR_dup,
+	[__NR_ia32_dup2] = __NR_dup2,
+	[__NR_ia32_dup3] = __NR_dup3,
+	[__NR_ia32_pipe] = __NR_pipe,
+	[__NR_ia32_pipe2] = __NR_pipe2,
+	[__NR_ia32_brk] = __NR_brk,
+	[__NR_ia32_eventfd] = __NR_eventfd,
+	[__NR_ia32_eventfd2] = __NR_eventfd2,
+	[__NR_ia32_clone] = __NR_clone,
+	[__NR_ia32_fork] = __NR_fork,
+	[__NR_ia32_fcntl] = __NR_fcntl,
+	[__NR_ia32_getcwd] = __NR_getcwd,
+	[__NR_ia32_ioctl] = __NR_ioctl,
+};
+#endif /* CONFIG_IA32_EMULATION */
@@ -0,0 +1,203 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//
+// Compares the event consumption speed of scap_next() and scap_next_batch().
+// For each round, one thread per CPU generates system calls while the capture
+// is running and nobody reads the buffers. The capture is then stopped and
+// the buffered events are consumed with the method under test, so only the
+// consumer cost is measured.
+//
+// Usage: scap-nextbatch [ring buffer size] [workload duration in ms] [rounds]
+//
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/time.h>
+
+#include <scap.h>
+
+#define BATCH_SIZE 256
+
+volatile int g_stop_workload = 0;
+
+static uint64_t get_time_us()
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static void* workload_thread(void* arg)
+{
+	long cpu = (long)arg;
+	cpu_set_t cpuset;
+
+	CPU_ZERO(&cpuset);
+	CPU_SET(cpu, &cpuset);
+	pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+
+	while(!g_stop_workload)
+	{
+		close(-1);
+	}
+
+	return NULL;
+}
+
+//
+// Fill the buffers running the workload on every CPU, then stop the capture
+//
+static int32_t fill_buffers(scap_t* h, uint32_t ndevs, uint32_t duration_ms)
+{
+	uint32_t j;
+	pthread_t threads[256];
+
+	g_stop_workload = 0;
+
+	if(scap_start_capture(h) != SCAP_SUCCESS)
+	{
+		return SCAP_FAILURE;
+	}
+
+	for(j = 0; j < ndevs; j++)
+	{
+		pthread_create(&threads[j], NULL, workload_thread, (void*)(long)j);
+	}
+
+	usleep(duration_ms * 1000);
+	g_stop_workload = 1;
+
+	for(j = 0; j < ndevs; j++)
+	{
+		pthread_join(threads[j], NULL);
+	}
+
+	return scap_stop_capture(h);
+}
+
+static int32_t drain_single(scap_t* h, uint64_t* nevts)
+{
+	int32_t res;
+	scap_evt* ev;
+	uint16_t cpuid;
+
+	*nevts = 0;
+
+	while((res = scap_next(h, &ev, &cpuid)) == SCAP_SUCCESS)
+	{
+		(*nevts)++;
+	}
+
+	return (res == SCAP_TIMEOUT)? SCAP_SUCCESS : res;
+}
+
+static int32_t drain_batch(scap_t* h, uint64_t* nevts)
+{
+	int32_t res;
+	scap_evt* evs[BATCH_SIZE];
+	uint16_t cpuids[BATCH_SIZE];
+	uint32_t n;
+
+	*nevts = 0;
+
+	while((res = scap_next_batch(h, evs, cpuids, BATCH_SIZE, &n)) == SCAP_SUCCESS)
+	{
+		*nevts += n;
+	}
+
+	return (res == SCAP_TIMEOUT)? SCAP_SUCCESS : res;
+}
+
+static int run_round(scap_t* h, uint32_t ndevs, uint32_t duration_ms, int batch)
+{
+	uint64_t nevts;
+	uint64_t start;
+	uint64_t delta;
+	int32_t res;
+
+	if(fill_buffers(h, ndevs, duration_ms) != SCAP_SUCCESS)
+	{
+		fprintf(stderr, "%s\n", scap_getlasterr(h));
+		return -1;
+	}
+
+	start = get_time_us();
+	res = batch? drain_batch(h, &nevts) : drain_single(h, &nevts);
+	delta = get_time_us() - start;
+
+	if(res != SCAP_SUCCESS)
+	{
+		fprintf(stderr, "%s\n", scap_getlasterr(h));
+		return -1;
+	}
+
+	printf("%-16s evts:%" PRIu64 " time:%" PRIu64 "us evts/s:%" PRIu64 "\n",
+		batch? "scap_next_batch" : "scap_next",
+		nevts,
+		delta,
+		delta? nevts * 1000000 / delta : 0);
+
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	char error[SCAP_LASTERR_SIZE];
+	uint32_t ring_buf_size = (argc > 1)? atoi(argv[1]) : 0;
+	uint32_t duration_ms = (argc > 2)? atoi(argv[2]) : 500;
+	uint32_t nrounds = (argc > 3)? atoi(argv[3]) : 3;
+	uint32_t ndevs;
+	uint32_t j;
+
+	scap_t* h = scap_open_live_ex(error, ring_buf_size);
+	if(h == NULL)
+	{
+		fprintf(stderr, "%s\n", error);
+		return -1;
+	}
+
+	ndevs = scap_get_ndevs(h);
+	if(ndevs > 256)
+	{
+		fprintf(stderr, "too many devices %u\n", ndevs);
+		scap_close(h);
+		return -1;
+	}
+
+	printf("%u CPUs, workload %ums per round\n", ndevs, duration_ms);
+
+	for(j = 0; j < nrounds; j++)
+	{
+		if(run_round(h, ndevs, duration_ms, 0) != 0 ||
+			run_round(h, ndevs, duration_ms, 1) != 0)
+		{
+			scap_close(h);
+			return -1;
+		}
+	}
+
+	scap_close(h);
+	return 0;
+}
@@ -0,0 +1,85 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//
+// Attaches to the event tap of a running capture (for example
+// sysdig --tap=<name>) and prints, every second, how many events were read
+// and how many were lost because this reader was too slow.
+//
+// Usage: scap-tap <tap name>
+//
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <scap.h>
+
+int main(int argc, char** argv)
+{
+	char error[SCAP_LASTERR_SIZE];
+	scap_tap_reader* r;
+	scap_evt* ev;
+	uint16_t cpuid;
+	uint64_t nevts = 0;
+	time_t last = time(NULL);
+	int32_t res;
+
+	if(argc < 2)
+	{
+		fprintf(stderr, "usage: %s <tap name>\n", argv[0]);
+		return -1;
+	}
+
+	r = scap_tap_attach(argv[1], error);
+	if(r == NULL)
+	{
+		fprintf(stderr, "%s\n", error);
+		return -1;
+	}
+
+	while(1)
+	{
+		res = scap_tap_next(r, &ev, &cpuid);
+
+		if(res == SCAP_SUCCESS)
+		{
+			nevts++;
+		}
+		else if(res == SCAP_TIMEOUT)
+		{
+			usleep(1000);
+		}
+		else
+		{
+			break;
+		}
+
+		if(time(NULL) != last)
+		{
+			last = time(NULL);
+			printf("evts:%" PRIu64 " lost:%" PRIu64 "\n", nevts, scap_tap_get_lost(r));
+		}
+	}
+
+	printf("evts:%" PRIu64 " lost:%" PRIu64 "\n", nevts, scap_tap_get_lost(r));
+
+	scap_tap_detach(r);
+	return (res == SCAP_EOF)? 0 : -1;
+}
@@ -0,0 +1,31 @@
+#!/bin/sh
+#
+# Measures the overhead of the driver for each workload: with the module
+# unloaded, loaded but idle, and capturing with a range of ring buffer sizes
+# and consumer speeds. Must run as root.
+#
+# Usage: run.sh <scap-overhead> <sysdig-probe.ko> [duration in ms] [threads]
+#
+
+set -e
+
+OVERHEAD=$1
+PROBE=$2
+DURATION=${3:-1000}
+THREADS=${4:-1}
+RING_SIZES=1m,8m,32m
+CONSUMER_NS=0,100,1000
+
+if [ -z "$OVERHEAD" ] || [ -z "$PROBE" ]; then
+	echo "usage: $0 <scap-overhead> <sysdig-probe.ko> [duration in ms] [threads]" >&2
+	exit 1
+fi
+
+for WORKLOAD in open "rw -s 64" "rw -s 4096" "rw -s 65536" connect clone; do
+	rmmod sysdig_probe 2>/dev/null || true
+	$OVERHEAD -T $DURATION -t $THREADS -w $WORKLOAD
+
+	insmod $PROBE
+	$OVERHEAD -T $DURATION -t $THREADS -w $WORKLOAD -c -b $RING_SIZES -d $CONSUMER_NS
+	echo
+done
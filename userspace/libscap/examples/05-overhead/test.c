@@ -0,0 +1,594 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//
+// Measures the overhead that the driver adds to the system calls. A load
+// generator runs tight loops of one kind of system call on a number of
+// threads, and the throughput is compared with and without a capture.
+//
+// Without -c, the workload runs alone, and the report says whether the
+// driver is loaded, so that run.sh can measure the module unloaded and
+// loaded but idle.
+// With -c, the workload first runs without a capture, as a baseline, and
+// then with a capture for each ring buffer size given with -b and each
+// consumer speed given with -d. A consumer thread reads the events, and
+// spins for the given nanoseconds on each of them to simulate a slower
+// consumer. For each combination the report has the throughput, the added
+// cost per system call, the drop rate, and the average time spent by the
+// driver in record_event() and in the fillers, from the detailed stats.
+//
+// Workloads:
+//  - open: open() and close() of /dev/null
+//  - rw: write() and read() of -s bytes on a pipe
+//  - connect: socket(), connect() and accept() on loopback, and the two
+//    close()
+//  - clone: fork() of a process that exits right away, and wait4()
+//
+// Usage: scap-overhead [-w open|rw|connect|clone] [-s io size] [-t threads]
+//                      [-T duration in ms] [-c] [-b ring size,...]
+//                      [-d consumer ns per event,...]
+//
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <scap.h>
+
+#define MAX_THREADS 256
+#define MAX_CONFIGS 16
+#define MAX_IO_SIZE (64 * 1024)
+
+enum workload_type
+{
+	WL_OPEN,
+	WL_RW,
+	WL_CONNECT,
+	WL_CLONE,
+};
+
+static const char* g_workload_names[] = {"open", "rw", "connect", "clone"};
+
+//
+// System calls done by one iteration of each workload
+//
+static const uint32_t g_workload_syscalls[] = {2, 2, 5, 3};
+
+struct workload_thread
+{
+	pthread_t m_thread;
+	enum workload_type m_type;
+	uint32_t m_io_size;
+	uint64_t m_nops;
+	int m_error;
+};
+
+volatile int g_stop_workload = 0;
+volatile int g_stop_consumer = 0;
+
+static uint64_t get_time_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void spin(uint64_t ns)
+{
+	uint64_t end = get_time_ns() + ns;
+
+	while(get_time_ns() < end)
+	{
+	}
+}
+
+static void run_open(struct workload_thread* wt)
+{
+	while(!g_stop_workload)
+	{
+		int fd = open("/dev/null", O_RDONLY);
+
+		if(fd < 0)
+		{
+			wt->m_error = 1;
+			return;
+		}
+
+		close(fd);
+		wt->m_nops++;
+	}
+}
+
+static void run_rw(struct workload_thread* wt)
+{
+	int fds[2];
+	char* buf = malloc(wt->m_io_size);
+
+	if(buf == NULL || pipe(fds) != 0)
+	{
+		free(buf);
+		wt->m_error = 1;
+		return;
+	}
+
+	memset(buf, 'a', wt->m_io_size);
+
+	while(!g_stop_workload)
+	{
+		if(write(fds[1], buf, wt->m_io_size) != (ssize_t)wt->m_io_size ||
+			read(fds[0], buf, wt->m_io_size) != (ssize_t)wt->m_io_size)
+		{
+			wt->m_error = 1;
+			break;
+		}
+
+		wt->m_nops++;
+	}
+
+	close(fds[0]);
+	close(fds[1]);
+	free(buf);
+}
+
+static void run_connect(struct workload_thread* wt)
+{
+	struct sockaddr_in sa;
+	socklen_t salen = sizeof(sa);
+	struct linger lin;
+	int ls;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	ls = socket(AF_INET, SOCK_STREAM, 0);
+	if(ls < 0 ||
+		bind(ls, (struct sockaddr*)&sa, sizeof(sa)) != 0 ||
+		listen(ls, 16) != 0 ||
+		getsockname(ls, (struct sockaddr*)&sa, &salen) != 0)
+	{
+		if(ls >= 0)
+		{
+			close(ls);
+		}
+
+		wt->m_error = 1;
+		return;
+	}
+
+	//
+	// The client closes first with a reset, so that the connections don't
+	// pile up in TIME_WAIT
+	//
+	lin.l_onoff = 1;
+	lin.l_linger = 0;
+
+	while(!g_stop_workload)
+	{
+		int cs = socket(AF_INET, SOCK_STREAM, 0);
+		int as;
+
+		if(cs < 0)
+		{
+			wt->m_error = 1;
+			break;
+		}
+
+		setsockopt(cs, SOL_SOCKET, SO_LINGER, &lin, sizeof(lin));
+
+		if(connect(cs, (struct sockaddr*)&sa, sizeof(sa)) != 0 ||
+			(as = accept(ls, NULL, NULL)) < 0)
+		{
+			close(cs);
+			wt->m_error = 1;
+			break;
+		}
+
+		close(cs);
+		close(as);
+		wt->m_nops++;
+	}
+
+	close(ls);
+}
+
+static void run_clone(struct workload_thread* wt)
+{
+	while(!g_stop_workload)
+	{
+		pid_t pid = fork();
+
+		if(pid == 0)
+		{
+			_exit(0);
+		}
+		else if(pid < 0)
+		{
+			wt->m_error = 1;
+			return;
+		}
+
+		waitpid(pid, NULL, 0);
+		wt->m_nops++;
+	}
+}
+
+static void* workload_main(void* arg)
+{
+	struct workload_thread* wt = (struct workload_thread*)arg;
+
+	switch(wt->m_type)
+	{
+	case WL_OPEN:
+		run_open(wt);
+		break;
+	case WL_RW:
+		run_rw(wt);
+		break;
+	case WL_CONNECT:
+		run_connect(wt);
+		break;
+	case WL_CLONE:
+		run_clone(wt);
+		break;
+	}
+
+	return NULL;
+}
+
+//
+// Run the workload on nthreads threads for duration_ms. Returns the number
+// of system calls per second, or 0 if the workload failed.
+//
+static double run_workload(enum workload_type type, uint32_t io_size, uint32_t nthreads, uint32_t duration_ms)
+{
+	struct workload_thread threads[MAX_THREADS];
+	uint64_t nops = 0;
+	uint64_t start;
+	uint64_t delta;
+	uint32_t j;
+
+	g_stop_workload = 0;
+	start = get_time_ns();
+
+	for(j = 0; j < nthreads; j++)
+	{
+		threads[j].m_type = type;
+		threads[j].m_io_size = io_size;
+		threads[j].m_nops = 0;
+		threads[j].m_error = 0;
+		pthread_create(&threads[j].m_thread, NULL, workload_main, &threads[j]);
+	}
+
+	usleep(duration_ms * 1000);
+	g_stop_workload = 1;
+
+	for(j = 0; j < nthreads; j++)
+	{
+		pthread_join(threads[j].m_thread, NULL);
+
+		if(threads[j].m_error)
+		{
+			fprintf(stderr, "the %s workload failed\n", g_workload_names[type]);
+			return 0;
+		}
+
+		nops += threads[j].m_nops;
+	}
+
+	delta = get_time_ns() - start;
+	return (double)nops * g_workload_syscalls[type] * 1000000000 / delta;
+}
+
+struct consumer
+{
+	scap_t* m_h;
+	uint64_t m_delay_ns;
+	uint64_t m_nevts;
+};
+
+static void* consumer_main(void* arg)
+{
+	struct consumer* c = (struct consumer*)arg;
+	scap_evt* ev;
+	uint16_t cpuid;
+
+	while(1)
+	{
+		int32_t res = scap_next(c->m_h, &ev, &cpuid);
+
+		if(res == SCAP_SUCCESS)
+		{
+			c->m_nevts++;
+
+			if(c->m_delay_ns != 0)
+			{
+				spin(c->m_delay_ns);
+			}
+		}
+		else if(res == SCAP_TIMEOUT)
+		{
+			if(g_stop_consumer)
+			{
+				break;
+			}
+		}
+		else
+		{
+			fprintf(stderr, "%s\n", scap_getlasterr(c->m_h));
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+//
+// Run the workload with a capture, and print a line of the report
+//
+static int run_capture(enum workload_type type, uint32_t io_size, uint32_t nthreads, uint32_t duration_ms,
+	uint32_t ring_size, uint64_t delay_ns, double baseline)
+{
+	char error[SCAP_LASTERR_SIZE];
+	struct ppm_detailed_stats* dstats;
+	struct consumer c;
+	pthread_t consumer_thread;
+	scap_stats stats;
+	uint64_t nevts = 0;
+	uint64_t record_ns = 0;
+	uint64_t filler_ns = 0;
+	double rate;
+	uint32_t j;
+
+	c.m_h = scap_open_live_flags(error, ring_size, SCAP_OPEN_SKIP_PROC_SCAN);
+	if(c.m_h == NULL)
+	{
+		fprintf(stderr, "%s\n", error);
+		return -1;
+	}
+
+	c.m_delay_ns = delay_ns;
+	c.m_nevts = 0;
+
+	if(scap_enable_detailed_stats(c.m_h, true) != SCAP_SUCCESS)
+	{
+		fprintf(stderr, "%s\n", scap_getlasterr(c.m_h));
+		scap_close(c.m_h);
+		return -1;
+	}
+
+	g_stop_consumer = 0;
+	pthread_create(&consumer_thread, NULL, consumer_main, &c);
+
+	rate = run_workload(type, io_size, nthreads, duration_ms);
+
+	scap_stop_capture(c.m_h);
+	g_stop_consumer = 1;
+	pthread_join(consumer_thread, NULL);
+
+	dstats = malloc(sizeof(struct ppm_detailed_stats));
+
+	if(dstats == NULL ||
+		scap_get_stats(c.m_h, &stats) != SCAP_SUCCESS ||
+		scap_get_detailed_stats(c.m_h, -1, dstats) != SCAP_SUCCESS)
+	{
+		fprintf(stderr, "%s\n", scap_getlasterr(c.m_h));
+		free(dstats);
+		scap_close(c.m_h);
+		return -1;
+	}
+
+	for(j = 0; j < PPM_EVENT_MAX; j++)
+	{
+		nevts += dstats->evts[j].n_evts + dstats->evts[j].n_drops;
+		record_ns += dstats->evts[j].record_ns;
+		filler_ns += dstats->evts[j].filler_ns;
+	}
+
+	printf("%-10u %-10" PRIu64 " %-12.0f %-12.1f %-12" PRIu64 " %-8.2f %-12.1f %.1f\n",
+		ring_size,
+		delay_ns,
+		rate,
+		(rate != 0 && baseline != 0)? 1000000000 / rate - 1000000000 / baseline : 0,
+		stats.n_evts,
+		stats.n_evts? (double)stats.n_drops * 100 / stats.n_evts : 0,
+		nevts? (double)record_ns / nevts : 0,
+		nevts? (double)filler_ns / nevts : 0);
+
+	free(dstats);
+	scap_close(c.m_h);
+	return (rate == 0)? -1 : 0;
+}
+
+//
+// Return 1 if the driver is loaded
+//
+static int is_driver_loaded()
+{
+	FILE* f = fopen("/proc/modules", "r");
+	char line[512];
+	int res = 0;
+
+	if(f == NULL)
+	{
+		return 0;
+	}
+
+	while(fgets(line, sizeof(line), f) != NULL)
+	{
+		if(strncmp(line, "sysdig_probe ", sizeof("sysdig_probe ") - 1) == 0)
+		{
+			res = 1;
+			break;
+		}
+	}
+
+	fclose(f);
+	return res;
+}
+
+//
+// Parse a comma separated list of numbers, with an optional k or m suffix
+//
+static uint32_t parse_list(char* str, uint64_t* vals)
+{
+	uint32_t n = 0;
+	char* tok;
+
+	for(tok = strtok(str, ","); tok != NULL && n < MAX_CONFIGS; tok = strtok(NULL, ","))
+	{
+		char* end;
+		uint64_t val = strtoull(tok, &end, 10);
+
+		if(*end == 'k' || *end == 'K')
+		{
+			val *= 1024;
+		}
+		else if(*end == 'm' || *end == 'M')
+		{
+			val *= 1024 * 1024;
+		}
+
+		vals[n++] = val;
+	}
+
+	return n;
+}
+
+static void usage()
+{
+	fprintf(stderr, "usage: scap-overhead [-w open|rw|connect|clone] [-s io size] [-t threads] [-T duration in ms]\n"
+		"                     [-c] [-b ring size,...] [-d consumer ns per event,...]\n");
+}
+
+int main(int argc, char** argv)
+{
+	enum workload_type type = WL_OPEN;
+	uint32_t io_size = 1024;
+	uint32_t nthreads = 1;
+	uint32_t duration_ms = 1000;
+	int capture = 0;
+	uint64_t ring_sizes[MAX_CONFIGS] = {0};
+	uint64_t delays[MAX_CONFIGS] = {0};
+	uint32_t nring_sizes = 1;
+	uint32_t ndelays = 1;
+	double baseline;
+	uint32_t j;
+	uint32_t k;
+	int op;
+
+	while((op = getopt(argc, argv, "b:cd:s:t:T:w:")) != -1)
+	{
+		switch(op)
+		{
+		case 'b':
+			nring_sizes = parse_list(optarg, ring_sizes);
+			break;
+		case 'c':
+			capture = 1;
+			break;
+		case 'd':
+			ndelays = parse_list(optarg, delays);
+			break;
+		case 's':
+			io_size = atoi(optarg);
+			break;
+		case 't':
+			nthreads = atoi(optarg);
+			break;
+		case 'T':
+			duration_ms = atoi(optarg);
+			break;
+		case 'w':
+			for(j = 0; j < sizeof(g_workload_names) / sizeof(g_workload_names[0]); j++)
+			{
+				if(strcmp(optarg, g_workload_names[j]) == 0)
+				{
+					break;
+				}
+			}
+
+			if(j == sizeof(g_workload_names) / sizeof(g_workload_names[0]))
+			{
+				usage();
+				return -1;
+			}
+
+			type = (enum workload_type)j;
+			break;
+		default:
+			usage();
+			return -1;
+		}
+	}
+
+	if(nthreads == 0 || nthreads > MAX_THREADS ||
+		io_size == 0 || io_size > MAX_IO_SIZE ||
+		nring_sizes == 0 || ndelays == 0)
+	{
+		usage();
+		return -1;
+	}
+
+	printf("workload %s", g_workload_names[type]);
+	if(type == WL_RW)
+	{
+		printf(" (%u bytes)", io_size);
+	}
+	printf(", %u threads, %ums\n", nthreads, duration_ms);
+
+	baseline = run_workload(type, io_size, nthreads, duration_ms);
+	if(baseline == 0)
+	{
+		return -1;
+	}
+
+	printf("driver %s: %.0f syscalls/s\n", is_driver_loaded()? "loaded, idle" : "not loaded", baseline);
+
+	if(!capture)
+	{
+		return 0;
+	}
+
+	printf("%-10s %-10s %-12s %-12s %-12s %-8s %-12s %s\n",
+		"Ring", "Consumer", "Syscalls/s", "Added ns", "Evts", "Drops%", "Record ns", "Filler ns");
+
+	for(j = 0; j < nring_sizes; j++)
+	{
+		for(k = 0; k < ndelays; k++)
+		{
+			if(run_capture(type, io_size, nthreads, duration_ms, (uint32_t)ring_sizes[j], delays[k], baseline) != 0)
+			{
+				return -1;
+			}
+		}
+	}
+
+	return 0;
+}
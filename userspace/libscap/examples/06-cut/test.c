@@ -0,0 +1,141 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//
+// Concatenates, splits and slices trace files without decoding them, see
+// scap_cut_open(). The events of the input files with a timestamp between
+// -s and -e, in nanoseconds, are written to the output file, in the order of
+// the files on the command line. With -C or -G, the output is split in files
+// of at most the given MB or seconds, named like the ones of sysdig -C.
+//
+// Usage: scap-cut -w <output file> [-s start ts] [-e end ts] [-C MB]
+//                 [-G seconds] <input file> [input file...]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include <scap.h>
+
+static uint64_t get_time_us()
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static void usage()
+{
+	fprintf(stderr, "usage: scap-cut -w <output file> [-s start ts] [-e end ts] [-C MB] [-G seconds]\n"
+		"                <input file> [input file...]\n");
+}
+
+int main(int argc, char** argv)
+{
+	char error[SCAP_LASTERR_SIZE];
+	const char* outfile = NULL;
+	uint64_t start_ts = 0;
+	uint64_t end_ts = UINT64_MAX;
+	uint64_t max_bytes = 0;
+	uint64_t max_duration = 0;
+	scap_cutter_t* c;
+	scap_cut_stats stats;
+	uint64_t start_us;
+	uint64_t elapsed_us;
+	int op;
+	int j;
+
+	while((op = getopt(argc, argv, "C:e:G:s:w:")) != -1)
+	{
+		switch(op)
+		{
+		case 'C':
+			max_bytes = strtoull(optarg, NULL, 10) * 1000000;
+			break;
+		case 'e':
+			end_ts = strtoull(optarg, NULL, 10);
+			break;
+		case 'G':
+			max_duration = strtoull(optarg, NULL, 10) * 1000000000;
+			break;
+		case 's':
+			start_ts = strtoull(optarg, NULL, 10);
+			break;
+		case 'w':
+			outfile = optarg;
+			break;
+		default:
+			usage();
+			return -1;
+		}
+	}
+
+	if(outfile == NULL || optind == argc || start_ts >= end_ts)
+	{
+		usage();
+		return -1;
+	}
+
+	start_us = get_time_us();
+
+	c = scap_cut_open(outfile, max_bytes, max_duration, error);
+	if(c == NULL)
+	{
+		fprintf(stderr, "%s\n", error);
+		return -1;
+	}
+
+	for(j = optind; j < argc; j++)
+	{
+		if(scap_cut_add(c, argv[j], start_ts, end_ts, error) != SCAP_SUCCESS)
+		{
+			fprintf(stderr, "%s\n", error);
+			scap_cut_close(c, error);
+			return -1;
+		}
+	}
+
+	scap_cut_get_stats(c, &stats);
+
+	if(scap_cut_close(c, error) != SCAP_SUCCESS)
+	{
+		fprintf(stderr, "%s\n", error);
+		return -1;
+	}
+
+	elapsed_us = get_time_us() - start_us;
+
+	if(stats.n_files == 0)
+	{
+		fprintf(stderr, "no events in the time range\n");
+		return -1;
+	}
+
+	printf("%" PRIu64 " events in %u files, %" PRIu64 " bytes copied whole, %" PRIu64 " bytes decoded, %.3fs\n",
+		stats.n_evts,
+		stats.n_files,
+		stats.n_bytes_copied,
+		stats.n_bytes_decoded,
+		elapsed_us / 1000000.0);
+
+	return 0;
+}
@@ -33,12 +33,35 @@ extern "C" {
 #include <crtdbg.h>
 #endif
 #include <assert.h>
+#include <string.h>
 
 //
 // The time scap_next will wait when a buffer is empty
 //
 #define BUFFER_EMPTY_WAIT_TIME_MS 30
 
+//
+// Size of the blocks the dumper accumulates the events in before writing
+// them, unless changed with scap_dump_set_buffering()
+//
+#define SCAP_DUMP_DEFAULT_BUFFER_SIZE (1024 * 1024)
+#define SCAP_DUMP_MIN_BUFFER_SIZE (64 * 1024)
+
+//
+// Chunk size of the verbatim copies of scap_cut_add()
+//
+#define SCAP_CUT_COPY_BUF_SIZE (4 * 1024 * 1024)
+
+//
+// stdio buffer of the connections of the remote captures
+//
+#define SCAP_REMOTE_STREAM_BUF_SIZE (256 * 1024)
+
+//
+// The driver parameter that controls the size of the ring buffers
+//
+#define SCAP_RING_BUF_SIZE_PARAM "/sys/module/sysdig_probe/parameters/ring_buf_size"
+
 //
 // Process flags
 //
@@ -52,42 +75,187 @@ typedef struct scap_device
 	int m_fd;
 	char* m_buffer;
 	struct ppm_ring_buffer_info* m_bufinfo;
+	volatile uint32_t* m_head; // Fields of m_bufinfo, whose place depends on the layout of the driver. See scap_set_bufinfo_fields()
+	volatile uint32_t* m_tail;
+	struct ppm_ring_buffer_stats* m_stats;
+	uint32_t m_buffer_size; // Size of the ring buffer, as reported by the driver
 	uint32_t m_lastreadsize;
 	char* m_sn_next_event; // Pointer to the next event available for scap_next
 	uint32_t m_sn_len; // Number of bytes available in the buffer pointed by m_sn_next_event
-//	uint64_t m_sn_next_ts; // timestamp
+	uint64_t m_sn_next_ts; // Timestamp of the event pointed by m_sn_next_event, if m_sn_len is not zero
+	char* m_sn_chunk; // Start of the chunk returned by the last read, validated by scap_read_dev()
+	uint32_t* m_sn_offsets; // Offset of each event of the chunk, used to prefetch the events ahead of m_sn_next_event
+	uint32_t m_sn_offsets_size; // Number of entries allocated in m_sn_offsets
+	uint32_t m_sn_idx; // Index in m_sn_offsets of the event pointed by m_sn_next_event
+	uint32_t m_sn_nevts; // Number of events in the chunk
+	struct ppm_syscall_aggr_table* m_aggr_table; // Mapped syscall aggregation table, NULL if the aggregation is off
+	bool m_compact; // The driver writes the events in the compact encoding, and scap_readbuf decodes them
+	char* m_decode_buf; // The events of the last chunk, decoded to the normal format. m_buffer_size bytes
+	uint64_t m_compact_last_ts; // Timestamp and tid of the last decoded event, the next one is encoded against them
+	uint64_t m_compact_last_tid;
+	uint32_t m_cpuid; // CPU of the ring. Differs from the index in m_devs for the auxiliary rings
+	uint64_t m_last_ts; // Timestamp of the last event consumed, see scap_unordered_max_ts()
+	uint32_t m_idle_refills; // Consecutive refills that found the ring empty, see scap_refill_empty_devs()
+	void* m_perf_page; // Control page of the perf buffer of the eBPF engine, m_buffer follows it. NULL with the driver
 }scap_device;
 
+//
+// A metadata block of a trace file. It's brought to memory with a single
+// read and its fields are copied from there, instead of being read from the
+// file one by one.
+//
+typedef struct scap_blockbuf
+{
+	const char* m_buf;
+	uint32_t m_len;
+	uint32_t m_pos;
+}scap_blockbuf;
+
+//
+// Copy up to size bytes of the block to dst, like fread() does from a file
+//
+#ifndef _WIN32
+static inline size_t scap_blockbuf_read(void* dst, size_t size, scap_blockbuf* b)
+#else
+static size_t scap_blockbuf_read(void* dst, size_t size, scap_blockbuf* b)
+#endif
+{
+	if(size > b->m_len - b->m_pos)
+	{
+		size = b->m_len - b->m_pos;
+	}
+
+	memcpy(dst, b->m_buf + b->m_pos, size);
+	b->m_pos += size;
+	return size;
+}
+
 //
 // The open instance handle
 //
 struct scap
 {
-	scap_device* m_devs;
+	scap_device* m_devs; // The main ring of each CPU, followed by the auxiliary rings that have been enabled, m_ndevs at a time
 	struct pollfd* m_pollfds;
 	uint32_t m_ndevs;
+	uint32_t m_ring_info_version; // Layout of the ppm_ring_buffer_info of the driver, see ppm_ringbuffer.h
+	uint32_t m_nrings; // Number of entries of m_devs in use, including the auxiliary rings
+	uint32_t m_aux_rings; // Bitmask of the PPM_AUX_RING_* rings that are enabled
+	uint32_t* m_merge_heap; // Min-heap of the devices with unconsumed events, keyed on m_sn_next_ts
+	uint32_t m_merge_heap_size;
+	uint32_t* m_empty_devs; // The devices that are not in the heap
+	uint32_t m_n_empty_devs;
+	uint32_t* m_idle_devs; // The empty devices that have been idle for a while, only checked every few refills
+	uint32_t m_n_idle_devs;
+	uint32_t m_idle_check_countdown; // Refills before the next check of m_idle_devs
+	bool m_unordered; // If true, drain each buffer without merging by timestamp
+	uint32_t m_cur_dev; // Device being drained in unordered mode
+	struct scap_reader* m_readers; // Threads that read the rings for scap_next, NULL if it reads them itself. See scap_readers.c
+	uint32_t m_nreaders;
+	uint32_t m_readers_started; // Number of m_readers whose thread is running
+	uint32_t m_cur_reader; // Queue being drained in unordered mode
+	struct scap_tap* m_tap; // Shared memory the returned events are copied to, NULL if off. See scap_tap.c
+	struct scap_fold* m_fold; // Folding of the repetitive syscalls, NULL if off. See scap_fold.c
+	struct scap_proc_scan* m_proc_scan; // Background scan of /proc, NULL if none. See scap_procs.c
+	volatile bool m_proc_scan_stop; // Makes scap_proc_scan_proc_dir() on this handle give up
+	bool m_driver_fd_table; // The driver can return the fd tables, see scap_fd_read_from_driver()
+	int64_t m_state_dump_next_pid; // Where the state dump of the driver continues, -1 if there's none. See scap_continue_state_dump()
+	int64_t m_state_dump_next_fd;
+	uint32_t m_state_dump_countdown; // Events to return before continuing the state dump
+	struct scap_userlist_refresh* m_userlist_refresh; // Background refresh of m_userlist, NULL if none. See scap_userlist.c
+	uint64_t m_consumer_cpus[PPM_MAX_EXCLUDED_CPUS / 64]; // CPUs the consumer threads are pinned to, see scap_affinity.c
+	uint32_t m_consumer_ncpus; // Number of CPUs in m_consumer_cpus, 0 if the consumer is not pinned
+	bool m_consumer_excluded; // The driver discards the events of m_consumer_cpus
+	struct scap_bpf* m_bpf; // eBPF engine used instead of the driver, NULL if none. See scap_bpf.c
 	FILE* m_file;
 	char* m_file_evt_buf;
+	char* m_file_zbuf; // Last compressed frame read from m_file
+	char* m_file_block; // Metadata block of m_file being parsed, see scap_read_init()
+	uint32_t m_file_block_size;
+	char* m_file_iflist_block; // Interface list block of m_file, decoded on the first scap_get_ifaddr_list()
+	uint32_t m_file_iflist_block_len;
+	char* m_file_userlist_block; // User list block of m_file, decoded on the first scap_get_user_list()
+	uint32_t m_file_userlist_block_len;
+	uint32_t m_file_zbuf_size;
+	char* m_file_frame; // Decompressed events of m_file_zbuf
+	uint32_t m_file_frame_size;
+	uint32_t m_file_frame_len;
+	uint32_t m_file_frame_pos; // Next event block in m_file_frame_data
+	char* m_file_frame_data; // Events being returned: m_file_frame, or a buffer of m_decoders
+	struct scap_decoders* m_decoders; // Threads that decompress the frames of m_file_map ahead of scap_next, NULL if off. See scap_decoders.c
+	char* m_file_map; // Mapping of m_file the events are read from, NULL to read them with stdio
+	uint64_t m_file_map_size;
+	uint64_t m_file_map_pos; // Next block in m_file_map
+	uint64_t m_file_map_ra_pos; // End of the part of m_file_map the kernel was asked to read ahead
+	uint64_t m_file_evts_offset; // Position of the first event block in m_file
+	struct _index_entry* m_file_index; // Index block of m_file, NULL if it doesn't have one
+	uint64_t m_file_index_len;
+	bool m_file_index_loaded;
+	scap_block_summary* m_file_summaries; // One per entry of m_file_index, NULL if the index doesn't have them
+	uint64_t m_file_evts_end; // Position of the index block in m_file
+	scap_block_filter m_file_block_filter; // Set with scap_set_block_filter()
+	void* m_file_block_filter_context;
+	uint64_t m_file_next_group; // First entry of m_file_index not yet passed to m_file_block_filter
+	scap_snapshot_info* m_file_snapshots; // State snapshots of m_file, built from the index
+	uint32_t m_file_nsnapshots;
+	bool m_file_snapshots_loaded;
+	scap_evt* m_file_next_evt; // Event to return before reading the file again
+	uint16_t m_file_next_cpuid;
+	//
+	// Block header already read from a stream that can't seek back, to use
+	// before reading again, if m_file_next_block_valid
+	//
+	uint32_t m_file_next_block_type;
+	uint32_t m_file_next_block_len;
+	bool m_file_next_block_valid;
+	struct scap_follow* m_file_follow; // Set if m_file is still being written and is followed. See scap_savefile.c
+	struct scap_merge* m_merge; // Sources read together by scap_open_merge(), NULL otherwise. See scap_merge.c
 	char m_lasterr[SCAP_LASTERR_SIZE];
 	scap_threadinfo* m_proclist;
 	scap_threadinfo m_fake_kernel_proc;
 	uint64_t m_evtcnt;
 	uint32_t m_emptybuf_timeout_ms;
+	uint32_t m_max_delay_ms; // Longest wait for events that are sitting in a ring. 0 means no limit
 	scap_addrlist* m_addrlist;
 	scap_machine_info m_machine_info;
 	scap_userlist* m_userlist;
 };
 
+//
+// In unordered mode, the latest event of ring d that can be returned. The
+// driver writes a process info event after the clone or execve it belongs
+// to, with the same timestamp, so an auxiliary ring doesn't get ahead of the
+// main ring of its CPU. The main rings have no limit.
+//
+#ifndef _WIN32
+static inline uint64_t scap_unordered_max_ts(scap_t* handle, uint32_t d)
+#else
+static uint64_t scap_unordered_max_ts(scap_t* handle, uint32_t d)
+#endif
+{
+	if(d < handle->m_ndevs)
+	{
+		return (uint64_t)-1;
+	}
+
+	return handle->m_devs[d % handle->m_ndevs].m_last_ts;
+}
+
 //
 // Misc stuff
 //
 #define MEMBER_SIZE(type, member) sizeof(((type *)0)->member)
 #define FILE_READ_BUF_SIZE 65536
+#define FILE_READAHEAD_SIZE (64 * 1024 * 1024) // How much of a mapped file is read ahead of the next event
+#define FILE_READAHEAD_CHUNK_SIZE (8 * 1024 * 1024)
+#define FILE_FOLLOW_WAIT_TIME_MS 100 // Longest wait for a followed file to grow before scap_next() returns SCAP_TIMEOUT
 
 //
 // Internal library functions
 //
 
+// Print a message in an error buffer of SCAP_LASTERR_SIZE bytes, ending it with "..." if it doesn't fit
+void scap_errprintf(char* error, const char* fmt, ...);
 // Read the full event buffer for the given processor
 int32_t scap_readbuf(scap_t* handle, uint32_t proc, bool blocking, OUT char** buf, OUT uint32_t* len);
 // Scan a directory containing process information
@@ -123,8 +291,8 @@ int32_t scap_fd_info_to_string(scap_fdinfo* fdi, OUT char* str, uint32_t strlen)
 uint32_t scap_fd_info_len(scap_fdinfo* fdi);
 // Write the given fd info to disk
 int32_t scap_fd_write_to_disk(scap_t* handle, scap_fdinfo* fdi, FILE *f);
-// Populate the given fd by reading the info from disk
-uint32_t scap_fd_read_from_disk(scap_t* handle, OUT scap_fdinfo* fdi, OUT size_t* nbytes, FILE *f);
+// Populate the given fd by reading the info from a block of a trace file
+uint32_t scap_fd_read_from_disk(scap_t* handle, OUT scap_fdinfo* fdi, OUT size_t* nbytes, scap_blockbuf* b);
 // Add the file descriptor info pointed by fdi to the fd table for process pi.
 // Note: silently skips if fdi->type is SCAP_FD_UNKNOWN.
 int32_t scap_add_fd_to_proc_table(scap_t* handle, scap_threadinfo* pi, scap_fdinfo* fdi);
@@ -132,10 +300,85 @@ int32_t scap_add_fd_to_proc_table(scap_t* handle, scap_threadinfo* pi, scap_fdin
 void scap_fd_remove(scap_t* handle, scap_threadinfo* pi, int64_t fd);
 // Parse the headers of a trace file and load the tables
 int32_t scap_read_init(scap_t* handle, FILE* f);
+// Decode the interface and user list blocks that scap_read_init() kept aside
+int32_t scap_load_iflist(scap_t* handle);
+int32_t scap_load_userlist(scap_t* handle);
+// Read the events of the trace file from a mapping, if it can be mapped
+int32_t scap_read_map(scap_t* handle);
+// Unmap the events of the trace file, if they were mapped
+void scap_read_unmap(scap_t* handle);
 // Read an event from disk
 int32_t scap_next_offline(scap_t* handle, OUT scap_evt** pevent, OUT uint16_t* pcpuid);
+// Start following the file of an offline handle, named fname
+int32_t scap_follow_init(scap_t* handle, const char* fname);
+// Stop following the file of an offline handle
+void scap_follow_close(scap_t* handle);
+// Tell if a trace file name is the address of a remote capture
+bool scap_is_remote_name(const char* name);
+// Connect to the collector of a remote capture, and return the stream to write it to
+FILE* scap_remote_connect(const char* name, char* error);
+// Wait for an agent to connect, and return the stream to read its capture from
+FILE* scap_remote_accept(const char* name, char* error);
+// Open the sources of a merge handle and load their tables
+int32_t scap_merge_init(scap_t* handle, const char** fnames, uint32_t nfiles, char* error);
+// Close the sources of a merge handle
+void scap_merge_close(scap_t* handle);
+// Return the next event of the sources of a merge handle, in timestamp order
+int32_t scap_next_merge(scap_t* handle, OUT scap_evt** pevent, OUT uint16_t* pcpuid);
+// Scan /proc in a thread, for scap_proc_scan_complete()
+int32_t scap_proc_scan_start(scap_t* handle);
+// Stop the background scan of /proc and free its results
+void scap_proc_scan_stop(scap_t* handle);
+// Read the id of the current boot of the system, without the newline
+int32_t scap_proc_get_boot_id(OUT char* boot_id, uint32_t len);
+// Load the tables of a checkpoint file into the process table
+struct _checkpoint_header;
+int32_t scap_read_checkpoint(scap_t* handle, const char* fname, OUT struct _checkpoint_header* ch);
+// Build the process table from a checkpoint file, scanning only the processes of /proc that differ from it
+int32_t scap_proc_load_checkpoint(scap_t* handle, const char* fname, OUT scap_checkpoint_stats* stats);
+// Pin the calling thread to the CPUs of the consumer, if it's pinned
+int32_t scap_pin_thread(scap_t* handle);
+// Start the reader threads, each one owning the rings of a group of CPUs
+int32_t scap_start_readers(scap_t* handle, uint32_t nreaders);
+// Stop the reader threads and free their queues
+void scap_stop_readers(scap_t* handle);
+// Return the next events from the queues of the reader threads
+int32_t scap_next_readers(scap_t* handle, OUT scap_evt** pevents, OUT uint16_t* pcpuids, uint32_t max_evts, OUT uint32_t* nevts);
+// Decompress a frame of a trace file into a buffer, growing it if needed
+struct _block_header;
+int32_t scap_uncompress_frame(const struct _block_header* bh, const char* payload, char** buf, uint32_t* bufsize, OUT uint32_t* len, char* error);
+// Have the frames of a mapped trace file decompressed by threads, started at the first frame
+int32_t scap_enable_decoders(scap_t* handle, uint32_t ndecoders);
+// Stop the decoder threads and free their buffers
+void scap_disable_decoders(scap_t* handle);
+// Make the frame at the given offset of the mapping the current one, taking it from the decoders
+int32_t scap_decoders_get_frame(scap_t* handle, uint64_t offset);
+// Set the decoder threads of every source of a merge handle
+int32_t scap_merge_set_decoders(scap_t* handle, uint32_t ndecoders);
+// Create the event tap
+int32_t scap_tap_open(scap_t* handle, const char* name, uint32_t size);
+// Mark the event tap as closed for its readers and remove it
+void scap_tap_close(scap_t* handle);
+// Copy an event to the event tap
+void scap_tap_write(scap_t* handle, scap_evt* pe, uint16_t cpuid);
+// Create the state of the folding of repetitive syscalls
+struct scap_fold* scap_fold_create(char* error);
+// Free the folding state
+void scap_fold_destroy(struct scap_fold* f);
+// Forget the runs and the held events, after moving in a file
+void scap_fold_reset(struct scap_fold* f);
+// Pass an event through the folding. The events that take its place are returned by scap_fold_pop()
+int32_t scap_fold_event(struct scap_fold* f, scap_evt* e, uint16_t cpuid, char* error);
+// End the runs of the threads that have been quiet for a while, when no events come
+int32_t scap_fold_expire(struct scap_fold* f, uint64_t ts, char* error);
+// End all the runs and release the held events, at the end of the capture
+int32_t scap_fold_flush(struct scap_fold* f, char* error);
+// Return the next event queued by the functions above, false if there are none
+bool scap_fold_pop(struct scap_fold* f, OUT scap_evt** pevent, OUT uint16_t* pcpuid);
 // read the filedescriptors for a given process directory
 int32_t scap_fd_scan_fd_dir(scap_t* handle, char * procdir, scap_threadinfo* pi, scap_fdinfo * sockets, char *error);
+// Read the fd table of a process from the driver
+int32_t scap_fd_read_from_driver(scap_t* handle, scap_threadinfo* tinfo, char *error);
 // read tcp or udp sockets from the proc filesystem
 int32_t scap_fd_read_ipv4_sockets_from_proc_fs(scap_t* handle, char * dir, int l4proto, scap_fdinfo ** sockets);
 // read all sockets and add them to the socket table hashed by their ino
@@ -146,12 +389,25 @@ void scap_proc_print_proc_by_tid(scap_t* handle, uint64_t tid);
 int32_t scap_create_iflist(scap_t* handle);
 // Free a previously allocated list of interfaces
 void scap_free_iflist(scap_addrlist* ifhandle);
-// Allocate and return the list of interfaces on this system
+// Allocate and return the list of users and groups on this system
 int32_t scap_create_userlist(scap_t* handle);
+// Wait for the background refresh of the user list and free its results
+void scap_refresh_userlist_stop(scap_t* handle);
 // Free a previously allocated list of users
 void scap_free_userlist(scap_userlist* uhandle);
 
 int32_t scap_fd_post_process_unix_sockets(scap_t* handle, scap_fdinfo* sockets);
+// Load the eBPF programs and open a perf buffer for each device
+int32_t scap_bpf_open(scap_t* handle, uint32_t ring_buf_size);
+// Detach the eBPF programs and release the perf buffers
+void scap_bpf_close(scap_t* handle);
+// scap_readbuf() of the eBPF engine
+int32_t scap_bpf_readbuf(scap_t* handle, uint32_t cpuid, OUT char** buf, OUT uint32_t* len);
+// The driver settings the eBPF engine has
+int32_t scap_bpf_set_capture(scap_t* handle, bool enable);
+int32_t scap_bpf_set_event_mask(scap_t* handle, struct ppm_evt_mask* mask);
+int32_t scap_bpf_set_excluded_tids(scap_t* handle, uint64_t* tids, uint32_t ntids);
+int32_t scap_bpf_set_predicate(scap_t* handle, struct ppm_predicate* pred);
 
 uint32_t scap_event_compute_len(scap_evt* e);
 
@@ -18,6 +18,8 @@ along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
 #ifndef _WIN32
 #include <unistd.h>
 #include <sys/stat.h>
@@ -26,6 +28,7 @@ along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
 #include <fcntl.h>
 #include <poll.h>
 #include <errno.h>
+#include <time.h>
 #endif // _WIN32
 
 #include "scap.h"
@@ -36,12 +39,300 @@ along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
 //#define NDEBUG
 #include <assert.h>
 
+extern const struct ppm_event_info g_event_info[];
+
 char* scap_getlasterr(scap_t* handle)
 {
 	return handle->m_lasterr;
 }
 
+//
+// The messages that carry a file name can be longer than the error buffer.
+// They are cut short, and the "..." tells that the name is incomplete.
+//
+void scap_errprintf(char* error, const char* fmt, ...)
+{
+	va_list args;
+	int len;
+
+	va_start(args, fmt);
+	len = vsnprintf(error, SCAP_LASTERR_SIZE, fmt, args);
+	va_end(args);
+
+	if(len >= SCAP_LASTERR_SIZE)
+	{
+		strcpy(error + SCAP_LASTERR_SIZE - 4, "...");
+	}
+}
+
 scap_t* scap_open_live(char *error)
+{
+	return scap_open_live_ex(error, 0);
+}
+
+#if !defined(_WIN32) && !defined(__APPLE__)
+//
+// Ask the driver to use the given ring buffer size for the next capture.
+// The parameter is applied by the driver when the first device is opened.
+//
+static int32_t scap_set_ring_buf_size(uint32_t ring_buf_size, char *error)
+{
+	FILE* fp;
+
+	fp = fopen(SCAP_RING_BUF_SIZE_PARAM, "w");
+	if(fp == NULL)
+	{
+		snprintf(error, SCAP_LASTERR_SIZE, "error opening %s. Make sure you have root credentials and that the sysdig-probe module is loaded.", SCAP_RING_BUF_SIZE_PARAM);
+		return SCAP_FAILURE;
+	}
+
+	if(fprintf(fp, "%u", ring_buf_size) < 0 || fclose(fp) != 0)
+	{
+		snprintf(error, SCAP_LASTERR_SIZE, "error setting the ring buffer size to %u", ring_buf_size);
+		return SCAP_FAILURE;
+	}
+
+	return SCAP_SUCCESS;
+}
+
+//
+// The live buffers are merged with a min-heap that contains the devices that
+// have unconsumed events, ordered by the timestamp of their next event.
+// Ties are broken by device number, so the events come out in the same order
+// as with a linear scan of the devices.
+// The devices that are not in the heap are kept in m_empty_devs, or in
+// m_idle_devs if they have been empty for a while.
+//
+
+//
+// A device that is found empty by SCAP_IDLE_DEV_REFILLS refills in a row is
+// moved to m_idle_devs, which is only checked every SCAP_IDLE_CHECK_INTERVAL
+// refills and when all the other devices are empty. This way the offline
+// CPUs and the isolated ones, which never run a system call, don't cost a
+// read of the head and tail of their ring for every event.
+//
+#define SCAP_IDLE_DEV_REFILLS 128
+#define SCAP_IDLE_CHECK_INTERVAL 32
+
+static inline bool scap_merge_less(scap_t* handle, uint32_t d1, uint32_t d2)
+{
+	uint64_t ts1 = handle->m_devs[d1].m_sn_next_ts;
+	uint64_t ts2 = handle->m_devs[d2].m_sn_next_ts;
+
+	return ts1 < ts2 || (ts1 == ts2 && d1 < d2);
+}
+
+static inline void scap_merge_sift_down(scap_t* handle, uint32_t pos)
+{
+	uint32_t* heap = handle->m_merge_heap;
+	uint32_t size = handle->m_merge_heap_size;
+	uint32_t dev = heap[pos];
+
+	while(true)
+	{
+		uint32_t child = 2 * pos + 1;
+
+		if(child >= size)
+		{
+			break;
+		}
+
+		if(child + 1 < size && scap_merge_less(handle, heap[child + 1], heap[child]))
+		{
+			child++;
+		}
+
+		if(!scap_merge_less(handle, heap[child], dev))
+		{
+			break;
+		}
+
+		heap[pos] = heap[child];
+		pos = child;
+	}
+
+	heap[pos] = dev;
+}
+
+static inline void scap_merge_push(scap_t* handle, uint32_t dev)
+{
+	uint32_t* heap = handle->m_merge_heap;
+	uint32_t pos = handle->m_merge_heap_size++;
+
+	while(pos > 0)
+	{
+		uint32_t parent = (pos - 1) / 2;
+
+		if(!scap_merge_less(handle, dev, heap[parent]))
+		{
+			break;
+		}
+
+		heap[pos] = heap[parent];
+		pos = parent;
+	}
+
+	heap[pos] = dev;
+}
+
+//
+// Unmap the syscall aggregation tables of all the devices
+//
+static void scap_unmap_aggr_tables(scap_t* handle)
+{
+	uint32_t j;
+
+	for(j = 0; j < handle->m_ndevs; j++)
+	{
+		if(handle->m_devs[j].m_aggr_table != NULL)
+		{
+			munmap(handle->m_devs[j].m_aggr_table, sizeof(struct ppm_syscall_aggr_table));
+			handle->m_devs[j].m_aggr_table = NULL;
+		}
+	}
+}
+
+//
+// Rebuild the merge structures from the current state of the devices.
+// Must be called every time m_sn_len is changed outside the merge code.
+//
+static void scap_reset_merge(scap_t* handle)
+{
+	uint32_t j;
+
+	handle->m_merge_heap_size = 0;
+	handle->m_n_empty_devs = 0;
+	handle->m_n_idle_devs = 0;
+	handle->m_idle_check_countdown = SCAP_IDLE_CHECK_INTERVAL;
+
+	for(j = 0; j < handle->m_nrings; j++)
+	{
+		scap_device* dev = &handle->m_devs[j];
+
+		if(dev->m_sn_len != 0)
+		{
+			dev->m_sn_next_ts = ((scap_evt*)dev->m_sn_next_event)->ts;
+			scap_merge_push(handle, j);
+		}
+		else
+		{
+			handle->m_empty_devs[handle->m_n_empty_devs++] = j;
+		}
+	}
+}
+
+//
+// Start with the rings of the CPUs that are offline among the idle ones, as
+// listed by /sys/devices/system/cpu/online, e.g. "0-3,6". They go back to
+// the others as soon as their CPU comes online and writes something.
+//
+static void scap_park_offline_cpus(scap_t* handle)
+{
+	char buf[1024];
+	char* p = buf;
+	FILE* fp;
+	uint32_t j;
+
+	fp = fopen("/sys/devices/system/cpu/online", "r");
+	if(fp == NULL)
+	{
+		return;
+	}
+
+	if(fgets(buf, sizeof(buf), fp) == NULL)
+	{
+		fclose(fp);
+		return;
+	}
+
+	fclose(fp);
+
+	for(j = 0; j < handle->m_ndevs; j++)
+	{
+		handle->m_devs[j].m_idle_refills = SCAP_IDLE_DEV_REFILLS;
+	}
+
+	while(*p >= '0' && *p <= '9')
+	{
+		unsigned long first = strtoul(p, &p, 10);
+		unsigned long last = first;
+
+		if(*p == '-')
+		{
+			last = strtoul(p + 1, &p, 10);
+		}
+
+		for(j = first; j <= last && j < handle->m_ndevs; j++)
+		{
+			handle->m_devs[j].m_idle_refills = 0;
+		}
+
+		if(*p != ',')
+		{
+			break;
+		}
+
+		p++;
+	}
+}
+
+//
+// Point the device to the fields of its mapped ppm_ring_buffer_info. Drivers
+// of version 1 pack head, tail and the stats in the first 64 bytes, newer
+// ones keep them on separate cache lines.
+//
+static void scap_set_bufinfo_fields(scap_t* handle, scap_device* dev)
+{
+	if(handle->m_ring_info_version >= 2)
+	{
+		dev->m_head = &dev->m_bufinfo->head;
+		dev->m_tail = &dev->m_bufinfo->tail;
+		dev->m_stats = &dev->m_bufinfo->stats;
+	}
+	else
+	{
+		dev->m_head = (volatile uint32_t*)dev->m_bufinfo;
+		dev->m_tail = (volatile uint32_t*)((char*)dev->m_bufinfo + sizeof(uint32_t));
+		dev->m_stats = (struct ppm_ring_buffer_stats*)((char*)dev->m_bufinfo + 2 * sizeof(uint32_t));
+	}
+}
+
+//
+// Ask the driver for the next part of the state dump of a capture opened with
+// SCAP_OPEN_DRIVER_STATE. The driver stops when the ring gets busy, so this
+// is called again every SCAP_STATE_DUMP_INTERVAL events until it's over.
+// An error ends the dump.
+//
+#define SCAP_STATE_DUMP_INTERVAL 1024
+
+static int32_t scap_continue_state_dump(scap_t* handle)
+{
+	struct ppm_state_dump dump;
+
+	handle->m_state_dump_countdown = SCAP_STATE_DUMP_INTERVAL;
+
+	dump.next_pid = handle->m_state_dump_next_pid;
+	dump.next_fd = handle->m_state_dump_next_fd;
+
+	if(ioctl(handle->m_devs[0].m_fd, PPM_IOCTL_DUMP_STATE, &dump))
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error dumping the state from the driver: %s", strerror(errno));
+		handle->m_state_dump_next_pid = -1;
+		return SCAP_FAILURE;
+	}
+
+	handle->m_state_dump_next_pid = dump.next_pid;
+	handle->m_state_dump_next_fd = dump.next_fd;
+	return SCAP_SUCCESS;
+}
+#endif // !defined(_WIN32) && !defined(__APPLE__)
+
+scap_t* scap_open_live_ex(char *error, uint32_t ring_buf_size)
+{
+	return scap_open_live_flags(error, ring_buf_size, 0);
+}
+
+static scap_t* scap_open_live_int(char *error, uint32_t ring_buf_size, uint32_t flags, const char* checkpoint, OUT scap_checkpoint_stats* stats)
 {
 #ifdef _WIN32
 	snprintf(error, SCAP_LASTERR_SIZE, "live capture not supported on windows");
@@ -51,12 +342,46 @@ scap_t* scap_open_live(char *error)
 	return NULL;
 #else
 	uint32_t j;
-	char dev[255];
+	char dev[32]; // "/dev/sysdig" and a CPU number, short enough for the error messages
 	scap_t* handle = NULL;
 	int len;
+	int dev_buf_size;
 	uint32_t ndevs;
 	uint32_t res;
 
+	//
+	// Validate and apply the requested ring buffer size
+	//
+	if(ring_buf_size != 0)
+	{
+		long page_size = sysconf(_SC_PAGESIZE);
+
+		if(ring_buf_size < 2 * page_size ||
+			ring_buf_size > MAX_RING_BUF_SIZE ||
+			ring_buf_size % page_size != 0)
+		{
+			snprintf(error, SCAP_LASTERR_SIZE, "invalid ring buffer size %u. It must be a multiple of %ld between %ld and %u",
+				ring_buf_size,
+				page_size,
+				2 * page_size,
+				MAX_RING_BUF_SIZE);
+			return NULL;
+		}
+
+		if(!(flags & SCAP_OPEN_BPF) && scap_set_ring_buf_size(ring_buf_size, error) != SCAP_SUCCESS)
+		{
+			return NULL;
+		}
+	}
+
+	//
+	// The eBPF programs don't write the state events
+	//
+	if(flags & SCAP_OPEN_BPF)
+	{
+		flags &= ~SCAP_OPEN_DRIVER_STATE;
+	}
+
 	//
 	// Allocate the handle
 	//
@@ -71,13 +396,78 @@ scap_t* scap_open_live(char *error)
 	// Preliminary initializations
 	//
 	handle->m_ndevs = 0;
+	handle->m_ring_info_version = PPM_RING_INFO_VERSION;
+	handle->m_nrings = 0;
+	handle->m_aux_rings = 0;
 	handle->m_proclist = NULL;
 	handle->m_file = NULL;
 	handle->m_file_evt_buf = NULL;
+	handle->m_file_zbuf = NULL;
+	handle->m_file_zbuf_size = 0;
+	handle->m_file_block = NULL;
+	handle->m_file_block_size = 0;
+	handle->m_file_iflist_block = NULL;
+	handle->m_file_iflist_block_len = 0;
+	handle->m_file_userlist_block = NULL;
+	handle->m_file_userlist_block_len = 0;
+	handle->m_file_frame = NULL;
+	handle->m_file_frame_size = 0;
+	handle->m_file_frame_len = 0;
+	handle->m_file_frame_pos = 0;
+	handle->m_file_frame_data = NULL;
+	handle->m_decoders = NULL;
+	handle->m_file_map = NULL;
+	handle->m_file_evts_offset = 0;
+	handle->m_file_index = NULL;
+	handle->m_file_index_len = 0;
+	handle->m_file_index_loaded = false;
+	handle->m_file_summaries = NULL;
+	handle->m_file_evts_end = 0;
+	handle->m_file_block_filter = NULL;
+	handle->m_file_block_filter_context = NULL;
+	handle->m_file_next_group = 0;
+	handle->m_file_snapshots = NULL;
+	handle->m_file_nsnapshots = 0;
+	handle->m_file_snapshots_loaded = false;
+	handle->m_file_next_evt = NULL;
+	handle->m_file_next_block_valid = false;
+	handle->m_file_follow = NULL;
+	handle->m_merge = NULL;
 	handle->m_evtcnt = 0;
 	handle->m_addrlist = NULL;
 	handle->m_userlist = NULL;
 	handle->m_emptybuf_timeout_ms = BUFFER_EMPTY_WAIT_TIME_MS;
+	handle->m_max_delay_ms = 0;
+	handle->m_merge_heap = NULL;
+	handle->m_merge_heap_size = 0;
+	handle->m_empty_devs = NULL;
+	handle->m_n_empty_devs = 0;
+	handle->m_idle_devs = NULL;
+	handle->m_n_idle_devs = 0;
+	handle->m_idle_check_countdown = 0;
+	handle->m_unordered = false;
+	handle->m_cur_dev = 0;
+	handle->m_driver_fd_table = true;
+	handle->m_state_dump_next_pid = -1;
+	handle->m_state_dump_next_fd = -1;
+	handle->m_state_dump_countdown = 0;
+	handle->m_readers = NULL;
+	handle->m_nreaders = 0;
+	handle->m_readers_started = 0;
+	handle->m_cur_reader = 0;
+	handle->m_tap = NULL;
+	handle->m_fold = NULL;
+	handle->m_proc_scan = NULL;
+	handle->m_proc_scan_stop = false;
+	handle->m_userlist_refresh = NULL;
+	handle->m_consumer_ncpus = 0;
+	handle->m_consumer_excluded = false;
+	handle->m_bpf = NULL;
+
+	if(flags & SCAP_OPEN_BPF)
+	{
+		handle->m_driver_fd_table = false;
+	}
 
 	//
 	// Find out how many devices we have to open, which equals to the number of CPUs
@@ -85,11 +475,9 @@ scap_t* scap_open_live(char *error)
 	ndevs = sysconf(_SC_NPROCESSORS_ONLN);
 
 	//
-	// Allocate the device descriptors.
+	// Allocate the device descriptors, with room for the auxiliary rings
 	//
-	len = RING_BUF_SIZE * 2;
-
-	handle->m_devs = (scap_device*)malloc(ndevs * sizeof(scap_device));
+	handle->m_devs = (scap_device*)malloc(ndevs * (1 + PPM_MAX_AUX_RINGS) * sizeof(scap_device));
 	if(!handle->m_devs)
 	{
 		scap_close(handle);
@@ -108,13 +496,36 @@ scap_t* scap_open_live(char *error)
 		return NULL;
 	}
 
-	for(j = 0; j < ndevs; j++)
+	//
+	// Allocate the structures used to merge the buffers.
+	//
+	handle->m_merge_heap = (uint32_t*)malloc(ndevs * (1 + PPM_MAX_AUX_RINGS) * sizeof(uint32_t));
+	handle->m_empty_devs = (uint32_t*)malloc(ndevs * (1 + PPM_MAX_AUX_RINGS) * sizeof(uint32_t));
+	handle->m_idle_devs = (uint32_t*)malloc(ndevs * (1 + PPM_MAX_AUX_RINGS) * sizeof(uint32_t));
+	if(!handle->m_merge_heap || !handle->m_empty_devs || !handle->m_idle_devs)
+	{
+		scap_close(handle);
+		snprintf(error, SCAP_LASTERR_SIZE, "error allocating the device handles");
+		return NULL;
+	}
+
+	for(j = 0; j < ndevs * (1 + PPM_MAX_AUX_RINGS); j++)
 	{
 		handle->m_devs[j].m_buffer = (char*)MAP_FAILED;
 		handle->m_devs[j].m_bufinfo = (struct ppm_ring_buffer_info*)MAP_FAILED;
+		handle->m_devs[j].m_aggr_table = NULL;
+		handle->m_devs[j].m_compact = false;
+		handle->m_devs[j].m_decode_buf = NULL;
+		handle->m_devs[j].m_sn_offsets = NULL;
+		handle->m_devs[j].m_sn_offsets_size = 0;
+		handle->m_devs[j].m_cpuid = j % ndevs;
+		handle->m_devs[j].m_idle_refills = 0;
+		handle->m_devs[j].m_last_ts = 0;
 	}
 
 	handle->m_ndevs = ndevs;
+	handle->m_nrings = ndevs;
+	scap_park_offline_cpus(handle);
 
 	//
 	// Extract machine information
@@ -122,7 +533,7 @@ scap_t* scap_open_live(char *error)
 	handle->m_machine_info.num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
 	handle->m_machine_info.memory_size_bytes = (uint64_t)sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE);
 	gethostname(handle->m_machine_info.hostname, sizeof(handle->m_machine_info.hostname) / sizeof(handle->m_machine_info.hostname[0]));
-	handle->m_machine_info.reserved1 = 0;
+	handle->m_machine_info.flags = 0;
 	handle->m_machine_info.reserved2 = 0;
 	handle->m_machine_info.reserved3 = 0;
 	handle->m_machine_info.reserved4 = 0;
@@ -148,117 +559,244 @@ scap_t* scap_open_live(char *error)
 	}
 
 	//
-	// Create the process list
+	// Create the process list, unless the caller is going to look up the
+	// processes as it needs them
 	//
 	error[0] = '\0';
-	if((res = scap_proc_scan_proc_dir(handle, "/proc", -1, -1, NULL, error, true)) != SCAP_SUCCESS)
+	if(flags & SCAP_OPEN_DRIVER_STATE)
 	{
-		scap_close(handle);
-		snprintf(error, SCAP_LASTERR_SIZE, "error creating the process list. Make sure you have root credentials.");
-		return NULL;
+		//
+		// Done once the devices are open
+		//
 	}
-
-	handle->m_fake_kernel_proc.tid = -1;
-	handle->m_fake_kernel_proc.pid = -1;
-	handle->m_fake_kernel_proc.flags = 0;
-	snprintf(handle->m_fake_kernel_proc.comm, SCAP_MAX_PATH_SIZE, "kernel");
-	snprintf(handle->m_fake_kernel_proc.exe, SCAP_MAX_PATH_SIZE, "kernel");
-	handle->m_fake_kernel_proc.args[0] = 0;
-
-	//
-	// Open and initialize all the devices
-	//
-	for(j = 0; j < handle->m_ndevs; j++)
+	else if(flags & SCAP_OPEN_SKIP_PROC_SCAN)
+	{
+		if((flags & SCAP_OPEN_BG_PROC_SCAN) && scap_proc_scan_start(handle) != SCAP_SUCCESS)
+		{
+			snprintf(error, SCAP_LASTERR_SIZE, "%s", handle->m_lasterr);
+			scap_close(handle);
+			return NULL;
+		}
+	}
+	else
 	{
 		//
-		// Open the device
+		// Start from the checkpoint, if there's a usable one
 		//
-		sprintf(dev, "/dev/sysdig%d", j);
-
-		if((handle->m_devs[j].m_fd = open(dev, O_RDWR | O_SYNC)) < 0)
+		if(checkpoint != NULL)
 		{
-			if(errno == EBUSY)
+			if(scap_proc_load_checkpoint(handle, checkpoint, stats) == SCAP_SUCCESS)
 			{
-				snprintf(error, SCAP_LASTERR_SIZE, "device %s is already open. You can't run multiple instances of sysdig.", dev);
+				stats->loaded = true;
 			}
 			else
 			{
-				snprintf(error, SCAP_LASTERR_SIZE, "error opening device %s. Make sure you have root credentials and that the sysdig-probe module is loaded.", dev);
+				memset(stats, 0, sizeof(*stats));
+				snprintf(stats->reason, sizeof(stats->reason), "%s", handle->m_lasterr);
 			}
-
-			scap_close(handle);
-			return NULL;
 		}
 
-		//
-		// Init the polling fd for the device
-		//
-		handle->m_pollfds[j].fd = handle->m_devs[j].m_fd;
-		handle->m_pollfds[j].events = POLLIN;
-
-		//
-		// Map the ring buffer
-		//
-		handle->m_devs[j].m_buffer = (char*)mmap(0,
-		                             len,
-		                             PROT_READ,
-		                             MAP_SHARED,
-		                             handle->m_devs[j].m_fd,
-		                             0);
-
-		if(handle->m_devs[j].m_buffer == MAP_FAILED)
+		if(!stats->loaded && (res = scap_proc_scan_proc_dir(handle, "/proc", -1, -1, NULL, error, true)) != SCAP_SUCCESS)
 		{
-			// we cleanup this fd and then we let scap_close() take care of the other ones
-			close(handle->m_devs[j].m_fd);
-
 			scap_close(handle);
-
-			snprintf(error, SCAP_LASTERR_SIZE, "error mapping the ring buffer for device %s", dev);
+			snprintf(error, SCAP_LASTERR_SIZE, "error creating the process list. Make sure you have root credentials.");
 			return NULL;
 		}
+	}
 
-		//
-		// Map the ppm_ring_buffer_info that contains the buffer pointers
-		//
-		handle->m_devs[j].m_bufinfo = (struct ppm_ring_buffer_info*)mmap(0,
-		                              sizeof(struct ppm_ring_buffer_info),
-		                              PROT_READ | PROT_WRITE,
-		                              MAP_SHARED,
-		                              handle->m_devs[j].m_fd,
-		                              0);
+	handle->m_fake_kernel_proc.tid = -1;
+	handle->m_fake_kernel_proc.pid = -1;
+	handle->m_fake_kernel_proc.flags = 0;
+	snprintf(handle->m_fake_kernel_proc.comm, SCAP_MAX_PATH_SIZE, "kernel");
+	snprintf(handle->m_fake_kernel_proc.exe, SCAP_MAX_PATH_SIZE, "kernel");
+	handle->m_fake_kernel_proc.args[0] = 0;
 
-		if(handle->m_devs[j].m_bufinfo == MAP_FAILED)
+	//
+	// Load the eBPF programs, or open and initialize all the devices
+	//
+	if(flags & SCAP_OPEN_BPF)
+	{
+		if(scap_bpf_open(handle, ring_buf_size) != SCAP_SUCCESS)
 		{
-			// we cleanup this fd and then we let scap_close() take care of the other ones
-			munmap(handle->m_devs[j].m_buffer, len);
-			close(handle->m_devs[j].m_fd);
-
+			snprintf(error, SCAP_LASTERR_SIZE, "%s", handle->m_lasterr);
 			scap_close(handle);
-
-			snprintf(error, SCAP_LASTERR_SIZE, "error mapping the ring buffer info for device %s", dev);
 			return NULL;
 		}
-
-		//
-		// Additional initializations
-		//
-		handle->m_devs[j].m_lastreadsize = 0;
-		handle->m_devs[j].m_sn_len = 0;
-		scap_stop_dropping_mode(handle);
 	}
+	else
+	{
+		for(j = 0; j < handle->m_ndevs; j++)
+		{
+			//
+			// Open the device
+			//
+			sprintf(dev, "/dev/sysdig%d", j);
 
-	return handle;
-#endif // _WIN32
-}
+			if((handle->m_devs[j].m_fd = open(dev, O_RDWR | O_SYNC)) < 0)
+			{
+				if(errno == EBUSY)
+				{
+					snprintf(error, SCAP_LASTERR_SIZE, "device %s is already open by this process, or too many processes are capturing at the same time.", dev);
+				}
+				else
+				{
+					snprintf(error, SCAP_LASTERR_SIZE, "error opening device %s. Make sure you have root credentials and that the sysdig-probe module is loaded.", dev);
+				}
 
-scap_t* scap_open_offline(char* fname, char *error)
-{
-	scap_t* handle = NULL;
+				scap_close(handle);
+				return NULL;
+			}
 
-	//
-	// Allocate the handle
-	//
-	handle = (scap_t*)malloc(sizeof(scap_t));
+			//
+			// Init the polling fd for the device
+			//
+			handle->m_pollfds[j].fd = handle->m_devs[j].m_fd;
+			handle->m_pollfds[j].events = POLLIN;
+
+			//
+			// Find out the size of the ring buffer.
+			// The driver resizes the buffers when the first device is opened.
+			//
+			dev_buf_size = ioctl(handle->m_devs[j].m_fd, PPM_IOCTL_GET_RING_BUF_SIZE);
+			if(dev_buf_size <= 0)
+			{
+				close(handle->m_devs[j].m_fd);
+				scap_close(handle);
+				snprintf(error, SCAP_LASTERR_SIZE, "error reading the ring buffer size for device %s. Make sure the loaded sysdig-probe module matches this version of sysdig.", dev);
+				return NULL;
+			}
+
+			if(ring_buf_size != 0 && (uint32_t)dev_buf_size != ring_buf_size)
+			{
+				close(handle->m_devs[j].m_fd);
+				scap_close(handle);
+				snprintf(error, SCAP_LASTERR_SIZE, "the driver could not allocate a ring buffer of %u bytes for device %s (current size is %d bytes)", ring_buf_size, dev, dev_buf_size);
+				return NULL;
+			}
+
+			handle->m_devs[j].m_buffer_size = dev_buf_size;
+			len = dev_buf_size * 2;
+
+			//
+			// Drivers that don't know the ioctl have the original layout
+			//
+			if(j == 0)
+			{
+				int version = ioctl(handle->m_devs[j].m_fd, PPM_IOCTL_GET_RING_INFO_VERSION);
+
+				handle->m_ring_info_version = (version > 0)? version : 1;
+			}
+
+			//
+			// Map the ring buffer
+			//
+			handle->m_devs[j].m_buffer = (char*)mmap(0,
+			                             len,
+			                             PROT_READ,
+			                             MAP_SHARED,
+			                             handle->m_devs[j].m_fd,
+			                             0);
+
+			if(handle->m_devs[j].m_buffer == MAP_FAILED)
+			{
+				// we cleanup this fd and then we let scap_close() take care of the other ones
+				close(handle->m_devs[j].m_fd);
+
+				scap_close(handle);
+
+				snprintf(error, SCAP_LASTERR_SIZE, "error mapping the ring buffer for device %s", dev);
+				return NULL;
+			}
+
+			//
+			// Map the ppm_ring_buffer_info that contains the buffer pointers
+			//
+			handle->m_devs[j].m_bufinfo = (struct ppm_ring_buffer_info*)mmap(0,
+			                              sizeof(struct ppm_ring_buffer_info),
+			                              PROT_READ | PROT_WRITE,
+			                              MAP_SHARED,
+			                              handle->m_devs[j].m_fd,
+			                              0);
+
+			if(handle->m_devs[j].m_bufinfo == MAP_FAILED)
+			{
+				// we cleanup this fd and then we let scap_close() take care of the other ones
+				munmap(handle->m_devs[j].m_buffer, len);
+				close(handle->m_devs[j].m_fd);
+
+				scap_close(handle);
+
+				snprintf(error, SCAP_LASTERR_SIZE, "error mapping the ring buffer info for device %s", dev);
+				return NULL;
+			}
+
+			//
+			// Additional initializations
+			//
+			scap_set_bufinfo_fields(handle, &handle->m_devs[j]);
+			handle->m_devs[j].m_lastreadsize = 0;
+			handle->m_devs[j].m_sn_len = 0;
+			scap_stop_dropping_mode(handle);
+		}
+	}
+
+	//
+	// Start the state dump. The driver writes the first events right away,
+	// and scap_next() asks it for the rest while the capture goes on. If it
+	// can't do it, scan /proc like the other captures.
+	//
+	if(flags & SCAP_OPEN_DRIVER_STATE)
+	{
+		handle->m_state_dump_next_pid = 0;
+		handle->m_state_dump_next_fd = -1;
+
+		if(scap_continue_state_dump(handle) != SCAP_SUCCESS &&
+			scap_proc_scan_proc_dir(handle, "/proc", -1, -1, NULL, error, true) != SCAP_SUCCESS)
+		{
+			scap_close(handle);
+			snprintf(error, SCAP_LASTERR_SIZE, "error creating the process list. Make sure you have root credentials.");
+			return NULL;
+		}
+	}
+
+	scap_reset_merge(handle);
+
+	return handle;
+#endif // _WIN32
+}
+
+scap_t* scap_open_live_flags(char *error, uint32_t ring_buf_size, uint32_t flags)
+{
+	scap_checkpoint_stats stats;
+
+	memset(&stats, 0, sizeof(stats));
+	return scap_open_live_int(error, ring_buf_size, flags, NULL, &stats);
+}
+
+scap_t* scap_open_live_checkpoint(char *error, uint32_t ring_buf_size, uint32_t flags, const char* checkpoint, OUT scap_checkpoint_stats* stats)
+{
+	scap_checkpoint_stats local_stats;
+
+	if(stats == NULL)
+	{
+		stats = &local_stats;
+	}
+
+	memset(stats, 0, sizeof(*stats));
+	return scap_open_live_int(error, ring_buf_size, flags, checkpoint, stats);
+}
+
+//
+// Allocate a handle that doesn't read from the driver
+//
+static scap_t* scap_alloc_offline_handle(char *error)
+{
+	scap_t* handle = NULL;
+
+	//
+	// Allocate the handle
+	//
+	handle = (scap_t*)malloc(sizeof(scap_t));
 	if(!handle)
 	{
 		snprintf(error, SCAP_LASTERR_SIZE, "error allocating the scap_t structure");
@@ -270,6 +808,9 @@ scap_t* scap_open_offline(char* fname, char *error)
 	//
 	handle->m_devs = NULL;
 	handle->m_ndevs = 0;
+	handle->m_ring_info_version = PPM_RING_INFO_VERSION;
+	handle->m_nrings = 0;
+	handle->m_aux_rings = 0;
 	handle->m_proclist = NULL;
 	handle->m_pollfds = NULL;
 	handle->m_evtcnt = 0;
@@ -277,6 +818,83 @@ scap_t* scap_open_offline(char* fname, char *error)
 	handle->m_addrlist = NULL;
 	handle->m_userlist = NULL;
 	handle->m_machine_info.num_cpus = (uint32_t)-1;
+	handle->m_readers = NULL;
+	handle->m_nreaders = 0;
+	handle->m_readers_started = 0;
+	handle->m_tap = NULL;
+	handle->m_fold = NULL;
+	handle->m_proc_scan = NULL;
+	handle->m_proc_scan_stop = false;
+	handle->m_driver_fd_table = false;
+	handle->m_state_dump_next_pid = -1;
+	handle->m_state_dump_next_fd = -1;
+	handle->m_state_dump_countdown = 0;
+	handle->m_max_delay_ms = 0;
+	handle->m_userlist_refresh = NULL;
+	handle->m_consumer_ncpus = 0;
+	handle->m_consumer_excluded = false;
+	handle->m_bpf = NULL;
+	handle->m_file_zbuf = NULL;
+	handle->m_file_zbuf_size = 0;
+	handle->m_file_block = NULL;
+	handle->m_file_block_size = 0;
+	handle->m_file_iflist_block = NULL;
+	handle->m_file_iflist_block_len = 0;
+	handle->m_file_userlist_block = NULL;
+	handle->m_file_userlist_block_len = 0;
+	handle->m_file_frame = NULL;
+	handle->m_file_frame_size = 0;
+	handle->m_file_frame_len = 0;
+	handle->m_file_frame_pos = 0;
+	handle->m_file_frame_data = NULL;
+	handle->m_decoders = NULL;
+	handle->m_file_map = NULL;
+	handle->m_file_evts_offset = 0;
+	handle->m_file_index = NULL;
+	handle->m_file_index_len = 0;
+	handle->m_file_index_loaded = false;
+	handle->m_file_summaries = NULL;
+	handle->m_file_evts_end = 0;
+	handle->m_file_block_filter = NULL;
+	handle->m_file_block_filter_context = NULL;
+	handle->m_file_next_group = 0;
+	handle->m_file_snapshots = NULL;
+	handle->m_file_nsnapshots = 0;
+	handle->m_file_snapshots_loaded = false;
+	handle->m_file_next_evt = NULL;
+	handle->m_file_next_block_valid = false;
+	handle->m_file_follow = NULL;
+	handle->m_file_evt_buf = NULL;
+	handle->m_merge = NULL;
+
+	//
+	// Add the fake process for kernel threads
+	//
+	handle->m_fake_kernel_proc.tid = -1;
+	handle->m_fake_kernel_proc.pid = -1;
+	handle->m_fake_kernel_proc.flags = 0;
+	snprintf(handle->m_fake_kernel_proc.comm, SCAP_MAX_PATH_SIZE, "kernel");
+	snprintf(handle->m_fake_kernel_proc.exe, SCAP_MAX_PATH_SIZE, "kernel");
+	handle->m_fake_kernel_proc.args[0] = 0;
+
+	return handle;
+}
+
+//
+// Start reading a trace file from the given stream, that is closed in case
+// of failure
+//
+static scap_t* scap_open_offline_stream(FILE* f, const char* follow_fname, char *error)
+{
+	scap_t* handle = scap_alloc_offline_handle(error);
+
+	if(handle == NULL)
+	{
+		fclose(f);
+		return NULL;
+	}
+
+	handle->m_file = f;
 
 	handle->m_file_evt_buf = (char*)malloc(FILE_READ_BUF_SIZE);
 	if(!handle->m_file_evt_buf)
@@ -286,16 +904,20 @@ scap_t* scap_open_offline(char* fname, char *error)
 		return NULL;
 	}
 
+#if !defined(_WIN32) && !defined(__APPLE__)
 	//
-	// Open the file
+	// The file is read once from start to end, let the kernel read ahead
+	// more aggressively
 	//
-	handle->m_file = fopen(fname, "rb");
-	if(handle->m_file == NULL)
+	posix_fadvise(fileno(handle->m_file), 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	if(follow_fname != NULL && scap_follow_init(handle, follow_fname) != SCAP_SUCCESS)
 	{
-		snprintf(error, SCAP_LASTERR_SIZE, "can't open file %s", fname);
+		snprintf(error, SCAP_LASTERR_SIZE, "%s", scap_getlasterr(handle));
 		scap_close(handle);
 		return NULL;
 	}
+#endif
 
 	//
 	// Validate the file and load the non-event blocks
@@ -308,20 +930,83 @@ scap_t* scap_open_offline(char* fname, char *error)
 	}
 
 	//
-	// Add the fake process for kernel threads
+	// Return the events straight from the page cache instead of copying
+	// them with fread. A followed file keeps growing, so it's not mapped.
 	//
-	handle->m_fake_kernel_proc.tid = -1;
-	handle->m_fake_kernel_proc.pid = -1;
-	handle->m_fake_kernel_proc.flags = 0;
-	snprintf(handle->m_fake_kernel_proc.comm, SCAP_MAX_PATH_SIZE, "kernel");
-	snprintf(handle->m_fake_kernel_proc.exe, SCAP_MAX_PATH_SIZE, "kernel");
-	handle->m_fake_kernel_proc.args[0] = 0;
+	if(follow_fname == NULL)
+	{
+		scap_read_map(handle);
+	}
 
 //scap_proc_print_table(handle);
 
 	return handle;
 }
 
+scap_t* scap_open_offline(char* fname, char *error)
+{
+	FILE* f;
+
+	f = fopen(fname, "rb");
+	if(f == NULL)
+	{
+		snprintf(error, SCAP_LASTERR_SIZE, "can't open file %s", fname);
+		return NULL;
+	}
+
+	return scap_open_offline_stream(f, NULL, error);
+}
+
+scap_t* scap_open_offline_follow(char* fname, char *error)
+{
+#if defined(_WIN32) || defined(__APPLE__)
+	snprintf(error, SCAP_LASTERR_SIZE, "following a trace file is not supported on this platform");
+	return NULL;
+#else
+	FILE* f;
+
+	f = fopen(fname, "rb");
+	if(f == NULL)
+	{
+		snprintf(error, SCAP_LASTERR_SIZE, "can't open file %s", fname);
+		return NULL;
+	}
+
+	return scap_open_offline_stream(f, fname, error);
+#endif
+}
+
+scap_t* scap_open_remote(const char* addr, char *error)
+{
+	FILE* f;
+
+	f = scap_remote_accept(addr, error);
+	if(f == NULL)
+	{
+		return NULL;
+	}
+
+	return scap_open_offline_stream(f, NULL, error);
+}
+
+scap_t* scap_open_merge(const char** fnames, uint32_t nfiles, char *error)
+{
+	scap_t* handle = scap_alloc_offline_handle(error);
+
+	if(handle == NULL)
+	{
+		return NULL;
+	}
+
+	if(scap_merge_init(handle, fnames, nfiles, error) != SCAP_SUCCESS)
+	{
+		scap_close(handle);
+		return NULL;
+	}
+
+	return handle;
+}
+
 int32_t scap_set_empty_buffer_timeout_ms(scap_t* handle, uint32_t timeout_ms)
 {
 	handle->m_emptybuf_timeout_ms = timeout_ms;
@@ -330,8 +1015,33 @@ int32_t scap_set_empty_buffer_timeout_ms(scap_t* handle, uint32_t timeout_ms)
 
 void scap_close(scap_t* handle)
 {
-	if(handle->m_file)
+	scap_tap_close(handle);
+
+	if(handle->m_fold != NULL)
+	{
+		scap_fold_destroy(handle->m_fold);
+	}
+
+	if(handle->m_merge)
 	{
+		scap_merge_close(handle);
+	}
+	else if(handle->m_file)
+	{
+		//
+		// The decoders read the mapping until they are stopped
+		//
+		scap_disable_decoders(handle);
+
+		scap_read_unmap(handle);
+
+#if !defined(_WIN32) && !defined(__APPLE__)
+		if(handle->m_file_follow != NULL)
+		{
+			scap_follow_close(handle);
+		}
+#endif
+
 		fclose(handle->m_file);
 	}
 	else
@@ -341,24 +1051,58 @@ void scap_close(scap_t* handle)
 
 		ASSERT(handle->m_file == NULL);
 
+		//
+		// The readers use the rings until they are stopped
+		//
+		scap_stop_readers(handle);
+		scap_proc_scan_stop(handle);
+
+		if(handle->m_bpf != NULL)
+		{
+			scap_bpf_close(handle);
+		}
+
 		//
 		// Destroy all the device descriptors
 		//
-		for(j = 0; j < handle->m_ndevs; j++)
+		scap_unmap_aggr_tables(handle);
+
+		for(j = 0; j < handle->m_nrings; j++)
 		{
 			if(handle->m_devs[j].m_buffer != MAP_FAILED)
 			{
 				munmap(handle->m_devs[j].m_bufinfo, sizeof(struct ppm_ring_buffer_info));
-				munmap(handle->m_devs[j].m_buffer, RING_BUF_SIZE * 2);
-				close(handle->m_devs[j].m_fd);
+				munmap(handle->m_devs[j].m_buffer, handle->m_devs[j].m_buffer_size * 2);
+
+				//
+				// The auxiliary rings are mapped from the device of their CPU
+				//
+				if(j < handle->m_ndevs)
+				{
+					close(handle->m_devs[j].m_fd);
+				}
+			}
+
+			if(handle->m_devs[j].m_decode_buf != NULL)
+			{
+				free(handle->m_devs[j].m_decode_buf);
 			}
 		}
 
 		//
-		// Free the memory
+		// Free the memory. The offsets of the auxiliary rings that have
+		// been disabled are still there.
 		//
 		if(handle->m_devs != NULL)
 		{
+			for(j = 0; j < handle->m_ndevs * (1 + PPM_MAX_AUX_RINGS); j++)
+			{
+				if(handle->m_devs[j].m_sn_offsets != NULL)
+				{
+					free(handle->m_devs[j].m_sn_offsets);
+				}
+			}
+
 			free(handle->m_devs);
 		}
 
@@ -366,6 +1110,21 @@ void scap_close(scap_t* handle)
 		{
 			free(handle->m_pollfds);
 		}
+
+		if(handle->m_merge_heap != NULL)
+		{
+			free(handle->m_merge_heap);
+		}
+
+		if(handle->m_empty_devs != NULL)
+		{
+			free(handle->m_empty_devs);
+		}
+
+		if(handle->m_idle_devs != NULL)
+		{
+			free(handle->m_idle_devs);
+		}
 #endif // _WIN32
 	}
 
@@ -374,6 +1133,46 @@ void scap_close(scap_t* handle)
 		free(handle->m_file_evt_buf);
 	}
 
+	if(handle->m_file_zbuf)
+	{
+		free(handle->m_file_zbuf);
+	}
+
+	if(handle->m_file_block)
+	{
+		free(handle->m_file_block);
+	}
+
+	if(handle->m_file_iflist_block)
+	{
+		free(handle->m_file_iflist_block);
+	}
+
+	if(handle->m_file_userlist_block)
+	{
+		free(handle->m_file_userlist_block);
+	}
+
+	if(handle->m_file_frame)
+	{
+		free(handle->m_file_frame);
+	}
+
+	if(handle->m_file_index)
+	{
+		free(handle->m_file_index);
+	}
+
+	if(handle->m_file_summaries)
+	{
+		free(handle->m_file_summaries);
+	}
+
+	if(handle->m_file_snapshots)
+	{
+		free(handle->m_file_snapshots);
+	}
+
 	// Free the process table
 	if(handle->m_proclist != NULL)
 	{
@@ -387,6 +1186,8 @@ void scap_close(scap_t* handle)
 	}
 
 	// Free the user list
+	scap_refresh_userlist_stop(handle);
+
 	if(handle->m_userlist)
 	{
 		scap_free_userlist(handle->m_userlist);
@@ -425,17 +1226,17 @@ uint32_t scap_get_ndevs(scap_t* handle)
 }
 
 #ifndef _WIN32
-inline void get_buf_pointers(struct ppm_ring_buffer_info* bufinfo, uint32_t* phead, uint32_t* ptail, uint32_t* pread_size)
+static inline void get_buf_pointers(scap_device* dev, uint32_t buffer_size, uint32_t* phead, uint32_t* ptail, uint32_t* pread_size)
 #else
-void get_buf_pointers(struct ppm_ring_buffer_info* bufinfo, uint32_t* phead, uint32_t* ptail, uint32_t* pread_size)
+static void get_buf_pointers(scap_device* dev, uint32_t buffer_size, uint32_t* phead, uint32_t* ptail, uint32_t* pread_size)
 #endif
 {
-	*phead = bufinfo->head;
-	*ptail = bufinfo->tail;
+	*phead = *dev->m_head;
+	*ptail = *dev->m_tail;
 
 	if(*ptail > *phead)
 	{
-		*pread_size = RING_BUF_SIZE - *ptail + *phead;
+		*pread_size = buffer_size - *ptail + *phead;
 	}
 	else
 	{
@@ -444,34 +1245,348 @@ void get_buf_pointers(struct ppm_ring_buffer_info* bufinfo, uint32_t* phead, uin
 }
 
 #if !defined(_WIN32) && !defined(__APPLE__)
-int32_t scap_readbuf(scap_t* handle, uint32_t cpuid, bool blocking, OUT char** buf, OUT uint32_t* len)
+//
+// Read a varint of the compact encoding. Returns the number of bytes it
+// takes, or 0 if it doesn't end before end.
+//
+static inline uint32_t scap_get_varint(const char* p, const char* end, OUT uint64_t* v)
 {
-	uint32_t thead;
-	uint32_t ttail;
-	uint32_t read_size;
-
-	//
-	// Update the tail based on the amount of data read in the *previous* call.
-	// Tail is never updated when we serve the data, because we assume that the caller is using
-	// the buffer we give to her until she calls us again.
-	//
-	ttail = handle->m_devs[cpuid].m_bufinfo->tail + handle->m_devs[cpuid].m_lastreadsize;
+	uint32_t n = 0;
+	uint32_t shift = 0;
 
-	//
-	// Make sure every read of the old buffer is completed before we move the tail and the
-	// producer (on another CPU) can start overwriting it.
-	// I use this instead of asm(mfence) because it should be portable even on the weirdest
-	// CPUs
-	//
-	__sync_synchronize();
+	*v = 0;
 
-	if(ttail < RING_BUF_SIZE)
+	while(p + n < end && shift < 64)
 	{
-		handle->m_devs[cpuid].m_bufinfo->tail = ttail;
-	}
-	else
-	{
-		handle->m_devs[cpuid].m_bufinfo->tail = ttail - RING_BUF_SIZE;
+		uint8_t b = (uint8_t)p[n++];
+
+		*v |= (uint64_t)(b & 0x7f) << shift;
+
+		if(!(b & 0x80))
+		{
+			return n;
+		}
+
+		shift += 7;
+	}
+
+	return 0;
+}
+
+//
+// Expand the lengths and the parameters of a compact event, from p to end,
+// into an event in the normal format at dst. Returns SCAP_INPUT_TOO_SMALL
+// if the event doesn't fit before dst_end, and SCAP_FAILURE if it's corrupted.
+//
+static int32_t scap_expand_compact_event(const char* p, const char* end, uint16_t type, uint64_t ts, uint64_t tid,
+	char* dst, char* dst_end, OUT uint32_t* evt_size)
+{
+	const struct ppm_event_info* info = &g_event_info[type];
+	const char* q = p;
+	uint64_t plens[PPM_MAX_EVENT_PARAMS];
+	struct ppm_evt_hdr* hdr;
+	uint16_t* lens;
+	char* data;
+	uint32_t size;
+	uint32_t n;
+	uint32_t j;
+	int is_signed;
+
+	//
+	// Read the lengths, and compute the size of the decoded event
+	//
+	size = sizeof(struct ppm_evt_hdr) + info->nparams * sizeof(uint16_t);
+
+	for(j = 0; j < info->nparams; j++)
+	{
+		n = scap_get_varint(q, end, &plens[j]);
+		if(n == 0 || (plens[j] >> 1) > (uint64_t)(end - q - n))
+		{
+			return SCAP_FAILURE;
+		}
+
+		q += n;
+
+		if(plens[j] & PPM_COMPACT_PARAM_CODED)
+		{
+			uint32_t width = ppm_compact_param_width(info->params[j].type, &is_signed);
+			if(width == 0)
+			{
+				return SCAP_FAILURE;
+			}
+
+			size += width;
+		}
+		else
+		{
+			size += (uint32_t)(plens[j] >> 1);
+		}
+	}
+
+	if(size > (uint32_t)(dst_end - dst))
+	{
+		return SCAP_INPUT_TOO_SMALL;
+	}
+
+	//
+	// Expand the event
+	//
+	hdr = (struct ppm_evt_hdr*)dst;
+	lens = (uint16_t*)(dst + sizeof(struct ppm_evt_hdr));
+	data = (char*)(lens + info->nparams);
+
+	for(j = 0; j < info->nparams; j++)
+	{
+		uint32_t plen = (uint32_t)(plens[j] >> 1);
+
+		if(plen > (uint32_t)(end - q))
+		{
+			return SCAP_FAILURE;
+		}
+
+		if(plens[j] & PPM_COMPACT_PARAM_CODED)
+		{
+			uint64_t v;
+			uint32_t width = ppm_compact_param_width(info->params[j].type, &is_signed);
+
+			if(scap_get_varint(q, q + plen, &v) != plen)
+			{
+				return SCAP_FAILURE;
+			}
+
+			if(is_signed)
+			{
+				v = (v >> 1) ^ (~(v & 1) + 1);
+			}
+
+			if(width == 8)
+			{
+				memcpy(data, &v, sizeof(uint64_t));
+			}
+			else if(width == 4)
+			{
+				uint32_t v32 = (uint32_t)v;
+				memcpy(data, &v32, sizeof(uint32_t));
+			}
+			else
+			{
+				uint16_t v16 = (uint16_t)v;
+				memcpy(data, &v16, sizeof(uint16_t));
+			}
+
+			lens[j] = (uint16_t)width;
+		}
+		else
+		{
+			memcpy(data, q, plen);
+			lens[j] = (uint16_t)plen;
+		}
+
+		data += lens[j];
+		q += plen;
+	}
+
+	if(q != end)
+	{
+		return SCAP_FAILURE;
+	}
+
+	hdr->ts = ts;
+	hdr->tid = tid;
+	hdr->len = size;
+	hdr->type = type;
+
+	*evt_size = size;
+	return SCAP_SUCCESS;
+}
+
+//
+// Expand the compact events of a chunk into the decode buffer of the device,
+// in the normal format. See ppm_events_public.h for the encoding.
+// Only the events that fit in the decode buffer are returned. m_lastreadsize
+// counts only the bytes they take in the ring, so the rest stays there and
+// is returned by the next read.
+// The exit events that carry their enter event are expanded into both, so
+// the exit only mode makes no difference for the readers.
+//
+static int32_t scap_decode_compact_chunk(scap_t* handle, uint32_t cpuid, const char* src, uint32_t src_len, OUT char** buf, OUT uint32_t* len)
+{
+	scap_device* dev = &handle->m_devs[cpuid];
+	const char* p = src;
+	const char* src_end = src + src_len;
+	char* dst = dev->m_decode_buf;
+	char* dst_end = dev->m_decode_buf + dev->m_buffer_size;
+
+	while(p < src_end)
+	{
+		const char* q = p + 1;
+		const char* evt_end;
+		uint8_t flags = (uint8_t)*p;
+		uint64_t rest;
+		uint64_t type;
+		uint64_t ts;
+		uint64_t tid = dev->m_compact_last_tid;
+		uint32_t enter_size = 0;
+		uint32_t evt_size;
+		uint32_t n;
+		int32_t res;
+
+		n = scap_get_varint(q, src_end, &rest);
+		if(n == 0 || rest > (uint64_t)(src_end - q - n))
+		{
+			goto decode_error;
+		}
+
+		q += n;
+		evt_end = q + rest;
+
+		n = scap_get_varint(q, evt_end, &type);
+		if(n == 0 || type >= PPM_EVENT_MAX)
+		{
+			goto decode_error;
+		}
+
+		q += n;
+
+		n = scap_get_varint(q, evt_end, &ts);
+		if(n == 0)
+		{
+			goto decode_error;
+		}
+
+		q += n;
+
+		if(!(flags & PPM_COMPACT_ABS_TS))
+		{
+			ts += dev->m_compact_last_ts;
+		}
+
+		if(flags & PPM_COMPACT_TID)
+		{
+			n = scap_get_varint(q, evt_end, &tid);
+			if(n == 0)
+			{
+				goto decode_error;
+			}
+
+			q += n;
+		}
+
+		if(flags & PPM_COMPACT_ENTER)
+		{
+			uint64_t latency;
+			uint64_t body_size;
+
+			n = scap_get_varint(q, evt_end, &latency);
+			if(n == 0 || latency > ts || PPME_IS_ENTER(type))
+			{
+				goto decode_error;
+			}
+
+			q += n;
+
+			n = scap_get_varint(q, evt_end, &body_size);
+			if(n == 0 || body_size > (uint64_t)(evt_end - q - n))
+			{
+				goto decode_error;
+			}
+
+			q += n;
+
+			res = scap_expand_compact_event(q, q + body_size, (uint16_t)(type - 1), ts - latency, tid,
+				dst, dst_end, &enter_size);
+
+			if(res == SCAP_FAILURE)
+			{
+				goto decode_error;
+			}
+			else if(res == SCAP_INPUT_TOO_SMALL)
+			{
+				if(dst == dev->m_decode_buf)
+				{
+					goto decode_error;
+				}
+
+				break;
+			}
+
+			q += body_size;
+		}
+
+		res = scap_expand_compact_event(q, evt_end, (uint16_t)type, ts, tid,
+			dst + enter_size, dst_end, &evt_size);
+
+		if(res == SCAP_FAILURE)
+		{
+			goto decode_error;
+		}
+		else if(res == SCAP_INPUT_TOO_SMALL)
+		{
+			if(dst == dev->m_decode_buf)
+			{
+				goto decode_error;
+			}
+
+			break;
+		}
+
+		dev->m_compact_last_ts = ts;
+		dev->m_compact_last_tid = tid;
+
+		dst += enter_size + evt_size;
+		p = evt_end;
+	}
+
+	//
+	// Remember how much we consumed so we can update the tail at the next call
+	//
+	dev->m_lastreadsize = (uint32_t)(p - src);
+
+	*buf = dev->m_decode_buf;
+	*len = (uint32_t)(dst - dev->m_decode_buf);
+
+	return SCAP_SUCCESS;
+
+decode_error:
+	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "corrupted compact event in buffer %u", cpuid);
+	ASSERT(false);
+	return SCAP_FAILURE;
+}
+
+int32_t scap_readbuf(scap_t* handle, uint32_t cpuid, bool blocking, OUT char** buf, OUT uint32_t* len)
+{
+	uint32_t thead;
+	uint32_t ttail;
+	uint32_t read_size;
+	uint32_t buffer_size = handle->m_devs[cpuid].m_buffer_size;
+
+	if(handle->m_bpf != NULL)
+	{
+		return scap_bpf_readbuf(handle, cpuid, buf, len);
+	}
+
+	//
+	// Update the tail based on the amount of data read in the *previous* call.
+	// Tail is never updated when we serve the data, because we assume that the caller is using
+	// the buffer we give to her until she calls us again.
+	//
+	ttail = *handle->m_devs[cpuid].m_tail + handle->m_devs[cpuid].m_lastreadsize;
+
+	//
+	// Make sure every read of the old buffer is completed before we move the tail and the
+	// producer (on another CPU) can start overwriting it.
+	// I use this instead of asm(mfence) because it should be portable even on the weirdest
+	// CPUs
+	//
+	__sync_synchronize();
+
+	if(ttail < buffer_size)
+	{
+		*handle->m_devs[cpuid].m_tail = ttail;
+	}
+	else
+	{
+		*handle->m_devs[cpuid].m_tail = ttail - buffer_size;
 	}
 
 	//
@@ -481,16 +1596,19 @@ int32_t scap_readbuf(scap_t* handle, uint32_t cpuid, bool blocking, OUT char** b
 	{
 		//
 		// If we are asked to operate in blocking mode, keep waiting until at least
-		// MIN_USERSPACE_READ_SIZE bytes are in the buffer.
+		// MIN_USERSPACE_READ_SIZE bytes (or half of a smaller buffer) are in the buffer.
 		//
+		uint32_t min_read_size = MIN(MIN_USERSPACE_READ_SIZE, buffer_size / 2);
+
 		while(true)
 		{
-			get_buf_pointers(handle->m_devs[cpuid].m_bufinfo,
+			get_buf_pointers(&handle->m_devs[cpuid],
+			                 buffer_size,
 			                 &thead,
 			                 &ttail,
 			                 &read_size);
 
-			if(read_size >= MIN_USERSPACE_READ_SIZE)
+			if(read_size >= min_read_size)
 			{
 				break;
 			}
@@ -503,7 +1621,8 @@ int32_t scap_readbuf(scap_t* handle, uint32_t cpuid, bool blocking, OUT char** b
 		//
 		// If we are not asked to block, read the pointers and keep going.
 		//
-		get_buf_pointers(handle->m_devs[cpuid].m_bufinfo,
+		get_buf_pointers(&handle->m_devs[cpuid],
+		                 buffer_size,
 		                 &thead,
 		                 &ttail,
 		                 &read_size);
@@ -514,16 +1633,16 @@ int32_t scap_readbuf(scap_t* handle, uint32_t cpuid, bool blocking, OUT char** b
 	// XXX should probably be an assertion, but for the moment we want to print some meaningful info and
 	// stop the processing.
 	//
-	if((handle->m_devs[cpuid].m_bufinfo->tail + read_size) % RING_BUF_SIZE != thead)
+	if((*handle->m_devs[cpuid].m_tail + read_size) % buffer_size != thead)
 	{
 		snprintf(handle->m_lasterr,
 		         SCAP_LASTERR_SIZE,
 		         "buffer corruption. H=%u, T=%u, R=%u, S=%u (%u)",
 		         thead,
-		         handle->m_devs[cpuid].m_bufinfo->tail,
+		         *handle->m_devs[cpuid].m_tail,
 		         read_size,
-		         RING_BUF_SIZE,
-		         (handle->m_devs[cpuid].m_bufinfo->tail + read_size) % RING_BUF_SIZE);
+		         buffer_size,
+		         (*handle->m_devs[cpuid].m_tail + read_size) % buffer_size);
 		ASSERT(false);
 		return SCAP_FAILURE;
 	}
@@ -534,10 +1653,15 @@ int32_t scap_readbuf(scap_t* handle, uint32_t cpuid, bool blocking, OUT char** b
 	       thead,
 	       ttail,
 	       read_size,
-	       (uint32_t)(RING_BUF_SIZE - read_size - 1),
-	       (uint32_t)RING_BUF_SIZE);
+	       (uint32_t)(buffer_size - read_size - 1),
+	       (uint32_t)buffer_size);
 #endif
 
+	if(handle->m_devs[cpuid].m_compact)
+	{
+		return scap_decode_compact_chunk(handle, cpuid, handle->m_devs[cpuid].m_buffer + ttail, read_size, buf, len);
+	}
+
 	//
 	// Remember read_size so we can update the tail at the next call
 	//
@@ -552,202 +1676,1908 @@ int32_t scap_readbuf(scap_t* handle, uint32_t cpuid, bool blocking, OUT char** b
 	return SCAP_SUCCESS;
 }
 
-bool check_scap_next_wait(scap_t* handle)
+//
+// Number of events that scap_consume_dev_event() prefetches ahead
+//
+#define SCAP_PREFETCH_DISTANCE 4
+
+//
+// Read the next chunk of a device for scap_next, and validate all of its
+// events at once, so that consuming them doesn't need to check their length.
+// The offsets of the events are kept to prefetch them before they're consumed.
+//
+static int32_t scap_read_dev(scap_t* handle, uint32_t cpuid)
 {
-	uint32_t j;
+	scap_device* dev = &handle->m_devs[cpuid];
+	uint32_t off = 0;
+	uint32_t n = 0;
+	int32_t res;
 
-	for(j = 0; j < handle->m_ndevs; j++)
+	res = scap_readbuf(handle, cpuid, false, &dev->m_sn_next_event, &dev->m_sn_len);
+	if(res != SCAP_SUCCESS)
 	{
-		uint32_t thead;
-		uint32_t ttail;
-		uint32_t read_size;
-
-		get_buf_pointers(handle->m_devs[j].m_bufinfo, &thead, &ttail, &read_size);
-
-		if(read_size > 100000)
-		{
-			return false;
-		}
+		dev->m_sn_len = 0;
+		return res;
 	}
 
-	return true;
-}
-
-#endif // _WIN32
-
-#ifndef _WIN32
-static inline int32_t scap_next_live(scap_t* handle, OUT scap_evt** pevent, OUT uint16_t* pcpuid)
-#else
-static int32_t scap_next_live(scap_t* handle, OUT scap_evt** pevent, OUT uint16_t* pcpuid)
-#endif
-{
-#if defined(_WIN32) || defined(__APPLE__)
-	//
-	// this should be prevented at open time
-	//
-	ASSERT(false);
-	return SCAP_FAILURE;
-#else
-	uint32_t j;
-	uint64_t max_ts = 0xffffffffffffffff;
-	uint64_t max_buf_size = 0;
-	scap_evt* pe = NULL;
-	bool waited = false;
-
-	*pcpuid = 65535;
+	dev->m_sn_chunk = dev->m_sn_next_event;
+	dev->m_sn_idx = 0;
 
-	for(j = 0; j < handle->m_ndevs; j++)
+	while(off < dev->m_sn_len)
 	{
-		if(handle->m_devs[j].m_sn_len == 0)
-		{
-			//
-			// The buffer for this CPU is fully consumed.
-			// This is a good time to check if we should wait
-			//
-			if(handle->m_emptybuf_timeout_ms != 0)
-			{
-				if(check_scap_next_wait(handle) && !waited)
-				{
-					usleep(BUFFER_EMPTY_WAIT_TIME_MS * 1000);
-					waited = true;
-				}
-			}
-
-			//
-			// read another buffer
-			//
-			int32_t res = scap_readbuf(handle,
-			                           j,
-			                           false,
-			                           &handle->m_devs[j].m_sn_next_event,
-			                           &handle->m_devs[j].m_sn_len);
-
-			if(res != SCAP_SUCCESS)
-			{
-				return res;
-			}
-		}
+		scap_evt* pe = (scap_evt*)(dev->m_sn_chunk + off);
 
-		//
-		// Make sure that we have data
-		//
-		if(handle->m_devs[j].m_sn_len != 0)
+		if(dev->m_sn_len - off < sizeof(scap_evt) ||
+			pe->len < sizeof(scap_evt) ||
+			pe->len > dev->m_sn_len - off)
 		{
-			if(handle->m_devs[j].m_sn_len > max_buf_size)
-			{
-				max_buf_size = handle->m_devs[j].m_sn_len;
-			}
+			snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "scap_next buffer corruption");
 
 			//
-			// We want to consume the event with the lowest timestamp
+			// if you get the following assertion, first recompile the driver and libscap
 			//
-			pe = (scap_evt*)handle->m_devs[j].m_sn_next_event;
+			ASSERT(false);
+			dev->m_sn_len = 0;
+			return SCAP_FAILURE;
+		}
 
 #ifdef _DEBUG
-			ASSERT(pe->len == scap_event_compute_len(pe));
+		ASSERT(pe->len == scap_event_compute_len(pe));
 #endif
 
-			if(pe->ts < max_ts)
-			{
-				if(pe->len > handle->m_devs[j].m_sn_len)
-				{
-					snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "scap_next buffer corruption");
-
-					//
-					// if you get the following assertion, first recompile the driver and libscap
-					//
-					ASSERT(false);
-					return SCAP_FAILURE;
-				}
+		if(n == dev->m_sn_offsets_size)
+		{
+			uint32_t size = (n == 0)? 1024 : n * 2;
+			uint32_t* offsets = (uint32_t*)realloc(dev->m_sn_offsets, size * sizeof(uint32_t));
 
-				*pevent = pe;
-				*pcpuid = j;
-				max_ts = pe->ts;
+			if(offsets == NULL)
+			{
+				snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "error allocating the event offsets");
+				dev->m_sn_len = 0;
+				return SCAP_FAILURE;
 			}
+
+			dev->m_sn_offsets = offsets;
+			dev->m_sn_offsets_size = size;
 		}
+
+		dev->m_sn_offsets[n++] = off;
+		off += pe->len;
 	}
 
+	dev->m_sn_nevts = n;
+
 	//
-	// Check which buffer has been picked
+	// The first events are consumed right away
 	//
-	if(*pcpuid != 65535)
+	for(n = 1; n <= SCAP_PREFETCH_DISTANCE && n < dev->m_sn_nevts; n++)
+	{
+		__builtin_prefetch(dev->m_sn_chunk + dev->m_sn_offsets[n]);
+	}
+
+	return SCAP_SUCCESS;
+}
+
+//
+// Called when all the buffers are empty. Their tails have just been moved past
+// everything we've consumed, so we can sleep until the driver tells us that one
+// of them got past the wakeup watermark, or until the timeout expires.
+//
+static int32_t scap_wait_for_events(scap_t* handle)
+{
+	if(handle->m_emptybuf_timeout_ms != 0)
 	{
+		uint32_t timeout_ms = handle->m_emptybuf_timeout_ms;
+
 		//
-		// Update the pointers.
+		// The driver wakes us up when an event has waited for the max delay,
+		// but if a CPU goes idle right after writing below the watermark
+		// nobody writes the event that would notice it. Don't sleep past it.
 		//
-		ASSERT(handle->m_devs[*pcpuid].m_sn_len >= (*pevent)->len);
-		handle->m_devs[*pcpuid].m_sn_len -= (*pevent)->len;
-		handle->m_devs[*pcpuid].m_sn_next_event += (*pevent)->len;
+		if(handle->m_max_delay_ms != 0 && handle->m_max_delay_ms < timeout_ms)
+		{
+			timeout_ms = handle->m_max_delay_ms;
+		}
 
-		return SCAP_SUCCESS;
+		if(poll(handle->m_pollfds, handle->m_ndevs, timeout_ms) < 0 &&
+			errno != EINTR)
+		{
+			snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "error waiting for the driver buffers: %s", strerror(errno));
+			return SCAP_FAILURE;
+		}
 	}
-	else
+
+	return SCAP_TIMEOUT;
+}
+
+//
+// Read a new chunk for the devices that have been fully consumed, and move the
+// ones that got new events into the merge heap.
+// Reading a buffer releases the previous chunk to the driver, so this must not
+// be called while the caller still holds events from the previous chunk.
+//
+static inline int32_t scap_refill_empty_devs(scap_t* handle)
+{
+	uint32_t j = 0;
+
+	//
+	// The idle devices had nothing to release when they were parked, so
+	// they only need to be read if the driver wrote something since. The ones
+	// that did go back to the empty devices, and are read right below.
+	//
+	if(handle->m_n_idle_devs != 0 &&
+		(--handle->m_idle_check_countdown == 0 || handle->m_merge_heap_size == 0))
+	{
+		handle->m_idle_check_countdown = SCAP_IDLE_CHECK_INTERVAL;
+
+		while(j < handle->m_n_idle_devs)
+		{
+			uint32_t d = handle->m_idle_devs[j];
+			scap_device* dev = &handle->m_devs[d];
+
+			if(*dev->m_head != *dev->m_tail)
+			{
+				dev->m_idle_refills = 0;
+				handle->m_empty_devs[handle->m_n_empty_devs++] = d;
+				handle->m_idle_devs[j] = handle->m_idle_devs[--handle->m_n_idle_devs];
+			}
+			else
+			{
+				j++;
+			}
+		}
+
+		j = 0;
+	}
+
+	while(j < handle->m_n_empty_devs)
+	{
+		uint32_t d = handle->m_empty_devs[j];
+		scap_device* dev = &handle->m_devs[d];
+		int32_t res;
+
+		//
+		// Nothing to release and nothing new: skip the read, which costs a
+		// memory barrier. This keeps idle CPUs cheap, and the ones that stay
+		// idle are parked.
+		//
+		if(dev->m_lastreadsize == 0 && *dev->m_head == *dev->m_tail)
+		{
+			if(++dev->m_idle_refills >= SCAP_IDLE_DEV_REFILLS)
+			{
+				handle->m_idle_devs[handle->m_n_idle_devs++] = d;
+				handle->m_empty_devs[j] = handle->m_empty_devs[--handle->m_n_empty_devs];
+			}
+			else
+			{
+				j++;
+			}
+
+			continue;
+		}
+
+		dev->m_idle_refills = 0;
+
+		res = scap_read_dev(handle, d);
+
+		if(res != SCAP_SUCCESS)
+		{
+			return res;
+		}
+
+		if(dev->m_sn_len != 0)
+		{
+			dev->m_sn_next_ts = ((scap_evt*)dev->m_sn_next_event)->ts;
+			scap_merge_push(handle, d);
+			handle->m_empty_devs[j] = handle->m_empty_devs[--handle->m_n_empty_devs];
+		}
+		else
+		{
+			j++;
+		}
+	}
+
+	return SCAP_SUCCESS;
+}
+
+//
+// Consume the next event of the given device
+//
+static inline int32_t scap_consume_dev_event(scap_t* handle, uint32_t cpuid, OUT scap_evt** pevent)
+{
+	scap_device* dev = &handle->m_devs[cpuid];
+	scap_evt* pe = (scap_evt*)dev->m_sn_next_event;
+	uint32_t ahead = dev->m_sn_idx + 1 + SCAP_PREFETCH_DISTANCE;
+
+	//
+	// The chunk has been validated by scap_read_dev()
+	//
+	ASSERT(dev->m_sn_idx < dev->m_sn_nevts);
+	ASSERT(pe->len <= dev->m_sn_len);
+
+	if(ahead < dev->m_sn_nevts)
+	{
+		__builtin_prefetch(dev->m_sn_chunk + dev->m_sn_offsets[ahead]);
+	}
+
+	dev->m_sn_idx++;
+	dev->m_sn_len -= pe->len;
+	dev->m_sn_next_event += pe->len;
+	dev->m_last_ts = pe->ts;
+
+	*pevent = pe;
+	return SCAP_SUCCESS;
+}
+
+//
+// Consume the oldest event, i.e. the next event of the device at the top of
+// the merge heap, and put the device back in place.
+// The heap must not be empty.
+//
+static inline int32_t scap_consume_merged_event(scap_t* handle, OUT scap_evt** pevent, OUT uint16_t* pcpuid)
+{
+	uint32_t d = handle->m_merge_heap[0];
+	scap_device* dev = &handle->m_devs[d];
+	int32_t res;
+
+	ASSERT(handle->m_merge_heap_size != 0);
+
+	res = scap_consume_dev_event(handle, d, pevent);
+	if(res != SCAP_SUCCESS)
+	{
+		return res;
+	}
+
+	*pcpuid = dev->m_cpuid;
+
+	if(dev->m_sn_len != 0)
+	{
+		dev->m_sn_next_ts = ((scap_evt*)dev->m_sn_next_event)->ts;
+	}
+	else
+	{
+		//
+		// The chunk is fully consumed. The device will be read again by
+		// the next refill, which also releases the chunk to the driver.
+		//
+		handle->m_empty_devs[handle->m_n_empty_devs++] = d;
+		handle->m_merge_heap[0] = handle->m_merge_heap[--handle->m_merge_heap_size];
+	}
+
+	if(handle->m_merge_heap_size != 0)
+	{
+		scap_merge_sift_down(handle, 0);
+	}
+
+	return SCAP_SUCCESS;
+}
+
+//
+// In unordered mode, whether the next event of the device can be returned
+//
+static inline bool scap_unordered_dev_ready(scap_t* handle, uint32_t d)
+{
+	scap_device* dev = &handle->m_devs[d];
+
+	return dev->m_sn_len != 0 &&
+		((scap_evt*)dev->m_sn_next_event)->ts <= scap_unordered_max_ts(handle, d);
+}
+
+//
+// In unordered mode, make sure that m_cur_dev points to a device with data.
+// When the current chunk is fully consumed we move to the next device, so
+// that a busy CPU can't starve the others. An auxiliary ring that got ahead
+// of its main ring is skipped, keeping the rest of its chunk.
+//
+static inline int32_t scap_select_unordered_dev(scap_t* handle)
+{
+	uint32_t j;
+	int32_t res;
+	scap_device* dev = &handle->m_devs[handle->m_cur_dev];
+
+	if(scap_unordered_dev_ready(handle, handle->m_cur_dev))
+	{
+		return SCAP_SUCCESS;
+	}
+
+	//
+	// Release the chunk we've just finished. If the device has new data,
+	// it stays there until its next turn.
+	//
+	if(dev->m_sn_len == 0 && dev->m_lastreadsize != 0)
+	{
+		res = scap_read_dev(handle, handle->m_cur_dev);
+
+		if(res != SCAP_SUCCESS)
+		{
+			return res;
+		}
+	}
+
+	for(j = 1; j <= handle->m_nrings; j++)
+	{
+		uint32_t d = (handle->m_cur_dev + j) % handle->m_nrings;
+
+		dev = &handle->m_devs[d];
+
+		if(dev->m_sn_len == 0)
+		{
+			res = scap_read_dev(handle, d);
+
+			if(res != SCAP_SUCCESS)
+			{
+				return res;
+			}
+		}
+
+		if(scap_unordered_dev_ready(handle, d))
+		{
+			handle->m_cur_dev = d;
+			return SCAP_SUCCESS;
+		}
+	}
+
+	return SCAP_TIMEOUT;
+}
+
+#endif // _WIN32
+
+#ifndef _WIN32
+static inline int32_t scap_next_live(scap_t* handle, OUT scap_evt** pevent, OUT uint16_t* pcpuid)
+#else
+static int32_t scap_next_live(scap_t* handle, OUT scap_evt** pevent, OUT uint16_t* pcpuid)
+#endif
+{
+#if defined(_WIN32) || defined(__APPLE__)
+	//
+	// this should be prevented at open time
+	//
+	ASSERT(false);
+	return SCAP_FAILURE;
+#else
+	int32_t res;
+
+	if(handle->m_state_dump_next_pid >= 0 && handle->m_state_dump_countdown-- == 0)
+	{
+		scap_continue_state_dump(handle);
+	}
+
+	if(handle->m_readers != NULL)
+	{
+		uint32_t n;
+
+		return scap_next_readers(handle, pevent, pcpuid, 1, &n);
+	}
+
+	if(handle->m_unordered)
+	{
+		res = scap_select_unordered_dev(handle);
+		if(res == SCAP_TIMEOUT)
+		{
+			return scap_wait_for_events(handle);
+		}
+		else if(res != SCAP_SUCCESS)
+		{
+			return res;
+		}
+
+		*pcpuid = handle->m_devs[handle->m_cur_dev].m_cpuid;
+		return scap_consume_dev_event(handle, handle->m_cur_dev, pevent);
+	}
+
+	res = scap_refill_empty_devs(handle);
+	if(res != SCAP_SUCCESS)
+	{
+		return res;
+	}
+
+	if(handle->m_merge_heap_size == 0)
+	{
+		//
+		// This happens only when all the buffers are empty.
+		// The caller won't receive an event, but shouldn't treat this as an error and should just retry.
+		//
+		return scap_wait_for_events(handle);
+	}
+
+	return scap_consume_merged_event(handle, pevent, pcpuid);
+#endif
+}
+
+#ifndef _WIN32
+static inline int32_t scap_next_batch_live(scap_t* handle, OUT scap_evt** pevents, OUT uint16_t* pcpuids, uint32_t max_evts, OUT uint32_t* nevts)
+#else
+static int32_t scap_next_batch_live(scap_t* handle, OUT scap_evt** pevents, OUT uint16_t* pcpuids, uint32_t max_evts, OUT uint32_t* nevts)
+#endif
+{
+#if defined(_WIN32) || defined(__APPLE__)
+	//
+	// this should be prevented at open time
+	//
+	ASSERT(false);
+	return SCAP_FAILURE;
+#else
+	uint32_t n = 0;
+	int32_t res;
+
+	if(handle->m_state_dump_next_pid >= 0 && handle->m_state_dump_countdown-- == 0)
+	{
+		scap_continue_state_dump(handle);
+	}
+
+	if(handle->m_readers != NULL)
+	{
+		return scap_next_readers(handle, pevents, pcpuids, max_evts, nevts);
+	}
+
+	if(handle->m_unordered)
+	{
+		uint32_t d;
+
+		res = scap_select_unordered_dev(handle);
+		if(res == SCAP_TIMEOUT)
+		{
+			return scap_wait_for_events(handle);
+		}
+		else if(res != SCAP_SUCCESS)
+		{
+			return res;
+		}
+
+		//
+		// Return the rest of the current chunk, up to max_evts
+		//
+		d = handle->m_cur_dev;
+
+		do
+		{
+			res = scap_consume_dev_event(handle, d, &pevents[n]);
+			if(res != SCAP_SUCCESS)
+			{
+				return res;
+			}
+
+			pcpuids[n] = handle->m_devs[d].m_cpuid;
+			n++;
+		}
+		while(n < max_evts && scap_unordered_dev_ready(handle, d));
+
+		*nevts = n;
+		return SCAP_SUCCESS;
+	}
+
+	//
+	// Read a new chunk for the buffers that have been fully consumed.
+	// This is the only place where we do it: reading a buffer releases the
+	// previous chunk to the driver, and the events we return point into it.
+	//
+	res = scap_refill_empty_devs(handle);
+	if(res != SCAP_SUCCESS)
+	{
+		return res;
+	}
+
+	while(n < max_evts && handle->m_merge_heap_size != 0)
+	{
+		uint32_t d = handle->m_merge_heap[0];
+
+		res = scap_consume_merged_event(handle, &pevents[n], &pcpuids[n]);
+		if(res != SCAP_SUCCESS)
+		{
+			return res;
+		}
+
+		//
+		// If the buffer has been fully consumed, we need to read it again
+		// before we know which event comes next, and we can't do it without
+		// releasing the events in this batch. Stop here.
+		//
+		n++;
+
+		if(handle->m_devs[d].m_sn_len == 0)
+		{
+			break;
+		}
+	}
+
+	*nevts = n;
+
+	if(n == 0)
+	{
+		return scap_wait_for_events(handle);
+	}
+
+	return SCAP_SUCCESS;
+#endif
+}
+
+static int32_t scap_next_unfolded(scap_t* handle, OUT scap_evt** pevent, OUT uint16_t* pcpuid)
+{
+	if(handle->m_merge)
+	{
+		return scap_next_merge(handle, pevent, pcpuid);
+	}
+	else if(handle->m_file)
+	{
+		return scap_next_offline(handle, pevent, pcpuid);
+	}
+	else
+	{
+		return scap_next_live(handle, pevent, pcpuid);
+	}
+}
+
+//
+// Read events until the folding returns some. When the capture ends, or
+// doesn't have new events for now, the runs that it was holding back are
+// returned
+//
+static int32_t scap_next_folded(scap_t* handle, OUT scap_evt** pevent, OUT uint16_t* pcpuid)
+{
+	int32_t res;
+
+	while(!scap_fold_pop(handle->m_fold, pevent, pcpuid))
+	{
+		res = scap_next_unfolded(handle, pevent, pcpuid);
+
+		if(res == SCAP_SUCCESS)
+		{
+			if(scap_fold_event(handle->m_fold, *pevent, *pcpuid, handle->m_lasterr) != SCAP_SUCCESS)
+			{
+				return SCAP_FAILURE;
+			}
+
+			continue;
+		}
+
+		if(res == SCAP_EOF)
+		{
+			if(scap_fold_flush(handle->m_fold, handle->m_lasterr) != SCAP_SUCCESS)
+			{
+				return SCAP_FAILURE;
+			}
+		}
+		else if(res == SCAP_TIMEOUT)
+		{
+#ifndef _WIN32
+			struct timespec now;
+
+			clock_gettime(CLOCK_REALTIME, &now);
+
+			if(scap_fold_expire(handle->m_fold, (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec, handle->m_lasterr) != SCAP_SUCCESS)
+			{
+				return SCAP_FAILURE;
+			}
+#endif
+		}
+		else
+		{
+			return res;
+		}
+
+		if(!scap_fold_pop(handle->m_fold, pevent, pcpuid))
+		{
+			return res;
+		}
+
+		break;
+	}
+
+	return SCAP_SUCCESS;
+}
+
+int32_t scap_next(scap_t* handle, OUT scap_evt** pevent, OUT uint16_t* pcpuid)
+{
+	int32_t res;
+
+	if(handle->m_fold)
+	{
+		res = scap_next_folded(handle, pevent, pcpuid);
+	}
+	else
+	{
+		res = scap_next_unfolded(handle, pevent, pcpuid);
+	}
+
+	if(res == SCAP_SUCCESS)
+	{
+		handle->m_evtcnt++;
+
+		if(handle->m_tap != NULL)
+		{
+			scap_tap_write(handle, *pevent, *pcpuid);
+		}
+	}
+
+	return res;
+}
+
+int32_t scap_next_batch(scap_t* handle, OUT scap_evt** pevents, OUT uint16_t* pcpuids, uint32_t max_evts, OUT uint32_t* nevts)
+{
+	int32_t res;
+
+	*nevts = 0;
+
+	if(max_evts == 0)
+	{
+		return SCAP_SUCCESS;
+	}
+
+	if(handle->m_fold)
+	{
+		//
+		// The events returned by the folding are only valid until the
+		// next one is read
+		//
+		res = scap_next_folded(handle, pevents, pcpuids);
+		if(res == SCAP_SUCCESS)
+		{
+			*nevts = 1;
+		}
+	}
+	else if(handle->m_merge)
+	{
+		//
+		// Like the files, the sources return one event at a time
+		//
+		res = scap_next_merge(handle, pevents, pcpuids);
+		if(res == SCAP_SUCCESS)
+		{
+			*nevts = 1;
+		}
+	}
+	else if(handle->m_file)
+	{
+		//
+		// Offline captures read every event into the same buffer, so we can
+		// only return one at a time
+		//
+		res = scap_next_offline(handle, pevents, pcpuids);
+		if(res == SCAP_SUCCESS)
+		{
+			*nevts = 1;
+		}
+	}
+	else
+	{
+		res = scap_next_batch_live(handle, pevents, pcpuids, max_evts, nevts);
+	}
+
+	if(res == SCAP_SUCCESS)
+	{
+		handle->m_evtcnt += *nevts;
+
+		if(handle->m_tap != NULL)
+		{
+			uint32_t j;
+
+			for(j = 0; j < *nevts; j++)
+			{
+				scap_tap_write(handle, pevents[j], pcpuids[j]);
+			}
+		}
+	}
+
+	return res;
+}
+
+//
+// Return the process list for the given handle
+//
+scap_threadinfo* scap_get_proc_table(scap_t* handle)
+{
+	return handle->m_proclist;
+}
+
+//
+// Return the number of dropped events for the given handle
+//
+int32_t scap_get_stats(scap_t* handle, OUT scap_stats* stats)
+{
+	uint32_t j;
+
+	stats->n_evts = 0;
+	stats->n_drops = 0;
+	stats->n_preemptions = 0;
+	stats->n_copy_bytes = 0;
+
+	for(j = 0; j < handle->m_nrings; j++)
+	{
+		stats->n_evts += handle->m_devs[j].m_stats->n_evts;
+		stats->n_drops += handle->m_devs[j].m_stats->n_drops_buffer + 
+			handle->m_devs[j].m_stats->n_drops_pf;
+		stats->n_preemptions += handle->m_devs[j].m_stats->n_preemptions;
+		stats->n_copy_bytes += handle->m_devs[j].m_stats->n_copy_bytes;
+	}
+
+	return SCAP_SUCCESS;
+}
+
+int32_t scap_get_device_stats(scap_t* handle, uint32_t devid, OUT scap_stats* stats)
+{
+	uint32_t j;
+
+	if(devid >= handle->m_ndevs)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "invalid device %u", devid);
+		return SCAP_FAILURE;
+	}
+
+	stats->n_evts = 0;
+	stats->n_drops = 0;
+	stats->n_preemptions = 0;
+	stats->n_copy_bytes = 0;
+
+	//
+	// The auxiliary rings of the device come after the main rings of all
+	// the devices
+	//
+	for(j = devid; j < handle->m_nrings; j += handle->m_ndevs)
+	{
+		stats->n_evts += handle->m_devs[j].m_stats->n_evts;
+		stats->n_drops += handle->m_devs[j].m_stats->n_drops_buffer +
+			handle->m_devs[j].m_stats->n_drops_pf;
+		stats->n_preemptions += handle->m_devs[j].m_stats->n_preemptions;
+		stats->n_copy_bytes += handle->m_devs[j].m_stats->n_copy_bytes;
+	}
+
+	return SCAP_SUCCESS;
+}
+
+int32_t scap_get_device_info(scap_t* handle, uint32_t devid, OUT scap_device_info* info)
+{
+	scap_device* dev;
+
+	if(devid >= handle->m_ndevs)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "invalid device %u", devid);
+		return SCAP_FAILURE;
+	}
+
+	dev = &handle->m_devs[devid];
+
+	info->cpuid = dev->m_cpuid;
+	info->buffer_size = dev->m_buffer_size;
+	info->numa_node = dev->m_stats->numa_node;
+	info->node_local = (dev->m_stats->placement & PPM_RING_NODE_LOCAL) != 0;
+	info->contiguous = (dev->m_stats->placement & PPM_RING_CONTIGUOUS) != 0;
+
+	return SCAP_SUCCESS;
+}
+
+int32_t scap_get_device_fill(scap_t* handle, uint32_t devid, OUT uint32_t* used)
+{
+	uint32_t thead;
+	uint32_t ttail;
+
+	if(devid >= handle->m_ndevs)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "invalid device %u", devid);
+		return SCAP_FAILURE;
+	}
+
+	//
+	// The perf buffers have running counters instead of offsets
+	//
+	if(handle->m_bpf != NULL)
+	{
+		*used = *handle->m_devs[devid].m_head - *handle->m_devs[devid].m_tail;
+		return SCAP_SUCCESS;
+	}
+
+	get_buf_pointers(&handle->m_devs[devid],
+	                 handle->m_devs[devid].m_buffer_size,
+	                 &thead,
+	                 &ttail,
+	                 used);
+
+	return SCAP_SUCCESS;
+}
+
+int32_t scap_enable_detailed_stats(scap_t* handle, bool enable)
+{
+	//
+	// Not supported on files
+	//
+	if(handle->m_file)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "detailed stats not supported on offline captures");
+		return SCAP_FAILURE;
+	}
+
+	if(handle->m_bpf != NULL)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "detailed stats not supported by the eBPF engine");
+		return SCAP_FAILURE;
+	}
+
+#ifdef _WIN32
+	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "live capture not supported on windows");
+	return SCAP_FAILURE;
+#elif defined(__APPLE__)
+	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "live capture not supported on OSX");
+	return SCAP_FAILURE;
+#else
+	if(ioctl(handle->m_devs[0].m_fd, PPM_IOCTL_SET_DETAILED_STATS, enable? 1 : 0))
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "scap_enable_detailed_stats failed: %s", strerror(errno));
+		return SCAP_FAILURE;
+	}
+
+	return SCAP_SUCCESS;
+#endif
+}
+
+int32_t scap_get_detailed_stats(scap_t* handle, int32_t cpuid, OUT struct ppm_detailed_stats* stats)
+{
+	//
+	// Not supported on files
+	//
+	if(handle->m_file)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "detailed stats not supported on offline captures");
+		return SCAP_FAILURE;
+	}
+
+	if(handle->m_bpf != NULL)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "detailed stats not supported by the eBPF engine");
+		return SCAP_FAILURE;
+	}
+
+#ifdef _WIN32
+	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "live capture not supported on windows");
+	return SCAP_FAILURE;
+#elif defined(__APPLE__)
+	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "live capture not supported on OSX");
+	return SCAP_FAILURE;
+#else
+	struct ppm_detailed_stats cpustats;
+	uint32_t j;
+	uint32_t k;
+
+	if(cpuid >= (int32_t)handle->m_ndevs)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "invalid cpu %d", cpuid);
+		return SCAP_FAILURE;
+	}
+
+	memset(stats, 0, sizeof(*stats));
+
+	for(j = 0; j < handle->m_ndevs; j++)
+	{
+		if(cpuid >= 0 && (uint32_t)cpuid != j)
+		{
+			continue;
+		}
+
+		if(ioctl(handle->m_devs[j].m_fd, PPM_IOCTL_GET_DETAILED_STATS, &cpustats))
+		{
+			snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "scap_get_detailed_stats failed: %s", strerror(errno));
+			return SCAP_FAILURE;
+		}
+
+		for(k = 0; k < PPM_EVENT_MAX; k++)
+		{
+			stats->evts[k].n_evts += cpustats.evts[k].n_evts;
+			stats->evts[k].n_bytes += cpustats.evts[k].n_bytes;
+			stats->evts[k].n_drops += cpustats.evts[k].n_drops;
+			stats->evts[k].filler_ns += cpustats.evts[k].filler_ns;
+			stats->evts[k].record_ns += cpustats.evts[k].record_ns;
+		}
+
+		for(k = 0; k < PPM_FILLER_LATENCY_BUCKETS; k++)
+		{
+			stats->filler_latency[k] += cpustats.filler_latency[k];
+		}
+	}
+
+	return SCAP_SUCCESS;
+#endif
+}
+
+int32_t scap_set_syscall_aggregation(scap_t* handle, uint32_t flags)
+{
+	//
+	// Not supported on files
+	//
+	if(handle->m_file)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "syscall aggregation not supported on offline captures");
+		return SCAP_FAILURE;
+	}
+
+	if(handle->m_bpf != NULL)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "syscall aggregation not supported by the eBPF engine");
+		return SCAP_FAILURE;
+	}
+
+	//
+	// The reader threads read the devices without locking
+	//
+	if(handle->m_readers != NULL)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "syscall aggregation can't be changed while the reader threads are running");
+		return SCAP_FAILURE;
+	}
+
+#ifdef _WIN32
+	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "live capture not supported on windows");
+	return SCAP_FAILURE;
+#elif defined(__APPLE__)
+	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "live capture not supported on OSX");
+	return SCAP_FAILURE;
+#else
+	uint32_t j;
+	void* table;
+
+	scap_unmap_aggr_tables(handle);
+
+	if(ioctl(handle->m_devs[0].m_fd, PPM_IOCTL_SET_SYSCALL_AGGREGATION, flags))
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "scap_set_syscall_aggregation failed: %s", strerror(errno));
+		return SCAP_FAILURE;
+	}
+
+	if(!(flags & PPM_AGGR_ENABLED))
+	{
+		return SCAP_SUCCESS;
+	}
+
+	//
+	// Map the aggregation table of every CPU
+	//
+	for(j = 0; j < handle->m_ndevs; j++)
+	{
+		table = mmap(0,
+			sizeof(struct ppm_syscall_aggr_table),
+			PROT_READ,
+			MAP_SHARED,
+			handle->m_devs[j].m_fd,
+			PPM_AGGR_MMAP_PGOFF * sysconf(_SC_PAGESIZE));
+
+		if(table == MAP_FAILED)
+		{
+			scap_unmap_aggr_tables(handle);
+			ioctl(handle->m_devs[0].m_fd, PPM_IOCTL_SET_SYSCALL_AGGREGATION, 0);
+			snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "error mapping the syscall aggregation table for device %u", j);
+			return SCAP_FAILURE;
+		}
+
+		handle->m_devs[j].m_aggr_table = (struct ppm_syscall_aggr_table*)table;
+	}
+
+	return SCAP_SUCCESS;
+#endif
+}
+
+int32_t scap_set_compact_encoding(scap_t* handle, bool enable)
+{
+	//
+	// Not supported on files
+	//
+	if(handle->m_file)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "compact encoding not supported on offline captures");
+		return SCAP_FAILURE;
+	}
+
+	if(handle->m_bpf != NULL)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "compact encoding not supported by the eBPF engine");
+		return SCAP_FAILURE;
+	}
+
+	//
+	// The decoding state of the devices and the merge belong to the reader
+	// threads while they run
+	//
+	if(handle->m_readers != NULL)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "compact encoding can't be changed while the reader threads are running");
+		return SCAP_FAILURE;
+	}
+
+#ifdef _WIN32
+	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "live capture not supported on windows");
+	return SCAP_FAILURE;
+#elif defined(__APPLE__)
+	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "live capture not supported on OSX");
+	return SCAP_FAILURE;
+#else
+	uint32_t j;
+
+	//
+	// A decoded event is never larger than the ring buffer, so a decode
+	// buffer of the same size always fits at least one
+	//
+	for(j = 0; enable && j < handle->m_ndevs; j++)
+	{
+		if(handle->m_devs[j].m_decode_buf == NULL)
+		{
+			handle->m_devs[j].m_decode_buf = (char*)malloc(handle->m_devs[j].m_buffer_size);
+			if(handle->m_devs[j].m_decode_buf == NULL)
+			{
+				snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "error allocating the decode buffers");
+				return SCAP_FAILURE;
+			}
+		}
+	}
+
+	if(ioctl(handle->m_devs[0].m_fd, PPM_IOCTL_SET_COMPACT_ENCODING, enable ? 1 : 0))
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "scap_set_compact_encoding failed: %s", strerror(errno));
+		return SCAP_FAILURE;
+	}
+
+	//
+	// The driver has discarded the content of the buffers, and the
+	// decoding starts from scratch
+	//
+	for(j = 0; j < handle->m_ndevs; j++)
+	{
+		handle->m_devs[j].m_compact = enable;
+		handle->m_devs[j].m_lastreadsize = 0;
+		handle->m_devs[j].m_sn_len = 0;
+		handle->m_devs[j].m_compact_last_ts = 0;
+		handle->m_devs[j].m_compact_last_tid = 0;
+	}
+
+	scap_reset_merge(handle);
+
+	return SCAP_SUCCESS;
+#endif
+}
+
+int32_t scap_set_exit_only(scap_t* handle, bool enable)
+{
+	//
+	// Not supported on files
+	//
+	if(handle->m_file)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "exit only mode not supported on offline captures");
+		return SCAP_FAILURE;
+	}
+
+	if(handle->m_bpf != NULL)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "exit only mode not supported by the eBPF engine");
+		return SCAP_FAILURE;
+	}
+
+#ifdef _WIN32
+	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "live capture not supported on windows");
+	return SCAP_FAILURE;
+#elif defined(__APPLE__)
+	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "live capture not supported on OSX");
+	return SCAP_FAILURE;
+#else
+	//
+	// The enter events travel inside the compact form of the exit ones
+	//
+	if(enable && (handle->m_ndevs == 0 || !handle->m_devs[0].m_compact))
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "the exit only mode requires the compact encoding");
+		return SCAP_FAILURE;
+	}
+
+	if(ioctl(handle->m_devs[0].m_fd, PPM_IOCTL_SET_EXIT_ONLY, enable ? 1 : 0))
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "scap_set_exit_only failed: %s", strerror(errno));
+		return SCAP_FAILURE;
+	}
+
+	return SCAP_SUCCESS;
+#endif
+}
+
+int32_t scap_set_tcp_tuple_elision(scap_t* handle, bool enable)
+{
+	//
+	// Not supported on files
+	//
+	if(handle->m_file)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "tcp tuple elision not supported on offline captures");
+		return SCAP_FAILURE;
+	}
+
+	if(handle->m_bpf != NULL)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "tcp tuple elision not supported by the eBPF engine");
+		return SCAP_FAILURE;
+	}
+
+#ifdef _WIN32
+	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "live capture not supported on windows");
+	return SCAP_FAILURE;
+#elif defined(__APPLE__)
+	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "live capture not supported on OSX");
+	return SCAP_FAILURE;
+#else
+	if(ioctl(handle->m_devs[0].m_fd, PPM_IOCTL_SET_TCP_TUPLE_ELISION, enable ? 1 : 0))
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "scap_set_tcp_tuple_elision failed: %s", strerror(errno));
+		return SCAP_FAILURE;
+	}
+
+	return SCAP_SUCCESS;
+#endif
+}
+
+int32_t scap_set_buffer_hash(scap_t* handle, uint32_t len)
+{
+	//
+	// Not supported on files
+	//
+	if(handle->m_file)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "buffer hash not supported on offline captures");
+		return SCAP_FAILURE;
+	}
+
+	if(handle->m_bpf != NULL)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "buffer hash not supported by the eBPF engine");
+		return SCAP_FAILURE;
+	}
+
+#ifdef _WIN32
+	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "live capture not supported on windows");
+	return SCAP_FAILURE;
+#elif defined(__APPLE__)
+	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "live capture not supported on OSX");
+	return SCAP_FAILURE;
+#else
+	if(len > PPM_MAX_BUFFER_HASH_LEN)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "invalid buffer hash length %u, the maximum is %u", len, PPM_MAX_BUFFER_HASH_LEN);
+		return SCAP_FAILURE;
+	}
+
+	if(ioctl(handle->m_devs[0].m_fd, PPM_IOCTL_SET_BUFFER_HASH, len))
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "scap_set_buffer_hash failed: %s", strerror(errno));
+		return SCAP_FAILURE;
+	}
+
+	if(len != 0)
+	{
+		handle->m_machine_info.flags |= SCAP_MI_BUFFER_HASH;
+	}
+	else
+	{
+		handle->m_machine_info.flags &= ~(uint64_t)SCAP_MI_BUFFER_HASH;
+	}
+
+	return SCAP_SUCCESS;
+#endif
+}
+
+int32_t scap_set_switch_summary(scap_t* handle, uint32_t interval_ms)
+{
+	//
+	// Not supported on files
+	//
+	if(handle->m_file)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "context switch summaries not supported on offline captures");
+		return SCAP_FAILURE;
+	}
+
+	if(handle->m_bpf != NULL)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "context switch summaries not supported by the eBPF engine");
+		return SCAP_FAILURE;
+	}
+
+#ifdef _WIN32
+	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "live capture not supported on windows");
+	return SCAP_FAILURE;
+#elif defined(__APPLE__)
+	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "live capture not supported on OSX");
+	return SCAP_FAILURE;
+#else
+	if(ioctl(handle->m_devs[0].m_fd, PPM_IOCTL_SET_SWITCH_SUMMARY, interval_ms))
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "scap_set_switch_summary failed: %s", strerror(errno));
+		return SCAP_FAILURE;
+	}
+
+	return SCAP_SUCCESS;
+#endif
+}
+
+int32_t scap_set_runq_summary(scap_t* handle, uint32_t interval_ms)
+{
+	//
+	// Not supported on files
+	//
+	if(handle->m_file)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "run queue summaries not supported on offline captures");
+		return SCAP_FAILURE;
+	}
+
+	if(handle->m_bpf != NULL)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "run queue summaries not supported by the eBPF engine");
+		return SCAP_FAILURE;
+	}
+
+#ifdef _WIN32
+	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "live capture not supported on windows");
+	return SCAP_FAILURE;
+#elif defined(__APPLE__)
+	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "live capture not supported on OSX");
+	return SCAP_FAILURE;
+#else
+	if(ioctl(handle->m_devs[0].m_fd, PPM_IOCTL_SET_RUNQ_SUMMARY, interval_ms))
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "scap_set_runq_summary failed: %s", strerror(errno));
+		return SCAP_FAILURE;
+	}
+
+	return SCAP_SUCCESS;
+#endif
+}
+
+int32_t scap_set_pgfault_summary(scap_t* handle, uint32_t interval_ms)
+{
+	//
+	// Not supported on files
+	//
+	if(handle->m_file)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "page fault summaries not supported on offline captures");
+		return SCAP_FAILURE;
+	}
+
+	if(handle->m_bpf != NULL)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "page fault summaries not supported by the eBPF engine");
+		return SCAP_FAILURE;
+	}
+
+#ifdef _WIN32
+	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "live capture not supported on windows");
+	return SCAP_FAILURE;
+#elif defined(__APPLE__)
+	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "live capture not supported on OSX");
+	return SCAP_FAILURE;
+#else
+	if(ioctl(handle->m_devs[0].m_fd, PPM_IOCTL_SET_PGFAULT_SUMMARY, interval_ms))
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "scap_set_pgfault_summary failed: %s", strerror(errno));
+		return SCAP_FAILURE;
+	}
+
+	return SCAP_SUCCESS;
+#endif
+}
+
+#if !defined(_WIN32) && !defined(__APPLE__)
+//
+// Ask the driver for the given auxiliary rings, and map them after the
+// rings we already have. The merge takes care of ordering their events with
+// the others.
+//
+static int32_t scap_enable_aux_ring(scap_t* handle, uint32_t aux, int request, uint32_t ring_size, const char* name)
+{
+	uint32_t j;
+	uint32_t base = handle->m_nrings;
+	off_t offset = (off_t)PPM_AUX_RING_MMAP_PGOFF(aux) * sysconf(_SC_PAGESIZE);
+
+	if(handle->m_bpf != NULL)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "the %s ring is not supported by the eBPF engine", name);
+		return SCAP_FAILURE;
+	}
+
+	//
+	// The readers split the rings among them when they start
+	//
+	if(handle->m_readers != NULL)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "the %s ring must be enabled before starting the reader threads", name);
+		return SCAP_FAILURE;
+	}
+
+	if(handle->m_aux_rings & (1 << aux))
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "the %s ring is already enabled", name);
+		return SCAP_FAILURE;
+	}
+
+	if(ioctl(handle->m_devs[0].m_fd, request, ring_size))
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "error enabling the %s ring: %s", name, strerror(errno));
+		return SCAP_FAILURE;
+	}
+
+	for(j = 0; j < handle->m_ndevs; j++)
+	{
+		scap_device* dev = &handle->m_devs[base + j];
+
+		dev->m_fd = handle->m_devs[j].m_fd;
+		dev->m_buffer_size = ring_size;
+		dev->m_buffer = (char*)mmap(0,
+		                            ring_size * 2,
+		                            PROT_READ,
+		                            MAP_SHARED,
+		                            dev->m_fd,
+		                            offset);
+
+		if(dev->m_buffer == MAP_FAILED)
+		{
+			snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "error mapping the %s ring for device %u", name, j);
+			break;
+		}
+
+		dev->m_bufinfo = (struct ppm_ring_buffer_info*)mmap(0,
+		                                                   sizeof(struct ppm_ring_buffer_info),
+		                                                   PROT_READ | PROT_WRITE,
+		                                                   MAP_SHARED,
+		                                                   dev->m_fd,
+		                                                   offset);
+
+		if(dev->m_bufinfo == MAP_FAILED)
+		{
+			munmap(dev->m_buffer, ring_size * 2);
+			dev->m_buffer = (char*)MAP_FAILED;
+			snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "error mapping the %s ring info for device %u", name, j);
+			break;
+		}
+
+		scap_set_bufinfo_fields(handle, dev);
+		dev->m_lastreadsize = 0;
+		dev->m_sn_len = 0;
+		dev->m_idle_refills = 0;
+	}
+
+	if(j < handle->m_ndevs)
+	{
+		while(j-- > 0)
+		{
+			scap_device* dev = &handle->m_devs[base + j];
+
+			munmap(dev->m_bufinfo, sizeof(struct ppm_ring_buffer_info));
+			munmap(dev->m_buffer, ring_size * 2);
+			dev->m_buffer = (char*)MAP_FAILED;
+			dev->m_bufinfo = (struct ppm_ring_buffer_info*)MAP_FAILED;
+		}
+
+		return SCAP_FAILURE;
+	}
+
+	handle->m_nrings += handle->m_ndevs;
+	handle->m_aux_rings |= 1 << aux;
+	scap_reset_merge(handle);
+
+	return SCAP_SUCCESS;
+}
+#endif
+
+int32_t scap_enable_procinfo_ring(scap_t* handle, uint32_t ring_size)
+{
+	//
+	// Not supported on files
+	//
+	if(handle->m_file)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "deferred process info not supported on offline captures");
+		return SCAP_FAILURE;
+	}
+
+#ifdef _WIN32
+	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "live capture not supported on windows");
+	return SCAP_FAILURE;
+#elif defined(__APPLE__)
+	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "live capture not supported on OSX");
+	return SCAP_FAILURE;
+#else
+	return scap_enable_aux_ring(handle, PPM_AUX_RING_PROCINFO, PPM_IOCTL_ENABLE_PROCINFO_RING, ring_size, "process info");
+#endif
+}
+
+int32_t scap_enable_state_ring(scap_t* handle, uint32_t ring_size)
+{
+	//
+	// Not supported on files
+	//
+	if(handle->m_file)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "the state ring is not supported on offline captures");
+		return SCAP_FAILURE;
+	}
+
+#ifdef _WIN32
+	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "live capture not supported on windows");
+	return SCAP_FAILURE;
+#elif defined(__APPLE__)
+	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "live capture not supported on OSX");
+	return SCAP_FAILURE;
+#else
+	return scap_enable_aux_ring(handle, PPM_AUX_RING_STATE, PPM_IOCTL_ENABLE_STATE_RING, ring_size, "state");
+#endif
+}
+
+const struct ppm_syscall_aggr_table* scap_get_syscall_aggr_table(scap_t* handle, uint32_t cpuid)
+{
+#if defined(_WIN32) || defined(__APPLE__)
+	return NULL;
+#else
+	if(handle->m_file || cpuid >= handle->m_ndevs)
+	{
+		return NULL;
+	}
+
+	return handle->m_devs[cpuid].m_aggr_table;
+#endif
+}
+
+//
+// Stop capturing the events
+//
+int32_t scap_stop_capture(scap_t* handle)
+{
+#ifdef _WIN32
+	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "live capture not supported on windows");
+	return SCAP_FAILURE;
+#elif defined(__APPLE__)
+	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "live capture not supported on OSX");
+	return SCAP_FAILURE;
+#else
+	uint32_t j;
+
+	//
+	// Not supported for files
+	//
+	if(handle->m_file)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "cannot stop offline captures");
+		ASSERT(false);
+		return SCAP_FAILURE;
+	}
+
+	//
+	// Disable capture on all the rings
+	//
+	if(handle->m_bpf != NULL)
+	{
+		if(scap_bpf_set_capture(handle, false) != SCAP_SUCCESS)
+		{
+			return SCAP_FAILURE;
+		}
+	}
+	else
+	{
+		for(j = 0; j < handle->m_ndevs; j++)
+		{
+			if(ioctl(handle->m_devs[j].m_fd, PPM_IOCTL_DISABLE_CAPTURE))
+			{
+				snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "scap_stop_capture failed for device %" PRIu32, j);
+				ASSERT(false);
+				return SCAP_FAILURE;
+			}
+		}
+	}
+
+	//
+	// Since no new data is going to be produced, we disable read waits so that the remaining data
+	// can be consumd without slowdowns
+	//
+	handle->m_emptybuf_timeout_ms = 0;
+
+	return SCAP_SUCCESS;
+#endif // _WIN32
+}
+
+//
+// Start capturing the events
+//
+int32_t scap_start_capture(scap_t* handle)
+{
+#ifdef _WIN32
+	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "live capture non supported on windows");
+	return SCAP_FAILURE;
+#elif defined(__APPLE__)
+	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "live capture non supported on OSX");
+	return SCAP_FAILURE;
+#else
+	uint32_t j;
+
+	//
+	// Not supported for files
+	//
+	if(handle->m_file)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "cannot start offline captures");
+		ASSERT(false);
+		return SCAP_FAILURE;
+	}
+
+	//
+	// Enable capture on all the rings
+	//
+	if(handle->m_bpf != NULL)
+	{
+		return scap_bpf_set_capture(handle, true);
+	}
+
+	for(j = 0; j < handle->m_ndevs; j++)
+	{
+		if(ioctl(handle->m_devs[j].m_fd, PPM_IOCTL_ENABLE_CAPTURE))
+		{
+			snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "scap_start_capture failed for device %" PRIu32, j);
+			ASSERT(false);
+			return SCAP_FAILURE;
+		}
+	}
+
+	return SCAP_SUCCESS;
+#endif // _WIN32
+}
+
+#if !defined (_WIN32) && !defined(__APPLE__)
+static int32_t scap_set_dropping_mode(scap_t* handle, int request, uint32_t sampling_ratio)
+{
+	//	
+	// Not supported for files
+	//
+	if(handle->m_file)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "dropping mode not supported on offline captures");
+		ASSERT(false);
+		return SCAP_FAILURE;
+	}
+
+	if(handle->m_bpf != NULL)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "dropping mode not supported by the eBPF engine");
+		return SCAP_FAILURE;
+	}
+
+	if(handle->m_ndevs)
+	{
+		if(ioctl(handle->m_devs[0].m_fd, request, sampling_ratio))
+		{
+			snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "%s failed", __FUNCTION__);
+			ASSERT(false);
+			return SCAP_FAILURE;
+		}		
+	}
+
+	return SCAP_SUCCESS;
+}
+#endif
+
+int32_t scap_stop_dropping_mode(scap_t* handle)
+{
+#ifdef _WIN32
+	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "live capture not supported on windows");
+	return SCAP_FAILURE;
+#elif defined(__APPLE__)
+	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "live capture not supported on OSX");
+	return SCAP_FAILURE;
+#else
+	return scap_set_dropping_mode(handle, PPM_IOCTL_DISABLE_DROPPING_MODE, 0);
+#endif
+}
+
+int32_t scap_start_dropping_mode(scap_t* handle, uint32_t sampling_ratio)
+{
+#ifdef _WIN32
+	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "live capture not supported on windows");
+	return SCAP_FAILURE;
+#elif defined(__APPLE__)
+	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "live capture not supported on OSX");
+	return SCAP_FAILURE;
+#else
+	return scap_set_dropping_mode(handle, PPM_IOCTL_ENABLE_DROPPING_MODE, sampling_ratio);
+#endif
+}
+
+//
+// Return the list of device addresses
+//
+scap_addrlist* scap_get_ifaddr_list(scap_t* handle)
+{
+	if(scap_load_iflist(handle) != SCAP_SUCCESS)
+	{
+		return NULL;
+	}
+
+	return handle->m_addrlist;
+}
+
+//
+// Return the list of machine users
+//
+scap_userlist* scap_get_user_list(scap_t* handle)
+{
+	if(scap_load_userlist(handle) != SCAP_SUCCESS)
+	{
+		return NULL;
+	}
+
+	return handle->m_userlist;
+}
+
+//
+// Get the machine information
+//
+const scap_machine_info* scap_get_machine_info(scap_t* handle)
+{
+	if(handle->m_machine_info.num_cpus != (uint32_t)-1)
+	{
+		return (const scap_machine_info*)&handle->m_machine_info;
+	}
+	else
+	{
+		//
+		// Reading from a file with no process info block
+		//
+		return NULL;
+	}
+}
+
+int32_t scap_set_snaplen(scap_t* handle, uint32_t snaplen)
+{
+	//
+	// Not supported on files
+	//
+	if(handle->m_file)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "setting snaplen not supported on offline captures");
+		return SCAP_FAILURE;
+	}
+
+#ifdef _WIN32
+	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "live capture not supported on windows");
+	return SCAP_FAILURE;
+#elif defined(__APPLE__)
+	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "live capture not supported on OSX");
+	return SCAP_FAILURE;
+#else
+	//
+	// The eBPF programs don't copy any buffer
+	//
+	if(handle->m_bpf != NULL)
+	{
+		return SCAP_SUCCESS;
+	}
+
+	//
+	// Tell the driver to change the snaplen
+	//
+	if(ioctl(handle->m_devs[0].m_fd, PPM_IOCTL_SET_SNAPLEN, snaplen))
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "scap_set_snaplen failed");
+		ASSERT(false);
+		return SCAP_FAILURE;
+	}
+
+	//
+	// The reader threads own the read buffers, and a few events with the
+	// old snaplen still come through them
+	//
+	if(handle->m_readers == NULL)
+	{
+		uint32_t j;
+
+		//
+		// Force a flush of the read buffers, so we don't capture events with the old snaplen
+		//
+		for(j = 0; j < handle->m_ndevs; j++)
+		{
+			scap_readbuf(handle,
+               j,
+               false,
+               &handle->m_devs[j].m_sn_next_event,
+               &handle->m_devs[j].m_sn_len);
+
+			handle->m_devs[j].m_sn_len = 0;
+		}
+
+		scap_reset_merge(handle);
+	}
+
+	return SCAP_SUCCESS;
+#endif
+}
+
+int32_t scap_set_event_mask(scap_t* handle, struct ppm_evt_mask* mask)
+{
+	//
+	// Not supported on files
+	//
+	if(handle->m_file)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "setting the event mask not supported on offline captures");
+		return SCAP_FAILURE;
+	}
+
+#ifdef _WIN32
+	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "live capture not supported on windows");
+	return SCAP_FAILURE;
+#elif defined(__APPLE__)
+	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "live capture not supported on OSX");
+	return SCAP_FAILURE;
+#else
+	if(handle->m_bpf != NULL)
+	{
+		return scap_bpf_set_event_mask(handle, mask);
+	}
+
+	//
+	// Tell the driver to change the event mask
+	//
+	if(ioctl(handle->m_devs[0].m_fd, PPM_IOCTL_SET_EVENT_MASK, mask))
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "scap_set_event_mask failed");
+		ASSERT(false);
+		return SCAP_FAILURE;
+	}
+
+	return SCAP_SUCCESS;
+#endif
+}
+
+
+int32_t scap_set_sampling_policy(scap_t* handle, struct ppm_sampling_policy* policy)
+{
+	//
+	// Not supported on files
+	//
+	if(handle->m_file)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "setting the sampling policy not supported on offline captures");
+		return SCAP_FAILURE;
+	}
+
+	if(handle->m_bpf != NULL)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "sampling policies not supported by the eBPF engine");
+		return SCAP_FAILURE;
+	}
+
+#ifdef _WIN32
+	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "live capture not supported on windows");
+	return SCAP_FAILURE;
+#elif defined(__APPLE__)
+	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "live capture not supported on OSX");
+	return SCAP_FAILURE;
+#else
+	if(policy->adaptive_threshold > 100)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "invalid adaptive sampling threshold %u%%", policy->adaptive_threshold);
+		return SCAP_FAILURE;
+	}
+
+	//
+	// Tell the driver to change the sampling policy
+	//
+	if(ioctl(handle->m_devs[0].m_fd, PPM_IOCTL_SET_SAMPLING_POLICY, policy))
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "scap_set_sampling_policy failed");
+		ASSERT(false);
+		return SCAP_FAILURE;
+	}
+
+	return SCAP_SUCCESS;
+#endif
+}
+
+int32_t scap_set_snaplen_policy(scap_t* handle, struct ppm_snaplen_policy* policy)
+{
+	//
+	// Not supported on files
+	//
+	if(handle->m_file)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "setting the snaplen policy not supported on offline captures");
+		return SCAP_FAILURE;
+	}
+
+	if(handle->m_bpf != NULL)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "snaplen policies not supported by the eBPF engine");
+		return SCAP_FAILURE;
+	}
+
+#ifdef _WIN32
+	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "live capture not supported on windows");
+	return SCAP_FAILURE;
+#elif defined(__APPLE__)
+	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "live capture not supported on OSX");
+	return SCAP_FAILURE;
+#else
+	if(policy->n_rules > PPM_MAX_SNAPLEN_RULES)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "too many snaplen rules %u, the maximum is %u", policy->n_rules, PPM_MAX_SNAPLEN_RULES);
+		return SCAP_FAILURE;
+	}
+
+	//
+	// Tell the driver to change the snaplen policy
+	//
+	if(ioctl(handle->m_devs[0].m_fd, PPM_IOCTL_SET_SNAPLEN_POLICY, policy))
 	{
-		//
-		// This happens only when all the buffers are empty, which should be very rare.
-		// The caller want't receive an event, but shouldn't treat this as an error and should just retry.
-		//
-		return SCAP_TIMEOUT;
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "scap_set_snaplen_policy failed");
+		ASSERT(false);
+		return SCAP_FAILURE;
 	}
+
+	return SCAP_SUCCESS;
 #endif
 }
 
-int32_t scap_next(scap_t* handle, OUT scap_evt** pevent, OUT uint16_t* pcpuid)
+int32_t scap_set_excluded_tids(scap_t* handle, uint64_t* tids, uint32_t ntids)
 {
-	int32_t res;
-
+	//
+	// Not supported on files
+	//
 	if(handle->m_file)
 	{
-		res = scap_next_offline(handle, pevent, pcpuid);
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "excluding threads not supported on offline captures");
+		return SCAP_FAILURE;
 	}
-	else
+
+#ifdef _WIN32
+	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "live capture not supported on windows");
+	return SCAP_FAILURE;
+#elif defined(__APPLE__)
+	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "live capture not supported on OSX");
+	return SCAP_FAILURE;
+#else
+	struct ppm_tid_exclusion_list list;
+
+	if(ntids > PPM_MAX_EXCLUDED_TIDS)
 	{
-		res = scap_next_live(handle, pevent, pcpuid);
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "too many excluded threads (%u, max is %u)", ntids, PPM_MAX_EXCLUDED_TIDS);
+		return SCAP_FAILURE;
 	}
 
-	if(res == SCAP_SUCCESS)
+	if(handle->m_bpf != NULL)
 	{
-		handle->m_evtcnt++;
+		return scap_bpf_set_excluded_tids(handle, tids, ntids);
 	}
 
-	return res;
-}
-
-//
-// Return the process list for the given handle
-//
-scap_threadinfo* scap_get_proc_table(scap_t* handle)
-{
-	return handle->m_proclist;
-}
-
-//
-// Return the number of dropped events for the given handle
-//
-int32_t scap_get_stats(scap_t* handle, OUT scap_stats* stats)
-{
-	uint32_t j;
-
-	stats->n_evts = 0;
-	stats->n_drops = 0;
-	stats->n_preemptions = 0;
+	memset(&list, 0, sizeof(list));
+	list.ntids = ntids;
+	if(ntids != 0)
+	{
+		memcpy(list.tids, tids, ntids * sizeof(uint64_t));
+	}
 
-	for(j = 0; j < handle->m_ndevs; j++)
+	//
+	// Tell the driver to change the exclusion list
+	//
+	if(ioctl(handle->m_devs[0].m_fd, PPM_IOCTL_SET_EXCLUDED_TIDS, &list))
 	{
-		stats->n_evts += handle->m_devs[j].m_bufinfo->n_evts;
-		stats->n_drops += handle->m_devs[j].m_bufinfo->n_drops_buffer + 
-			handle->m_devs[j].m_bufinfo->n_drops_pf;
-		stats->n_preemptions += handle->m_devs[j].m_bufinfo->n_preemptions;
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "scap_set_excluded_tids failed");
+		ASSERT(false);
+		return SCAP_FAILURE;
 	}
 
 	return SCAP_SUCCESS;
+#endif
 }
 
-//
-// Stop capturing the events
-//
-int32_t scap_stop_capture(scap_t* handle)
+int32_t scap_set_predicate(scap_t* handle, struct ppm_predicate* pred)
 {
+	//
+	// Not supported on files
+	//
+	if(handle->m_file)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "setting the predicate not supported on offline captures");
+		return SCAP_FAILURE;
+	}
+
 #ifdef _WIN32
 	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "live capture not supported on windows");
 	return SCAP_FAILURE;
@@ -755,111 +3585,92 @@ int32_t scap_stop_capture(scap_t* handle)
 	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "live capture not supported on OSX");
 	return SCAP_FAILURE;
 #else
-	uint32_t j;
-
-	//
-	// Not supported for files
-	//
-	if(handle->m_file)
+	if(pred->n_clauses > PPM_MAX_PREDICATE_CLAUSES)
 	{
-		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "cannot stop offline captures");
-		ASSERT(false);
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "too many predicate clauses %u, the maximum is %u", pred->n_clauses, PPM_MAX_PREDICATE_CLAUSES);
 		return SCAP_FAILURE;
 	}
 
-	//
-	// Disable capture on all the rings
-	//
-	for(j = 0; j < handle->m_ndevs; j++)
+	if(handle->m_bpf != NULL)
 	{
-		if(ioctl(handle->m_devs[j].m_fd, PPM_IOCTL_DISABLE_CAPTURE))
-		{
-			snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "scap_stop_capture failed for device %" PRIu32, j);
-			ASSERT(false);
-			return SCAP_FAILURE;
-		}
+		return scap_bpf_set_predicate(handle, pred);
 	}
 
 	//
-	// Since no new data is going to be produced, we disable read waits so that the remaining data
-	// can be consumd without slowdowns
+	// Tell the driver to change the predicate. Older drivers don't have
+	// it, so this is not asserted.
 	//
-	handle->m_emptybuf_timeout_ms = 0;
+	if(ioctl(handle->m_devs[0].m_fd, PPM_IOCTL_SET_PREDICATE, pred))
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "scap_set_predicate failed");
+		return SCAP_FAILURE;
+	}
 
 	return SCAP_SUCCESS;
-#endif // _WIN32
+#endif
 }
 
-//
-// Start capturing the events
-//
-int32_t scap_start_capture(scap_t* handle)
+int32_t scap_set_wakeup_watermark(scap_t* handle, uint32_t watermark)
 {
+	//
+	// Not supported on files
+	//
+	if(handle->m_file)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "setting the wakeup watermark not supported on offline captures");
+		return SCAP_FAILURE;
+	}
+
+	if(handle->m_bpf != NULL)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "wakeup watermark not supported by the eBPF engine");
+		return SCAP_FAILURE;
+	}
+
 #ifdef _WIN32
-	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "live capture non supported on windows");
+	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "live capture not supported on windows");
 	return SCAP_FAILURE;
 #elif defined(__APPLE__)
-	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "live capture non supported on OSX");
+	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "live capture not supported on OSX");
 	return SCAP_FAILURE;
 #else
-	uint32_t j;
-
-	//
-	// Not supported for files
-	//
-	if(handle->m_file)
+	if(watermark == 0)
 	{
-		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "cannot start offline captures");
-		ASSERT(false);
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "the wakeup watermark must be at least 1 byte");
 		return SCAP_FAILURE;
 	}
 
 	//
-	// Enable capture on all the rings
+	// Tell the driver to change the watermark
 	//
-	for(j = 0; j < handle->m_ndevs; j++)
+	if(ioctl(handle->m_devs[0].m_fd, PPM_IOCTL_SET_WAKEUP_WATERMARK, watermark))
 	{
-		if(ioctl(handle->m_devs[j].m_fd, PPM_IOCTL_ENABLE_CAPTURE))
-		{
-			snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "scap_start_capture failed for device %" PRIu32, j);
-			ASSERT(false);
-			return SCAP_FAILURE;
-		}
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "scap_set_wakeup_watermark failed");
+		ASSERT(false);
+		return SCAP_FAILURE;
 	}
 
 	return SCAP_SUCCESS;
-#endif // _WIN32
+#endif
 }
 
-#if !defined (_WIN32) && !defined(__APPLE__)
-static int32_t scap_set_dropping_mode(scap_t* handle, int request, uint32_t sampling_ratio)
+int32_t scap_set_max_delay_ms(scap_t* handle, uint32_t max_delay_ms)
 {
-	//	
-	// Not supported for files
+	//
+	// Not supported on files
 	//
 	if(handle->m_file)
 	{
-		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "dropping mode not supported on offline captures");
-		ASSERT(false);
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "setting the max delay not supported on offline captures");
 		return SCAP_FAILURE;
 	}
 
-	if(handle->m_ndevs)
+	if(handle->m_bpf != NULL)
 	{
-		if(ioctl(handle->m_devs[0].m_fd, request, sampling_ratio))
-		{
-			snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "%s failed", __FUNCTION__);
-			ASSERT(false);
-			return SCAP_FAILURE;
-		}		
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "maximum delay not supported by the eBPF engine");
+		return SCAP_FAILURE;
 	}
 
-	return SCAP_SUCCESS;
-}
-#endif
-
-int32_t scap_stop_dropping_mode(scap_t* handle)
-{
 #ifdef _WIN32
 	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "live capture not supported on windows");
 	return SCAP_FAILURE;
@@ -867,12 +3678,38 @@ int32_t scap_stop_dropping_mode(scap_t* handle)
 	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "live capture not supported on OSX");
 	return SCAP_FAILURE;
 #else
-	return scap_set_dropping_mode(handle, PPM_IOCTL_DISABLE_DROPPING_MODE, 0);
+	if(max_delay_ms > UINT32_MAX / 1000)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "the max delay can be at most %u ms", UINT32_MAX / 1000);
+		return SCAP_FAILURE;
+	}
+
+	//
+	// The driver works in microseconds
+	//
+	if(ioctl(handle->m_devs[0].m_fd, PPM_IOCTL_SET_MAX_DELAY, max_delay_ms * 1000))
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "scap_set_max_delay_ms failed");
+		ASSERT(false);
+		return SCAP_FAILURE;
+	}
+
+	handle->m_max_delay_ms = max_delay_ms;
+	return SCAP_SUCCESS;
 #endif
 }
 
-int32_t scap_start_dropping_mode(scap_t* handle, uint32_t sampling_ratio)
+int32_t scap_set_unordered_mode(scap_t* handle, bool unordered)
 {
+	//
+	// Not supported on files
+	//
+	if(handle->m_file)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "unordered mode not supported on offline captures");
+		return SCAP_FAILURE;
+	}
+
 #ifdef _WIN32
 	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "live capture not supported on windows");
 	return SCAP_FAILURE;
@@ -880,53 +3717,36 @@ int32_t scap_start_dropping_mode(scap_t* handle, uint32_t sampling_ratio)
 	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "live capture not supported on OSX");
 	return SCAP_FAILURE;
 #else
-	return scap_set_dropping_mode(handle, PPM_IOCTL_ENABLE_DROPPING_MODE, sampling_ratio);
-#endif
-}
-
-//
-// Return the list of device addresses
-//
-scap_addrlist* scap_get_ifaddr_list(scap_t* handle)
-{
-	return handle->m_addrlist;
-}
-
-//
-// Return the list of machine users
-//
-scap_userlist* scap_get_user_list(scap_t* handle)
-{
-	return handle->m_userlist;
-}
-
-//
-// Get the machine information
-//
-const scap_machine_info* scap_get_machine_info(scap_t* handle)
-{
-	if(handle->m_machine_info.num_cpus != (uint32_t)-1)
-	{
-		return (const scap_machine_info*)&handle->m_machine_info;
-	}
-	else
+	if(unordered != handle->m_unordered)
 	{
+		handle->m_unordered = unordered;
+
 		//
-		// Reading from a file with no process info block
+		// The heap is not maintained in unordered mode. With the reader
+		// threads it's not used at all.
 		//
-		return NULL;
+		if(handle->m_readers == NULL)
+		{
+			scap_reset_merge(handle);
+		}
 	}
+
+	return SCAP_SUCCESS;
+#endif
 }
 
-int32_t scap_set_snaplen(scap_t* handle, uint32_t snaplen)
+int32_t scap_set_reader_threads(scap_t* handle, uint32_t nthreads)
 {
 	//
-	// Not supported on files
+	// On files, the threads decompress the frames
 	//
-	if(handle->m_file)
+	if(handle->m_merge)
 	{
-		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "setting snaplen not supported on offline captures");
-		return SCAP_FAILURE;
+		return scap_merge_set_decoders(handle, nthreads);
+	}
+	else if(handle->m_file)
+	{
+		return scap_enable_decoders(handle, nthreads);
 	}
 
 #ifdef _WIN32
@@ -936,35 +3756,36 @@ int32_t scap_set_snaplen(scap_t* handle, uint32_t snaplen)
 	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "live capture not supported on OSX");
 	return SCAP_FAILURE;
 #else
-	//
-	// Tell the driver to change the snaplen
-	//
-	if(ioctl(handle->m_devs[0].m_fd, PPM_IOCTL_SET_SNAPLEN, snaplen))
+	return scap_start_readers(handle, nthreads);
+#endif
+}
+
+int32_t scap_enable_tap(scap_t* handle, const char* name, uint32_t size)
+{
+	return scap_tap_open(handle, name, size);
+}
+
+int32_t scap_set_fold(scap_t* handle, bool enable)
+{
+	if(!enable)
 	{
-		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "scap_set_snaplen failed");
-		ASSERT(false);
-		return SCAP_FAILURE;
+		if(handle->m_fold != NULL)
+		{
+			scap_fold_destroy(handle->m_fold);
+			handle->m_fold = NULL;
+		}
+
+		return SCAP_SUCCESS;
 	}
 
+	if(handle->m_fold == NULL)
 	{
-		uint32_t j;
-
-		//
-		// Force a flush of the read buffers, so we don't capture events with the old snaplen
-		//
-		for(j = 0; j < handle->m_ndevs; j++)
+		handle->m_fold = scap_fold_create(handle->m_lasterr);
+		if(handle->m_fold == NULL)
 		{
-			scap_readbuf(handle,
-               j,
-               false,
-               &handle->m_devs[j].m_sn_next_event,
-               &handle->m_devs[j].m_sn_len);
-
-			handle->m_devs[j].m_sn_len = 0;
+			return SCAP_FAILURE;
 		}
 	}
 
 	return SCAP_SUCCESS;
-#endif
 }
-
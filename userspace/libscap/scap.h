@@ -69,6 +69,31 @@ extern "C" {
 //
 #define SCAP_LASTERR_SIZE 256
 
+//
+// Prefix of the trace file names that are the address of a remote capture,
+// e.g. "tcp://collector:7000". See scap_open_remote() and scap_dump_open()
+//
+#define SCAP_REMOTE_PREFIX "tcp://"
+
+//
+// Thread ids of the sources of scap_open_merge(). The ids of source n are
+// moved to their own range, so that the threads of different machines
+// don't collide. Source 0, and the ids that are not positive, don't change.
+//
+#define SCAP_MAX_MERGE_SOURCES 1024
+#define SCAP_SOURCE_TID_SHIFT 48
+#define SCAP_TID_FROM_SOURCE(tid, source) (((int64_t)(tid) > 0)? (int64_t)((uint64_t)(tid) | ((uint64_t)(source) << SCAP_SOURCE_TID_SHIFT)) : (int64_t)(tid))
+#define SCAP_TID_SOURCE(tid) (((int64_t)(tid) > 0)? (uint32_t)((uint64_t)(tid) >> SCAP_SOURCE_TID_SHIFT) : 0)
+#define SCAP_TID_LOCAL(tid) (((int64_t)(tid) > 0)? (int64_t)((uint64_t)(tid) & ((1ULL << SCAP_SOURCE_TID_SHIFT) - 1)) : (int64_t)(tid))
+
+//
+// Flags for scap_open_live_flags()
+//
+#define SCAP_OPEN_SKIP_PROC_SCAN (1 << 0) // Don't scan /proc when opening, look up the processes with scap_proc_get()
+#define SCAP_OPEN_BG_PROC_SCAN (1 << 1) // With SCAP_OPEN_SKIP_PROC_SCAN, scan /proc in a thread. See scap_proc_scan_complete()
+#define SCAP_OPEN_DRIVER_STATE (1 << 2) // Don't scan /proc, get the processes and fds from PPME_PROCSTATE_E and PPME_FDSTATE_E events of the driver
+#define SCAP_OPEN_BPF (1 << 3) // Capture with eBPF programs instead of the sysdig-probe module. They only write PPME_GENERIC_E/X events, see scap_bpf.c
+
 /*!
   \brief Statisitcs about an in progress capture
 */
@@ -77,8 +102,38 @@ typedef struct scap_stats
 	uint64_t n_evts; ///< Total number of events that were received by the driver.
 	uint64_t n_drops; ///< Number of dropped events.
 	uint64_t n_preemptions; ///< Number of preemptions.
+	uint64_t n_copy_bytes; ///< Bytes of user memory that the driver copied into the ring buffers.
 }scap_stats;
 
+/*!
+  \brief Where the driver allocated the ring buffer of a device
+*/
+typedef struct scap_device_info
+{
+	uint32_t cpuid; ///< The CPU whose events are written to the ring.
+	uint32_t buffer_size; ///< Size of the ring, in bytes.
+	int32_t numa_node; ///< NUMA node the ring was allocated on, -1 if not known.
+	bool node_local; ///< true if the ring is on the node of its CPU.
+	bool contiguous; ///< true if the data area is physically contiguous. See the ring_buf_contiguous module parameter.
+}scap_device_info;
+
+/*!
+  \brief Where the consumer of the capture runs. See
+  \ref scap_set_consumer_cpus().
+*/
+typedef struct scap_consumer_placement
+{
+	int32_t cpu; ///< The CPU the calling thread is running on, -1 if not known.
+	int32_t numa_node; ///< The NUMA node of that CPU, -1 if not known.
+	uint32_t ncpus; ///< Number of CPUs the consumer is pinned to, 0 if it's not pinned.
+	bool excluded; ///< true if the driver discards the events of those CPUs.
+}scap_consumer_placement;
+
+/*!
+  \brief A process attached to an event tap. See \ref scap_tap_attach().
+*/
+typedef struct scap_tap_reader scap_tap_reader;
+
 /*!
   \brief Information about the parameter of an event
 */
@@ -194,10 +249,75 @@ typedef struct scap_threadinfo
 	uint32_t flags; ///< the process flags.
 	uint32_t uid; ///< user id
 	uint32_t gid; ///< group id
+	char cgroup[SCAP_MAX_PATH_SIZE]; ///< Path of the process in the cgroup hierarchy of the cpu controller, or in the unified one. Empty if unknown
 	scap_fdinfo* fdlist; ///< The fd table for this process
 	UT_hash_handle hh; ///< makes this structure hashable
 }scap_threadinfo;
 
+/*!
+  \brief A state snapshot of a trace file. See \ref scap_get_snapshots().
+*/
+typedef struct scap_snapshot_info
+{
+	uint64_t offset; ///< Position of the snapshot in the file.
+	uint64_t ts; ///< Timestamp of the last event before the snapshot.
+	uint64_t evtnum; ///< Number of events before the snapshot.
+}scap_snapshot_info;
+
+/*!
+  \brief How the process table of \ref scap_open_live_checkpoint() was built.
+*/
+typedef struct scap_checkpoint_stats
+{
+	bool loaded; ///< true if the table comes from the checkpoint, false if /proc was scanned from scratch.
+	uint32_t n_kept; ///< Processes taken from the checkpoint as they were.
+	uint32_t n_rescanned; ///< Processes read from /proc, because they are new, reused a pid, or changed their threads or fds.
+	uint32_t n_removed; ///< Processes of the checkpoint that have exited.
+	char reason[SCAP_LASTERR_SIZE]; ///< Why the checkpoint couldn't be used, when loaded is false.
+}scap_checkpoint_stats;
+
+#define SCAP_SUMMARY_MAX_EVTTYPES 512 ///< The event types that fit in a \ref scap_block_summary.
+#define SCAP_SUMMARY_BLOOM_BITS 16384 ///< Size of the Bloom filter of a \ref scap_block_summary.
+#define SCAP_SUMMARY_BLOOM_HASHES 4 ///< Bits set in the Bloom filter for each key.
+
+/*!
+  \brief The kinds of keys of the Bloom filter of a \ref scap_block_summary.
+   Each kind is also a bit of scap_block_summary::kinds.
+*/
+typedef enum scap_summary_kind
+{
+	SCAP_SUMMARY_TID = 0, ///< The tid of the events, as an int64_t. Always there.
+	SCAP_SUMMARY_PID = 1, ///< The pid of the process, as an int64_t.
+	SCAP_SUMMARY_COMM = 2, ///< The name of the process, proc.name, without the terminator.
+	SCAP_SUMMARY_FDNAME = 3, ///< The name of the fd, fd.name, without the terminator.
+	SCAP_SUMMARY_PORT = 4, ///< The client and the server port of the fd, as uint16_t.
+}scap_summary_kind;
+
+/*!
+  \brief What a group of events of a trace file contains: the group of
+   events the dumper writes together, 1MB by default, that has an entry in
+   the file index. Readers use it to skip the groups that can't have the
+   events they look for, see \ref scap_set_block_filter().
+*/
+typedef struct scap_block_summary
+{
+	uint64_t ts_min; ///< Timestamp of the first event.
+	uint64_t ts_max; ///< Timestamp of the last event.
+	uint32_t kinds; ///< The scap_summary_kind bits whose keys were added for all the events.
+	uint32_t reserved;
+	uint64_t evttypes[SCAP_SUMMARY_MAX_EVTTYPES / 64]; ///< Bitmap of the event types.
+	uint64_t bloom[SCAP_SUMMARY_BLOOM_BITS / 64]; ///< Bloom filter of the keys, see \ref scap_summary_hash().
+}scap_block_summary;
+
+/*!
+  \brief Called by the reader at the beginning of each group of events of the
+   index. The group has the events after number first_evtnum up to number
+   end_evtnum, as numbered by \ref scap_event_get_num(), with end_evtnum
+   UINT64_MAX for the last group. summary is NULL if the file doesn't have
+   summaries. Returns false to skip the whole group.
+*/
+typedef bool (*scap_block_filter)(void* context, uint64_t first_evtnum, uint64_t end_evtnum, const scap_block_summary* summary);
+
 //
 // The follwing stuff is byte aligned because we save it to disk.
 //
@@ -219,12 +339,17 @@ typedef struct _scap_machine_info
 	uint64_t memory_size_bytes; ///< Physical memory size
 	uint64_t max_pid; ///< Highest PID number on this machine
 	char hostname[128]; ///< The machine hostname 
-	uint64_t reserved1; ///< reserved for fututre use
+	uint64_t flags; ///< SCAP_MI_* flags describing how the events were captured
 	uint64_t reserved2; ///< reserved for fututre use
 	uint64_t reserved3; ///< reserved for fututre use
 	uint64_t reserved4; ///< reserved for fututre use
 }scap_machine_info;
 
+//
+// scap_machine_info flags
+//
+#define SCAP_MI_BUFFER_HASH (1 << 0) ///< The data of the I/O events is the hash of the buffers, see scap_set_buffer_hash()
+
 
 #define SCAP_IPV6_ADDR_LEN 16
 
@@ -375,6 +500,7 @@ typedef enum event_direction
 }event_direction;
 
 typedef struct scap_dumper scap_dumper_t;
+typedef struct scap_cutter scap_cutter_t;
 /*@}*/
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -408,6 +534,85 @@ typedef struct ppm_evt_hdr scap_evt;
 */
 scap_t* scap_open_live(char *error);
 
+/*!
+  \brief Start a live event capture, specifying the size of the per-CPU ring buffers.
+
+  \param error Pointer to a buffer that will contain the error string in case the
+    function fails. The buffer must have size SCAP_LASTERR_SIZE.
+  \param ring_buf_size Size in bytes of each per-CPU ring buffer. It must be a multiple
+    of the page size. 0 means use the size currently configured in the driver.
+
+  \return The capture instance handle in case of success. NULL in case of failure.
+
+  \note The driver applies the new size when the capture starts, so this fails if
+    another capture is already in progress.
+*/
+scap_t* scap_open_live_ex(char *error, uint32_t ring_buf_size);
+
+/*!
+  \brief Start a live event capture, like \ref scap_open_live_ex(), with the
+   given SCAP_OPEN_* flags.
+
+  \param error Pointer to a buffer that will contain the error string in case the
+    function fails. The buffer must have size SCAP_LASTERR_SIZE.
+  \param ring_buf_size Size in bytes of each per-CPU ring buffer, or 0. See
+    \ref scap_open_live_ex().
+  \param flags SCAP_OPEN_SKIP_PROC_SCAN leaves the process table returned by
+    \ref scap_get_proc_table() empty, instead of walking every process, thread
+    and fd under /proc before returning. Adding SCAP_OPEN_BG_PROC_SCAN makes
+    a background thread do that walk, and \ref scap_proc_scan_complete()
+    tells when the table is ready. SCAP_OPEN_DRIVER_STATE leaves the table
+    empty too, and makes the driver write the state of every thread and fd
+    as PPME_PROCSTATE_E and PPME_FDSTATE_E events at the start of the
+    capture, stamped like the live events, so that they can't be older than
+    the events that follow. If the driver can't do it, /proc is scanned
+    instead.
+
+  \return The capture instance handle in case of success. NULL in case of failure.
+*/
+scap_t* scap_open_live_flags(char *error, uint32_t ring_buf_size, uint32_t flags);
+
+/*!
+  \brief Start a live event capture, like \ref scap_open_live_flags(), with
+   the process table of a checkpoint written by \ref scap_write_checkpoint()
+   instead of a full scan of /proc.
+
+  \param error Pointer to a buffer that will contain the error string in case the
+    function fails. The buffer must have size SCAP_LASTERR_SIZE.
+  \param ring_buf_size Size in bytes of each per-CPU ring buffer, or 0.
+  \param flags The SCAP_OPEN_* flags. The checkpoint is ignored with
+    SCAP_OPEN_SKIP_PROC_SCAN and SCAP_OPEN_DRIVER_STATE.
+  \param checkpoint Name of the checkpoint file.
+  \param stats Filled with what was taken from the checkpoint. Can be NULL.
+
+  \return The capture instance handle in case of success. NULL in case of failure.
+
+  \note Only the differences with /proc are read: the processes of the
+   checkpoint that have exited are removed, and the ones that started after
+   it, or whose threads or fds are not the same, are scanned again. The
+   rest keep the state of the checkpoint. A checkpoint of another boot, or
+   one that can't be read, is discarded, and /proc is scanned as usual.
+*/
+scap_t* scap_open_live_checkpoint(char *error, uint32_t ring_buf_size, uint32_t flags, const char* checkpoint, OUT scap_checkpoint_stats* stats);
+
+/*!
+  \brief Check the background /proc scan started by \ref scap_open_live_flags()
+   with SCAP_OPEN_BG_PROC_SCAN.
+
+  \param handle Handle to the capture instance.
+
+  \return SCAP_TIMEOUT while the scan is running. SCAP_SUCCESS once, when it
+   has finished, after adding its processes to the table returned by
+   \ref scap_get_proc_table(). SCAP_NOTFOUND if there's no scan to wait for.
+   On Failure, SCAP_FAILURE is returned and scap_getlasterr() can be used to
+   obtain the cause of the error.
+
+  \note The scan reflects /proc at the time it ran, so processes that have
+   changed since then can be stale. Entries already built from the events
+   should be preferred over the ones of the scan.
+*/
+int32_t scap_proc_scan_complete(scap_t* handle);
+
 /*!
   \brief Start an event capture from file.
 
@@ -419,6 +624,87 @@ scap_t* scap_open_live(char *error);
 */
 scap_t* scap_open_offline(char* fname, char *error);
 
+/*!
+  \brief Start an event capture from a trace file that another process is
+   still writing.
+
+  \param fname The name of the file to open.
+  \param error Pointer to a buffer that will contain the error string in case the
+    function fails. The buffer must have size SCAP_LASTERR_SIZE.
+
+  \return The capture instance handle in case of success. NULL in case of failure.
+
+  \note Instead of returning SCAP_EOF at the end of the written data,
+   \ref scap_next() waits for the writer with inotify, and returns
+   SCAP_TIMEOUT if nothing was written within a short time. The blocks
+   that are only partially written are read once they are complete. If
+   the name ends with a number, like the files written with a
+   rotation (see \ref scap_dump_rotate()), the reading continues in the
+   file with the next number once the writer is done with the current one,
+   and the files must not be removed before they are read. Otherwise,
+   SCAP_EOF is returned once the writer closes the file. The functions that
+   move in the file, like \ref scap_seek_ts(), are not supported. Only
+   available on Linux.
+*/
+scap_t* scap_open_offline_follow(char* fname, char *error);
+
+/*!
+  \brief Start an event capture from an agent that sends it over the network,
+   see \ref scap_dump_open(). The capture is read like a trace file.
+
+  \param addr The address to listen on, "tcp://host:port". The host can be
+    omitted ("tcp://:7000") to listen on all the interfaces, and IPv6
+    addresses are written between brackets.
+  \param error Pointer to a buffer that will contain the error string in case the
+    function fails. The buffer must have size SCAP_LASTERR_SIZE.
+
+  \return The capture instance handle in case of success. NULL in case of failure.
+
+  \note This blocks until an agent connects, and the capture ends when it
+   closes the connection. Only one agent is accepted. The stream can't seek,
+   so the functions that move in the file, like \ref scap_seek_ts(), fail.
+*/
+scap_t* scap_open_remote(const char* addr, char *error);
+
+/*!
+  \brief Start an event capture from several trace files, or remote captures
+   (see \ref scap_open_remote()), read as a single one with the events in
+   timestamp order.
+
+  \param fnames The names of the files, or the addresses of the remote
+    captures. The position of a name in the array is the number of the
+    source.
+  \param nfiles The number of names, at most SCAP_MAX_MERGE_SOURCES.
+  \param error Pointer to a buffer that will contain the error string in case the
+    function fails. The buffer must have size SCAP_LASTERR_SIZE.
+
+  \return The capture instance handle in case of success. NULL in case of failure.
+
+  \note The thread ids of each source are moved to a range of their own,
+   see SCAP_TID_FROM_SOURCE(), in the events and in the process table.
+   SCAP_TID_SOURCE() tells the source of a thread. The machine info is
+   the one of the first source, with the highest number of CPUs, the
+   interface list has the interfaces of all the sources, and the user list
+   is the one of the first source. The functions that move in the files,
+   like \ref scap_seek_ts(), are not supported.
+*/
+scap_t* scap_open_merge(const char** fnames, uint32_t nfiles, char *error);
+
+/*!
+  \brief Return the number of sources of a capture: the number of files of
+   \ref scap_open_merge(), or 1.
+*/
+uint32_t scap_get_nsources(scap_t* handle);
+
+/*!
+  \brief Return the machine info of a source of the capture, see
+   \ref scap_get_nsources().
+
+  \return The machine info, or NULL if the source doesn't exist or doesn't
+   have one.
+*/
+const scap_machine_info* scap_get_source_machine_info(scap_t* handle, uint32_t source);
+
 /*!
   \brief Close a capture handle.
 
@@ -459,6 +745,141 @@ char* scap_getlasterr(scap_t* handle);
 */
 int32_t scap_next(scap_t* handle, OUT scap_evt** pevent, OUT uint16_t* pcpuid);
 
+/*!
+  \brief Get multiple events from the given capture instance, in timestamp order.
+   This is equivalent to calling \ref scap_next() multiple times, but it amortizes
+   the per-event cost of merging the per-CPU buffers.
+
+  \param handle Handle to the capture instance.
+  \param pevents User-provided array of max_evts event pointers, that will be filled
+    with the addresses of the events.
+  \param pcpuids User-provided array of max_evts CPU IDs, that will be filled with
+    the ID of the CPU where each event was captured.
+  \param max_evts Maximum number of events to return.
+  \param nevts Will be initialized with the number of events that were returned.
+
+  \return SCAP_SUCCESS if the call is succesful and nevts is at least 1.
+   SCAP_TIMEOUT in case the read timeout expired and no event is available.
+   SCAP_EOF when the end of an offline capture is reached.
+   On Failure, SCAP_FAILURE is returned and scap_getlasterr() can be used to obtain the cause of the error.
+
+  \note The events are valid until the next call to scap_next() or scap_next_batch().
+   A batch can contain fewer than max_evts events even when more are available, for
+   example when one of the CPU buffers needs to be read again. Offline captures always
+   return one event per call.
+*/
+int32_t scap_next_batch(scap_t* handle, OUT scap_evt** pevents, OUT uint16_t* pcpuids, uint32_t max_evts, OUT uint32_t* nevts);
+
+/*!
+  \brief Move a trace file capture to the first event with a timestamp equal
+   or greater than ts, so that it's the next one returned by \ref scap_next().
+
+  \param handle Handle to the capture instance, opened with
+   \ref scap_open_offline().
+  \param ts The timestamp, in nanoseconds since epoch.
+  \param evtnum Filled with the number of that event in the file, which
+   \ref scap_event_get_num() will return after it.
+
+  \return SCAP_SUCCESS if the call is succesful, SCAP_EOF if there are no
+   events after ts. On Failure, SCAP_FAILURE is returned and
+   scap_getlasterr() can be used to obtain the cause of the error.
+
+  \note Files written by \ref scap_dump() end with an index of the positions
+   of the events, which is used to jump close to ts, both forward and
+   backward. Without the index, the file is read again from the first event
+   up to ts, in either direction.
+*/
+int32_t scap_seek_ts(scap_t* handle, uint64_t ts, OUT uint64_t* evtnum);
+
+/*!
+  \brief Move a trace file capture right after the last state snapshot (see
+   \ref scap_dump_snapshot()) taken before ts, and replace the process table
+   returned by \ref scap_get_proc_table() with the one of the snapshot.
+
+  \param handle Handle to the capture instance, opened with
+   \ref scap_open_offline().
+  \param ts The timestamp, in nanoseconds since epoch.
+  \param evtnum Filled with the number of the first event after the snapshot.
+
+  \return SCAP_SUCCESS if the call is succesful, SCAP_NOTFOUND if the file
+   has no snapshot before ts, in which case nothing changes. On Failure,
+   SCAP_FAILURE is returned and scap_getlasterr() can be used to obtain the
+   cause of the error.
+
+  \note The events between the snapshot and ts still have to be read to get
+   the tables at ts.
+*/
+int32_t scap_seek_snapshot(scap_t* handle, uint64_t ts, OUT uint64_t* evtnum);
+
+/*!
+  \brief Get the list of the state snapshots in a trace file, in file order.
+
+  \param handle Handle to the capture instance, opened with
+   \ref scap_open_offline().
+  \param snapshots Filled with a pointer to the list. It's owned by the
+   handle and valid until \ref scap_close().
+  \param nsnapshots Filled with the number of entries of the list, 0 for
+   files without snapshots.
+
+  \return SCAP_SUCCESS if the call is succesful.
+   On Failure, SCAP_FAILURE is returned and scap_getlasterr() can be used to obtain
+   the cause of the error.
+*/
+int32_t scap_get_snapshots(scap_t* handle, OUT const scap_snapshot_info** snapshots, OUT uint32_t* nsnapshots);
+
+/*!
+  \brief Move a trace file capture right after the given state snapshot, and
+   replace the process table returned by \ref scap_get_proc_table() with the
+   one of the snapshot. The next event is number snapshot->evtnum + 1.
+
+  \param handle Handle to the capture instance, opened with
+   \ref scap_open_offline().
+  \param snapshot One of the entries returned by \ref scap_get_snapshots().
+
+  \return SCAP_SUCCESS if the call is succesful.
+   On Failure, SCAP_FAILURE is returned and scap_getlasterr() can be used to obtain
+   the cause of the error.
+*/
+int32_t scap_restore_snapshot(scap_t* handle, const scap_snapshot_info* snapshot);
+
+/*!
+  \brief Skip the groups of events of a trace file that the given function
+   rejects, without reading them. The function gets the event numbers
+   and the summary of each group, written by the dumper, before the first
+   event of the group is returned.
+
+  \param handle Handle to the capture instance, opened with
+   \ref scap_open_offline().
+  \param filter The function, or NULL to read all the events again.
+  \param context Passed to the function.
+
+  \return SCAP_SUCCESS if the call is succesful. SCAP_NOTFOUND if the file
+   has no index, e.g. because it was written by an older version, or if
+   it's not mapped in memory, e.g. because it's a pipe. On Failure,
+   SCAP_FAILURE is returned and scap_getlasterr() can be used to obtain the
+   cause of the error.
+
+  \note The events of the skipped groups are not returned at all, so the
+   state they change is lost too.
+*/
+int32_t scap_set_block_filter(scap_t* handle, scap_block_filter filter, void* context);
+
+/*!
+  \brief Hash a key of the Bloom filter of a \ref scap_block_summary.
+
+  \param kind A \ref scap_summary_kind.
+  \param key The key, in the format of its kind.
+  \param len The length of the key.
+*/
+uint64_t scap_summary_hash(uint32_t kind, const void* key, uint32_t len);
+
+/*!
+  \brief Return true if the Bloom filter of a summary can contain the key
+   with the given \ref scap_summary_hash(). False positives are possible,
+   false negatives are not.
+*/
+bool scap_summary_test(const scap_block_summary* summary, uint64_t hash);
+
 /*!
   \brief Get the length of an event
 
@@ -500,12 +921,35 @@ const struct ppm_event_info* scap_event_getinfo(scap_evt* e);
   \brief Open a tracefile for writing 
 
   \param handle Handle to the capture instance.
-  \param fname The name of the tracefile.
+  \param fname The name of the tracefile. A name starting with
+    SCAP_REMOTE_PREFIX, like "tcp://collector:7000", sends the capture to a
+    collector that called \ref scap_open_remote() instead.
 
   \return Dump handle that can be used to identify this specific dump instance. 
+
+  \note With a remote collector and the background writer (see
+   \ref scap_dump_set_buffering()), a block of events that is ready while the
+   previous one is still being sent is dropped instead of waiting, so a slow
+   link doesn't slow down the capture. \ref scap_dump_get_drops() counts
+   them. Without the background writer, \ref scap_dump() waits for the link.
 */
 scap_dumper_t* scap_dump_open(scap_t *handle, const char *fname);
 
+/*!
+  \brief Open a tracefile for writing, like \ref scap_dump_open(), with the
+   given process table at the start of the file instead of the one of the
+   capture.
+
+  \param handle Handle to the capture instance.
+  \param fname The name of the tracefile.
+  \param proclist The process table, with the fd tables of the processes,
+   or NULL for an empty one. It's written before the function returns, so
+   it can be freed then.
+
+  \return Dump handle that can be used to identify this specific dump instance.
+*/
+scap_dumper_t* scap_dump_open_ex(scap_t *handle, const char *fname, scap_threadinfo *proclist);
+
 /*!
   \brief Close a tracefile. 
 
@@ -535,6 +979,255 @@ uint64_t scap_dump_ftell(scap_dumper_t *d);
 */
 int32_t scap_dump(scap_t *handle, scap_dumper_t *d, scap_evt* e, uint16_t cpuid);
 
+/*!
+  \brief Write an event to several trace files. The block of the event is
+   rendered once and copied to the buffers of all the files, which is
+   cheaper than calling \ref scap_dump() for each of them.
+
+  \param handle Handle to the capture instance.
+  \param ds The dump handles, returned by \ref scap_dump_open
+  \param nds The number of entries of ds.
+  \param e pointer to an event returned by \ref scap_next.
+  \param cpuid The cpu from which the event was captured. Returned by \ref scap_next.
+
+  \return SCAP_SUCCESS if the call is succesful.
+   On Failure, SCAP_FAILURE is returned and scap_getlasterr() can be used to obtain
+   the cause of the error. The event may have been written to some of the
+   files.
+*/
+int32_t scap_dump_multi(scap_t *handle, scap_dumper_t **ds, uint32_t nds, scap_evt* e, uint16_t cpuid);
+
+/*!
+  \brief Change how the events are buffered before being written to a trace
+  file. By default, they are accumulated in a 1MB block that is written when
+  full, from the thread calling \ref scap_dump().
+
+  \param handle Handle to the capture instance.
+  \param d The dump handle, returned by \ref scap_dump_open
+  \param buffer_size The size of the block, at least 64KB.
+  \param async If true, two blocks are allocated and a background thread
+    writes one while \ref scap_dump() fills the other, so the caller only
+    waits if the disk can't keep up.
+
+  \return SCAP_SUCCESS if the call is succesful.
+   On Failure, SCAP_FAILURE is returned and scap_getlasterr() can be used to obtain
+   the cause of the error.
+
+  \note Once the background writer is started, the buffering can't be changed
+  anymore. Write errors of the background writer are reported by the next
+  call to \ref scap_dump().
+*/
+int32_t scap_dump_set_buffering(scap_t *handle, scap_dumper_t *d, uint32_t buffer_size, bool async);
+
+/*!
+  \brief Compress the events written to a trace file. Each block of events
+  (see \ref scap_dump_set_buffering()) is compressed with zlib and saved as a
+  single frame, the process, fd, interface and user tables are not affected.
+  \ref scap_open_offline() reads both compressed and uncompressed files.
+
+  \param handle Handle to the capture instance.
+  \param d The dump handle, returned by \ref scap_dump_open
+  \param level The zlib compression level, from 1 (fastest) to 9 (smallest).
+    0 goes back to writing the events uncompressed.
+
+  \return SCAP_SUCCESS if the call is succesful.
+   On Failure, SCAP_FAILURE is returned and scap_getlasterr() can be used to obtain
+   the cause of the error. This includes libscap builds without zlib.
+
+  \note With the background writer, the compression happens in the writer
+  thread. For compressed files, \ref scap_dump_ftell() returns the number of
+  bytes already written, without the events that are still buffered.
+*/
+int32_t scap_dump_set_compression(scap_t *handle, scap_dumper_t *d, int32_t level);
+
+/*!
+  \brief Write a snapshot of the given process and fd tables to a trace file,
+   after the events dumped so far. The tables are in the format returned by
+   \ref scap_get_proc_table(). The file index points to the snapshots, so
+   that \ref scap_seek_snapshot() can restore them.
+
+  \param handle Handle to the capture instance.
+  \param d The dump handle, returned by \ref scap_dump_open
+  \param proclist The process table, with the fd table of each process.
+
+  \return SCAP_SUCCESS if the call is succesful.
+   On Failure, SCAP_FAILURE is returned and scap_getlasterr() can be used to obtain
+   the cause of the error.
+
+  \note The buffered events are written first, so this blocks until the
+   background writer is idle.
+*/
+int32_t scap_dump_snapshot(scap_t *handle, scap_dumper_t *d, scap_threadinfo *proclist);
+
+/*!
+  \brief Write the given process and fd tables to a checkpoint file, that
+   \ref scap_open_live_checkpoint() can start from after a restart.
+
+  \param handle Handle to the capture instance.
+  \param fname The name of the checkpoint file. It's replaced atomically.
+  \param proclist The process table, with the fd table of each process, in
+   the format returned by \ref scap_get_proc_table().
+
+  \return SCAP_SUCCESS if the call is succesful.
+   On Failure, SCAP_FAILURE is returned and scap_getlasterr() can be used to obtain
+   the cause of the error.
+*/
+int32_t scap_write_checkpoint(scap_t *handle, const char *fname, scap_threadinfo *proclist);
+
+/*!
+  \brief Close the current file of a dumper and continue in a new one, that
+   starts with the given process table and can be read on its own.
+
+  \param handle Handle to the capture instance.
+  \param d The dump handle, returned by \ref scap_dump_open
+  \param fname The name of the new file.
+  \param proclist The process table to write in the header of the new file,
+   in the format returned by \ref scap_get_proc_table().
+  \param remove_fname If not NULL, a file to delete once the new one is open.
+
+  \return SCAP_SUCCESS if the call is succesful.
+   On Failure, SCAP_FAILURE is returned and scap_getlasterr() can be used to obtain
+   the cause of the error.
+
+  \note With the background writer, the header is prepared by the caller and
+   the file switch happens in the writer thread, after the buffered events.
+   Errors opening the new file are reported by the next call.
+*/
+int32_t scap_dump_rotate(scap_t *handle, scap_dumper_t *d, const char *fname, scap_threadinfo *proclist, const char *remove_fname);
+
+/*!
+  \brief Return how many events a dumper dropped because the remote collector
+   couldn't keep up, see \ref scap_dump_open().
+
+  \param d The dump handle, returned by \ref scap_dump_open
+  \param nevts Filled with the number of events dropped.
+  \param nbytes Filled with the size of the events dropped, before compression.
+*/
+void scap_dump_get_drops(scap_dumper_t *d, OUT uint64_t *nevts, OUT uint64_t *nbytes);
+
+/*!
+  \brief Fold the repetitive syscalls in a dump, like \ref scap_set_fold()
+   does for the events returned by a capture.
+
+  \param handle Handle to the capture instance.
+  \param d The dump handle, returned by \ref scap_dump_open
+  \param enable true to fold, false (the default) to write every event.
+
+  \return SCAP_SUCCESS if the call is succesful.
+   On Failure, SCAP_FAILURE is returned and scap_getlasterr() can be used to obtain
+   the cause of the error.
+
+  \note The runs end before \ref scap_dump_snapshot() and
+   \ref scap_dump_rotate(), so the PPME_REPEAT_E events are always in the
+   same file as the events they replace.
+*/
+int32_t scap_dump_set_fold(scap_t *handle, scap_dumper_t *d, bool enable);
+
+/*!
+  \brief Declare the kinds of keys that will be added with
+   \ref scap_dump_add_summary_key() for each of the following events. The
+   summaries of the groups of events say which kinds are complete, so that
+   readers don't skip groups for keys that were never added.
+
+  \param d The dump handle, returned by \ref scap_dump_open
+  \param kinds The scap_summary_kind bits. SCAP_SUMMARY_TID is always
+   added by the dumper.
+*/
+void scap_dump_set_summary_kinds(scap_dumper_t *d, uint32_t kinds);
+
+/*!
+  \brief Add a key to the summary of the group of the last event written
+   with \ref scap_dump().
+
+  \param d The dump handle, returned by \ref scap_dump_open
+  \param kind A \ref scap_summary_kind.
+  \param key The key, in the format of its kind.
+  \param len The length of the key.
+*/
+void scap_dump_add_summary_key(scap_dumper_t *d, uint32_t kind, const void* key, uint32_t len);
+
+/*!
+  \brief What a cutter wrote, see \ref scap_cut_get_stats().
+*/
+typedef struct scap_cut_stats
+{
+	uint64_t n_evts; ///< Events written.
+	uint64_t n_bytes_copied; ///< Bytes of the groups of events copied whole, without looking at the events.
+	uint64_t n_bytes_decoded; ///< Bytes of the blocks at the edges of the time ranges, read one by one to check the timestamps of their events.
+	uint32_t n_files; ///< Files written.
+}scap_cut_stats;
+
+/*!
+  \brief Start writing a trace file with the events of other trace files,
+   added with \ref scap_cut_add(). The groups of events that are entirely in
+   the requested time ranges are copied as they are, using the index of the
+   files, so only the blocks at the edges of the ranges are decoded.
+
+  \param fname The name of the file to write.
+  \param max_bytes If not 0, continue in a new file when the current one
+   would grow over this size.
+  \param max_duration If not 0, continue in a new file when the events of the
+   current one would span more than this number of nanoseconds.
+  \param error Pointer to a buffer that will contain the error string in case the
+    function fails. The buffer must have size SCAP_LASTERR_SIZE.
+
+  \return The cutter handle in case of success. NULL in case of failure.
+
+  \note With max_bytes or max_duration, the files are named like the ones of
+   a dump rotation, fname followed by their number starting from 0. The
+   files are switched only between groups of events, so they can be a
+   group larger, or longer, than requested. The header of every file has the
+   tables of the last state snapshot of the input before its first event,
+   or the tables of the header of the input if there's none.
+*/
+scap_cutter_t* scap_cut_open(const char* fname, uint64_t max_bytes, uint64_t max_duration, char* error);
+
+/*!
+  \brief Append the events of a trace file with a timestamp in
+   [start_ts, end_ts) to the output of a cutter.
+
+  \param c The cutter handle, returned by \ref scap_cut_open().
+  \param fname The name of the trace file to read.
+  \param start_ts The first timestamp to copy, 0 to start from the beginning.
+  \param end_ts The first timestamp not to copy, UINT64_MAX to copy up to the end.
+  \param error Pointer to a buffer that will contain the error string in case the
+    function fails. The buffer must have size SCAP_LASTERR_SIZE.
+
+  \return SCAP_SUCCESS if the call is succesful, SCAP_FAILURE otherwise.
+
+  \note The files must be added in time order, like the ones of a dump
+   rotation. The first one that has events in the range provides the
+   machine info, the interface list and the user list of the output. The
+   following ones are preceded by a state snapshot with their own tables,
+   for the readers that seek in the output. The files are expected to have
+   their events in timestamp order: the groups without a summary are copied
+   whole if the index says that they start and end in the range. Files
+   without an index are decoded entirely.
+*/
+int32_t scap_cut_add(scap_cutter_t* c, const char* fname, uint64_t start_ts, uint64_t end_ts, char* error);
+
+/*!
+  \brief Return what a cutter wrote so far.
+
+  \param c The cutter handle, returned by \ref scap_cut_open().
+  \param stats Filled with the counters.
+*/
+void scap_cut_get_stats(scap_cutter_t* c, OUT scap_cut_stats* stats);
+
+/*!
+  \brief Write the index of the last output file of a cutter, close it and
+   free the cutter.
+
+  \param c The cutter handle, returned by \ref scap_cut_open().
+  \param error Pointer to a buffer that will contain the error string in case the
+    function fails. The buffer must have size SCAP_LASTERR_SIZE.
+
+  \return SCAP_SUCCESS if the call is succesful, SCAP_FAILURE otherwise. The
+   cutter is freed in both cases. No file is written if no event was in the
+   requested ranges.
+*/
+int32_t scap_cut_close(scap_cutter_t* c, char* error);
+
 /*!
   \brief Get the process list for the given capture instance
 
@@ -576,6 +1269,247 @@ scap_threadinfo* scap_get_proc_table(scap_t* handle);
 */
 int32_t scap_get_stats(scap_t* handle, OUT scap_stats* stats);
 
+/*!
+  \brief Return the capture statistics of one of the capture devices,
+  including its auxiliary rings. The events of device N have cpuid N.
+
+  \param handle Handle to the capture instance.
+  \param devid The device, between 0 and scap_get_ndevs() - 1.
+  \param stats Pointer to a \ref scap_stats structure that will be filled with the
+  statistics of the device.
+
+  \return SCAP_SUCCESS if the call is succesful.
+   On Failure, SCAP_FAILURE is returned and scap_getlasterr() can be used to obtain
+   the cause of the error.
+*/
+int32_t scap_get_device_stats(scap_t* handle, uint32_t devid, OUT scap_stats* stats);
+
+/*!
+  \brief Return the placement of the ring buffer of one of the capture devices.
+
+  \param handle Handle to the capture instance.
+  \param devid The device, between 0 and scap_get_ndevs() - 1.
+  \param info Pointer to a \ref scap_device_info structure that will be filled
+  with the device information.
+
+  \return SCAP_SUCCESS if the call is succesful.
+   On Failure, SCAP_FAILURE is returned and scap_getlasterr() can be used to obtain
+   the cause of the error.
+*/
+int32_t scap_get_device_info(scap_t* handle, uint32_t devid, OUT scap_device_info* info);
+
+/*!
+  \brief Return how many bytes of the ring buffer of one of the capture devices
+  are in use, i.e. written by the driver and not yet released by the consumer.
+
+  \param handle Handle to the capture instance.
+  \param devid The device, between 0 and scap_get_ndevs() - 1.
+  \param used Pointer to the number of bytes in use.
+
+  \return SCAP_SUCCESS if the call is succesful.
+   On Failure, SCAP_FAILURE is returned and scap_getlasterr() can be used to obtain
+   the cause of the error.
+
+  \note The chunk that the consumer is still reading counts as in use, since
+   the driver can't overwrite it yet.
+*/
+int32_t scap_get_device_fill(scap_t* handle, uint32_t devid, OUT uint32_t* used);
+
+/*!
+  \brief Start or stop collecting the detailed driver statistics: per event
+  type counters and filler execution times.
+
+  \param handle Handle to the capture instance.
+  \param enable true to start collecting, false to stop. Starting again
+    resets the counters.
+
+  \note This function can only be called for live captures.
+  \note Collecting the stats adds two clock reads to every event.
+*/
+int32_t scap_enable_detailed_stats(scap_t* handle, bool enable);
+
+/*!
+  \brief Return the detailed driver statistics collected since
+  \ref scap_enable_detailed_stats() was called.
+
+  \param handle Handle to the capture instance.
+  \param cpuid the CPU to return the statistics for, or -1 to add them up
+    for all the CPUs.
+  \param stats Pointer to a \ref ppm_detailed_stats structure that will be
+    filled with the statistics.
+
+  \note This function can only be called for live captures.
+*/
+int32_t scap_get_detailed_stats(scap_t* handle, int32_t cpuid, OUT struct ppm_detailed_stats* stats);
+
+/*!
+  \brief Switch the capture to syscall aggregation: instead of sending the
+  events to this capture, the driver counts the system calls and their
+  latency in per-CPU tables, that can be read with
+  \ref scap_get_syscall_aggr_table().
+
+  \param handle Handle to the capture instance.
+  \param flags a combination of PPM_AGGR_ENABLED and PPM_AGGR_PER_TGID, or 0
+    to go back to capturing the events. Every call resets the counters.
+
+  \note This function can only be called for live captures, and not while
+  the reader threads of \ref scap_start_readers() are running.
+*/
+int32_t scap_set_syscall_aggregation(scap_t* handle, uint32_t flags);
+
+/*!
+  \brief Choose whether the driver writes the events of this capture in the
+  compact encoding, which fits more events in the same ring buffers.
+  The events are decoded while they are read, so \ref scap_next(),
+  \ref scap_next_batch() and \ref scap_readbuf() still return them in the
+  normal format.
+
+  \param handle Handle to the capture instance.
+  \param enable true to turn the compact encoding on, false to turn it off.
+
+  \note This function can only be called for live captures, and not while
+  the reader threads of \ref scap_start_readers() are running.
+  \note The events in the buffers when this function is called are
+  discarded, and the ones previously returned become invalid.
+*/
+int32_t scap_set_compact_encoding(scap_t* handle, bool enable);
+
+/*!
+  \brief Choose whether the driver writes the enter events of the system
+  calls inside their exit events, which halves the number of events in the
+  ring buffers. The enter events are expanded back while they are read,
+  with their original timestamp.
+
+  \param handle Handle to the capture instance.
+  \param enable true to turn the exit only mode on, false to turn it off.
+
+  \note This function can only be called for live captures, after the
+  compact encoding has been turned on with \ref scap_set_compact_encoding().
+  Turning the compact encoding off turns this mode off too.
+*/
+int32_t scap_set_exit_only(scap_t* handle, bool enable);
+
+/*!
+  \brief Choose whether the driver leaves the tuple out of the send and
+  receive events of connected TCP sockets. The connect and accept events
+  still carry it.
+
+  \param handle Handle to the capture instance.
+  \param enable true to leave the tuples out, false to write them again.
+
+  \note This function can only be called for live captures. The setting is
+  shared by all the processes capturing at the same time.
+*/
+int32_t scap_set_tcp_tuple_elision(scap_t* handle, bool enable);
+
+/*!
+  \brief Make the driver store a 64 bit hash of the I/O buffers in the
+  data parameter of the I/O events, instead of their first snaplen bytes.
+  Useful to tell whether two reads or writes moved the same data without
+  copying it to the ring buffers.
+
+  \param handle Handle to the capture instance.
+  \param len the number of bytes of each buffer that are hashed, at most
+  PPM_MAX_BUFFER_HASH_LEN. 0 goes back to copying the data.
+
+  \note This function can only be called for live captures. The setting is
+  shared by all the processes capturing at the same time, and it's recorded
+  in the flags of the machine info, so that the trace files written later
+  carry it.
+*/
+int32_t scap_set_buffer_hash(scap_t* handle, uint32_t len);
+
+/*!
+  \brief Replace the per context switch events with periodic summaries.
+  When the interval is not zero, a thread that leaves the CPU gets a
+  PPME_SCHEDSWITCH_SUMMARY_E event, with its total CPU time and its context
+  switch counts, at most once per interval.
+
+  \param handle Handle to the capture instance.
+  \param interval_ms the minimum time between two summaries of a thread, in
+    milliseconds. 0 goes back to one event per context switch.
+
+  \note This function can only be called for live captures.
+  \note The setting is shared by all the processes capturing.
+*/
+int32_t scap_set_switch_summary(scap_t* handle, uint32_t interval_ms);
+
+/*!
+  \brief Measure the time that the threads spend runnable, waiting for a
+  CPU. When the interval is not zero, a thread that waited and leaves the
+  CPU gets a PPME_RUNQ_E event, with the total, the number and the longest
+  of its waits since its previous one, at most once per interval.
+
+  \param handle Handle to the capture instance.
+  \param interval_ms the minimum time between two runq events of a thread,
+    in milliseconds. 0 disables the measurements.
+
+  \note This function can only be called for live captures.
+  \note The setting is shared by all the processes capturing.
+*/
+int32_t scap_set_runq_summary(scap_t* handle, uint32_t interval_ms);
+
+/*!
+  \brief Report the page faults of the threads. When the interval is not
+  zero, a thread that had page faults and leaves the CPU gets a
+  PPME_PGFAULT_E event, with its major and minor faults since its previous
+  one, at most once per interval. Where the driver can trace the faults, the
+  event also has the address of the last one.
+
+  \param handle Handle to the capture instance.
+  \param interval_ms the minimum time between two pgfault events of a
+    thread, in milliseconds. 0 disables the summaries.
+
+  \note This function can only be called for live captures.
+  \note The setting is shared by all the processes capturing.
+*/
+int32_t scap_set_pgfault_summary(scap_t* handle, uint32_t interval_ms);
+
+/*!
+  \brief Move the args and cwd of the clone and execve events to a separate
+  ring on each CPU.
+  The events in the main buffers keep the executable name and get empty args
+  and cwd, which follow in a PPME_PROCINFO_E event with the same timestamp and
+  tid. When the process info ring is full, only the PPME_PROCINFO_E events are
+  dropped, and large command lines don't take space from the other events.
+
+  \param handle Handle to the capture instance.
+  \param ring_size the size of the process info ring of each CPU, in bytes.
+    Same constraints as the size of the main ring buffer.
+
+  \note This function can only be called for live captures, once.
+  \note The events are deferred only when all the processes capturing them
+  enabled the process info ring.
+*/
+int32_t scap_enable_procinfo_ring(scap_t* handle, uint32_t ring_size);
+
+/*!
+  \brief Send the events that change the state, like open, close, clone,
+  execve and procexit, to a separate ring on each CPU.
+  scap_next() merges them with the other events by timestamp. When the main
+  buffers are full, only the I/O and the other events that don't change the
+  thread and fd tables are dropped.
+
+  \param handle Handle to the capture instance.
+  \param ring_size the size of the state ring of each CPU, in bytes. Same
+    constraints as the size of the main ring buffer.
+
+  \note This function can only be called for live captures, once.
+*/
+int32_t scap_enable_state_ring(scap_t* handle, uint32_t ring_size);
+
+/*!
+  \brief Return the syscall aggregation table of a CPU.
+
+  \param handle Handle to the capture instance.
+  \param cpuid the CPU of the table.
+
+  \return A pointer to the \ref ppm_syscall_aggr_table, mapped read only
+    from the driver, that keeps changing while the capture runs. NULL if the
+    aggregation is not enabled or cpuid is invalid.
+*/
+const struct ppm_syscall_aggr_table* scap_get_syscall_aggr_table(scap_t* handle, uint32_t cpuid);
+
 /*!
   \brief This function can be used to temporarily interrupt event capture.
 
@@ -619,6 +1553,34 @@ scap_addrlist* scap_get_ifaddr_list(scap_t* handle);
 */
 scap_userlist* scap_get_user_list(scap_t* handle);
 
+/*!
+  \brief Start reading the user and group lists again in a background
+   thread, to pick up the users that were added since the capture started.
+   Looking them up can take long with a remote directory, which is why
+   this doesn't block the caller.
+
+  \param handle Handle to the capture instance. Must be a live capture.
+
+  \return SCAP_SUCCESS if the refresh started or is already running,
+   SCAP_FAILURE otherwise.
+
+  \note The new lists replace the current ones only in
+   \ref scap_refresh_userlist_complete().
+*/
+int32_t scap_refresh_userlist_start(scap_t* handle);
+
+/*!
+  \brief Check the refresh started by \ref scap_refresh_userlist_start().
+
+  \param handle Handle to the capture instance.
+
+  \return SCAP_TIMEOUT while the refresh is running. SCAP_SUCCESS once, when
+   it's done: the lists returned by \ref scap_get_user_list() before are
+   freed, and the call now returns the new ones. SCAP_NOTFOUND if there's
+   no refresh to wait for, SCAP_FAILURE if it failed.
+*/
+int32_t scap_refresh_userlist_complete(scap_t* handle);
+
 /*!
   \brief This function can be used to specify the time after which \ref scap_next
   returns when no events are available. 
@@ -650,8 +1612,8 @@ const struct ppm_event_info* scap_get_event_info_table();
   the capture driver supports. 
 
   \return The pointer to a table of \ref ppm_syscall_desc entries, each of which describes
-  one of the events that can come from the driver. The table contains SYSCALL_TABLE_SIZE entries,
-  and the position of each entry in the table corresponds to the system call ID.
+  one of the events that can come from the driver. The table contains PPM_SC_MAX entries,
+  and the position of each entry in the table corresponds to the \ref ppm_syscall_code of the system call.
 
   This table can be used to interpret the ID parameter of PPME_GENERIC_E and PPME_GENERIC_X.
 */
@@ -684,6 +1646,247 @@ const scap_machine_info* scap_get_machine_info(scap_t* handle);
 */
 int32_t scap_set_snaplen(scap_t* handle, uint32_t snaplen);
 
+/*!
+  \brief Set the event types that the driver captures. Events whose type is
+  not in the mask are discarded in the kernel, before reaching the ring buffer.
+
+  \param handle Handle to the capture instance.
+  \param mask bitmap of the event types to capture, see \ref ppm_evt_mask.
+
+  \note This function can only be called for live captures.
+  \note By default, all the event types are captured. Drop events are
+  always captured, regardless of the mask.
+*/
+int32_t scap_set_event_mask(scap_t* handle, struct ppm_evt_mask* mask);
+
+/*!
+  \brief Set a separate sampling ratio for each event type.
+
+  \param handle Handle to the capture instance.
+  \param policy the ratios and the adaptive threshold, see \ref ppm_sampling_policy.
+
+  \note This function can only be called for live captures.
+  \note Unlike \ref scap_start_dropping_mode(), which drops everything for a
+  fraction of every second, the policy lets the callers keep the events that
+  the state tracking needs, and sample only the high volume ones, like I/O.
+  With a nonzero adaptive threshold, sampling happens only while the
+  buffers are filling up.
+*/
+int32_t scap_set_sampling_policy(scap_t* handle, struct ppm_sampling_policy* policy);
+
+/*!
+  \brief Set per event type, fd type or port snaplens. The driver uses the
+  snaplen of the first matching rule when it copies an I/O buffer, and the
+  one set with \ref scap_set_snaplen() if no rule matches.
+
+  \param handle Handle to the capture instance.
+  \param policy the rules, see \ref ppm_snaplen_policy. No rules restores
+  the single snaplen.
+
+  \note This function can only be called for live captures.
+*/
+int32_t scap_set_snaplen_policy(scap_t* handle, struct ppm_snaplen_policy* policy);
+
+/*!
+  \brief Set the list of threads whose events are discarded by the driver.
+
+  \param handle Handle to the capture instance.
+  \param tids Array of thread ids. Each entry matches both a thread id and a
+    process id, so adding a pid excludes all the threads of that process.
+  \param ntids Number of entries in tids, at most PPM_MAX_EXCLUDED_TIDS.
+    0 clears the list.
+
+  \note This function can only be called for live captures.
+*/
+int32_t scap_set_excluded_tids(scap_t* handle, uint64_t* tids, uint32_t ntids);
+
+/*!
+  \brief Pin the consumer to a set of CPUs. The calling thread moves there
+  right away, and the reader and decoder threads started later run there
+  too. Call it before reading the first events, so that the buffers of
+  libscap are allocated on the NUMA node of those CPUs.
+
+  \param handle Handle to the capture instance.
+  \param cpus Array of CPU numbers, below PPM_MAX_EXCLUDED_CPUS.
+  \param ncpus Number of entries in cpus. 0 unpins the consumer.
+  \param exclude If true, the driver discards the events of those CPUs, so
+    that the consumer doesn't capture itself. Only for live captures.
+*/
+int32_t scap_set_consumer_cpus(scap_t* handle, const uint32_t* cpus, uint32_t ncpus, bool exclude);
+
+/*!
+  \brief Return where the calling thread runs, and how the consumer is
+  pinned.
+
+  \param handle Handle to the capture instance.
+  \param placement Pointer to a \ref scap_consumer_placement structure that
+    will be filled.
+*/
+int32_t scap_get_consumer_placement(scap_t* handle, OUT scap_consumer_placement* placement);
+
+/*!
+  \brief Set the conditions on the thread id, the process id and the return
+  value that the events must meet to be captured. The driver tests them
+  before filling the events, see \ref ppm_predicate.
+
+  \param handle Handle to the capture instance.
+  \param pred the clauses. No clauses captures all the events.
+
+  \note This function can only be called for live captures.
+  \note The events that modify the state are always captured.
+*/
+int32_t scap_set_predicate(scap_t* handle, struct ppm_predicate* pred);
+
+/*!
+  \brief Set how much data must be in a ring buffer before the driver wakes up
+  a reader waiting for events.
+
+  \param handle Handle to the capture instance.
+  \param watermark the amount of data, in bytes. It's capped to half of the ring
+    buffer size.
+
+  \note This function can only be called for live captures.
+  \note When all the buffers are empty, \ref scap_next() waits until a buffer
+  reaches the watermark, or until the timeout set with
+  scap_set_empty_buffer_timeout_ms() expires. The default watermark is 1 byte,
+  which gives the lowest delivery latency. Bigger values reduce the number of
+  wakeups on moderately busy systems, at the cost of latency.
+*/
+int32_t scap_set_wakeup_watermark(scap_t* handle, uint32_t watermark);
+
+/*!
+  \brief Set the longest time an event can stay in a ring buffer that is below
+  the wakeup watermark before the driver wakes up the reader.
+
+  \param handle Handle to the capture instance.
+  \param max_delay_ms the delay, in milliseconds. 0 turns the limit off, which
+    is the default.
+
+  \note This function can only be called for live captures.
+  \note It bounds the latency of the events of the CPUs that write too little
+  to reach the watermark, so a big watermark can be used on the busy CPUs
+  without holding back the events of the quiet ones. The empty buffer timeout
+  is also capped to this delay, since a CPU that goes idle can't notice that
+  its last event has waited too long.
+*/
+int32_t scap_set_max_delay_ms(scap_t* handle, uint32_t max_delay_ms);
+
+/*!
+  \brief Choose whether \ref scap_next() and \ref scap_next_batch() merge the
+  per-CPU buffers by timestamp.
+
+  \param handle Handle to the capture instance.
+  \param unordered if true, each buffer is drained in turn and events are
+    returned in timestamp order only within a CPU. If false (the default),
+    events are returned in global timestamp order.
+    In both modes, a process info event (see \ref scap_enable_procinfo_ring())
+    comes after the clone or execve it belongs to.
+
+  \note This function can only be called for live captures.
+  \note Unordered mode is cheaper when there are many CPUs, but consumers that
+  correlate events across CPUs, like the sinsp state engine, need the ordered
+  mode.
+*/
+int32_t scap_set_unordered_mode(scap_t* handle, bool unordered);
+
+/*!
+  \brief Read the buffers from a pool of threads instead of the one calling
+  \ref scap_next().
+
+  \param handle Handle to the capture instance.
+  \param nthreads the number of reader threads. Each one owns the buffers of
+    the CPUs whose number modulo nthreads is its index, merges them and copies
+    the events into its own queue. \ref scap_next() and \ref scap_next_batch()
+    then merge the queues, so the ordering follows scap_set_unordered_mode()
+    as usual. When the caller can't keep up, the queues fill up and the events
+    are dropped by the driver, like without the readers.
+    On trace files, the threads decompress the frames of compressed files
+    ahead of \ref scap_next(), each one a frame in turn, while the caller
+    processes the events of the current one. Files that are read as
+    streams, like pipes, or that aren't compressed, are read as usual.
+
+  \note This function can only be called once. For live captures, the
+  auxiliary rings must be enabled before it, and the event returned by the
+  previous \ref scap_next() call is not valid anymore after it.
+*/
+int32_t scap_set_reader_threads(scap_t* handle, uint32_t nthreads);
+
+/*!
+  \brief Copy every event returned by \ref scap_next() and
+  \ref scap_next_batch() to a shared memory ring, so that other processes can
+  consume them without opening the driver. See scap_tap.h for the layout.
+
+  \param handle Handle to the capture instance.
+  \param name the name of the shared memory object, see shm_open(). A leading
+    slash is added if missing. An existing object with the same name is
+    replaced.
+  \param size the size of the ring, in bytes. Must be a multiple of 8 and at
+    least 64KB.
+
+  \note The writer never waits: readers that fall behind by more than the
+  size of the ring lose events, and can tell how many with
+  \ref scap_tap_get_lost(). The tap is removed by \ref scap_close().
+  \note The shared memory object is readable and writable by the owner of
+  the capture process only, so the readers must run as the same user.
+*/
+int32_t scap_enable_tap(scap_t* handle, const char* name, uint32_t size);
+
+/*!
+  \brief Fold the runs of identical poll(), epoll_wait(), select(),
+  nanosleep() and futex() calls of each thread in the events returned by
+  \ref scap_next() and \ref scap_next_batch().
+
+  \param handle Handle to the capture instance.
+  \param enable true to fold, false (the default) to return every event.
+
+  \note The first call of a run is returned as usual. The calls with the same
+  parameters and the same result that follow it are dropped, and replaced by
+  a PPME_REPEAT_E event with the number of events dropped and the time
+  between the first and the last one, once the run ends. Runs last at most
+  one second. While a run can continue, the enter event of each call is held
+  until its exit, so it can be returned after the events of other threads.
+  \note With folding on, \ref scap_next_batch() returns one event per call.
+  \note Turning folding off drops the events being held.
+*/
+int32_t scap_set_fold(scap_t* handle, bool enable);
+
+/*!
+  \brief Attach to the event tap of another process, read-only. Only the
+  events written after this call are returned.
+
+  \param name the name given to \ref scap_enable_tap().
+  \param error Pointer to a buffer that will contain the error string in case the
+    function fails. The buffer must have size SCAP_LASTERR_SIZE.
+
+  \return The reader, or NULL on failure. Release it with \ref scap_tap_detach().
+*/
+scap_tap_reader* scap_tap_attach(const char* name, char* error);
+
+/*!
+  \brief Get the next event from an event tap.
+
+  \param r The reader returned by \ref scap_tap_attach().
+  \param pevent User-provided event pointer that will be initialized with the
+    address of a copy of the event, valid until the next call.
+  \param pcpuid User-provided event pointer that will be initialized with the
+    ID of the CPU where the event was captured.
+
+  \return SCAP_SUCCESS if an event was returned, SCAP_TIMEOUT if there are no
+   new events, SCAP_EOF if the writer closed the tap and everything was read.
+*/
+int32_t scap_tap_next(scap_tap_reader* r, OUT scap_evt** pevent, OUT uint16_t* pcpuid);
+
+/*!
+  \brief Return the number of events the reader missed because the writer
+  overwrote them.
+*/
+uint64_t scap_tap_get_lost(scap_tap_reader* r);
+
+/*!
+  \brief Detach from an event tap and free the reader.
+*/
+void scap_tap_detach(scap_tap_reader* r);
+
 /*@}*/
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -710,6 +1913,16 @@ struct scap_threadinfo* scap_proc_get(scap_t* handle, int64_t tid, bool scan_soc
 
 void scap_proc_free(scap_t* handle, struct scap_threadinfo* procinfo);
 
+// Read the cgroup path of a live process, in the format of scap_threadinfo.cgroup.
+// cgroup is set to an empty string if the process has none. Fails if the
+// process is gone.
+int32_t scap_proc_get_cgroup(scap_t* handle, int64_t tid, OUT char* cgroup, uint32_t len);
+
+// Convert the fd of a PPME_FDSTATE_E event the same way the fds under /proc
+// are. Returns SCAP_NOTFOUND for the fds that the fd tables don't keep, like
+// the netlink sockets, and for malformed events.
+int32_t scap_fd_from_state_event(scap_evt* e, OUT scap_fdinfo* fdi);
+
 int32_t scap_stop_dropping_mode(scap_t* handle);
 
 int32_t scap_start_dropping_mode(scap_t* handle, uint32_t sampling_ratio);
@@ -0,0 +1,189 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "scap.h"
+#include "scap-int.h"
+
+//
+// Placement of the consumer. The thread that calls scap_next() and the
+// reader and decoder threads can be pinned to a set of CPUs, so that they
+// don't migrate away from the caches they filled, and optionally the driver
+// can discard the events of those CPUs, so that the consumer doesn't capture
+// itself.
+// There is no explicit NUMA allocation: the buffers of libscap are written
+// first by the threads that use them, so with the default first touch policy
+// of Linux they land on the node of the CPUs they are pinned to, as long as
+// the pinning happens before the capture starts.
+//
+
+#if !defined(_WIN32) && !defined(__APPLE__)
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+int32_t scap_pin_thread(scap_t* handle)
+{
+	cpu_set_t set;
+	uint32_t j;
+
+	if(handle->m_consumer_ncpus == 0)
+	{
+		return SCAP_SUCCESS;
+	}
+
+	CPU_ZERO(&set);
+
+	for(j = 0; j < PPM_MAX_EXCLUDED_CPUS && j < CPU_SETSIZE; j++)
+	{
+		if(handle->m_consumer_cpus[j / 64] & (1ULL << (j % 64)))
+		{
+			CPU_SET(j, &set);
+		}
+	}
+
+	//
+	// 0 is the calling thread, not the whole process
+	//
+	if(sched_setaffinity(0, sizeof(set), &set) != 0)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "error pinning the consumer: %s", strerror(errno));
+		return SCAP_FAILURE;
+	}
+
+	return SCAP_SUCCESS;
+}
+
+int32_t scap_set_consumer_cpus(scap_t* handle, const uint32_t* cpus, uint32_t ncpus, bool exclude)
+{
+	struct ppm_cpu_exclusion_mask mask;
+	uint32_t j;
+
+	if(exclude && handle->m_file)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "excluding CPUs not supported on offline captures");
+		return SCAP_FAILURE;
+	}
+
+	memset(&mask, 0, sizeof(mask));
+
+	for(j = 0; j < ncpus; j++)
+	{
+		if(cpus[j] >= PPM_MAX_EXCLUDED_CPUS)
+		{
+			snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "invalid CPU %u (max is %u)", cpus[j], PPM_MAX_EXCLUDED_CPUS - 1);
+			return SCAP_FAILURE;
+		}
+
+		mask.bits[cpus[j] / 64] |= 1ULL << (cpus[j] % 64);
+	}
+
+	memcpy(handle->m_consumer_cpus, mask.bits, sizeof(mask.bits));
+	handle->m_consumer_ncpus = 0;
+
+	for(j = 0; j < PPM_MAX_EXCLUDED_CPUS / 64; j++)
+	{
+		handle->m_consumer_ncpus += __builtin_popcountll(mask.bits[j]);
+	}
+
+	if(scap_pin_thread(handle) != SCAP_SUCCESS)
+	{
+		handle->m_consumer_ncpus = 0;
+		return SCAP_FAILURE;
+	}
+
+	//
+	// Only the calling thread moves now. The reader and decoder threads
+	// pin themselves when they start.
+	//
+	if(handle->m_file)
+	{
+		return SCAP_SUCCESS;
+	}
+
+	//
+	// An empty mask captures all the CPUs again
+	//
+	if(!exclude)
+	{
+		memset(&mask, 0, sizeof(mask));
+	}
+
+	if(ioctl(handle->m_devs[0].m_fd, PPM_IOCTL_SET_EXCLUDED_CPUS, &mask))
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "scap_set_consumer_cpus failed: %s", strerror(errno));
+		return SCAP_FAILURE;
+	}
+
+	handle->m_consumer_excluded = exclude && ncpus != 0;
+
+	return SCAP_SUCCESS;
+}
+
+int32_t scap_get_consumer_placement(scap_t* handle, OUT scap_consumer_placement* placement)
+{
+	unsigned int cpu;
+	unsigned int node;
+
+	placement->cpu = -1;
+	placement->numa_node = -1;
+
+	//
+	// The node comes with the CPU from getcpu(), which glibc doesn't wrap
+	//
+	if(syscall(SYS_getcpu, &cpu, &node, NULL) == 0)
+	{
+		placement->cpu = (int32_t)cpu;
+		placement->numa_node = (int32_t)node;
+	}
+
+	placement->ncpus = handle->m_consumer_ncpus;
+	placement->excluded = handle->m_consumer_excluded;
+
+	return SCAP_SUCCESS;
+}
+
+#else // !defined(_WIN32) && !defined(__APPLE__)
+
+int32_t scap_pin_thread(scap_t* handle)
+{
+	return SCAP_SUCCESS;
+}
+
+int32_t scap_set_consumer_cpus(scap_t* handle, const uint32_t* cpus, uint32_t ncpus, bool exclude)
+{
+	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "pinning the consumer is only supported on linux");
+	return SCAP_FAILURE;
+}
+
+int32_t scap_get_consumer_placement(scap_t* handle, OUT scap_consumer_placement* placement)
+{
+	placement->cpu = -1;
+	placement->numa_node = -1;
+	placement->ncpus = 0;
+	placement->excluded = false;
+
+	return SCAP_SUCCESS;
+}
+
+#endif // !defined(_WIN32) && !defined(__APPLE__)
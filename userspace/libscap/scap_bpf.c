@@ -0,0 +1,997 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "scap.h"
+#include "scap-int.h"
+
+//
+// eBPF capture engine, selected with SCAP_OPEN_BPF. Instead of the
+// sysdig-probe module, two programs attached to the raw_syscalls tracepoints
+// write the events to a perf buffer per CPU, so nothing has to be built for
+// the running kernel.
+// The programs don't run the fillers of the driver: every system call gives
+// a PPME_GENERIC_E/PPME_GENERIC_X pair, with the same system call ids the
+// driver would put there. What the programs do is the filtering that doesn't
+// need the arguments: the event mask, the excluded threads and the predicate
+// are checked before anything is written, and the predicate is compiled
+// into the programs, so a clause costs a couple of instructions.
+// The programs are generated here as bytecode, so there's no compiler and
+// no object file to load.
+// The rest of libscap sees a device per CPU like with the driver, whose
+// buffer is the copy of the events of the perf buffer made by
+// scap_bpf_readbuf().
+//
+
+#if !defined(_WIN32) && !defined(__APPLE__) && defined(__x86_64__)
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/bpf.h>
+#include <linux/perf_event.h>
+#include "../../driver/ppm_ringbuffer.h"
+
+extern const struct ppm_event_info g_event_info[];
+extern const struct syscall_evt_pair g_syscall_table[];
+extern const enum ppm_syscall_code g_syscall_code_routing_table[];
+
+//
+// Offset of orig_ax in the pt_regs of x86_64, where the exit program finds
+// the number of the system call
+//
+#define SCAP_BPF_ORIG_AX_OFF (15 * 8)
+
+//
+// Entry of the system call map: the PPM_SC_* id in the low 16 bits, and
+// these flags
+//
+#define SCAP_BPF_SC_ENTER (1 << 16) // The enter event is in the event mask
+#define SCAP_BPF_SC_EXIT (1 << 17) // The exit event is in the event mask
+#define SCAP_BPF_SC_NEVER_DROP (1 << 18) // The predicate doesn't apply, the events change the state
+#define SCAP_BPF_SC_RES (1 << 19) // The return value clauses apply to the exit event
+
+#define SCAP_BPF_MAX_INSNS 512
+#define SCAP_BPF_LOG_SIZE (64 * 1024)
+
+//
+// Where the programs keep things on the stack
+//
+#define SCAP_BPF_STACK_EVT -64 // The event being built
+#define SCAP_BPF_STACK_PID_TGID -24
+#define SCAP_BPF_STACK_TMP -16
+#define SCAP_BPF_STACK_KEY -4
+
+struct scap_bpf
+{
+	int m_settings_map; // One u32: capturing or not
+	int m_syscalls_map; // SCAP_BPF_SC_* of each system call number
+	int m_tids_map; // The excluded threads
+	int m_events_map; // The perf buffer of each CPU
+	int m_enter_prog;
+	int m_exit_prog;
+	int m_enter_link; // Closing the raw tracepoints detaches the programs
+	int m_exit_link;
+	uint64_t m_boot_ts; // Wall clock time of the boot, the programs give the time since then
+	uint32_t m_page_size;
+	struct ppm_evt_mask m_event_mask;
+	struct ppm_predicate m_predicate;
+	uint64_t m_tids[PPM_MAX_EXCLUDED_TIDS];
+	uint32_t m_ntids;
+	struct ppm_ring_buffer_info* m_bufinfos; // Stats of each device, like the ones of the driver
+};
+
+//
+// A program being generated. The jumps to the end, taken when the event is
+// discarded, are patched when the end is known.
+//
+typedef struct scap_bpf_code
+{
+	struct bpf_insn m_insns[SCAP_BPF_MAX_INSNS];
+	uint32_t m_len;
+	uint32_t m_drops[SCAP_BPF_MAX_INSNS];
+	uint32_t m_ndrops;
+}scap_bpf_code;
+
+#define MOV64_REG(D, S) BPF_ALU64 | BPF_MOV | BPF_X, D, S, 0, 0
+#define MOV64_IMM(D, K) BPF_ALU64 | BPF_MOV | BPF_K, D, 0, 0, K
+#define MOV32_IMM(D, K) BPF_ALU | BPF_MOV | BPF_K, D, 0, 0, K
+#define ALU64_IMM(OP, D, K) BPF_ALU64 | OP | BPF_K, D, 0, 0, K
+#define LDX_MEM(SIZE, D, S, OFF) BPF_LDX | SIZE | BPF_MEM, D, S, OFF, 0
+#define STX_MEM(SIZE, D, S, OFF) BPF_STX | SIZE | BPF_MEM, D, S, OFF, 0
+#define ST_MEM(SIZE, D, OFF, K) BPF_ST | SIZE | BPF_MEM, D, 0, OFF, K
+#define JMP_IMM(OP, D, K, OFF) BPF_JMP | OP | BPF_K, D, 0, OFF, K
+#define CALL(F) BPF_JMP | BPF_CALL, 0, 0, 0, F
+#define EXIT() BPF_JMP | BPF_EXIT, 0, 0, 0, 0
+
+static void emit(scap_bpf_code* c, uint8_t code, uint8_t dst, uint8_t src, int16_t off, int32_t imm)
+{
+	struct bpf_insn* insn = &c->m_insns[c->m_len++];
+
+	ASSERT(c->m_len <= SCAP_BPF_MAX_INSNS);
+
+	insn->code = code;
+	insn->dst_reg = dst;
+	insn->src_reg = src;
+	insn->off = off;
+	insn->imm = imm;
+}
+
+static void emit_ld_imm64(scap_bpf_code* c, uint8_t dst, uint8_t src, uint64_t imm)
+{
+	emit(c, BPF_LD | BPF_DW | BPF_IMM, dst, src, 0, (int32_t)(uint32_t)imm);
+	emit(c, 0, 0, 0, 0, (int32_t)(imm >> 32));
+}
+
+//
+// Discard the event if dst <op> src (BPF_X) or dst <op> imm (BPF_K)
+//
+static void emit_drop(scap_bpf_code* c, uint8_t op, uint8_t srcmode, uint8_t dst, uint8_t src, int32_t imm)
+{
+	c->m_drops[c->m_ndrops++] = c->m_len;
+	emit(c, BPF_JMP | op | srcmode, dst, src, 0, imm);
+}
+
+//
+// r0 = the entry of the u32 key at SCAP_BPF_STACK_KEY in the map, or NULL
+//
+static void emit_lookup(scap_bpf_code* c, int map_fd)
+{
+	emit_ld_imm64(c, BPF_REG_1, BPF_PSEUDO_MAP_FD, map_fd);
+	emit(c, MOV64_REG(BPF_REG_2, BPF_REG_10));
+	emit(c, ALU64_IMM(BPF_ADD, BPF_REG_2, SCAP_BPF_STACK_KEY));
+	emit(c, CALL(BPF_FUNC_map_lookup_elem));
+}
+
+//
+// Compile the predicate. A clause is false when the jump of its comparison
+// isn't taken, or is taken if it's negated.
+//
+static void emit_predicate(scap_bpf_code* c, struct ppm_predicate* pred, bool is_exit)
+{
+	static const uint8_t jmp_false[] = {BPF_JNE, BPF_JEQ, BPF_JSGE, BPF_JSGT, BPF_JSLE, BPF_JSLT};
+	static const uint8_t jmp_true[] = {BPF_JEQ, BPF_JNE, BPF_JSLT, BPF_JSLE, BPF_JSGT, BPF_JSGE};
+	uint32_t never_drop;
+	uint32_t j;
+
+	emit(c, MOV64_REG(BPF_REG_1, BPF_REG_8));
+	emit(c, ALU64_IMM(BPF_AND, BPF_REG_1, SCAP_BPF_SC_NEVER_DROP));
+	never_drop = c->m_len;
+	emit(c, JMP_IMM(BPF_JNE, BPF_REG_1, 0, 0));
+
+	for(j = 0; j < pred->n_clauses; j++)
+	{
+		struct ppm_predicate_clause* cl = &pred->clauses[j];
+		uint8_t op = cl->negate? jmp_true[cl->cmp] : jmp_false[cl->cmp];
+
+		switch(cl->field)
+		{
+		case PPM_PRED_FIELD_TID:
+			emit(c, LDX_MEM(BPF_DW, BPF_REG_1, BPF_REG_10, SCAP_BPF_STACK_PID_TGID));
+			emit(c, ALU64_IMM(BPF_LSH, BPF_REG_1, 32));
+			emit(c, ALU64_IMM(BPF_ARSH, BPF_REG_1, 32));
+			break;
+		case PPM_PRED_FIELD_PID:
+			emit(c, LDX_MEM(BPF_DW, BPF_REG_1, BPF_REG_10, SCAP_BPF_STACK_PID_TGID));
+			emit(c, ALU64_IMM(BPF_ARSH, BPF_REG_1, 32));
+			break;
+		case PPM_PRED_FIELD_RES:
+			//
+			// True for the enter events, and for the exit events that
+			// are not in res_events, so skip the 4 instructions of the
+			// comparison
+			//
+			if(!is_exit)
+			{
+				continue;
+			}
+
+			emit(c, MOV64_REG(BPF_REG_1, BPF_REG_8));
+			emit(c, ALU64_IMM(BPF_AND, BPF_REG_1, SCAP_BPF_SC_RES));
+			emit(c, JMP_IMM(BPF_JEQ, BPF_REG_1, 0, 4));
+			emit(c, MOV64_REG(BPF_REG_1, BPF_REG_9));
+			break;
+		default:
+			ASSERT(false);
+			continue;
+		}
+
+		emit_ld_imm64(c, BPF_REG_2, 0, (uint64_t)cl->value);
+		emit_drop(c, op, BPF_X, BPF_REG_1, BPF_REG_2, 0);
+	}
+
+	c->m_insns[never_drop].off = c->m_len - never_drop - 1;
+}
+
+//
+// Generate the program of the enter or of the exit events.
+// Registers: r6 the context, r7 the system call number, r8 its entry of
+// the system call map, r9 the return value.
+//
+static void scap_bpf_gen_prog(struct scap_bpf* bpf, bool is_exit, scap_bpf_code* c)
+{
+	uint32_t hdr_len = sizeof(struct ppm_evt_hdr);
+	uint32_t nparams = is_exit? 1 : 2;
+	uint32_t evt_len = hdr_len + nparams * sizeof(uint16_t) + nparams * sizeof(uint16_t);
+	int16_t params_off = SCAP_BPF_STACK_EVT + hdr_len + nparams * sizeof(uint16_t);
+	uint32_t j;
+
+	c->m_len = 0;
+	c->m_ndrops = 0;
+
+	emit(c, MOV64_REG(BPF_REG_6, BPF_REG_1));
+
+	//
+	// Capture stopped?
+	//
+	emit(c, ST_MEM(BPF_W, BPF_REG_10, SCAP_BPF_STACK_KEY, 0));
+	emit_lookup(c, bpf->m_settings_map);
+	emit_drop(c, BPF_JEQ, BPF_K, BPF_REG_0, 0, 0);
+	emit(c, LDX_MEM(BPF_W, BPF_REG_1, BPF_REG_0, 0));
+	emit_drop(c, BPF_JEQ, BPF_K, BPF_REG_1, 0, 0);
+
+	//
+	// The arguments of sys_enter are the registers and the system call
+	// number, the ones of sys_exit the registers and the return value
+	//
+	if(!is_exit)
+	{
+		emit(c, LDX_MEM(BPF_DW, BPF_REG_7, BPF_REG_6, 8));
+	}
+	else
+	{
+		emit(c, LDX_MEM(BPF_DW, BPF_REG_9, BPF_REG_6, 8));
+		emit(c, LDX_MEM(BPF_DW, BPF_REG_3, BPF_REG_6, 0));
+		emit(c, ALU64_IMM(BPF_ADD, BPF_REG_3, SCAP_BPF_ORIG_AX_OFF));
+		emit(c, MOV64_REG(BPF_REG_1, BPF_REG_10));
+		emit(c, ALU64_IMM(BPF_ADD, BPF_REG_1, SCAP_BPF_STACK_TMP));
+		emit(c, MOV64_IMM(BPF_REG_2, 8));
+		emit(c, CALL(BPF_FUNC_probe_read));
+		emit_drop(c, BPF_JNE, BPF_K, BPF_REG_0, 0, 0);
+		emit(c, LDX_MEM(BPF_DW, BPF_REG_7, BPF_REG_10, SCAP_BPF_STACK_TMP));
+	}
+
+	//
+	// Event mask, unsigned so that -1 is out of the table too
+	//
+	emit_drop(c, BPF_JGT, BPF_K, BPF_REG_7, 0, SYSCALL_TABLE_SIZE - 1);
+	emit(c, STX_MEM(BPF_W, BPF_REG_10, BPF_REG_7, SCAP_BPF_STACK_KEY));
+	emit_lookup(c, bpf->m_syscalls_map);
+	emit_drop(c, BPF_JEQ, BPF_K, BPF_REG_0, 0, 0);
+	emit(c, LDX_MEM(BPF_W, BPF_REG_8, BPF_REG_0, 0));
+	emit(c, MOV64_REG(BPF_REG_1, BPF_REG_8));
+	emit(c, ALU64_IMM(BPF_AND, BPF_REG_1, is_exit? SCAP_BPF_SC_EXIT : SCAP_BPF_SC_ENTER));
+	emit_drop(c, BPF_JEQ, BPF_K, BPF_REG_1, 0, 0);
+
+	//
+	// Excluded threads
+	//
+	emit(c, CALL(BPF_FUNC_get_current_pid_tgid));
+	emit(c, STX_MEM(BPF_DW, BPF_REG_10, BPF_REG_0, SCAP_BPF_STACK_PID_TGID));
+	emit(c, STX_MEM(BPF_W, BPF_REG_10, BPF_REG_0, SCAP_BPF_STACK_KEY));
+	emit_lookup(c, bpf->m_tids_map);
+	emit_drop(c, BPF_JNE, BPF_K, BPF_REG_0, 0, 0);
+
+	if(bpf->m_predicate.n_clauses != 0)
+	{
+		emit_predicate(c, &bpf->m_predicate, is_exit);
+	}
+
+	//
+	// The event: header, parameter lengths, system call id and, for the
+	// enter event, the native number
+	//
+	emit(c, CALL(BPF_FUNC_ktime_get_ns));
+	emit(c, STX_MEM(BPF_DW, BPF_REG_10, BPF_REG_0, SCAP_BPF_STACK_EVT));
+	emit(c, LDX_MEM(BPF_DW, BPF_REG_1, BPF_REG_10, SCAP_BPF_STACK_PID_TGID));
+	emit(c, ALU64_IMM(BPF_LSH, BPF_REG_1, 32));
+	emit(c, ALU64_IMM(BPF_RSH, BPF_REG_1, 32));
+	emit(c, STX_MEM(BPF_DW, BPF_REG_10, BPF_REG_1, SCAP_BPF_STACK_EVT + 8));
+	emit(c, ST_MEM(BPF_W, BPF_REG_10, SCAP_BPF_STACK_EVT + 16, evt_len));
+	emit(c, ST_MEM(BPF_H, BPF_REG_10, SCAP_BPF_STACK_EVT + 20, is_exit? PPME_GENERIC_X : PPME_GENERIC_E));
+
+	for(j = 0; j < nparams; j++)
+	{
+		emit(c, ST_MEM(BPF_H, BPF_REG_10, SCAP_BPF_STACK_EVT + hdr_len + j * sizeof(uint16_t), sizeof(uint16_t)));
+	}
+
+	emit(c, STX_MEM(BPF_H, BPF_REG_10, BPF_REG_8, params_off));
+	if(!is_exit)
+	{
+		emit(c, STX_MEM(BPF_H, BPF_REG_10, BPF_REG_7, params_off + sizeof(uint16_t)));
+	}
+
+	emit(c, MOV64_REG(BPF_REG_1, BPF_REG_6));
+	emit_ld_imm64(c, BPF_REG_2, BPF_PSEUDO_MAP_FD, bpf->m_events_map);
+	emit(c, MOV32_IMM(BPF_REG_3, -1)); // BPF_F_CURRENT_CPU
+	emit(c, MOV64_REG(BPF_REG_4, BPF_REG_10));
+	emit(c, ALU64_IMM(BPF_ADD, BPF_REG_4, SCAP_BPF_STACK_EVT));
+	emit(c, MOV64_IMM(BPF_REG_5, evt_len));
+	emit(c, CALL(BPF_FUNC_perf_event_output));
+
+	//
+	// The end, where the discarded events jump
+	//
+	for(j = 0; j < c->m_ndrops; j++)
+	{
+		c->m_insns[c->m_drops[j]].off = c->m_len - c->m_drops[j] - 1;
+	}
+
+	emit(c, MOV64_IMM(BPF_REG_0, 0));
+	emit(c, EXIT());
+}
+
+static int sys_bpf(int cmd, union bpf_attr* attr)
+{
+	return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+static int scap_bpf_create_map(uint32_t type, uint32_t key_size, uint32_t value_size, uint32_t max_entries)
+{
+	union bpf_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_type = type;
+	attr.key_size = key_size;
+	attr.value_size = value_size;
+	attr.max_entries = max_entries;
+
+	return sys_bpf(BPF_MAP_CREATE, &attr);
+}
+
+static int scap_bpf_update_elem(int map_fd, const void* key, const void* value)
+{
+	union bpf_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_fd = map_fd;
+	attr.key = (uint64_t)(unsigned long)key;
+	attr.value = (uint64_t)(unsigned long)value;
+	attr.flags = BPF_ANY;
+
+	return sys_bpf(BPF_MAP_UPDATE_ELEM, &attr);
+}
+
+static int scap_bpf_delete_elem(int map_fd, const void* key)
+{
+	union bpf_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_fd = map_fd;
+	attr.key = (uint64_t)(unsigned long)key;
+
+	return sys_bpf(BPF_MAP_DELETE_ELEM, &attr);
+}
+
+//
+// Load a program and attach it to a raw tracepoint. On failure, the last
+// line of the log of the verifier ends up in the error.
+//
+static int32_t scap_bpf_load_prog(scap_t* handle, scap_bpf_code* c, const char* tp, OUT int* prog_fd, OUT int* link_fd)
+{
+	union bpf_attr attr;
+	char* log;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.prog_type = BPF_PROG_TYPE_RAW_TRACEPOINT;
+	attr.insns = (uint64_t)(unsigned long)c->m_insns;
+	attr.insn_cnt = c->m_len;
+	attr.license = (uint64_t)(unsigned long)"GPL";
+
+	*prog_fd = sys_bpf(BPF_PROG_LOAD, &attr);
+	if(*prog_fd < 0)
+	{
+		int err = errno;
+
+		//
+		// Load it again to get the reason
+		//
+		log = (char*)calloc(1, SCAP_BPF_LOG_SIZE);
+		if(log != NULL)
+		{
+			char* last;
+
+			attr.log_buf = (uint64_t)(unsigned long)log;
+			attr.log_size = SCAP_BPF_LOG_SIZE;
+			attr.log_level = 1;
+			sys_bpf(BPF_PROG_LOAD, &attr);
+
+			while(strlen(log) != 0 && log[strlen(log) - 1] == '\n')
+			{
+				log[strlen(log) - 1] = 0;
+			}
+
+			last = strrchr(log, '\n');
+			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error loading the %s program: %s %s",
+				tp, strerror(err), (last != NULL)? last + 1 : log);
+			free(log);
+		}
+		else
+		{
+			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error loading the %s program: %s", tp, strerror(err));
+		}
+
+		return SCAP_FAILURE;
+	}
+
+	memset(&attr, 0, sizeof(attr));
+	attr.raw_tracepoint.name = (uint64_t)(unsigned long)tp;
+	attr.raw_tracepoint.prog_fd = *prog_fd;
+
+	*link_fd = sys_bpf(BPF_RAW_TRACEPOINT_OPEN, &attr);
+	if(*link_fd < 0)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error attaching to the %s tracepoint: %s", tp, strerror(errno));
+		close(*prog_fd);
+		*prog_fd = -1;
+		return SCAP_FAILURE;
+	}
+
+	return SCAP_SUCCESS;
+}
+
+static void scap_bpf_detach(struct scap_bpf* bpf)
+{
+	int* fds[] = {&bpf->m_enter_link, &bpf->m_exit_link, &bpf->m_enter_prog, &bpf->m_exit_prog};
+	uint32_t j;
+
+	for(j = 0; j < sizeof(fds) / sizeof(fds[0]); j++)
+	{
+		if(*fds[j] >= 0)
+		{
+			close(*fds[j]);
+			*fds[j] = -1;
+		}
+	}
+}
+
+//
+// Generate and attach the programs, replacing the ones that are there. The
+// old ones go first, so that no event is written twice.
+//
+static int32_t scap_bpf_attach(scap_t* handle)
+{
+	struct scap_bpf* bpf = handle->m_bpf;
+	scap_bpf_code* c;
+	int32_t res;
+
+	c = (scap_bpf_code*)malloc(sizeof(scap_bpf_code));
+	if(c == NULL)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error allocating the eBPF programs");
+		return SCAP_FAILURE;
+	}
+
+	scap_bpf_detach(bpf);
+
+	scap_bpf_gen_prog(bpf, false, c);
+	res = scap_bpf_load_prog(handle, c, "sys_enter", &bpf->m_enter_prog, &bpf->m_enter_link);
+
+	if(res == SCAP_SUCCESS)
+	{
+		scap_bpf_gen_prog(bpf, true, c);
+		res = scap_bpf_load_prog(handle, c, "sys_exit", &bpf->m_exit_prog, &bpf->m_exit_link);
+	}
+
+	if(res != SCAP_SUCCESS)
+	{
+		scap_bpf_detach(bpf);
+	}
+
+	free(c);
+	return res;
+}
+
+//
+// Fill the system call map from the event mask and the predicate
+//
+static int32_t scap_bpf_update_syscalls(scap_t* handle)
+{
+	struct scap_bpf* bpf = handle->m_bpf;
+	uint32_t j;
+
+	for(j = 0; j < SYSCALL_TABLE_SIZE; j++)
+	{
+		const struct syscall_evt_pair* p = &g_syscall_table[j];
+		enum ppm_event_type enter = (p->flags & UF_USED)? p->enter_event_type : PPME_GENERIC_E;
+		enum ppm_event_type exit = (p->flags & UF_USED)? p->exit_event_type : PPME_GENERIC_X;
+		uint32_t val = (uint32_t)g_syscall_code_routing_table[j] & 0xffff;
+
+		if(PPM_EVT_MASK_ISSET(&bpf->m_event_mask, enter))
+		{
+			val |= SCAP_BPF_SC_ENTER;
+		}
+
+		if(PPM_EVT_MASK_ISSET(&bpf->m_event_mask, exit))
+		{
+			val |= SCAP_BPF_SC_EXIT;
+		}
+
+		if((g_event_info[enter].flags | g_event_info[exit].flags) &
+			(EF_CREATES_FD | EF_DESTROYS_FD | EF_MODIFIES_STATE))
+		{
+			val |= SCAP_BPF_SC_NEVER_DROP;
+		}
+
+		if(PPM_EVT_MASK_ISSET(&bpf->m_predicate.res_events, exit))
+		{
+			val |= SCAP_BPF_SC_RES;
+		}
+
+		if(scap_bpf_update_elem(bpf->m_syscalls_map, &j, &val) != 0)
+		{
+			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error updating the system call map: %s", strerror(errno));
+			return SCAP_FAILURE;
+		}
+	}
+
+	return SCAP_SUCCESS;
+}
+
+static uint64_t scap_bpf_clock_ns(clockid_t clk)
+{
+	struct timespec ts;
+
+	clock_gettime(clk, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//
+// Open the perf buffer of a CPU and map it. The CPUs that are offline
+// don't have one, and their device stays empty.
+//
+static int32_t scap_bpf_open_buffer(scap_t* handle, uint32_t cpu, uint32_t size)
+{
+	struct scap_bpf* bpf = handle->m_bpf;
+	scap_device* dev = &handle->m_devs[cpu];
+	struct perf_event_attr attr;
+	char* base;
+
+	dev->m_fd = -1;
+	dev->m_perf_page = NULL;
+	dev->m_bufinfo = &bpf->m_bufinfos[cpu];
+	dev->m_head = &dev->m_bufinfo->head;
+	dev->m_tail = &dev->m_bufinfo->tail;
+	dev->m_stats = &dev->m_bufinfo->stats;
+	dev->m_buffer_size = size;
+	dev->m_lastreadsize = 0;
+	dev->m_sn_len = 0;
+
+	dev->m_decode_buf = (char*)malloc(size);
+	if(dev->m_decode_buf == NULL)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error allocating the buffer of CPU %u", cpu);
+		return SCAP_FAILURE;
+	}
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_SOFTWARE;
+	attr.config = PERF_COUNT_SW_BPF_OUTPUT;
+	attr.sample_type = PERF_SAMPLE_RAW;
+	attr.sample_period = 1;
+	attr.watermark = 1;
+	attr.wakeup_watermark = MIN(MIN_USERSPACE_READ_SIZE, size / 2);
+
+	dev->m_fd = syscall(__NR_perf_event_open, &attr, -1, cpu, -1, PERF_FLAG_FD_CLOEXEC);
+	if(dev->m_fd < 0)
+	{
+		if(errno == ENODEV)
+		{
+			return SCAP_SUCCESS;
+		}
+
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error opening the perf buffer of CPU %u: %s", cpu, strerror(errno));
+		return SCAP_FAILURE;
+	}
+
+	base = (char*)mmap(NULL, bpf->m_page_size + size, PROT_READ | PROT_WRITE, MAP_SHARED, dev->m_fd, 0);
+	if(base == MAP_FAILED)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error mapping the perf buffer of CPU %u: %s", cpu, strerror(errno));
+		return SCAP_FAILURE;
+	}
+
+	dev->m_perf_page = base;
+	dev->m_buffer = base + bpf->m_page_size;
+
+	//
+	// The checks for new data compare head and tail, so they look at the
+	// low halves of the counters of perf
+	//
+	dev->m_head = (volatile uint32_t*)&((struct perf_event_mmap_page*)base)->data_head;
+	dev->m_tail = (volatile uint32_t*)&((struct perf_event_mmap_page*)base)->data_tail;
+
+	if(scap_bpf_update_elem(bpf->m_events_map, &cpu, &dev->m_fd) != 0 ||
+		ioctl(dev->m_fd, PERF_EVENT_IOC_ENABLE, 0) != 0)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error enabling the perf buffer of CPU %u: %s", cpu, strerror(errno));
+		return SCAP_FAILURE;
+	}
+
+	return SCAP_SUCCESS;
+}
+
+int32_t scap_bpf_open(scap_t* handle, uint32_t ring_buf_size)
+{
+	struct scap_bpf* bpf;
+	uint32_t size = (ring_buf_size != 0)? ring_buf_size : DEFAULT_RING_BUF_SIZE;
+	uint32_t capturing = 1;
+	uint32_t j;
+
+	if((size & (size - 1)) != 0)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "invalid ring buffer size %u. The eBPF engine needs a power of 2", size);
+		return SCAP_FAILURE;
+	}
+
+	bpf = (struct scap_bpf*)calloc(1, sizeof(struct scap_bpf));
+	if(bpf == NULL)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error allocating the eBPF engine");
+		return SCAP_FAILURE;
+	}
+
+	handle->m_bpf = bpf;
+	bpf->m_settings_map = -1;
+	bpf->m_syscalls_map = -1;
+	bpf->m_tids_map = -1;
+	bpf->m_events_map = -1;
+	bpf->m_enter_prog = -1;
+	bpf->m_exit_prog = -1;
+	bpf->m_enter_link = -1;
+	bpf->m_exit_link = -1;
+	bpf->m_page_size = sysconf(_SC_PAGESIZE);
+	bpf->m_boot_ts = scap_bpf_clock_ns(CLOCK_REALTIME) - scap_bpf_clock_ns(CLOCK_MONOTONIC);
+
+	//
+	// Everything is captured until told otherwise, like with the driver
+	//
+	memset(&bpf->m_event_mask, 0xff, sizeof(bpf->m_event_mask));
+
+	bpf->m_bufinfos = (struct ppm_ring_buffer_info*)calloc(handle->m_ndevs, sizeof(struct ppm_ring_buffer_info));
+	if(bpf->m_bufinfos == NULL)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error allocating the eBPF engine");
+		return SCAP_FAILURE;
+	}
+
+	bpf->m_settings_map = scap_bpf_create_map(BPF_MAP_TYPE_ARRAY, sizeof(uint32_t), sizeof(uint32_t), 1);
+	bpf->m_syscalls_map = scap_bpf_create_map(BPF_MAP_TYPE_ARRAY, sizeof(uint32_t), sizeof(uint32_t), SYSCALL_TABLE_SIZE);
+	bpf->m_tids_map = scap_bpf_create_map(BPF_MAP_TYPE_HASH, sizeof(uint32_t), sizeof(uint8_t), PPM_MAX_EXCLUDED_TIDS);
+	bpf->m_events_map = scap_bpf_create_map(BPF_MAP_TYPE_PERF_EVENT_ARRAY, sizeof(uint32_t), sizeof(uint32_t), handle->m_ndevs);
+
+	if(bpf->m_settings_map < 0 || bpf->m_syscalls_map < 0 || bpf->m_tids_map < 0 || bpf->m_events_map < 0)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error creating the eBPF maps: %s. Make sure you have root credentials.", strerror(errno));
+		return SCAP_FAILURE;
+	}
+
+	j = 0;
+	if(scap_bpf_update_elem(bpf->m_settings_map, &j, &capturing) != 0)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error starting the capture: %s", strerror(errno));
+		return SCAP_FAILURE;
+	}
+
+	if(scap_bpf_update_syscalls(handle) != SCAP_SUCCESS)
+	{
+		return SCAP_FAILURE;
+	}
+
+	for(j = 0; j < handle->m_ndevs; j++)
+	{
+		handle->m_pollfds[j].fd = -1;
+		handle->m_pollfds[j].events = POLLIN;
+
+		if(scap_bpf_open_buffer(handle, j, size) != SCAP_SUCCESS)
+		{
+			return SCAP_FAILURE;
+		}
+
+		handle->m_pollfds[j].fd = handle->m_devs[j].m_fd;
+	}
+
+	return scap_bpf_attach(handle);
+}
+
+void scap_bpf_close(scap_t* handle)
+{
+	struct scap_bpf* bpf = handle->m_bpf;
+	uint32_t j;
+
+	scap_bpf_detach(bpf);
+
+	for(j = 0; j < handle->m_ndevs; j++)
+	{
+		scap_device* dev = &handle->m_devs[j];
+
+		if(dev->m_perf_page != NULL)
+		{
+			munmap(dev->m_perf_page, bpf->m_page_size + dev->m_buffer_size);
+			dev->m_perf_page = NULL;
+		}
+
+		if(dev->m_bufinfo == &bpf->m_bufinfos[j] && dev->m_fd >= 0)
+		{
+			close(dev->m_fd);
+		}
+
+		//
+		// Nothing left for scap_close() to unmap
+		//
+		dev->m_buffer = (char*)MAP_FAILED;
+		dev->m_bufinfo = (struct ppm_ring_buffer_info*)MAP_FAILED;
+	}
+
+	if(bpf->m_settings_map >= 0)
+	{
+		close(bpf->m_settings_map);
+	}
+
+	if(bpf->m_syscalls_map >= 0)
+	{
+		close(bpf->m_syscalls_map);
+	}
+
+	if(bpf->m_tids_map >= 0)
+	{
+		close(bpf->m_tids_map);
+	}
+
+	if(bpf->m_events_map >= 0)
+	{
+		close(bpf->m_events_map);
+	}
+
+	free(bpf->m_bufinfos);
+	free(bpf);
+	handle->m_bpf = NULL;
+}
+
+//
+// Copy size bytes from the position pos of the perf buffer, which wraps
+//
+static void scap_bpf_copy(scap_device* dev, uint64_t pos, char* dst, uint32_t size)
+{
+	uint32_t off = pos & (dev->m_buffer_size - 1);
+	uint32_t first = MIN(size, dev->m_buffer_size - off);
+
+	memcpy(dst, dev->m_buffer + off, first);
+	memcpy(dst + first, dev->m_buffer, size - first);
+}
+
+//
+// Copy the events of the perf buffer of a CPU, without the records of perf
+// around them, to the buffer of its device. Like with the driver, the part
+// of the perf buffer they came from is released at the next call.
+//
+int32_t scap_bpf_readbuf(scap_t* handle, uint32_t cpuid, OUT char** buf, OUT uint32_t* len)
+{
+	scap_device* dev = &handle->m_devs[cpuid];
+	struct perf_event_mmap_page* page = (struct perf_event_mmap_page*)dev->m_perf_page;
+	char* dst = dev->m_decode_buf;
+	char* dst_end = dev->m_decode_buf + dev->m_buffer_size;
+	uint64_t head;
+	uint64_t tail;
+	uint64_t pos;
+
+	*buf = dev->m_decode_buf;
+	*len = 0;
+
+	if(page == NULL)
+	{
+		return SCAP_SUCCESS;
+	}
+
+	tail = page->data_tail + dev->m_lastreadsize;
+	__sync_synchronize();
+	page->data_tail = tail;
+
+	head = page->data_head;
+	__sync_synchronize();
+
+	for(pos = tail; pos < head;)
+	{
+		struct perf_event_header ph;
+
+		scap_bpf_copy(dev, pos, (char*)&ph, sizeof(ph));
+
+		if(ph.size < sizeof(ph) || ph.size > head - pos)
+		{
+			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "perf buffer corruption on CPU %u", cpuid);
+			ASSERT(false);
+			return SCAP_FAILURE;
+		}
+
+		if(ph.type == PERF_RECORD_SAMPLE)
+		{
+			struct ppm_evt_hdr* evt = (struct ppm_evt_hdr*)dst;
+			uint32_t raw_size;
+
+			scap_bpf_copy(dev, pos + sizeof(ph), (char*)&raw_size, sizeof(raw_size));
+
+			if(raw_size < sizeof(struct ppm_evt_hdr) || raw_size > ph.size - sizeof(ph) - sizeof(raw_size))
+			{
+				snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "perf buffer corruption on CPU %u", cpuid);
+				ASSERT(false);
+				return SCAP_FAILURE;
+			}
+
+			//
+			// The rest is returned by the next call
+			//
+			if(raw_size > (uint32_t)(dst_end - dst))
+			{
+				break;
+			}
+
+			//
+			// Only the event, perf pads the record to 8 bytes
+			//
+			scap_bpf_copy(dev, pos + sizeof(ph) + sizeof(raw_size), dst, sizeof(struct ppm_evt_hdr));
+			if(evt->len > raw_size)
+			{
+				snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "perf buffer corruption on CPU %u", cpuid);
+				ASSERT(false);
+				return SCAP_FAILURE;
+			}
+
+			scap_bpf_copy(dev, pos + sizeof(ph) + sizeof(raw_size), dst, evt->len);
+			evt->ts += handle->m_bpf->m_boot_ts;
+			dst += evt->len;
+			dev->m_stats->n_evts++;
+		}
+		else if(ph.type == PERF_RECORD_LOST)
+		{
+			uint64_t lost[2]; // id, lost
+
+			scap_bpf_copy(dev, pos + sizeof(ph), (char*)lost, sizeof(lost));
+			dev->m_stats->n_evts += lost[1];
+			dev->m_stats->n_drops_buffer += lost[1];
+		}
+
+		pos += ph.size;
+	}
+
+	dev->m_lastreadsize = (uint32_t)(pos - tail);
+	*len = (uint32_t)(dst - dev->m_decode_buf);
+
+	return SCAP_SUCCESS;
+}
+
+int32_t scap_bpf_set_capture(scap_t* handle, bool enable)
+{
+	uint32_t key = 0;
+	uint32_t capturing = enable;
+
+	if(scap_bpf_update_elem(handle->m_bpf->m_settings_map, &key, &capturing) != 0)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error %s the capture: %s", enable? "starting" : "stopping", strerror(errno));
+		return SCAP_FAILURE;
+	}
+
+	return SCAP_SUCCESS;
+}
+
+int32_t scap_bpf_set_event_mask(scap_t* handle, struct ppm_evt_mask* mask)
+{
+	handle->m_bpf->m_event_mask = *mask;
+	return scap_bpf_update_syscalls(handle);
+}
+
+int32_t scap_bpf_set_excluded_tids(scap_t* handle, uint64_t* tids, uint32_t ntids)
+{
+	struct scap_bpf* bpf = handle->m_bpf;
+	uint8_t one = 1;
+	uint32_t tid;
+	uint32_t j;
+
+	for(j = 0; j < bpf->m_ntids; j++)
+	{
+		tid = (uint32_t)bpf->m_tids[j];
+		scap_bpf_delete_elem(bpf->m_tids_map, &tid);
+	}
+
+	bpf->m_ntids = 0;
+
+	for(j = 0; j < ntids; j++)
+	{
+		tid = (uint32_t)tids[j];
+
+		if(scap_bpf_update_elem(bpf->m_tids_map, &tid, &one) != 0)
+		{
+			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error excluding thread %u: %s", tid, strerror(errno));
+			return SCAP_FAILURE;
+		}
+
+		bpf->m_tids[bpf->m_ntids++] = tids[j];
+	}
+
+	return SCAP_SUCCESS;
+}
+
+int32_t scap_bpf_set_predicate(scap_t* handle, struct ppm_predicate* pred)
+{
+	struct scap_bpf* bpf = handle->m_bpf;
+	uint32_t j;
+
+	for(j = 0; j < pred->n_clauses; j++)
+	{
+		if(pred->clauses[j].field > PPM_PRED_FIELD_RES || pred->clauses[j].cmp > PPM_PRED_CMP_GE)
+		{
+			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "invalid predicate clause %u", j);
+			return SCAP_FAILURE;
+		}
+	}
+
+	bpf->m_predicate = *pred;
+
+	if(scap_bpf_update_syscalls(handle) != SCAP_SUCCESS)
+	{
+		return SCAP_FAILURE;
+	}
+
+	return scap_bpf_attach(handle);
+}
+
+#else // !defined(_WIN32) && !defined(__APPLE__) && defined(__x86_64__)
+
+int32_t scap_bpf_open(scap_t* handle, uint32_t ring_buf_size)
+{
+	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "the eBPF engine is only supported on linux x86_64");
+	return SCAP_FAILURE;
+}
+
+void scap_bpf_close(scap_t* handle)
+{
+}
+
+int32_t scap_bpf_readbuf(scap_t* handle, uint32_t cpuid, OUT char** buf, OUT uint32_t* len)
+{
+	*len = 0;
+	return SCAP_SUCCESS;
+}
+
+int32_t scap_bpf_set_capture(scap_t* handle, bool enable)
+{
+	return SCAP_FAILURE;
+}
+
+int32_t scap_bpf_set_event_mask(scap_t* handle, struct ppm_evt_mask* mask)
+{
+	return SCAP_FAILURE;
+}
+
+int32_t scap_bpf_set_excluded_tids(scap_t* handle, uint64_t* tids, uint32_t ntids)
+{
+	return SCAP_FAILURE;
+}
+
+int32_t scap_bpf_set_predicate(scap_t* handle, struct ppm_predicate* pred)
+{
+	return SCAP_FAILURE;
+}
+
+#endif // !defined(_WIN32) && !defined(__APPLE__) && defined(__x86_64__)
@@ -0,0 +1,1203 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "scap.h"
+#include "scap-int.h"
+#include "scap_savefile.h"
+
+//
+// Concatenation, splitting and time slicing of trace files. The events are
+// moved in the groups the dumper wrote them in: a group that the index of
+// the input says is entirely in the time range is copied as it is, frames
+// included, and only the groups at the edges of the range are read block
+// by block. The output gets new headers, index and snapshot headers, with
+// the offsets and the event numbers of its own.
+//
+
+//
+// A metadata block of the header of an input file
+//
+typedef struct scap_cut_block
+{
+	uint32_t m_type;
+	uint32_t m_len;
+	uint64_t m_offset;
+}scap_cut_block;
+
+//
+// The file being added
+//
+typedef struct scap_cut_input
+{
+	const char* m_fname;
+	FILE* m_f;
+	uint32_t m_shb_len;
+	scap_cut_block* m_blocks; // The blocks between the section header and the events
+	uint32_t m_nblocks;
+	uint64_t m_evts_offset; // Where the events start
+	uint64_t m_evts_end; // Where the events end, at the index or at the end of the file
+	index_entry* m_index;
+	scap_block_summary* m_summaries; // NULL if the index doesn't have them
+	uint64_t m_index_len;
+	uint64_t m_snapshot; // The snapshot with the tables valid at the current position, 0 for the header
+	bool m_started; // Some of its events were written
+}scap_cut_input;
+
+//
+// A snapshot of the input copied to the current output file
+//
+typedef struct scap_cut_snapshot
+{
+	uint64_t m_in_offset;
+	uint64_t m_out_offset;
+}scap_cut_snapshot;
+
+struct scap_cutter
+{
+	char m_fname[SCAP_MAX_PATH_SIZE];
+	char m_cur_fname[SCAP_MAX_PATH_SIZE + 16];
+	uint64_t m_max_bytes;
+	uint64_t m_max_duration;
+	uint32_t m_seq; // Number of the next output file
+	FILE* m_f;
+	uint64_t m_pos; // Bytes written to the current file
+	uint64_t m_nevts; // Events written to the current file
+	uint64_t m_first_ts; // Timestamp of the first event of the current file
+	uint64_t m_last_ts; // Timestamp of the last event written, or an upper bound of it
+	bool m_pending_tables; // The tables of the current input must be written before its events
+	uint64_t m_base_snapshot; // Where the tables of the current input are, 0 for the header
+	scap_cut_snapshot* m_snapshots; // Snapshots of the current input copied to the current file
+	uint32_t m_nsnapshots;
+	uint32_t m_snapshots_size;
+	index_entry* m_index;
+	scap_block_summary* m_summaries;
+	uint64_t m_index_len;
+	uint64_t m_index_size;
+	bool m_has_summaries; // All the groups of the current file have a summary
+	uint64_t m_entry_pos; // Offset of the last index entry, UINT64_MAX to start a new one at the next block
+	char* m_copy; // Buffer of the verbatim copies
+	uint32_t m_copysize;
+	char* m_buf; // The block being decoded
+	uint32_t m_bufsize;
+	char* m_frame;
+	uint32_t m_framesize;
+	scap_cut_stats m_stats;
+};
+
+//
+// The blocks with the thread and fd tables, that a snapshot replaces
+//
+static bool scap_cut_is_table(uint32_t type)
+{
+	switch(type)
+	{
+	case PL_BLOCK_TYPE:
+	case PL_BLOCK_TYPE_INT:
+	case FDL_BLOCK_TYPE:
+	case FDL_BLOCK_TYPE_INT:
+	case FDLC_BLOCK_TYPE:
+	case CG_BLOCK_TYPE:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static int32_t scap_cut_reserve(char **buf, uint32_t *bufsize, uint32_t size, char *error)
+{
+	char* p;
+
+	if(size <= *bufsize)
+	{
+		return SCAP_SUCCESS;
+	}
+
+	p = (char *)realloc(*buf, size);
+	if(p == NULL)
+	{
+		snprintf(error, SCAP_LASTERR_SIZE, "error allocating a %u bytes buffer", size);
+		return SCAP_FAILURE;
+	}
+
+	*buf = p;
+	*bufsize = size;
+	return SCAP_SUCCESS;
+}
+
+static int32_t scap_cut_read_at(scap_cut_input* in, uint64_t offset, void* buf, uint32_t len, char *error)
+{
+	if(fseek(in->m_f, (long)offset, SEEK_SET) != 0 ||
+		fread(buf, 1, len, in->m_f) != len)
+	{
+		snprintf(error, SCAP_LASTERR_SIZE, "error reading file %s at offset %" PRIu64, in->m_fname, offset);
+		return SCAP_FAILURE;
+	}
+
+	return SCAP_SUCCESS;
+}
+
+//
+// Read a whole block of the input into m_buf
+//
+static int32_t scap_cut_read_block(scap_cutter_t* c, scap_cut_input* in, uint64_t offset, const block_header* bh, char *error)
+{
+	uint32_t bt;
+
+	if(scap_cut_reserve(&c->m_buf, &c->m_bufsize, bh->block_total_length, error) != SCAP_SUCCESS ||
+		scap_cut_read_at(in, offset, c->m_buf, bh->block_total_length, error) != SCAP_SUCCESS)
+	{
+		return SCAP_FAILURE;
+	}
+
+	memcpy(&bt, c->m_buf + bh->block_total_length - sizeof(bt), sizeof(bt));
+	if(bt != bh->block_total_length)
+	{
+		snprintf(error, SCAP_LASTERR_SIZE, "wrong block total length in %s, header=%u, trailer=%u",
+			in->m_fname,
+			bh->block_total_length,
+			bt);
+		return SCAP_FAILURE;
+	}
+
+	return SCAP_SUCCESS;
+}
+
+//
+// Find the metadata blocks and the start of the events
+//
+static int32_t scap_cut_read_header(scap_cut_input* in, char *error)
+{
+	block_header bh;
+	section_header_block sh;
+	uint64_t offset;
+	scap_cut_block* blocks;
+
+	if(fread(&bh, sizeof(bh), 1, in->m_f) != 1 ||
+		fread(&sh, sizeof(sh), 1, in->m_f) != 1 ||
+		bh.block_type != SHB_BLOCK_TYPE ||
+		sh.byte_order_magic != SHB_MAGIC ||
+		bh.block_total_length < sizeof(bh) + sizeof(sh) + 4)
+	{
+		snprintf(error, SCAP_LASTERR_SIZE, "%s is not a trace file", in->m_fname);
+		return SCAP_FAILURE;
+	}
+
+	in->m_shb_len = bh.block_total_length;
+	offset = bh.block_total_length;
+
+	while(true)
+	{
+		if(fseek(in->m_f, (long)offset, SEEK_SET) != 0)
+		{
+			snprintf(error, SCAP_LASTERR_SIZE, "error seeking in file %s", in->m_fname);
+			return SCAP_FAILURE;
+		}
+
+		if(fread(&bh, sizeof(bh), 1, in->m_f) != 1)
+		{
+			//
+			// A file without events
+			//
+			break;
+		}
+
+		if(bh.block_type == EV_BLOCK_TYPE || bh.block_type == EV_BLOCK_TYPE_INT ||
+			bh.block_type == EVF_BLOCK_TYPE || bh.block_type == SS_BLOCK_TYPE ||
+			bh.block_type == IX_BLOCK_TYPE)
+		{
+			break;
+		}
+
+		if(bh.block_total_length < sizeof(bh) + 4)
+		{
+			snprintf(error, SCAP_LASTERR_SIZE, "invalid length %u of block type %x in %s",
+				bh.block_total_length,
+				bh.block_type,
+				in->m_fname);
+			return SCAP_FAILURE;
+		}
+
+		blocks = (scap_cut_block *)realloc(in->m_blocks, (in->m_nblocks + 1) * sizeof(scap_cut_block));
+		if(blocks == NULL)
+		{
+			snprintf(error, SCAP_LASTERR_SIZE, "error allocating the header of %s", in->m_fname);
+			return SCAP_FAILURE;
+		}
+
+		in->m_blocks = blocks;
+		in->m_blocks[in->m_nblocks].m_type = bh.block_type;
+		in->m_blocks[in->m_nblocks].m_len = bh.block_total_length;
+		in->m_blocks[in->m_nblocks].m_offset = offset;
+		in->m_nblocks++;
+
+		offset += bh.block_total_length;
+	}
+
+	in->m_evts_offset = offset;
+	return SCAP_SUCCESS;
+}
+
+//
+// Load the index at the end of the file, like scap_load_index() does. A
+// file without one has its events up to its end.
+//
+static int32_t scap_cut_read_index(scap_cut_input* in, char *error)
+{
+	FILE *f = in->m_f;
+	block_header bh;
+	index_header ih;
+	uint32_t bt;
+	long start;
+	long size;
+
+	if(fseek(f, 0, SEEK_END) != 0 || (size = ftell(f)) < 0)
+	{
+		snprintf(error, SCAP_LASTERR_SIZE, "error seeking in file %s", in->m_fname);
+		return SCAP_FAILURE;
+	}
+
+	in->m_evts_end = size;
+
+	if(fseek(f, (long)0 - sizeof(bt), SEEK_END) == 0 &&
+		fread(&bt, sizeof(bt), 1, f) == 1 &&
+		bt >= sizeof(block_header) + sizeof(index_header) + 4 &&
+		fseek(f, (long)0 - bt, SEEK_END) == 0 &&
+		(start = ftell(f)) >= 0 &&
+		(uint64_t)start >= in->m_evts_offset &&
+		fread(&bh, sizeof(bh), 1, f) == 1 &&
+		bh.block_type == IX_BLOCK_TYPE &&
+		bh.block_total_length == bt &&
+		fread(&ih, sizeof(ih), 1, f) == 1 &&
+		ih.entry_size == sizeof(index_entry) &&
+		(ih.summary_size == 0 || ih.summary_size == sizeof(scap_block_summary)) &&
+		ih.nentries != 0 &&
+		ih.nentries == (bt - sizeof(block_header) - sizeof(index_header) - 4) / (sizeof(index_entry) + ih.summary_size))
+	{
+		in->m_index = (index_entry *)malloc(ih.nentries * sizeof(index_entry));
+		if(ih.summary_size != 0)
+		{
+			in->m_summaries = (scap_block_summary *)malloc(ih.nentries * sizeof(scap_block_summary));
+		}
+
+		if(in->m_index == NULL || (ih.summary_size != 0 && in->m_summaries == NULL))
+		{
+			snprintf(error, SCAP_LASTERR_SIZE, "error allocating the index of %s", in->m_fname);
+			return SCAP_FAILURE;
+		}
+
+		if(fread(in->m_index, sizeof(index_entry), ih.nentries, f) != ih.nentries ||
+			(in->m_summaries != NULL && fread(in->m_summaries, sizeof(scap_block_summary), ih.nentries, f) != ih.nentries))
+		{
+			snprintf(error, SCAP_LASTERR_SIZE, "error reading the index of %s", in->m_fname);
+			return SCAP_FAILURE;
+		}
+
+		in->m_index_len = ih.nentries;
+		in->m_evts_end = start;
+	}
+
+	return SCAP_SUCCESS;
+}
+
+//
+// Report an error about the output file. A long file name is cut short, so
+// that the message fits in the error buffer
+//
+static int32_t scap_cut_file_error(scap_cutter_t* c, const char* what, char* error)
+{
+	if(snprintf(error, SCAP_LASTERR_SIZE, "%s %s", what, c->m_cur_fname) >= SCAP_LASTERR_SIZE)
+	{
+		strcpy(error + SCAP_LASTERR_SIZE - 4, "...");
+	}
+
+	return SCAP_FAILURE;
+}
+
+static int32_t scap_cut_write(scap_cutter_t* c, const void* buf, uint64_t len, char *error)
+{
+	if(fwrite(buf, 1, len, c->m_f) != len)
+	{
+		return scap_cut_file_error(c, "error writing to file", error);
+	}
+
+	c->m_pos += len;
+	return SCAP_SUCCESS;
+}
+
+//
+// Copy len bytes of the input, from offset, to the output
+//
+static int32_t scap_cut_copy(scap_cutter_t* c, scap_cut_input* in, uint64_t offset, uint64_t len, char *error)
+{
+	uint32_t chunk;
+
+	if(scap_cut_reserve(&c->m_copy, &c->m_copysize, SCAP_CUT_COPY_BUF_SIZE, error) != SCAP_SUCCESS)
+	{
+		return SCAP_FAILURE;
+	}
+
+	if(fseek(in->m_f, (long)offset, SEEK_SET) != 0)
+	{
+		snprintf(error, SCAP_LASTERR_SIZE, "error seeking in file %s", in->m_fname);
+		return SCAP_FAILURE;
+	}
+
+	while(len != 0)
+	{
+		chunk = (len < c->m_copysize)? (uint32_t)len : c->m_copysize;
+
+		if(fread(c->m_copy, 1, chunk, in->m_f) != chunk)
+		{
+			snprintf(error, SCAP_LASTERR_SIZE, "error reading file %s", in->m_fname);
+			return SCAP_FAILURE;
+		}
+
+		if(scap_cut_write(c, c->m_copy, chunk, error) != SCAP_SUCCESS)
+		{
+			return SCAP_FAILURE;
+		}
+
+		len -= chunk;
+	}
+
+	return SCAP_SUCCESS;
+}
+
+//
+// Where the tables of the current position of the input are: the blocks
+// inside its current snapshot, or the table blocks of its header
+//
+static int32_t scap_cut_tables_len(scap_cut_input* in, OUT uint64_t* len, char *error)
+{
+	block_header bh;
+	uint32_t j;
+
+	if(in->m_snapshot != 0)
+	{
+		if(scap_cut_read_at(in, in->m_snapshot, &bh, sizeof(bh), error) != SCAP_SUCCESS)
+		{
+			return SCAP_FAILURE;
+		}
+
+		if(bh.block_type != SS_BLOCK_TYPE ||
+			bh.block_total_length < sizeof(block_header) + sizeof(snapshot_header) + 4)
+		{
+			snprintf(error, SCAP_LASTERR_SIZE, "corrupted index in %s, no snapshot at offset %" PRIu64,
+				in->m_fname,
+				in->m_snapshot);
+			return SCAP_FAILURE;
+		}
+
+		*len = bh.block_total_length - sizeof(block_header) - sizeof(snapshot_header) - 4;
+		return SCAP_SUCCESS;
+	}
+
+	*len = 0;
+
+	for(j = 0; j < in->m_nblocks; j++)
+	{
+		if(scap_cut_is_table(in->m_blocks[j].m_type))
+		{
+			*len += in->m_blocks[j].m_len;
+		}
+	}
+
+	return SCAP_SUCCESS;
+}
+
+static int32_t scap_cut_write_tables(scap_cutter_t* c, scap_cut_input* in, uint64_t len, char *error)
+{
+	uint32_t j;
+
+	if(in->m_snapshot != 0)
+	{
+		return scap_cut_copy(c, in, in->m_snapshot + sizeof(block_header) + sizeof(snapshot_header), len, error);
+	}
+
+	for(j = 0; j < in->m_nblocks; j++)
+	{
+		if(scap_cut_is_table(in->m_blocks[j].m_type) &&
+			scap_cut_copy(c, in, in->m_blocks[j].m_offset, in->m_blocks[j].m_len, error) != SCAP_SUCCESS)
+		{
+			return SCAP_FAILURE;
+		}
+	}
+
+	return SCAP_SUCCESS;
+}
+
+//
+// Start a new output file, with the header of the input and the tables of
+// its current position
+//
+static int32_t scap_cut_open_file(scap_cutter_t* c, scap_cut_input* in, char *error)
+{
+	uint64_t len;
+	uint32_t j;
+
+	if(c->m_max_bytes != 0 || c->m_max_duration != 0)
+	{
+		snprintf(c->m_cur_fname, sizeof(c->m_cur_fname), "%s%u", c->m_fname, c->m_seq);
+	}
+	else
+	{
+		snprintf(c->m_cur_fname, sizeof(c->m_cur_fname), "%s", c->m_fname);
+	}
+
+	c->m_f = fopen(c->m_cur_fname, "wb");
+	if(c->m_f == NULL)
+	{
+		return scap_cut_file_error(c, "can't open file", error);
+	}
+
+	c->m_seq++;
+	c->m_stats.n_files++;
+	c->m_pos = 0;
+	c->m_nevts = 0;
+	c->m_pending_tables = false;
+	c->m_base_snapshot = 0;
+	c->m_nsnapshots = 0;
+	c->m_index_len = 0;
+	c->m_has_summaries = true;
+	c->m_entry_pos = UINT64_MAX;
+
+	if(scap_cut_copy(c, in, 0, in->m_shb_len, error) != SCAP_SUCCESS)
+	{
+		return SCAP_FAILURE;
+	}
+
+	for(j = 0; j < in->m_nblocks; j++)
+	{
+		if(!scap_cut_is_table(in->m_blocks[j].m_type) &&
+			scap_cut_copy(c, in, in->m_blocks[j].m_offset, in->m_blocks[j].m_len, error) != SCAP_SUCCESS)
+		{
+			return SCAP_FAILURE;
+		}
+	}
+
+	if(scap_cut_tables_len(in, &len, error) != SCAP_SUCCESS ||
+		scap_cut_write_tables(c, in, len, error) != SCAP_SUCCESS)
+	{
+		return SCAP_FAILURE;
+	}
+
+	return SCAP_SUCCESS;
+}
+
+//
+// Append the index and close the current output file
+//
+static int32_t scap_cut_close_file(scap_cutter_t* c, char *error)
+{
+	block_header bh;
+	index_header ih;
+	uint32_t summary_size = c->m_has_summaries? sizeof(scap_block_summary) : 0;
+	uint64_t len = sizeof(block_header) + sizeof(index_header) + c->m_index_len * (sizeof(index_entry) + summary_size) + 4;
+	uint32_t bt;
+	int32_t res = SCAP_SUCCESS;
+
+	if(c->m_index_len != 0 && len <= 0xffffffff)
+	{
+		bh.block_type = IX_BLOCK_TYPE;
+		bh.block_total_length = (uint32_t)len;
+		bt = bh.block_total_length;
+
+		ih.entry_size = sizeof(index_entry);
+		ih.summary_size = summary_size;
+		ih.nentries = c->m_index_len;
+
+		if(scap_cut_write(c, &bh, sizeof(bh), error) != SCAP_SUCCESS ||
+			scap_cut_write(c, &ih, sizeof(ih), error) != SCAP_SUCCESS ||
+			scap_cut_write(c, c->m_index, c->m_index_len * sizeof(index_entry), error) != SCAP_SUCCESS ||
+			(summary_size != 0 &&
+			scap_cut_write(c, c->m_summaries, c->m_index_len * sizeof(scap_block_summary), error) != SCAP_SUCCESS) ||
+			scap_cut_write(c, &bt, sizeof(bt), error) != SCAP_SUCCESS)
+		{
+			res = SCAP_FAILURE;
+		}
+	}
+
+	if(fclose(c->m_f) != 0 && res == SCAP_SUCCESS)
+	{
+		res = scap_cut_file_error(c, "error writing to file", error);
+	}
+
+	c->m_f = NULL;
+	c->m_stats.n_evts += c->m_nevts;
+	c->m_nevts = 0;
+	return res;
+}
+
+//
+// The position in the current output file of a snapshot of the input. The
+// ones that weren't copied are the ones the tables of the file, or of the
+// input, were taken from.
+//
+static uint64_t scap_cut_map_snapshot(scap_cutter_t* c, uint64_t offset)
+{
+	uint32_t j;
+
+	for(j = 0; j < c->m_nsnapshots; j++)
+	{
+		if(c->m_snapshots[j].m_in_offset == offset)
+		{
+			return c->m_snapshots[j].m_out_offset;
+		}
+	}
+
+	return c->m_base_snapshot;
+}
+
+static int32_t scap_cut_add_snapshot(scap_cutter_t* c, uint64_t in_offset, uint64_t out_offset, char *error)
+{
+	if(c->m_nsnapshots == c->m_snapshots_size)
+	{
+		uint32_t size = (c->m_snapshots_size != 0)? c->m_snapshots_size * 2 : 64;
+		scap_cut_snapshot* snapshots = (scap_cut_snapshot *)realloc(c->m_snapshots, size * sizeof(scap_cut_snapshot));
+
+		if(snapshots == NULL)
+		{
+			snprintf(error, SCAP_LASTERR_SIZE, "error allocating the snapshot list");
+			return SCAP_FAILURE;
+		}
+
+		c->m_snapshots = snapshots;
+		c->m_snapshots_size = size;
+	}
+
+	c->m_snapshots[c->m_nsnapshots].m_in_offset = in_offset;
+	c->m_snapshots[c->m_nsnapshots].m_out_offset = out_offset;
+	c->m_nsnapshots++;
+	return SCAP_SUCCESS;
+}
+
+//
+// Write the tables of an input that isn't the first of the file as a
+// snapshot, valid for its events
+//
+static int32_t scap_cut_write_input_tables(scap_cutter_t* c, scap_cut_input* in, char *error)
+{
+	block_header bh;
+	snapshot_header sh;
+	uint64_t len;
+	uint64_t offset = c->m_pos;
+	uint32_t bt;
+
+	if(scap_cut_tables_len(in, &len, error) != SCAP_SUCCESS)
+	{
+		return SCAP_FAILURE;
+	}
+
+	len += sizeof(block_header) + sizeof(snapshot_header) + 4;
+	if(len > 0xffffffff)
+	{
+		snprintf(error, SCAP_LASTERR_SIZE, "the tables of %s are too big for a snapshot", in->m_fname);
+		return SCAP_FAILURE;
+	}
+
+	bh.block_type = SS_BLOCK_TYPE;
+	bh.block_total_length = (uint32_t)len;
+	bt = bh.block_total_length;
+
+	sh.ts = c->m_last_ts;
+	sh.evtnum = c->m_nevts;
+
+	if(scap_cut_write(c, &bh, sizeof(bh), error) != SCAP_SUCCESS ||
+		scap_cut_write(c, &sh, sizeof(sh), error) != SCAP_SUCCESS ||
+		scap_cut_write_tables(c, in, len - sizeof(block_header) - sizeof(snapshot_header) - 4, error) != SCAP_SUCCESS ||
+		scap_cut_write(c, &bt, sizeof(bt), error) != SCAP_SUCCESS)
+	{
+		return SCAP_FAILURE;
+	}
+
+	c->m_base_snapshot = offset;
+	return SCAP_SUCCESS;
+}
+
+static int32_t scap_cut_add_index_entry(scap_cutter_t* c, uint64_t ts, uint64_t snapshot_offset, const scap_block_summary* summary, char *error)
+{
+	index_entry* entry;
+
+	if(c->m_index_len == c->m_index_size)
+	{
+		uint64_t size = (c->m_index_size != 0)? c->m_index_size * 2 : 1024;
+		scap_block_summary* summaries;
+
+		entry = (index_entry *)realloc(c->m_index, size * sizeof(index_entry));
+		if(entry == NULL)
+		{
+			snprintf(error, SCAP_LASTERR_SIZE, "error allocating the index");
+			return SCAP_FAILURE;
+		}
+
+		c->m_index = entry;
+
+		summaries = (scap_block_summary *)realloc(c->m_summaries, size * sizeof(scap_block_summary));
+		if(summaries == NULL)
+		{
+			snprintf(error, SCAP_LASTERR_SIZE, "error allocating the index");
+			return SCAP_FAILURE;
+		}
+
+		c->m_summaries = summaries;
+		c->m_index_size = size;
+	}
+
+	entry = &c->m_index[c->m_index_len];
+	entry->offset = c->m_pos;
+	entry->ts = ts;
+	entry->evtnum = c->m_nevts;
+	entry->snapshot_offset = snapshot_offset;
+
+	//
+	// The summary of the group of the input is still valid for a part of it
+	//
+	if(summary != NULL)
+	{
+		memcpy(&c->m_summaries[c->m_index_len], summary, sizeof(*summary));
+	}
+	else
+	{
+		c->m_has_summaries = false;
+	}
+
+	c->m_index_len++;
+	c->m_entry_pos = c->m_pos;
+	return SCAP_SUCCESS;
+}
+
+//
+// Get the output ready for len bytes of event blocks, whose first event has
+// timestamp ts: switch file if it's full, write the tables of the input if
+// they're due, and start a new index entry if it's time to
+//
+static int32_t scap_cut_prepare(scap_cutter_t* c, scap_cut_input* in, uint64_t ts, uint64_t len, bool new_group,
+	const scap_block_summary* summary, char *error)
+{
+	if(c->m_f != NULL && c->m_nevts != 0 &&
+		((c->m_max_bytes != 0 && c->m_pos + len > c->m_max_bytes) ||
+		(c->m_max_duration != 0 && ts > c->m_first_ts && ts - c->m_first_ts >= c->m_max_duration)))
+	{
+		if(scap_cut_close_file(c, error) != SCAP_SUCCESS)
+		{
+			return SCAP_FAILURE;
+		}
+	}
+
+	if(c->m_f == NULL)
+	{
+		if(scap_cut_open_file(c, in, error) != SCAP_SUCCESS)
+		{
+			return SCAP_FAILURE;
+		}
+	}
+	else if(c->m_pending_tables)
+	{
+		if(scap_cut_write_input_tables(c, in, error) != SCAP_SUCCESS)
+		{
+			return SCAP_FAILURE;
+		}
+	}
+
+	c->m_pending_tables = false;
+
+	if(c->m_nevts == 0)
+	{
+		c->m_first_ts = ts;
+	}
+
+	if(new_group || c->m_entry_pos == UINT64_MAX || c->m_pos - c->m_entry_pos >= SCAP_DUMP_DEFAULT_BUFFER_SIZE)
+	{
+		return scap_cut_add_index_entry(c, ts, scap_cut_map_snapshot(c, in->m_snapshot), summary, error);
+	}
+
+	return SCAP_SUCCESS;
+}
+
+//
+// Copy a snapshot block of the input with the event number of the output
+//
+static int32_t scap_cut_copy_snapshot(scap_cutter_t* c, scap_cut_input* in, uint64_t offset, const block_header* bh, char *error)
+{
+	snapshot_header sh;
+	uint64_t out_offset = c->m_pos;
+
+	if(bh->block_total_length < sizeof(block_header) + sizeof(snapshot_header) + 4)
+	{
+		snprintf(error, SCAP_LASTERR_SIZE, "corrupted snapshot in %s at offset %" PRIu64, in->m_fname, offset);
+		return SCAP_FAILURE;
+	}
+
+	if(scap_cut_read_at(in, offset + sizeof(block_header), &sh, sizeof(sh), error) != SCAP_SUCCESS)
+	{
+		return SCAP_FAILURE;
+	}
+
+	sh.evtnum = c->m_nevts;
+
+	if(scap_cut_write(c, bh, sizeof(*bh), error) != SCAP_SUCCESS ||
+		scap_cut_write(c, &sh, sizeof(sh), error) != SCAP_SUCCESS ||
+		scap_cut_copy(c, in,
+			offset + sizeof(block_header) + sizeof(snapshot_header),
+			bh->block_total_length - sizeof(block_header) - sizeof(snapshot_header), error) != SCAP_SUCCESS)
+	{
+		return SCAP_FAILURE;
+	}
+
+	return scap_cut_add_snapshot(c, offset, out_offset, error);
+}
+
+//
+// Copy a whole group of the input, the one of index entry g, which isn't
+// the last one
+//
+static int32_t scap_cut_copy_group(scap_cutter_t* c, scap_cut_input* in, uint64_t g, char *error)
+{
+	index_entry* entry = &in->m_index[g];
+	index_entry* next = &in->m_index[g + 1];
+	const scap_block_summary* summary = (in->m_summaries != NULL)? &in->m_summaries[g] : NULL;
+	uint64_t len = next->offset - entry->offset;
+	uint64_t out_offset;
+	uint64_t out_evtnum;
+
+	if(scap_cut_prepare(c, in, entry->ts, len, true, summary, error) != SCAP_SUCCESS)
+	{
+		return SCAP_FAILURE;
+	}
+
+	out_offset = c->m_pos;
+	out_evtnum = c->m_nevts;
+
+	if(scap_cut_copy(c, in, entry->offset, len, error) != SCAP_SUCCESS)
+	{
+		return SCAP_FAILURE;
+	}
+
+	c->m_nevts += next->evtnum - entry->evtnum;
+	c->m_last_ts = (summary != NULL)? summary->ts_max : next->ts;
+	c->m_stats.n_bytes_copied += len;
+	in->m_started = true;
+
+	//
+	// A snapshot taken after the group is at its end, and its event number
+	// moves like the ones of the events
+	//
+	if(next->snapshot_offset >= entry->offset && next->snapshot_offset < next->offset)
+	{
+		snapshot_header sh;
+		uint64_t pos = out_offset + (next->snapshot_offset - entry->offset);
+
+		if(scap_cut_read_at(in, next->snapshot_offset + sizeof(block_header), &sh, sizeof(sh), error) != SCAP_SUCCESS)
+		{
+			return SCAP_FAILURE;
+		}
+
+		sh.evtnum = sh.evtnum - entry->evtnum + out_evtnum;
+
+		if(fseek(c->m_f, (long)(pos + sizeof(block_header)), SEEK_SET) != 0 ||
+			fwrite(&sh, sizeof(sh), 1, c->m_f) != 1 ||
+			fseek(c->m_f, 0, SEEK_END) != 0)
+		{
+			return scap_cut_file_error(c, "error writing to file", error);
+		}
+
+		if(scap_cut_add_snapshot(c, next->snapshot_offset, pos, error) != SCAP_SUCCESS)
+		{
+			return SCAP_FAILURE;
+		}
+	}
+
+	return SCAP_SUCCESS;
+}
+
+//
+// Write an event block if its event is in the range. The input is in
+// timestamp order when it has no index, and it can stop at the first event
+// after the range.
+//
+static int32_t scap_cut_evt_block(scap_cutter_t* c, scap_cut_input* in, const char* block, uint32_t len,
+	uint64_t start_ts, uint64_t end_ts, const scap_block_summary* summary, OUT bool* done, char *error)
+{
+	scap_evt* e = (scap_evt *)(block + sizeof(block_header) + sizeof(uint16_t));
+
+	if(e->ts < start_ts || e->ts >= end_ts)
+	{
+		if(e->ts >= end_ts && in->m_index_len == 0)
+		{
+			*done = true;
+		}
+
+		return SCAP_SUCCESS;
+	}
+
+	if(scap_cut_prepare(c, in, e->ts, len, false, summary, error) != SCAP_SUCCESS ||
+		scap_cut_write(c, block, len, error) != SCAP_SUCCESS)
+	{
+		return SCAP_FAILURE;
+	}
+
+	c->m_nevts++;
+	c->m_last_ts = e->ts;
+	in->m_started = true;
+	return SCAP_SUCCESS;
+}
+
+//
+// Write the events of a frame in the range. The frame is copied whole if
+// they all are, otherwise they're written uncompressed.
+//
+static int32_t scap_cut_frame(scap_cutter_t* c, scap_cut_input* in, const block_header* bh,
+	uint64_t start_ts, uint64_t end_ts, const scap_block_summary* summary, OUT bool* done, char *error)
+{
+	uint32_t len;
+	uint32_t pos;
+	uint32_t nevts = 0;
+	uint64_t first_ts = 0;
+	uint64_t last_ts = 0;
+	bool all_in = true;
+	block_header* ebh;
+	scap_evt* e;
+
+	if(bh->block_total_length < sizeof(block_header) + sizeof(event_frame_header) + 4)
+	{
+		snprintf(error, SCAP_LASTERR_SIZE, "corrupted frame in %s", in->m_fname);
+		return SCAP_FAILURE;
+	}
+
+	if(scap_uncompress_frame(bh, c->m_buf + sizeof(block_header), &c->m_frame, &c->m_framesize, &len, error) != SCAP_SUCCESS)
+	{
+		return SCAP_FAILURE;
+	}
+
+	for(pos = 0; pos < len; pos += ebh->block_total_length)
+	{
+		ebh = (block_header *)(c->m_frame + pos);
+
+		if(len - pos < sizeof(block_header) ||
+			ebh->block_type != EV_BLOCK_TYPE ||
+			ebh->block_total_length < sizeof(block_header) + sizeof(uint16_t) + sizeof(struct ppm_evt_hdr) + 4 ||
+			ebh->block_total_length > len - pos)
+		{
+			snprintf(error, SCAP_LASTERR_SIZE, "corrupted frame in %s", in->m_fname);
+			return SCAP_FAILURE;
+		}
+
+		e = (scap_evt *)(c->m_frame + pos + sizeof(block_header) + sizeof(uint16_t));
+		if(nevts == 0)
+		{
+			first_ts = e->ts;
+		}
+
+		if(e->ts < start_ts || e->ts >= end_ts)
+		{
+			all_in = false;
+		}
+
+		last_ts = e->ts;
+		nevts++;
+	}
+
+	if(nevts == 0)
+	{
+		return SCAP_SUCCESS;
+	}
+
+	if(all_in)
+	{
+		if(scap_cut_prepare(c, in, first_ts, bh->block_total_length, false, summary, error) != SCAP_SUCCESS ||
+			scap_cut_write(c, c->m_buf, bh->block_total_length, error) != SCAP_SUCCESS)
+		{
+			return SCAP_FAILURE;
+		}
+
+		c->m_nevts += nevts;
+		c->m_last_ts = last_ts;
+		in->m_started = true;
+		return SCAP_SUCCESS;
+	}
+
+	for(pos = 0; pos < len && !*done; pos += ebh->block_total_length)
+	{
+		ebh = (block_header *)(c->m_frame + pos);
+
+		if(scap_cut_evt_block(c, in, (char *)ebh, ebh->block_total_length, start_ts, end_ts, summary, done, error) != SCAP_SUCCESS)
+		{
+			return SCAP_FAILURE;
+		}
+	}
+
+	return SCAP_SUCCESS;
+}
+
+//
+// Copy the events in the range of the blocks between offset and end_offset,
+// checking them one by one
+//
+static int32_t scap_cut_walk(scap_cutter_t* c, scap_cut_input* in, uint64_t offset, uint64_t end_offset,
+	uint64_t start_ts, uint64_t end_ts, const scap_block_summary* summary, OUT bool* done, char *error)
+{
+	block_header bh;
+
+	//
+	// The events of different groups of the input don't share an index entry
+	//
+	c->m_entry_pos = UINT64_MAX;
+
+	while(offset < end_offset && !*done)
+	{
+		if(scap_cut_read_at(in, offset, &bh, sizeof(bh), error) != SCAP_SUCCESS)
+		{
+			return SCAP_FAILURE;
+		}
+
+		if(bh.block_total_length < sizeof(bh) + 4 || bh.block_total_length > end_offset - offset)
+		{
+			snprintf(error, SCAP_LASTERR_SIZE, "invalid length %u of block type %x in %s at offset %" PRIu64,
+				bh.block_total_length,
+				bh.block_type,
+				in->m_fname,
+				offset);
+			return SCAP_FAILURE;
+		}
+
+		switch(bh.block_type)
+		{
+		case EV_BLOCK_TYPE:
+		case EV_BLOCK_TYPE_INT:
+			if(bh.block_total_length < sizeof(bh) + sizeof(uint16_t) + sizeof(struct ppm_evt_hdr) + 4)
+			{
+				snprintf(error, SCAP_LASTERR_SIZE, "block length too short %u in %s", bh.block_total_length, in->m_fname);
+				return SCAP_FAILURE;
+			}
+
+			if(scap_cut_read_block(c, in, offset, &bh, error) != SCAP_SUCCESS ||
+				scap_cut_evt_block(c, in, c->m_buf, bh.block_total_length, start_ts, end_ts, summary, done, error) != SCAP_SUCCESS)
+			{
+				return SCAP_FAILURE;
+			}
+			break;
+		case EVF_BLOCK_TYPE:
+			if(scap_cut_read_block(c, in, offset, &bh, error) != SCAP_SUCCESS ||
+				scap_cut_frame(c, in, &bh, start_ts, end_ts, summary, done, error) != SCAP_SUCCESS)
+			{
+				return SCAP_FAILURE;
+			}
+			break;
+		case SS_BLOCK_TYPE:
+			//
+			// The snapshots before the first event written are replaced by
+			// the tables the output starts with
+			//
+			if(in->m_started && c->m_f != NULL &&
+				scap_cut_copy_snapshot(c, in, offset, &bh, error) != SCAP_SUCCESS)
+			{
+				return SCAP_FAILURE;
+			}
+
+			in->m_snapshot = offset;
+			break;
+		case IX_BLOCK_TYPE:
+			return SCAP_SUCCESS;
+		default:
+			break;
+		}
+
+		c->m_stats.n_bytes_decoded += bh.block_total_length;
+		offset += bh.block_total_length;
+	}
+
+	return SCAP_SUCCESS;
+}
+
+//
+// Copy the events of an input in the range, group by group
+//
+static int32_t scap_cut_input_events(scap_cutter_t* c, scap_cut_input* in, uint64_t start_ts, uint64_t end_ts, char *error)
+{
+	uint64_t lo = 0;
+	uint64_t hi = in->m_index_len;
+	uint64_t g;
+	bool done = false;
+
+	if(in->m_index_len == 0)
+	{
+		return scap_cut_walk(c, in, in->m_evts_offset, in->m_evts_end, start_ts, end_ts, NULL, &done, error);
+	}
+
+	//
+	// Start from the last group that starts before the range, like
+	// scap_seek_ts() does
+	//
+	if(in->m_index[0].ts > start_ts)
+	{
+		if(scap_cut_walk(c, in, in->m_evts_offset, in->m_index[0].offset, start_ts, end_ts, NULL, &done, error) != SCAP_SUCCESS)
+		{
+			return SCAP_FAILURE;
+		}
+	}
+	else
+	{
+		while(hi - lo > 1)
+		{
+			uint64_t mid = lo + (hi - lo) / 2;
+
+			if(in->m_index[mid].ts <= start_ts)
+			{
+				lo = mid;
+			}
+			else
+			{
+				hi = mid;
+			}
+		}
+	}
+
+	for(g = lo; g < in->m_index_len; g++)
+	{
+		const scap_block_summary* summary = (in->m_summaries != NULL)? &in->m_summaries[g] : NULL;
+		uint64_t first_ts = (summary != NULL)? summary->ts_min : in->m_index[g].ts;
+		uint64_t last_ts;
+
+		if(first_ts >= end_ts)
+		{
+			break;
+		}
+
+		in->m_snapshot = in->m_index[g].snapshot_offset;
+
+		//
+		// Without a summary, the events of a group are between its first
+		// timestamp and the one of the next group. The last group has an
+		// unknown number of events, and it's always read.
+		//
+		if(g + 1 < in->m_index_len)
+		{
+			last_ts = (summary != NULL)? summary->ts_max : in->m_index[g + 1].ts;
+
+			if(first_ts >= start_ts && last_ts < end_ts)
+			{
+				if(scap_cut_copy_group(c, in, g, error) != SCAP_SUCCESS)
+				{
+					return SCAP_FAILURE;
+				}
+
+				continue;
+			}
+		}
+
+		if(scap_cut_walk(c, in,
+			in->m_index[g].offset,
+			(g + 1 < in->m_index_len)? in->m_index[g + 1].offset : in->m_evts_end,
+			start_ts, end_ts, summary, &done, error) != SCAP_SUCCESS)
+		{
+			return SCAP_FAILURE;
+		}
+	}
+
+	return SCAP_SUCCESS;
+}
+
+scap_cutter_t* scap_cut_open(const char* fname, uint64_t max_bytes, uint64_t max_duration, char* error)
+{
+	scap_cutter_t* c;
+
+	if(strlen(fname) >= SCAP_MAX_PATH_SIZE)
+	{
+		snprintf(error, SCAP_LASTERR_SIZE, "file name too long");
+		return NULL;
+	}
+
+	c = (scap_cutter_t *)calloc(1, sizeof(scap_cutter_t));
+	if(c == NULL)
+	{
+		snprintf(error, SCAP_LASTERR_SIZE, "error allocating the cutter");
+		return NULL;
+	}
+
+	strcpy(c->m_fname, fname);
+	c->m_max_bytes = max_bytes;
+	c->m_max_duration = max_duration;
+	return c;
+}
+
+int32_t scap_cut_add(scap_cutter_t* c, const char* fname, uint64_t start_ts, uint64_t end_ts, char* error)
+{
+	scap_cut_input in;
+	int32_t res = SCAP_FAILURE;
+
+	memset(&in, 0, sizeof(in));
+	in.m_fname = fname;
+
+	in.m_f = fopen(fname, "rb");
+	if(in.m_f == NULL)
+	{
+		snprintf(error, SCAP_LASTERR_SIZE, "can't open file %s", fname);
+		return SCAP_FAILURE;
+	}
+
+	if(scap_cut_read_header(&in, error) != SCAP_SUCCESS ||
+		scap_cut_read_index(&in, error) != SCAP_SUCCESS)
+	{
+		goto scap_cut_add_done;
+	}
+
+	//
+	// The tables of an input that continues a file go in a snapshot, written
+	// before its first event. The snapshots already copied are of the
+	// previous input.
+	//
+	c->m_pending_tables = (c->m_f != NULL);
+	c->m_nsnapshots = 0;
+
+	res = scap_cut_input_events(c, &in, start_ts, end_ts, error);
+
+scap_cut_add_done:
+	fclose(in.m_f);
+	free(in.m_blocks);
+	free(in.m_index);
+	free(in.m_summaries);
+	return res;
+}
+
+void scap_cut_get_stats(scap_cutter_t* c, OUT scap_cut_stats* stats)
+{
+	*stats = c->m_stats;
+	stats->n_evts += c->m_nevts;
+}
+
+int32_t scap_cut_close(scap_cutter_t* c, char* error)
+{
+	int32_t res = SCAP_SUCCESS;
+
+	if(c->m_f != NULL)
+	{
+		res = scap_cut_close_file(c, error);
+	}
+
+	free(c->m_snapshots);
+	free(c->m_index);
+	free(c->m_summaries);
+	free(c->m_copy);
+	free(c->m_buf);
+	free(c->m_frame);
+	free(c);
+	return res;
+}
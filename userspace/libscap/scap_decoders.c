@@ -0,0 +1,472 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "scap.h"
+#include "scap-int.h"
+#include "scap_savefile.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <pthread.h>
+#endif
+
+//
+// Decoder threads.
+// When a mapped trace file is made of compressed frames, the thread calling
+// scap_next() spends most of its time decompressing them. The decoders do it
+// ahead of it instead, so that the kernel reads the file ahead (see
+// scap_map_readahead()), the decoders decompress the next frames and the
+// caller parses the events of the current one, all at the same time.
+//
+// The decoders start at the first frame that the caller reaches. Each one
+// walks the block headers of the mapping from there, and decompresses the
+// frames whose number, counted from the start, modulo the number of decoders
+// is its id. The caller takes the frames from the decoders in turn, so they
+// come back in file order.
+//
+// Each queue has a single producer (its decoder) and a single consumer (the
+// caller of scap_next()), so like the queues of the reader threads it only
+// needs the head and tail positions and a barrier before each of them is
+// published.
+//
+// If the caller asks for a frame that isn't the next one of the decoders,
+// because it moved in the file or skipped some groups of events, the
+// decoders are restarted from there.
+//
+
+//
+// Frames decompressed ahead by each decoder
+//
+#define DECODER_QUEUE_LEN 4
+
+//
+// How long the threads sleep when the queue they need is full or empty
+//
+#define DECODER_WAIT_TIME_US 50
+
+//
+// The few thread primitives the decoders need. Windows can't sleep for less
+// than a scheduler tick, so there the waiting threads only yield.
+//
+#ifdef _WIN32
+typedef HANDLE scap_decoder_thread_t;
+#define scap_decoder_barrier() MemoryBarrier()
+#define scap_decoder_wait() SwitchToThread()
+#else
+typedef pthread_t scap_decoder_thread_t;
+#define scap_decoder_barrier() __sync_synchronize()
+#define scap_decoder_wait() usleep(DECODER_WAIT_TIME_US)
+#endif
+
+typedef struct scap_decoded_frame
+{
+	uint64_t m_offset; // Of the frame in the file
+	char* m_buf;
+	uint32_t m_bufsize;
+	uint32_t m_len;
+}scap_decoded_frame;
+
+typedef struct scap_decoder
+{
+	struct scap_decoders* m_decoders;
+	uint32_t m_id;
+	scap_decoder_thread_t m_thread;
+	scap_decoded_frame m_frames[DECODER_QUEUE_LEN];
+	volatile uint64_t m_head; // Written by the decoder
+	volatile uint64_t m_tail; // Written by the consumer, once it's done with the frame before it
+	volatile bool m_done; // The decoder has no more frames, because it reached the end or an error
+	volatile bool m_stop;
+}scap_decoder;
+
+struct scap_decoders
+{
+	scap_t* m_handle;
+	scap_decoder* m_decoders;
+	uint32_t m_ndecoders;
+	bool m_running;
+	uint64_t m_start; // Where the running decoders started
+	uint64_t m_next; // Number of the next frame for the consumer, counted from m_start
+	int32_t m_cur; // Decoder whose frame the consumer is reading, -1 if none
+};
+
+static void* scap_decoder_thread(void* arg)
+{
+	scap_decoder* d = (scap_decoder*)arg;
+	struct scap_decoders* ds = d->m_decoders;
+	scap_t* handle = ds->m_handle;
+	uint64_t pos = ds->m_start;
+	uint64_t nframes = 0;
+	char error[SCAP_LASTERR_SIZE];
+
+	//
+	// A failure only leaves the decoder unpinned
+	//
+	scap_pin_thread(handle);
+
+	while(!d->m_stop)
+	{
+		block_header* bh;
+		scap_decoded_frame* f;
+
+		if(handle->m_file_map_size - pos < sizeof(block_header))
+		{
+			break;
+		}
+
+		bh = (block_header*)(handle->m_file_map + pos);
+
+		if(bh->block_type == IX_BLOCK_TYPE ||
+			bh->block_total_length < sizeof(block_header) + 4 ||
+			bh->block_total_length > handle->m_file_map_size - pos)
+		{
+			break;
+		}
+
+		if(bh->block_type != EVF_BLOCK_TYPE)
+		{
+			pos += bh->block_total_length;
+			continue;
+		}
+
+		if(bh->block_total_length < sizeof(block_header) + sizeof(event_frame_header) + 4)
+		{
+			break;
+		}
+
+		if(nframes++ % ds->m_ndecoders != d->m_id)
+		{
+			pos += bh->block_total_length;
+			continue;
+		}
+
+		while(d->m_head - d->m_tail == DECODER_QUEUE_LEN && !d->m_stop)
+		{
+			scap_decoder_wait();
+		}
+
+		if(d->m_stop)
+		{
+			break;
+		}
+
+		//
+		// The consumer doesn't touch the frame at the head until it's
+		// published
+		//
+		scap_decoder_barrier();
+
+		f = &d->m_frames[d->m_head % DECODER_QUEUE_LEN];
+
+		//
+		// The consumer decompresses the frame itself, and reports the
+		// error
+		//
+		if(scap_uncompress_frame(bh, (char*)(bh + 1), &f->m_buf, &f->m_bufsize, &f->m_len, error) != SCAP_SUCCESS)
+		{
+			break;
+		}
+
+		f->m_offset = pos;
+
+		//
+		// The frame must be complete before the consumer can see it
+		//
+		scap_decoder_barrier();
+		d->m_head++;
+
+		pos += bh->block_total_length;
+	}
+
+	scap_decoder_barrier();
+	d->m_done = true;
+	return NULL;
+}
+
+#ifdef _WIN32
+static DWORD WINAPI scap_decoder_thread_win(LPVOID arg)
+{
+	scap_decoder_thread(arg);
+	return 0;
+}
+#endif
+
+static bool scap_decoder_create(scap_decoder* d)
+{
+#ifdef _WIN32
+	d->m_thread = CreateThread(NULL, 0, scap_decoder_thread_win, d, 0, NULL);
+	return d->m_thread != NULL;
+#else
+	return pthread_create(&d->m_thread, NULL, scap_decoder_thread, d) == 0;
+#endif
+}
+
+static void scap_decoder_join(scap_decoder* d)
+{
+#ifdef _WIN32
+	WaitForSingleObject(d->m_thread, INFINITE);
+	CloseHandle(d->m_thread);
+#else
+	pthread_join(d->m_thread, NULL);
+#endif
+}
+
+static void scap_decoders_stop(struct scap_decoders* ds)
+{
+	uint32_t j;
+
+	if(!ds->m_running)
+	{
+		return;
+	}
+
+	for(j = 0; j < ds->m_ndecoders; j++)
+	{
+		ds->m_decoders[j].m_stop = true;
+	}
+
+	for(j = 0; j < ds->m_ndecoders; j++)
+	{
+		scap_decoder_join(&ds->m_decoders[j]);
+	}
+
+	ds->m_running = false;
+	ds->m_cur = -1;
+}
+
+static int32_t scap_decoders_start(struct scap_decoders* ds, uint64_t offset)
+{
+	uint32_t j;
+
+	scap_decoders_stop(ds);
+
+	ds->m_start = offset;
+	ds->m_next = 0;
+
+	for(j = 0; j < ds->m_ndecoders; j++)
+	{
+		scap_decoder* d = &ds->m_decoders[j];
+
+		d->m_head = 0;
+		d->m_tail = 0;
+		d->m_done = false;
+		d->m_stop = false;
+	}
+
+	for(j = 0; j < ds->m_ndecoders; j++)
+	{
+		if(!scap_decoder_create(&ds->m_decoders[j]))
+		{
+			uint32_t k;
+
+			for(k = 0; k < j; k++)
+			{
+				ds->m_decoders[k].m_stop = true;
+				scap_decoder_join(&ds->m_decoders[k]);
+			}
+
+			snprintf(ds->m_handle->m_lasterr, SCAP_LASTERR_SIZE, "error starting the decoder threads");
+			return SCAP_FAILURE;
+		}
+	}
+
+	ds->m_running = true;
+	return SCAP_SUCCESS;
+}
+
+int32_t scap_enable_decoders(scap_t* handle, uint32_t ndecoders)
+{
+	struct scap_decoders* ds;
+	uint32_t j;
+
+	if(handle->m_decoders != NULL)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "the decoder threads are already running");
+		return SCAP_FAILURE;
+	}
+
+	if(ndecoders == 0)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "invalid number of decoder threads");
+		return SCAP_FAILURE;
+	}
+
+	//
+	// The events of streams are read one at a time, there's nothing to
+	// decompress ahead
+	//
+	if(handle->m_file_map == NULL)
+	{
+		return SCAP_SUCCESS;
+	}
+
+	ds = (struct scap_decoders*)calloc(1, sizeof(struct scap_decoders));
+	if(ds == NULL)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "error allocating the decoder threads");
+		return SCAP_FAILURE;
+	}
+
+	ds->m_decoders = (scap_decoder*)calloc(ndecoders, sizeof(scap_decoder));
+	if(ds->m_decoders == NULL)
+	{
+		free(ds);
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "error allocating the decoder threads");
+		return SCAP_FAILURE;
+	}
+
+	ds->m_handle = handle;
+	ds->m_ndecoders = ndecoders;
+	ds->m_cur = -1;
+
+	for(j = 0; j < ndecoders; j++)
+	{
+		ds->m_decoders[j].m_decoders = ds;
+		ds->m_decoders[j].m_id = j;
+	}
+
+	handle->m_decoders = ds;
+	return SCAP_SUCCESS;
+}
+
+void scap_disable_decoders(scap_t* handle)
+{
+	struct scap_decoders* ds = handle->m_decoders;
+	uint32_t j;
+	uint32_t k;
+
+	if(ds == NULL)
+	{
+		return;
+	}
+
+	scap_decoders_stop(ds);
+
+	for(j = 0; j < ds->m_ndecoders; j++)
+	{
+		for(k = 0; k < DECODER_QUEUE_LEN; k++)
+		{
+			free(ds->m_decoders[j].m_frames[k].m_buf);
+		}
+	}
+
+	//
+	// The current frame might be in one of the buffers
+	//
+	handle->m_file_frame_len = 0;
+	handle->m_file_frame_pos = 0;
+
+	free(ds->m_decoders);
+	free(ds);
+	handle->m_decoders = NULL;
+}
+
+int32_t scap_decoders_get_frame(scap_t* handle, uint64_t offset)
+{
+	struct scap_decoders* ds = handle->m_decoders;
+	block_header* bh = (block_header*)(handle->m_file_map + offset);
+	uint32_t len;
+
+	//
+	// The consumer is done with the events of the last frame, give its
+	// buffer back
+	//
+	if(ds->m_cur != -1)
+	{
+		scap_decoder_barrier();
+		ds->m_decoders[ds->m_cur].m_tail++;
+		ds->m_cur = -1;
+	}
+
+	if(!ds->m_running && scap_decoders_start(ds, offset) != SCAP_SUCCESS)
+	{
+		return SCAP_FAILURE;
+	}
+
+	while(true)
+	{
+		scap_decoder* d = &ds->m_decoders[ds->m_next % ds->m_ndecoders];
+
+		if(d->m_tail != d->m_head)
+		{
+			scap_decoded_frame* f;
+
+			scap_decoder_barrier();
+
+			f = &d->m_frames[d->m_tail % DECODER_QUEUE_LEN];
+
+			if(f->m_offset != offset)
+			{
+				//
+				// The reader moved
+				//
+				if(scap_decoders_start(ds, offset) != SCAP_SUCCESS)
+				{
+					return SCAP_FAILURE;
+				}
+
+				continue;
+			}
+
+			handle->m_file_frame_data = f->m_buf;
+			handle->m_file_frame_len = f->m_len;
+			handle->m_file_frame_pos = 0;
+			ds->m_cur = (int32_t)(ds->m_next % ds->m_ndecoders);
+			ds->m_next++;
+			return SCAP_SUCCESS;
+		}
+
+		if(d->m_done)
+		{
+			//
+			// Check again, the decoder might have published a frame
+			// right before finishing
+			//
+			scap_decoder_barrier();
+			if(d->m_tail != d->m_head)
+			{
+				continue;
+			}
+
+			break;
+		}
+
+		scap_decoder_wait();
+	}
+
+	//
+	// The decoder stopped before this frame, because it's corrupted or
+	// the reader moved past where the decoders could go. Decompress it here,
+	// and start again from the next one.
+	//
+	scap_decoders_stop(ds);
+
+	if(scap_uncompress_frame(bh, (char*)(bh + 1), &handle->m_file_frame, &handle->m_file_frame_size, &len, handle->m_lasterr) != SCAP_SUCCESS)
+	{
+		return SCAP_FAILURE;
+	}
+
+	handle->m_file_frame_data = handle->m_file_frame;
+	handle->m_file_frame_len = len;
+	handle->m_file_frame_pos = 0;
+	return SCAP_SUCCESS;
+}
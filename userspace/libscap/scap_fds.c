@@ -42,11 +42,13 @@ along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
 #include <arpa/inet.h>
 
 #include <errno.h>
+#include <sys/ioctl.h>
 #include <netinet/tcp.h>
 #if !defined __sun
 #include <linux/netlink.h>
 #include <linux/rtnetlink.h>
-//#include <linux/sock_diag.h>
+#include <linux/sock_diag.h>
+#include <linux/inet_diag.h>
 //#include <linux/unix_diag.h>
 #endif
 #endif
@@ -312,21 +314,21 @@ int32_t scap_fd_write_to_disk(scap_t *handle, scap_fdinfo *fdi, FILE *f)
 	return SCAP_SUCCESS;
 }
 
-uint32_t scap_fd_read_prop_from_disk(scap_t *handle, OUT void *target, size_t expected_size, OUT size_t *nbytes, FILE *f)
+uint32_t scap_fd_read_prop_from_disk(scap_t *handle, OUT void *target, size_t expected_size, OUT size_t *nbytes, scap_blockbuf *b)
 {
 	size_t readsize;
-	readsize = fread(target, 1, expected_size, f);
+	readsize = scap_blockbuf_read(target, expected_size, b);
 	CHECK_READ_SIZE(readsize, expected_size);
 	(*nbytes) += readsize;
 	return SCAP_SUCCESS;
 }
 
-uint32_t scap_fd_read_fname_from_disk(scap_t* handle, char* fname,OUT size_t* nbytes,FILE* f)
+uint32_t scap_fd_read_fname_from_disk(scap_t* handle, char* fname,OUT size_t* nbytes,scap_blockbuf* b)
 {
 	size_t readsize;
 	uint16_t stlen;
 
-	readsize = fread(&(stlen), 1, sizeof(uint16_t), f);
+	readsize = scap_blockbuf_read(&(stlen), sizeof(uint16_t), b);
 	CHECK_READ_SIZE(readsize, sizeof(uint16_t));
 
 	if(stlen >= SCAP_MAX_PATH_SIZE)
@@ -337,7 +339,7 @@ uint32_t scap_fd_read_fname_from_disk(scap_t* handle, char* fname,OUT size_t* nb
 
 	(*nbytes) += readsize;
 
-	readsize = fread(fname, 1, stlen, f);
+	readsize = scap_blockbuf_read(fname, stlen, b);
 	CHECK_READ_SIZE(readsize, stlen);
 
 	(*nbytes) += stlen;
@@ -351,15 +353,15 @@ uint32_t scap_fd_read_fname_from_disk(scap_t* handle, char* fname,OUT size_t* nb
 // Populate the given fd by reading the info from disk
 // Returns the number of read bytes.
 //
-uint32_t scap_fd_read_from_disk(scap_t *handle, OUT scap_fdinfo *fdi, OUT size_t *nbytes, FILE *f)
+uint32_t scap_fd_read_from_disk(scap_t *handle, OUT scap_fdinfo *fdi, OUT size_t *nbytes, scap_blockbuf *b)
 {
 	uint8_t type;
 	uint32_t res = SCAP_SUCCESS;
 	*nbytes = 0;
 
-	if(scap_fd_read_prop_from_disk(handle, &(fdi->fd), sizeof(fdi->fd), nbytes, f) ||
-	        scap_fd_read_prop_from_disk(handle, &(fdi->ino), sizeof(fdi->ino), nbytes, f) ||
-	        scap_fd_read_prop_from_disk(handle, &type, sizeof(uint8_t), nbytes, f))
+	if(scap_fd_read_prop_from_disk(handle, &(fdi->fd), sizeof(fdi->fd), nbytes, b) ||
+	        scap_fd_read_prop_from_disk(handle, &(fdi->ino), sizeof(fdi->ino), nbytes, b) ||
+	        scap_fd_read_prop_from_disk(handle, &type, sizeof(uint8_t), nbytes, b))
 	{
 		return SCAP_FAILURE;
 	}
@@ -369,11 +371,11 @@ uint32_t scap_fd_read_from_disk(scap_t *handle, OUT scap_fdinfo *fdi, OUT size_t
 	switch(fdi->type)
 	{
 	case SCAP_FD_IPV4_SOCK:
-		if(fread(&(fdi->info.ipv4info.sip), 1, sizeof(uint32_t), f) != sizeof(uint32_t) ||
-		        fread(&(fdi->info.ipv4info.dip), 1, sizeof(uint32_t), f) != sizeof(uint32_t) ||
-		        fread(&(fdi->info.ipv4info.sport), 1, sizeof(uint16_t), f) != sizeof(uint16_t) ||
-		        fread(&(fdi->info.ipv4info.dport), 1, sizeof(uint16_t), f) != sizeof(uint16_t) ||
-		        fread(&(fdi->info.ipv4info.l4proto), 1, sizeof(uint8_t), f) != sizeof(uint8_t))
+		if(scap_blockbuf_read(&(fdi->info.ipv4info.sip), sizeof(uint32_t), b) != sizeof(uint32_t) ||
+		        scap_blockbuf_read(&(fdi->info.ipv4info.dip), sizeof(uint32_t), b) != sizeof(uint32_t) ||
+		        scap_blockbuf_read(&(fdi->info.ipv4info.sport), sizeof(uint16_t), b) != sizeof(uint16_t) ||
+		        scap_blockbuf_read(&(fdi->info.ipv4info.dport), sizeof(uint16_t), b) != sizeof(uint16_t) ||
+		        scap_blockbuf_read(&(fdi->info.ipv4info.l4proto), sizeof(uint8_t), b) != sizeof(uint8_t))
 		{
 			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error reading the fd info from file (1)");
 			return SCAP_FAILURE;
@@ -383,9 +385,9 @@ uint32_t scap_fd_read_from_disk(scap_t *handle, OUT scap_fdinfo *fdi, OUT size_t
 
 		break;
 	case SCAP_FD_IPV4_SERVSOCK:
-		if(fread(&(fdi->info.ipv4serverinfo.ip), 1, sizeof(uint32_t), f) != sizeof(uint32_t) ||
-		        fread(&(fdi->info.ipv4serverinfo.port), 1, sizeof(uint16_t), f) != sizeof(uint16_t) ||
-		        fread(&(fdi->info.ipv4serverinfo.l4proto), 1, sizeof(uint8_t), f) != sizeof(uint8_t))
+		if(scap_blockbuf_read(&(fdi->info.ipv4serverinfo.ip), sizeof(uint32_t), b) != sizeof(uint32_t) ||
+		        scap_blockbuf_read(&(fdi->info.ipv4serverinfo.port), sizeof(uint16_t), b) != sizeof(uint16_t) ||
+		        scap_blockbuf_read(&(fdi->info.ipv4serverinfo.l4proto), sizeof(uint8_t), b) != sizeof(uint8_t))
 		{
 			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error reading the fd info from file (2)");
 			return SCAP_FAILURE;
@@ -394,11 +396,11 @@ uint32_t scap_fd_read_from_disk(scap_t *handle, OUT scap_fdinfo *fdi, OUT size_t
 		(*nbytes) += (sizeof(uint32_t) + sizeof(uint16_t) + sizeof(uint8_t));
 		break;
 	case SCAP_FD_IPV6_SOCK:
-		if(fread((char*)fdi->info.ipv6info.sip, 1, sizeof(uint32_t) * 4, f) != sizeof(uint32_t) * 4 ||
-		        fread((char*)fdi->info.ipv6info.dip, 1, sizeof(uint32_t) * 4, f) != sizeof(uint32_t) * 4 ||
-		        fread(&(fdi->info.ipv6info.sport), 1, sizeof(uint16_t), f) != sizeof(uint16_t) ||
-		        fread(&(fdi->info.ipv6info.dport), 1, sizeof(uint16_t), f) != sizeof(uint16_t) ||
-		        fread(&(fdi->info.ipv6info.l4proto), 1, sizeof(uint8_t), f) != sizeof(uint8_t))
+		if(scap_blockbuf_read((char*)fdi->info.ipv6info.sip, sizeof(uint32_t) * 4, b) != sizeof(uint32_t) * 4 ||
+		        scap_blockbuf_read((char*)fdi->info.ipv6info.dip, sizeof(uint32_t) * 4, b) != sizeof(uint32_t) * 4 ||
+		        scap_blockbuf_read(&(fdi->info.ipv6info.sport), sizeof(uint16_t), b) != sizeof(uint16_t) ||
+		        scap_blockbuf_read(&(fdi->info.ipv6info.dport), sizeof(uint16_t), b) != sizeof(uint16_t) ||
+		        scap_blockbuf_read(&(fdi->info.ipv6info.l4proto), sizeof(uint8_t), b) != sizeof(uint8_t))
 		{
 			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error writing to file (fi3)");
 		}
@@ -409,9 +411,9 @@ uint32_t scap_fd_read_from_disk(scap_t *handle, OUT scap_fdinfo *fdi, OUT size_t
 				sizeof(uint8_t)); // l4proto
 		break;
 	case SCAP_FD_IPV6_SERVSOCK:
-		if(fread((char*)fdi->info.ipv6serverinfo.ip, 1, sizeof(uint32_t) * 4, f) != sizeof(uint32_t) * 4||
-		        fread(&(fdi->info.ipv6serverinfo.port), 1, sizeof(uint16_t), f) != sizeof(uint16_t) ||
-		        fread(&(fdi->info.ipv6serverinfo.l4proto), 1, sizeof(uint8_t), f) != sizeof(uint8_t))
+		if(scap_blockbuf_read((char*)fdi->info.ipv6serverinfo.ip, sizeof(uint32_t) * 4, b) != sizeof(uint32_t) * 4||
+		        scap_blockbuf_read(&(fdi->info.ipv6serverinfo.port), sizeof(uint16_t), b) != sizeof(uint16_t) ||
+		        scap_blockbuf_read(&(fdi->info.ipv6serverinfo.l4proto), sizeof(uint8_t), b) != sizeof(uint8_t))
 		{
 			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error writing to file (fi4)");
 		}
@@ -420,15 +422,15 @@ uint32_t scap_fd_read_from_disk(scap_t *handle, OUT scap_fdinfo *fdi, OUT size_t
 				sizeof(uint8_t)); // l4proto
 		break;
 	case SCAP_FD_UNIX_SOCK:
-		if(fread(&(fdi->info.unix_socket_info.source), 1, sizeof(uint64_t), f) != sizeof(uint64_t) ||
-		        fread(&(fdi->info.unix_socket_info.destination), 1, sizeof(uint64_t), f) != sizeof(uint64_t))
+		if(scap_blockbuf_read(&(fdi->info.unix_socket_info.source), sizeof(uint64_t), b) != sizeof(uint64_t) ||
+		        scap_blockbuf_read(&(fdi->info.unix_socket_info.destination), sizeof(uint64_t), b) != sizeof(uint64_t))
 		{
 			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error reading the fd info from file (fi5)");
 			return SCAP_FAILURE;
 		}
 
 		(*nbytes) += (sizeof(uint64_t) + sizeof(uint64_t));
-		res = scap_fd_read_fname_from_disk(handle, fdi->info.unix_socket_info.fname,nbytes,f);
+		res = scap_fd_read_fname_from_disk(handle, fdi->info.unix_socket_info.fname,nbytes,b);
 		break;
 	case SCAP_FD_FIFO:
 	case SCAP_FD_FILE:
@@ -439,7 +441,7 @@ uint32_t scap_fd_read_from_disk(scap_t *handle, OUT scap_fdinfo *fdi, OUT size_t
 	case SCAP_FD_EVENTPOLL:
 	case SCAP_FD_INOTIFY:
 	case SCAP_FD_TIMERFD:
-		res = scap_fd_read_fname_from_disk(handle, fdi->info.fname,nbytes,f);
+		res = scap_fd_read_fname_from_disk(handle, fdi->info.fname,nbytes,b);
 		break;
 	default:
 		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error reading the fd info from file, wrong fd type %u", (uint32_t)fdi->type);
@@ -681,13 +683,31 @@ int32_t scap_fd_read_unix_sockets_from_proc_fs(scap_t *handle, scap_fdinfo **soc
 	int first_line = false;
 	char *delimiters = " \t";
 	char *token;
+	char *saveptr;
+	char *scan_buf;
 	int32_t uth_status = SCAP_SUCCESS;
+
+	scan_buf = (char*)malloc(SOCKET_SCAN_BUFFER_SIZE);
+	if(scan_buf == NULL)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "scan_buf allocation error");
+		return SCAP_FAILURE;
+	}
+
 	f = fopen("/proc/net/unix", "r");
 	if(NULL == f)
 	{
 		ASSERT(false);
+		free(scan_buf);
 		return SCAP_FAILURE;
 	}
+
+	//
+	// Read the file in big chunks, like the ipv4 and ipv6 tables, instead
+	// of a page at a time
+	//
+	setvbuf(f, scan_buf, _IOFBF, SOCKET_SCAN_BUFFER_SIZE);
+
 	while(NULL != fgets(line, sizeof(line), f))
 	{
 		// skip the first line ... contains field names
@@ -704,7 +724,7 @@ int32_t scap_fd_read_unix_sockets_from_proc_fs(scap_t *handle, scap_fdinfo **soc
 		// parse the fields
 		//
 		// 1. Num
-		token = strtok(line, delimiters);
+		token = strtok_r(line, delimiters, &saveptr);
 		if(token == NULL)
 		{
 			ASSERT(false);
@@ -716,7 +736,7 @@ int32_t scap_fd_read_unix_sockets_from_proc_fs(scap_t *handle, scap_fdinfo **soc
 		fdinfo->info.unix_socket_info.destination = 0;
 
 		// 2. RefCount
-		token = strtok(NULL, delimiters);
+		token = strtok_r(NULL, delimiters, &saveptr);
 		if(token == NULL)
 		{
 			ASSERT(false);
@@ -725,7 +745,7 @@ int32_t scap_fd_read_unix_sockets_from_proc_fs(scap_t *handle, scap_fdinfo **soc
 		}
 
 		// 3. Protocol
-		token = strtok(NULL, delimiters);
+		token = strtok_r(NULL, delimiters, &saveptr);
 		if(token == NULL)
 		{
 			ASSERT(false);
@@ -734,7 +754,7 @@ int32_t scap_fd_read_unix_sockets_from_proc_fs(scap_t *handle, scap_fdinfo **soc
 		}
 
 		// 4. Flags
-		token = strtok(NULL, delimiters);
+		token = strtok_r(NULL, delimiters, &saveptr);
 		if(token == NULL)
 		{
 			ASSERT(false);
@@ -743,7 +763,7 @@ int32_t scap_fd_read_unix_sockets_from_proc_fs(scap_t *handle, scap_fdinfo **soc
 		}
 
 		// 5. Type
-		token = strtok(NULL, delimiters);
+		token = strtok_r(NULL, delimiters, &saveptr);
 		if(token == NULL)
 		{
 			ASSERT(false);
@@ -752,7 +772,7 @@ int32_t scap_fd_read_unix_sockets_from_proc_fs(scap_t *handle, scap_fdinfo **soc
 		}
 
 		// 6. St
-		token = strtok(NULL, delimiters);
+		token = strtok_r(NULL, delimiters, &saveptr);
 		if(token == NULL)
 		{
 			ASSERT(false);
@@ -761,7 +781,7 @@ int32_t scap_fd_read_unix_sockets_from_proc_fs(scap_t *handle, scap_fdinfo **soc
 		}
 		
 		// 7. Inode
-		token = strtok(NULL, delimiters);
+		token = strtok_r(NULL, delimiters, &saveptr);
 		if(token == NULL)
 		{
 			ASSERT(false);
@@ -772,7 +792,7 @@ int32_t scap_fd_read_unix_sockets_from_proc_fs(scap_t *handle, scap_fdinfo **soc
 		sscanf(token, "%"PRIu64, &(fdinfo->ino));
 
 		// 8. Path
-		token = strtok(NULL, delimiters);
+		token = strtok_r(NULL, delimiters, &saveptr);
 		if(NULL != token)
 		{
 			strncpy(fdinfo->info.unix_socket_info.fname, token, SCAP_MAX_PATH_SIZE);
@@ -790,6 +810,7 @@ int32_t scap_fd_read_unix_sockets_from_proc_fs(scap_t *handle, scap_fdinfo **soc
 		}
 	}
 	fclose(f);
+	free(scan_buf);
 	return uth_status;
 }
 
@@ -1185,27 +1206,265 @@ int32_t scap_fd_read_ipv6_sockets_from_proc_fs(scap_t *handle, char *dir, int l4
 	return uth_status;
 }
 
+#if !defined __sun
+//
+// Read the sockets of a family and protocol with a NETLINK_SOCK_DIAG dump,
+// which returns binary records instead of the text of /proc/net. The
+// records are converted to the same entries as the /proc parsers.
+// SCAP_NOTFOUND means that the kernel can't do the dump and that nothing
+// has been added to the table.
+//
+static int32_t scap_fd_read_inet_sockets_from_netlink(scap_t *handle, int nl_sock, char *buf, int family, int protocol, int l4proto, scap_fdinfo **sockets)
+{
+	struct
+	{
+		struct nlmsghdr nlh;
+		struct inet_diag_req_v2 req;
+	} msg;
+	struct sockaddr_nl sa;
+	struct nlmsghdr *nlh;
+	struct inet_diag_msg *diag;
+	scap_fdinfo *fdinfo;
+	int32_t uth_status = SCAP_SUCCESS;
+	bool added = false;
+	ssize_t len;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.nlh.nlmsg_len = sizeof(msg);
+	msg.nlh.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+	msg.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	msg.req.sdiag_family = family;
+	msg.req.sdiag_protocol = protocol;
+	msg.req.idiag_states = (uint32_t)-1;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.nl_family = AF_NETLINK;
+
+	if(sendto(nl_sock, &msg, sizeof(msg), 0, (struct sockaddr *)&sa, sizeof(sa)) < 0)
+	{
+		return SCAP_NOTFOUND;
+	}
+
+	while(true)
+	{
+		len = recv(nl_sock, buf, SOCKET_SCAN_BUFFER_SIZE, 0);
+		if(len < 0 && errno == EINTR)
+		{
+			continue;
+		}
+
+		if(len <= 0)
+		{
+			break;
+		}
+
+		for(nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len))
+		{
+			if(nlh->nlmsg_type == NLMSG_DONE)
+			{
+				return SCAP_SUCCESS;
+			}
+
+			if(nlh->nlmsg_type == NLMSG_ERROR)
+			{
+				goto dump_error;
+			}
+
+			if(nlh->nlmsg_type != SOCK_DIAG_BY_FAMILY || nlh->nlmsg_len < NLMSG_LENGTH(sizeof(*diag)))
+			{
+				continue;
+			}
+
+			diag = (struct inet_diag_msg *)NLMSG_DATA(nlh);
+
+			//
+			// No fd can point to sockets without an inode, like the ones
+			// in TIME_WAIT
+			//
+			if(diag->idiag_inode == 0)
+			{
+				continue;
+			}
+
+			fdinfo = malloc(sizeof(scap_fdinfo));
+			if(fdinfo == NULL)
+			{
+				snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "socket table allocation error");
+				return SCAP_FAILURE;
+			}
+
+			fdinfo->ino = diag->idiag_inode;
+
+			//
+			// The addresses are in network order, like the raw words that
+			// /proc prints in hex. The ports are printed in host order.
+			//
+			if(family == AF_INET)
+			{
+				if(diag->id.idiag_dst[0] == 0)
+				{
+					fdinfo->type = SCAP_FD_IPV4_SERVSOCK;
+					fdinfo->info.ipv4serverinfo.ip = diag->id.idiag_src[0];
+					fdinfo->info.ipv4serverinfo.port = ntohs(diag->id.idiag_sport);
+					fdinfo->info.ipv4serverinfo.l4proto = l4proto;
+				}
+				else
+				{
+					fdinfo->type = SCAP_FD_IPV4_SOCK;
+					fdinfo->info.ipv4info.sip = diag->id.idiag_src[0];
+					fdinfo->info.ipv4info.dip = diag->id.idiag_dst[0];
+					fdinfo->info.ipv4info.sport = ntohs(diag->id.idiag_sport);
+					fdinfo->info.ipv4info.dport = ntohs(diag->id.idiag_dport);
+					fdinfo->info.ipv4info.l4proto = l4proto;
+				}
+			}
+			else
+			{
+				if(scap_fd_is_ipv6_server_socket(diag->id.idiag_dst))
+				{
+					fdinfo->type = SCAP_FD_IPV6_SERVSOCK;
+					memcpy(fdinfo->info.ipv6serverinfo.ip, diag->id.idiag_src, sizeof(fdinfo->info.ipv6serverinfo.ip));
+					fdinfo->info.ipv6serverinfo.port = ntohs(diag->id.idiag_sport);
+					fdinfo->info.ipv6serverinfo.l4proto = l4proto;
+				}
+				else
+				{
+					fdinfo->type = SCAP_FD_IPV6_SOCK;
+					memcpy(fdinfo->info.ipv6info.sip, diag->id.idiag_src, sizeof(fdinfo->info.ipv6info.sip));
+					memcpy(fdinfo->info.ipv6info.dip, diag->id.idiag_dst, sizeof(fdinfo->info.ipv6info.dip));
+					fdinfo->info.ipv6info.sport = ntohs(diag->id.idiag_sport);
+					fdinfo->info.ipv6info.dport = ntohs(diag->id.idiag_dport);
+					fdinfo->info.ipv6info.l4proto = l4proto;
+				}
+			}
+
+			HASH_ADD_INT64((*sockets), ino, fdinfo);
+			if(uth_status != SCAP_SUCCESS)
+			{
+				snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "socket table allocation error");
+				return SCAP_FAILURE;
+			}
+
+			added = true;
+		}
+	}
+
+dump_error:
+	if(added)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error reading the socket table from netlink");
+		return SCAP_FAILURE;
+	}
+
+	return SCAP_NOTFOUND;
+}
+#endif
+
+//
+// The socket tables read by scap_fd_read_sockets()
+//
+static const struct
+{
+	int family;
+	int protocol;
+	int l4proto;
+	char* proc_file;
+} g_socket_tables[] =
+{
+	{AF_INET, IPPROTO_TCP, SCAP_L4_TCP, "/proc/net/tcp"},
+	{AF_INET, IPPROTO_UDP, SCAP_L4_UDP, "/proc/net/udp"},
+	{AF_INET, IPPROTO_RAW, SCAP_L4_RAW, "/proc/net/raw"},
+	{AF_INET6, IPPROTO_TCP, SCAP_L4_TCP, "/proc/net/tcp6"},
+	{AF_INET6, IPPROTO_UDP, SCAP_L4_UDP, "/proc/net/udp6"},
+	{AF_INET6, IPPROTO_RAW, SCAP_L4_RAW, "/proc/net/raw6"},
+};
+
+//
+// Read the ip sockets from netlink where the kernel supports it, one table
+// at a time, and from /proc/net otherwise. The unix sockets always come
+// from /proc/net/unix, which is the only place with their kernel address.
+//
 int32_t scap_fd_read_sockets(scap_t *handle, scap_fdinfo **sockets)
 {
-	if(SCAP_FAILURE == scap_fd_read_ipv4_sockets_from_proc_fs(handle, "/proc/net/tcp", SCAP_L4_TCP, sockets) ||
-	        SCAP_FAILURE == scap_fd_read_ipv4_sockets_from_proc_fs(handle, "/proc/net/udp", SCAP_L4_UDP, sockets) ||
-	        SCAP_FAILURE == scap_fd_read_ipv4_sockets_from_proc_fs(handle, "/proc/net/raw", SCAP_L4_RAW, sockets) ||
-	        SCAP_FAILURE == scap_fd_read_unix_sockets_from_proc_fs(handle, sockets))
+	int nl_sock = -1;
+	char *nl_buf = NULL;
+	bool has_ipv6;
+	int32_t res = SCAP_SUCCESS;
+	uint32_t j;
+
+	/* We assume if there is /proc/net/tcp6 that ipv6 is avaiable */
+	has_ipv6 = (0 == access("/proc/net/tcp6", R_OK));
+
+#if !defined __sun
+	nl_sock = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_SOCK_DIAG);
+	if(nl_sock >= 0)
+	{
+		nl_buf = (char*)malloc(SOCKET_SCAN_BUFFER_SIZE);
+		if(nl_buf == NULL)
+		{
+			close(nl_sock);
+			nl_sock = -1;
+		}
+	}
+#endif
+
+	for(j = 0; j < sizeof(g_socket_tables) / sizeof(g_socket_tables[0]); j++)
+	{
+		if(g_socket_tables[j].family == AF_INET6 && !has_ipv6)
+		{
+			continue;
+		}
+
+		res = SCAP_NOTFOUND;
+
+#if !defined __sun
+		if(nl_sock >= 0)
+		{
+			res = scap_fd_read_inet_sockets_from_netlink(handle,
+				nl_sock,
+				nl_buf,
+				g_socket_tables[j].family,
+				g_socket_tables[j].protocol,
+				g_socket_tables[j].l4proto,
+				sockets);
+		}
+#endif
+
+		if(res == SCAP_NOTFOUND)
+		{
+			if(g_socket_tables[j].family == AF_INET)
+			{
+				res = scap_fd_read_ipv4_sockets_from_proc_fs(handle, g_socket_tables[j].proc_file, g_socket_tables[j].l4proto, sockets);
+			}
+			else
+			{
+				res = scap_fd_read_ipv6_sockets_from_proc_fs(handle, g_socket_tables[j].proc_file, g_socket_tables[j].l4proto, sockets);
+			}
+		}
+
+		if(res != SCAP_SUCCESS)
+		{
+			break;
+		}
+	}
+
+	if(nl_sock >= 0)
+	{
+		close(nl_sock);
+		free(nl_buf);
+	}
+
+	if(res == SCAP_SUCCESS)
+	{
+		res = scap_fd_read_unix_sockets_from_proc_fs(handle, sockets);
+	}
+
+	if(res != SCAP_SUCCESS)
 	{
 		scap_fd_free_table(handle, sockets);
 		return SCAP_FAILURE;
 	}
 
-    /* We assume if there is /proc/net/tcp6 that ipv6 is avaiable */
-    if(0 == access("/proc/net/tcp6", R_OK)) {
-        if(SCAP_FAILURE == scap_fd_read_ipv6_sockets_from_proc_fs(handle, "/proc/net/tcp6", SCAP_L4_TCP, sockets) ||
-        	SCAP_FAILURE == scap_fd_read_ipv6_sockets_from_proc_fs(handle, "/proc/net/udp6", SCAP_L4_UDP, sockets) ||
-	        SCAP_FAILURE == scap_fd_read_ipv6_sockets_from_proc_fs(handle, "/proc/net/raw6", SCAP_L4_RAW, sockets))
-    	{
-	    	scap_fd_free_table(handle, sockets);
-		    return SCAP_FAILURE;
-    	}
-    }
 	return SCAP_SUCCESS;
 }
 
@@ -1360,6 +1619,315 @@ int32_t scap_fd_scan_fd_dir(scap_t *handle, char *procdir, scap_threadinfo *tinf
 	return res;
 }
 
+//
+// Number of fds read with each PPM_IOCTL_GET_FD_TABLE
+//
+#define DRIVER_FD_TABLE_CHUNK 256
+
+//
+// Convert an fd table entry of the driver, the same way scap_fd_scan_fd_dir()
+// does with the files in /proc/<pid>/fd. Return false for the fds that the
+// fd tables don't keep.
+//
+static bool scap_fd_convert_driver_entry(struct ppm_fd_entry *entry, scap_fdinfo *fdi)
+{
+	entry->name[PPM_FD_NAME_LEN - 1] = 0;
+
+	switch(entry->mode & S_IFMT)
+	{
+	case S_IFIFO:
+		fdi->type = SCAP_FD_FIFO;
+		break;
+	case S_IFREG:
+	case S_IFBLK:
+	case S_IFCHR:
+	case S_IFLNK:
+		fdi->type = SCAP_FD_FILE;
+		break;
+	case S_IFDIR:
+		fdi->type = SCAP_FD_DIRECTORY;
+		break;
+	case S_IFSOCK:
+		if(entry->family != PPM_AF_INET && entry->family != PPM_AF_INET6 && entry->family != PPM_AF_UNIX)
+		{
+			//
+			// Like the netlink sockets, which aren't in the socket table
+			//
+			return false;
+		}
+
+		fdi->type = SCAP_FD_UNKNOWN;
+		break;
+	default:
+		fdi->type = SCAP_FD_UNSUPPORTED;
+		break;
+	}
+
+	fdi->fd = entry->fd;
+	fdi->ino = entry->ino;
+
+	if(fdi->type == SCAP_FD_UNKNOWN)
+	{
+		uint8_t l4proto;
+
+		if(entry->type == SOCK_RAW)
+		{
+			l4proto = SCAP_L4_RAW;
+		}
+		else if(entry->protocol == IPPROTO_TCP)
+		{
+			l4proto = SCAP_L4_TCP;
+		}
+		else if(entry->protocol == IPPROTO_UDP)
+		{
+			l4proto = SCAP_L4_UDP;
+		}
+		else if(entry->protocol == IPPROTO_ICMP)
+		{
+			l4proto = SCAP_L4_ICMP;
+		}
+		else
+		{
+			l4proto = SCAP_L4_UNKNOWN;
+		}
+
+		//
+		// Sockets without a peer are server sockets, like in the socket table
+		//
+		if(entry->family == PPM_AF_INET)
+		{
+			memcpy(&fdi->info.ipv4info.sip, entry->saddr, sizeof(uint32_t));
+			memcpy(&fdi->info.ipv4info.dip, entry->daddr, sizeof(uint32_t));
+			fdi->info.ipv4info.sport = entry->sport;
+			fdi->info.ipv4info.dport = entry->dport;
+
+			if(fdi->info.ipv4info.dip == 0)
+			{
+				fdi->type = SCAP_FD_IPV4_SERVSOCK;
+				fdi->info.ipv4serverinfo.l4proto = l4proto;
+				fdi->info.ipv4serverinfo.port = fdi->info.ipv4info.sport;
+				fdi->info.ipv4serverinfo.ip = fdi->info.ipv4info.sip;
+			}
+			else
+			{
+				fdi->type = SCAP_FD_IPV4_SOCK;
+				fdi->info.ipv4info.l4proto = l4proto;
+			}
+		}
+		else if(entry->family == PPM_AF_INET6)
+		{
+			memcpy(fdi->info.ipv6info.sip, entry->saddr, sizeof(fdi->info.ipv6info.sip));
+			memcpy(fdi->info.ipv6info.dip, entry->daddr, sizeof(fdi->info.ipv6info.dip));
+			fdi->info.ipv6info.sport = entry->sport;
+			fdi->info.ipv6info.dport = entry->dport;
+
+			if(scap_fd_is_ipv6_server_socket(fdi->info.ipv6info.dip))
+			{
+				fdi->type = SCAP_FD_IPV6_SERVSOCK;
+				fdi->info.ipv6serverinfo.l4proto = l4proto;
+				fdi->info.ipv6serverinfo.port = fdi->info.ipv6info.sport;
+				fdi->info.ipv6serverinfo.ip[0] = fdi->info.ipv6info.sip[0];
+				fdi->info.ipv6serverinfo.ip[1] = fdi->info.ipv6info.sip[1];
+				fdi->info.ipv6serverinfo.ip[2] = fdi->info.ipv6info.sip[2];
+				fdi->info.ipv6serverinfo.ip[3] = fdi->info.ipv6info.sip[3];
+			}
+			else
+			{
+				fdi->type = SCAP_FD_IPV6_SOCK;
+				fdi->info.ipv6info.l4proto = l4proto;
+			}
+		}
+		else
+		{
+			fdi->type = SCAP_FD_UNIX_SOCK;
+			memcpy(&fdi->info.unix_socket_info.source, entry->saddr, sizeof(uint64_t));
+			memcpy(&fdi->info.unix_socket_info.destination, entry->daddr, sizeof(uint64_t));
+			strncpy(fdi->info.unix_socket_info.fname, entry->name, SCAP_MAX_PATH_SIZE);
+		}
+	}
+	else if(fdi->type == SCAP_FD_UNSUPPORTED)
+	{
+		//
+		// Classify by link name, like scap_fd_handle_regular_file()
+		//
+		if(0 == strcmp(entry->name, "anon_inode:[eventfd]"))
+		{
+			fdi->type = SCAP_FD_EVENT;
+		}
+		else if(0 == strcmp(entry->name, "anon_inode:[signalfd]"))
+		{
+			fdi->type = SCAP_FD_SIGNALFD;
+		}
+		else if(0 == strcmp(entry->name, "anon_inode:[eventpoll]"))
+		{
+			fdi->type = SCAP_FD_EVENTPOLL;
+		}
+		else if(0 == strcmp(entry->name, "anon_inode:inotify"))
+		{
+			fdi->type = SCAP_FD_INOTIFY;
+		}
+		else if(0 == strcmp(entry->name, "anon_inode:[timerfd]"))
+		{
+			fdi->type = SCAP_FD_TIMERFD;
+		}
+
+		fdi->info.fname[0] = '\0';
+	}
+	else
+	{
+		strncpy(fdi->info.fname, entry->name, SCAP_MAX_PATH_SIZE);
+	}
+
+	return true;
+}
+
+static int32_t scap_fd_add_driver_entry(scap_t *handle, scap_threadinfo *tinfo, struct ppm_fd_entry *entry)
+{
+	scap_fdinfo *fdi = NULL;
+	int32_t res;
+
+	res = scap_fd_allocate_fdinfo(handle, &fdi, entry->fd, SCAP_FD_UNSUPPORTED);
+	if(res != SCAP_SUCCESS)
+	{
+		return res;
+	}
+
+	if(!scap_fd_convert_driver_entry(entry, fdi))
+	{
+		scap_fd_free_fdinfo(&fdi);
+		return SCAP_SUCCESS;
+	}
+
+	return scap_add_fd_to_proc_table(handle, tinfo, fdi);
+}
+
+//
+// Read the fd table of a process with PPM_IOCTL_GET_FD_TABLE, which returns
+// the type, inode, name and socket tuple of each fd, instead of reading the
+// links in /proc/<pid>/fd and parsing /proc/net to find the sockets.
+// SCAP_NOTFOUND means that the driver can't do it and that the caller
+// should scan /proc.
+//
+int32_t scap_fd_read_from_driver(scap_t *handle, scap_threadinfo *tinfo, char *error)
+{
+	struct ppm_fd_entry* entries;
+	struct ppm_fd_table table;
+	int32_t res = SCAP_SUCCESS;
+	uint32_t j;
+
+	if(handle->m_ndevs == 0 || !handle->m_driver_fd_table)
+	{
+		return SCAP_NOTFOUND;
+	}
+
+	entries = (struct ppm_fd_entry*)malloc(DRIVER_FD_TABLE_CHUNK * sizeof(struct ppm_fd_entry));
+	if(entries == NULL)
+	{
+		snprintf(error, SCAP_LASTERR_SIZE, "error allocating the fd table entries");
+		return SCAP_FAILURE;
+	}
+
+	table.tid = tinfo->tid;
+	table.start_fd = 0;
+	table.max_entries = DRIVER_FD_TABLE_CHUNK;
+	table.entries = (uint64_t)(unsigned long)entries;
+
+	while(table.start_fd != -1)
+	{
+		if(ioctl(handle->m_devs[0].m_fd, PPM_IOCTL_GET_FD_TABLE, &table))
+		{
+			if(errno == ESRCH)
+			{
+				snprintf(error, SCAP_LASTERR_SIZE, "tid %" PRId64 " doesn't exist anymore", tinfo->tid);
+				res = SCAP_FAILURE;
+			}
+			else
+			{
+				//
+				// An older driver. Don't try again.
+				//
+				handle->m_driver_fd_table = false;
+				res = SCAP_NOTFOUND;
+			}
+
+			break;
+		}
+
+		for(j = 0; j < table.n_entries && res == SCAP_SUCCESS; j++)
+		{
+			res = scap_fd_add_driver_entry(handle, tinfo, &entries[j]);
+		}
+
+		if(res != SCAP_SUCCESS)
+		{
+			break;
+		}
+	}
+
+	free(entries);
+
+	//
+	// Don't return a partial table
+	//
+	if(res != SCAP_SUCCESS)
+	{
+		scap_fd_free_proc_fd_table(handle, tinfo);
+	}
+
+	return res;
+}
+
+//
+// The parameters of PPME_FDSTATE_E are the fields of the ppm_fd_entry, see
+// PPM_IOCTL_DUMP_STATE
+//
+int32_t scap_fd_from_state_event(scap_evt* e, OUT scap_fdinfo* fdi)
+{
+	struct ppm_fd_entry entry;
+	uint16_t* lens = (uint16_t*)((char*)e + sizeof(struct ppm_evt_hdr));
+	char* p = (char*)(lens + 5);
+	uint32_t name_len;
+
+	if(e->type != PPME_FDSTATE_E || e->len < sizeof(struct ppm_evt_hdr) + 5 * sizeof(uint16_t) ||
+		lens[0] != sizeof(int64_t) || lens[1] != sizeof(uint64_t) || lens[2] != sizeof(uint32_t) ||
+		(lens[4] != 0 && lens[4] != PPM_FDSTATE_SOCK_LEN) ||
+		e->len != sizeof(struct ppm_evt_hdr) + 5 * sizeof(uint16_t) + lens[0] + lens[1] + lens[2] + lens[3] + lens[4])
+	{
+		return SCAP_NOTFOUND;
+	}
+
+	memset(&entry, 0, sizeof(entry));
+
+	memcpy(&entry.fd, p, sizeof(int64_t));
+	p += lens[0];
+	memcpy(&entry.ino, p, sizeof(uint64_t));
+	p += lens[1];
+	memcpy(&entry.mode, p, sizeof(uint32_t));
+	p += lens[2];
+	name_len = (lens[3] < PPM_FD_NAME_LEN)? lens[3] : PPM_FD_NAME_LEN;
+	memcpy(entry.name, p, name_len);
+	p += lens[3];
+
+	if(lens[4] != 0)
+	{
+		entry.family = p[0];
+		entry.type = p[1];
+		entry.protocol = p[2];
+		memcpy(&entry.sport, p + 3, sizeof(uint16_t));
+		memcpy(&entry.dport, p + 5, sizeof(uint16_t));
+		memcpy(entry.saddr, p + 7, sizeof(entry.saddr));
+		memcpy(entry.daddr, p + 23, sizeof(entry.daddr));
+	}
+
+	return scap_fd_convert_driver_entry(&entry, fdi)? SCAP_SUCCESS : SCAP_NOTFOUND;
+}
+
+#else // !defined(_WIN32) && !defined(__APPLE__)
+
+int32_t scap_fd_from_state_event(scap_evt* e, OUT scap_fdinfo* fdi)
+{
+	return SCAP_NOTFOUND;
+}
 
 #endif // _WIN32
 
@@ -0,0 +1,523 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "scap.h"
+#include "scap-int.h"
+#include "uthash.h"
+
+extern const struct ppm_event_info g_event_info[];
+
+//
+// Folding of repetitive syscalls. A thread that loops on poll(),
+// epoll_wait(), futex() or nanosleep() with the same arguments and the same
+// result generates lots of events that say nothing new. The first call of
+// such a run goes through; the calls that repeat it exactly are dropped and
+// counted, and a PPME_REPEAT_E event with the number of dropped events and
+// the time they span takes their place when the run ends.
+//
+// A call can only be dropped once its exit event shows that it repeated
+// the previous one, so the enter event of a candidate is held until then.
+// A held enter that turns out to be different is released right before its
+// exit: the order of the events of a thread never changes, but the held
+// enter can end up after the events of other threads.
+//
+
+//
+// Longer events, e.g. polls on many fds, are never folded
+//
+#define SCAP_FOLD_MAX_EVENT_LEN 256
+//
+// The longest run. It's also how long a thread can keep a run open or an
+// enter event held without generating other events
+//
+#define SCAP_FOLD_MAX_SPAN_NS 1000000000ULL
+//
+// Threads tracked at the same time. The events of the others go through
+//
+#define SCAP_FOLD_MAX_THREADS 65536
+
+typedef struct scap_fold_thread
+{
+	uint64_t m_tid;
+	char m_last_e[SCAP_FOLD_MAX_EVENT_LEN]; // Last enter event of a foldable call, if m_has_e
+	char m_last_x[SCAP_FOLD_MAX_EVENT_LEN]; // Its exit event, if m_has_x
+	bool m_has_e;
+	bool m_has_x;
+	bool m_held; // An enter event identical to m_last_e is being held
+	uint64_t m_held_ts;
+	uint16_t m_held_cpuid;
+	uint32_t m_count; // Events dropped in the current run, 0 if none
+	uint64_t m_first_ts; // Of the first dropped event
+	uint64_t m_last_ts; // Of the last dropped event
+	uint16_t m_cpuid; // Of the last dropped event
+	UT_hash_handle hh;
+}scap_fold_thread;
+
+typedef struct scap_fold_entry
+{
+	scap_evt* m_evt;
+	uint16_t m_cpuid;
+}scap_fold_entry;
+
+struct scap_fold
+{
+	scap_fold_thread* m_threads;
+	uint32_t m_nthreads;
+	//
+	// The events to return, and the buffers allocated for them. The
+	// buffers are freed when the next event comes in, so they stay valid
+	// as long as the events returned by scap_next()
+	//
+	scap_fold_entry* m_queue;
+	uint32_t m_queue_len;
+	uint32_t m_queue_size;
+	uint32_t m_queue_pos;
+	char** m_owned;
+	uint32_t m_nowned;
+	uint32_t m_owned_size;
+	uint64_t m_last_expire_ts;
+};
+
+struct scap_fold* scap_fold_create(char* error)
+{
+	struct scap_fold* f = (struct scap_fold*)calloc(1, sizeof(struct scap_fold));
+	if(f == NULL)
+	{
+		snprintf(error, SCAP_LASTERR_SIZE, "error allocating the folding state");
+		return NULL;
+	}
+
+	return f;
+}
+
+static void scap_fold_free_owned(struct scap_fold* f)
+{
+	uint32_t j;
+
+	for(j = 0; j < f->m_nowned; j++)
+	{
+		free(f->m_owned[j]);
+	}
+
+	f->m_nowned = 0;
+	f->m_queue_len = 0;
+	f->m_queue_pos = 0;
+}
+
+void scap_fold_reset(struct scap_fold* f)
+{
+	scap_fold_thread* t;
+	scap_fold_thread* tt;
+
+	HASH_ITER(hh, f->m_threads, t, tt)
+	{
+		HASH_DEL(f->m_threads, t);
+		free(t);
+	}
+
+	f->m_nthreads = 0;
+	f->m_last_expire_ts = 0;
+	scap_fold_free_owned(f);
+}
+
+void scap_fold_destroy(struct scap_fold* f)
+{
+	scap_fold_reset(f);
+
+	if(f->m_queue != NULL)
+	{
+		free(f->m_queue);
+	}
+
+	if(f->m_owned != NULL)
+	{
+		free(f->m_owned);
+	}
+
+	free(f);
+}
+
+static int32_t scap_fold_push(struct scap_fold* f, scap_evt* e, uint16_t cpuid, char* error)
+{
+	if(f->m_queue_len == f->m_queue_size)
+	{
+		uint32_t size = f->m_queue_size? f->m_queue_size * 2 : 16;
+		scap_fold_entry* queue = (scap_fold_entry*)realloc(f->m_queue, size * sizeof(scap_fold_entry));
+		if(queue == NULL)
+		{
+			snprintf(error, SCAP_LASTERR_SIZE, "error allocating the folding queue");
+			return SCAP_FAILURE;
+		}
+
+		f->m_queue = queue;
+		f->m_queue_size = size;
+	}
+
+	f->m_queue[f->m_queue_len].m_evt = e;
+	f->m_queue[f->m_queue_len].m_cpuid = cpuid;
+	f->m_queue_len++;
+	return SCAP_SUCCESS;
+}
+
+//
+// Allocate an event that lives until the queue is drained, and queue it
+//
+static scap_evt* scap_fold_push_new(struct scap_fold* f, uint32_t len, uint16_t cpuid, char* error)
+{
+	char* buf;
+
+	if(f->m_nowned == f->m_owned_size)
+	{
+		uint32_t size = f->m_owned_size? f->m_owned_size * 2 : 16;
+		char** owned = (char**)realloc(f->m_owned, size * sizeof(char*));
+		if(owned == NULL)
+		{
+			snprintf(error, SCAP_LASTERR_SIZE, "error allocating the folding queue");
+			return NULL;
+		}
+
+		f->m_owned = owned;
+		f->m_owned_size = size;
+	}
+
+	buf = (char*)malloc(len);
+	if(buf == NULL)
+	{
+		snprintf(error, SCAP_LASTERR_SIZE, "error allocating a folded event");
+		return NULL;
+	}
+
+	f->m_owned[f->m_nowned++] = buf;
+
+	if(scap_fold_push(f, (scap_evt*)buf, cpuid, error) != SCAP_SUCCESS)
+	{
+		return NULL;
+	}
+
+	return (scap_evt*)buf;
+}
+
+//
+// Queue the PPME_REPEAT_E event of the current run of a thread, if there's one
+//
+static int32_t scap_fold_end_run(struct scap_fold* f, scap_fold_thread* t, char* error)
+{
+	uint32_t len = sizeof(scap_evt) + 2 * sizeof(uint16_t) + sizeof(uint32_t) + sizeof(uint64_t);
+	uint64_t span;
+	scap_evt* e;
+	uint16_t* lens;
+	char* p;
+
+	if(t->m_count == 0)
+	{
+		return SCAP_SUCCESS;
+	}
+
+	e = scap_fold_push_new(f, len, t->m_cpuid, error);
+	if(e == NULL)
+	{
+		return SCAP_FAILURE;
+	}
+
+	e->ts = t->m_last_ts;
+	e->tid = t->m_tid;
+	e->len = len;
+	e->type = PPME_REPEAT_E;
+
+	lens = (uint16_t*)(e + 1);
+	lens[0] = sizeof(uint32_t);
+	lens[1] = sizeof(uint64_t);
+
+	span = t->m_last_ts - t->m_first_ts;
+	p = (char*)(lens + 2);
+	memcpy(p, &t->m_count, sizeof(uint32_t));
+	memcpy(p + sizeof(uint32_t), &span, sizeof(uint64_t));
+
+	t->m_count = 0;
+	return SCAP_SUCCESS;
+}
+
+//
+// Queue the enter event held by a thread, if there's one
+//
+static int32_t scap_fold_release(struct scap_fold* f, scap_fold_thread* t, char* error)
+{
+	scap_evt* last = (scap_evt*)t->m_last_e;
+	scap_evt* e;
+
+	if(!t->m_held)
+	{
+		return SCAP_SUCCESS;
+	}
+
+	e = scap_fold_push_new(f, last->len, t->m_held_cpuid, error);
+	if(e == NULL)
+	{
+		return SCAP_FAILURE;
+	}
+
+	memcpy(e, last, last->len);
+	e->ts = t->m_held_ts;
+
+	t->m_held = false;
+	return SCAP_SUCCESS;
+}
+
+//
+// End the runs and release the enter events of the threads that didn't
+// generate foldable events for SCAP_FOLD_MAX_SPAN_NS before ts
+//
+static int32_t scap_fold_expire_threads(struct scap_fold* f, uint64_t ts, char* error)
+{
+	scap_fold_thread* t;
+	scap_fold_thread* tt;
+
+	if(ts < f->m_last_expire_ts + SCAP_FOLD_MAX_SPAN_NS)
+	{
+		return SCAP_SUCCESS;
+	}
+
+	f->m_last_expire_ts = ts;
+
+	HASH_ITER(hh, f->m_threads, t, tt)
+	{
+		if(t->m_count != 0 && t->m_last_ts + SCAP_FOLD_MAX_SPAN_NS <= ts)
+		{
+			if(scap_fold_end_run(f, t, error) != SCAP_SUCCESS)
+			{
+				return SCAP_FAILURE;
+			}
+		}
+
+		if(t->m_held && t->m_held_ts + SCAP_FOLD_MAX_SPAN_NS <= ts)
+		{
+			if(scap_fold_release(f, t, error) != SCAP_SUCCESS)
+			{
+				return SCAP_FAILURE;
+			}
+		}
+	}
+
+	return SCAP_SUCCESS;
+}
+
+int32_t scap_fold_expire(struct scap_fold* f, uint64_t ts, char* error)
+{
+	ASSERT(f->m_queue_pos == f->m_queue_len);
+	scap_fold_free_owned(f);
+
+	return scap_fold_expire_threads(f, ts, error);
+}
+
+int32_t scap_fold_flush(struct scap_fold* f, char* error)
+{
+	scap_fold_thread* t;
+	scap_fold_thread* tt;
+
+	ASSERT(f->m_queue_pos == f->m_queue_len);
+	scap_fold_free_owned(f);
+
+	HASH_ITER(hh, f->m_threads, t, tt)
+	{
+		if(scap_fold_end_run(f, t, error) != SCAP_SUCCESS ||
+			scap_fold_release(f, t, error) != SCAP_SUCCESS)
+		{
+			return SCAP_FAILURE;
+		}
+	}
+
+	return SCAP_SUCCESS;
+}
+
+static inline bool scap_fold_is_foldable(scap_evt* e)
+{
+	if(e->len > SCAP_FOLD_MAX_EVENT_LEN || e->type >= PPM_EVENT_MAX)
+	{
+		return false;
+	}
+
+	return (g_event_info[e->type].flags & EF_WAITS) ||
+		e->type == PPME_SYSCALL_FUTEX_E ||
+		e->type == PPME_SYSCALL_FUTEX_X;
+}
+
+//
+// Same call with the same parameters, at any time
+//
+static inline bool scap_fold_is_same(scap_evt* e, char* last)
+{
+	scap_evt* le = (scap_evt*)last;
+
+	return e->type == le->type &&
+		e->len == le->len &&
+		memcmp(e + 1, le + 1, e->len - sizeof(scap_evt)) == 0;
+}
+
+int32_t scap_fold_event(struct scap_fold* f, scap_evt* e, uint16_t cpuid, char* error)
+{
+	scap_fold_thread* t;
+	uint64_t tid = e->tid;
+	bool foldable = scap_fold_is_foldable(e);
+	int32_t uth_status = SCAP_SUCCESS;
+
+	ASSERT(f->m_queue_pos == f->m_queue_len);
+	scap_fold_free_owned(f);
+
+	if(scap_fold_expire_threads(f, e->ts, error) != SCAP_SUCCESS)
+	{
+		return SCAP_FAILURE;
+	}
+
+	HASH_FIND_INT64(f->m_threads, &tid, t);
+
+	if(t == NULL)
+	{
+		if(!foldable || f->m_nthreads >= SCAP_FOLD_MAX_THREADS)
+		{
+			return scap_fold_push(f, e, cpuid, error);
+		}
+
+		t = (scap_fold_thread*)calloc(1, sizeof(scap_fold_thread));
+		if(t == NULL)
+		{
+			snprintf(error, SCAP_LASTERR_SIZE, "error allocating the folding state");
+			return SCAP_FAILURE;
+		}
+
+		t->m_tid = tid;
+		HASH_ADD_INT64(f->m_threads, m_tid, t);
+		if(uth_status != SCAP_SUCCESS)
+		{
+			free(t);
+			snprintf(error, SCAP_LASTERR_SIZE, "error allocating the folding state");
+			return SCAP_FAILURE;
+		}
+
+		f->m_nthreads++;
+	}
+
+	if(!foldable)
+	{
+		if(scap_fold_end_run(f, t, error) != SCAP_SUCCESS ||
+			scap_fold_release(f, t, error) != SCAP_SUCCESS ||
+			scap_fold_push(f, e, cpuid, error) != SCAP_SUCCESS)
+		{
+			return SCAP_FAILURE;
+		}
+
+		t->m_has_e = false;
+		t->m_has_x = false;
+
+		if(e->type == PPME_PROCEXIT_E)
+		{
+			HASH_DEL(f->m_threads, t);
+			free(t);
+			f->m_nthreads--;
+		}
+
+		return SCAP_SUCCESS;
+	}
+
+	if(!PPME_IS_EXIT(e->type))
+	{
+		//
+		// An enter after a held enter means that the exit was lost
+		//
+		if(scap_fold_release(f, t, error) != SCAP_SUCCESS)
+		{
+			return SCAP_FAILURE;
+		}
+
+		if(t->m_has_x && scap_fold_is_same(e, t->m_last_e))
+		{
+			t->m_held = true;
+			t->m_held_ts = e->ts;
+			t->m_held_cpuid = cpuid;
+			return SCAP_SUCCESS;
+		}
+
+		if(scap_fold_end_run(f, t, error) != SCAP_SUCCESS)
+		{
+			return SCAP_FAILURE;
+		}
+
+		memcpy(t->m_last_e, e, e->len);
+		t->m_has_e = true;
+		t->m_has_x = false;
+		return scap_fold_push(f, e, cpuid, error);
+	}
+
+	if(t->m_held && scap_fold_is_same(e, t->m_last_x))
+	{
+		if(t->m_count == 0)
+		{
+			t->m_first_ts = t->m_held_ts;
+		}
+
+		t->m_count += 2;
+		t->m_last_ts = e->ts;
+		t->m_cpuid = cpuid;
+		t->m_held = false;
+
+		if(t->m_last_ts - t->m_first_ts >= SCAP_FOLD_MAX_SPAN_NS)
+		{
+			return scap_fold_end_run(f, t, error);
+		}
+
+		return SCAP_SUCCESS;
+	}
+
+	if(scap_fold_end_run(f, t, error) != SCAP_SUCCESS ||
+		scap_fold_release(f, t, error) != SCAP_SUCCESS ||
+		scap_fold_push(f, e, cpuid, error) != SCAP_SUCCESS)
+	{
+		return SCAP_FAILURE;
+	}
+
+	//
+	// Only the exit of the last enter can start a run
+	//
+	if(t->m_has_e && e->type == ((scap_evt*)t->m_last_e)->type + 1)
+	{
+		memcpy(t->m_last_x, e, e->len);
+		t->m_has_x = true;
+	}
+	else
+	{
+		t->m_has_e = false;
+		t->m_has_x = false;
+	}
+
+	return SCAP_SUCCESS;
+}
+
+bool scap_fold_pop(struct scap_fold* f, OUT scap_evt** pevent, OUT uint16_t* pcpuid)
+{
+	if(f->m_queue_pos == f->m_queue_len)
+	{
+		return false;
+	}
+
+	*pevent = f->m_queue[f->m_queue_pos].m_evt;
+	*pcpuid = f->m_queue[f->m_queue_pos].m_cpuid;
+	f->m_queue_pos++;
+	return true;
+}
@@ -0,0 +1,487 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "scap.h"
+#include "scap-int.h"
+#include "uthash.h"
+
+extern const struct ppm_event_info g_event_info[];
+
+//
+// Several trace files, or remote captures, read as one. Each source is a
+// handle of its own, and the merge handle returns their events ordered by
+// timestamp, with a min-heap of the sources that have an event ready.
+//
+// The thread ids of the sources can collide, so the ones of source n are
+// moved to their own range with SCAP_TID_FROM_SOURCE(), in the events and in
+// the process table. Source 0 keeps its ids.
+//
+
+typedef struct scap_merge_source
+{
+	scap_t* m_handle;
+	scap_evt* m_evt; // Next event of the source, if it's in the heap
+	uint16_t m_cpuid;
+}scap_merge_source;
+
+struct scap_merge
+{
+	scap_merge_source* m_sources;
+	uint32_t m_nsources;
+	uint32_t* m_heap; // Sources with an event ready, ordered by its timestamp
+	uint32_t m_heap_size;
+	int32_t m_last; // Source of the last event returned, to read again at the next call. -1 if none
+};
+
+//
+// Ties are broken by source number, so the order doesn't depend on how the
+// heap was built
+//
+static inline bool scap_merge_src_less(struct scap_merge* m, uint32_t s1, uint32_t s2)
+{
+	uint64_t ts1 = m->m_sources[s1].m_evt->ts;
+	uint64_t ts2 = m->m_sources[s2].m_evt->ts;
+
+	return ts1 < ts2 || (ts1 == ts2 && s1 < s2);
+}
+
+static void scap_merge_src_sift_down(struct scap_merge* m, uint32_t pos)
+{
+	uint32_t* heap = m->m_heap;
+	uint32_t size = m->m_heap_size;
+	uint32_t src = heap[pos];
+
+	while(true)
+	{
+		uint32_t child = 2 * pos + 1;
+
+		if(child >= size)
+		{
+			break;
+		}
+
+		if(child + 1 < size && scap_merge_src_less(m, heap[child + 1], heap[child]))
+		{
+			child++;
+		}
+
+		if(!scap_merge_src_less(m, heap[child], src))
+		{
+			break;
+		}
+
+		heap[pos] = heap[child];
+		pos = child;
+	}
+
+	heap[pos] = src;
+}
+
+static void scap_merge_src_push(struct scap_merge* m, uint32_t src)
+{
+	uint32_t* heap = m->m_heap;
+	uint32_t pos = m->m_heap_size++;
+
+	while(pos > 0)
+	{
+		uint32_t parent = (pos - 1) / 2;
+
+		if(!scap_merge_src_less(m, src, heap[parent]))
+		{
+			break;
+		}
+
+		heap[pos] = heap[parent];
+		pos = parent;
+	}
+
+	heap[pos] = src;
+}
+
+//
+// Move the thread ids of an event to the range of its source: the one in the
+// header, and the parameters that are thread ids, like the child of a clone
+//
+static void scap_merge_remap_event(scap_evt* e, uint32_t src)
+{
+	const struct ppm_event_info* info;
+	uint16_t* lens;
+	char* p;
+	uint32_t j;
+	int64_t v;
+
+	e->tid = SCAP_TID_FROM_SOURCE((int64_t)e->tid, src);
+
+	if(e->type >= PPM_EVENT_MAX)
+	{
+		return;
+	}
+
+	info = &g_event_info[e->type];
+	lens = (uint16_t*)((char*)e + sizeof(struct ppm_evt_hdr));
+	p = (char*)lens + info->nparams * sizeof(uint16_t);
+
+	for(j = 0; j < info->nparams; j++)
+	{
+		if(p + lens[j] > (char*)e + e->len)
+		{
+			break;
+		}
+
+		if(info->params[j].type == PT_PID && lens[j] == sizeof(int64_t))
+		{
+			memcpy(&v, p, sizeof(v));
+			v = SCAP_TID_FROM_SOURCE(v, src);
+			memcpy(p, &v, sizeof(v));
+		}
+
+		p += lens[j];
+	}
+}
+
+//
+// Read the next event of a source and put the source in the heap, unless
+// it's over
+//
+static int32_t scap_merge_read(scap_t* handle, uint32_t src)
+{
+	scap_merge_source* s = &handle->m_merge->m_sources[src];
+	int32_t res;
+
+	res = scap_next(s->m_handle, &s->m_evt, &s->m_cpuid);
+
+	if(res == SCAP_EOF)
+	{
+		s->m_evt = NULL;
+		return SCAP_SUCCESS;
+	}
+	else if(res != SCAP_SUCCESS)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "source %u: %s", src, scap_getlasterr(s->m_handle));
+		return SCAP_FAILURE;
+	}
+
+	if(src != 0)
+	{
+		scap_merge_remap_event(s->m_evt, src);
+	}
+
+	scap_merge_src_push(handle->m_merge, src);
+	return SCAP_SUCCESS;
+}
+
+int32_t scap_next_merge(scap_t* handle, OUT scap_evt** pevent, OUT uint16_t* pcpuid)
+{
+	struct scap_merge* m = handle->m_merge;
+	uint32_t src;
+
+	//
+	// The last event returned stays valid until now
+	//
+	if(m->m_last >= 0)
+	{
+		src = (uint32_t)m->m_last;
+		m->m_last = -1;
+
+		if(scap_merge_read(handle, src) != SCAP_SUCCESS)
+		{
+			return SCAP_FAILURE;
+		}
+	}
+
+	if(m->m_heap_size == 0)
+	{
+		return SCAP_EOF;
+	}
+
+	src = m->m_heap[0];
+	m->m_heap[0] = m->m_heap[--m->m_heap_size];
+
+	if(m->m_heap_size != 0)
+	{
+		scap_merge_src_sift_down(m, 0);
+	}
+
+	*pevent = m->m_sources[src].m_evt;
+	*pcpuid = m->m_sources[src].m_cpuid;
+	m->m_last = (int32_t)src;
+
+	return SCAP_SUCCESS;
+}
+
+//
+// Move the process table of a source into the one of the merge handle
+//
+static int32_t scap_merge_import_procs(scap_t* handle, uint32_t src, char* error)
+{
+	scap_t* h = handle->m_merge->m_sources[src].m_handle;
+	scap_threadinfo* tinfo;
+	scap_threadinfo* ttinfo;
+	int32_t uth_status = SCAP_SUCCESS;
+
+	HASH_ITER(hh, h->m_proclist, tinfo, ttinfo)
+	{
+		HASH_DEL(h->m_proclist, tinfo);
+
+		tinfo->tid = SCAP_TID_FROM_SOURCE((int64_t)tinfo->tid, src);
+		tinfo->pid = SCAP_TID_FROM_SOURCE((int64_t)tinfo->pid, src);
+		tinfo->ptid = SCAP_TID_FROM_SOURCE((int64_t)tinfo->ptid, src);
+
+		HASH_ADD_INT64(handle->m_proclist, tid, tinfo);
+		if(uth_status != SCAP_SUCCESS)
+		{
+			scap_proc_free(handle, tinfo);
+			snprintf(error, SCAP_LASTERR_SIZE, "process table allocation error");
+			return SCAP_FAILURE;
+		}
+	}
+
+	return SCAP_SUCCESS;
+}
+
+//
+// The interfaces of all the sources, so that the connections between them
+// are seen as local on both ends
+//
+static int32_t scap_merge_import_ifaddrs(scap_t* handle)
+{
+	struct scap_merge* m = handle->m_merge;
+	scap_addrlist* al;
+	scap_addrlist* sal;
+	uint32_t j;
+
+	al = (scap_addrlist*)calloc(1, sizeof(scap_addrlist));
+	if(al == NULL)
+	{
+		return SCAP_FAILURE;
+	}
+
+	handle->m_addrlist = al;
+
+	for(j = 0; j < m->m_nsources; j++)
+	{
+		sal = m->m_sources[j].m_handle->m_addrlist;
+
+		if(sal != NULL)
+		{
+			al->n_v4_addrs += sal->n_v4_addrs;
+			al->n_v6_addrs += sal->n_v6_addrs;
+		}
+	}
+
+	al->v4list = (scap_ifinfo_ipv4*)malloc((al->n_v4_addrs + 1) * sizeof(scap_ifinfo_ipv4));
+	al->v6list = (scap_ifinfo_ipv6*)malloc((al->n_v6_addrs + 1) * sizeof(scap_ifinfo_ipv6));
+	if(al->v4list == NULL || al->v6list == NULL)
+	{
+		return SCAP_FAILURE;
+	}
+
+	al->n_v4_addrs = 0;
+	al->n_v6_addrs = 0;
+
+	for(j = 0; j < m->m_nsources; j++)
+	{
+		sal = m->m_sources[j].m_handle->m_addrlist;
+
+		if(sal == NULL)
+		{
+			continue;
+		}
+
+		memcpy(al->v4list + al->n_v4_addrs, sal->v4list, sal->n_v4_addrs * sizeof(scap_ifinfo_ipv4));
+		memcpy(al->v6list + al->n_v6_addrs, sal->v6list, sal->n_v6_addrs * sizeof(scap_ifinfo_ipv6));
+		al->n_v4_addrs += sal->n_v4_addrs;
+		al->n_v6_addrs += sal->n_v6_addrs;
+		al->totlen += sal->totlen;
+	}
+
+	return SCAP_SUCCESS;
+}
+
+int32_t scap_merge_init(scap_t* handle, const char** fnames, uint32_t nfiles, char* error)
+{
+	struct scap_merge* m;
+	const scap_machine_info* mi;
+	scap_t* h;
+	uint32_t j;
+
+	if(nfiles == 0 || nfiles > SCAP_MAX_MERGE_SOURCES)
+	{
+		snprintf(error, SCAP_LASTERR_SIZE, "can't merge %u sources, the limit is %u", nfiles, SCAP_MAX_MERGE_SOURCES);
+		return SCAP_FAILURE;
+	}
+
+	m = (struct scap_merge*)calloc(1, sizeof(struct scap_merge));
+	if(m == NULL)
+	{
+		snprintf(error, SCAP_LASTERR_SIZE, "error allocating the merge state");
+		return SCAP_FAILURE;
+	}
+
+	handle->m_merge = m;
+	m->m_last = -1;
+
+	m->m_sources = (scap_merge_source*)calloc(nfiles, sizeof(scap_merge_source));
+	m->m_heap = (uint32_t*)malloc(nfiles * sizeof(uint32_t));
+	if(m->m_sources == NULL || m->m_heap == NULL)
+	{
+		snprintf(error, SCAP_LASTERR_SIZE, "error allocating the merge state");
+		return SCAP_FAILURE;
+	}
+
+	//
+	// Remote sources block until their agent connects, so they are
+	// accepted in order
+	//
+	for(j = 0; j < nfiles; j++)
+	{
+		if(scap_is_remote_name(fnames[j]))
+		{
+			h = scap_open_remote(fnames[j], error);
+		}
+		else
+		{
+			h = scap_open_offline((char*)fnames[j], error);
+		}
+
+		if(h == NULL)
+		{
+			return SCAP_FAILURE;
+		}
+
+		m->m_sources[j].m_handle = h;
+		m->m_nsources++;
+	}
+
+	//
+	// The machine is the first one, with enough CPUs for all the sources
+	//
+	for(j = 0; j < nfiles; j++)
+	{
+		mi = scap_get_machine_info(m->m_sources[j].m_handle);
+
+		if(mi == NULL)
+		{
+			continue;
+		}
+
+		if(handle->m_machine_info.num_cpus == (uint32_t)-1)
+		{
+			handle->m_machine_info = *mi;
+		}
+		else if(mi->num_cpus > handle->m_machine_info.num_cpus)
+		{
+			handle->m_machine_info.num_cpus = mi->num_cpus;
+		}
+	}
+
+	for(j = 0; j < nfiles; j++)
+	{
+		if(scap_merge_import_procs(handle, j, error) != SCAP_SUCCESS)
+		{
+			return SCAP_FAILURE;
+		}
+	}
+
+	if(scap_merge_import_ifaddrs(handle) != SCAP_SUCCESS)
+	{
+		snprintf(error, SCAP_LASTERR_SIZE, "error allocating the interface list");
+		return SCAP_FAILURE;
+	}
+
+	//
+	// The users are the ones of the first source, the ids of the other
+	// machines can mean something else
+	//
+	handle->m_userlist = m->m_sources[0].m_handle->m_userlist;
+	m->m_sources[0].m_handle->m_userlist = NULL;
+
+	for(j = 0; j < nfiles; j++)
+	{
+		if(scap_merge_read(handle, j) != SCAP_SUCCESS)
+		{
+			snprintf(error, SCAP_LASTERR_SIZE, "%s", handle->m_lasterr);
+			return SCAP_FAILURE;
+		}
+	}
+
+	return SCAP_SUCCESS;
+}
+
+int32_t scap_merge_set_decoders(scap_t* handle, uint32_t ndecoders)
+{
+	struct scap_merge* m = handle->m_merge;
+	uint32_t j;
+
+	for(j = 0; j < m->m_nsources; j++)
+	{
+		scap_t* h = m->m_sources[j].m_handle;
+
+		if(scap_enable_decoders(h, ndecoders) != SCAP_SUCCESS)
+		{
+			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "%s", h->m_lasterr);
+			return SCAP_FAILURE;
+		}
+	}
+
+	return SCAP_SUCCESS;
+}
+
+void scap_merge_close(scap_t* handle)
+{
+	struct scap_merge* m = handle->m_merge;
+	uint32_t j;
+
+	if(m == NULL)
+	{
+		return;
+	}
+
+	for(j = 0; j < m->m_nsources; j++)
+	{
+		scap_close(m->m_sources[j].m_handle);
+	}
+
+	free(m->m_sources);
+	free(m->m_heap);
+	free(m);
+	handle->m_merge = NULL;
+}
+
+uint32_t scap_get_nsources(scap_t* handle)
+{
+	return (handle->m_merge != NULL)? handle->m_merge->m_nsources : 1;
+}
+
+const scap_machine_info* scap_get_source_machine_info(scap_t* handle, uint32_t source)
+{
+	if(handle->m_merge == NULL)
+	{
+		return (source == 0)? scap_get_machine_info(handle) : NULL;
+	}
+
+	if(source >= handle->m_merge->m_nsources)
+	{
+		return NULL;
+	}
+
+	return scap_get_machine_info(handle->m_merge->m_sources[source].m_handle);
+}
@@ -18,17 +18,21 @@ along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #ifndef _WIN32
 #include <unistd.h>
 #include <sys/param.h>
+#include <sys/stat.h>
 #include <dirent.h>
 #include <sys/resource.h>
 #include <sys/syscall.h>
+#include <pthread.h>
 #endif
 
 #include "scap.h"
 
 #include "scap-int.h"
+#include "scap_savefile.h"
 
 #if !defined(_WIN32) && !defined(__APPLE__)
 int32_t scap_proc_fill_cwd(char* procdirname, struct scap_threadinfo* tinfo)
@@ -48,30 +52,47 @@ int32_t scap_proc_fill_cwd(char* procdirname, struct scap_threadinfo* tinfo)
 	return SCAP_SUCCESS;
 }
 
-int32_t scap_proc_fill_info_from_stats(char* procdirname, struct scap_threadinfo* tinfo)
+//
+// Read the command name, and unless name_only is set the user id, group id
+// and ppid, from <procdirname>status
+//
+int32_t scap_proc_fill_info_from_stats(char* procdirname, struct scap_threadinfo* tinfo, bool name_only)
 {
 	char filename[SCAP_MAX_PATH_SIZE];
 	uint32_t nfound = 0;
+	uint32_t nwanted = name_only? 1 : 4;
 	uint32_t tmp;
 	uint32_t uid;
 	uint64_t ppid;
-	char line[128];
+	char line[SCAP_MAX_PATH_SIZE];
 
-	tinfo->uid = (uint32_t)-1;
-	tinfo->ptid = (uint32_t)-1LL;
+	if(!name_only)
+	{
+		tinfo->uid = (uint32_t)-1;
+		tinfo->ptid = (uint32_t)-1LL;
+	}
 
 	snprintf(filename, sizeof(filename), "%sstatus", procdirname);
 
 	FILE* f = fopen(filename, "r");
 	if(f == NULL)
 	{
-		ASSERT(false);
 		return SCAP_FAILURE;
 	}
 
 	while(fgets(line, sizeof(line), f) != NULL)
 	{
-		if(strstr(line, "Uid") == line)
+		if(strstr(line, "Name:") == line)
+		{
+			nfound++;
+			line[SCAP_MAX_PATH_SIZE - 1] = 0;
+			sscanf(line, "Name:%s", tinfo->comm);
+		}
+		else if(name_only)
+		{
+			break;
+		}
+		else if(strstr(line, "Uid") == line)
 		{
 			nfound++;
 
@@ -111,15 +132,90 @@ int32_t scap_proc_fill_info_from_stats(char* procdirname, struct scap_threadinfo
 			}
 		}
 
-		if(nfound == 3)
+		if(nfound == nwanted)
 		{
 			break;
 		}
 	}
 
-	ASSERT(nfound == 3);
+	ASSERT(nfound == nwanted);
+
+	fclose(f);
+	return SCAP_SUCCESS;
+}
+
+//
+// Read the cgroup of a process from <procdirname>cgroup. Each line is
+// "hierarchy:controllers:path". We keep the path of the cpu controller,
+// which every container runtime sets up with cgroup v1, or else the one of
+// the unified hierarchy of cgroup v2, which has no controllers. Return false
+// if the process is gone.
+//
+static bool scap_proc_read_cgroup(const char* filename, OUT char* cgroup, uint32_t len)
+{
+	char line[SCAP_MAX_PATH_SIZE];
+	bool found = false;
+	FILE* f;
+
+	cgroup[0] = 0;
+
+	f = fopen(filename, "r");
+	if(f == NULL)
+	{
+		return false;
+	}
+
+	while(!found && fgets(line, sizeof(line), f) != NULL)
+	{
+		char* controllers = strchr(line, ':');
+		char* path;
+		char* tok;
+		char* saveptr;
+		size_t plen;
+
+		if(controllers == NULL)
+		{
+			continue;
+		}
+
+		controllers++;
+		path = strchr(controllers, ':');
+		if(path == NULL)
+		{
+			continue;
+		}
+
+		*path++ = 0;
+		plen = strcspn(path, "\n");
+		path[plen] = 0;
+
+		if(controllers[0] == 0)
+		{
+			snprintf(cgroup, len, "%s", path);
+			continue;
+		}
+
+		for(tok = strtok_r(controllers, ",", &saveptr); tok != NULL; tok = strtok_r(NULL, ",", &saveptr))
+		{
+			if(strcmp(tok, "cpu") == 0)
+			{
+				snprintf(cgroup, len, "%s", path);
+				found = true;
+				break;
+			}
+		}
+	}
 
 	fclose(f);
+	return true;
+}
+
+int32_t scap_proc_fill_cgroup(char* procdirname, struct scap_threadinfo* tinfo)
+{
+	char filename[SCAP_MAX_PATH_SIZE];
+
+	snprintf(filename, sizeof(filename), "%scgroup", procdirname);
+	scap_proc_read_cgroup(filename, tinfo->cgroup, sizeof(tinfo->cgroup));
 	return SCAP_SUCCESS;
 }
 
@@ -159,6 +255,7 @@ int32_t scap_proc_add_from_proc(scap_t* handle, uint32_t tid, int parenttid, int
 	char filename[252];
 	char line[SCAP_MAX_PATH_SIZE];
 	struct scap_threadinfo* tinfo;
+	struct scap_threadinfo* main_tinfo = NULL;
 	int32_t uth_status = SCAP_SUCCESS;
 	FILE* f;
 	size_t filesize;
@@ -222,31 +319,25 @@ int32_t scap_proc_add_from_proc(scap_t* handle, uint32_t tid, int parenttid, int
 	snprintf(tinfo->exe, SCAP_MAX_PATH_SIZE, "%s", target_name);
 
 	//
-	// Gather the command name
+	// The threads of a scan of /proc come right after their process, and
+	// share its ids, its file limit and, unless they were created without
+	// CLONE_FS, its working directory. They are copied instead of being
+	// read again for each thread.
 	//
-	snprintf(filename, sizeof(filename), "%sstatus", dir_name);
+	if(parenttid != -1 && tid_to_scan == -1 && tinfo->tid != tinfo->pid)
+	{
+		HASH_FIND_INT64(handle->m_proclist, &tinfo->pid, main_tinfo);
+	}
 
-	f = fopen(filename, "r");
-	if(f == NULL)
+	//
+	// Gather the command name, and the ids
+	//
+	if(SCAP_FAILURE == scap_proc_fill_info_from_stats(dir_name, tinfo, main_tinfo != NULL))
 	{
-		snprintf(error, SCAP_LASTERR_SIZE, "can't open %s", filename);
+		scap_errprintf(error, "can't read %sstatus", dir_name);
 		free(tinfo);
 		return SCAP_FAILURE;
 	}
-	else
-	{
-		if(fgets(line, SCAP_MAX_PATH_SIZE, f) == NULL)
-		{
-			snprintf(error, SCAP_LASTERR_SIZE, "can't read from %s", filename);
-			fclose(f);
-			free(tinfo);
-			return SCAP_FAILURE;
-		}
-
-		line[SCAP_MAX_PATH_SIZE - 1] = 0;
-		sscanf(line, "Name:%s", tinfo->comm);
-		fclose(f);
-	}
 
 	//
 	// Gather the command line
@@ -256,7 +347,7 @@ int32_t scap_proc_add_from_proc(scap_t* handle, uint32_t tid, int parenttid, int
 	f = fopen(filename, "r");
 	if(f == NULL)
 	{
-		snprintf(error, SCAP_LASTERR_SIZE, "can't open %s", filename);
+		scap_errprintf(error, "can't open %s", filename);
 		free(tinfo);
 		return SCAP_FAILURE;
 	}
@@ -283,36 +374,39 @@ int32_t scap_proc_add_from_proc(scap_t* handle, uint32_t tid, int parenttid, int
 		fclose(f);
 	}
 
-	//
-	// set the current working directory of the process
-	//
-	if(SCAP_FAILURE == scap_proc_fill_cwd(dir_name, tinfo))
+	if(main_tinfo != NULL)
 	{
-		snprintf(error, SCAP_LASTERR_SIZE, "can't fill cwd for %s", dir_name);
-		free(tinfo);
-		return SCAP_FAILURE;
+		tinfo->uid = main_tinfo->uid;
+		tinfo->gid = main_tinfo->gid;
+		tinfo->ptid = main_tinfo->ptid;
+		tinfo->fdlimit = main_tinfo->fdlimit;
+		snprintf(tinfo->cwd, sizeof(tinfo->cwd), "%s", main_tinfo->cwd);
 	}
-
-	//
-	// extract the user id and ppid from /proc/pid/status
-	//
-	if(SCAP_FAILURE == scap_proc_fill_info_from_stats(dir_name, tinfo))
+	else
 	{
-		snprintf(error, SCAP_LASTERR_SIZE, "can't fill cwd for %s", dir_name);
-		free(tinfo);
-		return SCAP_FAILURE;
-	}
+		//
+		// set the current working directory of the process
+		//
+		if(SCAP_FAILURE == scap_proc_fill_cwd(dir_name, tinfo))
+		{
+			scap_errprintf(error, "can't fill cwd for %s", dir_name);
+			free(tinfo);
+			return SCAP_FAILURE;
+		}
 
-	//
-	// Set the file limit
-	//
-	if(SCAP_FAILURE == scap_proc_fill_flimit(tinfo->tid, tinfo))
-	{
-		snprintf(error, SCAP_LASTERR_SIZE, "can't fill flimit for %s", dir_name);
-		free(tinfo);
-		return SCAP_FAILURE;
+		//
+		// Set the file limit
+		//
+		if(SCAP_FAILURE == scap_proc_fill_flimit(tinfo->tid, tinfo))
+		{
+			scap_errprintf(error, "can't fill flimit for %s", dir_name);
+			free(tinfo);
+			return SCAP_FAILURE;
+		}
 	}
 
+	scap_proc_fill_cgroup(dir_name, tinfo);
+
 	//
 	// if tid_to_scan is set we assume is a runtime lookup so no
 	// need to use the table
@@ -345,6 +439,273 @@ int32_t scap_proc_add_from_proc(scap_t* handle, uint32_t tid, int parenttid, int
 	return SCAP_SUCCESS;
 }
 
+//
+// Parallel scan of /proc.
+// The processes are listed first, then the workers take them in turn and add
+// them, with their threads and fds, to the table of a private handle. The
+// socket table is read once, and only looked up by the workers. The private
+// tables are moved to the one of the handle at the end.
+//
+#define SCAP_PROC_SCAN_MAX_WORKERS 8
+#define SCAP_PROC_SCAN_MIN_PROCS_PER_WORKER 32
+
+struct scap_proc_scan_job
+{
+	scap_t* m_handle; // The handle that started the scan
+	uint64_t* m_tids;
+	uint32_t m_ntids;
+	volatile uint32_t m_next; // Next entry of m_tids to scan
+	volatile bool m_failed;
+	scap_fdinfo* m_sockets;
+	bool m_scan_sockets;
+};
+
+struct scap_proc_scan_worker
+{
+	pthread_t m_thread;
+	struct scap_proc_scan_job* m_job;
+	int32_t m_res;
+	scap_t m_handle; // Only m_proclist, m_lasterr and m_proc_scan_stop are used
+};
+
+//
+// Add a process, its threads and its fds, like an iteration of
+// scap_proc_scan_proc_dir() on /proc
+//
+static int32_t scap_proc_scan_one(scap_t* handle, uint64_t tid, scap_fdinfo* sockets, bool scan_sockets, char* error)
+{
+	char childdir[SCAP_MAX_PATH_SIZE];
+	int32_t res;
+
+	res = scap_proc_add_from_proc(handle, tid, -1, -1, "/proc", sockets, NULL, error);
+	if(res != SCAP_SUCCESS)
+	{
+		snprintf(error, SCAP_LASTERR_SIZE, "cannot add procs tid = %"PRIu64", parenttid = -1, dirname = /proc", tid);
+		return res;
+	}
+
+	snprintf(childdir, sizeof(childdir), "/proc/%u/task", (int)tid);
+	if(scap_proc_scan_proc_dir(handle, childdir, tid, -1, NULL, error, scan_sockets) == SCAP_FAILURE)
+	{
+		return SCAP_FAILURE;
+	}
+
+	return SCAP_SUCCESS;
+}
+
+static void* scap_proc_scan_worker_thread(void* arg)
+{
+	struct scap_proc_scan_worker* worker = (struct scap_proc_scan_worker*)arg;
+	struct scap_proc_scan_job* job = worker->m_job;
+	uint32_t j;
+
+	worker->m_res = SCAP_SUCCESS;
+
+	while(!job->m_failed)
+	{
+		if(job->m_handle->m_proc_scan_stop)
+		{
+			snprintf(worker->m_handle.m_lasterr, SCAP_LASTERR_SIZE, "scan of /proc interrupted");
+			worker->m_res = SCAP_FAILURE;
+			job->m_failed = true;
+			break;
+		}
+
+		j = __sync_fetch_and_add(&job->m_next, 1);
+		if(j >= job->m_ntids)
+		{
+			break;
+		}
+
+		worker->m_res = scap_proc_scan_one(&worker->m_handle,
+			job->m_tids[j],
+			job->m_sockets,
+			job->m_scan_sockets,
+			worker->m_handle.m_lasterr);
+
+		if(worker->m_res != SCAP_SUCCESS)
+		{
+			job->m_failed = true;
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+//
+// Move the processes found by a worker to the table of the handle
+//
+static int32_t scap_proc_scan_merge(scap_t* handle, scap_t* worker_handle, char* error)
+{
+	struct scap_threadinfo* tinfo;
+	struct scap_threadinfo* ttinfo;
+	struct scap_threadinfo* cur;
+	int32_t uth_status = SCAP_SUCCESS;
+
+	HASH_ITER(hh, worker_handle->m_proclist, tinfo, ttinfo)
+	{
+		HASH_FIND_INT64(handle->m_proclist, &tinfo->tid, cur);
+		if(cur != NULL)
+		{
+			ASSERT(false);
+			snprintf(error, SCAP_LASTERR_SIZE, "duplicate process %"PRIu64, tinfo->tid);
+			return SCAP_FAILURE;
+		}
+
+		HASH_DEL(worker_handle->m_proclist, tinfo);
+		HASH_ADD_INT64(handle->m_proclist, tid, tinfo);
+		if(uth_status != SCAP_SUCCESS)
+		{
+			snprintf(error, SCAP_LASTERR_SIZE, "process table allocation error (2)");
+			scap_proc_free(handle, tinfo);
+			return SCAP_FAILURE;
+		}
+	}
+
+	return SCAP_SUCCESS;
+}
+
+static int32_t scap_proc_scan_parallel(scap_t* handle, DIR* dir_p, scap_fdinfo* sockets, char* error, bool scan_sockets)
+{
+	struct dirent *dir_entry_p;
+	struct scap_proc_scan_job job;
+	struct scap_proc_scan_worker* workers;
+	uint32_t tids_size = 0;
+	uint32_t nworkers;
+	uint32_t nstarted;
+	uint32_t j;
+	long ncpus;
+	int32_t res = SCAP_SUCCESS;
+
+	memset(&job, 0, sizeof(job));
+	job.m_handle = handle;
+	job.m_sockets = sockets;
+	job.m_scan_sockets = scan_sockets;
+
+	while((dir_entry_p = readdir(dir_p)) != NULL)
+	{
+		if(strspn(dir_entry_p->d_name, "0123456789") != strlen(dir_entry_p->d_name))
+		{
+			continue;
+		}
+
+		if(job.m_ntids == tids_size)
+		{
+			uint64_t* tids;
+
+			tids_size = tids_size? tids_size * 2 : 1024;
+			tids = (uint64_t*)realloc(job.m_tids, tids_size * sizeof(uint64_t));
+			if(tids == NULL)
+			{
+				free(job.m_tids);
+				snprintf(error, SCAP_LASTERR_SIZE, "process table allocation error (4)");
+				return SCAP_FAILURE;
+			}
+
+			job.m_tids = tids;
+		}
+
+		job.m_tids[job.m_ntids++] = atoi(dir_entry_p->d_name);
+	}
+
+	ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	nworkers = job.m_ntids / SCAP_PROC_SCAN_MIN_PROCS_PER_WORKER;
+	if(nworkers > SCAP_PROC_SCAN_MAX_WORKERS)
+	{
+		nworkers = SCAP_PROC_SCAN_MAX_WORKERS;
+	}
+
+	if(ncpus > 0 && nworkers > (uint32_t)ncpus)
+	{
+		nworkers = ncpus;
+	}
+
+	if(nworkers <= 1)
+	{
+		for(j = 0; j < job.m_ntids && res == SCAP_SUCCESS; j++)
+		{
+			struct scap_threadinfo* tinfo;
+
+			if(handle->m_proc_scan_stop)
+			{
+				snprintf(error, SCAP_LASTERR_SIZE, "scan of /proc interrupted");
+				res = SCAP_FAILURE;
+				break;
+			}
+
+			HASH_FIND_INT64(handle->m_proclist, &job.m_tids[j], tinfo);
+			if(tinfo != NULL)
+			{
+				ASSERT(false);
+				snprintf(error, SCAP_LASTERR_SIZE, "duplicate process %"PRIu64, job.m_tids[j]);
+				res = SCAP_FAILURE;
+				break;
+			}
+
+			res = scap_proc_scan_one(handle, job.m_tids[j], sockets, scan_sockets, error);
+		}
+
+		free(job.m_tids);
+		return res;
+	}
+
+	workers = (struct scap_proc_scan_worker*)calloc(nworkers, sizeof(struct scap_proc_scan_worker));
+	if(workers == NULL)
+	{
+		free(job.m_tids);
+		snprintf(error, SCAP_LASTERR_SIZE, "process table allocation error (5)");
+		return SCAP_FAILURE;
+	}
+
+	//
+	// The calling thread is the first worker. If a thread can't be
+	// started, the others do its share.
+	//
+	for(j = 0; j < nworkers; j++)
+	{
+		workers[j].m_job = &job;
+	}
+
+	for(nstarted = 1; nstarted < nworkers; nstarted++)
+	{
+		if(pthread_create(&workers[nstarted].m_thread, NULL, scap_proc_scan_worker_thread, &workers[nstarted]) != 0)
+		{
+			break;
+		}
+	}
+
+	scap_proc_scan_worker_thread(&workers[0]);
+
+	for(j = 1; j < nstarted; j++)
+	{
+		pthread_join(workers[j].m_thread, NULL);
+	}
+
+	for(j = 0; j < nstarted; j++)
+	{
+		if(res == SCAP_SUCCESS && workers[j].m_res != SCAP_SUCCESS)
+		{
+			snprintf(error, SCAP_LASTERR_SIZE, "%s", workers[j].m_handle.m_lasterr);
+			res = workers[j].m_res;
+		}
+
+		if(res == SCAP_SUCCESS)
+		{
+			res = scap_proc_scan_merge(handle, &workers[j].m_handle, error);
+		}
+
+		if(workers[j].m_handle.m_proclist != NULL)
+		{
+			scap_proc_free_table(&workers[j].m_handle);
+		}
+	}
+
+	free(workers);
+	free(job.m_tids);
+	return res;
+}
+
 //
 // Scan a directory containing multiple processes under /proc
 //
@@ -385,8 +746,26 @@ int32_t scap_proc_scan_proc_dir(scap_t* handle, char* procdirname, int parenttid
 		*procinfo = NULL;
 	}
 
+	//
+	// The full scans of /proc are split among multiple threads
+	//
+	if(parenttid == -1 && tid_to_scan == -1)
+	{
+		res = scap_proc_scan_parallel(handle, dir_p, sockets, error, scan_sockets);
+		closedir(dir_p);
+		scap_fd_free_table(handle, &sockets);
+		return res;
+	}
+
 	while((dir_entry_p = readdir(dir_p)) != NULL)
 	{
+		if(handle->m_proc_scan_stop)
+		{
+			snprintf(error, SCAP_LASTERR_SIZE, "scan of %s interrupted", procdirname);
+			res = SCAP_FAILURE;
+			break;
+		}
+
 		if(strspn(dir_entry_p->d_name, "0123456789") != strlen(dir_entry_p->d_name))
 		{
 			continue;
@@ -469,8 +848,595 @@ int32_t scap_proc_scan_proc_dir(scap_t* handle, char* procdirname, int parenttid
 	return res;
 }
 
-#endif // _WIN32
-
+//
+// Find the process of a thread, from the Tgid line of its status file
+//
+static int32_t scap_proc_get_tgid(int64_t tid, OUT int64_t* tgid)
+{
+	char filename[SCAP_MAX_PATH_SIZE];
+	char line[128];
+	int32_t res = SCAP_NOTFOUND;
+	FILE* f;
+
+	snprintf(filename, sizeof(filename), "/proc/%" PRId64 "/status", tid);
+
+	f = fopen(filename, "r");
+	if(f == NULL)
+	{
+		return SCAP_NOTFOUND;
+	}
+
+	while(fgets(line, sizeof(line), f) != NULL)
+	{
+		if(sscanf(line, "Tgid: %" PRId64, tgid) == 1)
+		{
+			res = SCAP_SUCCESS;
+			break;
+		}
+	}
+
+	fclose(f);
+	return res;
+}
+
+//
+// Background scan of /proc.
+// The thread fills the process table of a private handle, so the one of
+// the capture is only touched by scap_proc_scan_complete(), from the thread
+// that owns it.
+//
+struct scap_proc_scan
+{
+	pthread_t m_thread;
+	volatile bool m_done;
+	int32_t m_res;
+	scap_t m_handle; // Only m_proclist, m_lasterr and m_proc_scan_stop are used
+};
+
+static void* scap_proc_scan_thread(void* arg)
+{
+	struct scap_proc_scan* scan = (struct scap_proc_scan*)arg;
+
+	scan->m_res = scap_proc_scan_proc_dir(&scan->m_handle, "/proc", -1, -1, NULL, scan->m_handle.m_lasterr, true);
+
+	__sync_synchronize();
+	scan->m_done = true;
+
+	return NULL;
+}
+
+int32_t scap_proc_scan_start(scap_t* handle)
+{
+	struct scap_proc_scan* scan;
+
+	scan = (struct scap_proc_scan*)calloc(1, sizeof(struct scap_proc_scan));
+	if(scan == NULL)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error allocating the /proc scan");
+		return SCAP_FAILURE;
+	}
+
+	if(pthread_create(&scan->m_thread, NULL, scap_proc_scan_thread, scan) != 0)
+	{
+		free(scan);
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error starting the /proc scan thread");
+		return SCAP_FAILURE;
+	}
+
+	handle->m_proc_scan = scan;
+	return SCAP_SUCCESS;
+}
+
+static void scap_proc_scan_free(scap_t* handle)
+{
+	struct scap_proc_scan* scan = handle->m_proc_scan;
+
+	pthread_join(scan->m_thread, NULL);
+
+	if(scan->m_handle.m_proclist != NULL)
+	{
+		scap_proc_free_table(&scan->m_handle);
+	}
+
+	free(scan);
+	handle->m_proc_scan = NULL;
+}
+
+void scap_proc_scan_stop(scap_t* handle)
+{
+	if(handle->m_proc_scan == NULL)
+	{
+		return;
+	}
+
+	handle->m_proc_scan->m_handle.m_proc_scan_stop = true;
+	scap_proc_scan_free(handle);
+}
+
+int32_t scap_proc_get_boot_id(OUT char* boot_id, uint32_t len)
+{
+	FILE* f;
+	size_t idlen;
+
+	f = fopen("/proc/sys/kernel/random/boot_id", "r");
+	if(f == NULL)
+	{
+		return SCAP_NOTFOUND;
+	}
+
+	if(fgets(boot_id, len, f) == NULL)
+	{
+		fclose(f);
+		return SCAP_FAILURE;
+	}
+
+	fclose(f);
+
+	idlen = strlen(boot_id);
+	if(idlen != 0 && boot_id[idlen - 1] == '\n')
+	{
+		boot_id[idlen - 1] = 0;
+	}
+
+	return SCAP_SUCCESS;
+}
+
+//
+// Reconciliation of a checkpoint with /proc.
+// A process of the checkpoint is kept if it started before the checkpoint,
+// still has the same name, the same threads and the same fds. Anything else
+// in /proc is scanned as usual, and the rest of the checkpoint is dropped.
+//
+struct scap_checkpoint_proc
+{
+	int64_t pid;
+	uint32_t nthreads; // Threads of the process in the checkpoint
+	bool keep;
+	UT_hash_handle hh;
+};
+
+//
+// Tell if an fd of the checkpoint whose inode isn't known can be the file
+// with the given mode. The fds learned from the events have no inode.
+//
+static bool scap_proc_checkpoint_fd_type_matches(scap_fd_type type, mode_t mode)
+{
+	switch(mode & S_IFMT)
+	{
+	case S_IFSOCK:
+		return type == SCAP_FD_IPV4_SOCK || type == SCAP_FD_IPV6_SOCK ||
+			type == SCAP_FD_IPV4_SERVSOCK || type == SCAP_FD_IPV6_SERVSOCK ||
+			type == SCAP_FD_UNIX_SOCK || type == SCAP_FD_UNSUPPORTED;
+	case S_IFIFO:
+		return type == SCAP_FD_FIFO;
+	case S_IFDIR:
+		return type == SCAP_FD_DIRECTORY;
+	case S_IFREG:
+	case S_IFBLK:
+	case S_IFCHR:
+	case S_IFLNK:
+		return type == SCAP_FD_FILE;
+	default:
+		return type != SCAP_FD_FILE && type != SCAP_FD_DIRECTORY && type != SCAP_FD_FIFO;
+	}
+}
+
+//
+// Compare a process of /proc with its entries in the checkpoint, and
+// refresh their working directories. Return false if it must be scanned.
+//
+static bool scap_proc_checkpoint_match(scap_t* handle, int64_t pid, uint32_t nthreads, uint64_t uptime)
+{
+	char filename[SCAP_MAX_PATH_SIZE];
+	char line[SCAP_MAX_PATH_SIZE];
+	scap_threadinfo* tinfo;
+	scap_threadinfo* thread;
+	scap_fdinfo* fdi;
+	DIR* dir_p;
+	struct dirent* dir_entry_p;
+	struct stat sb;
+	char* comm;
+	char* end;
+	uint64_t starttime;
+	uint64_t tick_ns = 1000000000 / sysconf(_SC_CLK_TCK);
+	int64_t tid;
+	int64_t fd;
+	uint32_t n;
+	bool match = true;
+	FILE* f;
+
+	HASH_FIND_INT64(handle->m_proclist, &pid, tinfo);
+	if(tinfo == NULL || tinfo->pid != (uint64_t)pid)
+	{
+		return false;
+	}
+
+	//
+	// The pid can have been reused while nobody was watching. The name and
+	// the start time, in ticks since boot, are in /proc/<pid>/stat as
+	// "pid (comm) state" followed by 18 more fields.
+	//
+	snprintf(filename, sizeof(filename), "/proc/%" PRId64 "/stat", pid);
+	f = fopen(filename, "r");
+	if(f == NULL)
+	{
+		return false;
+	}
+
+	if(fgets(line, sizeof(line), f) == NULL)
+	{
+		fclose(f);
+		return false;
+	}
+
+	fclose(f);
+
+	comm = strchr(line, '(');
+	end = strrchr(line, ')');
+	if(comm == NULL || end == NULL || end < comm)
+	{
+		return false;
+	}
+
+	*end = 0;
+	comm++;
+
+	if(strcmp(comm, tinfo->comm) != 0 ||
+		sscanf(end + 1, " %*c %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %" SCNu64, &starttime) != 1 ||
+		(starttime + 1) * tick_ns >= uptime)
+	{
+		return false;
+	}
+
+	//
+	// Same threads
+	//
+	snprintf(filename, sizeof(filename), "/proc/%" PRId64 "/task", pid);
+	dir_p = opendir(filename);
+	if(dir_p == NULL)
+	{
+		return false;
+	}
+
+	n = 0;
+	while(match && (dir_entry_p = readdir(dir_p)) != NULL)
+	{
+		if(sscanf(dir_entry_p->d_name, "%" PRId64, &tid) != 1)
+		{
+			continue;
+		}
+
+		HASH_FIND_INT64(handle->m_proclist, &tid, thread);
+		if(thread == NULL || thread->pid != (uint64_t)pid)
+		{
+			match = false;
+			break;
+		}
+
+		snprintf(filename, sizeof(filename), "/proc/%" PRId64 "/task/%" PRId64 "/", pid, tid);
+		scap_proc_fill_cwd(filename, thread);
+		n++;
+	}
+
+	closedir(dir_p);
+
+	if(!match || n != nthreads)
+	{
+		return false;
+	}
+
+	//
+	// Same fds. stat() gives the inode of the sockets and the pipes too.
+	//
+	snprintf(filename, sizeof(filename), "/proc/%" PRId64 "/fd", pid);
+	dir_p = opendir(filename);
+	if(dir_p == NULL)
+	{
+		return false;
+	}
+
+	n = 0;
+	while((dir_entry_p = readdir(dir_p)) != NULL)
+	{
+		if(sscanf(dir_entry_p->d_name, "%" PRId64, &fd) != 1)
+		{
+			continue;
+		}
+
+		snprintf(filename, sizeof(filename), "/proc/%" PRId64 "/fd/%" PRId64, pid, fd);
+		HASH_FIND_INT64(tinfo->fdlist, &fd, fdi);
+
+		if(fdi == NULL || stat(filename, &sb) != 0 ||
+			(fdi->ino != 0 && fdi->ino != sb.st_ino) ||
+			(fdi->ino == 0 && !scap_proc_checkpoint_fd_type_matches(fdi->type, sb.st_mode)))
+		{
+			match = false;
+			break;
+		}
+
+		n++;
+	}
+
+	closedir(dir_p);
+
+	return match && n == HASH_COUNT(tinfo->fdlist);
+}
+
+static int32_t scap_proc_reconcile(scap_t* handle, uint64_t uptime, OUT scap_checkpoint_stats* stats)
+{
+	struct scap_checkpoint_proc* procs = NULL;
+	struct scap_checkpoint_proc* cp;
+	struct scap_checkpoint_proc* tcp;
+	scap_threadinfo* tinfo;
+	scap_threadinfo* ttinfo;
+	scap_fdinfo* sockets = NULL;
+	bool sockets_read = false;
+	uint64_t* rescan = NULL;
+	uint64_t* tmp;
+	uint32_t nrescan = 0;
+	uint32_t rescan_size = 0;
+	uint32_t nreused = 0;
+	uint32_t nprocs;
+	uint32_t j;
+	char procdir[SCAP_MAX_PATH_SIZE];
+	DIR* dir_p;
+	struct dirent* dir_entry_p;
+	int64_t pid;
+	int32_t uth_status = SCAP_SUCCESS;
+	int32_t res = SCAP_SUCCESS;
+
+	//
+	// Count the threads of each process of the checkpoint
+	//
+	HASH_ITER(hh, handle->m_proclist, tinfo, ttinfo)
+	{
+		int64_t tpid = tinfo->pid;
+
+		HASH_FIND_INT64(procs, &tpid, cp);
+		if(cp == NULL)
+		{
+			cp = (struct scap_checkpoint_proc*)calloc(1, sizeof(struct scap_checkpoint_proc));
+			if(cp == NULL)
+			{
+				snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "checkpoint allocation error");
+				res = SCAP_FAILURE;
+				goto done;
+			}
+
+			cp->pid = tpid;
+			HASH_ADD_INT64(procs, pid, cp);
+			if(uth_status != SCAP_SUCCESS)
+			{
+				free(cp);
+				snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "checkpoint allocation error");
+				res = SCAP_FAILURE;
+				goto done;
+			}
+		}
+
+		cp->nthreads++;
+	}
+
+	nprocs = HASH_COUNT(procs);
+
+	//
+	// Find the processes of /proc that must be scanned
+	//
+	dir_p = opendir("/proc");
+	if(dir_p == NULL)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error opening the /proc directory");
+		res = SCAP_FAILURE;
+		goto done;
+	}
+
+	while((dir_entry_p = readdir(dir_p)) != NULL)
+	{
+		if(strspn(dir_entry_p->d_name, "0123456789") != strlen(dir_entry_p->d_name))
+		{
+			continue;
+		}
+
+		pid = atoi(dir_entry_p->d_name);
+
+		HASH_FIND_INT64(procs, &pid, cp);
+		if(cp != NULL && scap_proc_checkpoint_match(handle, pid, cp->nthreads, uptime))
+		{
+			cp->keep = true;
+			stats->n_kept++;
+			continue;
+		}
+
+		if(cp != NULL)
+		{
+			nreused++;
+		}
+		else
+		{
+			//
+			// Skip the kernel threads, which the table doesn't keep, so
+			// that they don't make us read the sockets
+			//
+			char c;
+
+			snprintf(procdir, sizeof(procdir), "/proc/%" PRId64 "/exe", pid);
+			if(readlink(procdir, &c, 1) <= 0)
+			{
+				continue;
+			}
+		}
+
+		if(nrescan == rescan_size)
+		{
+			rescan_size = rescan_size? rescan_size * 2 : 256;
+			tmp = (uint64_t*)realloc(rescan, rescan_size * sizeof(uint64_t));
+			if(tmp == NULL)
+			{
+				closedir(dir_p);
+				snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "checkpoint allocation error");
+				res = SCAP_FAILURE;
+				goto done;
+			}
+
+			rescan = tmp;
+		}
+
+		rescan[nrescan++] = pid;
+	}
+
+	closedir(dir_p);
+
+	//
+	// Drop the processes that exited and the ones that will be scanned again
+	//
+	HASH_ITER(hh, handle->m_proclist, tinfo, ttinfo)
+	{
+		int64_t tpid = tinfo->pid;
+
+		HASH_FIND_INT64(procs, &tpid, cp);
+		if(cp == NULL || !cp->keep)
+		{
+			scap_proc_delete(handle, tinfo);
+		}
+	}
+
+	stats->n_removed = nprocs - stats->n_kept - nreused;
+
+	//
+	// Scan the rest. The socket table is read only if there's something to
+	// scan, it's the most expensive part of a full scan.
+	//
+	for(j = 0; j < nrescan; j++)
+	{
+		if(!sockets_read)
+		{
+			if(scap_fd_read_sockets(handle, &sockets) == SCAP_FAILURE)
+			{
+				res = SCAP_FAILURE;
+				goto done;
+			}
+
+			sockets_read = true;
+		}
+
+		if(scap_proc_scan_one(handle, rescan[j], sockets, true, handle->m_lasterr) != SCAP_SUCCESS)
+		{
+			//
+			// Fine if the process has exited in the meantime
+			//
+			snprintf(procdir, sizeof(procdir), "/proc/%" PRIu64, rescan[j]);
+			if(access(procdir, F_OK) == 0)
+			{
+				res = SCAP_FAILURE;
+				goto done;
+			}
+		}
+
+		stats->n_rescanned++;
+	}
+
+done:
+	HASH_ITER(hh, procs, cp, tcp)
+	{
+		HASH_DEL(procs, cp);
+		free(cp);
+	}
+
+	free(rescan);
+	scap_fd_free_table(handle, &sockets);
+	return res;
+}
+
+int32_t scap_proc_load_checkpoint(scap_t* handle, const char* fname, OUT scap_checkpoint_stats* stats)
+{
+	checkpoint_header ch;
+	char boot_id[sizeof(ch.boot_id)];
+	int32_t res;
+
+	res = scap_read_checkpoint(handle, fname, &ch);
+	if(res != SCAP_SUCCESS)
+	{
+		return res;
+	}
+
+	if(scap_proc_get_boot_id(boot_id, sizeof(boot_id)) != SCAP_SUCCESS || strcmp(boot_id, ch.boot_id) != 0)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "checkpoint %s is from another boot", fname);
+		scap_proc_free_table(handle);
+		return SCAP_NOTFOUND;
+	}
+
+	res = scap_proc_reconcile(handle, ch.uptime, stats);
+	if(res != SCAP_SUCCESS)
+	{
+		scap_proc_free_table(handle);
+	}
+
+	return res;
+}
+
+#endif // _WIN32
+
+int32_t scap_proc_scan_complete(scap_t* handle)
+{
+#if defined(_WIN32) || defined(__APPLE__)
+	return SCAP_NOTFOUND;
+#else
+	struct scap_proc_scan* scan = handle->m_proc_scan;
+	struct scap_threadinfo* tinfo;
+	struct scap_threadinfo* ttinfo;
+	struct scap_threadinfo* cur;
+	int32_t uth_status = SCAP_SUCCESS;
+	int32_t res = SCAP_SUCCESS;
+
+	if(scan == NULL)
+	{
+		return SCAP_NOTFOUND;
+	}
+
+	if(!scan->m_done)
+	{
+		return SCAP_TIMEOUT;
+	}
+
+	__sync_synchronize();
+
+	if(scan->m_res != SCAP_SUCCESS)
+	{
+		scap_errprintf(handle->m_lasterr, "error scanning /proc: %s", scan->m_handle.m_lasterr);
+		scap_proc_scan_free(handle);
+		return SCAP_FAILURE;
+	}
+
+	//
+	// Move the processes that the table doesn't have yet
+	//
+	HASH_ITER(hh, scan->m_handle.m_proclist, tinfo, ttinfo)
+	{
+		HASH_DEL(scan->m_handle.m_proclist, tinfo);
+
+		HASH_FIND_INT64(handle->m_proclist, &tinfo->tid, cur);
+		if(cur != NULL)
+		{
+			scap_proc_free(handle, tinfo);
+			continue;
+		}
+
+		HASH_ADD_INT64(handle->m_proclist, tid, tinfo);
+		if(uth_status != SCAP_SUCCESS)
+		{
+			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "process table allocation error (3)");
+			scap_proc_free(handle, tinfo);
+			res = SCAP_FAILURE;
+			break;
+		}
+	}
+
+	scap_proc_scan_free(handle);
+	return res;
+#endif
+}
+
 //
 // Delete a process entry
 //
@@ -512,9 +1478,63 @@ struct scap_threadinfo* scap_proc_get(scap_t* handle, int64_t tid, bool scan_soc
 	return NULL;
 #else
 	struct scap_threadinfo* tinfo = NULL;
+	scap_fdinfo* sockets = NULL;
+	char procdirname[SCAP_MAX_PATH_SIZE];
+	int64_t tgid;
+	int32_t res;
 
-	if(scap_proc_scan_proc_dir(handle, "/proc", -1, tid, &tinfo, handle->m_lasterr, scan_sockets) != SCAP_SUCCESS)
+	//
+	// /proc/<tid> exists for every thread, even if only the processes are
+	// listed, so there's no need to walk the directory. Threads are read
+	// from the task directory of their process, like
+	// scap_proc_scan_proc_dir() does, which skips their fds.
+	//
+	if(scap_proc_get_tgid(tid, &tgid) != SCAP_SUCCESS)
 	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "can't find tid %" PRId64 " in /proc", tid);
+		return NULL;
+	}
+
+	if(tgid == tid)
+	{
+		//
+		// Passing the tid as the parent skips the fds, which are read
+		// with a single call to the driver when it can. That includes
+		// the sockets, even if scan_sockets is false.
+		//
+		res = scap_proc_add_from_proc(handle, tid, tid, tid, "/proc", NULL, &tinfo, handle->m_lasterr);
+
+		if(res == SCAP_SUCCESS && tinfo != NULL)
+		{
+			res = scap_fd_read_from_driver(handle, tinfo, handle->m_lasterr);
+
+			if(res == SCAP_NOTFOUND)
+			{
+				if(scan_sockets && scap_fd_read_sockets(handle, &sockets) == SCAP_FAILURE)
+				{
+					scap_proc_free(handle, tinfo);
+					return NULL;
+				}
+
+				snprintf(procdirname, sizeof(procdirname), "/proc/%" PRId64 "/", tid);
+				res = scap_fd_scan_fd_dir(handle, procdirname, tinfo, sockets, handle->m_lasterr);
+				scap_fd_free_table(handle, &sockets);
+			}
+		}
+	}
+	else
+	{
+		snprintf(procdirname, sizeof(procdirname), "/proc/%" PRId64 "/task", tgid);
+		res = scap_proc_add_from_proc(handle, tid, tgid, tid, procdirname, NULL, &tinfo, handle->m_lasterr);
+	}
+
+	if(res != SCAP_SUCCESS)
+	{
+		if(tinfo != NULL)
+		{
+			scap_proc_free(handle, tinfo);
+		}
+
 		return NULL;
 	}
 
@@ -522,6 +1542,26 @@ struct scap_threadinfo* scap_proc_get(scap_t* handle, int64_t tid, bool scan_soc
 #endif // WIN32
 }
 
+int32_t scap_proc_get_cgroup(scap_t* handle, int64_t tid, OUT char* cgroup, uint32_t len)
+{
+#if defined(_WIN32) || defined(__APPLE__)
+	cgroup[0] = 0;
+	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "cgroups not supported on this platform");
+	return SCAP_FAILURE;
+#else
+	char filename[64]; // Fits /proc/<any int64>/cgroup
+
+	snprintf(filename, sizeof(filename), "/proc/%" PRId64 "/cgroup", tid);
+	if(!scap_proc_read_cgroup(filename, cgroup, len))
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "can't open %s", filename);
+		return SCAP_FAILURE;
+	}
+
+	return SCAP_SUCCESS;
+#endif
+}
+
 void scap_proc_free(scap_t* handle, struct scap_threadinfo* proc)
 {
 	scap_fd_free_proc_fd_table(handle, proc);
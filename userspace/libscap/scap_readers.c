@@ -0,0 +1,582 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "scap.h"
+#include "scap-int.h"
+
+#if !defined(_WIN32) && !defined(__APPLE__)
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+
+#include "../../driver/ppm_ringbuffer.h"
+
+//
+// Reader threads.
+// Each reader owns the rings of the CPUs c with c % nreaders == its id,
+// including their auxiliary rings. It merges them by timestamp (or drains
+// them in turn in unordered mode) and copies the events into its queue,
+// which releases the ring space to the driver as soon as possible.
+// The thread calling scap_next() merges the heads of the queues, so the
+// events are globally ordered within what the queues have buffered.
+//
+// Each queue has a single producer (its reader) and a single consumer (the
+// caller of scap_next()), so it only needs the head and tail positions and
+// a barrier before each of them is published.
+//
+
+//
+// Size of the queue of each reader
+//
+#define READER_QUEUE_SIZE (8 * 1024 * 1024)
+
+//
+// How long the caller of scap_next() sleeps when all the queues are empty
+//
+#define READER_QUEUE_EMPTY_WAIT_TIME_US 1000
+
+//
+// How long a reader sleeps when its queue is full
+//
+#define READER_QUEUE_FULL_WAIT_TIME_US 100
+
+//
+// Entries of the queues. The event follows the header. m_cpuid is
+// READER_ENTRY_WRAP for the padding at the end of the queue, when the next
+// event doesn't fit there.
+//
+typedef struct scap_reader_entry
+{
+	uint32_t m_len; // Total length of the entry, including the header. Multiple of 8
+	uint16_t m_cpuid;
+	uint16_t m_reserved;
+}scap_reader_entry;
+
+#define READER_ENTRY_WRAP 0xffff
+#define READER_ENTRY_LEN(evt_len) ((sizeof(scap_reader_entry) + (evt_len) + 7) & ~7)
+
+typedef struct scap_reader
+{
+	scap_t* m_handle;
+	pthread_t m_thread;
+	uint32_t* m_devs; // Indexes in the m_devs of the handle of the rings owned by this reader
+	uint32_t m_ndevs;
+	uint32_t m_cur_dev; // Index in m_devs of the ring being drained in unordered mode
+	struct pollfd* m_pollfds; // The devices of the CPUs owned by this reader
+	uint32_t m_npollfds;
+	char* m_queue;
+	volatile uint64_t m_head; // Written by the reader
+	volatile uint64_t m_tail; // Written by the consumer, once it's done with the entries before it
+	uint64_t m_next; // Next entry returned to the consumer, between m_tail and m_head
+	volatile bool m_stop;
+	volatile int32_t m_res; // SCAP_SUCCESS, or the error that stopped the reader
+	char m_lasterr[SCAP_LASTERR_SIZE];
+}scap_reader;
+
+//
+// Copy an event at the head of the queue. Returns false if it's full.
+//
+static bool scap_reader_push(scap_reader* r, scap_evt* pe, uint16_t cpuid)
+{
+	uint32_t len = READER_ENTRY_LEN(pe->len);
+	uint64_t head = r->m_head;
+	uint32_t off = (uint32_t)(head % READER_QUEUE_SIZE);
+	uint32_t pad = 0;
+	scap_reader_entry* entry;
+
+	if(off + len > READER_QUEUE_SIZE)
+	{
+		pad = READER_QUEUE_SIZE - off;
+	}
+
+	if(head + pad + len - r->m_tail > READER_QUEUE_SIZE)
+	{
+		return false;
+	}
+
+	if(pad != 0)
+	{
+		entry = (scap_reader_entry*)(r->m_queue + off);
+		entry->m_len = pad;
+		entry->m_cpuid = READER_ENTRY_WRAP;
+		head += pad;
+		off = 0;
+	}
+
+	entry = (scap_reader_entry*)(r->m_queue + off);
+	entry->m_len = len;
+	entry->m_cpuid = cpuid;
+	memcpy(entry + 1, pe, pe->len);
+
+	//
+	// The entry must be complete before the consumer can see it
+	//
+	__sync_synchronize();
+	r->m_head = head + len;
+
+	return true;
+}
+
+//
+// Return the next entry for the consumer, or NULL if the queue is empty
+//
+static inline scap_reader_entry* scap_reader_peek(scap_reader* r)
+{
+	scap_reader_entry* entry;
+
+	while(r->m_next != r->m_head)
+	{
+		__sync_synchronize();
+
+		entry = (scap_reader_entry*)(r->m_queue + r->m_next % READER_QUEUE_SIZE);
+
+		if(entry->m_cpuid != READER_ENTRY_WRAP)
+		{
+			return entry;
+		}
+
+		r->m_next += entry->m_len;
+	}
+
+	return NULL;
+}
+
+//
+// Read a new chunk for the rings of the reader that have been fully consumed
+//
+static int32_t scap_reader_refill(scap_reader* r)
+{
+	scap_t* handle = r->m_handle;
+	uint32_t j;
+
+	for(j = 0; j < r->m_ndevs; j++)
+	{
+		scap_device* dev = &handle->m_devs[r->m_devs[j]];
+		int32_t res;
+
+		if(dev->m_sn_len != 0)
+		{
+			continue;
+		}
+
+		if(dev->m_lastreadsize == 0 && *dev->m_head == *dev->m_tail)
+		{
+			continue;
+		}
+
+		res = scap_readbuf(handle,
+		                   r->m_devs[j],
+		                   false,
+		                   &dev->m_sn_next_event,
+		                   &dev->m_sn_len);
+
+		if(res != SCAP_SUCCESS)
+		{
+			strncpy(r->m_lasterr, handle->m_lasterr, SCAP_LASTERR_SIZE - 1);
+			return res;
+		}
+	}
+
+	return SCAP_SUCCESS;
+}
+
+//
+// Copy the events of a ring to the queue, as long as their timestamp is not
+// after max_ts. Returns false if the queue got full.
+//
+static bool scap_reader_copy_dev(scap_reader* r, uint32_t d, uint64_t max_ts)
+{
+	scap_device* dev = &r->m_handle->m_devs[d];
+
+	while(dev->m_sn_len != 0)
+	{
+		scap_evt* pe = (scap_evt*)dev->m_sn_next_event;
+
+		if(pe->len > dev->m_sn_len)
+		{
+			snprintf(r->m_lasterr, SCAP_LASTERR_SIZE, "scap_next buffer corruption");
+			ASSERT(false);
+			r->m_res = SCAP_FAILURE;
+			return false;
+		}
+
+		if(pe->ts > max_ts)
+		{
+			break;
+		}
+
+		if(!scap_reader_push(r, pe, (uint16_t)dev->m_cpuid))
+		{
+			return false;
+		}
+
+		dev->m_sn_len -= pe->len;
+		dev->m_sn_next_event += pe->len;
+		dev->m_last_ts = pe->ts;
+	}
+
+	return true;
+}
+
+//
+// Move one run of events from the rings to the queue: the whole current chunk
+// in unordered mode, otherwise the events of the oldest ring up to the next
+// event of the second oldest. Returns false if there was nothing to move.
+//
+static bool scap_reader_move_events(scap_reader* r, OUT bool* full)
+{
+	scap_t* handle = r->m_handle;
+	uint32_t j;
+	int64_t first = -1;
+	uint64_t first_ts = 0;
+	uint64_t second_ts = (uint64_t)-1;
+
+	*full = false;
+
+	if(handle->m_unordered)
+	{
+		for(j = 0; j < r->m_ndevs; j++)
+		{
+			uint32_t d = r->m_devs[(r->m_cur_dev + j) % r->m_ndevs];
+			scap_device* dev = &handle->m_devs[d];
+			uint64_t max_ts = scap_unordered_max_ts(handle, d);
+
+			//
+			// The auxiliary rings of a CPU belong to the same reader as
+			// its main ring, so the queue keeps them in order
+			//
+			if(dev->m_sn_len != 0 && ((scap_evt*)dev->m_sn_next_event)->ts <= max_ts)
+			{
+				r->m_cur_dev = (r->m_cur_dev + j) % r->m_ndevs;
+				*full = !scap_reader_copy_dev(r, d, max_ts);
+				if(!*full)
+				{
+					r->m_cur_dev = (r->m_cur_dev + 1) % r->m_ndevs;
+				}
+
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	for(j = 0; j < r->m_ndevs; j++)
+	{
+		scap_device* dev = &handle->m_devs[r->m_devs[j]];
+		uint64_t ts;
+
+		if(dev->m_sn_len == 0)
+		{
+			continue;
+		}
+
+		ts = ((scap_evt*)dev->m_sn_next_event)->ts;
+
+		if(first == -1 || ts < first_ts)
+		{
+			if(first != -1)
+			{
+				second_ts = first_ts;
+			}
+
+			first = r->m_devs[j];
+			first_ts = ts;
+		}
+		else if(ts < second_ts)
+		{
+			second_ts = ts;
+		}
+	}
+
+	if(first == -1)
+	{
+		return false;
+	}
+
+	//
+	// A ring that runs out of data is read again before the next run, since
+	// its next chunk might have older events than the other rings
+	//
+	*full = !scap_reader_copy_dev(r, (uint32_t)first, second_ts);
+	return true;
+}
+
+static void* scap_reader_thread(void* arg)
+{
+	scap_reader* r = (scap_reader*)arg;
+	bool full;
+
+	//
+	// If the consumer is pinned, its readers stay on the same CPUs, and
+	// their queues are allocated on its node
+	//
+	if(scap_pin_thread(r->m_handle) != SCAP_SUCCESS)
+	{
+		r->m_res = SCAP_FAILURE;
+		return NULL;
+	}
+
+	while(!r->m_stop && r->m_res == SCAP_SUCCESS)
+	{
+		int32_t res = scap_reader_refill(r);
+		if(res != SCAP_SUCCESS)
+		{
+			r->m_res = res;
+			break;
+		}
+
+		if(!scap_reader_move_events(r, &full))
+		{
+			//
+			// All our rings are empty. Sleep until one of them reaches
+			// the wakeup watermark, or has had an event for the max delay.
+			//
+			uint32_t timeout_ms = BUFFER_EMPTY_WAIT_TIME_MS;
+
+			if(r->m_handle->m_max_delay_ms != 0 && r->m_handle->m_max_delay_ms < timeout_ms)
+			{
+				timeout_ms = r->m_handle->m_max_delay_ms;
+			}
+
+			poll(r->m_pollfds, r->m_npollfds, timeout_ms);
+		}
+		else if(full)
+		{
+			//
+			// The consumer is behind. The events stay in the rings, and if
+			// it doesn't catch up the driver drops the new ones.
+			//
+			usleep(READER_QUEUE_FULL_WAIT_TIME_US);
+		}
+	}
+
+	return NULL;
+}
+
+int32_t scap_start_readers(scap_t* handle, uint32_t nreaders)
+{
+	uint32_t j;
+	uint32_t k;
+
+	if(handle->m_readers != NULL)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "the reader threads are already running");
+		return SCAP_FAILURE;
+	}
+
+	if(nreaders == 0)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "invalid number of reader threads");
+		return SCAP_FAILURE;
+	}
+
+	if(nreaders > handle->m_ndevs)
+	{
+		nreaders = handle->m_ndevs;
+	}
+
+	handle->m_readers = (scap_reader*)calloc(nreaders, sizeof(scap_reader));
+	if(handle->m_readers == NULL)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "error allocating the reader threads");
+		return SCAP_FAILURE;
+	}
+
+	for(j = 0; j < nreaders; j++)
+	{
+		scap_reader* r = &handle->m_readers[j];
+
+		r->m_handle = handle;
+		r->m_res = SCAP_SUCCESS;
+		r->m_devs = (uint32_t*)malloc(handle->m_nrings * sizeof(uint32_t));
+		r->m_pollfds = (struct pollfd*)malloc(handle->m_ndevs * sizeof(struct pollfd));
+		r->m_queue = (char*)malloc(READER_QUEUE_SIZE);
+
+		if(r->m_devs == NULL || r->m_pollfds == NULL || r->m_queue == NULL)
+		{
+			snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "error allocating the reader threads");
+			handle->m_nreaders = j + 1;
+			scap_stop_readers(handle);
+			return SCAP_FAILURE;
+		}
+
+		for(k = 0; k < handle->m_nrings; k++)
+		{
+			if(handle->m_devs[k].m_cpuid % nreaders == j)
+			{
+				r->m_devs[r->m_ndevs++] = k;
+			}
+		}
+
+		for(k = 0; k < handle->m_ndevs; k++)
+		{
+			if(k % nreaders == j)
+			{
+				r->m_pollfds[r->m_npollfds++] = handle->m_pollfds[k];
+			}
+		}
+	}
+
+	for(j = 0; j < nreaders; j++)
+	{
+		if(pthread_create(&handle->m_readers[j].m_thread, NULL, scap_reader_thread, &handle->m_readers[j]) != 0)
+		{
+			snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "error starting the reader threads");
+			handle->m_nreaders = nreaders;
+			handle->m_readers_started = j;
+			scap_stop_readers(handle);
+			return SCAP_FAILURE;
+		}
+	}
+
+	handle->m_nreaders = nreaders;
+	handle->m_readers_started = nreaders;
+
+	return SCAP_SUCCESS;
+}
+
+void scap_stop_readers(scap_t* handle)
+{
+	uint32_t j;
+
+	if(handle->m_readers == NULL)
+	{
+		return;
+	}
+
+	for(j = 0; j < handle->m_readers_started; j++)
+	{
+		handle->m_readers[j].m_stop = true;
+	}
+
+	for(j = 0; j < handle->m_readers_started; j++)
+	{
+		pthread_join(handle->m_readers[j].m_thread, NULL);
+	}
+
+	for(j = 0; j < handle->m_nreaders; j++)
+	{
+		free(handle->m_readers[j].m_devs);
+		free(handle->m_readers[j].m_pollfds);
+		free(handle->m_readers[j].m_queue);
+	}
+
+	free(handle->m_readers);
+	handle->m_readers = NULL;
+	handle->m_nreaders = 0;
+	handle->m_readers_started = 0;
+}
+
+int32_t scap_next_readers(scap_t* handle, OUT scap_evt** pevents, OUT uint16_t* pcpuids, uint32_t max_evts, OUT uint32_t* nevts)
+{
+	uint32_t n = 0;
+	uint32_t j;
+
+	//
+	// The events returned by the previous call are not used anymore, give
+	// their space back to the readers
+	//
+	for(j = 0; j < handle->m_nreaders; j++)
+	{
+		scap_reader* r = &handle->m_readers[j];
+
+		if(r->m_res != SCAP_SUCCESS)
+		{
+			memcpy(handle->m_lasterr, r->m_lasterr, SCAP_LASTERR_SIZE);
+			return r->m_res;
+		}
+
+		if(r->m_tail != r->m_next)
+		{
+			__sync_synchronize();
+			r->m_tail = r->m_next;
+		}
+	}
+
+	while(n < max_evts)
+	{
+		scap_reader* first = NULL;
+		scap_reader_entry* first_entry = NULL;
+
+		for(j = 0; j < handle->m_nreaders; j++)
+		{
+			scap_reader* r = &handle->m_readers[(handle->m_cur_reader + j) % handle->m_nreaders];
+			scap_reader_entry* entry = scap_reader_peek(r);
+
+			if(entry == NULL)
+			{
+				continue;
+			}
+
+			if(first == NULL || ((scap_evt*)(entry + 1))->ts < ((scap_evt*)(first_entry + 1))->ts)
+			{
+				first = r;
+				first_entry = entry;
+
+				if(handle->m_unordered)
+				{
+					break;
+				}
+			}
+		}
+
+		if(first == NULL)
+		{
+			break;
+		}
+
+		pevents[n] = (scap_evt*)(first_entry + 1);
+		pcpuids[n] = first_entry->m_cpuid;
+		n++;
+		first->m_next += first_entry->m_len;
+
+		//
+		// Same as the single threaded merge: once a queue is empty we don't
+		// know what it will return next, so the batch ends here
+		//
+		if(!handle->m_unordered && first->m_next == first->m_head)
+		{
+			break;
+		}
+
+		if(handle->m_unordered && scap_reader_peek(first) == NULL)
+		{
+			handle->m_cur_reader = (handle->m_cur_reader + 1) % handle->m_nreaders;
+		}
+	}
+
+	*nevts = n;
+
+	if(n == 0)
+	{
+		if(handle->m_emptybuf_timeout_ms != 0)
+		{
+			usleep(READER_QUEUE_EMPTY_WAIT_TIME_US);
+		}
+
+		return SCAP_TIMEOUT;
+	}
+
+	return SCAP_SUCCESS;
+}
+
+#endif // !defined(_WIN32) && !defined(__APPLE__)
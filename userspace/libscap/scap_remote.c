@@ -0,0 +1,309 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "scap.h"
+#include "scap-int.h"
+
+//
+// Remote captures. The agent sends exactly what it would write to a trace
+// file, headers first and then the event blocks, on a TCP connection; the
+// collector reads it with the same code that reads the files. The
+// connection is wrapped in a stdio stream, so neither side needs to know
+// that it's not a file, except that the stream can't seek.
+//
+
+bool scap_is_remote_name(const char* name)
+{
+	return strncmp(name, SCAP_REMOTE_PREFIX, sizeof(SCAP_REMOTE_PREFIX) - 1) == 0;
+}
+
+#if !defined(_WIN32) && !defined(__APPLE__)
+#include <unistd.h>
+#include <errno.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+//
+// Split "tcp://host:port" into host and port. The host can be empty, or
+// between brackets for IPv6 addresses
+//
+static int32_t scap_remote_parse(const char* name, OUT char* host, OUT char* port, char* error)
+{
+	const char* p = name + sizeof(SCAP_REMOTE_PREFIX) - 1;
+	const char* sep;
+	size_t hlen;
+
+	if(*p == '[')
+	{
+		sep = strchr(p, ']');
+		if(sep == NULL || sep[1] != ':')
+		{
+			snprintf(error, SCAP_LASTERR_SIZE, "invalid remote address %s", name);
+			return SCAP_FAILURE;
+		}
+
+		p++;
+		hlen = sep - p;
+		sep++;
+	}
+	else
+	{
+		sep = strrchr(p, ':');
+		if(sep == NULL)
+		{
+			snprintf(error, SCAP_LASTERR_SIZE, "invalid remote address %s, the port is missing", name);
+			return SCAP_FAILURE;
+		}
+
+		hlen = sep - p;
+	}
+
+	if(hlen >= NI_MAXHOST || strlen(sep + 1) >= NI_MAXSERV || sep[1] == '\0')
+	{
+		snprintf(error, SCAP_LASTERR_SIZE, "invalid remote address %s", name);
+		return SCAP_FAILURE;
+	}
+
+	memcpy(host, p, hlen);
+	host[hlen] = 0;
+	strcpy(port, sep + 1);
+	return SCAP_SUCCESS;
+}
+
+//
+// The stream functions of the connections. send() is used instead of write()
+// so that a collector that goes away is reported as a write error instead
+// of killing the process with SIGPIPE
+//
+static ssize_t scap_remote_read(void* cookie, char* buf, size_t size)
+{
+	ssize_t res;
+
+	do
+	{
+		res = recv((int)(intptr_t)cookie, buf, size, 0);
+	}
+	while(res < 0 && errno == EINTR);
+
+	return res;
+}
+
+static ssize_t scap_remote_write(void* cookie, const char* buf, size_t size)
+{
+	size_t done = 0;
+	ssize_t res;
+
+	while(done < size)
+	{
+		res = send((int)(intptr_t)cookie, buf + done, size - done, MSG_NOSIGNAL);
+		if(res < 0)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+
+			return -1;
+		}
+
+		done += res;
+	}
+
+	return done;
+}
+
+static int scap_remote_seek(void* cookie, off64_t* offset, int whence)
+{
+	errno = ESPIPE;
+	return -1;
+}
+
+static int scap_remote_close(void* cookie)
+{
+	return close((int)(intptr_t)cookie);
+}
+
+static FILE* scap_remote_fdopen(int fd, const char* mode, char* error)
+{
+	cookie_io_functions_t funcs;
+	FILE* f;
+
+	funcs.read = scap_remote_read;
+	funcs.write = scap_remote_write;
+	funcs.seek = scap_remote_seek;
+	funcs.close = scap_remote_close;
+
+	f = fopencookie((void *)(intptr_t)fd, mode, funcs);
+	if(f == NULL)
+	{
+		snprintf(error, SCAP_LASTERR_SIZE, "error allocating the remote stream");
+		close(fd);
+		return NULL;
+	}
+
+	//
+	// Large enough that the header blocks don't go out in small packets
+	//
+	setvbuf(f, NULL, _IOFBF, SCAP_REMOTE_STREAM_BUF_SIZE);
+	return f;
+}
+
+FILE* scap_remote_connect(const char* name, char* error)
+{
+	char host[NI_MAXHOST];
+	char port[NI_MAXSERV];
+	struct addrinfo hints;
+	struct addrinfo* res;
+	struct addrinfo* ai;
+	int fd = -1;
+	int err;
+
+	if(scap_remote_parse(name, host, port, error) != SCAP_SUCCESS)
+	{
+		return NULL;
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	err = getaddrinfo(host[0] != 0? host : NULL, port, &hints, &res);
+	if(err != 0)
+	{
+		snprintf(error, SCAP_LASTERR_SIZE, "can't resolve %s: %s", name, gai_strerror(err));
+		return NULL;
+	}
+
+	for(ai = res; ai != NULL; ai = ai->ai_next)
+	{
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if(fd < 0)
+		{
+			continue;
+		}
+
+		if(connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+		{
+			break;
+		}
+
+		err = errno;
+		close(fd);
+		fd = -1;
+	}
+
+	freeaddrinfo(res);
+
+	if(fd < 0)
+	{
+		snprintf(error, SCAP_LASTERR_SIZE, "can't connect to %s: %s", name, strerror(err != 0? err : errno));
+		return NULL;
+	}
+
+	return scap_remote_fdopen(fd, "wb", error);
+}
+
+FILE* scap_remote_accept(const char* name, char* error)
+{
+	char host[NI_MAXHOST];
+	char port[NI_MAXSERV];
+	struct addrinfo hints;
+	struct addrinfo* res;
+	int lfd;
+	int fd;
+	int err;
+	int on = 1;
+
+	if(scap_remote_parse(name, host, port, error) != SCAP_SUCCESS)
+	{
+		return NULL;
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+
+	err = getaddrinfo(host[0] != 0? host : NULL, port, &hints, &res);
+	if(err != 0)
+	{
+		snprintf(error, SCAP_LASTERR_SIZE, "can't resolve %s: %s", name, gai_strerror(err));
+		return NULL;
+	}
+
+	lfd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+	if(lfd < 0)
+	{
+		snprintf(error, SCAP_LASTERR_SIZE, "error creating the socket for %s: %s", name, strerror(errno));
+		freeaddrinfo(res);
+		return NULL;
+	}
+
+	setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+	if(bind(lfd, res->ai_addr, res->ai_addrlen) != 0 || listen(lfd, 1) != 0)
+	{
+		snprintf(error, SCAP_LASTERR_SIZE, "can't listen on %s: %s", name, strerror(errno));
+		freeaddrinfo(res);
+		close(lfd);
+		return NULL;
+	}
+
+	freeaddrinfo(res);
+
+	//
+	// One capture per connection: stop listening once the agent is here
+	//
+	do
+	{
+		fd = accept(lfd, NULL, NULL);
+	}
+	while(fd < 0 && errno == EINTR);
+
+	err = errno;
+	close(lfd);
+
+	if(fd < 0)
+	{
+		snprintf(error, SCAP_LASTERR_SIZE, "error accepting a connection on %s: %s", name, strerror(err));
+		return NULL;
+	}
+
+	return scap_remote_fdopen(fd, "rb", error);
+}
+
+#else // !defined(_WIN32) && !defined(__APPLE__)
+
+FILE* scap_remote_connect(const char* name, char* error)
+{
+	snprintf(error, SCAP_LASTERR_SIZE, "remote captures are not supported on this platform");
+	return NULL;
+}
+
+FILE* scap_remote_accept(const char* name, char* error)
+{
+	snprintf(error, SCAP_LASTERR_SIZE, "remote captures are not supported on this platform");
+	return NULL;
+}
+
+#endif // !defined(_WIN32) && !defined(__APPLE__)
@@ -16,12 +16,32 @@ You should have received a copy of the GNU General Public License
 along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
 */
 
-#ifndef _WIN32
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#include <sys/stat.h>
+#else
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#if !defined(_WIN32) && !defined(__APPLE__)
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
 #endif
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+#ifdef HAS_ZLIB
+#include <zlib.h>
+#endif
 
 #include "scap.h"
 #include "scap-int.h"
@@ -56,116 +76,357 @@ static int32_t scap_write_padding(FILE *f, uint32_t blocklen)
 	}
 }
 
-static int32_t scap_write_proc_fds(scap_t *handle, struct scap_threadinfo *tinfo, FILE *f)
+//
+// Zigzag encoding of the signed deltas of the compact fd list, so that
+// small negative deltas also get short varints
+//
+#define SCAP_ZIGZAG(v) (((uint64_t)(v) << 1) ^ (uint64_t)((int64_t)(v) >> 63))
+#define SCAP_UNZIGZAG(v) ((int64_t)((v) >> 1) ^ -(int64_t)((v) & 1))
+
+//
+// A growable buffer the compact fd list is encoded into
+//
+typedef struct scap_encbuf
 {
-	block_header bh;
-	uint32_t bt;
-	uint32_t totlen = MEMBER_SIZE(scap_threadinfo, tid);  // This includes the tid
-	struct scap_fdinfo *fdi;
-	struct scap_fdinfo *tfdi;
+	char* m_buf;
+	uint32_t m_len;
+	uint32_t m_size;
+}scap_encbuf;
 
-	//
-	// First pass of the table to calculate the length
-	//
-	HASH_ITER(hh, tinfo->fdlist, fdi, tfdi)
+//
+// A name of the name table of the compact fd list
+//
+typedef struct scap_fdlist_string
+{
+	const char* m_str; // Points to the name in the fd, which outlives the encoder
+	uint32_t m_idx;
+	UT_hash_handle hh;
+}scap_fdlist_string;
+
+//
+// The compact fd list block of a process list, encoded before it's
+// written so its length is known in advance
+//
+typedef struct scap_fdlist_encoder
+{
+	scap_encbuf m_strings; // Name table
+	scap_encbuf m_entries; // Processes and fds, referring to the name table
+	scap_fdlist_string* m_string_index;
+	uint32_t m_nstrings;
+	uint32_t m_nprocs;
+}scap_fdlist_encoder;
+
+//
+// Make room for len more bytes in the buffer
+//
+static int32_t scap_encbuf_reserve(scap_t *handle, scap_encbuf *e, uint32_t len)
+{
+	uint64_t size;
+	char *p;
+
+	if((uint64_t)e->m_len + len <= e->m_size)
 	{
-		totlen += scap_fd_info_len(fdi);
+		return SCAP_SUCCESS;
 	}
 
-	//
-	// Create the block
-	//
-	bh.block_type = FDL_BLOCK_TYPE;
-	bh.block_total_length = scap_normalize_block_len(sizeof(block_header) + totlen + 4);
+	size = MAX((uint64_t)e->m_size * 2, (uint64_t)e->m_len + len);
+	size = MAX(size, 4096);
 
-	if(fwrite(&bh, sizeof(bh), 1, f) != 1)
+	if(size > 0xffffff00)
 	{
-		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error writing to file (fd1)");
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "fd list too big");
 		return SCAP_FAILURE;
 	}
 
-	//
-	// Write the tid
-	//
-	if(fwrite(&tinfo->tid, sizeof(tinfo->tid), 1, f) != 1)
+	p = (char *)realloc(e->m_buf, size);
+	if(p == NULL)
 	{
-		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error writing to file (fd2)");
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "fd list allocation error");
 		return SCAP_FAILURE;
 	}
 
-	//
-	// Second pass pass of the table to dump it
-	//
-	HASH_ITER(hh, tinfo->fdlist, fdi, tfdi)
+	e->m_buf = p;
+	e->m_size = (uint32_t)size;
+	return SCAP_SUCCESS;
+}
+
+//
+// The put functions don't check the room, which must have been reserved
+//
+static void scap_encbuf_put(scap_encbuf *e, const void *p, uint32_t len)
+{
+	memcpy(e->m_buf + e->m_len, p, len);
+	e->m_len += len;
+}
+
+static void scap_encbuf_put_varint(scap_encbuf *e, uint64_t v)
+{
+	while(v >= 0x80)
 	{
-		if(scap_fd_write_to_disk(handle, fdi, f) != SCAP_SUCCESS)
-		{
-			return SCAP_FAILURE;
-		}
+		e->m_buf[e->m_len++] = (char)(v | 0x80);
+		v >>= 7;
 	}
 
-	//
-	// Add the padding
-	//
-	if(scap_write_padding(f, totlen) != SCAP_SUCCESS)
+	e->m_buf[e->m_len++] = (char)v;
+}
+
+//
+// Return the index of a name in the name table, adding it if it's new
+//
+static int32_t scap_fdlist_intern(scap_t *handle, scap_fdlist_encoder *enc, const char *str, OUT uint32_t *idx)
+{
+	scap_fdlist_string *s;
+	uint32_t len = strnlen(str, SCAP_MAX_PATH_SIZE);
+	int32_t uth_status = SCAP_SUCCESS;
+
+	HASH_FIND(hh, enc->m_string_index, str, len, s);
+	if(s != NULL)
+	{
+		*idx = s->m_idx;
+		return SCAP_SUCCESS;
+	}
+
+	if(scap_encbuf_reserve(handle, &enc->m_strings, len + 10) != SCAP_SUCCESS)
 	{
-		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error writing to file (fd3)");
 		return SCAP_FAILURE;
 	}
 
-	//
-	// Create the trailer
-	//
-	bt = bh.block_total_length;
-	if(fwrite(&bt, sizeof(bt), 1, f) != 1)
+	s = (scap_fdlist_string *)malloc(sizeof(scap_fdlist_string));
+	if(s == NULL)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "fd list allocation error");
+		return SCAP_FAILURE;
+	}
+
+	s->m_str = str;
+	s->m_idx = enc->m_nstrings++;
+	HASH_ADD_KEYPTR(hh, enc->m_string_index, s->m_str, len, s);
+	if(uth_status != SCAP_SUCCESS)
 	{
-		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error writing to file (fd4)");
+		free(s);
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "fd list allocation error");
 		return SCAP_FAILURE;
 	}
 
+	scap_encbuf_put_varint(&enc->m_strings, len);
+	scap_encbuf_put(&enc->m_strings, str, len);
+
+	*idx = s->m_idx;
 	return SCAP_SUCCESS;
 }
 
+static void scap_fdlist_encoder_free(scap_fdlist_encoder *enc)
+{
+	scap_fdlist_string *s;
+	scap_fdlist_string *ts;
+
+	HASH_ITER(hh, enc->m_string_index, s, ts)
+	{
+		HASH_DEL(enc->m_string_index, s);
+		free(s);
+	}
+
+	free(enc->m_strings.m_buf);
+	free(enc->m_entries.m_buf);
+	memset(enc, 0, sizeof(*enc));
+}
+
 //
-// Write the fd list blocks
+// Encode the fd tables of the processes in the FDLC_BLOCK_TYPE format
 //
-int32_t scap_write_fdlist(scap_t *handle, FILE *f)
+static int32_t scap_encode_fdlist(scap_t *handle, scap_threadinfo *proclist, OUT scap_fdlist_encoder *enc)
 {
 	struct scap_threadinfo *tinfo;
 	struct scap_threadinfo *ttinfo;
-	int32_t res;
+	struct scap_fdinfo *fdi;
+	struct scap_fdinfo *tfdi;
+	uint64_t prev_tid = 0;
+	int64_t prev_fd;
+	uint64_t prev_ino;
+	uint8_t type;
+	uint32_t idx;
+
+	memset(enc, 0, sizeof(*enc));
 
-	HASH_ITER(hh, handle->m_proclist, tinfo, ttinfo)
+	HASH_ITER(hh, proclist, tinfo, ttinfo)
 	{
-		res = scap_write_proc_fds(handle, tinfo, f);
-		if(res != SCAP_SUCCESS)
+		if(tinfo->fdlist == NULL)
 		{
-			return res;
+			continue;
+		}
+
+		if(scap_encbuf_reserve(handle, &enc->m_entries, 20) != SCAP_SUCCESS)
+		{
+			goto scap_encode_fdlist_error;
+		}
+
+		scap_encbuf_put_varint(&enc->m_entries, SCAP_ZIGZAG(tinfo->tid - prev_tid));
+		scap_encbuf_put_varint(&enc->m_entries, HASH_COUNT(tinfo->fdlist));
+		prev_tid = tinfo->tid;
+		prev_fd = 0;
+		prev_ino = 0;
+		enc->m_nprocs++;
+
+		HASH_ITER(hh, tinfo->fdlist, fdi, tfdi)
+		{
+			//
+			// Enough for the largest entry, an IPv6 socket
+			//
+			if(scap_encbuf_reserve(handle, &enc->m_entries, 64) != SCAP_SUCCESS)
+			{
+				goto scap_encode_fdlist_error;
+			}
+
+			type = (uint8_t)fdi->type;
+
+			scap_encbuf_put_varint(&enc->m_entries, SCAP_ZIGZAG(fdi->fd - prev_fd));
+			scap_encbuf_put_varint(&enc->m_entries, SCAP_ZIGZAG(fdi->ino - prev_ino));
+			scap_encbuf_put(&enc->m_entries, &type, sizeof(type));
+			prev_fd = fdi->fd;
+			prev_ino = fdi->ino;
+
+			switch(fdi->type)
+			{
+			case SCAP_FD_IPV4_SOCK:
+				scap_encbuf_put(&enc->m_entries, &fdi->info.ipv4info.sip, sizeof(uint32_t));
+				scap_encbuf_put(&enc->m_entries, &fdi->info.ipv4info.dip, sizeof(uint32_t));
+				scap_encbuf_put(&enc->m_entries, &fdi->info.ipv4info.sport, sizeof(uint16_t));
+				scap_encbuf_put(&enc->m_entries, &fdi->info.ipv4info.dport, sizeof(uint16_t));
+				scap_encbuf_put(&enc->m_entries, &fdi->info.ipv4info.l4proto, sizeof(uint8_t));
+				break;
+			case SCAP_FD_IPV4_SERVSOCK:
+				scap_encbuf_put(&enc->m_entries, &fdi->info.ipv4serverinfo.ip, sizeof(uint32_t));
+				scap_encbuf_put(&enc->m_entries, &fdi->info.ipv4serverinfo.port, sizeof(uint16_t));
+				scap_encbuf_put(&enc->m_entries, &fdi->info.ipv4serverinfo.l4proto, sizeof(uint8_t));
+				break;
+			case SCAP_FD_IPV6_SOCK:
+				scap_encbuf_put(&enc->m_entries, fdi->info.ipv6info.sip, sizeof(uint32_t) * 4);
+				scap_encbuf_put(&enc->m_entries, fdi->info.ipv6info.dip, sizeof(uint32_t) * 4);
+				scap_encbuf_put(&enc->m_entries, &fdi->info.ipv6info.sport, sizeof(uint16_t));
+				scap_encbuf_put(&enc->m_entries, &fdi->info.ipv6info.dport, sizeof(uint16_t));
+				scap_encbuf_put(&enc->m_entries, &fdi->info.ipv6info.l4proto, sizeof(uint8_t));
+				break;
+			case SCAP_FD_IPV6_SERVSOCK:
+				scap_encbuf_put(&enc->m_entries, fdi->info.ipv6serverinfo.ip, sizeof(uint32_t) * 4);
+				scap_encbuf_put(&enc->m_entries, &fdi->info.ipv6serverinfo.port, sizeof(uint16_t));
+				scap_encbuf_put(&enc->m_entries, &fdi->info.ipv6serverinfo.l4proto, sizeof(uint8_t));
+				break;
+			case SCAP_FD_UNIX_SOCK:
+				scap_encbuf_put(&enc->m_entries, &fdi->info.unix_socket_info.source, sizeof(uint64_t));
+				scap_encbuf_put(&enc->m_entries, &fdi->info.unix_socket_info.destination, sizeof(uint64_t));
+
+				if(scap_fdlist_intern(handle, enc, fdi->info.unix_socket_info.fname, &idx) != SCAP_SUCCESS)
+				{
+					goto scap_encode_fdlist_error;
+				}
+
+				scap_encbuf_put_varint(&enc->m_entries, idx);
+				break;
+			case SCAP_FD_FIFO:
+			case SCAP_FD_FILE:
+			case SCAP_FD_DIRECTORY:
+			case SCAP_FD_UNSUPPORTED:
+			case SCAP_FD_EVENT:
+			case SCAP_FD_SIGNALFD:
+			case SCAP_FD_EVENTPOLL:
+			case SCAP_FD_INOTIFY:
+			case SCAP_FD_TIMERFD:
+				if(scap_fdlist_intern(handle, enc, fdi->info.fname, &idx) != SCAP_SUCCESS)
+				{
+					goto scap_encode_fdlist_error;
+				}
+
+				scap_encbuf_put_varint(&enc->m_entries, idx);
+				break;
+			default:
+				ASSERT(false);
+				snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "can't write fd %" PRId64 " of unknown type %u", fdi->fd, (uint32_t)type);
+				goto scap_encode_fdlist_error;
+			}
 		}
 	}
 
+	if((uint64_t)sizeof(fdlist_compact_header) + enc->m_strings.m_len + enc->m_entries.m_len + sizeof(block_header) + 8 > 0xffffffff)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "fd list too big");
+		goto scap_encode_fdlist_error;
+	}
+
 	return SCAP_SUCCESS;
+
+scap_encode_fdlist_error:
+	scap_fdlist_encoder_free(enc);
+	return SCAP_FAILURE;
 }
 
 //
-// Write the process list block
+// Length of the content of the block of an encoded fd list
 //
-int32_t scap_write_proclist(scap_t *handle, FILE *f)
+static uint32_t scap_fdlist_len(scap_fdlist_encoder *enc)
+{
+	return sizeof(fdlist_compact_header) + enc->m_strings.m_len + enc->m_entries.m_len;
+}
+
+static int32_t scap_write_encoded_fdlist(scap_t *handle, scap_fdlist_encoder *enc, FILE *f)
 {
 	block_header bh;
+	fdlist_compact_header ch;
 	uint32_t bt;
+	uint32_t totlen = scap_fdlist_len(enc);
+
+	bh.block_type = FDLC_BLOCK_TYPE;
+	bh.block_total_length = scap_normalize_block_len(sizeof(block_header) + totlen + 4);
+
+	ch.nstrings = enc->m_nstrings;
+	ch.strings_len = enc->m_strings.m_len;
+	ch.nprocs = enc->m_nprocs;
+	ch.reserved = 0;
+
+	bt = bh.block_total_length;
+
+	if(fwrite(&bh, sizeof(bh), 1, f) != 1 ||
+		fwrite(&ch, sizeof(ch), 1, f) != 1 ||
+		(enc->m_strings.m_len != 0 && fwrite(enc->m_strings.m_buf, enc->m_strings.m_len, 1, f) != 1) ||
+		(enc->m_entries.m_len != 0 && fwrite(enc->m_entries.m_buf, enc->m_entries.m_len, 1, f) != 1) ||
+		scap_write_padding(f, totlen) != SCAP_SUCCESS ||
+		fwrite(&bt, sizeof(bt), 1, f) != 1)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error writing to file (fd1)");
+		return SCAP_FAILURE;
+	}
+
+	return SCAP_SUCCESS;
+}
+
+//
+// Write the fd list block
+//
+int32_t scap_write_fdlist(scap_t *handle, scap_threadinfo *proclist, FILE *f)
+{
+	scap_fdlist_encoder enc;
+	int32_t res;
+
+	if(scap_encode_fdlist(handle, proclist, &enc) != SCAP_SUCCESS)
+	{
+		return SCAP_FAILURE;
+	}
+
+	res = scap_write_encoded_fdlist(handle, &enc, f);
+
+	scap_fdlist_encoder_free(&enc);
+	return res;
+}
+
+//
+// Length of the process list block content
+//
+static uint32_t scap_proclist_len(scap_threadinfo *proclist)
+{
 	uint32_t totlen = 0;
 	struct scap_threadinfo *tinfo;
 	struct scap_threadinfo *ttinfo;
-	uint16_t commlen;
-	uint16_t exelen;
-	uint16_t argslen;
-	uint16_t cwdlen;
 
-	//
-	// First pass pass of the table to calculate the length
-	//
-	HASH_ITER(hh, handle->m_proclist, tinfo, ttinfo)
+	HASH_ITER(hh, proclist, tinfo, ttinfo)
 	{
 		totlen +=
 		    sizeof(uint64_t) +	// tid
@@ -181,6 +442,29 @@ int32_t scap_write_proclist(scap_t *handle, FILE *f)
 		    sizeof(uint32_t);
 	}
 
+	return totlen;
+}
+
+//
+// Write the process list block
+//
+int32_t scap_write_proclist(scap_t *handle, scap_threadinfo *proclist, FILE *f)
+{
+	block_header bh;
+	uint32_t bt;
+	uint32_t totlen;
+	struct scap_threadinfo *tinfo;
+	struct scap_threadinfo *ttinfo;
+	uint16_t commlen;
+	uint16_t exelen;
+	uint16_t argslen;
+	uint16_t cwdlen;
+
+	//
+	// First pass pass of the table to calculate the length
+	//
+	totlen = scap_proclist_len(proclist);
+
 	//
 	// Create the block
 	//
@@ -196,7 +480,7 @@ int32_t scap_write_proclist(scap_t *handle, FILE *f)
 	//
 	// Second pass pass of the table to dump it
 	//
-	HASH_ITER(hh, handle->m_proclist, tinfo, ttinfo)
+	HASH_ITER(hh, proclist, tinfo, ttinfo)
 	{
 		commlen = strnlen(tinfo->comm, SCAP_MAX_PATH_SIZE);
 		exelen = strnlen(tinfo->exe, SCAP_MAX_PATH_SIZE);
@@ -246,6 +530,82 @@ int32_t scap_write_proclist(scap_t *handle, FILE *f)
 	return SCAP_SUCCESS;
 }
 
+//
+// Length of the cgroup list block content, 0 if no process has a cgroup
+//
+static uint32_t scap_cglist_len(scap_threadinfo *proclist)
+{
+	uint32_t totlen = 0;
+	struct scap_threadinfo *tinfo;
+	struct scap_threadinfo *ttinfo;
+
+	HASH_ITER(hh, proclist, tinfo, ttinfo)
+	{
+		if(tinfo->cgroup[0] != 0)
+		{
+			totlen += sizeof(uint64_t) + 2 + strnlen(tinfo->cgroup, SCAP_MAX_PATH_SIZE);
+		}
+	}
+
+	return totlen;
+}
+
+//
+// Write the cgroup list block. Nothing is written if no process has a cgroup
+//
+static int32_t scap_write_cglist(scap_t *handle, scap_threadinfo *proclist, FILE *f)
+{
+	block_header bh;
+	uint32_t bt;
+	uint32_t totlen;
+	struct scap_threadinfo *tinfo;
+	struct scap_threadinfo *ttinfo;
+	uint16_t cglen;
+
+	totlen = scap_cglist_len(proclist);
+	if(totlen == 0)
+	{
+		return SCAP_SUCCESS;
+	}
+
+	bh.block_type = CG_BLOCK_TYPE;
+	bh.block_total_length = scap_normalize_block_len(sizeof(block_header) + totlen + 4);
+
+	if(fwrite(&bh, sizeof(bh), 1, f) != 1)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error writing to file (cg1)");
+		return SCAP_FAILURE;
+	}
+
+	HASH_ITER(hh, proclist, tinfo, ttinfo)
+	{
+		if(tinfo->cgroup[0] == 0)
+		{
+			continue;
+		}
+
+		cglen = strnlen(tinfo->cgroup, SCAP_MAX_PATH_SIZE);
+
+		if(fwrite(&(tinfo->tid), sizeof(uint64_t), 1, f) != 1 ||
+			fwrite(&cglen, sizeof(uint16_t), 1, f) != 1 ||
+			fwrite(tinfo->cgroup, 1, cglen, f) != cglen)
+		{
+			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error writing to file (cg2)");
+			return SCAP_FAILURE;
+		}
+	}
+
+	bt = bh.block_total_length;
+	if(scap_write_padding(f, totlen) != SCAP_SUCCESS ||
+		fwrite(&bt, sizeof(bt), 1, f) != 1)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error writing to file (cg3)");
+		return SCAP_FAILURE;
+	}
+
+	return SCAP_SUCCESS;
+}
+
 //
 // Write the machine info block
 //
@@ -287,6 +647,11 @@ int32_t scap_write_iflist(scap_t *handle, FILE *f)
 	//
 	// Get the interface list
 	//
+	if(scap_load_iflist(handle) != SCAP_SUCCESS)
+	{
+		return SCAP_FAILURE;
+	}
+
 	if(handle->m_addrlist == NULL)
 	{
 		ASSERT(false);
@@ -381,6 +746,11 @@ int32_t scap_write_userlist(scap_t *handle, FILE *f)
 	//
 	// Make sure we have a user list interface list
 	//
+	if(scap_load_userlist(handle) != SCAP_SUCCESS)
+	{
+		return SCAP_FAILURE;
+	}
+
 	if(handle->m_userlist == NULL)
 	{
 		ASSERT(false);
@@ -494,17 +864,74 @@ int32_t scap_write_userlist(scap_t *handle, FILE *f)
 }
 
 //
-// Create the dump file headers and add the tables
+// The dump handle.
+// The events are accumulated in large blocks, so that writing them costs one
+// fwrite per block instead of five per event. With the background writer,
+// there are two blocks: the writer thread saves one while scap_dump() fills
+// the other. With compression, each block becomes an EVF_BLOCK_TYPE frame.
+//
+struct scap_dumper
+{
+	FILE* m_f;
+	uint64_t m_offset; // Size of the file, including the events that are still in the buffers
+	uint64_t m_written; // Bytes actually written to the file
+	int32_t m_compression_level; // 0 to write the events uncompressed
+	char* m_zbuf; // Where the frames are built
+	uint32_t m_zbuf_size;
+	uint64_t m_nevts; // Events dumped so far
+	uint64_t m_block_ts[2]; // Timestamp of the first event in each of m_bufs
+	uint64_t m_block_evtnum[2]; // Number of the first event in each of m_bufs
+	uint64_t m_block_snapshot[2]; // Snapshot written right before each of m_bufs, 0 if none
+	uint64_t m_snapshot_offset; // Last snapshot, not yet in the index
+	uint64_t m_last_ts; // Timestamp of the last event dumped
+	index_entry* m_index; // One entry per block written, saved by scap_dump_close()
+	uint64_t m_index_len;
+	uint64_t m_index_size;
+	bool m_index_error; // The index is incomplete and won't be saved
+	scap_block_summary m_block_summary[2]; // What each of m_bufs contains
+	scap_block_summary* m_summaries; // One per entry of m_index, saved with it
+	bool m_summary_error; // The summaries are incomplete and won't be saved
+	uint32_t m_summary_kinds; // Set with scap_dump_set_summary_kinds()
+	char* m_bufs[2];
+	uint32_t m_buf_size;
+	uint32_t m_cur; // Buffer being filled
+	uint32_t m_len; // Bytes in the buffer being filled
+	bool m_write_error;
+	bool m_remote; // m_f is the connection to a remote collector
+	bool m_drop_when_busy; // Drop a full buffer instead of waiting for the background writer
+	uint64_t m_dropped_evts;
+	uint64_t m_dropped_bytes;
+	struct scap_fold* m_fold; // Folding of the repetitive syscalls, NULL if off
+#ifndef _WIN32
+	bool m_async; // The blocks are written by m_thread
+	pthread_t m_thread;
+	pthread_mutex_t m_mutex;
+	pthread_cond_t m_cond;
+	bool m_pending; // m_bufs[1 - m_cur] is waiting to be written, or being written
+	uint32_t m_pending_len;
+	bool m_stop;
+	//
+	// File switch queued by scap_dump_rotate(), done by m_thread after
+	// writing the pending buffer
+	//
+	char* m_rotate_fname;
+	char* m_rotate_header; // The header of the new file, already rendered
+	size_t m_rotate_header_len;
+	char* m_rotate_remove; // File to delete once the new one is open, or NULL
+#endif
+};
+
+static int32_t scap_dump_flush_fold(scap_dumper_t *d, char *error);
+
 //
-static scap_dumper_t *scap_setup_dump(scap_t *handle, FILE *f, const char *fname)
+// Write the section header block that starts every file
+//
+static int32_t scap_write_section_header(scap_t *handle, FILE *f, const char *fname)
 {
 	block_header bh;
 	section_header_block sh;
 	uint32_t bt;
 
-	//
-	// Write the section header
-	//
 	bh.block_type = SHB_BLOCK_TYPE;
 	bh.block_total_length = sizeof(block_header) + sizeof(section_header_block) + 4;
 
@@ -520,31 +947,31 @@ static scap_dumper_t *scap_setup_dump(scap_t *handle, FILE *f, const char *fname
 	        fwrite(&bt, sizeof(bt), 1, f) != 1)
 	{
 		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error writing to file %s  (5)", fname);
-		return NULL;
+		return SCAP_FAILURE;
 	}
 
+	return SCAP_SUCCESS;
+}
+
+//
+// Write the dump file headers and the tables, with the given process list
+//
+static int32_t scap_write_header(scap_t *handle, FILE *f, const char *fname, scap_threadinfo *proclist)
+{
 	//
-	// If we're dumping in live mode, refresh the process tables list
-	// so we don't lose information about processes created in the interval
-	// between opening the handle and starting the dump
+	// Write the section header
 	//
-#if !defined(_WIN32) && !defined(__APPLE__)
-	if(handle->m_file == NULL)
+	if(scap_write_section_header(handle, f, fname) != SCAP_SUCCESS)
 	{
-		scap_proc_free_table(handle);
-		if(scap_proc_scan_proc_dir(handle, "/proc", -1, -1, NULL, handle->m_lasterr, true) != SCAP_SUCCESS)
-		{
-			return NULL;
-		}
+		return SCAP_FAILURE;
 	}
-#endif
 
 	//
 	// Write the machine info
 	//
 	if(scap_write_machine_info(handle, f) != SCAP_SUCCESS)
 	{
-		return NULL;
+		return SCAP_FAILURE;
 	}
 
 	//
@@ -552,7 +979,7 @@ static scap_dumper_t *scap_setup_dump(scap_t *handle, FILE *f, const char *fname
 	//
 	if(scap_write_iflist(handle, f) != SCAP_SUCCESS)
 	{
-		return NULL;
+		return SCAP_FAILURE;
 	}
 
 	//
@@ -560,44 +987,78 @@ static scap_dumper_t *scap_setup_dump(scap_t *handle, FILE *f, const char *fname
 	//
 	if(scap_write_userlist(handle, f) != SCAP_SUCCESS)
 	{
-		return NULL;
+		return SCAP_FAILURE;
 	}
 
 	//
 	// Write the process list
 	//
-	if(scap_write_proclist(handle, f) != SCAP_SUCCESS)
+	if(scap_write_proclist(handle, proclist, f) != SCAP_SUCCESS ||
+		scap_write_cglist(handle, proclist, f) != SCAP_SUCCESS)
 	{
-		return NULL;
+		return SCAP_FAILURE;
 	}
 
 	//
 	// Write the fd lists
 	//
 
-	if(scap_write_fdlist(handle, f) != SCAP_SUCCESS)
+	if(scap_write_fdlist(handle, proclist, f) != SCAP_SUCCESS)
 	{
-		return NULL;
+		return SCAP_FAILURE;
 	}
 
+	return SCAP_SUCCESS;
+}
+
+//
+// Create the dump file headers and add the tables
+//
+static int32_t scap_setup_dump(scap_t *handle, FILE *f, const char *fname)
+{
 	//
-	// Done, return the file
+	// If we're dumping in live mode, refresh the process tables list
+	// so we don't lose information about processes created in the interval
+	// between opening the handle and starting the dump
 	//
-	return (scap_dumper_t *)f;
+#if !defined(_WIN32) && !defined(__APPLE__)
+	if(handle->m_file == NULL && handle->m_merge == NULL)
+	{
+		scap_proc_free_table(handle);
+		if(scap_proc_scan_proc_dir(handle, "/proc", -1, -1, NULL, handle->m_lasterr, true) != SCAP_SUCCESS)
+		{
+			return SCAP_FAILURE;
+		}
+	}
+#endif
+
+	return scap_write_header(handle, f, fname, handle->m_proclist);
 }
 
 //
-// Open a "savefile" for writing.
+// Open a "savefile" for writing, with the process table of the handle in
+// the header, or the given one
 //
-scap_dumper_t *scap_dump_open(scap_t *handle, const char *fname)
+static scap_dumper_t *scap_dump_open_int(scap_t *handle, const char *fname, scap_threadinfo *proclist, bool handle_procs)
 {
 	FILE *f;
+	scap_dumper_t *d;
+	int32_t res;
 
 	if(fname[0] == '-' && fname[1] == '\0')
 	{
 		f = stdout;
 		fname = "standard output";
 	}
+	else if(scap_is_remote_name(fname))
+	{
+		f = scap_remote_connect(fname, handle->m_lasterr);
+
+		if(f == NULL)
+		{
+			return NULL;
+		}
+	}
 	else
 	{
 		f = fopen(fname, "wb");
@@ -609,1016 +1070,4398 @@ scap_dumper_t *scap_dump_open(scap_t *handle, const char *fname)
 		}
 	}
 
-	return scap_setup_dump(handle, f, fname);
+	d = (scap_dumper_t *)calloc(1, sizeof(scap_dumper_t));
+	if(d == NULL)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error allocating the dumper");
+		fclose(f);
+		return NULL;
+	}
+
+	d->m_f = f;
+	d->m_buf_size = SCAP_DUMP_DEFAULT_BUFFER_SIZE;
+	d->m_summary_kinds = 1 << SCAP_SUMMARY_TID;
+
+	//
+	// A capture that stops when the network is slow is worse than one
+	// with holes
+	//
+	d->m_remote = scap_is_remote_name(fname);
+	d->m_drop_when_busy = d->m_remote;
+	d->m_bufs[0] = (char *)malloc(d->m_buf_size);
+
+	if(d->m_bufs[0] == NULL)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error allocating the dumper");
+		fclose(f);
+		free(d);
+		return NULL;
+	}
+
+	if(handle_procs)
+	{
+		res = scap_setup_dump(handle, f, fname);
+	}
+	else
+	{
+		res = scap_write_header(handle, f, fname, proclist);
+	}
+
+	if(res != SCAP_SUCCESS)
+	{
+		fclose(f);
+		free(d->m_bufs[0]);
+		free(d);
+		return NULL;
+	}
+
+	d->m_offset = (uint64_t)ftell(f);
+	d->m_written = d->m_offset;
+
+	//
+	// The file positions are meaningless if the output is a pipe
+	//
+	if(ftell(f) < 0)
+	{
+		d->m_index_error = true;
+	}
+
+	return d;
 }
 
 //
-// Close a "savefile" opened with scap_dump_open
+// Open a "savefile" for writing.
 //
-void scap_dump_close(scap_dumper_t *d)
+scap_dumper_t *scap_dump_open(scap_t *handle, const char *fname)
 {
-	fclose((FILE *)d);
+	return scap_dump_open_int(handle, fname, NULL, true);
 }
 
-//
-// Return the current size of a tracefile
-//
-uint64_t scap_dump_ftell(scap_dumper_t *d)
+scap_dumper_t *scap_dump_open_ex(scap_t *handle, const char *fname, scap_threadinfo *proclist)
 {
-	return (uint64_t)ftell((FILE *)d);
+	return scap_dump_open_int(handle, fname, proclist, false);
 }
 
 //
-// Write an event to a dump file
+// Write a checkpoint: the section header, the checkpoint block and the
+// process tables. The file is written aside and renamed at the end, so that
+// a crash while writing leaves the previous checkpoint in place.
 //
-int32_t scap_dump(scap_t *handle, scap_dumper_t *d, scap_evt *e, uint16_t cpuid)
+int32_t scap_write_checkpoint(scap_t *handle, const char *fname, scap_threadinfo *proclist)
 {
+#if defined(_WIN32) || defined(__APPLE__)
+	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "checkpoints are not supported on this platform");
+	return SCAP_FAILURE;
+#else
+	char tmpname[SCAP_MAX_PATH_SIZE];
 	block_header bh;
+	checkpoint_header ch;
 	uint32_t bt;
-	FILE *f = (FILE *)d;
+	struct timespec now;
+	FILE *f;
+	int32_t res = SCAP_FAILURE;
 
-	//
-	// Write the section header
-	//
-	bh.block_type = EV_BLOCK_TYPE;
-	bh.block_total_length = scap_normalize_block_len(sizeof(block_header) + sizeof(cpuid) + e->len + 4);
+	memset(&ch, 0, sizeof(ch));
+
+	if(scap_proc_get_boot_id(ch.boot_id, sizeof(ch.boot_id)) != SCAP_SUCCESS)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "can't read the boot id of the system");
+		return SCAP_FAILURE;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ch.uptime = now.tv_sec * (uint64_t) 1000000000 + now.tv_nsec;
+	clock_gettime(CLOCK_REALTIME, &now);
+	ch.ts = now.tv_sec * (uint64_t) 1000000000 + now.tv_nsec;
+
+	if(snprintf(tmpname, sizeof(tmpname), "%s.tmp", fname) >= (int)sizeof(tmpname))
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "checkpoint file name too long");
+		return SCAP_FAILURE;
+	}
+
+	f = fopen(tmpname, "wb");
+	if(f == NULL)
+	{
+		scap_errprintf(handle->m_lasterr, "can't open %s: %s", tmpname, strerror(errno));
+		return SCAP_FAILURE;
+	}
+
+	bh.block_type = CK_BLOCK_TYPE;
+	bh.block_total_length = sizeof(block_header) + sizeof(checkpoint_header) + 4;
 	bt = bh.block_total_length;
 
+	if(scap_write_section_header(handle, f, tmpname) != SCAP_SUCCESS)
+	{
+		goto done;
+	}
+
 	if(fwrite(&bh, sizeof(bh), 1, f) != 1 ||
-	        fwrite(&cpuid, sizeof(cpuid), 1, f) != 1 ||
-	        fwrite(e, e->len, 1, f) != 1 ||
-	        scap_write_padding(f, sizeof(cpuid) + e->len) != SCAP_SUCCESS ||
-	        fwrite(&bt, sizeof(bt), 1, f) != 1)
+		fwrite(&ch, sizeof(ch), 1, f) != 1 ||
+		fwrite(&bt, sizeof(bt), 1, f) != 1)
 	{
-		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error writing to file (6)");
-		return SCAP_FAILURE;
+		scap_errprintf(handle->m_lasterr, "error writing to file %s", tmpname);
+		goto done;
 	}
 
-	//
-	// Enalbe this to make sure that everything is saved to disk during the tests
-	//
-#if 0
-	fflush(f);
-#endif
+	if(scap_write_proclist(handle, proclist, f) != SCAP_SUCCESS ||
+		scap_write_cglist(handle, proclist, f) != SCAP_SUCCESS ||
+		scap_write_fdlist(handle, proclist, f) != SCAP_SUCCESS)
+	{
+		goto done;
+	}
 
-	return SCAP_SUCCESS;
+	res = SCAP_SUCCESS;
+
+done:
+	if(fclose(f) != 0 && res == SCAP_SUCCESS)
+	{
+		scap_errprintf(handle->m_lasterr, "error writing to file %s", tmpname);
+		res = SCAP_FAILURE;
+	}
+
+	if(res == SCAP_SUCCESS && rename(tmpname, fname) != 0)
+	{
+		scap_errprintf(handle->m_lasterr, "can't rename %s to %s: %s", tmpname, fname, strerror(errno));
+		res = SCAP_FAILURE;
+	}
+
+	if(res != SCAP_SUCCESS)
+	{
+		unlink(tmpname);
+	}
+
+	return res;
+#endif
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-///////////////////////////////////////////////////////////////////////////////
-// READ FUNCTIONS
-///////////////////////////////////////////////////////////////////////////////
+// Summaries of the groups of events
 ///////////////////////////////////////////////////////////////////////////////
 
 //
-// Load the machine info block
+// FNV-1a of the kind and the key, with the final mix of splitmix64 so that
+// all the bits are usable
 //
-int32_t scap_read_machine_info(scap_t *handle, FILE *f, uint32_t block_length)
+uint64_t scap_summary_hash(uint32_t kind, const void* key, uint32_t len)
 {
-	//
-	// Read the section header block
-	//
-	if(fread(&handle->m_machine_info, sizeof(handle->m_machine_info), 1, f) != 1)
+	const uint8_t* p = (const uint8_t *)key;
+	uint64_t h = 0xcbf29ce484222325ULL;
+	uint32_t j;
+
+	h = (h ^ (uint8_t)kind) * 0x100000001b3ULL;
+
+	for(j = 0; j < len; j++)
 	{
-		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error reading from file (1)");
-		return SCAP_FAILURE;
+		h = (h ^ p[j]) * 0x100000001b3ULL;
 	}
 
-	return SCAP_SUCCESS;
+	h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+	return h ^ (h >> 31);
 }
 
 //
-// Parse a process list block
+// The bits of a key are h1 + j * h2, j = 0..SCAP_SUMMARY_BLOOM_HASHES - 1
 //
-int32_t scap_read_proclist(scap_t *handle, FILE *f, uint32_t block_length)
+bool scap_summary_test(const scap_block_summary* summary, uint64_t hash)
 {
-	size_t readsize;
-	size_t totreadsize = 0;
-	struct scap_threadinfo tinfo;
-	uint16_t stlen;
-	uint32_t padding;
-	int32_t padding_len;
-	int32_t uth_status = SCAP_SUCCESS;
-	struct scap_threadinfo *ntinfo;
-
-	tinfo.fdlist = NULL;
-	tinfo.flags = 0;
+	uint32_t h1 = (uint32_t)hash;
+	uint32_t h2 = (uint32_t)(hash >> 32) | 1;
+	uint32_t j;
 
-	while(((int32_t)block_length - (int32_t)totreadsize) >= 4)
+	for(j = 0; j < SCAP_SUMMARY_BLOOM_HASHES; j++)
 	{
-		//
-		// tid
-		//
-		readsize = fread(&(tinfo.tid), 1, sizeof(uint64_t), f);
-		CHECK_READ_SIZE(readsize, sizeof(uint64_t));
+		uint32_t bit = (h1 + j * h2) % SCAP_SUMMARY_BLOOM_BITS;
 
-		totreadsize += readsize;
-
-		//
-		// pid
-		//
-		readsize = fread(&(tinfo.pid), 1, sizeof(uint64_t), f);
-		CHECK_READ_SIZE(readsize, sizeof(uint64_t));
+		if((summary->bloom[bit / 64] & (1ULL << (bit % 64))) == 0)
+		{
+			return false;
+		}
+	}
 
-		totreadsize += readsize;
+	return true;
+}
 
-		//
-		// ptid
-		//
-		readsize = fread(&(tinfo.ptid), 1, sizeof(uint64_t), f);
-		CHECK_READ_SIZE(readsize, sizeof(uint64_t));
+static void scap_summary_add(scap_block_summary* summary, uint64_t hash)
+{
+	uint32_t h1 = (uint32_t)hash;
+	uint32_t h2 = (uint32_t)(hash >> 32) | 1;
+	uint32_t j;
 
-		totreadsize += readsize;
+	for(j = 0; j < SCAP_SUMMARY_BLOOM_HASHES; j++)
+	{
+		uint32_t bit = (h1 + j * h2) % SCAP_SUMMARY_BLOOM_BITS;
 
-		//
-		// comm
-		//
-		readsize = fread(&(stlen), 1, sizeof(uint16_t), f);
-		CHECK_READ_SIZE(readsize, sizeof(uint16_t));
+		summary->bloom[bit / 64] |= 1ULL << (bit % 64);
+	}
+}
 
-		if(stlen >= SCAP_MAX_PATH_SIZE)
-		{
-			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "invalid commlen %d", stlen);
-			return SCAP_FAILURE;
-		}
+//
+// A summary that matches anything, for the groups that are not summarized
+//
+static void scap_summary_set_all(scap_block_summary* summary)
+{
+	memset(summary, 0xff, sizeof(*summary));
+	summary->ts_min = 0;
+	summary->kinds = 0;
+	summary->reserved = 0;
+}
 
-		totreadsize += readsize;
+static void scap_summary_add_event(scap_dumper_t *d, scap_block_summary* summary, scap_evt *e)
+{
+	if(d->m_len == 0)
+	{
+		memset(summary, 0, sizeof(*summary));
+		summary->ts_min = e->ts;
+		summary->kinds = 0xffffffff;
+	}
 
-		readsize = fread(tinfo.comm, 1, stlen, f);
-		CHECK_READ_SIZE(readsize, stlen);
+	if(e->ts < summary->ts_min)
+	{
+		summary->ts_min = e->ts;
+	}
 
-		// the string is not null-terminated on file
-		tinfo.comm[stlen] = 0;
+	if(e->ts > summary->ts_max)
+	{
+		summary->ts_max = e->ts;
+	}
 
-		totreadsize += readsize;
+	if(e->type < SCAP_SUMMARY_MAX_EVTTYPES)
+	{
+		summary->evttypes[e->type / 64] |= 1ULL << (e->type % 64);
+	}
 
-		//
-		// exe
-		//
-		readsize = fread(&(stlen), 1, sizeof(uint16_t), f);
-		CHECK_READ_SIZE(readsize, sizeof(uint16_t));
+	summary->kinds &= d->m_summary_kinds;
+	scap_summary_add(summary, scap_summary_hash(SCAP_SUMMARY_TID, &e->tid, sizeof(e->tid)));
+}
 
-		if(stlen >= SCAP_MAX_PATH_SIZE)
-		{
-			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "invalid exelen %d", stlen);
-			return SCAP_FAILURE;
-		}
+void scap_dump_set_summary_kinds(scap_dumper_t *d, uint32_t kinds)
+{
+	d->m_summary_kinds = kinds | (1 << SCAP_SUMMARY_TID);
+}
 
-		totreadsize += readsize;
+void scap_dump_add_summary_key(scap_dumper_t *d, uint32_t kind, const void* key, uint32_t len)
+{
+	//
+	// The event was written on its own, or dropped, and its group matches
+	// anything
+	//
+	if(d->m_len == 0)
+	{
+		return;
+	}
 
-		readsize = fread(tinfo.exe, 1, stlen, f);
-		CHECK_READ_SIZE(readsize, stlen);
+	scap_summary_add(&d->m_block_summary[d->m_cur], scap_summary_hash(kind, key, len));
+}
 
-		// the string is not null-terminated on file
-		tinfo.exe[stlen] = 0;
+//
+// Remember where a block of events starts, and what it contains. summary is
+// NULL for the blocks that are not summarized.
+//
+static void scap_dump_add_index_entry(scap_dumper_t *d, uint64_t offset, uint64_t ts, uint64_t evtnum, uint64_t snapshot_offset,
+	const scap_block_summary* summary)
+{
+	index_entry* entry;
 
-		totreadsize += readsize;
+	if(d->m_index_error)
+	{
+		return;
+	}
 
-		//
-		// args
-		//
-		readsize = fread(&(stlen), 1, sizeof(uint16_t), f);
-		CHECK_READ_SIZE(readsize, sizeof(uint16_t));
+	if(d->m_index_len == d->m_index_size)
+	{
+		uint64_t size = (d->m_index_size != 0)? d->m_index_size * 2 : 1024;
+		scap_block_summary* summaries;
 
-		if(stlen >= SCAP_MAX_PATH_SIZE)
+		entry = (index_entry *)realloc(d->m_index, size * sizeof(index_entry));
+		if(entry == NULL)
 		{
-			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "invalid argslen %d", stlen);
-			return SCAP_FAILURE;
+			d->m_index_error = true;
+			return;
 		}
 
-		totreadsize += readsize;
+		d->m_index = entry;
 
-		readsize = fread(tinfo.args, 1, stlen, f);
-		CHECK_READ_SIZE(readsize, stlen);
+		summaries = (scap_block_summary *)realloc(d->m_summaries, size * sizeof(scap_block_summary));
+		if(summaries == NULL)
+		{
+			d->m_index_error = true;
+			return;
+		}
 
-		// the string is not null-terminated on file
-		tinfo.args[stlen] = 0;
-		tinfo.args_len = stlen;
+		d->m_summaries = summaries;
+		d->m_index_size = size;
+	}
 
-		totreadsize += readsize;
+	entry = &d->m_index[d->m_index_len];
+	entry->offset = offset;
+	entry->ts = ts;
+	entry->evtnum = evtnum;
+	entry->snapshot_offset = snapshot_offset;
 
-		//
-		// cwd
-		//
-		readsize = fread(&(stlen), 1, sizeof(uint16_t), f);
-		CHECK_READ_SIZE(readsize, sizeof(uint16_t));
+	if(summary != NULL)
+	{
+		memcpy(&d->m_summaries[d->m_index_len], summary, sizeof(*summary));
+	}
+	else
+	{
+		scap_summary_set_all(&d->m_summaries[d->m_index_len]);
+	}
 
-		if(stlen >= SCAP_MAX_PATH_SIZE)
+	d->m_index_len++;
+}
+
+//
+// Append the index block, as the last block of the file
+//
+static bool scap_dump_write_index(scap_dumper_t *d)
+{
+	block_header bh;
+	index_header ih;
+	uint32_t summary_size = d->m_summary_error? 0 : sizeof(scap_block_summary);
+	uint64_t len = sizeof(block_header) + sizeof(index_header) + d->m_index_len * (sizeof(index_entry) + summary_size) + 4;
+	uint32_t bt;
+
+	if(d->m_index_error || d->m_write_error || d->m_index_len == 0 || len > 0xffffffff)
+	{
+		return true;
+	}
+
+	bh.block_type = IX_BLOCK_TYPE;
+	bh.block_total_length = (uint32_t)len;
+	bt = bh.block_total_length;
+
+	ih.entry_size = sizeof(index_entry);
+	ih.summary_size = summary_size;
+	ih.nentries = d->m_index_len;
+
+	return fwrite(&bh, sizeof(bh), 1, d->m_f) == 1 &&
+		fwrite(&ih, sizeof(ih), 1, d->m_f) == 1 &&
+		fwrite(d->m_index, sizeof(index_entry), d->m_index_len, d->m_f) == d->m_index_len &&
+		(summary_size == 0 ||
+		fwrite(d->m_summaries, sizeof(scap_block_summary), d->m_index_len, d->m_f) == d->m_index_len) &&
+		fwrite(&bt, sizeof(bt), 1, d->m_f) == 1;
+}
+
+#ifdef HAS_ZLIB
+//
+// Compress the given event blocks and write them as a frame
+//
+static bool scap_dump_write_frame(scap_dumper_t *d, const char *buf, uint32_t len, OUT uint32_t *written)
+{
+	block_header bh;
+	event_frame_header fh;
+	uint32_t bt;
+	uLongf zlen = compressBound(len);
+	uint32_t needed = scap_normalize_block_len(sizeof(block_header) + sizeof(event_frame_header) + zlen + 4);
+	char* p;
+
+	if(needed > d->m_zbuf_size)
+	{
+		p = (char *)realloc(d->m_zbuf, needed);
+		if(p == NULL)
 		{
-			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "invalid cwdlen %d", stlen);
-			return SCAP_FAILURE;
+			return false;
 		}
 
-		totreadsize += readsize;
-
-		readsize = fread(tinfo.cwd, 1, stlen, f);
-		CHECK_READ_SIZE(readsize, stlen);
+		d->m_zbuf = p;
+		d->m_zbuf_size = needed;
+	}
 
-		// the string is not null-terminated on file
-		tinfo.cwd[stlen] = 0;
+	p = d->m_zbuf + sizeof(block_header) + sizeof(event_frame_header);
 
-		totreadsize += readsize;
+	if(compress2((Bytef *)p, &zlen, (const Bytef *)buf, len, d->m_compression_level) != Z_OK)
+	{
+		return false;
+	}
 
-		//
-		// fdlimit
-		//
-		readsize = fread(&(tinfo.fdlimit), 1, sizeof(uint64_t), f);
-		CHECK_READ_SIZE(readsize, sizeof(uint64_t));
+	bh.block_type = EVF_BLOCK_TYPE;
+	bh.block_total_length = scap_normalize_block_len(sizeof(block_header) + sizeof(event_frame_header) + zlen + 4);
+	bt = bh.block_total_length;
 
-		totreadsize += readsize;
+	fh.compression = EVF_COMPRESSION_ZLIB;
+	fh.compressed_len = zlen;
+	fh.uncompressed_len = len;
+	fh.reserved = 0;
 
-		//
-		// flags
-		//
-		readsize = fread(&(tinfo.flags), 1, sizeof(uint32_t), f);
-		CHECK_READ_SIZE(readsize, sizeof(uint32_t));
+	memcpy(d->m_zbuf, &bh, sizeof(bh));
+	memcpy(d->m_zbuf + sizeof(bh), &fh, sizeof(fh));
+	memset(p + zlen, 0, bt - sizeof(bh) - sizeof(fh) - zlen - sizeof(bt));
+	memcpy(d->m_zbuf + bt - sizeof(bt), &bt, sizeof(bt));
 
-		totreadsize += readsize;
+	if(fwrite(d->m_zbuf, bt, 1, d->m_f) != 1)
+	{
+		return false;
+	}
 
-		//
-		// uid
-		//
-		readsize = fread(&(tinfo.uid), 1, sizeof(uint32_t), f);
-		CHECK_READ_SIZE(readsize, sizeof(uint32_t));
+	*written = bt;
+	return true;
+}
+#endif
 
-		totreadsize += readsize;
+//
+// Write the first len bytes of m_bufs[id] to the file, and return in written
+// how many bytes that took
+//
+static bool scap_dump_write_block(scap_dumper_t *d, uint32_t id, uint32_t len, OUT uint32_t *written)
+{
+	const char* buf = d->m_bufs[id];
 
-		//
-		// gid
-		//
-		readsize = fread(&(tinfo.gid), 1, sizeof(uint32_t), f);
-		CHECK_READ_SIZE(readsize, sizeof(uint32_t));
+	*written = 0;
 
-		totreadsize += readsize;
+	if(len == 0)
+	{
+		return true;
+	}
 
-		//
-		// All parsed. Allocate the new entry and copy the temp one into into it.
-		//
-		ntinfo = (scap_threadinfo *)malloc(sizeof(scap_threadinfo));
-		if(ntinfo == NULL)
-		{
-			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "process table allocation error (fd1)");
-			return SCAP_FAILURE;
-		}
+	scap_dump_add_index_entry(d, d->m_written, d->m_block_ts[id], d->m_block_evtnum[id], d->m_block_snapshot[id],
+		&d->m_block_summary[id]);
 
-		// Structure copy
-		*ntinfo = tinfo;
+#ifdef HAS_ZLIB
+	if(d->m_compression_level != 0)
+	{
+		return scap_dump_write_frame(d, buf, len, written);
+	}
+#endif
 
-		//
-		// All parsed. Add the entry to the table
-		//
-		HASH_ADD_INT64(handle->m_proclist, tid, ntinfo);
-		if(uth_status != SCAP_SUCCESS)
-		{
-			free(ntinfo);
-			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "process table allocation error (fd2)");
-			return SCAP_FAILURE;
-		}
+	if(fwrite(buf, len, 1, d->m_f) != 1)
+	{
+		return false;
 	}
 
-	//
-	// Read the padding bytes so we properly align to the end of the data
-	//
-	padding_len = ((int32_t)block_length - (int32_t)totreadsize);
-	ASSERT(padding_len >= 0);
+	*written = len;
+	return true;
+}
 
-	readsize = fread(&padding, 1, padding_len, f);
-	CHECK_READ_SIZE(readsize, padding_len);
+//
+// Complete the current file with its index and close it
+//
+static bool scap_dump_finish_file(scap_dumper_t *d)
+{
+	bool res = scap_dump_write_index(d);
 
-	return SCAP_SUCCESS;
+	if(fclose(d->m_f) != 0)
+	{
+		res = false;
+	}
+
+	d->m_f = NULL;
+	d->m_index_len = 0;
+	d->m_index_error = false;
+	d->m_summary_error = (d->m_fold != NULL);
+	return res;
 }
 
+#ifndef _WIN32
 //
-// Parse an interface list block
+// Finish the current file, and continue in the one queued by
+// scap_dump_rotate()
 //
-int32_t scap_read_iflist(scap_t *handle, FILE *f, uint32_t block_length)
+static bool scap_dump_switch_file(scap_dumper_t *d)
 {
-	int32_t res = SCAP_SUCCESS;
-	size_t readsize;
-	size_t totreadsize;
-	char *readbuf = NULL;
-	char *pif;
-	uint16_t iftype;
-	uint16_t ifnamlen;
-	uint32_t toread;
-	uint32_t entrysize;
-	uint32_t ifcnt4 = 0;
-	uint32_t ifcnt6 = 0;
+	FILE *f;
 
-	//
-	// If the list of interfaces was already allocated for this handle (for example because this is
-	// not the first interface list block), free it
-	//
-	if(handle->m_addrlist != NULL)
+	if(!scap_dump_finish_file(d))
 	{
-		scap_free_iflist(handle->m_addrlist);
-		handle->m_addrlist = NULL;
+		return false;
 	}
 
-	//
-	// Bring the block to memory
-	// We assume that this block is always small enough that we can read it in a single shot
-	//
-	readbuf = (char *)malloc(block_length);
-	if(!readbuf)
+	f = fopen(d->m_rotate_fname, "wb");
+	if(f == NULL)
 	{
-		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "memory allocation error in scap_read_iflist");
-		return SCAP_FAILURE;
+		return false;
 	}
 
-	readsize = fread(readbuf, 1, block_length, f);
-	CHECK_READ_SIZE(readsize, block_length);
+	d->m_f = f;
 
-	//
-	// First pass, count the number of addresses
-	//
-	pif = readbuf;
-	totreadsize = 0;
+	if(fwrite(d->m_rotate_header, d->m_rotate_header_len, 1, f) != 1)
+	{
+		return false;
+	}
 
-	while(true)
+	d->m_index_error = (ftell(f) < 0);
+
+	if(d->m_rotate_remove != NULL)
 	{
-		toread = (int32_t)block_length - (int32_t)totreadsize;
+		remove(d->m_rotate_remove);
+	}
 
-		if(toread < 4)
-		{
-			break;
-		}
+	return true;
+}
 
-		iftype = *(uint16_t *)pif;
-		ifnamlen = *(uint16_t *)(pif + 2);
+static void* scap_dump_writer_thread(void *arg)
+{
+	scap_dumper_t *d = (scap_dumper_t *)arg;
+	uint32_t written;
+	bool rotated;
+	bool error;
 
-		if(iftype == SCAP_II_IPV4)
-		{
-			entrysize = sizeof(scap_ifinfo_ipv4) + ifnamlen - SCAP_MAX_PATH_SIZE;
-		}
-		else if(iftype == SCAP_II_IPV6)
-		{
-			entrysize = sizeof(scap_ifinfo_ipv6) + ifnamlen - SCAP_MAX_PATH_SIZE;
-		}
-		else if(iftype == SCAP_II_IPV4_NOLINKSPEED)
+	pthread_mutex_lock(&d->m_mutex);
+
+	while(true)
+	{
+		while(!d->m_pending && !d->m_stop)
 		{
-			entrysize = sizeof(scap_ifinfo_ipv4_nolinkspeed) + ifnamlen - SCAP_MAX_PATH_SIZE;
+			pthread_cond_wait(&d->m_cond, &d->m_mutex);
 		}
-		else if(iftype == SCAP_II_IPV6_NOLINKSPEED)
+
+		if(!d->m_pending)
 		{
-			entrysize = sizeof(scap_ifinfo_ipv6_nolinkspeed) + ifnamlen - SCAP_MAX_PATH_SIZE;
+			break;
 		}
-		else
+
+		//
+		// The buffer being saved is not touched by scap_dump() until we
+		// clear m_pending, so the lock is not needed while writing it.
+		// m_write_error is read by scap_dump() too, so it's only updated
+		// with the lock held.
+		//
+		error = d->m_write_error;
+		pthread_mutex_unlock(&d->m_mutex);
+
+		written = 0;
+
+		if(error || !scap_dump_write_block(d, 1 - d->m_cur, d->m_pending_len, &written))
 		{
-			ASSERT(false);
-			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "trace file has corrupted interface list(1)");
-			res = SCAP_FAILURE;
-			goto scap_read_iflist_error;
+			error = true;
 		}
 
-		if(toread < entrysize)
+		rotated = (d->m_rotate_fname != NULL);
+		if(rotated)
 		{
-			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "trace file has corrupted interface list(2)");
-			res = SCAP_FAILURE;
-			goto scap_read_iflist_error;
+			if(!error && !scap_dump_switch_file(d))
+			{
+				error = true;
+			}
+
+			free(d->m_rotate_fname);
+			free(d->m_rotate_header);
+			free(d->m_rotate_remove);
+			d->m_rotate_fname = NULL;
+			d->m_rotate_header = NULL;
+			d->m_rotate_remove = NULL;
 		}
 
-		pif += entrysize;
-		totreadsize += entrysize;
+		pthread_mutex_lock(&d->m_mutex);
 
-		if(iftype == SCAP_II_IPV4 || iftype == SCAP_II_IPV4_NOLINKSPEED)
-		{
-			ifcnt4++;
-		}
-		else if(iftype == SCAP_II_IPV6 || iftype == SCAP_II_IPV6_NOLINKSPEED)
+		d->m_write_error = error;
+
+		if(rotated)
 		{
-			ifcnt6++;
+			d->m_written = d->m_rotate_header_len;
 		}
 		else
 		{
-			ASSERT(false);
-			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "unknown interface type %d", (int)iftype);
-			res = SCAP_FAILURE;
-			goto scap_read_iflist_error;
+			d->m_written += written;
 		}
+
+		d->m_pending = false;
+		pthread_cond_broadcast(&d->m_cond);
 	}
 
-	//
-	// Allocate the handle and the arrays
-	//
-	handle->m_addrlist = (scap_addrlist *)malloc(sizeof(scap_addrlist));
-	if(!handle->m_addrlist)
+	pthread_mutex_unlock(&d->m_mutex);
+	return NULL;
+}
+
+//
+// Wait until the background writer is done with the other buffer
+//
+static void scap_dump_wait_pending(scap_dumper_t *d)
+{
+	pthread_mutex_lock(&d->m_mutex);
+
+	while(d->m_pending)
 	{
-		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "scap_read_iflist allocation failed(1)");
-		res = SCAP_FAILURE;
-		goto scap_read_iflist_error;
+		pthread_cond_wait(&d->m_cond, &d->m_mutex);
 	}
 
-	handle->m_addrlist->n_v4_addrs = 0;
-	handle->m_addrlist->n_v6_addrs = 0;
-	handle->m_addrlist->v4list = NULL;
-	handle->m_addrlist->v6list = NULL;
-	handle->m_addrlist->totlen = block_length;
+	pthread_mutex_unlock(&d->m_mutex);
+}
+#endif
 
-	if(ifcnt4 != 0)
+//
+// Send the buffer being filled to the file, directly or through the
+// background writer
+//
+static int32_t scap_dump_flush_buffer(scap_dumper_t *d)
+{
+	uint32_t written;
+#ifndef _WIN32
+	bool error;
+#endif
+
+#ifndef _WIN32
+	if(d->m_async)
 	{
-		handle->m_addrlist->v4list = (scap_ifinfo_ipv4 *)malloc(ifcnt4 * sizeof(scap_ifinfo_ipv4));
-		if(!handle->m_addrlist->v4list)
+		//
+		// The writer is still busy with the other buffer: throw away this
+		// one, with whole blocks so that the stream stays readable
+		//
+		if(d->m_drop_when_busy && d->m_len != 0)
 		{
-			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "scap_read_iflist allocation failed(2)");
-			res = SCAP_FAILURE;
-			goto scap_read_iflist_error;
+			pthread_mutex_lock(&d->m_mutex);
+
+			if(d->m_pending)
+			{
+				d->m_dropped_evts += d->m_nevts - d->m_block_evtnum[d->m_cur];
+				d->m_dropped_bytes += d->m_len;
+				d->m_nevts = d->m_block_evtnum[d->m_cur];
+				d->m_offset -= d->m_len;
+				d->m_len = 0;
+				error = d->m_write_error;
+				pthread_mutex_unlock(&d->m_mutex);
+				return error? SCAP_FAILURE : SCAP_SUCCESS;
+			}
+
+			pthread_mutex_unlock(&d->m_mutex);
 		}
-	}
-	else
-	{
-		handle->m_addrlist->v4list = NULL;
-	}
+
+		scap_dump_wait_pending(d);
+
+		pthread_mutex_lock(&d->m_mutex);
+		d->m_pending = true;
+		d->m_pending_len = d->m_len;
+		d->m_cur = 1 - d->m_cur;
+		d->m_len = 0;
+		error = d->m_write_error;
+		pthread_cond_broadcast(&d->m_cond);
+		pthread_mutex_unlock(&d->m_mutex);
+
+		return error? SCAP_FAILURE : SCAP_SUCCESS;
+	}
+#endif
+
+	if(!scap_dump_write_block(d, d->m_cur, d->m_len, &written))
+	{
+		d->m_write_error = true;
+	}
+
+	d->m_written += written;
+	d->m_len = 0;
+
+	return d->m_write_error? SCAP_FAILURE : SCAP_SUCCESS;
+}
+
+int32_t scap_dump_set_buffering(scap_t *handle, scap_dumper_t *d, uint32_t buffer_size, bool async)
+{
+	char* buf;
+
+	if(buffer_size < SCAP_DUMP_MIN_BUFFER_SIZE)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "the dump buffer must be at least %u bytes", SCAP_DUMP_MIN_BUFFER_SIZE);
+		return SCAP_FAILURE;
+	}
+
+#ifdef _WIN32
+	if(async)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "background dump writing not supported on windows");
+		return SCAP_FAILURE;
+	}
+#else
+	if(d->m_async)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "the dump buffering can't be changed after starting the background writer");
+		return SCAP_FAILURE;
+	}
+#endif
+
+	//
+	// Save what we have with the old buffer
+	//
+	if(scap_dump_flush_buffer(d) != SCAP_SUCCESS)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error writing to file (6)");
+		return SCAP_FAILURE;
+	}
+
+	buf = (char *)realloc(d->m_bufs[0], buffer_size);
+	if(buf == NULL)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error allocating the dump buffer");
+		return SCAP_FAILURE;
+	}
+
+	d->m_bufs[0] = buf;
+	d->m_buf_size = buffer_size;
+
+#ifndef _WIN32
+	if(async)
+	{
+		d->m_bufs[1] = (char *)malloc(buffer_size);
+		if(d->m_bufs[1] == NULL)
+		{
+			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error allocating the dump buffer");
+			return SCAP_FAILURE;
+		}
+
+		pthread_mutex_init(&d->m_mutex, NULL);
+		pthread_cond_init(&d->m_cond, NULL);
+
+		if(pthread_create(&d->m_thread, NULL, scap_dump_writer_thread, d) != 0)
+		{
+			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error starting the dump writer thread");
+			pthread_mutex_destroy(&d->m_mutex);
+			pthread_cond_destroy(&d->m_cond);
+			free(d->m_bufs[1]);
+			d->m_bufs[1] = NULL;
+			return SCAP_FAILURE;
+		}
+
+		d->m_async = true;
+	}
+#endif
+
+	return SCAP_SUCCESS;
+}
+
+int32_t scap_dump_set_compression(scap_t *handle, scap_dumper_t *d, int32_t level)
+{
+#ifndef HAS_ZLIB
+	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "compressed trace files not supported by this build");
+	return SCAP_FAILURE;
+#else
+	if(level < 0 || level > Z_BEST_COMPRESSION)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "invalid compression level %d", (int)level);
+		return SCAP_FAILURE;
+	}
+
+	//
+	// The events that are already buffered keep the old setting
+	//
+	if(scap_dump_flush_buffer(d) != SCAP_SUCCESS)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error writing to file (6)");
+		return SCAP_FAILURE;
+	}
+
+#ifndef _WIN32
+	if(d->m_async)
+	{
+		scap_dump_wait_pending(d);
+	}
+#endif
+
+	d->m_compression_level = level;
+
+	return SCAP_SUCCESS;
+#endif
+}
+
+int32_t scap_dump_snapshot(scap_t *handle, scap_dumper_t *d, scap_threadinfo *proclist)
+{
+	block_header bh;
+	snapshot_header sh;
+	uint32_t bt;
+	uint64_t len;
+	uint32_t cglen;
+	scap_fdlist_encoder enc;
+	int32_t res = SCAP_FAILURE;
+
+	//
+	// The fd list is encoded in advance to know its length
+	//
+	if(scap_encode_fdlist(handle, proclist, &enc) != SCAP_SUCCESS)
+	{
+		return SCAP_FAILURE;
+	}
+
+	//
+	// The blocks of the tables have their own header and trailer
+	//
+	len = sizeof(block_header) + sizeof(snapshot_header) +
+		scap_normalize_block_len(sizeof(block_header) + scap_proclist_len(proclist) + 4) + 4;
+
+	cglen = scap_cglist_len(proclist);
+	if(cglen != 0)
+	{
+		len += scap_normalize_block_len(sizeof(block_header) + cglen + 4);
+	}
+
+	len += scap_normalize_block_len(sizeof(block_header) + scap_fdlist_len(&enc) + 4);
+
+	if(len > 0xffffffff)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "state snapshot too big");
+		goto scap_dump_snapshot_done;
+	}
+
+	//
+	// The snapshot goes after all the events dumped so far
+	//
+	if(scap_dump_flush_fold(d, handle->m_lasterr) != SCAP_SUCCESS)
+	{
+		goto scap_dump_snapshot_done;
+	}
+
+	if(scap_dump_flush_buffer(d) != SCAP_SUCCESS)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error writing to file (6)");
+		goto scap_dump_snapshot_done;
+	}
+
+#ifndef _WIN32
+	if(d->m_async)
+	{
+		scap_dump_wait_pending(d);
+	}
+#endif
+
+	bh.block_type = SS_BLOCK_TYPE;
+	bh.block_total_length = (uint32_t)len;
+	bt = bh.block_total_length;
+
+	sh.ts = d->m_last_ts;
+	sh.evtnum = d->m_nevts;
+
+	if(d->m_write_error ||
+		fwrite(&bh, sizeof(bh), 1, d->m_f) != 1 ||
+		fwrite(&sh, sizeof(sh), 1, d->m_f) != 1 ||
+		scap_write_proclist(handle, proclist, d->m_f) != SCAP_SUCCESS ||
+		scap_write_cglist(handle, proclist, d->m_f) != SCAP_SUCCESS ||
+		scap_write_encoded_fdlist(handle, &enc, d->m_f) != SCAP_SUCCESS ||
+		fwrite(&bt, sizeof(bt), 1, d->m_f) != 1)
+	{
+		//
+		// The file can't be parsed after this point anyway
+		//
+		d->m_write_error = true;
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error writing the state snapshot");
+		goto scap_dump_snapshot_done;
+	}
+
+	d->m_snapshot_offset = d->m_written;
+	d->m_written += len;
+	d->m_offset += len;
+	res = SCAP_SUCCESS;
+
+scap_dump_snapshot_done:
+	scap_fdlist_encoder_free(&enc);
+	return res;
+}
+
+int32_t scap_dump_rotate(scap_t *handle, scap_dumper_t *d, const char *fname, scap_threadinfo *proclist, const char *remove_fname)
+{
+	FILE *f;
+
+	if(d->m_f == stdout)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "can't rotate the standard output");
+		return SCAP_FAILURE;
+	}
+
+	if(d->m_remote)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "can't rotate a remote capture");
+		return SCAP_FAILURE;
+	}
+
+	if(scap_dump_flush_fold(d, handle->m_lasterr) != SCAP_SUCCESS)
+	{
+		return SCAP_FAILURE;
+	}
+
+#ifndef _WIN32
+	if(d->m_async)
+	{
+		char *header = NULL;
+		size_t header_len = 0;
+
+		//
+		// Render the header here, with the caller's tables, and leave the
+		// file operations to the background writer
+		//
+		f = open_memstream(&header, &header_len);
+		if(f == NULL)
+		{
+			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error allocating the header of %s", fname);
+			return SCAP_FAILURE;
+		}
+
+		if(scap_write_header(handle, f, fname, proclist) != SCAP_SUCCESS)
+		{
+			fclose(f);
+			free(header);
+			return SCAP_FAILURE;
+		}
+
+		fclose(f);
+
+		scap_dump_wait_pending(d);
+
+		if(d->m_write_error)
+		{
+			free(header);
+			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error writing to file (6)");
+			return SCAP_FAILURE;
+		}
+
+		d->m_rotate_fname = strdup(fname);
+		d->m_rotate_header = header;
+		d->m_rotate_header_len = header_len;
+		d->m_rotate_remove = (remove_fname != NULL)? strdup(remove_fname) : NULL;
+
+		if(d->m_rotate_fname == NULL || (remove_fname != NULL && d->m_rotate_remove == NULL))
+		{
+			free(d->m_rotate_fname);
+			free(d->m_rotate_header);
+			free(d->m_rotate_remove);
+			d->m_rotate_fname = NULL;
+			d->m_rotate_header = NULL;
+			d->m_rotate_remove = NULL;
+			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error allocating the dumper");
+			return SCAP_FAILURE;
+		}
+
+		if(scap_dump_flush_buffer(d) != SCAP_SUCCESS)
+		{
+			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error writing to file (6)");
+			return SCAP_FAILURE;
+		}
+
+		d->m_offset = header_len;
+	}
+	else
+#endif
+	{
+		if(scap_dump_flush_buffer(d) != SCAP_SUCCESS)
+		{
+			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error writing to file (6)");
+			return SCAP_FAILURE;
+		}
+
+		if(!scap_dump_finish_file(d))
+		{
+			d->m_write_error = true;
+			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error writing to file (6)");
+			return SCAP_FAILURE;
+		}
+
+		f = fopen(fname, "wb");
+		if(f == NULL)
+		{
+			d->m_write_error = true;
+			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "can't open %s", fname);
+			return SCAP_FAILURE;
+		}
+
+		d->m_f = f;
+
+		if(scap_write_header(handle, f, fname, proclist) != SCAP_SUCCESS)
+		{
+			d->m_write_error = true;
+			return SCAP_FAILURE;
+		}
+
+		d->m_offset = (uint64_t)ftell(f);
+		d->m_written = d->m_offset;
+		d->m_index_error = (ftell(f) < 0);
+
+		if(remove_fname != NULL)
+		{
+			remove(remove_fname);
+		}
+	}
+
+	//
+	// The new file starts from scratch: event numbers and snapshots refer
+	// to it only
+	//
+	d->m_nevts = 0;
+	d->m_snapshot_offset = 0;
+
+	return SCAP_SUCCESS;
+}
+
+//
+// Close a "savefile" opened with scap_dump_open
+//
+void scap_dump_close(scap_dumper_t *d)
+{
+	char error[SCAP_LASTERR_SIZE];
+
+	//
+	// The last events are worth waiting for
+	//
+	d->m_drop_when_busy = false;
+
+	if(d->m_fold != NULL)
+	{
+		scap_dump_flush_fold(d, error);
+		scap_fold_destroy(d->m_fold);
+	}
+
+	scap_dump_flush_buffer(d);
+
+#ifndef _WIN32
+	if(d->m_async)
+	{
+		pthread_mutex_lock(&d->m_mutex);
+		d->m_stop = true;
+		pthread_cond_broadcast(&d->m_cond);
+		pthread_mutex_unlock(&d->m_mutex);
+
+		pthread_join(d->m_thread, NULL);
+		pthread_mutex_destroy(&d->m_mutex);
+		pthread_cond_destroy(&d->m_cond);
+	}
+#endif
+
+	if(d->m_f != NULL)
+	{
+		scap_dump_finish_file(d);
+	}
+
+	free(d->m_bufs[0]);
+	if(d->m_bufs[1] != NULL)
+	{
+		free(d->m_bufs[1]);
+	}
+
+	if(d->m_zbuf != NULL)
+	{
+		free(d->m_zbuf);
+	}
+
+	if(d->m_index != NULL)
+	{
+		free(d->m_index);
+	}
+
+	if(d->m_summaries != NULL)
+	{
+		free(d->m_summaries);
+	}
+
+	free(d);
+}
+
+//
+// Return the current size of a tracefile
+//
+uint64_t scap_dump_ftell(scap_dumper_t *d)
+{
+	uint64_t res;
+
+	if(d->m_compression_level == 0)
+	{
+		return d->m_offset;
+	}
+
+	//
+	// The size of the buffered events is known only once they are
+	// compressed, so count what is already in the file
+	//
+#ifndef _WIN32
+	if(d->m_async)
+	{
+		pthread_mutex_lock(&d->m_mutex);
+		res = d->m_written;
+		pthread_mutex_unlock(&d->m_mutex);
+		return res;
+	}
+#endif
+
+	res = d->m_written;
+	return res;
+}
+
+void scap_dump_get_drops(scap_dumper_t *d, OUT uint64_t *nevts, OUT uint64_t *nbytes)
+{
+	*nevts = d->m_dropped_evts;
+	*nbytes = d->m_dropped_bytes;
+}
+
+//
+// Size of the block of an event in a dump file
+//
+static inline uint32_t scap_dump_evt_block_len(scap_evt *e, uint16_t cpuid)
+{
+	return scap_normalize_block_len(sizeof(block_header) + sizeof(cpuid) + e->len + 4);
+}
+
+//
+// Render the block of an event at p, which has room for bt bytes
+//
+static void scap_dump_encode_evt(char *p, scap_evt *e, uint16_t cpuid, uint32_t bt)
+{
+	block_header bh;
+
+	bh.block_type = EV_BLOCK_TYPE;
+	bh.block_total_length = bt;
+
+	memcpy(p, &bh, sizeof(bh));
+	memcpy(p + sizeof(bh), &cpuid, sizeof(cpuid));
+	memcpy(p + sizeof(bh) + sizeof(cpuid), e, e->len);
+	memset(p + sizeof(bh) + sizeof(cpuid) + e->len, 0, bt - sizeof(bh) - sizeof(cpuid) - e->len - sizeof(bt));
+	memcpy(p + bt - sizeof(bt), &bt, sizeof(bt));
+}
+
+//
+// Account for an event of bt bytes, and return where its block goes in the
+// buffer being filled. *p is NULL when the event doesn't go in the buffer:
+// it was bigger than a whole buffer and was written on its own, or it was
+// dropped.
+//
+static int32_t scap_dump_reserve(scap_dumper_t *d, scap_evt *e, uint16_t cpuid, uint32_t bt, OUT char **p, char *error)
+{
+	block_header bh;
+
+	*p = NULL;
+
+	if(d->m_len + bt > d->m_buf_size)
+	{
+		if(scap_dump_flush_buffer(d) != SCAP_SUCCESS)
+		{
+			snprintf(error, SCAP_LASTERR_SIZE, "error writing to file (6)");
+			return SCAP_FAILURE;
+		}
+
+		//
+		// Bigger than a whole buffer: write it piece by piece, after
+		// everything that was buffered before it. This is a plain event
+		// block even if the dump is compressed
+		//
+		if(bt > d->m_buf_size)
+		{
+#ifndef _WIN32
+			if(d->m_async)
+			{
+				if(d->m_drop_when_busy)
+				{
+					pthread_mutex_lock(&d->m_mutex);
+
+					if(d->m_pending)
+					{
+						d->m_dropped_evts++;
+						d->m_dropped_bytes += bt;
+						pthread_mutex_unlock(&d->m_mutex);
+						return SCAP_SUCCESS;
+					}
+
+					pthread_mutex_unlock(&d->m_mutex);
+				}
+
+				scap_dump_wait_pending(d);
+			}
+#endif
+
+			//
+			// It gets its own index entry, so that the readers that skip
+			// groups of events don't skip it with the group before
+			//
+			scap_dump_add_index_entry(d, d->m_written, e->ts, d->m_nevts, d->m_snapshot_offset, NULL);
+			d->m_snapshot_offset = 0;
+
+			bh.block_type = EV_BLOCK_TYPE;
+			bh.block_total_length = bt;
+
+			if(d->m_write_error ||
+			        fwrite(&bh, sizeof(bh), 1, d->m_f) != 1 ||
+			        fwrite(&cpuid, sizeof(cpuid), 1, d->m_f) != 1 ||
+			        fwrite(e, e->len, 1, d->m_f) != 1 ||
+			        scap_write_padding(d->m_f, sizeof(cpuid) + e->len) != SCAP_SUCCESS ||
+			        fwrite(&bt, sizeof(bt), 1, d->m_f) != 1)
+			{
+				snprintf(error, SCAP_LASTERR_SIZE, "error writing to file (6)");
+				return SCAP_FAILURE;
+			}
+
+			d->m_offset += bt;
+			d->m_written += bt;
+			d->m_nevts++;
+			d->m_last_ts = e->ts;
+			return SCAP_SUCCESS;
+		}
+	}
+
+	if(d->m_len == 0)
+	{
+		d->m_block_ts[d->m_cur] = e->ts;
+		d->m_block_evtnum[d->m_cur] = d->m_nevts;
+		d->m_block_snapshot[d->m_cur] = d->m_snapshot_offset;
+		d->m_snapshot_offset = 0;
+	}
+
+	scap_summary_add_event(d, &d->m_block_summary[d->m_cur], e);
+
+	*p = d->m_bufs[d->m_cur] + d->m_len;
+
+	d->m_len += bt;
+	d->m_offset += bt;
+	d->m_nevts++;
+	d->m_last_ts = e->ts;
+
+	return SCAP_SUCCESS;
+}
+
+//
+// Write an event to a dump file
+//
+static int32_t scap_dump_evt(scap_dumper_t *d, scap_evt *e, uint16_t cpuid, char *error)
+{
+	uint32_t bt = scap_dump_evt_block_len(e, cpuid);
+	char* p;
+
+	if(scap_dump_reserve(d, e, cpuid, bt, &p, error) != SCAP_SUCCESS)
+	{
+		return SCAP_FAILURE;
+	}
+
+	if(p != NULL)
+	{
+		scap_dump_encode_evt(p, e, cpuid, bt);
+	}
+
+	//
+	// Enalbe this to make sure that everything is saved to disk during the tests
+	//
+#if 0
+	scap_dump_flush_buffer(d);
+	fflush(d->m_f);
+#endif
+
+	return SCAP_SUCCESS;
+}
+
+//
+// Write the events queued by the folding. The queue is always drained
+//
+static int32_t scap_dump_folded(scap_dumper_t *d, char *error)
+{
+	int32_t res = SCAP_SUCCESS;
+	scap_evt *e;
+	uint16_t cpuid;
+
+	while(scap_fold_pop(d->m_fold, &e, &cpuid))
+	{
+		if(res == SCAP_SUCCESS)
+		{
+			res = scap_dump_evt(d, e, cpuid, error);
+		}
+	}
+
+	return res;
+}
+
+//
+// End the runs being folded, before the dump is closed or moves to a new file
+//
+static int32_t scap_dump_flush_fold(scap_dumper_t *d, char *error)
+{
+	if(d->m_fold == NULL)
+	{
+		return SCAP_SUCCESS;
+	}
+
+	if(scap_fold_flush(d->m_fold, error) != SCAP_SUCCESS)
+	{
+		return SCAP_FAILURE;
+	}
+
+	return scap_dump_folded(d, error);
+}
+
+int32_t scap_dump(scap_t *handle, scap_dumper_t *d, scap_evt *e, uint16_t cpuid)
+{
+	if(d->m_fold == NULL)
+	{
+		return scap_dump_evt(d, e, cpuid, handle->m_lasterr);
+	}
+
+	if(scap_fold_event(d->m_fold, e, cpuid, handle->m_lasterr) != SCAP_SUCCESS)
+	{
+		return SCAP_FAILURE;
+	}
+
+	return scap_dump_folded(d, handle->m_lasterr);
+}
+
+//
+// The block is rendered in the buffer of the first dumper that takes it, and
+// copied from there to the buffers of the others. The buffers of a dumper
+// are not touched by the others, and the one being filled is not written
+// before its next scap_dump call, so the copy source stays valid.
+//
+int32_t scap_dump_multi(scap_t *handle, scap_dumper_t **ds, uint32_t nds, scap_evt *e, uint16_t cpuid)
+{
+	uint32_t bt = scap_dump_evt_block_len(e, cpuid);
+	char* encoded = NULL;
+	char* p;
+	uint32_t j;
+
+	for(j = 0; j < nds; j++)
+	{
+		//
+		// Folding dumpers may hold the event back, or replace it
+		//
+		if(ds[j]->m_fold != NULL)
+		{
+			if(scap_dump(handle, ds[j], e, cpuid) != SCAP_SUCCESS)
+			{
+				return SCAP_FAILURE;
+			}
+
+			continue;
+		}
+
+		if(scap_dump_reserve(ds[j], e, cpuid, bt, &p, handle->m_lasterr) != SCAP_SUCCESS)
+		{
+			return SCAP_FAILURE;
+		}
+
+		if(p == NULL)
+		{
+			continue;
+		}
+
+		if(encoded == NULL)
+		{
+			scap_dump_encode_evt(p, e, cpuid, bt);
+			encoded = p;
+		}
+		else
+		{
+			memcpy(p, encoded, bt);
+		}
+	}
+
+	return SCAP_SUCCESS;
+}
+
+int32_t scap_dump_set_fold(scap_t *handle, scap_dumper_t *d, bool enable)
+{
+	if(!enable)
+	{
+		if(d->m_fold != NULL)
+		{
+			if(scap_dump_flush_fold(d, handle->m_lasterr) != SCAP_SUCCESS)
+			{
+				return SCAP_FAILURE;
+			}
+
+			scap_fold_destroy(d->m_fold);
+			d->m_fold = NULL;
+		}
+
+		return SCAP_SUCCESS;
+	}
+
+	if(d->m_fold == NULL)
+	{
+		d->m_fold = scap_fold_create(handle->m_lasterr);
+		if(d->m_fold == NULL)
+		{
+			return SCAP_FAILURE;
+		}
+
+		//
+		// The folded events are written after the keys of their summaries
+		// are added, maybe in the next group
+		//
+		d->m_summary_error = true;
+	}
+
+	return SCAP_SUCCESS;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+// READ FUNCTIONS
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+
+#if !defined(_WIN32) && !defined(__APPLE__)
+//
+// A file that another process is still writing, see scap_open_offline_follow().
+// The events are read with stdio, up to the last block that has been
+// completely written according to the size of the file, and then inotify
+// tells when the file, or its directory, changes.
+//
+struct scap_follow
+{
+	int m_inotify_fd; // Watches the directory of the file
+	char* m_prefix; // Name of the files without the sequence number that scap_dump_rotate() appends, NULL if the name has none
+	uint64_t m_seq; // Sequence number of the current file
+	uint64_t m_pos; // Position of the next block in m_file
+	uint64_t m_size; // Size of m_file the last time it was checked
+};
+#endif
+
+//
+// Make sure that the given buffer can hold size bytes
+//
+static int32_t scap_reserve_read_buffer(scap_t *handle, char **buf, uint32_t *bufsize, uint32_t size)
+{
+	char* p;
+
+	if(size <= *bufsize)
+	{
+		return SCAP_SUCCESS;
+	}
+
+	p = (char *)realloc(*buf, size);
+	if(p == NULL)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error allocating a %u bytes read buffer", size);
+		return SCAP_FAILURE;
+	}
+
+	*buf = p;
+	*bufsize = size;
+	return SCAP_SUCCESS;
+}
+
+//
+// Bring the rest of the metadata block whose header is bh to memory with a
+// single read, and validate its trailer. b points to the content of the
+// block, which is valid until the next call.
+//
+static int32_t scap_read_block(scap_t *handle, FILE *f, block_header *bh, OUT scap_blockbuf *b)
+{
+	uint32_t len;
+	uint32_t bt;
+	size_t readsize;
+
+	if(bh->block_total_length < sizeof(block_header) + sizeof(bt))
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "invalid length %u of block type %x",
+		         bh->block_total_length,
+		         bh->block_type);
+		return SCAP_FAILURE;
+	}
+
+	len = bh->block_total_length - sizeof(block_header);
+
+	if(scap_reserve_read_buffer(handle, &handle->m_file_block, &handle->m_file_block_size, len) != SCAP_SUCCESS)
+	{
+		return SCAP_FAILURE;
+	}
+
+	readsize = fread(handle->m_file_block, 1, len, f);
+	CHECK_READ_SIZE(readsize, len);
+
+	memcpy(&bt, handle->m_file_block + len - sizeof(bt), sizeof(bt));
+	if(bt != bh->block_total_length)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "wrong block total length, header=%u, trailer=%u",
+		         bh->block_total_length,
+		         bt);
+		return SCAP_FAILURE;
+	}
+
+	b->m_buf = handle->m_file_block;
+	b->m_len = len - sizeof(bt);
+	b->m_pos = 0;
+	return SCAP_SUCCESS;
+}
+
+//
+// Keep the block read by scap_read_block() aside, to be decoded when it's
+// first needed
+//
+static void scap_keep_block(scap_t *handle, scap_blockbuf *b, char **block, uint32_t *block_len)
+{
+	if(*block != NULL)
+	{
+		free(*block);
+	}
+
+	*block = handle->m_file_block;
+	*block_len = b->m_len;
+
+	handle->m_file_block = NULL;
+	handle->m_file_block_size = 0;
+}
+
+//
+// Load the machine info block
+//
+int32_t scap_read_machine_info(scap_t *handle, scap_blockbuf *b, uint32_t block_length)
+{
+	//
+	// Read the section header block
+	//
+	if(scap_blockbuf_read(&handle->m_machine_info, sizeof(handle->m_machine_info), b) != sizeof(handle->m_machine_info))
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error reading from file (1)");
+		return SCAP_FAILURE;
+	}
+
+	return SCAP_SUCCESS;
+}
+
+//
+// Parse a process list block
+//
+int32_t scap_read_proclist(scap_t *handle, scap_blockbuf *b, uint32_t block_length)
+{
+	size_t readsize;
+	size_t totreadsize = 0;
+	struct scap_threadinfo tinfo;
+	uint16_t stlen;
+	uint32_t padding;
+	int32_t padding_len;
+	int32_t uth_status = SCAP_SUCCESS;
+	struct scap_threadinfo *ntinfo;
+
+	tinfo.fdlist = NULL;
+	tinfo.flags = 0;
+	tinfo.cgroup[0] = 0;
+
+	while(((int32_t)block_length - (int32_t)totreadsize) >= 4)
+	{
+		//
+		// tid
+		//
+		readsize = scap_blockbuf_read(&(tinfo.tid), sizeof(uint64_t), b);
+		CHECK_READ_SIZE(readsize, sizeof(uint64_t));
+
+		totreadsize += readsize;
+
+		//
+		// pid
+		//
+		readsize = scap_blockbuf_read(&(tinfo.pid), sizeof(uint64_t), b);
+		CHECK_READ_SIZE(readsize, sizeof(uint64_t));
+
+		totreadsize += readsize;
+
+		//
+		// ptid
+		//
+		readsize = scap_blockbuf_read(&(tinfo.ptid), sizeof(uint64_t), b);
+		CHECK_READ_SIZE(readsize, sizeof(uint64_t));
+
+		totreadsize += readsize;
+
+		//
+		// comm
+		//
+		readsize = scap_blockbuf_read(&(stlen), sizeof(uint16_t), b);
+		CHECK_READ_SIZE(readsize, sizeof(uint16_t));
+
+		if(stlen >= SCAP_MAX_PATH_SIZE)
+		{
+			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "invalid commlen %d", stlen);
+			return SCAP_FAILURE;
+		}
+
+		totreadsize += readsize;
+
+		readsize = scap_blockbuf_read(tinfo.comm, stlen, b);
+		CHECK_READ_SIZE(readsize, stlen);
+
+		// the string is not null-terminated on file
+		tinfo.comm[stlen] = 0;
+
+		totreadsize += readsize;
+
+		//
+		// exe
+		//
+		readsize = scap_blockbuf_read(&(stlen), sizeof(uint16_t), b);
+		CHECK_READ_SIZE(readsize, sizeof(uint16_t));
+
+		if(stlen >= SCAP_MAX_PATH_SIZE)
+		{
+			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "invalid exelen %d", stlen);
+			return SCAP_FAILURE;
+		}
+
+		totreadsize += readsize;
+
+		readsize = scap_blockbuf_read(tinfo.exe, stlen, b);
+		CHECK_READ_SIZE(readsize, stlen);
+
+		// the string is not null-terminated on file
+		tinfo.exe[stlen] = 0;
+
+		totreadsize += readsize;
+
+		//
+		// args
+		//
+		readsize = scap_blockbuf_read(&(stlen), sizeof(uint16_t), b);
+		CHECK_READ_SIZE(readsize, sizeof(uint16_t));
+
+		if(stlen >= SCAP_MAX_PATH_SIZE)
+		{
+			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "invalid argslen %d", stlen);
+			return SCAP_FAILURE;
+		}
+
+		totreadsize += readsize;
+
+		readsize = scap_blockbuf_read(tinfo.args, stlen, b);
+		CHECK_READ_SIZE(readsize, stlen);
+
+		// the string is not null-terminated on file
+		tinfo.args[stlen] = 0;
+		tinfo.args_len = stlen;
+
+		totreadsize += readsize;
+
+		//
+		// cwd
+		//
+		readsize = scap_blockbuf_read(&(stlen), sizeof(uint16_t), b);
+		CHECK_READ_SIZE(readsize, sizeof(uint16_t));
+
+		if(stlen >= SCAP_MAX_PATH_SIZE)
+		{
+			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "invalid cwdlen %d", stlen);
+			return SCAP_FAILURE;
+		}
+
+		totreadsize += readsize;
+
+		readsize = scap_blockbuf_read(tinfo.cwd, stlen, b);
+		CHECK_READ_SIZE(readsize, stlen);
+
+		// the string is not null-terminated on file
+		tinfo.cwd[stlen] = 0;
+
+		totreadsize += readsize;
+
+		//
+		// fdlimit
+		//
+		readsize = scap_blockbuf_read(&(tinfo.fdlimit), sizeof(uint64_t), b);
+		CHECK_READ_SIZE(readsize, sizeof(uint64_t));
+
+		totreadsize += readsize;
+
+		//
+		// flags
+		//
+		readsize = scap_blockbuf_read(&(tinfo.flags), sizeof(uint32_t), b);
+		CHECK_READ_SIZE(readsize, sizeof(uint32_t));
+
+		totreadsize += readsize;
+
+		//
+		// uid
+		//
+		readsize = scap_blockbuf_read(&(tinfo.uid), sizeof(uint32_t), b);
+		CHECK_READ_SIZE(readsize, sizeof(uint32_t));
+
+		totreadsize += readsize;
+
+		//
+		// gid
+		//
+		readsize = scap_blockbuf_read(&(tinfo.gid), sizeof(uint32_t), b);
+		CHECK_READ_SIZE(readsize, sizeof(uint32_t));
+
+		totreadsize += readsize;
+
+		//
+		// All parsed. Allocate the new entry and copy the temp one into into it.
+		//
+		ntinfo = (scap_threadinfo *)malloc(sizeof(scap_threadinfo));
+		if(ntinfo == NULL)
+		{
+			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "process table allocation error (fd1)");
+			return SCAP_FAILURE;
+		}
+
+		// Structure copy
+		*ntinfo = tinfo;
+
+		//
+		// All parsed. Add the entry to the table
+		//
+		HASH_ADD_INT64(handle->m_proclist, tid, ntinfo);
+		if(uth_status != SCAP_SUCCESS)
+		{
+			free(ntinfo);
+			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "process table allocation error (fd2)");
+			return SCAP_FAILURE;
+		}
+	}
+
+	//
+	// Read the padding bytes so we properly align to the end of the data
+	//
+	padding_len = ((int32_t)block_length - (int32_t)totreadsize);
+	ASSERT(padding_len >= 0);
+
+	readsize = scap_blockbuf_read(&padding, padding_len, b);
+	CHECK_READ_SIZE(readsize, padding_len);
+
+	return SCAP_SUCCESS;
+}
+
+//
+// Parse an interface list block
+//
+int32_t scap_read_iflist(scap_t *handle, scap_blockbuf *b, uint32_t block_length)
+{
+	int32_t res = SCAP_SUCCESS;
+	size_t readsize;
+	size_t totreadsize;
+	char *readbuf = NULL;
+	char *pif;
+	uint16_t iftype;
+	uint16_t ifnamlen;
+	uint32_t toread;
+	uint32_t entrysize;
+	uint32_t ifcnt4 = 0;
+	uint32_t ifcnt6 = 0;
+
+	//
+	// If the list of interfaces was already allocated for this handle (for example because this is
+	// not the first interface list block), free it
+	//
+	if(handle->m_addrlist != NULL)
+	{
+		scap_free_iflist(handle->m_addrlist);
+		handle->m_addrlist = NULL;
+	}
+
+	//
+	// The block is already in memory, parse it in place
+	//
+	readsize = MIN(block_length, b->m_len - b->m_pos);
+	CHECK_READ_SIZE(readsize, block_length);
+
+	readbuf = (char *)b->m_buf + b->m_pos;
+	b->m_pos += block_length;
+
+	//
+	// First pass, count the number of addresses
+	//
+	pif = readbuf;
+	totreadsize = 0;
+
+	while(true)
+	{
+		toread = (int32_t)block_length - (int32_t)totreadsize;
+
+		if(toread < 4)
+		{
+			break;
+		}
+
+		iftype = *(uint16_t *)pif;
+		ifnamlen = *(uint16_t *)(pif + 2);
+
+		if(iftype == SCAP_II_IPV4)
+		{
+			entrysize = sizeof(scap_ifinfo_ipv4) + ifnamlen - SCAP_MAX_PATH_SIZE;
+		}
+		else if(iftype == SCAP_II_IPV6)
+		{
+			entrysize = sizeof(scap_ifinfo_ipv6) + ifnamlen - SCAP_MAX_PATH_SIZE;
+		}
+		else if(iftype == SCAP_II_IPV4_NOLINKSPEED)
+		{
+			entrysize = sizeof(scap_ifinfo_ipv4_nolinkspeed) + ifnamlen - SCAP_MAX_PATH_SIZE;
+		}
+		else if(iftype == SCAP_II_IPV6_NOLINKSPEED)
+		{
+			entrysize = sizeof(scap_ifinfo_ipv6_nolinkspeed) + ifnamlen - SCAP_MAX_PATH_SIZE;
+		}
+		else
+		{
+			ASSERT(false);
+			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "trace file has corrupted interface list(1)");
+			res = SCAP_FAILURE;
+			goto scap_read_iflist_error;
+		}
+
+		if(toread < entrysize)
+		{
+			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "trace file has corrupted interface list(2)");
+			res = SCAP_FAILURE;
+			goto scap_read_iflist_error;
+		}
+
+		pif += entrysize;
+		totreadsize += entrysize;
+
+		if(iftype == SCAP_II_IPV4 || iftype == SCAP_II_IPV4_NOLINKSPEED)
+		{
+			ifcnt4++;
+		}
+		else if(iftype == SCAP_II_IPV6 || iftype == SCAP_II_IPV6_NOLINKSPEED)
+		{
+			ifcnt6++;
+		}
+		else
+		{
+			ASSERT(false);
+			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "unknown interface type %d", (int)iftype);
+			res = SCAP_FAILURE;
+			goto scap_read_iflist_error;
+		}
+	}
+
+	//
+	// Allocate the handle and the arrays
+	//
+	handle->m_addrlist = (scap_addrlist *)malloc(sizeof(scap_addrlist));
+	if(!handle->m_addrlist)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "scap_read_iflist allocation failed(1)");
+		res = SCAP_FAILURE;
+		goto scap_read_iflist_error;
+	}
+
+	handle->m_addrlist->n_v4_addrs = 0;
+	handle->m_addrlist->n_v6_addrs = 0;
+	handle->m_addrlist->v4list = NULL;
+	handle->m_addrlist->v6list = NULL;
+	handle->m_addrlist->totlen = block_length;
+
+	if(ifcnt4 != 0)
+	{
+		handle->m_addrlist->v4list = (scap_ifinfo_ipv4 *)malloc(ifcnt4 * sizeof(scap_ifinfo_ipv4));
+		if(!handle->m_addrlist->v4list)
+		{
+			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "scap_read_iflist allocation failed(2)");
+			res = SCAP_FAILURE;
+			goto scap_read_iflist_error;
+		}
+	}
+	else
+	{
+		handle->m_addrlist->v4list = NULL;
+	}
 
 	if(ifcnt6 != 0)
 	{
-		handle->m_addrlist->v6list = (scap_ifinfo_ipv6 *)malloc(ifcnt6 * sizeof(scap_ifinfo_ipv6));
-		if(!handle->m_addrlist->v6list)
+		handle->m_addrlist->v6list = (scap_ifinfo_ipv6 *)malloc(ifcnt6 * sizeof(scap_ifinfo_ipv6));
+		if(!handle->m_addrlist->v6list)
+		{
+			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "getifaddrs allocation failed(3)");
+			res = SCAP_FAILURE;
+			goto scap_read_iflist_error;
+		}
+	}
+	else
+	{
+		handle->m_addrlist->v6list = NULL;
+	}
+
+	handle->m_addrlist->n_v4_addrs = ifcnt4;
+	handle->m_addrlist->n_v6_addrs = ifcnt6;
+
+	//
+	// Second pass: populate the arrays
+	//
+	ifcnt4 = 0;
+	ifcnt6 = 0;
+	pif = readbuf;
+	totreadsize = 0;
+
+	while(true)
+	{
+		toread = (int32_t)block_length - (int32_t)totreadsize;
+
+		if(toread < 4)
+		{
+			break;
+		}
+
+		iftype = *(uint16_t *)pif;
+		ifnamlen = *(uint16_t *)(pif + 2);
+
+		if(ifnamlen >= SCAP_MAX_PATH_SIZE)
+		{
+			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "trace file has corrupted interface list(0)");
+			res = SCAP_FAILURE;
+			goto scap_read_iflist_error;
+		}
+
+		if(iftype == SCAP_II_IPV4)
+		{
+			entrysize = sizeof(scap_ifinfo_ipv4) + ifnamlen - SCAP_MAX_PATH_SIZE;
+
+			if(toread < entrysize)
+			{
+				snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "trace file has corrupted interface list(1)");
+				res = SCAP_FAILURE;
+				goto scap_read_iflist_error;
+			}
+
+			// Copy the entry
+			memcpy(handle->m_addrlist->v4list + ifcnt4, pif, entrysize);
+
+			// Make sure the name string is NULL-terminated
+			*((char *)(handle->m_addrlist->v4list + ifcnt4) + entrysize) = 0;
+
+			pif += entrysize;
+			totreadsize += entrysize;
+
+			ifcnt4++;
+		}
+		else if(iftype == SCAP_II_IPV4_NOLINKSPEED)
+		{
+			scap_ifinfo_ipv4_nolinkspeed* src;
+			scap_ifinfo_ipv4* dst;
+
+			entrysize = sizeof(scap_ifinfo_ipv4_nolinkspeed) + ifnamlen - SCAP_MAX_PATH_SIZE;
+
+			if(toread < entrysize)
+			{
+				snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "trace file has corrupted interface list(1)");
+				res = SCAP_FAILURE;
+				goto scap_read_iflist_error;
+			}
+
+			// Copy the entry
+			src = (scap_ifinfo_ipv4_nolinkspeed*)pif;
+			dst = handle->m_addrlist->v4list + ifcnt4;
+
+			dst->type = src->type;
+			dst->ifnamelen = src->ifnamelen;
+			dst->addr = src->addr;
+			dst->netmask = src->netmask;
+			dst->bcast = src->bcast;
+			dst->linkspeed = 0;
+			memcpy(dst->ifname, src->ifname, MIN(dst->ifnamelen, SCAP_MAX_PATH_SIZE - 1));
+
+			// Make sure the name string is NULL-terminated
+			*((char *)(dst->ifname + MIN(dst->ifnamelen, SCAP_MAX_PATH_SIZE - 1))) = 0;
+
+			pif += entrysize;
+			totreadsize += entrysize;
+
+			ifcnt4++;
+		}
+		else if(iftype == SCAP_II_IPV6)
+		{
+			entrysize = sizeof(scap_ifinfo_ipv6) + ifnamlen - SCAP_MAX_PATH_SIZE;
+
+			if(toread < entrysize)
+			{
+				snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "trace file has corrupted interface list(1)");
+				res = SCAP_FAILURE;
+				goto scap_read_iflist_error;
+			}
+
+			// Copy the entry
+			memcpy(handle->m_addrlist->v6list + ifcnt6, pif, entrysize);
+
+			// Make sure the name string is NULL-terminated
+			*((char *)(handle->m_addrlist->v6list + ifcnt6) + entrysize) = 0;
+
+			pif += entrysize;
+			totreadsize += entrysize;
+
+			ifcnt6++;
+		}
+		else if(iftype == SCAP_II_IPV6_NOLINKSPEED)
+		{
+			scap_ifinfo_ipv6_nolinkspeed* src;
+			scap_ifinfo_ipv6* dst;
+			entrysize = sizeof(scap_ifinfo_ipv6_nolinkspeed) + ifnamlen - SCAP_MAX_PATH_SIZE;
+
+			if(toread < entrysize)
+			{
+				snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "trace file has corrupted interface list(1)");
+				res = SCAP_FAILURE;
+				goto scap_read_iflist_error;
+			}
+
+			// Copy the entry
+			src = (scap_ifinfo_ipv6_nolinkspeed*)pif;
+			dst = handle->m_addrlist->v6list + ifcnt6;
+
+			dst->type = src->type;
+			dst->ifnamelen = src->ifnamelen;
+			memcpy(dst->addr, src->addr, SCAP_IPV6_ADDR_LEN);
+			memcpy(dst->netmask, src->netmask, SCAP_IPV6_ADDR_LEN);
+			memcpy(dst->bcast, src->bcast, SCAP_IPV6_ADDR_LEN);
+			dst->linkspeed = 0;
+			memcpy(dst->ifname, src->ifname, MIN(dst->ifnamelen, SCAP_MAX_PATH_SIZE - 1));
+
+			// Make sure the name string is NULL-terminated
+			*((char *)(dst->ifname + MIN(dst->ifnamelen, SCAP_MAX_PATH_SIZE - 1))) = 0;
+
+			pif += entrysize;
+			totreadsize += entrysize;
+
+			ifcnt6++;
+		}
+		else
+		{
+			ASSERT(false);
+			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "unknown interface type %d", (int)iftype);
+			res = SCAP_FAILURE;
+			goto scap_read_iflist_error;
+		}
+	}
+
+	return res;
+
+scap_read_iflist_error:
+	scap_free_iflist(handle->m_addrlist);
+	handle->m_addrlist = NULL;
+
+	return res;
+}
+
+//
+// Parse a user list block
+//
+int32_t scap_read_userlist(scap_t *handle, scap_blockbuf *b, uint32_t block_length)
+{
+	size_t readsize;
+	size_t totreadsize = 0;
+	uint32_t padding;
+	int32_t padding_len;
+	uint8_t type;
+	uint16_t stlen;
+
+	//
+	// If the list of users was already allocated for this handle (for example because this is
+	// not the first interface list block), free it
+	//
+	if(handle->m_userlist != NULL)
+	{
+		scap_free_userlist(handle->m_userlist);
+		handle->m_userlist = NULL;
+	}
+
+	//
+	// Allocate and initialize the handle info
+	//
+	handle->m_userlist = (scap_userlist*)malloc(sizeof(scap_userlist));
+	if(handle->m_userlist == NULL)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "userlist allocation failed(2)");
+		return SCAP_FAILURE;
+	}
+
+	handle->m_userlist->nusers = 0;
+	handle->m_userlist->ngroups = 0;
+	handle->m_userlist->totsavelen = 0;
+	handle->m_userlist->users = NULL;
+	handle->m_userlist->groups = NULL;
+
+	//
+	// Import the blocks
+	//
+	while(((int32_t)block_length - (int32_t)totreadsize) >= 4)
+	{
+		//
+		// type
+		//
+		readsize = scap_blockbuf_read(&(type), sizeof(type), b);
+		CHECK_READ_SIZE(readsize, sizeof(type));
+
+		totreadsize += readsize;
+
+		if(type == USERBLOCK_TYPE_USER)
+		{
+			scap_userinfo* puser;
+
+			handle->m_userlist->nusers++;
+			handle->m_userlist->users = (scap_userinfo*)realloc(handle->m_userlist->users, handle->m_userlist->nusers * sizeof(scap_userinfo));
+			if(handle->m_userlist->users == NULL)
+			{
+				snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "memory allocation error in scap_read_userlist(1)");
+				return SCAP_FAILURE;
+			}
+
+			puser = &handle->m_userlist->users[handle->m_userlist->nusers -1];
+
+			//
+			// uid
+			//
+			readsize = scap_blockbuf_read(&(puser->uid), sizeof(uint32_t), b);
+			CHECK_READ_SIZE(readsize, sizeof(uint32_t));
+
+			totreadsize += readsize;
+
+			//
+			// gid
+			//
+			readsize = scap_blockbuf_read(&(puser->gid), sizeof(uint32_t), b);
+			CHECK_READ_SIZE(readsize, sizeof(uint32_t));
+
+			totreadsize += readsize;
+
+			//
+			// name
+			//
+			readsize = scap_blockbuf_read(&(stlen), sizeof(uint16_t), b);
+			CHECK_READ_SIZE(readsize, sizeof(uint16_t));
+
+			if(stlen >= MAX_CREDENTIALS_STR_LEN)
+			{
+				snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "invalid user name len %d", stlen);
+				return SCAP_FAILURE;
+			}
+
+			totreadsize += readsize;
+
+			readsize = scap_blockbuf_read(puser->name, stlen, b);
+			CHECK_READ_SIZE(readsize, stlen);
+
+			// the string is not null-terminated on file
+			puser->name[stlen] = 0;
+
+			totreadsize += readsize;
+
+			//
+			// homedir
+			//
+			readsize = scap_blockbuf_read(&(stlen), sizeof(uint16_t), b);
+			CHECK_READ_SIZE(readsize, sizeof(uint16_t));
+
+			if(stlen >= MAX_CREDENTIALS_STR_LEN)
+			{
+				snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "invalid user homedir len %d", stlen);
+				return SCAP_FAILURE;
+			}
+
+			totreadsize += readsize;
+
+			readsize = scap_blockbuf_read(puser->homedir, stlen, b);
+			CHECK_READ_SIZE(readsize, stlen);
+
+			// the string is not null-terminated on file
+			puser->homedir[stlen] = 0;
+
+			totreadsize += readsize;
+
+			//
+			// shell
+			//
+			readsize = scap_blockbuf_read(&(stlen), sizeof(uint16_t), b);
+			CHECK_READ_SIZE(readsize, sizeof(uint16_t));
+
+			if(stlen >= MAX_CREDENTIALS_STR_LEN)
+			{
+				snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "invalid user shell len %d", stlen);
+				return SCAP_FAILURE;
+			}
+
+			totreadsize += readsize;
+
+			readsize = scap_blockbuf_read(puser->shell, stlen, b);
+			CHECK_READ_SIZE(readsize, stlen);
+
+			// the string is not null-terminated on file
+			puser->shell[stlen] = 0;
+
+			totreadsize += readsize;
+		}
+		else
+		{
+			scap_groupinfo* pgroup;
+
+			handle->m_userlist->ngroups++;
+			handle->m_userlist->groups = (scap_groupinfo*)realloc(handle->m_userlist->groups, handle->m_userlist->ngroups * sizeof(scap_groupinfo));
+			if(handle->m_userlist->groups == NULL)
+			{
+				snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "memory allocation error in scap_read_userlist(2)");
+				return SCAP_FAILURE;
+			}
+
+			pgroup = &handle->m_userlist->groups[handle->m_userlist->ngroups -1];
+
+			//
+			// gid
+			//
+			readsize = scap_blockbuf_read(&(pgroup->gid), sizeof(uint32_t), b);
+			CHECK_READ_SIZE(readsize, sizeof(uint32_t));
+
+			totreadsize += readsize;
+
+			//
+			// name
+			//
+			readsize = scap_blockbuf_read(&(stlen), sizeof(uint16_t), b);
+			CHECK_READ_SIZE(readsize, sizeof(uint16_t));
+
+			if(stlen >= MAX_CREDENTIALS_STR_LEN)
+			{
+				snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "invalid group name len %d", stlen);
+				return SCAP_FAILURE;
+			}
+
+			totreadsize += readsize;
+
+			readsize = scap_blockbuf_read(pgroup->name, stlen, b);
+			CHECK_READ_SIZE(readsize, stlen);
+
+			// the string is not null-terminated on file
+			pgroup->name[stlen] = 0;
+
+			totreadsize += readsize;
+		}
+	}
+
+	//
+	// Read the padding bytes so we properly align to the end of the data
+	//
+	padding_len = ((int32_t)block_length - (int32_t)totreadsize);
+	ASSERT(padding_len >= 0);
+
+	readsize = scap_blockbuf_read(&padding, padding_len, b);
+	CHECK_READ_SIZE(readsize, padding_len);
+
+	return SCAP_SUCCESS;
+}
+
+//
+// Parse a process list block
+//
+int32_t scap_read_fdlist(scap_t *handle, scap_blockbuf *b, uint32_t block_length)
+{
+	size_t readsize;
+	size_t totreadsize = 0;
+	struct scap_threadinfo *tinfo;
+	scap_fdinfo fdi;
+	scap_fdinfo *nfdi;
+	//  uint16_t stlen;
+	uint64_t tid;
+	int32_t uth_status = SCAP_SUCCESS;
+	uint32_t padding;
+	int32_t padding_len;
+
+	//
+	// Read the tid
+	//
+	readsize = scap_blockbuf_read(&tid, sizeof(tid), b);
+	CHECK_READ_SIZE(readsize, sizeof(tid));
+	totreadsize += readsize;
+
+	//
+	// Identify the process descriptor
+	//
+	HASH_FIND_INT64(handle->m_proclist, &tid, tinfo);
+	if(tinfo == NULL)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "corrupted trace file. FD block references TID %"PRIu64", which doesn't exist.",
+		         tid);
+		return SCAP_FAILURE;
+	}
+
+	while(((int32_t)block_length - (int32_t)totreadsize) >= 4)
+	{
+		if(scap_fd_read_from_disk(handle, &fdi, &readsize, b) != SCAP_SUCCESS)
+		{
+			return SCAP_FAILURE;
+		}
+		totreadsize += readsize;
+
+		//
+		// Parsed successfully. Allocate the new entry and copy the temp one into into it.
+		//
+		nfdi = (scap_fdinfo *)malloc(sizeof(scap_fdinfo));
+		if(nfdi == NULL)
+		{
+			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "process table allocation error (fd1)");
+			return SCAP_FAILURE;
+		}
+
+		// Structure copy
+		*nfdi = fdi;
+
+		//
+		// Add the entry to the table
+		//
+		HASH_ADD_INT64(tinfo->fdlist, fd, nfdi);
+		if(uth_status != SCAP_SUCCESS)
+		{
+			free(nfdi);
+			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "process table allocation error (fd2)");
+			return SCAP_FAILURE;
+		}
+	}
+
+	//
+	// Read the padding bytes so we properly align to the end of the data
+	//
+	padding_len = ((int32_t)block_length - (int32_t)totreadsize);
+	ASSERT(padding_len >= 0);
+
+	readsize = scap_blockbuf_read(&padding, padding_len, b);
+	CHECK_READ_SIZE(readsize, padding_len);
+
+	return SCAP_SUCCESS;
+}
+
+//
+// Read a varint of the compact fd list
+//
+static int32_t scap_blockbuf_read_varint(scap_blockbuf *b, OUT uint64_t *res)
+{
+	uint64_t v = 0;
+	uint32_t shift = 0;
+	uint8_t c;
+
+	do
+	{
+		if(b->m_pos == b->m_len || shift > 63)
+		{
+			return SCAP_FAILURE;
+		}
+
+		c = (uint8_t)b->m_buf[b->m_pos++];
+		v |= (uint64_t)(c & 0x7f) << shift;
+		shift += 7;
+	}
+	while(c & 0x80);
+
+	*res = v;
+	return SCAP_SUCCESS;
+}
+
+//
+// A name of the name table of the compact fd list, pointing to the block
+//
+typedef struct scap_fdlist_name
+{
+	const char* m_str;
+	uint32_t m_len;
+}scap_fdlist_name;
+
+//
+// Read a name of the compact fd list, given as an index in the name table
+//
+static int32_t scap_fdlist_read_name(scap_blockbuf *b, scap_fdlist_name *names, uint32_t nnames, OUT char *dst)
+{
+	uint64_t idx;
+
+	if(scap_blockbuf_read_varint(b, &idx) != SCAP_SUCCESS || idx >= nnames)
+	{
+		return SCAP_FAILURE;
+	}
+
+	memcpy(dst, names[idx].m_str, names[idx].m_len);
+	dst[names[idx].m_len] = 0;
+	return SCAP_SUCCESS;
+}
+
+//
+// Parse a compact fd list block
+//
+static int32_t scap_read_fdlist_compact(scap_t *handle, scap_blockbuf *b, uint32_t block_length)
+{
+	fdlist_compact_header ch;
+	scap_fdlist_name *names = NULL;
+	struct scap_threadinfo *tinfo;
+	scap_fdinfo fdi;
+	scap_fdinfo *nfdi;
+	scap_blockbuf sb;
+	uint64_t tid = 0;
+	uint64_t nfds;
+	uint64_t v;
+	uint8_t type;
+	uint32_t j;
+	int32_t res = SCAP_FAILURE;
+	int32_t uth_status = SCAP_SUCCESS;
+	bool ok;
+
+	if(scap_blockbuf_read(&ch, sizeof(ch), b) != sizeof(ch) ||
+		ch.strings_len > b->m_len - b->m_pos ||
+		ch.nstrings > ch.strings_len)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "corrupted fd list header");
+		return SCAP_FAILURE;
+	}
+
+	//
+	// The name table
+	//
+	if(ch.nstrings != 0)
+	{
+		names = (scap_fdlist_name *)malloc(ch.nstrings * sizeof(scap_fdlist_name));
+		if(names == NULL)
+		{
+			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "fd list allocation error");
+			return SCAP_FAILURE;
+		}
+	}
+
+	sb.m_buf = b->m_buf + b->m_pos;
+	sb.m_len = ch.strings_len;
+	sb.m_pos = 0;
+
+	for(j = 0; j < ch.nstrings; j++)
+	{
+		if(scap_blockbuf_read_varint(&sb, &v) != SCAP_SUCCESS ||
+			v >= SCAP_MAX_PATH_SIZE ||
+			v > sb.m_len - sb.m_pos)
+		{
+			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "corrupted fd list name table");
+			goto scap_read_fdlist_compact_done;
+		}
+
+		names[j].m_str = sb.m_buf + sb.m_pos;
+		names[j].m_len = (uint32_t)v;
+		sb.m_pos += (uint32_t)v;
+	}
+
+	b->m_pos += ch.strings_len;
+
+	//
+	// The processes
+	//
+	for(j = 0; j < ch.nprocs; j++)
+	{
+		if(scap_blockbuf_read_varint(b, &v) != SCAP_SUCCESS ||
+			scap_blockbuf_read_varint(b, &nfds) != SCAP_SUCCESS)
+		{
+			goto scap_read_fdlist_compact_corrupted;
+		}
+
+		tid += SCAP_UNZIGZAG(v);
+
+		HASH_FIND_INT64(handle->m_proclist, &tid, tinfo);
+		if(tinfo == NULL)
+		{
+			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "corrupted trace file. FD block references TID %"PRIu64", which doesn't exist.",
+			         tid);
+			goto scap_read_fdlist_compact_done;
+		}
+
+		fdi.fd = 0;
+		fdi.ino = 0;
+
+		for(; nfds != 0; nfds--)
+		{
+			if(scap_blockbuf_read_varint(b, &v) != SCAP_SUCCESS)
+			{
+				goto scap_read_fdlist_compact_corrupted;
+			}
+
+			fdi.fd += SCAP_UNZIGZAG(v);
+
+			if(scap_blockbuf_read_varint(b, &v) != SCAP_SUCCESS ||
+				scap_blockbuf_read(&type, sizeof(type), b) != sizeof(type))
+			{
+				goto scap_read_fdlist_compact_corrupted;
+			}
+
+			fdi.ino += SCAP_UNZIGZAG(v);
+			fdi.type = (scap_fd_type)type;
+
+			switch(fdi.type)
+			{
+			case SCAP_FD_IPV4_SOCK:
+				ok = scap_blockbuf_read(&fdi.info.ipv4info.sip, sizeof(uint32_t), b) == sizeof(uint32_t) &&
+					scap_blockbuf_read(&fdi.info.ipv4info.dip, sizeof(uint32_t), b) == sizeof(uint32_t) &&
+					scap_blockbuf_read(&fdi.info.ipv4info.sport, sizeof(uint16_t), b) == sizeof(uint16_t) &&
+					scap_blockbuf_read(&fdi.info.ipv4info.dport, sizeof(uint16_t), b) == sizeof(uint16_t) &&
+					scap_blockbuf_read(&fdi.info.ipv4info.l4proto, sizeof(uint8_t), b) == sizeof(uint8_t);
+				break;
+			case SCAP_FD_IPV4_SERVSOCK:
+				ok = scap_blockbuf_read(&fdi.info.ipv4serverinfo.ip, sizeof(uint32_t), b) == sizeof(uint32_t) &&
+					scap_blockbuf_read(&fdi.info.ipv4serverinfo.port, sizeof(uint16_t), b) == sizeof(uint16_t) &&
+					scap_blockbuf_read(&fdi.info.ipv4serverinfo.l4proto, sizeof(uint8_t), b) == sizeof(uint8_t);
+				break;
+			case SCAP_FD_IPV6_SOCK:
+				ok = scap_blockbuf_read(fdi.info.ipv6info.sip, sizeof(uint32_t) * 4, b) == sizeof(uint32_t) * 4 &&
+					scap_blockbuf_read(fdi.info.ipv6info.dip, sizeof(uint32_t) * 4, b) == sizeof(uint32_t) * 4 &&
+					scap_blockbuf_read(&fdi.info.ipv6info.sport, sizeof(uint16_t), b) == sizeof(uint16_t) &&
+					scap_blockbuf_read(&fdi.info.ipv6info.dport, sizeof(uint16_t), b) == sizeof(uint16_t) &&
+					scap_blockbuf_read(&fdi.info.ipv6info.l4proto, sizeof(uint8_t), b) == sizeof(uint8_t);
+				break;
+			case SCAP_FD_IPV6_SERVSOCK:
+				ok = scap_blockbuf_read(fdi.info.ipv6serverinfo.ip, sizeof(uint32_t) * 4, b) == sizeof(uint32_t) * 4 &&
+					scap_blockbuf_read(&fdi.info.ipv6serverinfo.port, sizeof(uint16_t), b) == sizeof(uint16_t) &&
+					scap_blockbuf_read(&fdi.info.ipv6serverinfo.l4proto, sizeof(uint8_t), b) == sizeof(uint8_t);
+				break;
+			case SCAP_FD_UNIX_SOCK:
+				ok = scap_blockbuf_read(&fdi.info.unix_socket_info.source, sizeof(uint64_t), b) == sizeof(uint64_t) &&
+					scap_blockbuf_read(&fdi.info.unix_socket_info.destination, sizeof(uint64_t), b) == sizeof(uint64_t) &&
+					scap_fdlist_read_name(b, names, ch.nstrings, fdi.info.unix_socket_info.fname) == SCAP_SUCCESS;
+				break;
+			case SCAP_FD_FIFO:
+			case SCAP_FD_FILE:
+			case SCAP_FD_DIRECTORY:
+			case SCAP_FD_UNSUPPORTED:
+			case SCAP_FD_EVENT:
+			case SCAP_FD_SIGNALFD:
+			case SCAP_FD_EVENTPOLL:
+			case SCAP_FD_INOTIFY:
+			case SCAP_FD_TIMERFD:
+				ok = scap_fdlist_read_name(b, names, ch.nstrings, fdi.info.fname) == SCAP_SUCCESS;
+				break;
+			default:
+				snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error reading the fd info from file, wrong fd type %u", (uint32_t)type);
+				goto scap_read_fdlist_compact_done;
+			}
+
+			if(!ok)
+			{
+				goto scap_read_fdlist_compact_corrupted;
+			}
+
+			nfdi = (scap_fdinfo *)malloc(sizeof(scap_fdinfo));
+			if(nfdi == NULL)
+			{
+				snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "process table allocation error (fd1)");
+				goto scap_read_fdlist_compact_done;
+			}
+
+			// Structure copy
+			*nfdi = fdi;
+
+			HASH_ADD_INT64(tinfo->fdlist, fd, nfdi);
+			if(uth_status != SCAP_SUCCESS)
+			{
+				free(nfdi);
+				snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "process table allocation error (fd2)");
+				goto scap_read_fdlist_compact_done;
+			}
+		}
+	}
+
+	//
+	// Skip the padding
+	//
+	b->m_pos = b->m_len;
+	res = SCAP_SUCCESS;
+	goto scap_read_fdlist_compact_done;
+
+scap_read_fdlist_compact_corrupted:
+	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "corrupted fd list of TID %"PRIu64, tid);
+
+scap_read_fdlist_compact_done:
+	if(names != NULL)
+	{
+		free(names);
+	}
+
+	return res;
+}
+
+//
+// Skip len bytes of the file. The remote captures can't seek, so they
+// are read and thrown away
+//
+static int32_t scap_skip(FILE *f, uint64_t len)
+{
+	char buf[4096];
+	size_t toread;
+
+	if(len <= 0x7fffffff && fseek(f, (long)len, SEEK_CUR) == 0)
+	{
+		return SCAP_SUCCESS;
+	}
+
+	while(len != 0)
+	{
+		toread = (len < sizeof(buf))? (size_t)len : sizeof(buf);
+
+		if(fread(buf, 1, toread, f) != toread)
+		{
+			return SCAP_FAILURE;
+		}
+
+		len -= toread;
+	}
+
+	return SCAP_SUCCESS;
+}
+
+//
+// Parse a cgroup list block, and set the cgroups of the processes already
+// in the table
+//
+static int32_t scap_read_cglist(scap_t *handle, scap_blockbuf *b, uint32_t block_length)
+{
+	size_t readsize;
+	size_t totreadsize = 0;
+	uint64_t tid;
+	uint16_t cglen;
+	char cgroup[SCAP_MAX_PATH_SIZE];
+	struct scap_threadinfo *tinfo;
+
+	while(block_length - totreadsize >= sizeof(uint64_t) + sizeof(uint16_t))
+	{
+		readsize = scap_blockbuf_read(&tid, sizeof(uint64_t), b);
+		CHECK_READ_SIZE(readsize, sizeof(uint64_t));
+		totreadsize += readsize;
+
+		readsize = scap_blockbuf_read(&cglen, sizeof(uint16_t), b);
+		CHECK_READ_SIZE(readsize, sizeof(uint16_t));
+		totreadsize += readsize;
+
+		if(cglen >= SCAP_MAX_PATH_SIZE || cglen > block_length - totreadsize)
+		{
+			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "invalid cgroup length %d", cglen);
+			return SCAP_FAILURE;
+		}
+
+		readsize = scap_blockbuf_read(cgroup, cglen, b);
+		CHECK_READ_SIZE(readsize, cglen);
+		totreadsize += readsize;
+
+		cgroup[cglen] = 0;
+
+		HASH_FIND_INT64(handle->m_proclist, &tid, tinfo);
+		if(tinfo != NULL)
+		{
+			memcpy(tinfo->cgroup, cgroup, cglen + 1);
+		}
+	}
+
+	b->m_pos += block_length - totreadsize;
+	return SCAP_SUCCESS;
+}
+
+//
+// Parse the headers of a trace file and load the tables
+//
+int32_t scap_read_init(scap_t *handle, FILE *f)
+{
+	block_header bh;
+	section_header_block sh;
+	scap_blockbuf b;
+	int32_t res;
+	uint32_t bt;
+	size_t readsize;
+	size_t toread;
+	int fseekres;
+
+	handle->m_file_next_block_valid = false;
+
+	//
+	// Read the section header block
+	//
+	if(fread(&bh, sizeof(bh), 1, f) != 1 ||
+	        fread(&sh, sizeof(sh), 1, f) != 1 ||
+	        fread(&bt, sizeof(bt), 1, f) != 1)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error reading from file (1)");
+		return SCAP_FAILURE;
+	}
+
+	if(bh.block_type != SHB_BLOCK_TYPE)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "invalid block type");
+		return SCAP_FAILURE;
+	}
+
+	if(sh.byte_order_magic != 0x1a2b3c4d)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "invalid magic number");
+		return SCAP_FAILURE;
+	}
+
+	//
+	// Read the metadata blocks (processes, FDs, etc.)
+	//
+	while(true)
+	{
+		readsize = fread(&bh, 1, sizeof(bh), f);
+
+#if !defined(_WIN32) && !defined(__APPLE__)
+		if(readsize == 0 && handle->m_file_follow != NULL)
+		{
+			//
+			// The writer hasn't written any event yet
+			//
+			clearerr(f);
+			handle->m_file_evts_offset = ftell(f);
+			handle->m_file_follow->m_pos = handle->m_file_evts_offset;
+			return SCAP_SUCCESS;
+		}
+#endif
+
+		CHECK_READ_SIZE(readsize, sizeof(bh));
+
+		switch(bh.block_type)
+		{
+		case EV_BLOCK_TYPE:
+		case EV_BLOCK_TYPE_INT:
+		case EVF_BLOCK_TYPE:
+			//
+			// We're done with the metadata headers. Rewind the file position so we are aligned to start reading the events.
+			//
+			fseekres = fseek(f, (long)0 - sizeof(bh), SEEK_CUR);
+			if(fseekres == 0)
+			{
+				handle->m_file_evts_offset = ftell(f);
+#if !defined(_WIN32) && !defined(__APPLE__)
+				if(handle->m_file_follow != NULL)
+				{
+					handle->m_file_follow->m_pos = handle->m_file_evts_offset;
+				}
+#endif
+				res = SCAP_SUCCESS;
+			}
+			else if(errno == ESPIPE || errno == EINVAL)
+			{
+				//
+				// A remote capture. scap_next_offline() will start
+				// from this header
+				//
+				handle->m_file_next_block_type = bh.block_type;
+				handle->m_file_next_block_len = bh.block_total_length;
+				handle->m_file_next_block_valid = true;
+				res = SCAP_SUCCESS;
+			}
+			else
+			{
+				snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error seeking in file");
+				res = SCAP_FAILURE;
+			}
+
+			//
+			// The parse buffer is only needed again if a snapshot is loaded
+			//
+			free(handle->m_file_block);
+			handle->m_file_block = NULL;
+			handle->m_file_block_size = 0;
+			return res;
+		case MI_BLOCK_TYPE:
+		case MI_BLOCK_TYPE_INT:
+		case PL_BLOCK_TYPE:
+		case PL_BLOCK_TYPE_INT:
+		case FDL_BLOCK_TYPE:
+		case FDL_BLOCK_TYPE_INT:
+		case FDLC_BLOCK_TYPE:
+		case CG_BLOCK_TYPE:
+		case IL_BLOCK_TYPE:
+		case IL_BLOCK_TYPE_INT:
+		case UL_BLOCK_TYPE:
+		case UL_BLOCK_TYPE_INT:
+			//
+			// Bring the whole block to memory and parse it from there
+			//
+			if(scap_read_block(handle, f, &bh, &b) != SCAP_SUCCESS)
+			{
+				return SCAP_FAILURE;
+			}
+
+			switch(bh.block_type)
+			{
+			case MI_BLOCK_TYPE:
+			case MI_BLOCK_TYPE_INT:
+				res = scap_read_machine_info(handle, &b, b.m_len);
+				break;
+			case PL_BLOCK_TYPE:
+			case PL_BLOCK_TYPE_INT:
+				res = scap_read_proclist(handle, &b, b.m_len);
+				break;
+			case FDL_BLOCK_TYPE:
+			case FDL_BLOCK_TYPE_INT:
+				res = scap_read_fdlist(handle, &b, b.m_len);
+				break;
+			case FDLC_BLOCK_TYPE:
+				res = scap_read_fdlist_compact(handle, &b, b.m_len);
+				break;
+			case CG_BLOCK_TYPE:
+				res = scap_read_cglist(handle, &b, b.m_len);
+				break;
+			case IL_BLOCK_TYPE:
+			case IL_BLOCK_TYPE_INT:
+				//
+				// The interfaces and the users are often not needed at
+				// all, decode them the first time they're asked for
+				//
+				scap_keep_block(handle, &b, &handle->m_file_iflist_block, &handle->m_file_iflist_block_len);
+				res = SCAP_SUCCESS;
+				break;
+			default:
+				scap_keep_block(handle, &b, &handle->m_file_userlist_block, &handle->m_file_userlist_block_len);
+				res = SCAP_SUCCESS;
+				break;
+			}
+
+			if(res != SCAP_SUCCESS)
+			{
+				return SCAP_FAILURE;
+			}
+			break;
+		default:
+			//
+			// Unknwon block type. Skip the block.
+			//
+			toread = bh.block_total_length - sizeof(block_header) - 4;
+			if(scap_skip(f, toread) != SCAP_SUCCESS)
+			{
+				snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "corrupted input file. Can't skip block of type %x and size %u.",
+				         (int)bh.block_type,
+				         (unsigned int)toread);
+				return SCAP_FAILURE;
+			}
+
+			//
+			// Read and validate the trailer
+			//
+			readsize = fread(&bt, 1, sizeof(bt), f);
+			CHECK_READ_SIZE(readsize, sizeof(bt));
+
+			if(bt != bh.block_total_length)
+			{
+				snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "wrong block total length, header=%u, trailer=%u",
+				         bh.block_total_length,
+				         bt);
+				return SCAP_FAILURE;
+			}
+			break;
+		}
+	}
+
+	return SCAP_SUCCESS;
+}
+
+//
+// Decode the interface list block that scap_read_init() kept aside, if any
+//
+int32_t scap_load_iflist(scap_t *handle)
+{
+	scap_blockbuf b;
+	int32_t res;
+
+	if(handle->m_file_iflist_block == NULL)
+	{
+		return SCAP_SUCCESS;
+	}
+
+	b.m_buf = handle->m_file_iflist_block;
+	b.m_len = handle->m_file_iflist_block_len;
+	b.m_pos = 0;
+
+	res = scap_read_iflist(handle, &b, b.m_len);
+
+	free(handle->m_file_iflist_block);
+	handle->m_file_iflist_block = NULL;
+	return res;
+}
+
+//
+// Decode the user list block that scap_read_init() kept aside, if any
+//
+int32_t scap_load_userlist(scap_t *handle)
+{
+	scap_blockbuf b;
+	int32_t res;
+
+	if(handle->m_file_userlist_block == NULL)
+	{
+		return SCAP_SUCCESS;
+	}
+
+	b.m_buf = handle->m_file_userlist_block;
+	b.m_len = handle->m_file_userlist_block_len;
+	b.m_pos = 0;
+
+	res = scap_read_userlist(handle, &b, b.m_len);
+
+	free(handle->m_file_userlist_block);
+	handle->m_file_userlist_block = NULL;
+	return res;
+}
+
+//
+// Decompress the frame whose block header is bh into buf, growing it if
+// needed. payload points to the rest of the block, including the trailer.
+// Doesn't touch the handle, so that the decoder threads can use it too.
+//
+int32_t scap_uncompress_frame(const block_header *bh, const char *payload, char **buf, uint32_t *bufsize, OUT uint32_t *len, char *error)
+{
+	uint32_t readlen = bh->block_total_length - sizeof(block_header);
+	event_frame_header *fh = (event_frame_header *)payload;
+
+	if(fh->compression != EVF_COMPRESSION_ZLIB)
+	{
+		snprintf(error, SCAP_LASTERR_SIZE, "unsupported frame compression %u", fh->compression);
+		return SCAP_FAILURE;
+	}
+
+	if(fh->compressed_len > readlen - sizeof(event_frame_header) - 4)
+	{
+		snprintf(error, SCAP_LASTERR_SIZE, "corrupted frame, compressed length %u in a block of %u bytes",
+			fh->compressed_len,
+			bh->block_total_length);
+		return SCAP_FAILURE;
+	}
+
+#ifdef HAS_ZLIB
+	{
+		uLongf ulen;
+
+		if(fh->uncompressed_len > *bufsize)
+		{
+			char* p = (char *)realloc(*buf, fh->uncompressed_len);
+			if(p == NULL)
+			{
+				snprintf(error, SCAP_LASTERR_SIZE, "error allocating a %u bytes read buffer", fh->uncompressed_len);
+				return SCAP_FAILURE;
+			}
+
+			*buf = p;
+			*bufsize = fh->uncompressed_len;
+		}
+
+		ulen = fh->uncompressed_len;
+
+		if(uncompress((Bytef *)*buf,
+			&ulen,
+			(const Bytef *)(payload + sizeof(event_frame_header)),
+			fh->compressed_len) != Z_OK ||
+			ulen != fh->uncompressed_len)
+		{
+			snprintf(error, SCAP_LASTERR_SIZE, "error decompressing a frame");
+			return SCAP_FAILURE;
+		}
+
+		*len = (uint32_t)ulen;
+	}
+
+	return SCAP_SUCCESS;
+#else
+	snprintf(error, SCAP_LASTERR_SIZE, "the file is compressed, and this build doesn't support compressed trace files");
+	return SCAP_FAILURE;
+#endif
+}
+
+//
+// Decompress the frame whose block header is bh into m_file_frame, and start
+// returning its events
+//
+static int32_t scap_decode_frame(scap_t *handle, block_header *bh, const char *payload)
+{
+	uint32_t len;
+
+	if(scap_uncompress_frame(bh, payload, &handle->m_file_frame, &handle->m_file_frame_size, &len, handle->m_lasterr) != SCAP_SUCCESS)
+	{
+		return SCAP_FAILURE;
+	}
+
+	handle->m_file_frame_data = handle->m_file_frame;
+	handle->m_file_frame_len = len;
+	handle->m_file_frame_pos = 0;
+	return SCAP_SUCCESS;
+}
+
+//
+// Load and decompress the frame whose block header is bh
+//
+static int32_t scap_read_frame(scap_t *handle, block_header *bh)
+{
+	size_t readsize;
+	uint32_t readlen;
+
+	if(bh->block_total_length < sizeof(block_header) + sizeof(event_frame_header) + 4)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "block length too short %u", (uint32_t)bh->block_total_length);
+		return SCAP_FAILURE;
+	}
+
+	//
+	// Get the whole frame with a single read
+	//
+	readlen = bh->block_total_length - sizeof(block_header);
+
+	if(scap_reserve_read_buffer(handle, &handle->m_file_zbuf, &handle->m_file_zbuf_size, readlen) != SCAP_SUCCESS)
+	{
+		return SCAP_FAILURE;
+	}
+
+	readsize = fread(handle->m_file_zbuf, 1, readlen, handle->m_file);
+	CHECK_READ_SIZE(readsize, readlen);
+
+	return scap_decode_frame(handle, bh, handle->m_file_zbuf);
+}
+
+//
+// Return the next event of the current frame. The event is not copied, it
+// stays valid until the next frame is loaded.
+//
+static int32_t scap_next_frame_event(scap_t *handle, OUT scap_evt **pevent, OUT uint16_t *pcpuid)
+{
+	char* p = handle->m_file_frame_data + handle->m_file_frame_pos;
+	block_header* bh = (block_header *)p;
+	uint32_t left = handle->m_file_frame_len - handle->m_file_frame_pos;
+
+	if(left < sizeof(block_header) ||
+		bh->block_total_length < sizeof(block_header) + sizeof(uint16_t) + sizeof(struct ppm_evt_hdr) + 4 ||
+		bh->block_total_length > left)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "corrupted frame at offset %u", handle->m_file_frame_pos);
+		return SCAP_FAILURE;
+	}
+
+	if(bh->block_type != EV_BLOCK_TYPE)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "unexpected block type %u in frame", (uint32_t)bh->block_type);
+		return SCAP_FAILURE;
+	}
+
+	*pcpuid = *(uint16_t *)(p + sizeof(block_header));
+	*pevent = (struct ppm_evt_hdr *)(p + sizeof(block_header) + sizeof(uint16_t));
+
+	handle->m_file_frame_pos += bh->block_total_length;
+	return SCAP_SUCCESS;
+}
+
+//
+// Map the events of the file, starting from the current position of
+// m_file. If the file can't be mapped, e.g. because it's a pipe, the events
+// keep being read with stdio.
+//
+int32_t scap_read_map(scap_t *handle)
+{
+	char* map;
+#ifdef _WIN32
+	struct _stati64 st;
+	HANDLE mapping;
+	__int64 pos;
+
+	//
+	// ftell() is 32 bit here
+	//
+	pos = _ftelli64(handle->m_file);
+
+	if(pos < 0 ||
+		_fstati64(_fileno(handle->m_file), &st) != 0 ||
+		(st.st_mode & _S_IFMT) != _S_IFREG ||
+		(uint64_t)st.st_size != (uint64_t)(size_t)st.st_size ||
+		st.st_size == 0)
+	{
+		return SCAP_SUCCESS;
+	}
+
+	mapping = CreateFileMapping((HANDLE)_get_osfhandle(_fileno(handle->m_file)), NULL, PAGE_WRITECOPY, 0, 0, NULL);
+	if(mapping == NULL)
+	{
+		return SCAP_SUCCESS;
+	}
+
+	//
+	// Copy on write, so that whoever gets the events can still modify
+	// them in place. The view keeps the mapping object alive.
+	//
+	map = (char *)MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+	CloseHandle(mapping);
+
+	if(map == NULL)
+	{
+		return SCAP_SUCCESS;
+	}
+#else
+	struct stat st;
+	long pos;
+
+	pos = ftell(handle->m_file);
+
+	if(pos < 0 ||
+		fstat(fileno(handle->m_file), &st) != 0 ||
+		!S_ISREG(st.st_mode) ||
+		(uint64_t)st.st_size != (uint64_t)(size_t)st.st_size)
+	{
+		return SCAP_SUCCESS;
+	}
+
+	//
+	// Private and writable, so that whoever gets the events can still
+	// modify them in place
+	//
+	map = (char *)mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(handle->m_file), 0);
+	if(map == MAP_FAILED)
+	{
+		return SCAP_SUCCESS;
+	}
+
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+#endif
+
+	handle->m_file_map = map;
+	handle->m_file_map_size = st.st_size;
+	handle->m_file_map_pos = pos;
+	handle->m_file_map_ra_pos = pos & ~((uint64_t)FILE_READAHEAD_CHUNK_SIZE - 1);
+
+	return SCAP_SUCCESS;
+}
+
+void scap_read_unmap(scap_t *handle)
+{
+	if(handle->m_file_map == NULL)
+	{
+		return;
+	}
+
+#ifdef _WIN32
+	UnmapViewOfFile(handle->m_file_map);
+#else
+	munmap(handle->m_file_map, handle->m_file_map_size);
+#endif
+	handle->m_file_map = NULL;
+}
+
+//
+// Make sure that the kernel is reading the next FILE_READAHEAD_SIZE bytes
+// of the mapping
+//
+static inline void scap_map_readahead(scap_t *handle)
+{
+	uint64_t len;
+
+	while(handle->m_file_map_ra_pos < handle->m_file_map_size &&
+		handle->m_file_map_ra_pos < handle->m_file_map_pos + FILE_READAHEAD_SIZE)
+	{
+		len = handle->m_file_map_size - handle->m_file_map_ra_pos;
+		if(len > FILE_READAHEAD_CHUNK_SIZE)
 		{
-			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "getifaddrs allocation failed(3)");
-			res = SCAP_FAILURE;
-			goto scap_read_iflist_error;
+			len = FILE_READAHEAD_CHUNK_SIZE;
+		}
+
+#ifdef _WIN32
+#if _WIN32_WINNT >= 0x0602
+		{
+			WIN32_MEMORY_RANGE_ENTRY range;
+
+			range.VirtualAddress = handle->m_file_map + handle->m_file_map_ra_pos;
+			range.NumberOfBytes = (SIZE_T)len;
+			PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+		}
+#endif
+#else
+		madvise(handle->m_file_map + handle->m_file_map_ra_pos, len, MADV_WILLNEED);
+#endif
+		handle->m_file_map_ra_pos += len;
+	}
+}
+
+//
+// If the reader is at the start of a group of events of the index, skip it and
+// the following ones as long as the block filter says that they have nothing
+// it's looking for
+//
+static void scap_filter_groups(scap_t *handle)
+{
+	uint64_t g = handle->m_file_next_group;
+	uint64_t pos = handle->m_file_map_pos;
+
+	while(g < handle->m_file_index_len && handle->m_file_index[g].offset < pos)
+	{
+		g++;
+	}
+
+	if(g < handle->m_file_index_len && handle->m_file_index[g].offset == pos)
+	{
+		uint64_t first = g;
+
+		while(g < handle->m_file_index_len &&
+			!handle->m_file_block_filter(handle->m_file_block_filter_context,
+				handle->m_file_index[g].evtnum,
+				(g + 1 < handle->m_file_index_len)? handle->m_file_index[g + 1].evtnum : (uint64_t)-1,
+				(handle->m_file_summaries != NULL)? &handle->m_file_summaries[g] : NULL))
+		{
+			g++;
+		}
+
+		if(g != first)
+		{
+			if(g < handle->m_file_index_len)
+			{
+				handle->m_file_map_pos = handle->m_file_index[g].offset;
+				handle->m_evtcnt = handle->m_file_index[g].evtnum;
+			}
+			else
+			{
+				handle->m_file_map_pos = handle->m_file_evts_end;
+			}
+
+			handle->m_file_map_ra_pos = handle->m_file_map_pos & ~((uint64_t)FILE_READAHEAD_CHUNK_SIZE - 1);
+		}
+
+		g++;
+	}
+
+	handle->m_file_next_group = g;
+}
+
+//
+// Read an event from the mapping. The event is not copied, it points into the
+// file.
+//
+static int32_t scap_next_mapped(scap_t *handle, OUT scap_evt **pevent, OUT uint16_t *pcpuid)
+{
+	block_header* bh;
+	char* p;
+	uint64_t left;
+
+	while(true)
+	{
+		//
+		// Consume the events of the last frame first
+		//
+		if(handle->m_file_frame_pos < handle->m_file_frame_len)
+		{
+			return scap_next_frame_event(handle, pevent, pcpuid);
+		}
+
+		if(handle->m_file_block_filter != NULL)
+		{
+			scap_filter_groups(handle);
 		}
+
+		left = handle->m_file_map_size - handle->m_file_map_pos;
+		if(left == 0)
+		{
+			return SCAP_EOF;
+		}
+
+		CHECK_READ_SIZE((left < sizeof(block_header)? left : sizeof(block_header)), sizeof(block_header));
+
+		p = handle->m_file_map + handle->m_file_map_pos;
+		bh = (block_header *)p;
+
+		//
+		// The index comes after all the events
+		//
+		if(bh->block_type == IX_BLOCK_TYPE)
+		{
+			return SCAP_EOF;
+		}
+
+		if(bh->block_total_length < sizeof(block_header) + 4)
+		{
+			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "block length too short %u", (uint32_t)bh->block_total_length);
+			return SCAP_FAILURE;
+		}
+
+		CHECK_READ_SIZE((left < bh->block_total_length? left : bh->block_total_length), bh->block_total_length);
+
+		scap_map_readahead(handle);
+		handle->m_file_map_pos += bh->block_total_length;
+
+		if(bh->block_type == SS_BLOCK_TYPE)
+		{
+			continue;
+		}
+
+		if(bh->block_type == EVF_BLOCK_TYPE)
+		{
+			if(bh->block_total_length < sizeof(block_header) + sizeof(event_frame_header) + 4)
+			{
+				snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "block length too short %u", (uint32_t)bh->block_total_length);
+				return SCAP_FAILURE;
+			}
+
+			if(handle->m_decoders != NULL)
+			{
+				if(scap_decoders_get_frame(handle, handle->m_file_map_pos - bh->block_total_length) != SCAP_SUCCESS)
+				{
+					return SCAP_FAILURE;
+				}
+			}
+			else if(scap_decode_frame(handle, bh, p + sizeof(block_header)) != SCAP_SUCCESS)
+			{
+				return SCAP_FAILURE;
+			}
+
+			continue;
+		}
+
+		if(bh->block_type != EV_BLOCK_TYPE && bh->block_type != EV_BLOCK_TYPE_INT)
+		{
+			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "unexpected block type %u", (uint32_t)bh->block_type);
+			return SCAP_FAILURE;
+		}
+
+		if(bh->block_total_length < sizeof(block_header) + sizeof(struct ppm_evt_hdr) + 4)
+		{
+			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "block length too short %u", (uint32_t)bh->block_total_length);
+			return SCAP_FAILURE;
+		}
+
+		*pcpuid = *(uint16_t *)(p + sizeof(block_header));
+		*pevent = (struct ppm_evt_hdr *)(p + sizeof(block_header) + sizeof(uint16_t));
+		return SCAP_SUCCESS;
+	}
+}
+
+#if !defined(_WIN32) && !defined(__APPLE__)
+int32_t scap_follow_init(scap_t *handle, const char *fname)
+{
+	struct scap_follow *fl;
+	struct stat st;
+	const char* slash;
+	char* dir;
+	size_t len;
+	size_t j;
+	int wd;
+
+	if(fstat(fileno(handle->m_file), &st) != 0 || !S_ISREG(st.st_mode))
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "only regular files can be followed");
+		return SCAP_FAILURE;
+	}
+
+	fl = (struct scap_follow *)calloc(1, sizeof(struct scap_follow));
+	if(fl == NULL)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error allocating the follow state");
+		return SCAP_FAILURE;
+	}
+
+	fl->m_inotify_fd = -1;
+	handle->m_file_follow = fl;
+
+	//
+	// The writer rotates from <name><n> to <name><n+1>
+	//
+	len = strlen(fname);
+	for(j = len; j > 0 && isdigit((unsigned char)fname[j - 1]); j--)
+	{
+	}
+
+	if(j < len && len - j < 20)
+	{
+		fl->m_prefix = strdup(fname);
+		if(fl->m_prefix == NULL)
+		{
+			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error allocating the follow state");
+			return SCAP_FAILURE;
+		}
+
+		fl->m_prefix[j] = 0;
+		fl->m_seq = strtoull(fname + j, NULL, 10);
+	}
+
+	//
+	// Watching the directory tells both when the file grows and when the
+	// next one is created
+	//
+	slash = strrchr(fname, '/');
+	if(slash == NULL)
+	{
+		dir = strdup(".");
+	}
+	else if(slash == fname)
+	{
+		dir = strdup("/");
 	}
 	else
 	{
-		handle->m_addrlist->v6list = NULL;
+		dir = strdup(fname);
+		if(dir != NULL)
+		{
+			dir[slash - fname] = 0;
+		}
+	}
+
+	if(dir == NULL)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error allocating the follow state");
+		return SCAP_FAILURE;
+	}
+
+	fl->m_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if(fl->m_inotify_fd < 0)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error creating the inotify instance: %s", strerror(errno));
+		free(dir);
+		return SCAP_FAILURE;
+	}
+
+	wd = inotify_add_watch(fl->m_inotify_fd, dir, IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_MOVED_TO);
+	if(wd < 0)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error watching %s: %s", dir, strerror(errno));
+		free(dir);
+		return SCAP_FAILURE;
+	}
+
+	free(dir);
+	return SCAP_SUCCESS;
+}
+
+void scap_follow_close(scap_t *handle)
+{
+	struct scap_follow *fl = handle->m_file_follow;
+
+	if(fl->m_inotify_fd >= 0)
+	{
+		close(fl->m_inotify_fd);
+	}
+
+	free(fl->m_prefix);
+	free(fl);
+	handle->m_file_follow = NULL;
+}
+
+//
+// Sleep until something changes in the directory of the file, or until
+// FILE_FOLLOW_WAIT_TIME_MS expires
+//
+static void scap_follow_wait(scap_t *handle)
+{
+	struct scap_follow *fl = handle->m_file_follow;
+	struct pollfd pfd;
+	char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+
+	clearerr(handle->m_file);
+
+	pfd.fd = fl->m_inotify_fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+
+	if(poll(&pfd, 1, FILE_FOLLOW_WAIT_TIME_MS) > 0)
+	{
+		//
+		// Which file changed doesn't matter, the caller looks again
+		//
+		while(read(fl->m_inotify_fd, buf, sizeof(buf)) > 0)
+		{
+		}
+	}
+}
+
+//
+// Continue in the file the writer rotated to. Returns SCAP_TIMEOUT if it
+// doesn't exist yet, and SCAP_EOF if the name of the file has no sequence
+// number, which means that the writer doesn't rotate.
+//
+static int32_t scap_follow_switch(scap_t *handle)
+{
+	struct scap_follow *fl = handle->m_file_follow;
+	char fname[SCAP_MAX_PATH_SIZE];
+	FILE* f;
+
+	if(fl->m_prefix == NULL)
+	{
+		return SCAP_EOF;
+	}
+
+	if(snprintf(fname, sizeof(fname), "%s%" PRIu64, fl->m_prefix, fl->m_seq + 1) >= (int)sizeof(fname))
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "the name of the next file is too long");
+		return SCAP_FAILURE;
+	}
+
+	f = fopen(fname, "rb");
+	if(f == NULL)
+	{
+		if(errno != ENOENT)
+		{
+			scap_errprintf(handle->m_lasterr, "can't open file %s", fname);
+			return SCAP_FAILURE;
+		}
+
+		scap_follow_wait(handle);
+		return SCAP_TIMEOUT;
 	}
 
-	handle->m_addrlist->n_v4_addrs = ifcnt4;
-	handle->m_addrlist->n_v6_addrs = ifcnt6;
+	posix_fadvise(fileno(f), 0, 0, POSIX_FADV_SEQUENTIAL);
 
-	//
-	// Second pass: populate the arrays
-	//
-	ifcnt4 = 0;
-	ifcnt6 = 0;
-	pif = readbuf;
-	totreadsize = 0;
+	fclose(handle->m_file);
+	handle->m_file = f;
+	handle->m_file_evts_offset = 0;
+
+	fl->m_seq++;
+	fl->m_pos = 0;
+	fl->m_size = 0;
+
+	return SCAP_SUCCESS;
+}
+
+//
+// Read the header of the next block of a followed file, once the writer has
+// written all of the block. The blocks that come before the events in the
+// files the writer rotated to are skipped, the state they describe is
+// already known from the events. Returns SCAP_TIMEOUT after waiting for the
+// writer without getting a block.
+//
+static int32_t scap_follow_next_block(scap_t *handle, OUT block_header *bh)
+{
+	struct scap_follow *fl = handle->m_file_follow;
+	struct stat st;
+	bool size_checked = false;
+	int32_t res;
 
 	while(true)
 	{
-		toread = (int32_t)block_length - (int32_t)totreadsize;
-
-		if(toread < 4)
+		if(fl->m_pos + sizeof(block_header) <= fl->m_size)
 		{
-			break;
-		}
+			if(fread(bh, sizeof(block_header), 1, handle->m_file) != 1)
+			{
+				snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error reading from file");
+				return SCAP_FAILURE;
+			}
 
-		iftype = *(uint16_t *)pif;
-		ifnamlen = *(uint16_t *)(pif + 2);
+			if(fl->m_pos == 0 && bh->block_type != SHB_BLOCK_TYPE)
+			{
+				snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "invalid block type");
+				return SCAP_FAILURE;
+			}
 
-		if(ifnamlen >= SCAP_MAX_PATH_SIZE)
-		{
-			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "trace file has corrupted interface list(0)");
-			res = SCAP_FAILURE;
-			goto scap_read_iflist_error;
-		}
+			//
+			// The index is the last block the writer adds to a file. Stay in
+			// front of it until there's a file to continue in.
+			//
+			if(bh->block_type == IX_BLOCK_TYPE)
+			{
+				if(fseek(handle->m_file, (long)fl->m_pos, SEEK_SET) != 0)
+				{
+					snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error seeking in file");
+					return SCAP_FAILURE;
+				}
+
+				res = scap_follow_switch(handle);
+				if(res != SCAP_SUCCESS)
+				{
+					return res;
+				}
+
+				size_checked = false;
+				continue;
+			}
 
-		if(iftype == SCAP_II_IPV4)
-		{
-			entrysize = sizeof(scap_ifinfo_ipv4) + ifnamlen - SCAP_MAX_PATH_SIZE;
+			if(bh->block_total_length < sizeof(block_header) + 4)
+			{
+				snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "block length too short %u", (uint32_t)bh->block_total_length);
+				return SCAP_FAILURE;
+			}
 
-			if(toread < entrysize)
+			if(fl->m_pos + bh->block_total_length <= fl->m_size)
 			{
-				snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "trace file has corrupted interface list(1)");
-				res = SCAP_FAILURE;
-				goto scap_read_iflist_error;
+				fl->m_pos += bh->block_total_length;
+
+				if(bh->block_type == EV_BLOCK_TYPE ||
+					bh->block_type == EV_BLOCK_TYPE_INT ||
+					bh->block_type == EVF_BLOCK_TYPE ||
+					bh->block_type == SS_BLOCK_TYPE)
+				{
+					return SCAP_SUCCESS;
+				}
+
+				if(fseek(handle->m_file, (long)fl->m_pos, SEEK_SET) != 0)
+				{
+					snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error seeking in file");
+					return SCAP_FAILURE;
+				}
+
+				continue;
 			}
 
-			// Copy the entry
-			memcpy(handle->m_addrlist->v4list + ifcnt4, pif, entrysize);
+			//
+			// Partially written, go back to the start of the block
+			//
+			if(fseek(handle->m_file, (long)fl->m_pos, SEEK_SET) != 0)
+			{
+				snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error seeking in file");
+				return SCAP_FAILURE;
+			}
+		}
 
-			// Make sure the name string is NULL-terminated
-			*((char *)(handle->m_addrlist->v4list + ifcnt4) + entrysize) = 0;
+		if(!size_checked)
+		{
+			if(fstat(fileno(handle->m_file), &st) != 0)
+			{
+				snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error reading the size of the file: %s", strerror(errno));
+				return SCAP_FAILURE;
+			}
 
-			pif += entrysize;
-			totreadsize += entrysize;
+			size_checked = true;
 
-			ifcnt4++;
+			if((uint64_t)st.st_size > fl->m_size)
+			{
+				fl->m_size = st.st_size;
+				continue;
+			}
 		}
-		else if(iftype == SCAP_II_IPV4_NOLINKSPEED)
+
+		//
+		// The writer finishes a file before creating the next one, so if
+		// the next one exists and this one didn't grow in the meantime,
+		// this one is complete, even without an index
+		//
+		if(fl->m_prefix != NULL)
 		{
-			scap_ifinfo_ipv4_nolinkspeed* src;
-			scap_ifinfo_ipv4* dst;
+			char fname[SCAP_MAX_PATH_SIZE];
 
-			entrysize = sizeof(scap_ifinfo_ipv4_nolinkspeed) + ifnamlen - SCAP_MAX_PATH_SIZE;
+			snprintf(fname, sizeof(fname), "%s%" PRIu64, fl->m_prefix, fl->m_seq + 1);
 
-			if(toread < entrysize)
+			if(access(fname, F_OK) == 0 &&
+				fstat(fileno(handle->m_file), &st) == 0 &&
+				(uint64_t)st.st_size == fl->m_size)
 			{
-				snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "trace file has corrupted interface list(1)");
-				res = SCAP_FAILURE;
-				goto scap_read_iflist_error;
+				res = scap_follow_switch(handle);
+				if(res != SCAP_SUCCESS)
+				{
+					return res;
+				}
+
+				size_checked = false;
+				continue;
 			}
+		}
 
-			// Copy the entry
-			src = (scap_ifinfo_ipv4_nolinkspeed*)pif;
-			dst = handle->m_addrlist->v4list + ifcnt4;
+		scap_follow_wait(handle);
+		return SCAP_TIMEOUT;
+	}
+}
+#endif
 
-			dst->type = src->type;
-			dst->ifnamelen = src->ifnamelen;
-			dst->addr = src->addr;
-			dst->netmask = src->netmask;
-			dst->bcast = src->bcast;
-			dst->linkspeed = 0;
-			memcpy(dst->ifname, src->ifname, MIN(dst->ifnamelen, SCAP_MAX_PATH_SIZE - 1));
+//
+// Read an event from disk
+//
+int32_t scap_next_offline(scap_t *handle, OUT scap_evt **pevent, OUT uint16_t *pcpuid)
+{
+	block_header bh;
+	size_t readsize;
+	uint32_t readlen;
+	FILE *f = handle->m_file;
 
-			// Make sure the name string is NULL-terminated
-			*((char *)(dst->ifname + MIN(dst->ifnamelen, SCAP_MAX_PATH_SIZE - 1))) = 0;
+	ASSERT(f != NULL);
 
-			pif += entrysize;
-			totreadsize += entrysize;
+	//
+	// The event that stopped scap_seek_ts()
+	//
+	if(handle->m_file_next_evt != NULL)
+	{
+		*pevent = handle->m_file_next_evt;
+		*pcpuid = handle->m_file_next_cpuid;
+		handle->m_file_next_evt = NULL;
+		return SCAP_SUCCESS;
+	}
 
-			ifcnt4++;
-		}
-		else if(iftype == SCAP_II_IPV6)
+	if(handle->m_file_map != NULL)
+	{
+		return scap_next_mapped(handle, pevent, pcpuid);
+	}
+
+	while(true)
+	{
+		//
+		// Consume the events of the last frame first
+		//
+		if(handle->m_file_frame_pos < handle->m_file_frame_len)
 		{
-			entrysize = sizeof(scap_ifinfo_ipv6) + ifnamlen - SCAP_MAX_PATH_SIZE;
+			return scap_next_frame_event(handle, pevent, pcpuid);
+		}
 
-			if(toread < entrysize)
+		//
+		// Read the block header
+		//
+#if !defined(_WIN32) && !defined(__APPLE__)
+		if(handle->m_file_follow != NULL)
+		{
+			int32_t res = scap_follow_next_block(handle, &bh);
+			if(res != SCAP_SUCCESS)
 			{
-				snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "trace file has corrupted interface list(1)");
-				res = SCAP_FAILURE;
-				goto scap_read_iflist_error;
+				return res;
 			}
 
-			// Copy the entry
-			memcpy(handle->m_addrlist->v6list + ifcnt6, pif, entrysize);
+			f = handle->m_file;
+			readsize = sizeof(bh);
+		}
+		else
+#endif
+		if(handle->m_file_next_block_valid)
+		{
+			bh.block_type = handle->m_file_next_block_type;
+			bh.block_total_length = handle->m_file_next_block_len;
+			handle->m_file_next_block_valid = false;
+			readsize = sizeof(bh);
+		}
+		else
+		{
+			readsize = fread(&bh, 1, sizeof(bh), f);
+		}
 
-			// Make sure the name string is NULL-terminated
-			*((char *)(handle->m_addrlist->v6list + ifcnt6) + entrysize) = 0;
+		if(readsize != sizeof(bh))
+		{
+			if(readsize == 0)
+			{
+				//
+				// We read exactly 0 bytes. This indicates a correct end of file.
+				//
+				return SCAP_EOF;
+			}
+			else
+			{
+				CHECK_READ_SIZE(readsize, sizeof(bh));
+			}
+		}
 
-			pif += entrysize;
-			totreadsize += entrysize;
+		//
+		// The index comes after all the events. Stay in front of it, so
+		// that the next calls return SCAP_EOF too
+		//
+		if(bh.block_type == IX_BLOCK_TYPE)
+		{
+			if(fseek(f, (long)0 - sizeof(bh), SEEK_CUR) != 0)
+			{
+				snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error seeking in file");
+				return SCAP_FAILURE;
+			}
 
-			ifcnt6++;
+			return SCAP_EOF;
 		}
-		else if(iftype == SCAP_II_IPV6_NOLINKSPEED)
-		{
-			scap_ifinfo_ipv6_nolinkspeed* src;
-			scap_ifinfo_ipv6* dst;
-			entrysize = sizeof(scap_ifinfo_ipv6_nolinkspeed) + ifnamlen - SCAP_MAX_PATH_SIZE;
 
-			if(toread < entrysize)
+		//
+		// The state snapshots are loaded only by scap_seek_snapshot()
+		//
+		if(bh.block_type == SS_BLOCK_TYPE)
+		{
+			if(bh.block_total_length < sizeof(bh) ||
+				scap_skip(f, bh.block_total_length - sizeof(bh)) != SCAP_SUCCESS)
 			{
-				snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "trace file has corrupted interface list(1)");
-				res = SCAP_FAILURE;
-				goto scap_read_iflist_error;
+				snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "corrupted input file. Can't skip snapshot block of size %u.",
+					bh.block_total_length);
+				return SCAP_FAILURE;
 			}
 
-			// Copy the entry
-			src = (scap_ifinfo_ipv6_nolinkspeed*)pif;
-			dst = handle->m_addrlist->v6list + ifcnt6;
+			continue;
+		}
 
-			dst->type = src->type;
-			dst->ifnamelen = src->ifnamelen;
-			memcpy(dst->addr, src->addr, SCAP_IPV6_ADDR_LEN);
-			memcpy(dst->netmask, src->netmask, SCAP_IPV6_ADDR_LEN);
-			memcpy(dst->bcast, src->bcast, SCAP_IPV6_ADDR_LEN);
-			dst->linkspeed = 0;
-			memcpy(dst->ifname, src->ifname, MIN(dst->ifnamelen, SCAP_MAX_PATH_SIZE - 1));
+		if(bh.block_type != EVF_BLOCK_TYPE)
+		{
+			break;
+		}
 
-			// Make sure the name string is NULL-terminated
-			*((char *)(dst->ifname + MIN(dst->ifnamelen, SCAP_MAX_PATH_SIZE - 1))) = 0;
+		if(scap_read_frame(handle, &bh) != SCAP_SUCCESS)
+		{
+			return SCAP_FAILURE;
+		}
+	}
 
-			pif += entrysize;
-			totreadsize += entrysize;
+	if(bh.block_type != EV_BLOCK_TYPE && bh.block_type != EV_BLOCK_TYPE_INT)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "unexpected block type %u", (uint32_t)bh.block_type);
+		return SCAP_FAILURE;
+	}
 
-			ifcnt6++;
+	if(bh.block_total_length < sizeof(bh) + sizeof(struct ppm_evt_hdr) + 4)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "block length too short %u", (uint32_t)bh.block_total_length);
+		return SCAP_FAILURE;
+	}
+
+	//
+	// Read the event
+	//
+	readlen = bh.block_total_length - sizeof(bh);
+	readsize = fread(handle->m_file_evt_buf, 1, readlen, f);
+	CHECK_READ_SIZE(readsize, readlen);
+
+	*pcpuid = *(uint16_t *)handle->m_file_evt_buf;
+	*pevent = (struct ppm_evt_hdr *)(handle->m_file_evt_buf + sizeof(uint16_t));
+	return SCAP_SUCCESS;
+}
+
+//
+// Load the index block at the end of the file, if there is one
+//
+static int32_t scap_load_index(scap_t *handle)
+{
+	FILE *f = handle->m_file;
+	long pos = ftell(f);
+	block_header bh;
+	index_header ih;
+	uint32_t bt;
+	long start;
+	index_entry* index;
+	scap_block_summary* summaries = NULL;
+
+	handle->m_file_index_loaded = true;
+
+	if(pos < 0)
+	{
+		return SCAP_SUCCESS;
+	}
+
+	//
+	// The summaries are optional, and a reader that doesn't know their size
+	// ignores the whole index
+	//
+	if(fseek(f, (long)0 - sizeof(bt), SEEK_END) == 0 &&
+		fread(&bt, sizeof(bt), 1, f) == 1 &&
+		bt >= sizeof(block_header) + sizeof(index_header) + 4 &&
+		fseek(f, (long)0 - bt, SEEK_END) == 0 &&
+		(start = ftell(f)) >= 0 &&
+		fread(&bh, sizeof(bh), 1, f) == 1 &&
+		bh.block_type == IX_BLOCK_TYPE &&
+		bh.block_total_length == bt &&
+		fread(&ih, sizeof(ih), 1, f) == 1 &&
+		ih.entry_size == sizeof(index_entry) &&
+		(ih.summary_size == 0 || ih.summary_size == sizeof(scap_block_summary)) &&
+		ih.nentries != 0 &&
+		ih.nentries == (bt - sizeof(block_header) - sizeof(index_header) - 4) / (sizeof(index_entry) + ih.summary_size))
+	{
+		index = (index_entry *)malloc(ih.nentries * sizeof(index_entry));
+		if(ih.summary_size != 0)
+		{
+			summaries = (scap_block_summary *)malloc(ih.nentries * sizeof(scap_block_summary));
 		}
-		else
+
+		if(index == NULL || (ih.summary_size != 0 && summaries == NULL))
 		{
-			ASSERT(false);
-			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "unknown interface type %d", (int)iftype);
-			res = SCAP_FAILURE;
-			goto scap_read_iflist_error;
+			free(index);
+			free(summaries);
+			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error allocating the file index");
+			return SCAP_FAILURE;
+		}
+
+		if(fread(index, sizeof(index_entry), ih.nentries, f) != ih.nentries ||
+			(summaries != NULL && fread(summaries, sizeof(scap_block_summary), ih.nentries, f) != ih.nentries))
+		{
+			free(index);
+			free(summaries);
+		}
+		else
+		{
+			handle->m_file_index = index;
+			handle->m_file_index_len = ih.nentries;
+			handle->m_file_summaries = summaries;
+			handle->m_file_evts_end = start;
 		}
 	}
 
-	//
-	// Release the read storage
-	//
-	free(readbuf);
-
-	return res;
-
-scap_read_iflist_error:
-	scap_free_iflist(handle->m_addrlist);
-
-	if(readbuf)
+	if(fseek(f, pos, SEEK_SET) != 0)
 	{
-		free(readbuf);
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error seeking in file");
+		return SCAP_FAILURE;
 	}
 
-	return res;
+	return SCAP_SUCCESS;
 }
 
 //
-// Parse a user list block
+// Move the reader to the given block
 //
-int32_t scap_read_userlist(scap_t *handle, FILE *f, uint32_t block_length)
+static int32_t scap_set_read_pos(scap_t *handle, uint64_t offset)
 {
-	size_t readsize;
-	size_t totreadsize = 0;
-	uint32_t padding;
-	int32_t padding_len;
-	uint8_t type;
-	uint16_t stlen;
+	if(handle->m_file_map != NULL)
+	{
+		if(offset > handle->m_file_map_size)
+		{
+			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "corrupted index, offset %" PRIu64 " past the end of the file", offset);
+			return SCAP_FAILURE;
+		}
 
-	//
-	// If the list of users was already allocated for this handle (for example because this is
-	// not the first interface list block), free it
-	//
-	if(handle->m_userlist != NULL)
+		handle->m_file_map_pos = offset;
+		handle->m_file_map_ra_pos = offset & ~((uint64_t)FILE_READAHEAD_CHUNK_SIZE - 1);
+	}
+	else
+	if(fseek(handle->m_file, (long)offset, SEEK_SET) != 0)
 	{
-		scap_free_userlist(handle->m_userlist);
-		handle->m_userlist = NULL;
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error seeking in file");
+		return SCAP_FAILURE;
 	}
 
+	handle->m_file_frame_len = 0;
+	handle->m_file_frame_pos = 0;
+	handle->m_file_next_evt = NULL;
+	handle->m_file_next_group = 0;
+
 	//
-	// Allocate and initialize the handle info
+	// The runs being folded don't continue at the new position
 	//
-	handle->m_userlist = (scap_userlist*)malloc(sizeof(scap_userlist));
-	if(handle->m_userlist == NULL)
+	if(handle->m_fold != NULL)
 	{
-		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "userlist allocation failed(2)");
+		scap_fold_reset(handle->m_fold);
+	}
+
+	return SCAP_SUCCESS;
+}
+
+int32_t scap_seek_ts(scap_t *handle, uint64_t ts, OUT uint64_t *evtnum)
+{
+	scap_evt* pevent;
+	uint16_t cpuid;
+	int32_t res;
+
+	if(handle->m_file == NULL)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "seeking is supported only on trace files");
 		return SCAP_FAILURE;
 	}
 
-	handle->m_userlist->nusers = 0;
-	handle->m_userlist->ngroups = 0;
-	handle->m_userlist->totsavelen = 0;
-	handle->m_userlist->users = NULL;
-	handle->m_userlist->groups = NULL;
+	if(handle->m_file_follow != NULL)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "seeking is not supported on a followed trace file");
+		return SCAP_FAILURE;
+	}
+
+	if(!handle->m_file_index_loaded)
+	{
+		if(scap_load_index(handle) != SCAP_SUCCESS)
+		{
+			return SCAP_FAILURE;
+		}
+	}
 
 	//
-	// Import the blocks
+	// Jump to the last block that starts before ts, or to the first event if
+	// there's none. Without an index, we don't know if ts is before or after
+	// the current position, so we always read again from the first event.
 	//
-	while(((int32_t)block_length - (int32_t)totreadsize) >= 4)
+	if(handle->m_file_index_len == 0 || handle->m_file_index[0].ts > ts)
 	{
-		//
-		// type
-		//
-		readsize = fread(&(type), 1, sizeof(type), f);
-		CHECK_READ_SIZE(readsize, sizeof(type));
+		if(scap_set_read_pos(handle, handle->m_file_evts_offset) != SCAP_SUCCESS)
+		{
+			return SCAP_FAILURE;
+		}
 
-		totreadsize += readsize;
+		handle->m_evtcnt = 0;
+	}
+	else if(handle->m_file_index_len != 0)
+	{
+		uint64_t lo = 0;
+		uint64_t hi = handle->m_file_index_len;
 
-		if(type == USERBLOCK_TYPE_USER)
+		while(hi - lo > 1)
 		{
-			scap_userinfo* puser;
+			uint64_t mid = lo + (hi - lo) / 2;
 
-			handle->m_userlist->nusers++;
-			handle->m_userlist->users = (scap_userinfo*)realloc(handle->m_userlist->users, handle->m_userlist->nusers * sizeof(scap_userinfo));
-			if(handle->m_userlist->users == NULL)
+			if(handle->m_file_index[mid].ts <= ts)
 			{
-				snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "memory allocation error in scap_read_userlist(1)");
-				return SCAP_FAILURE;
+				lo = mid;
+			}
+			else
+			{
+				hi = mid;
 			}
+		}
 
-			puser = &handle->m_userlist->users[handle->m_userlist->nusers -1];
+		if(scap_set_read_pos(handle, handle->m_file_index[lo].offset) != SCAP_SUCCESS)
+		{
+			return SCAP_FAILURE;
+		}
 
-			//
-			// uid
-			//
-			readsize = fread(&(puser->uid), 1, sizeof(uint32_t), f);
-			CHECK_READ_SIZE(readsize, sizeof(uint32_t));
+		handle->m_evtcnt = handle->m_file_index[lo].evtnum;
+	}
 
-			totreadsize += readsize;
+	if(handle->m_fold != NULL)
+	{
+		scap_fold_reset(handle->m_fold);
+	}
 
-			//
-			// gid
-			//
-			readsize = fread(&(puser->gid), 1, sizeof(uint32_t), f);
-			CHECK_READ_SIZE(readsize, sizeof(uint32_t));
+	//
+	// Skip the events before ts, and keep the first one after it for the
+	// next scap_next()
+	//
+	while(true)
+	{
+		res = scap_next_offline(handle, &pevent, &cpuid);
+		if(res != SCAP_SUCCESS)
+		{
+			return res;
+		}
 
-			totreadsize += readsize;
+		if(pevent->ts >= ts)
+		{
+			handle->m_file_next_evt = pevent;
+			handle->m_file_next_cpuid = cpuid;
+			break;
+		}
 
-			//
-			// name
-			//
-			readsize = fread(&(stlen), 1, sizeof(uint16_t), f);
-			CHECK_READ_SIZE(readsize, sizeof(uint16_t));
+		handle->m_evtcnt++;
+	}
 
-			if(stlen >= MAX_CREDENTIALS_STR_LEN)
-			{
-				snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "invalid user name len %d", stlen);
-				return SCAP_FAILURE;
-			}
+	*evtnum = handle->m_evtcnt;
+	return SCAP_SUCCESS;
+}
 
-			totreadsize += readsize;
+//
+// Replace the process table with the state snapshot at the given offset, and
+// return where the events after it start
+//
+static int32_t scap_load_snapshot(scap_t *handle, uint64_t offset, OUT snapshot_header *sh, OUT uint64_t *end)
+{
+	FILE *f = handle->m_file;
+	block_header bh;
+	block_header ibh;
+	scap_blockbuf b;
+	uint64_t left;
+	size_t readsize;
+	int32_t res;
 
-			readsize = fread(puser->name, 1, stlen, f);
-			CHECK_READ_SIZE(readsize, stlen);
+	if(fseek(f, (long)offset, SEEK_SET) != 0)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error seeking in file");
+		return SCAP_FAILURE;
+	}
 
-			// the string is not null-terminated on file
-			puser->name[stlen] = 0;
+	readsize = fread(&bh, 1, sizeof(bh), f);
+	CHECK_READ_SIZE(readsize, sizeof(bh));
 
-			totreadsize += readsize;
+	if(bh.block_type != SS_BLOCK_TYPE ||
+		bh.block_total_length < sizeof(block_header) + sizeof(snapshot_header) + 4)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "corrupted index, no snapshot at offset %" PRIu64, offset);
+		return SCAP_FAILURE;
+	}
 
-			//
-			// homedir
-			//
-			readsize = fread(&(stlen), 1, sizeof(uint16_t), f);
-			CHECK_READ_SIZE(readsize, sizeof(uint16_t));
+	readsize = fread(sh, 1, sizeof(*sh), f);
+	CHECK_READ_SIZE(readsize, sizeof(*sh));
 
-			if(stlen >= MAX_CREDENTIALS_STR_LEN)
-			{
-				snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "invalid user homedir len %d", stlen);
-				return SCAP_FAILURE;
-			}
+	scap_proc_free_table(handle);
 
-			totreadsize += readsize;
+	//
+	// Load the process list and the fd lists
+	//
+	left = bh.block_total_length - sizeof(block_header) - sizeof(snapshot_header) - 4;
 
-			readsize = fread(puser->homedir, 1, stlen, f);
-			CHECK_READ_SIZE(readsize, stlen);
+	while(left != 0)
+	{
+		readsize = fread(&ibh, 1, sizeof(ibh), f);
+		CHECK_READ_SIZE(readsize, sizeof(ibh));
 
-			// the string is not null-terminated on file
-			puser->homedir[stlen] = 0;
+		if(ibh.block_total_length < sizeof(block_header) + 4 || ibh.block_total_length > left)
+		{
+			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "corrupted snapshot at offset %" PRIu64, offset);
+			return SCAP_FAILURE;
+		}
 
-			totreadsize += readsize;
+		if(ibh.block_type != PL_BLOCK_TYPE && ibh.block_type != FDL_BLOCK_TYPE &&
+			ibh.block_type != FDLC_BLOCK_TYPE && ibh.block_type != CG_BLOCK_TYPE)
+		{
+			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "unexpected block type %u in snapshot", ibh.block_type);
+			return SCAP_FAILURE;
+		}
 
-			//
-			// shell
-			//
-			readsize = fread(&(stlen), 1, sizeof(uint16_t), f);
-			CHECK_READ_SIZE(readsize, sizeof(uint16_t));
+		if(scap_read_block(handle, f, &ibh, &b) != SCAP_SUCCESS)
+		{
+			return SCAP_FAILURE;
+		}
 
-			if(stlen >= MAX_CREDENTIALS_STR_LEN)
-			{
-				snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "invalid user shell len %d", stlen);
-				return SCAP_FAILURE;
-			}
+		switch(ibh.block_type)
+		{
+		case PL_BLOCK_TYPE:
+			res = scap_read_proclist(handle, &b, b.m_len);
+			break;
+		case FDL_BLOCK_TYPE:
+			res = scap_read_fdlist(handle, &b, b.m_len);
+			break;
+		case FDLC_BLOCK_TYPE:
+			res = scap_read_fdlist_compact(handle, &b, b.m_len);
+			break;
+		default:
+			res = scap_read_cglist(handle, &b, b.m_len);
+			break;
+		}
 
-			totreadsize += readsize;
+		if(res != SCAP_SUCCESS)
+		{
+			return SCAP_FAILURE;
+		}
 
-			readsize = fread(puser->shell, 1, stlen, f);
-			CHECK_READ_SIZE(readsize, stlen);
+		left -= ibh.block_total_length;
+	}
 
-			// the string is not null-terminated on file
-			puser->shell[stlen] = 0;
+	*end = offset + bh.block_total_length;
+	return SCAP_SUCCESS;
+}
 
-			totreadsize += readsize;
-		}
-		else
+int32_t scap_set_block_filter(scap_t *handle, scap_block_filter filter, void* context)
+{
+	if(handle->m_file == NULL)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "block filters are supported only on trace files");
+		return SCAP_FAILURE;
+	}
+
+	if(filter == NULL)
+	{
+		handle->m_file_block_filter = NULL;
+		handle->m_file_block_filter_context = NULL;
+		return SCAP_SUCCESS;
+	}
+
+	if(handle->m_file_follow != NULL)
+	{
+		return SCAP_NOTFOUND;
+	}
+
+	if(!handle->m_file_index_loaded)
+	{
+		if(scap_load_index(handle) != SCAP_SUCCESS)
 		{
-			scap_groupinfo* pgroup;
+			return SCAP_FAILURE;
+		}
+	}
 
-			handle->m_userlist->ngroups++;
-			handle->m_userlist->groups = (scap_groupinfo*)realloc(handle->m_userlist->groups, handle->m_userlist->ngroups * sizeof(scap_groupinfo));
-			if(handle->m_userlist->groups == NULL)
-			{
-				snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "memory allocation error in scap_read_userlist(2)");
-				return SCAP_FAILURE;
-			}
+	//
+	// Only the mapped reader can jump over a group without reading it
+	//
+	if(handle->m_file_index_len == 0 || handle->m_file_map == NULL)
+	{
+		return SCAP_NOTFOUND;
+	}
 
-			pgroup = &handle->m_userlist->groups[handle->m_userlist->ngroups -1];
+	handle->m_file_block_filter = filter;
+	handle->m_file_block_filter_context = context;
+	handle->m_file_next_group = 0;
+	return SCAP_SUCCESS;
+}
 
-			//
-			// gid
-			//
-			readsize = fread(&(pgroup->gid), 1, sizeof(uint32_t), f);
-			CHECK_READ_SIZE(readsize, sizeof(uint32_t));
+int32_t scap_seek_snapshot(scap_t *handle, uint64_t ts, OUT uint64_t *evtnum)
+{
+	snapshot_header sh;
+	uint64_t lo = 0;
+	uint64_t hi;
+	uint64_t end;
 
-			totreadsize += readsize;
+	if(handle->m_file == NULL)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "seeking is supported only on trace files");
+		return SCAP_FAILURE;
+	}
 
-			//
-			// name
-			//
-			readsize = fread(&(stlen), 1, sizeof(uint16_t), f);
-			CHECK_READ_SIZE(readsize, sizeof(uint16_t));
+	if(handle->m_file_follow != NULL)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "seeking is not supported on a followed trace file");
+		return SCAP_FAILURE;
+	}
+
+	if(!handle->m_file_index_loaded)
+	{
+		if(scap_load_index(handle) != SCAP_SUCCESS)
+		{
+			return SCAP_FAILURE;
+		}
+	}
 
-			if(stlen >= MAX_CREDENTIALS_STR_LEN)
-			{
-				snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "invalid group name len %d", stlen);
-				return SCAP_FAILURE;
-			}
+	hi = handle->m_file_index_len;
 
-			totreadsize += readsize;
+	if(hi == 0 || handle->m_file_index[0].ts > ts)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "no state snapshot before the given time");
+		return SCAP_NOTFOUND;
+	}
 
-			readsize = fread(pgroup->name, 1, stlen, f);
-			CHECK_READ_SIZE(readsize, stlen);
+	//
+	// Find the last block that starts before ts, then the last snapshot
+	// before it
+	//
+	while(hi - lo > 1)
+	{
+		uint64_t mid = lo + (hi - lo) / 2;
 
-			// the string is not null-terminated on file
-			pgroup->name[stlen] = 0;
+		if(handle->m_file_index[mid].ts <= ts)
+		{
+			lo = mid;
+		}
+		else
+		{
+			hi = mid;
+		}
+	}
 
-			totreadsize += readsize;
+	while(handle->m_file_index[lo].snapshot_offset == 0)
+	{
+		if(lo == 0)
+		{
+			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "no state snapshot before the given time");
+			return SCAP_NOTFOUND;
 		}
+
+		lo--;
 	}
 
-	//
-	// Read the padding bytes so we properly align to the end of the data
-	//
-	padding_len = ((int32_t)block_length - (int32_t)totreadsize);
-	ASSERT(padding_len >= 0);
+	if(scap_load_snapshot(handle, handle->m_file_index[lo].snapshot_offset, &sh, &end) != SCAP_SUCCESS)
+	{
+		return SCAP_FAILURE;
+	}
 
-	readsize = fread(&padding, 1, padding_len, f);
-	CHECK_READ_SIZE(readsize, padding_len);
+	if(scap_set_read_pos(handle, end) != SCAP_SUCCESS)
+	{
+		return SCAP_FAILURE;
+	}
 
+	handle->m_evtcnt = sh.evtnum;
+	*evtnum = sh.evtnum;
 	return SCAP_SUCCESS;
 }
 
-//
-// Parse a process list block
-//
-int32_t scap_read_fdlist(scap_t *handle, FILE *f, uint32_t block_length)
+int32_t scap_get_snapshots(scap_t *handle, OUT const scap_snapshot_info **snapshots, OUT uint32_t *nsnapshots)
 {
-	size_t readsize;
-	size_t totreadsize = 0;
-	struct scap_threadinfo *tinfo;
-	scap_fdinfo fdi;
-	scap_fdinfo *nfdi;
-	//  uint16_t stlen;
-	uint64_t tid;
-	int32_t uth_status = SCAP_SUCCESS;
-	uint32_t padding;
-	int32_t padding_len;
+	FILE *f = handle->m_file;
+	block_header bh;
+	snapshot_header sh;
+	uint64_t last = 0;
+	uint64_t j;
+	long pos;
 
-	//
-	// Read the tid
-	//
-	readsize = fread(&tid, 1, sizeof(tid), f);
-	CHECK_READ_SIZE(readsize, sizeof(tid));
-	totreadsize += readsize;
+	if(f == NULL)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "snapshots are supported only on trace files");
+		return SCAP_FAILURE;
+	}
 
-	//
-	// Identify the process descriptor
-	//
-	HASH_FIND_INT64(handle->m_proclist, &tid, tinfo);
-	if(tinfo == NULL)
+	if(handle->m_file_follow != NULL)
 	{
-		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "corrupted trace file. FD block references TID %"PRIu64", which doesn't exist.",
-		         tid);
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "snapshots are not supported on a followed trace file");
 		return SCAP_FAILURE;
 	}
 
-	while(((int32_t)block_length - (int32_t)totreadsize) >= 4)
+	if(!handle->m_file_snapshots_loaded)
 	{
-		if(scap_fd_read_from_disk(handle, &fdi, &readsize, f) != SCAP_SUCCESS)
+		if(!handle->m_file_index_loaded)
 		{
-			return SCAP_FAILURE;
+			if(scap_load_index(handle) != SCAP_SUCCESS)
+			{
+				return SCAP_FAILURE;
+			}
 		}
-		totreadsize += readsize;
 
-		//
-		// Parsed successfully. Allocate the new entry and copy the temp one into into it.
-		//
-		nfdi = (scap_fdinfo *)malloc(sizeof(scap_fdinfo));
-		if(nfdi == NULL)
+		if(handle->m_file_index_len != 0)
 		{
-			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "process table allocation error (fd1)");
-			return SCAP_FAILURE;
+			handle->m_file_snapshots = (scap_snapshot_info *)malloc(handle->m_file_index_len * sizeof(scap_snapshot_info));
+			if(handle->m_file_snapshots == NULL)
+			{
+				snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error allocating the snapshot list");
+				return SCAP_FAILURE;
+			}
 		}
 
-		// Structure copy
-		*nfdi = fdi;
-
 		//
-		// Add the entry to the table
+		// The index entries point to the last snapshot before their block,
+		// so every snapshot appears at least once, in file order
 		//
-		HASH_ADD_INT64(tinfo->fdlist, fd, nfdi);
-		if(uth_status != SCAP_SUCCESS)
+		pos = ftell(f);
+
+		for(j = 0; j < handle->m_file_index_len; j++)
 		{
-			free(nfdi);
-			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "process table allocation error (fd2)");
+			uint64_t offset = handle->m_file_index[j].snapshot_offset;
+			scap_snapshot_info *si;
+
+			if(offset == 0 || offset == last)
+			{
+				continue;
+			}
+
+			if(fseek(f, (long)offset, SEEK_SET) != 0 ||
+				fread(&bh, sizeof(bh), 1, f) != 1 ||
+				bh.block_type != SS_BLOCK_TYPE ||
+				fread(&sh, sizeof(sh), 1, f) != 1)
+			{
+				snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "corrupted index, no snapshot at offset %" PRIu64, offset);
+				return SCAP_FAILURE;
+			}
+
+			si = &handle->m_file_snapshots[handle->m_file_nsnapshots++];
+			si->offset = offset;
+			si->ts = sh.ts;
+			si->evtnum = sh.evtnum;
+			last = offset;
+		}
+
+		if(pos < 0 || fseek(f, pos, SEEK_SET) != 0)
+		{
+			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error seeking in file");
 			return SCAP_FAILURE;
 		}
+
+		handle->m_file_snapshots_loaded = true;
 	}
 
-	//
-	// Read the padding bytes so we properly align to the end of the data
-	//
-	padding_len = ((int32_t)block_length - (int32_t)totreadsize);
-	ASSERT(padding_len >= 0);
+	*snapshots = handle->m_file_snapshots;
+	*nsnapshots = handle->m_file_nsnapshots;
+	return SCAP_SUCCESS;
+}
 
-	readsize = fread(&padding, 1, padding_len, f);
-	CHECK_READ_SIZE(readsize, padding_len);
+int32_t scap_restore_snapshot(scap_t *handle, const scap_snapshot_info *snapshot)
+{
+	snapshot_header sh;
+	uint64_t end;
+
+	if(handle->m_file == NULL)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "snapshots are supported only on trace files");
+		return SCAP_FAILURE;
+	}
+
+	if(handle->m_file_follow != NULL)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "snapshots are not supported on a followed trace file");
+		return SCAP_FAILURE;
+	}
+
+	if(scap_load_snapshot(handle, snapshot->offset, &sh, &end) != SCAP_SUCCESS)
+	{
+		return SCAP_FAILURE;
+	}
+
+	if(scap_set_read_pos(handle, end) != SCAP_SUCCESS)
+	{
+		return SCAP_FAILURE;
+	}
 
+	handle->m_evtcnt = sh.evtnum;
 	return SCAP_SUCCESS;
 }
 
 //
-// Parse the headers of a trace file and load the tables
+// Load the tables of a checkpoint written by scap_write_checkpoint() into
+// the process table of the handle, and return its header. SCAP_NOTFOUND if
+// there's no checkpoint.
 //
-int32_t scap_read_init(scap_t *handle, FILE *f)
+static int32_t scap_read_checkpoint_blocks(scap_t *handle, FILE *f, OUT checkpoint_header *ch)
 {
 	block_header bh;
+	scap_blockbuf b;
 	section_header_block sh;
-	uint32_t bt;
 	size_t readsize;
-	size_t toread;
-	int fseekres;
+	int32_t res;
 
-	//
-	// Read the section header block
-	//
-	if(fread(&bh, sizeof(bh), 1, f) != 1 ||
-	        fread(&sh, sizeof(sh), 1, f) != 1 ||
-	        fread(&bt, sizeof(bt), 1, f) != 1)
-	{
-		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error reading from file (1)");
-		return SCAP_FAILURE;
-	}
+	readsize = fread(&bh, 1, sizeof(bh), f);
+	CHECK_READ_SIZE(readsize, sizeof(bh));
 
-	if(bh.block_type != SHB_BLOCK_TYPE)
+	if(bh.block_type != SHB_BLOCK_TYPE || scap_read_block(handle, f, &bh, &b) != SCAP_SUCCESS ||
+		scap_blockbuf_read(&sh, sizeof(sh), &b) != sizeof(sh) || sh.byte_order_magic != SHB_MAGIC)
 	{
-		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "invalid block type");
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "invalid checkpoint file");
 		return SCAP_FAILURE;
 	}
 
-	if(sh.byte_order_magic != 0x1a2b3c4d)
+	readsize = fread(&bh, 1, sizeof(bh), f);
+	CHECK_READ_SIZE(readsize, sizeof(bh));
+
+	if(bh.block_type != CK_BLOCK_TYPE || scap_read_block(handle, f, &bh, &b) != SCAP_SUCCESS ||
+		scap_blockbuf_read(ch, sizeof(*ch), &b) != sizeof(*ch))
 	{
-		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "invalid magic number");
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "invalid checkpoint file, no checkpoint block");
 		return SCAP_FAILURE;
 	}
 
-	//
-	// Read the metadata blocks (processes, FDs, etc.)
-	//
-	while(true)
+	ch->boot_id[sizeof(ch->boot_id) - 1] = 0;
+
+	while((readsize = fread(&bh, 1, sizeof(bh), f)) != 0)
 	{
-		readsize = fread(&bh, 1, sizeof(bh), f);
 		CHECK_READ_SIZE(readsize, sizeof(bh));
 
+		if(scap_read_block(handle, f, &bh, &b) != SCAP_SUCCESS)
+		{
+			return SCAP_FAILURE;
+		}
+
 		switch(bh.block_type)
 		{
-		case MI_BLOCK_TYPE:
-		case MI_BLOCK_TYPE_INT:
-			if(scap_read_machine_info(handle, f, bh.block_total_length - sizeof(block_header) - 4) != SCAP_SUCCESS)
-			{
-				return SCAP_FAILURE;
-			}
-			break;
 		case PL_BLOCK_TYPE:
-		case PL_BLOCK_TYPE_INT:
-			if(scap_read_proclist(handle, f, bh.block_total_length - sizeof(block_header) - 4) != SCAP_SUCCESS)
-			{
-				return SCAP_FAILURE;
-			}
+			res = scap_read_proclist(handle, &b, b.m_len);
 			break;
 		case FDL_BLOCK_TYPE:
-		case FDL_BLOCK_TYPE_INT:
-			if(scap_read_fdlist(handle, f, bh.block_total_length - sizeof(block_header) - 4) != SCAP_SUCCESS)
-			{
-				return SCAP_FAILURE;
-			}
+			res = scap_read_fdlist(handle, &b, b.m_len);
 			break;
-		case EV_BLOCK_TYPE:
-		case EV_BLOCK_TYPE_INT:
-			//
-			// We're done with the metadata headers. Rewind the file position so we are aligned to start reading the events.
-			//
-			fseekres = fseek(f, (long)0 - sizeof(bh), SEEK_CUR);
-			if(fseekres == 0)
-			{
-				return SCAP_SUCCESS;
-			}
-			else
-			{
-				snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error seeking in file");
-				return SCAP_FAILURE;
-			}
-		case IL_BLOCK_TYPE:
-		case IL_BLOCK_TYPE_INT:
-			if(scap_read_iflist(handle, f, bh.block_total_length - sizeof(block_header) - 4) != SCAP_SUCCESS)
-			{
-				return SCAP_FAILURE;
-			}
+		case FDLC_BLOCK_TYPE:
+			res = scap_read_fdlist_compact(handle, &b, b.m_len);
 			break;
-		case UL_BLOCK_TYPE:
-		case UL_BLOCK_TYPE_INT:
-			if(scap_read_userlist(handle, f, bh.block_total_length - sizeof(block_header) - 4) != SCAP_SUCCESS)
-			{
-				return SCAP_FAILURE;
-			}
+		case CG_BLOCK_TYPE:
+			res = scap_read_cglist(handle, &b, b.m_len);
 			break;
 		default:
 			//
-			// Unknwon block type. Skip the block.
+			// Unknown blocks are skipped, like in the trace files
 			//
-			toread = bh.block_total_length - sizeof(block_header) - 4;
-			fseekres = fseek(f, toread, SEEK_CUR);
-			if(fseekres != 0)
-			{
-				snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "corrupted input file. Can't skip block of type %x and size %u.",
-				         (int)bh.block_type,
-				         (unsigned int)toread);
-				return SCAP_FAILURE;
-			}
+			res = SCAP_SUCCESS;
 			break;
 		}
 
-		//
-		// Read and validate the trailer
-		//
-		readsize = fread(&bt, 1, sizeof(bt), f);
-		CHECK_READ_SIZE(readsize, sizeof(bt));
-
-		if(bt != bh.block_total_length)
+		if(res != SCAP_SUCCESS)
 		{
-			snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "wrong block total length, header=%u, trailer=%u",
-			         bh.block_total_length,
-			         bt);
 			return SCAP_FAILURE;
 		}
 	}
@@ -1626,57 +5469,25 @@ int32_t scap_read_init(scap_t *handle, FILE *f)
 	return SCAP_SUCCESS;
 }
 
-//
-// Read an event from disk
-//
-int32_t scap_next_offline(scap_t *handle, OUT scap_evt **pevent, OUT uint16_t *pcpuid)
+int32_t scap_read_checkpoint(scap_t *handle, const char *fname, OUT checkpoint_header *ch)
 {
-	block_header bh;
-	size_t readsize;
-	uint32_t readlen;
-	FILE *f = handle->m_file;
-
-	ASSERT(f != NULL);
+	FILE *f;
+	int32_t res;
 
-	//
-	// Read the block header
-	//
-	readsize = fread(&bh, 1, sizeof(bh), f);
-	if(readsize != sizeof(bh))
+	f = fopen(fname, "rb");
+	if(f == NULL)
 	{
-		if(readsize == 0)
-		{
-			//
-			// We read exactly 0 bytes. This indicates a correct end of file.
-			//
-			return SCAP_EOF;
-		}
-		else
-		{
-			CHECK_READ_SIZE(readsize, sizeof(bh));
-		}
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "can't open %s: %s", fname, strerror(errno));
+		return SCAP_NOTFOUND;
 	}
 
-	if(bh.block_type != EV_BLOCK_TYPE && bh.block_type != EV_BLOCK_TYPE_INT)
-	{
-		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "unexpected block type %u", (uint32_t)bh.block_type);
-		return SCAP_FAILURE;
-	}
+	res = scap_read_checkpoint_blocks(handle, f, ch);
+	fclose(f);
 
-	if(bh.block_total_length < sizeof(bh) + sizeof(struct ppm_evt_hdr) + 4)
+	if(res != SCAP_SUCCESS)
 	{
-		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "block length too short %u", (uint32_t)bh.block_total_length);
-		return SCAP_FAILURE;
+		scap_proc_free_table(handle);
 	}
 
-	//
-	// Read the event
-	//
-	readlen = bh.block_total_length - sizeof(bh);
-	readsize = fread(handle->m_file_evt_buf, 1, readlen, f);
-	CHECK_READ_SIZE(readsize, readlen);
-
-	*pcpuid = *(uint16_t *)handle->m_file_evt_buf;
-	*pevent = (struct ppm_evt_hdr *)(handle->m_file_evt_buf + sizeof(uint16_t));
-	return SCAP_SUCCESS;
+	return res;
 }
@@ -80,6 +80,35 @@ typedef struct _section_header_block
 										// library release. We'll keep him for a while for
 										// backward compatibility
 
+///////////////////////////////////////////////////////////////////////////////
+// COMPACT FD LIST BLOCK
+///////////////////////////////////////////////////////////////////////////////
+// The fd tables of all the processes of the PL_BLOCK_TYPE block that precedes
+// it, written instead of one FDL_BLOCK_TYPE block per process. The header is
+// followed by a table of the names of the fds, each one a varint length and
+// its characters, so a name shared by many processes is only written once.
+// Then come nprocs entries, each one:
+//
+//   varint tid, as the zigzag delta from the tid of the previous entry
+//   varint number of fds
+//   for each fd:
+//     varint fd and varint inode, as the zigzag deltas from the previous fd
+//     of the same process (0 for the first one)
+//     8 bit type
+//     the addresses of the sockets, in the same format of FDL_BLOCK_TYPE,
+//     and a varint index in the name table instead of each name
+//
+// Varints are little endian base 128. Readers support both the fd list formats.
+#define FDLC_BLOCK_TYPE		0x20B
+
+typedef struct _fdlist_compact_header
+{
+	uint32_t nstrings; // Entries of the name table
+	uint32_t strings_len; // Bytes of the name table
+	uint32_t nprocs; // Entries after the name table
+	uint32_t reserved;
+}fdlist_compact_header;
+
 ///////////////////////////////////////////////////////////////////////////////
 // EVENT BLOCK
 ///////////////////////////////////////////////////////////////////////////////
@@ -104,6 +133,98 @@ typedef struct _section_header_block
 										// library release. We'll keep him for a while for
 										// backward compatibility
 
+///////////////////////////////////////////////////////////////////////////////
+// CGROUP LIST BLOCK
+///////////////////////////////////////////////////////////////////////////////
+// The cgroups of the processes of the PL_BLOCK_TYPE block that precedes it,
+// for the processes that have one. Each entry is the tid, followed by the
+// 16 bit length of the path and by its characters. Files without it are
+// read as if no process had a cgroup.
+#define CG_BLOCK_TYPE		0x20A
+
+///////////////////////////////////////////////////////////////////////////////
+// COMPRESSED EVENT FRAME BLOCK
+///////////////////////////////////////////////////////////////////////////////
+// A sequence of event blocks, compressed together. The frame header is
+// followed by compressed_len bytes that decompress to uncompressed_len bytes
+// of EV_BLOCK_TYPE blocks, in the same format they have in an uncompressed
+// file. The frames can be mixed with plain event blocks.
+#define EVF_BLOCK_TYPE		0x207
+
+// Compression algorithms
+#define EVF_COMPRESSION_ZLIB	1
+
+typedef struct _event_frame_header
+{
+	uint32_t compression;
+	uint32_t compressed_len;
+	uint32_t uncompressed_len;
+	uint32_t reserved;
+}event_frame_header;
+
+///////////////////////////////////////////////////////////////////////////////
+// INDEX BLOCK
+///////////////////////////////////////////////////////////////////////////////
+// The last block of the file, if present. It has one entry for each group
+// of events written together by the dumper (1MB by default), so readers can
+// find the position of a given time without reading the events before it.
+// It can be located from the end of the file through the block trailer.
+//
+// The entries can be followed by one scap_block_summary per entry, in the
+// same order: the time range, the event types and a Bloom filter of the
+// threads, processes, fd names and ports of the events of the group, so
+// that readers can skip the groups that can't match a filter. The readers
+// that don't know about them see an index of the wrong size and ignore it.
+#define IX_BLOCK_TYPE		0x208
+
+typedef struct _index_header
+{
+	uint32_t entry_size; // sizeof(index_entry)
+	uint32_t summary_size; // sizeof(scap_block_summary), 0 if there are no summaries
+	uint64_t nentries;
+}index_header;
+
+typedef struct _index_entry
+{
+	uint64_t offset; // Position of an event or frame block in the file
+	uint64_t ts; // Timestamp of its first event
+	uint64_t evtnum; // Number of its first event, starting from 0
+	uint64_t snapshot_offset; // Position of a snapshot of the thread and fd tables valid at offset, 0 if none
+}index_entry;
+
+///////////////////////////////////////////////////////////////////////////////
+// STATE SNAPSHOT BLOCK
+///////////////////////////////////////////////////////////////////////////////
+// The process and fd tables at a point of the capture. The snapshot header is
+// followed by a PL_BLOCK_TYPE block and by the fd list blocks, complete
+// with their headers and trailers, in the same format of the ones at the
+// beginning of the file. The tables are valid for the events that come after
+// the snapshot block. Readers that don't need the tables skip the whole block.
+#define SS_BLOCK_TYPE		0x209
+
+typedef struct _snapshot_header
+{
+	uint64_t ts; // Timestamp of the last event before the snapshot
+	uint64_t evtnum; // Number of the first event after the snapshot
+}snapshot_header;
+
+///////////////////////////////////////////////////////////////////////////////
+// CHECKPOINT BLOCK
+///////////////////////////////////////////////////////////////////////////////
+// The first block after the section header of a checkpoint file, written by
+// scap_write_checkpoint(). It's followed by the PL_BLOCK_TYPE, CG_BLOCK_TYPE
+// and fd list blocks of the tables of the inspector, which are only valid
+// for the boot they were written in, and only for the processes that started
+// before the checkpoint.
+#define CK_BLOCK_TYPE		0x20C
+
+typedef struct _checkpoint_header
+{
+	char boot_id[40]; // /proc/sys/kernel/random/boot_id, without the newline
+	uint64_t uptime; // CLOCK_MONOTONIC time of the checkpoint, in ns
+	uint64_t ts; // Wall clock time of the checkpoint, in ns
+}checkpoint_header;
+
 #if defined __sun
 #pragma pack()
 #else
@@ -0,0 +1,447 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "scap.h"
+#include "scap-int.h"
+
+#if !defined(_WIN32) && !defined(__APPLE__)
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "scap_tap.h"
+
+//
+// The event tap. See scap_tap.h for the layout and the protocol.
+//
+
+#define SCAP_TAP_NAME_SIZE 128
+
+//
+// Smallest data area we accept, so that a normal event always fits
+//
+#define SCAP_TAP_MIN_SIZE (64 * 1024)
+
+typedef struct scap_tap
+{
+	char m_name[SCAP_TAP_NAME_SIZE];
+	struct scap_tap_header* m_hdr;
+	char* m_data;
+	size_t m_map_size;
+	uint64_t m_head;
+	uint64_t m_seq;
+}scap_tap;
+
+struct scap_tap_reader
+{
+	struct scap_tap_header* m_hdr;
+	char* m_data;
+	size_t m_map_size;
+	uint64_t m_pos;
+	uint64_t m_next_seq;
+	bool m_started; // false until the first event, so that what was written before attaching doesn't count as lost
+	uint64_t m_lost;
+	char* m_evt_buf; // Copy of the last returned event
+	uint32_t m_evt_buf_size;
+};
+
+//
+// shm_open() wants a name that starts with a slash
+//
+static void scap_tap_make_name(const char* name, OUT char* shm_name)
+{
+	snprintf(shm_name, SCAP_TAP_NAME_SIZE, "%s%s", name[0] == '/'? "" : "/", name);
+}
+
+int32_t scap_tap_open(scap_t* handle, const char* name, uint32_t size)
+{
+	scap_tap* tap;
+	int fd;
+
+	if(handle->m_tap != NULL)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "the event tap is already enabled");
+		return SCAP_FAILURE;
+	}
+
+	if(size < SCAP_TAP_MIN_SIZE || size % 8 != 0)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "invalid event tap size %u, must be a multiple of 8 and at least %u bytes", size, SCAP_TAP_MIN_SIZE);
+		return SCAP_FAILURE;
+	}
+
+	tap = (scap_tap*)calloc(1, sizeof(scap_tap));
+	if(tap == NULL)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "error allocating the event tap");
+		return SCAP_FAILURE;
+	}
+
+	scap_tap_make_name(name, tap->m_name);
+	tap->m_map_size = sizeof(struct scap_tap_header) + size;
+
+	//
+	// Never reuse an existing object: a tap left behind by a process that
+	// crashed might still be mapped by its readers
+	//
+	shm_unlink(tap->m_name);
+
+	//
+	// The tap has every event, I/O buffers included, so only the user of
+	// the capture can read it
+	//
+	fd = shm_open(tap->m_name, O_CREAT | O_EXCL | O_RDWR, 0600);
+	if(fd < 0)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "error creating the event tap %s: %s", tap->m_name, strerror(errno));
+		free(tap);
+		return SCAP_FAILURE;
+	}
+
+	if(ftruncate(fd, tap->m_map_size) < 0)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "error sizing the event tap %s: %s", tap->m_name, strerror(errno));
+		close(fd);
+		shm_unlink(tap->m_name);
+		free(tap);
+		return SCAP_FAILURE;
+	}
+
+	tap->m_hdr = (struct scap_tap_header*)mmap(0, tap->m_map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if(tap->m_hdr == MAP_FAILED)
+	{
+		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "error mapping the event tap %s: %s", tap->m_name, strerror(errno));
+		shm_unlink(tap->m_name);
+		free(tap);
+		return SCAP_FAILURE;
+	}
+
+	tap->m_data = (char*)tap->m_hdr + sizeof(struct scap_tap_header);
+
+	tap->m_hdr->version = SCAP_TAP_VERSION;
+	tap->m_hdr->header_size = sizeof(struct scap_tap_header);
+	tap->m_hdr->data_size = size;
+	tap->m_hdr->state = SCAP_TAP_STATE_ACTIVE;
+	tap->m_hdr->head = 0;
+	tap->m_hdr->write_pos = 0;
+	tap->m_hdr->n_evts = 0;
+
+	//
+	// The readers check the magic before anything else
+	//
+	__sync_synchronize();
+	tap->m_hdr->magic = SCAP_TAP_MAGIC;
+
+	handle->m_tap = tap;
+
+	return SCAP_SUCCESS;
+}
+
+void scap_tap_close(scap_t* handle)
+{
+	scap_tap* tap = handle->m_tap;
+
+	if(tap == NULL)
+	{
+		return;
+	}
+
+	tap->m_hdr->state = SCAP_TAP_STATE_CLOSED;
+	munmap(tap->m_hdr, tap->m_map_size);
+	shm_unlink(tap->m_name);
+	free(tap);
+
+	handle->m_tap = NULL;
+}
+
+void scap_tap_write(scap_t* handle, scap_evt* pe, uint16_t cpuid)
+{
+	scap_tap* tap = handle->m_tap;
+	uint32_t data_size = tap->m_hdr->data_size;
+	uint32_t len = SCAP_TAP_ENTRY_LEN(pe->len);
+	uint32_t off = (uint32_t)(tap->m_head % data_size);
+	uint32_t pad = 0;
+	struct scap_tap_entry* entry;
+
+	//
+	// Too big to ever fit. The readers see the gap in the sequence numbers.
+	//
+	if(len > data_size)
+	{
+		tap->m_seq++;
+		return;
+	}
+
+	if(off + len > data_size)
+	{
+		pad = data_size - off;
+	}
+
+	//
+	// Claim the space, so that the readers know it's being overwritten
+	//
+	tap->m_hdr->write_pos = tap->m_head + pad + len;
+	__sync_synchronize();
+
+	if(pad != 0)
+	{
+		entry = (struct scap_tap_entry*)(tap->m_data + off);
+		entry->len = pad;
+		entry->cpuid = SCAP_TAP_ENTRY_PAD;
+		tap->m_head += pad;
+		off = 0;
+	}
+
+	entry = (struct scap_tap_entry*)(tap->m_data + off);
+	entry->len = len;
+	entry->cpuid = cpuid;
+	entry->seq = tap->m_seq++;
+	memcpy(entry + 1, pe, pe->len);
+
+	__sync_synchronize();
+	tap->m_head += len;
+	tap->m_hdr->head = tap->m_head;
+	tap->m_hdr->n_evts = tap->m_seq;
+}
+
+scap_tap_reader* scap_tap_attach(const char* name, char* error)
+{
+	char shm_name[SCAP_TAP_NAME_SIZE];
+	struct scap_tap_reader* r;
+	struct stat st;
+	int fd;
+
+	scap_tap_make_name(name, shm_name);
+
+	fd = shm_open(shm_name, O_RDONLY, 0);
+	if(fd < 0)
+	{
+		snprintf(error, SCAP_LASTERR_SIZE, "error opening the event tap %s: %s", shm_name, strerror(errno));
+		return NULL;
+	}
+
+	if(fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(struct scap_tap_header))
+	{
+		snprintf(error, SCAP_LASTERR_SIZE, "invalid event tap %s", shm_name);
+		close(fd);
+		return NULL;
+	}
+
+	r = (struct scap_tap_reader*)calloc(1, sizeof(struct scap_tap_reader));
+	if(r == NULL)
+	{
+		snprintf(error, SCAP_LASTERR_SIZE, "error allocating the event tap reader");
+		close(fd);
+		return NULL;
+	}
+
+	r->m_map_size = st.st_size;
+	r->m_hdr = (struct scap_tap_header*)mmap(0, r->m_map_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if(r->m_hdr == MAP_FAILED)
+	{
+		snprintf(error, SCAP_LASTERR_SIZE, "error mapping the event tap %s: %s", shm_name, strerror(errno));
+		free(r);
+		return NULL;
+	}
+
+	if(r->m_hdr->magic != SCAP_TAP_MAGIC)
+	{
+		snprintf(error, SCAP_LASTERR_SIZE, "the event tap %s is not ready", shm_name);
+		scap_tap_detach(r);
+		return NULL;
+	}
+
+	__sync_synchronize();
+
+	if(r->m_hdr->version != SCAP_TAP_VERSION ||
+		(size_t)r->m_hdr->header_size + r->m_hdr->data_size > r->m_map_size)
+	{
+		snprintf(error, SCAP_LASTERR_SIZE, "unsupported event tap %s", shm_name);
+		scap_tap_detach(r);
+		return NULL;
+	}
+
+	r->m_data = (char*)r->m_hdr + r->m_hdr->header_size;
+	r->m_pos = r->m_hdr->head;
+
+	return r;
+}
+
+int32_t scap_tap_next(scap_tap_reader* r, OUT scap_evt** pevent, OUT uint16_t* pcpuid)
+{
+	uint32_t data_size = r->m_hdr->data_size;
+
+	while(true)
+	{
+		uint64_t head = r->m_hdr->head;
+		struct scap_tap_entry entry;
+		uint32_t off;
+		uint32_t evt_len = 0;
+		bool valid;
+
+		__sync_synchronize();
+
+		if(r->m_pos == head)
+		{
+			return (r->m_hdr->state == SCAP_TAP_STATE_CLOSED)? SCAP_EOF : SCAP_TIMEOUT;
+		}
+
+		//
+		// We are more than a full lap behind
+		//
+		if(head - r->m_pos > data_size)
+		{
+			r->m_pos = head;
+			continue;
+		}
+
+		off = (uint32_t)(r->m_pos % data_size);
+		memcpy(&entry, r->m_data + off, sizeof(entry));
+
+		valid = entry.len >= sizeof(entry) &&
+			entry.len % 8 == 0 &&
+			entry.len <= data_size - off;
+
+		if(valid && entry.cpuid != SCAP_TAP_ENTRY_PAD)
+		{
+			evt_len = entry.len - sizeof(entry);
+
+			if(evt_len > r->m_evt_buf_size)
+			{
+				char* buf = (char*)realloc(r->m_evt_buf, evt_len);
+				if(buf == NULL)
+				{
+					return SCAP_FAILURE;
+				}
+
+				r->m_evt_buf = buf;
+				r->m_evt_buf_size = evt_len;
+			}
+
+			memcpy(r->m_evt_buf, r->m_data + off + sizeof(entry), evt_len);
+		}
+
+		//
+		// If the writer got to the entry while we were copying it, what we
+		// have is garbage
+		//
+		__sync_synchronize();
+
+		if(r->m_hdr->write_pos > r->m_pos + data_size)
+		{
+			r->m_pos = r->m_hdr->head;
+			continue;
+		}
+
+		if(!valid)
+		{
+			ASSERT(false);
+			r->m_pos = r->m_hdr->head;
+			continue;
+		}
+
+		r->m_pos += entry.len;
+
+		if(entry.cpuid == SCAP_TAP_ENTRY_PAD)
+		{
+			continue;
+		}
+
+		if(evt_len < sizeof(scap_evt) || ((scap_evt*)r->m_evt_buf)->len > evt_len)
+		{
+			ASSERT(false);
+			continue;
+		}
+
+		if(r->m_started)
+		{
+			r->m_lost += entry.seq - r->m_next_seq;
+		}
+
+		r->m_started = true;
+		r->m_next_seq = entry.seq + 1;
+
+		*pevent = (scap_evt*)r->m_evt_buf;
+		*pcpuid = entry.cpuid;
+		return SCAP_SUCCESS;
+	}
+}
+
+uint64_t scap_tap_get_lost(scap_tap_reader* r)
+{
+	return r->m_lost;
+}
+
+void scap_tap_detach(scap_tap_reader* r)
+{
+	munmap(r->m_hdr, r->m_map_size);
+
+	if(r->m_evt_buf != NULL)
+	{
+		free(r->m_evt_buf);
+	}
+
+	free(r);
+}
+
+#else // !defined(_WIN32) && !defined(__APPLE__)
+
+int32_t scap_tap_open(scap_t* handle, const char* name, uint32_t size)
+{
+	snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "the event tap is not supported on this platform");
+	return SCAP_FAILURE;
+}
+
+void scap_tap_close(scap_t* handle)
+{
+}
+
+void scap_tap_write(scap_t* handle, scap_evt* pe, uint16_t cpuid)
+{
+}
+
+scap_tap_reader* scap_tap_attach(const char* name, char* error)
+{
+	snprintf(error, SCAP_LASTERR_SIZE, "the event tap is not supported on this platform");
+	return NULL;
+}
+
+int32_t scap_tap_next(scap_tap_reader* r, OUT scap_evt** pevent, OUT uint16_t* pcpuid)
+{
+	return SCAP_FAILURE;
+}
+
+uint64_t scap_tap_get_lost(scap_tap_reader* r)
+{
+	return 0;
+}
+
+void scap_tap_detach(scap_tap_reader* r)
+{
+}
+
+#endif // !defined(_WIN32) && !defined(__APPLE__)
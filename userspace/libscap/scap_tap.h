@@ -0,0 +1,87 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+///////////////////////////////////////////////////////////////////////////////
+// Layout of the event tap.
+//
+// The tap is a POSIX shared memory object (see shm_open) written by the
+// process that runs the capture, and mapped read-only by any number of
+// readers. It starts with a scap_tap_header, followed by data_size bytes of
+// entries. Positions are byte counters that only grow; the offset of a
+// position in the data area is position % data_size.
+//
+// Each entry is a scap_tap_entry followed by the event, in the same format
+// scap_next() returns it, and is padded to a multiple of 8 bytes. An entry
+// never wraps: when it doesn't fit before the end of the data area, the
+// writer fills the rest with an entry whose cpuid is SCAP_TAP_ENTRY_PAD and
+// starts again at offset 0.
+//
+// The writer never waits for the readers. Before touching the data area it
+// stores in write_pos the position where the entry will end, and once the
+// entry is complete it moves head there. A reader keeps its own position:
+//  - if it's equal to head, there's nothing new;
+//  - otherwise it copies the entry at its position, then reads write_pos
+//    again. If write_pos is more than data_size bytes ahead of the position,
+//    the writer may have overwritten the entry: the copy must be discarded
+//    and the reader starts again from head.
+// The entries carry a sequence number, so the readers know how many events
+// they missed.
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SCAP_TAP_MAGIC 0x50415453 /* "STAP" */
+#define SCAP_TAP_VERSION 1
+
+#define SCAP_TAP_ENTRY_PAD 0xffff
+#define SCAP_TAP_ENTRY_LEN(evt_len) ((sizeof(struct scap_tap_entry) + (evt_len) + 7) & ~7)
+
+//
+// Writer states
+//
+#define SCAP_TAP_STATE_ACTIVE 1
+#define SCAP_TAP_STATE_CLOSED 2 // The writer is gone, nothing will be added after head
+
+struct scap_tap_header
+{
+	uint32_t magic; // SCAP_TAP_MAGIC, written last when the tap is created
+	uint32_t version;
+	uint32_t header_size; // Offset of the data area from the beginning of the object
+	uint32_t data_size; // Size of the data area. Multiple of 8
+	volatile uint32_t state; // SCAP_TAP_STATE_*
+	uint32_t reserved;
+	volatile uint64_t head; // End of the last complete entry
+	volatile uint64_t write_pos; // End of the entry being written, equal to head between writes
+	volatile uint64_t n_evts; // Number of events written
+};
+
+struct scap_tap_entry
+{
+	uint32_t len; // Length of the entry, including this header and the padding
+	uint16_t cpuid; // CPU of the event, or SCAP_TAP_ENTRY_PAD
+	uint16_t reserved;
+	uint64_t seq; // Sequence number of the event, starting from 0
+};
+
+#ifdef __cplusplus
+}
+#endif
@@ -25,27 +25,20 @@ along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <pwd.h>
 #include <grp.h>
+#include <pthread.h>
 
 //
-// Allocate and return the list of interfaces on this system
+// Read the users and groups of this system in a new list. This goes through
+// NSS, so it can be slow with a remote directory like LDAP.
 //
-int32_t scap_create_userlist(scap_t* handle)
+static scap_userlist* scap_read_userlist(char* error)
 {
+	scap_userlist* ul;
 	uint32_t usercnt;
 	uint32_t grpcnt;
 	struct passwd *p;
 	struct group *g;
 
-	//
-	// If the list of interfaces was already allocated for this handle (for example because this is
-	// not the first interface list block), free it
-	//
-	if(handle->m_userlist != NULL)
-	{
-		scap_free_userlist(handle->m_userlist);
-		handle->m_userlist = NULL;
-	}
-
 	//
 	// First pass: count the number of users and the number of groups
 	//
@@ -60,77 +53,228 @@ int32_t scap_create_userlist(scap_t* handle)
 	//
 	// Memory allocations
 	//
-	handle->m_userlist = (scap_userlist*)malloc(sizeof(scap_userlist));
-	if(handle->m_userlist == NULL)
+	ul = (scap_userlist*)malloc(sizeof(scap_userlist));
+	if(ul == NULL)
 	{
-		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "userlist allocation failed(1)");
-		return SCAP_FAILURE;
+		snprintf(error, SCAP_LASTERR_SIZE, "userlist allocation failed(1)");
+		return NULL;
 	}
 
-	handle->m_userlist->nusers = usercnt;
-	handle->m_userlist->ngroups = grpcnt;
-	handle->m_userlist->totsavelen = 0;
-	handle->m_userlist->users = (scap_userinfo*)malloc(usercnt * sizeof(scap_userinfo));
-	if(handle->m_userlist->users == NULL)
+	ul->nusers = usercnt;
+	ul->ngroups = grpcnt;
+	ul->totsavelen = 0;
+	ul->users = (scap_userinfo*)malloc(usercnt * sizeof(scap_userinfo));
+	if(ul->users == NULL)
 	{
-		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "userlist allocation failed(2)");
-		free(handle->m_userlist);
-		return SCAP_FAILURE;		
+		snprintf(error, SCAP_LASTERR_SIZE, "userlist allocation failed(2)");
+		free(ul);
+		return NULL;
 	}
 
-	handle->m_userlist->groups = (scap_groupinfo*)malloc(grpcnt * sizeof(scap_groupinfo));
-	if(handle->m_userlist->groups == NULL)
+	ul->groups = (scap_groupinfo*)malloc(grpcnt * sizeof(scap_groupinfo));
+	if(ul->groups == NULL)
 	{
-		snprintf(handle->m_lasterr,	SCAP_LASTERR_SIZE, "grouplist allocation failed(2)");
-		free(handle->m_userlist);
-		free(handle->m_userlist->users);
-		return SCAP_FAILURE;		
+		snprintf(error, SCAP_LASTERR_SIZE, "grouplist allocation failed(2)");
+		free(ul->users);
+		free(ul);
+		return NULL;
 	}
 
 	//
-	// Second pass: copy the data
+	// Second pass: copy the data. The database can change between the two
+	// passes, so we stop at the entries counted by the first one.
 	//
 
 	//users
 	p = getpwent();
 
-	for(usercnt = 0; p; p = getpwent(), usercnt++)
+	for(usercnt = 0; p && usercnt < ul->nusers; p = getpwent(), usercnt++)
 	{
-		handle->m_userlist->users[usercnt].uid = p->pw_uid;
-		handle->m_userlist->users[usercnt].gid = p->pw_gid;
-		strncpy(handle->m_userlist->users[usercnt].name, p->pw_name, sizeof(handle->m_userlist->users[usercnt].name));
-		strncpy(handle->m_userlist->users[usercnt].homedir, p->pw_dir, sizeof(handle->m_userlist->users[usercnt].homedir));
-		strncpy(handle->m_userlist->users[usercnt].shell, p->pw_shell, sizeof(handle->m_userlist->users[usercnt].shell));
+		ul->users[usercnt].uid = p->pw_uid;
+		ul->users[usercnt].gid = p->pw_gid;
+		strncpy(ul->users[usercnt].name, p->pw_name, sizeof(ul->users[usercnt].name));
+		strncpy(ul->users[usercnt].homedir, p->pw_dir, sizeof(ul->users[usercnt].homedir));
+		strncpy(ul->users[usercnt].shell, p->pw_shell, sizeof(ul->users[usercnt].shell));
 
-		handle->m_userlist->totsavelen += 
+		ul->totsavelen += 
 			sizeof(uint8_t) + // type
 			sizeof(uint32_t) + // uid
 			sizeof(uint32_t) +  // gid
-			strlen(handle->m_userlist->users[usercnt].name) + 2 + 
-			strlen(handle->m_userlist->users[usercnt].homedir) + 2 +
-			strlen(handle->m_userlist->users[usercnt].shell) + 2; 
+			strlen(ul->users[usercnt].name) + 2 + 
+			strlen(ul->users[usercnt].homedir) + 2 +
+			strlen(ul->users[usercnt].shell) + 2; 
 	}
 
 	endpwent();
+	ul->nusers = usercnt;
 
 	// groups
 	g = getgrent();
 
-	for(grpcnt = 0; g; g = getgrent(), grpcnt++)
+	for(grpcnt = 0; g && grpcnt < ul->ngroups; g = getgrent(), grpcnt++)
 	{
-		handle->m_userlist->groups[grpcnt].gid = g->gr_gid;
-		strncpy(handle->m_userlist->groups[grpcnt].name, g->gr_name, sizeof(handle->m_userlist->groups[grpcnt].name));
+		ul->groups[grpcnt].gid = g->gr_gid;
+		strncpy(ul->groups[grpcnt].name, g->gr_name, sizeof(ul->groups[grpcnt].name));
 
-		handle->m_userlist->totsavelen += 
+		ul->totsavelen += 
 			sizeof(uint8_t) + // type
 			sizeof(uint32_t) +  // gid
-			strlen(handle->m_userlist->groups[grpcnt].name) + 2;
+			strlen(ul->groups[grpcnt].name) + 2;
 	}
 
 	endgrent();
+	ul->ngroups = grpcnt;
+
+	return ul;
+}
+
+//
+// Allocate and return the list of users and groups on this system
+//
+int32_t scap_create_userlist(scap_t* handle)
+{
+	scap_userlist* ul = scap_read_userlist(handle->m_lasterr);
+
+	if(ul == NULL)
+	{
+		return SCAP_FAILURE;
+	}
+
+	//
+	// If the list was already allocated for this handle, replace it
+	//
+	if(handle->m_userlist != NULL)
+	{
+		scap_free_userlist(handle->m_userlist);
+	}
+
+	handle->m_userlist = ul;
+	return SCAP_SUCCESS;
+}
+
+//
+// Background refresh of the user list.
+// The thread builds a new list, that only scap_refresh_userlist_complete()
+// swaps in, from the thread that owns the handle.
+//
+struct scap_userlist_refresh
+{
+	pthread_t m_thread;
+	volatile bool m_done;
+	scap_userlist* m_userlist;
+	char m_lasterr[SCAP_LASTERR_SIZE];
+};
+
+static void* scap_userlist_refresh_thread(void* arg)
+{
+	struct scap_userlist_refresh* refresh = (struct scap_userlist_refresh*)arg;
+
+	refresh->m_userlist = scap_read_userlist(refresh->m_lasterr);
+
+	__sync_synchronize();
+	refresh->m_done = true;
+
+	return NULL;
+}
+
+int32_t scap_refresh_userlist_start(scap_t* handle)
+{
+	struct scap_userlist_refresh* refresh;
+
+	if(handle->m_file)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "the user list of a trace file can't be refreshed");
+		return SCAP_FAILURE;
+	}
 
+	if(handle->m_userlist_refresh != NULL)
+	{
+		return SCAP_SUCCESS;
+	}
+
+	refresh = (struct scap_userlist_refresh*)calloc(1, sizeof(struct scap_userlist_refresh));
+	if(refresh == NULL)
+	{
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error allocating the user list refresh");
+		return SCAP_FAILURE;
+	}
+
+	if(pthread_create(&refresh->m_thread, NULL, scap_userlist_refresh_thread, refresh) != 0)
+	{
+		free(refresh);
+		snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "error starting the user list refresh thread");
+		return SCAP_FAILURE;
+	}
+
+	handle->m_userlist_refresh = refresh;
+	return SCAP_SUCCESS;
+}
+
+static void scap_refresh_userlist_free(scap_t* handle)
+{
+	struct scap_userlist_refresh* refresh = handle->m_userlist_refresh;
+
+	pthread_join(refresh->m_thread, NULL);
+	scap_free_userlist(refresh->m_userlist);
+	free(refresh);
+	handle->m_userlist_refresh = NULL;
+}
+
+void scap_refresh_userlist_stop(scap_t* handle)
+{
+	if(handle->m_userlist_refresh == NULL)
+	{
+		return;
+	}
+
+	scap_refresh_userlist_free(handle);
+}
+
+int32_t scap_refresh_userlist_complete(scap_t* handle)
+{
+	struct scap_userlist_refresh* refresh = handle->m_userlist_refresh;
+
+	if(refresh == NULL)
+	{
+		return SCAP_NOTFOUND;
+	}
+
+	if(!refresh->m_done)
+	{
+		return SCAP_TIMEOUT;
+	}
+
+	__sync_synchronize();
+
+	if(refresh->m_userlist == NULL)
+	{
+		scap_errprintf(handle->m_lasterr, "error refreshing the user list: %s", refresh->m_lasterr);
+		scap_refresh_userlist_free(handle);
+		return SCAP_FAILURE;
+	}
+
+	scap_free_userlist(handle->m_userlist);
+	handle->m_userlist = refresh->m_userlist;
+	refresh->m_userlist = NULL;
+
+	scap_refresh_userlist_free(handle);
 	return SCAP_SUCCESS;
 }
+#else // _WIN32
+int32_t scap_refresh_userlist_start(scap_t* handle)
+{
+	snprintf(handle->m_lasterr, SCAP_LASTERR_SIZE, "the user list can't be refreshed on this platform");
+	return SCAP_FAILURE;
+}
+
+void scap_refresh_userlist_stop(scap_t* handle)
+{
+}
+
+int32_t scap_refresh_userlist_complete(scap_t* handle)
+{
+	return SCAP_NOTFOUND;
+}
 #endif // _WIN32
 
 //
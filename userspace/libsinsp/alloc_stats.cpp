@@ -0,0 +1,216 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _WIN32
+#define __STDC_FORMAT_MACROS
+#include <inttypes.h>
+#endif
+#include <new>
+#include "sinsp.h"
+#include "sinsp_int.h"
+#include "alloc_stats.h"
+
+#ifdef GATHER_ALLOC_STATS
+
+#ifdef _WIN32
+#error "GATHER_ALLOC_STATS needs gcc thread local variables and atomics"
+#endif
+
+__thread uint32_t g_alloc_subsys = SAS_OTHER;
+
+static sinsp_alloc_stats::subsys_stats g_alloc_stats[SAS_MAX];
+
+//
+// Prepended to each allocation, to know the size and the subsystem when
+// it's freed. 16 bytes keep the alignment of malloc().
+//
+struct alloc_header
+{
+	uint64_t m_size;
+	uint64_t m_subsys;
+};
+
+static void* counted_alloc(size_t size)
+{
+	uint32_t subsys = g_alloc_subsys;
+	alloc_header* hdr = (alloc_header*)malloc(sizeof(alloc_header) + size);
+
+	if(hdr == NULL)
+	{
+		return NULL;
+	}
+
+	hdr->m_size = size;
+	hdr->m_subsys = subsys;
+
+	__sync_fetch_and_add(&g_alloc_stats[subsys].m_n_allocs, 1);
+	__sync_fetch_and_add(&g_alloc_stats[subsys].m_alloc_bytes, size);
+
+	return hdr + 1;
+}
+
+static void counted_free(void* p)
+{
+	if(p == NULL)
+	{
+		return;
+	}
+
+	alloc_header* hdr = (alloc_header*)p - 1;
+
+	__sync_fetch_and_add(&g_alloc_stats[hdr->m_subsys].m_n_frees, 1);
+	__sync_fetch_and_add(&g_alloc_stats[hdr->m_subsys].m_freed_bytes, hdr->m_size);
+
+	free(hdr);
+}
+
+void* operator new(size_t size)
+{
+	void* res = counted_alloc(size);
+
+	if(res == NULL)
+	{
+		throw std::bad_alloc();
+	}
+
+	return res;
+}
+
+void* operator new[](size_t size)
+{
+	void* res = counted_alloc(size);
+
+	if(res == NULL)
+	{
+		throw std::bad_alloc();
+	}
+
+	return res;
+}
+
+void* operator new(size_t size, const std::nothrow_t&) throw()
+{
+	return counted_alloc(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) throw()
+{
+	return counted_alloc(size);
+}
+
+void operator delete(void* p) throw()
+{
+	counted_free(p);
+}
+
+void operator delete[](void* p) throw()
+{
+	counted_free(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) throw()
+{
+	counted_free(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) throw()
+{
+	counted_free(p);
+}
+
+bool sinsp_alloc_stats::is_enabled()
+{
+	return true;
+}
+
+void sinsp_alloc_stats::get(sinsp_alloc_subsys subsys, OUT subsys_stats* res)
+{
+	*res = g_alloc_stats[subsys];
+}
+
+void sinsp_alloc_stats::clear()
+{
+	memset(g_alloc_stats, 0, sizeof(g_alloc_stats));
+}
+
+#else // GATHER_ALLOC_STATS
+
+bool sinsp_alloc_stats::is_enabled()
+{
+	return false;
+}
+
+void sinsp_alloc_stats::get(sinsp_alloc_subsys subsys, OUT subsys_stats* res)
+{
+	memset(res, 0, sizeof(*res));
+}
+
+void sinsp_alloc_stats::clear()
+{
+}
+
+#endif // GATHER_ALLOC_STATS
+
+const char* sinsp_alloc_stats::get_subsys_name(sinsp_alloc_subsys subsys)
+{
+	switch(subsys)
+	{
+	case SAS_OTHER:
+		return "other";
+	case SAS_THREADS:
+		return "threads";
+	case SAS_FDS:
+		return "fds";
+	case SAS_PARSER:
+		return "parser";
+	case SAS_FILTER:
+		return "filter";
+	case SAS_FORMATTER:
+		return "formatter";
+	case SAS_CHISEL:
+		return "chisel";
+	default:
+		return "<unknown>";
+	}
+}
+
+void sinsp_alloc_stats::emit(FILE* f)
+{
+	uint32_t j;
+
+	if(!is_enabled())
+	{
+		return;
+	}
+
+	fprintf(f, "%-10s %12s %14s %12s %14s\n", "Subsystem", "Allocs", "Alloc bytes", "Frees", "Live bytes");
+
+	for(j = 0; j < SAS_MAX; j++)
+	{
+		subsys_stats s;
+
+		get((sinsp_alloc_subsys)j, &s);
+
+		fprintf(f, "%-10s %12" PRIu64 " %14" PRIu64 " %12" PRIu64 " %14" PRId64 "\n",
+			get_subsys_name((sinsp_alloc_subsys)j),
+			s.m_n_allocs,
+			s.m_alloc_bytes,
+			s.m_n_frees,
+			(int64_t)(s.m_alloc_bytes - s.m_freed_bytes));
+	}
+}
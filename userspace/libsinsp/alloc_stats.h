@@ -0,0 +1,101 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+/*!
+  \brief The parts of libsinsp that the heap allocations are attributed to
+*/
+enum sinsp_alloc_subsys
+{
+	SAS_OTHER = 0, ///< Outside of the instrumented code, e.g. the library user.
+	SAS_THREADS = 1, ///< The thread table.
+	SAS_FDS = 2, ///< The fd tables.
+	SAS_PARSER = 3, ///< The parsing of the events, besides the tables.
+	SAS_FILTER = 4, ///< The filter and its checks.
+	SAS_FORMATTER = 5, ///< The rendering of the events to text.
+	SAS_CHISEL = 6, ///< The C++ side of the chisels. Lua has its own allocator.
+	SAS_MAX = 7,
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Heap allocation accounting, compiled in with GATHER_ALLOC_STATS, which
+// the SINSP_ALLOC_STATS cmake option defines. The global operator new and
+// delete of the process are replaced by versions that count the calls and
+// the bytes, and charge them to the subsystem of the innermost
+// sinsp_alloc_scope of the calling thread. The memory is charged to the
+// same subsystem when it's freed, wherever that happens, so that the
+// difference is what the subsystem holds. For profiling builds only.
+///////////////////////////////////////////////////////////////////////////////
+class SINSP_PUBLIC sinsp_alloc_stats
+{
+public:
+	struct subsys_stats
+	{
+		uint64_t m_n_allocs;
+		uint64_t m_alloc_bytes;
+		uint64_t m_n_frees;
+		uint64_t m_freed_bytes;
+	};
+
+	//
+	// True if the library was built with GATHER_ALLOC_STATS
+	//
+	static bool is_enabled();
+
+	static void get(sinsp_alloc_subsys subsys, OUT subsys_stats* res);
+	static void clear();
+	static const char* get_subsys_name(sinsp_alloc_subsys subsys);
+
+	//
+	// Print a table with the stats of each subsystem
+	//
+	static void emit(FILE* f);
+};
+
+#ifdef GATHER_ALLOC_STATS
+extern __thread uint32_t g_alloc_subsys;
+#endif
+
+//
+// Charge the allocations of the calling thread to a subsystem until the
+// end of the scope. It compiles to nothing without GATHER_ALLOC_STATS.
+//
+class sinsp_alloc_scope
+{
+public:
+#ifdef GATHER_ALLOC_STATS
+	sinsp_alloc_scope(sinsp_alloc_subsys subsys)
+	{
+		m_prev = g_alloc_subsys;
+		g_alloc_subsys = subsys;
+	}
+
+	~sinsp_alloc_scope()
+	{
+		g_alloc_subsys = m_prev;
+	}
+
+private:
+	uint32_t m_prev;
+#else
+	sinsp_alloc_scope(sinsp_alloc_subsys subsys)
+	{
+	}
+#endif
+};
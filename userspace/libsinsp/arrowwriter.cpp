@@ -0,0 +1,911 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include "sinsp.h"
+#include "sinsp_int.h"
+#include "filter.h"
+#include "filterchecks.h"
+#include "arrowwriter.h"
+
+#ifdef HAS_FILTERING
+extern sinsp_filter_check_list g_filterlist;
+
+//
+// The constants of the Arrow format that we use, from Schema.fbs and
+// Message.fbs
+//
+#define ARROW_METADATA_V5 4
+#define ARROW_HEADER_SCHEMA 1
+#define ARROW_HEADER_DICTIONARY_BATCH 2
+#define ARROW_HEADER_RECORD_BATCH 3
+#define ARROW_TYPE_INT 2
+#define ARROW_TYPE_BINARY 4
+#define ARROW_TYPE_UTF8 5
+#define ARROW_TYPE_BOOL 6
+#define ARROW_TYPE_TIMESTAMP 10
+#define ARROW_TIMEUNIT_NANOSECOND 3
+#define ARROW_CONTINUATION 0xFFFFFFFF
+
+//
+// The string fields that are dictionary encoded: they repeat a few values
+// over and over
+//
+static const char* g_dict_fields[] =
+{
+	"evt.type",
+	"evt.dir",
+	"proc.name",
+	"proc.exe",
+	"fd.name",
+	"fd.type",
+	"user.name",
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Minimal writer of the flatbuffers that hold the metadata of the messages.
+// The objects are laid out front to back: a table comes before the objects
+// that it points to, and its offsets are filled when they're written.
+///////////////////////////////////////////////////////////////////////////////
+class fb_builder
+{
+public:
+	fb_builder()
+	{
+		//
+		// The offset of the root table
+		//
+		m_buf.assign(sizeof(uint32_t), 0);
+	}
+
+	uint32_t pos()
+	{
+		return (uint32_t)m_buf.size();
+	}
+
+	void pad(uint32_t align, uint32_t rem = 0)
+	{
+		while(m_buf.size() % align != rem)
+		{
+			m_buf.push_back(0);
+		}
+	}
+
+	void put(uint64_t val, uint32_t size)
+	{
+		//
+		// Little endian, like the rest of the file
+		//
+		m_buf.insert(m_buf.end(), (uint8_t*)&val, (uint8_t*)&val + size);
+	}
+
+	//
+	// Make the offset at position off point to the object at position target
+	//
+	void set_offset(uint32_t off, uint32_t target)
+	{
+		uint32_t val = target - off;
+
+		ASSERT(target > off);
+		memcpy(&m_buf[off], &val, sizeof(val));
+	}
+
+	uint32_t add_string(const string& str)
+	{
+		pad(4);
+		uint32_t res = pos();
+
+		put(str.size(), 4);
+		m_buf.insert(m_buf.end(), str.begin(), str.end());
+		m_buf.push_back(0);
+		return res;
+	}
+
+	//
+	// A vector of structs of two int64, like FieldNode and Buffer
+	//
+	uint32_t add_struct_vector(const vector<int64_t>& vals)
+	{
+		pad(8, 4);
+		uint32_t res = pos();
+
+		put(vals.size() / 2, 4);
+		m_buf.insert(m_buf.end(), (uint8_t*)&vals[0], (uint8_t*)&vals[0] + vals.size() * sizeof(int64_t));
+		return res;
+	}
+
+	//
+	// A vector of n offsets, for the vectors of tables. Element j is at
+	// res + 4 + 4 * j.
+	//
+	uint32_t add_offset_vector(uint32_t n)
+	{
+		pad(4);
+		uint32_t res = pos();
+
+		put(n, 4);
+		m_buf.resize(m_buf.size() + n * sizeof(uint32_t), 0);
+		return res;
+	}
+
+	vector<uint8_t> m_buf;
+};
+
+class fb_table
+{
+public:
+	void add(uint32_t slot, uint64_t val, uint32_t size)
+	{
+		field f;
+
+		f.m_slot = slot;
+		f.m_size = size;
+		f.m_val = val;
+		f.m_pos = 0;
+		m_fields.push_back(f);
+	}
+
+	//
+	// An offset to a child object, filled with fb_builder::set_offset()
+	//
+	void add_offset(uint32_t slot)
+	{
+		add(slot, 0, sizeof(uint32_t));
+	}
+
+	//
+	// Write the vtable and the table, and return the position of the table.
+	// The fields are sorted by size, and the table starts where the 8 byte
+	// fields that follow the vtable offset are aligned.
+	//
+	uint32_t write(fb_builder* b)
+	{
+		uint32_t nslots = 0;
+		uint32_t tsize = sizeof(int32_t);
+		bool has_int64 = false;
+		uint32_t j;
+
+		stable_sort(m_fields.begin(), m_fields.end(), larger_first);
+
+		for(j = 0; j < m_fields.size(); j++)
+		{
+			nslots = max(nslots, m_fields[j].m_slot + 1);
+			m_fields[j].m_pos = tsize;
+			tsize += m_fields[j].m_size;
+			has_int64 |= (m_fields[j].m_size == 8);
+		}
+
+		vector<uint16_t> vtable(2 + nslots, 0);
+
+		vtable[0] = (uint16_t)(vtable.size() * sizeof(uint16_t));
+		vtable[1] = (uint16_t)tsize;
+
+		for(j = 0; j < m_fields.size(); j++)
+		{
+			vtable[2 + m_fields[j].m_slot] = (uint16_t)m_fields[j].m_pos;
+		}
+
+		b->pad(2);
+		uint32_t vpos = b->pos();
+
+		for(j = 0; j < vtable.size(); j++)
+		{
+			b->put(vtable[j], sizeof(uint16_t));
+		}
+
+		b->pad(has_int64? 8 : 4, 4 % (has_int64? 8 : 4));
+		uint32_t tpos = b->pos();
+
+		b->put(tpos - vpos, sizeof(int32_t));
+
+		for(j = 0; j < m_fields.size(); j++)
+		{
+			m_fields[j].m_pos += tpos;
+			b->put(m_fields[j].m_val, m_fields[j].m_size);
+		}
+
+		return tpos;
+	}
+
+	//
+	// Position of a field in the buffer, after write()
+	//
+	uint32_t field_pos(uint32_t slot)
+	{
+		uint32_t j;
+
+		for(j = 0; j < m_fields.size(); j++)
+		{
+			if(m_fields[j].m_slot == slot)
+			{
+				return m_fields[j].m_pos;
+			}
+		}
+
+		ASSERT(false);
+		return 0;
+	}
+
+private:
+	struct field
+	{
+		uint32_t m_slot;
+		uint32_t m_size;
+		uint64_t m_val;
+		uint32_t m_pos;
+	};
+
+	static bool larger_first(const field& a, const field& b)
+	{
+		return a.m_size > b.m_size;
+	}
+
+	vector<field> m_fields;
+};
+
+//
+// Start a message with the given header, and return the position of the
+// offset of the header
+//
+static uint32_t add_message(fb_builder* b, uint8_t header_type, uint64_t body_len)
+{
+	fb_table msg;
+
+	msg.add(0, ARROW_METADATA_V5, sizeof(int16_t));
+	msg.add(1, header_type, sizeof(uint8_t));
+	msg.add_offset(2);
+	msg.add(3, body_len, sizeof(int64_t));
+
+	b->set_offset(0, msg.write(b));
+	return msg.field_pos(2);
+}
+
+//
+// Append a buffer to the body of a record batch, and its position to the
+// Buffer vector. The buffers are aligned to 8 bytes.
+//
+static void add_body_buffer(vector<uint8_t>* body, OUT vector<int64_t>* buffers, const void* data, size_t len)
+{
+	buffers->push_back(body->size());
+	buffers->push_back(len);
+
+	body->insert(body->end(), (uint8_t*)data, (uint8_t*)data + len);
+	body->resize((body->size() + 7) & ~7, 0);
+}
+
+//
+// Write a RecordBatch table with its nodes and buffers, and return its
+// position
+//
+static uint32_t add_record_batch(fb_builder* b, uint64_t nrows, const vector<int64_t>& nodes, const vector<int64_t>& buffers)
+{
+	fb_table rb;
+
+	rb.add(0, nrows, sizeof(int64_t));
+	rb.add_offset(1);
+	rb.add_offset(2);
+
+	uint32_t res = rb.write(b);
+	b->set_offset(rb.field_pos(1), b->add_struct_vector(nodes));
+	b->set_offset(rb.field_pos(2), b->add_struct_vector(buffers));
+	return res;
+}
+
+static inline void append_bit(vector<uint8_t>* bitmap, uint32_t row, bool val)
+{
+	if((row & 7) == 0)
+	{
+		bitmap->push_back(0);
+	}
+
+	if(val)
+	{
+		bitmap->back() |= (uint8_t)(1 << (row & 7));
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// sinsp_arrow_writer implementation
+///////////////////////////////////////////////////////////////////////////////
+sinsp_arrow_writer::sinsp_arrow_writer(sinsp* inspector,
+	const string& fields,
+	const string& filename,
+	uint32_t batch_size)
+{
+	size_t start = 0;
+
+	m_inspector = inspector;
+	m_filename = filename;
+	m_f = NULL;
+	m_batch_size = MAX(batch_size, 1);
+	m_batch_rows = 0;
+	m_nbatches = 0;
+	m_nrows = 0;
+
+	while(start <= fields.size())
+	{
+		size_t end = fields.find(',', start);
+
+		if(end == string::npos)
+		{
+			end = fields.size();
+		}
+
+		size_t first = fields.find_first_not_of(" \t", start);
+		size_t last = fields.find_last_not_of(" \t", end - 1);
+
+		if(first < end && last != string::npos && last >= first)
+		{
+			add_field(fields.substr(first, last - first + 1));
+		}
+
+		start = end + 1;
+	}
+
+	if(m_columns.empty())
+	{
+		throw sinsp_exception("no fields to write to " + filename);
+	}
+
+	m_f = fopen(filename.c_str(), "wb");
+
+	if(m_f == NULL)
+	{
+		throw sinsp_exception("can't open " + filename + ": " + strerror(errno));
+	}
+
+	write_schema();
+}
+
+sinsp_arrow_writer::~sinsp_arrow_writer()
+{
+	uint32_t j;
+
+	if(m_f != NULL)
+	{
+		try
+		{
+			close();
+		}
+		catch(sinsp_exception&)
+		{
+		}
+	}
+
+	for(j = 0; j < m_columns.size(); j++)
+	{
+		delete m_columns[j].m_check;
+	}
+}
+
+void sinsp_arrow_writer::add_field(const string& name)
+{
+	sinsp_filter_check* chk = g_filterlist.new_filter_check_from_fldname(name, m_inspector, false);
+	uint32_t j;
+
+	if(chk == NULL)
+	{
+		throw sinsp_exception("invalid field name " + name);
+	}
+
+	chk->parse_field_name(name.c_str());
+	chk->enable_field_cache(name);
+
+	column col;
+
+	col.m_check = chk;
+	col.m_name = name;
+	col.m_type = chk->get_field_info()->m_type;
+	col.m_width = 0;
+	col.m_is_signed = false;
+	col.m_null_count = 0;
+	col.m_dict_id = -1;
+	col.m_dict_written = 0;
+
+	switch(col.m_type)
+	{
+	case PT_INT8:
+	case PT_INT16:
+	case PT_INT32:
+	case PT_INT64:
+	case PT_ERRNO:
+	case PT_FD:
+	case PT_PID:
+	case PT_ABSTIME:
+		col.m_kind = CK_INT;
+		col.m_is_signed = true;
+		break;
+	case PT_UINT8:
+	case PT_UINT16:
+	case PT_UINT32:
+	case PT_UINT64:
+	case PT_FLAGS8:
+	case PT_FLAGS16:
+	case PT_FLAGS32:
+	case PT_PORT:
+	case PT_L4PROTO:
+	case PT_RELTIME:
+		col.m_kind = CK_INT;
+		break;
+	case PT_BOOL:
+		col.m_kind = CK_BOOL;
+		break;
+	case PT_BYTEBUF:
+		col.m_kind = CK_BINARY;
+		break;
+	default:
+		col.m_kind = CK_STRING;
+
+		for(j = 0; j < sizeof(g_dict_fields) / sizeof(g_dict_fields[0]); j++)
+		{
+			if(name == g_dict_fields[j])
+			{
+				col.m_kind = CK_DICT;
+				col.m_dict_id = m_columns.size();
+				break;
+			}
+		}
+
+		break;
+	}
+
+	switch(col.m_type)
+	{
+	case PT_INT8:
+	case PT_UINT8:
+	case PT_FLAGS8:
+	case PT_L4PROTO:
+		col.m_width = 1;
+		break;
+	case PT_INT16:
+	case PT_UINT16:
+	case PT_FLAGS16:
+	case PT_PORT:
+		col.m_width = 2;
+		break;
+	case PT_INT32:
+	case PT_UINT32:
+	case PT_FLAGS32:
+		col.m_width = 4;
+		break;
+	default:
+		col.m_width = 8;
+		break;
+	}
+
+	col.m_offsets.push_back(0);
+	col.m_dict_offsets.push_back(0);
+	m_columns.push_back(col);
+}
+
+void sinsp_arrow_writer::write_bytes(const void* buf, size_t len)
+{
+	if(len != 0 && fwrite(buf, len, 1, m_f) != 1)
+	{
+		throw sinsp_exception("error writing to " + m_filename + ": " + strerror(errno));
+	}
+}
+
+//
+// An encapsulated message: the continuation marker, the size of the
+// metadata, the metadata padded to 8 bytes, and the body
+//
+void sinsp_arrow_writer::write_message(const vector<uint8_t>& metadata, const vector<uint8_t>& body)
+{
+	static const uint8_t zeros[8] = {0};
+	uint32_t hdr[2];
+
+	hdr[0] = ARROW_CONTINUATION;
+	hdr[1] = (metadata.size() + 7) & ~7;
+
+	write_bytes(hdr, sizeof(hdr));
+	write_bytes(&metadata[0], metadata.size());
+	write_bytes(zeros, hdr[1] - metadata.size());
+
+	if(!body.empty())
+	{
+		write_bytes(&body[0], body.size());
+	}
+}
+
+void sinsp_arrow_writer::write_schema()
+{
+	fb_builder b;
+	fb_table schema;
+	uint32_t j;
+
+	uint32_t hdr_off = add_message(&b, ARROW_HEADER_SCHEMA, 0);
+
+	schema.add(0, 0, sizeof(int16_t)); // Little endian
+	schema.add_offset(1);
+	b.set_offset(hdr_off, schema.write(&b));
+
+	uint32_t fields_pos = b.add_offset_vector(m_columns.size());
+	b.set_offset(schema.field_pos(1), fields_pos);
+
+	for(j = 0; j < m_columns.size(); j++)
+	{
+		const column* col = &m_columns[j];
+		fb_table field;
+		fb_table type;
+		uint8_t type_id;
+
+		switch(col->m_kind)
+		{
+		case CK_INT:
+			if(col->m_type == PT_ABSTIME)
+			{
+				type_id = ARROW_TYPE_TIMESTAMP;
+				type.add(0, ARROW_TIMEUNIT_NANOSECOND, sizeof(int16_t));
+				type.add_offset(1);
+			}
+			else
+			{
+				type_id = ARROW_TYPE_INT;
+				type.add(0, col->m_width * 8, sizeof(int32_t));
+				type.add(1, col->m_is_signed, sizeof(uint8_t));
+			}
+			break;
+		case CK_BOOL:
+			type_id = ARROW_TYPE_BOOL;
+			break;
+		case CK_BINARY:
+			type_id = ARROW_TYPE_BINARY;
+			break;
+		default:
+			type_id = ARROW_TYPE_UTF8;
+			break;
+		}
+
+		field.add_offset(0); // name
+		field.add(1, 1, sizeof(uint8_t)); // nullable
+		field.add(2, type_id, sizeof(uint8_t));
+		field.add_offset(3); // type
+		if(col->m_kind == CK_DICT)
+		{
+			field.add_offset(4); // dictionary
+		}
+		field.add_offset(5); // children
+
+		b.set_offset(fields_pos + 4 + 4 * j, field.write(&b));
+		b.set_offset(field.field_pos(0), b.add_string(col->m_name));
+		b.set_offset(field.field_pos(3), type.write(&b));
+
+		if(col->m_type == PT_ABSTIME)
+		{
+			b.set_offset(type.field_pos(1), b.add_string("UTC"));
+		}
+
+		if(col->m_kind == CK_DICT)
+		{
+			fb_table dict;
+			fb_table index_type;
+
+			dict.add(0, col->m_dict_id, sizeof(int64_t));
+			dict.add_offset(1);
+			dict.add(2, 0, sizeof(uint8_t)); // Not ordered
+			b.set_offset(field.field_pos(4), dict.write(&b));
+
+			index_type.add(0, 32, sizeof(int32_t));
+			index_type.add(1, 1, sizeof(uint8_t));
+			b.set_offset(dict.field_pos(1), index_type.write(&b));
+		}
+
+		b.set_offset(field.field_pos(5), b.add_offset_vector(0));
+	}
+
+	write_message(b.m_buf, vector<uint8_t>());
+}
+
+void sinsp_arrow_writer::add_null(column* col)
+{
+	uint32_t row = m_batch_rows;
+
+	//
+	// The validity bitmap is only built once there's a null
+	//
+	if(col->m_null_count == 0)
+	{
+		col->m_validity.assign((row + 7) / 8, 0xff);
+
+		if(row & 7)
+		{
+			col->m_validity.back() = (uint8_t)((1 << (row & 7)) - 1);
+		}
+	}
+
+	col->m_null_count++;
+	append_bit(&col->m_validity, row, false);
+
+	switch(col->m_kind)
+	{
+	case CK_INT:
+		col->m_values.resize(col->m_values.size() + col->m_width, 0);
+		break;
+	case CK_BOOL:
+		append_bit(&col->m_values, row, false);
+		break;
+	case CK_DICT:
+		col->m_values.resize(col->m_values.size() + sizeof(int32_t), 0);
+		break;
+	default:
+		col->m_offsets.push_back(col->m_data.size());
+		break;
+	}
+}
+
+void sinsp_arrow_writer::add_string(column* col, const char* str, uint32_t len)
+{
+	col->m_data.insert(col->m_data.end(), str, str + len);
+	col->m_offsets.push_back(col->m_data.size());
+}
+
+void sinsp_arrow_writer::add_dict_string(column* col, const char* str, uint32_t len)
+{
+	m_key.assign(str, len);
+
+	unordered_map<string, int32_t>::iterator it = col->m_dict.find(m_key);
+	int32_t idx;
+
+	if(it != col->m_dict.end())
+	{
+		idx = it->second;
+	}
+	else
+	{
+		idx = (int32_t)col->m_dict.size();
+		col->m_dict[m_key] = idx;
+		col->m_dict_data.insert(col->m_dict_data.end(), str, str + len);
+		col->m_dict_offsets.push_back(col->m_dict_data.size());
+	}
+
+	col->m_values.insert(col->m_values.end(), (uint8_t*)&idx, (uint8_t*)&idx + sizeof(idx));
+}
+
+void sinsp_arrow_writer::write(sinsp_evt* evt)
+{
+	uint32_t row = m_batch_rows;
+	uint32_t j;
+
+	for(j = 0; j < m_columns.size(); j++)
+	{
+		column* col = &m_columns[j];
+		sinsp_field_value val;
+
+		if(col->m_kind == CK_STRING || col->m_kind == CK_DICT)
+		{
+			//
+			// The strings are written as they're printed, except the plain
+			// ones, which are taken as they are
+			//
+			if(col->m_type == PT_CHARBUF)
+			{
+				if(!col->m_check->extract_value(evt, &val))
+				{
+					add_null(col);
+					continue;
+				}
+			}
+			else
+			{
+				char* str = col->m_check->tostring_cached(evt);
+
+				if(str == NULL)
+				{
+					add_null(col);
+					continue;
+				}
+
+				val.m_buf = str;
+				val.m_len = (uint32_t)strlen(str);
+			}
+
+			if(col->m_kind == CK_DICT)
+			{
+				add_dict_string(col, val.m_buf, val.m_len);
+			}
+			else
+			{
+				add_string(col, val.m_buf, val.m_len);
+			}
+		}
+		else
+		{
+			if(!col->m_check->extract_value(evt, &val))
+			{
+				add_null(col);
+				continue;
+			}
+
+			switch(col->m_kind)
+			{
+			case CK_INT:
+				col->m_values.insert(col->m_values.end(), (uint8_t*)&val.m_uint, (uint8_t*)&val.m_uint + col->m_width);
+				break;
+			case CK_BOOL:
+				append_bit(&col->m_values, row, val.m_uint != 0);
+				break;
+			default:
+				add_string(col, val.m_buf, val.m_len);
+				break;
+			}
+		}
+
+		if(col->m_null_count != 0)
+		{
+			append_bit(&col->m_validity, row, true);
+		}
+	}
+
+	m_batch_rows++;
+	m_nrows++;
+
+	if(m_batch_rows == m_batch_size)
+	{
+		flush();
+	}
+}
+
+//
+// Write the new entries of the dictionary of a column. The first batch of
+// a dictionary has all its entries, the next ones are deltas.
+//
+void sinsp_arrow_writer::write_dictionary(column* col)
+{
+	uint32_t nentries = (uint32_t)col->m_dict.size() - col->m_dict_written;
+	vector<uint8_t> body;
+	vector<int64_t> nodes;
+	vector<int64_t> buffers;
+	fb_builder b;
+	fb_table dbatch;
+
+	if(nentries == 0 && m_nbatches != 0)
+	{
+		return;
+	}
+
+	nodes.push_back(nentries);
+	nodes.push_back(0);
+
+	add_body_buffer(&body, &buffers, NULL, 0);
+	add_body_buffer(&body, &buffers, &col->m_dict_offsets[0], col->m_dict_offsets.size() * sizeof(int32_t));
+	add_body_buffer(&body, &buffers, col->m_dict_data.empty()? NULL : &col->m_dict_data[0], col->m_dict_data.size());
+
+	uint32_t hdr_off = add_message(&b, ARROW_HEADER_DICTIONARY_BATCH, body.size());
+
+	dbatch.add(0, col->m_dict_id, sizeof(int64_t));
+	dbatch.add_offset(1);
+	dbatch.add(2, m_nbatches != 0, sizeof(uint8_t)); // isDelta
+	b.set_offset(hdr_off, dbatch.write(&b));
+	b.set_offset(dbatch.field_pos(1), add_record_batch(&b, nentries, nodes, buffers));
+
+	write_message(b.m_buf, body);
+
+	col->m_dict_written = (uint32_t)col->m_dict.size();
+	col->m_dict_offsets.assign(1, 0);
+	col->m_dict_data.clear();
+}
+
+void sinsp_arrow_writer::flush()
+{
+	vector<uint8_t> body;
+	vector<int64_t> nodes;
+	vector<int64_t> buffers;
+	fb_builder b;
+	uint32_t j;
+
+	if(m_batch_rows == 0)
+	{
+		return;
+	}
+
+	for(j = 0; j < m_columns.size(); j++)
+	{
+		if(m_columns[j].m_kind == CK_DICT)
+		{
+			write_dictionary(&m_columns[j]);
+		}
+	}
+
+	for(j = 0; j < m_columns.size(); j++)
+	{
+		column* col = &m_columns[j];
+
+		nodes.push_back(m_batch_rows);
+		nodes.push_back(col->m_null_count);
+
+		if(col->m_null_count != 0)
+		{
+			add_body_buffer(&body, &buffers, &col->m_validity[0], col->m_validity.size());
+		}
+		else
+		{
+			add_body_buffer(&body, &buffers, NULL, 0);
+		}
+
+		if(col->m_kind == CK_STRING || col->m_kind == CK_BINARY)
+		{
+			add_body_buffer(&body, &buffers, &col->m_offsets[0], col->m_offsets.size() * sizeof(int32_t));
+			add_body_buffer(&body, &buffers, col->m_data.empty()? NULL : &col->m_data[0], col->m_data.size());
+		}
+		else
+		{
+			add_body_buffer(&body, &buffers, &col->m_values[0], col->m_values.size());
+		}
+
+		col->m_null_count = 0;
+		col->m_validity.clear();
+		col->m_values.clear();
+		col->m_offsets.assign(1, 0);
+		col->m_data.clear();
+	}
+
+	uint32_t hdr_off = add_message(&b, ARROW_HEADER_RECORD_BATCH, body.size());
+	b.set_offset(hdr_off, add_record_batch(&b, m_batch_rows, nodes, buffers));
+
+	write_message(b.m_buf, body);
+
+	m_batch_rows = 0;
+	m_nbatches++;
+}
+
+void sinsp_arrow_writer::close()
+{
+	uint32_t eos[2] = {ARROW_CONTINUATION, 0};
+
+	if(m_f == NULL)
+	{
+		return;
+	}
+
+	flush();
+	write_bytes(eos, sizeof(eos));
+
+	FILE* f = m_f;
+	m_f = NULL;
+
+	if(fclose(f) != 0)
+	{
+		throw sinsp_exception("error writing to " + m_filename + ": " + strerror(errno));
+	}
+}
+
+#else // HAS_FILTERING
+
+sinsp_arrow_writer::sinsp_arrow_writer(sinsp* inspector,
+	const string& fields,
+	const string& filename,
+	uint32_t batch_size)
+{
+	throw sinsp_exception("sinsp_arrow_writer unvavailable because it was not compiled in the library");
+}
+
+sinsp_arrow_writer::~sinsp_arrow_writer()
+{
+}
+
+void sinsp_arrow_writer::write(sinsp_evt* evt)
+{
+	throw sinsp_exception("sinsp_arrow_writer unvavailable because it was not compiled in the library");
+}
+
+void sinsp_arrow_writer::close()
+{
+}
+
+#endif // HAS_FILTERING
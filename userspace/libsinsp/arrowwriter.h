@@ -0,0 +1,135 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+class sinsp_filter_check;
+
+/** @defgroup event Event manipulation
+ *  @{
+ */
+
+/*!
+  \brief Columnar event exporter class.
+  This class writes some fields of the events to a file in the Apache Arrow
+  IPC stream format, which the analytics tools (pandas, Spark, DuckDB...)
+  read without parsing any text. The values are written in their native
+  type, in batches of rows, and the fields that repeat a few names, like
+  proc.name and fd.name, are dictionary encoded.
+*/
+class SINSP_PUBLIC sinsp_arrow_writer
+{
+public:
+	/*!
+	  \brief Constructs a writer and writes the schema to the file.
+
+	  \param inspector Pointer to the inspector instance that will generate the
+	   events.
+	  \param fields The names of the fields to write, separated by commas,
+	   e.g. "evt.num,evt.rawtime,proc.name,fd.name". Each one becomes a
+	   column with the same name.
+	  \param filename The file to write.
+	  \param batch_size The number of rows of each batch.
+
+	  \note Throws a sinsp_exception if a field doesn't exist or the file
+	   can't be opened.
+	*/
+	sinsp_arrow_writer(sinsp* inspector,
+		const string& fields,
+		const string& filename,
+		uint32_t batch_size = SP_ARROW_BATCH_SIZE);
+
+	/*!
+	  \brief Writes the pending rows and closes the file, if close() wasn't
+	   called.
+	*/
+	~sinsp_arrow_writer();
+
+	/*!
+	  \brief Adds one row with the fields of an event. The events that don't
+	   have a field get a null.
+	*/
+	void write(sinsp_evt* evt);
+
+	/*!
+	  \brief Writes the pending rows and the end of stream marker, and closes
+	   the file.
+	*/
+	void close();
+
+	/*!
+	  \brief Returns the number of rows written so far.
+	*/
+	uint64_t get_nrows()
+	{
+		return m_nrows;
+	}
+
+private:
+	enum column_kind
+	{
+		CK_INT = 0, // Integer of m_width bytes, or timestamp
+		CK_BOOL = 1,
+		CK_STRING = 2,
+		CK_BINARY = 3,
+		CK_DICT = 4, // String, written as the indexes of its dictionary
+	};
+
+	struct column
+	{
+		sinsp_filter_check* m_check;
+		string m_name;
+		column_kind m_kind;
+		ppm_param_type m_type;
+		uint32_t m_width;
+		bool m_is_signed;
+		uint64_t m_null_count;
+		vector<uint8_t> m_validity;
+		vector<uint8_t> m_values; // The integers, the bits or the dictionary indexes
+		vector<int32_t> m_offsets; // Of the strings in m_data
+		vector<char> m_data;
+		// The dictionary
+		int64_t m_dict_id;
+		unordered_map<string, int32_t> m_dict;
+		uint32_t m_dict_written; // Entries already in the file
+		vector<int32_t> m_dict_offsets; // Of the new entries, in m_dict_data
+		vector<char> m_dict_data;
+	};
+
+	void add_field(const string& name);
+	void add_null(column* col);
+	void add_string(column* col, const char* str, uint32_t len);
+	void add_dict_string(column* col, const char* str, uint32_t len);
+	void write_schema();
+	void write_dictionary(column* col);
+	void flush();
+	void write_message(const vector<uint8_t>& metadata, const vector<uint8_t>& body);
+	void write_bytes(const void* buf, size_t len);
+
+	sinsp* m_inspector;
+	vector<column> m_columns;
+	string m_filename;
+	FILE* m_f;
+	uint32_t m_batch_size;
+	uint32_t m_batch_rows;
+	uint64_t m_nbatches;
+	uint64_t m_nrows;
+	string m_key; // For the lookups in the dictionaries
+};
+
+/*@}*/
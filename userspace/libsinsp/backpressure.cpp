@@ -0,0 +1,165 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "sinsp.h"
+#include "sinsp_int.h"
+#include "backpressure.h"
+
+sinsp_backpressure::sinsp_backpressure(sinsp* inspector)
+{
+	m_inspector = inspector;
+	m_ratio = 1;
+	m_calm_checks = 0;
+	m_next_check_ns = 0;
+	m_last_nevts = 0;
+	m_n_escalations = 0;
+	m_marker_pending = false;
+	memset(m_marker, 0, sizeof(m_marker));
+}
+
+void sinsp_backpressure::reset(bool announce)
+{
+	if(m_ratio != 1)
+	{
+		set_ratio(1);
+	}
+
+	if(!announce)
+	{
+		m_marker_pending = false;
+	}
+
+	m_calm_checks = 0;
+}
+
+void sinsp_backpressure::set_ratio(uint32_t ratio)
+{
+	scap_t* h = m_inspector->m_h;
+	int32_t res;
+
+	if(ratio == 1)
+	{
+		res = scap_stop_dropping_mode(h);
+	}
+	else
+	{
+		res = scap_start_dropping_mode(h, ratio);
+	}
+
+	if(res != SCAP_SUCCESS)
+	{
+		g_logger.format(sinsp_logger::SEV_ERROR, "can't set the sampling ratio to %u: %s", ratio, scap_getlasterr(h));
+		return;
+	}
+
+	g_logger.format(sinsp_logger::SEV_INFO, "sampling ratio %u -> %u", m_ratio, ratio);
+
+	m_ratio = ratio;
+	m_marker_pending = true;
+}
+
+void sinsp_backpressure::update()
+{
+	scap_t* h = m_inspector->m_h;
+	uint32_t ndevs = scap_get_ndevs(h);
+	uint64_t nevts = m_inspector->get_num_events();
+	uint32_t max_fill_pct = 0;
+	uint64_t lag = 0;
+	uint32_t j;
+
+	for(j = 0; j < ndevs; j++)
+	{
+		scap_device_info info;
+		uint32_t used;
+
+		if(scap_get_device_info(h, j, &info) != SCAP_SUCCESS ||
+			scap_get_device_fill(h, j, &used) != SCAP_SUCCESS ||
+			info.buffer_size == 0)
+		{
+			continue;
+		}
+
+		uint32_t pct = (uint32_t)((uint64_t)used * 100 / info.buffer_size);
+
+		if(pct > max_fill_pct)
+		{
+			max_fill_pct = pct;
+		}
+	}
+
+	//
+	// The timestamp of the last event tells how late the consumer is only
+	// if there have been events since the last check. Otherwise the system
+	// is just quiet.
+	//
+	if(nevts != m_last_nevts && m_inspector->m_lastevent_ts != 0)
+	{
+		uint64_t now = sinsp_metrics::get_wall_time_ns();
+
+		if(now > m_inspector->m_lastevent_ts)
+		{
+			lag = now - m_inspector->m_lastevent_ts;
+		}
+	}
+
+	m_last_nevts = nevts;
+
+	if(max_fill_pct >= BACKPRESSURE_HIGH_FILL_PCT || lag >= BACKPRESSURE_MAX_LAG_NS)
+	{
+		m_calm_checks = 0;
+
+		if(m_ratio < BACKPRESSURE_MAX_RATIO)
+		{
+			m_n_escalations++;
+			set_ratio(m_ratio * 2);
+		}
+	}
+	else if(max_fill_pct < BACKPRESSURE_LOW_FILL_PCT && lag < BACKPRESSURE_MAX_LAG_NS / 4)
+	{
+		if(m_ratio != 1 && ++m_calm_checks >= BACKPRESSURE_CALM_CHECKS)
+		{
+			m_calm_checks = 0;
+			set_ratio(m_ratio / 2);
+		}
+	}
+	else
+	{
+		m_calm_checks = 0;
+	}
+}
+
+scap_evt* sinsp_backpressure::get_marker(uint64_t ts)
+{
+	scap_evt* evt = (scap_evt*)m_marker;
+	uint16_t* lens = (uint16_t*)(m_marker + sizeof(scap_evt));
+	uint32_t* ratio = (uint32_t*)(m_marker + sizeof(scap_evt) + sizeof(uint16_t));
+
+	//
+	// The marker is not about any thread
+	//
+	evt->ts = ts;
+	evt->tid = (uint64_t)-1;
+	evt->len = sizeof(m_marker);
+	evt->type = PPME_SAMPLING_E;
+	*lens = sizeof(uint32_t);
+	*ratio = m_ratio;
+
+	m_marker_pending = false;
+
+	return evt;
+}
@@ -0,0 +1,93 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+///////////////////////////////////////////////////////////////////////////////
+// Control loop that puts the driver in dropping mode before the ring buffers
+// overflow. Every BACKPRESSURE_CHECK_INTERVAL_NS it looks at the fullest
+// ring and at the delivery lag of the last event. When either is above its
+// limit, the sampling ratio doubles, up to BACKPRESSURE_MAX_RATIO. When both
+// stay well below their limits for BACKPRESSURE_CALM_CHECKS checks in a row,
+// the ratio halves, and at 1 the dropping mode stops.
+// Every change is announced with a PPME_SAMPLING_E event in the stream,
+// which carries the new ratio and is never filtered out, so consumers can
+// scale what they count from then on.
+///////////////////////////////////////////////////////////////////////////////
+class SINSP_PUBLIC sinsp_backpressure
+{
+public:
+	sinsp_backpressure(sinsp* inspector);
+
+	//
+	// Called by the inspector when it fetches a new batch of events
+	//
+	void check()
+	{
+		uint64_t now = sinsp_metrics::get_time_ns();
+
+		if(now >= m_next_check_ns)
+		{
+			m_next_check_ns = now + BACKPRESSURE_CHECK_INTERVAL_NS;
+			update();
+		}
+	}
+
+	//
+	// Go back to capturing everything. If announce is false, e.g. because
+	// the capture is being closed, no PPME_SAMPLING_E event is generated.
+	//
+	void reset(bool announce);
+
+	uint32_t get_sampling_ratio()
+	{
+		return m_ratio;
+	}
+
+	//
+	// True if a PPME_SAMPLING_E event must be delivered before the next one
+	//
+	bool has_marker()
+	{
+		return m_marker_pending;
+	}
+
+	//
+	// Return the PPME_SAMPLING_E event with the current ratio and the given
+	// timestamp. It stays valid until the next call.
+	//
+	scap_evt* get_marker(uint64_t ts);
+
+	uint64_t get_n_escalations()
+	{
+		return m_n_escalations;
+	}
+
+private:
+	void update();
+	void set_ratio(uint32_t ratio);
+
+	sinsp* m_inspector;
+	uint32_t m_ratio;
+	uint32_t m_calm_checks; // Consecutive checks below the low limits
+	uint64_t m_next_check_ns;
+	uint64_t m_last_nevts; // To tell if events were delivered since the last check
+	uint64_t m_n_escalations;
+	bool m_marker_pending;
+	char m_marker[sizeof(scap_evt) + sizeof(uint16_t) + sizeof(uint32_t)];
+};
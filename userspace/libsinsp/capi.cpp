@@ -0,0 +1,408 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "sinsp.h"
+#include "sinsp_int.h"
+#include "filter.h"
+#include "filterchecks.h"
+#include "capi.h"
+
+#ifdef HAS_FILTERING
+extern sinsp_filter_check_list g_filterlist;
+#endif
+
+struct sinsp_capi_field
+{
+	sinsp_filter_check* m_check;
+	sinsp_capi_field_kind m_kind;
+	ppm_param_type m_type;
+};
+
+struct sinsp_capi_inspector
+{
+	sinsp* m_inspector;
+	vector<sinsp_capi_field> m_fields;
+	vector<sinsp_field_value> m_values; // Of the event being added to the batch
+	sinsp_evt* m_pending; // Read, but it didn't fit in the last batch
+	string m_lasterr;
+};
+
+static void free_fields(sinsp_capi_inspector* inspector)
+{
+	uint32_t j;
+
+	for(j = 0; j < inspector->m_fields.size(); j++)
+	{
+		delete inspector->m_fields[j].m_check;
+	}
+
+	inspector->m_fields.clear();
+}
+
+#ifdef HAS_FILTERING
+static sinsp_capi_field_kind get_field_kind(ppm_param_type type)
+{
+	switch(type)
+	{
+	case PT_INT8:
+	case PT_INT16:
+	case PT_INT32:
+	case PT_INT64:
+	case PT_ERRNO:
+	case PT_FD:
+	case PT_PID:
+		return SINSP_CAPI_INT;
+	case PT_UINT8:
+	case PT_UINT16:
+	case PT_UINT32:
+	case PT_UINT64:
+	case PT_FLAGS8:
+	case PT_FLAGS16:
+	case PT_FLAGS32:
+	case PT_PORT:
+	case PT_L4PROTO:
+	case PT_RELTIME:
+	case PT_ABSTIME:
+		return SINSP_CAPI_UINT;
+	case PT_BOOL:
+		return SINSP_CAPI_BOOL;
+	case PT_IPV4ADDR:
+		return SINSP_CAPI_IPV4;
+	case PT_BYTEBUF:
+		return SINSP_CAPI_BINARY;
+	default:
+		return SINSP_CAPI_STRING;
+	}
+}
+
+static void add_field(sinsp_capi_inspector* inspector, const string& name)
+{
+	sinsp_filter_check* chk = g_filterlist.new_filter_check_from_fldname(name, inspector->m_inspector, false);
+
+	if(chk == NULL)
+	{
+		throw sinsp_exception("invalid field name " + name);
+	}
+
+	chk->parse_field_name(name.c_str());
+	chk->enable_field_cache(name);
+
+	sinsp_capi_field field;
+
+	field.m_check = chk;
+	field.m_type = chk->get_field_info()->m_type;
+	field.m_kind = get_field_kind(field.m_type);
+
+	inspector->m_fields.push_back(field);
+}
+
+//
+// Get the values of the fields of an event. Return the space that its
+// strings need in the arena.
+//
+static uint64_t extract_values(sinsp_capi_inspector* inspector, sinsp_evt* evt)
+{
+	uint64_t arena_len = 0;
+	uint32_t j;
+
+	inspector->m_values.resize(inspector->m_fields.size());
+
+	for(j = 0; j < inspector->m_fields.size(); j++)
+	{
+		sinsp_capi_field* field = &inspector->m_fields[j];
+		sinsp_field_value* val = &inspector->m_values[j];
+
+		//
+		// Like in the arrow writer, the strings are taken as they're
+		// printed, except the plain ones
+		//
+		if(field->m_kind == SINSP_CAPI_STRING && field->m_type != PT_CHARBUF)
+		{
+			char* str = field->m_check->tostring_cached(evt);
+
+			if(str == NULL)
+			{
+				val->m_kind = SFV_NONE;
+				continue;
+			}
+
+			val->m_kind = SFV_BUF;
+			val->m_buf = str;
+			val->m_len = (uint32_t)strlen(str);
+		}
+		else if(!field->m_check->extract_value(evt, val))
+		{
+			val->m_kind = SFV_NONE;
+			continue;
+		}
+
+		if(val->m_kind == SFV_BUF)
+		{
+			arena_len += val->m_len;
+		}
+	}
+
+	return arena_len;
+}
+
+static void add_row(sinsp_capi_inspector* inspector, sinsp_capi_batch* batch)
+{
+	uint32_t row = batch->m_nrows;
+	uint32_t j;
+
+	for(j = 0; j < inspector->m_fields.size(); j++)
+	{
+		sinsp_capi_field_kind kind = inspector->m_fields[j].m_kind;
+		sinsp_capi_column* col = &batch->m_columns[j];
+		sinsp_field_value* val = &inspector->m_values[j];
+		bool present = (val->m_kind != SFV_NONE);
+
+		col->m_present[row] = present;
+
+		if(kind == SINSP_CAPI_STRING || kind == SINSP_CAPI_BINARY)
+		{
+			col->m_offsets[row] = batch->m_arena_len;
+			col->m_lengths[row] = present? val->m_len : 0;
+
+			if(present)
+			{
+				memcpy(batch->m_arena + batch->m_arena_len, val->m_buf, val->m_len);
+				batch->m_arena_len += val->m_len;
+			}
+		}
+		else
+		{
+			col->m_values[row] = present? val->m_int : 0;
+		}
+	}
+
+	batch->m_nrows++;
+}
+#endif // HAS_FILTERING
+
+sinsp_capi_inspector* sinsp_capi_open(const char* filename, char* error, uint32_t errorlen)
+{
+	sinsp_capi_inspector* inspector = new sinsp_capi_inspector;
+
+	inspector->m_inspector = new sinsp();
+	inspector->m_pending = NULL;
+
+	try
+	{
+		if(filename != NULL)
+		{
+			inspector->m_inspector->open(filename);
+		}
+		else
+		{
+			inspector->m_inspector->open("");
+		}
+	}
+	catch(sinsp_exception& e)
+	{
+		if(error != NULL && errorlen != 0)
+		{
+			snprintf(error, errorlen, "%s", e.what());
+		}
+
+		delete inspector->m_inspector;
+		delete inspector;
+		return NULL;
+	}
+
+	return inspector;
+}
+
+void sinsp_capi_close(sinsp_capi_inspector* inspector)
+{
+	if(inspector == NULL)
+	{
+		return;
+	}
+
+	free_fields(inspector);
+	delete inspector->m_inspector;
+	delete inspector;
+}
+
+const char* sinsp_capi_getlasterr(sinsp_capi_inspector* inspector)
+{
+	return inspector->m_lasterr.c_str();
+}
+
+int32_t sinsp_capi_set_filter(sinsp_capi_inspector* inspector, const char* filter)
+{
+	try
+	{
+		inspector->m_inspector->set_filter(filter);
+	}
+	catch(sinsp_exception& e)
+	{
+		inspector->m_lasterr = e.what();
+		return SINSP_CAPI_FAILURE;
+	}
+
+	return SINSP_CAPI_SUCCESS;
+}
+
+int32_t sinsp_capi_set_fields(sinsp_capi_inspector* inspector, const char* fields)
+{
+#ifdef HAS_FILTERING
+	string fstr(fields);
+	size_t start = 0;
+
+	free_fields(inspector);
+
+	try
+	{
+		while(start <= fstr.size())
+		{
+			size_t end = fstr.find(',', start);
+
+			if(end == string::npos)
+			{
+				end = fstr.size();
+			}
+
+			size_t first = fstr.find_first_not_of(" \t", start);
+			size_t last = fstr.find_last_not_of(" \t", end - 1);
+
+			if(first != string::npos && first < end)
+			{
+				add_field(inspector, fstr.substr(first, last - first + 1));
+			}
+
+			start = end + 1;
+		}
+	}
+	catch(sinsp_exception& e)
+	{
+		free_fields(inspector);
+		inspector->m_lasterr = e.what();
+		return SINSP_CAPI_FAILURE;
+	}
+
+	return SINSP_CAPI_SUCCESS;
+#else
+	inspector->m_lasterr = "the fields are unavailable because filtering was not compiled in the library";
+	return SINSP_CAPI_FAILURE;
+#endif
+}
+
+uint32_t sinsp_capi_get_nfields(sinsp_capi_inspector* inspector)
+{
+	return (uint32_t)inspector->m_fields.size();
+}
+
+int32_t sinsp_capi_get_field_kind(sinsp_capi_inspector* inspector, uint32_t field)
+{
+	if(field >= inspector->m_fields.size())
+	{
+		return -1;
+	}
+
+	return inspector->m_fields[field].m_kind;
+}
+
+int32_t sinsp_capi_next_batch(sinsp_capi_inspector* inspector, sinsp_capi_batch* batch)
+{
+#ifdef HAS_FILTERING
+	int32_t res = SCAP_SUCCESS;
+
+	batch->m_nrows = 0;
+	batch->m_arena_len = 0;
+
+	try
+	{
+		while(batch->m_nrows < batch->m_max_rows)
+		{
+			sinsp_evt* evt;
+
+			if(inspector->m_pending != NULL)
+			{
+				evt = inspector->m_pending;
+				inspector->m_pending = NULL;
+			}
+			else
+			{
+				res = inspector->m_inspector->next(&evt);
+
+				if(res == SCAP_TIMEOUT)
+				{
+					//
+					// The events that the filter drops come back as
+					// timeouts too, with the event
+					//
+					if(evt != NULL)
+					{
+						continue;
+					}
+
+					break;
+				}
+				else if(res == SCAP_EOF)
+				{
+					break;
+				}
+				else if(res != SCAP_SUCCESS)
+				{
+					inspector->m_lasterr = inspector->m_inspector->getlasterr();
+					return SINSP_CAPI_FAILURE;
+				}
+			}
+
+			uint64_t len = extract_values(inspector, evt);
+
+			//
+			// The event stays for the next batch if its strings don't fit.
+			// Its values remain valid, since no other event is read
+			// before.
+			//
+			if(batch->m_arena_len + len > batch->m_arena_size)
+			{
+				inspector->m_pending = evt;
+
+				if(batch->m_nrows == 0)
+				{
+					inspector->m_lasterr = "the arena is too small for the event " + to_string((long long)evt->get_num());
+					return SINSP_CAPI_FAILURE;
+				}
+
+				break;
+			}
+
+			add_row(inspector, batch);
+		}
+	}
+	catch(sinsp_exception& e)
+	{
+		inspector->m_lasterr = e.what();
+		return SINSP_CAPI_FAILURE;
+	}
+
+	if(batch->m_nrows == 0)
+	{
+		return (res == SCAP_EOF)? SINSP_CAPI_EOF : SINSP_CAPI_TIMEOUT;
+	}
+
+	return SINSP_CAPI_SUCCESS;
+#else
+	inspector->m_lasterr = "the fields are unavailable because filtering was not compiled in the library";
+	return SINSP_CAPI_FAILURE;
+#endif
+}
@@ -0,0 +1,159 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//
+// C interface of libsinsp, for the bindings of the other languages.
+// Instead of one call per event and per field, the fields of the events are
+// extracted in batches, into columns that the caller allocates, so that the
+// bindings cross the language boundary once per batch.
+// This header only uses C types, and it doesn't include the C++ ones.
+//
+
+#pragma once
+
+#include <stdint.h>
+
+#ifdef _WIN32
+#define SINSP_CAPI_PUBLIC __declspec(dllexport)
+#else
+#define SINSP_CAPI_PUBLIC
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @defgroup capi C interface
+ *  @{
+ */
+
+//
+// Return values
+//
+#define SINSP_CAPI_SUCCESS 0
+#define SINSP_CAPI_FAILURE 1
+#define SINSP_CAPI_TIMEOUT 2 ///< A live capture got no event, try again.
+#define SINSP_CAPI_EOF 3 ///< No more events in the trace file.
+
+/*!
+  \brief An inspector, opened with \ref sinsp_capi_open().
+*/
+typedef struct sinsp_capi_inspector sinsp_capi_inspector;
+
+/*!
+  \brief How the values of a field are stored in its column.
+*/
+typedef enum sinsp_capi_field_kind
+{
+	SINSP_CAPI_INT = 0, ///< Signed integer, in m_values.
+	SINSP_CAPI_UINT = 1, ///< Unsigned integer, in m_values.
+	SINSP_CAPI_BOOL = 2, ///< 0 or 1, in m_values.
+	SINSP_CAPI_IPV4 = 3, ///< IPv4 address, in m_values. 1.2.3.4 is 0x01020304.
+	SINSP_CAPI_STRING = 4, ///< Text in the arena, in m_offsets and m_lengths, not NUL terminated.
+	SINSP_CAPI_BINARY = 5, ///< Binary buffer in the arena, in m_offsets and m_lengths.
+}sinsp_capi_field_kind;
+
+/*!
+  \brief The values of one field, for the rows of a batch. The caller
+  allocates the arrays, with m_max_rows entries each. The ones that the kind
+  of the field doesn't use can be NULL.
+*/
+typedef struct sinsp_capi_column
+{
+	int64_t* m_values; ///< The numbers. The unsigned ones are stored as their bits.
+	uint32_t* m_offsets; ///< For the strings, where they start in the arena.
+	uint32_t* m_lengths; ///< For the strings, their length.
+	uint8_t* m_present; ///< 1 if the event has the field, 0 if it doesn't.
+}sinsp_capi_column;
+
+/*!
+  \brief A batch of events, with one column for each field set with
+  \ref sinsp_capi_set_fields(), in the same order. The caller allocates it
+  and reuses it for every batch.
+*/
+typedef struct sinsp_capi_batch
+{
+	uint32_t m_max_rows; ///< The size of the arrays of the columns.
+	sinsp_capi_column* m_columns;
+	char* m_arena; ///< The storage of the strings of the batch.
+	uint32_t m_arena_size;
+	uint32_t m_nrows; ///< Set by sinsp_capi_next_batch(): the number of events in the batch.
+	uint32_t m_arena_len; ///< Set by sinsp_capi_next_batch(): the bytes used in the arena.
+}sinsp_capi_batch;
+
+/*!
+  \brief Open a trace file, or start a live capture.
+
+  \param filename The trace file, or NULL for a live capture.
+  \param error Receives the error message if the open fails.
+  \param errorlen The size of error.
+
+  \return The inspector, or NULL if the open failed.
+*/
+SINSP_CAPI_PUBLIC sinsp_capi_inspector* sinsp_capi_open(const char* filename, char* error, uint32_t errorlen);
+
+/*!
+  \brief Stop the capture and free the inspector.
+*/
+SINSP_CAPI_PUBLIC void sinsp_capi_close(sinsp_capi_inspector* inspector);
+
+/*!
+  \brief Return the error message of the last call that failed.
+*/
+SINSP_CAPI_PUBLIC const char* sinsp_capi_getlasterr(sinsp_capi_inspector* inspector);
+
+/*!
+  \brief Only return the events that match a filter, in the syntax of
+  sysdig's filters.
+*/
+SINSP_CAPI_PUBLIC int32_t sinsp_capi_set_filter(sinsp_capi_inspector* inspector, const char* filter);
+
+/*!
+  \brief Choose the fields that the batches have, as a comma separated
+  list, e.g. "evt.num,evt.rawtime,proc.name,fd.name".
+*/
+SINSP_CAPI_PUBLIC int32_t sinsp_capi_set_fields(sinsp_capi_inspector* inspector, const char* fields);
+
+/*!
+  \brief Return the number of fields set with \ref sinsp_capi_set_fields().
+*/
+SINSP_CAPI_PUBLIC uint32_t sinsp_capi_get_nfields(sinsp_capi_inspector* inspector);
+
+/*!
+  \brief Return the sinsp_capi_field_kind of a field, -1 if there's no field
+  with that index.
+*/
+SINSP_CAPI_PUBLIC int32_t sinsp_capi_get_field_kind(sinsp_capi_inspector* inspector, uint32_t field);
+
+/*!
+  \brief Fill a batch with the fields of the next events.
+
+  \return SINSP_CAPI_SUCCESS if the batch has at least one event. It can
+   have less than m_max_rows if the arena is full, if the end of the file is
+   reached or if a live capture has no more events for now.
+   SINSP_CAPI_TIMEOUT or SINSP_CAPI_EOF if there was no event.
+   SINSP_CAPI_FAILURE on error, also when an event doesn't fit in an empty
+   arena. In that case, the same event is tried again by the next call.
+*/
+SINSP_CAPI_PUBLIC int32_t sinsp_capi_next_batch(sinsp_capi_inspector* inspector, sinsp_capi_batch* batch);
+
+/*@}*/
+
+#ifdef __cplusplus
+}
+#endif
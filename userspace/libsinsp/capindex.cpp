@@ -0,0 +1,603 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <algorithm>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include "sinsp.h"
+#include "sinsp_int.h"
+#include "filter.h"
+#include "filterchecks.h"
+#include "capindex.h"
+
+#ifdef HAS_FILTERING
+
+extern sinsp_filter_check_list g_filterlist;
+
+//
+// Start of the index file, followed by the version of the format
+//
+#define CAPTURE_INDEX_MAGIC "SDIX"
+#define CAPTURE_INDEX_VERSION 1
+
+///////////////////////////////////////////////////////////////////////////////
+// Encoding of the index file: little endian integers, strings as their 32 bit
+// length followed by their bytes, and the lists of event numbers as their
+// length followed by the differences between consecutive numbers, 7 bits per
+// byte, since most are small
+///////////////////////////////////////////////////////////////////////////////
+static void put_u32(string* dst, uint32_t val)
+{
+	uint32_t j;
+
+	for(j = 0; j < 4; j++)
+	{
+		dst->push_back((char)(val >> (j * 8)));
+	}
+}
+
+static void put_u64(string* dst, uint64_t val)
+{
+	put_u32(dst, (uint32_t)val);
+	put_u32(dst, (uint32_t)(val >> 32));
+}
+
+static void put_str(string* dst, const string& val)
+{
+	put_u32(dst, (uint32_t)val.size());
+	dst->append(val);
+}
+
+static void put_varint(string* dst, uint64_t val)
+{
+	while(val >= 0x80)
+	{
+		dst->push_back((char)(val | 0x80));
+		val >>= 7;
+	}
+
+	dst->push_back((char)val);
+}
+
+//
+// Reader of the index file. Once a read goes past the end of the data,
+// m_error is set and all the reads return zeros.
+//
+class capture_index_reader
+{
+public:
+	capture_index_reader(const string& data)
+	{
+		m_data = &data;
+		m_pos = 0;
+		m_error = false;
+	}
+
+	uint32_t get_u32()
+	{
+		uint32_t res = 0;
+		uint32_t j;
+
+		if(m_error || m_data->size() - m_pos < 4)
+		{
+			m_error = true;
+			return 0;
+		}
+
+		for(j = 0; j < 4; j++)
+		{
+			res |= (uint32_t)(uint8_t)(*m_data)[m_pos + j] << (j * 8);
+		}
+
+		m_pos += 4;
+		return res;
+	}
+
+	uint64_t get_u64()
+	{
+		uint64_t lo = get_u32();
+		uint64_t hi = get_u32();
+
+		return lo | (hi << 32);
+	}
+
+	void get_str(OUT string* res)
+	{
+		uint32_t len = get_u32();
+
+		if(m_error || m_data->size() - m_pos < len)
+		{
+			m_error = true;
+			res->clear();
+			return;
+		}
+
+		res->assign(*m_data, m_pos, len);
+		m_pos += len;
+	}
+
+	uint64_t get_varint()
+	{
+		uint64_t res = 0;
+		uint32_t shift;
+
+		for(shift = 0; shift < 64 && !m_error; shift += 7)
+		{
+			if(m_pos >= m_data->size())
+			{
+				m_error = true;
+				break;
+			}
+
+			uint8_t b = (uint8_t)(*m_data)[m_pos++];
+
+			res |= (uint64_t)(b & 0x7f) << shift;
+			if((b & 0x80) == 0)
+			{
+				return res;
+			}
+		}
+
+		m_error = true;
+		return 0;
+	}
+
+	const string* m_data;
+	size_t m_pos;
+	bool m_error;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// sinsp_capture_index implementation
+///////////////////////////////////////////////////////////////////////////////
+sinsp_capture_index::sinsp_capture_index(sinsp* inspector)
+{
+	m_inspector = inspector;
+}
+
+sinsp_capture_index::~sinsp_capture_index()
+{
+	uint32_t j;
+
+	for(j = 0; j < m_fields.size(); j++)
+	{
+		delete m_fields[j]->m_check;
+		delete m_fields[j];
+	}
+}
+
+string sinsp_capture_index::get_filename(const string& capture_filename)
+{
+	return capture_filename + ".idx";
+}
+
+void sinsp_capture_index::add_field(const string& name)
+{
+	if(find_field(name) != NULL)
+	{
+		return;
+	}
+
+	sinsp_filter_check* chk = g_filterlist.new_filter_check_from_fldname(name, m_inspector, true);
+	if(chk == NULL)
+	{
+		throw sinsp_exception("invalid field name " + name);
+	}
+
+	chk->parse_field_name(name.c_str());
+
+	//
+	// The filter-only fields, like fd.port, have nothing to extract
+	//
+	if(chk->get_field_info()->m_flags & EPF_FILTER_ONLY)
+	{
+		delete chk;
+		throw sinsp_exception("field " + name + " can't be indexed");
+	}
+
+	switch(chk->get_field_info()->m_type)
+	{
+	case PT_CHARBUF:
+	case PT_INT8:
+	case PT_UINT8:
+	case PT_L4PROTO:
+	case PT_INT16:
+	case PT_UINT16:
+	case PT_PORT:
+	case PT_INT32:
+	case PT_UINT32:
+	case PT_IPV4ADDR:
+	case PT_INT64:
+	case PT_UINT64:
+	case PT_PID:
+	case PT_FD:
+		break;
+	default:
+		delete chk;
+		throw sinsp_exception("field " + name + " can't be indexed");
+	}
+
+	field* f = new field();
+	f->m_name = name;
+	f->m_check = chk;
+	m_fields.push_back(f);
+}
+
+void sinsp_capture_index::add(sinsp_evt* evt)
+{
+	uint32_t j;
+	uint64_t evtnum = evt->get_num();
+
+	for(j = 0; j < m_fields.size(); j++)
+	{
+		field* f = m_fields[j];
+
+		if(f->m_check->extract_key(evt, &m_key))
+		{
+			vector<uint64_t>& evtnums = f->m_values[m_key];
+
+			if(evtnums.empty() || evtnums.back() != evtnum)
+			{
+				evtnums.push_back(evtnum);
+			}
+		}
+	}
+}
+
+bool sinsp_capture_index::get_file_id(const string& capture_filename, OUT uint64_t* size, OUT uint64_t* mtime)
+{
+	struct stat st;
+
+	if(stat(capture_filename.c_str(), &st) != 0)
+	{
+		return false;
+	}
+
+	*size = (uint64_t)st.st_size;
+	*mtime = (uint64_t)st.st_mtime;
+	return true;
+}
+
+void sinsp_capture_index::write(const string& capture_filename)
+{
+	string data;
+	string filename = get_filename(capture_filename);
+	uint64_t size;
+	uint64_t mtime;
+	uint32_t j;
+
+	if(!get_file_id(capture_filename, &size, &mtime))
+	{
+		throw sinsp_exception("can't index " + capture_filename + ": " + strerror(errno));
+	}
+
+	put_str(&data, CAPTURE_INDEX_MAGIC);
+	put_u32(&data, CAPTURE_INDEX_VERSION);
+	put_u64(&data, size);
+	put_u64(&data, mtime);
+	put_u32(&data, (uint32_t)m_fields.size());
+
+	for(j = 0; j < m_fields.size(); j++)
+	{
+		field* f = m_fields[j];
+
+		put_str(&data, f->m_name);
+		put_u64(&data, f->m_values.size());
+
+		for(unordered_map<string, vector<uint64_t> >::iterator it = f->m_values.begin(); it != f->m_values.end(); ++it)
+		{
+			const vector<uint64_t>& evtnums = it->second;
+			uint64_t last = 0;
+			uint32_t k;
+
+			put_str(&data, it->first);
+			put_varint(&data, evtnums.size());
+
+			for(k = 0; k < evtnums.size(); k++)
+			{
+				put_varint(&data, evtnums[k] - last);
+				last = evtnums[k];
+			}
+		}
+	}
+
+	//
+	// Write a temporary file and move it in place, so that a reader never
+	// sees a partial index
+	//
+#ifndef _WIN32
+	string tmpname = filename + "." + to_string((long long int)getpid());
+#else
+	string tmpname = filename + ".tmp";
+#endif
+
+	FILE* fp = fopen(tmpname.c_str(), "wb");
+	if(fp == NULL)
+	{
+		throw sinsp_exception("can't create " + tmpname + ": " + strerror(errno));
+	}
+
+	bool ok = (fwrite(data.data(), 1, data.size(), fp) == data.size());
+
+	if(fclose(fp) != 0)
+	{
+		ok = false;
+	}
+
+#ifdef _WIN32
+	if(ok)
+	{
+		remove(filename.c_str());
+	}
+#endif
+
+	if(!ok || rename(tmpname.c_str(), filename.c_str()) != 0)
+	{
+		remove(tmpname.c_str());
+		throw sinsp_exception("error writing " + filename);
+	}
+}
+
+bool sinsp_capture_index::load(const string& capture_filename)
+{
+	string filename = get_filename(capture_filename);
+	uint64_t size;
+	uint64_t mtime;
+	uint32_t nfields;
+	uint32_t j;
+
+	FILE* fp = fopen(filename.c_str(), "rb");
+	if(fp == NULL)
+	{
+		return false;
+	}
+
+	string data;
+	char buf[65536];
+	size_t n;
+
+	while((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+	{
+		data.append(buf, n);
+	}
+
+	fclose(fp);
+
+	capture_index_reader rd(data);
+	string str;
+
+	rd.get_str(&str);
+	if(str != CAPTURE_INDEX_MAGIC || rd.get_u32() != CAPTURE_INDEX_VERSION)
+	{
+		g_logger.log(filename + " is not a capture index", sinsp_logger::SEV_WARNING);
+		return false;
+	}
+
+	if(!get_file_id(capture_filename, &size, &mtime) ||
+		rd.get_u64() != size || rd.get_u64() != mtime)
+	{
+		g_logger.log(capture_filename + " changed after " + filename + " was built, not using it", sinsp_logger::SEV_WARNING);
+		return false;
+	}
+
+	nfields = rd.get_u32();
+
+	for(j = 0; j < nfields && !rd.m_error; j++)
+	{
+		field* f = new field();
+		uint64_t nvalues;
+		uint64_t k;
+
+		f->m_check = NULL;
+		m_fields.push_back(f);
+
+		rd.get_str(&f->m_name);
+		nvalues = rd.get_u64();
+
+		for(k = 0; k < nvalues && !rd.m_error; k++)
+		{
+			uint64_t nevts;
+			uint64_t last = 0;
+			uint64_t l;
+
+			rd.get_str(&str);
+			nevts = rd.get_varint();
+
+			//
+			// Every event number takes at least a byte
+			//
+			if(nevts > data.size() - rd.m_pos)
+			{
+				rd.m_error = true;
+				break;
+			}
+
+			vector<uint64_t>& evtnums = f->m_values[str];
+			evtnums.reserve(nevts);
+
+			for(l = 0; l < nevts && !rd.m_error; l++)
+			{
+				last += rd.get_varint();
+				evtnums.push_back(last);
+			}
+		}
+	}
+
+	//
+	// A truncated index is thrown away as a whole
+	//
+	if(rd.m_error)
+	{
+		for(j = 0; j < m_fields.size(); j++)
+		{
+			delete m_fields[j];
+		}
+
+		m_fields.clear();
+		g_logger.log(filename + " is truncated", sinsp_logger::SEV_WARNING);
+		return false;
+	}
+
+	return true;
+}
+
+sinsp_capture_index::field* sinsp_capture_index::find_field(const string& name)
+{
+	uint32_t j;
+
+	for(j = 0; j < m_fields.size(); j++)
+	{
+		if(m_fields[j]->m_name == name)
+		{
+			return m_fields[j];
+		}
+	}
+
+	return NULL;
+}
+
+bool sinsp_capture_index::lookup(sinsp_filter* filter, OUT vector<uint64_t>* evtnums)
+{
+	evtnums->clear();
+	return lookup_expression(filter->m_filter, evtnums);
+}
+
+//
+// Like sinsp_filter_expression::get_evttypes(): a check that the index can't
+// answer, or a negated one, can accept any event, which only matters when
+// it's not and-ed with one that the index answers
+//
+bool sinsp_capture_index::lookup_expression(sinsp_filter_expression* expr, OUT vector<uint64_t>* evtnums)
+{
+	uint32_t j;
+	bool known = false;
+	vector<uint64_t> chkevtnums;
+	vector<uint64_t> merged;
+
+	for(j = 0; j < expr->m_checks.size(); j++)
+	{
+		sinsp_filter_check* chk = expr->m_checks[j];
+		bool chkknown;
+
+		switch(chk->m_boolop)
+		{
+		case BO_NOT:
+		case BO_ORNOT:
+			known = false;
+			continue;
+		case BO_ANDNOT:
+			continue;
+		default:
+			break;
+		}
+
+		chkevtnums.clear();
+
+		if(chk->is_expression())
+		{
+			chkknown = lookup_expression((sinsp_filter_expression*)chk, &chkevtnums);
+		}
+		else
+		{
+			chkknown = lookup_check(chk, &chkevtnums);
+		}
+
+		switch(chk->m_boolop)
+		{
+		case BO_NONE:
+			known = chkknown;
+			evtnums->swap(chkevtnums);
+			break;
+		case BO_AND:
+			if(!known)
+			{
+				known = chkknown;
+				evtnums->swap(chkevtnums);
+			}
+			else if(chkknown)
+			{
+				merged.clear();
+				set_intersection(evtnums->begin(), evtnums->end(),
+					chkevtnums.begin(), chkevtnums.end(),
+					back_inserter(merged));
+				evtnums->swap(merged);
+			}
+			break;
+		case BO_OR:
+			if(known && chkknown)
+			{
+				merged.clear();
+				set_union(evtnums->begin(), evtnums->end(),
+					chkevtnums.begin(), chkevtnums.end(),
+					back_inserter(merged));
+				evtnums->swap(merged);
+			}
+			else
+			{
+				known = false;
+			}
+			break;
+		default:
+			ASSERT(false);
+			known = false;
+			break;
+		}
+	}
+
+	if(!known)
+	{
+		evtnums->clear();
+	}
+
+	return known;
+}
+
+bool sinsp_capture_index::lookup_check(sinsp_filter_check* chk, OUT vector<uint64_t>* evtnums)
+{
+	field* f = find_field(chk->m_fldname);
+	vector<string> keys;
+	vector<uint64_t> merged;
+	uint32_t j;
+
+	if(f == NULL || !chk->get_lookup_keys(&keys))
+	{
+		return false;
+	}
+
+	for(j = 0; j < keys.size(); j++)
+	{
+		unordered_map<string, vector<uint64_t> >::iterator it = f->m_values.find(keys[j]);
+
+		if(it != f->m_values.end())
+		{
+			merged.clear();
+			set_union(evtnums->begin(), evtnums->end(),
+				it->second.begin(), it->second.end(),
+				back_inserter(merged));
+			evtnums->swap(merged);
+		}
+	}
+
+	return true;
+}
+
+#endif // HAS_FILTERING
@@ -0,0 +1,97 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#ifdef HAS_FILTERING
+
+class sinsp_filter;
+class sinsp_filter_check;
+class sinsp_filter_expression;
+
+///////////////////////////////////////////////////////////////////////////////
+// Inverted index of a trace file: for some fields, the numbers of the events
+// that have each value. It's built once by reading the whole file, and saved
+// next to it, in <file>.idx.
+//
+// When the capture filter is an '=' or 'in' check on an indexed field, or
+// combines such checks with 'and' and 'or', the index gives the events that
+// the filter can accept, and the reader skips the groups of events of the
+// file that have none of them, see sinsp::set_block_skipping().
+//
+// The index is tied to the size and the modification time of the file, and
+// it's ignored if the file changed.
+///////////////////////////////////////////////////////////////////////////////
+class SINSP_PUBLIC sinsp_capture_index
+{
+public:
+	sinsp_capture_index(sinsp* inspector);
+	~sinsp_capture_index();
+
+	//
+	// Index the given field. Throws a sinsp_exception if it doesn't exist
+	// or if it's not of a type that can be looked up.
+	//
+	void add_field(const string& name);
+
+	//
+	// Index an event. The events must be added in order, from the first one
+	// of the file.
+	//
+	void add(sinsp_evt* evt);
+
+	//
+	// Save the index of the given trace file, in get_filename(). Throws a
+	// sinsp_exception on error.
+	//
+	void write(const string& capture_filename);
+
+	//
+	// Load the index of the given trace file. Returns false if there's none,
+	// or if it's stale.
+	//
+	bool load(const string& capture_filename);
+
+	//
+	// Get the sorted numbers of the events that the filter can accept.
+	// Returns false if the index can't tell, because the filter has checks
+	// that it can't answer in a position that matters.
+	//
+	bool lookup(sinsp_filter* filter, OUT vector<uint64_t>* evtnums);
+
+	static string get_filename(const string& capture_filename);
+
+private:
+	struct field
+	{
+		string m_name;
+		sinsp_filter_check* m_check; // Extracts the values when building the index
+		unordered_map<string, vector<uint64_t> > m_values; // The event numbers of each value
+	};
+
+	field* find_field(const string& name);
+	bool lookup_expression(sinsp_filter_expression* expr, OUT vector<uint64_t>* evtnums);
+	bool lookup_check(sinsp_filter_check* chk, OUT vector<uint64_t>* evtnums);
+	static bool get_file_id(const string& capture_filename, OUT uint64_t* size, OUT uint64_t* mtime);
+
+	sinsp* m_inspector;
+	vector<field*> m_fields;
+	string m_key;
+};
+
+#endif // HAS_FILTERING
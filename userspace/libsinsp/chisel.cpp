@@ -34,6 +34,9 @@ along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
 #include "chisel.h"
 #include "filter.h"
 #include "filterchecks.h"
+#include "fieldaggr.h"
+#include "tableview.h"
+#include "chiselcache.h"
 
 #ifdef HAS_CHISELS
 
@@ -44,13 +47,64 @@ extern "C" {
 #include "lua.h"
 #include "lualib.h"
 #include "lauxlib.h"
+#include "luajit.h"
 }
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <pthread.h>
+#define HAS_CHISEL_THREADS
+#endif
 #endif
 
 extern vector<chiseldir_info>* g_chisel_dirs;
 extern sinsp_filter_check_list g_filterlist;
 extern sinsp_evttables g_infotables;
 
+#ifdef HAS_CHISEL_THREADS
+//
+// Work for the thread of a chisel
+//
+enum chisel_work_type
+{
+	CW_EVENTS, // A batch of events for on_events()
+	CW_INTERVAL, // The end of an interval
+	CW_CAPTURE_END,
+};
+
+typedef struct chisel_work_item
+{
+	uint32_t m_type;
+	vector<sinsp_field_value> m_batch;
+	string m_batch_bufs;
+	uint32_t m_nevts;
+	uint64_t m_ts;
+	int64_t m_delta;
+	vector<sinsp_field_aggregator::group_table> m_groups; // What the aggregations got since the previous end of interval
+}chisel_work_item;
+
+//
+// The queue between the capture and the thread of a chisel. Like the queues
+// of the scap readers, it has a single producer and a single consumer, so
+// it only needs the two positions and a barrier before each of them is
+// published. The items are reused, so their buffers keep their size.
+//
+struct chisel_thread
+{
+	vector<chisel_work_item> m_items;
+	volatile uint64_t m_head; // Next item to process, moved by the chisel thread
+	volatile uint64_t m_tail; // Next item to fill, moved by the capture
+	bool m_drop;
+	volatile bool m_stop;
+	volatile bool m_failed;
+	string m_error; // Set before m_failed
+	pthread_t m_thread;
+	bool m_joined;
+	chisel_thread_stats m_stats;
+	vector<sinsp_field_aggregator::group_table> m_groups; // Filled by the capture, one for each aggregation
+};
+#endif
+
 ///////////////////////////////////////////////////////////////////////////////
 // For LUA debugging
 ///////////////////////////////////////////////////////////////////////////////
@@ -154,9 +208,18 @@ public:
 					uint32_t max_len = len < sizeof(ch->m_lua_fld_storage) ?
 						len : sizeof(ch->m_lua_fld_storage) - 1;
 
-					memcpy(ch->m_lua_fld_storage, rawval, max_len);
-					ch->m_lua_fld_storage[max_len] = 0;
-					lua_pushstring(ls, (char*)ch->m_lua_fld_storage);
+					//
+					// Same string as the one that was copied into
+					// m_lua_fld_storage, which ended at the first zero,
+					// without the copy
+					//
+					const char* end = (const char*)memchr(rawval, 0, max_len);
+					if(end != NULL)
+					{
+						max_len = (uint32_t)(end - (const char*)rawval);
+					}
+
+					lua_pushlstring(ls, (char*)rawval, max_len);
 					return 1;
 				}
 			case PT_SOCKADDR:
@@ -235,7 +298,17 @@ public:
 			throw sinsp_exception("invalid call to evt.get_type()");
 		}
 
-		const char* evname;
+		lua_pushstring(ls, get_evt_type_name(evt));
+
+		return 1;
+	}
+
+	//
+	// The name of the system call for the generic events, the name of the
+	// event otherwise
+	//
+	static const char* get_evt_type_name(sinsp_evt* evt)
+	{
 		uint16_t etype = evt->get_type();
 
 		if(etype == PPME_GENERIC_E || etype == PPME_GENERIC_X)
@@ -244,16 +317,12 @@ public:
 			ASSERT(parinfo->m_len == sizeof(uint16_t));
 			uint16_t evid = *(uint16_t *)parinfo->m_val;
 
-			evname = g_infotables.m_syscall_info_table[evid].name;
+			return g_infotables.m_syscall_info_table[evid].name;
 		}
 		else
 		{
-			evname = evt->get_name();
+			return evt->get_name();
 		}
-
-		lua_pushstring(ls, evname);
-
-		return 1;
 	}
 
 	static int get_cpuid(lua_State *ls) 
@@ -294,6 +363,7 @@ public:
 		}
 
 		chk->parse_field_name(fld);
+		chk->enable_field_cache(fld);
 
 		lua_pushlightuserdata(ls, chk);
 
@@ -325,7 +395,7 @@ public:
 		}
 
 		uint32_t vlen;
-		uint8_t* rawval = chk->extract(evt, &vlen);
+		uint8_t* rawval = chk->extract_cached(evt, &vlen);
 
 		if(rawval != NULL)
 		{
@@ -338,251 +408,1478 @@ public:
 		}
 	}
 
-	static int set_global_filter(lua_State *ls) 
+	//
+	// The typed version of evt.field(), called by the chisels through the
+	// LuaJIT FFI instead of the Lua C API, so the JIT can compile the calls
+	// and the values don't become Lua strings. See fieldvalue.lua.
+	// Returns 1 if the event has the field, 0 otherwise.
+	//
+	static int32_t ffi_field_value(void* chk, void* evt, sinsp_field_value* val)
 	{
-		lua_getglobal(ls, "sichisel");
-
-		sinsp_chisel* ch = (sinsp_chisel*)lua_touserdata(ls, -1);
-		lua_pop(ls, 1);
-
-		const char* filter = lua_tostring(ls, 1); 
-
-		ASSERT(ch);
-		ASSERT(ch->m_lua_cinfo);
-
-		ch->m_inspector->set_filter(filter);
+		if(chk == NULL || evt == NULL)
+		{
+			return 0;
+		}
 
-		return 0;
+		return ((sinsp_filter_check*)chk)->extract_value((sinsp_evt*)evt, val)? 1 : 0;
 	}
 
-	static int set_filter(lua_State *ls) 
+	//
+	// chisel.get_field_value_fn(): return the address of ffi_field_value()
+	//
+	static int get_field_value_fn(lua_State *ls) 
 	{
-		lua_getglobal(ls, "sichisel");
-
-		sinsp_chisel* ch = (sinsp_chisel*)lua_touserdata(ls, -1);
-		lua_pop(ls, 1);
-
-		const char* filter = lua_tostring(ls, 1); 
-
-		ASSERT(ch);
-		ASSERT(ch->m_lua_cinfo);
-
-		ch->m_lua_cinfo->set_filter(filter);
-
-		return 0;
+		lua_pushlightuserdata(ls, (void*)&ffi_field_value);
+		return 1;
 	}
 
-	static int set_snaplen(lua_State *ls) 
+	//
+	// The FFI versions of evt.get_ts(), evt.get_num(), evt.get_cpuid() and
+	// evt.get_type(). The name of the type is valid until the end of the
+	// capture.
+	//
+	static uint64_t ffi_evt_get_ts(void* evt)
 	{
-		lua_getglobal(ls, "sichisel");
-
-		sinsp_chisel* ch = (sinsp_chisel*)lua_touserdata(ls, -1);
-		lua_pop(ls, 1);
+		return (evt != NULL)? ((sinsp_evt*)evt)->get_ts() : 0;
+	}
 
-		const uint32_t snaplen = lua_tointeger(ls, 1); 
+	static uint64_t ffi_evt_get_num(void* evt)
+	{
+		return (evt != NULL)? ((sinsp_evt*)evt)->get_num() : 0;
+	}
 
-		ASSERT(ch);
-		ASSERT(ch->m_lua_cinfo);
+	static int32_t ffi_evt_get_cpuid(void* evt)
+	{
+		return (evt != NULL)? ((sinsp_evt*)evt)->get_cpuid() : -1;
+	}
 
-		ch->m_inspector->set_snaplen(snaplen);
+	static const char* ffi_evt_get_type(void* evt)
+	{
+		if(evt == NULL)
+		{
+			return "";
+		}
 
-		return 0;
+		return get_evt_type_name((sinsp_evt*)evt);
 	}
 
-	static int make_ts(lua_State *ls) 
+	//
+	// chisel.get_ffi_fn(name): return the address of one of the FFI
+	// functions: field_value, evt_get_ts, evt_get_num, evt_get_cpuid or
+	// evt_get_type. See fieldvalue.lua for their types.
+	//
+	static int get_ffi_fn(lua_State *ls) 
 	{
-		lua_getglobal(ls, "sichisel");
+		const char* name = lua_tostring(ls, 1);
+		void* fn;
 
-		uint32_t op1 = lua_tointeger(ls, 1);
-		lua_pop(ls, 1);
-		uint32_t op2 = lua_tointeger(ls, 2);
-		lua_pop(ls, 1);
+		if(name == NULL)
+		{
+			throw sinsp_exception("chisel.get_ffi_fn() needs a function name");
+		}
 
-		uint64_t sum = (uint64_t)op1 * ONE_SECOND_IN_NS + op2;
+		if(strcmp(name, "field_value") == 0)
+		{
+			fn = (void*)&ffi_field_value;
+		}
+		else if(strcmp(name, "evt_get_ts") == 0)
+		{
+			fn = (void*)&ffi_evt_get_ts;
+		}
+		else if(strcmp(name, "evt_get_num") == 0)
+		{
+			fn = (void*)&ffi_evt_get_num;
+		}
+		else if(strcmp(name, "evt_get_cpuid") == 0)
+		{
+			fn = (void*)&ffi_evt_get_cpuid;
+		}
+		else if(strcmp(name, "evt_get_type") == 0)
+		{
+			fn = (void*)&ffi_evt_get_type;
+		}
+		else
+		{
+			throw sinsp_exception("chisel.get_ffi_fn(): unknown function " + string(name));
+		}
 
-		lua_pushstring(ls, to_string(sum).c_str());
+		lua_pushlightuserdata(ls, fn);
 		return 1;
 	}
 
-	static int is_live(lua_State *ls) 
+	//
+	// chisel.request_matcher(patterns, anchored): build a matcher for the
+	// strings in the patterns table. If anchored is true, the patterns only
+	// match at the start of the values.
+	//
+	static int request_matcher(lua_State *ls) 
 	{
 		lua_getglobal(ls, "sichisel");
 
 		sinsp_chisel* ch = (sinsp_chisel*)lua_touserdata(ls, -1);
 		lua_pop(ls, 1);
 
-		ASSERT(ch);
-		ASSERT(ch->m_lua_cinfo);
+		if(!lua_istable(ls, 1))
+		{
+			throw sinsp_exception("chisel.request_matcher() needs a table of patterns");
+		}
 
-		lua_pushboolean(ls, ch->m_inspector->is_live());
-		return 1;
-	}
+		bool anchored = (lua_toboolean(ls, 2) != 0);
+		uint32_t npatterns = (uint32_t)lua_objlen(ls, 1);
+		sinsp_string_matcher* matcher = new sinsp_string_matcher();
 
-	static int get_machine_info(lua_State *ls) 
-	{
-		lua_getglobal(ls, "sichisel");
+		ch->m_allocated_matchers.push_back(matcher);
 
-		sinsp_chisel* ch = (sinsp_chisel*)lua_touserdata(ls, -1);
-		lua_pop(ls, 1);
+		for(uint32_t j = 1; j <= npatterns; j++)
+		{
+			size_t len;
 
-		ASSERT(ch);
-		ASSERT(ch->m_lua_cinfo);
+			lua_rawgeti(ls, 1, j);
+			const char* pattern = lua_tolstring(ls, -1, &len);
 
-		const scap_machine_info* minfo = ch->m_inspector->get_machine_info();
+			if(pattern == NULL)
+			{
+				throw sinsp_exception("chisel.request_matcher(): the patterns must be strings");
+			}
 
-		lua_newtable(ls);
-		lua_pushstring(ls, "num_cpus");
-		lua_pushnumber(ls, minfo->num_cpus);
-		lua_settable(ls, -3);
-		lua_pushstring(ls, "memory_size_bytes");
-		lua_pushnumber(ls, (double)minfo->memory_size_bytes);
-		lua_settable(ls, -3);
-		lua_pushstring(ls, "max_pid");
-		lua_pushnumber(ls, (double)minfo->max_pid);
-		lua_settable(ls, -3);
-		lua_pushstring(ls, "hostname");
-		lua_pushstring(ls, minfo->hostname);
-		lua_settable(ls, -3);
+			matcher->add(pattern, (uint32_t)len, anchored);
+			lua_pop(ls, 1);
+		}
 
+		matcher->compile();
+
+		lua_pushlightuserdata(ls, matcher);
 		return 1;
 	}
 
-	static int get_output_format(lua_State *ls) 
+	//
+	// evt.match(matcher, field): return the table of the indexes of the
+	// patterns of the matcher that are in the value of the field, or nil if
+	// the event doesn't have the field. The value is scanned once for all
+	// the patterns.
+	//
+	static int match(lua_State *ls) 
 	{
-		lua_getglobal(ls, "sichisel");
-
-		sinsp_chisel* ch = (sinsp_chisel*)lua_touserdata(ls, -1);
+		lua_getglobal(ls, "sievt");
+		sinsp_evt* evt = (sinsp_evt*)lua_touserdata(ls, -1);
 		lua_pop(ls, 1);
 
-		ASSERT(ch);
-		ASSERT(ch->m_lua_cinfo);
+		if(evt == NULL)
+		{
+			throw sinsp_exception("invalid call to evt.match()");
+		}
 
-		sinsp_evt::param_fmt fmt = ch->m_inspector->get_buffer_format();
+		sinsp_string_matcher* matcher = (sinsp_string_matcher*)lua_topointer(ls, 1);
+		sinsp_filter_check* chk = (sinsp_filter_check*)lua_topointer(ls, 2);
 
-		if(fmt & sinsp_evt::PF_JSON)
+		if(matcher == NULL || chk == NULL)
 		{
-			lua_pushstring(ls, "json");
+			lua_pushnil(ls);
+			return 1;
 		}
-		else
+
+		ppm_param_type type = chk->get_field_info()->m_type;
+
+		if(type != PT_CHARBUF && type != PT_BYTEBUF)
 		{
-			lua_pushstring(ls, "normal");
+			throw sinsp_exception("evt.match() needs a string field");
 		}
 
-		return 1;
-	}
+		uint32_t vlen;
+		uint8_t* rawval = chk->extract_cached(evt, &vlen);
 
-	static int set_event_formatter(lua_State *ls) 
-	{
-		lua_getglobal(ls, "sichisel");
+		if(rawval == NULL)
+		{
+			lua_pushnil(ls);
+			return 1;
+		}
 
-		sinsp_chisel* ch = (sinsp_chisel*)lua_touserdata(ls, -1);
-		lua_pop(ls, 1);
+		if(type == PT_CHARBUF)
+		{
+			vlen = strlen((char*)rawval);
+		}
 
-		const char* formatter = lua_tostring(ls, 1); 
+		vector<uint32_t> ids;
+		matcher->match_all((char*)rawval, vlen, &ids);
 
-		ASSERT(ch);
-		ASSERT(ch->m_lua_cinfo);
+		lua_createtable(ls, ids.size(), 0);
 
-		ch->m_lua_cinfo->set_formatter(formatter);
+		for(uint32_t j = 0; j < ids.size(); j++)
+		{
+			lua_pushnumber(ls, ids[j] + 1);
+			lua_rawseti(ls, -2, j + 1);
+		}
 
-		return 0;
+		return 1;
 	}
 
-	static int set_interval_ns(lua_State *ls) 
+	//
+	// chisel.add_aggregation(keys, value, op, positive_only, max_groups,
+	// scale_by_sampling): group the
+	// events that pass the chisel filter by the values of the keys fields
+	// (a field name or a table of them), and compute the op (sum, count,
+	// min or max, sum by default) of the value field for each group. The
+	// value is optional for count. If positive_only is true, the events
+	// with a value that's not greater than zero are left out.
+	// If max_groups is given, at most that number of groups are kept, see
+	// sinsp_field_aggregator::set_max_groups().
+	// If scale_by_sampling is true, sums and counts are multiplied by the
+	// sampling ratio of the events, to estimate the totals when the driver
+	// drops some of them.
+	// The events are added in C++, before on_event() is called. Returns a
+	// handle for get_aggregation() and clear_aggregation().
+	//
+	static int add_aggregation(lua_State *ls) 
 	{
 		lua_getglobal(ls, "sichisel");
 
 		sinsp_chisel* ch = (sinsp_chisel*)lua_touserdata(ls, -1);
 		lua_pop(ls, 1);
 
-		uint64_t interval = (uint64_t)lua_tonumber(ls, 1);
-
-		ASSERT(ch);
-		ASSERT(ch->m_lua_cinfo);
-
-		ch->m_lua_cinfo->set_callback_interval(interval);
-
-		return 0;
-	}
-
-	static int set_interval_s(lua_State *ls) 
-	{
-		lua_getglobal(ls, "sichisel");
-
-		sinsp_chisel* ch = (sinsp_chisel*)lua_touserdata(ls, -1);
-		lua_pop(ls, 1);
+		sinsp_field_aggregator::op aggr_op = sinsp_field_aggregator::AO_SUM;
+		const char* opname = lua_tostring(ls, 3);
 
-		uint64_t interval = (uint64_t)lua_tonumber(ls, 1);
+		if(opname != NULL && !sinsp_field_aggregator::parse_op(opname, &aggr_op))
+		{
+			throw sinsp_exception("chisel.add_aggregation(): unknown operation " + string(opname));
+		}
 
-		ASSERT(ch);
-		ASSERT(ch->m_lua_cinfo);
+		bool positive_only = (lua_toboolean(ls, 4) != 0);
+		sinsp_field_aggregator* aggr = new sinsp_field_aggregator(ch->m_inspector, aggr_op, positive_only);
 
-		ch->m_lua_cinfo->set_callback_interval(interval * 1000000000);
+		ch->m_allocated_aggregators.push_back(aggr);
 
-		return 0;
-	}
+		if(lua_istable(ls, 1))
+		{
+			uint32_t nkeys = (uint32_t)lua_objlen(ls, 1);
 
-	static int exec(lua_State *ls) 
-	{
-		lua_getglobal(ls, "sichisel");
+			for(uint32_t j = 1; j <= nkeys; j++)
+			{
+				lua_rawgeti(ls, 1, j);
+				const char* fld = lua_tostring(ls, -1);
 
-		sinsp_chisel* ch = (sinsp_chisel*)lua_touserdata(ls, -1);
-		lua_pop(ls, 1);
+				if(fld == NULL)
+				{
+					throw sinsp_exception("chisel.add_aggregation(): the keys must be field names");
+				}
 
-		ASSERT(ch);
-		ASSERT(ch->m_lua_cinfo);
+				aggr->add_key(fld);
+				lua_pop(ls, 1);
+			}
+		}
+		else if(lua_isstring(ls, 1))
+		{
+			aggr->add_key(lua_tostring(ls, 1));
+		}
 
-		const char* chname = lua_tostring(ls, 1);
-		if(chname == NULL)
+		if(aggr->get_nkeys() == 0)
 		{
-			throw sinsp_exception("invalid exec field name in chisel " + ch->m_filename);
+			throw sinsp_exception("chisel.add_aggregation() needs at least one key field");
 		}
 
-		ch->m_new_chisel_to_exec = chname;
+		const char* value = lua_tostring(ls, 2);
 
-		ch->m_argvals.clear();
-		uint32_t stackpos = 2;
+		if(value != NULL)
+		{
+			aggr->set_value(value);
+		}
+		else if(aggr_op != sinsp_field_aggregator::AO_COUNT)
+		{
+			throw sinsp_exception("chisel.add_aggregation() needs a value field");
+		}
 
-		while(true)
+		if(!lua_isnoneornil(ls, 5))
 		{
-			const char* argval = lua_tostring(ls, stackpos++);
-			if(argval == NULL)
+			int max_groups = (int)lua_tointeger(ls, 5);
+
+			if(max_groups <= 0)
 			{
-				break;
+				throw sinsp_exception("chisel.add_aggregation(): the maximum number of groups must be positive");
 			}
 
-			ch->m_argvals.push_back(argval);
+			aggr->set_max_groups((uint32_t)max_groups);
 		}
 
-		return 0;
+		aggr->set_scale_by_sampling(lua_toboolean(ls, 6) != 0);
+
+		lua_pushlightuserdata(ls, aggr);
+		return 1;
 	}
-};
 
-const static struct luaL_reg ll_sysdig [] = 
-{
-	{"set_filter", &lua_cbacks::set_global_filter},
+	//
+	// Push the key of a group of an aggregation: the value of the field
+	// like evt.field() gives it, or the values separated by spaces if the
+	// key has more than one field
+	//
+	static void aggregation_key_to_lua_stack(lua_State *ls, sinsp_field_aggregator* aggr, const string& key, vector<sinsp_field_value>* vals)
+	{
+		aggr->get_key_values(key, vals);
+
+		for(uint32_t j = 0; j < vals->size(); j++)
+		{
+			const sinsp_field_value* val = &vals->at(j);
+			char ipstr[16];
+
+			if(j > 0)
+			{
+				lua_pushstring(ls, " ");
+			}
+
+			switch(val->m_kind)
+			{
+			case SFV_INT:
+				lua_pushnumber(ls, (double)val->m_int);
+				break;
+			case SFV_UINT:
+				lua_pushnumber(ls, (double)val->m_uint);
+				break;
+			case SFV_BOOL:
+				if(vals->size() == 1)
+				{
+					lua_pushboolean(ls, val->m_uint != 0);
+				}
+				else
+				{
+					lua_pushstring(ls, (val->m_uint != 0)? "true" : "false");
+				}
+				break;
+			case SFV_IPV4:
+				snprintf(ipstr,
+					sizeof(ipstr),
+					"%u.%u.%u.%u",
+					(uint32_t)(val->m_uint >> 24) & 0xff,
+					(uint32_t)(val->m_uint >> 16) & 0xff,
+					(uint32_t)(val->m_uint >> 8) & 0xff,
+					(uint32_t)val->m_uint & 0xff);
+				lua_pushstring(ls, ipstr);
+				break;
+			default:
+				lua_pushlstring(ls, val->m_buf, val->m_len);
+				break;
+			}
+		}
+
+		if(vals->size() > 1)
+		{
+			lua_concat(ls, (int)vals->size() * 2 - 1);
+		}
+	}
+
+	//
+	// chisel.get_aggregation(aggr, top_number): return a table with the
+	// values of the top_number groups with the largest values, indexed by
+	// their keys, or of all the groups if top_number is 0 or missing
+	//
+	static int get_aggregation(lua_State *ls) 
+	{
+		sinsp_field_aggregator* aggr = (sinsp_field_aggregator*)lua_topointer(ls, 1);
+
+		if(aggr == NULL)
+		{
+			throw sinsp_exception("invalid call to chisel.get_aggregation()");
+		}
+
+		uint32_t n = (uint32_t)lua_tointeger(ls, 2);
+		vector<const sinsp_field_aggregator::entry*> top;
+		vector<sinsp_field_value> vals;
+
+		aggr->get_top(n, &top);
+
+		lua_createtable(ls, 0, top.size());
+
+		for(uint32_t j = 0; j < top.size(); j++)
+		{
+			aggregation_key_to_lua_stack(ls, aggr, top[j]->first, &vals);
+			lua_pushnumber(ls, top[j]->second);
+			lua_settable(ls, -3);
+		}
+
+		return 1;
+	}
+
+	//
+	// chisel.clear_aggregation(aggr): remove all the groups
+	//
+	static int clear_aggregation(lua_State *ls) 
+	{
+		sinsp_field_aggregator* aggr = (sinsp_field_aggregator*)lua_topointer(ls, 1);
+
+		if(aggr == NULL)
+		{
+			throw sinsp_exception("invalid call to chisel.clear_aggregation()");
+		}
+
+		aggr->clear();
+		return 0;
+	}
+
+	//
+	// chisel.get_aggregation_partial(aggr): return the groups as a string
+	// that chisel.merge_aggregation_partial() can add to the same
+	// aggregation on another host, see sinsp_field_aggregator::serialize()
+	//
+	static int get_aggregation_partial(lua_State *ls) 
+	{
+		sinsp_field_aggregator* aggr = (sinsp_field_aggregator*)lua_topointer(ls, 1);
+		string partial;
+
+		if(aggr == NULL)
+		{
+			throw sinsp_exception("invalid call to chisel.get_aggregation_partial()");
+		}
+
+		aggr->serialize(&partial);
+		lua_pushlstring(ls, partial.data(), partial.size());
+		return 1;
+	}
+
+	//
+	// chisel.merge_aggregation_partial(aggr, partial): add the groups of a
+	// partial. Returns false if the partial is not valid or comes from a
+	// different aggregation.
+	//
+	static int merge_aggregation_partial(lua_State *ls) 
+	{
+		sinsp_field_aggregator* aggr = (sinsp_field_aggregator*)lua_topointer(ls, 1);
+		size_t len;
+		const char* partial = lua_tolstring(ls, 2, &len);
+
+		if(aggr == NULL || partial == NULL)
+		{
+			throw sinsp_exception("invalid call to chisel.merge_aggregation_partial()");
+		}
+
+		lua_pushboolean(ls, aggr->merge_partial(partial, (uint32_t)len));
+		return 1;
+	}
+
+	//
+	// Return the string field name of the table at the top of the stack,
+	// or an empty string
+	//
+	static string get_string_field(lua_State *ls, const char* name)
+	{
+		string res;
+
+		lua_getfield(ls, -1, name);
+
+		if(lua_isstring(ls, -1))
+		{
+			res = lua_tostring(ls, -1);
+		}
+
+		lua_pop(ls, 1);
+		return res;
+	}
+
+	//
+	// chisel.add_table_view(aggr, columns, top_number, incremental): render
+	// the groups of an aggregation as a table, see sinsp_table_view.
+	// columns describes the key and the value of the table, like the info
+	// of the json output:
+	//   {{name = <key field>, desc = <key description>, is_key = true},
+	//    {name = <value field>, desc = <value description>, units = <units>}}
+	// where units is none, bytes, time or timepct. top_number limits the
+	// number of rows, 0 for all of them. If incremental is true, the
+	// renders after the first one only output what changed. The output is
+	// json if the inspector formats the events as json. Returns a handle
+	// for render_table_view().
+	//
+	static int add_table_view(lua_State *ls) 
+	{
+		lua_getglobal(ls, "sichisel");
+
+		sinsp_chisel* ch = (sinsp_chisel*)lua_touserdata(ls, -1);
+		lua_pop(ls, 1);
+
+		sinsp_field_aggregator* aggr = (sinsp_field_aggregator*)lua_topointer(ls, 1);
+
+		if(aggr == NULL || !lua_istable(ls, 2))
+		{
+			throw sinsp_exception("invalid call to chisel.add_table_view()");
+		}
+
+		bool json = (ch->m_inspector->get_buffer_format() & sinsp_evt::PF_JSON) != 0;
+		sinsp_table_view* view = new sinsp_table_view(aggr, json, lua_toboolean(ls, 4) != 0);
+
+		ch->m_allocated_table_views.push_back(view);
+
+		uint32_t ncols = (uint32_t)lua_objlen(ls, 2);
+
+		for(uint32_t j = 1; j <= ncols; j++)
+		{
+			lua_rawgeti(ls, 2, j);
+
+			if(!lua_istable(ls, -1))
+			{
+				throw sinsp_exception("chisel.add_table_view(): the columns must be tables");
+			}
+
+			string name = get_string_field(ls, "name");
+			string desc = get_string_field(ls, "desc");
+
+			lua_getfield(ls, -1, "is_key");
+			bool is_key = (lua_toboolean(ls, -1) != 0);
+			lua_pop(ls, 1);
+
+			if(is_key)
+			{
+				view->set_key(name, desc);
+			}
+			else
+			{
+				string units = get_string_field(ls, "units");
+				sinsp_table_view::units value_units = sinsp_table_view::TU_NONE;
+
+				if(!units.empty() && !sinsp_table_view::parse_units(units, &value_units))
+				{
+					throw sinsp_exception("chisel.add_table_view(): unknown units " + units);
+				}
+
+				view->set_value(name, desc, value_units);
+			}
+
+			lua_pop(ls, 1);
+		}
+
+		view->set_top_number((uint32_t)lua_tointeger(ls, 3));
+
+		lua_pushlightuserdata(ls, view);
+		return 1;
+	}
+
+	//
+	// chisel.render_table_view(view, ts_s, ts_ns, delta): return the
+	// rendering of the current groups of the aggregation of the view, to be
+	// written as is. delta is the duration of the interval in nanoseconds.
+	//
+	static int render_table_view(lua_State *ls) 
+	{
+		sinsp_table_view* view = (sinsp_table_view*)lua_topointer(ls, 1);
+
+		if(view == NULL)
+		{
+			throw sinsp_exception("invalid call to chisel.render_table_view()");
+		}
+
+		uint64_t ts = (uint64_t)lua_tointeger(ls, 2) * ONE_SECOND_IN_NS + (uint64_t)lua_tointeger(ls, 3);
+		uint64_t delta = (uint64_t)lua_tonumber(ls, 4);
+		string res;
+
+		view->render(ts, delta, &res);
+
+		lua_pushlstring(ls, res.data(), res.size());
+		return 1;
+	}
+
+	//
+	// chisel.add_rollup(name, keys, value, op): add a metric to the rollup
+	// of the inspector, see sinsp_rollup::add_metric(). keys is a field
+	// name or a table of them, value can be nil for count, and op is sum
+	// (the default), count, min, max or a percentile like p99. If another
+	// chisel already added a metric with the same name, that one is used
+	// and the arguments are ignored.
+	//
+	static int add_rollup(lua_State *ls) 
+	{
+		lua_getglobal(ls, "sichisel");
+
+		sinsp_chisel* ch = (sinsp_chisel*)lua_touserdata(ls, -1);
+		lua_pop(ls, 1);
+
+		const char* name = lua_tostring(ls, 1);
+
+		if(name == NULL)
+		{
+			throw sinsp_exception("chisel.add_rollup() needs a metric name");
+		}
+
+		sinsp_rollup* rollup = ch->m_inspector->get_rollup();
+
+		if(rollup->find_metric(name) != -1)
+		{
+			return 0;
+		}
+
+		vector<string> keys;
+
+		if(lua_istable(ls, 2))
+		{
+			uint32_t nkeys = (uint32_t)lua_objlen(ls, 2);
+
+			for(uint32_t j = 1; j <= nkeys; j++)
+			{
+				lua_rawgeti(ls, 2, j);
+				const char* fld = lua_tostring(ls, -1);
+
+				if(fld == NULL)
+				{
+					throw sinsp_exception("chisel.add_rollup(): the keys must be field names");
+				}
+
+				keys.push_back(fld);
+				lua_pop(ls, 1);
+			}
+		}
+		else if(lua_isstring(ls, 2))
+		{
+			keys.push_back(lua_tostring(ls, 2));
+		}
+
+		const char* value = lua_tostring(ls, 3);
+		const char* op = lua_tostring(ls, 4);
+
+		rollup->add_metric(name, keys, (value != NULL)? value : "", (op != NULL)? op : "sum");
+		return 0;
+	}
+
+	//
+	// chisel.get_rollup(name, top_number): return a table with the values
+	// of the top_number groups of a rollup metric with the largest values in
+	// the last interval that ended, indexed by their keys, or of all the
+	// groups if top_number is 0 or missing. The keys are strings, with the
+	// values of the fields separated by spaces. The groups of an interval
+	// can be read until the end of the next one, so a chisel that runs in a
+	// thread of its own must not fall behind by more than that.
+	//
+	static int get_rollup(lua_State *ls) 
+	{
+		lua_getglobal(ls, "sichisel");
+
+		sinsp_chisel* ch = (sinsp_chisel*)lua_touserdata(ls, -1);
+		lua_pop(ls, 1);
+
+		const char* name = lua_tostring(ls, 1);
+		sinsp_rollup* rollup = ch->m_inspector->get_rollup();
+		int32_t metric = (name != NULL)? rollup->find_metric(name) : -1;
+
+		if(metric == -1)
+		{
+			throw sinsp_exception(string("chisel.get_rollup(): unknown metric ") + ((name != NULL)? name : ""));
+		}
+
+		uint32_t n = (uint32_t)lua_tointeger(ls, 2);
+		vector<sinsp_rollup::group> groups;
+
+		rollup->get_groups((uint32_t)metric, n, &groups);
+
+		lua_createtable(ls, 0, groups.size());
+
+		for(uint32_t j = 0; j < groups.size(); j++)
+		{
+			lua_pushlstring(ls, groups[j].first.c_str(), groups[j].first.size());
+			lua_pushnumber(ls, groups[j].second);
+			lua_settable(ls, -3);
+		}
+
+		return 1;
+	}
+
+	//
+	// Return the sketch that is the first argument, checking its type
+	//
+	static sinsp_sketch* get_sketch_arg(lua_State *ls, const char* fn, int type)
+	{
+		sinsp_sketch* sketch = (sinsp_sketch*)lua_topointer(ls, 1);
+
+		if(sketch == NULL || (type != -1 && sketch->get_type() != type))
+		{
+			throw sinsp_exception(string("invalid call to chisel.") + fn + "()");
+		}
+
+		return sketch;
+	}
+
+	static int push_sketch(lua_State *ls, sinsp_sketch* sketch)
+	{
+		lua_getglobal(ls, "sichisel");
+
+		sinsp_chisel* ch = (sinsp_chisel*)lua_touserdata(ls, -1);
+		lua_pop(ls, 1);
+
+		ch->m_allocated_sketches.push_back(sketch);
+
+		lua_pushlightuserdata(ls, sketch);
+		return 1;
+	}
+
+	//
+	// Return the integer argument n, or def if it's missing
+	//
+	static uint32_t get_size_arg(lua_State *ls, int n, uint32_t def, const char* fn)
+	{
+		if(lua_isnoneornil(ls, n))
+		{
+			return def;
+		}
+
+		int res = (int)lua_tointeger(ls, n);
+
+		if(res <= 0)
+		{
+			throw sinsp_exception(string("chisel.") + fn + "(): the sizes must be positive");
+		}
+
+		return (uint32_t)res;
+	}
+
+	//
+	// chisel.new_topk(capacity): create a summary of the capacity keys with
+	// the largest weights, see sinsp_topk
+	//
+	static int new_topk(lua_State *ls) 
+	{
+		uint32_t capacity = get_size_arg(ls, 1, 0, "new_topk");
+
+		if(capacity == 0)
+		{
+			throw sinsp_exception("chisel.new_topk() needs a capacity");
+		}
+
+		return push_sketch(ls, new sinsp_topk(capacity));
+	}
+
+	//
+	// chisel.new_countmin(width, depth): create a Count-Min sketch, which
+	// estimates the weight of any key, see sinsp_countmin
+	//
+	static int new_countmin(lua_State *ls) 
+	{
+		uint32_t width = get_size_arg(ls, 1, SP_COUNTMIN_DEFAULT_WIDTH, "new_countmin");
+		uint32_t depth = get_size_arg(ls, 2, SP_COUNTMIN_DEFAULT_DEPTH, "new_countmin");
+
+		return push_sketch(ls, new sinsp_countmin(width, depth));
+	}
+
+	//
+	// chisel.new_hll(precision): create a HyperLogLog sketch, which
+	// estimates the number of distinct keys, see sinsp_hyperloglog
+	//
+	static int new_hll(lua_State *ls) 
+	{
+		uint32_t precision = get_size_arg(ls, 1, SP_HLL_DEFAULT_PRECISION, "new_hll");
+
+		return push_sketch(ls, new sinsp_hyperloglog(precision));
+	}
+
+	//
+	// chisel.sketch_add(sketch, key, weight): add weight occurrences of the
+	// key, a string or a number, 1 by default
+	//
+	static int sketch_add(lua_State *ls) 
+	{
+		sinsp_sketch* sketch = get_sketch_arg(ls, "sketch_add", -1);
+		size_t len;
+		const char* key = lua_tolstring(ls, 2, &len);
+
+		if(key == NULL)
+		{
+			throw sinsp_exception("chisel.sketch_add() needs a string or a number key");
+		}
+
+		double weight = lua_isnoneornil(ls, 3)? 1 : lua_tonumber(ls, 3);
+
+		sketch->add(key, (uint32_t)len, weight);
+		return 0;
+	}
+
+	//
+	// chisel.clear_sketch(sketch): forget all the keys
+	//
+	static int clear_sketch(lua_State *ls) 
+	{
+		get_sketch_arg(ls, "clear_sketch", -1)->clear();
+		return 0;
+	}
+
+	//
+	// chisel.get_sketch_partial(sketch): return the state of the sketch as
+	// a string that chisel.merge_sketch_partial() can add to a sketch of
+	// the same type on another host
+	//
+	static int get_sketch_partial(lua_State *ls) 
+	{
+		string partial;
+
+		get_sketch_arg(ls, "get_sketch_partial", -1)->get_partial(&partial);
+		lua_pushlstring(ls, partial.data(), partial.size());
+		return 1;
+	}
+
+	//
+	// chisel.merge_sketch_partial(sketch, partial): add the keys of a
+	// partial. Returns false if the partial is not valid, or if its sketch
+	// has a different type or size.
+	//
+	static int merge_sketch_partial(lua_State *ls) 
+	{
+		sinsp_sketch* sketch = get_sketch_arg(ls, "merge_sketch_partial", -1);
+		size_t len;
+		const char* partial = lua_tolstring(ls, 2, &len);
+
+		if(partial == NULL)
+		{
+			throw sinsp_exception("invalid call to chisel.merge_sketch_partial()");
+		}
+
+		lua_pushboolean(ls, sketch->merge_partial(partial, (uint32_t)len));
+		return 1;
+	}
+
+	//
+	// chisel.get_topk(topk, top_number): return a table with the counts of
+	// the top_number keys with the largest counts, indexed by the keys, or
+	// of all the keys that are counted if top_number is 0 or missing
+	//
+	static int get_topk(lua_State *ls) 
+	{
+		sinsp_topk* topk = (sinsp_topk*)get_sketch_arg(ls, "get_topk", sinsp_sketch::ST_TOPK);
+		uint32_t n = (uint32_t)lua_tointeger(ls, 2);
+		vector<const sinsp_topk::entry*> top;
+
+		topk->get_top(n, &top);
+
+		lua_createtable(ls, 0, top.size());
+
+		for(uint32_t j = 0; j < top.size(); j++)
+		{
+			lua_pushlstring(ls, top[j]->m_key.data(), top[j]->m_key.size());
+			lua_pushnumber(ls, top[j]->m_count);
+			lua_settable(ls, -3);
+		}
+
+		return 1;
+	}
+
+	//
+	// chisel.get_estimate(sketch, key): return the estimated weight of the
+	// key for a Count-Min sketch or a top-k summary (0 if the key is not
+	// in it), or the estimated number of distinct keys for a HyperLogLog
+	// sketch, which has no key argument
+	//
+	static int get_estimate(lua_State *ls) 
+	{
+		sinsp_sketch* sketch = get_sketch_arg(ls, "get_estimate", -1);
+		size_t len = 0;
+		const char* key = NULL;
+
+		if(sketch->get_type() != sinsp_sketch::ST_HLL)
+		{
+			key = lua_tolstring(ls, 2, &len);
+
+			if(key == NULL)
+			{
+				throw sinsp_exception("chisel.get_estimate() needs a string or a number key");
+			}
+		}
+
+		switch(sketch->get_type())
+		{
+		case sinsp_sketch::ST_TOPK:
+			{
+				const sinsp_topk::entry* e = ((sinsp_topk*)sketch)->find(string(key, len));
+				lua_pushnumber(ls, (e != NULL)? e->m_count : 0);
+			}
+			break;
+		case sinsp_sketch::ST_COUNTMIN:
+			lua_pushnumber(ls, ((sinsp_countmin*)sketch)->estimate(key, (uint32_t)len));
+			break;
+		case sinsp_sketch::ST_HLL:
+			lua_pushnumber(ls, ((sinsp_hyperloglog*)sketch)->estimate());
+			break;
+		default:
+			ASSERT(false);
+			lua_pushnil(ls);
+			break;
+		}
+
+		return 1;
+	}
+
+	static int set_global_filter(lua_State *ls) 
+	{
+		lua_getglobal(ls, "sichisel");
+
+		sinsp_chisel* ch = (sinsp_chisel*)lua_touserdata(ls, -1);
+		lua_pop(ls, 1);
+
+		const char* filter = lua_tostring(ls, 1); 
+
+		ASSERT(ch);
+		ASSERT(ch->m_lua_cinfo);
+
+		ch->m_inspector->set_filter(filter);
+
+		return 0;
+	}
+
+	static int set_filter(lua_State *ls) 
+	{
+		lua_getglobal(ls, "sichisel");
+
+		sinsp_chisel* ch = (sinsp_chisel*)lua_touserdata(ls, -1);
+		lua_pop(ls, 1);
+
+		const char* filter = lua_tostring(ls, 1); 
+
+		ASSERT(ch);
+		ASSERT(ch->m_lua_cinfo);
+
+		ch->m_lua_cinfo->set_filter(filter);
+
+		return 0;
+	}
+
+	static int set_snaplen(lua_State *ls) 
+	{
+		lua_getglobal(ls, "sichisel");
+
+		sinsp_chisel* ch = (sinsp_chisel*)lua_touserdata(ls, -1);
+		lua_pop(ls, 1);
+
+		const uint32_t snaplen = lua_tointeger(ls, 1); 
+
+		ASSERT(ch);
+		ASSERT(ch->m_lua_cinfo);
+
+		ch->m_inspector->set_snaplen(snaplen);
+
+		return 0;
+	}
+
+	static int set_runq_summary(lua_State *ls) 
+	{
+		lua_getglobal(ls, "sichisel");
+
+		sinsp_chisel* ch = (sinsp_chisel*)lua_touserdata(ls, -1);
+		lua_pop(ls, 1);
+
+		const uint32_t interval_ms = lua_tointeger(ls, 1); 
+
+		ASSERT(ch);
+		ASSERT(ch->m_lua_cinfo);
+
+		//
+		// The trace files already have the runq events that were captured,
+		// if any, so the request is only for live captures
+		//
+		try
+		{
+			ch->m_inspector->set_runq_summary(interval_ms);
+		}
+		catch(sinsp_exception&)
+		{
+			if(ch->m_inspector->is_live())
+			{
+				throw;
+			}
+		}
+
+		return 0;
+	}
+
+	static int set_pgfault_summary(lua_State *ls) 
+	{
+		lua_getglobal(ls, "sichisel");
+
+		sinsp_chisel* ch = (sinsp_chisel*)lua_touserdata(ls, -1);
+		lua_pop(ls, 1);
+
+		const uint32_t interval_ms = lua_tointeger(ls, 1); 
+
+		ASSERT(ch);
+		ASSERT(ch->m_lua_cinfo);
+
+		//
+		// Like the run queue summaries, only live captures can be asked
+		// for them
+		//
+		try
+		{
+			ch->m_inspector->set_pgfault_summary(interval_ms);
+		}
+		catch(sinsp_exception&)
+		{
+			if(ch->m_inspector->is_live())
+			{
+				throw;
+			}
+		}
+
+		return 0;
+	}
+
+	static int set_syscall_aggregation(lua_State *ls) 
+	{
+		lua_getglobal(ls, "sichisel");
+
+		sinsp_chisel* ch = (sinsp_chisel*)lua_touserdata(ls, -1);
+		lua_pop(ls, 1);
+
+		bool per_process = (lua_toboolean(ls, 1) != 0);
+
+		ASSERT(ch);
+		ASSERT(ch->m_lua_cinfo);
+
+		ch->m_inspector->set_syscall_aggregation(true, per_process);
+
+		return 0;
+	}
+
+	static int get_syscall_aggregation(lua_State *ls) 
+	{
+		lua_getglobal(ls, "sichisel");
+
+		sinsp_chisel* ch = (sinsp_chisel*)lua_touserdata(ls, -1);
+		lua_pop(ls, 1);
+
+		ASSERT(ch);
+		ASSERT(ch->m_lua_cinfo);
+
+		vector<ppm_syscall_aggr_entry> entries;
+		const ppm_syscall_desc* sc_table = ch->m_inspector->get_event_info_tables()->m_syscall_info_table;
+		uint32_t j;
+		uint32_t k;
+
+		ch->m_inspector->get_syscall_aggregation(&entries);
+
+		//
+		// Return an array of tables, one per system call or per process
+		// and system call
+		//
+		lua_newtable(ls);
+
+		for(j = 0; j < entries.size(); j++)
+		{
+			const ppm_syscall_aggr_entry* e = &entries[j];
+
+			lua_newtable(ls);
+			lua_pushstring(ls, "name");
+			lua_pushstring(ls, (e->ppm_sc < PPM_SC_MAX)? sc_table[e->ppm_sc].name : "<unknown>");
+			lua_settable(ls, -3);
+			lua_pushstring(ls, "pid");
+			lua_pushnumber(ls, e->tgid);
+			lua_settable(ls, -3);
+			lua_pushstring(ls, "calls");
+			lua_pushnumber(ls, (double)e->n_calls);
+			lua_settable(ls, -3);
+			lua_pushstring(ls, "errors");
+			lua_pushnumber(ls, (double)e->n_errors);
+			lua_settable(ls, -3);
+			lua_pushstring(ls, "time_ns");
+			lua_pushnumber(ls, (double)e->total_ns);
+			lua_settable(ls, -3);
+
+			lua_pushstring(ls, "latency");
+			lua_newtable(ls);
+			for(k = 0; k < PPM_AGGR_LATENCY_BUCKETS; k++)
+			{
+				lua_pushnumber(ls, (double)e->latency[k]);
+				lua_rawseti(ls, -2, k + 1);
+			}
+			lua_settable(ls, -3);
+
+			lua_rawseti(ls, -2, j + 1);
+		}
+
+		return 1;
+	}
+
+	static int make_ts(lua_State *ls) 
+	{
+		lua_getglobal(ls, "sichisel");
+
+		uint32_t op1 = lua_tointeger(ls, 1);
+		lua_pop(ls, 1);
+		uint32_t op2 = lua_tointeger(ls, 2);
+		lua_pop(ls, 1);
+
+		uint64_t sum = (uint64_t)op1 * ONE_SECOND_IN_NS + op2;
+
+		lua_pushstring(ls, to_string(sum).c_str());
+		return 1;
+	}
+
+	static int is_live(lua_State *ls) 
+	{
+		lua_getglobal(ls, "sichisel");
+
+		sinsp_chisel* ch = (sinsp_chisel*)lua_touserdata(ls, -1);
+		lua_pop(ls, 1);
+
+		ASSERT(ch);
+		ASSERT(ch->m_lua_cinfo);
+
+		lua_pushboolean(ls, ch->m_inspector->is_live());
+		return 1;
+	}
+
+	static int get_sampling_ratio(lua_State *ls) 
+	{
+		lua_getglobal(ls, "sichisel");
+
+		sinsp_chisel* ch = (sinsp_chisel*)lua_touserdata(ls, -1);
+		lua_pop(ls, 1);
+
+		ASSERT(ch);
+		ASSERT(ch->m_lua_cinfo);
+
+		lua_pushnumber(ls, ch->m_inspector->get_sampling_ratio());
+		return 1;
+	}
+
+	//
+	// sysdig.get_proc_costs(): return an array of tables with what it cost
+	// to observe each process since the start of the capture. time_ns is
+	// extrapolated from the events whose parsing was timed.
+	//
+	static int get_proc_costs(lua_State *ls) 
+	{
+		lua_getglobal(ls, "sichisel");
+
+		sinsp_chisel* ch = (sinsp_chisel*)lua_touserdata(ls, -1);
+		lua_pop(ls, 1);
+
+		ASSERT(ch);
+		ASSERT(ch->m_lua_cinfo);
+
+		const unordered_map<int64_t, sinsp_metrics::proc_cost>& procs = ch->m_inspector->get_metrics()->get_proc_costs();
+		unordered_map<int64_t, sinsp_metrics::proc_cost>::const_iterator it;
+		uint32_t j = 0;
+
+		lua_newtable(ls);
+
+		for(it = procs.begin(); it != procs.end(); ++it)
+		{
+			lua_newtable(ls);
+			lua_pushstring(ls, "pid");
+			lua_pushnumber(ls, (double)it->first);
+			lua_settable(ls, -3);
+			lua_pushstring(ls, "name");
+			lua_pushstring(ls, it->second.m_comm.c_str());
+			lua_settable(ls, -3);
+			lua_pushstring(ls, "events");
+			lua_pushnumber(ls, (double)it->second.m_n_evts);
+			lua_settable(ls, -3);
+			lua_pushstring(ls, "bytes");
+			lua_pushnumber(ls, (double)it->second.m_bytes);
+			lua_settable(ls, -3);
+			lua_pushstring(ls, "time_ns");
+			lua_pushnumber(ls, (double)it->second.get_est_ns());
+			lua_settable(ls, -3);
+
+			lua_rawseti(ls, -2, ++j);
+		}
+
+		return 1;
+	}
+
+	//
+	// sysdig.get_evttype_costs(): same as get_proc_costs(), by event type
+	//
+	static int get_evttype_costs(lua_State *ls) 
+	{
+		lua_getglobal(ls, "sichisel");
+
+		sinsp_chisel* ch = (sinsp_chisel*)lua_touserdata(ls, -1);
+		lua_pop(ls, 1);
+
+		ASSERT(ch);
+		ASSERT(ch->m_lua_cinfo);
+
+		sinsp_metrics* metrics = ch->m_inspector->get_metrics();
+		const struct ppm_event_info* etable = ch->m_inspector->get_event_info_tables()->m_event_info;
+		uint32_t j;
+		uint32_t k = 0;
+
+		lua_newtable(ls);
+
+		for(j = 0; j < PPM_EVENT_MAX; j++)
+		{
+			uint64_t nevts = metrics->get_n_evts(j);
+
+			if(nevts == 0)
+			{
+				continue;
+			}
+
+			//
+			// Scale the sampled time by the share of the events of this type
+			// that were timed
+			//
+			uint64_t nsamples = metrics->get_parser_samples(j);
+			uint64_t time_ns = nsamples? (uint64_t)((double)metrics->get_parser_sampled_ns(j) * nevts / nsamples) : 0;
+
+			lua_newtable(ls);
+			lua_pushstring(ls, "name");
+			lua_pushstring(ls, etable[j].name);
+			lua_settable(ls, -3);
+			lua_pushstring(ls, "dir");
+			lua_pushstring(ls, PPME_IS_ENTER(j)? ">" : "<");
+			lua_settable(ls, -3);
+			lua_pushstring(ls, "events");
+			lua_pushnumber(ls, (double)nevts);
+			lua_settable(ls, -3);
+			lua_pushstring(ls, "bytes");
+			lua_pushnumber(ls, (double)metrics->get_evt_bytes(j));
+			lua_settable(ls, -3);
+			lua_pushstring(ls, "time_ns");
+			lua_pushnumber(ls, (double)time_ns);
+			lua_settable(ls, -3);
+
+			lua_rawseti(ls, -2, ++k);
+		}
+
+		return 1;
+	}
+
+	static int get_machine_info(lua_State *ls) 
+	{
+		lua_getglobal(ls, "sichisel");
+
+		sinsp_chisel* ch = (sinsp_chisel*)lua_touserdata(ls, -1);
+		lua_pop(ls, 1);
+
+		ASSERT(ch);
+		ASSERT(ch->m_lua_cinfo);
+
+		const scap_machine_info* minfo = ch->m_inspector->get_machine_info();
+
+		lua_newtable(ls);
+		lua_pushstring(ls, "num_cpus");
+		lua_pushnumber(ls, minfo->num_cpus);
+		lua_settable(ls, -3);
+		lua_pushstring(ls, "memory_size_bytes");
+		lua_pushnumber(ls, (double)minfo->memory_size_bytes);
+		lua_settable(ls, -3);
+		lua_pushstring(ls, "max_pid");
+		lua_pushnumber(ls, (double)minfo->max_pid);
+		lua_settable(ls, -3);
+		lua_pushstring(ls, "hostname");
+		lua_pushstring(ls, minfo->hostname);
+		lua_settable(ls, -3);
+
+		return 1;
+	}
+
+	static int get_output_format(lua_State *ls) 
+	{
+		lua_getglobal(ls, "sichisel");
+
+		sinsp_chisel* ch = (sinsp_chisel*)lua_touserdata(ls, -1);
+		lua_pop(ls, 1);
+
+		ASSERT(ch);
+		ASSERT(ch->m_lua_cinfo);
+
+		sinsp_evt::param_fmt fmt = ch->m_inspector->get_buffer_format();
+
+		if(fmt & sinsp_evt::PF_JSON)
+		{
+			lua_pushstring(ls, "json");
+		}
+		else
+		{
+			lua_pushstring(ls, "normal");
+		}
+
+		return 1;
+	}
+
+	static int set_event_formatter(lua_State *ls) 
+	{
+		lua_getglobal(ls, "sichisel");
+
+		sinsp_chisel* ch = (sinsp_chisel*)lua_touserdata(ls, -1);
+		lua_pop(ls, 1);
+
+		const char* formatter = lua_tostring(ls, 1); 
+
+		ASSERT(ch);
+		ASSERT(ch->m_lua_cinfo);
+
+		ch->m_lua_cinfo->set_formatter(formatter);
+
+		return 0;
+	}
+
+	static int set_interval_ns(lua_State *ls) 
+	{
+		lua_getglobal(ls, "sichisel");
+
+		sinsp_chisel* ch = (sinsp_chisel*)lua_touserdata(ls, -1);
+		lua_pop(ls, 1);
+
+		uint64_t interval = (uint64_t)lua_tonumber(ls, 1);
+
+		ASSERT(ch);
+		ASSERT(ch->m_lua_cinfo);
+
+		ch->m_lua_cinfo->set_callback_interval(interval);
+
+		return 0;
+	}
+
+	static int set_interval_s(lua_State *ls) 
+	{
+		lua_getglobal(ls, "sichisel");
+
+		sinsp_chisel* ch = (sinsp_chisel*)lua_touserdata(ls, -1);
+		lua_pop(ls, 1);
+
+		uint64_t interval = (uint64_t)lua_tonumber(ls, 1);
+
+		ASSERT(ch);
+		ASSERT(ch->m_lua_cinfo);
+
+		ch->m_lua_cinfo->set_callback_interval(interval * 1000000000);
+
+		return 0;
+	}
+
+	static int exec(lua_State *ls) 
+	{
+		lua_getglobal(ls, "sichisel");
+
+		sinsp_chisel* ch = (sinsp_chisel*)lua_touserdata(ls, -1);
+		lua_pop(ls, 1);
+
+		ASSERT(ch);
+		ASSERT(ch->m_lua_cinfo);
+
+		const char* chname = lua_tostring(ls, 1);
+		if(chname == NULL)
+		{
+			throw sinsp_exception("invalid exec field name in chisel " + ch->m_filename);
+		}
+
+		ch->m_new_chisel_to_exec = chname;
+
+		ch->m_argvals.clear();
+		uint32_t stackpos = 2;
+
+		while(true)
+		{
+			const char* argval = lua_tostring(ls, stackpos++);
+			if(argval == NULL)
+			{
+				break;
+			}
+
+			ch->m_argvals.push_back(argval);
+		}
+
+		return 0;
+	}
+
+	//
+	// chisel.subscribe(channel, fn): call fn(record, channel) for each record
+	// that the other chisels of the inspector emit on channel. This way a
+	// chisel can build on what another one derived from the events, e.g.
+	// transactions, without filtering the events and extracting their
+	// fields again. Subscribing again to a channel replaces the callback.
+	//
+	static int subscribe(lua_State *ls) 
+	{
+		lua_getglobal(ls, "sichisel");
+
+		sinsp_chisel* ch = (sinsp_chisel*)lua_touserdata(ls, -1);
+		lua_pop(ls, 1);
+
+		ASSERT(ch);
+
+		const char* channel = lua_tostring(ls, 1);
+		if(channel == NULL || !lua_isfunction(ls, 2))
+		{
+			throw sinsp_exception("invalid call to chisel.subscribe() in chisel " + ch->m_filename);
+		}
+
+		lua_pushvalue(ls, 2);
+		ch->subscribe(channel, luaL_ref(ls, LUA_REGISTRYINDEX));
+		return 0;
+	}
+
+	//
+	// chisel.emit(channel, record): give a copy of record, a table of plain
+	// data, to the chisels subscribed to channel, before returning. Returns
+	// how many chisels got it.
+	//
+	static int emit(lua_State *ls) 
+	{
+		lua_getglobal(ls, "sichisel");
+
+		sinsp_chisel* ch = (sinsp_chisel*)lua_touserdata(ls, -1);
+		lua_pop(ls, 1);
+
+		ASSERT(ch);
+
+		const char* channel = lua_tostring(ls, 1);
+		if(channel == NULL || !lua_istable(ls, 2))
+		{
+			throw sinsp_exception("invalid call to chisel.emit() in chisel " + ch->m_filename);
+		}
+
+		lua_pushnumber(ls, ch->emit(channel, ls, 2));
+		return 1;
+	}
+};
+
+const static struct luaL_reg ll_sysdig [] = 
+{
+	{"set_filter", &lua_cbacks::set_global_filter},
 	{"set_snaplen", &lua_cbacks::set_snaplen},
+	{"set_runq_summary", &lua_cbacks::set_runq_summary},
+	{"set_pgfault_summary", &lua_cbacks::set_pgfault_summary},
 	{"is_live", &lua_cbacks::is_live},
+	{"get_sampling_ratio", &lua_cbacks::get_sampling_ratio},
 	{"get_machine_info", &lua_cbacks::get_machine_info},
+	{"get_proc_costs", &lua_cbacks::get_proc_costs},
+	{"get_evttype_costs", &lua_cbacks::get_evttype_costs},
 	{"get_output_format", &lua_cbacks::get_output_format},
 	{"make_ts", &lua_cbacks::make_ts},
+	{"set_syscall_aggregation", &lua_cbacks::set_syscall_aggregation},
+	{"get_syscall_aggregation", &lua_cbacks::get_syscall_aggregation},
 	{NULL,NULL}
 };
 
 const static struct luaL_reg ll_chisel [] = 
 {
 	{"request_field", &lua_cbacks::request_field},
+	{"request_matcher", &lua_cbacks::request_matcher},
+	{"get_field_value_fn", &lua_cbacks::get_field_value_fn},
+	{"get_ffi_fn", &lua_cbacks::get_ffi_fn},
+	{"add_aggregation", &lua_cbacks::add_aggregation},
+	{"get_aggregation", &lua_cbacks::get_aggregation},
+	{"clear_aggregation", &lua_cbacks::clear_aggregation},
+	{"get_aggregation_partial", &lua_cbacks::get_aggregation_partial},
+	{"merge_aggregation_partial", &lua_cbacks::merge_aggregation_partial},
+	{"add_table_view", &lua_cbacks::add_table_view},
+	{"render_table_view", &lua_cbacks::render_table_view},
+	{"add_rollup", &lua_cbacks::add_rollup},
+	{"get_rollup", &lua_cbacks::get_rollup},
+	{"new_topk", &lua_cbacks::new_topk},
+	{"new_countmin", &lua_cbacks::new_countmin},
+	{"new_hll", &lua_cbacks::new_hll},
+	{"sketch_add", &lua_cbacks::sketch_add},
+	{"clear_sketch", &lua_cbacks::clear_sketch},
+	{"get_sketch_partial", &lua_cbacks::get_sketch_partial},
+	{"merge_sketch_partial", &lua_cbacks::merge_sketch_partial},
+	{"get_topk", &lua_cbacks::get_topk},
+	{"get_estimate", &lua_cbacks::get_estimate},
 	{"set_filter", &lua_cbacks::set_filter},
 	{"set_event_formatter", &lua_cbacks::set_event_formatter},
 	{"set_interval_ns", &lua_cbacks::set_interval_ns},
 	{"set_interval_s", &lua_cbacks::set_interval_s},
 	{"exec", &lua_cbacks::exec},
+	{"subscribe", &lua_cbacks::subscribe},
+	{"emit", &lua_cbacks::emit},
 	{NULL,NULL}
 };
 
 const static struct luaL_reg ll_evt [] = 
 {
 	{"field", &lua_cbacks::field},
+	{"match", &lua_cbacks::match},
 	{"get_num", &lua_cbacks::get_num},
 	{"get_ts", &lua_cbacks::get_ts},
 	{"get_type", &lua_cbacks::get_type},
@@ -736,10 +2033,20 @@ sinsp_chisel::sinsp_chisel(sinsp* inspector, string filename)
 	m_root = NULL;
 	m_ls = NULL;
 	m_lua_has_handle_evt = false;
+#ifdef HAS_LUA_CHISELS
+	m_lua_on_event_ref = LUA_NOREF;
+	m_lua_on_events_ref = LUA_NOREF;
+#endif
+	m_lua_batch_nevts = 0;
 	m_lua_is_first_evt = true;
 	m_lua_cinfo = NULL;
 	m_lua_last_interval_sample_time = 0;
 	m_lua_last_interval_ts = 0;
+	m_lua_merged_lastevent_ts = 0;
+	memset(&m_lua_stats, 0, sizeof(m_lua_stats));
+	m_lua_gc_mem_bytes = 0;
+	m_thread = NULL;
+	m_lua_pipeline_busy = false;
 
 	load(filename);
 }
@@ -756,24 +2063,58 @@ sinsp_chisel::~sinsp_chisel()
 		delete m_root;
 	}
 
+	stop_thread();
 	free_lua_chisel();
 }
 
 void sinsp_chisel::free_lua_chisel()
 {
 #ifdef HAS_LUA_CHISELS
+	unsubscribe_all();
+
 	if(m_ls)
 	{
 		lua_close(m_ls);
 		m_ls = NULL;
 	}
 
+	m_lua_has_handle_evt = false;
+	m_lua_on_event_ref = LUA_NOREF;
+	m_lua_on_events_ref = LUA_NOREF;
+	m_lua_batch.clear();
+	m_lua_batch_bufs.clear();
+	m_lua_batch_nevts = 0;
+
 	for(uint32_t j = 0; j < m_allocated_fltchecks.size(); j++)
 	{
 		delete m_allocated_fltchecks[j];
 	}
 	m_allocated_fltchecks.clear();
 
+	for(uint32_t j = 0; j < m_allocated_matchers.size(); j++)
+	{
+		delete m_allocated_matchers[j];
+	}
+	m_allocated_matchers.clear();
+
+	for(uint32_t j = 0; j < m_allocated_aggregators.size(); j++)
+	{
+		delete m_allocated_aggregators[j];
+	}
+	m_allocated_aggregators.clear();
+
+	for(uint32_t j = 0; j < m_allocated_table_views.size(); j++)
+	{
+		delete m_allocated_table_views[j];
+	}
+	m_allocated_table_views.clear();
+
+	for(uint32_t j = 0; j < m_allocated_sketches.size(); j++)
+	{
+		delete m_allocated_sketches[j];
+	}
+	m_allocated_sketches.clear();
+
 	if(m_lua_cinfo != NULL)
 	{
 		delete m_lua_cinfo; 
@@ -785,6 +2126,66 @@ void sinsp_chisel::free_lua_chisel()
 }
 
 #ifdef HAS_LUA_CHISELS
+//
+// Push on the dst stack a copy of the value at index idx of the src stack.
+// Only plain data crosses the states: functions, userdata and threads become
+// nil, and so do tables nested too deep (e.g. because they have cycles).
+//
+static void copy_lua_value(lua_State* src, int idx, lua_State* dst, uint32_t depth = 0)
+{
+	if(idx < 0)
+	{
+		idx = lua_gettop(src) + idx + 1;
+	}
+
+	switch(lua_type(src, idx))
+	{
+	case LUA_TBOOLEAN:
+		lua_pushboolean(dst, lua_toboolean(src, idx));
+		break;
+	case LUA_TNUMBER:
+		lua_pushnumber(dst, lua_tonumber(src, idx));
+		break;
+	case LUA_TSTRING:
+		{
+			size_t len;
+			const char* str = lua_tolstring(src, idx, &len);
+			lua_pushlstring(dst, str, len);
+		}
+		break;
+	case LUA_TTABLE:
+		if(depth >= 32)
+		{
+			lua_pushnil(dst);
+			break;
+		}
+
+		lua_newtable(dst);
+		lua_pushnil(src);
+
+		while(lua_next(src, idx) != 0)
+		{
+			copy_lua_value(src, -2, dst, depth + 1);
+			copy_lua_value(src, -1, dst, depth + 1);
+
+			if(lua_isnil(dst, -2))
+			{
+				lua_pop(dst, 2);
+			}
+			else
+			{
+				lua_rawset(dst, -3);
+			}
+
+			lua_pop(src, 1);
+		}
+		break;
+	default:
+		lua_pushnil(dst);
+		break;
+	}
+}
+
 void parse_lua_chisel_arg(lua_State *ls, OUT chisel_desc* cd)
 {
 	lua_pushnil(ls);
@@ -858,26 +2259,200 @@ void sinsp_chisel::add_lua_package_path(lua_State* ls, const char* path)
 	lua_setfield(ls, -2, "path");
 	lua_pop(ls, 1);
 }
+
+//
+// The cache of the chisel descriptions, in the home directory if there's one
+//
+//
+// Lock of the cache, since the chisels of different inspectors can be loaded
+// by different threads. A thread can take it again while holding it, because
+// listing the chisels loads the .sc ones.
+//
+#ifdef HAS_CHISEL_THREADS
+static pthread_mutex_t g_chisel_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static __thread uint32_t g_chisel_cache_lock_depth = 0;
+
+class chisel_cache_lock
+{
+public:
+	chisel_cache_lock()
+	{
+		if(g_chisel_cache_lock_depth++ == 0)
+		{
+			pthread_mutex_lock(&g_chisel_cache_mutex);
+		}
+	}
+
+	~chisel_cache_lock()
+	{
+		if(--g_chisel_cache_lock_depth == 0)
+		{
+			pthread_mutex_unlock(&g_chisel_cache_mutex);
+		}
+	}
+};
+#else
+class chisel_cache_lock
+{
+};
+#endif
+
+static sinsp_chisel_cache* get_chisel_cache()
+{
+	static sinsp_chisel_cache* cache = NULL;
+
+	if(cache == NULL)
+	{
+		const char* home = getenv("HOME");
+		string filename;
+
+		if(home != NULL && home[0] != 0)
+		{
+			filename = string(home) + "/" + CHISEL_CACHE_FILE;
+		}
+
+		cache = new sinsp_chisel_cache(filename);
+	}
+
+	return cache;
+}
+
+//
+// Create a Lua state with our libs and the chisel paths
+//
+static lua_State* new_chisel_lua_state(const vector<chiseldir_info>& dirs)
+{
+	lua_State* ls = lua_open();
+
+	luaL_openlibs(ls);
+
+	//
+	// Load our own lua libs
+	//
+	luaL_openlib(ls, "sysdig", ll_sysdig, 0);
+	luaL_openlib(ls, "chisel", ll_chisel, 0);
+	luaL_openlib(ls, "evt", ll_evt, 0);
+
+	//
+	// Add our chisel paths to package.path
+	//
+	for(uint32_t k = 0; k < dirs.size(); k++)
+	{
+		string path(dirs[k].m_dir);
+		path += "?.lua";
+		sinsp_chisel::add_lua_package_path(ls, path.c_str());
+	}
+
+	return ls;
+}
+
+//
+// Run the script of a Lua chisel to get its description
+//
+static void describe_lua_chisel(const string& fpath, const vector<chiseldir_info>& dirs, OUT sinsp_chisel_cache::entry* ce)
+{
+	lua_State* ls = new_chisel_lua_state(dirs);
+	chisel_desc* cd = &ce->m_desc;
+
+	ce->m_has_desc = true;
+	ce->m_valid = false;
+
+	//
+	// Load the script
+	//
+	if(luaL_loadfile(ls, fpath.c_str()))
+	{
+		goto done;
+	}
+
+	if(lua_pcall(ls, 0, 0, 0))
+	{
+		goto done;
+	}
+
+	//
+	// Extract the description
+	//
+	lua_getglobal(ls, "description");
+	if(!lua_isstring(ls, -1)) 
+	{
+		goto done;
+	}
+
+	cd->m_description = lua_tostring(ls, -1);
+
+	//
+	// Extract the short description
+	//
+	lua_getglobal(ls, "short_description");
+	if(!lua_isstring(ls, -1)) 
+	{
+		goto done;
+	}
+	cd->m_shortdesc = lua_tostring(ls, -1);
+
+	// 
+	// Extract the category
+	//
+	cd->m_category = "";
+	lua_getglobal(ls, "category");
+	if(lua_isstring(ls, -1)) 
+	{
+		cd->m_category = lua_tostring(ls, -1);
+	}
+
+	//
+	// Extract the hidden flag
+	//
+	lua_getglobal(ls, "hidden");
+	if(lua_isboolean(ls, -1)) 
+	{
+		ce->m_hidden = (lua_toboolean(ls, -1) != 0);
+	}
+
+	//
+	// Extract the args
+	//
+	lua_getglobal(ls, "args");
+
+	try
+	{
+		parse_lua_chisel_args(ls, cd);
+	}
+	catch(...)
+	{
+		goto done;
+	}
+
+	ce->m_valid = true;
+
+done:
+	lua_close(ls);
+}
 #endif
 
 //
 // 1. Iterates through the chisel files on disk (.sc and .lua)
 // 2. Opens them and extracts the fields (name, description, etc)
 // 3. Adds them to the chisel_descs vector.
+// The directories are the ones of the inspector, or the default ones if
+// there's none.
 //
-void sinsp_chisel::get_chisel_list(vector<chisel_desc>* chisel_descs)
+void sinsp_chisel::get_chisel_list(vector<chisel_desc>* chisel_descs, sinsp* inspector)
 {
+	const vector<chiseldir_info>& dirs = (inspector != NULL)? inspector->m_chisel_dirs : *g_chisel_dirs;
+	chisel_cache_lock lock;
 	uint32_t j;
 
-	for(j = 0; j < g_chisel_dirs->size(); j++)
+	for(j = 0; j < dirs.size(); j++)
 	{
-		if(string(g_chisel_dirs->at(j).m_dir) == "")
+		if(string(dirs[j].m_dir) == "")
 		{
 			continue;
 		}
 
 		tinydir_dir dir;
-		tinydir_open(&dir, g_chisel_dirs->at(j).m_dir);
+		tinydir_open(&dir, dirs[j].m_dir);
 
 		while(dir.has_next)
 		{
@@ -905,116 +2480,53 @@ void sinsp_chisel::get_chisel_list(vector<chisel_desc>* chisel_descs)
 							args[k]["type"].asString(), 
 							args[k]["description"].asString()
 						));
-					}
-
-					chisel_descs->push_back(cd);
-				}
-				catch(...)
-				{
-					//
-					// If there was an error opening the chisel, skip to the next one
-					//
-					goto next_file;
-				}
-			}
-
-#ifdef HAS_LUA_CHISELS
-			if(fname.find(".lua") == fname.size() - 4)
-			{
-				chisel_desc cd;
-				cd.m_name = fname.substr(0, fname.rfind('.'));
-
-				lua_State* ls = lua_open();
- 
-				luaL_openlibs(ls);
- 
-				//
-				// Load our own lua libs
-				//
-				luaL_openlib(ls, "sysdig", ll_sysdig, 0);
-				luaL_openlib(ls, "chisel", ll_chisel, 0);
-				luaL_openlib(ls, "evt", ll_evt, 0);
-
-				//
-				// Add our chisel paths to package.path
-				//
-				for(uint32_t k  = 0; k < g_chisel_dirs->size(); k++)
-				{
-					string path(g_chisel_dirs->at(k).m_dir);
-					path += "?.lua";
-					add_lua_package_path(ls, path.c_str());
-				}
-
-				//
-				// Load the script
-				//
-				if(luaL_loadfile(ls, fpath.c_str()) || lua_pcall(ls, 0, 0, 0)) 
-				{
-					goto next_lua_file;
-				}
-
-				//
-				// Extract the description
-				//
-				lua_getglobal(ls, "description");
-				if(!lua_isstring(ls, -1)) 
-				{
-					goto next_lua_file;
-				}				
-
-				cd.m_description = lua_tostring(ls, -1);
+					}
 
-				//
-				// Extract the short description
-				//
-				lua_getglobal(ls, "short_description");
-				if(!lua_isstring(ls, -1)) 
+					chisel_descs->push_back(cd);
+				}
+				catch(...)
 				{
-					goto next_lua_file;
-				}				
-				cd.m_shortdesc = lua_tostring(ls, -1);
+					//
+					// If there was an error opening the chisel, skip to the next one
+					//
+					goto next_file;
+				}
+			}
 
-				// 
-				// Extract the category
-				//
-			  	cd.m_category = "";
-				lua_getglobal(ls, "category");
-				if(lua_isstring(ls, -1)) 
-				{
-				  cd.m_category = lua_tostring(ls, -1);
-				}				
+#ifdef HAS_LUA_CHISELS
+			if(fname.find(".lua") == fname.size() - 4)
+			{
+				uint64_t mtime;
+				uint64_t size;
+				sinsp_chisel_cache::entry* ce = NULL;
+				sinsp_chisel_cache::entry tmpentry;
 
 				//
-				// Extract the hidden flag and skip the chisel if it's set
+				// Run the script only if its description is not in the
+				// cache
 				//
-				lua_getglobal(ls, "hidden");
-				if(lua_isboolean(ls, -1)) 
+				if(sinsp_chisel_cache::get_file_info(fpath, &mtime, &size))
 				{
-					int sares = lua_toboolean(ls, -1);
+					ce = get_chisel_cache()->lookup(fpath, mtime, size);
 
-					if(sares)
+					if(ce == NULL || !ce->m_has_desc)
 					{
-						goto next_lua_file;
+						ce = get_chisel_cache()->add(fpath, mtime, size);
+						describe_lua_chisel(fpath, dirs, ce);
+						ce->m_desc.m_name = fname.substr(0, fname.rfind('.'));
 					}
-				}				
-
-				//
-				// Extract the args
-				//
-				lua_getglobal(ls, "args");
-
-				try
-				{
-					parse_lua_chisel_args(ls, &cd);
 				}
-				catch(...)
+				else
 				{
-					goto next_lua_file;
+					ce = &tmpentry;
+					describe_lua_chisel(fpath, dirs, ce);
+					ce->m_desc.m_name = fname.substr(0, fname.rfind('.'));
 				}
 
-				chisel_descs->push_back(cd);
-next_lua_file:
-				lua_close(ls);
+				if(ce->m_valid && !ce->m_hidden)
+				{
+					chisel_descs->push_back(ce->m_desc);
+				}
 			}
 #endif
 
@@ -1024,19 +2536,36 @@ next_file:
 
 		tinydir_close(&dir);
 	}
+
+#ifdef HAS_LUA_CHISELS
+	get_chisel_cache()->save();
+#endif
+}
+
+//
+// The chisels that are only described have no inspector, they use the
+// default directories
+//
+const vector<chiseldir_info>& sinsp_chisel::get_chisel_dirs()
+{
+	return (m_inspector != NULL)? m_inspector->m_chisel_dirs : *g_chisel_dirs;
 }
 
 //
 // If the function succeeds, is is initialized to point to the file.
 // Otherwise, the return value is "false".
 //
-bool sinsp_chisel::openfile(string filename, OUT ifstream* is)
+bool sinsp_chisel::openfile(string filename, OUT ifstream* is, OUT string* path)
 {
 	uint32_t j;
 
-	for(j = 0; j < g_chisel_dirs->size(); j++)
+	const vector<chiseldir_info>& dirs = get_chisel_dirs();
+
+	for(j = 0; j < dirs.size(); j++)
 	{
-		is->open(string(g_chisel_dirs->at(j).m_dir) + filename);
+		*path = string(dirs[j].m_dir) + filename;
+
+		is->open(path->c_str());
 		if(is->is_open())
 		{
 			return true;
@@ -1048,46 +2577,53 @@ bool sinsp_chisel::openfile(string filename, OUT ifstream* is)
 
 void sinsp_chisel::load(string cmdstr)
 {
+	chisel_cache_lock lock;
+
 	m_filename = cmdstr;
 	trim(cmdstr);
 
 	ifstream is;
+	string path;
 
 	//
 	// Try to open the file as is
 	//
-	if(!openfile(m_filename, &is))
+	if(!openfile(m_filename, &is, &path))
 	{
 		//
 		// Try to add the .sc extension
 		//
-		if(!openfile(m_filename + ".sc", &is))
+		if(!openfile(m_filename + ".sc", &is, &path))
 		{
-			if(!openfile(m_filename + ".lua", &is))
+			if(!openfile(m_filename + ".lua", &is, &path))
 			{
 				throw sinsp_exception("can't open file " + m_filename);
 			}
 		}
 	}
 
+	if(m_root != NULL)
+	{
+		delete m_root;
+	}
+
+	m_root = new Json::Value();
+
+	string docstr;
+	bool parsingSuccessful = false;
+
 	//
 	// Bring the file into a string
 	//
-	string docstr((istreambuf_iterator<char>(is)),
+	docstr.assign((istreambuf_iterator<char>(is)),
 		istreambuf_iterator<char>());
 
 	//
 	// Try to parse as json
 	//
-	if(m_root != NULL)
-	{
-		delete m_root;
-	}
-
-	m_root = new Json::Value();
-
 	Json::Reader reader;
-	bool parsingSuccessful = reader.parse(docstr, (*m_root));
+	parsingSuccessful = reader.parse(docstr, (*m_root));
+
 	if(parsingSuccessful)
 	{
 		//
@@ -1098,45 +2634,18 @@ void sinsp_chisel::load(string cmdstr)
 	else
 	{
 #ifdef HAS_LUA_CHISELS
-		//
-		// Rewind the stream
-		//
-		is.seekg(0);
-
-		//
-		// Load the file
-		//
-		std::istreambuf_iterator<char> eos;
-		std::string scriptstr(std::istreambuf_iterator<char>(is), eos);
-
 		//
 		// Open the script
 		//
-		m_ls = lua_open();
- 
-		luaL_openlibs(m_ls);
+		m_ls = new_chisel_lua_state(get_chisel_dirs());
 
 		//
-		// Load our own lua libs
+		// Load the script. The chunk is named after the file, so that the
+		// errors point to it.
 		//
-		luaL_openlib(m_ls, "sysdig", ll_sysdig, 0);
-		luaL_openlib(m_ls, "chisel", ll_chisel, 0);
-		luaL_openlib(m_ls, "evt", ll_evt, 0);
-
-		//
-		// Add our chisel paths to package.path
-		//
-		for(uint32_t j = 0; j < g_chisel_dirs->size(); j++)
-		{
-			string path(g_chisel_dirs->at(j).m_dir);
-			path += "?.lua";
-			add_lua_package_path(m_ls, path.c_str());
-		}
+		int res = luaL_loadbuffer(m_ls, docstr.data(), docstr.size(), ("@" + path).c_str());
 
-		//
-		// Load the script
-		//
-		if(luaL_loadstring(m_ls, scriptstr.c_str()) || lua_pcall(m_ls, 0, 0, 0)) 
+		if(res || lua_pcall(m_ls, 0, 0, 0)) 
 		{
 			throw sinsp_exception("Failed to load chisel " + 
 				m_filename + ": " + lua_tostring(m_ls, -1));
@@ -1173,13 +2682,29 @@ void sinsp_chisel::load(string cmdstr)
 		}
 
 		//
-		// Check if the script has an on_event
+		// Check if the script has an on_events or an on_event, and keep a
+		// reference to it so that it's not looked up for every event
 		//
-		lua_getglobal(m_ls, "on_event");
+		lua_getglobal(m_ls, "on_events");
 		if(lua_isfunction(m_ls, -1))
 		{
 			m_lua_has_handle_evt = true;
+			m_lua_on_events_ref = luaL_ref(m_ls, LUA_REGISTRYINDEX);
+		}
+		else
+		{
 			lua_pop(m_ls, 1);
+			lua_getglobal(m_ls, "on_event");
+
+			if(lua_isfunction(m_ls, -1))
+			{
+				m_lua_has_handle_evt = true;
+				m_lua_on_event_ref = luaL_ref(m_ls, LUA_REGISTRYINDEX);
+			}
+			else
+			{
+				lua_pop(m_ls, 1);
+			}
 		}
 #endif
 	}
@@ -1352,6 +2877,7 @@ void sinsp_chisel::on_init()
 
 bool sinsp_chisel::run(sinsp_evt* evt)
 {
+	sinsp_alloc_scope alloc_scope(SAS_CHISEL);
 	uint32_t j;
 	string line;
 
@@ -1372,7 +2898,7 @@ bool sinsp_chisel::run(sinsp_evt* evt)
 
 			if(m_subchisels[j]->m_formatter->tostring(evt, &line))
 			{
-				cout << line << endl;
+				g_output_sink.write_line(line);
 			}
 		}
 
@@ -1387,8 +2913,15 @@ bool sinsp_chisel::run(sinsp_evt* evt)
 		//
 		if(m_lua_is_first_evt)
 		{
-			lua_pushlightuserdata(m_ls, evt);
-			lua_setglobal(m_ls, "sievt");
+			//
+			// The callbacks that run on the thread of the chisel can't
+			// look at the event, which the capture has already moved past
+			//
+			if(m_thread == NULL)
+			{
+				lua_pushlightuserdata(m_ls, evt);
+				lua_setglobal(m_ls, "sievt");
+			}
 
 			uint64_t ts = evt->get_ts();
 			if(m_lua_cinfo->m_callback_interval != 0)
@@ -1415,12 +2948,29 @@ bool sinsp_chisel::run(sinsp_evt* evt)
 			}
 		}
 
+		for(j = 0; j < m_allocated_aggregators.size(); j++)
+		{
+#ifdef HAS_CHISEL_THREADS
+			if(m_thread != NULL)
+			{
+				m_allocated_aggregators[j]->process(evt, &m_thread->m_groups[j]);
+				continue;
+			}
+#endif
+			m_allocated_aggregators[j]->process(evt);
+		}
+
 		//
-		// If the script has the on_event callback, call it
+		// If the script has the on_events callback, queue the event for
+		// it. Otherwise, if it has the on_event callback, call it.
 		//
-		if(m_lua_has_handle_evt)
+		if(m_lua_on_events_ref != LUA_NOREF)
 		{
-			lua_getglobal(m_ls, "on_event");
+			add_to_batch(evt);
+		}
+		else if(m_lua_has_handle_evt)
+		{
+			lua_rawgeti(m_ls, LUA_REGISTRYINDEX, m_lua_on_event_ref);
 			
 			if(lua_pcall(m_ls, 0, 1, 0) != 0) 
 			{
@@ -1430,33 +2980,329 @@ bool sinsp_chisel::run(sinsp_evt* evt)
 			int oeres = lua_toboolean(m_ls, -1);
 			lua_pop(m_ls, 1);
 
-			if(oeres == false)
-			{
-				return false;
-			}
+			if(oeres == false)
+			{
+				return false;
+			}
+		}
+
+		//
+		// If the script has a formatter, run it
+		//
+		if(m_lua_cinfo->m_formatter != NULL)
+		{
+			if(m_lua_cinfo->m_formatter->tostring(evt, &line))
+			{
+				g_output_sink.write_line(line);
+			}
+		}
+
+		return true;
+#endif
+	}
+}
+
+//
+// Add the event types that filter can accept to mask, or all of them if
+// there's no filter
+//
+static void add_filter_evttypes(sinsp_filter* filter, OUT ppm_evt_mask* mask)
+{
+	uint32_t j;
+	ppm_evt_mask fmask;
+
+	if(filter == NULL)
+	{
+		memset(mask, 0xff, sizeof(ppm_evt_mask));
+		return;
+	}
+
+	filter->get_evttypes(&fmask);
+
+	for(j = 0; j < sizeof(fmask.mask); j++)
+	{
+		mask->mask[j] |= fmask.mask[j];
+	}
+}
+
+void sinsp_chisel::get_evttypes(OUT ppm_evt_mask* mask)
+{
+	uint32_t j;
+
+	if(!m_ls)
+	{
+		for(j = 0; j < m_subchisels.size(); j++)
+		{
+			add_filter_evttypes(m_subchisels[j]->m_filter, mask);
+		}
+
+		return;
+	}
+
+	//
+	// The requested fields are only extracted from the events that pass
+	// the filter, so they don't add event types. The state that they
+	// rely on, like the file descriptors of fd.name, is kept by the events
+	// that modify it, which are always captured, and the enter events that
+	// evt.latency needs have the same name as their exit events.
+	// A Lua chisel that has no per event callback, aggregation or
+	// formatter doesn't look at the events at all.
+	//
+#ifdef HAS_LUA_CHISELS
+	if(m_lua_has_handle_evt || !m_allocated_aggregators.empty() ||
+		(m_lua_cinfo != NULL && m_lua_cinfo->m_formatter != NULL))
+	{
+		add_filter_evttypes((m_lua_cinfo != NULL)? m_lua_cinfo->m_filter : NULL, mask);
+	}
+#endif
+}
+
+#ifdef HAS_LUA_CHISELS
+//
+// Queue the values of the requested fields of the event for on_events().
+// The buffers are copied, because they're only valid until the next event.
+// Until the batch is flushed, their m_buf is their offset in
+// m_lua_batch_bufs, which can move while it grows.
+//
+void sinsp_chisel::add_to_batch(sinsp_evt* evt)
+{
+	uint32_t nfields = (uint32_t)m_allocated_fltchecks.size();
+	uint32_t j;
+
+	for(j = 0; j < nfields; j++)
+	{
+		sinsp_field_value val;
+
+		if(!m_allocated_fltchecks[j]->extract_value(evt, &val))
+		{
+			memset(&val, 0, sizeof(val));
+			val.m_type = m_allocated_fltchecks[j]->get_field_info()->m_type;
+			val.m_kind = SFV_NONE;
+		}
+		else if(val.m_kind == SFV_BUF)
+		{
+			size_t offset = m_lua_batch_bufs.size();
+
+			m_lua_batch_bufs.append(val.m_buf, val.m_len);
+			m_lua_batch_bufs.push_back(0);
+			val.m_buf = (const char*)offset;
+		}
+
+		m_lua_batch.push_back(val);
+	}
+
+	m_lua_batch_nevts++;
+
+	if(m_lua_batch_nevts >= SP_CHISEL_EVT_BATCH_SIZE)
+	{
+		flush_batch();
+	}
+}
+
+//
+// Call on_events(batch, nevts, nfields) with the queued events. batch is
+// an array of nevts * nfields sinsp_field_value, one row per event, with
+// the fields in the order of the chisel.request_field() calls.
+//
+void sinsp_chisel::flush_batch()
+{
+	sinsp_alloc_scope alloc_scope(SAS_CHISEL);
+	uint32_t nevts = m_lua_batch_nevts;
+
+	if(nevts == 0)
+	{
+		return;
+	}
+
+	m_lua_batch_nevts = 0;
+
+#ifdef HAS_CHISEL_THREADS
+	if(m_thread != NULL)
+	{
+		chisel_work_item* item = get_free_item(true);
+
+		if(item == NULL)
+		{
+			m_thread->m_stats.m_ndropped_batches++;
+			m_thread->m_stats.m_ndropped_evts += nevts;
+		}
+		else
+		{
+			item->m_type = CW_EVENTS;
+			item->m_nevts = nevts;
+			item->m_batch.swap(m_lua_batch);
+			item->m_batch_bufs.swap(m_lua_batch_bufs);
+			publish_item();
+			m_thread->m_stats.m_nbatches++;
+		}
+
+		m_lua_batch.clear();
+		m_lua_batch_bufs.clear();
+		return;
+	}
+#endif
+
+	try
+	{
+		call_on_events(&m_lua_batch, m_lua_batch_bufs, nevts);
+	}
+	catch(...)
+	{
+		m_lua_batch.clear();
+		m_lua_batch_bufs.clear();
+		throw;
+	}
+
+	m_lua_batch.clear();
+	m_lua_batch_bufs.clear();
+}
+
+void sinsp_chisel::call_on_events(vector<sinsp_field_value>* batch, const string& bufs, uint32_t nevts)
+{
+	uint32_t j;
+
+	for(j = 0; j < batch->size(); j++)
+	{
+		if((*batch)[j].m_kind == SFV_BUF)
+		{
+			(*batch)[j].m_buf = bufs.data() + (size_t)(*batch)[j].m_buf;
+		}
+	}
+
+	lua_rawgeti(m_ls, LUA_REGISTRYINDEX, m_lua_on_events_ref);
+	lua_pushlightuserdata(m_ls, batch->data());
+	lua_pushnumber(m_ls, nevts);
+	lua_pushnumber(m_ls, (double)m_allocated_fltchecks.size());
+
+	if(lua_pcall(m_ls, 3, 0, 0) != 0) 
+	{
+		throw sinsp_exception(m_filename + " chisel error: " + lua_tostring(m_ls, -1));
+	}
+}
+
+void sinsp_chisel::subscribe(const string& channel, int ref)
+{
+	vector<pair<sinsp_chisel*, int> >& subs = m_inspector->m_chisel_channels[channel];
+	uint32_t j;
+
+	for(j = 0; j < subs.size(); j++)
+	{
+		if(subs[j].first == this)
+		{
+			luaL_unref(m_ls, LUA_REGISTRYINDEX, subs[j].second);
+			subs[j].second = ref;
+			return;
+		}
+	}
+
+	subs.push_back(pair<sinsp_chisel*, int>(this, ref));
+	m_lua_channels.push_back(channel);
+}
+
+void sinsp_chisel::unsubscribe_all()
+{
+	uint32_t j;
+	uint32_t k;
+
+	for(j = 0; j < m_lua_channels.size(); j++)
+	{
+		map<string, vector<pair<sinsp_chisel*, int> > >::iterator it =
+			m_inspector->m_chisel_channels.find(m_lua_channels[j]);
+
+		if(it == m_inspector->m_chisel_channels.end())
+		{
+			continue;
+		}
+
+		for(k = 0; k < it->second.size(); k++)
+		{
+			if(it->second[k].first == this)
+			{
+				it->second.erase(it->second.begin() + k);
+				break;
+			}
+		}
+
+		if(it->second.empty())
+		{
+			m_inspector->m_chisel_channels.erase(it);
+		}
+	}
+
+	m_lua_channels.clear();
+}
+
+//
+// Call the callbacks of the chisels subscribed to channel with a copy of the
+// table at index idx of src. The callbacks can emit records in turn, so the
+// stages of a pipeline run one after the other for each record, but a
+// record never goes back to a chisel that is already handling one.
+//
+uint32_t sinsp_chisel::emit(const string& channel, lua_State* src, int idx)
+{
+	uint32_t n = 0;
+	uint32_t j;
+
+	if(m_thread != NULL)
+	{
+		throw sinsp_exception("chisel " + m_filename + " runs on its own thread and can't emit records");
+	}
+
+	map<string, vector<pair<sinsp_chisel*, int> > >::iterator it =
+		m_inspector->m_chisel_channels.find(channel);
+
+	if(it == m_inspector->m_chisel_channels.end())
+	{
+		return 0;
+	}
+
+	bool was_busy = m_lua_pipeline_busy;
+	m_lua_pipeline_busy = true;
+
+	//
+	// Subscribing from a callback can add to the vector, so it's walked by
+	// index
+	//
+	for(j = 0; j < it->second.size(); j++)
+	{
+		sinsp_chisel* sub = it->second[j].first;
+
+		if(sub->m_lua_pipeline_busy)
+		{
+			continue;
 		}
 
-		//
-		// If the script has a formatter, run it
-		//
-		if(m_lua_cinfo->m_formatter != NULL)
+		sub->m_lua_pipeline_busy = true;
+
+		lua_rawgeti(sub->m_ls, LUA_REGISTRYINDEX, it->second[j].second);
+		copy_lua_value(src, idx, sub->m_ls);
+		lua_pushlstring(sub->m_ls, channel.data(), channel.size());
+
+		if(lua_pcall(sub->m_ls, 2, 0, 0) != 0)
 		{
-			if(m_lua_cinfo->m_formatter->tostring(evt, &line))
-			{
-				cout << line << endl;
-			}
+			sub->m_lua_pipeline_busy = false;
+			m_lua_pipeline_busy = was_busy;
+			throw sinsp_exception(sub->m_filename + " chisel error: " + lua_tostring(sub->m_ls, -1));
 		}
 
-		return true;
-#endif
+		sub->m_lua_pipeline_busy = false;
+		n++;
 	}
+
+	m_lua_pipeline_busy = was_busy;
+	return n;
 }
+#endif // HAS_LUA_CHISELS
 
 void sinsp_chisel::do_timeout(sinsp_evt* evt)
+{
+	do_timeout_at(evt->get_ts());
+}
+
+void sinsp_chisel::do_timeout_at(uint64_t ts)
 {
 	if(m_lua_cinfo->m_callback_interval != 0)
 	{
-		uint64_t ts = evt->get_ts();
 		uint64_t sample_time = ts - ts % m_lua_cinfo->m_callback_interval;
 
 		if(sample_time != m_lua_last_interval_sample_time)
@@ -1469,23 +3315,17 @@ void sinsp_chisel::do_timeout(sinsp_evt* evt)
 				ASSERT(delta > 0);
 			}
 
-			lua_getglobal(m_ls, "on_interval");
-			
-			lua_pushnumber(m_ls, (double)(ts / 1000000000)); 
-			lua_pushnumber(m_ls, (double)(ts % 1000000000)); 
-			lua_pushnumber(m_ls, (double)delta); 
+			flush_batch();
 
-			if(lua_pcall(m_ls, 3, 1, 0) != 0) 
+#ifdef HAS_CHISEL_THREADS
+			if(m_thread != NULL)
 			{
-				throw sinsp_exception(m_filename + " chisel error: calling on_interval() failed:" + lua_tostring(m_ls, -1));
+				queue_interval_end(CW_INTERVAL, ts, delta);
 			}
-	
-			int oeres = lua_toboolean(m_ls, -1);
-			lua_pop(m_ls, 1);
-
-			if(oeres == false)
+			else
+#endif
 			{
-				throw sinsp_exception("execution terminated by the " + m_filename + " chisel");
+				call_on_interval(ts, delta);
 			}
 	
 			m_lua_last_interval_sample_time = sample_time;
@@ -1494,6 +3334,83 @@ void sinsp_chisel::do_timeout(sinsp_evt* evt)
 	}
 }
 
+void sinsp_chisel::call_on_interval(uint64_t ts, int64_t delta)
+{
+	sinsp_alloc_scope alloc_scope(SAS_CHISEL);
+
+	lua_getglobal(m_ls, "on_interval");
+	
+	lua_pushnumber(m_ls, (double)(ts / 1000000000)); 
+	lua_pushnumber(m_ls, (double)(ts % 1000000000)); 
+	lua_pushnumber(m_ls, (double)delta); 
+
+	if(lua_pcall(m_ls, 3, 1, 0) != 0) 
+	{
+		throw sinsp_exception(m_filename + " chisel error: calling on_interval() failed:" + lua_tostring(m_ls, -1));
+	}
+
+	int oeres = lua_toboolean(m_ls, -1);
+	lua_pop(m_ls, 1);
+
+	if(oeres == false)
+	{
+		throw sinsp_exception("execution terminated by the " + m_filename + " chisel");
+	}
+
+	gc_step();
+}
+
+uint64_t sinsp_chisel::get_lua_mem_bytes()
+{
+	return (uint64_t)lua_gc(m_ls, LUA_GCCOUNT, 0) * 1024 + lua_gc(m_ls, LUA_GCCOUNTB, 0);
+}
+
+//
+// The collector is incremental, and its steps are otherwise run by the
+// allocations of the event callbacks, so a chisel that creates many strings
+// slows down some of the events. The end of an interval is where the chisel
+// already takes time to print its results, so it gets a larger step of
+// SP_CHISEL_GC_STEP_KB there, which leaves less work for the events. The
+// chisels that allocated less than that since the last step don't need it.
+//
+void sinsp_chisel::gc_step()
+{
+	uint64_t mem = get_lua_mem_bytes();
+
+	if(mem > m_lua_stats.m_max_mem_bytes)
+	{
+		m_lua_stats.m_max_mem_bytes = mem;
+	}
+
+	if(mem < m_lua_gc_mem_bytes + SP_CHISEL_GC_STEP_KB * 1024)
+	{
+		return;
+	}
+
+	if(lua_gc(m_ls, LUA_GCSTEP, SP_CHISEL_GC_STEP_KB) != 0)
+	{
+		m_lua_stats.m_ngc_cycles++;
+	}
+
+	m_lua_stats.m_ngc_steps++;
+	m_lua_gc_mem_bytes = get_lua_mem_bytes();
+}
+
+void sinsp_chisel::get_lua_stats(OUT chisel_lua_stats* stats)
+{
+	*stats = m_lua_stats;
+
+	if(m_ls != NULL)
+	{
+		stats->m_mem_bytes = get_lua_mem_bytes();
+
+		if(stats->m_mem_bytes > stats->m_max_mem_bytes)
+		{
+			stats->m_max_mem_bytes = stats->m_mem_bytes;
+		}
+	}
+}
+
 void sinsp_chisel::on_capture_start()
 {
 #ifdef HAS_LUA_CHISELS
@@ -1524,14 +3441,45 @@ void sinsp_chisel::on_capture_start()
 void sinsp_chisel::on_capture_end()
 {
 #ifdef HAS_LUA_CHISELS
+	uint64_t ts = m_inspector->m_firstevent_ts;
+	uint64_t te = max(m_inspector->m_lastevent_ts, m_lua_merged_lastevent_ts);
+	int64_t delta = te - ts;
+
+	flush_batch();
+
+#ifdef HAS_CHISEL_THREADS
+	if(m_thread != NULL)
+	{
+		//
+		// The thread exits after the capture end, and then the chisel
+		// runs in the capture thread again
+		//
+		queue_interval_end(CW_CAPTURE_END, te, delta);
+		pthread_join(m_thread->m_thread, NULL);
+		m_thread->m_joined = true;
+
+		if(m_thread->m_failed)
+		{
+			throw sinsp_exception(m_thread->m_error);
+		}
+
+		return;
+	}
+#endif
+
+	call_on_capture_end(te, delta);
+#endif // HAS_LUA_CHISELS
+}
+
+#ifdef HAS_LUA_CHISELS
+void sinsp_chisel::call_on_capture_end(uint64_t te, int64_t delta)
+{
+	sinsp_alloc_scope alloc_scope(SAS_CHISEL);
+
 	lua_getglobal(m_ls, "on_capture_end");
 
 	if(lua_isfunction(m_ls, -1))
 	{
-		uint64_t ts = m_inspector->m_firstevent_ts;
-		uint64_t te = m_inspector->m_lastevent_ts;
-		int64_t delta = te - ts;
-
 		lua_pushnumber(m_ls, (double)(te / 1000000000)); 
 		lua_pushnumber(m_ls, (double)(te % 1000000000)); 
 		lua_pushnumber(m_ls, (double)delta);
@@ -1540,9 +3488,324 @@ void sinsp_chisel::on_capture_end()
 		{
 			throw sinsp_exception(m_filename + " chisel error: " + lua_tostring(m_ls, -1));
 		}
-
+	}
+	else
+	{
 		lua_pop(m_ls, 1);
 	}
+}
+#endif // HAS_LUA_CHISELS
+
+///////////////////////////////////////////////////////////////////////////////
+// Chisel threads
+///////////////////////////////////////////////////////////////////////////////
+bool sinsp_chisel::start_thread(uint32_t queue_len, bool drop)
+{
+#ifdef HAS_CHISEL_THREADS
+	ASSERT(m_thread == NULL);
+	ASSERT(queue_len != 0);
+
+	if(!m_ls || (m_lua_has_handle_evt && m_lua_on_events_ref == LUA_NOREF) || !m_lua_channels.empty())
+	{
+		return false;
+	}
+
+	m_thread = new chisel_thread();
+	m_thread->m_items.resize(queue_len);
+	m_thread->m_head = 0;
+	m_thread->m_tail = 0;
+	m_thread->m_drop = drop;
+	m_thread->m_stop = false;
+	m_thread->m_failed = false;
+	m_thread->m_joined = false;
+	memset(&m_thread->m_stats, 0, sizeof(m_thread->m_stats));
+	m_thread->m_groups.resize(m_allocated_aggregators.size());
+
+	if(pthread_create(&m_thread->m_thread, NULL, thread_main, this) != 0)
+	{
+		delete m_thread;
+		m_thread = NULL;
+		throw sinsp_exception("cannot create the thread of the " + m_filename + " chisel");
+	}
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool sinsp_chisel::get_thread_stats(OUT chisel_thread_stats* stats)
+{
+#ifdef HAS_CHISEL_THREADS
+	if(m_thread == NULL)
+	{
+		return false;
+	}
+
+	*stats = m_thread->m_stats;
+	return true;
+#else
+	return false;
+#endif
+}
+
+#ifdef HAS_CHISEL_THREADS
+//
+// Return the next item of the queue, waiting for the chisel thread to free
+// one if the queue is full. If can_drop is true and the chisel drops what
+// doesn't fit, return NULL instead of waiting. Throws the error of the
+// chisel thread if it failed.
+//
+chisel_work_item* sinsp_chisel::get_free_item(bool can_drop)
+{
+	uint64_t size = m_thread->m_items.size();
+	bool waited = false;
+
+	while(!m_thread->m_failed && m_thread->m_tail - m_thread->m_head >= size)
+	{
+		if(can_drop && m_thread->m_drop)
+		{
+			return NULL;
+		}
+
+		if(!waited)
+		{
+			m_thread->m_stats.m_nwaits++;
+			waited = true;
+		}
+
+		usleep(SP_CHISEL_QUEUE_FULL_WAIT_US);
+	}
+
+	__sync_synchronize();
+
+	if(m_thread->m_failed)
+	{
+		throw sinsp_exception(m_thread->m_error);
+	}
+
+	return &m_thread->m_items[m_thread->m_tail % size];
+}
+
+void sinsp_chisel::publish_item()
+{
+	uint32_t depth;
+
+	__sync_synchronize();
+	m_thread->m_tail++;
+
+	depth = (uint32_t)(m_thread->m_tail - m_thread->m_head);
+	if(depth > m_thread->m_stats.m_max_depth)
+	{
+		m_thread->m_stats.m_max_depth = depth;
+	}
+}
+
+//
+// Queue the end of an interval or of the capture, with the groups that the
+// aggregations got since the previous one. These are never dropped.
+//
+void sinsp_chisel::queue_interval_end(uint32_t type, uint64_t ts, int64_t delta)
+{
+	chisel_work_item* item = get_free_item(false);
+	uint32_t j;
+
+	item->m_type = type;
+	item->m_ts = ts;
+	item->m_delta = delta;
+	item->m_groups.resize(m_thread->m_groups.size());
+
+	for(j = 0; j < m_thread->m_groups.size(); j++)
+	{
+		item->m_groups[j].swap(m_thread->m_groups[j]);
+		m_thread->m_groups[j].clear();
+	}
+
+	publish_item();
+}
+
+void* sinsp_chisel::thread_main(void* arg)
+{
+	sinsp_chisel* ch = (sinsp_chisel*)arg;
+
+	try
+	{
+		ch->thread_loop();
+	}
+	catch(sinsp_exception& e)
+	{
+		ch->m_thread->m_error = e.what();
+		__sync_synchronize();
+		ch->m_thread->m_failed = true;
+	}
+	catch(...)
+	{
+		ch->m_thread->m_error = ch->m_filename + " chisel error";
+		__sync_synchronize();
+		ch->m_thread->m_failed = true;
+	}
+
+	return NULL;
+}
+
+void sinsp_chisel::thread_loop()
+{
+	sinsp_alloc_scope alloc_scope(SAS_CHISEL);
+	uint64_t size = m_thread->m_items.size();
+	uint32_t j;
+
+	while(true)
+	{
+		while(m_thread->m_head == m_thread->m_tail)
+		{
+			if(m_thread->m_stop)
+			{
+				return;
+			}
+
+			usleep(SP_CHISEL_QUEUE_EMPTY_WAIT_US);
+		}
+
+		__sync_synchronize();
+
+		if(m_thread->m_stop)
+		{
+			return;
+		}
+
+		chisel_work_item* item = &m_thread->m_items[m_thread->m_head % size];
+		bool end = (item->m_type == CW_CAPTURE_END);
+
+		if(item->m_type == CW_EVENTS)
+		{
+			call_on_events(&item->m_batch, item->m_batch_bufs, item->m_nevts);
+			item->m_batch.clear();
+			item->m_batch_bufs.clear();
+		}
+		else
+		{
+			for(j = 0; j < item->m_groups.size() && j < m_allocated_aggregators.size(); j++)
+			{
+				m_allocated_aggregators[j]->merge_groups(item->m_groups[j]);
+				item->m_groups[j].clear();
+			}
+
+			if(end)
+			{
+				call_on_capture_end(item->m_ts, item->m_delta);
+			}
+			else
+			{
+				call_on_interval(item->m_ts, item->m_delta);
+			}
+		}
+
+		__sync_synchronize();
+		m_thread->m_head++;
+
+		if(end)
+		{
+			return;
+		}
+	}
+}
+#endif // HAS_CHISEL_THREADS
+
+void sinsp_chisel::stop_thread()
+{
+#ifdef HAS_CHISEL_THREADS
+	if(m_thread == NULL)
+	{
+		return;
+	}
+
+	if(!m_thread->m_joined)
+	{
+		m_thread->m_stop = true;
+		pthread_join(m_thread->m_thread, NULL);
+	}
+
+	delete m_thread;
+	m_thread = NULL;
+#endif
+}
+
+//
+// A chisel can process a part of a trace file, and then be merged into the
+// chisel that runs on another part, if it has the on_segment_end() callback,
+// which returns its partial results, and the on_merge() callback, which adds
+// them to its own.
+//
+bool sinsp_chisel::can_merge()
+{
+#ifdef HAS_LUA_CHISELS
+	bool res;
+
+	if(!m_ls)
+	{
+		return false;
+	}
+
+	lua_getglobal(m_ls, "on_segment_end");
+	lua_getglobal(m_ls, "on_merge");
+	res = lua_isfunction(m_ls, -1) && lua_isfunction(m_ls, -2);
+	lua_pop(m_ls, 2);
+
+	return res;
+#else
+	return false;
+#endif // HAS_LUA_CHISELS
+}
+
+//
+// Add the results of a chisel that processed a later part of the capture.
+// segment must be the same chisel, in the same state it was after the
+// last event of its part.
+//
+void sinsp_chisel::merge(sinsp_chisel* segment)
+{
+#ifdef HAS_LUA_CHISELS
+	ASSERT(can_merge() && segment->can_merge());
+
+	flush_batch();
+	segment->flush_batch();
+
+	//
+	// The aggregations are merged here, the script only merges its own
+	// tables
+	//
+	ASSERT(m_allocated_aggregators.size() == segment->m_allocated_aggregators.size());
+
+	for(uint32_t j = 0; j < m_allocated_aggregators.size() && j < segment->m_allocated_aggregators.size(); j++)
+	{
+		m_allocated_aggregators[j]->merge(segment->m_allocated_aggregators[j]);
+	}
+
+	lua_getglobal(segment->m_ls, "on_segment_end");
+
+	if(lua_pcall(segment->m_ls, 0, 1, 0) != 0)
+	{
+		throw sinsp_exception(m_filename + " chisel error: " + lua_tostring(segment->m_ls, -1));
+	}
+
+	lua_getglobal(m_ls, "on_merge");
+	copy_lua_value(segment->m_ls, -1, m_ls);
+	lua_pop(segment->m_ls, 1);
+
+	if(lua_pcall(m_ls, 1, 1, 0) != 0)
+	{
+		throw sinsp_exception(m_filename + " chisel error: " + lua_tostring(m_ls, -1));
+	}
+
+	if(!lua_toboolean(m_ls, -1))
+	{
+		throw sinsp_exception("on_merge() for chisel " + m_filename + " failed.");
+	}
+
+	lua_pop(m_ls, 1);
+
+	m_lua_merged_lastevent_ts = max(m_lua_merged_lastevent_ts, segment->m_inspector->m_lastevent_ts);
+	m_lua_merged_lastevent_ts = max(m_lua_merged_lastevent_ts, segment->m_lua_merged_lastevent_ts);
 #endif // HAS_LUA_CHISELS
 }
 
@@ -22,6 +22,10 @@ along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
 
 class sinsp_filter_check;
 class sinsp_evt_formatter;
+class sinsp_string_matcher;
+class sinsp_field_aggregator;
+class sinsp_table_view;
+class sinsp_sketch;
 namespace Json {
 	class Value;
 }
@@ -77,6 +81,32 @@ public:
 };
 
 
+//
+// Memory and garbage collection statistics of the Lua state of a chisel
+//
+typedef struct chisel_lua_stats
+{
+	uint64_t m_mem_bytes; // Memory used by the state now
+	uint64_t m_max_mem_bytes; // Highest memory use seen at the end of the intervals
+	uint64_t m_ngc_steps; // Garbage collection steps run at the end of the intervals
+	uint64_t m_ngc_cycles; // Garbage collection cycles that these steps completed
+}chisel_lua_stats;
+
+//
+// Counters of a chisel that runs on its own thread
+//
+typedef struct chisel_thread_stats
+{
+	uint64_t m_nbatches; // Batches of events queued for on_events()
+	uint64_t m_ndropped_batches; // Batches dropped because the queue was full
+	uint64_t m_ndropped_evts; // Events in the dropped batches
+	uint64_t m_nwaits; // Times the capture waited for room in the queue
+	uint32_t m_max_depth; // Largest number of items that were in the queue
+}chisel_thread_stats;
+
+struct chisel_thread;
+struct chisel_work_item;
+
 class chiselinfo
 {
 public:
@@ -101,19 +131,72 @@ public:
 	sinsp_chisel(sinsp* inspector, string filename);
 	~sinsp_chisel();
 	static void add_lua_package_path(lua_State* ls, const char* path);
-	static void get_chisel_list(vector<chisel_desc>* chisel_descs);
+	static void get_chisel_list(vector<chisel_desc>* chisel_descs, sinsp* inspector = NULL);
 	void load(string cmdstr);
 	uint32_t get_n_args();
 	void set_args(vector<string>* argvals);
 	bool run(sinsp_evt* evt);
 	void do_timeout(sinsp_evt* evt);
+	void do_timeout_at(uint64_t ts);
 	void on_init();
 	void on_capture_start();
 	void on_capture_end();
+	bool can_merge();
+	void merge(sinsp_chisel* segment);
+	void get_lua_stats(OUT chisel_lua_stats* stats);
+
+	//
+	// Run the Lua callbacks of the chisel on its own thread from now on,
+	// with a queue of queue_len items between the capture and the thread.
+	// The capture thread keeps running the filter, the aggregations and the
+	// formatter, and queues the batches of on_events() and the ends of the
+	// intervals. When the queue is full, the batches are dropped if drop is
+	// true, otherwise the capture waits.
+	// Returns false if the chisel can't run on a thread because it has an
+	// on_event() callback, which needs the event and the state of the
+	// inspector, or because it subscribed to the records of other chisels,
+	// which are delivered on the capture thread. Must be called after
+	// on_capture_start().
+	//
+	bool start_thread(uint32_t queue_len, bool drop);
+
+	//
+	// Return false if the chisel doesn't run on its own thread
+	//
+	bool get_thread_stats(OUT chisel_thread_stats* stats);
+
+	//
+	// Add to mask the types of the events that the chisel looks at: the
+	// ones that its filters can accept, or all of them if it looks at the
+	// events without a filter. Must be called after on_capture_start().
+	//
+	void get_evttypes(OUT ppm_evt_mask* mask);
+
+	const string& get_filename()
+	{
+		return m_filename;
+	}
 
 private:
-	bool openfile(string filename, OUT ifstream* is);
+	const vector<chiseldir_info>& get_chisel_dirs();
+	bool openfile(string filename, OUT ifstream* is, OUT string* path);
 	void free_lua_chisel();
+	void add_to_batch(sinsp_evt* evt);
+	void flush_batch();
+	void gc_step();
+	uint64_t get_lua_mem_bytes();
+	void call_on_events(vector<sinsp_field_value>* batch, const string& bufs, uint32_t nevts);
+	void call_on_interval(uint64_t ts, int64_t delta);
+	void call_on_capture_end(uint64_t te, int64_t delta);
+	chisel_work_item* get_free_item(bool can_drop);
+	void publish_item();
+	void queue_interval_end(uint32_t type, uint64_t ts, int64_t delta);
+	void stop_thread();
+	void subscribe(const string& channel, int ref);
+	void unsubscribe_all();
+	uint32_t emit(const string& channel, lua_State* src, int idx);
+	void thread_loop();
+	static void* thread_main(void* arg);
 
 	sinsp* m_inspector;
 	string m_description;
@@ -124,10 +207,25 @@ private:
 	lua_State* m_ls;
 	chisel_desc m_lua_script_info;
 	bool m_lua_has_handle_evt;
+	int m_lua_on_event_ref; // Registry references to the callbacks, LUA_NOREF if the script doesn't have them
+	int m_lua_on_events_ref;
+	vector<sinsp_field_value> m_lua_batch; // Values of the requested fields of the events for on_events()
+	string m_lua_batch_bufs; // The buffers of the values in m_lua_batch
+	uint32_t m_lua_batch_nevts;
 	bool m_lua_is_first_evt;
 	uint64_t m_lua_last_interval_sample_time;
 	uint64_t m_lua_last_interval_ts;
+	uint64_t m_lua_merged_lastevent_ts;
+	chisel_lua_stats m_lua_stats;
+	uint64_t m_lua_gc_mem_bytes; // Memory use after the last garbage collection step
+	chisel_thread* m_thread; // NULL if the chisel runs in the capture thread
+	vector<string> m_lua_channels; // The channels the chisel subscribed to, see chisel.subscribe()
+	bool m_lua_pipeline_busy; // Emitting or receiving a record, so that the records can't loop back to the chisel
 	vector<sinsp_filter_check*> m_allocated_fltchecks;
+	vector<sinsp_string_matcher*> m_allocated_matchers;
+	vector<sinsp_field_aggregator*> m_allocated_aggregators;
+	vector<sinsp_table_view*> m_allocated_table_views;
+	vector<sinsp_sketch*> m_allocated_sketches;
 	char m_lua_fld_storage[1024];
 	chiselinfo* m_lua_cinfo;
 	string m_new_chisel_to_exec;
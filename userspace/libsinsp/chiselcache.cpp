@@ -0,0 +1,419 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <unistd.h>
+#include <limits.h>
+#include <fcntl.h>
+#endif
+
+#include "sinsp.h"
+#include "sinsp_int.h"
+#include "chiselcache.h"
+
+#ifdef HAS_CHISELS
+
+//
+// Start of the cache file, followed by the version of the format
+//
+#define CHISEL_CACHE_MAGIC "SDCC"
+#define CHISEL_CACHE_VERSION 2
+
+///////////////////////////////////////////////////////////////////////////////
+// Encoding of the cache file: little endian integers, and strings as their
+// 32 bit length followed by their bytes
+///////////////////////////////////////////////////////////////////////////////
+static void put_u32(string* dst, uint32_t val)
+{
+	uint32_t j;
+
+	for(j = 0; j < 4; j++)
+	{
+		dst->push_back((char)(val >> (j * 8)));
+	}
+}
+
+static void put_u64(string* dst, uint64_t val)
+{
+	put_u32(dst, (uint32_t)val);
+	put_u32(dst, (uint32_t)(val >> 32));
+}
+
+static void put_str(string* dst, const string& val)
+{
+	put_u32(dst, (uint32_t)val.size());
+	dst->append(val);
+}
+
+//
+// Reader of the cache file. Once a read goes past the end of the data,
+// m_error is set and all the reads return zeros.
+//
+class chisel_cache_reader
+{
+public:
+	chisel_cache_reader(const string& data)
+	{
+		m_data = &data;
+		m_pos = 0;
+		m_error = false;
+	}
+
+	uint32_t get_u32()
+	{
+		uint32_t res = 0;
+		uint32_t j;
+
+		if(m_error || m_data->size() - m_pos < 4)
+		{
+			m_error = true;
+			return 0;
+		}
+
+		for(j = 0; j < 4; j++)
+		{
+			res |= (uint32_t)(uint8_t)(*m_data)[m_pos + j] << (j * 8);
+		}
+
+		m_pos += 4;
+		return res;
+	}
+
+	uint64_t get_u64()
+	{
+		uint64_t lo = get_u32();
+		uint64_t hi = get_u32();
+
+		return lo | (hi << 32);
+	}
+
+	void get_str(OUT string* res)
+	{
+		uint32_t len = get_u32();
+
+		if(m_error || m_data->size() - m_pos < len)
+		{
+			m_error = true;
+			res->clear();
+			return;
+		}
+
+		res->assign(*m_data, m_pos, len);
+		m_pos += len;
+	}
+
+	const string* m_data;
+	size_t m_pos;
+	bool m_error;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// sinsp_chisel_cache implementation
+///////////////////////////////////////////////////////////////////////////////
+sinsp_chisel_cache::sinsp_chisel_cache(const string& filename)
+{
+	m_filename = filename;
+	m_loaded = false;
+	m_dirty = false;
+}
+
+void sinsp_chisel_cache::load()
+{
+	m_loaded = true;
+
+	if(m_filename == "")
+	{
+		return;
+	}
+
+#ifndef _WIN32
+	//
+	// Don't follow links, and only trust a file that nobody else could have
+	// written
+	//
+	int fd = open(m_filename.c_str(), O_RDONLY | O_NOFOLLOW);
+	if(fd < 0)
+	{
+		return;
+	}
+
+	struct stat st;
+
+	if(fstat(fd, &st) != 0 ||
+		!S_ISREG(st.st_mode) ||
+		st.st_uid != geteuid() ||
+		(st.st_mode & (S_IWGRP | S_IWOTH)) != 0)
+	{
+		close(fd);
+		return;
+	}
+
+	FILE* fp = fdopen(fd, "rb");
+	if(fp == NULL)
+	{
+		close(fd);
+		return;
+	}
+#else
+	FILE* fp = fopen(m_filename.c_str(), "rb");
+	if(fp == NULL)
+	{
+		return;
+	}
+#endif
+
+	string data;
+	char buf[16384];
+	size_t n;
+
+	while((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+	{
+		data.append(buf, n);
+	}
+
+	fclose(fp);
+
+	chisel_cache_reader rd(data);
+	string str;
+
+	rd.get_str(&str);
+	if(str != CHISEL_CACHE_MAGIC || rd.get_u32() != CHISEL_CACHE_VERSION)
+	{
+		return;
+	}
+
+	uint32_t nentries = rd.get_u32();
+	uint32_t j, k;
+
+	for(j = 0; j < nentries && !rd.m_error; j++)
+	{
+		string path;
+		entry e;
+
+		rd.get_str(&path);
+		e.m_mtime = rd.get_u64();
+		e.m_size = rd.get_u64();
+		e.m_has_desc = (rd.get_u32() != 0);
+		e.m_valid = (rd.get_u32() != 0);
+		e.m_hidden = (rd.get_u32() != 0);
+		rd.get_str(&e.m_desc.m_name);
+		rd.get_str(&e.m_desc.m_description);
+		rd.get_str(&e.m_desc.m_shortdesc);
+		rd.get_str(&e.m_desc.m_category);
+
+		uint32_t nargs = rd.get_u32();
+
+		for(k = 0; k < nargs && !rd.m_error; k++)
+		{
+			string name;
+			string type;
+			string desc;
+
+			rd.get_str(&name);
+			rd.get_str(&type);
+			rd.get_str(&desc);
+			e.m_desc.m_args.push_back(chiselarg_desc(name, type, desc));
+		}
+
+		if(!rd.m_error)
+		{
+			m_entries[path] = e;
+		}
+	}
+
+	//
+	// A truncated file is thrown away as a whole
+	//
+	if(rd.m_error)
+	{
+		m_entries.clear();
+	}
+}
+
+bool sinsp_chisel_cache::get_file_info(const string& path, OUT uint64_t* mtime, OUT uint64_t* size)
+{
+	struct stat st;
+
+	if(stat(path.c_str(), &st) != 0)
+	{
+		return false;
+	}
+
+#ifdef __linux__
+	*mtime = (uint64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#else
+	*mtime = (uint64_t)st.st_mtime;
+#endif
+	*size = (uint64_t)st.st_size;
+	return true;
+}
+
+//
+// The same chisel can be opened through different relative paths, so the
+// entries are keyed by the absolute ones when they can be found
+//
+string sinsp_chisel_cache::get_key(const string& path)
+{
+#ifndef _WIN32
+	char resolved_path[PATH_MAX];
+
+	if(realpath(path.c_str(), resolved_path) != NULL)
+	{
+		return resolved_path;
+	}
+#endif
+	return path;
+}
+
+sinsp_chisel_cache::entry* sinsp_chisel_cache::lookup(const string& path, uint64_t mtime, uint64_t size)
+{
+	if(!m_loaded)
+	{
+		load();
+	}
+
+	map<string, entry>::iterator it = m_entries.find(get_key(path));
+
+	if(it == m_entries.end() || it->second.m_mtime != mtime || it->second.m_size != size)
+	{
+		return NULL;
+	}
+
+	return &it->second;
+}
+
+sinsp_chisel_cache::entry* sinsp_chisel_cache::add(const string& path, uint64_t mtime, uint64_t size)
+{
+	if(!m_loaded)
+	{
+		load();
+	}
+
+	entry* e = &m_entries[get_key(path)];
+
+	e->m_mtime = mtime;
+	e->m_size = size;
+	e->m_has_desc = false;
+	e->m_valid = false;
+	e->m_hidden = false;
+	e->m_desc.reset();
+
+	m_dirty = true;
+	return e;
+}
+
+void sinsp_chisel_cache::save()
+{
+	map<string, entry>::iterator it;
+	string data;
+	uint32_t j;
+
+	if(!m_dirty || m_filename == "")
+	{
+		return;
+	}
+
+	m_dirty = false;
+
+	put_str(&data, CHISEL_CACHE_MAGIC);
+	put_u32(&data, CHISEL_CACHE_VERSION);
+	put_u32(&data, (uint32_t)m_entries.size());
+
+	for(it = m_entries.begin(); it != m_entries.end(); ++it)
+	{
+		const entry* e = &it->second;
+
+		put_str(&data, it->first);
+		put_u64(&data, e->m_mtime);
+		put_u64(&data, e->m_size);
+		put_u32(&data, e->m_has_desc? 1 : 0);
+		put_u32(&data, e->m_valid? 1 : 0);
+		put_u32(&data, e->m_hidden? 1 : 0);
+		put_str(&data, e->m_desc.m_name);
+		put_str(&data, e->m_desc.m_description);
+		put_str(&data, e->m_desc.m_shortdesc);
+		put_str(&data, e->m_desc.m_category);
+		put_u32(&data, (uint32_t)e->m_desc.m_args.size());
+
+		for(j = 0; j < e->m_desc.m_args.size(); j++)
+		{
+			put_str(&data, e->m_desc.m_args[j].m_name);
+			put_str(&data, e->m_desc.m_args[j].m_type);
+			put_str(&data, e->m_desc.m_args[j].m_description);
+		}
+	}
+
+	//
+	// Write a temporary file and move it in place, so that another sysdig
+	// never reads a partial cache. The temporary file is created with a
+	// unique name, readable and writable by the owner only, so that an
+	// existing file or link with its name can't be written through.
+	//
+#ifndef _WIN32
+	string tmpname = m_filename + ".XXXXXX";
+	vector<char> tmpl(tmpname.begin(), tmpname.end());
+	tmpl.push_back(0);
+
+	int fd = mkstemp(&tmpl[0]);
+	if(fd < 0)
+	{
+		return;
+	}
+
+	tmpname = &tmpl[0];
+
+	FILE* fp = fdopen(fd, "wb");
+	if(fp == NULL)
+	{
+		close(fd);
+		remove(tmpname.c_str());
+		return;
+	}
+#else
+	string tmpname = m_filename + ".tmp";
+
+	FILE* fp = fopen(tmpname.c_str(), "wb");
+	if(fp == NULL)
+	{
+		return;
+	}
+#endif
+
+	bool ok = (fwrite(data.data(), 1, data.size(), fp) == data.size());
+
+	if(fclose(fp) != 0)
+	{
+		ok = false;
+	}
+
+#ifdef _WIN32
+	if(ok)
+	{
+		remove(m_filename.c_str());
+	}
+#endif
+
+	if(!ok || rename(tmpname.c_str(), m_filename.c_str()) != 0)
+	{
+		remove(tmpname.c_str());
+	}
+}
+
+#endif // HAS_CHISELS
@@ -0,0 +1,92 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+///////////////////////////////////////////////////////////////////////////////
+// On disk index of the Lua chisels: the description that the chisel list
+// shows for each script, keyed by its path. An entry is only used while the
+// modification time and the size of the file are the ones it was built
+// from, so listing the chisels that didn't change doesn't run them again.
+// Only descriptions are kept, the scripts are always loaded from their
+// sources.
+// The file is read on the first lookup, and written back by save() if
+// something changed. It's ignored unless it belongs to the effective user
+// and only the owner can write it, since sysdig often runs as root with the
+// home directory of another user. Not being able to read or write it is not
+// an error, the chisels are just described from their sources.
+///////////////////////////////////////////////////////////////////////////////
+class SINSP_PUBLIC sinsp_chisel_cache
+{
+public:
+	typedef struct entry
+	{
+		uint64_t m_mtime;
+		uint64_t m_size;
+		bool m_has_desc; // false if the script was never listed
+		bool m_valid; // false if the script failed to load or has no description
+		bool m_hidden;
+		chisel_desc m_desc;
+	}entry;
+
+	//
+	// filename is the path of the cache file, or "" to keep the cache in
+	// memory only
+	//
+	sinsp_chisel_cache(const string& filename);
+
+	//
+	// Get the modification time and the size of a file. Returns false if
+	// the file can't be looked at, and then it can't be cached either.
+	//
+	static bool get_file_info(const string& path, OUT uint64_t* mtime, OUT uint64_t* size);
+
+	//
+	// Return the entry of the file at path if it was built from the given
+	// modification time and size, or NULL
+	//
+	entry* lookup(const string& path, uint64_t mtime, uint64_t size);
+
+	//
+	// Return a new empty entry for the file at path, replacing the old one
+	//
+	entry* add(const string& path, uint64_t mtime, uint64_t size);
+
+	//
+	// Mark the cache as changed, after an entry returned by lookup() or
+	// add() was modified
+	//
+	void set_dirty()
+	{
+		m_dirty = true;
+	}
+
+	//
+	// Write the cache file if the cache changed
+	//
+	void save();
+
+private:
+	void load();
+	static string get_key(const string& path);
+
+	string m_filename;
+	map<string, entry> m_entries;
+	bool m_loaded;
+	bool m_dirty;
+};
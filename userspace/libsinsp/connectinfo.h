@@ -0,0 +1,301 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+/** @defgroup state State management
+ *  @{
+ */
+
+/*!
+	\brief The two ends of a connection, as seen by the processes of this
+	 machine. The end that is not on this machine, or that is not known yet,
+	 has a tid of -1.
+*/
+class SINSP_PUBLIC sinsp_connection
+{
+public:
+	sinsp_connection()
+	{
+		m_cpid = -1;
+		m_ctid = -1;
+		m_cfd = -1;
+		m_spid = -1;
+		m_stid = -1;
+		m_sfd = -1;
+		m_lastaccess_ts = 0;
+	}
+
+	bool has_client()
+	{
+		return m_ctid != -1;
+	}
+
+	bool has_server()
+	{
+		return m_stid != -1;
+	}
+
+	int64_t m_cpid; ///< PID of the process that called connect().
+	int64_t m_ctid; ///< TID of the thread that called connect().
+	int64_t m_cfd; ///< FD of the client socket.
+	int64_t m_spid; ///< PID of the process that called accept().
+	int64_t m_stid; ///< TID of the thread that called accept().
+	int64_t m_sfd; ///< FD of the server socket.
+	uint64_t m_lastaccess_ts; ///< Last time the connection was added or looked up.
+};
+
+/*!
+	\brief Table of the connections, indexed by their tuple, so that the
+	 other end of a socket is found without going through the fd tables of
+	 all the threads. The connections are added by connect() and accept()
+	 and removed when both their ends are closed. The ones that are not
+	 looked up for a while are removed too, since the end of a connection
+	 isn't always seen (e.g. when the process is killed), and the table
+	 never grows past its maximum size: the connections that don't fit are
+	 not tracked.
+*/
+template<class TKey, class THash, class TCompare>
+class sinsp_connection_manager
+{
+public:
+	typedef unordered_map<TKey, sinsp_connection, THash, TCompare> connection_map;
+
+	sinsp_connection_manager(sinsp* inspector)
+	{
+		m_inspector = inspector;
+		m_max_size = MAX_CONNECTION_TABLE_SIZE;
+		m_timeout_ns = DEFAULT_CONNECTION_TIMEOUT_S * ONE_SECOND_IN_NS;
+		m_last_scan_ts = 0;
+		m_n_drops = 0;
+	}
+
+	/*!
+	  \brief Record one end of the connection with the given key. If
+	   isclient is true, it's the end that called connect(), otherwise the
+	   one that called accept().
+
+	  \return the connection, or NULL if the table is full and doesn't
+	   have it already.
+	*/
+	sinsp_connection* add_connection(const TKey& key, int64_t pid, int64_t tid, int64_t fd, bool isclient, uint64_t ts)
+	{
+		typename connection_map::iterator it = m_connections.find(key);
+		sinsp_connection* conn;
+
+		if(it != m_connections.end())
+		{
+			conn = &it->second;
+		}
+		else
+		{
+			if(m_connections.size() >= m_max_size)
+			{
+				m_n_drops++;
+				return NULL;
+			}
+
+			conn = &m_connections[key];
+		}
+
+		if(isclient)
+		{
+			conn->m_cpid = pid;
+			conn->m_ctid = tid;
+			conn->m_cfd = fd;
+		}
+		else
+		{
+			conn->m_spid = pid;
+			conn->m_stid = tid;
+			conn->m_sfd = fd;
+		}
+
+		conn->m_lastaccess_ts = ts;
+		return conn;
+	}
+
+	/*!
+	  \brief Forget the end of the connection that is the fd of the process
+	   pid. The fd table is shared by the threads of a process, so the end
+	   is the same whatever thread closes it. The connection is removed when
+	   both its ends are gone.
+	*/
+	void remove_connection(const TKey& key, int64_t pid, int64_t fd)
+	{
+		typename connection_map::iterator it = m_connections.find(key);
+
+		if(it == m_connections.end())
+		{
+			return;
+		}
+
+		sinsp_connection* conn = &it->second;
+
+		if(conn->m_cpid == pid && conn->m_cfd == fd)
+		{
+			conn->m_cpid = -1;
+			conn->m_ctid = -1;
+			conn->m_cfd = -1;
+		}
+
+		if(conn->m_spid == pid && conn->m_sfd == fd)
+		{
+			conn->m_spid = -1;
+			conn->m_stid = -1;
+			conn->m_sfd = -1;
+		}
+
+		if(!conn->has_client() && !conn->has_server())
+		{
+			m_connections.erase(it);
+		}
+	}
+
+	/*!
+	  \brief Return the connection with the given key, or NULL if it's not
+	   in the table.
+	*/
+	sinsp_connection* get_connection(const TKey& key, uint64_t ts)
+	{
+		typename connection_map::iterator it = m_connections.find(key);
+
+		if(it == m_connections.end())
+		{
+			return NULL;
+		}
+
+		it->second.m_lastaccess_ts = ts;
+		return &it->second;
+	}
+
+	/*!
+	  \brief Remove the connections that were not looked up in the last
+	   timeout. The table is only scanned every CONNECTION_SCAN_INTERVAL_S.
+	*/
+	void remove_expired_connections(uint64_t ts)
+	{
+		typename connection_map::iterator it;
+
+		if(m_last_scan_ts == 0)
+		{
+			m_last_scan_ts = ts;
+		}
+
+		if(ts <= m_last_scan_ts + CONNECTION_SCAN_INTERVAL_S * ONE_SECOND_IN_NS)
+		{
+			return;
+		}
+
+		m_last_scan_ts = ts;
+
+		for(it = m_connections.begin(); it != m_connections.end();)
+		{
+			if(ts > it->second.m_lastaccess_ts + m_timeout_ns)
+			{
+				it = m_connections.erase(it);
+			}
+			else
+			{
+				++it;
+			}
+		}
+	}
+
+	void clear()
+	{
+		m_connections.clear();
+		m_last_scan_ts = 0;
+	}
+
+	uint32_t size()
+	{
+		return (uint32_t)m_connections.size();
+	}
+
+	/*!
+	  \brief Number of connections that were not tracked because the table
+	   was full.
+	*/
+	uint64_t get_n_drops()
+	{
+		return m_n_drops;
+	}
+
+private:
+	sinsp* m_inspector;
+	connection_map m_connections;
+	uint32_t m_max_size;
+	uint64_t m_timeout_ns;
+	uint64_t m_last_scan_ts;
+	uint64_t m_n_drops;
+};
+
+//
+// Hash and comparison of the tuples, on their bytes
+//
+struct ip4t_hash
+{
+	size_t operator()(const ipv4tuple& t) const
+	{
+		size_t res = (size_t)0xcbf29ce484222325ULL;
+		uint32_t j;
+
+		for(j = 0; j < sizeof(t.m_all); j++)
+		{
+			res ^= t.m_all[j];
+			res *= (size_t)0x100000001b3ULL;
+		}
+
+		return res;
+	}
+};
+
+struct ip4t_cmp
+{
+	bool operator()(const ipv4tuple& a, const ipv4tuple& b) const
+	{
+		return memcmp(a.m_all, b.m_all, sizeof(a.m_all)) == 0;
+	}
+};
+
+typedef sinsp_connection_manager<ipv4tuple, ip4t_hash, ip4t_cmp> sinsp_ipv4_connection_manager;
+
+//
+// The IPv6 tuples are compared and hashed a word at a time, since hashing
+// their 37 bytes one by one would cost much more than for the IPv4 ones
+//
+struct ip6t_hash
+{
+	size_t operator()(const ipv6tuple& t) const
+	{
+		return ipv6tuple_hash(&t);
+	}
+};
+
+struct ip6t_cmp
+{
+	bool operator()(const ipv6tuple& a, const ipv6tuple& b) const
+	{
+		return ipv6tuple_equal(&a, &b);
+	}
+};
+
+typedef sinsp_connection_manager<ipv6tuple, ip6t_hash, ip6t_cmp> sinsp_ipv6_connection_manager;
+
+/*@}*/
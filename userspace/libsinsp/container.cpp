@@ -0,0 +1,153 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "sinsp.h"
+#include "sinsp_int.h"
+
+//
+// Length of the container ids of docker, containerd and cri-o, and of the
+// short version of them
+//
+#define CONTAINER_ID_LEN 64
+#define CONTAINER_SHORT_ID_LEN 12
+
+sinsp_container_manager::sinsp_container_manager()
+{
+	sinsp_container_info host;
+
+	host.m_id = "host";
+	m_containers.push_back(host);
+}
+
+bool sinsp_container_manager::parse_cgroup(const char* cgroup, OUT string* id)
+{
+	const char* p;
+	const char* run = NULL;
+
+	//
+	// LXC: /lxc/<name>/... or /lxc.payload.<name>/...
+	//
+	if(strncmp(cgroup, "/lxc/", sizeof("/lxc/") - 1) == 0 ||
+		strncmp(cgroup, "/lxc.payload.", sizeof("/lxc.payload.") - 1) == 0)
+	{
+		p = cgroup + ((cgroup[4] == '/')? sizeof("/lxc/") - 1 : sizeof("/lxc.payload.") - 1);
+		size_t len = strcspn(p, "/");
+
+		if(len == 0)
+		{
+			return false;
+		}
+
+		id->assign(p, len);
+		return true;
+	}
+
+	//
+	// Everything else: a run of exactly 64 hex digits, which can be a
+	// directory (/docker/<id>, /kubepods/.../<id>) or part of one
+	// (docker-<id>.scope, crio-<id>.scope)
+	//
+	for(p = cgroup; ; p++)
+	{
+		if(isxdigit((unsigned char)*p))
+		{
+			if(run == NULL)
+			{
+				run = p;
+			}
+
+			continue;
+		}
+
+		if(run != NULL && p - run == CONTAINER_ID_LEN)
+		{
+			id->assign(run, CONTAINER_SHORT_ID_LEN);
+			return true;
+		}
+
+		run = NULL;
+
+		if(*p == 0)
+		{
+			return false;
+		}
+	}
+}
+
+uint32_t sinsp_container_manager::intern(const char* cgroup)
+{
+	unordered_map<string, uint32_t>::iterator it;
+	uint32_t num;
+	string id;
+
+	if(cgroup[0] == 0)
+	{
+		return SINSP_HOST_CONTAINER_NUM;
+	}
+
+	it = m_cgroups.find(cgroup);
+	if(it != m_cgroups.end())
+	{
+		return it->second;
+	}
+
+	if(!parse_cgroup(cgroup, &id))
+	{
+		num = SINSP_HOST_CONTAINER_NUM;
+	}
+	else
+	{
+		it = m_ids.find(id);
+		if(it != m_ids.end())
+		{
+			num = it->second;
+		}
+		else
+		{
+			sinsp_container_info cinfo;
+
+			cinfo.m_id = id;
+			cinfo.m_cgroup = cgroup;
+
+			num = m_containers.size();
+			m_containers.push_back(cinfo);
+			m_ids[id] = num;
+		}
+	}
+
+	m_cgroups[cgroup] = num;
+	return num;
+}
+
+int64_t sinsp_container_manager::find(const string& id)
+{
+	unordered_map<string, uint32_t>::iterator it;
+
+	if(id == m_containers[SINSP_HOST_CONTAINER_NUM].m_id)
+	{
+		return SINSP_HOST_CONTAINER_NUM;
+	}
+
+	it = m_ids.find(id);
+	if(it == m_ids.end())
+	{
+		return -1;
+	}
+
+	return it->second;
+}
@@ -0,0 +1,81 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+//
+// Number of the processes that don't run in a container
+//
+#define SINSP_HOST_CONTAINER_NUM 0
+
+//
+// A container, as seen through the cgroup of its processes
+//
+class SINSP_PUBLIC sinsp_container_info
+{
+public:
+	string m_id; // Short id, like the one shown by docker ps. "host" for the host
+	string m_cgroup; // cgroup of the first process seen in the container
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// The containers of the capture. Each thread only keeps the number of its
+// container, so comparing the containers of two threads, or filtering on
+// one, is an integer compare. The numbers are assigned in the order the
+// containers are seen and never reused during a capture.
+///////////////////////////////////////////////////////////////////////////////
+class SINSP_PUBLIC sinsp_container_manager
+{
+public:
+	sinsp_container_manager();
+
+	//
+	// Return the number of the container of a process with the given cgroup,
+	// adding the container if it's new. The processes whose cgroup doesn't
+	// belong to a container are in SINSP_HOST_CONTAINER_NUM.
+	//
+	uint32_t intern(const char* cgroup);
+
+	//
+	// Return the number of a container from its short id, or -1 if it
+	// hasn't been seen
+	//
+	int64_t find(const string& id);
+
+	const sinsp_container_info& get(uint32_t num)
+	{
+		return m_containers[num];
+	}
+
+	uint32_t size()
+	{
+		return m_containers.size();
+	}
+
+	//
+	// Extract the container id from a cgroup path, e.g. the 64 hex digits
+	// of docker, containerd and cri-o, or the name of an LXC container.
+	// Return false if the path doesn't belong to a container.
+	//
+	static bool parse_cgroup(const char* cgroup, OUT string* id);
+
+private:
+	vector<sinsp_container_info> m_containers;
+	unordered_map<string, uint32_t> m_ids;
+	unordered_map<string, uint32_t> m_cgroups; // cgroups already parsed, and their container
+};
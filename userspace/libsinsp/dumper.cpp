@@ -16,15 +16,218 @@ You should have received a copy of the GNU General Public License
 along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <deque>
+#ifdef HAS_ZLIB
+#include <zlib.h>
+#endif
+
 #include "sinsp.h"
 #include "sinsp_int.h"
 #include "../libscap/scap.h"
 #include "dumper.h"
+#include "filter.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// The events retained by the flight recorder, oldest first, in blocks of up
+// to FLIGHT_RECORDER_BLOCK_SIZE bytes. The block being filled is kept as
+// is, the full ones are compressed when zlib is available. The oldest
+// blocks are dropped when the blocks go over the size limit, or when their
+// last event is older than the time limit.
+//
+// Each event follows a record_header, and is padded to 8 bytes so that the
+// events of a block are aligned.
+///////////////////////////////////////////////////////////////////////////////
+class sinsp_event_ring
+{
+public:
+	sinsp_event_ring(uint64_t max_bytes, uint64_t max_duration_ns)
+	{
+		m_max_bytes = max_bytes;
+		m_max_duration_ns = max_duration_ns;
+		m_bytes = 0;
+		m_cur.reserve(FLIGHT_RECORDER_BLOCK_SIZE);
+	}
+
+	~sinsp_event_ring()
+	{
+		for(deque<block*>::iterator it = m_blocks.begin(); it != m_blocks.end(); ++it)
+		{
+			delete *it;
+		}
+	}
+
+	void add(scap_evt* pevt, uint16_t cpuid, uint64_t ts);
+
+	//
+	// Write the retained events, oldest first
+	//
+	int32_t write(scap_t* h, scap_dumper_t* d);
+
+private:
+	struct record_header
+	{
+		uint16_t m_cpuid;
+		uint16_t m_reserved;
+		uint32_t m_len; // The event, without the padding
+	};
+
+	struct block
+	{
+		vector<char> m_data;
+		uint32_t m_len; // Before compression
+		uint64_t m_last_ts;
+		bool m_compressed;
+	};
+
+	void seal();
+	static int32_t write_records(scap_t* h, scap_dumper_t* d, const char* buf, uint32_t len);
+
+	uint64_t m_max_bytes;
+	uint64_t m_max_duration_ns;
+	deque<block*> m_blocks;
+	uint64_t m_bytes; // Of the blocks in m_blocks
+	vector<char> m_cur;
+	uint64_t m_cur_last_ts;
+};
+
+void sinsp_event_ring::add(scap_evt* pevt, uint16_t cpuid, uint64_t ts)
+{
+	record_header rh;
+	uint32_t padded_len = (pevt->len + 7) & ~7;
+	size_t pos;
+
+	if(!m_cur.empty() && m_cur.size() + sizeof(rh) + padded_len > FLIGHT_RECORDER_BLOCK_SIZE)
+	{
+		seal();
+	}
+
+	rh.m_cpuid = cpuid;
+	rh.m_reserved = 0;
+	rh.m_len = pevt->len;
+
+	pos = m_cur.size();
+	m_cur.resize(pos + sizeof(rh) + padded_len);
+	memcpy(&m_cur[pos], &rh, sizeof(rh));
+	memcpy(&m_cur[pos + sizeof(rh)], pevt, pevt->len);
+	m_cur_last_ts = ts;
+
+	while(!m_blocks.empty() &&
+		(m_bytes + m_cur.size() > m_max_bytes ||
+		(m_max_duration_ns != 0 && m_blocks.front()->m_last_ts + m_max_duration_ns < ts)))
+	{
+		m_bytes -= m_blocks.front()->m_data.size();
+		delete m_blocks.front();
+		m_blocks.pop_front();
+	}
+}
+
+//
+// Move the current block to the list, compressed if possible
+//
+void sinsp_event_ring::seal()
+{
+	block* b = new block;
+
+	b->m_len = (uint32_t)m_cur.size();
+	b->m_last_ts = m_cur_last_ts;
+	b->m_compressed = false;
+
+#ifdef HAS_ZLIB
+	uLongf zlen = compressBound(b->m_len);
+
+	b->m_data.resize(zlen);
+	if(compress2((Bytef *)&b->m_data[0], &zlen, (const Bytef *)&m_cur[0], b->m_len, Z_BEST_SPEED) == Z_OK &&
+		zlen < b->m_len)
+	{
+		b->m_data.resize(zlen);
+		b->m_compressed = true;
+	}
+#endif
+
+	if(!b->m_compressed)
+	{
+		b->m_data.assign(m_cur.begin(), m_cur.end());
+	}
+
+	m_bytes += b->m_data.size();
+	m_blocks.push_back(b);
+	m_cur.clear();
+}
+
+int32_t sinsp_event_ring::write(scap_t* h, scap_dumper_t* d)
+{
+	vector<char> buf;
+	int32_t res = SCAP_SUCCESS;
+
+	for(deque<block*>::iterator it = m_blocks.begin(); it != m_blocks.end(); ++it)
+	{
+		block* b = *it;
+
+		if(b->m_compressed)
+		{
+#ifdef HAS_ZLIB
+			uLongf len = b->m_len;
+
+			buf.resize(b->m_len);
+			if(uncompress((Bytef *)&buf[0], &len, (const Bytef *)&b->m_data[0], b->m_data.size()) != Z_OK ||
+				len != b->m_len)
+			{
+				throw sinsp_exception("corrupted flight recorder block");
+			}
+
+			res = write_records(h, d, &buf[0], b->m_len);
+#endif
+		}
+		else
+		{
+			res = write_records(h, d, &b->m_data[0], b->m_len);
+		}
+
+		if(res != SCAP_SUCCESS)
+		{
+			return res;
+		}
+	}
+
+	if(m_cur.empty())
+	{
+		return SCAP_SUCCESS;
+	}
+
+	return write_records(h, d, &m_cur[0], (uint32_t)m_cur.size());
+}
+
+int32_t sinsp_event_ring::write_records(scap_t* h, scap_dumper_t* d, const char* buf, uint32_t len)
+{
+	uint32_t pos = 0;
+	record_header rh;
+	int32_t res;
+
+	while(pos < len)
+	{
+		memcpy(&rh, buf + pos, sizeof(rh));
+
+		res = scap_dump(h, d, (scap_evt*)(buf + pos + sizeof(rh)), rh.m_cpuid);
+		if(res != SCAP_SUCCESS)
+		{
+			return res;
+		}
+
+		pos += sizeof(rh) + ((rh.m_len + 7) & ~7);
+	}
+
+	return SCAP_SUCCESS;
+}
 
 sinsp_dumper::sinsp_dumper(sinsp* inspector)
 {
 	m_inspector = inspector;
 	m_dumper = NULL;
+	m_ring = NULL;
+	m_trigger = NULL;
+	m_post_trigger_ns = 0;
+	m_trigger_end_ts = 0;
+	m_ntriggers = 0;
 }
 
 sinsp_dumper::~sinsp_dumper()
@@ -33,6 +236,11 @@ sinsp_dumper::~sinsp_dumper()
 	{
 		scap_dump_close(m_dumper);
 	}
+
+	delete m_ring;
+#ifdef HAS_FILTERING
+	delete m_trigger;
+#endif
 }
 
 void sinsp_dumper::open(const string& filename)
@@ -47,10 +255,23 @@ void sinsp_dumper::open(const string& filename)
 	{
 		throw sinsp_exception(scap_getlasterr(m_inspector->m_h));
 	}
+
+#ifdef HAS_FILTERING
+	m_inspector->get_block_summarizer();
+	scap_dump_set_summary_kinds(m_dumper, sinsp_block_summarizer::get_kinds());
+#endif
 }
 
 void sinsp_dumper::dump(sinsp_evt* evt)
 {
+#ifdef HAS_FILTERING
+	if(m_ring != NULL)
+	{
+		record(evt);
+		return;
+	}
+#endif
+
 	if(m_dumper == NULL)
 	{
 		throw sinsp_exception("dumper not opened yet");
@@ -63,6 +284,10 @@ void sinsp_dumper::dump(sinsp_evt* evt)
 	{
 		throw sinsp_exception(scap_getlasterr(m_inspector->m_h));
 	}
+
+#ifdef HAS_FILTERING
+	m_inspector->m_block_summarizer->add_keys(m_dumper, evt);
+#endif
 }
 
 uint64_t sinsp_dumper::written_bytes()
@@ -74,3 +299,239 @@ uint64_t sinsp_dumper::written_bytes()
 
 	return scap_dump_ftell(m_dumper);	
 }
+
+#ifdef HAS_FILTERING
+void sinsp_dumper::open_flight_recorder(const string& filename,
+	const string& trigger,
+	uint64_t max_bytes,
+	uint64_t max_duration_ns,
+	uint64_t post_trigger_ns)
+{
+	if(m_inspector->m_h == NULL)
+	{
+		throw sinsp_exception("can't start event dump, inspector not opened yet");
+	}
+
+	if(m_dumper != NULL || m_ring != NULL)
+	{
+		throw sinsp_exception("dumper already opened");
+	}
+
+	m_trigger = new sinsp_filter(m_inspector, trigger);
+	m_ring = new sinsp_event_ring(max_bytes, max_duration_ns);
+	m_trigger_filename = filename;
+	m_post_trigger_ns = post_trigger_ns;
+}
+
+//
+// Flight recorder mode: keep the event, and write it if a trigger is in
+// progress or if it matches the trigger
+//
+void sinsp_dumper::record(sinsp_evt* evt)
+{
+	uint64_t ts = evt->get_ts();
+	bool triggered = m_trigger->run(evt);
+
+	m_ring->add(evt->m_pevt, evt->m_cpuid, ts);
+
+	if(m_dumper == NULL)
+	{
+		if(triggered)
+		{
+			start_trigger(ts);
+		}
+	}
+	else
+	{
+		int32_t res = scap_dump(m_inspector->m_h, m_dumper, evt->m_pevt, evt->m_cpuid);
+
+		if(res != SCAP_SUCCESS)
+		{
+			throw sinsp_exception(scap_getlasterr(m_inspector->m_h));
+		}
+
+		m_inspector->get_block_summarizer()->add_keys(m_dumper, evt);
+
+		if(triggered)
+		{
+			m_trigger_end_ts = ts + m_post_trigger_ns;
+		}
+	}
+
+	if(m_dumper != NULL && ts >= m_trigger_end_ts)
+	{
+		scap_dump_close(m_dumper);
+		m_dumper = NULL;
+	}
+}
+
+//
+// Open the file of a new trigger, with the current tables, and write the
+// retained events, which include the one that matched
+//
+void sinsp_dumper::start_trigger(uint64_t ts)
+{
+	string fname = m_trigger_filename + to_string((long long unsigned int)m_ntriggers);
+	scap_threadinfo* table = m_inspector->m_thread_manager->to_scap_table();
+
+	m_dumper = scap_dump_open_ex(m_inspector->m_h, fname.c_str(), table);
+	sinsp_thread_manager::free_scap_table(table);
+
+	if(m_dumper == NULL)
+	{
+		throw sinsp_exception(scap_getlasterr(m_inspector->m_h));
+	}
+
+	m_ntriggers++;
+	m_trigger_end_ts = ts + m_post_trigger_ns;
+
+	if(m_ring->write(m_inspector->m_h, m_dumper) != SCAP_SUCCESS)
+	{
+		throw sinsp_exception(scap_getlasterr(m_inspector->m_h));
+	}
+
+	//
+	// The keys of the retained events are not known, so their groups are
+	// only summarized by thread id
+	//
+	scap_dump_set_summary_kinds(m_dumper, sinsp_block_summarizer::get_kinds());
+}
+#endif
+
+sinsp_dump_manager::sinsp_dump_manager(sinsp* inspector)
+{
+	m_inspector = inspector;
+}
+
+sinsp_dump_manager::~sinsp_dump_manager()
+{
+	uint32_t j;
+
+	for(j = 0; j < m_outputs.size(); j++)
+	{
+		close(j);
+	}
+}
+
+uint32_t sinsp_dump_manager::open(const string& filename, const string& filter)
+{
+	output o;
+
+	if(m_inspector->m_h == NULL)
+	{
+		throw sinsp_exception("can't start event dump, inspector not opened yet");
+	}
+
+	o.m_filter = NULL;
+
+	if(!filter.empty())
+	{
+#ifdef HAS_FILTERING
+		o.m_filter = new sinsp_filter(m_inspector, filter);
+#else
+		throw sinsp_exception("filtering not supported");
+#endif
+	}
+
+	o.m_dumper = scap_dump_open(m_inspector->m_h, filename.c_str());
+	if(o.m_dumper == NULL)
+	{
+#ifdef HAS_FILTERING
+		delete o.m_filter;
+#endif
+		throw sinsp_exception(scap_getlasterr(m_inspector->m_h));
+	}
+
+	m_outputs.push_back(o);
+
+	try
+	{
+		m_inspector->configure_dumper(o.m_dumper);
+	}
+	catch(...)
+	{
+		close((uint32_t)m_outputs.size() - 1);
+		throw;
+	}
+
+	return (uint32_t)m_outputs.size() - 1;
+}
+
+sinsp_dump_manager::output* sinsp_dump_manager::get_output(uint32_t id)
+{
+	if(id >= m_outputs.size() || m_outputs[id].m_dumper == NULL)
+	{
+		throw sinsp_exception("invalid dump id " + to_string((long long unsigned int)id));
+	}
+
+	return &m_outputs[id];
+}
+
+void sinsp_dump_manager::close(uint32_t id)
+{
+	output* o;
+
+	if(id >= m_outputs.size())
+	{
+		throw sinsp_exception("invalid dump id " + to_string((long long unsigned int)id));
+	}
+
+	o = &m_outputs[id];
+
+	if(o->m_dumper != NULL)
+	{
+		scap_dump_close(o->m_dumper);
+		o->m_dumper = NULL;
+	}
+
+#ifdef HAS_FILTERING
+	delete o->m_filter;
+#endif
+	o->m_filter = NULL;
+}
+
+uint64_t sinsp_dump_manager::written_bytes(uint32_t id)
+{
+	return scap_dump_ftell(get_output(id)->m_dumper);
+}
+
+void sinsp_dump_manager::dump(sinsp_evt* evt)
+{
+	uint32_t j;
+
+	m_matched.clear();
+
+	for(j = 0; j < m_outputs.size(); j++)
+	{
+		output* o = &m_outputs[j];
+
+		if(o->m_dumper == NULL)
+		{
+			continue;
+		}
+
+#ifdef HAS_FILTERING
+		if(o->m_filter != NULL && !o->m_filter->run(evt))
+		{
+			continue;
+		}
+#endif
+
+		m_matched.push_back(o->m_dumper);
+	}
+
+	if(m_matched.empty())
+	{
+		return;
+	}
+
+	if(scap_dump_multi(m_inspector->m_h, &m_matched[0], (uint32_t)m_matched.size(),
+		evt->m_pevt, evt->m_cpuid) != SCAP_SUCCESS)
+	{
+		throw sinsp_exception(scap_getlasterr(m_inspector->m_h));
+	}
+
+#ifdef HAS_FILTERING
+	m_inspector->m_block_summarizer->add_keys(&m_matched[0], (uint32_t)m_matched.size(), evt);
+#endif
+}
@@ -20,6 +20,13 @@ along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
 
 class sinsp;
 class sinsp_evt;
+class sinsp_filter;
+class sinsp_event_ring;
+
+//
+// The uncompressed size of the blocks of the flight recorder
+//
+#define FLIGHT_RECORDER_BLOCK_SIZE (256 * 1024)
 
 /** @defgroup dump Dumping events to disk 
  * Classes to perform miscellneous functionality
@@ -66,9 +73,135 @@ public:
 	*/
 	void dump(sinsp_evt* evt);
 
+#ifdef HAS_FILTERING
+	/*!
+	  \brief Turns the dumper into a flight recorder. Instead of writing the
+	   events to a file, \ref dump() keeps the most recent ones in memory,
+	   in compressed blocks, and only writes them when an event matches the
+	   trigger filter. Each trigger writes a new file with the retained
+	   events and the ones of the next post_trigger_ns nanoseconds. A
+	   trigger during that time extends it.
+
+	  \param filename the prefix of the files. The first trigger writes
+	   <filename>0, the second <filename>1, and so on.
+	  \param trigger the filter that starts a file.
+	  \param max_bytes how much memory the retained events can use,
+	   compressed.
+	  \param max_duration_ns how old the retained events can be, 0 for no
+	   limit.
+	  \param post_trigger_ns how long to keep writing after a trigger.
+
+	  \note the process and fd tables at the beginning of the files are the
+	   ones of the inspector when the trigger matched, so the processes that
+	   ended before it are only known from the events in the file.
+
+	  @throws a sinsp_exception if the filter is invalid.
+	*/
+	void open_flight_recorder(const string& filename,
+		const string& trigger,
+		uint64_t max_bytes,
+		uint64_t max_duration_ns,
+		uint64_t post_trigger_ns);
+
+	/*!
+	  \brief Return the number of files written by the flight recorder.
+	*/
+	uint64_t get_ntriggers()
+	{
+		return m_ntriggers;
+	}
+#endif
+
 private:
+#ifdef HAS_FILTERING
+	void record(sinsp_evt* evt);
+	void start_trigger(uint64_t ts);
+#endif
+
 	sinsp* m_inspector;
 	scap_dumper_t* m_dumper;
+
+	//
+	// The flight recorder. m_dumper is only open while a trigger is being
+	// written.
+	//
+	sinsp_event_ring* m_ring;
+	sinsp_filter* m_trigger;
+	string m_trigger_filename;
+	uint64_t m_post_trigger_ns;
+	uint64_t m_trigger_end_ts;
+	uint64_t m_ntriggers;
+};
+
+/*!
+  \brief Writes the events to several files at once, each with its own
+   filter. The filters are evaluated once per event, and the block of each
+   event is rendered once for all the files that take it, with
+   scap_dump_multi(). The summary keys of the event are also extracted
+   once. N files cost much less than N \ref sinsp_dumper.
+
+  \note The files are written with the dump settings of the inspector,
+   see \ref sinsp::set_dump_buffering(), \ref sinsp::set_dump_compression()
+   and \ref sinsp::set_dump_fold_repeats(). Each file starts with its own
+   copy of the tables.
+*/
+class SINSP_PUBLIC sinsp_dump_manager
+{
+public:
+	/*!
+	  \brief Constructs the manager.
+
+	  \param inspector Pointer to the inspector object that will be the source
+	   of the events to save.
+	*/
+	sinsp_dump_manager(sinsp* inspector);
+
+	~sinsp_dump_manager();
+
+	/*!
+	  \brief Opens a file.
+
+	  \param filename The name of the target file.
+	  \param filter The events to write to it, in the sysdig filter syntax.
+	   Empty for all of them.
+
+	  \return the id of the file, for \ref written_bytes() and
+	   \ref close().
+
+	  @throws a sinsp_exception if the file can't be opened or the filter is
+	   invalid.
+	*/
+	uint32_t open(const string& filename, const string& filter = "");
+
+	/*!
+	  \brief Closes a file. Its id is not reused.
+	*/
+	void close(uint32_t id);
+
+	/*!
+	  \brief Return the current size of a file.
+	*/
+	uint64_t written_bytes(uint32_t id);
+
+	/*!
+	  \brief Writes an event to the files whose filter it matches.
+
+	  \param evt Pointer to the event to dump.
+	*/
+	void dump(sinsp_evt* evt);
+
+private:
+	struct output
+	{
+		scap_dumper_t* m_dumper; // NULL once closed
+		sinsp_filter* m_filter; // NULL to take every event
+	};
+
+	output* get_output(uint32_t id);
+
+	sinsp* m_inspector;
+	vector<output> m_outputs;
+	vector<scap_dumper_t*> m_matched; // The files of the event being dumped
 };
 
 /*@}*/
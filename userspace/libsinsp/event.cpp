@@ -22,6 +22,9 @@ along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
 #include <sys/socket.h>
 #include <algorithm>
 #endif
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "sinsp.h"
 #include "sinsp_int.h"
@@ -30,6 +33,76 @@ along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
 
 extern sinsp_evttables g_infotables;
 
+///////////////////////////////////////////////////////////////////////////////
+// sinsp_evttables implementation
+///////////////////////////////////////////////////////////////////////////////
+
+//
+// Size of the values of the parameter types that the driver always writes
+// with the same size (see val_to_ring()), 0 for the others
+//
+static uint32_t get_fixed_param_size(ppm_param_type type)
+{
+	switch(type)
+	{
+	case PT_INT8:
+	case PT_UINT8:
+	case PT_FLAGS8:
+	case PT_SIGTYPE:
+		return 1;
+	case PT_INT16:
+	case PT_UINT16:
+	case PT_FLAGS16:
+	case PT_SYSCALLID:
+		return 2;
+	case PT_INT32:
+	case PT_UINT32:
+	case PT_FLAGS32:
+		return 4;
+	case PT_INT64:
+	case PT_UINT64:
+	case PT_ERRNO:
+	case PT_FD:
+	case PT_PID:
+	case PT_RELTIME:
+	case PT_ABSTIME:
+		return 8;
+	default:
+		return 0;
+	}
+}
+
+void sinsp_evttables::init_param_offsets()
+{
+	uint32_t j;
+	uint32_t k;
+
+	for(j = 0; j < PPM_EVENT_MAX; j++)
+	{
+		const struct ppm_event_info* einfo = &m_event_info[j];
+		uint32_t offset = sizeof(struct ppm_evt_hdr) + einfo->nparams * sizeof(uint16_t);
+
+		for(k = 0; k < PPM_MAX_EVENT_PARAMS; k++)
+		{
+			m_param_offsets[j][k] = SINSP_VARIABLE_PARAM_OFFSET;
+		}
+
+		for(k = 0; k < einfo->nparams; k++)
+		{
+			uint32_t size = get_fixed_param_size(einfo->params[k].type);
+
+			m_param_offsets[j][k] = (uint16_t)offset;
+
+			if(size == 0)
+			{
+				break;
+			}
+
+			offset += size;
+		}
+	}
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // sinsp_evt_param implementation
 ///////////////////////////////////////////////////////////////////////////////
@@ -46,10 +119,16 @@ sinsp_evt::sinsp_evt() :
 	m_paramstr_storage(256), m_resolved_paramstr_storage(1024)
 {
 	m_params_loaded = false;
+	m_rendered_mask = 0;
 	m_tinfo = NULL;
+	m_cpuid = 0;
+	m_after_drop = false;
 #ifdef _DEBUG
 	m_filtered_out = false;
 #endif
+#ifdef HAS_FILTERING
+	m_batch_rejected = false;
+#endif
 }
 
 sinsp_evt::sinsp_evt(sinsp *inspector) :
@@ -57,10 +136,16 @@ sinsp_evt::sinsp_evt(sinsp *inspector) :
 {
 	m_inspector = inspector;
 	m_params_loaded = false;
+	m_rendered_mask = 0;
 	m_tinfo = NULL;
+	m_cpuid = 0;
+	m_after_drop = false;
 #ifdef _DEBUG
 	m_filtered_out = false;
 #endif
+#ifdef HAS_FILTERING
+	m_batch_rejected = false;
+#endif
 }
 
 sinsp_evt::~sinsp_evt()
@@ -70,7 +155,9 @@ sinsp_evt::~sinsp_evt()
 void sinsp_evt::init()
 {
 	m_params_loaded = false;
+	m_rendered_mask = 0;
 	m_info = scap_event_getinfo(m_pevt);
+	m_param_offsets = g_infotables.m_param_offsets[m_pevt->type];
 	m_tinfo = NULL;
 	m_fdinfo = NULL;
 	m_iosize = 0;
@@ -79,8 +166,10 @@ void sinsp_evt::init()
 void sinsp_evt::init(uint8_t *evdata, uint16_t cpuid)
 {
 	m_params_loaded = false;
+	m_rendered_mask = 0;
 	m_pevt = (scap_evt *)evdata;
 	m_info = scap_event_getinfo(m_pevt);
+	m_param_offsets = g_infotables.m_param_offsets[m_pevt->type];
 	m_tinfo = NULL;
 	m_fdinfo = NULL;
 	m_iosize = 0;
@@ -168,13 +257,7 @@ uint64_t sinsp_evt::get_fd_num()
 
 uint32_t sinsp_evt::get_num_params()
 {
-	if(!m_params_loaded)
-	{
-		load_params();
-		m_params_loaded = true;
-	}
-
-	return m_params.size();
+	return m_info->nparams;
 }
 
 sinsp_evt_param *sinsp_evt::get_param(uint32_t id)
@@ -185,17 +268,13 @@ sinsp_evt_param *sinsp_evt::get_param(uint32_t id)
 		m_params_loaded = true;
 	}
 
+	ASSERT(id < m_info->nparams);
+
 	return &(m_params[id]);
 }
 
 const char *sinsp_evt::get_param_name(uint32_t id)
 {
-	if(!m_params_loaded)
-	{
-		load_params();
-		m_params_loaded = true;
-	}
-
 	ASSERT(id < m_info->nparams);
 
 	return m_info->params[id].name;
@@ -203,88 +282,156 @@ const char *sinsp_evt::get_param_name(uint32_t id)
 
 const struct ppm_param_info* sinsp_evt::get_param_info(uint32_t id)
 {
-	if(!m_params_loaded)
-	{
-		load_params();
-		m_params_loaded = true;
-	}
-
 	ASSERT(id < m_info->nparams);
 
 	return &(m_info->params[id]);
 }
 
+//
+// The buffer renderings below write the characters with table lookups and
+// copy the runs of plain text in blocks, instead of going through sprintf()
+// and isprint() for each byte. The output is the same as the one of the
+// byte by byte versions.
+//
+static const char g_hex_digits[] = "0123456789abcdef";
+
+//
+// isprint() in the C locale, the one of the library
+//
+static inline bool is_printable(uint8_t c)
+{
+	return (uint8_t)(c - 0x20) < 0x5f;
+}
+
+static inline char* write_hex_byte(char* dst, uint8_t b)
+{
+	dst[0] = g_hex_digits[b >> 4];
+	dst[1] = g_hex_digits[b & 0xf];
+	return dst + 2;
+}
+
+#ifdef __SSE2__
+//
+// The number of leading bytes, among the 16 at src, that are printable and
+// are not a quote or a backslash, i.e. that are copied as they are
+//
+static inline uint32_t plain_prefix_len(const char* src)
+{
+	__m128i v = _mm_loadu_si128((const __m128i*)src);
+	__m128i printable = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(0x1f)),
+		_mm_cmplt_epi8(v, _mm_set1_epi8(0x7f)));
+	__m128i special = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')),
+		_mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+	uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_andnot_si128(special, printable));
+
+	return (mask == 0xffff)? 16 : __builtin_ctz(~mask);
+}
+
+//
+// Copy the plain characters at src + *j to dst + *k, 16 at a time, while
+// there are 16 bytes left in the source and the destination has room for
+// them before the last byte that the callers reserve
+//
+static inline void copy_plain_runs(char* dst, const char* src, uint32_t dstlen, uint32_t srclen, uint32_t* j, uint32_t* k)
+{
+	while(*j + 16 <= srclen && *k + 16 < dstlen - 1)
+	{
+		uint32_t n = plain_prefix_len(src + *j);
+
+		_mm_storeu_si128((__m128i*)(dst + *k), _mm_loadu_si128((const __m128i*)(src + *j)));
+		*j += n;
+		*k += n;
+
+		if(n != 16)
+		{
+			break;
+		}
+	}
+}
+#endif
+
 uint32_t binary_buffer_to_hex_string(char *dst, char *src, uint32_t dstlen, uint32_t srclen, sinsp_evt::param_fmt fmt)
 {
 	uint32_t j;
-	uint32_t k;
 	uint32_t l = 0;
-	uint32_t num_chunks;
-	uint32_t row_len;
-	char row[128];
-	char *ptr;
 	bool truncated = false;
 
+	//
+	// One row for each 16 bytes: the offset, the bytes as 16 bit words, and
+	// with PF_HEXASCII the printable characters
+	//
 	for(j = 0; j < srclen; j += 8 * sizeof(uint16_t))
 	{
-		k = 0;
-		k += sprintf(row + k, "\n\t0x%.4x:", j);
+		uint32_t nbytes = min(srclen - j, (uint32_t)(8 * sizeof(uint16_t)));
+		uint32_t nchunks = (nbytes + 1) / 2;
+		uint32_t ndigits = 4;
+		uint32_t row_len;
+		uint32_t i;
+		char* row;
+
+		while(ndigits < 8 && (j >> (ndigits * 4)) != 0)
+		{
+			ndigits++;
+		}
 
-		ptr = &src[j];
-		num_chunks = 0;
-		while(num_chunks < 8 && ptr < src + srclen)
+		row_len = 4 + ndigits + 1 + nchunks * 5;
+		if(fmt & sinsp_evt::PF_HEXASCII)
 		{
-			uint16_t* chunk = (uint16_t*)ptr;
-			if(ptr == src + srclen - 1)
-			{
-				k += sprintf(row + k, "   %.2x", *((uint8_t*)chunk));
-			}
-			else
-			{
-				k += sprintf(row + k, " %.4x", *chunk);
-			}
+			row_len += (8 - nchunks) * 5 + 2 + nbytes;
+		}
 
-			num_chunks++;
-			ptr += sizeof(uint16_t);
+		if(l + row_len >= dstlen - 1)
+		{
+			truncated = true;
+			break;
 		}
 
-		if(fmt & sinsp_evt::PF_HEXASCII)
+		row = dst + l;
+
+		*row++ = '\n';
+		*row++ = '\t';
+		*row++ = '0';
+		*row++ = 'x';
+		for(i = ndigits; i > 0; i--)
 		{
-			// Fill the row with spaces to align it to other rows
-			while(num_chunks < 8)
-			{
-				memset(row + k, ' ', 5);
+			*row++ = g_hex_digits[(j >> ((i - 1) * 4)) & 0xf];
+		}
+		*row++ = ':';
 
-				k += 5;
-				num_chunks++;
-			}
+		//
+		// The words are in the byte order of the machine, and the last byte
+		// of an odd buffer is on its own
+		//
+		for(i = 0; i + 1 < nbytes; i += sizeof(uint16_t))
+		{
+			uint16_t chunk;
 
-			row[k++] = ' ';
-			row[k++] = ' ';
+			memcpy(&chunk, src + j + i, sizeof(uint16_t));
+			*row++ = ' ';
+			row = write_hex_byte(row, (uint8_t)(chunk >> 8));
+			row = write_hex_byte(row, (uint8_t)chunk);
+		}
 
-			for(ptr = &src[j];
-				ptr < src + j + 8 * sizeof(uint16_t) && ptr < src + srclen;
-				ptr++, k++)
-			{
-				if(isprint((int)(uint8_t)*ptr))
-				{
-					row[k] = *ptr;
-				}
-				else
-				{
-					row[k] = '.';
-				}
-			}
+		if(i < nbytes)
+		{
+			memset(row, ' ', 3);
+			row = write_hex_byte(row + 3, (uint8_t)src[j + i]);
 		}
-		row[k] = 0;
 
-		row_len = strlen(row);
-		if(l + row_len >= dstlen - 1)
+		if(fmt & sinsp_evt::PF_HEXASCII)
 		{
-			truncated = true;
-			break;
+			// Fill the row with spaces to align it to other rows
+			memset(row, ' ', (8 - nchunks) * 5 + 2);
+			row += (8 - nchunks) * 5 + 2;
+
+			for(i = 0; i < nbytes; i++)
+			{
+				uint8_t c = (uint8_t)src[j + i];
+
+				*row++ = is_printable(c)? (char)c : '.';
+			}
 		}
-		strcpy(dst + l, row);
+
 		l += row_len;
 	}
 
@@ -309,6 +456,15 @@ uint32_t binary_buffer_to_asciionly_string(char *dst, char *src, uint32_t dstlen
 
 	for(j = 0; j < srclen; j++)
 	{
+#ifdef __SSE2__
+		copy_plain_runs(dst, src, dstlen, srclen, &j, &k);
+
+		if(j == srclen)
+		{
+			break;
+		}
+#endif
+
 		//
 		// Make sure there's enough space in the target buffer.
 		// Note that we reserve two bytes, because some characters are expanded
@@ -320,7 +476,7 @@ uint32_t binary_buffer_to_asciionly_string(char *dst, char *src, uint32_t dstlen
 			return dstlen;
 		}
 
-		if(isprint((int)(uint8_t)src[j]))
+		if(is_printable((uint8_t)src[j]))
 		{
 			switch(src[j])
 			{
@@ -361,6 +517,15 @@ uint32_t binary_buffer_to_string_dots(char *dst, char *src, uint32_t dstlen, uin
 
 	for(j = 0; j < srclen; j++)
 	{
+#ifdef __SSE2__
+		copy_plain_runs(dst, src, dstlen, srclen, &j, &k);
+
+		if(j == srclen)
+		{
+			break;
+		}
+#endif
+
 		//
 		// Make sure there's enough space in the target buffer.
 		// Note that we reserve two bytes, because some characters are expanded
@@ -372,16 +537,22 @@ uint32_t binary_buffer_to_string_dots(char *dst, char *src, uint32_t dstlen, uin
 			return dstlen;
 		}
 
-		if(isprint((int)(uint8_t)src[j]))
+		if(is_printable((uint8_t)src[j]))
 		{
-			switch(src[j])
+			//
+			// The JSON output escapes the whole string later
+			//
+			if(!(fmt & sinsp_evt::PF_JSON))
 			{
-			case '"':
-			case '\\':
-				dst[k++] = '\\';
-				break;
-			default:
-				break;
+				switch(src[j])
+				{
+				case '"':
+				case '\\':
+					dst[k++] = '\\';
+					break;
+				default:
+					break;
+				}
 			}
 
 			dst[k] = src[j];
@@ -465,11 +636,113 @@ uint32_t strcpy_sanitized(char *dest, char *src, uint32_t dstsize)
 	return dstsize;
 }
 
+//
+// Render a flags value with the names of its bits, e.g. O_RDWR|O_CREAT.
+// A name whose value matches the whole value ends the list.
+//
+static void flags_to_str(const struct ppm_name_value* flags, uint32_t val, OUT string* res)
+{
+	const char* separator = "";
+	uint32_t initial_val = val;
+
+	res->clear();
+
+	while(flags != NULL && flags->name != NULL && flags->value != initial_val)
+	{
+		if((val & flags->value) == flags->value && val != 0)
+		{
+			res->append(separator);
+			res->append(flags->name);
+
+			separator = "|";
+			// We remove current flags value to avoid duplicate flags e.g. PPM_O_RDWR, PPM_O_RDONLY, PPM_O_WRONLY
+			val &= ~flags->value;
+		}
+
+		flags++;
+	}
+
+	if(flags != NULL && flags->name != NULL)
+	{
+		res->append(separator);
+		res->append(flags->name);
+	}
+}
+
+//
+// The same flags values come back over and over, so their names are built
+// once per symbol table and kept by the inspector
+//
+const string& sinsp_evt::get_flags_str(const struct ppm_name_value* flags, uint32_t val)
+{
+	unordered_map<uint32_t, string>& table = m_inspector->m_flagstr_tables[flags];
+	unordered_map<uint32_t, string>::iterator it = table.find(val);
+
+	if(it != table.end())
+	{
+		return it->second;
+	}
+
+	if(m_inspector->m_n_flagstrs >= SP_MAX_FLAGSTRS)
+	{
+		flags_to_str(flags, val, &m_inspector->m_flagstr_tmp);
+		return m_inspector->m_flagstr_tmp;
+	}
+
+	string& res = table[val];
+	flags_to_str(flags, val, &res);
+	m_inspector->m_n_flagstrs++;
+	return res;
+}
+
+//
+// The rendered parameters are kept until the next init(), so that the
+// fields that show the same parameter, like evt.args and evt.res, render
+// it once. A string stays valid until the event is reinitialized, or the
+// parser invalidates the cache with invalidate_rendered_params().
+//
 const char* sinsp_evt::get_param_as_str(uint32_t id, OUT const char** resolved_str, sinsp_evt::param_fmt fmt)
 {
-	uint32_t j;
 	ASSERT(id < m_info->nparams);
 
+	rendered_param* rp = &m_rendered_params[id];
+
+	if((m_rendered_mask & (1 << id)) && rp->m_fmt == fmt)
+	{
+		*resolved_str = rp->m_resolved_is_val? &rp->m_val[0] : &rp->m_resolved[0];
+		return &rp->m_val[0];
+	}
+
+	//
+	// The storage vectors take turns between the scratch space and the
+	// slots, so they're allocated only the first time a slot is used
+	//
+	if(m_paramstr_storage.size() < SP_EVT_PARAMSTR_STORAGE_SIZE)
+	{
+		m_paramstr_storage.resize(SP_EVT_PARAMSTR_STORAGE_SIZE);
+	}
+
+	if(m_resolved_paramstr_storage.size() < SP_EVT_PARAMSTR_STORAGE_SIZE)
+	{
+		m_resolved_paramstr_storage.resize(SP_EVT_PARAMSTR_STORAGE_SIZE);
+	}
+
+	render_param(id, resolved_str, fmt);
+
+	rp->m_fmt = fmt;
+	rp->m_resolved_is_val = (*resolved_str == &m_paramstr_storage[0]);
+	rp->m_val.swap(m_paramstr_storage);
+	rp->m_resolved.swap(m_resolved_paramstr_storage);
+	m_rendered_mask |= (1 << id);
+
+	*resolved_str = rp->m_resolved_is_val? &rp->m_val[0] : &rp->m_resolved[0];
+	return &rp->m_val[0];
+}
+
+void sinsp_evt::render_param(uint32_t id, OUT const char** resolved_str, sinsp_evt::param_fmt fmt)
+{
+	uint32_t j;
+
 	//
 	// Make sure the params are actually loaded
 	//
@@ -583,21 +856,23 @@ const char* sinsp_evt::get_param_as_str(uint32_t id, OUT const char** resolved_s
 				//
 				// Make sure we remove invalid characters from the resolved name
 				//
-				string sanitized_str = fdinfo->m_name;
+				const string& name = fdinfo->m_name;
+				char* sanitized_str = (char*)m_inspector->get_evt_arena()->alloc(name.length() + 1);
+				uint32_t sanitized_len = remove_copy_if(name.begin(), name.end(), sanitized_str, g_invalidchar()) - sanitized_str;
 
-				sanitized_str.erase(remove_if(sanitized_str.begin(), sanitized_str.end(), g_invalidchar()), sanitized_str.end());
+				sanitized_str[sanitized_len] = 0;
 
 				//
 				// Make sure the string will fit
 				//
-				if(sanitized_str.size() >= m_resolved_paramstr_storage.size())
+				if(sanitized_len + sizeof("<>") + sizeof(typestr) >= m_resolved_paramstr_storage.size())
 				{
-					m_resolved_paramstr_storage.resize(sanitized_str.size() + 1);
+					m_resolved_paramstr_storage.resize(sanitized_len + sizeof("<>") + sizeof(typestr));
 				}
 
 				snprintf(&m_resolved_paramstr_storage[0],
 					m_resolved_paramstr_storage.size(),
-					"<%s>%s", typestr, sanitized_str.c_str());
+					"<%s>%s", typestr, sanitized_str);
 
 /* XXX
 				if(sanitized_str.length() == 0)
@@ -620,13 +895,9 @@ const char* sinsp_evt::get_param_as_str(uint32_t id, OUT const char** resolved_s
 			//
 			// Resolve this as an errno
 			//
-			string errstr(sinsp_utils::errno_to_str((int32_t)fd));
-			if(errstr != "")
-			{
-				snprintf(&m_resolved_paramstr_storage[0],
-				         m_resolved_paramstr_storage.size(),
-				         "%s", errstr.c_str());
-			}
+			const char* errstr = sinsp_utils::errno_to_str((int32_t)fd);
+			ASSERT(strlen(errstr) < m_resolved_paramstr_storage.size());
+			memcpy(&m_resolved_paramstr_storage[0], errstr, strlen(errstr) + 1);
 		}
 	}
 	break;
@@ -636,13 +907,13 @@ const char* sinsp_evt::get_param_as_str(uint32_t id, OUT const char** resolved_s
 
 			snprintf(&m_paramstr_storage[0],
 					 m_paramstr_storage.size(),
-					 "%" PRId64, *(int64_t *)param->m_val);
+					 "%" PRId64, SCAP_TID_LOCAL(*(int64_t *)param->m_val));
 
 
 			sinsp_threadinfo* atinfo = m_inspector->get_thread(*(int64_t *)param->m_val, false);
 			if(atinfo != NULL)
 			{
-				string& tcomm = atinfo->m_comm;
+				const string& tcomm = atinfo->m_comm;
 
 				//
 				// Make sure the string will fit
@@ -690,18 +961,11 @@ const char* sinsp_evt::get_param_as_str(uint32_t id, OUT const char** resolved_s
 		//
 		// Resolve this as an errno
 		//
-		string errstr;
-
 		if(val < 0)
 		{
-			errstr = sinsp_utils::errno_to_str((int32_t)val);
-
-			if(errstr != "")
-			{
-				snprintf(&m_resolved_paramstr_storage[0],
-				         m_resolved_paramstr_storage.size(),
-				         "%s", errstr.c_str());
-			}
+			const char* errstr = sinsp_utils::errno_to_str((int32_t)val);
+			ASSERT(strlen(errstr) < m_resolved_paramstr_storage.size());
+			memcpy(&m_resolved_paramstr_storage[0], errstr, strlen(errstr) + 1);
 		}
 	}
 	break;
@@ -734,8 +998,7 @@ const char* sinsp_evt::get_param_as_str(uint32_t id, OUT const char** resolved_s
 
 		if(tinfo)
 		{
-			string fullpath;
-			string cwd = tinfo->get_cwd();
+			const string& cwd = tinfo->get_cwd();
 
 			if(!sinsp_utils::concatenate_paths(&m_resolved_paramstr_storage[0],
 				m_resolved_paramstr_storage.size(),
@@ -814,14 +1077,9 @@ const char* sinsp_evt::get_param_as_str(uint32_t id, OUT const char** resolved_s
 		{
 			if(param->m_len == 1 + 4 + 2)
 			{
-				snprintf(&m_paramstr_storage[0],
-				         m_paramstr_storage.size(),
-				         "%u.%u.%u.%u:%u",
-				         (unsigned int)(uint8_t)param->m_val[1],
-				         (unsigned int)(uint8_t)param->m_val[2],
-				         (unsigned int)(uint8_t)param->m_val[3],
-				         (unsigned int)(uint8_t)param->m_val[4],
-				         (unsigned int)*(uint16_t*)(param->m_val+5));
+				char* dst = sinsp_utils::ipv4_to_str((uint8_t*)param->m_val + 1, &m_paramstr_storage[0]);
+				*dst++ = ':';
+				sinsp_utils::port_to_str(*(uint16_t*)(param->m_val + 5), dst);
 			}
 			else
 			{
@@ -852,19 +1110,14 @@ const char* sinsp_evt::get_param_as_str(uint32_t id, OUT const char** resolved_s
 		{
 			if(param->m_len == 1 + 4 + 2 + 4 + 2)
 			{
-				snprintf(&m_paramstr_storage[0],
-				         m_paramstr_storage.size(),
-				         "%u.%u.%u.%u:%u->%u.%u.%u.%u:%u",
-				         (unsigned int)(uint8_t)param->m_val[1],
-				         (unsigned int)(uint8_t)param->m_val[2],
-				         (unsigned int)(uint8_t)param->m_val[3],
-				         (unsigned int)(uint8_t)param->m_val[4],
-				         (unsigned int)*(uint16_t*)(param->m_val+5),
-				         (unsigned int)(uint8_t)param->m_val[7],
-				         (unsigned int)(uint8_t)param->m_val[8],
-				         (unsigned int)(uint8_t)param->m_val[9],
-				         (unsigned int)(uint8_t)param->m_val[10],
-				         (unsigned int)*(uint16_t*)(param->m_val+11));
+				char* dst = sinsp_utils::ipv4_to_str((uint8_t*)param->m_val + 1, &m_paramstr_storage[0]);
+				*dst++ = ':';
+				dst = sinsp_utils::port_to_str(*(uint16_t*)(param->m_val + 5), dst);
+				*dst++ = '-';
+				*dst++ = '>';
+				dst = sinsp_utils::ipv4_to_str((uint8_t*)param->m_val + 7, dst);
+				*dst++ = ':';
+				sinsp_utils::port_to_str(*(uint16_t*)(param->m_val + 11), dst);
 			}
 			else
 			{
@@ -880,43 +1133,33 @@ const char* sinsp_evt::get_param_as_str(uint32_t id, OUT const char** resolved_s
 			{
 				uint8_t* sip6 = (uint8_t*)param->m_val + 1;
 				uint8_t* dip6 = (uint8_t*)param->m_val + 19;
-				uint8_t* sip = (uint8_t*)param->m_val + 13;
-				uint8_t* dip = (uint8_t*)param->m_val + 31;
+				char* dst;
 
+				//
+				// The IPv4-mapped addresses are shown as plain IPv4 ones
+				//
 				if(sinsp_utils::is_ipv4_mapped_ipv6(sip6) && sinsp_utils::is_ipv4_mapped_ipv6(dip6))
 				{
-					snprintf(&m_paramstr_storage[0],
-							 m_paramstr_storage.size(),
-							 "%u.%u.%u.%u:%u->%u.%u.%u.%u:%u",
-							 (unsigned int)sip[0],
-							 (unsigned int)sip[1],
-							 (unsigned int)sip[2],
-							 (unsigned int)sip[3],
-							 (unsigned int)*(uint16_t*)(param->m_val + 17),
-							 (unsigned int)dip[0],
-							 (unsigned int)dip[1],
-							 (unsigned int)dip[2],
-							 (unsigned int)dip[3],
-							 (unsigned int)*(uint16_t*)(param->m_val + 35));
-					break;
+					dst = sinsp_utils::ipv4_to_str(sip6 + 12, &m_paramstr_storage[0]);
+					*dst++ = ':';
+					dst = sinsp_utils::port_to_str(*(uint16_t*)(param->m_val + 17), dst);
+					*dst++ = '-';
+					*dst++ = '>';
+					dst = sinsp_utils::ipv4_to_str(dip6 + 12, dst);
 				}
 				else
 				{
-					char srcstr[INET6_ADDRSTRLEN];
-					char dststr[INET6_ADDRSTRLEN];
-					if(inet_ntop(AF_INET6, sip6, srcstr, sizeof(srcstr)) && 
-						inet_ntop(AF_INET6, sip6, dststr, sizeof(dststr)))
-					{
-						snprintf(&m_paramstr_storage[0],
-								 m_paramstr_storage.size(),
-								 "%s:%u->%s:%u",
-								 srcstr,
-								 (unsigned int)*(uint16_t*)(param->m_val + 17),
-								 dststr,
-								 (unsigned int)*(uint16_t*)(param->m_val + 35));
-						break;
-					}
+					dst = sinsp_utils::ipv6_to_str(sip6, &m_paramstr_storage[0]);
+					*dst++ = ':';
+					dst = sinsp_utils::port_to_str(*(uint16_t*)(param->m_val + 17), dst);
+					*dst++ = '-';
+					*dst++ = '>';
+					dst = sinsp_utils::ipv6_to_str(dip6, dst);
 				}
+
+				*dst++ = ':';
+				sinsp_utils::port_to_str(*(uint16_t*)(param->m_val + 35), dst);
+				break;
 			}
 
 			ASSERT(false);
@@ -1068,40 +1311,17 @@ const char* sinsp_evt::get_param_as_str(uint32_t id, OUT const char** resolved_s
 				     "%" PRIu32, val);
 
 			const struct ppm_name_value *flags = m_info->params[id].symbols;
-			const char *separator = "";
-			uint32_t initial_val = val;
-			uint32_t j = 0;
 
-			while(flags != NULL && flags->name != NULL && flags->value != initial_val)
+			if(flags != NULL)
 			{
-				if((val & flags->value) == flags->value && val != 0)
-				{
-					if(m_resolved_paramstr_storage.size() < j + strlen(separator) + strlen(flags->name))
-					{
-						m_resolved_paramstr_storage.resize(m_resolved_paramstr_storage.size() * 2);
-					}
-
-					j += snprintf(&m_resolved_paramstr_storage[j],
-								  m_resolved_paramstr_storage.size(),
-							 	  "%s%s",
-							 	  separator,
-							 	  flags->name);
+				const string& flagstr = get_flags_str(flags, val);
 
-					separator = "|";
-					// We remove current flags value to avoid duplicate flags e.g. PPM_O_RDWR, PPM_O_RDONLY, PPM_O_WRONLY
-					val &= ~flags->value;
+				if(flagstr.size() >= m_resolved_paramstr_storage.size())
+				{
+					m_resolved_paramstr_storage.resize(flagstr.size() + 1);
 				}
 
-				flags++;
-			}
-
-			if(flags != NULL && flags->name != NULL)
-			{
-				j += snprintf(&m_resolved_paramstr_storage[j],
-							  m_resolved_paramstr_storage.size(),
-							  "%s%s",
-							  separator,
-							  flags->name);
+				memcpy(&m_resolved_paramstr_storage[0], flagstr.c_str(), flagstr.size() + 1);
 			}
 
 			break;
@@ -1118,8 +1338,6 @@ const char* sinsp_evt::get_param_as_str(uint32_t id, OUT const char** resolved_s
 		         "(n.a.)");
 		break;
 	}
-
-	return &m_paramstr_storage[0];
 }
 
 string sinsp_evt::get_param_value_str(string &name, bool resolved)
@@ -1203,21 +1421,26 @@ void sinsp_evt::load_params()
 {
 	uint32_t j;
 	uint32_t nparams;
-	sinsp_evt_param par;
 
 	nparams = m_info->nparams;
+	ASSERT(nparams <= PPM_MAX_EVENT_PARAMS);
 	uint16_t *lens = (uint16_t *)((char *)m_pevt + sizeof(struct ppm_evt_hdr));
 	char *valptr = (char *)lens + nparams * sizeof(uint16_t);
-	m_params.clear();
 
 	for(j = 0; j < nparams; j++)
 	{
-		par.init(valptr, lens[j]);
-		m_params.push_back(par);
+		m_params[j].init(valptr, lens[j]);
 		valptr += lens[j];
 	}
 }
 
+#ifdef _DEBUG
+void sinsp_evt::check_param_len(uint32_t id, uint32_t len)
+{
+	ASSERT(get_param(id)->m_len == len);
+}
+#endif
+
 void sinsp_evt::get_category(OUT sinsp_evt::category* cat)
 {
 	if(get_type() == PPME_GENERIC_E || 
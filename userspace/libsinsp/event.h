@@ -53,6 +53,12 @@ typedef struct filtercheck_field_info
  *  @{
  */
 
+/*!
+  \brief Value of sinsp_evttables::m_param_offsets for the parameters that
+   come after one of variable size.
+*/
+#define SINSP_VARIABLE_PARAM_OFFSET 0xffff
+
 /*!
   \brief Wrapper that exports the libscap event tables.
 */
@@ -61,6 +67,12 @@ class SINSP_PUBLIC sinsp_evttables
 public:
 	const struct ppm_event_info* m_event_info; ///< List of events supported by the capture and analysis subsystems. Each entry fully documents an event and its parameters.
 	const struct ppm_syscall_desc* m_syscall_info_table; ///< List of system calls that the capture subsystem recognizes, including the ones that are not decoded yet.
+	uint16_t m_param_offsets[PPM_EVENT_MAX][PPM_MAX_EVENT_PARAMS]; ///< For each event type, the position of the value of each parameter from the start of the event, when all the parameters before it have a fixed size. SINSP_VARIABLE_PARAM_OFFSET for the others. Used by sinsp_evt::get_param_value().
+
+	/*!
+	  \brief Fill m_param_offsets from m_event_info.
+	*/
+	void init_param_offsets();
 };
 
 /*!
@@ -142,6 +154,16 @@ public:
 	*/
 	int16_t get_cpuid();
 
+	/*!
+	  \brief Return true if this is the first event of its CPU after some
+	   events were lost, because the ring buffer was full or because of the
+	   sampling of the driver.
+	*/
+	bool is_after_drop()
+	{
+		return m_after_drop;
+	}
+
 	/*!
 	  \brief Get the event type. 
 	  
@@ -166,6 +188,14 @@ public:
 	*/
 	uint64_t get_ts();
 
+	/*!
+	  \brief Get the size of the event, header and parameters included, as
+	   it was captured.
+	*/
+	uint32_t get_len()
+	{
+		return m_pevt->len;
+	}
 
 	/*!
 	  \brief Return the event name string, e.g. 'open' or 'socket'.
@@ -229,6 +259,32 @@ public:
 	*/
 	sinsp_evt_param* get_param(uint32_t id);
 
+	/*!
+	  \brief Get the value of a parameter of fixed size, e.g. the int64_t
+	   return value of an exit event.
+
+	  \param id The parameter number.
+
+	  \note When all the parameters before it have a fixed size too, its
+	   position is known from the event table and the value is loaded
+	   directly, without decoding the lengths of the parameters like
+	   get_param() does.
+	*/
+	template<typename T> T get_param_value(uint32_t id)
+	{
+		uint16_t offset = m_param_offsets[id];
+
+#ifdef _DEBUG
+		check_param_len(id, sizeof(T));
+#endif
+		if(offset != SINSP_VARIABLE_PARAM_OFFSET)
+		{
+			return *(T*)((char*)m_pevt + offset);
+		}
+
+		return *(T*)get_param(id)->m_val;
+	}
+
 	/*!
 	  \brief Get a parameter in raw format.
 
@@ -272,6 +328,15 @@ private:
 	void init();
 	void init(uint8_t* evdata, uint16_t cpuid);
 	void load_params();
+#ifdef _DEBUG
+	void check_param_len(uint32_t id, uint32_t len);
+#endif
+	void render_param(uint32_t id, OUT const char** resolved_str, param_fmt fmt);
+	const string& get_flags_str(const struct ppm_name_value* flags, uint32_t val);
+	void invalidate_rendered_params()
+	{
+		m_rendered_mask = 0;
+	}
 	string get_param_value_str(uint32_t id, bool resolved);
 	string get_param_value_str(const char* name, bool resolved = true);
 
@@ -283,7 +348,10 @@ VISIBILITY_PRIVATE
 	uint64_t m_evtnum;
 	bool m_params_loaded;
 	const struct ppm_event_info* m_info;
-	vector<sinsp_evt_param> m_params;
+	const uint16_t* m_param_offsets; // The ones of the type of the event in sinsp_evttables
+	// Decoded on the first access to a parameter. Only the first
+	// m_info->nparams entries are valid.
+	sinsp_evt_param m_params[PPM_MAX_EVENT_PARAMS];
 
 	// Note: this is a lot of storage. We assume that it's not a bit deal since
 	//       currently there's no case in which more than one single event is 
@@ -292,12 +360,28 @@ VISIBILITY_PRIVATE
 	vector<char> m_paramstr_storage;
 	vector<char> m_resolved_paramstr_storage;
 
+	//
+	// The parameters that get_param_as_str() rendered since init(), one
+	// bit per parameter in m_rendered_mask
+	//
+	struct rendered_param
+	{
+		param_fmt m_fmt;
+		bool m_resolved_is_val; // The resolved string is the value itself
+		vector<char> m_val;
+		vector<char> m_resolved;
+	};
+	rendered_param m_rendered_params[PPM_MAX_EVENT_PARAMS];
+	uint32_t m_rendered_mask;
+
 	sinsp_threadinfo* m_tinfo;
 	sinsp_fdinfo_t* m_fdinfo;
 	uint32_t m_iosize;
 	int32_t m_errorcode;
+	bool m_after_drop;
 #ifdef HAS_FILTERING
 	bool m_filtered_out;
+	bool m_batch_rejected; // The filter already rejected the raw event in sinsp_filter::run_batch()
 #endif
 
 	friend class sinsp;
@@ -306,8 +390,15 @@ VISIBILITY_PRIVATE
 	friend class sinsp_analyzer;
 	friend class sinsp_filter_check_event;
 	friend class sinsp_dumper;
+	friend class sinsp_dump_manager;
 	friend class sinsp_analyzer_fd_listener;
 	friend class sinsp_analyzer_parsers;
+	friend class sinsp_evt_copier;
 };
 
+/*!
+  \brief Function called for the events of a type, see \ref sinsp::add_event_hook().
+*/
+typedef void (*sinsp_event_hook)(sinsp_evt* evt, void* arg);
+
 /*@}*/
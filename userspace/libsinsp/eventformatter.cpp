@@ -23,7 +23,7 @@ along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
 #include "eventformatter.h"
 
 ///////////////////////////////////////////////////////////////////////////////
-// rawstring_check implementation
+// sinsp_evt_formatter implementation
 ///////////////////////////////////////////////////////////////////////////////
 #ifdef HAS_FILTERING
 extern sinsp_filter_check_list g_filterlist;
@@ -74,7 +74,8 @@ void sinsp_evt_formatter::set_format(const string& fmt)
 	//
 	const char* cfmt = lfmt.c_str();
 
-	m_tokens.clear();
+	m_program.clear();
+	m_text.clear();
 	uint32_t lfmtlen = lfmt.length();
 
 	for(j = 0; j < lfmtlen; j++)
@@ -85,10 +86,7 @@ void sinsp_evt_formatter::set_format(const string& fmt)
 
 			if(last_nontoken_str_start != j)
 			{
-				rawstring_check* newtkn = new rawstring_check(lfmt.substr(last_nontoken_str_start, j - last_nontoken_str_start));
-				m_tokens.push_back(newtkn);
-				m_tokenlens.push_back(0);
-				m_chks_to_free.push_back(newtkn);
+				add_text(cfmt + last_nontoken_str_start, j - last_nontoken_str_start);
 			}
 
 			if(j == lfmtlen - 1)
@@ -138,11 +136,16 @@ void sinsp_evt_formatter::set_format(const string& fmt)
 
 			m_chks_to_free.push_back(chk);
 
-			j += chk->parse_field_name(cfmt + j + 1);
+			int32_t fldlen = chk->parse_field_name(cfmt + j + 1);
+			chk->enable_field_cache(string(cfmt + j + 1, fldlen));
+			j += fldlen;
 			ASSERT(j <= lfmt.length());
 
-			m_tokens.push_back(chk);
-			m_tokenlens.push_back(toklen);
+			fmt_op op;
+			op.m_check = chk;
+			op.m_text_off = 0;
+			op.m_len = toklen;
+			m_program.push_back(op);
 
 			last_nontoken_str_start = j + 1;
 		}
@@ -150,22 +153,41 @@ void sinsp_evt_formatter::set_format(const string& fmt)
 
 	if(last_nontoken_str_start != j)
 	{
-		m_tokens.push_back(new rawstring_check(lfmt.substr(last_nontoken_str_start, j - last_nontoken_str_start)));
-		m_tokenlens.push_back(0);
+		add_text(cfmt + last_nontoken_str_start, j - last_nontoken_str_start);
 	}
 }
 
+void sinsp_evt_formatter::add_text(const char* text, uint32_t len)
+{
+	fmt_op op;
+
+	op.m_check = NULL;
+	op.m_text_off = (uint32_t)m_text.length();
+	op.m_len = len;
+	m_text.append(text, len);
+	m_program.push_back(op);
+}
+
 bool sinsp_evt_formatter::tostring(sinsp_evt* evt, OUT string* res)
 {
-	uint32_t j = 0;
-	vector<sinsp_filter_check*>::iterator it;
-	res->clear();
+	sinsp_alloc_scope alloc_scope(SAS_FORMATTER);
+	const char* text = m_text.c_str();
+	uint32_t nops = (uint32_t)m_program.size();
+	uint32_t j;
 
-	ASSERT(m_tokenlens.size() == m_tokens.size());
+	res->clear();
 
-	for(j = 0; j < m_tokens.size(); j++)
+	for(j = 0; j < nops; j++)
 	{
-		char* str = m_tokens[j]->tostring(evt);
+		const fmt_op* op = &m_program[j];
+
+		if(op->m_check == NULL)
+		{
+			res->append(text + op->m_text_off, op->m_len);
+			continue;
+		}
+
+		char* str = op->m_check->tostring_cached(evt);
 
 		if(str == NULL)
 		{
@@ -179,23 +201,305 @@ bool sinsp_evt_formatter::tostring(sinsp_evt* evt, OUT string* res)
 			}
 		}
 
-		uint32_t tks = m_tokenlens[j];
+		size_t len = strlen(str);
+
+		if(op->m_len == 0)
+		{
+			res->append(str, len);
+		}
+		else if(len >= op->m_len)
+		{
+			res->append(str, op->m_len);
+		}
+		else
+		{
+			res->append(str, len);
+			res->append(op->m_len - len, ' ');
+		}
+	}
+
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// sinsp_evt_json_formatter implementation
+///////////////////////////////////////////////////////////////////////////////
+
+//
+// The character that follows the backslash in the escape sequence of c, 'u'
+// for the \u00XX ones, or 0 if c doesn't need to be escaped
+//
+static inline char json_escape_char(uint8_t c)
+{
+	if(c >= 0x20)
+	{
+		return (c == '"' || c == '\\')? (char)c : 0;
+	}
+
+	switch(c)
+	{
+	case '\n':
+		return 'n';
+	case '\r':
+		return 'r';
+	case '\t':
+		return 't';
+	case '\b':
+		return 'b';
+	case '\f':
+		return 'f';
+	default:
+		return 'u';
+	}
+}
+
+//
+// Append str to res as a quoted JSON string. The runs of characters that
+// don't need escaping are copied at once.
+//
+static void json_append_string(const char* str, size_t len, OUT string* res)
+{
+	static const char hex[] = "0123456789abcdef";
+	size_t start = 0;
+	size_t j;
+
+	res->push_back('"');
+
+	for(j = 0; j < len; j++)
+	{
+		char esc = json_escape_char((uint8_t)str[j]);
+
+		if(esc == 0)
+		{
+			continue;
+		}
+
+		res->append(str + start, j - start);
+		res->push_back('\\');
+		res->push_back(esc);
+
+		if(esc == 'u')
+		{
+			res->append("00", 2);
+			res->push_back(hex[((uint8_t)str[j]) >> 4]);
+			res->push_back(hex[((uint8_t)str[j]) & 0xf]);
+		}
+
+		start = j + 1;
+	}
+
+	res->append(str + start, len - start);
+	res->push_back('"');
+}
+
+//
+// True if str can be written as a JSON number
+//
+static bool json_is_integer(const char* str, size_t len)
+{
+	size_t j = 0;
+
+	if(len != 0 && str[0] == '-')
+	{
+		j++;
+	}
+
+	if(j == len || (str[j] == '0' && len > j + 1))
+	{
+		return false;
+	}
+
+	for(; j < len; j++)
+	{
+		if(str[j] < '0' || str[j] > '9')
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static bool is_integer_type(ppm_param_type type)
+{
+	switch(type)
+	{
+	case PT_INT8:
+	case PT_INT16:
+	case PT_INT32:
+	case PT_INT64:
+	case PT_UINT8:
+	case PT_UINT16:
+	case PT_UINT32:
+	case PT_UINT64:
+	case PT_FD:
+	case PT_PID:
+	case PT_ERRNO:
+	case PT_PORT:
+		return true;
+	default:
+		return false;
+	}
+}
+
+sinsp_evt_json_formatter::sinsp_evt_json_formatter(sinsp* inspector, const string& fmt)
+{
+	m_inspector = inspector;
+	set_format(fmt);
+}
+
+sinsp_evt_json_formatter::~sinsp_evt_json_formatter()
+{
+	uint32_t j;
+
+	for(j = 0; j < m_fields.size(); j++)
+	{
+		delete m_fields[j].m_check;
+	}
+}
+
+void sinsp_evt_json_formatter::set_format(const string& fmt)
+{
+	string lfmt(fmt);
+	uint32_t j;
+
+	if(lfmt == "")
+	{
+		throw sinsp_exception("empty formatting token");
+	}
+
+	if(lfmt[0] == '*')
+	{
+		m_require_all_values = false;
+		lfmt.erase(0, 1);
+	}
+	else
+	{
+		m_require_all_values = true;
+	}
+
+	//
+	// Only the fields matter. The widths are skipped.
+	//
+	const char* cfmt = lfmt.c_str();
+	uint32_t lfmtlen = lfmt.length();
+
+	for(j = 0; j < lfmtlen; j++)
+	{
+		if(cfmt[j] != '%')
+		{
+			continue;
+		}
+
+		while(j < lfmtlen - 1 && isdigit(cfmt[j + 1]))
+		{
+			j++;
+		}
+
+		if(j == lfmtlen - 1)
+		{
+			throw sinsp_exception("invalid formatting syntax: formatting cannot end with a % or a number");
+		}
+
+		sinsp_filter_check* chk = g_filterlist.new_filter_check_from_fldname(string(cfmt + j + 1), 
+			m_inspector, 
+			false);
+
+		if(chk == NULL)
+		{
+			throw sinsp_exception("invalid formatting token " + string(cfmt + j + 1));
+		}
+
+		int32_t fldlen = chk->parse_field_name(cfmt + j + 1);
+		string fldname(cfmt + j + 1, fldlen);
+		json_field fld;
+
+		chk->enable_field_cache(fldname);
+
+		fld.m_check = chk;
+		fld.m_key.push_back(m_fields.empty()? '{' : ',');
+		json_append_string(fldname.c_str(), fldname.length(), &fld.m_key);
+		fld.m_key.push_back(':');
+		fld.m_is_integer = is_integer_type(chk->get_field_info()->m_type);
+		m_fields.push_back(fld);
+
+		j += fldlen;
+	}
+
+	if(m_fields.empty())
+	{
+		throw sinsp_exception("the json format has no fields");
+	}
+}
+
+bool sinsp_evt_json_formatter::tostring(sinsp_evt* evt, OUT string* res)
+{
+	sinsp_alloc_scope alloc_scope(SAS_FORMATTER);
+	uint32_t nfields = (uint32_t)m_fields.size();
+	uint32_t j;
+
+	res->clear();
+
+	for(j = 0; j < nfields; j++)
+	{
+		const json_field* fld = &m_fields[j];
+		char* str = fld->m_check->tostring_cached(evt);
+
+		res->append(fld->m_key);
+
+		if(str == NULL)
+		{
+			if(m_require_all_values)
+			{
+				return false;
+			}
+
+			res->append("null", 4);
+			continue;
+		}
+
+		size_t len = strlen(str);
 
-		if(tks != 0)
+		if(fld->m_is_integer && json_is_integer(str, len))
 		{
-			string sstr(str);
-			sstr.resize(tks, ' ');
-			(*res) += sstr;
+			res->append(str, len);
 		}
 		else
 		{
-			(*res) += str;
+			json_append_string(str, len, res);
 		}
 	}
 
+	res->push_back('}');
 	return true;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// sinsp_evt_field_extractor implementation
+///////////////////////////////////////////////////////////////////////////////
+sinsp_evt_field_extractor::sinsp_evt_field_extractor(sinsp* inspector, const string& fldname)
+{
+	m_check = g_filterlist.new_filter_check_from_fldname(fldname, inspector, false);
+
+	if(m_check == NULL)
+	{
+		throw sinsp_exception("invalid field name " + fldname);
+	}
+
+	m_check->parse_field_name(fldname.c_str());
+	m_check->enable_field_cache(fldname);
+}
+
+sinsp_evt_field_extractor::~sinsp_evt_field_extractor()
+{
+	delete m_check;
+}
+
+bool sinsp_evt_field_extractor::get(sinsp_evt* evt, OUT sinsp_field_value* val)
+{
+	return m_check->extract_value(evt, val);
+}
+
 #else  // HAS_FILTERING
 
 sinsp_evt_formatter::sinsp_evt_formatter(sinsp* inspector, const string& fmt)
@@ -212,4 +516,37 @@ bool sinsp_evt_formatter::tostring(sinsp_evt* evt, OUT string* res)
 	throw sinsp_exception("sinsp_evt_formatter unvavailable because it was not compiled in the library");
 	return false;
 }
+sinsp_evt_json_formatter::sinsp_evt_json_formatter(sinsp* inspector, const string& fmt)
+{
+	throw sinsp_exception("sinsp_evt_json_formatter unvavailable because it was not compiled in the library");
+}
+
+sinsp_evt_json_formatter::~sinsp_evt_json_formatter()
+{
+}
+
+void sinsp_evt_json_formatter::set_format(const string& fmt)
+{
+}
+
+bool sinsp_evt_json_formatter::tostring(sinsp_evt* evt, OUT string* res)
+{
+	throw sinsp_exception("sinsp_evt_json_formatter unvavailable because it was not compiled in the library");
+	return false;
+}
+
+sinsp_evt_field_extractor::sinsp_evt_field_extractor(sinsp* inspector, const string& fldname)
+{
+	throw sinsp_exception("sinsp_evt_field_extractor unvavailable because it was not compiled in the library");
+}
+
+sinsp_evt_field_extractor::~sinsp_evt_field_extractor()
+{
+}
+
+bool sinsp_evt_field_extractor::get(sinsp_evt* evt, OUT sinsp_field_value* val)
+{
+	throw sinsp_exception("sinsp_evt_field_extractor unvavailable because it was not compiled in the library");
+	return false;
+}
 #endif // HAS_FILTERING
@@ -50,6 +50,8 @@ public:
 
 	  \param evt Pointer to the event to be converted into string.
 	  \param res Pointer to the string that will be filled with the result. 
+	   The string is cleared first, and its storage is reused, so passing the
+	   same string for every event doesn't allocate memory.
 
 	  \return true if the string should be shown (based on the initial *), 
 	   false otherwise.
@@ -57,12 +59,141 @@ public:
 	bool tostring(sinsp_evt* evt, OUT string* res);
 
 private:
+	//
+	// One step of the compiled format: either a piece of the text between the
+	// fields, or a field
+	//
+	struct fmt_op
+	{
+		sinsp_filter_check* m_check; // NULL for the text
+		uint32_t m_text_off; // Position of the text in m_text
+		uint32_t m_len; // Length of the text, or width of the field (0 for no padding)
+	};
+
 	void set_format(const string& fmt);
-	vector<sinsp_filter_check*> m_tokens;
-	vector<uint32_t> m_tokenlens;
+	void add_text(const char* text, uint32_t len);
+	vector<fmt_op> m_program;
+	string m_text; // The text of all the steps
 	sinsp* m_inspector;
 	bool m_require_all_values;
 	vector<sinsp_filter_check*> m_chks_to_free;
 };
 
+/*!
+  \brief Event to JSON converter class.
+  This class can be used to format an event into a JSON object, with one
+  member for each of the fields of a format like the one of
+  sinsp_evt_formatter. The text between the fields is ignored. The fields
+  are the keys, in the order of the format, and the values are their
+  renderings, as numbers for the integer fields and as strings otherwise.
+*/
+class SINSP_PUBLIC sinsp_evt_json_formatter
+{
+public:
+	/*!
+	  \brief Constructs a JSON formatter.
+
+	  \param inspector Pointer to the inspector instance that will generate the 
+	   events to be formatter.
+	  \param fmt The format, the same as the one of sinsp_evt_formatter. If it
+	   starts with a *, the fields that the event doesn't have are null,
+	   otherwise the event is skipped.
+	*/
+	sinsp_evt_json_formatter(sinsp* inspector, const string& fmt);
+
+	~sinsp_evt_json_formatter();
+
+	/*!
+	  \brief Fills res with the JSON object of the event, on a single line
+	   and without a line terminator.
+
+	  \param evt Pointer to the event to be converted into JSON.
+	  \param res Pointer to the string that will be filled with the result. 
+	   The string is cleared first, and its storage is reused, so passing the
+	   same string for every event doesn't allocate memory.
+
+	  \return true if the object should be shown (based on the initial *), 
+	   false otherwise.
+	*/
+	bool tostring(sinsp_evt* evt, OUT string* res);
+
+private:
+	struct json_field
+	{
+		sinsp_filter_check* m_check;
+		string m_key; // The field name, quoted and followed by the colon
+		bool m_is_integer;
+	};
+
+	void set_format(const string& fmt);
+	vector<json_field> m_fields;
+	sinsp* m_inspector;
+	bool m_require_all_values;
+};
+
+/*!
+  \brief How to read a sinsp_field_value.
+*/
+typedef enum sinsp_field_value_kind
+{
+	SFV_INT = 0, ///< Signed integer, in m_int.
+	SFV_UINT = 1, ///< Unsigned integer, in m_uint.
+	SFV_BOOL = 2, ///< Boolean, in m_uint as 0 or 1.
+	SFV_IPV4 = 3, ///< IPv4 address, in m_uint. 1.2.3.4 is 0x01020304.
+	SFV_BUF = 4, ///< String or binary buffer, in m_buf and m_len.
+	SFV_NONE = 5, ///< The event doesn't have the field. Only in the event batches of the chisels.
+}sinsp_field_value_kind;
+
+/*!
+  \brief The value of an event field in its native type.
+  This is a plain C struct, so it can also be used through the LuaJIT FFI.
+  For the numeric kinds, m_int, m_uint and m_num all contain the value.
+  m_buf points into the event or into the extractor, and it's valid until the
+  next event.
+*/
+typedef struct sinsp_field_value
+{
+	uint32_t m_type; ///< The ppm_param_type of the field.
+	uint32_t m_kind; ///< A sinsp_field_value_kind.
+	int64_t m_int;
+	uint64_t m_uint;
+	double m_num;
+	const char* m_buf; ///< Not NUL terminated for the binary buffers.
+	uint32_t m_len;
+}sinsp_field_value;
+
+/*!
+  \brief Typed field extractor class.
+  This class can be used to get the value of one field of the events, like
+  the ones accepted by sinsp_evt_formatter, in its native type, without
+  converting it into a string.
+*/
+class SINSP_PUBLIC sinsp_evt_field_extractor
+{
+public:
+	/*!
+	  \brief Constructs an extractor.
+
+	  \param inspector Pointer to the inspector instance that will generate the 
+	   events.
+	  \param fldname The name of the field, e.g. "fd.name" or "evt.rawarg.res".
+	*/
+	sinsp_evt_field_extractor(sinsp* inspector, const string& fldname);
+
+	~sinsp_evt_field_extractor();
+
+	/*!
+	  \brief Get the value of the field for an event.
+
+	  \param evt Pointer to the event.
+	  \param val Pointer to the struct that will be filled with the value.
+
+	  \return true if the event has the field, false otherwise.
+	*/
+	bool get(sinsp_evt* evt, OUT sinsp_field_value* val);
+
+private:
+	sinsp_filter_check* m_check;
+};
+
 /*@}*/
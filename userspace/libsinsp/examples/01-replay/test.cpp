@@ -0,0 +1,214 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//
+// Measures the cost of the event parsing of libsinsp, replaying a trace
+// file. For each round, the file is read once with scap_next() alone and
+// once through sinsp::next(), which parses each event with
+// sinsp_parser::process_event(). The difference is the parsing cost.
+// With -k, a hook that does nothing is added to every event type, to
+// measure the cost of the hooks.
+// With -f, the events go through the given filter, and the filtering cost
+// is included in the sinsp time.
+//
+// Usage: sinsp-replay [-k] [-f <filter>] <trace file> [rounds]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <sys/time.h>
+
+#include <sinsp.h>
+
+static uint64_t get_time_us()
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static void count_hook(sinsp_evt* evt, void* arg)
+{
+	(*(uint64_t*)arg)++;
+}
+
+//
+// Read the file with libscap only. Returns the number of events.
+//
+static uint64_t read_scap(char* fname, uint64_t* duration_us)
+{
+	char error[SCAP_LASTERR_SIZE];
+	scap_evt* ev;
+	uint16_t cpuid;
+	uint64_t nevts = 0;
+	uint64_t start;
+	scap_t* h;
+
+	h = scap_open_offline(fname, error);
+	if(h == NULL)
+	{
+		fprintf(stderr, "%s\n", error);
+		exit(EXIT_FAILURE);
+	}
+
+	start = get_time_us();
+
+	while(scap_next(h, &ev, &cpuid) == SCAP_SUCCESS)
+	{
+		nevts++;
+	}
+
+	*duration_us = get_time_us() - start;
+	scap_close(h);
+	return nevts;
+}
+
+//
+// Read the file through the inspector. Returns the number of events.
+//
+static uint64_t read_sinsp(char* fname, bool hooks, char* filter, uint64_t* duration_us)
+{
+	sinsp inspector;
+	sinsp_evt* ev;
+	uint64_t nevts = 0;
+	uint64_t nhooks = 0;
+	uint64_t start;
+	uint32_t j;
+
+	if(hooks)
+	{
+		for(j = 0; j < PPM_EVENT_MAX; j++)
+		{
+			inspector.add_event_hook(j, count_hook, &nhooks);
+		}
+	}
+
+	inspector.open(fname);
+
+	if(filter != NULL)
+	{
+		inspector.set_filter(filter);
+	}
+
+	start = get_time_us();
+
+	while(true)
+	{
+		int32_t res = inspector.next(&ev);
+
+		if(res == SCAP_TIMEOUT)
+		{
+			continue;
+		}
+		else if(res != SCAP_SUCCESS)
+		{
+			break;
+		}
+
+		nevts++;
+	}
+
+	*duration_us = get_time_us() - start;
+	inspector.close();
+	return nevts;
+}
+
+int main(int argc, char** argv)
+{
+	bool hooks = false;
+	char* filter = NULL;
+	uint32_t rounds = 5;
+	uint32_t j;
+	char* fname;
+
+	while(argc > 1)
+	{
+		if(strcmp(argv[1], "-k") == 0)
+		{
+			hooks = true;
+			argc--;
+			argv++;
+		}
+		else if(strcmp(argv[1], "-f") == 0 && argc > 2)
+		{
+			filter = argv[2];
+			argc -= 2;
+			argv += 2;
+		}
+		else
+		{
+			break;
+		}
+	}
+
+	if(argc < 2)
+	{
+		fprintf(stderr, "usage: sinsp-replay [-k] [-f <filter>] <trace file> [rounds]\n");
+		return EXIT_FAILURE;
+	}
+
+	fname = argv[1];
+
+	if(argc > 2)
+	{
+		rounds = atoi(argv[2]);
+	}
+
+	try
+	{
+		for(j = 0; j < rounds; j++)
+		{
+			uint64_t scap_us;
+			uint64_t sinsp_us;
+			uint64_t nevts = read_scap(fname, &scap_us);
+			uint64_t naccepted = read_sinsp(fname, hooks, filter, &sinsp_us);
+
+			if(nevts == 0 || (filter == NULL && naccepted != nevts))
+			{
+				fprintf(stderr, "the file has %" PRIu64 " events, but the inspector didn't return all of them\n", nevts);
+				return EXIT_FAILURE;
+			}
+
+			printf("round %u: %" PRIu64 " events, scap %.1fns/evt, sinsp %.1fns/evt, parsing %.1fns/evt",
+				j,
+				nevts,
+				(double)scap_us * 1000 / nevts,
+				(double)sinsp_us * 1000 / nevts,
+				((double)sinsp_us - (double)scap_us) * 1000 / nevts);
+
+			if(filter != NULL)
+			{
+				printf(", %" PRIu64 " accepted, %.0fevts/s",
+					naccepted,
+					(double)nevts * 1000000 / (sinsp_us? sinsp_us : 1));
+			}
+
+			printf("\n");
+		}
+	}
+	catch(sinsp_exception& e)
+	{
+		fprintf(stderr, "%s\n", e.what());
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,664 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//
+// Benchmark of the processing stages of libsinsp over a corpus of trace
+// files. Each file is replayed through each stage on its own:
+//
+//  - scap: scap_next() only
+//  - parse: sinsp::next(), i.e. the parsing of sinsp_parser::process_event()
+//  - filter: sinsp::next() with each of the canned filters, or the ones
+//    given with -f
+//  - format: sinsp::next() and sinsp_evt_formatter::tostring() with the
+//    default format of sysdig
+//  - chisel: sinsp::next() and sinsp_chisel::run() for each chisel in the
+//    chisel directory that takes no arguments. The output of the chisels
+//    goes to /dev/null.
+//
+// Each stage is run for a number of rounds, and the median is reported.
+// The cost of a stage includes the ones before it, e.g. the filter stages
+// include the parsing. For each stage the report has the events per second,
+// the nanoseconds per event, the C++ allocations per event in the event
+// loop, and the peak RSS of the stage, which is reset between the stages
+// when the kernel supports it.
+// The report is JSON, on stdout or in the file given with -o, so that the
+// numbers can be compared across versions.
+//
+// Usage: sysdig-bench [-r <rounds>] [-f <filter>]... [-c <chisel dir>]
+//                     [-o <json file>] <trace file or directory>...
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <new>
+#include <algorithm>
+
+#include <sinsp.h>
+#include "chisel.h"
+#include <json/json.h>
+#include "config.h"
+
+#define BENCH_DEFAULT_ROUNDS 3
+#define BENCH_FORMAT "*%evt.num %evt.time %evt.cpu %proc.name (%thread.tid) %evt.dir %evt.type %evt.args"
+
+static const char* g_canned_filters[] =
+{
+	"evt.type=read",
+	"evt.dir=< and evt.rawres<0",
+	"proc.name=bash or proc.name=sshd",
+	"fd.type=file and fd.name contains /etc",
+	"fd.type=ipv4 and evt.is_io=true",
+	NULL
+};
+
+//
+// Allocation counting. Only the allocations of the event loops are
+// counted, and only the C++ ones: libscap uses malloc() but doesn't allocate
+// while reading a file.
+//
+static volatile bool g_count_allocs = false;
+static uint64_t g_nallocs = 0;
+
+void* operator new(size_t size)
+{
+	if(g_count_allocs)
+	{
+		g_nallocs++;
+	}
+
+	void* p = malloc(size == 0? 1 : size);
+	if(p == NULL)
+	{
+		throw std::bad_alloc();
+	}
+
+	return p;
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void* p) throw()
+{
+	free(p);
+}
+
+void operator delete[](void* p) throw()
+{
+	free(p);
+}
+
+static uint64_t get_time_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+//
+// Reset the peak RSS of the process to the current RSS. Returns false if
+// the kernel doesn't support it, in which case the peak is the one of the
+// whole run.
+//
+static bool reset_peak_rss()
+{
+	int fd = open("/proc/self/clear_refs", O_WRONLY);
+	bool res;
+
+	if(fd < 0)
+	{
+		return false;
+	}
+
+	res = (write(fd, "5", 1) == 1);
+	close(fd);
+	return res;
+}
+
+static uint64_t get_peak_rss_kb()
+{
+	FILE* f = fopen("/proc/self/status", "r");
+	char line[256];
+	uint64_t res = 0;
+
+	if(f != NULL)
+	{
+		while(fgets(line, sizeof(line), f) != NULL)
+		{
+			if(sscanf(line, "VmHWM: %" PRIu64, &res) == 1)
+			{
+				fclose(f);
+				return res;
+			}
+		}
+
+		fclose(f);
+	}
+
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss;
+}
+
+//
+// Measures of one round of a stage
+//
+struct round_result
+{
+	uint64_t m_duration_ns;
+	uint64_t m_nallocs;
+	uint64_t m_naccepted;
+};
+
+static void start_round()
+{
+	g_nallocs = 0;
+	g_count_allocs = true;
+}
+
+static void end_round(uint64_t start_ns, uint64_t naccepted, OUT round_result* res)
+{
+	res->m_duration_ns = get_time_ns() - start_ns;
+	g_count_allocs = false;
+	res->m_nallocs = g_nallocs;
+	res->m_naccepted = naccepted;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The stages
+///////////////////////////////////////////////////////////////////////////////
+enum stage_type
+{
+	ST_SCAP,
+	ST_PARSE,
+	ST_FILTER,
+	ST_FORMAT,
+	ST_CHISEL,
+};
+
+struct stage
+{
+	stage_type m_type;
+	string m_name;
+	string m_arg; // The filter or the chisel
+};
+
+static void run_scap(const string& fname, OUT round_result* res)
+{
+	char error[SCAP_LASTERR_SIZE];
+	scap_evt* ev;
+	uint16_t cpuid;
+	uint64_t nevts = 0;
+	uint64_t start;
+	scap_t* h;
+
+	h = scap_open_offline((char*)fname.c_str(), error);
+	if(h == NULL)
+	{
+		throw sinsp_exception(error);
+	}
+
+	start_round();
+	start = get_time_ns();
+
+	while(scap_next(h, &ev, &cpuid) == SCAP_SUCCESS)
+	{
+		nevts++;
+	}
+
+	end_round(start, nevts, res);
+	scap_close(h);
+}
+
+static void run_sinsp(const string& fname, stage* st, OUT round_result* res)
+{
+	sinsp inspector;
+	sinsp_evt_formatter* formatter = NULL;
+	sinsp_chisel* chisel = NULL;
+	sinsp_evt* ev;
+	uint64_t naccepted = 0;
+	uint64_t start;
+	string line;
+
+	if(st->m_type == ST_CHISEL)
+	{
+		chisel = new sinsp_chisel(&inspector, st->m_arg);
+		chisel->on_init();
+	}
+
+	inspector.open(fname);
+
+	if(st->m_type == ST_FILTER)
+	{
+		inspector.set_filter(st->m_arg);
+	}
+	else if(st->m_type == ST_FORMAT)
+	{
+		formatter = new sinsp_evt_formatter(&inspector, BENCH_FORMAT);
+	}
+	else if(chisel != NULL)
+	{
+		chisel->on_capture_start();
+	}
+
+	start_round();
+	start = get_time_ns();
+
+	while(true)
+	{
+		int32_t res = inspector.next(&ev);
+
+		if(res == SCAP_TIMEOUT)
+		{
+			if(chisel != NULL && ev != NULL)
+			{
+				chisel->do_timeout(ev);
+			}
+
+			continue;
+		}
+		else if(res != SCAP_SUCCESS)
+		{
+			break;
+		}
+
+		if(formatter != NULL)
+		{
+			if(formatter->tostring(ev, &line))
+			{
+				naccepted++;
+			}
+		}
+		else if(chisel != NULL)
+		{
+			if(chisel->run(ev))
+			{
+				naccepted++;
+			}
+		}
+		else
+		{
+			naccepted++;
+		}
+	}
+
+	if(chisel != NULL)
+	{
+		chisel->on_capture_end();
+	}
+
+	end_round(start, naccepted, res);
+
+	inspector.close();
+	delete formatter;
+	delete chisel;
+}
+
+//
+// Run the stage for the given rounds, and add its report to the trace
+//
+static bool run_stage(const string& fname, stage* st, uint32_t rounds, uint64_t nevts, bool can_reset_rss, Json::Value* jtrace)
+{
+	vector<round_result> results;
+	Json::Value jstage;
+	int devnull = -1;
+	int saved_stdout = -1;
+	uint32_t j;
+
+	jstage["name"] = st->m_name;
+	if(st->m_type == ST_FILTER)
+	{
+		jstage["filter"] = st->m_arg;
+	}
+
+	//
+	// The output of the chisels is not part of the report
+	//
+	if(st->m_type == ST_CHISEL)
+	{
+		fflush(stdout);
+		devnull = open("/dev/null", O_WRONLY);
+		saved_stdout = dup(STDOUT_FILENO);
+		dup2(devnull, STDOUT_FILENO);
+	}
+
+	if(can_reset_rss)
+	{
+		reset_peak_rss();
+	}
+
+	try
+	{
+		for(j = 0; j < rounds; j++)
+		{
+			round_result res;
+
+			if(st->m_type == ST_SCAP)
+			{
+				run_scap(fname, &res);
+			}
+			else
+			{
+				run_sinsp(fname, st, &res);
+			}
+
+			results.push_back(res);
+		}
+	}
+	catch(sinsp_exception& e)
+	{
+		jstage["error"] = e.what();
+	}
+
+	if(saved_stdout != -1)
+	{
+		fflush(stdout);
+		dup2(saved_stdout, STDOUT_FILENO);
+		close(saved_stdout);
+		close(devnull);
+	}
+
+	if(results.size() != 0)
+	{
+		//
+		// The median round by duration
+		//
+		vector<uint64_t> durations;
+
+		for(j = 0; j < results.size(); j++)
+		{
+			durations.push_back(results[j].m_duration_ns);
+		}
+
+		sort(durations.begin(), durations.end());
+
+		uint64_t duration = durations[durations.size() / 2];
+		round_result* res = &results[0];
+
+		jstage["accepted"] = (Json::Value::UInt64)res->m_naccepted;
+		jstage["ns_per_evt"] = (double)duration / nevts;
+		jstage["evts_per_s"] = (double)nevts * 1000000000 / (duration? duration : 1);
+		jstage["allocs_per_evt"] = (double)res->m_nallocs / nevts;
+		jstage["peak_rss_kb"] = (Json::Value::UInt64)get_peak_rss_kb();
+
+		fprintf(stderr, "  %-40s %10.1fns/evt %12.0fevts/s %8.2fallocs/evt\n",
+			st->m_name.c_str(),
+			(double)duration / nevts,
+			(double)nevts * 1000000000 / (duration? duration : 1),
+			(double)res->m_nallocs / nevts);
+	}
+	else
+	{
+		fprintf(stderr, "  %-40s %s\n", st->m_name.c_str(), jstage["error"].asCString());
+	}
+
+	(*jtrace)["stages"].append(jstage);
+	return results.size() != 0;
+}
+
+#ifdef HAS_CHISELS
+//
+// Add a stage for each chisel that can run without arguments
+//
+static void add_chisel_stages(sinsp* inspector, OUT vector<stage>* stages)
+{
+	vector<chisel_desc> chlist;
+	uint32_t j;
+
+	sinsp_chisel::get_chisel_list(&chlist, inspector);
+
+	for(j = 0; j < chlist.size(); j++)
+	{
+		if(chlist[j].m_args.size() != 0)
+		{
+			continue;
+		}
+
+		stage st;
+		st.m_type = ST_CHISEL;
+		st.m_name = "chisel:" + chlist[j].m_name;
+		st.m_arg = chlist[j].m_name;
+		stages->push_back(st);
+	}
+}
+#endif
+
+//
+// Add the trace files in path, which is a file or a directory of .scap
+// files
+//
+static void add_traces(const char* path, OUT vector<string>* traces)
+{
+	struct stat st;
+
+	if(stat(path, &st) != 0 || !S_ISDIR(st.st_mode))
+	{
+		traces->push_back(path);
+		return;
+	}
+
+	DIR* d = opendir(path);
+	struct dirent* de;
+	vector<string> files;
+
+	if(d == NULL)
+	{
+		return;
+	}
+
+	while((de = readdir(d)) != NULL)
+	{
+		size_t len = strlen(de->d_name);
+
+		if(len > 5 && strcmp(de->d_name + len - 5, ".scap") == 0)
+		{
+			files.push_back(string(path) + "/" + de->d_name);
+		}
+	}
+
+	closedir(d);
+
+	//
+	// Same order on every run
+	//
+	sort(files.begin(), files.end());
+	traces->insert(traces->end(), files.begin(), files.end());
+}
+
+static void usage()
+{
+	fprintf(stderr, "usage: sysdig-bench [-r <rounds>] [-f <filter>]... [-c <chisel dir>] [-o <json file>] <trace file or directory>...\n");
+}
+
+int main(int argc, char** argv)
+{
+	uint32_t rounds = BENCH_DEFAULT_ROUNDS;
+	vector<string> filters;
+	vector<string> traces;
+	vector<stage> stages;
+	const char* outfile = NULL;
+	const char* chisel_dir = BENCH_CHISELS_DIR;
+	Json::Value jroot;
+	bool can_reset_rss;
+	bool success = true;
+	uint32_t j;
+	int op;
+
+	while((op = getopt(argc, argv, "c:f:o:r:")) != -1)
+	{
+		switch(op)
+		{
+		case 'c':
+			chisel_dir = optarg;
+			break;
+		case 'f':
+			filters.push_back(optarg);
+			break;
+		case 'o':
+			outfile = optarg;
+			break;
+		case 'r':
+			rounds = atoi(optarg);
+			break;
+		default:
+			usage();
+			return EXIT_FAILURE;
+		}
+	}
+
+	for(j = optind; j < (uint32_t)argc; j++)
+	{
+		add_traces(argv[j], &traces);
+	}
+
+	if(traces.size() == 0 || rounds == 0)
+	{
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	if(filters.size() == 0)
+	{
+		for(j = 0; g_canned_filters[j] != NULL; j++)
+		{
+			filters.push_back(g_canned_filters[j]);
+		}
+	}
+
+	//
+	// The list of stages
+	//
+	stage st;
+
+	st.m_type = ST_SCAP;
+	st.m_name = "scap";
+	stages.push_back(st);
+
+	st.m_type = ST_PARSE;
+	st.m_name = "parse";
+	stages.push_back(st);
+
+	for(j = 0; j < filters.size(); j++)
+	{
+		st.m_type = ST_FILTER;
+		st.m_name = "filter:" + filters[j];
+		st.m_arg = filters[j];
+		stages.push_back(st);
+	}
+
+	st.m_type = ST_FORMAT;
+	st.m_name = "format";
+	st.m_arg = "";
+	stages.push_back(st);
+
+#ifdef HAS_CHISELS
+	{
+		sinsp inspector;
+		inspector.add_chisel_dir(chisel_dir);
+		add_chisel_stages(&inspector, &stages);
+	}
+#endif
+
+	can_reset_rss = reset_peak_rss();
+
+	jroot["version"] = SYSDIG_VERSION;
+	jroot["rounds"] = rounds;
+	jroot["peak_rss_per_stage"] = can_reset_rss;
+
+	for(j = 0; j < traces.size(); j++)
+	{
+		Json::Value jtrace;
+		round_result res;
+		uint32_t k;
+
+		jtrace["file"] = traces[j];
+
+		//
+		// The number of events of the file is the denominator of all the
+		// stages, since the filters and the chisels drop some of them
+		//
+		try
+		{
+			run_scap(traces[j], &res);
+		}
+		catch(sinsp_exception& e)
+		{
+			fprintf(stderr, "%s: %s\n", traces[j].c_str(), e.what());
+			jtrace["error"] = e.what();
+			jroot["traces"].append(jtrace);
+			success = false;
+			continue;
+		}
+
+		if(res.m_naccepted == 0)
+		{
+			fprintf(stderr, "%s: no events\n", traces[j].c_str());
+			jtrace["error"] = "no events";
+			jroot["traces"].append(jtrace);
+			success = false;
+			continue;
+		}
+
+		jtrace["events"] = (Json::Value::UInt64)res.m_naccepted;
+		fprintf(stderr, "%s: %" PRIu64 " events\n", traces[j].c_str(), res.m_naccepted);
+
+		for(k = 0; k < stages.size(); k++)
+		{
+			if(!run_stage(traces[j], &stages[k], rounds, res.m_naccepted, can_reset_rss, &jtrace))
+			{
+				success = false;
+			}
+		}
+
+		jroot["traces"].append(jtrace);
+	}
+
+	Json::StyledWriter writer;
+	string report = writer.write(jroot);
+
+	if(outfile != NULL)
+	{
+		FILE* f = fopen(outfile, "w");
+
+		if(f == NULL)
+		{
+			fprintf(stderr, "can't open %s\n", outfile);
+			return EXIT_FAILURE;
+		}
+
+		fwrite(report.c_str(), 1, report.size(), f);
+		fclose(f);
+	}
+	else
+	{
+		fwrite(report.c_str(), 1, report.size(), stdout);
+	}
+
+	return success? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,914 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//
+// Microbenchmarks of the data structures and the functions that run for
+// every event: the fd table, the thread table, flt_compare() for each
+// parameter type, the rendering of the buffers and the decoding of the
+// event parameters.
+//
+// Each benchmark times a loop of a number of iterations, which doubles
+// until the loop takes at least MB_MIN_TIME_NS. The loop is then timed for
+// a number of rounds, and the median time per iteration is reported.
+// The report is JSON, on stdout or in the file given with -o. With -b, the
+// results are compared with the report of a previous run, and the program
+// fails if a benchmark got slower by more than the tolerance given with -t,
+// in percent, so that it can gate a build.
+//
+// Usage: sinsp-microbench [-r <rounds>] [-f <name substring>]
+//                         [-b <baseline json> [-t <tolerance %>]]
+//                         [-o <json file>]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <time.h>
+#include <algorithm>
+#include <fstream>
+
+//
+// The benchmarks need some of the internals of the inspector and of the
+// events
+//
+#define VISIBILITY_PRIVATE
+#include <sinsp.h>
+#include "sinsp_int.h"
+#include "filterchecks.h"
+#include <json/json.h>
+#include "config.h"
+
+#define MB_DEFAULT_ROUNDS 5
+#define MB_DEFAULT_TOLERANCE_PCT 15
+#define MB_MIN_TIME_NS 20000000
+#define MB_MAX_ITERS (1 << 26)
+#define MB_N_FDS 256
+#define MB_N_RW_FDS 16384
+#define MB_N_THREADS 4096
+
+//
+// Defined in event.cpp
+//
+uint32_t binary_buffer_to_hex_string(char *dst, char *src, uint32_t dstlen, uint32_t srclen, sinsp_evt::param_fmt fmt);
+uint32_t binary_buffer_to_asciionly_string(char *dst, char *src, uint32_t dstlen, uint32_t srclen, sinsp_evt::param_fmt fmt);
+uint32_t binary_buffer_to_string_dots(char *dst, char *src, uint32_t dstlen, uint32_t srclen, sinsp_evt::param_fmt fmt);
+
+//
+// The results of the loops end up here, so that the compiler can't drop them
+//
+static volatile uint64_t g_sink = 0;
+
+static uint64_t get_time_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+//
+// Passed to the benchmarks. A benchmark does its setup, then calls start(),
+// runs m_iters iterations and calls stop().
+//
+struct bench_ctx
+{
+	uint64_t m_iters;
+	uint64_t m_start_ns;
+	uint64_t m_duration_ns;
+
+	void start()
+	{
+		m_start_ns = get_time_ns();
+	}
+
+	void stop()
+	{
+		m_duration_ns = get_time_ns() - m_start_ns;
+	}
+};
+
+typedef void (*bench_fn)(bench_ctx* ctx, uint32_t arg);
+
+struct bench
+{
+	string m_name;
+	bench_fn m_fn;
+	uint32_t m_arg;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// sinsp_fdtable
+///////////////////////////////////////////////////////////////////////////////
+
+//
+// arg is the first fd: 0 for the fds in the dense index, SP_FDTABLE_DENSE_SIZE
+// or above for the ones in the hash table
+//
+static void bench_fdtable_find(bench_ctx* ctx, uint32_t arg)
+{
+	sinsp inspector;
+	sinsp_fdtable table(&inspector);
+	sinsp_fdinfo_t fdinfo;
+	uint64_t sum = 0;
+	uint64_t j;
+
+	for(j = 0; j < MB_N_FDS; j++)
+	{
+		table.add(arg + j, &fdinfo);
+	}
+
+	ctx->start();
+
+	//
+	// The step skips the one-entry cache of the last fd
+	//
+	for(j = 0; j < ctx->m_iters; j++)
+	{
+		sum += (uint64_t)table.find(arg + (j * 7) % MB_N_FDS);
+	}
+
+	ctx->stop();
+	g_sink += sum;
+}
+
+static void bench_fdtable_add_erase(bench_ctx* ctx, uint32_t arg)
+{
+	sinsp inspector;
+	sinsp_fdtable table(&inspector);
+	sinsp_fdinfo_t fdinfo;
+	uint64_t j;
+
+	for(j = 0; j < MB_N_FDS; j++)
+	{
+		table.add(arg + j, &fdinfo);
+	}
+
+	ctx->start();
+
+	for(j = 0; j < ctx->m_iters; j++)
+	{
+		table.add(arg + MB_N_FDS, &fdinfo);
+		table.erase(arg + MB_N_FDS);
+	}
+
+	ctx->stop();
+	g_sink += table.size();
+}
+
+//
+// What the parser does with the fd of each read and write, on more fds than
+// fit in the caches: the lookup, the checks of the type, of the protocol
+// and of the role of the socket, and the counters
+//
+static void bench_fdtable_rw(bench_ctx* ctx, uint32_t arg)
+{
+	sinsp inspector;
+	sinsp_fdtable table(&inspector);
+	sinsp_fdinfo_t fdinfo;
+	uint64_t sum = 0;
+	uint64_t j;
+
+	fdinfo.m_type = SCAP_FD_IPV4_SOCK;
+	fdinfo.m_sockinfo.m_ipv4info.m_fields.m_l4proto = SCAP_L4_TCP;
+	fdinfo.set_role_server();
+
+	for(j = 0; j < MB_N_RW_FDS; j++)
+	{
+		table.add(SP_FDTABLE_DENSE_SIZE + j, &fdinfo);
+	}
+
+	ctx->start();
+
+	for(j = 0; j < ctx->m_iters; j++)
+	{
+		sinsp_fdinfo_t* pfdinfo = table.find(SP_FDTABLE_DENSE_SIZE + (j * 4099) % MB_N_RW_FDS);
+
+		if(pfdinfo->is_tcp_socket() && pfdinfo->is_role_server())
+		{
+			pfdinfo->m_io.add(true, 100, 0);
+			sum += pfdinfo->m_sockinfo.m_ipv4info.m_fields.m_dport;
+		}
+	}
+
+	ctx->stop();
+	g_sink += sum;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// sinsp_thread_manager
+///////////////////////////////////////////////////////////////////////////////
+static void add_threads(sinsp* inspector, uint32_t n, uint64_t ts)
+{
+	sinsp_threadinfo tinfo(inspector);
+	uint32_t j;
+
+	for(j = 0; j < n; j++)
+	{
+		tinfo.m_tid = j + 1;
+		tinfo.m_pid = j + 1;
+		tinfo.m_ptid = 0;
+		tinfo.m_lastaccess_ts = ts;
+		inspector->m_thread_manager->add_thread(tinfo, true);
+	}
+}
+
+static void bench_threads_get(bench_ctx* ctx, uint32_t arg)
+{
+	sinsp inspector;
+	uint64_t sum = 0;
+	uint64_t j;
+
+	inspector.m_lastevent_ts = 1;
+	add_threads(&inspector, MB_N_THREADS, 1);
+
+	ctx->start();
+
+	for(j = 0; j < ctx->m_iters; j++)
+	{
+		sum += (uint64_t)inspector.m_thread_manager->get_thread((j * 7) % MB_N_THREADS + 1);
+	}
+
+	ctx->stop();
+	g_sink += sum;
+}
+
+static void bench_threads_add_remove(bench_ctx* ctx, uint32_t arg)
+{
+	sinsp inspector;
+	sinsp_threadinfo tinfo(&inspector);
+	uint64_t j;
+
+	inspector.m_lastevent_ts = 1;
+	add_threads(&inspector, MB_N_THREADS, 1);
+
+	tinfo.m_tid = MB_N_THREADS + 1;
+	tinfo.m_pid = MB_N_THREADS + 1;
+	tinfo.m_ptid = 0;
+
+	ctx->start();
+
+	for(j = 0; j < ctx->m_iters; j++)
+	{
+		inspector.m_thread_manager->add_thread(tinfo, true);
+		inspector.m_thread_manager->remove_thread(tinfo.m_tid);
+	}
+
+	ctx->stop();
+	g_sink += inspector.m_thread_manager->get_thread_count();
+}
+
+//
+// arg is 0 to time the calls that find nothing to remove, which happen for
+// most events, and 1 to time the removal of the expired threads, per thread
+//
+static void bench_threads_remove_inactive(bench_ctx* ctx, uint32_t arg)
+{
+	sinsp inspector;
+	sinsp_thread_manager* tm = inspector.m_thread_manager;
+	uint64_t ts = inspector.m_inactive_thread_scan_time_ns + 1;
+	uint64_t j;
+
+	//
+	// The first call starts the scan interval
+	//
+	inspector.m_lastevent_ts = ts;
+	tm->remove_inactive_threads();
+
+	if(arg == 0)
+	{
+		add_threads(&inspector, MB_N_THREADS, ts);
+		inspector.m_lastevent_ts = ts + inspector.m_inactive_thread_scan_time_ns + 1;
+
+		ctx->start();
+
+		for(j = 0; j < ctx->m_iters; j++)
+		{
+			tm->remove_inactive_threads();
+		}
+
+		ctx->stop();
+	}
+	else
+	{
+		add_threads(&inspector, (uint32_t)min(ctx->m_iters, (uint64_t)MAX_THREAD_TABLE_SIZE), ts);
+		inspector.m_lastevent_ts = ts + inspector.m_inactive_thread_scan_time_ns + inspector.m_thread_timeout_ns + 1;
+		ctx->m_iters = tm->get_thread_count();
+
+		ctx->start();
+
+		while(tm->get_thread_count() != 0)
+		{
+			tm->remove_inactive_threads();
+		}
+
+		ctx->stop();
+	}
+
+	g_sink += tm->get_thread_count();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// flt_compare()
+///////////////////////////////////////////////////////////////////////////////
+struct compare_type
+{
+	ppm_param_type m_type;
+	const char* m_name;
+};
+
+static const compare_type g_compare_types[] =
+{
+	{PT_INT8, "PT_INT8"},
+	{PT_INT16, "PT_INT16"},
+	{PT_INT32, "PT_INT32"},
+	{PT_INT64, "PT_INT64"},
+	{PT_FD, "PT_FD"},
+	{PT_PID, "PT_PID"},
+	{PT_ERRNO, "PT_ERRNO"},
+	{PT_FLAGS8, "PT_FLAGS8"},
+	{PT_UINT8, "PT_UINT8"},
+	{PT_SIGTYPE, "PT_SIGTYPE"},
+	{PT_FLAGS16, "PT_FLAGS16"},
+	{PT_UINT16, "PT_UINT16"},
+	{PT_PORT, "PT_PORT"},
+	{PT_SYSCALLID, "PT_SYSCALLID"},
+	{PT_UINT32, "PT_UINT32"},
+	{PT_FLAGS32, "PT_FLAGS32"},
+	{PT_BOOL, "PT_BOOL"},
+	{PT_IPV4ADDR, "PT_IPV4ADDR"},
+	{PT_UINT64, "PT_UINT64"},
+	{PT_RELTIME, "PT_RELTIME"},
+	{PT_ABSTIME, "PT_ABSTIME"},
+	{PT_CHARBUF, "PT_CHARBUF"},
+	{PT_BYTEBUF, "PT_BYTEBUF"},
+};
+
+//
+// arg is the index in g_compare_types. The operands are different only at
+// the end, so the strings and the buffers are compared in full.
+//
+static void bench_flt_compare(bench_ctx* ctx, uint32_t arg)
+{
+	ppm_param_type type = g_compare_types[arg].m_type;
+	char op1[64];
+	char op2[64];
+	uint64_t sum = 0;
+	uint64_t j;
+
+	memset(op1, 'a', sizeof(op1));
+	memset(op2, 'a', sizeof(op2));
+	op1[sizeof(op1) - 2] = 'b';
+	op1[sizeof(op1) - 1] = 0;
+	op2[sizeof(op2) - 1] = 0;
+
+	if(type != PT_CHARBUF && type != PT_BYTEBUF)
+	{
+		uint64_t v1 = 0x1234;
+		uint64_t v2 = 0x1235;
+
+		memcpy(op1, &v1, sizeof(v1));
+		memcpy(op2, &v2, sizeof(v2));
+	}
+
+	ctx->start();
+
+	for(j = 0; j < ctx->m_iters; j++)
+	{
+		sum += flt_compare(CO_EQ, type, op1, op2, sizeof(op1), sizeof(op2));
+	}
+
+	ctx->stop();
+	g_sink += sum;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Buffer rendering
+///////////////////////////////////////////////////////////////////////////////
+
+//
+// Text with some binary bytes, like the data of the I/O events
+//
+static void fill_buffer(char* buf, uint32_t len)
+{
+	uint32_t j;
+
+	for(j = 0; j < len; j++)
+	{
+		buf[j] = (j % 16 == 15)? (char)(j & 0xff) : 'a' + j % 26;
+	}
+}
+
+struct render_size
+{
+	uint32_t m_size;
+	const char* m_name;
+};
+
+static const render_size g_render_sizes[] =
+{
+	{80, "80B"},
+	{1024, "1KB"},
+	{65536, "64KB"},
+};
+
+typedef uint32_t (*render_fn)(char *dst, char *src, uint32_t dstlen, uint32_t srclen, sinsp_evt::param_fmt fmt);
+
+//
+// Render a buffer of srclen bytes. The destination is large enough for the
+// whole rendering.
+//
+static void bench_render(bench_ctx* ctx, render_fn fn, uint32_t srclen, sinsp_evt::param_fmt fmt)
+{
+	vector<char> src(srclen);
+	vector<char> dst(srclen * 8 + 256);
+	uint64_t sum = 0;
+	uint64_t j;
+
+	fill_buffer(&src[0], srclen);
+
+	ctx->start();
+
+	for(j = 0; j < ctx->m_iters; j++)
+	{
+		sum += fn(&dst[0], &src[0], dst.size(), srclen, fmt);
+	}
+
+	ctx->stop();
+	g_sink += sum;
+}
+
+//
+// arg is the size of the buffer
+//
+static void bench_hex_string(bench_ctx* ctx, uint32_t arg)
+{
+	bench_render(ctx, binary_buffer_to_hex_string, arg, sinsp_evt::PF_HEXASCII);
+}
+
+static void bench_asciionly_string(bench_ctx* ctx, uint32_t arg)
+{
+	bench_render(ctx, binary_buffer_to_asciionly_string, arg, sinsp_evt::PF_EOLS);
+}
+
+static void bench_string_dots(bench_ctx* ctx, uint32_t arg)
+{
+	bench_render(ctx, binary_buffer_to_string_dots, arg, sinsp_evt::PF_NORMAL);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// sinsp_evt::load_params()
+///////////////////////////////////////////////////////////////////////////////
+
+//
+// Build an event of the given type with the given parameters in buf
+//
+static void build_event(vector<char>* buf, uint16_t type, const vector<pair<const void*, uint16_t> >& params)
+{
+	uint32_t len = sizeof(scap_evt) + params.size() * sizeof(uint16_t);
+	uint32_t j;
+
+	for(j = 0; j < params.size(); j++)
+	{
+		len += params[j].second;
+	}
+
+	buf->assign(len, 0);
+
+	scap_evt* evt = (scap_evt*)&(*buf)[0];
+	uint16_t* lens = (uint16_t*)(evt + 1);
+	char* valptr = (char*)(lens + params.size());
+
+	evt->ts = 1;
+	evt->tid = 1;
+	evt->len = len;
+	evt->type = type;
+
+	for(j = 0; j < params.size(); j++)
+	{
+		lens[j] = params[j].second;
+		memcpy(valptr, params[j].first, params[j].second);
+		valptr += params[j].second;
+	}
+}
+
+//
+// arg is the event type, one of the ones below
+//
+static void bench_load_params(bench_ctx* ctx, uint32_t arg)
+{
+	sinsp inspector;
+	sinsp_evt evt(&inspector);
+	vector<pair<const void*, uint16_t> > params;
+	vector<char> buf;
+	int64_t res = 3;
+	int64_t tid = 1;
+	uint32_t flags = 0;
+	uint64_t fdlimit = 1024;
+	const char path[] = "/usr/lib/x86_64-linux-gnu/libc.so.6";
+	const char args[] = "-l\0-a\0/tmp";
+	char data[1024];
+	uint64_t sum = 0;
+	uint64_t j;
+
+	fill_buffer(data, sizeof(data));
+
+	switch(arg)
+	{
+	case PPME_SYSCALL_READ_X:
+		params.push_back(make_pair(&res, sizeof(res)));
+		params.push_back(make_pair(data, sizeof(data)));
+		break;
+	case PPME_SYSCALL_OPEN_X:
+		params.push_back(make_pair(&res, sizeof(res)));
+		params.push_back(make_pair(path, sizeof(path)));
+		params.push_back(make_pair(&flags, sizeof(flags)));
+		params.push_back(make_pair(&flags, sizeof(flags)));
+		break;
+	case PPME_SYSCALL_EXECVE_X:
+		params.push_back(make_pair(&res, sizeof(res)));
+		params.push_back(make_pair(path, sizeof(path)));
+		params.push_back(make_pair(args, sizeof(args)));
+		params.push_back(make_pair(&tid, sizeof(tid)));
+		params.push_back(make_pair(&tid, sizeof(tid)));
+		params.push_back(make_pair(&tid, sizeof(tid)));
+		params.push_back(make_pair(path, sizeof(path)));
+		params.push_back(make_pair(&fdlimit, sizeof(fdlimit)));
+		break;
+	default:
+		ASSERT(false);
+		return;
+	}
+
+	build_event(&buf, arg, params);
+	evt.init((uint8_t*)&buf[0], 0);
+
+	ctx->start();
+
+	for(j = 0; j < ctx->m_iters; j++)
+	{
+		evt.load_params();
+		sum += evt.m_params[params.size() - 1].m_len;
+	}
+
+	ctx->stop();
+	g_sink += sum;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// sinsp_evt::get_param_as_str(), through a formatter
+///////////////////////////////////////////////////////////////////////////////
+
+//
+// arg is 1 to show the arguments twice, as evt.args and as single fields
+//
+static void bench_format_params(bench_ctx* ctx, uint32_t arg)
+{
+	sinsp inspector;
+	sinsp_evt evt(&inspector);
+	vector<pair<const void*, uint16_t> > params;
+	vector<char> buf;
+	int64_t res = -2;
+	uint32_t flags = 0x242;
+	uint32_t mode = 0644;
+	const char path[] = "/usr/lib/x86_64-linux-gnu/libc.so.6";
+	string line;
+	uint64_t sum = 0;
+	uint64_t j;
+
+	params.push_back(make_pair(&res, sizeof(res)));
+	params.push_back(make_pair(path, sizeof(path)));
+	params.push_back(make_pair(&flags, sizeof(flags)));
+	params.push_back(make_pair(&mode, sizeof(mode)));
+	build_event(&buf, PPME_SYSCALL_OPEN_X, params);
+
+	sinsp_evt_formatter formatter(&inspector, arg?
+		"%evt.args %evt.res %evt.arg.name %evt.arg.flags" :
+		"%evt.args");
+
+	ctx->start();
+
+	for(j = 0; j < ctx->m_iters; j++)
+	{
+		evt.init((uint8_t*)&buf[0], 0);
+		formatter.tostring(&evt, &line);
+		sum += line.size();
+	}
+
+	ctx->stop();
+	g_sink += sum;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The harness
+///////////////////////////////////////////////////////////////////////////////
+static void add_benchmarks(OUT vector<bench>* benchs)
+{
+	bench b;
+	uint32_t j;
+
+	b.m_arg = 0;
+
+	b.m_name = "fdtable/find/dense";
+	b.m_fn = bench_fdtable_find;
+	benchs->push_back(b);
+
+	b.m_name = "fdtable/find/sparse";
+	b.m_arg = SP_FDTABLE_DENSE_SIZE;
+	benchs->push_back(b);
+
+	b.m_name = "fdtable/add_erase/dense";
+	b.m_fn = bench_fdtable_add_erase;
+	b.m_arg = 0;
+	benchs->push_back(b);
+
+	b.m_name = "fdtable/add_erase/sparse";
+	b.m_arg = SP_FDTABLE_DENSE_SIZE;
+	benchs->push_back(b);
+
+	b.m_name = "fdtable/rw";
+	b.m_fn = bench_fdtable_rw;
+	b.m_arg = 0;
+	benchs->push_back(b);
+
+	b.m_arg = 0;
+
+	b.m_name = "threads/get_thread";
+	b.m_fn = bench_threads_get;
+	benchs->push_back(b);
+
+	b.m_name = "threads/add_remove";
+	b.m_fn = bench_threads_add_remove;
+	benchs->push_back(b);
+
+	b.m_name = "threads/remove_inactive/idle";
+	b.m_fn = bench_threads_remove_inactive;
+	benchs->push_back(b);
+
+	b.m_name = "threads/remove_inactive/expired";
+	b.m_arg = 1;
+	benchs->push_back(b);
+
+	for(j = 0; j < sizeof(g_compare_types) / sizeof(g_compare_types[0]); j++)
+	{
+		b.m_name = string("flt_compare/") + g_compare_types[j].m_name;
+		b.m_fn = bench_flt_compare;
+		b.m_arg = j;
+		benchs->push_back(b);
+	}
+
+	for(j = 0; j < sizeof(g_render_sizes) / sizeof(g_render_sizes[0]); j++)
+	{
+		b.m_arg = g_render_sizes[j].m_size;
+
+		b.m_name = string("binary_buffer_to_hex_string/") + g_render_sizes[j].m_name;
+		b.m_fn = bench_hex_string;
+		benchs->push_back(b);
+
+		b.m_name = string("binary_buffer_to_asciionly_string/") + g_render_sizes[j].m_name;
+		b.m_fn = bench_asciionly_string;
+		benchs->push_back(b);
+
+		b.m_name = string("binary_buffer_to_string_dots/") + g_render_sizes[j].m_name;
+		b.m_fn = bench_string_dots;
+		benchs->push_back(b);
+	}
+
+	b.m_arg = 0;
+
+	b.m_fn = bench_load_params;
+
+	b.m_name = "load_params/read_x";
+	b.m_arg = PPME_SYSCALL_READ_X;
+	benchs->push_back(b);
+
+	b.m_name = "load_params/open_x";
+	b.m_arg = PPME_SYSCALL_OPEN_X;
+	benchs->push_back(b);
+
+	b.m_name = "load_params/execve_x";
+	b.m_arg = PPME_SYSCALL_EXECVE_X;
+	benchs->push_back(b);
+
+	b.m_fn = bench_format_params;
+
+	b.m_name = "format_params/args";
+	b.m_arg = 0;
+	benchs->push_back(b);
+
+	b.m_name = "format_params/args_and_fields";
+	b.m_arg = 1;
+	benchs->push_back(b);
+}
+
+//
+// Return the median nanoseconds per iteration of the benchmark
+//
+static double run_benchmark(bench* b, uint32_t rounds)
+{
+	bench_ctx ctx;
+	vector<double> results;
+	uint32_t j;
+
+	uint64_t iters = 1;
+
+	//
+	// Find the number of iterations. A benchmark can run fewer than the
+	// requested ones, e.g. when it fills a table, and that is the most.
+	//
+	while(true)
+	{
+		ctx.m_iters = iters;
+		b->m_fn(&ctx, b->m_arg);
+
+		if(ctx.m_duration_ns >= MB_MIN_TIME_NS || iters >= MB_MAX_ITERS || ctx.m_iters < iters)
+		{
+			break;
+		}
+
+		iters *= 2;
+	}
+
+	for(j = 0; j < rounds; j++)
+	{
+		ctx.m_iters = iters;
+		b->m_fn(&ctx, b->m_arg);
+		results.push_back((double)ctx.m_duration_ns / (ctx.m_iters? ctx.m_iters : 1));
+	}
+
+	sort(results.begin(), results.end());
+	return results[results.size() / 2];
+}
+
+static bool load_baseline(const char* fname, OUT Json::Value* res)
+{
+	std::ifstream f(fname);
+	Json::Reader reader;
+
+	if(!f.good() || !reader.parse(f, *res) || !(*res)["benchmarks"].isObject())
+	{
+		fprintf(stderr, "can't read the baseline %s\n", fname);
+		return false;
+	}
+
+	return true;
+}
+
+static void usage()
+{
+	fprintf(stderr, "usage: sinsp-microbench [-r <rounds>] [-f <name substring>] [-b <baseline json> [-t <tolerance %%>]] [-o <json file>]\n");
+}
+
+int main(int argc, char** argv)
+{
+	uint32_t rounds = MB_DEFAULT_ROUNDS;
+	double tolerance_pct = MB_DEFAULT_TOLERANCE_PCT;
+	const char* outfile = NULL;
+	const char* baseline_file = NULL;
+	vector<string> name_filters;
+	vector<bench> benchs;
+	Json::Value jroot;
+	Json::Value jbaseline;
+	uint32_t nregressions = 0;
+	uint32_t j;
+	int op;
+
+	while((op = getopt(argc, argv, "b:f:o:r:t:")) != -1)
+	{
+		switch(op)
+		{
+		case 'b':
+			baseline_file = optarg;
+			break;
+		case 'f':
+			name_filters.push_back(optarg);
+			break;
+		case 'o':
+			outfile = optarg;
+			break;
+		case 'r':
+			rounds = atoi(optarg);
+			break;
+		case 't':
+			tolerance_pct = atof(optarg);
+			break;
+		default:
+			usage();
+			return EXIT_FAILURE;
+		}
+	}
+
+	if(rounds == 0 || optind != argc)
+	{
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	if(baseline_file != NULL && !load_baseline(baseline_file, &jbaseline))
+	{
+		return EXIT_FAILURE;
+	}
+
+	add_benchmarks(&benchs);
+
+	jroot["version"] = SYSDIG_VERSION;
+	jroot["rounds"] = rounds;
+
+	for(j = 0; j < benchs.size(); j++)
+	{
+		bench* b = &benchs[j];
+		uint32_t k;
+
+		if(name_filters.size() != 0)
+		{
+			for(k = 0; k < name_filters.size(); k++)
+			{
+				if(b->m_name.find(name_filters[k]) != string::npos)
+				{
+					break;
+				}
+			}
+
+			if(k == name_filters.size())
+			{
+				continue;
+			}
+		}
+
+		double ns = run_benchmark(b, rounds);
+
+		jroot["benchmarks"][b->m_name] = ns;
+
+		fprintf(stderr, "%-45s %10.2fns", b->m_name.c_str(), ns);
+
+		if(baseline_file != NULL)
+		{
+			const Json::Value& jbase = jbaseline["benchmarks"][b->m_name];
+
+			if(jbase.isNumeric() && jbase.asDouble() > 0)
+			{
+				double base = jbase.asDouble();
+				double delta_pct = (ns - base) * 100 / base;
+
+				fprintf(stderr, " %+8.1f%%", delta_pct);
+
+				if(delta_pct > tolerance_pct)
+				{
+					fprintf(stderr, " REGRESSION (baseline %.2fns)", base);
+					nregressions++;
+				}
+			}
+			else
+			{
+				fprintf(stderr, "     (new)");
+			}
+		}
+
+		fprintf(stderr, "\n");
+	}
+
+	Json::StyledWriter writer;
+	string report = writer.write(jroot);
+
+	if(outfile != NULL)
+	{
+		FILE* f = fopen(outfile, "w");
+
+		if(f == NULL)
+		{
+			fprintf(stderr, "can't open %s\n", outfile);
+			return EXIT_FAILURE;
+		}
+
+		fwrite(report.c_str(), 1, report.size(), f);
+		fclose(f);
+	}
+	else
+	{
+		fwrite(report.c_str(), 1, report.size(), stdout);
+	}
+
+	if(nregressions != 0)
+	{
+		fprintf(stderr, "%u benchmarks are more than %.1f%% slower than the baseline\n", nregressions, tolerance_pct);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
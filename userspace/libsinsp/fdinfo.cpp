@@ -23,6 +23,15 @@ along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
 #include "sinsp.h"
 #include "sinsp_int.h"
 
+//
+// The fields that every read and write looks at, at the beginning of the
+// fd, fit in a cache line, and the whole fd in four of them
+//
+static_assert(sizeof(scap_fd_type) + 2 * sizeof(uint32_t) + sizeof(sinsp_sockinfo) + sizeof(sinsp_pooled_string) <= 64,
+	"the hot fields of sinsp_fdinfo don't fit in a cache line");
+static_assert(sizeof(sinsp_fdinfo_t) <= 4 * 64,
+	"sinsp_fdinfo takes more than four cache lines");
+
 ///////////////////////////////////////////////////////////////////////////////
 // sinsp_fdinfo inomlementation
 ///////////////////////////////////////////////////////////////////////////////
@@ -30,11 +39,15 @@ template<> sinsp_fdinfo_t::sinsp_fdinfo()
 {
 	m_type = SCAP_FD_UNINITIALIZED;
 	m_flags = FLAGS_NONE;
+	m_local_dip = 0;
+	m_drop_gen = 0;
+	m_io.clear();
+	m_access.clear();
 }
 
-template<> string* sinsp_fdinfo_t::tostring()
+template<> const string* sinsp_fdinfo_t::tostring()
 {
-	return &m_name;
+	return &m_name.str();
 }
 
 template<> char sinsp_fdinfo_t::get_typechar()
@@ -77,13 +90,13 @@ template<> char sinsp_fdinfo_t::get_typechar()
 	}
 }
 
-template<> void sinsp_fdinfo_t::add_filename(const char* directory, uint32_t directorylen, const char* filename, uint32_t filenamelen)
+template<> void sinsp_fdinfo_t::add_filename(sinsp_string_pool* pool, const char* directory, uint32_t directorylen, const char* filename, uint32_t filenamelen)
 {
 	char fullpath[SCAP_MAX_PATH_SIZE];
 
 	sinsp_utils::concatenate_paths(fullpath, SCAP_MAX_PATH_SIZE, directory, directorylen, filename, filenamelen);
 	
-	m_name = fullpath;
+	m_name.set(pool, fullpath, strlen(fullpath));
 }
 
 template<> bool sinsp_fdinfo_t::set_net_role_by_guessing(sinsp* inspector,
@@ -161,6 +174,26 @@ wildass_guess:
 	return true;
 }
 
+template<> bool sinsp_fdinfo_t::is_dip_local(sinsp* inspector)
+{
+	uint32_t dip = m_sockinfo.m_ipv4info.m_fields.m_dip;
+
+	if(!(m_flags & FLAGS_DIP_LOCAL_KNOWN) || m_local_dip != dip)
+	{
+		m_flags &= ~FLAGS_DIP_LOCAL;
+
+		if(inspector->get_ifaddr_list()->is_ipv4addr_in_local_machine(dip))
+		{
+			m_flags |= FLAGS_DIP_LOCAL;
+		}
+
+		m_flags |= FLAGS_DIP_LOCAL_KNOWN;
+		m_local_dip = dip;
+	}
+
+	return (m_flags & FLAGS_DIP_LOCAL) != 0;
+}
+
 template<> scap_l4_proto sinsp_fdinfo_t::get_l4proto()
 {
 	scap_fd_type evt_type = m_type;
@@ -203,30 +236,382 @@ template<> scap_l4_proto sinsp_fdinfo_t::get_l4proto()
 sinsp_fdtable::sinsp_fdtable(sinsp* inspector)
 {
 	m_inspector = inspector;
+	m_shared = NULL;
 	reset_cache();
 }
 
-sinsp_fdinfo_t* sinsp_fdtable::find(int64_t fd)
+sinsp_fdtable::sinsp_fdtable(const sinsp_fdtable& other)
+{
+	m_inspector = NULL;
+	m_shared = NULL;
+	*this = other;
+}
+
+sinsp_fdtable::~sinsp_fdtable()
+{
+	account(-(int64_t)m_table.size());
+	release_snapshot(m_shared);
+}
+
+//
+// The index points to the entries of the other table, so it's rebuilt
+//
+sinsp_fdtable& sinsp_fdtable::operator=(const sinsp_fdtable& other)
+{
+	if(this == &other)
+	{
+		return *this;
+	}
+
+	if(other.m_shared != NULL)
+	{
+		other.m_shared->m_refcount++;
+	}
+
+	account(-(int64_t)m_table.size());
+	release_snapshot(m_shared);
+	m_shared = other.m_shared;
+
+	m_inspector = other.m_inspector;
+	m_table = other.m_table;
+	account(m_table.size());
+	m_dense.clear();
+	reset_cache();
+	rebuild_dense();
+
+	return *this;
+}
+
+void sinsp_fdtable::rebuild_dense()
+{
+	unordered_map<int64_t, sinsp_fdinfo_t>::iterator fdit;
+
+	for(fdit = m_table.begin(); fdit != m_table.end(); ++fdit)
+	{
+		if(!(fdit->second.m_flags & sinsp_fdinfo_t::FLAGS_REMOVED))
+		{
+			set_dense(fdit->first, &(fdit->second));
+		}
+	}
+}
+
+//
+// Return the entry of the most recent snapshot that has the fd, or NULL if
+// the fd is not there or it was closed
+//
+sinsp_fdinfo_t* sinsp_fdtable::find_in_snapshots(snapshot* s, int64_t fd)
+{
+	unordered_map<int64_t, sinsp_fdinfo_t>::iterator fdit;
+
+	for(; s != NULL; s = s->m_base)
+	{
+		fdit = s->m_table.find(fd);
+
+		if(fdit != s->m_table.end())
+		{
+			if(fdit->second.m_flags & sinsp_fdinfo_t::FLAGS_REMOVED)
+			{
+				return NULL;
+			}
+
+			return &(fdit->second);
+		}
+	}
+
+	return NULL;
+}
+
+//
+// The number of entries of all the tables and snapshots is tracked by the
+// thread manager, for the memory accounting
+//
+void sinsp_fdtable::account(int64_t nentries)
+{
+	if(m_inspector != NULL && m_inspector->m_thread_manager != NULL)
+	{
+		m_inspector->m_thread_manager->m_n_fd_entries += nentries;
+	}
+}
+
+void sinsp_fdtable::release_snapshot(snapshot* s)
+{
+	while(s != NULL && --s->m_refcount == 0)
+	{
+		snapshot* base = s->m_base;
+		account(-(int64_t)s->m_table.size());
+		delete s;
+		s = base;
+	}
+}
+
+//
+// Add the entries of the snapshots to the table, without replacing the ones
+// that it already has
+//
+void sinsp_fdtable::merge_snapshots(snapshot* s, unordered_map<int64_t, sinsp_fdinfo_t>* table)
+{
+	for(; s != NULL; s = s->m_base)
+	{
+		table->insert(s->m_table.begin(), s->m_table.end());
+	}
+}
+
+//
+// Copy a shared entry to this table, since the caller can modify it
+//
+sinsp_fdinfo_t* sinsp_fdtable::copy_shared(int64_t fd)
 {
 	unordered_map<int64_t, sinsp_fdinfo_t>::iterator fdit = m_table.find(fd);
+	sinsp_fdinfo_t* fdinfo;
+
+	if(fdit != m_table.end())
+	{
+		return (fdit->second.m_flags & sinsp_fdinfo_t::FLAGS_REMOVED)? NULL : &(fdit->second);
+	}
+
+	fdinfo = find_in_snapshots(m_shared, fd);
+	if(fdinfo == NULL)
+	{
+		return NULL;
+	}
+
+	account(1);
+	return &(m_table.insert(std::make_pair(fd, *fdinfo)).first->second);
+}
+
+void sinsp_fdtable::share()
+{
+	snapshot* s;
+
+	if(m_shared != NULL && m_shared->m_refcount == 1)
+	{
+		//
+		// Nobody else uses our snapshot, so we can just move the new entries there
+		//
+		s = m_shared;
+		int64_t nentries = s->m_table.size() + m_table.size();
+
+		unordered_map<int64_t, sinsp_fdinfo_t>::iterator fdit;
+		for(fdit = m_table.begin(); fdit != m_table.end(); ++fdit)
+		{
+			s->m_table[fdit->first] = fdit->second;
+		}
+
+		m_table.clear();
+		account(s->m_table.size() - nentries);
+	}
+	else
+	{
+		s = new snapshot;
+		s->m_table.swap(m_table);
+		s->m_base = m_shared;
+		s->m_refcount = 1;
+		s->m_depth = (m_shared != NULL)? m_shared->m_depth + 1 : 1;
+
+		//
+		// Don't make the lookups go through too many snapshots
+		//
+		if(s->m_depth > SP_FDTABLE_MAX_SNAPSHOTS)
+		{
+			snapshot* flat = new snapshot;
+			merge_snapshots(s, &flat->m_table);
+			flat->m_base = NULL;
+			flat->m_refcount = 1;
+			flat->m_depth = 1;
+
+			unordered_map<int64_t, sinsp_fdinfo_t>::iterator fdit;
+			for(fdit = flat->m_table.begin(); fdit != flat->m_table.end();)
+			{
+				if(fdit->second.m_flags & sinsp_fdinfo_t::FLAGS_REMOVED)
+				{
+					fdit = flat->m_table.erase(fdit);
+				}
+				else
+				{
+					++fdit;
+				}
+			}
+
+			account(flat->m_table.size());
+			release_snapshot(s);
+			s = flat;
+		}
+
+		m_shared = s;
+	}
+
+	m_dense.clear();
+	reset_cache();
+}
+
+void sinsp_fdtable::unshare()
+{
+	if(m_shared == NULL)
+	{
+		return;
+	}
+
+	int64_t nentries = m_table.size();
+
+	merge_snapshots(m_shared, &m_table);
+	release_snapshot(m_shared);
+	m_shared = NULL;
+
+	unordered_map<int64_t, sinsp_fdinfo_t>::iterator fdit;
+	for(fdit = m_table.begin(); fdit != m_table.end();)
+	{
+		if(fdit->second.m_flags & sinsp_fdinfo_t::FLAGS_REMOVED)
+		{
+			fdit = m_table.erase(fdit);
+		}
+		else
+		{
+			++fdit;
+		}
+	}
+
+	account(m_table.size() - nentries);
+	reset_cache();
+	rebuild_dense();
+}
+
+bool sinsp_fdtable::visit(sinsp_fdtable_visitor visitor, void* arg)
+{
+	unordered_map<int64_t, sinsp_fdinfo_t>::iterator fdit;
+	snapshot* s;
+	snapshot* t;
+
+	for(fdit = m_table.begin(); fdit != m_table.end(); ++fdit)
+	{
+		if(!(fdit->second.m_flags & sinsp_fdinfo_t::FLAGS_REMOVED) &&
+			visitor(fdit->first, &(fdit->second), arg))
+		{
+			return true;
+		}
+	}
+
+	for(s = m_shared; s != NULL; s = s->m_base)
+	{
+		for(fdit = s->m_table.begin(); fdit != s->m_table.end(); ++fdit)
+		{
+			if(fdit->second.m_flags & sinsp_fdinfo_t::FLAGS_REMOVED)
+			{
+				continue;
+			}
+
+			//
+			// Skip the fds that are replaced by a more recent entry
+			//
+			if(m_table.find(fdit->first) != m_table.end())
+			{
+				continue;
+			}
+
+			for(t = m_shared; t != s; t = t->m_base)
+			{
+				if(t->m_table.find(fdit->first) != t->m_table.end())
+				{
+					break;
+				}
+			}
+
+			if(t == s && visitor(fdit->first, &(fdit->second), arg))
+			{
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+void sinsp_fdtable::set_dense(int64_t fd, sinsp_fdinfo_t* fdinfo)
+{
+	if(fd < 0 || fd >= SP_FDTABLE_DENSE_SIZE)
+	{
+		return;
+	}
+
+	if(fd >= (int64_t)m_dense.size())
+	{
+		if(fdinfo == NULL)
+		{
+			return;
+		}
+
+		size_t newsize = m_dense.empty()? 64 : m_dense.size();
+		while(newsize <= (size_t)fd)
+		{
+			newsize *= 2;
+		}
+
+		m_dense.resize(newsize, NULL);
+	}
+
+	m_dense[fd] = fdinfo;
+}
+
+sinsp_fdinfo_t* sinsp_fdtable::find(int64_t fd)
+{
+	unordered_map<int64_t, sinsp_fdinfo_t>::iterator fdit;
+	sinsp_fdinfo_t* fdinfo;
+	uint32_t j;
+
+	//
+	// The small fds are in the dense index, which is as fast as a cache
+	//
+	if(fd >= 0 && fd < SP_FDTABLE_DENSE_SIZE)
+	{
+		fdinfo = (fd < (int64_t)m_dense.size())? m_dense[fd] : NULL;
+
+		if(fdinfo == NULL && m_shared != NULL)
+		{
+			fdinfo = copy_shared(fd);
+			set_dense(fd, fdinfo);
+		}
+
+#ifdef GATHER_INTERNAL_STATS
+		if(fdinfo == NULL)
+		{
+			m_inspector->m_stats.m_n_failed_fd_lookups++;
+		}
+		else
+		{
+			m_inspector->m_stats.m_n_cached_fd_lookups++;
+			m_inspector->m_thread_manager->m_fd_cached_lookups->increment();
+		}
+#endif
+		return fdinfo;
+	}
 
 	//
-	// Try looking up in our simple cache
+	// Try looking up in our cache
 	//
-	if(m_last_accessed_fd != -1 && fd == m_last_accessed_fd)
+	j = fd & (SP_FD_CACHE_SIZE - 1);
+
+	if(m_cache_fdinfos[j] != NULL && m_cache_fds[j] == fd)
 	{
 #ifdef GATHER_INTERNAL_STATS
 		m_inspector->m_stats.m_n_cached_fd_lookups++;
+		m_inspector->m_thread_manager->m_fd_cached_lookups->increment();
 #endif
-		return m_last_accessed_fdinfo;
+		return m_cache_fdinfos[j];
 	}
 
 	//
 	// Caching failed, do a real lookup
 	//
-	fdit = m_table.find(fd);
+	if(m_shared != NULL)
+	{
+		fdinfo = copy_shared(fd);
+	}
+	else
+	{
+		fdit = m_table.find(fd);
+		fdinfo = (fdit == m_table.end())? NULL : &(fdit->second);
+	}
 
-	if(fdit == m_table.end())
+	if(fdinfo == NULL)
 	{
 #ifdef GATHER_INTERNAL_STATS
 		m_inspector->m_stats.m_n_failed_fd_lookups++;
@@ -237,28 +622,41 @@ sinsp_fdinfo_t* sinsp_fdtable::find(int64_t fd)
 	{
 #ifdef GATHER_INTERNAL_STATS
 		m_inspector->m_stats.m_n_noncached_fd_lookups++;
+		m_inspector->m_thread_manager->m_fd_non_cached_lookups->increment();
 #endif
-		m_last_accessed_fd = fd;
-		m_last_accessed_fdinfo = &(fdit->second);
-		return &(fdit->second);
+		m_cache_fds[j] = fd;
+		m_cache_fdinfos[j] = fdinfo;
+		return fdinfo;
 	}
 }
 
 sinsp_fdinfo_t* sinsp_fdtable::add(int64_t fd, sinsp_fdinfo_t* fdinfo)
 {
-	pair<unordered_map<int64_t, sinsp_fdinfo_t>::iterator, bool> insert_res;
-
-	insert_res = m_table.insert(std::make_pair(fd,*fdinfo));
+	sinsp_alloc_scope alloc_scope(SAS_FDS);
+	unordered_map<int64_t, sinsp_fdinfo_t>::iterator fdit = m_table.find(fd);
+	sinsp_fdinfo_t* prev = NULL;
+	int64_t nentries = m_table.size();
 
 	//
-	// Look for the FD in the table
+	// Look for the FD in the table, and in the snapshot that we share
 	//
-	if(insert_res.second == true)
+	if(fdit != m_table.end())
+	{
+		if(!(fdit->second.m_flags & sinsp_fdinfo_t::FLAGS_REMOVED))
+		{
+			prev = &(fdit->second);
+		}
+	}
+	else if(m_shared != NULL)
+	{
+		prev = find_in_snapshots(m_shared, fd);
+	}
+
+	if(prev == NULL)
 	{
 		//
 		// No entry in the table, this is the normal case
 		//
-		m_last_accessed_fd = -1;
 #ifdef GATHER_INTERNAL_STATS
 		m_inspector->m_stats.m_n_added_fds++;
 #endif
@@ -268,7 +666,7 @@ sinsp_fdinfo_t* sinsp_fdtable::add(int64_t fd, sinsp_fdinfo_t* fdinfo)
 		//
 		// the fd is already in the table.
 		//
-		if(insert_res.first->second.m_flags & sinsp_fdinfo_t::FLAGS_CLOSE_IN_PROGRESS)
+		if(prev->m_flags & sinsp_fdinfo_t::FLAGS_CLOSE_IN_PROGRESS)
 		{
 			//
 			// Sometimes an FD-creating syscall can be called on an FD that is being closed (i.e
@@ -279,7 +677,7 @@ sinsp_fdinfo_t* sinsp_fdtable::add(int64_t fd, sinsp_fdinfo_t* fdinfo)
 			fdinfo->m_flags &= ~sinsp_fdinfo_t::FLAGS_CLOSE_IN_PROGRESS;
 			fdinfo->m_flags |= sinsp_fdinfo_t::FLAGS_CLOSE_CANCELED;
 			
-			m_table[CANCELED_FD_NUMBER] = insert_res.first->second;
+			m_table[CANCELED_FD_NUMBER] = *prev;
 		}
 		else
 		{
@@ -295,26 +693,40 @@ sinsp_fdinfo_t* sinsp_fdtable::add(int64_t fd, sinsp_fdinfo_t* fdinfo)
 			// XXX Can't have this enabled until the FD_CLOEXEC flag is supported
 //					ASSERT(false);
 		}
+	}
 
-		//
-		// Replace the fd as a struct copy
-		//
-		insert_res.first->second = *fdinfo;
+	//
+	// Replace the fd as a struct copy
+	//
+	if(fdit == m_table.end())
+	{
+		fdit = m_table.insert(std::make_pair(fd, *fdinfo)).first;
+	}
+	else
+	{
+		fdit->second = *fdinfo;
 	}
 
-	return &(insert_res.first->second);
+	account(m_table.size() - nentries);
+	set_dense(fd, &(fdit->second));
+	return &(fdit->second);
 }
 
 void sinsp_fdtable::erase(int64_t fd)
 {
+	sinsp_alloc_scope alloc_scope(SAS_FDS);
 	unordered_map<int64_t, sinsp_fdinfo_t>::iterator fdit = m_table.find(fd);
+	bool shared = (m_shared != NULL && find_in_snapshots(m_shared, fd) != NULL);
+
+	uint32_t j = fd & (SP_FD_CACHE_SIZE - 1);
 
-	if(fd == m_last_accessed_fd)
+	if(m_cache_fds[j] == fd)
 	{
-		m_last_accessed_fd = -1;		
+		m_cache_fdinfos[j] = NULL;
 	}
 
-	if(fdit == m_table.end())
+	if((fdit == m_table.end() && !shared) ||
+		(fdit != m_table.end() && (fdit->second.m_flags & sinsp_fdinfo_t::FLAGS_REMOVED)))
 	{
 		//
 		// Looks like there's no fd to remove.
@@ -329,7 +741,27 @@ void sinsp_fdtable::erase(int64_t fd)
 	}
 	else
 	{
-		m_table.erase(fdit);
+		set_dense(fd, NULL);
+
+		if(shared)
+		{
+			//
+			// Hide the entry of the snapshot
+			//
+			sinsp_fdinfo_t removed;
+			removed.m_flags = sinsp_fdinfo_t::FLAGS_REMOVED;
+			if(fdit == m_table.end())
+			{
+				account(1);
+			}
+
+			m_table[fd] = removed;
+		}
+		else
+		{
+			account(-1);
+			m_table.erase(fdit);
+		}
 #ifdef GATHER_INTERNAL_STATS
 		m_inspector->m_stats.m_n_noncached_fd_lookups++;
 		m_inspector->m_stats.m_n_removed_fds++;
@@ -339,15 +771,40 @@ void sinsp_fdtable::erase(int64_t fd)
 
 void sinsp_fdtable::clear()
 {
+	account(-(int64_t)m_table.size());
 	m_table.clear();
+	release_snapshot(m_shared);
+	m_shared = NULL;
+	m_dense.clear();
+	reset_cache();
+}
+
+static bool count_fd(int64_t fd, sinsp_fdinfo_t* fdinfo, void* arg)
+{
+	(*(size_t*)arg)++;
+	return false;
 }
 
 size_t sinsp_fdtable::size()
 {
-	return m_table.size();
+	size_t res = 0;
+
+	if(m_shared == NULL)
+	{
+		return m_table.size();
+	}
+
+	visit(count_fd, &res);
+	return res;
 }
 
 void sinsp_fdtable::reset_cache()
 {
-	m_last_accessed_fd = -1;
+	uint32_t j;
+
+	for(j = 0; j < SP_FD_CACHE_SIZE; j++)
+	{
+		m_cache_fds[j] = -1;
+		m_cache_fdinfos[j] = NULL;
+	}
 }
@@ -55,6 +55,283 @@ typedef union _sinsp_sockinfo
 	unix_tuple m_unixinfo; ///< The tuple if this a unix socket.
 }sinsp_sockinfo;
 
+/*!
+  \brief The I/O counters that the top fds and threads can be ranked by,
+   see \ref sinsp::get_top_fds.
+*/
+enum sinsp_io_counter
+{
+	IOC_BYTES_IN = 0, ///< Bytes read.
+	IOC_BYTES_OUT = 1, ///< Bytes written.
+	IOC_BYTES = 2, ///< Bytes read or written.
+	IOC_OPS_IN = 3, ///< Successful reads.
+	IOC_OPS_OUT = 4, ///< Successful writes.
+	IOC_OPS = 5, ///< Successful reads or writes.
+	IOC_TIME = 6, ///< Nanoseconds spent in the read and write syscalls.
+};
+
+/*!
+  \brief Byte, operation and time counters of the reads and writes of an FD
+   or of a thread, updated by the parser for each successful read or write.
+*/
+struct sinsp_io_counters
+{
+	uint64_t m_bytes_in; ///< Bytes read.
+	uint64_t m_bytes_out; ///< Bytes written.
+	uint64_t m_ops_in; ///< Successful reads.
+	uint64_t m_ops_out; ///< Successful writes.
+	uint64_t m_time_ns; ///< Nanoseconds spent in the read and write syscalls. Only counted when filtering is compiled in, since it comes from the event latency.
+
+	void clear()
+	{
+		m_bytes_in = 0;
+		m_bytes_out = 0;
+		m_ops_in = 0;
+		m_ops_out = 0;
+		m_time_ns = 0;
+	}
+
+	void add(bool is_read, uint64_t bytes, uint64_t time_ns)
+	{
+		if(is_read)
+		{
+			m_bytes_in += bytes;
+			m_ops_in++;
+		}
+		else
+		{
+			m_bytes_out += bytes;
+			m_ops_out++;
+		}
+
+		m_time_ns += time_ns;
+	}
+
+	uint64_t get(sinsp_io_counter counter) const
+	{
+		switch(counter)
+		{
+		case IOC_BYTES_IN:
+			return m_bytes_in;
+		case IOC_BYTES_OUT:
+			return m_bytes_out;
+		case IOC_BYTES:
+			return m_bytes_in + m_bytes_out;
+		case IOC_OPS_IN:
+			return m_ops_in;
+		case IOC_OPS_OUT:
+			return m_ops_out;
+		case IOC_OPS:
+			return m_ops_in + m_ops_out;
+		case IOC_TIME:
+			return m_time_ns;
+		default:
+			return 0;
+		}
+	}
+};
+
+//
+// Number of size classes of the reads and writes in sinsp_access_pattern
+//
+#define SINSP_IO_SIZE_BUCKETS 8
+
+/*!
+  \brief How the reads and writes of a regular file move in it, updated by
+   the parser for each successful read or write. A read or write is
+   sequential if it starts where the previous one ended.
+
+  The offset of the FD is only known if the file was opened during the
+  capture, without O_APPEND, or after an lseek. Until then only the reads
+  and writes at a given position (pread, pwrite...) are classified.
+*/
+struct sinsp_access_pattern
+{
+	uint64_t m_offset; ///< The offset of the FD, where the next read or write starts. Valid if m_offset_known.
+	uint64_t m_next; ///< Where the last read or write ended. Valid if m_next_known.
+	uint64_t m_seq_ops; ///< Reads and writes that started where the previous one ended.
+	uint64_t m_rand_ops; ///< Reads and writes that started somewhere else.
+	uint32_t m_sizes[SINSP_IO_SIZE_BUCKETS]; ///< Reads and writes by size: less than 1KB, 4KB, 16KB, 64KB, 256KB, 1MB, 4MB, and the others.
+	bool m_offset_known;
+	bool m_next_known;
+	bool m_last_known; ///< The last read or write could be classified.
+	bool m_last_seq; ///< The last read or write was sequential. Valid if m_last_known.
+
+	void clear()
+	{
+		memset(this, 0, sizeof(*this));
+	}
+
+	void set_offset(uint64_t offset)
+	{
+		m_offset = offset;
+		m_offset_known = true;
+	}
+
+	//
+	// A read or write of len bytes at the offset of the FD
+	//
+	void add(uint64_t len)
+	{
+		add_at(m_offset_known, m_offset, len);
+		m_offset += len;
+	}
+
+	//
+	// A read or write of len bytes at a given position, which doesn't move
+	// the offset of the FD. known is false if the position isn't known.
+	//
+	void add_at(bool known, uint64_t pos, uint64_t len)
+	{
+		m_last_known = known && m_next_known;
+
+		if(m_last_known)
+		{
+			m_last_seq = (pos == m_next);
+
+			if(m_last_seq)
+			{
+				m_seq_ops++;
+			}
+			else
+			{
+				m_rand_ops++;
+			}
+		}
+
+		m_next = pos + len;
+		m_next_known = known;
+		add_size(len);
+	}
+
+	//
+	// A write to a file opened with O_APPEND, which is always sequential
+	// but leaves the offset of the FD at an unknown place
+	//
+	void add_append(uint64_t len)
+	{
+		m_seq_ops++;
+		m_last_known = true;
+		m_last_seq = true;
+		m_offset_known = false;
+		m_next_known = false;
+		add_size(len);
+	}
+
+	void add_size(uint64_t len)
+	{
+		uint64_t limit = 1024;
+		uint32_t j = 0;
+
+		while(j < SINSP_IO_SIZE_BUCKETS - 1 && len >= limit)
+		{
+			limit <<= 2;
+			j++;
+		}
+
+		m_sizes[j]++;
+	}
+};
+
+/*!
+  \brief An entry of the result of \ref sinsp::get_top_fds and
+   \ref sinsp::get_top_threads.
+*/
+struct sinsp_io_top_entry
+{
+	int64_t m_tid; ///< For a thread, its id. For an FD, the id of the process that owns it.
+	int64_t m_pid; ///< The id of the process.
+	int64_t m_fd; ///< The FD number, or -1 for a thread.
+	string m_name; ///< The FD name, or the thread command name.
+	sinsp_io_counters m_counters;
+};
+
+//
+// The state of an fd that only the sockets with transactions or with a
+// decoded protocol need. It's allocated the first time it's needed, so
+// that it doesn't make every entry of the fd tables bigger.
+//
+struct sinsp_fdinfo_cold
+{
+	sinsp_fdinfo_cold()
+	{
+		m_trans_state = 0;
+		m_trans_start_ts = 0;
+		m_trans_end_ts = 0;
+		m_trans_count = 0;
+		m_protoinfo.m_proto = SINSP_L7_NONE;
+		m_protoinfo.clear();
+	}
+
+	//
+	// State of the current request/response transaction, see
+	// sinsp_transaction_table
+	//
+	uint8_t m_trans_state;
+	uint64_t m_trans_start_ts; // First request read or write
+	uint64_t m_trans_end_ts; // Last response read or write
+	uint64_t m_trans_count; // Completed transactions
+
+	//
+	// Last request/response decoded by sinsp_protocol_decoder_table
+	//
+	sinsp_protoinfo m_protoinfo;
+};
+
+//
+// Owns the cold state of an fd, and copies it with the fd
+//
+class sinsp_fdinfo_cold_ptr
+{
+public:
+	sinsp_fdinfo_cold_ptr()
+	{
+		m_ptr = NULL;
+	}
+
+	sinsp_fdinfo_cold_ptr(const sinsp_fdinfo_cold_ptr& other)
+	{
+		m_ptr = (other.m_ptr != NULL)? new sinsp_fdinfo_cold(*other.m_ptr) : NULL;
+	}
+
+	~sinsp_fdinfo_cold_ptr()
+	{
+		delete m_ptr;
+	}
+
+	sinsp_fdinfo_cold_ptr& operator=(const sinsp_fdinfo_cold_ptr& other)
+	{
+		if(this != &other)
+		{
+			delete m_ptr;
+			m_ptr = (other.m_ptr != NULL)? new sinsp_fdinfo_cold(*other.m_ptr) : NULL;
+		}
+
+		return *this;
+	}
+
+	//
+	// NULL if the fd never needed its cold state
+	//
+	sinsp_fdinfo_cold* get() const
+	{
+		return m_ptr;
+	}
+
+	sinsp_fdinfo_cold* get_or_create()
+	{
+		if(m_ptr == NULL)
+		{
+			m_ptr = new sinsp_fdinfo_cold();
+		}
+
+		return m_ptr;
+	}
+
+private:
+	sinsp_fdinfo_cold* m_ptr;
+};
+
 /*!
   \brief File Descriptor information class.
   This class contains the full state for a FD, and a bunch of functions to
@@ -68,7 +345,7 @@ class SINSP_PUBLIC sinsp_fdinfo
 {
 public:
 	sinsp_fdinfo();
-	string* tostring();
+	const string* tostring();
 
 	/*!
 	  \brief Return a single ASCII character that identifies the FD type.
@@ -94,7 +371,7 @@ public:
 	}
 
 	/*!
-	  \brief Returns true if this is an IPv4 socket.
+	  \brief Returns true if this is an IPv6 socket.
 	*/
 	bool is_ipv6_socket()
 	{
@@ -106,7 +383,8 @@ public:
 	*/
 	bool is_udp_socket()
 	{
-		return m_type == SCAP_FD_IPV4_SOCK && m_sockinfo.m_ipv4info.m_fields.m_l4proto == SCAP_L4_UDP;
+		return (m_type == SCAP_FD_IPV4_SOCK && m_sockinfo.m_ipv4info.m_fields.m_l4proto == SCAP_L4_UDP) ||
+			(m_type == SCAP_FD_IPV6_SOCK && m_sockinfo.m_ipv6info.m_fields.m_l4proto == SCAP_L4_UDP);
 	}
 
 	/*!
@@ -114,7 +392,8 @@ public:
 	*/
 	bool is_tcp_socket()
 	{
-		return m_type == SCAP_FD_IPV4_SOCK && m_sockinfo.m_ipv4info.m_fields.m_l4proto == SCAP_L4_TCP;
+		return (m_type == SCAP_FD_IPV4_SOCK && m_sockinfo.m_ipv4info.m_fields.m_l4proto == SCAP_L4_TCP) ||
+			(m_type == SCAP_FD_IPV6_SOCK && m_sockinfo.m_ipv6info.m_fields.m_l4proto == SCAP_L4_TCP);
 	}
 
 	/*!
@@ -130,16 +409,29 @@ public:
 	*/
 	scap_l4_proto get_l4proto();
 
+	//
+	// The members are declared in the order of their use: the ones that
+	// every read and write looks at come first and fit in 64 bytes, see the
+	// static_asserts in fdinfo.cpp, and the state of the transactions and
+	// of the protocols is allocated apart, in m_cold.
+	//
 	scap_fd_type m_type; ///< The fd type, e.g. file, directory, IPv4 socket...
 	uint32_t m_openflags; ///< If this FD is a file, the flags that were used when opening it. See the PPM_O_* definitions in driver/ppm_events_public.h.
-	
+
+VISIBILITY_PRIVATE
+	uint32_t m_flags;
+
+public:
 	/*!
 	  \brief Socket-specific state.
 	  This is uninitialized for non-socket FDs.
 	*/
 	sinsp_sockinfo m_sockinfo;
 
-	string m_name; ///< Human readable rendering of this FD. For files, this is the full file name. For sockets, this is the tuple. And so on.
+	sinsp_pooled_string m_name; ///< Human readable rendering of this FD. For files, this is the full file name. For sockets, this is the tuple. And so on.
+	sinsp_io_counters m_io; ///< Reads and writes on this FD since it was opened.
+	sinsp_access_pattern m_access; ///< For regular files, where the reads and writes happen in the file.
+	uint32_t m_drop_gen; ///< The drop generation of the inspector when this FD was added, see \ref sinsp_threadinfo::is_fd_stale().
 
 VISIBILITY_PRIVATE
 
@@ -162,9 +454,15 @@ private:
 		FLAGS_CLOSE_CANCELED = (1 << 5),
 		// Pipe-specific flags
 		FLAGS_IS_SOCKET_PIPE = (1 << 6),
+		// The fd was closed, but it's still in a snapshot shared with other
+		// fd tables. Only used internally by sinsp_fdtable.
+		FLAGS_REMOVED = (1 << 7),
+		// FLAGS_DIP_LOCAL is known for the destination address in m_local_dip
+		FLAGS_DIP_LOCAL_KNOWN = (1 << 8),
+		FLAGS_DIP_LOCAL = (1 << 9),
 	};
 
-	void add_filename(const char* directory, uint32_t directorylen, const char* filename, uint32_t filenamelen);
+	void add_filename(sinsp_string_pool* pool, const char* directory, uint32_t directorylen, const char* filename, uint32_t filenamelen);
 
 	bool is_role_server()
 	{
@@ -206,6 +504,12 @@ private:
 		sinsp_fdinfo_t* pfdinfo,
 		bool incoming);
 
+	//
+	// Return true if the IPv4 destination address is one of the machine.
+	// The interfaces are only looked at when the address changes.
+	//
+	bool is_dip_local(sinsp* inspector);
+
 	void reset_flags()
 	{
 		m_flags = FLAGS_NONE;
@@ -226,9 +530,10 @@ private:
 		return !is_role_client() && !is_role_server();
 	}
 
-	T m_usrstate;
-	uint32_t m_flags;
+	uint32_t m_local_dip; // The address that FLAGS_DIP_LOCAL was computed for
 	uint64_t m_ino;
+	sinsp_fdinfo_cold_ptr m_cold;
+	T m_usrstate;
 
 	friend class sinsp_parser;
 	friend class sinsp_threadinfo;
@@ -237,17 +542,37 @@ private:
 	friend class sinsp_analyzer_fd_listener;
 	friend class sinsp_fdtable;
 	friend class sinsp_filter_check_fd;
+	friend class sinsp_transaction_table;
+	friend class sinsp_protocol_decoder_table;
+	friend class sinsp_ipc_index;
 };
 
 /*@}*/
 
+//
+// Called by sinsp_fdtable::visit() for each fd. Returning true stops the visit.
+//
+typedef bool (*sinsp_fdtable_visitor)(int64_t fd, sinsp_fdinfo_t* fdinfo, void* arg);
+
 ///////////////////////////////////////////////////////////////////////////////
 // fd info table
+//
+// The tables of a forked process and of its parent share the fds that they
+// had at the fork: share() moves the entries of the parent to a read only
+// snapshot, and the copies of the table keep a reference to it. A table
+// copies an entry of its snapshot the first time it's looked up, since the
+// caller can modify it, and records the fds that it closes. The snapshots
+// can be stacked, up to SP_FDTABLE_MAX_SNAPSHOTS, when a process keeps
+// forking.
 ///////////////////////////////////////////////////////////////////////////////
 class sinsp_fdtable
 {
 public:
 	sinsp_fdtable(sinsp* inspector);
+	sinsp_fdtable(const sinsp_fdtable& other);
+	~sinsp_fdtable();
+	// The copy shares the snapshot of the other table
+	sinsp_fdtable& operator=(const sinsp_fdtable& other);
 	sinsp_fdinfo_t* find(int64_t fd);
 	// If the key is already present, overwrite the existing value and return false.
 	sinsp_fdinfo_t* add(int64_t fd, sinsp_fdinfo_t* fdinfo);
@@ -255,14 +580,69 @@ public:
 	void erase(int64_t fd);
 	void clear();
 	size_t size();
+	bool empty()
+	{
+		return m_table.empty() && m_shared == NULL;
+	}
 	void reset_cache();
+	void set_dense(int64_t fd, sinsp_fdinfo_t* fdinfo);
+
+	//
+	// Move the entries to a snapshot, shared with the copies of the table
+	// made from now on
+	//
+	void share();
+
+	//
+	// Copy all the shared entries in this table, so that m_table contains
+	// all the fds and can be modified
+	//
+	void unshare();
+
+	//
+	// Call the visitor for each fd, shared or not, without copying them.
+	// The shared entries must not be modified.
+	//
+	bool visit(sinsp_fdtable_visitor visitor, void* arg);
 
 	sinsp* m_inspector;
+
+	//
+	// The entries that belong to this table. When the table shares a
+	// snapshot, this doesn't include the shared fds and contains the
+	// FLAGS_REMOVED entries of the closed ones: use unshare() before
+	// iterating it directly.
+	//
 	unordered_map<int64_t, sinsp_fdinfo_t> m_table;
 
 	//
-	// Simple fd cache
+	// Entries of m_table indexed by fd number, for the fds below
+	// SP_FDTABLE_DENSE_SIZE. NULL for the fds that are not open.
+	//
+	vector<sinsp_fdinfo_t*> m_dense;
+
+	//
+	// Recently looked up fds that are not in the dense index, in the slot
+	// given by their low bits
 	//
-	int64_t m_last_accessed_fd;
-	sinsp_fdinfo_t *m_last_accessed_fdinfo;
+	int64_t m_cache_fds[SP_FD_CACHE_SIZE];
+	sinsp_fdinfo_t* m_cache_fdinfos[SP_FD_CACHE_SIZE];
+
+private:
+	struct snapshot
+	{
+		unordered_map<int64_t, sinsp_fdinfo_t> m_table;
+		snapshot* m_base; // The older snapshot that this one was stacked on
+		uint32_t m_refcount;
+		uint32_t m_depth;
+	};
+
+	static sinsp_fdinfo_t* find_in_snapshots(snapshot* s, int64_t fd);
+	void account(int64_t nentries);
+	void release_snapshot(snapshot* s);
+	static void merge_snapshots(snapshot* s, unordered_map<int64_t, sinsp_fdinfo_t>* table);
+	sinsp_fdinfo_t* copy_shared(int64_t fd);
+	void rebuild_dense();
+
+	snapshot* m_shared; // NULL if the table doesn't share its fds
 };
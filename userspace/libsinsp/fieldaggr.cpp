@@ -0,0 +1,692 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+
+#include "sinsp.h"
+#include "sinsp_int.h"
+#include "filter.h"
+#include "filterchecks.h"
+#include "fieldaggr.h"
+#include "sketches.h"
+
+extern sinsp_filter_check_list g_filterlist;
+
+//
+// Order of the groups in get_top()
+//
+static bool entry_greater(const sinsp_field_aggregator::entry* a, const sinsp_field_aggregator::entry* b)
+{
+	return a->second > b->second;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// sinsp_field_aggregator implementation
+///////////////////////////////////////////////////////////////////////////////
+sinsp_field_aggregator::sinsp_field_aggregator(sinsp* inspector, op aggr_op, bool positive_only)
+{
+	m_inspector = inspector;
+	m_op = aggr_op;
+	m_positive_only = positive_only;
+	m_scale_by_sampling = false;
+	m_value = NULL;
+	m_topk = NULL;
+}
+
+sinsp_field_aggregator::~sinsp_field_aggregator()
+{
+	for(uint32_t j = 0; j < m_keys.size(); j++)
+	{
+		delete m_keys[j];
+	}
+
+	if(m_value != NULL)
+	{
+		delete m_value;
+	}
+
+	if(m_topk != NULL)
+	{
+		delete m_topk;
+	}
+}
+
+bool sinsp_field_aggregator::parse_op(const string& name, OUT op* res)
+{
+	if(name == "sum")
+	{
+		*res = AO_SUM;
+	}
+	else if(name == "count")
+	{
+		*res = AO_COUNT;
+	}
+	else if(name == "min")
+	{
+		*res = AO_MIN;
+	}
+	else if(name == "max")
+	{
+		*res = AO_MAX;
+	}
+	else
+	{
+		return false;
+	}
+
+	return true;
+}
+
+sinsp_filter_check* sinsp_field_aggregator::new_check(const string& fldname)
+{
+	sinsp_filter_check* chk = g_filterlist.new_filter_check_from_fldname(fldname,
+		m_inspector,
+		false);
+
+	if(chk == NULL)
+	{
+		throw sinsp_exception("aggregation on nonexistent field " + fldname);
+	}
+
+	chk->parse_field_name(fldname.c_str());
+	chk->enable_field_cache(fldname);
+	return chk;
+}
+
+void sinsp_field_aggregator::add_key(const string& fldname)
+{
+	m_keys.push_back(new_check(fldname));
+}
+
+void sinsp_field_aggregator::set_value(const string& fldname)
+{
+	sinsp_filter_check* chk = new_check(fldname);
+
+	switch(chk->get_field_info()->m_type)
+	{
+	case PT_INT8:
+	case PT_INT16:
+	case PT_INT32:
+	case PT_INT64:
+	case PT_ERRNO:
+	case PT_PID:
+	case PT_UINT8:
+	case PT_UINT16:
+	case PT_UINT32:
+	case PT_UINT64:
+	case PT_RELTIME:
+	case PT_ABSTIME:
+		break;
+	default:
+		delete chk;
+		throw sinsp_exception("aggregation value " + fldname + " is not numeric");
+	}
+
+	if(m_value != NULL)
+	{
+		delete m_value;
+	}
+
+	m_value = chk;
+}
+
+void sinsp_field_aggregator::set_max_groups(uint32_t n)
+{
+	if(m_op != AO_SUM && m_op != AO_COUNT)
+	{
+		throw sinsp_exception("only the sum and count aggregations can have a maximum number of groups");
+	}
+
+	ASSERT(m_table.empty());
+
+	if(m_topk != NULL)
+	{
+		delete m_topk;
+	}
+
+	m_topk = new sinsp_topk(n);
+}
+
+void sinsp_field_aggregator::add(group_table* table, const string& key, double value)
+{
+	if(m_topk != NULL && table == &m_table)
+	{
+		m_topk->add(key, value);
+		return;
+	}
+
+	pair<group_table::iterator, bool> res =
+		table->insert(entry(key, value));
+
+	if(res.second)
+	{
+		return;
+	}
+
+	double* cur = &res.first->second;
+
+	switch(m_op)
+	{
+	case AO_SUM:
+	case AO_COUNT:
+		*cur += value;
+		break;
+	case AO_MIN:
+		if(value < *cur)
+		{
+			*cur = value;
+		}
+		break;
+	case AO_MAX:
+		if(value > *cur)
+		{
+			*cur = value;
+		}
+		break;
+	default:
+		ASSERT(false);
+		break;
+	}
+}
+
+void sinsp_field_aggregator::process(sinsp_evt* evt, group_table* table)
+{
+	double value;
+
+	if(extract(evt, &value))
+	{
+		add(table, m_keybuf, value);
+	}
+}
+
+bool sinsp_field_aggregator::extract(sinsp_evt* evt, OUT double* res)
+{
+	sinsp_field_value val;
+	double value = 1;
+	uint32_t j;
+
+	ASSERT(m_value != NULL || m_op == AO_COUNT);
+
+	if(m_value != NULL)
+	{
+		if(!m_value->extract_value(evt, &val))
+		{
+			return false;
+		}
+
+		if(m_positive_only && val.m_num <= 0)
+		{
+			return false;
+		}
+
+		if(m_op != AO_COUNT)
+		{
+			value = val.m_num;
+		}
+	}
+
+	if(m_scale_by_sampling && (m_op == AO_SUM || m_op == AO_COUNT))
+	{
+		value *= m_inspector->get_sampling_ratio();
+	}
+
+	//
+	// Pack the key fields: the kind of each value, followed by the 8 bytes
+	// of the numbers or the length and the bytes of the buffers
+	//
+	m_keybuf.clear();
+
+	for(j = 0; j < m_keys.size(); j++)
+	{
+		if(!m_keys[j]->extract_value(evt, &val))
+		{
+			return false;
+		}
+
+		m_keybuf.push_back((char)val.m_kind);
+
+		if(val.m_kind == SFV_BUF)
+		{
+			//
+			// Like for evt.field(), the buffers end at the first zero
+			//
+			const char* end = (const char*)memchr(val.m_buf, 0, val.m_len);
+			uint32_t len = (end != NULL)? (uint32_t)(end - val.m_buf) : val.m_len;
+
+			m_keybuf.append((const char*)&len, sizeof(len));
+			m_keybuf.append(val.m_buf, len);
+		}
+		else
+		{
+			m_keybuf.append((const char*)&val.m_uint, sizeof(val.m_uint));
+		}
+	}
+
+	*res = value;
+	return true;
+}
+
+void sinsp_field_aggregator::merge(sinsp_field_aggregator* other)
+{
+	ASSERT(other->m_op == m_op);
+	ASSERT(other->m_keys.size() == m_keys.size());
+
+	if(other->m_topk != NULL)
+	{
+		vector<const sinsp_topk::entry*> groups;
+
+		other->m_topk->get_top(0, &groups);
+
+		for(uint32_t j = 0; j < groups.size(); j++)
+		{
+			add(&m_table, groups[j]->m_key, groups[j]->m_count);
+		}
+
+		return;
+	}
+
+	merge_groups(other->m_table);
+}
+
+void sinsp_field_aggregator::merge_groups(const group_table& groups)
+{
+	group_table::const_iterator it;
+
+	for(it = groups.begin(); it != groups.end(); ++it)
+	{
+		add(&m_table, it->first, it->second);
+	}
+}
+
+//
+// After the header of sinsp_partial_buffer, a partial has its version, the
+// op and the number of keys, and whether the groups are a top-k summary or a
+// plain table
+//
+#define FIELD_AGGREGATOR_PARTIAL_VERSION 2
+
+//
+// The numbers in the keys are in the byte order of the host, see
+// get_key(). In the partials they are little endian like the rest, and a
+// key read from a partial is checked to have nkeys well formed values.
+//
+static bool convert_partial_key(const string& key, uint32_t nkeys, bool to_partial, OUT string* res)
+{
+	const char* p = key.data();
+	const char* end = p + key.size();
+
+	res->clear();
+
+	for(uint32_t j = 0; j < nkeys; j++)
+	{
+		uint64_t val = 0;
+		uint32_t size;
+
+		if(p == end)
+		{
+			return false;
+		}
+
+		res->push_back(*p);
+		size = ((uint8_t)*p++ == SFV_BUF)? sizeof(uint32_t) : sizeof(uint64_t);
+
+		if((size_t)(end - p) < size)
+		{
+			return false;
+		}
+
+		if(to_partial)
+		{
+			if(size == sizeof(uint32_t))
+			{
+				uint32_t val32;
+
+				memcpy(&val32, p, sizeof(val32));
+				sinsp_partial_buffer::put(res, val32);
+				val = val32;
+			}
+			else
+			{
+				memcpy(&val, p, sizeof(val));
+				sinsp_partial_buffer::put(res, val);
+			}
+		}
+		else
+		{
+			for(uint32_t k = 0; k < size; k++)
+			{
+				val |= (uint64_t)(uint8_t)p[k] << (k * 8);
+			}
+
+			if(size == sizeof(uint32_t))
+			{
+				uint32_t val32 = (uint32_t)val;
+
+				res->append((const char*)&val32, sizeof(val32));
+			}
+			else
+			{
+				res->append((const char*)&val, sizeof(val));
+			}
+		}
+
+		p += size;
+
+		//
+		// The bytes of a buffer follow its length
+		//
+		if(size == sizeof(uint32_t))
+		{
+			if((uint64_t)(end - p) < val)
+			{
+				return false;
+			}
+
+			res->append(p, (size_t)val);
+			p += val;
+		}
+	}
+
+	return p == end;
+}
+
+static bool key_to_partial(const string& key, uint32_t nkeys, OUT string* res)
+{
+	return convert_partial_key(key, nkeys, true, res);
+}
+
+static bool key_from_partial(const string& key, uint32_t nkeys, OUT string* res)
+{
+	return convert_partial_key(key, nkeys, false, res);
+}
+
+void sinsp_field_aggregator::serialize(OUT string* res)
+{
+	uint32_t nkeys = (uint32_t)m_keys.size();
+	size_t start = sinsp_partial_buffer::put_header(res);
+	string key;
+
+	sinsp_partial_buffer::put(res, (uint8_t)FIELD_AGGREGATOR_PARTIAL_VERSION);
+	sinsp_partial_buffer::put(res, (uint8_t)m_op);
+	sinsp_partial_buffer::put(res, nkeys);
+	sinsp_partial_buffer::put(res, (uint8_t)(m_topk != NULL));
+
+	if(m_topk != NULL)
+	{
+		sinsp_topk groups(*m_topk);
+
+		groups.convert_keys(key_to_partial, nkeys);
+		groups.serialize(res);
+		sinsp_partial_buffer::put_length(res, start);
+		return;
+	}
+
+	sinsp_partial_buffer::put(res, (uint32_t)m_table.size());
+
+	for(group_table::iterator it = m_table.begin(); it != m_table.end(); ++it)
+	{
+		key_to_partial(it->first, nkeys, &key);
+		sinsp_partial_buffer::put_string(res, key);
+		sinsp_partial_buffer::put(res, it->second);
+	}
+
+	sinsp_partial_buffer::put_length(res, start);
+}
+
+bool sinsp_field_aggregator::merge_partial(const char* buf, uint32_t len)
+{
+	sinsp_partial_buffer pbuf(buf, len);
+	uint8_t version;
+	uint8_t aggr_op;
+	uint32_t nkeys;
+	uint8_t is_topk;
+
+	if(!pbuf.get_header() ||
+		!pbuf.get(&version) || version != FIELD_AGGREGATOR_PARTIAL_VERSION ||
+		!pbuf.get(&aggr_op) || aggr_op != m_op ||
+		!pbuf.get(&nkeys) || nkeys != m_keys.size() ||
+		!pbuf.get(&is_topk))
+	{
+		return false;
+	}
+
+	if(is_topk)
+	{
+		sinsp_topk other(1);
+
+		if(!other.deserialize(&pbuf) || !pbuf.at_end() ||
+			!other.convert_keys(key_from_partial, nkeys))
+		{
+			return false;
+		}
+
+		if(m_topk != NULL)
+		{
+			m_topk->merge(other);
+			return true;
+		}
+
+		vector<const sinsp_topk::entry*> groups;
+
+		other.get_top(0, &groups);
+
+		for(uint32_t j = 0; j < groups.size(); j++)
+		{
+			add(&m_table, groups[j]->m_key, groups[j]->m_count);
+		}
+
+		return true;
+	}
+
+	//
+	// The groups are read before any of them is added, so that an invalid
+	// partial doesn't change the groups
+	//
+	uint32_t ngroups;
+	vector<entry> groups;
+
+	if(!pbuf.get(&ngroups))
+	{
+		return false;
+	}
+
+	for(uint32_t j = 0; j < ngroups; j++)
+	{
+		string pkey;
+		string key;
+		double value;
+
+		if(!pbuf.get_string(&pkey) || !pbuf.get(&value) ||
+			!key_from_partial(pkey, nkeys, &key))
+		{
+			return false;
+		}
+
+		groups.push_back(entry(key, value));
+	}
+
+	if(!pbuf.at_end())
+	{
+		return false;
+	}
+
+	for(uint32_t j = 0; j < groups.size(); j++)
+	{
+		add(&m_table, groups[j].first, groups[j].second);
+	}
+
+	return true;
+}
+
+void sinsp_field_aggregator::clear()
+{
+	m_table.clear();
+
+	if(m_topk != NULL)
+	{
+		m_topk->clear();
+	}
+}
+
+uint32_t sinsp_field_aggregator::size()
+{
+	if(m_topk != NULL)
+	{
+		return m_topk->size();
+	}
+
+	return (uint32_t)m_table.size();
+}
+
+void sinsp_field_aggregator::get_top(uint32_t n, OUT vector<const entry*>* res)
+{
+	group_table::iterator it;
+	uint32_t j;
+
+	res->clear();
+
+	if(m_topk != NULL)
+	{
+		vector<const sinsp_topk::entry*> groups;
+
+		m_topk->get_top(n, &groups);
+
+		m_top_entries.clear();
+		m_top_entries.reserve(groups.size());
+
+		for(j = 0; j < groups.size(); j++)
+		{
+			m_top_entries.push_back(entry(groups[j]->m_key, groups[j]->m_count));
+		}
+
+		for(j = 0; j < m_top_entries.size(); j++)
+		{
+			res->push_back(&m_top_entries[j]);
+		}
+
+		return;
+	}
+
+	res->reserve(m_table.size());
+
+	for(it = m_table.begin(); it != m_table.end(); ++it)
+	{
+		res->push_back(&*it);
+	}
+
+	//
+	// Only the first n groups are sorted
+	//
+	if(n != 0 && n < res->size())
+	{
+		partial_sort(res->begin(), res->begin() + n, res->end(), entry_greater);
+		res->resize(n);
+	}
+	else
+	{
+		sort(res->begin(), res->end(), entry_greater);
+	}
+}
+
+void sinsp_field_aggregator::get_key_values(const string& key, OUT vector<sinsp_field_value>* vals)
+{
+	const char* p = key.data();
+	const char* end = p + key.size();
+	uint32_t j;
+
+	vals->clear();
+
+	for(j = 0; j < m_keys.size() && p < end; j++)
+	{
+		sinsp_field_value val;
+
+		val.m_type = m_keys[j]->get_field_info()->m_type;
+		val.m_kind = (uint8_t)*p++;
+		val.m_int = 0;
+		val.m_uint = 0;
+		val.m_num = 0;
+		val.m_buf = NULL;
+		val.m_len = 0;
+
+		if(val.m_kind == SFV_BUF)
+		{
+			memcpy(&val.m_len, p, sizeof(val.m_len));
+			p += sizeof(val.m_len);
+			val.m_buf = p;
+			p += val.m_len;
+		}
+		else
+		{
+			memcpy(&val.m_uint, p, sizeof(val.m_uint));
+			p += sizeof(val.m_uint);
+			val.m_int = (int64_t)val.m_uint;
+			val.m_num = (val.m_kind == SFV_INT)? (double)val.m_int : (double)val.m_uint;
+		}
+
+		vals->push_back(val);
+	}
+
+	ASSERT(p == end);
+}
+
+void sinsp_field_aggregator::key_to_string(const string& key, OUT string* res)
+{
+	vector<sinsp_field_value> vals;
+	char buf[32];
+
+	get_key_values(key, &vals);
+	res->clear();
+
+	for(uint32_t j = 0; j < vals.size(); j++)
+	{
+		const sinsp_field_value* val = &vals[j];
+
+		if(j > 0)
+		{
+			res->push_back(' ');
+		}
+
+		switch(val->m_kind)
+		{
+		case SFV_INT:
+			snprintf(buf, sizeof(buf), "%" PRId64, val->m_int);
+			res->append(buf);
+			break;
+		case SFV_UINT:
+			snprintf(buf, sizeof(buf), "%" PRIu64, val->m_uint);
+			res->append(buf);
+			break;
+		case SFV_BOOL:
+			res->append((val->m_uint != 0)? "true" : "false");
+			break;
+		case SFV_IPV4:
+			snprintf(buf,
+				sizeof(buf),
+				"%u.%u.%u.%u",
+				(uint32_t)(val->m_uint >> 24) & 0xff,
+				(uint32_t)(val->m_uint >> 16) & 0xff,
+				(uint32_t)(val->m_uint >> 8) & 0xff,
+				(uint32_t)val->m_uint & 0xff);
+			res->append(buf);
+			break;
+		default:
+			res->append(val->m_buf, val->m_len);
+			break;
+		}
+	}
+}
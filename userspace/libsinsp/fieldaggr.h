@@ -0,0 +1,177 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+class sinsp_filter_check;
+class sinsp_topk;
+
+///////////////////////////////////////////////////////////////////////////////
+// Group by of the events on the values of some key fields, with the sum,
+// the count, the minimum or the maximum of a numeric value field for each
+// group. This is what the table chisels compute for every event, done
+// without going through Lua: the values of the key fields are packed into
+// one string, which is looked up in a hash table.
+///////////////////////////////////////////////////////////////////////////////
+class SINSP_PUBLIC sinsp_field_aggregator
+{
+public:
+	enum op
+	{
+		AO_SUM,
+		AO_COUNT,
+		AO_MIN,
+		AO_MAX,
+	};
+
+	//
+	// If positive_only is true, the events with a value that's not greater
+	// than zero are left out
+	//
+	sinsp_field_aggregator(sinsp* inspector, op aggr_op, bool positive_only);
+	~sinsp_field_aggregator();
+
+	//
+	// Return false if name is not one of sum, count, min and max
+	//
+	static bool parse_op(const string& name, OUT op* res);
+
+	//
+	// Add a field to the key. The events that don't have all the key
+	// fields are left out. Throws a sinsp_exception if the field doesn't
+	// exist.
+	//
+	void add_key(const string& fldname);
+
+	//
+	// Set the value field, which must be numeric. It's optional for
+	// AO_COUNT, where it only selects the events that have it.
+	//
+	void set_value(const string& fldname);
+
+	//
+	// Keep at most n groups, with the Space-Saving algorithm of sinsp_topk:
+	// a new group replaces the one with the smallest value, and starts
+	// from it. The largest groups are kept, and their values are never
+	// lower than the real ones. Only for AO_SUM and AO_COUNT, and must be
+	// called before the first event.
+	//
+	void set_max_groups(uint32_t n);
+
+	//
+	// Multiply the values of AO_SUM and AO_COUNT by the sampling ratio of
+	// the events, to estimate the totals when the driver drops some of
+	// them. Off by default.
+	//
+	void set_scale_by_sampling(bool enable)
+	{
+		m_scale_by_sampling = enable;
+	}
+
+	typedef unordered_map<string, double> group_table;
+
+	//
+	// Add the event to its group
+	//
+	void process(sinsp_evt* evt)
+	{
+		process(evt, &m_table);
+	}
+
+	//
+	// Add the event to its group in table instead of the aggregator's own
+	// groups, e.g. when another thread reads them. table can then be
+	// merged with merge_groups().
+	//
+	void process(sinsp_evt* evt, group_table* table);
+
+	//
+	// Compute the key of the event and its value, without adding it to a
+	// group. Return false if the event is left out. The key is valid until
+	// the next event, see get_extracted_key().
+	//
+	bool extract(sinsp_evt* evt, OUT double* value);
+
+	const string& get_extracted_key()
+	{
+		return m_keybuf;
+	}
+
+	//
+	// Add the groups of another aggregator with the same fields and op,
+	// e.g. one that processed another part of the capture
+	//
+	void merge(sinsp_field_aggregator* other);
+	void merge_groups(const group_table& groups);
+
+	//
+	// Append the groups to res as a partial, for example at the end of an
+	// interval on a host of a fleet, which can be merged with
+	// merge_partial() by an aggregator with the same op and number of keys
+	// on another host. When the number of groups is bounded, the partial
+	// has the top-k summary, and merging it keeps its guarantees.
+	// merge_partial() returns false if the partial is not valid, or was
+	// written by a different aggregation.
+	//
+	void serialize(OUT string* res);
+	bool merge_partial(const char* buf, uint32_t len);
+
+	void clear();
+	uint32_t size();
+
+	uint32_t get_nkeys()
+	{
+		return (uint32_t)m_keys.size();
+	}
+
+	typedef pair<const string, double> entry;
+
+	//
+	// Return the n groups with the largest values, in decreasing order of
+	// value, or all of them if n is 0. The pointers are valid until the
+	// next call to process(), merge(), clear() or get_top().
+	//
+	void get_top(uint32_t n, OUT vector<const entry*>* res);
+
+	//
+	// Unpack the values of the key fields of a group. The buffers point
+	// into key.
+	//
+	void get_key_values(const string& key, OUT vector<sinsp_field_value>* vals);
+
+	//
+	// Render the key of a group like chisel.get_aggregation() does, with
+	// the values of the fields separated by spaces
+	//
+	void key_to_string(const string& key, OUT string* res);
+
+private:
+	sinsp_filter_check* new_check(const string& fldname);
+	void add(group_table* table, const string& key, double value);
+
+	sinsp* m_inspector;
+	op m_op;
+	bool m_positive_only;
+	bool m_scale_by_sampling;
+	vector<sinsp_filter_check*> m_keys;
+	sinsp_filter_check* m_value;
+	group_table m_table;
+	sinsp_topk* m_topk; // Replaces m_table if the number of groups is bounded
+	vector<entry> m_top_entries; // The groups returned by get_top() from m_topk
+	string m_keybuf; // Key of the event being processed, reused to avoid allocations
+};
@@ -26,6 +26,8 @@ along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
 // code at every new release, and I will have a cleaner and easier to understand code base.
 //
 
+#include <algorithm>
+
 #include "sinsp.h"
 #include "sinsp_int.h"
 
@@ -34,6 +36,7 @@ along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
 #include "filterchecks.h"
 
 extern sinsp_filter_check_list g_filterlist;
+extern sinsp_evttables g_infotables;
 
 ///////////////////////////////////////////////////////////////////////////////
 // sinsp_filter_check_list implementation
@@ -48,6 +51,7 @@ sinsp_filter_check_list::sinsp_filter_check_list()
 	add_filter_check(new sinsp_filter_check_event());
 	add_filter_check(new sinsp_filter_check_user());
 	add_filter_check(new sinsp_filter_check_group());
+	add_filter_check(new sinsp_filter_check_container());
 }
 
 sinsp_filter_check_list::~sinsp_filter_check_list()
@@ -62,7 +66,17 @@ sinsp_filter_check_list::~sinsp_filter_check_list()
 
 void sinsp_filter_check_list::add_filter_check(sinsp_filter_check* filter_check)
 {
+	int32_t j;
+
 	m_check_list.push_back(filter_check);
+
+	//
+	// Like the scan of the list, the first check that has a field wins
+	//
+	for(j = 0; j < filter_check->m_info.m_nfiedls; j++)
+	{
+		m_check_by_field.insert(make_pair(string(filter_check->m_info.m_fields[j].m_name), filter_check));
+	}
 }
 
 void sinsp_filter_check_list::get_all_fields(OUT vector<const filter_check_info*>* list)
@@ -75,32 +89,81 @@ void sinsp_filter_check_list::get_all_fields(OUT vector<const filter_check_info*
 	}
 }
 
-sinsp_filter_check* sinsp_filter_check_list::new_filter_check_from_fldname(string name, 
+//
+// Return a new check of the same class as template_chk if it can parse the
+// name, NULL if it can't. The list is shared by all the inspectors of the
+// process, which can compile their filters from different threads, so the
+// name is parsed by the new check instead of the one in the list.
+//
+sinsp_filter_check* sinsp_filter_check_list::new_filter_check(sinsp_filter_check* template_chk, 
+	const string& name, 
+	sinsp* inspector,
+	OUT int32_t* fldnamelen)
+{
+	sinsp_filter_check* newchk = template_chk->allocate_new();
+
+	newchk->set_inspector(inspector);
+
+	try
+	{
+		*fldnamelen = newchk->parse_field_name(name.c_str());
+	}
+	catch(...)
+	{
+		delete newchk;
+		throw;
+	}
+
+	if(*fldnamelen == -1)
+	{
+		delete newchk;
+		return NULL;
+	}
+
+	return newchk;
+}
+
+sinsp_filter_check* sinsp_filter_check_list::new_filter_check_from_fldname(const string& name, 
 																		   sinsp* inspector,
 																		   bool do_exact_check)
 {
+	sinsp_filter_check* newchk = NULL;
+	int32_t fldnamelen = -1;
+	uint32_t len = 0;
 	uint32_t j;
 
-	for(j = 0; j < m_check_list.size(); j++)
+	//
+	// The names without an argument, like proc.name or fd.name[2], are
+	// looked up in the table. The name can be followed by the rest of a
+	// format string, which can't contain the characters of a field name.
+	// The others, like evt.arg.fd, are tried on every class.
+	//
+	while(len < name.size() && (isalnum((int)name[len]) || name[len] == '.' || name[len] == '_'))
 	{
-		m_check_list[j]->m_inspector = inspector;
+		len++;
+	}
 
-		int32_t fldnamelen = m_check_list[j]->parse_field_name(name.c_str());
+	unordered_map<string, sinsp_filter_check*>::iterator it = m_check_by_field.find(name.substr(0, len));
 
-		if(fldnamelen != -1)
-		{
-			if(do_exact_check)
-			{
-				if((int32_t)name.size() != fldnamelen)
-				{
-					goto field_not_found;
-				}
-			}
+	if(it != m_check_by_field.end())
+	{
+		newchk = new_filter_check(it->second, name, inspector, &fldnamelen);
+	}
+
+	for(j = 0; newchk == NULL && j < m_check_list.size(); j++)
+	{
+		newchk = new_filter_check(m_check_list[j], name, inspector, &fldnamelen);
+	}
 
-			sinsp_filter_check* newchk = m_check_list[j]->allocate_new();
-			newchk->set_inspector(inspector);
-			return newchk;
+	if(newchk != NULL)
+	{
+		if(do_exact_check && (int32_t)name.size() != fldnamelen)
+		{
+			delete newchk;
+			goto field_not_found;
 		}
+
+		return newchk;
 	}
 
 field_not_found:
@@ -171,6 +234,8 @@ bool flt_compare_string(ppm_cmp_operator op, char* operand1, char* operand2)
 		return (strcmp(operand1, operand2) != 0);
 	case CO_CONTAINS:
 		return (strstr(operand1, operand2) != NULL);
+	case CO_STARTSWITH:
+		return (strncmp(operand1, operand2, strlen(operand2)) == 0);
 	case CO_LT:
 		throw sinsp_exception("'<' not supported for string filters");
 	case CO_LE:
@@ -196,6 +261,8 @@ bool flt_compare_buffer(ppm_cmp_operator op, char* operand1, char* operand2, uin
 		return op1_len != op2_len || (memcmp(operand1, operand2, op1_len) != 0);
 	case CO_CONTAINS:
 		return (memmem(operand1, op1_len, operand2, op2_len) != NULL);
+	case CO_STARTSWITH:
+		return op1_len >= op2_len && (memcmp(operand1, operand2, op2_len) == 0);
 	case CO_LT:
 		throw sinsp_exception("'<' not supported for buffer filters");
 	case CO_LE:
@@ -258,188 +325,748 @@ bool flt_compare(ppm_cmp_operator op, ppm_param_type type, void* operand1, void*
 	}
 }
 
+//
+// Read a number the way flt_compare() reads it. Returns false for the types
+// that are not numbers.
+//
+static bool flt_load_number(ppm_param_type type, const void* val, OUT uint64_t* res, OUT bool* is_signed)
+{
+	switch(type)
+	{
+	case PT_INT8:
+		*res = (uint64_t)(int64_t)*(int8_t*)val;
+		*is_signed = true;
+		return true;
+	case PT_INT16:
+		*res = (uint64_t)(int64_t)*(int16_t*)val;
+		*is_signed = true;
+		return true;
+	case PT_INT32:
+		*res = (uint64_t)(int64_t)*(int32_t*)val;
+		*is_signed = true;
+		return true;
+	case PT_INT64:
+	case PT_FD:
+	case PT_PID:
+	case PT_ERRNO:
+		*res = *(uint64_t*)val;
+		*is_signed = true;
+		return true;
+	case PT_FLAGS8:
+	case PT_UINT8:
+	case PT_SIGTYPE:
+		*res = (uint64_t)*(int8_t*)val;
+		*is_signed = false;
+		return true;
+	case PT_FLAGS16:
+	case PT_UINT16:
+	case PT_PORT:
+	case PT_SYSCALLID:
+		*res = (uint64_t)*(int16_t*)val;
+		*is_signed = false;
+		return true;
+	case PT_UINT32:
+	case PT_FLAGS32:
+	case PT_BOOL:
+	case PT_IPV4ADDR:
+		*res = (uint64_t)*(int32_t*)val;
+		*is_signed = false;
+		return true;
+	case PT_UINT64:
+	case PT_RELTIME:
+	case PT_ABSTIME:
+		*res = *(uint64_t*)val;
+		*is_signed = false;
+		return true;
+	default:
+		return false;
+	}
+}
+
+//
+// Compare a column of values of a batch with a constant. The loops have no
+// branches, so the compiler can turn them into vector instructions.
+//
+template<class T> static void flt_batch_compare(ppm_cmp_operator op, const T* vals, T cst, uint32_t nvals, OUT uint8_t* res)
+{
+	uint32_t j;
+
+	switch(op)
+	{
+	case CO_EQ:
+		for(j = 0; j < nvals; j++)
+		{
+			res[j] = (vals[j] == cst);
+		}
+		break;
+	case CO_NE:
+		for(j = 0; j < nvals; j++)
+		{
+			res[j] = (vals[j] != cst);
+		}
+		break;
+	case CO_LT:
+		for(j = 0; j < nvals; j++)
+		{
+			res[j] = (vals[j] < cst);
+		}
+		break;
+	case CO_LE:
+		for(j = 0; j < nvals; j++)
+		{
+			res[j] = (vals[j] <= cst);
+		}
+		break;
+	case CO_GT:
+		for(j = 0; j < nvals; j++)
+		{
+			res[j] = (vals[j] > cst);
+		}
+		break;
+	case CO_GE:
+		for(j = 0; j < nvals; j++)
+		{
+			res[j] = (vals[j] >= cst);
+		}
+		break;
+	default:
+		ASSERT(false);
+		memset(res, 1, nvals);
+		break;
+	}
+}
+
 ///////////////////////////////////////////////////////////////////////////////
-// sinsp_filter_check implementation
+// sinsp_filter_value_set implementation
 ///////////////////////////////////////////////////////////////////////////////
-sinsp_filter_check::sinsp_filter_check() :
-	m_val_storage(256)
+//
+// FNV-1a
+//
+static uint64_t flt_hash(const uint8_t* val, uint32_t len)
 {
-	m_boolop = BO_NONE;
-	m_cmpop = CO_NONE;
-	m_inspector = NULL;
-	m_field = NULL;
-	m_info.m_fields = NULL;
-	m_info.m_nfiedls = -1;
-	m_val_storage_len = 0;
+	uint64_t res = 0xcbf29ce484222325ULL;
+	uint32_t j;
+
+	for(j = 0; j < len; j++)
+	{
+		res ^= val[j];
+		res *= 0x100000001b3ULL;
+	}
+
+	return res;
 }
 
-void sinsp_filter_check::set_inspector(sinsp* inspector)
+sinsp_filter_value_set::sinsp_filter_value_set()
 {
-	m_inspector = inspector;
+	m_kind = SK_SORTED;
+	m_width = sizeof(uint64_t);
+	m_is_string = false;
 }
 
-char* sinsp_filter_check::rawval_to_string(uint8_t* rawval, const filtercheck_field_info* finfo, uint32_t len)
+void sinsp_filter_value_set::init(ppm_param_type type)
+{
+	switch(type)
+	{
+	case PT_INT8:
+	case PT_UINT8:
+	case PT_FLAGS8:
+	case PT_SIGTYPE:
+	case PT_L4PROTO:
+		m_kind = SK_BITMAP;
+		m_width = sizeof(uint8_t);
+		m_bitmap.assign(((uint32_t)1 << 8) / 8, 0);
+		break;
+	case PT_INT16:
+	case PT_UINT16:
+	case PT_FLAGS16:
+	case PT_PORT:
+	case PT_SYSCALLID:
+		m_kind = SK_BITMAP;
+		m_width = sizeof(uint16_t);
+		m_bitmap.assign(((uint32_t)1 << 16) / 8, 0);
+		break;
+	case PT_INT32:
+	case PT_UINT32:
+	case PT_FLAGS32:
+	case PT_BOOL:
+	case PT_IPV4ADDR:
+		m_kind = SK_SORTED;
+		m_width = sizeof(uint32_t);
+		break;
+	case PT_INT64:
+	case PT_UINT64:
+	case PT_FD:
+	case PT_PID:
+	case PT_ERRNO:
+	case PT_RELTIME:
+	case PT_ABSTIME:
+		m_kind = SK_SORTED;
+		m_width = sizeof(uint64_t);
+		break;
+	case PT_CHARBUF:
+	case PT_SOCKADDR:
+	case PT_SOCKFAMILY:
+		m_kind = SK_HASH;
+		m_is_string = true;
+		resize_hash(16);
+		break;
+	case PT_BYTEBUF:
+		m_kind = SK_HASH;
+		m_is_string = false;
+		resize_hash(16);
+		break;
+	default:
+		throw sinsp_exception("filter error: 'in' not supported for this field");
+	}
+}
+
+//
+// Only equality matters, so the signed values don't need sign extension
+//
+uint64_t sinsp_filter_value_set::get_int(const uint8_t* val)
 {
-	char* prfmt;
+	switch(m_width)
+	{
+	case sizeof(uint8_t):
+		return *(uint8_t*)val;
+	case sizeof(uint16_t):
+		return *(uint16_t*)val;
+	case sizeof(uint32_t):
+		return *(uint32_t*)val;
+	default:
+		return *(uint64_t*)val;
+	}
+}
 
-	ASSERT(rawval != NULL);
-	ASSERT(finfo != NULL);
+uint32_t sinsp_filter_value_set::get_len(const uint8_t* val, uint32_t len)
+{
+	return m_is_string? strlen((char*)val) : len;
+}
 
-	switch(finfo->m_type)
+void sinsp_filter_value_set::resize_hash(uint32_t nslots)
+{
+	uint32_t j;
+	uint32_t k;
+
+	ASSERT((nslots & (nslots - 1)) == 0);
+	m_slots.assign(nslots, -1);
+
+	for(j = 0; j < m_strings.size(); j++)
 	{
-		case PT_INT8:
-			if(finfo->m_print_format == PF_DEC)
-			{
-				prfmt = (char*)"%" PRId8;
-			}
-			else if(finfo->m_print_format == PF_HEX)
-			{
-				prfmt = (char*)"%" PRIX8;
-			}
-			else
-			{
-				ASSERT(false);
-				return NULL;
-			}
+		for(k = m_hashes[j] & (nslots - 1); m_slots[k] != -1; k = (k + 1) & (nslots - 1))
+		{
+		}
 
-			snprintf(m_getpropertystr_storage,
-					 sizeof(m_getpropertystr_storage),
-					 prfmt, *(int8_t *)rawval);
-			return m_getpropertystr_storage;
-		case PT_INT16:
-			if(finfo->m_print_format == PF_DEC)
-			{
-				prfmt = (char*)"%" PRId16;
-			}
-			else if(finfo->m_print_format == PF_HEX)
-			{
-				prfmt = (char*)"%" PRIX16;
-			}
-			else
-			{
-				ASSERT(false);
-				return NULL;
-			}
+		m_slots[k] = j;
+	}
+}
 
-			snprintf(m_getpropertystr_storage,
-					 sizeof(m_getpropertystr_storage),
-					 prfmt, *(int16_t *)rawval);
-			return m_getpropertystr_storage;
-		case PT_INT32:
-			if(finfo->m_print_format == PF_DEC)
-			{
-				prfmt = (char*)"%" PRId32;
-			}
-			else if(finfo->m_print_format == PF_HEX)
-			{
-				prfmt = (char*)"%" PRIX32;
-			}
-			else
+void sinsp_filter_value_set::add(const uint8_t* val, uint32_t len)
+{
+	uint64_t v;
+
+	switch(m_kind)
+	{
+	case SK_BITMAP:
+		v = get_int(val);
+		m_bitmap[v / 8] |= (1 << (v % 8));
+		break;
+	case SK_SORTED:
+		{
+			v = get_int(val);
+			vector<uint64_t>::iterator it = lower_bound(m_ints.begin(), m_ints.end(), v);
+
+			if(it == m_ints.end() || *it != v)
 			{
-				ASSERT(false);
-				return NULL;
+				m_ints.insert(it, v);
 			}
+		}
+		break;
+	case SK_HASH:
+		if(!contains(val, len))
+		{
+			len = get_len(val, len);
+			m_strings.push_back(string((char*)val, len));
+			m_hashes.push_back(flt_hash(val, len));
 
-			snprintf(m_getpropertystr_storage,
-					 sizeof(m_getpropertystr_storage),
-					 prfmt, *(int32_t *)rawval);
-			return m_getpropertystr_storage;
-		case PT_INT64:
-		case PT_PID:
-			if(finfo->m_print_format == PF_DEC)
+			//
+			// Keep the table at most half full, so the runs stay short
+			//
+			resize_hash((m_strings.size() * 2 > m_slots.size())? m_slots.size() * 2 : m_slots.size());
+		}
+		break;
+	default:
+		ASSERT(false);
+		break;
+	}
+}
+
+void sinsp_filter_value_set::get_ints(OUT vector<uint64_t>* values)
+{
+	uint32_t j;
+
+	values->clear();
+
+	switch(m_kind)
+	{
+	case SK_BITMAP:
+		for(j = 0; j < m_bitmap.size() * 8; j++)
+		{
+			if(m_bitmap[j / 8] & (1 << (j % 8)))
 			{
-				prfmt = (char*)"%" PRId64;
+				values->push_back(j);
 			}
-			else if(finfo->m_print_format == PF_10_PADDED_DEC)
+		}
+		break;
+	case SK_SORTED:
+		*values = m_ints;
+		break;
+	default:
+		break;
+	}
+}
+
+bool sinsp_filter_value_set::contains(const uint8_t* val, uint32_t len)
+{
+	uint64_t v;
+	uint64_t h;
+	uint32_t j;
+	uint32_t mask;
+
+	switch(m_kind)
+	{
+	case SK_BITMAP:
+		v = get_int(val);
+		return (m_bitmap[v / 8] & (1 << (v % 8))) != 0;
+	case SK_SORTED:
+		return binary_search(m_ints.begin(), m_ints.end(), get_int(val));
+	case SK_HASH:
+		len = get_len(val, len);
+		h = flt_hash(val, len);
+		mask = m_slots.size() - 1;
+
+		for(j = h & mask; m_slots[j] != -1; j = (j + 1) & mask)
+		{
+			int32_t idx = m_slots[j];
+
+			if(m_hashes[idx] == h &&
+				m_strings[idx].size() == len &&
+				memcmp(m_strings[idx].c_str(), val, len) == 0)
 			{
-				prfmt = (char*)"%09" PRId64;
+				return true;
 			}
-			else if(finfo->m_print_format == PF_HEX)
-			{
-				prfmt = (char*)"%" PRIX64;
-			}
-			else
+		}
+
+		return false;
+	default:
+		ASSERT(false);
+		return false;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// comparison functions specialized by type and operator, picked by the
+// checks when they parse their value to avoid the two switches of
+// flt_compare()
+///////////////////////////////////////////////////////////////////////////////
+template<typename T> static bool flt_compare_eq(ppm_cmp_operator op, ppm_param_type type, void* operand1, void* operand2, uint32_t op1_len, uint32_t op2_len)
+{
+	return *(T*)operand1 == *(T*)operand2;
+}
+
+template<typename T> static bool flt_compare_ne(ppm_cmp_operator op, ppm_param_type type, void* operand1, void* operand2, uint32_t op1_len, uint32_t op2_len)
+{
+	return *(T*)operand1 != *(T*)operand2;
+}
+
+template<typename T> static bool flt_compare_lt(ppm_cmp_operator op, ppm_param_type type, void* operand1, void* operand2, uint32_t op1_len, uint32_t op2_len)
+{
+	return *(T*)operand1 < *(T*)operand2;
+}
+
+template<typename T> static bool flt_compare_le(ppm_cmp_operator op, ppm_param_type type, void* operand1, void* operand2, uint32_t op1_len, uint32_t op2_len)
+{
+	return *(T*)operand1 <= *(T*)operand2;
+}
+
+template<typename T> static bool flt_compare_gt(ppm_cmp_operator op, ppm_param_type type, void* operand1, void* operand2, uint32_t op1_len, uint32_t op2_len)
+{
+	return *(T*)operand1 > *(T*)operand2;
+}
+
+template<typename T> static bool flt_compare_ge(ppm_cmp_operator op, ppm_param_type type, void* operand1, void* operand2, uint32_t op1_len, uint32_t op2_len)
+{
+	return *(T*)operand1 >= *(T*)operand2;
+}
+
+static bool flt_compare_string_eq(ppm_cmp_operator op, ppm_param_type type, void* operand1, void* operand2, uint32_t op1_len, uint32_t op2_len)
+{
+	return strcmp((char*)operand1, (char*)operand2) == 0;
+}
+
+static bool flt_compare_string_ne(ppm_cmp_operator op, ppm_param_type type, void* operand1, void* operand2, uint32_t op1_len, uint32_t op2_len)
+{
+	return strcmp((char*)operand1, (char*)operand2) != 0;
+}
+
+static bool flt_compare_string_contains(ppm_cmp_operator op, ppm_param_type type, void* operand1, void* operand2, uint32_t op1_len, uint32_t op2_len)
+{
+	return strstr((char*)operand1, (char*)operand2) != NULL;
+}
+
+static bool flt_compare_string_startswith(ppm_cmp_operator op, ppm_param_type type, void* operand1, void* operand2, uint32_t op1_len, uint32_t op2_len)
+{
+	return strncmp((char*)operand1, (char*)operand2, op2_len) == 0;
+}
+
+static bool flt_compare_buffer_eq(ppm_cmp_operator op, ppm_param_type type, void* operand1, void* operand2, uint32_t op1_len, uint32_t op2_len)
+{
+	return op1_len == op2_len && memcmp(operand1, operand2, op1_len) == 0;
+}
+
+static bool flt_compare_buffer_ne(ppm_cmp_operator op, ppm_param_type type, void* operand1, void* operand2, uint32_t op1_len, uint32_t op2_len)
+{
+	return op1_len != op2_len || memcmp(operand1, operand2, op1_len) != 0;
+}
+
+static bool flt_compare_in(ppm_cmp_operator op, ppm_param_type type, void* operand1, void* operand2, uint32_t op1_len, uint32_t op2_len)
+{
+	return ((sinsp_filter_value_set*)operand2)->contains((uint8_t*)operand1, op1_len);
+}
+
+static bool flt_compare_matches(ppm_cmp_operator op, ppm_param_type type, void* operand1, void* operand2, uint32_t op1_len, uint32_t op2_len)
+{
+	if(type == PT_CHARBUF)
+	{
+		op1_len = (uint32_t)strlen((char*)operand1);
+	}
+
+	return ((sinsp_regex*)operand2)->match((char*)operand1, op1_len);
+}
+
+static bool flt_compare_buffer_contains(ppm_cmp_operator op, ppm_param_type type, void* operand1, void* operand2, uint32_t op1_len, uint32_t op2_len)
+{
+	return memmem(operand1, op1_len, operand2, op2_len) != NULL;
+}
+
+static bool flt_compare_buffer_startswith(ppm_cmp_operator op, ppm_param_type type, void* operand1, void* operand2, uint32_t op1_len, uint32_t op2_len)
+{
+	return op1_len >= op2_len && memcmp(operand1, operand2, op2_len) == 0;
+}
+
+//
+// The unsupported operators go through flt_compare(), which throws the
+// usual exception when the filter runs
+//
+template<typename T> static sinsp_filter_cmp_fn flt_get_numeric_compare_fn(ppm_cmp_operator op)
+{
+	switch(op)
+	{
+	case CO_EQ:
+		return flt_compare_eq<T>;
+	case CO_NE:
+		return flt_compare_ne<T>;
+	case CO_LT:
+		return flt_compare_lt<T>;
+	case CO_LE:
+		return flt_compare_le<T>;
+	case CO_GT:
+		return flt_compare_gt<T>;
+	case CO_GE:
+		return flt_compare_ge<T>;
+	default:
+		return flt_compare;
+	}
+}
+
+//
+// Note: flt_compare() sign extends the unsigned values before comparing
+// them as uint64_t, which keeps their order, so comparing them with their
+// own type gives the same results.
+//
+static sinsp_filter_cmp_fn flt_get_compare_fn(ppm_cmp_operator op, ppm_param_type type)
+{
+	//
+	// For 'in', the constant is the set of the values, for 'matches' the
+	// compiled expression
+	//
+	if(op == CO_IN)
+	{
+		return flt_compare_in;
+	}
+	else if(op == CO_MATCHES)
+	{
+		return flt_compare_matches;
+	}
+
+	switch(type)
+	{
+	case PT_INT8:
+		return flt_get_numeric_compare_fn<int8_t>(op);
+	case PT_INT16:
+		return flt_get_numeric_compare_fn<int16_t>(op);
+	case PT_INT32:
+		return flt_get_numeric_compare_fn<int32_t>(op);
+	case PT_INT64:
+	case PT_FD:
+	case PT_PID:
+	case PT_ERRNO:
+		return flt_get_numeric_compare_fn<int64_t>(op);
+	case PT_FLAGS8:
+	case PT_UINT8:
+	case PT_SIGTYPE:
+		return flt_get_numeric_compare_fn<uint8_t>(op);
+	case PT_FLAGS16:
+	case PT_UINT16:
+	case PT_PORT:
+	case PT_SYSCALLID:
+		return flt_get_numeric_compare_fn<uint16_t>(op);
+	case PT_UINT32:
+	case PT_FLAGS32:
+	case PT_BOOL:
+	case PT_IPV4ADDR:
+		return flt_get_numeric_compare_fn<uint32_t>(op);
+	case PT_UINT64:
+	case PT_RELTIME:
+	case PT_ABSTIME:
+		return flt_get_numeric_compare_fn<uint64_t>(op);
+	case PT_CHARBUF:
+		switch(op)
+		{
+		case CO_EQ:
+			return flt_compare_string_eq;
+		case CO_NE:
+			return flt_compare_string_ne;
+		case CO_CONTAINS:
+			return flt_compare_string_contains;
+		case CO_STARTSWITH:
+			return flt_compare_string_startswith;
+		default:
+			return flt_compare;
+		}
+	case PT_BYTEBUF:
+		switch(op)
+		{
+		case CO_EQ:
+			return flt_compare_buffer_eq;
+		case CO_NE:
+			return flt_compare_buffer_ne;
+		case CO_CONTAINS:
+			return flt_compare_buffer_contains;
+		case CO_STARTSWITH:
+			return flt_compare_buffer_startswith;
+		default:
+			return flt_compare;
+		}
+	default:
+		return flt_compare;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// sinsp_filter_check implementation
+///////////////////////////////////////////////////////////////////////////////
+sinsp_filter_check::sinsp_filter_check() :
+	m_val_storage(256)
+{
+	m_boolop = BO_NONE;
+	m_cmpop = CO_NONE;
+	m_cmp = flt_compare;
+	m_inspector = NULL;
+	m_field = NULL;
+	m_info.m_fields = NULL;
+	m_info.m_nfiedls = -1;
+	m_val_storage_len = 0;
+	m_cache_slot = SINSP_NO_CACHE_SLOT;
+}
+
+void sinsp_filter_check::set_inspector(sinsp* inspector)
+{
+	m_inspector = inspector;
+}
+
+//
+// Number formatting for rawval_to_string(). These write the same text as the
+// printf formats they replace, without parsing a format for every value.
+// They return the position after the last character written, and don't
+// terminate the string.
+//
+static char* flt_format_dec(char* buf, uint64_t val, uint32_t minwidth)
+{
+	char tmp[24];
+	uint32_t ndigits = 0;
+
+	do
+	{
+		tmp[ndigits++] = '0' + (char)(val % 10);
+		val /= 10;
+	}
+	while(val != 0);
+
+	while(minwidth > ndigits)
+	{
+		*buf++ = '0';
+		minwidth--;
+	}
+
+	while(ndigits != 0)
+	{
+		*buf++ = tmp[--ndigits];
+	}
+
+	return buf;
+}
+
+//
+// Like "%0<minwidth>d": the sign counts in the width
+//
+static char* flt_format_signed_dec(char* buf, int64_t val, uint32_t minwidth)
+{
+	if(val < 0)
+	{
+		*buf++ = '-';
+		return flt_format_dec(buf, -(uint64_t)val, (minwidth != 0)? minwidth - 1 : 0);
+	}
+
+	return flt_format_dec(buf, (uint64_t)val, minwidth);
+}
+
+static char* flt_format_hex(char* buf, uint64_t val)
+{
+	static const char digits[] = "0123456789ABCDEF";
+	char tmp[16];
+	uint32_t ndigits = 0;
+
+	do
+	{
+		tmp[ndigits++] = digits[val & 0xf];
+		val >>= 4;
+	}
+	while(val != 0);
+
+	while(ndigits != 0)
+	{
+		*buf++ = tmp[--ndigits];
+	}
+
+	return buf;
+}
+
+char* sinsp_filter_check::rawval_to_string(uint8_t* rawval, const filtercheck_field_info* finfo, uint32_t len)
+{
+	char* end;
+	uint32_t j;
+
+	ASSERT(rawval != NULL);
+	ASSERT(finfo != NULL);
+
+	switch(finfo->m_type)
+	{
+		case PT_INT8:
+		case PT_INT16:
+		case PT_INT32:
 			{
-				prfmt = (char*)"%" PRId64;
+				int32_t val;
+
+				if(finfo->m_type == PT_INT8)
+				{
+					val = *(int8_t *)rawval;
+				}
+				else if(finfo->m_type == PT_INT16)
+				{
+					val = *(int16_t *)rawval;
+				}
+				else
+				{
+					val = *(int32_t *)rawval;
+				}
+
+				if(finfo->m_print_format == PF_DEC)
+				{
+					end = flt_format_signed_dec(m_getpropertystr_storage, val, 0);
+				}
+				else if(finfo->m_print_format == PF_HEX)
+				{
+					//
+					// Like printf, which gets the value promoted to int
+					//
+					end = flt_format_hex(m_getpropertystr_storage, (uint32_t)val);
+				}
+				else
+				{
+					ASSERT(false);
+					return NULL;
+				}
 			}
 
-			snprintf(m_getpropertystr_storage,
-					 sizeof(m_getpropertystr_storage),
-					 prfmt, *(int64_t *)rawval);
+			*end = 0;
 			return m_getpropertystr_storage;
-		case PT_L4PROTO: // This can be resolved in the future
-		case PT_UINT8:
-			if(finfo->m_print_format == PF_DEC)
+		case PT_INT64:
+		case PT_PID:
+			if(finfo->m_print_format == PF_10_PADDED_DEC)
 			{
-				prfmt = (char*)"%" PRIu8;
+				end = flt_format_signed_dec(m_getpropertystr_storage, *(int64_t *)rawval, 9);
 			}
 			else if(finfo->m_print_format == PF_HEX)
 			{
-				prfmt = (char*)"%" PRIu8;
+				end = flt_format_hex(m_getpropertystr_storage, *(uint64_t *)rawval);
 			}
 			else
 			{
-				ASSERT(false);
-				return NULL;
+				end = flt_format_signed_dec(m_getpropertystr_storage, *(int64_t *)rawval, 0);
 			}
 
-			snprintf(m_getpropertystr_storage,
-					 sizeof(m_getpropertystr_storage),
-					 prfmt, *(uint8_t *)rawval);
+			*end = 0;
 			return m_getpropertystr_storage;
+		case PT_L4PROTO: // This can be resolved in the future
+		case PT_UINT8:
 		case PT_PORT: // This can be resolved in the future
 		case PT_UINT16:
-			if(finfo->m_print_format == PF_DEC)
-			{
-				prfmt = (char*)"%" PRIu16;
-			}
-			else if(finfo->m_print_format == PF_HEX)
-			{
-				prfmt = (char*)"%" PRIu16;
-			}
-			else
-			{
-				ASSERT(false);
-				return NULL;
-			}
-
-			snprintf(m_getpropertystr_storage,
-					 sizeof(m_getpropertystr_storage),
-					 prfmt, *(uint16_t *)rawval);
-			return m_getpropertystr_storage;
 		case PT_UINT32:
-			if(finfo->m_print_format == PF_DEC)
-			{
-				prfmt = (char*)"%" PRIu32;
-			}
-			else if(finfo->m_print_format == PF_HEX)
-			{
-				prfmt = (char*)"%" PRIu32;
-			}
-			else
 			{
-				ASSERT(false);
-				return NULL;
+				uint32_t val;
+
+				if(finfo->m_type == PT_L4PROTO || finfo->m_type == PT_UINT8)
+				{
+					val = *(uint8_t *)rawval;
+				}
+				else if(finfo->m_type == PT_PORT || finfo->m_type == PT_UINT16)
+				{
+					val = *(uint16_t *)rawval;
+				}
+				else
+				{
+					val = *(uint32_t *)rawval;
+				}
+
+				//
+				// The hex format of these types is printed in decimal too
+				//
+				if(finfo->m_print_format != PF_DEC && finfo->m_print_format != PF_HEX)
+				{
+					ASSERT(false);
+					return NULL;
+				}
+
+				end = flt_format_dec(m_getpropertystr_storage, val, 0);
 			}
 
-			snprintf(m_getpropertystr_storage,
-					 sizeof(m_getpropertystr_storage),
-					 prfmt, *(uint32_t *)rawval);
+			*end = 0;
 			return m_getpropertystr_storage;
 		case PT_UINT64:
 		case PT_RELTIME:
 		case PT_ABSTIME:
 			if(finfo->m_print_format == PF_DEC)
 			{
-				prfmt = (char*)"%" PRIu64;
+				end = flt_format_dec(m_getpropertystr_storage, *(uint64_t *)rawval, 0);
 			}
 			else if(finfo->m_print_format == PF_10_PADDED_DEC)
 			{
-				prfmt = (char*)"%09" PRIu64;
+				end = flt_format_dec(m_getpropertystr_storage, *(uint64_t *)rawval, 9);
 			}
 			else if(finfo->m_print_format == PF_HEX)
 			{
-				prfmt = (char*)"%" PRIX64;
+				end = flt_format_hex(m_getpropertystr_storage, *(uint64_t *)rawval);
 			}
 			else
 			{
@@ -447,9 +1074,7 @@ char* sinsp_filter_check::rawval_to_string(uint8_t* rawval, const filtercheck_fi
 				return NULL;
 			}
 
-			snprintf(m_getpropertystr_storage,
-					 sizeof(m_getpropertystr_storage),
-					 prfmt, *(uint64_t *)rawval);
+			*end = 0;
 			return m_getpropertystr_storage;
 		case PT_CHARBUF:
 			return (char*)rawval;
@@ -487,13 +1112,19 @@ char* sinsp_filter_check::rawval_to_string(uint8_t* rawval, const filtercheck_fi
 				return (char*)"false";
 			}
 		case PT_IPV4ADDR:
-			snprintf(m_getpropertystr_storage,
-				        sizeof(m_getpropertystr_storage),
-				        "%" PRIu8 ".%" PRIu8 ".%" PRIu8 ".%" PRIu8,
-				        rawval[0],
-				        rawval[1],
-				        rawval[2],
-				        rawval[3]);
+			end = m_getpropertystr_storage;
+
+			for(j = 0; j < 4; j++)
+			{
+				if(j != 0)
+				{
+					*end++ = '.';
+				}
+
+				end = flt_format_dec(end, rawval[j], 0);
+			}
+
+			*end = 0;
 			return m_getpropertystr_storage;
 		default:
 			ASSERT(false);
@@ -552,6 +1183,7 @@ void sinsp_filter_check::string_to_rawval(const char* str, uint32_t len, ppm_par
 
 				memcpy((&m_val_storage[0]), str, len);
 				m_val_storage[len] = 0;
+				m_val_storage_len = len;
 			}
 			break;
 		case PT_BOOL:
@@ -588,623 +1220,2722 @@ void sinsp_filter_check::string_to_rawval(const char* str, uint32_t len, ppm_par
 			ASSERT(false);
 			throw sinsp_exception("wrong event type " + to_string((long long) m_field->m_type));
 	}
-}
 
-char* sinsp_filter_check::tostring(sinsp_evt* evt)
-{
-	uint32_t len;
-	uint8_t* rawval = extract(evt, &len);
-
-	if(rawval == NULL)
-	{
-		return NULL;
-	}
-
-	return rawval_to_string(rawval, m_field, len);
+	//
+	// The value and the operator don't change, so the comparison is picked
+	// once here instead of switching on them for every event
+	//
+	m_cmp = flt_get_compare_fn(m_cmpop, ptype);
 }
 
-int32_t sinsp_filter_check::parse_field_name(const char* str)
+//
+// The strings are matched up to their terminator, the buffers on their
+// whole length
+//
+bool sinsp_filter_check::regex_matches(ppm_param_type type, uint8_t* val, uint32_t len)
 {
-	int32_t j;
-	int32_t max_fldlen = -1;
-
-	ASSERT(m_info.m_fields != NULL);
-	ASSERT(m_info.m_nfiedls != -1);
-
-	string val(str);
-
-	m_field_id = 0xffffffff;
-
-	for(j = 0; j < m_info.m_nfiedls; j++)
+	if(type == PT_CHARBUF)
 	{
-		string fldname = m_info.m_fields[j].m_name;
-		int32_t fldlen = fldname.length();
-
-		if(val.compare(0, fldlen, fldname) == 0)
-		{
-			if(fldlen > max_fldlen)
-			{
-				m_field_id = j;
-				m_field = &m_info.m_fields[j];
-				max_fldlen = fldlen;
-			}
-		}
+		len = (uint32_t)strlen((char*)val);
 	}
 
-	return max_fldlen;
-}
-
-void sinsp_filter_check::parse_filter_value(const char* str, uint32_t len)
-{
-	string_to_rawval(str, len, m_field->m_type);
+	return m_regex.match((char*)val, len);
 }
 
-const filtercheck_field_info* sinsp_filter_check::get_field_info()
+//
+// Length of a value as a lookup key, 0 for the types that can't be looked up.
+// The writers of the summaries and of the indexes, and the checks, must agree
+// on it.
+//
+static uint32_t flt_key_len(ppm_param_type type, const uint8_t* val)
 {
-	return &m_info.m_fields[m_field_id];
+	switch(type)
+	{
+	case PT_CHARBUF:
+		return (uint32_t)strlen((char*)val);
+	case PT_INT8:
+	case PT_UINT8:
+	case PT_L4PROTO:
+		return sizeof(uint8_t);
+	case PT_INT16:
+	case PT_UINT16:
+	case PT_PORT:
+		return sizeof(uint16_t);
+	case PT_INT32:
+	case PT_UINT32:
+	case PT_IPV4ADDR:
+		return sizeof(uint32_t);
+	case PT_INT64:
+	case PT_UINT64:
+	case PT_PID:
+	case PT_FD:
+		return sizeof(uint64_t);
+	default:
+		return 0;
+	}
 }
 
-bool sinsp_filter_check::compare(sinsp_evt *evt)
+bool sinsp_filter_check::extract_key(sinsp_evt* evt, OUT string* key)
 {
 	uint32_t len;
-	uint8_t* extracted_val = extract(evt, &len);
+	uint8_t* val = extract(evt, &len);
 
-	if(extracted_val == NULL)
+	if(val == NULL)
 	{
 		return false;
 	}
 
-	return flt_compare(m_cmpop, 
-		m_info.m_fields[m_field_id].m_type, 
-		extracted_val, 
-		&m_val_storage[0],
-		len,
-		m_val_storage_len);
-}
-
-///////////////////////////////////////////////////////////////////////////////
-// sinsp_filter_expression implementation
-///////////////////////////////////////////////////////////////////////////////
-sinsp_filter_expression::sinsp_filter_expression()
-{
-	m_parent = NULL;
+	len = flt_key_len(get_field_info()->m_type, val);
+	key->assign((char*)val, len);
+	return len != 0 || get_field_info()->m_type == PT_CHARBUF;
 }
 
-sinsp_filter_expression::~sinsp_filter_expression()
+bool sinsp_filter_check::get_lookup_keys(OUT vector<string>* keys)
 {
+	ppm_param_type type = m_field->m_type;
+	uint32_t width = flt_key_len(type, (const uint8_t*)"");
 	uint32_t j;
 
-	for(j = 0; j < m_checks.size(); j++)
+	keys->clear();
+
+	if((width == 0 && type != PT_CHARBUF) || (m_cmpop != CO_EQ && m_cmpop != CO_IN))
 	{
-		delete m_checks[j];
+		return false;
 	}
-}
-
-sinsp_filter_check* sinsp_filter_expression::allocate_new()
-{
-	ASSERT(false);
-	return NULL;
-}
-
-void sinsp_filter_expression::add_check(sinsp_filter_check* chk)
-{
-	m_checks.push_back(chk);
-}
-
-void sinsp_filter_expression::parse(string expr)
-{
-}
 
-bool sinsp_filter_expression::compare(sinsp_evt *evt)
-{
-	uint32_t j;
-	uint32_t size = m_checks.size();
-	bool res = true;
-	bool chkres;
-	 
-	for(j = 0; j < size; j++)
+	if(m_cmpop == CO_EQ)
 	{
-		sinsp_filter_check* chk = m_checks[j];
-		ASSERT(chk != NULL);
+		keys->push_back(string((char*)&m_val_storage[0], flt_key_len(type, &m_val_storage[0])));
+	}
+	else if(type == PT_CHARBUF)
+	{
+		*keys = m_val_set.get_strings();
+	}
+	else
+	{
+		vector<uint64_t> ints;
 
-		chkres = chk->compare(evt);
-		if(j == 0)
-		{
-			switch(chk->m_boolop)
-			{
-			case BO_NONE:
-				res = chkres;
-				break;
-			case BO_NOT:
-				res = !chkres;
-				break;
-			default:
-				ASSERT(false);
-				break;
-			}
-		}
-		else
+		m_val_set.get_ints(&ints);
+
+		for(j = 0; j < ints.size(); j++)
 		{
-			switch(chk->m_boolop)
+			uint8_t v8 = (uint8_t)ints[j];
+			uint16_t v16 = (uint16_t)ints[j];
+			uint32_t v32 = (uint32_t)ints[j];
+			uint64_t v64 = ints[j];
+
+			switch(width)
 			{
-			case BO_OR:
-				res = res || chkres;
+			case sizeof(uint8_t):
+				keys->push_back(string((char*)&v8, width));
 				break;
-			case BO_AND:
-				res = res && chkres;
-				break;
-			case BO_ORNOT:
-				res = res || !chkres;
+			case sizeof(uint16_t):
+				keys->push_back(string((char*)&v16, width));
 				break;
-			case BO_ANDNOT:
-				res = res && !chkres;
+			case sizeof(uint32_t):
+				keys->push_back(string((char*)&v32, width));
 				break;
 			default:
-				ASSERT(false);
+				keys->push_back(string((char*)&v64, width));
 				break;
 			}
 		}
 	}
 
-	return res;
+	return true;
 }
 
-///////////////////////////////////////////////////////////////////////////////
-// sinsp_filter implementation
-///////////////////////////////////////////////////////////////////////////////
-sinsp_filter::sinsp_filter(sinsp* inspector, string fltstr)
+//
+// For the checks on a summarized field: return false if the summary has
+// none of the values of an '=' or 'in' check
+//
+bool sinsp_filter_check::may_match_keys(const scap_block_summary* summary, scap_summary_kind kind)
 {
-	m_inspector = inspector;
-	m_scanpos = -1;
-	m_scansize = 0;
-	m_state = ST_NEED_EXPRESSION;
-	m_filter = new sinsp_filter_expression();
-	m_curexpr = m_filter;
-	m_last_boolop = BO_NONE;
-	m_nest_level = 0;
+	uint32_t j;
 
-	try
+	if((summary->kinds & (1 << kind)) == 0)
 	{
-		compile(fltstr);
+		return true;
 	}
-	catch(sinsp_exception& e)
+
+	if(m_summary_hashes.empty())
 	{
-		delete m_filter;
-		throw e;
+		vector<string> keys;
+
+		if(!get_lookup_keys(&keys))
+		{
+			return true;
+		}
+
+		for(j = 0; j < keys.size(); j++)
+		{
+			m_summary_hashes.push_back(scap_summary_hash(kind, keys[j].data(), (uint32_t)keys[j].size()));
+		}
 	}
-	catch(...)
+
+	for(j = 0; j < m_summary_hashes.size(); j++)
 	{
-		delete m_filter;
-		throw sinsp_exception("error parsing the filter string");
+		if(scap_summary_test(summary, m_summary_hashes[j]))
+		{
+			return true;
+		}
 	}
+
+	return false;
 }
 
-sinsp_filter::~sinsp_filter()
+char* sinsp_filter_check::tostring(sinsp_evt* evt)
 {
-	if(m_filter)
+	uint32_t len;
+	uint8_t* rawval = extract_cached(evt, &len);
+
+	if(rawval == NULL)
 	{
-		delete m_filter;
+		return NULL;
 	}
+
+	return rawval_to_string(rawval, m_field, len);
 }
 
-bool sinsp_filter::isblank(char c)
+//
+// Get the size of a value for its copy in the field cache. Returns false for
+// the types that are not cached.
+//
+static bool flt_get_cached_size(ppm_param_type type, uint8_t* val, uint32_t len, OUT uint32_t* size)
 {
-	if(c == ' ' || c == '\t' || c == '\n' || c == '\r')
+	switch(type)
 	{
+	case PT_INT8:
+	case PT_UINT8:
+	case PT_FLAGS8:
+	case PT_SIGTYPE:
+	case PT_L4PROTO:
+		*size = 1;
+		return true;
+	case PT_INT16:
+	case PT_UINT16:
+	case PT_FLAGS16:
+	case PT_PORT:
+	case PT_SYSCALLID:
+		*size = 2;
+		return true;
+	case PT_INT32:
+	case PT_UINT32:
+	case PT_FLAGS32:
+	case PT_BOOL:
+	case PT_IPV4ADDR:
+		*size = 4;
+		return true;
+	case PT_INT64:
+	case PT_UINT64:
+	case PT_FD:
+	case PT_PID:
+	case PT_ERRNO:
+	case PT_RELTIME:
+	case PT_ABSTIME:
+		*size = 8;
+		return true;
+	case PT_CHARBUF:
+		*size = (val != NULL)? strlen((char*)val) : 0;
+		return true;
+	case PT_BYTEBUF:
+		*size = len;
 		return true;
+	default:
+		return false;
+	}
+}
+
+uint32_t sinsp_field_cache::add_user(const string& fldname)
+{
+	unordered_map<string, uint32_t>::iterator it = m_slot_ids.find(fldname);
+	uint32_t id;
+
+	if(it != m_slot_ids.end())
+	{
+		id = it->second;
 	}
 	else
 	{
-		return false;
+		sinsp_field_cache_slot slot;
+
+		slot.m_nusers = 0;
+		slot.m_gen = 0;
+		slot.m_isnull = true;
+		slot.m_len = 0;
+		slot.m_str_gen = 0;
+		slot.m_str_isnull = true;
+
+		id = m_slots.size();
+		m_slots.push_back(slot);
+		m_slot_ids[fldname] = id;
 	}
+
+	m_slots[id].m_nusers++;
+	return id;
 }
 
-bool sinsp_filter::is_special_char(char c)
+uint32_t sinsp_field_cache::add_result_user(const string& key)
 {
-	if(c == '(' || c == ')' || c == '!' || c == '=' || c == '<' || c == '>')
+	unordered_map<string, uint32_t>::iterator it = m_result_slot_ids.find(key);
+	uint32_t id;
+
+	if(it != m_result_slot_ids.end())
 	{
-		return true;
+		id = it->second;
+	}
+	else
+	{
+		sinsp_filter_result_slot slot;
+
+		slot.m_nusers = 0;
+		slot.m_gen = 0;
+		slot.m_res = false;
+
+		id = m_result_slots.size();
+		m_result_slots.push_back(slot);
+		m_result_slot_ids[key] = id;
 	}
 
-	return false;
+	m_result_slots[id].m_nusers++;
+	return id;
 }
 
-bool sinsp_filter::is_bracket(char c)
+uint32_t sinsp_field_cache::add_thread_result_user(const string& key)
 {
-	if(c == '(' || c == ')')
+	unordered_map<string, uint32_t>::iterator it = m_thread_result_slot_ids.find(key);
+	uint32_t id;
+
+	if(it != m_thread_result_slot_ids.end())
 	{
-		return true;
+		return it->second;
 	}
 
-	return false;
+	id = m_thread_result_slot_ids.size();
+	m_thread_result_slot_ids[key] = id;
+	return id;
 }
 
-char sinsp_filter::next()
+void sinsp_filter_check::enable_field_cache(const string& fldname)
 {
-	while(true)
+	uint32_t size;
+
+	if(m_inspector == NULL || !is_cacheable() ||
+		!flt_get_cached_size(get_field_info()->m_type, NULL, 0, &size))
 	{
-		m_scanpos++;
+		return;
+	}
 
-		if(m_scanpos >= m_scansize)
-		{
+	m_cache_slot = m_inspector->m_field_cache->add_user(fldname);
+}
+
+//
+// Return the slot of the check if its value is shared with other checks, and
+// evt is the current event of the inspector
+//
+sinsp_field_cache_slot* sinsp_filter_check::get_cache_slot(sinsp_evt* evt)
+{
+	sinsp_field_cache_slot* slot;
+
+	if(m_cache_slot == SINSP_NO_CACHE_SLOT || evt != &m_inspector->m_evt)
+	{
+		return NULL;
+	}
+
+	slot = &m_inspector->m_field_cache->m_slots[m_cache_slot];
+	return (slot->m_nusers > 1)? slot : NULL;
+}
+
+uint8_t* sinsp_filter_check::extract_cached(sinsp_evt *evt, OUT uint32_t* len)
+{
+	sinsp_field_cache_slot* slot = get_cache_slot(evt);
+	uint64_t gen;
+	uint8_t* val;
+	uint32_t size;
+
+	if(slot == NULL)
+	{
+		return extract(evt, len);
+	}
+
+	gen = m_inspector->m_field_cache->m_gen;
+
+	if(slot->m_gen == gen)
+	{
+		*len = slot->m_len;
+		return slot->m_isnull? NULL : &slot->m_val[0];
+	}
+
+	*len = 0;
+	val = extract(evt, len);
+	slot->m_gen = gen;
+
+	if(val == NULL)
+	{
+		slot->m_isnull = true;
+		return NULL;
+	}
+
+	//
+	// The value can be in the storage of this check, which the next
+	// extraction overwrites, so the slot keeps a copy
+	//
+	flt_get_cached_size(get_field_info()->m_type, val, *len, &size);
+	if(slot->m_val.size() < size + 1)
+	{
+		slot->m_val.resize(size + 1);
+	}
+
+	memcpy(&slot->m_val[0], val, size);
+	slot->m_val[size] = 0;
+	slot->m_isnull = false;
+	slot->m_len = (get_field_info()->m_type == PT_CHARBUF)? size : *len;
+
+	*len = slot->m_len;
+	return &slot->m_val[0];
+}
+
+char* sinsp_filter_check::tostring_cached(sinsp_evt* evt)
+{
+	sinsp_field_cache_slot* slot = get_cache_slot(evt);
+	uint64_t gen;
+	char* str;
+
+	if(slot == NULL)
+	{
+		return tostring(evt);
+	}
+
+	gen = m_inspector->m_field_cache->m_gen;
+
+	if(slot->m_str_gen == gen)
+	{
+		return slot->m_str_isnull? NULL : (char*)slot->m_str.c_str();
+	}
+
+	str = tostring(evt);
+	slot->m_str_gen = gen;
+	slot->m_str_isnull = (str == NULL);
+
+	if(str != NULL)
+	{
+		slot->m_str = str;
+	}
+
+	return str;
+}
+
+bool sinsp_filter_check::extract_value(sinsp_evt* evt, OUT sinsp_field_value* val)
+{
+	uint32_t len;
+	uint8_t* rawval = extract_cached(evt, &len);
+	const filtercheck_field_info* finfo = get_field_info();
+
+	if(rawval == NULL)
+	{
+		return false;
+	}
+
+	val->m_type = finfo->m_type;
+	val->m_int = 0;
+	val->m_uint = 0;
+	val->m_num = 0;
+	val->m_buf = NULL;
+	val->m_len = 0;
+
+	switch(finfo->m_type)
+	{
+	case PT_INT8:
+		val->m_kind = SFV_INT;
+		val->m_int = *(int8_t*)rawval;
+		break;
+	case PT_INT16:
+		val->m_kind = SFV_INT;
+		val->m_int = *(int16_t*)rawval;
+		break;
+	case PT_INT32:
+		val->m_kind = SFV_INT;
+		val->m_int = *(int32_t*)rawval;
+		break;
+	case PT_INT64:
+	case PT_ERRNO:
+	case PT_FD:
+	case PT_PID:
+		val->m_kind = SFV_INT;
+		val->m_int = *(int64_t*)rawval;
+		break;
+	case PT_L4PROTO:
+	case PT_FLAGS8:
+	case PT_UINT8:
+		val->m_kind = SFV_UINT;
+		val->m_uint = *(uint8_t*)rawval;
+		break;
+	case PT_PORT:
+	case PT_FLAGS16:
+	case PT_UINT16:
+		val->m_kind = SFV_UINT;
+		val->m_uint = *(uint16_t*)rawval;
+		break;
+	case PT_FLAGS32:
+	case PT_UINT32:
+		val->m_kind = SFV_UINT;
+		val->m_uint = *(uint32_t*)rawval;
+		break;
+	case PT_UINT64:
+	case PT_RELTIME:
+	case PT_ABSTIME:
+		val->m_kind = SFV_UINT;
+		val->m_uint = *(uint64_t*)rawval;
+		break;
+	case PT_BOOL:
+		val->m_kind = SFV_BOOL;
+		val->m_uint = (*(uint32_t*)rawval != 0);
+		break;
+	case PT_IPV4ADDR:
+		val->m_kind = SFV_IPV4;
+		val->m_uint = ((uint32_t)rawval[0] << 24) | ((uint32_t)rawval[1] << 16) |
+			((uint32_t)rawval[2] << 8) | rawval[3];
+		break;
+	case PT_CHARBUF:
+		val->m_kind = SFV_BUF;
+		val->m_buf = (const char*)rawval;
+		val->m_len = (uint32_t)strlen((char*)rawval);
+		return true;
+	default:
+		val->m_kind = SFV_BUF;
+		val->m_buf = (const char*)rawval;
+		val->m_len = len;
+		return true;
+	}
+
+	if(val->m_kind == SFV_INT)
+	{
+		val->m_uint = (uint64_t)val->m_int;
+		val->m_num = (double)val->m_int;
+	}
+	else
+	{
+		val->m_int = (int64_t)val->m_uint;
+		val->m_num = (double)val->m_uint;
+	}
+
+	return true;
+}
+
+int32_t sinsp_filter_check::parse_field_name(const char* str)
+{
+	int32_t j;
+	int32_t max_fldlen = -1;
+
+	ASSERT(m_info.m_fields != NULL);
+	ASSERT(m_info.m_nfiedls != -1);
+
+	string val(str);
+
+	m_field_id = 0xffffffff;
+
+	for(j = 0; j < m_info.m_nfiedls; j++)
+	{
+		string fldname = m_info.m_fields[j].m_name;
+		int32_t fldlen = fldname.length();
+
+		if(val.compare(0, fldlen, fldname) == 0)
+		{
+			if(fldlen > max_fldlen)
+			{
+				m_field_id = j;
+				m_field = &m_info.m_fields[j];
+				max_fldlen = fldlen;
+			}
+		}
+	}
+
+	return max_fldlen;
+}
+
+void sinsp_filter_check::parse_filter_value(const char* str, uint32_t len)
+{
+	string_to_rawval(str, len, m_field->m_type);
+}
+
+const filtercheck_field_info* sinsp_filter_check::get_field_info()
+{
+	return &m_info.m_fields[m_field_id];
+}
+
+bool sinsp_filter_check::compare(sinsp_evt *evt)
+{
+	uint32_t len;
+	uint8_t* extracted_val = extract(evt, &len);
+
+	if(extracted_val == NULL)
+	{
+		return false;
+	}
+
+	if(m_cmpop == CO_IN)
+	{
+		return m_val_set.contains(extracted_val, len);
+	}
+	else if(m_cmpop == CO_MATCHES)
+	{
+		return regex_matches(m_info.m_fields[m_field_id].m_type, extracted_val, len);
+	}
+
+	return m_cmp(m_cmpop,
+		m_info.m_fields[m_field_id].m_type,
+		extracted_val,
+		&m_val_storage[0],
+		len,
+		m_val_storage_len);
+}
+
+void sinsp_filter_check::get_evttypes(OUT ppm_evt_mask* mask)
+{
+	memset(mask, 0xff, sizeof(ppm_evt_mask));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// sinsp_filter_expression implementation
+///////////////////////////////////////////////////////////////////////////////
+sinsp_filter_expression::sinsp_filter_expression()
+{
+	m_parent = NULL;
+}
+
+sinsp_filter_expression::~sinsp_filter_expression()
+{
+	uint32_t j;
+
+	for(j = 0; j < m_checks.size(); j++)
+	{
+		delete m_checks[j];
+	}
+}
+
+sinsp_filter_check* sinsp_filter_expression::allocate_new()
+{
+	ASSERT(false);
+	return NULL;
+}
+
+void sinsp_filter_expression::add_check(sinsp_filter_check* chk)
+{
+	m_checks.push_back(chk);
+}
+
+void sinsp_filter_expression::parse(string expr)
+{
+}
+
+bool sinsp_filter_expression::compare(sinsp_evt *evt)
+{
+	uint32_t j;
+	uint32_t size = m_checks.size();
+	bool res = true;
+	bool chkres;
+	 
+	for(j = 0; j < size; j++)
+	{
+		sinsp_filter_check* chk = m_checks[j];
+		ASSERT(chk != NULL);
+
+		chkres = chk->compare(evt);
+		if(j == 0)
+		{
+			switch(chk->m_boolop)
+			{
+			case BO_NONE:
+				res = chkres;
+				break;
+			case BO_NOT:
+				res = !chkres;
+				break;
+			default:
+				ASSERT(false);
+				break;
+			}
+		}
+		else
+		{
+			switch(chk->m_boolop)
+			{
+			case BO_OR:
+				res = res || chkres;
+				break;
+			case BO_AND:
+				res = res && chkres;
+				break;
+			case BO_ORNOT:
+				res = res || !chkres;
+				break;
+			case BO_ANDNOT:
+				res = res && !chkres;
+				break;
+			default:
+				ASSERT(false);
+				break;
+			}
+		}
+	}
+
+	return res;
+}
+
+void sinsp_filter_expression::get_evttypes(OUT ppm_evt_mask* mask)
+{
+	uint32_t j;
+	uint32_t k;
+	uint32_t size = m_checks.size();
+	ppm_evt_mask chkmask;
+
+	//
+	// The checks are evaluated left to right, so we do the same with their
+	// masks. Negated checks can match any event type.
+	//
+	memset(mask, 0xff, sizeof(ppm_evt_mask));
+
+	for(j = 0; j < size; j++)
+	{
+		sinsp_filter_check* chk = m_checks[j];
+		ASSERT(chk != NULL);
+
+		chk->get_evttypes(&chkmask);
+
+		switch(chk->m_boolop)
+		{
+		case BO_NONE:
+			ASSERT(j == 0);
+			memcpy(mask, &chkmask, sizeof(ppm_evt_mask));
+			break;
+		case BO_OR:
+			for(k = 0; k < sizeof(mask->mask); k++)
+			{
+				mask->mask[k] |= chkmask.mask[k];
+			}
+			break;
+		case BO_AND:
+			for(k = 0; k < sizeof(mask->mask); k++)
+			{
+				mask->mask[k] &= chkmask.mask[k];
+			}
+			break;
+		case BO_NOT:
+		case BO_ORNOT:
+			memset(mask, 0xff, sizeof(ppm_evt_mask));
+			break;
+		case BO_ANDNOT:
+			break;
+		default:
+			ASSERT(false);
+			memset(mask, 0xff, sizeof(ppm_evt_mask));
+			break;
+		}
+	}
+}
+
+//
+// Like get_evttypes(), a negated check can match any group
+//
+bool sinsp_filter_expression::may_match_block(const scap_block_summary* summary)
+{
+	uint32_t j;
+	uint32_t size = m_checks.size();
+	bool res = true;
+
+	for(j = 0; j < size; j++)
+	{
+		sinsp_filter_check* chk = m_checks[j];
+		ASSERT(chk != NULL);
+
+		switch(chk->m_boolop)
+		{
+		case BO_NONE:
+			res = chk->may_match_block(summary);
+			break;
+		case BO_OR:
+			res = res || chk->may_match_block(summary);
+			break;
+		case BO_AND:
+			res = res && chk->may_match_block(summary);
+			break;
+		case BO_NOT:
+		case BO_ORNOT:
+			res = true;
+			break;
+		case BO_ANDNOT:
+			break;
+		default:
+			ASSERT(false);
+			res = true;
+			break;
+		}
+	}
+
+	return res;
+}
+
+//
+// The masks of the negated checks are not exact, see get_evttypes()
+//
+bool sinsp_filter_expression::is_evttype_only()
+{
+	uint32_t j;
+	uint32_t size = m_checks.size();
+
+	if(size == 0)
+	{
+		return false;
+	}
+
+	for(j = 0; j < size; j++)
+	{
+		uint32_t op = m_checks[j]->m_boolop;
+
+		if((op & BO_NOT) || (j > 0 && (op & (BO_OR | BO_AND)) == 0) ||
+			!m_checks[j]->is_evttype_only())
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// sinsp_filter implementation
+///////////////////////////////////////////////////////////////////////////////
+sinsp_filter::sinsp_filter(sinsp* inspector, string fltstr)
+{
+	sinsp_alloc_scope alloc_scope(SAS_FILTER);
+
+	m_inspector = inspector;
+	m_scanpos = -1;
+	m_scansize = 0;
+	m_state = ST_NEED_EXPRESSION;
+	m_filter = new sinsp_filter_expression();
+	m_curexpr = m_filter;
+	m_last_boolop = BO_NONE;
+	m_nest_level = 0;
+	m_result_slot = SINSP_NO_CACHE_SLOT;
+
+	try
+	{
+		compile(fltstr);
+		generate_program();
+	}
+	catch(sinsp_exception& e)
+	{
+		free_match_groups();
+		delete m_filter;
+		throw e;
+	}
+	catch(...)
+	{
+		free_match_groups();
+		delete m_filter;
+		throw sinsp_exception("error parsing the filter string");
+	}
+
+	if(is_cacheable(m_filter))
+	{
+		m_result_slot = m_inspector->m_field_cache->add_result_user("filter " + m_fltstr);
+	}
+}
+
+sinsp_filter::~sinsp_filter()
+{
+	free_match_groups();
+
+	if(m_filter)
+	{
+		delete m_filter;
+	}
+}
+
+bool sinsp_filter::isblank(char c)
+{
+	if(c == ' ' || c == '\t' || c == '\n' || c == '\r')
+	{
+		return true;
+	}
+	else
+	{
+		return false;
+	}
+}
+
+bool sinsp_filter::is_special_char(char c)
+{
+	if(c == '(' || c == ')' || c == '!' || c == '=' || c == '<' || c == '>')
+	{
+		return true;
+	}
+
+	return false;
+}
+
+bool sinsp_filter::is_bracket(char c)
+{
+	if(c == '(' || c == ')')
+	{
+		return true;
+	}
+
+	return false;
+}
+
+char sinsp_filter::next()
+{
+	while(true)
+	{
+		m_scanpos++;
+
+		if(m_scanpos >= m_scansize)
+		{
 			return 0;
 		}
 
-		if(!isblank(m_fltstr[m_scanpos]))
+		if(!isblank(m_fltstr[m_scanpos]))
+		{
+			return m_fltstr[m_scanpos];
+		}
+	}
+}
+
+void sinsp_filter::next_operand(bool expecting_first_operand, bool in_list, OUT string* res)
+{
+	int32_t start;
+	int32_t nums[2];
+	uint32_t num_pos;
+	enum ppm_escape_state
+	{
+		PES_NORMAL,
+		PES_SLASH,
+		PES_NUMBER,
+		PES_ERROR,
+	} escape_state;
+
+	//
+	// Skip spaces
+	//
+	if(isblank(m_fltstr[m_scanpos]))
+	{
+		next();
+	}
+
+	//
+	// Mark the beginning of the word
+	//
+	start = m_scanpos;
+	escape_state = PES_NORMAL;
+	num_pos = 0;
+	res->clear();
+
+	while(m_scanpos < m_scansize && escape_state != PES_ERROR)
+	{
+		char curchar = m_fltstr[m_scanpos];
+		bool is_end_of_word;
+
+		if(expecting_first_operand)
+		{
+			is_end_of_word = (isblank(curchar) || is_special_char(curchar));
+		}
+		else
+		{
+			is_end_of_word = (isblank(curchar) || is_bracket(curchar) ||
+				(in_list && curchar == ','));
+		}
+
+		if(is_end_of_word)
+		{
+			if(escape_state != PES_NORMAL)
+			{
+				escape_state = PES_ERROR;
+				break;
+			}
+
+			//
+			// End of word
+			//
+			ASSERT(m_scanpos > start);
+
+			if(curchar == '(' || curchar == ')' || curchar == ',')
+			{
+				m_scanpos--;
+			}
+
+			return;
+		}
+
+		switch(escape_state)
+		{
+		case PES_NORMAL:
+			if(curchar == '\\' && !expecting_first_operand)
+			{
+				escape_state = PES_SLASH;
+			}
+			else
+			{
+				res->push_back(curchar);
+			}
+			break;
+		case PES_SLASH:
+			if(curchar == '\\')
+			{
+				escape_state = PES_NORMAL;
+				res->push_back(curchar);
+			}
+			else if(curchar == 'x')
+			{
+				escape_state = PES_NUMBER;
+			}
+			else
+			{
+				escape_state = PES_ERROR;
+			}
+			break;
+		case PES_NUMBER:
+			if(isdigit((int)curchar))
+			{
+				nums[num_pos++] = curchar - '0';
+			}
+			else if((curchar >= 'a' && curchar <= 'f') || (curchar >= 'A' && curchar <= 'F'))
+			{
+				nums[num_pos++] = tolower((int)curchar) - 'a' + 10;
+			}
+			else
+			{
+				escape_state = PES_ERROR;
+			}
+
+			if(num_pos == 2 && escape_state != PES_ERROR)
+			{
+				res->push_back((char)(nums[0] * 16 + nums[1]));
+
+				num_pos = 0;
+				escape_state = PES_NORMAL;
+			}
+			break;
+		default:
+			ASSERT(false);
+			escape_state = PES_ERROR;
+			break;
+		}
+
+		m_scanpos++;
+	}
+
+	if(escape_state == PES_ERROR)
+	{
+		throw sinsp_exception("filter error: unrecognized escape sequence at " + m_fltstr.substr(start, m_scanpos));
+	}
+
+	//
+	// End of filter
+	//
+}
+
+bool sinsp_filter::compare_no_consume(const char* str)
+{
+	int32_t len = (int32_t)strlen(str);
+
+	if(m_scanpos + len >= m_scansize)
+	{
+		return false;
+	}
+
+	return m_fltstr.compare(m_scanpos, len, str) == 0;
+}
+
+ppm_cmp_operator sinsp_filter::next_comparison_operator()
+{
+	int32_t start;
+
+	//
+	// Skip spaces
+	//
+	if(isblank(m_fltstr[m_scanpos]))
+	{
+		next();
+	}
+
+	//
+	// Mark the beginning of the word
+	//
+	start = m_scanpos;
+
+	if(compare_no_consume("="))
+	{
+		m_scanpos += 1;
+		return CO_EQ;
+	}
+	else if(compare_no_consume("!="))
+	{
+		m_scanpos += 2;
+		return CO_NE;
+	}
+	else if(compare_no_consume("<="))
+	{
+		m_scanpos += 2;
+		return CO_LE;
+	}
+	else if(compare_no_consume("<"))
+	{
+		m_scanpos += 1;
+		return CO_LT;
+	}
+	else if(compare_no_consume(">="))
+	{
+		m_scanpos += 2;
+		return CO_GE;
+	}
+	else if(compare_no_consume(">"))
+	{
+		m_scanpos += 1;
+		return CO_GT;
+	}
+	else if(compare_no_consume("contains"))
+	{
+		m_scanpos += 8;
+		return CO_CONTAINS;
+	}
+	else if(compare_no_consume("startswith"))
+	{
+		m_scanpos += 10;
+		return CO_STARTSWITH;
+	}
+	else if(compare_no_consume("matches"))
+	{
+		m_scanpos += 7;
+		return CO_MATCHES;
+	}
+	else if(compare_no_consume("in"))
+	{
+		m_scanpos += 2;
+		return CO_IN;
+	}
+	else
+	{
+		throw sinsp_exception("filter error: unrecognized comparison operator after " + m_fltstr.substr(0, start));
+	}
+}
+
+//
+// The values of 'in', e.g. "(open, close, read)". They are separated by
+// commas or blanks.
+//
+void sinsp_filter::next_operand_list(OUT vector<string>* res)
+{
+	int32_t start = m_scanpos;
+	uint32_t n = 0;
+
+	if(next() != '(')
+	{
+		throw sinsp_exception("filter error: expected '(' after 'in' at pos " + to_string((long long) start));
+	}
+
+	while(true)
+	{
+		char c = next();
+
+		if(c == 0)
+		{
+			throw sinsp_exception("filter error: unterminated list of values at pos " + to_string((long long) start));
+		}
+		else if(c == ')')
+		{
+			break;
+		}
+		else if(c == ',')
+		{
+			continue;
+		}
+
+		//
+		// The strings of the previous lists are reused
+		//
+		if(n == res->size())
+		{
+			res->push_back(string());
+		}
+
+		next_operand(false, true, &(*res)[n++]);
+	}
+
+	if(n == 0)
+	{
+		throw sinsp_exception("filter error: empty list of values at pos " + to_string((long long) start));
+	}
+
+	res->resize(n);
+}
+
+//
+// The expression of 'matches'. It ends at a blank or at a ')' that closes
+// none of its groups. The escape sequences are left to sinsp_regex, and the
+// brackets inside the bracket expressions and after a '\' don't count.
+//
+string sinsp_filter::next_regex_operand()
+{
+	string res;
+	uint32_t depth = 0;
+	bool in_bracket = false;
+
+	if(isblank(m_fltstr[m_scanpos]))
+	{
+		next();
+	}
+
+	while(m_scanpos < m_scansize)
+	{
+		char curchar = m_fltstr[m_scanpos];
+
+		if(isblank(curchar))
+		{
+			break;
+		}
+		else if(curchar == '\\')
+		{
+			if(m_scanpos + 1 >= m_scansize)
+			{
+				throw sinsp_exception("filter error: unterminated escape sequence at pos " + to_string((long long) m_scanpos));
+			}
+
+			res.push_back(curchar);
+			curchar = m_fltstr[++m_scanpos];
+		}
+		else if(in_bracket)
+		{
+			//
+			// A ']' right after the '[' or the '[^' is a literal
+			//
+			if(curchar == ']' && res[res.size() - 1] != '[' &&
+				!(res[res.size() - 1] == '^' && res[res.size() - 2] == '['))
+			{
+				in_bracket = false;
+			}
+		}
+		else if(curchar == '[')
+		{
+			in_bracket = true;
+		}
+		else if(curchar == '(')
+		{
+			depth++;
+		}
+		else if(curchar == ')')
+		{
+			if(depth == 0)
+			{
+				break;
+			}
+
+			depth--;
+		}
+
+		res.push_back(curchar);
+		m_scanpos++;
+	}
+
+	if(res.empty())
+	{
+		throw sinsp_exception("filter error: missing regular expression at pos " + to_string((long long) m_scanpos));
+	}
+
+	//
+	// Like next_operand(), leave the ')' to the caller
+	//
+	if(m_scanpos < m_scansize && m_fltstr[m_scanpos] == ')')
+	{
+		m_scanpos--;
+	}
+
+	return res;
+}
+
+void sinsp_filter::parse_check(sinsp_filter_expression* parent_expr, boolop op)
+{
+	uint32_t startpos = m_scanpos;
+
+	next_operand(true, false, &m_operand1);
+
+	sinsp_filter_check* chk = g_filterlist.new_filter_check_from_fldname(m_operand1, m_inspector, true);
+
+	if(chk == NULL)
+	{
+		throw sinsp_exception("filter error: unrecognized field " + 
+			m_operand1 + " at pos " + to_string((long long) startpos));
+	}
+
+	ppm_cmp_operator co = next_comparison_operator();
+
+	chk->m_boolop = op;
+	chk->m_cmpop = co;
+	chk->parse_field_name(m_operand1.c_str());
+	chk->m_fldname = m_operand1;
+
+	//
+	// The other checks extract the field in compare()
+	//
+	if(chk->has_plain_compare())
+	{
+		chk->enable_field_cache(m_operand1);
+	}
+
+	if(co == CO_IN)
+	{
+		uint32_t j;
+
+		next_operand_list(&m_operand_list);
+
+		chk->m_val_set.init(chk->get_compare_type());
+
+		for(j = 0; j < m_operand_list.size(); j++)
+		{
+			chk->parse_filter_value(m_operand_list[j].c_str(), (uint32_t)m_operand_list[j].size());
+			chk->m_val_set.add(&chk->m_val_storage[0], chk->m_val_storage_len);
+		}
+	}
+	else if(co == CO_MATCHES)
+	{
+		ppm_param_type type = chk->get_compare_type();
+
+		if(type != PT_CHARBUF && type != PT_BYTEBUF)
+		{
+			throw sinsp_exception("filter error: 'matches' is only supported for string and buffer fields, at pos " +
+				to_string((long long) startpos));
+		}
+
+		chk->m_regex.compile(next_regex_operand());
+	}
+	else
+	{
+		next_operand(false, false, &m_operand2);
+		chk->parse_filter_value(m_operand2.c_str(), (uint32_t)m_operand2.size());
+	}
+
+	chk->m_clause = m_fltstr.substr(startpos, m_scanpos + 1 - startpos);
+	while(chk->m_clause.size() != 0 && isblank(chk->m_clause[chk->m_clause.size() - 1]))
+	{
+		chk->m_clause.resize(chk->m_clause.size() - 1);
+	}
+
+	parent_expr->add_check(chk);
+}
+
+void sinsp_filter::push_expression(boolop op)
+{
+	sinsp_filter_expression* newexpr = new sinsp_filter_expression();
+	newexpr->m_boolop = op;
+	newexpr->m_parent = m_curexpr;
+	m_last_boolop = BO_NONE;
+
+	m_curexpr->m_checks.push_back((sinsp_filter_check*)newexpr);
+	m_curexpr = newexpr;
+	m_nest_level++;
+}
+
+void sinsp_filter::pop_expression()
+{
+	ASSERT(m_curexpr->m_parent != NULL);
+
+	m_curexpr = m_curexpr->m_parent;
+	m_nest_level--;
+}
+
+void sinsp_filter::compile(string fltstr)
+{
+	m_fltstr = fltstr;
+	m_scansize = m_fltstr.size();
+
+	while(true)
+	{
+		char a = next();
+
+		switch(a)
+		{
+		case 0:
+			//
+			// Finished parsing the filter string
+			//
+			if(m_nest_level != 0)
+			{
+				throw sinsp_exception("filter error: unexpected end of filter");
+			}
+
+			if(m_state != ST_EXPRESSION_DONE)
+			{
+				throw sinsp_exception("filter error: unexpected end of filter at position " + to_string((long long) m_scanpos));
+			}
+
+			//
+			// Good filter
+			//
+			return;
+
+			break;
+		case '(':
+			if(m_state != ST_NEED_EXPRESSION)
+			{
+				throw sinsp_exception("unexpected '(' after " + m_fltstr.substr(0, m_scanpos));
+			}
+
+			push_expression(m_last_boolop);
+
+			break;
+		case ')':
+			pop_expression();
+			break;
+		case 'o':
+			if(next() == 'r')
+			{
+				m_last_boolop = BO_OR;
+			}
+			else
+			{
+				throw sinsp_exception("syntax error in filter at position " + to_string((long long) m_scanpos));
+			}
+
+			if(m_state != ST_EXPRESSION_DONE)
+			{
+				throw sinsp_exception("unexpected 'or' after " + m_fltstr.substr(0, m_scanpos));
+			}
+
+			m_state = ST_NEED_EXPRESSION;
+
+			break;
+		case 'a':
+			if(next() == 'n' && next() == 'd')
+			{
+				m_last_boolop = BO_AND;
+			}
+			else
+			{
+				throw sinsp_exception("syntax error in filter at position " + to_string((long long) m_scanpos));
+			}
+
+			if(m_state != ST_EXPRESSION_DONE)
+			{
+				throw sinsp_exception("unexpected 'and' after " + m_fltstr.substr(0, m_scanpos));
+			}
+
+			m_state = ST_NEED_EXPRESSION;
+
+			break;
+		case 'n':
+			if(next() == 'o' && next() == 't')
+			{
+				m_last_boolop = (boolop)((uint32_t)m_last_boolop | BO_NOT);
+			}
+			else
+			{
+				throw sinsp_exception("syntax error in filter at position " + to_string((long long) m_scanpos));
+			}
+
+			if(m_state != ST_EXPRESSION_DONE && m_state != ST_NEED_EXPRESSION)
+			{
+				throw sinsp_exception("unexpected 'not' after " + m_fltstr.substr(0, m_scanpos));
+			}
+
+			m_state = ST_NEED_EXPRESSION;
+
+			break;
+		default:
+			parse_check(m_curexpr, m_last_boolop);
+
+			m_state = ST_EXPRESSION_DONE;
+
+			break;
+		}
+	}
+
+	vector<string> components = sinsp_split(m_fltstr, ' ');
+}
+
+void sinsp_filter::emit(uint32_t opcode)
+{
+	sinsp_filter_instr instr;
+
+	instr.m_opcode = opcode;
+	instr.m_jump = 0;
+	instr.m_negate = false;
+	instr.m_check = NULL;
+	instr.m_cmp = NULL;
+	instr.m_cmpop = CO_NONE;
+	instr.m_type = PT_NONE;
+	instr.m_cst = NULL;
+	instr.m_cstlen = 0;
+	instr.m_result_slot = SINSP_NO_CACHE_SLOT;
+	instr.m_thread_result_slot = SINSP_NO_CACHE_SLOT;
+
+	m_program.push_back(instr);
+}
+
+void sinsp_filter::generate_check(sinsp_filter_check* chk, bool negate)
+{
+	if(chk->is_expression())
+	{
+		generate_expression((sinsp_filter_expression*)chk, false);
+
+		if(negate)
+		{
+			emit(FOP_NOT);
+		}
+
+		return;
+	}
+
+	if(chk->has_plain_compare())
+	{
+		sinsp_filter_instr* instr;
+
+		emit(FOP_CMP);
+		instr = &m_program.back();
+		instr->m_cmpop = chk->m_cmpop;
+		instr->m_type = chk->get_compare_type();
+		instr->m_cmp = chk->m_cmp;
+		instr->m_cstlen = chk->m_val_storage_len;
+
+		if(instr->m_cmpop == CO_IN)
+		{
+			instr->m_cst = &chk->m_val_set;
+		}
+		else if(instr->m_cmpop == CO_MATCHES)
+		{
+			instr->m_cst = &chk->m_regex;
+			instr->m_cmp = flt_compare_matches;
+		}
+		else
+		{
+			instr->m_cst = &chk->m_val_storage[0];
+		}
+	}
+	else
+	{
+		emit(FOP_COMPARE);
+	}
+
+	m_program.back().m_check = chk;
+	m_program.back().m_negate = negate;
+
+	//
+	// The result is cached before the negation, so "fd.type=file" and
+	// "not fd.type=file" share it
+	//
+	if(chk->is_cacheable())
+	{
+		m_program.back().m_result_slot = m_inspector->m_field_cache->add_result_user("check " + chk->m_clause);
+	}
+
+	//
+	// The checks on the process name, the user and so on give the same
+	// result for all the events of a thread until it execs
+	//
+	if(chk->is_thread_state())
+	{
+		m_program.back().m_thread_result_slot = m_inspector->m_field_cache->add_thread_result_user("check " + chk->m_clause);
+	}
+}
+
+//
+// Return true if the result of the check only depends on the event, which is
+// the case if none of its checks keeps some state
+//
+bool sinsp_filter::is_cacheable(sinsp_filter_check* chk)
+{
+	uint32_t j;
+
+	if(!chk->is_expression())
+	{
+		return chk->is_cacheable();
+	}
+
+	sinsp_filter_expression* expr = (sinsp_filter_expression*)chk;
+
+	for(j = 0; j < expr->m_checks.size(); j++)
+	{
+		if(!is_cacheable(expr->m_checks[j]))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+//
+// Like sinsp_filter_check::get_cache_slot(), return the result slot if other
+// filters use it and evt is the current event of the inspector
+//
+sinsp_filter_result_slot* sinsp_filter::get_result_slot(sinsp_evt* evt, uint32_t id)
+{
+	sinsp_filter_result_slot* slot;
+
+	if(id == SINSP_NO_CACHE_SLOT || evt != &m_inspector->m_evt)
+	{
+		return NULL;
+	}
+
+	slot = &m_inspector->m_field_cache->m_result_slots[id];
+	return (slot->m_nusers > 1)? slot : NULL;
+}
+
+//
+// Return the result of a check that the thread of the event keeps, see
+// sinsp_threadinfo::m_check_results. valid is false if it must be computed
+// again, and stored in the returned entry.
+//
+uint64_t* sinsp_filter::get_thread_result(sinsp_evt* evt, uint32_t id, OUT bool* valid)
+{
+	sinsp_threadinfo* tinfo;
+	sinsp_thread_manager* thread_manager = m_inspector->m_thread_manager;
+	uint64_t* entry;
+	uint64_t stamp;
+
+	*valid = false;
+
+	if(id == SINSP_NO_CACHE_SLOT)
+	{
+		return NULL;
+	}
+
+	tinfo = evt->get_thread_info();
+	if(tinfo == NULL)
+	{
+		return NULL;
+	}
+
+	if(tinfo->m_check_results.size() <= id)
+	{
+		tinfo->m_check_results.resize(id + 1, 0);
+	}
+
+	entry = &tinfo->m_check_results[id];
+	stamp = *entry >> 1;
+
+	*valid = (*entry != 0 &&
+		stamp >= tinfo->m_state_gen &&
+		stamp >= thread_manager->get_check_results_epoch());
+
+	return entry;
+}
+
+//
+// Estimated cost of a check, in rough units of a comparison of a numeric
+// event field
+//
+uint32_t sinsp_filter::get_cost(sinsp_filter_check* chk)
+{
+	uint32_t j;
+	uint32_t res = 0;
+
+	if(chk->is_expression())
+	{
+		sinsp_filter_expression* expr = (sinsp_filter_expression*)chk;
+
+		for(j = 0; j < expr->m_checks.size(); j++)
+		{
+			res += get_cost(expr->m_checks[j]);
+		}
+
+		return res;
+	}
+
+	//
+	// The event fields are in the event, the others need the thread lookup
+	// and, for the fd ones, the fd lookup
+	//
+	if(chk->m_info.m_name == "evt")
+	{
+		res += 1;
+	}
+	else if(chk->m_info.m_name == "fd")
+	{
+		res += 4;
+	}
+	else
+	{
+		res += 2;
+	}
+
+	if(!chk->has_plain_compare())
+	{
+		return res + 8;
+	}
+
+	switch(chk->get_compare_type())
+	{
+	case PT_CHARBUF:
+		if(chk->m_cmpop == CO_CONTAINS || chk->m_cmpop == CO_MATCHES)
+		{
+			return res + 16;
+		}
+		else if(chk->m_cmpop == CO_IN)
+		{
+			return res + 6;
+		}
+		else
+		{
+			return res + 4;
+		}
+	case PT_BYTEBUF:
+		return res + 32;
+	default:
+		return res + ((chk->m_cmpop == CO_IN)? 2 : 1);
+	}
+}
+
+//
+// Rough probability that a check is true. Equality is assumed to be
+// selective, inequality to be almost always true.
+//
+double sinsp_filter::get_true_probability(sinsp_filter_check* chk)
+{
+	double res;
+
+	if(chk->is_expression())
+	{
+		res = 0.5;
+	}
+	else
+	{
+		switch(chk->m_cmpop)
+		{
+		case CO_EQ:
+		case CO_CONTAINS:
+		case CO_STARTSWITH:
+		case CO_IN:
+		case CO_MATCHES:
+			res = 0.1;
+			break;
+		case CO_NE:
+			res = 0.9;
+			break;
+		default:
+			res = 0.5;
+			break;
+		}
+	}
+
+	return (chk->m_boolop & BO_NOT)? 1 - res : res;
+}
+
+//
+// Checks that were merged into one scan of their field
+//
+typedef struct sinsp_filter_match_group
+{
+	vector<sinsp_filter_check*> m_checks;
+	sinsp_string_matcher m_matcher;
+	uint32_t m_cost;
+}sinsp_filter_match_group;
+
+//
+// A check or a group of merged checks in a run, with the key it's sorted by
+//
+typedef struct sinsp_filter_run_item
+{
+	sinsp_filter_check* m_check;
+	sinsp_filter_match_group* m_group; // NULL if the item is a single check
+	double m_rank;
+}sinsp_filter_run_item;
+
+static bool flt_compare_rank(const sinsp_filter_run_item& a, const sinsp_filter_run_item& b)
+{
+	return a.m_rank < b.m_rank;
+}
+
+//
+// Return true if the check can be merged with the others on the same field
+// in a sinsp_filter_match_group. In the 'or' runs these are the checks
+// that are not negated, in the 'and' runs the negated ones.
+//
+bool sinsp_filter::is_mergeable(sinsp_filter_check* chk, bool negate)
+{
+	ppm_param_type type;
+
+	if(chk->is_expression() || !chk->has_plain_compare() ||
+		((chk->m_boolop & BO_NOT) != 0) != negate ||
+		(chk->m_cmpop != CO_CONTAINS && chk->m_cmpop != CO_STARTSWITH))
+	{
+		return false;
+	}
+
+	type = chk->get_compare_type();
+	return type == PT_CHARBUF || type == PT_BYTEBUF;
+}
+
+void sinsp_filter::free_match_groups()
+{
+	uint32_t j;
+
+	for(j = 0; j < m_match_groups.size(); j++)
+	{
+		delete m_match_groups[j];
+	}
+
+	m_match_groups.clear();
+}
+
+//
+// The checks of an expression are combined left to right, so the ones in a
+// run of checks with the same operator can be evaluated in any order, and
+// the first run also includes the first check. In each run, the checks are
+// sorted by cost over the probability that they end the run: for 'and' the
+// probability of being false, for 'or' of being true.
+// Each check except the first one is preceded by a jump that skips the rest
+// of its run when the result can't change: the run of an 'or' is skipped
+// when the result is already true, the run of an 'and' when it's false.
+//
+void sinsp_filter::generate_expression(sinsp_filter_expression* expr, bool evttype_tested)
+{
+	uint32_t j;
+	uint32_t k;
+	uint32_t l;
+	uint32_t size = expr->m_checks.size();
+	vector<sinsp_filter_check*> checks;
+	vector<uint32_t> runs;
+	vector<uint32_t> guards;
+	vector<sinsp_filter_run_item> items;
+	vector<bool> merged;
+	bool and_only = true;
+
+	if(size == 0)
+	{
+		emit(FOP_TRUE);
+		return;
+	}
+
+	for(j = 0; j < size; j++)
+	{
+		sinsp_filter_check* chk = expr->m_checks[j];
+		ASSERT(chk != NULL);
+
+		if(j == 0)
+		{
+			ASSERT(chk->m_boolop == BO_NONE || chk->m_boolop == BO_NOT);
+		}
+		else if((chk->m_boolop & (BO_OR | BO_AND)) == 0)
+		{
+			//
+			// The tree ignores the result of these checks
+			//
+			ASSERT(false);
+			continue;
+		}
+		else if(chk->m_boolop & BO_OR)
+		{
+			and_only = false;
+		}
+
+		checks.push_back(chk);
+	}
+
+	//
+	// If all the checks must be true, the event type test already did the
+	// work of the event type checks
+	//
+	if(evttype_tested && and_only)
+	{
+		for(j = 0, k = 0; j < checks.size(); j++)
+		{
+			if((checks[j]->m_boolop & BO_NOT) || !checks[j]->is_evttype_only())
+			{
+				checks[k++] = checks[j];
+			}
+		}
+
+		checks.resize(k);
+	}
+
+	for(j = 0; j < checks.size(); j++)
+	{
+		if(j == 0 ||
+			(j > 1 && (checks[j]->m_boolop & (BO_OR | BO_AND)) != (checks[j - 1]->m_boolop & (BO_OR | BO_AND))))
+		{
+			runs.push_back(j);
+		}
+	}
+
+	runs.push_back(checks.size());
+
+	for(j = 0; j + 1 < runs.size(); j++)
+	{
+		uint32_t first = runs[j];
+		uint32_t last = runs[j + 1];
+		uint32_t op = (first + 1 < checks.size())? checks[first + 1]->m_boolop : BO_AND;
+		bool is_or;
+
+		if(j > 0)
+		{
+			op = checks[first]->m_boolop;
+		}
+
+		is_or = (op & BO_OR) != 0;
+
+		//
+		// Merge the string searches on the same field, so that the field
+		// is extracted and scanned once for all of them. An 'or' of
+		// searches is true if any pattern is found, a group of negated
+		// searches in an 'and' is true if none is found.
+		//
+		items.clear();
+		merged.assign(last - first, false);
+
+		for(k = first; k < last; k++)
+		{
+			sinsp_filter_run_item item;
+			sinsp_filter_match_group* group = NULL;
+			double p = 1;
+
+			if(merged[k - first])
+			{
+				continue;
+			}
+
+			item.m_check = checks[k];
+
+			if(is_mergeable(checks[k], !is_or))
+			{
+				for(l = k + 1; l < last; l++)
+				{
+					if(!merged[l - first] && is_mergeable(checks[l], !is_or) &&
+						checks[l]->m_fldname == checks[k]->m_fldname &&
+						checks[l]->get_compare_type() == checks[k]->get_compare_type())
+					{
+						if(group == NULL)
+						{
+							group = new sinsp_filter_match_group;
+							group->m_checks.push_back(checks[k]);
+							m_match_groups.push_back(group);
+						}
+
+						group->m_checks.push_back(checks[l]);
+						merged[l - first] = true;
+					}
+				}
+			}
+
+			item.m_group = group;
+
+			if(group == NULL)
+			{
+				p = get_true_probability(checks[k]);
+				item.m_rank = get_cost(checks[k]) / (is_or? p : 1 - p);
+			}
+			else
+			{
+				group->m_cost = 0;
+
+				for(l = 0; l < group->m_checks.size(); l++)
+				{
+					sinsp_filter_check* chk = group->m_checks[l];
+					const char* pattern = (const char*)&chk->m_val_storage[0];
+
+					group->m_matcher.add(pattern,
+						(chk->get_compare_type() == PT_CHARBUF)? strlen(pattern) : chk->m_val_storage_len,
+						chk->m_cmpop == CO_STARTSWITH);
+
+					group->m_cost = MAX(group->m_cost, get_cost(chk));
+
+					//
+					// p is the probability that none of the searches is
+					// true for 'or', and that all are for 'and'
+					//
+					p *= is_or? 1 - get_true_probability(chk) : get_true_probability(chk);
+				}
+
+				group->m_matcher.compile();
+				group->m_cost += 2;
+				item.m_rank = group->m_cost / (1 - p);
+			}
+
+			items.push_back(item);
+		}
+
+		stable_sort(items.begin(), items.end(), flt_compare_rank);
+
+		guards.clear();
+
+		for(k = 0; k < items.size(); k++)
 		{
-			return m_fltstr[m_scanpos];
+			if(first + k > 0)
+			{
+				guards.push_back(m_program.size());
+				emit(is_or? FOP_JT : FOP_JF);
+			}
+
+			if(items[k].m_group == NULL)
+			{
+				generate_check(items[k].m_check, (items[k].m_check->m_boolop & BO_NOT) != 0);
+			}
+			else
+			{
+				emit(FOP_MATCH);
+				m_program.back().m_check = items[k].m_check;
+				m_program.back().m_type = items[k].m_check->get_compare_type();
+				m_program.back().m_cst = items[k].m_group;
+				m_program.back().m_negate = !is_or;
+
+				if(items[k].m_check->is_thread_state())
+				{
+					string key = "match";
+
+					for(l = 0; l < items[k].m_group->m_checks.size(); l++)
+					{
+						key += " " + items[k].m_group->m_checks[l]->m_clause;
+					}
+
+					m_program.back().m_thread_result_slot = m_inspector->m_field_cache->add_thread_result_user(key);
+				}
+			}
+		}
+
+		for(k = 0; k < guards.size(); k++)
+		{
+			m_program[guards[k]].m_jump = m_program.size();
 		}
 	}
 }
 
-vector<char> sinsp_filter::next_operand(bool expecting_first_operand)
+void sinsp_filter::generate_program()
 {
-	vector<char> res;
-	int32_t start;
-	int32_t nums[2];
-	uint32_t num_pos;
-	enum ppm_escape_state
+	uint32_t j;
+
+	m_filter->get_evttypes(&m_evttypes);
+	m_test_evttype = false;
+
+	m_batch_clauses.clear();
+	generate_batch_clauses(m_filter);
+
+	for(j = 0; j < PPM_EVENT_MAX; j++)
 	{
-		PES_NORMAL,
-		PES_SLASH,
-		PES_NUMBER,
-		PES_ERROR,
-	} escape_state;
+		if(!PPM_EVT_MASK_ISSET(&m_evttypes, j))
+		{
+			m_test_evttype = true;
+			break;
+		}
+	}
 
 	//
-	// Skip spaces
+	// For filters like "evt.type=open or evt.type=close", the event type
+	// test is the whole filter
 	//
-	if(isblank(m_fltstr[m_scanpos]))
+	if(m_test_evttype && m_filter->is_evttype_only())
 	{
-		next();
+		return;
 	}
 
-	//
-	// Mark the beginning of the word
-	//
-	start = m_scanpos;
-	escape_state = PES_NORMAL;
-	num_pos = 0;
+	generate_expression(m_filter, m_test_evttype);
+}
 
-	while(m_scanpos < m_scansize && escape_state != PES_ERROR)
+//
+// Collect the checks that must be true for the events to be accepted, and
+// that only depend on the raw event. These are the checks of the top level
+// 'and' of the filter, and of the 'and' expressions nested in it.
+//
+void sinsp_filter::generate_batch_clauses(sinsp_filter_expression* expr)
+{
+	uint32_t j;
+	uint32_t k;
+
+	for(j = 1; j < expr->m_checks.size(); j++)
 	{
-		char curchar = m_fltstr[m_scanpos];
-		bool is_end_of_word;
+		if((expr->m_checks[j]->m_boolop & BO_AND) == 0)
+		{
+			return;
+		}
+	}
 
-		if(expecting_first_operand)
+	for(j = 0; j < expr->m_checks.size(); j++)
+	{
+		sinsp_filter_check* chk = expr->m_checks[j];
+		bool negate = (chk->m_boolop & BO_NOT) != 0;
+		sinsp_filter_batch_clause clause;
+		string argname;
+
+		if(chk->is_expression())
 		{
-			is_end_of_word = (isblank(curchar) || is_special_char(curchar));
+			if(!negate)
+			{
+				generate_batch_clauses((sinsp_filter_expression*)chk);
+			}
+
+			continue;
 		}
-		else
+
+		clause.m_column = chk->get_batch_column(&argname);
+
+		if(clause.m_column == BCOL_NONE)
 		{
-			is_end_of_word = (isblank(curchar) || is_bracket(curchar));
+			continue;
 		}
 
-		if(is_end_of_word)
+		if(chk->m_cmpop != CO_EQ && chk->m_cmpop != CO_NE &&
+			chk->m_cmpop != CO_LT && chk->m_cmpop != CO_LE &&
+			chk->m_cmpop != CO_GT && chk->m_cmpop != CO_GE)
 		{
-			if(escape_state != PES_NORMAL)
+			continue;
+		}
+
+		clause.m_check = chk;
+		clause.m_cmpop = chk->m_cmpop;
+		clause.m_type = chk->get_compare_type();
+		clause.m_negate = negate;
+
+		if(!flt_load_number(clause.m_type, &chk->m_val_storage[0], &clause.m_cst, &clause.m_signed))
+		{
+			continue;
+		}
+
+		if(clause.m_column == BCOL_ARG)
+		{
+			clause.m_argpos.assign(PPM_EVENT_MAX, SINSP_BATCH_ARG_ABSENT);
+
+			for(k = 0; k < PPM_EVENT_MAX; k++)
 			{
-				escape_state = PES_ERROR;
-				break;
+				const struct ppm_event_info* info = &g_infotables.m_event_info[k];
+				uint32_t l;
+
+				//
+				// Like sinsp_evt::get_param_value_raw(), use the first
+				// argument with the name
+				//
+				for(l = 0; l < info->nparams; l++)
+				{
+					if(argname == info->params[l].name)
+					{
+						clause.m_argpos[k] = (info->params[l].type == clause.m_type)?
+							(int16_t)l : SINSP_BATCH_ARG_UNKNOWN;
+						break;
+					}
+				}
 			}
+		}
+
+		m_batch_clauses.push_back(clause);
+	}
+}
+
+bool sinsp_filter::run_batch(scap_evt** evts, uint16_t* cpuids, uint32_t nevts, OUT uint8_t* selected)
+{
+	sinsp_alloc_scope alloc_scope(SAS_FILTER);
+	uint32_t j;
+	uint32_t k;
+	bool is_signed;
+
+	if(m_batch_clauses.empty())
+	{
+		return false;
+	}
+
+	if(m_batch_vals.size() < nevts)
+	{
+		m_batch_vals.resize(nevts);
+		m_batch_state.resize(nevts);
+		m_batch_res.resize(nevts);
+	}
 
+	uint64_t* vals = &m_batch_vals[0];
+	uint8_t* state = &m_batch_state[0];
+	uint8_t* res = &m_batch_res[0];
+
+	for(j = 0; j < nevts; j++)
+	{
+		selected[j] = (!m_test_evttype || PPM_EVT_MASK_ISSET(&m_evttypes, evts[j]->type))? 1 : 0;
+	}
+
+	for(k = 0; k < m_batch_clauses.size(); k++)
+	{
+		const sinsp_filter_batch_clause* clause = &m_batch_clauses[k];
+		uint8_t negate = clause->m_negate? 1 : 0;
+
+		//
+		// Gather the column. The state of each value is 0 if the value is
+		// there, 1 if the event doesn't have it, so the check is false,
+		// and 2 if the check must be left to run().
+		//
+		switch(clause->m_column)
+		{
+		case BCOL_TID:
 			//
-			// End of word
+			// thread.tid is a PT_INT64 and evt.cpu a PT_INT16, so these are
+			// the values that flt_load_number() would return
 			//
-			ASSERT(m_scanpos > start);
+			ASSERT(clause->m_type == PT_INT64);
 
-			if(curchar == '(' || curchar == ')')
+			for(j = 0; j < nevts; j++)
 			{
-				m_scanpos--;
+				vals[j] = SCAP_TID_LOCAL(evts[j]->tid);
+			}
+
+			memset(state, 0, nevts);
+			break;
+		case BCOL_CPU:
+			ASSERT(clause->m_type == PT_INT16);
+
+			for(j = 0; j < nevts; j++)
+			{
+				vals[j] = (uint64_t)(int64_t)(int16_t)cpuids[j];
+			}
+
+			memset(state, 0, nevts);
+			break;
+		case BCOL_ARG:
+			for(j = 0; j < nevts; j++)
+			{
+				int16_t pos = clause->m_argpos[evts[j]->type];
+
+				if(pos == SINSP_BATCH_ARG_ABSENT)
+				{
+					vals[j] = 0;
+					state[j] = 1;
+				}
+				else if(pos == SINSP_BATCH_ARG_UNKNOWN)
+				{
+					vals[j] = 0;
+					state[j] = 2;
+				}
+				else
+				{
+					uint32_t nparams = g_infotables.m_event_info[evts[j]->type].nparams;
+					uint16_t* lens = (uint16_t*)((char*)evts[j] + sizeof(struct ppm_evt_hdr));
+					char* valptr = (char*)lens + nparams * sizeof(uint16_t);
+					int16_t l;
+
+					for(l = 0; l < pos; l++)
+					{
+						valptr += lens[l];
+					}
+
+					flt_load_number(clause->m_type, valptr, &vals[j], &is_signed);
+					state[j] = 0;
+				}
 			}
+			break;
+		default:
+			ASSERT(false);
+			continue;
+		}
 
-			res.push_back('\0');
-			return res;
+		if(clause->m_signed)
+		{
+			flt_batch_compare<int64_t>(clause->m_cmpop, (const int64_t*)vals, (int64_t)clause->m_cst, nevts, res);
+		}
+		else
+		{
+			flt_batch_compare<uint64_t>(clause->m_cmpop, vals, clause->m_cst, nevts, res);
 		}
 
-		switch(escape_state)
+		for(j = 0; j < nevts; j++)
 		{
-		case PES_NORMAL:
-			if(curchar == '\\' && !expecting_first_operand)
+			uint8_t r = res[j] ^ negate;
+
+			selected[j] &= (state[j] == 0)? r : ((state[j] == 1)? negate : 1);
+		}
+	}
+
+	return true;
+}
+
+string sinsp_filter::explain()
+{
+	string res;
+	char line[64];
+	uint32_t j;
+	const char* last_name = NULL;
+
+	res = "filter: " + m_fltstr + "\n";
+	res += "event types:";
+
+	if(m_test_evttype)
+	{
+		for(j = 0; j < PPM_EVENT_MAX; j++)
+		{
+			if(PPM_EVT_MASK_ISSET(&m_evttypes, j))
 			{
-				escape_state = PES_SLASH;
+				//
+				// The enter and exit events have the same name
+				//
+				if(last_name == NULL || strcmp(last_name, g_infotables.m_event_info[j].name) != 0)
+				{
+					last_name = g_infotables.m_event_info[j].name;
+					res += string(" ") + last_name;
+				}
 			}
-			else
+		}
+
+		if(last_name == NULL)
+		{
+			res += " none";
+		}
+	}
+	else
+	{
+		res += " all";
+	}
+
+	res += "\n";
+
+	//
+	// The checks that sinsp::next() also tests on whole batches of events
+	//
+	if(m_batch_clauses.size() != 0)
+	{
+		res += "raw event checks:";
+
+		for(j = 0; j < m_batch_clauses.size(); j++)
+		{
+			res += (j == 0)? " " : ", ";
+			res += m_batch_clauses[j].m_negate? "not " : "";
+			res += m_batch_clauses[j].m_check->m_clause;
+		}
+
+		res += "\n";
+	}
+
+	if(m_program.size() == 0)
+	{
+		res += "no checks, the event type decides\n";
+	}
+
+	for(j = 0; j < m_program.size(); j++)
+	{
+		const sinsp_filter_instr* instr = &m_program[j];
+
+		snprintf(line, sizeof(line), "%4u  ", j);
+		res += line;
+
+		switch(instr->m_opcode)
+		{
+		case FOP_CMP:
+		case FOP_COMPARE:
+			res += (instr->m_opcode == FOP_CMP)? "cmp     " : "compare ";
+			res += instr->m_negate? "not " : "";
+			res += instr->m_check->m_clause;
+			snprintf(line, sizeof(line), "  [cost %u]", get_cost(instr->m_check));
+			res += line;
+			break;
+		case FOP_MATCH:
 			{
-				res.push_back(curchar);
+				sinsp_filter_match_group* group = (sinsp_filter_match_group*)instr->m_cst;
+				uint32_t k;
+
+				res += "match   ";
+				res += instr->m_negate? "not (" : "(";
+
+				for(k = 0; k < group->m_checks.size(); k++)
+				{
+					res += (k == 0)? "" : " or ";
+					res += group->m_checks[k]->m_clause;
+				}
+
+				snprintf(line, sizeof(line), ")  [cost %u]", group->m_cost);
+				res += line;
 			}
 			break;
-		case PES_SLASH:
-			if(curchar == '\\')
+		case FOP_JT:
+			snprintf(line, sizeof(line), "jt      %u", instr->m_jump);
+			res += line;
+			break;
+		case FOP_JF:
+			snprintf(line, sizeof(line), "jf      %u", instr->m_jump);
+			res += line;
+			break;
+		case FOP_NOT:
+			res += "not";
+			break;
+		case FOP_TRUE:
+			res += "true";
+			break;
+		default:
+			ASSERT(false);
+			break;
+		}
+
+		res += "\n";
+	}
+
+	return res;
+}
+
+bool sinsp_filter::run(sinsp_evt *evt)
+{
+	sinsp_alloc_scope alloc_scope(SAS_FILTER);
+	const sinsp_filter_instr* program = m_program.data();
+	uint32_t size = m_program.size();
+	uint32_t pc = 0;
+	bool res = true;
+	uint8_t* val;
+	uint32_t len;
+	sinsp_filter_result_slot* slot;
+	sinsp_filter_result_slot* filter_slot;
+	uint64_t gen;
+	uint64_t* thread_res;
+	bool thread_res_valid;
+
+	if(m_test_evttype && !PPM_EVT_MASK_ISSET(&m_evttypes, evt->get_type()))
+	{
+		return false;
+	}
+
+	gen = m_inspector->m_field_cache->m_gen;
+	filter_slot = get_result_slot(evt, m_result_slot);
+
+	if(filter_slot != NULL && filter_slot->m_gen == gen)
+	{
+		return filter_slot->m_res;
+	}
+
+	while(pc < size)
+	{
+		const sinsp_filter_instr* instr = &program[pc];
+
+		switch(instr->m_opcode)
+		{
+		case FOP_CMP:
+			slot = get_result_slot(evt, instr->m_result_slot);
+
+			if(slot != NULL && slot->m_gen == gen)
 			{
-				escape_state = PES_NORMAL;
-				res.push_back(curchar);
+				res = slot->m_res != instr->m_negate;
+				pc++;
+				break;
 			}
-			else if(curchar == 'x')
+
+			thread_res = get_thread_result(evt, instr->m_thread_result_slot, &thread_res_valid);
+
+			if(thread_res_valid)
 			{
-				escape_state = PES_NUMBER;
+				res = (*thread_res & 1) != 0;
 			}
 			else
 			{
-				escape_state = PES_ERROR;
+				val = instr->m_check->extract_cached(evt, &len);
+				res = (val != NULL &&
+					instr->m_cmp(instr->m_cmpop, instr->m_type, val, instr->m_cst, len, instr->m_cstlen));
+
+				if(thread_res != NULL)
+				{
+					*thread_res = (m_inspector->m_thread_manager->get_state_generation() << 1) | (res? 1 : 0);
+				}
+			}
+
+			if(slot != NULL)
+			{
+				slot->m_gen = gen;
+				slot->m_res = res;
 			}
+
+			res = res != instr->m_negate;
+			pc++;
 			break;
-		case PES_NUMBER:
-			if(isdigit((int)curchar))
+		case FOP_COMPARE:
+			slot = get_result_slot(evt, instr->m_result_slot);
+
+			if(slot != NULL && slot->m_gen == gen)
 			{
-				nums[num_pos++] = curchar - '0';
+				res = slot->m_res != instr->m_negate;
+				pc++;
+				break;
 			}
-			else if((curchar >= 'a' && curchar <= 'f') || (curchar >= 'A' && curchar <= 'F'))
+
+			thread_res = get_thread_result(evt, instr->m_thread_result_slot, &thread_res_valid);
+
+			if(thread_res_valid)
 			{
-				nums[num_pos++] = tolower((int)curchar) - 'a' + 10;
+				res = (*thread_res & 1) != 0;
 			}
 			else
 			{
-				escape_state = PES_ERROR;
+				res = instr->m_check->compare(evt);
+
+				if(thread_res != NULL)
+				{
+					*thread_res = (m_inspector->m_thread_manager->get_state_generation() << 1) | (res? 1 : 0);
+				}
+			}
+
+			if(slot != NULL)
+			{
+				slot->m_gen = gen;
+				slot->m_res = res;
+			}
+
+			res = res != instr->m_negate;
+			pc++;
+			break;
+		case FOP_MATCH:
+			thread_res = get_thread_result(evt, instr->m_thread_result_slot, &thread_res_valid);
+
+			if(thread_res_valid)
+			{
+				res = ((*thread_res & 1) != 0) != instr->m_negate;
+				pc++;
+				break;
 			}
 
-			if(num_pos == 2 && escape_state != PES_ERROR)
+			val = instr->m_check->extract_cached(evt, &len);
+
+			if(val != NULL && instr->m_type == PT_CHARBUF)
 			{
-				res.push_back((char)(nums[0] * 16 + nums[1]));
+				len = strlen((char*)val);
+			}
 
-				num_pos = 0;
-				escape_state = PES_NORMAL;
+			res = (val != NULL &&
+				((sinsp_filter_match_group*)instr->m_cst)->m_matcher.match((char*)val, len));
+
+			if(thread_res != NULL)
+			{
+				*thread_res = (m_inspector->m_thread_manager->get_state_generation() << 1) | (res? 1 : 0);
 			}
+
+			res = res != instr->m_negate;
+			pc++;
+			break;
+		case FOP_JT:
+			pc = res? instr->m_jump : pc + 1;
+			break;
+		case FOP_JF:
+			pc = res? pc + 1 : instr->m_jump;
+			break;
+		case FOP_NOT:
+			res = !res;
+			pc++;
+			break;
+		case FOP_TRUE:
+			res = true;
+			pc++;
 			break;
 		default:
 			ASSERT(false);
-			escape_state = PES_ERROR;
+			pc++;
 			break;
 		}
-
-		m_scanpos++;
 	}
 
-	if(escape_state == PES_ERROR)
+	if(filter_slot != NULL)
 	{
-		throw sinsp_exception("filter error: unrecognized escape sequence at " + m_fltstr.substr(start, m_scanpos));
+		filter_slot->m_gen = gen;
+		filter_slot->m_res = res;
 	}
 
-	//
-	// End of filter
-	//
-	res.push_back('\0');
 	return res;
 }
 
-bool sinsp_filter::compare_no_consume(string str)
+void sinsp_filter::get_evttypes(OUT ppm_evt_mask* mask)
 {
-	if(m_scanpos + (int32_t)str.size() >= m_scansize)
-	{
-		return false;
-	}
-
-	string tstr = m_fltstr.substr(m_scanpos, str.size());
-
-	if(tstr == str)
-	{
-		return true;
-	}
-	else
-	{
-		return false;
-	}
+	memcpy(mask, &m_evttypes, sizeof(ppm_evt_mask));
 }
 
-ppm_cmp_operator sinsp_filter::next_comparison_operator()
+///////////////////////////////////////////////////////////////////////////////
+// sinsp_block_summarizer implementation
+///////////////////////////////////////////////////////////////////////////////
+sinsp_block_summarizer::sinsp_block_summarizer(sinsp* inspector)
 {
-	int32_t start;
-
 	//
-	// Skip spaces
+	// fd.port is not extracted, it's the same as the other two. The thread
+	// id is summarized by libscap.
 	//
-	if(isblank(m_fltstr[m_scanpos]))
+	static const pair<const char*, scap_summary_kind> fields[] =
 	{
-		next();
-	}
-
-	//
-	// Mark the beginning of the word
-	//
-	start = m_scanpos;
+		make_pair("proc.pid", SCAP_SUMMARY_PID),
+		make_pair("proc.name", SCAP_SUMMARY_COMM),
+		make_pair("fd.name", SCAP_SUMMARY_FDNAME),
+		make_pair("fd.cport", SCAP_SUMMARY_PORT),
+		make_pair("fd.sport", SCAP_SUMMARY_PORT),
+	};
+	uint32_t j;
 
-	if(compare_no_consume("="))
-	{
-		m_scanpos += 1;
-		return CO_EQ;
-	}
-	else if(compare_no_consume("!="))
-	{
-		m_scanpos += 2;
-		return CO_NE;
-	}
-	else if(compare_no_consume("<="))
-	{
-		m_scanpos += 2;
-		return CO_LE;
-	}
-	else if(compare_no_consume("<"))
+	for(j = 0; j < sizeof(fields) / sizeof(fields[0]); j++)
 	{
-		m_scanpos += 1;
-		return CO_LT;
-	}
-	else if(compare_no_consume(">="))
-	{
-		m_scanpos += 2;
-		return CO_GE;
-	}
-	else if(compare_no_consume(">"))
-	{
-		m_scanpos += 1;
-		return CO_GT;
-	}
-	else if(compare_no_consume("contains"))
-	{
-		m_scanpos += 8;
-		return CO_CONTAINS;
-	}
-	else
-	{
-		throw sinsp_exception("filter error: unrecognized comparison operator after " + m_fltstr.substr(0, start));
+		sinsp_filter_check* chk = g_filterlist.new_filter_check_from_fldname(fields[j].first, inspector, true);
+		ASSERT(chk != NULL);
+
+		chk->parse_field_name(fields[j].first);
+		m_checks.push_back(make_pair(chk, fields[j].second));
 	}
 }
 
-void sinsp_filter::parse_check(sinsp_filter_expression* parent_expr, boolop op)
+sinsp_block_summarizer::~sinsp_block_summarizer()
 {
-	uint32_t startpos = m_scanpos;
-	vector<char> operand1 = next_operand(true);
-	string str_operand1 = string((char *)&operand1[0]);
-	sinsp_filter_check* chk = g_filterlist.new_filter_check_from_fldname(str_operand1, m_inspector, true);
+	uint32_t j;
 
-	if(chk == NULL)
+	for(j = 0; j < m_checks.size(); j++)
 	{
-		throw sinsp_exception("filter error: unrecognized field " + 
-			str_operand1 + " at pos " + to_string((long long) startpos));
+		delete m_checks[j].first;
 	}
+}
 
-	ppm_cmp_operator co = next_comparison_operator();
-	vector<char> operand2 = next_operand(false);
+uint32_t sinsp_block_summarizer::get_kinds()
+{
+	return (1 << SCAP_SUMMARY_TID) | (1 << SCAP_SUMMARY_PID) | (1 << SCAP_SUMMARY_COMM) |
+		(1 << SCAP_SUMMARY_FDNAME) | (1 << SCAP_SUMMARY_PORT);
+}
 
-	chk->m_boolop = op;
-	chk->m_cmpop = co;
-	chk->parse_field_name((char *)&operand1[0]);
-	chk->parse_filter_value((char *)&operand2[0], operand2.size() - 1);
+void sinsp_block_summarizer::add_keys(scap_dumper_t* dumper, sinsp_evt* evt)
+{
+	uint32_t j;
 
-	parent_expr->add_check(chk);
+	for(j = 0; j < m_checks.size(); j++)
+	{
+		if(m_checks[j].first->extract_key(evt, &m_key))
+		{
+			scap_dump_add_summary_key(dumper, m_checks[j].second, m_key.data(), (uint32_t)m_key.size());
+		}
+	}
 }
 
-void sinsp_filter::push_expression(boolop op)
+void sinsp_block_summarizer::add_keys(scap_dumper_t** dumpers, uint32_t ndumpers, sinsp_evt* evt)
 {
-	sinsp_filter_expression* newexpr = new sinsp_filter_expression();
-	newexpr->m_boolop = op;
-	newexpr->m_parent = m_curexpr;
-	m_last_boolop = BO_NONE;
+	uint32_t j;
+	uint32_t k;
 
-	m_curexpr->m_checks.push_back((sinsp_filter_check*)newexpr);
-	m_curexpr = newexpr;
-	m_nest_level++;
+	for(j = 0; j < m_checks.size(); j++)
+	{
+		if(m_checks[j].first->extract_key(evt, &m_key))
+		{
+			for(k = 0; k < ndumpers; k++)
+			{
+				scap_dump_add_summary_key(dumpers[k], m_checks[j].second, m_key.data(), (uint32_t)m_key.size());
+			}
+		}
+	}
 }
 
-void sinsp_filter::pop_expression()
+bool sinsp_filter::may_match_block(const scap_block_summary* summary)
 {
-	ASSERT(m_curexpr->m_parent != NULL);
+	uint32_t j;
 
-	m_curexpr = m_curexpr->m_parent;
-	m_nest_level--;
+	ASSERT(PPM_EVENT_MAX <= SCAP_SUMMARY_MAX_EVTTYPES);
+
+	for(j = 0; j < PPM_EVENT_MAX; j++)
+	{
+		if(PPM_EVT_MASK_ISSET(&m_evttypes, j) && (summary->evttypes[j / 64] & (1ULL << (j % 64))))
+		{
+			return m_filter->may_match_block(summary);
+		}
+	}
+
+	return false;
 }
 
-void sinsp_filter::compile(string fltstr)
+//
+// Same walk as generate_batch_clauses(): only the checks of the top level
+// 'and' and of the 'and' expressions nested in it must be true for the
+// events to be accepted, so the driver can drop the events that fail them.
+//
+void sinsp_filter::add_predicate_clauses(sinsp_filter_expression* expr, OUT ppm_predicate* pred)
 {
-	m_fltstr = fltstr;
-	m_scansize = m_fltstr.size();
+	uint32_t j;
 
-	while(true)
+	for(j = 1; j < expr->m_checks.size(); j++)
 	{
-		char a = next();
+		if((expr->m_checks[j]->m_boolop & BO_AND) == 0)
+		{
+			return;
+		}
+	}
 
-		switch(a)
+	for(j = 0; j < expr->m_checks.size() && pred->n_clauses < PPM_MAX_PREDICATE_CLAUSES; j++)
+	{
+		sinsp_filter_check* chk = expr->m_checks[j];
+		bool negate = (chk->m_boolop & BO_NOT) != 0;
+		ppm_predicate_clause* clause = &pred->clauses[pred->n_clauses];
+		ppm_predicate_field field;
+		uint64_t cst;
+		bool is_signed;
+
+		if(chk->is_expression())
 		{
-		case 0:
-			//
-			// Finished parsing the filter string
-			//
-			if(m_nest_level != 0)
+			if(!negate)
 			{
-				throw sinsp_exception("filter error: unexpected end of filter");
+				add_predicate_clauses((sinsp_filter_expression*)chk, pred);
 			}
 
-			if(m_state != ST_EXPRESSION_DONE)
-			{
-				throw sinsp_exception("filter error: unexpected end of filter at position " + to_string((long long) m_scanpos));
-			}
+			continue;
+		}
 
-			//
-			// Good filter
-			//
-			return;
+		if(!chk->get_predicate_field(&field))
+		{
+			continue;
+		}
 
+		switch(chk->m_cmpop)
+		{
+		case CO_EQ:
+			clause->cmp = PPM_PRED_CMP_EQ;
 			break;
-		case '(':
-			if(m_state != ST_NEED_EXPRESSION)
-			{
-				throw sinsp_exception("unexpected '(' after " + m_fltstr.substr(0, m_scanpos));
-			}
-
-			push_expression(m_last_boolop);
-
+		case CO_NE:
+			clause->cmp = PPM_PRED_CMP_NE;
 			break;
-		case ')':
-			pop_expression();
+		case CO_LT:
+			clause->cmp = PPM_PRED_CMP_LT;
 			break;
-		case 'o':
-			if(next() == 'r')
-			{
-				m_last_boolop = BO_OR;
-			}
-			else
-			{
-				throw sinsp_exception("syntax error in filter at position " + to_string((long long) m_scanpos));
-			}
-
-			if(m_state != ST_EXPRESSION_DONE)
-			{
-				throw sinsp_exception("unexpected 'or' after " + m_fltstr.substr(0, m_scanpos));
-			}
-
-			m_state = ST_NEED_EXPRESSION;
-
+		case CO_LE:
+			clause->cmp = PPM_PRED_CMP_LE;
 			break;
-		case 'a':
-			if(next() == 'n' && next() == 'd')
-			{
-				m_last_boolop = BO_AND;
-			}
-			else
-			{
-				throw sinsp_exception("syntax error in filter at position " + to_string((long long) m_scanpos));
-			}
-
-			if(m_state != ST_EXPRESSION_DONE)
-			{
-				throw sinsp_exception("unexpected 'and' after " + m_fltstr.substr(0, m_scanpos));
-			}
+		case CO_GT:
+			clause->cmp = PPM_PRED_CMP_GT;
+			break;
+		case CO_GE:
+			clause->cmp = PPM_PRED_CMP_GE;
+			break;
+		default:
+			continue;
+		}
 
-			m_state = ST_NEED_EXPRESSION;
+		if(!flt_load_number(chk->get_compare_type(), &chk->m_val_storage[0], &cst, &is_signed) ||
+			!is_signed)
+		{
+			continue;
+		}
 
-			break;
-		case 'n':
-			if(next() == 'o' && next() == 't')
-			{
-				m_last_boolop = (boolop)((uint32_t)m_last_boolop | BO_NOT);
-			}
-			else
-			{
-				throw sinsp_exception("syntax error in filter at position " + to_string((long long) m_scanpos));
-			}
+		clause->field = field;
+		clause->negate = negate? 1 : 0;
+		clause->value = (int64_t)cst;
+		pred->n_clauses++;
+	}
+}
 
-			if(m_state != ST_EXPRESSION_DONE && m_state != ST_NEED_EXPRESSION)
-			{
-				throw sinsp_exception("unexpected 'not' after " + m_fltstr.substr(0, m_scanpos));
-			}
+void sinsp_filter::get_predicate(OUT ppm_predicate* pred)
+{
+	uint32_t j;
+	uint32_t k;
 
-			m_state = ST_NEED_EXPRESSION;
+	memset(pred, 0, sizeof(ppm_predicate));
 
-			break;
-		default:
-			parse_check(m_curexpr, m_last_boolop);
+	add_predicate_clauses(m_filter, pred);
 
-			m_state = ST_EXPRESSION_DONE;
+	//
+	// evt.rawres is the first 'res' argument of the event. The driver only
+	// has the return value of the system call, which is what that argument
+	// holds when it's a 64 bit signed number.
+	//
+	for(j = 0; j < PPM_EVENT_MAX; j++)
+	{
+		const struct ppm_event_info* info = &g_infotables.m_event_info[j];
 
-			break;
+		if(!PPME_IS_EXIT(j))
+		{
+			continue;
 		}
-	}
 
-	vector<string> components = sinsp_split(m_fltstr, ' ');
-}
+		for(k = 0; k < info->nparams; k++)
+		{
+			if(strcmp(info->params[k].name, "res") == 0)
+			{
+				if(info->params[k].type == PT_ERRNO || info->params[k].type == PT_INT64 ||
+					info->params[k].type == PT_FD || info->params[k].type == PT_PID)
+				{
+					PPM_EVT_MASK_SET(&pred->res_events, j);
+				}
 
-bool sinsp_filter::run(sinsp_evt *evt)
-{
-	return m_filter->compare(evt);
+				break;
+			}
+		}
+	}
 }
 
 #endif // HAS_FILTERING
@@ -20,7 +20,10 @@ along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
 
 #ifdef HAS_FILTERING
 
+class sinsp_filter_check;
 class sinsp_filter_expression;
+struct sinsp_filter_result_slot;
+typedef struct sinsp_filter_match_group sinsp_filter_match_group;
 
 enum boolop
 {
@@ -32,6 +35,60 @@ enum boolop
 	BO_ANDNOT = 5,
 };
 
+//
+// Function that compares a value extracted from an event with the constant
+// of a check. It has the signature of flt_compare(), which is what is used
+// for the type and operator combinations that don't have a specialized one.
+//
+typedef bool (*sinsp_filter_cmp_fn)(ppm_cmp_operator op, ppm_param_type type, void* operand1, void* operand2, uint32_t op1_len, uint32_t op2_len);
+
+//
+// Instruction of a compiled filter program
+//
+typedef struct sinsp_filter_instr
+{
+	uint32_t m_opcode;
+	uint32_t m_jump; // Target of the jump instructions
+	bool m_negate; // The result of the check is negated
+	sinsp_filter_check* m_check;
+	sinsp_filter_cmp_fn m_cmp;
+	ppm_cmp_operator m_cmpop;
+	ppm_param_type m_type;
+	void* m_cst; // Constant the extracted value is compared to
+	uint32_t m_cstlen;
+	uint32_t m_result_slot; // Slot of the result of the check in the sinsp_field_cache, SINSP_NO_CACHE_SLOT if not shared
+	uint32_t m_thread_result_slot; // Slot of the result in sinsp_threadinfo::m_check_results, SINSP_NO_CACHE_SLOT if not kept there
+}sinsp_filter_instr;
+
+//
+// Values of sinsp_filter_batch_clause::m_argpos for the event types that
+// don't have the argument, and for the ones whose argument has a different
+// type than the check, which run() compares differently
+//
+#define SINSP_BATCH_ARG_ABSENT -1
+#define SINSP_BATCH_ARG_UNKNOWN -2
+
+//
+// A condition that the events must meet to be accepted by a filter, and that
+// only depends on the raw event, so it can be tested on a whole batch of
+// events before they are parsed
+//
+typedef struct sinsp_filter_batch_clause
+{
+	sinsp_filter_check* m_check;
+	uint32_t m_column; // A sinsp_batch_column
+	ppm_cmp_operator m_cmpop;
+	ppm_param_type m_type;
+	bool m_negate;
+	bool m_signed; // Compare the values as signed numbers
+	uint64_t m_cst;
+	//
+	// For BCOL_ARG, the position of the argument in each event type, or one
+	// of the SINSP_BATCH_ARG_* values
+	//
+	vector<int16_t> m_argpos;
+}sinsp_filter_batch_clause;
+
 /** @defgroup filter Filtering events
  * Filtering infrastructure.
  *  @{
@@ -66,6 +123,60 @@ public:
 	*/
 	bool run(sinsp_evt *evt);
 
+	/*!
+	  \brief Returns the event types that can be accepted by the filter.
+
+	  \param mask Pointer to the bitmap that will be filled with the event
+	   types. Event types that are rejected by the filter regardless of
+	   their content are cleared, all the others are set.
+	*/
+	void get_evttypes(OUT ppm_evt_mask* mask);
+
+	/*!
+	  \brief Tests the summary of a group of events of a trace file, written
+	   by the dumper.
+
+	  \param summary The summary, see \ref scap_block_summary.
+	  \return false if the filter rejects all the events of the group, true
+	   if it can accept some of them.
+	*/
+	bool may_match_block(const scap_block_summary* summary);
+
+	/*!
+	  \brief Returns a description of how the filter is run: the event types
+	   that it can accept, and its checks in the order they are evaluated,
+	   with their estimated cost.
+	*/
+	string explain();
+
+	/*!
+	  \brief Tests the conditions of the filter that only depend on the raw
+	   event, like the thread id, the CPU or the raw arguments, on a batch
+	   of events returned by scap_next_batch().
+
+	  \param evts The events.
+	  \param cpuids The CPU of each event.
+	  \param nevts The number of events.
+	  \param selected For each event, set to 0 if the filter rejects it, or
+	   to 1 if the filter can accept it. run() must still be called on the
+	   events that are set to 1.
+
+	  \return false if the filter has no such conditions, in which case
+	   selected is not set.
+	*/
+	bool run_batch(scap_evt** evts, uint16_t* cpuids, uint32_t nevts, OUT uint8_t* selected);
+
+	/*!
+	  \brief Returns the conditions of the filter that the driver can test
+	   before filling the events: the comparisons of the thread id, the
+	   process id and the raw return value that must be true for the events
+	   to be accepted.
+
+	  \param pred Pointer to the predicate that will be filled. If the
+	   filter has no such conditions, n_clauses is 0.
+	*/
+	void get_predicate(OUT ppm_predicate* pred);
+
 private:
 	enum state
 	{
@@ -73,16 +184,43 @@ private:
 		ST_NEED_EXPRESSION,
 	};
 
+	enum opcode
+	{
+		FOP_CMP, // Extract the field and compare it with m_cmp
+		FOP_COMPARE, // Call the compare() method of the check
+		FOP_JT, // Jump to m_jump if the result is true
+		FOP_JF, // Jump to m_jump if the result is false
+		FOP_NOT, // Negate the result
+		FOP_TRUE, // Set the result to true
+		FOP_MATCH, // Extract the field and look for the patterns of the sinsp_filter_match_group in m_cst
+	};
+
 	char next();
-	bool compare_no_consume(string str);
+	bool compare_no_consume(const char* str);
 
-	vector<char> next_operand(bool expecting_first_operand);
+	void next_operand(bool expecting_first_operand, bool in_list, OUT string* res);
+	void next_operand_list(OUT vector<string>* res);
+	string next_regex_operand();
 	ppm_cmp_operator next_comparison_operator();
 	void parse_check(sinsp_filter_expression* parent_expr, boolop op);
 	void push_expression(boolop op);
 	void pop_expression();
 
 	void compile(string fltstr);
+	void generate_program();
+	void generate_batch_clauses(sinsp_filter_expression* expr);
+	void add_predicate_clauses(sinsp_filter_expression* expr, OUT ppm_predicate* pred);
+	void generate_expression(sinsp_filter_expression* expr, bool evttype_tested);
+	void generate_check(sinsp_filter_check* chk, bool negate);
+	void emit(uint32_t opcode);
+	void free_match_groups();
+
+	static uint32_t get_cost(sinsp_filter_check* chk);
+	static double get_true_probability(sinsp_filter_check* chk);
+	static bool is_mergeable(sinsp_filter_check* chk, bool negate);
+	static bool is_cacheable(sinsp_filter_check* chk);
+	sinsp_filter_result_slot* get_result_slot(sinsp_evt* evt, uint32_t id);
+	uint64_t* get_thread_result(sinsp_evt* evt, uint32_t id, OUT bool* valid);
 
 	static bool isblank(char c);
 	static bool is_special_char(char c);
@@ -93,6 +231,9 @@ private:
 	string m_fltstr;
 	int32_t m_scanpos;
 	int32_t m_scansize;
+	string m_operand1; // The operands of the check being parsed, reused by all the checks
+	string m_operand2;
+	vector<string> m_operand_list;
 	state m_state;
 	sinsp_filter_expression* m_curexpr;
 	boolop m_last_boolop;
@@ -100,7 +241,76 @@ private:
 
 	sinsp_filter_expression* m_filter;
 
+	//
+	// The expression tree flattened into a list of instructions, which is
+	// what run() executes. The checks are sorted by cost where the order
+	// doesn't matter, and the jumps skip the ones that can't change the
+	// result.
+	//
+	vector<sinsp_filter_instr> m_program;
+
+	//
+	// The 'contains' and 'startswith' checks on the same field that are in
+	// the same run of 'or' checks, or negated in the same run of 'and'
+	// checks, are merged into one scan of the field
+	//
+	vector<sinsp_filter_match_group*> m_match_groups;
+
+	//
+	// Slot of the result of the whole filter in the sinsp_field_cache, for
+	// the filters that other chisels have too
+	//
+	uint32_t m_result_slot;
+
+	//
+	// The event types that the filter can accept. If m_test_evttype is set,
+	// run() rejects the other types without running the program.
+	//
+	ppm_evt_mask m_evttypes;
+	bool m_test_evttype;
+
+	//
+	// The conditions that run_batch() tests, and its temporary columns
+	//
+	vector<sinsp_filter_batch_clause> m_batch_clauses;
+	vector<uint64_t> m_batch_vals;
+	vector<uint8_t> m_batch_state;
+	vector<uint8_t> m_batch_res;
+
 	friend class sinsp_evt_formatter;
+	friend class sinsp_capture_index;
+};
+
+//
+// Adds the keys of the events written to a trace file to the summary of their
+// group: the fields of the events that sinsp_filter::may_match_block() tests,
+// extracted like the filters extract them.
+//
+class SINSP_PUBLIC sinsp_block_summarizer
+{
+public:
+	sinsp_block_summarizer(sinsp* inspector);
+	~sinsp_block_summarizer();
+
+	//
+	// The scap_summary_kind bits that add_keys() fills
+	//
+	static uint32_t get_kinds();
+
+	//
+	// Call after the event is written with scap_dump()
+	//
+	void add_keys(scap_dumper_t* dumper, sinsp_evt* evt);
+
+	//
+	// Same, for an event written to several files with scap_dump_multi().
+	// The keys are extracted once.
+	//
+	void add_keys(scap_dumper_t** dumpers, uint32_t ndumpers, sinsp_evt* evt);
+
+private:
+	vector<pair<sinsp_filter_check*, scap_summary_kind> > m_checks;
+	string m_key;
 };
 
 /*@}*/
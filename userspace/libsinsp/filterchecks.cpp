@@ -47,6 +47,28 @@ const filtercheck_field_info sinsp_filter_check_fd_fields[] =
 	{PT_CHARBUF, EPF_NONE, PF_NA, "fd.l4proto", "the IP protocol of a socket. Can be 'tcp', 'udp', 'icmp' or 'raw'."},
 	{PT_SOCKFAMILY, EPF_NONE, PF_DEC, "fd.sockfamily", "the socket family for socket events. Can be 'ip' or 'unix'."},
 	{PT_BOOL, EPF_NONE, PF_NA, "fd.is_server", "'true' if the process owning this FD is the server endpoint in the connection."},
+	{PT_INT64, EPF_NONE, PF_DEC, "fd.peer_pid", "for IPv4 connections between two processes of this machine, and for pipes and unix sockets, the PID of the process at the other end."},
+	{PT_INT64, EPF_NONE, PF_DEC, "fd.peer_tid", "for IPv4 connections between two processes of this machine, the TID of the thread that opened the other end. For pipes and unix sockets, the PID of the process at the other end."},
+	{PT_INT64, EPF_NONE, PF_DEC, "fd.peer_fd", "for IPv4 connections between two processes of this machine, and for pipes and unix sockets, the FD number of the other end."},
+	{PT_CHARBUF, EPF_NONE, PF_NA, "fd.peer_proc", "for IPv4 connections between two processes of this machine, and for pipes and unix sockets, the name of the process at the other end."},
+	{PT_RELTIME, EPF_NONE, PF_DEC, "fd.trans_latency", "for the events that complete a request/response transaction on a socket, i.e. the start of the next request or the close, its latency in nanoseconds, from the first request read or write to the last response one."},
+	{PT_UINT64, EPF_NONE, PF_DEC, "fd.trans_count", "number of request/response transactions completed on the socket."},
+	{PT_RELTIME, EPF_NONE, PF_DEC, "fd.trans_p50", "median latency of the transactions of the socket, in nanoseconds."},
+	{PT_RELTIME, EPF_NONE, PF_DEC, "fd.trans_p99", "99th percentile of the latency of the transactions of the socket, in nanoseconds."},
+	{PT_RELTIME, EPF_NONE, PF_DEC, "fd.port_trans_p50", "median latency of the transactions of all the sockets with the same server port, seen from the same end (client or server) as this one, in nanoseconds."},
+	{PT_RELTIME, EPF_NONE, PF_DEC, "fd.port_trans_p99", "99th percentile of the latency of the transactions of all the sockets with the same server port, seen from the same end (client or server) as this one, in nanoseconds."},
+	{PT_CHARBUF, EPF_NONE, PF_NA, "fd.l7proto", "the application protocol decoded from the data of a TCP socket, based on its server port. Can be 'http', 'redis' or 'mysql'."},
+	{PT_CHARBUF, EPF_NONE, PF_NA, "fd.l7cmd", "the command of the last request decoded on the socket: the HTTP method, or the Redis or MySQL command, e.g. 'GET' or 'QUERY'."},
+	{PT_CHARBUF, EPF_NONE, PF_NA, "fd.l7arg", "the argument of the last request decoded on the socket: the HTTP URL, the Redis key or the MySQL query. Only the start of it is kept, and it can be further truncated by the snaplen."},
+	{PT_UINT32, EPF_NONE, PF_DEC, "fd.l7status", "the HTTP status code of the response to the last request decoded on the socket, or the MySQL error code if it failed."},
+	{PT_BOOL, EPF_NONE, PF_NA, "fd.l7error", "'true' if the response to the last request decoded on the socket is an error, i.e. an HTTP status of 400 or more, a Redis error reply or a MySQL error packet."},
+	{PT_BOOL, EPF_NONE, PF_NA, "fd.is_stale", "'true' if the FD was opened before some events of the capture were lost, so that its information can be out of date."},
+	{PT_UINT64, EPF_NONE, PF_DEC, "fd.offset", "for regular files, the offset of the FD, i.e. where its next read or write starts. Only known if the file was opened during the capture, or after an lseek."},
+	{PT_BOOL, EPF_NONE, PF_NA, "fd.ioseq", "for the reads and writes of regular files, 'true' if the event started where the previous read or write of the FD ended."},
+	{PT_UINT64, EPF_NONE, PF_DEC, "fd.seqops", "for regular files, the number of reads and writes of the FD that started where the previous one ended."},
+	{PT_UINT64, EPF_NONE, PF_DEC, "fd.randops", "for regular files, the number of reads and writes of the FD that didn't start where the previous one ended."},
+	{PT_UINT32, EPF_NONE, PF_DEC, "fd.seqpct", "for regular files, the percentage of the reads and writes of the FD that were sequential, among the ones that could be classified."},
+	{PT_CHARBUF, EPF_NONE, PF_NA, "fd.iosizes", "for regular files, the number of reads and writes of the FD by size, e.g. '<1K:10 <4K:2 >=4M:1'."},
 };
 
 sinsp_filter_check_fd::sinsp_filter_check_fd()
@@ -207,10 +229,24 @@ uint8_t* sinsp_filter_check_fd::extract(sinsp_evt *evt, OUT uint32_t* len)
 	switch(m_field_id)
 	{
 	case TYPE_FDNAME:
-		m_tstr = m_fdinfo->m_name;
-		m_tstr.erase(remove_if(m_tstr.begin(), m_tstr.end(), g_invalidchar()), m_tstr.end());
+		{
+			const string& name = m_fdinfo->m_name;
+
+			//
+			// Almost all the names have nothing to sanitize: return the
+			// pooled string itself, which stays alive at least until the
+			// next event
+			//
+			if(m_fdinfo->m_name.is_printable())
+			{
+				return (uint8_t*)name.c_str();
+			}
 
-		return (uint8_t*)m_tstr.c_str();
+			char* sanitized_str = (char*)m_inspector->get_evt_arena()->alloc(name.length() + 1);
+
+			*remove_copy_if(name.begin(), name.end(), sanitized_str, g_invalidchar()) = 0;
+			return (uint8_t*)sanitized_str;
+		}
 	case TYPE_FDTYPE:
 		return extract_fdtype(m_fdinfo);
 	case TYPE_FDTYPECHAR:
@@ -333,11 +369,248 @@ uint8_t* sinsp_filter_check_fd::extract(sinsp_evt *evt, OUT uint32_t* len)
 		}
 	case TYPE_IS_SERVER:
 		{
-			m_tbool = 
-				m_inspector->get_ifaddr_list()->is_ipv4addr_in_local_machine(m_fdinfo->m_sockinfo.m_ipv4info.m_fields.m_dip);
+			m_tbool = m_fdinfo->is_dip_local(m_inspector);
 			return (uint8_t*)&m_tbool;
 		}
 		break;
+	case TYPE_PEER_PID:
+	case TYPE_PEER_TID:
+	case TYPE_PEER_FD:
+		{
+			int64_t pid;
+			int64_t tid;
+			int64_t fd;
+
+			if(!get_peer(&pid, &tid, &fd))
+			{
+				return NULL;
+			}
+
+			if(m_field_id == TYPE_PEER_PID)
+			{
+				m_s64val = SCAP_TID_LOCAL(pid);
+			}
+			else if(m_field_id == TYPE_PEER_TID)
+			{
+				m_s64val = SCAP_TID_LOCAL(tid);
+			}
+			else
+			{
+				m_s64val = fd;
+			}
+
+			return (uint8_t*)&m_s64val;
+		}
+		break;
+	case TYPE_PEER_PROC:
+		{
+			int64_t pid;
+			int64_t tid;
+			int64_t fd;
+
+			if(!get_peer(&pid, &tid, &fd))
+			{
+				return NULL;
+			}
+
+			sinsp_threadinfo* ptinfo = m_inspector->get_thread(tid);
+
+			if(ptinfo == NULL)
+			{
+				return NULL;
+			}
+
+			m_tstr = ptinfo->get_comm();
+			return (uint8_t*)m_tstr.c_str();
+		}
+		break;
+	case TYPE_TRANS_LATENCY:
+		if(!m_inspector->get_transactions()->get_completed_latency(evt->get_num(),
+			m_tinfo->m_pid,
+			m_tinfo->m_lastevent_fd,
+			&m_u64val))
+		{
+			return NULL;
+		}
+
+		return (uint8_t*)&m_u64val;
+	case TYPE_TRANS_COUNT:
+		if(m_fdinfo->has_no_role())
+		{
+			return NULL;
+		}
+
+		m_u64val = (m_fdinfo->m_cold.get() != NULL)? m_fdinfo->m_cold.get()->m_trans_count : 0;
+		return (uint8_t*)&m_u64val;
+	case TYPE_TRANS_P50:
+	case TYPE_TRANS_P99:
+	case TYPE_PORT_TRANS_P50:
+	case TYPE_PORT_TRANS_P99:
+		{
+			sinsp_latency_histogram* histo;
+
+			if(m_fdinfo->has_no_role())
+			{
+				return NULL;
+			}
+
+			if(m_field_id == TYPE_TRANS_P50 || m_field_id == TYPE_TRANS_P99)
+			{
+				histo = m_inspector->get_transactions()->get_fd_histogram(m_tinfo->m_pid, m_tinfo->m_lastevent_fd);
+			}
+			else
+			{
+				histo = m_inspector->get_transactions()->get_port_histogram(m_fdinfo);
+			}
+
+			if(histo == NULL)
+			{
+				return NULL;
+			}
+
+			if(m_field_id == TYPE_TRANS_P50 || m_field_id == TYPE_PORT_TRANS_P50)
+			{
+				m_u64val = histo->get_percentile(0.5);
+			}
+			else
+			{
+				m_u64val = histo->get_percentile(0.99);
+			}
+
+			return (uint8_t*)&m_u64val;
+		}
+		break;
+	case TYPE_L7PROTO:
+	case TYPE_L7CMD:
+	case TYPE_L7ARG:
+	case TYPE_L7STATUS:
+	case TYPE_L7ERROR:
+		{
+			if(m_fdinfo->m_cold.get() == NULL)
+			{
+				return NULL;
+			}
+
+			sinsp_protoinfo* info = &m_fdinfo->m_cold.get()->m_protoinfo;
+
+			if(info->m_proto == SINSP_L7_NONE)
+			{
+				return NULL;
+			}
+
+			if(m_field_id == TYPE_L7PROTO)
+			{
+				return (uint8_t*)m_inspector->get_protocol_decoders()->get_proto_name((sinsp_l7_proto)info->m_proto);
+			}
+
+			if(info->m_cmd[0] == 0)
+			{
+				return NULL;
+			}
+
+			switch(m_field_id)
+			{
+			case TYPE_L7CMD:
+				return (uint8_t*)info->m_cmd;
+			case TYPE_L7ARG:
+				return (uint8_t*)info->m_arg;
+			case TYPE_L7STATUS:
+				if(info->m_state != sinsp_protoinfo::PS_RESPONSE || info->m_status == 0)
+				{
+					return NULL;
+				}
+
+				m_u32val = info->m_status;
+				return (uint8_t*)&m_u32val;
+			default:
+				if(info->m_state != sinsp_protoinfo::PS_RESPONSE)
+				{
+					return NULL;
+				}
+
+				m_tbool = (info->m_flags & sinsp_protoinfo::PIF_ERROR) != 0;
+				return (uint8_t*)&m_tbool;
+			}
+		}
+		break;
+	case TYPE_ISSTALE:
+		m_tbool = m_tinfo->is_fd_stale(m_fdinfo);
+		return (uint8_t*)&m_tbool;
+	case TYPE_OFFSET:
+	case TYPE_IOSEQ:
+	case TYPE_SEQOPS:
+	case TYPE_RANDOPS:
+	case TYPE_SEQPCT:
+	case TYPE_IOSIZES:
+		{
+			sinsp_access_pattern* access = &m_fdinfo->m_access;
+
+			if(m_fdinfo->m_type != SCAP_FD_FILE)
+			{
+				return NULL;
+			}
+
+			switch(m_field_id)
+			{
+			case TYPE_OFFSET:
+				if(!access->m_offset_known)
+				{
+					return NULL;
+				}
+
+				m_u64val = access->m_offset;
+				return (uint8_t*)&m_u64val;
+			case TYPE_IOSEQ:
+				if(evt->get_direction() != SCAP_ED_OUT ||
+					!(evt->get_flags() & (EF_READS_FROM_FD | EF_WRITES_TO_FD)) ||
+					!access->m_last_known)
+				{
+					return NULL;
+				}
+
+				m_tbool = access->m_last_seq;
+				return (uint8_t*)&m_tbool;
+			case TYPE_SEQOPS:
+				m_u64val = access->m_seq_ops;
+				return (uint8_t*)&m_u64val;
+			case TYPE_RANDOPS:
+				m_u64val = access->m_rand_ops;
+				return (uint8_t*)&m_u64val;
+			case TYPE_SEQPCT:
+				if(access->m_seq_ops + access->m_rand_ops == 0)
+				{
+					return NULL;
+				}
+
+				m_u32val = (uint32_t)(access->m_seq_ops * 100 / (access->m_seq_ops + access->m_rand_ops));
+				return (uint8_t*)&m_u32val;
+			default:
+				{
+					static const char* names[SINSP_IO_SIZE_BUCKETS] = {"<1K", "<4K", "<16K", "<64K", "<256K", "<1M", "<4M", ">=4M"};
+					char buf[32];
+
+					m_tstr.clear();
+
+					for(uint32_t j = 0; j < SINSP_IO_SIZE_BUCKETS; j++)
+					{
+						if(access->m_sizes[j] == 0)
+						{
+							continue;
+						}
+
+						snprintf(buf, sizeof(buf), "%s%s:%u", m_tstr.empty()? "" : " ", names[j], access->m_sizes[j]);
+						m_tstr += buf;
+					}
+
+					if(m_tstr.empty())
+					{
+						return NULL;
+					}
+
+					return (uint8_t*)m_tstr.c_str();
+				}
+			}
+		}
 	default:
 		ASSERT(false);
 	}
@@ -345,6 +618,99 @@ uint8_t* sinsp_filter_check_fd::extract(sinsp_evt *evt, OUT uint32_t* len)
 	return NULL;
 }
 
+//
+// Look up the other end of the connection of m_fdinfo in the connection
+// table. Returns NULL if the fd is not an IPv4 connection, or if its other
+// end is not a process of this machine.
+//
+bool sinsp_filter_check_fd::get_peer(OUT int64_t* pid, OUT int64_t* tid, OUT int64_t* fd)
+{
+	//
+	// The peers of the pipes and unix sockets are in the ipc index. Their
+	// thread is the main thread of the process.
+	//
+	if(m_fdinfo->m_type == SCAP_FD_FIFO || m_fdinfo->m_type == SCAP_FD_UNIX_SOCK)
+	{
+		if(!m_inspector->get_ipc_peer(m_tinfo->m_pid, m_tinfo->m_lastevent_fd, m_fdinfo, pid, fd))
+		{
+			return false;
+		}
+
+		*tid = *pid;
+		return true;
+	}
+
+	if(m_fdinfo->is_role_none())
+	{
+		return false;
+	}
+
+	sinsp_connection* conn;
+
+	if(m_fdinfo->m_type == SCAP_FD_IPV4_SOCK)
+	{
+		conn = m_inspector->get_connection(m_fdinfo->m_sockinfo.m_ipv4info);
+	}
+	else if(m_fdinfo->m_type == SCAP_FD_IPV6_SOCK)
+	{
+		conn = m_inspector->get_connection(m_fdinfo->m_sockinfo.m_ipv6info);
+	}
+	else
+	{
+		return false;
+	}
+
+	if(conn == NULL)
+	{
+		return false;
+	}
+
+	if(m_fdinfo->is_role_client())
+	{
+		if(!conn->has_server())
+		{
+			return false;
+		}
+
+		*pid = conn->m_spid;
+		*tid = conn->m_stid;
+		*fd = conn->m_sfd;
+	}
+	else
+	{
+		if(!conn->has_client())
+		{
+			return false;
+		}
+
+		*pid = conn->m_cpid;
+		*tid = conn->m_ctid;
+		*fd = conn->m_cfd;
+	}
+
+	return true;
+}
+
+bool sinsp_filter_check_fd::ip_matches(uint32_t ip)
+{
+	if(m_cmpop == CO_IN)
+	{
+		return m_val_set.contains((uint8_t*)&ip, sizeof(ip));
+	}
+
+	return ip == *(uint32_t*)&m_val_storage[0];
+}
+
+bool sinsp_filter_check_fd::port_matches(uint16_t port)
+{
+	if(m_cmpop == CO_IN)
+	{
+		return m_val_set.contains((uint8_t*)&port, sizeof(port));
+	}
+
+	return port == *(uint16_t*)&m_val_storage[0];
+}
+
 bool sinsp_filter_check_fd::compare_ip(sinsp_evt *evt)
 {
 	if(!extract_fd(evt))
@@ -358,10 +724,10 @@ bool sinsp_filter_check_fd::compare_ip(sinsp_evt *evt)
 
 		if(evt_type == SCAP_FD_IPV4_SOCK)
 		{
-			if(m_cmpop == CO_EQ)
+			if(m_cmpop == CO_EQ || m_cmpop == CO_IN)
 			{
-				if(flt_compare(m_cmpop, PT_IPV4ADDR, &m_fdinfo->m_sockinfo.m_ipv4info.m_fields.m_sip, &m_val_storage[0]) ||
-					flt_compare(m_cmpop, PT_IPV4ADDR, &m_fdinfo->m_sockinfo.m_ipv4info.m_fields.m_dip, &m_val_storage[0]))
+				if(ip_matches(m_fdinfo->m_sockinfo.m_ipv4info.m_fields.m_sip) ||
+					ip_matches(m_fdinfo->m_sockinfo.m_ipv4info.m_fields.m_dip))
 				{
 					return true;
 				}
@@ -376,12 +742,12 @@ bool sinsp_filter_check_fd::compare_ip(sinsp_evt *evt)
 			}
 			else
 			{
-				throw sinsp_exception("filter error: IP filter only supports '=' and '!=' operators");
+				throw sinsp_exception("filter error: IP filter only supports '=', '!=' and 'in' operators");
 			}
 		}
 		else if(evt_type == SCAP_FD_IPV4_SERVSOCK)
 		{
-			if(m_fdinfo->m_sockinfo.m_ipv4serverinfo.m_ip == *(uint32_t*)&m_val_storage[0])
+			if(ip_matches(m_fdinfo->m_sockinfo.m_ipv4serverinfo.m_ip))
 			{
 				return true;
 			}
@@ -404,10 +770,10 @@ bool sinsp_filter_check_fd::compare_port(sinsp_evt *evt)
 
 		if(evt_type == SCAP_FD_IPV4_SOCK)
 		{
-			if(m_cmpop == CO_EQ)
+			if(m_cmpop == CO_EQ || m_cmpop == CO_IN)
 			{
-				if(m_fdinfo->m_sockinfo.m_ipv4info.m_fields.m_sport == *(uint16_t*)&m_val_storage[0] ||
-					m_fdinfo->m_sockinfo.m_ipv4info.m_fields.m_dport == *(uint16_t*)&m_val_storage[0])
+				if(port_matches(m_fdinfo->m_sockinfo.m_ipv4info.m_fields.m_sport) ||
+					port_matches(m_fdinfo->m_sockinfo.m_ipv4info.m_fields.m_dport))
 				{
 					return true;
 				}
@@ -422,27 +788,27 @@ bool sinsp_filter_check_fd::compare_port(sinsp_evt *evt)
 			}
 			else
 			{
-				throw sinsp_exception("filter error: IP filter only supports '=' and '!=' operators");
+				throw sinsp_exception("filter error: IP filter only supports '=', '!=' and 'in' operators");
 			}
 		}
 		else if(evt_type == SCAP_FD_IPV4_SERVSOCK)
 		{
-			if(m_fdinfo->m_sockinfo.m_ipv4serverinfo.m_port == *(uint16_t*)&m_val_storage[0])
+			if(port_matches(m_fdinfo->m_sockinfo.m_ipv4serverinfo.m_port))
 			{
 				return true;
 			}
 		}
 		else if(evt_type == SCAP_FD_IPV6_SOCK)
 		{
-			if(m_fdinfo->m_sockinfo.m_ipv6info.m_fields.m_sport == *(uint16_t*)&m_val_storage[0] ||
-				m_fdinfo->m_sockinfo.m_ipv6info.m_fields.m_dport == *(uint16_t*)&m_val_storage[0])
+			if(port_matches(m_fdinfo->m_sockinfo.m_ipv6info.m_fields.m_sport) ||
+				port_matches(m_fdinfo->m_sockinfo.m_ipv6info.m_fields.m_dport))
 			{
 				return true;
 			}
 		}
 		else if(evt_type == SCAP_FD_IPV6_SERVSOCK)
 		{
-			if(m_fdinfo->m_sockinfo.m_ipv6serverinfo.m_port == *(uint16_t*)&m_val_storage[0])
+			if(port_matches(m_fdinfo->m_sockinfo.m_ipv6serverinfo.m_port))
 			{
 				return true;
 			}
@@ -487,6 +853,25 @@ bool sinsp_filter_check_fd::extract_fd(sinsp_evt *evt)
 	return true;
 }
 
+//
+// fd.port is compared with the client and the server port, which are both
+// summarized as ports
+//
+bool sinsp_filter_check_fd::may_match_block(const scap_block_summary* summary)
+{
+	switch(m_field_id)
+	{
+	case TYPE_FDNAME:
+		return may_match_keys(summary, SCAP_SUMMARY_FDNAME);
+	case TYPE_PORT:
+	case TYPE_CLIENTPORT:
+	case TYPE_SERVERPORT:
+		return may_match_keys(summary, SCAP_SUMMARY_PORT);
+	default:
+		return true;
+	}
+}
+
 bool sinsp_filter_check_fd::compare(sinsp_evt *evt)
 {
 	//
@@ -512,23 +897,79 @@ bool sinsp_filter_check_fd::compare(sinsp_evt *evt)
 		return false;
 	}
 
-	return flt_compare(m_cmpop, 
-		m_info.m_fields[m_field_id].m_type, 
-		extracted_val, 
-		&m_val_storage[0]);
+	if(m_cmpop == CO_IN)
+	{
+		return m_val_set.contains(extracted_val, len);
+	}
+	else if(m_cmpop == CO_MATCHES)
+	{
+		return regex_matches(m_info.m_fields[m_field_id].m_type, extracted_val, len);
+	}
+
+	return m_cmp(m_cmpop,
+		m_info.m_fields[m_field_id].m_type,
+		extracted_val,
+		&m_val_storage[0],
+		len,
+		m_val_storage_len);
 }
 
 char* sinsp_filter_check_fd::tostring(sinsp_evt* evt)
 {
 	uint32_t len;
 
-	uint8_t* rawval = extract(evt, &len);
+	uint8_t* rawval = extract_cached(evt, &len);
 
 	if(rawval == NULL)
 	{
 		return NULL;
 	}
 
+	sinsp_name_resolver* resolver = m_inspector->get_name_resolver();
+
+	if(resolver != NULL &&
+		(m_field_id == TYPE_FDNAME ||
+		m_field_id == TYPE_CLIENTIP || m_field_id == TYPE_SERVERIP ||
+		m_field_id == TYPE_CLIENTPORT || m_field_id == TYPE_SERVERPORT))
+	{
+		//
+		// The cached value may come from another check, so the fd of this
+		// event is looked up again
+		//
+		if(extract_fd(evt) && m_fdinfo != NULL && m_fdinfo->m_type == SCAP_FD_IPV4_SOCK)
+		{
+			ipv4tuple* tuple = &m_fdinfo->m_sockinfo.m_ipv4info;
+			uint8_t l4proto = tuple->m_fields.m_l4proto;
+
+			if(l4proto == SCAP_L4_TCP || l4proto == SCAP_L4_UDP)
+			{
+				m_tstr.clear();
+
+				switch(m_field_id)
+				{
+				case TYPE_FDNAME:
+					resolver->append_host(tuple->m_fields.m_sip, &m_tstr);
+					m_tstr += ':';
+					resolver->append_port(tuple->m_fields.m_sport, l4proto, &m_tstr);
+					m_tstr += "->";
+					resolver->append_host(tuple->m_fields.m_dip, &m_tstr);
+					m_tstr += ':';
+					resolver->append_port(tuple->m_fields.m_dport, l4proto, &m_tstr);
+					break;
+				case TYPE_CLIENTIP:
+				case TYPE_SERVERIP:
+					resolver->append_host(*(uint32_t*)rawval, &m_tstr);
+					break;
+				default:
+					resolver->append_port(*(uint16_t*)rawval, l4proto, &m_tstr);
+					break;
+				}
+
+				return (char*)m_tstr.c_str();
+			}
+		}
+	}
+
 	return rawval_to_string(rawval, m_field, len);
 }
 
@@ -546,7 +987,20 @@ const filtercheck_field_info sinsp_filter_check_thread_fields[] =
 	{PT_CHARBUF, EPF_NONE, PF_NA, "proc.parentname", "the name (excluding the path) of the parent of the process generating the event."},
 	{PT_INT64, EPF_NONE, PF_DEC, "thread.tid", "the id of the thread generating the event."},
 	{PT_BOOL, EPF_NONE, PF_NA, "thread.ismain", "'true' if the thread generating the event is the main one in the process."},
-	{PT_RELTIME, EPF_NONE, PF_DEC, "thread.exectime", "Thread execution time. Exported only by switch events."},
+	{PT_RELTIME, EPF_NONE, PF_DEC, "thread.exectime", "Thread execution time. Exported only by switch events. With switch summaries, the CPU time since the previous summary of the thread."},
+	{PT_UINT64, EPF_NONE, PF_DEC, "thread.vcsw", "Voluntary context switches of the thread since its previous switch summary. Exported only by switch summary events."},
+	{PT_UINT64, EPF_NONE, PF_DEC, "thread.ivcsw", "Involuntary context switches of the thread since its previous switch summary. Exported only by switch summary events."},
+	{PT_INT64, EPF_NONE, PF_DEC, "proc.apid", "the pid of an ancestor of the process generating the event. proc.apid[1] is the parent, proc.apid[2] the grandparent and so on, and proc.apid is the parent. In filters, proc.apid without an index matches if any ancestor matches, e.g. proc.apid=1234 selects all the descendants of 1234."},
+	{PT_CHARBUF, EPF_NONE, PF_NA, "proc.aname", "the name (excluding the path) of an ancestor of the process generating the event, with the same indexes as proc.apid. In filters, proc.aname without an index matches if any ancestor matches, e.g. proc.aname=sshd selects all the processes started from an ssh session."},
+	{PT_BOOL, EPF_NONE, PF_NA, "thread.is_stale", "'true' if some events of the capture were lost since the thread was first seen, so that its information, and the one of its FDs, can be out of date."},
+	{PT_RELTIME, EPF_NONE, PF_DEC, "thread.runqdelay", "Time the thread spent runnable, waiting for a CPU, since its previous runq event. Exported only by runq events, see sysdig --runq-summary."},
+	{PT_UINT32, EPF_NONE, PF_DEC, "thread.runqwaits", "Number of times the thread waited for a CPU since its previous runq event. Exported only by runq events."},
+	{PT_RELTIME, EPF_NONE, PF_DEC, "thread.runqmax", "Longest wait of the thread for a CPU since its previous runq event. Exported only by runq events."},
+	{PT_UINT64, EPF_NONE, PF_DEC, "thread.pfmajor", "Major page faults of the thread since its previous pgfault event. Exported only by pgfault events, see sysdig --pgfault-summary."},
+	{PT_UINT64, EPF_NONE, PF_DEC, "thread.pfminor", "Minor page faults of the thread since its previous pgfault event. Exported only by pgfault events."},
+	{PT_UINT64, EPF_NONE, PF_HEX, "thread.pfaddr", "Address of the last page fault of the thread before its pgfault event, where the driver can trace the faults. Exported only by pgfault events."},
+	{PT_UINT64, EPF_NONE, PF_DEC, "proc.pfmajor", "Major page faults of the process in the pgfault events of its threads since the beginning of the capture."},
+	{PT_UINT64, EPF_NONE, PF_DEC, "proc.pfminor", "Minor page faults of the process in the pgfault events of its threads since the beginning of the capture."},
 //	{PT_UINT64, EPF_NONE, PF_DEC, "iobytes", "I/O bytes (either read or write) generated by I/O calls like read, write, send receive..."},
 //	{PT_UINT64, EPF_NONE, PF_DEC, "totiobytes", "aggregated number of I/O bytes (either read or write) since the beginning of the capture."},
 //	{PT_RELTIME, EPF_NONE, PF_DEC, "latency", "number of nanoseconds spent in the last system call."},
@@ -560,6 +1014,9 @@ sinsp_filter_check_thread::sinsp_filter_check_thread()
 	m_info.m_nfiedls = sizeof(sinsp_filter_check_thread_fields) / sizeof(sinsp_filter_check_thread_fields[0]);
 
 	m_u64val = 0;
+	m_s64val = 0;
+	m_argid = -1;
+	m_ancestor_generation = 0;
 }
 
 sinsp_filter_check* sinsp_filter_check_thread::allocate_new()
@@ -578,12 +1035,52 @@ int32_t sinsp_filter_check_thread::parse_field_name(const char* str)
 		//
 		throw sinsp_exception("filter error: proc.arg filter not implemented yet");
 	}
+	else if(string(val, 0, sizeof("proc.apid") - 1) == "proc.apid")
+	{
+		m_field_id = TYPE_APID;
+		m_field = &m_info.m_fields[m_field_id];
+
+		return extract_ancestor_level("proc.apid", val);
+	}
+	else if(string(val, 0, sizeof("proc.aname") - 1) == "proc.aname")
+	{
+		m_field_id = TYPE_ANAME;
+		m_field = &m_info.m_fields[m_field_id];
+
+		return extract_ancestor_level("proc.aname", val);
+	}
 	else
 	{
 		return sinsp_filter_check::parse_field_name(str);
 	}
 }
 
+int32_t sinsp_filter_check_thread::extract_ancestor_level(const string& fldname, const string& val)
+{
+	if(val.size() == fldname.size() || val[fldname.size()] != '[')
+	{
+		m_argid = -1;
+		return fldname.size();
+	}
+
+	size_t parsed_len = val.find(']');
+
+	if(parsed_len == string::npos)
+	{
+		throw sinsp_exception("filter syntax error: " + val);
+	}
+
+	string numstr = val.substr(fldname.size() + 1, parsed_len - fldname.size() - 1);
+	m_argid = sinsp_numparser::parsed32(numstr);
+
+	if(m_argid < 0)
+	{
+		throw sinsp_exception("invalid ancestor level in " + val);
+	}
+
+	return parsed_len + 1;
+}
+
 uint8_t* sinsp_filter_check_thread::extract(sinsp_evt *evt, OUT uint32_t* len)
 {
 	sinsp_threadinfo* tinfo = evt->get_thread_info();
@@ -595,40 +1092,43 @@ uint8_t* sinsp_filter_check_thread::extract(sinsp_evt *evt, OUT uint32_t* len)
 		return NULL;
 	}
 
+	//
+	// The ids of the merged captures are shown as they were on their
+	// machine, see sinsp::open(const vector<string>&)
+	//
 	switch(m_field_id)
 	{
 	case TYPE_TID:
-		m_u64val = evt->get_tid();
+		m_u64val = SCAP_TID_LOCAL(evt->get_tid());
 		return (uint8_t*)&m_u64val;
 	case TYPE_PID:
-		return (uint8_t*)&tinfo->m_pid;
+		m_s64val = SCAP_TID_LOCAL(tinfo->m_pid);
+		return (uint8_t*)&m_s64val;
 	case TYPE_NAME:
-		m_tstr = tinfo->get_comm();
-		return (uint8_t*)m_tstr.c_str();
+		return (uint8_t*)tinfo->get_comm().c_str();
 	case TYPE_EXE:
-		m_tstr = tinfo->get_exe();
-		return (uint8_t*)m_tstr.c_str();
+		return (uint8_t*)tinfo->get_exe().c_str();
 	case TYPE_ARGS:
 		{
-			m_tstr.clear();
-
-			uint32_t j;
-			uint32_t nargs = tinfo->m_args.size();
+			//
+			// The arguments separated by spaces, straight from the ones
+			// separated by terminators, without splitting them
+			//
+			const sinsp_pooled_string& args = tinfo->get_raw_args();
+			size_t len = args.length();
 
-			for(j = 0; j < nargs; j++)
+			if(len != 0 && args[len - 1] == 0)
 			{
-				m_tstr += tinfo->m_args[j];
-				if(j < nargs -1)
-				{
-					m_tstr += ' ';
-				}
+				len--;
 			}
 
+			m_tstr.assign(args.c_str(), len);
+			replace(m_tstr.begin(), m_tstr.end(), '\0', ' ');
+
 			return (uint8_t*)m_tstr.c_str();
 		}
 	case TYPE_CWD:
-		m_tstr = tinfo->get_cwd();
-		return (uint8_t*)m_tstr.c_str();
+		return (uint8_t*)tinfo->get_cwd().c_str();
 	case TYPE_ISMAINTHREAD:
 		m_tbool = (uint32_t)tinfo->is_main_thread();
 		return (uint8_t*)&m_tbool;
@@ -637,7 +1137,14 @@ uint8_t* sinsp_filter_check_thread::extract(sinsp_evt *evt, OUT uint32_t* len)
 			m_u64val = 0;
 			uint16_t etype = evt->get_type();
 
-			if(etype == PPME_SCHEDSWITCH_E || etype == PPME_SCHEDSWITCHEX_X)
+			if(etype == PPME_SCHEDSWITCH_SUMMARY_E)
+			{
+				if(tinfo != NULL)
+				{
+					m_u64val = tinfo->m_switch_exectime_delta;
+				}
+			}
+			else if(etype == PPME_SCHEDSWITCH_E || etype == PPME_SCHEDSWITCHEX_X)
 			{
 				if(m_last_proc_switch_times.size() == 0)
 				{
@@ -667,17 +1174,104 @@ uint8_t* sinsp_filter_check_thread::extract(sinsp_evt *evt, OUT uint32_t* len)
 				m_last_proc_switch_times[cpuid] = ts;
 			}
 
+			return (uint8_t*)&m_u64val;
+		}
+	case TYPE_VCSW:
+	case TYPE_IVCSW:
+		if(evt->get_type() != PPME_SCHEDSWITCH_SUMMARY_E)
+		{
+			return NULL;
+		}
+
+		m_u64val = (m_field_id == TYPE_VCSW)? tinfo->m_switch_vcsw_delta : tinfo->m_switch_ivcsw_delta;
+		return (uint8_t*)&m_u64val;
+	case TYPE_APID:
+	case TYPE_ANAME:
+		{
+			sinsp_proc_tree_node* node = m_inspector->get_proc_tree()->get_node(tinfo->m_pid);
+
+			if(node == NULL)
+			{
+				return NULL;
+			}
+
+			node = sinsp_proc_tree::get_ancestor(node, (m_argid == -1)? 1 : m_argid);
+
+			if(node == NULL)
+			{
+				return NULL;
+			}
+
+			if(m_field_id == TYPE_APID)
+			{
+				m_s64val = SCAP_TID_LOCAL(node->m_pid);
+				return (uint8_t*)&m_s64val;
+			}
+
+			return (uint8_t*)node->m_comm.c_str();
+		}
+	case TYPE_ISSTALE:
+		m_tbool = tinfo->is_stale();
+		return (uint8_t*)&m_tbool;
+	case TYPE_RUNQDELAY:
+	case TYPE_RUNQMAX:
+		if(evt->get_type() != PPME_RUNQ_E)
+		{
+			return NULL;
+		}
+
+		m_u64val = evt->get_param_value<uint64_t>((m_field_id == TYPE_RUNQDELAY)? 0 : 2);
+		return (uint8_t*)&m_u64val;
+	case TYPE_RUNQWAITS:
+		if(evt->get_type() != PPME_RUNQ_E)
+		{
+			return NULL;
+		}
+
+		m_u32val = evt->get_param_value<uint32_t>(1);
+		return (uint8_t*)&m_u32val;
+	case TYPE_PFMAJOR:
+	case TYPE_PFMINOR:
+		if(evt->get_type() != PPME_PGFAULT_E)
+		{
+			return NULL;
+		}
+
+		m_u64val = evt->get_param_value<uint64_t>((m_field_id == TYPE_PFMAJOR)? 0 : 1);
+		return (uint8_t*)&m_u64val;
+	case TYPE_PFADDR:
+		if(evt->get_type() != PPME_PGFAULT_E)
+		{
+			return NULL;
+		}
+
+		m_u64val = evt->get_param_value<uint64_t>(2);
+		if(m_u64val == 0)
+		{
+			return NULL;
+		}
+
+		return (uint8_t*)&m_u64val;
+	case TYPE_PROC_PFMAJOR:
+	case TYPE_PROC_PFMINOR:
+		{
+			sinsp_threadinfo* mtinfo = tinfo->get_main_thread();
+
+			if(mtinfo == NULL)
+			{
+				return NULL;
+			}
+
+			m_u64val = (m_field_id == TYPE_PROC_PFMAJOR)? mtinfo->m_pfmajor : mtinfo->m_pfminor;
 			return (uint8_t*)&m_u64val;
 		}
 	case TYPE_PARENTNAME:
 		{
-			sinsp_threadinfo* ptinfo = 
-				m_inspector->get_thread(tinfo->m_ptid);
+			sinsp_threadinfo* ptinfo = tinfo->get_parent_thread();
 
 			if(ptinfo != NULL)
 			{
-				m_tstr = ptinfo->get_comm();
-				return (uint8_t*)m_tstr.c_str();
+				return (uint8_t*)ptinfo->get_comm().c_str();
 			}
 			else
 			{
@@ -743,8 +1337,125 @@ uint8_t* sinsp_filter_check_thread::extract(sinsp_evt *evt, OUT uint32_t* len)
 		ASSERT(false);
 		return NULL;
 	}
-}
+}
+
+
+bool sinsp_filter_check_thread::may_match_block(const scap_block_summary* summary)
+{
+	switch(m_field_id)
+	{
+	case TYPE_TID:
+		return may_match_keys(summary, SCAP_SUMMARY_TID);
+	case TYPE_PID:
+		return may_match_keys(summary, SCAP_SUMMARY_PID);
+	case TYPE_NAME:
+		return may_match_keys(summary, SCAP_SUMMARY_COMM);
+	default:
+		return true;
+	}
+}
+
+bool sinsp_filter_check_thread::compare(sinsp_evt *evt)
+{
+	if(is_any_ancestor_check())
+	{
+		return compare_ancestors(evt);
+	}
+
+	return sinsp_filter_check::compare(evt);
+}
+
+bool sinsp_filter_check_thread::compare_value(uint8_t* val, uint32_t len)
+{
+	if(m_cmpop == CO_IN)
+	{
+		return m_val_set.contains(val, len);
+	}
+	else if(m_cmpop == CO_MATCHES)
+	{
+		return regex_matches(m_info.m_fields[m_field_id].m_type, val, len);
+	}
+
+	return m_cmp(m_cmpop,
+		m_info.m_fields[m_field_id].m_type,
+		val,
+		&m_val_storage[0],
+		len,
+		m_val_storage_len);
+}
+
+//
+// The ancestors of a process never change, so whether one of them matches
+// is computed once per process, from the answer for its parent: a new
+// process costs a single comparison, with its parent.
+//
+bool sinsp_filter_check_thread::compare_ancestors(sinsp_evt *evt)
+{
+	sinsp_threadinfo* tinfo = evt->get_thread_info();
+
+	if(tinfo == NULL)
+	{
+		return false;
+	}
+
+	sinsp_proc_tree* tree = m_inspector->get_proc_tree();
+	sinsp_proc_tree_node* node = tree->get_node(tinfo->m_pid);
+
+	if(node == NULL)
+	{
+		return false;
+	}
+
+	if(m_ancestor_generation != tree->get_generation() ||
+		m_ancestor_matches.size() >= PROC_TREE_ANCESTOR_CACHE_SIZE)
+	{
+		m_ancestor_matches.clear();
+		m_ancestor_generation = tree->get_generation();
+	}
+
+	//
+	// Go up to the first node with a known answer, then compute the answers
+	// of the ones below it
+	//
+	vector<sinsp_proc_tree_node*> path;
+	sinsp_proc_tree_node* above = node;
+	bool res = false;
+
+	while(above != NULL)
+	{
+		unordered_map<uint64_t, bool>::iterator it = m_ancestor_matches.find(above->m_id);
+
+		if(it != m_ancestor_matches.end())
+		{
+			res = it->second;
+			break;
+		}
+
+		path.push_back(above);
+		above = above->m_parent;
+	}
+
+	for(vector<sinsp_proc_tree_node*>::reverse_iterator it = path.rbegin(); it != path.rend(); ++it)
+	{
+		if(above != NULL && !res)
+		{
+			if(m_field_id == TYPE_APID)
+			{
+				m_s64val = SCAP_TID_LOCAL(above->m_pid);
+				res = compare_value((uint8_t*)&m_s64val, sizeof(m_s64val));
+			}
+			else
+			{
+				res = compare_value((uint8_t*)above->m_comm.c_str(), 0);
+			}
+		}
+
+		m_ancestor_matches[(*it)->m_id] = res;
+		above = *it;
+	}
 
+	return res;
+}
 ///////////////////////////////////////////////////////////////////////////////
 // sinsp_filter_check_event implementation
 ///////////////////////////////////////////////////////////////////////////////
@@ -777,13 +1488,22 @@ const filtercheck_field_info sinsp_filter_check_event_fields[] =
 	{PT_BOOL, EPF_NONE, PF_NA, "evt.is_io_read", "'true' for events that read from FDs, like read(), recv(), recvfrom(), etc."},
 	{PT_BOOL, EPF_NONE, PF_NA, "evt.is_io_write", "'true' for events that write to FDs, like write(), send(), etc."},
 	{PT_BOOL, EPF_NONE, PF_NA, "evt.is_wait", "'true' for events that make the thread wait, e.g. sleep(), select(), poll()."},
-	{PT_UINT32, EPF_NONE, PF_DEC, "evt.count", "This filter field always returns 1 and can be used to count events from inside chisels."},
+	{PT_UINT32, EPF_NONE, PF_DEC, "evt.count", "The number of events this event stands for: 1, or the number of repeated calls folded into a 'repeat' event (see sysdig --fold). Can be used to count events from inside chisels."},
+	{PT_BOOL, EPF_NONE, PF_NA, "evt.is_after_drop", "'true' for the first event of a CPU after some events were lost, because the buffers were full or because of the sampling of the driver. Conclusions drawn from consecutive events can be wrong across it."},
+	{PT_UINT32, EPF_NONE, PF_DEC, "evt.sampling", "the sampling ratio the event was captured with: 1 if all the events were captured, N if about one out of N was. Multiply counts by it to estimate the real values."},
+	{PT_CHARBUF, EPF_NONE, PF_NA, "evt.host", "the hostname of the machine where the event happened. Useful when several captures are read together, e.g. with more than one -r in sysdig."},
+	{PT_RELTIME, EPF_NONE, PF_DEC, "evt.offcpu", "for exit events, the part of the latency of the system call that the thread spent switched out, i.e. blocked or waiting for a CPU. Needs the context switch events of the capture, and it's 0 without them."},
+	{PT_RELTIME, EPF_NONE, PF_DEC, "evt.oncpu", "for exit events, the part of the latency of the system call that the thread spent running, i.e. evt.latency minus evt.offcpu."},
+	{PT_UINT64, EPF_NONE, PF_HEX, "evt.buffer_hash", "64 bit hash of the data buffer of the I/O events. When the capture was taken with the buffer hash mode (see sysdig --buffer-hash), the driver hashed the first bytes of the buffers and the events carry only the hash. Otherwise it's the hash of the captured bytes of evt.buffer. Equal hashes mean that two reads or writes moved the same data."},
 };
 
 sinsp_filter_check_event::sinsp_filter_check_event()
 {
 	m_first_ts = 0;
 	m_is_compare = false;
+	m_tz_time = 0;
+	m_thiszone = 0;
+	m_date_time = 0;
 	m_info.m_name = "evt";
 	m_info.m_fields = sinsp_filter_check_event_fields;
 	m_info.m_nfiedls = sizeof(sinsp_filter_check_event_fields) / sizeof(sinsp_filter_check_event_fields[0]);
@@ -895,6 +1615,19 @@ void sinsp_filter_check_event::parse_filter_value(const char* str, uint32_t len)
 	}
 }
 
+ppm_param_type sinsp_filter_check_event::get_compare_type()
+{
+	if(m_field_id == TYPE_ARGRAW)
+	{
+		ASSERT(m_arginfo != NULL);
+		return m_arginfo->type;
+	}
+	else
+	{
+		return sinsp_filter_check::get_compare_type();
+	}
+}
+
 const filtercheck_field_info* sinsp_filter_check_event::get_field_info()
 {
 	if(m_field_id == TYPE_ARGRAW)
@@ -935,44 +1668,87 @@ int32_t sinsp_filter_check_event::gmt2local(time_t t)
 	return (dt);
 }
 
+//
+// Write val in exactly ndigits digits, with leading zeros
+//
+static inline char* ts_format_digits(char* buf, uint32_t val, uint32_t ndigits)
+{
+	uint32_t j;
+
+	for(j = ndigits; j > 0; j--)
+	{
+		buf[j - 1] = '0' + (char)(val % 10);
+		val /= 10;
+	}
+
+	return buf + ndigits;
+}
+
 void sinsp_filter_check_event::ts_to_string(uint64_t ts, OUT string* res, bool date, bool ns)
 {
 	struct tm *tm;
 	time_t Time;
+	time_t now = time(NULL);
 	uint64_t sec = ts / ONE_SECOND_IN_NS;
 	uint64_t nsec = ts % ONE_SECOND_IN_NS;
-	int32_t thiszone = gmt2local(0);
-	int32_t s = (sec + thiszone) % 86400;
-	int32_t bufsize = 0;
 	char buf[256];
+	char* end = buf;
+
+	//
+	// The offset of the local time zone only changes with the current time,
+	// so it's computed at most once per second instead of for every event
+	//
+	if(now != m_tz_time)
+	{
+		m_thiszone = gmt2local(now);
+		m_tz_time = now;
+	}
+
+	int32_t s = (sec + m_thiszone) % 86400;
 
 	if(date) 
 	{
-		Time = (sec + thiszone) - s;
-		tm = gmtime (&Time);
-		if(!tm)
-		{
-			bufsize = sprintf(buf, "<date error> ");
-		}
-		else
+		//
+		// The date is converted again only when the day changes
+		//
+		Time = (sec + m_thiszone) - s;
+
+		if(Time != m_date_time || m_date_str.empty())
 		{
-			bufsize = sprintf(buf, "%04d-%02d-%02d ",
-				   tm->tm_year+1900, tm->tm_mon+1, tm->tm_mday);
+			tm = gmtime (&Time);
+			if(!tm)
+			{
+				m_date_str = "<date error> ";
+			}
+			else
+			{
+				char datebuf[64];
+
+				snprintf(datebuf, sizeof(datebuf), "%04d-%02d-%02d ",
+					   tm->tm_year+1900, tm->tm_mon+1, tm->tm_mday);
+				m_date_str = datebuf;
+			}
+
+			m_date_time = Time;
 		}
+
+		memcpy(end, m_date_str.c_str(), m_date_str.length());
+		end += m_date_str.length();
 	}
 
+	end = ts_format_digits(end, s / 3600, 2);
+	*end++ = ':';
+	end = ts_format_digits(end, (s % 3600) / 60, 2);
+	*end++ = ':';
+	end = ts_format_digits(end, s % 60, 2);
+
 	if(ns)
 	{
-		sprintf(buf + bufsize, "%02d:%02d:%02d.%09u",
-				s / 3600, (s % 3600) / 60, s % 60, (unsigned)nsec);
-	}
-	else
-	{
-		sprintf(buf + bufsize, "%02d:%02d:%02d",
-				s / 3600, (s % 3600) / 60, s % 60);
+		*end++ = '.';
+		end = ts_format_digits(end, (uint32_t)nsec, 9);
 	}
 
-	*res = buf;
+	res->assign(buf, end - buf);
 }
 
 uint8_t* extract_argraw(sinsp_evt *evt, OUT uint32_t* len, const char *argname)
@@ -1368,8 +2144,93 @@ uint8_t* sinsp_filter_check_event::extract(sinsp_evt *evt, OUT uint32_t* len)
 
 		return (uint8_t*)&m_u32val;
 	case TYPE_COUNT:
-		m_u32val = 1;
+		if(evt->get_type() == PPME_REPEAT_E)
+		{
+			sinsp_evt_param *parinfo = evt->get_param(0);
+			ASSERT(parinfo->m_len == sizeof(uint32_t));
+			m_u32val = *(uint32_t *)parinfo->m_val;
+		}
+		else
+		{
+			m_u32val = 1;
+		}
+
 		return (uint8_t*)&m_u32val;
+	case TYPE_ISAFTERDROP:
+		m_u32val = evt->is_after_drop();
+		return (uint8_t*)&m_u32val;
+	case TYPE_SAMPLING_RATIO:
+		m_u32val = m_inspector->get_sampling_ratio();
+		return (uint8_t*)&m_u32val;
+	case TYPE_HOST:
+		{
+			const scap_machine_info* mi = m_inspector->get_source_machine_info(SCAP_TID_SOURCE(evt->get_tid()));
+
+			if(mi == NULL)
+			{
+				return NULL;
+			}
+
+			return (uint8_t*)mi->hostname;
+		}
+	case TYPE_OFFCPU:
+	case TYPE_ONCPU:
+		{
+			sinsp_threadinfo* tinfo = evt->get_thread_info(false);
+
+			if(evt->get_direction() == SCAP_ED_IN || tinfo == NULL || tinfo->m_last_latency_entertime == 0)
+			{
+				return NULL;
+			}
+
+			//
+			// The switches are per thread and the latency isn't, they
+			// can disagree if some events were dropped
+			//
+			uint64_t offcpu = min(tinfo->m_offcpu, tinfo->m_latency);
+
+			if(m_field_id == TYPE_OFFCPU)
+			{
+				m_u64val = offcpu;
+			}
+			else
+			{
+				m_u64val = tinfo->m_latency - offcpu;
+			}
+
+			return (uint8_t*)&m_u64val;
+		}
+	case TYPE_BUFFER_HASH:
+		{
+			const sinsp_evt_param* pi = evt->get_param_value_raw("data");
+
+			if(pi == NULL || pi->m_len == 0)
+			{
+				return NULL;
+			}
+
+			const scap_machine_info* mi = m_inspector->get_source_machine_info(SCAP_TID_SOURCE(evt->get_tid()));
+
+			if(mi != NULL && (mi->flags & SCAP_MI_BUFFER_HASH) != 0)
+			{
+				if(pi->m_len != PPM_BUFFER_HASH_SIZE)
+				{
+					return NULL;
+				}
+
+				memcpy(&m_u64val, pi->m_val, sizeof(m_u64val));
+			}
+			else
+			{
+				//
+				// The driver hashes the data the same way
+				//
+				m_u64val = ppm_buffer_hash_update(PPM_BUFFER_HASH_SEED, (const uint8_t*)pi->m_val, pi->m_len);
+				m_u64val = ppm_buffer_hash_final(m_u64val, pi->m_len);
+			}
+
+			return (uint8_t*)&m_u64val;
+		}
 	default:
 		ASSERT(false);
 		return NULL;
@@ -1383,7 +2244,7 @@ char* sinsp_filter_check_event::tostring(sinsp_evt* evt)
 	if(m_field_id == TYPE_ARGRAW)
 	{
 		uint32_t len;
-		uint8_t* rawval = extract(evt, &len);
+		uint8_t* rawval = extract_cached(evt, &len);
 
 		if(rawval == NULL)
 		{
@@ -1415,10 +2276,23 @@ bool sinsp_filter_check_event::compare(sinsp_evt *evt)
 
 		ASSERT(m_arginfo != NULL);
 
-		res = flt_compare(m_cmpop,
-			m_arginfo->type, 
-			extracted_val, 
-			&m_val_storage[0]);
+		if(m_cmpop == CO_IN)
+		{
+			res = m_val_set.contains(extracted_val, len);
+		}
+		else if(m_cmpop == CO_MATCHES)
+		{
+			res = regex_matches(m_arginfo->type, extracted_val, len);
+		}
+		else
+		{
+			res = m_cmp(m_cmpop,
+				m_arginfo->type,
+				extracted_val,
+				&m_val_storage[0],
+				len,
+				m_val_storage_len);
+		}
 	}
 	else
 	{
@@ -1429,6 +2303,200 @@ bool sinsp_filter_check_event::compare(sinsp_evt *evt)
 	return res;
 }
 
+//
+// Add to mask the event types with the given name. Returns false if no
+// event type has that name, in which case the generic events are added if
+// it's the name of a system call.
+//
+bool sinsp_filter_check_event::add_evttype(const char* evname, OUT ppm_evt_mask* mask)
+{
+	uint32_t j;
+	bool found = false;
+
+	for(j = 0; j < PPM_EVENT_MAX; j++)
+	{
+		if(strcmp(g_infotables.m_event_info[j].name, evname) == 0)
+		{
+			PPM_EVT_MASK_SET(mask, j);
+			found = true;
+		}
+	}
+
+	if(found)
+	{
+		return true;
+	}
+
+	//
+	// System calls that are not decoded by the driver are reported as
+	// generic events, and their type is the system call name
+	//
+	for(j = 0; j < PPM_SC_MAX; j++)
+	{
+		if(g_infotables.m_syscall_info_table[j].name != NULL &&
+			strcmp(g_infotables.m_syscall_info_table[j].name, evname) == 0)
+		{
+			PPM_EVT_MASK_SET(mask, PPME_GENERIC_E);
+			PPM_EVT_MASK_SET(mask, PPME_GENERIC_X);
+			break;
+		}
+	}
+
+	return false;
+}
+
+void sinsp_filter_check_event::get_evttypes(OUT ppm_evt_mask* mask)
+{
+	uint32_t j;
+	uint32_t flags = 0;
+
+	//
+	// The evt.is_io, evt.is_io_read, evt.is_io_write and evt.is_wait checks
+	// for true accept the event types with the corresponding flags
+	//
+	switch(m_field_id)
+	{
+	case TYPE_ISIO:
+		flags = EF_READS_FROM_FD | EF_WRITES_TO_FD;
+		break;
+	case TYPE_ISIO_READ:
+		flags = EF_READS_FROM_FD;
+		break;
+	case TYPE_ISIO_WRITE:
+		flags = EF_WRITES_TO_FD;
+		break;
+	case TYPE_ISWAIT:
+		flags = EF_WAITS;
+		break;
+	default:
+		break;
+	}
+
+	if(flags != 0 && m_cmpop == CO_EQ && *(uint32_t*)&m_val_storage[0] != 0)
+	{
+		memset(mask, 0, sizeof(ppm_evt_mask));
+
+		for(j = 0; j < PPM_EVENT_MAX; j++)
+		{
+			if(g_infotables.m_event_info[j].flags & flags)
+			{
+				PPM_EVT_MASK_SET(mask, j);
+			}
+		}
+
+		return;
+	}
+
+	//
+	// Otherwise, only evt.type=<name> and evt.type in (<names>) restrict the
+	// event types
+	//
+	if(m_field_id != TYPE_TYPE || (m_cmpop != CO_EQ && m_cmpop != CO_IN))
+	{
+		sinsp_filter_check::get_evttypes(mask);
+		return;
+	}
+
+	memset(mask, 0, sizeof(ppm_evt_mask));
+
+	if(m_cmpop == CO_EQ)
+	{
+		add_evttype((const char*)&m_val_storage[0], mask);
+		return;
+	}
+
+	const vector<string>& names = m_val_set.get_strings();
+
+	for(j = 0; j < names.size(); j++)
+	{
+		add_evttype(names[j].c_str(), mask);
+	}
+}
+
+//
+// The summaries have the time range of their group
+//
+bool sinsp_filter_check_event::may_match_block(const scap_block_summary* summary)
+{
+	uint64_t ts;
+
+	if(m_field_id != TYPE_RAWTS)
+	{
+		return true;
+	}
+
+	ts = *(uint64_t*)&m_val_storage[0];
+
+	switch(m_cmpop)
+	{
+	case CO_EQ:
+		return ts >= summary->ts_min && ts <= summary->ts_max;
+	case CO_LT:
+		return summary->ts_min < ts;
+	case CO_LE:
+		return summary->ts_min <= ts;
+	case CO_GT:
+		return summary->ts_max > ts;
+	case CO_GE:
+		return summary->ts_max >= ts;
+	default:
+		return true;
+	}
+}
+
+//
+// evt.type=<name> accepts exactly the event types with that name. The
+// generic events are also accepted by the names of the system calls that
+// they report, so the check isn't exact for those names.
+//
+bool sinsp_filter_check_event::is_evttype_only()
+{
+	uint32_t j;
+	ppm_evt_mask mask;
+
+	if(m_field_id != TYPE_TYPE)
+	{
+		return false;
+	}
+
+	if(m_cmpop == CO_EQ)
+	{
+		return add_evttype((const char*)&m_val_storage[0], &mask);
+	}
+	else if(m_cmpop == CO_IN)
+	{
+		const vector<string>& names = m_val_set.get_strings();
+
+		for(j = 0; j < names.size(); j++)
+		{
+			if(!add_evttype(names[j].c_str(), &mask))
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	return false;
+}
+
+sinsp_batch_column sinsp_filter_check_event::get_batch_column(OUT string* argname)
+{
+	if(m_field_id == TYPE_CPU)
+	{
+		return BCOL_CPU;
+	}
+	else if(m_field_id == TYPE_ARGRAW)
+	{
+		ASSERT(m_arginfo != NULL);
+		*argname = m_arginfo->name;
+		return BCOL_ARG;
+	}
+
+	return BCOL_NONE;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // sinsp_filter_check_user implementation
 ///////////////////////////////////////////////////////////////////////////////
@@ -1464,26 +2532,13 @@ uint8_t* sinsp_filter_check_user::extract(sinsp_evt *evt, OUT uint32_t* len)
 
 	if(m_field_id != TYPE_UID)
 	{
-		unordered_map<uint32_t, scap_userinfo*>::const_iterator it;
-
 		ASSERT(m_inspector != NULL);
-		const unordered_map<uint32_t, scap_userinfo*>* userlist = m_inspector->get_userlist();
-		ASSERT(userlist->size() != 0);
-
-		if(tinfo->m_uid == 0xffffffff)
-		{
-			return NULL;
-		}
 
-		it = userlist->find(tinfo->m_uid);
-		if(it == userlist->end())
+		uinfo = m_inspector->get_user(tinfo->m_uid);
+		if(uinfo == NULL)
 		{
-			ASSERT(false);
 			return NULL;
 		}
-
-		uinfo = it->second;
-		ASSERT(uinfo != NULL);
 	}
 
 	switch(m_field_id)
@@ -1540,30 +2595,70 @@ uint8_t* sinsp_filter_check_group::extract(sinsp_evt *evt, OUT uint32_t* len)
 		return (uint8_t*)&tinfo->m_gid;
 	case TYPE_NAME:
 		{
-			unordered_map<uint32_t, scap_groupinfo*>::iterator it;
-
 			ASSERT(m_inspector != NULL);
-			unordered_map<uint32_t, scap_groupinfo*>* grouplist = 
-				(unordered_map<uint32_t, scap_groupinfo*>*)m_inspector->get_grouplist();
-			ASSERT(grouplist->size() != 0);
 
-			if(tinfo->m_gid == 0xffffffff)
+			scap_groupinfo* ginfo = m_inspector->get_group(tinfo->m_gid);
+			if(ginfo == NULL)
 			{
 				return NULL;
 			}
 
-			it = grouplist->find(tinfo->m_gid);
-			if(it == grouplist->end())
-			{
-				ASSERT(false);
-				return NULL;
-			}
+			return (uint8_t*)ginfo->name;
+		}
+	default:
+		ASSERT(false);
+		break;
+	}
 
-			scap_groupinfo* ginfo = it->second;
-			ASSERT(ginfo != NULL);
+	return NULL;
+}
 
-			return (uint8_t*)ginfo->name;
+///////////////////////////////////////////////////////////////////////////////
+// sinsp_filter_check_container implementation
+///////////////////////////////////////////////////////////////////////////////
+const filtercheck_field_info sinsp_filter_check_container_fields[] =
+{
+	{PT_CHARBUF, EPF_NONE, PF_NA, "container.id", "the short id of the container the process runs in, e.g. the one shown by docker ps. 'host' if the process doesn't run in a container."},
+	{PT_UINT32, EPF_NONE, PF_DEC, "container.num", "the number of the container in this capture, 0 for the host. Cheaper to compare than container.id when filtering on many events."},
+	{PT_CHARBUF, EPF_NONE, PF_NA, "container.cgroup", "the cgroup of the first process seen in the container."},
+};
+
+sinsp_filter_check_container::sinsp_filter_check_container()
+{
+	m_info.m_name = "container";
+	m_info.m_fields = sinsp_filter_check_container_fields;
+	m_info.m_nfiedls = sizeof(sinsp_filter_check_container_fields) / sizeof(sinsp_filter_check_container_fields[0]);
+}
+
+sinsp_filter_check* sinsp_filter_check_container::allocate_new()
+{
+	return (sinsp_filter_check*) new sinsp_filter_check_container();
+}
+
+uint8_t* sinsp_filter_check_container::extract(sinsp_evt *evt, OUT uint32_t* len)
+{
+	sinsp_threadinfo* tinfo = evt->get_thread_info();
+
+	if(tinfo == NULL)
+	{
+		return NULL;
+	}
+
+	ASSERT(m_inspector != NULL);
+
+	switch(m_field_id)
+	{
+	case TYPE_ID:
+		return (uint8_t*)m_inspector->get_container_manager()->get(tinfo->m_container_num).m_id.c_str();
+	case TYPE_NUM:
+		return (uint8_t*)&tinfo->m_container_num;
+	case TYPE_CGROUP:
+		if(tinfo->m_container_num == SINSP_HOST_CONTAINER_NUM)
+		{
+			return NULL;
 		}
+
+		return (uint8_t*)m_inspector->get_container_manager()->get(tinfo->m_container_num).m_cgroup.c_str();
 	default:
 		ASSERT(false);
 		break;
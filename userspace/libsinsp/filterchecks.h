@@ -28,6 +28,95 @@ along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
 bool flt_compare(ppm_cmp_operator op, ppm_param_type type, void* operand1, void* operand2, uint32_t op1_len = 0, uint32_t op2_len = 0);
 char* flt_to_string(uint8_t* rawval, filtercheck_field_info* finfo);
 
+//
+// No slot of the sinsp_field_cache
+//
+#define SINSP_NO_CACHE_SLOT 0xffffffff
+
+//
+// The values of the raw events that the filters can test on a whole batch of
+// events, before the events are parsed. See sinsp_filter::run_batch().
+//
+enum sinsp_batch_column
+{
+	BCOL_NONE = 0, // The field needs the parsed event or the state
+	BCOL_TID = 1, // The thread id in the event header
+	BCOL_CPU = 2, // The CPU of the event
+	BCOL_ARG = 3, // A raw argument of the event, by name
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Per-event cache of the field values. The filter, the formatters and the
+// chisels each have their own checks, so without it a field used by several
+// of them would be extracted once for each. The checks on the same field
+// share a slot, and the first of them that extracts the field in an event
+// stores a copy of the value in the slot for the others.
+// The slots are never cleared: a value is valid if it has the generation of
+// the cache, and sinsp::next() moves to a new generation.
+///////////////////////////////////////////////////////////////////////////////
+typedef struct sinsp_field_cache_slot
+{
+	uint32_t m_nusers; // The number of checks that use the slot
+	uint64_t m_gen; // Generation of the value
+	bool m_isnull; // true if the event doesn't have the field
+	uint32_t m_len;
+	vector<uint8_t> m_val; // Copy of the value, followed by a 0
+	uint64_t m_str_gen; // Generation of the string rendering
+	bool m_str_isnull;
+	string m_str;
+}sinsp_field_cache_slot;
+
+//
+// The results of the checks and of the whole filters are shared the same
+// way, so that several chisels that test the same conditions, e.g.
+// fd.type=file, only test them once per event
+//
+typedef struct sinsp_filter_result_slot
+{
+	uint32_t m_nusers;
+	uint64_t m_gen;
+	bool m_res;
+}sinsp_filter_result_slot;
+
+class sinsp_field_cache
+{
+public:
+	sinsp_field_cache()
+	{
+		m_gen = 1;
+	}
+
+	//
+	// Return the slot of the field with the given name, e.g. fd.name,
+	// and count one more user for it
+	//
+	uint32_t add_user(const string& fldname);
+
+	//
+	// Same for the result of a check or a filter. key is the text of the
+	// check, or of the filter.
+	//
+	uint32_t add_result_user(const string& key);
+
+	//
+	// Same for the result of a check that is kept in the threads, see
+	// sinsp_filter_check::is_thread_state()
+	//
+	uint32_t add_thread_result_user(const string& key);
+
+	void invalidate()
+	{
+		m_gen++;
+	}
+
+	vector<sinsp_field_cache_slot> m_slots;
+	unordered_map<string, uint32_t> m_slot_ids;
+	vector<sinsp_filter_result_slot> m_result_slots;
+	unordered_map<string, uint32_t> m_result_slot_ids;
+	unordered_map<string, uint32_t> m_thread_result_slot_ids;
+	uint64_t m_gen;
+};
+
 class operand_info
 {
 public:
@@ -37,6 +126,62 @@ public:
 	string m_description;
 };
 
+///////////////////////////////////////////////////////////////////////////////
+// The set of values of an 'in' check. The values of up to 16 bits are kept in
+// a bitmap, the other integers in a sorted array, and the strings and the
+// buffers in an open addressing hash table.
+///////////////////////////////////////////////////////////////////////////////
+class sinsp_filter_value_set
+{
+public:
+	sinsp_filter_value_set();
+
+	//
+	// Must be called before adding the values
+	//
+	void init(ppm_param_type type);
+
+	//
+	// len is only used for buffers, the length of the other types is known
+	//
+	void add(const uint8_t* val, uint32_t len);
+	bool contains(const uint8_t* val, uint32_t len);
+
+	//
+	// The string and buffer values, in the order they were added
+	//
+	const vector<string>& get_strings()
+	{
+		return m_strings;
+	}
+
+	//
+	// The integer values, in increasing order
+	//
+	void get_ints(OUT vector<uint64_t>* values);
+
+private:
+	enum set_kind
+	{
+		SK_BITMAP,
+		SK_SORTED,
+		SK_HASH,
+	};
+
+	uint64_t get_int(const uint8_t* val);
+	uint32_t get_len(const uint8_t* val, uint32_t len);
+	void resize_hash(uint32_t nslots);
+
+	set_kind m_kind;
+	uint32_t m_width; // Size of the integer values
+	bool m_is_string;
+	vector<uint8_t> m_bitmap;
+	vector<uint64_t> m_ints;
+	vector<string> m_strings;
+	vector<uint64_t> m_hashes; // Hash of each of m_strings
+	vector<int32_t> m_slots; // Index in m_strings, -1 for the free slots
+};
+
 ///////////////////////////////////////////////////////////////////////////////
 // The filter check interface
 // NOTE: in order to add a new type of filter check, you need to add a class for
@@ -83,6 +228,15 @@ public:
 	//
 	virtual const filtercheck_field_info* get_field_info();
 
+	//
+	// Return the type of the values that compare() compares with the
+	// constant
+	//
+	virtual ppm_param_type get_compare_type()
+	{
+		return m_info.m_fields[m_field_id].m_type;
+	}
+
 	//
 	// Extract the field from the event
 	//
@@ -98,16 +252,145 @@ public:
 	//
 	virtual char* tostring(sinsp_evt* evt);
 
+	//
+	// Like extract() and tostring(), but if other checks on the same field
+	// already did the work for the current event, return their result from
+	// the inspector's sinsp_field_cache
+	//
+	uint8_t* extract_cached(sinsp_evt *evt, OUT uint32_t* len);
+	char* tostring_cached(sinsp_evt* evt);
+
+	//
+	// Extract the value in its native type, without converting it into a
+	// string. Returns false if the event doesn't have the field.
+	//
+	bool extract_value(sinsp_evt* evt, OUT sinsp_field_value* val);
+
+	//
+	// Share the values of the field with the other checks that have the
+	// same field name. Must be called after parse_field_name().
+	//
+	void enable_field_cache(const string& fldname);
+
+	//
+	// Return true if the value only depends on the event, so it can be
+	// shared with the other checks on the same field. The fields that keep
+	// some state in the check, like the time since the first event that the
+	// check saw, return false.
+	//
+	virtual bool is_cacheable()
+	{
+		return true;
+	}
+
+	//
+	// Return true if the value only depends on the thread of the event, and
+	// only changes when the thread execs, so the result of the check can be
+	// kept in the thread until then, see sinsp_threadinfo::m_check_results
+	//
+	virtual bool is_thread_state()
+	{
+		return false;
+	}
+
+	//
+	// Fill mask with the event types that this check can possibly accept.
+	// The default is all of them. Checks that restrict the event type,
+	// like evt.type=open, override this so the driver can skip the others.
+	//
+	virtual void get_evttypes(OUT ppm_evt_mask* mask);
+
+	//
+	// Return true if the check accepts exactly the event types returned by
+	// get_evttypes(). The filters test the event type before running the
+	// checks, so they can leave these out when the test already implies them.
+	//
+	virtual bool is_evttype_only()
+	{
+		return false;
+	}
+
+	//
+	// Return false if the check rejects all the events of a group with the
+	// given summary, see scap_set_block_filter(). The default is true, the
+	// checks on fields that the summaries record override this.
+	//
+	virtual bool may_match_block(const scap_block_summary* summary)
+	{
+		return true;
+	}
+
+	//
+	// Extract the value as a lookup key, the bytes of the value in its
+	// native type. Returns false if the event doesn't have the field, or if
+	// its type can't be a key.
+	//
+	bool extract_key(sinsp_evt* evt, OUT string* key);
+
+	//
+	// Get the values of an '=' or 'in' check as lookup keys, like
+	// extract_key() would extract them. Returns false for the other
+	// operators and for the types that can't be keys.
+	//
+	bool get_lookup_keys(OUT vector<string>* keys);
+
+	//
+	// Return the sinsp_batch_column that the value of the check is, if it
+	// can be read from the raw event, without the state. For BCOL_ARG,
+	// argname is the name of the argument.
+	//
+	virtual sinsp_batch_column get_batch_column(OUT string* argname)
+	{
+		return BCOL_NONE;
+	}
+
+	//
+	// Return true if the driver can compute the value of the check before
+	// filling the event, and set field to the ppm_predicate_field
+	//
+	virtual bool get_predicate_field(OUT ppm_predicate_field* field)
+	{
+		return false;
+	}
+
+	//
+	// Return true if compare() only extracts the field and compares it with
+	// the constant. The compiled filters do that comparison themselves for
+	// these checks, with a function resolved for the field type and the
+	// operator when the filter is compiled.
+	//
+	virtual bool has_plain_compare()
+	{
+		return true;
+	}
+
+	//
+	// Return true for the expressions, i.e. the internal nodes of the
+	// filtering tree
+	//
+	virtual bool is_expression()
+	{
+		return false;
+	}
+
 	sinsp* m_inspector;
 	boolop m_boolop;
 	ppm_cmp_operator m_cmpop;
+	sinsp_filter_cmp_fn m_cmp; // Compares the values with the constant, picked for its type and m_cmpop by parse_filter_value()
+	string m_clause; // Text of the check in the filter, for sinsp_filter::explain()
+	string m_fldname; // Name of the field, including its argument, e.g. evt.arg.fd
 
 protected:
 	char* rawval_to_string(uint8_t* rawval, const filtercheck_field_info* finfo, uint32_t len);
 	void string_to_rawval(const char* str, uint32_t len, ppm_param_type ptype);
+	bool regex_matches(ppm_param_type type, uint8_t* val, uint32_t len);
+	bool may_match_keys(const scap_block_summary* summary, scap_summary_kind kind);
 
 	char m_getpropertystr_storage[1024];
 	vector<uint8_t> m_val_storage;
+	sinsp_filter_value_set m_val_set; // The values of an 'in' check
+	sinsp_regex m_regex; // The expression of a 'matches' check
+	vector<uint64_t> m_summary_hashes; // The values of an '=' or 'in' check as summary keys, see may_match_keys()
 	const filtercheck_field_info* m_field;
 	filter_check_info m_info;
 	uint32_t m_field_id;
@@ -116,8 +399,12 @@ protected:
 
 private:
 	void set_inspector(sinsp* inspector);
+	sinsp_field_cache_slot* get_cache_slot(sinsp_evt* evt);
+
+	uint32_t m_cache_slot; // SINSP_NO_CACHE_SLOT if the values are not shared
 
 friend class sinsp_filter_check_list;
+friend class sinsp_filter;
 };
 
 //
@@ -131,10 +418,13 @@ public:
 	~sinsp_filter_check_list();
 	void add_filter_check(sinsp_filter_check* filter_check);
 	void get_all_fields(vector<const filter_check_info*>* list);
-	sinsp_filter_check* new_filter_check_from_fldname(string name, sinsp* inspector, bool do_exact_check);
+	sinsp_filter_check* new_filter_check_from_fldname(const string& name, sinsp* inspector, bool do_exact_check);
 
 private:
+	sinsp_filter_check* new_filter_check(sinsp_filter_check* template_chk, const string& name, sinsp* inspector, OUT int32_t* fldnamelen);
+
 	vector<sinsp_filter_check*> m_check_list;
+	unordered_map<string, sinsp_filter_check*> m_check_by_field; // Check of each field name, for the names without an argument
 };
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -152,6 +442,20 @@ public:
 	// does nothing for sinsp_filter_expression
 	void parse(string expr);
 	bool compare(sinsp_evt *evt);
+	void get_evttypes(OUT ppm_evt_mask* mask);
+
+	bool has_plain_compare()
+	{
+		return false;
+	}
+
+	bool is_expression()
+	{
+		return true;
+	}
+
+	bool is_evttype_only();
+	bool may_match_block(const scap_block_summary* summary);
 
 	//
 	// The following methods are part of the filter check interface but are irrelevant
@@ -209,6 +513,28 @@ public:
 		TYPE_L4PROTO = 10,
 		TYPE_SOCKFAMILY = 11,
 		TYPE_IS_SERVER = 12,
+		TYPE_PEER_PID = 13,
+		TYPE_PEER_TID = 14,
+		TYPE_PEER_FD = 15,
+		TYPE_PEER_PROC = 16,
+		TYPE_TRANS_LATENCY = 17,
+		TYPE_TRANS_COUNT = 18,
+		TYPE_TRANS_P50 = 19,
+		TYPE_TRANS_P99 = 20,
+		TYPE_PORT_TRANS_P50 = 21,
+		TYPE_PORT_TRANS_P99 = 22,
+		TYPE_L7PROTO = 23,
+		TYPE_L7CMD = 24,
+		TYPE_L7ARG = 25,
+		TYPE_L7STATUS = 26,
+		TYPE_L7ERROR = 27,
+		TYPE_ISSTALE = 28,
+		TYPE_OFFSET = 29,
+		TYPE_IOSEQ = 30,
+		TYPE_SEQOPS = 31,
+		TYPE_RANDOPS = 32,
+		TYPE_SEQPCT = 33,
+		TYPE_IOSIZES = 34,
 	};
 
 	enum fd_type
@@ -237,15 +563,28 @@ public:
 	bool compare(sinsp_evt *evt);
 	char* tostring(sinsp_evt* evt);
 
+	bool has_plain_compare()
+	{
+		return m_field_id != TYPE_IP && m_field_id != TYPE_PORT;
+	}
+
+	bool may_match_block(const scap_block_summary* summary);
+
 	sinsp_threadinfo* m_tinfo;
 	sinsp_fdinfo_t* m_fdinfo;
 	fd_type m_fd_type;
 	string m_tstr;
 	uint8_t m_tcstr[2];
 	uint32_t m_tbool;
+	int64_t m_s64val;
+	uint64_t m_u64val;
+	uint32_t m_u32val;
 
 private:
 	bool extract_fd(sinsp_evt *evt);
+	bool get_peer(OUT int64_t* pid, OUT int64_t* tid, OUT int64_t* fd);
+	bool ip_matches(uint32_t ip);
+	bool port_matches(uint16_t port);
 };
 
 //
@@ -266,16 +605,77 @@ public:
 		TYPE_TID = 7,
 		TYPE_ISMAINTHREAD = 8,
 		TYPE_EXECTIME = 9,
-		IOBYTES = 10,
-		TOTIOBYTES = 11,
-		LATENCY = 12,
-		TOTLATENCY = 13,
+		TYPE_VCSW = 10,
+		TYPE_IVCSW = 11,
+		TYPE_APID = 12,
+		TYPE_ANAME = 13,
+		TYPE_ISSTALE = 14,
+		TYPE_RUNQDELAY = 15,
+		TYPE_RUNQWAITS = 16,
+		TYPE_RUNQMAX = 17,
+		TYPE_PFMAJOR = 18,
+		TYPE_PFMINOR = 19,
+		TYPE_PFADDR = 20,
+		TYPE_PROC_PFMAJOR = 21,
+		TYPE_PROC_PFMINOR = 22,
+		IOBYTES = 23,
+		TOTIOBYTES = 24,
+		LATENCY = 25,
+		TOTLATENCY = 26,
 	};
 
 	sinsp_filter_check_thread();
 	sinsp_filter_check* allocate_new();
 	int32_t parse_field_name(const char* str);
 	uint8_t* extract(sinsp_evt *evt, OUT uint32_t* len);
+	bool compare(sinsp_evt *evt);
+
+	//
+	// proc.apid and proc.aname without an index compare all the ancestors
+	//
+	bool has_plain_compare()
+	{
+		return !is_any_ancestor_check();
+	}
+
+	//
+	// These fields keep their previous values in the check
+	//
+	bool is_cacheable()
+	{
+		return m_field_id != TYPE_EXECTIME && m_field_id != TOTIOBYTES && m_field_id != TOTLATENCY;
+	}
+
+	//
+	// The cwd is the one of the main thread, which doesn't tell the others
+	// when it changes
+	//
+	bool is_thread_state()
+	{
+		return m_field_id == TYPE_NAME || m_field_id == TYPE_EXE || m_field_id == TYPE_ARGS;
+	}
+
+	sinsp_batch_column get_batch_column(OUT string* argname)
+	{
+		return (m_field_id == TYPE_TID)? BCOL_TID : BCOL_NONE;
+	}
+
+	bool get_predicate_field(OUT ppm_predicate_field* field)
+	{
+		switch(m_field_id)
+		{
+		case TYPE_TID:
+			*field = PPM_PRED_FIELD_TID;
+			return true;
+		case TYPE_PID:
+			*field = PPM_PRED_FIELD_PID;
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	bool may_match_block(const scap_block_summary* summary);
 
 	// XXX this is overkill and wasted for most of the fields.
 	// It could be optimized by dynamically allocating the right amount
@@ -283,8 +683,28 @@ public:
 	// to be pretty small.
 	uint32_t m_tbool;
 	string m_tstr;
+	uint32_t m_u32val;
 	uint64_t m_u64val;
+	int64_t m_s64val;
 	vector<uint64_t> m_last_proc_switch_times;
+
+private:
+	int32_t extract_ancestor_level(const string& fldname, const string& val);
+	bool compare_ancestors(sinsp_evt *evt);
+	bool compare_value(uint8_t* val, uint32_t len);
+
+	bool is_any_ancestor_check()
+	{
+		return (m_field_id == TYPE_APID || m_field_id == TYPE_ANAME) && m_argid == -1;
+	}
+
+	int32_t m_argid; // Level of the ancestor of proc.apid[N] and proc.aname[N], -1 without an index
+	//
+	// Whether any ancestor of a process matches, by the id of its node in the
+	// process tree. Cleared when the names in the tree change.
+	//
+	unordered_map<uint64_t, bool> m_ancestor_matches;
+	uint64_t m_ancestor_generation;
 };
 
 //
@@ -323,6 +743,12 @@ public:
 		TYPE_ISIO_WRITE = 25,
 		TYPE_ISWAIT = 26,
 		TYPE_COUNT = 27,
+		TYPE_ISAFTERDROP = 28,
+		TYPE_SAMPLING_RATIO = 29,
+		TYPE_HOST = 30,
+		TYPE_OFFCPU = 31,
+		TYPE_ONCPU = 32,
+		TYPE_BUFFER_HASH = 33,
 	};
 
 	sinsp_filter_check_event();
@@ -330,9 +756,43 @@ public:
 	int32_t parse_field_name(const char* str);
 	void parse_filter_value(const char* str, uint32_t len);
 	const filtercheck_field_info* get_field_info();
+	ppm_param_type get_compare_type();
 	uint8_t* extract(sinsp_evt *evt, OUT uint32_t* len);
 	bool compare(sinsp_evt *evt);
 	char* tostring(sinsp_evt* evt);
+	void get_evttypes(OUT ppm_evt_mask* mask);
+	bool is_evttype_only();
+	bool may_match_block(const scap_block_summary* summary);
+
+	//
+	// The raw arguments and the buffer are extracted differently when
+	// they are compared
+	//
+	bool has_plain_compare()
+	{
+		return m_field_id != TYPE_ARGRAW && m_field_id != TYPE_BUFFER;
+	}
+
+	//
+	// The relative times start from the first event that the check saw
+	//
+	bool is_cacheable()
+	{
+		return m_field_id != TYPE_RELTS && m_field_id != TYPE_RELTS_S && m_field_id != TYPE_RELTS_NS;
+	}
+
+	sinsp_batch_column get_batch_column(OUT string* argname);
+
+	bool get_predicate_field(OUT ppm_predicate_field* field)
+	{
+		if(m_field_id == TYPE_RESRAW)
+		{
+			*field = PPM_PRED_FIELD_RES;
+			return true;
+		}
+
+		return false;
+	}
 
 	uint64_t m_first_ts;
 	uint64_t m_u64val;
@@ -348,10 +808,15 @@ public:
 	filtercheck_field_info m_customfield;
 
 private:
+	static bool add_evttype(const char* evname, OUT ppm_evt_mask* mask);
 	int32_t extract_arg(string fldname, string val, OUT const struct ppm_param_info** parinfo);
 	int32_t gmt2local(time_t t);
 	void ts_to_string(uint64_t ts, OUT string* res, bool full, bool ns);
 	bool m_is_compare;
+	time_t m_tz_time; // When m_thiszone was computed
+	int32_t m_thiszone;
+	time_t m_date_time; // The day of m_date_str
+	string m_date_str;
 };
 
 //
@@ -372,6 +837,11 @@ public:
 	sinsp_filter_check* allocate_new();
 	uint8_t* extract(sinsp_evt *evt, OUT uint32_t* len);
 
+	bool is_thread_state()
+	{
+		return true;
+	}
+
 	uint32_t m_uid;
 	string m_strval;
 };
@@ -392,10 +862,38 @@ public:
 	sinsp_filter_check* allocate_new();
 	uint8_t* extract(sinsp_evt *evt, OUT uint32_t* len);
 
+	bool is_thread_state()
+	{
+		return true;
+	}
+
 	uint32_t m_gid;
 	string m_name;
 };
 
+//
+// container checks
+//
+class sinsp_filter_check_container : public sinsp_filter_check
+{
+public:
+	enum check_type
+	{
+		TYPE_ID = 0,
+		TYPE_NUM = 1,
+		TYPE_CGROUP = 2,
+	};
+
+	sinsp_filter_check_container();
+	sinsp_filter_check* allocate_new();
+	uint8_t* extract(sinsp_evt *evt, OUT uint32_t* len);
+
+	bool is_thread_state()
+	{
+		return true;
+	}
+};
+
 //
 // Fake filter check used by the event formatter to render format text
 //
@@ -52,36 +52,240 @@ string sinsp_ipv4_ifinfo::to_string()
 	return string(s);
 }
 
-uint32_t sinsp_network_interfaces::infer_ipv4_address(uint32_t destination_address)
+///////////////////////////////////////////////////////////////////////////////
+// sinsp_lpm_trie implementation
+///////////////////////////////////////////////////////////////////////////////
+sinsp_lpm_trie::sinsp_lpm_trie()
 {
-	vector<sinsp_ipv4_ifinfo>::iterator it;
+	clear();
+}
 
-	// first try to find exact match
-	for(it = m_ipv4_interfaces.begin(); it != m_ipv4_interfaces.end(); it++)
+void sinsp_lpm_trie::clear()
+{
+	node root;
+
+	root.m_child[0] = 0;
+	root.m_child[1] = 0;
+	root.m_value = -1;
+
+	m_nodes.clear();
+	m_nodes.push_back(root);
+}
+
+void sinsp_lpm_trie::insert(const uint8_t* key, uint32_t prefixlen, int32_t value)
+{
+	uint32_t cur = 0;
+	uint32_t j;
+
+	for(j = 0; j < prefixlen; j++)
 	{
-		if(it->m_addr == destination_address)
+		uint32_t bit = (key[j / 8] >> (7 - j % 8)) & 1;
+
+		if(m_nodes[cur].m_child[bit] == 0)
 		{
-			return it->m_addr;
+			node n;
+
+			n.m_child[0] = 0;
+			n.m_child[1] = 0;
+			n.m_value = -1;
+
+			m_nodes.push_back(n);
+			m_nodes[cur].m_child[bit] = (uint32_t)m_nodes.size() - 1;
 		}
+
+		cur = m_nodes[cur].m_child[bit];
 	}
 
-	// try to find an interface for the same subnet
-	for(it = m_ipv4_interfaces.begin(); it != m_ipv4_interfaces.end(); it++)
+	if(m_nodes[cur].m_value == -1)
+	{
+		m_nodes[cur].m_value = value;
+	}
+}
+
+int32_t sinsp_lpm_trie::lookup(const uint8_t* key, uint32_t keylen)
+{
+	uint32_t cur = 0;
+	int32_t res = m_nodes[0].m_value;
+	uint32_t j;
+
+	for(j = 0; j < keylen; j++)
 	{
-		if((it->m_addr & it->m_netmask) == (destination_address & it->m_netmask))
+		cur = m_nodes[cur].m_child[(key[j / 8] >> (7 - j % 8)) & 1];
+
+		if(cur == 0)
+		{
+			break;
+		}
+
+		if(m_nodes[cur].m_value != -1)
 		{
-			return it->m_addr;
+			res = m_nodes[cur].m_value;
 		}
 	}
 
-	// otherwise take the first non loopback interface
-	for(it = m_ipv4_interfaces.begin(); it != m_ipv4_interfaces.end(); it++)
+	return res;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// sinsp_network_interfaces implementation
+///////////////////////////////////////////////////////////////////////////////
+//
+// Return the number of leading ones of a netmask in network byte order, or
+// -1 if the ones are not contiguous
+//
+static int32_t get_prefix_len(const uint8_t* mask, uint32_t nbytes)
+{
+	uint32_t len = 0;
+	uint32_t j;
+
+	while(len < nbytes * 8 && ((mask[len / 8] >> (7 - len % 8)) & 1))
+	{
+		len++;
+	}
+
+	for(j = len; j < nbytes * 8; j++)
+	{
+		if((mask[j / 8] >> (7 - j % 8)) & 1)
+		{
+			return -1;
+		}
+	}
+
+	return (int32_t)len;
+}
+
+sinsp_network_interfaces::sinsp_network_interfaces()
+{
+	m_ipv4_first_non_loopback = -1;
+	m_n_indexed_ipv4 = 0;
+	m_n_indexed_ipv6 = 0;
+}
+
+void sinsp_network_interfaces::index_ipv4_interface(uint32_t j)
+{
+	sinsp_ipv4_ifinfo* ifinfo = &m_ipv4_interfaces[j];
+	int32_t prefixlen = get_prefix_len((uint8_t*)&ifinfo->m_netmask, sizeof(uint32_t));
+
+	if(prefixlen >= 0)
+	{
+		m_ipv4_subnets.insert((uint8_t*)&ifinfo->m_addr, prefixlen, j);
+	}
+	else
+	{
+		m_ipv4_irregular.push_back(j);
+	}
+
+	if(m_ipv4_addrs.find(ifinfo->m_addr) == m_ipv4_addrs.end())
+	{
+		m_ipv4_addrs[ifinfo->m_addr] = j;
+	}
+
+	if(m_ipv4_first_non_loopback == -1 && ifinfo->m_addr != LOOPBACK_ADDR)
+	{
+		m_ipv4_first_non_loopback = j;
+	}
+}
+
+void sinsp_network_interfaces::index_ipv6_interface(uint32_t j)
+{
+	sinsp_ipv6_ifinfo* ifinfo = &m_ipv6_interfaces[j];
+	int32_t prefixlen = get_prefix_len((uint8_t*)ifinfo->m_netmask, SCAP_IPV6_ADDR_LEN);
+
+	if(prefixlen >= 0)
+	{
+		m_ipv6_subnets.insert((uint8_t*)ifinfo->m_addr, prefixlen, j);
+	}
+	else
 	{
-		if(it->m_addr != LOOPBACK_ADDR)
+		m_ipv6_irregular.push_back(j);
+	}
+}
+
+//
+// The lists can be grown or shrunk directly through get_ipv4_list() and
+// get_ipv6_list(), so the indexes are checked against their size before each
+// use. Adding interfaces only indexes the new ones, removing any of them
+// rebuilds the indexes.
+//
+void sinsp_network_interfaces::update_index()
+{
+	uint32_t j;
+
+	if(m_n_indexed_ipv4 != m_ipv4_interfaces.size())
+	{
+		if(m_n_indexed_ipv4 > m_ipv4_interfaces.size())
+		{
+			m_ipv4_subnets.clear();
+			m_ipv4_addrs.clear();
+			m_ipv4_irregular.clear();
+			m_ipv4_first_non_loopback = -1;
+			m_n_indexed_ipv4 = 0;
+		}
+
+		for(j = m_n_indexed_ipv4; j < m_ipv4_interfaces.size(); j++)
+		{
+			index_ipv4_interface(j);
+		}
+
+		m_n_indexed_ipv4 = (uint32_t)m_ipv4_interfaces.size();
+	}
+
+	if(m_n_indexed_ipv6 != m_ipv6_interfaces.size())
+	{
+		if(m_n_indexed_ipv6 > m_ipv6_interfaces.size())
+		{
+			m_ipv6_subnets.clear();
+			m_ipv6_irregular.clear();
+			m_n_indexed_ipv6 = 0;
+		}
+
+		for(j = m_n_indexed_ipv6; j < m_ipv6_interfaces.size(); j++)
 		{
-			return it->m_addr;
+			index_ipv6_interface(j);
 		}
+
+		m_n_indexed_ipv6 = (uint32_t)m_ipv6_interfaces.size();
+	}
+}
+
+uint32_t sinsp_network_interfaces::infer_ipv4_address(uint32_t destination_address)
+{
+	unordered_map<uint32_t, uint32_t>::iterator it;
+	vector<uint32_t>::iterator irit;
+	int32_t j;
+
+	update_index();
+
+	// first try to find exact match
+	it = m_ipv4_addrs.find(destination_address);
+	if(it != m_ipv4_addrs.end())
+	{
+		return m_ipv4_interfaces[it->second].m_addr;
 	}
+
+	// try to find the interface with the most specific subnet
+	j = m_ipv4_subnets.lookup((uint8_t*)&destination_address, sizeof(uint32_t) * 8);
+	if(j != -1)
+	{
+		return m_ipv4_interfaces[j].m_addr;
+	}
+
+	for(irit = m_ipv4_irregular.begin(); irit != m_ipv4_irregular.end(); ++irit)
+	{
+		sinsp_ipv4_ifinfo* ifinfo = &m_ipv4_interfaces[*irit];
+
+		if((ifinfo->m_addr & ifinfo->m_netmask) == (destination_address & ifinfo->m_netmask))
+		{
+			return ifinfo->m_addr;
+		}
+	}
+
+	// otherwise take the first non loopback interface
+	if(m_ipv4_first_non_loopback != -1)
+	{
+		return m_ipv4_interfaces[m_ipv4_first_non_loopback].m_addr;
+	}
+
 	return 0;
 }
 
@@ -113,7 +317,7 @@ void sinsp_network_interfaces::update_fd(sinsp_fdinfo_t *fd)
 
 bool sinsp_network_interfaces::is_ipv4addr_in_subnet(uint32_t addr)
 {
-	vector<sinsp_ipv4_ifinfo>::iterator it;
+	vector<uint32_t>::iterator it;
 
 	//
 	// Accept everything that comes from 192.168.0.0/16 or 10.0.0.0/8
@@ -125,10 +329,19 @@ bool sinsp_network_interfaces::is_ipv4addr_in_subnet(uint32_t addr)
 		return true;
 	}
 
+	update_index();
+
 	// try to find an interface for the same subnet
-	for(it = m_ipv4_interfaces.begin(); it != m_ipv4_interfaces.end(); it++)
+	if(m_ipv4_subnets.lookup((uint8_t*)&addr, sizeof(uint32_t) * 8) != -1)
+	{
+		return true;
+	}
+
+	for(it = m_ipv4_irregular.begin(); it != m_ipv4_irregular.end(); ++it)
 	{
-		if((it->m_addr & it->m_netmask) == (addr & it->m_netmask))
+		sinsp_ipv4_ifinfo* ifinfo = &m_ipv4_interfaces[*it];
+
+		if((ifinfo->m_addr & ifinfo->m_netmask) == (addr & ifinfo->m_netmask))
 		{
 			return true;
 		}
@@ -139,12 +352,38 @@ bool sinsp_network_interfaces::is_ipv4addr_in_subnet(uint32_t addr)
 
 bool sinsp_network_interfaces::is_ipv4addr_in_local_machine(uint32_t addr)
 {
-	vector<sinsp_ipv4_ifinfo>::iterator it;
+	update_index();
 
-	// try to find an interface for the same subnet
-	for(it = m_ipv4_interfaces.begin(); it != m_ipv4_interfaces.end(); it++)
+	return m_ipv4_addrs.find(addr) != m_ipv4_addrs.end();
+}
+
+bool sinsp_network_interfaces::is_ipv6addr_in_subnet(const uint8_t* addr)
+{
+	vector<uint32_t>::iterator it;
+	uint32_t k;
+
+	update_index();
+
+	if(m_ipv6_subnets.lookup(addr, SCAP_IPV6_ADDR_LEN * 8) != -1)
 	{
-		if(it->m_addr == addr)
+		return true;
+	}
+
+	for(it = m_ipv6_irregular.begin(); it != m_ipv6_irregular.end(); ++it)
+	{
+		sinsp_ipv6_ifinfo* ifinfo = &m_ipv6_interfaces[*it];
+
+		for(k = 0; k < SCAP_IPV6_ADDR_LEN; k++)
+		{
+			uint8_t mask = (uint8_t)ifinfo->m_netmask[k];
+
+			if(((uint8_t)ifinfo->m_addr[k] & mask) != (addr[k] & mask))
+			{
+				break;
+			}
+		}
+
+		if(k == SCAP_IPV6_ADDR_LEN)
 		{
 			return true;
 		}
@@ -200,6 +439,7 @@ void sinsp_network_interfaces::import_interfaces(scap_addrlist* paddrlist)
 	{
 		m_ipv4_interfaces.clear();
 		m_ipv6_interfaces.clear();
+		update_index();
 		import_ipv4_ifaddr_list(paddrlist->n_v4_addrs, paddrlist->v4list);
 		import_ipv6_ifaddr_list(paddrlist->n_v6_addrs, paddrlist->v6list);
 	}
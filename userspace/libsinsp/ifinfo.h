@@ -61,14 +61,52 @@ public:
 	string m_name;
 };
 
+//
+// Binary trie of address prefixes, for the longest prefix match of an
+// address in a set of subnets. The keys are in network byte order, and each
+// prefix carries a value, e.g. the index of the interface it comes from.
+// The nodes are kept in a vector and refer to each other by index, so the
+// trie is compact and cheap to rebuild.
+//
+class SINSP_PUBLIC sinsp_lpm_trie
+{
+public:
+	sinsp_lpm_trie();
+
+	void clear();
+
+	//
+	// Add the first prefixlen bits of key. If the prefix is already there,
+	// it keeps its value.
+	//
+	void insert(const uint8_t* key, uint32_t prefixlen, int32_t value);
+
+	//
+	// Return the value of the longest prefix of the keylen bits of key, or
+	// -1 if no prefix matches
+	//
+	int32_t lookup(const uint8_t* key, uint32_t keylen);
+
+private:
+	typedef struct node
+	{
+		uint32_t m_child[2]; // 0 if there's no child, since the root is never one
+		int32_t m_value; // -1 if no prefix ends here
+	}node;
+
+	vector<node> m_nodes; // m_nodes[0] is the root
+};
+
 class SINSP_PUBLIC sinsp_network_interfaces
 {
 public:
+	sinsp_network_interfaces();
 	void import_interfaces(scap_addrlist* paddrlist);
 	void import_ipv4_interface(const sinsp_ipv4_ifinfo& ifinfo);
 	void update_fd(sinsp_fdinfo_t *fd);
 	bool is_ipv4addr_in_subnet(uint32_t addr);
 	bool is_ipv4addr_in_local_machine(uint32_t addr);
+	bool is_ipv6addr_in_subnet(const uint8_t* addr);
 	vector<sinsp_ipv4_ifinfo>* get_ipv4_list();
 	vector<sinsp_ipv6_ifinfo>* get_ipv6_list();
 
@@ -76,7 +114,22 @@ VISIBILITY_PRIVATE
 	uint32_t infer_ipv4_address(uint32_t destination_address);
 	void import_ipv4_ifaddr_list(uint32_t count, scap_ifinfo_ipv4* plist);
 	void import_ipv6_ifaddr_list(uint32_t count, scap_ifinfo_ipv6* plist);
+	void index_ipv4_interface(uint32_t j);
+	void index_ipv6_interface(uint32_t j);
+	void update_index();
 	vector<sinsp_ipv4_ifinfo> m_ipv4_interfaces;
 	vector<sinsp_ipv6_ifinfo> m_ipv6_interfaces;
 
+	//
+	// Indexes of the interface lists, rebuilt when the number of interfaces
+	// is not the one they were built from
+	//
+	sinsp_lpm_trie m_ipv4_subnets;
+	sinsp_lpm_trie m_ipv6_subnets;
+	unordered_map<uint32_t, uint32_t> m_ipv4_addrs; // First interface with each address
+	vector<uint32_t> m_ipv4_irregular; // Interfaces with a non contiguous netmask, not in the trie
+	vector<uint32_t> m_ipv6_irregular;
+	int32_t m_ipv4_first_non_loopback;
+	uint32_t m_n_indexed_ipv4;
+	uint32_t m_n_indexed_ipv6;
 };
\ No newline at end of file
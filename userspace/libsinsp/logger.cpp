@@ -22,9 +22,92 @@ along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
 #include <time.h>
 #endif
 #include <stdarg.h>
+#ifndef _WIN32
+#include <pthread.h>
+#define HAS_LOGGER_THREAD
+#endif
 #include "sinsp.h"
 #include "sinsp_int.h"
 
+#ifndef _WIN32
+#define SINSP_THREAD_LOCAL __thread
+#else
+#define SINSP_THREAD_LOCAL __declspec(thread)
+#endif
+
+#define SINSP_LOGGER_BUF_SIZE 512
+#define SINSP_LOGGER_SITE_PROBES 8
+#define SINSP_LOGGER_WAIT_MS 100
+
+#ifdef HAS_LOGGER_THREAD
+#define logger_add_and_fetch(p, v) __sync_add_and_fetch(p, v)
+#define logger_exchange(p, v) __sync_lock_test_and_set(p, v)
+#define logger_compare_and_swap(p, o, n) __sync_bool_compare_and_swap(p, o, n)
+#else
+template<typename T> static inline T logger_add_and_fetch(volatile T* p, T v)
+{
+	return *p += v;
+}
+
+template<typename T> static inline T logger_exchange(volatile T* p, T v)
+{
+	T old = *p;
+	*p = v;
+	return old;
+}
+
+template<typename T> static inline bool logger_compare_and_swap(T* volatile* p, T* o, T* n)
+{
+	if(*p != o)
+	{
+		return false;
+	}
+
+	*p = n;
+	return true;
+}
+#endif
+
+#ifdef HAS_LOGGER_THREAD
+//
+// A slot of the queue. It can be written by the producers when m_seq is
+// its position in the queue, and read by the thread when m_seq is the
+// position + 1, like in a bounded multi-producer queue.
+//
+struct sinsp_logger_msg
+{
+	volatile uint64_t m_seq;
+	uint64_t m_ts_us;
+	uint32_t m_sev;
+	uint32_t m_n_suppressed;
+	char m_msg[SINSP_LOGGER_BUF_SIZE];
+};
+
+struct sinsp_logger_thread
+{
+	pthread_t m_thread;
+	pthread_mutex_t m_mutex;
+	pthread_cond_t m_cond; // Signaled when a message is queued or on stop
+	bool m_stop;
+	sinsp_logger_msg* m_queue;
+	uint32_t m_len;
+	volatile uint64_t m_tail; // Next position to write, taken with a compare and swap
+	uint64_t m_head; // Next position to read, only used by the thread
+};
+#else
+struct sinsp_logger_thread
+{
+};
+#endif
+
+static uint64_t logger_now_us()
+{
+	struct timeval ts;
+
+	gettimeofday(&ts, NULL);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_usec;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // sinsp_logger implementation
 ///////////////////////////////////////////////////////////////////////////////
@@ -34,10 +117,17 @@ sinsp_logger::sinsp_logger()
 	m_flags = OT_NONE;
 	m_sev = SEV_INFO;
 	m_callback = NULL;
+	m_rate_limit = SINSP_LOGGER_DEFAULT_RATE_LIMIT;
+	memset(m_sites, 0, sizeof(m_sites));
+	m_thread = NULL;
+	m_n_suppressed = 0;
+	m_n_queue_drops = 0;
 }
 
 sinsp_logger::~sinsp_logger()
 {
+	stop_async();
+
 	if(m_file)
 	{
 		ASSERT(m_flags & sinsp_logger::OT_FILE);
@@ -111,64 +201,374 @@ void sinsp_logger::set_severity(severity sev)
 	m_sev = sev;
 }
 
-void sinsp_logger::log(string msg, severity sev)
+void sinsp_logger::set_rate_limit(uint32_t max_per_s)
 {
-	struct timeval ts;
+	m_rate_limit = max_per_s;
+}
+
+bool sinsp_logger::start_async(uint32_t queue_len)
+{
+#ifdef HAS_LOGGER_THREAD
+	if(m_thread != NULL)
+	{
+		return true;
+	}
+
+	ASSERT(queue_len != 0 && (queue_len & (queue_len - 1)) == 0);
+
+	m_thread = new sinsp_logger_thread();
+	m_thread->m_stop = false;
+	m_thread->m_len = queue_len;
+	m_thread->m_queue = new sinsp_logger_msg[queue_len];
+	m_thread->m_tail = 0;
+	m_thread->m_head = 0;
+
+	for(uint32_t j = 0; j < queue_len; j++)
+	{
+		m_thread->m_queue[j].m_seq = j;
+	}
+
+	pthread_mutex_init(&m_thread->m_mutex, NULL);
+	pthread_cond_init(&m_thread->m_cond, NULL);
+
+	if(pthread_create(&m_thread->m_thread, NULL, thread_main, this) != 0)
+	{
+		pthread_cond_destroy(&m_thread->m_cond);
+		pthread_mutex_destroy(&m_thread->m_mutex);
+		delete[] m_thread->m_queue;
+		delete m_thread;
+		m_thread = NULL;
+		throw sinsp_exception("cannot create the logger thread");
+	}
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+//
+// Must not be called while other threads are logging
+//
+void sinsp_logger::stop_async()
+{
+#ifdef HAS_LOGGER_THREAD
+	if(m_thread == NULL)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&m_thread->m_mutex);
+	m_thread->m_stop = true;
+	pthread_cond_signal(&m_thread->m_cond);
+	pthread_mutex_unlock(&m_thread->m_mutex);
+
+	pthread_join(m_thread->m_thread, NULL);
+	pthread_cond_destroy(&m_thread->m_cond);
+	pthread_mutex_destroy(&m_thread->m_mutex);
+	delete[] m_thread->m_queue;
+	delete m_thread;
+	m_thread = NULL;
+#endif
+}
+
+//
+// The logger is shared by all the inspectors of the process, which can run
+// in different threads, so the messages are built in buffers of the calling
+// thread
+//
+void sinsp_logger::log(string msg, severity sev, const char* site)
+{
+	uint32_t n_suppressed = 0;
 
 	if(sev < m_sev)
 	{
 		return;
 	}
 
+	uint64_t ts_us = logger_now_us();
+
+	if(site != NULL && rate_limit(site, ts_us, &n_suppressed))
+	{
+		return;
+	}
+
+	log(msg.c_str(), sev, ts_us, n_suppressed);
+}
+
+void sinsp_logger::log(const char* msg, severity sev, uint64_t ts_us, uint32_t n_suppressed)
+{
+	if(m_thread != NULL)
+	{
+		enqueue(msg, sev, ts_us, n_suppressed);
+	}
+	else
+	{
+		write(msg, sev, ts_us, n_suppressed);
+	}
+}
+
+//
+// Never blocks: when the queue is full the message is dropped, and the
+// thread is only woken up if its mutex is free. Otherwise it's about to
+// look at the queue, or will in SINSP_LOGGER_WAIT_MS at the latest.
+//
+void sinsp_logger::enqueue(const char* msg, severity sev, uint64_t ts_us, uint32_t n_suppressed)
+{
+#ifdef HAS_LOGGER_THREAD
+	sinsp_logger_msg* qmsg;
+	uint64_t pos = m_thread->m_tail;
+
+	while(true)
+	{
+		qmsg = &m_thread->m_queue[pos & (m_thread->m_len - 1)];
+		int64_t diff = (int64_t)(qmsg->m_seq - pos);
+
+		if(diff == 0)
+		{
+			if(__sync_bool_compare_and_swap(&m_thread->m_tail, pos, pos + 1))
+			{
+				break;
+			}
+		}
+		else if(diff < 0)
+		{
+			__sync_fetch_and_add(&m_n_queue_drops, 1);
+			return;
+		}
+
+		pos = m_thread->m_tail;
+	}
+
+	qmsg->m_ts_us = ts_us;
+	qmsg->m_sev = sev;
+	qmsg->m_n_suppressed = n_suppressed;
+	strncpy(qmsg->m_msg, msg, sizeof(qmsg->m_msg) - 1);
+	qmsg->m_msg[sizeof(qmsg->m_msg) - 1] = 0;
+	__sync_synchronize();
+	qmsg->m_seq = pos + 1;
+
+	if(pthread_mutex_trylock(&m_thread->m_mutex) == 0)
+	{
+		pthread_cond_signal(&m_thread->m_cond);
+		pthread_mutex_unlock(&m_thread->m_mutex);
+	}
+#endif
+}
+
+void sinsp_logger::write(const char* msg, severity sev, uint64_t ts_us, uint32_t n_suppressed)
+{
+	char tbuf[SINSP_LOGGER_BUF_SIZE];
+	uint32_t len;
+
 	if((m_flags & sinsp_logger::OT_NOTS) == 0)
 	{
-		gettimeofday(&ts, NULL);
-		time_t rawtime = (time_t)ts.tv_sec;
-		struct tm* time_info = gmtime(&rawtime);
-		snprintf(m_tbuf, sizeof(m_tbuf), "%.2d-%.2d %.2d:%.2d:%.2d.%.6d %s",
-			time_info->tm_mon + 1,
-			time_info->tm_mday,
-			time_info->tm_hour,
-			time_info->tm_min,
-			time_info->tm_sec,
-			(int)ts.tv_usec,
-			msg.c_str());
+		struct tm time_info;
+		time_t rawtime = (time_t)(ts_us / 1000000);
+
+#ifndef _WIN32
+		gmtime_r(&rawtime, &time_info);
+#else
+		gmtime_s(&time_info, &rawtime);
+#endif
+		len = snprintf(tbuf, sizeof(tbuf), "%.2d-%.2d %.2d:%.2d:%.2d.%.6d %s",
+			time_info.tm_mon + 1,
+			time_info.tm_mday,
+			time_info.tm_hour,
+			time_info.tm_min,
+			time_info.tm_sec,
+			(int)(ts_us % 1000000),
+			msg);
 	}
 	else
 	{
-		snprintf(m_tbuf, sizeof(m_tbuf), "%s", msg.c_str());
+		len = snprintf(tbuf, sizeof(tbuf), "%s", msg);
+	}
+
+	if(n_suppressed != 0 && len < sizeof(tbuf))
+	{
+		snprintf(tbuf + len, sizeof(tbuf) - len, " (%u similar messages suppressed)", n_suppressed);
 	}
 
 	if(m_flags & sinsp_logger::OT_CALLBACK)
 	{
-		(*m_callback)(m_tbuf, (uint32_t)sev);
+		(*m_callback)(tbuf, (uint32_t)sev);
 	}
 	else if(m_flags & sinsp_logger::OT_FILE)
 	{
-		fprintf(m_file, "%s\n", m_tbuf);
+		fprintf(m_file, "%s\n", tbuf);
 		fflush(m_file);
 	}
 	else if(m_flags & sinsp_logger::OT_STDOUT)
 	{
-		fprintf(stdout, "%s\n", m_tbuf);
+		fprintf(stdout, "%s\n", tbuf);
 		fflush(stdout);
 	}
 	else if(m_flags & sinsp_logger::OT_STDERR)
 	{
-		fprintf(stderr, "%s\n", m_tbuf);
+		fprintf(stderr, "%s\n", tbuf);
 		fflush(stderr);
 	}
 }
 
+//
+// The call sites are told apart by the address of their id, a literal: the
+// format string of format(), or the SINSP_LOGGER_SITE given to log(). When
+// the table is full, the new sites are not rate limited.
+//
+sinsp_logger::site* sinsp_logger::get_site(const char* id)
+{
+	uint32_t h = (uint32_t)(((uintptr_t)id >> 3) * 2654435761U);
+
+	for(uint32_t j = 0; j < SINSP_LOGGER_SITE_PROBES; j++)
+	{
+		site* s = &m_sites[(h + j) & (SINSP_LOGGER_N_SITES - 1)];
+		const char* cur = s->m_id;
+
+		if(cur == id)
+		{
+			return s;
+		}
+
+		if(cur == NULL &&
+			(logger_compare_and_swap(&s->m_id, (const char*)NULL, id) || s->m_id == id))
+		{
+			return s;
+		}
+	}
+
+	return NULL;
+}
+
+//
+// Return true if the message of the site must be suppressed. Otherwise, set
+// n_suppressed to the number of its messages suppressed since the last one
+// that went through.
+//
+bool sinsp_logger::rate_limit(const char* id, uint64_t ts_us, OUT uint32_t* n_suppressed)
+{
+	if(m_rate_limit == 0)
+	{
+		return false;
+	}
+
+	site* s = get_site(id);
+
+	if(s == NULL)
+	{
+		return false;
+	}
+
+	//
+	// Two threads can both start the new window, which only lets a few more
+	// messages through
+	//
+	uint64_t window = ts_us / 1000000;
+
+	if(s->m_window != window)
+	{
+		s->m_window = window;
+		s->m_n = 0;
+	}
+
+	if(logger_add_and_fetch(&s->m_n, (uint32_t)1) > m_rate_limit)
+	{
+		logger_add_and_fetch(&s->m_n_suppressed, (uint32_t)1);
+		logger_add_and_fetch(&m_n_suppressed, (uint64_t)1);
+		return true;
+	}
+
+	*n_suppressed = logger_exchange(&s->m_n_suppressed, (uint32_t)0);
+	return false;
+}
+
+//
+// The returned message stays valid until the next call from the same thread.
+// It's empty if the message was below the severity or rate limited, since
+// those are not formatted at all.
+//
 char* sinsp_logger::format(severity sev, const char* fmt, ...)
 {
+	static SINSP_THREAD_LOCAL char tbuf[SINSP_LOGGER_BUF_SIZE];
 	va_list ap;
+	uint32_t n_suppressed = 0;
+
+	tbuf[0] = 0;
+
+	if(sev < m_sev)
+	{
+		return tbuf;
+	}
+
+	uint64_t ts_us = logger_now_us();
+
+	if(rate_limit(fmt, ts_us, &n_suppressed))
+	{
+		return tbuf;
+	}
 
 	va_start(ap, fmt);
-	vsnprintf(m_tbuf, sizeof(m_tbuf), fmt, ap);
+	vsnprintf(tbuf, sizeof(tbuf), fmt, ap);
 	va_end(ap);
 
-	log(m_tbuf, sev);
+	log(tbuf, sev, ts_us, n_suppressed);
+
+	return tbuf;
+}
+
+void* sinsp_logger::thread_main(void* arg)
+{
+	((sinsp_logger*)arg)->run();
+	return NULL;
+}
+
+void sinsp_logger::run()
+{
+#ifdef HAS_LOGGER_THREAD
+	while(true)
+	{
+		sinsp_logger_msg* qmsg = &m_thread->m_queue[m_thread->m_head & (m_thread->m_len - 1)];
+
+		if(qmsg->m_seq == m_thread->m_head + 1)
+		{
+			__sync_synchronize();
+			write(qmsg->m_msg, (severity)qmsg->m_sev, qmsg->m_ts_us, qmsg->m_n_suppressed);
+			__sync_synchronize();
+			qmsg->m_seq = m_thread->m_head + m_thread->m_len;
+			m_thread->m_head++;
+			continue;
+		}
 
-	return m_tbuf;
+		//
+		// The queue is empty. The messages queued while the producers
+		// couldn't signal are picked up at the next timeout.
+		//
+		pthread_mutex_lock(&m_thread->m_mutex);
+
+		if(m_thread->m_stop)
+		{
+			pthread_mutex_unlock(&m_thread->m_mutex);
+
+			if(qmsg->m_seq != m_thread->m_head + 1)
+			{
+				break;
+			}
+
+			continue;
+		}
+
+		struct timespec deadline;
+		uint64_t deadline_us = logger_now_us() + SINSP_LOGGER_WAIT_MS * 1000;
+
+		deadline.tv_sec = deadline_us / 1000000;
+		deadline.tv_nsec = (deadline_us % 1000000) * 1000;
+
+		if(qmsg->m_seq != m_thread->m_head + 1)
+		{
+			pthread_cond_timedwait(&m_thread->m_cond, &m_thread->m_mutex, &deadline);
+		}
+
+		pthread_mutex_unlock(&m_thread->m_mutex);
+	}
+#endif
 }
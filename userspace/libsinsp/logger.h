@@ -18,9 +18,28 @@ along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
 
 #pragma once
 
+struct sinsp_logger_thread;
+
+#define SINSP_LOGGER_N_SITES 128 // Power of two, the most call sites that are rate limited
+#define SINSP_LOGGER_DEFAULT_RATE_LIMIT 10
+#define SINSP_LOGGER_DEFAULT_QUEUE_LEN 256 // Power of two
+
 ///////////////////////////////////////////////////////////////////////////////
-// The logger class
+// The logger class.
+// By default the messages are written by the thread that logs them. With
+// start_async(), they're put in a lock-free queue instead, and a thread of
+// the logger adds the timestamp and writes them, or calls the callback.
+// The messages of format() are also rate limited per call site, i.e. per
+// format string: after set_rate_limit() messages in a second, the others
+// are only counted, and the next one that goes through tells how many
+// were suppressed. So the format string must be a literal. The messages
+// built at runtime go through log(), which rate limits them when it's given
+// the id of the call site, SINSP_LOGGER_SITE.
 ///////////////////////////////////////////////////////////////////////////////
+#define SINSP_LOGGER_STR_(x) #x
+#define SINSP_LOGGER_STR(x) SINSP_LOGGER_STR_(x)
+#define SINSP_LOGGER_SITE (__FILE__ ":" SINSP_LOGGER_STR(__LINE__))
+
 typedef void (*sinsp_logger_callback)(char* str, uint32_t sev);
 
 class SINSP_PUBLIC sinsp_logger
@@ -58,14 +77,61 @@ public:
 
 	void set_severity(severity sev);
 
-	void log(string msg, severity sev=SEV_INFO);
+	//
+	// Maximum number of messages per second from each call site of
+	// format(). 0 means no limit.
+	//
+	void set_rate_limit(uint32_t max_per_s);
+
+	//
+	// Move the output to a thread of the logger. Returns false if threads
+	// are not supported on this platform, in which case the messages keep
+	// being written synchronously. When the queue is full, the messages are
+	// dropped and counted. The callback is called from the logger thread.
+	//
+	bool start_async(uint32_t queue_len = SINSP_LOGGER_DEFAULT_QUEUE_LEN);
+	// Write the queued messages and stop the thread
+	void stop_async();
+
+	// With a site, usually SINSP_LOGGER_SITE, the messages are rate limited
+	void log(string msg, severity sev=SEV_INFO, const char* site=NULL);
 	// Log function that accepts printf syntax and returns the formatted buffer.
 	char* format(severity sev, const char* fmt, ...);
 
+	uint64_t get_n_suppressed()
+	{
+		return m_n_suppressed;
+	}
+
+	uint64_t get_n_queue_drops()
+	{
+		return m_n_queue_drops;
+	}
+
 private:
+	struct site
+	{
+		const char* volatile m_id; // Format string or site id, NULL if the slot is free
+		volatile uint64_t m_window; // Second of the messages counted in m_n
+		volatile uint32_t m_n;
+		volatile uint32_t m_n_suppressed; // Since the last message that went through
+	};
+
+	void log(const char* msg, severity sev, uint64_t ts_us, uint32_t n_suppressed);
+	void enqueue(const char* msg, severity sev, uint64_t ts_us, uint32_t n_suppressed);
+	void write(const char* msg, severity sev, uint64_t ts_us, uint32_t n_suppressed);
+	site* get_site(const char* id);
+	bool rate_limit(const char* id, uint64_t ts_us, OUT uint32_t* n_suppressed);
+	static void* thread_main(void* arg);
+	void run();
+
 	FILE* m_file;
 	sinsp_logger_callback m_callback;
 	uint32_t m_flags;
 	severity m_sev;
-	char m_tbuf[512];
+	uint32_t m_rate_limit;
+	site m_sites[SINSP_LOGGER_N_SITES];
+	sinsp_logger_thread* m_thread;
+	volatile uint64_t m_n_suppressed;
+	volatile uint64_t m_n_queue_drops;
 };
@@ -0,0 +1,568 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <time.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+#include "sinsp.h"
+#include "sinsp_int.h"
+#include "metrics.h"
+
+sinsp_metrics::sinsp_metrics(sinsp* inspector)
+{
+	m_inspector = inspector;
+	m_export_interval_ns = 0;
+	m_next_export_ns = 0;
+	m_next_ring_sample_ns = 0;
+	clear();
+}
+
+void sinsp_metrics::clear()
+{
+	memset(m_n_evts, 0, sizeof(m_n_evts));
+	memset(m_evt_bytes, 0, sizeof(m_evt_bytes));
+	memset(m_parser_ns, 0, sizeof(m_parser_ns));
+	memset(m_parser_samples, 0, sizeof(m_parser_samples));
+	memset(m_parser_latency, 0, sizeof(m_parser_latency));
+	m_sample_countdown = METRICS_PARSER_SAMPLE_RATE;
+	m_n_filtered = 0;
+	m_n_accepted = 0;
+	m_cpus.clear();
+	clear_proc_costs();
+}
+
+void sinsp_metrics::clear_proc_costs()
+{
+	m_procs.clear();
+	m_last_pid = -1;
+	m_last_proc = NULL;
+}
+
+uint64_t sinsp_metrics::get_time_ns()
+{
+#ifdef _WIN32
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * ONE_SECOND_IN_NS + tv.tv_usec * 1000;
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * ONE_SECOND_IN_NS + ts.tv_nsec;
+#endif
+}
+
+uint64_t sinsp_metrics::get_wall_time_ns()
+{
+#ifdef _WIN32
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * ONE_SECOND_IN_NS + tv.tv_usec * 1000;
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec * ONE_SECOND_IN_NS + ts.tv_nsec;
+#endif
+}
+
+sinsp_metrics::cpu_stats* sinsp_metrics::get_cpu(uint16_t cpuid)
+{
+	if(cpuid >= m_cpus.size())
+	{
+		cpu_stats cs;
+
+		memset(&cs, 0, sizeof(cs));
+		m_cpus.resize(cpuid + 1, cs);
+	}
+
+	return &m_cpus[cpuid];
+}
+
+void sinsp_metrics::add_lag_sample(uint16_t cpuid, uint64_t evt_ts)
+{
+	cpu_stats* cs = get_cpu(cpuid);
+	uint64_t now = get_wall_time_ns();
+	uint32_t bucket = 0;
+	uint64_t lag;
+
+	//
+	// The wall clock can go back
+	//
+	lag = (now > evt_ts)? now - evt_ts : 0;
+
+	cs->m_lag_ns += lag;
+	cs->m_lag_samples++;
+
+	while(lag > 1 && bucket < METRICS_LAG_BUCKETS - 1)
+	{
+		lag >>= 1;
+		bucket++;
+	}
+
+	cs->m_lag[bucket]++;
+}
+
+void sinsp_metrics::sample_rings()
+{
+	scap_t* h = m_inspector->m_h;
+	uint32_t ndevs;
+	uint32_t j;
+
+	if(h == NULL)
+	{
+		return;
+	}
+
+	ndevs = scap_get_ndevs(h);
+
+	for(j = 0; j < ndevs; j++)
+	{
+		scap_device_info info;
+		uint32_t used;
+
+		if(scap_get_device_info(h, j, &info) != SCAP_SUCCESS ||
+			scap_get_device_fill(h, j, &used) != SCAP_SUCCESS)
+		{
+			continue;
+		}
+
+		cpu_stats* cs = get_cpu(info.cpuid);
+
+		cs->m_ring_size = info.buffer_size;
+		cs->m_ring_used = used;
+		if(used > cs->m_ring_peak_used)
+		{
+			cs->m_ring_peak_used = used;
+		}
+	}
+}
+
+void sinsp_metrics::add_parser_sample(uint16_t etype, uint64_t ns)
+{
+	uint32_t bucket = 0;
+
+	m_parser_ns[etype] += ns;
+	m_parser_samples[etype]++;
+
+	while(ns > 1 && bucket < METRICS_PARSER_LATENCY_BUCKETS - 1)
+	{
+		ns >>= 1;
+		bucket++;
+	}
+
+	m_parser_latency[bucket]++;
+}
+
+void sinsp_metrics::add_proc_cost(sinsp_threadinfo* tinfo, uint32_t len, int64_t sampled_ns)
+{
+	int64_t pid = (tinfo != NULL)? tinfo->m_pid : -1;
+	proc_cost* pc;
+
+	if(pid == m_last_pid && m_last_proc != NULL)
+	{
+		pc = m_last_proc;
+	}
+	else
+	{
+		unordered_map<int64_t, proc_cost>::iterator it = m_procs.find(pid);
+
+		if(it != m_procs.end())
+		{
+			pc = &it->second;
+		}
+		else
+		{
+			if(m_procs.size() >= METRICS_MAX_PROCS)
+			{
+				tinfo = NULL;
+				pid = -1;
+			}
+
+			//
+			// The new entries are zeroed
+			//
+			pc = &m_procs[pid];
+
+			if(pc->m_n_evts == 0)
+			{
+				pc->m_comm = (tinfo != NULL)? tinfo->m_comm : "<other>";
+			}
+		}
+
+		m_last_pid = pid;
+		m_last_proc = pc;
+	}
+
+	pc->m_n_evts++;
+	pc->m_bytes += len;
+
+	if(sampled_ns >= 0)
+	{
+		pc->m_sampled_ns += sampled_ns;
+		pc->m_n_samples++;
+
+		//
+		// Follow the execve()s
+		//
+		if(tinfo != NULL && pc->m_comm != tinfo->m_comm)
+		{
+			pc->m_comm = tinfo->m_comm;
+		}
+	}
+}
+
+void sinsp_metrics::set_export_file(const string& filename, uint64_t interval_ns)
+{
+	m_export_filename = filename;
+
+	if(filename.empty())
+	{
+		m_export_interval_ns = 0;
+	}
+	else
+	{
+		m_export_interval_ns = interval_ns? interval_ns : ONE_SECOND_IN_NS;
+		m_next_export_ns = 0;
+	}
+}
+
+void sinsp_metrics::write_export_file()
+{
+	if(m_export_filename.empty())
+	{
+		return;
+	}
+
+	string tmpname = m_export_filename + ".tmp";
+	string text;
+	FILE* f;
+
+	tostring(&text);
+
+	f = fopen(tmpname.c_str(), "w");
+	if(f == NULL)
+	{
+		g_logger.format(sinsp_logger::SEV_ERROR, "can't write the metrics to %s", tmpname.c_str());
+		return;
+	}
+
+	if(fwrite(text.c_str(), 1, text.size(), f) != text.size())
+	{
+		fclose(f);
+		remove(tmpname.c_str());
+		return;
+	}
+
+	fclose(f);
+
+#ifdef _WIN32
+	remove(m_export_filename.c_str());
+#endif
+	rename(tmpname.c_str(), m_export_filename.c_str());
+
+	//
+	// The peaks are per export interval
+	//
+	for(vector<cpu_stats>::iterator it = m_cpus.begin(); it != m_cpus.end(); ++it)
+	{
+		it->m_ring_peak_used = it->m_ring_used;
+	}
+}
+
+void sinsp_metrics::append_evt_type_labels(uint16_t etype, OUT string* res)
+{
+	sinsp_evttables* einfo = m_inspector->get_event_info_tables();
+
+	res->append("{type=\"");
+	res->append(einfo->m_event_info[etype].name);
+	res->append("\",dir=\"");
+	res->append(PPME_IS_ENTER(etype)? ">" : "<");
+	res->append("\"}");
+}
+
+static void append_header(const char* name, const char* type, const char* help, OUT string* res)
+{
+	res->append("# HELP ");
+	res->append(name);
+	res->append(" ");
+	res->append(help);
+	res->append("\n# TYPE ");
+	res->append(name);
+	res->append(" ");
+	res->append(type);
+	res->append("\n");
+}
+
+static void append_value(const char* name, uint64_t value, OUT string* res)
+{
+	char buf[32];
+
+	snprintf(buf, sizeof(buf), " %" PRIu64 "\n", value);
+	res->append(name);
+	res->append(buf);
+}
+
+static void append_metric(const char* name, const char* type, const char* help, uint64_t value, OUT string* res)
+{
+	append_header(name, type, help, res);
+	append_value(name, value, res);
+}
+
+void sinsp_metrics::tostring(OUT string* res)
+{
+	char buf[64];
+	uint64_t total;
+	uint64_t total_ns;
+	uint32_t j;
+
+	res->clear();
+
+	append_header("sinsp_events_total", "counter", "Events processed by the inspector.", res);
+
+	for(j = 0; j < PPM_EVENT_MAX; j++)
+	{
+		if(m_n_evts[j] != 0)
+		{
+			res->append("sinsp_events_total");
+			append_evt_type_labels(j, res);
+			snprintf(buf, sizeof(buf), " %" PRIu64 "\n", m_n_evts[j]);
+			res->append(buf);
+		}
+	}
+
+	append_header("sinsp_event_bytes_total", "counter", "Bytes of the events processed by the inspector, as captured by the driver.", res);
+
+	for(j = 0; j < PPM_EVENT_MAX; j++)
+	{
+		if(m_n_evts[j] != 0)
+		{
+			res->append("sinsp_event_bytes_total");
+			append_evt_type_labels(j, res);
+			snprintf(buf, sizeof(buf), " %" PRIu64 "\n", m_evt_bytes[j]);
+			res->append(buf);
+		}
+	}
+
+	append_header("sinsp_parser_sampled_seconds_total", "counter", "Time spent parsing the sampled events.", res);
+
+	for(j = 0; j < PPM_EVENT_MAX; j++)
+	{
+		if(m_parser_samples[j] != 0)
+		{
+			res->append("sinsp_parser_sampled_seconds_total");
+			append_evt_type_labels(j, res);
+			snprintf(buf, sizeof(buf), " %.9f\n", (double)m_parser_ns[j] / ONE_SECOND_IN_NS);
+			res->append(buf);
+		}
+	}
+
+	append_header("sinsp_parser_samples_total", "counter", "Events whose parsing was timed.", res);
+
+	total = 0;
+	total_ns = 0;
+
+	for(j = 0; j < PPM_EVENT_MAX; j++)
+	{
+		if(m_parser_samples[j] != 0)
+		{
+			res->append("sinsp_parser_samples_total");
+			append_evt_type_labels(j, res);
+			snprintf(buf, sizeof(buf), " %" PRIu64 "\n", m_parser_samples[j]);
+			res->append(buf);
+			total += m_parser_samples[j];
+			total_ns += m_parser_ns[j];
+		}
+	}
+
+	//
+	// The buckets of a Prometheus histogram are cumulative
+	//
+	uint64_t cumulative = 0;
+
+	append_header("sinsp_parser_seconds", "histogram", "Parser time of the sampled events.", res);
+
+	for(j = 0; j < METRICS_PARSER_LATENCY_BUCKETS - 1; j++)
+	{
+		cumulative += m_parser_latency[j];
+		snprintf(buf, sizeof(buf), "sinsp_parser_seconds_bucket{le=\"%.9f\"} %" PRIu64 "\n",
+			(double)(((uint64_t)2 << j) - 1) / ONE_SECOND_IN_NS,
+			cumulative);
+		res->append(buf);
+	}
+
+	snprintf(buf, sizeof(buf), "sinsp_parser_seconds_bucket{le=\"+Inf\"} %" PRIu64 "\n", total);
+	res->append(buf);
+	snprintf(buf, sizeof(buf), "sinsp_parser_seconds_sum %.9f\n", (double)total_ns / ONE_SECOND_IN_NS);
+	res->append(buf);
+	append_value("sinsp_parser_seconds_count", total, res);
+
+	append_metric("sinsp_filter_evaluated_total", "counter", "Events that went through the capture filter.", m_n_filtered, res);
+	append_metric("sinsp_filter_accepted_total", "counter", "Events accepted by the capture filter.", m_n_accepted, res);
+
+	//
+	// The delivery lag and the ring fill levels, per CPU
+	//
+	append_header("sinsp_delivery_lag_seconds", "histogram", "Time from the driver timestamp of the sampled events to the end of their parsing.", res);
+
+	for(j = 0; j < m_cpus.size(); j++)
+	{
+		cpu_stats* cs = &m_cpus[j];
+		uint32_t k;
+
+		if(cs->m_lag_samples == 0)
+		{
+			continue;
+		}
+
+		cumulative = 0;
+
+		for(k = 0; k < METRICS_LAG_BUCKETS - 1; k++)
+		{
+			cumulative += cs->m_lag[k];
+			snprintf(buf, sizeof(buf), "sinsp_delivery_lag_seconds_bucket{cpu=\"%u\",le=\"%.9f\"} %" PRIu64 "\n",
+				j,
+				(double)(((uint64_t)2 << k) - 1) / ONE_SECOND_IN_NS,
+				cumulative);
+			res->append(buf);
+		}
+
+		snprintf(buf, sizeof(buf), "sinsp_delivery_lag_seconds_bucket{cpu=\"%u\",le=\"+Inf\"} %" PRIu64 "\n", j, cs->m_lag_samples);
+		res->append(buf);
+		snprintf(buf, sizeof(buf), "sinsp_delivery_lag_seconds_sum{cpu=\"%u\"} %.9f\n", j, (double)cs->m_lag_ns / ONE_SECOND_IN_NS);
+		res->append(buf);
+		snprintf(buf, sizeof(buf), "sinsp_delivery_lag_seconds_count{cpu=\"%u\"} %" PRIu64 "\n", j, cs->m_lag_samples);
+		res->append(buf);
+	}
+
+	append_header("sinsp_ring_size_bytes", "gauge", "Size of the driver ring buffers.", res);
+
+	for(j = 0; j < m_cpus.size(); j++)
+	{
+		if(m_cpus[j].m_ring_size != 0)
+		{
+			snprintf(buf, sizeof(buf), "sinsp_ring_size_bytes{cpu=\"%u\"} %u\n", j, m_cpus[j].m_ring_size);
+			res->append(buf);
+		}
+	}
+
+	append_header("sinsp_ring_used_bytes", "gauge", "Bytes of the driver ring buffers not yet consumed, at the last sample.", res);
+
+	for(j = 0; j < m_cpus.size(); j++)
+	{
+		if(m_cpus[j].m_ring_size != 0)
+		{
+			snprintf(buf, sizeof(buf), "sinsp_ring_used_bytes{cpu=\"%u\"} %u\n", j, m_cpus[j].m_ring_used);
+			res->append(buf);
+		}
+	}
+
+	append_header("sinsp_ring_peak_used_bytes", "gauge", "Highest sampled fill of the driver ring buffers since the previous export.", res);
+
+	for(j = 0; j < m_cpus.size(); j++)
+	{
+		if(m_cpus[j].m_ring_size != 0)
+		{
+			snprintf(buf, sizeof(buf), "sinsp_ring_peak_used_bytes{cpu=\"%u\"} %u\n", j, m_cpus[j].m_ring_peak_used);
+			res->append(buf);
+		}
+	}
+
+	//
+	// The sizes of the tables
+	//
+	sinsp_thread_manager* tm = m_inspector->m_thread_manager;
+
+	append_metric("sinsp_threads", "gauge", "Entries of the thread table.", tm->get_thread_count(), res);
+	append_metric("sinsp_fds", "gauge", "Entries of the fd tables.", tm->get_fd_count(), res);
+	append_metric("sinsp_memory_bytes", "gauge", "Estimated memory used by the thread and fd tables.", tm->get_memory_usage(), res);
+	append_metric("sinsp_evicted_threads_total", "counter", "Threads dropped to stay in the memory budget.", tm->get_evicted_threads(), res);
+	append_metric("sinsp_evicted_fds_total", "counter", "Fds dropped to stay in the memory budget.", tm->get_evicted_fds(), res);
+	append_metric("sinsp_thread_table_capacity", "gauge", "Buckets of the thread table and slots of its index.", tm->get_table_capacity(), res);
+	append_metric("sinsp_thread_table_resizes_total", "counter", "Times the thread table or its index were resized.", tm->get_table_resizes(), res);
+	append_metric("sinsp_thread_table_compactions_total", "counter", "Times the thread table was shrunk after the threads were gone.", tm->get_compactions(), res);
+	append_metric("sinsp_thread_tombstones", "gauge", "Exited threads remembered for the late events.", tm->get_tombstone_count(), res);
+	append_metric("sinsp_thread_tombstone_hits_total", "counter", "Late events of exited threads resolved from their tombstones.", tm->get_tombstone_hits(), res);
+
+	append_header("sinsp_connections", "gauge", "Entries of the connection tables.", res);
+	append_value("sinsp_connections{family=\"ipv4\"}", m_inspector->m_ipv4_connections->size(), res);
+	append_value("sinsp_connections{family=\"ipv6\"}", m_inspector->m_ipv6_connections->size(), res);
+
+	append_header("sinsp_connection_drops_total", "counter", "Connections not tracked because the table was full.", res);
+	append_value("sinsp_connection_drops_total{family=\"ipv4\"}", m_inspector->m_ipv4_connections->get_n_drops(), res);
+	append_value("sinsp_connection_drops_total{family=\"ipv6\"}", m_inspector->m_ipv6_connections->get_n_drops(), res);
+
+	//
+	// The counters of the driver
+	//
+	if(m_inspector->m_h != NULL && m_inspector->is_live())
+	{
+		scap_stats stats;
+
+		if(scap_get_stats(m_inspector->m_h, &stats) == SCAP_SUCCESS)
+		{
+			append_metric("scap_events_total", "counter", "Events received by the driver.", stats.n_evts, res);
+			append_metric("scap_drops_total", "counter", "Events dropped by the driver.", stats.n_drops, res);
+			append_metric("scap_preemptions_total", "counter", "Events lost to preemptions in the driver.", stats.n_preemptions, res);
+		}
+	}
+
+	//
+	// The heap allocations per subsystem, in the builds that count them
+	//
+	if(sinsp_alloc_stats::is_enabled())
+	{
+		sinsp_alloc_stats::subsys_stats as[SAS_MAX];
+
+		for(j = 0; j < SAS_MAX; j++)
+		{
+			sinsp_alloc_stats::get((sinsp_alloc_subsys)j, &as[j]);
+		}
+
+		append_header("sinsp_allocs_total", "counter", "Heap allocations, by the subsystem that made them.", res);
+
+		for(j = 0; j < SAS_MAX; j++)
+		{
+			snprintf(buf, sizeof(buf), "sinsp_allocs_total{subsystem=\"%s\"} %" PRIu64 "\n",
+				sinsp_alloc_stats::get_subsys_name((sinsp_alloc_subsys)j), as[j].m_n_allocs);
+			res->append(buf);
+		}
+
+		append_header("sinsp_alloc_bytes_total", "counter", "Bytes of the heap allocations, by the subsystem that made them.", res);
+
+		for(j = 0; j < SAS_MAX; j++)
+		{
+			snprintf(buf, sizeof(buf), "sinsp_alloc_bytes_total{subsystem=\"%s\"} %" PRIu64 "\n",
+				sinsp_alloc_stats::get_subsys_name((sinsp_alloc_subsys)j), as[j].m_alloc_bytes);
+			res->append(buf);
+		}
+
+		append_header("sinsp_alloc_live_bytes", "gauge", "Bytes allocated and not yet freed, by the subsystem that allocated them.", res);
+
+		for(j = 0; j < SAS_MAX; j++)
+		{
+			snprintf(buf, sizeof(buf), "sinsp_alloc_live_bytes{subsystem=\"%s\"} %" PRId64 "\n",
+				sinsp_alloc_stats::get_subsys_name((sinsp_alloc_subsys)j), (int64_t)(as[j].m_alloc_bytes - as[j].m_freed_bytes));
+			res->append(buf);
+		}
+	}
+}
@@ -0,0 +1,250 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+//
+// Buckets of the histogram of the parser time. Bucket N counts the events
+// that took 2^N to 2^(N+1) - 1 nanoseconds to parse, and the last one also
+// counts the slower ones.
+//
+#define METRICS_PARSER_LATENCY_BUCKETS 24
+
+//
+// Buckets of the histograms of the delivery lag, same scheme as above. The
+// last one starts at about 34 seconds.
+//
+#define METRICS_LAG_BUCKETS 36
+
+///////////////////////////////////////////////////////////////////////////////
+// Counters about the work of the inspector, always collected, that can be
+// written periodically to a file in the Prometheus text format, e.g. for the
+// textfile collector of the node exporter.
+// The counters are only updated by the thread that calls sinsp::next(),
+// which is also the one that writes the file, so they are plain integers.
+// Timing the parser costs more than the parsing of the simplest events, so
+// only one event in METRICS_PARSER_SAMPLE_RATE is timed. The same events are
+// used for the delivery lag of live captures, i.e. how old the event is, from
+// the timestamp that the driver gave it, when the parser is done with it.
+// The events, their bytes and the sampled parser time are also charged to
+// the process that generated them, to tell which workloads are the most
+// expensive to observe. The parser time includes the capture filter.
+///////////////////////////////////////////////////////////////////////////////
+class SINSP_PUBLIC sinsp_metrics
+{
+public:
+	struct cpu_stats
+	{
+		uint64_t m_lag_ns; // Sum of the sampled lags
+		uint64_t m_lag_samples;
+		uint64_t m_lag[METRICS_LAG_BUCKETS];
+		uint32_t m_ring_size;
+		uint32_t m_ring_used; // At the last sample
+		uint32_t m_ring_peak_used; // Since the file was last written
+	};
+
+	struct proc_cost
+	{
+		string m_comm; // At the last sample
+		uint64_t m_n_evts;
+		uint64_t m_bytes; // Captured by the driver, headers included
+		uint64_t m_sampled_ns; // Parser time of the sampled events
+		uint64_t m_n_samples;
+
+		//
+		// The parser time of all the events of the process, extrapolated
+		// from the sampled ones
+		//
+		uint64_t get_est_ns() const
+		{
+			return m_sampled_ns * METRICS_PARSER_SAMPLE_RATE;
+		}
+	};
+
+	sinsp_metrics(sinsp* inspector);
+
+	void clear();
+
+	//
+	// Called for each parsed event. tinfo is the thread of the event, if it
+	// has one, and sampled_ns its parser time, or -1 if it wasn't timed.
+	//
+	void on_event(uint16_t etype, uint32_t len, sinsp_threadinfo* tinfo, int64_t sampled_ns)
+	{
+		m_n_evts[etype]++;
+		m_evt_bytes[etype] += len;
+		add_proc_cost(tinfo, len, sampled_ns);
+	}
+
+	//
+	// Return true if the parsing of the current event must be timed
+	//
+	bool sample_parser()
+	{
+		if(--m_sample_countdown != 0)
+		{
+			return false;
+		}
+
+		m_sample_countdown = METRICS_PARSER_SAMPLE_RATE;
+		return true;
+	}
+
+	void add_parser_sample(uint16_t etype, uint64_t ns);
+
+	//
+	// Account the delivery lag of an event of the given CPU, from its
+	// timestamp to now
+	//
+	void add_lag_sample(uint16_t cpuid, uint64_t evt_ts);
+
+	//
+	// Read the fill level of the driver buffers if
+	// METRICS_RING_SAMPLE_INTERVAL_NS have elapsed since the last time.
+	// Called by the inspector when it fetches a new batch of events during
+	// live captures.
+	//
+	void check_rings()
+	{
+		uint64_t now = get_time_ns();
+
+		if(now >= m_next_ring_sample_ns)
+		{
+			m_next_ring_sample_ns = now + METRICS_RING_SAMPLE_INTERVAL_NS;
+			sample_rings();
+		}
+	}
+
+	//
+	// Called for each event that went through the capture filter
+	//
+	void on_filter(bool accepted)
+	{
+		m_n_filtered++;
+		if(accepted)
+		{
+			m_n_accepted++;
+		}
+	}
+
+	//
+	// Write the metrics to filename every interval_ns. The file is replaced
+	// atomically, so readers never see it half written. An empty filename
+	// stops the export.
+	//
+	void set_export_file(const string& filename, uint64_t interval_ns);
+
+	//
+	// Write the file if the interval has elapsed. Called often enough by the
+	// inspector, e.g. when it fetches a new batch of events.
+	//
+	void check_export()
+	{
+		if(m_export_interval_ns != 0)
+		{
+			uint64_t now = get_time_ns();
+
+			if(now >= m_next_export_ns)
+			{
+				m_next_export_ns = now + m_export_interval_ns;
+				write_export_file();
+			}
+		}
+	}
+
+	//
+	// Write the file now, if there is one
+	//
+	void write_export_file();
+
+	//
+	// The metrics in the Prometheus text format
+	//
+	void tostring(OUT string* res);
+
+	uint64_t get_n_evts(uint16_t etype)
+	{
+		return m_n_evts[etype];
+	}
+
+	uint64_t get_evt_bytes(uint16_t etype)
+	{
+		return m_evt_bytes[etype];
+	}
+
+	uint64_t get_parser_sampled_ns(uint16_t etype)
+	{
+		return m_parser_ns[etype];
+	}
+
+	uint64_t get_parser_samples(uint16_t etype)
+	{
+		return m_parser_samples[etype];
+	}
+
+	//
+	// The cost of each process, by pid. The events without a thread, and
+	// the ones of the processes that didn't fit in METRICS_MAX_PROCS, are
+	// charged to pid -1.
+	//
+	const unordered_map<int64_t, proc_cost>& get_proc_costs()
+	{
+		return m_procs;
+	}
+
+	void clear_proc_costs();
+
+	//
+	// The lag and ring stats of each CPU, indexed by the cpuid of the events
+	//
+	const vector<cpu_stats>& get_cpu_stats()
+	{
+		return m_cpus;
+	}
+
+	static uint64_t get_time_ns();
+
+	//
+	// Wall clock time, the one of the event timestamps
+	//
+	static uint64_t get_wall_time_ns();
+
+private:
+	void append_evt_type_labels(uint16_t etype, OUT string* res);
+	void sample_rings();
+	cpu_stats* get_cpu(uint16_t cpuid);
+	void add_proc_cost(sinsp_threadinfo* tinfo, uint32_t len, int64_t sampled_ns);
+
+	sinsp* m_inspector;
+	uint64_t m_n_evts[PPM_EVENT_MAX];
+	uint64_t m_evt_bytes[PPM_EVENT_MAX];
+	uint32_t m_sample_countdown;
+	uint64_t m_parser_ns[PPM_EVENT_MAX]; // Parser time of the sampled events
+	uint64_t m_parser_samples[PPM_EVENT_MAX];
+	uint64_t m_parser_latency[METRICS_PARSER_LATENCY_BUCKETS];
+	uint64_t m_n_filtered;
+	uint64_t m_n_accepted;
+	string m_export_filename;
+	uint64_t m_export_interval_ns;
+	uint64_t m_next_export_ns;
+	vector<cpu_stats> m_cpus;
+	uint64_t m_next_ring_sample_ns;
+	unordered_map<int64_t, proc_cost> m_procs;
+	int64_t m_last_pid; // Consecutive events often come from the same process
+	proc_cost* m_last_proc;
+};
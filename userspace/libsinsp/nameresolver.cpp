@@ -0,0 +1,303 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#ifndef _WIN32
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#define HAS_NAME_RESOLVER_THREAD
+#endif
+#include "sinsp.h"
+#include "sinsp_int.h"
+#include "nameresolver.h"
+
+#ifdef HAS_NAME_RESOLVER_THREAD
+struct name_resolver_thread
+{
+	pthread_t m_thread;
+	pthread_mutex_t m_mutex;
+	pthread_cond_t m_cond; // Signaled when an address is queued or on stop
+	bool m_stop;
+};
+#else
+struct name_resolver_thread
+{
+};
+#endif
+
+sinsp_name_resolver::sinsp_name_resolver()
+{
+	m_thread = NULL;
+	m_services_loaded = false;
+	m_n_lookups = 0;
+	m_n_drops = 0;
+}
+
+sinsp_name_resolver::~sinsp_name_resolver()
+{
+	stop();
+}
+
+bool sinsp_name_resolver::start()
+{
+#ifdef HAS_NAME_RESOLVER_THREAD
+	if(m_thread != NULL)
+	{
+		return true;
+	}
+
+	m_thread = new name_resolver_thread();
+	m_thread->m_stop = false;
+	pthread_mutex_init(&m_thread->m_mutex, NULL);
+	pthread_cond_init(&m_thread->m_cond, NULL);
+
+	if(pthread_create(&m_thread->m_thread, NULL, thread_main, this) != 0)
+	{
+		pthread_cond_destroy(&m_thread->m_cond);
+		pthread_mutex_destroy(&m_thread->m_mutex);
+		delete m_thread;
+		m_thread = NULL;
+		throw sinsp_exception("cannot create the name resolution thread");
+	}
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+void sinsp_name_resolver::stop()
+{
+#ifdef HAS_NAME_RESOLVER_THREAD
+	if(m_thread == NULL)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&m_thread->m_mutex);
+	m_thread->m_stop = true;
+	pthread_cond_signal(&m_thread->m_cond);
+	pthread_mutex_unlock(&m_thread->m_mutex);
+
+	pthread_join(m_thread->m_thread, NULL);
+	pthread_cond_destroy(&m_thread->m_cond);
+	pthread_mutex_destroy(&m_thread->m_mutex);
+	delete m_thread;
+	m_thread = NULL;
+#endif
+}
+
+void sinsp_name_resolver::append_numeric_host(uint32_t ip, OUT string* res)
+{
+	char buf[16];
+	uint8_t* b = (uint8_t*)&ip;
+
+	snprintf(buf, sizeof(buf), "%u.%u.%u.%u",
+		(unsigned int)b[0],
+		(unsigned int)b[1],
+		(unsigned int)b[2],
+		(unsigned int)b[3]);
+
+	res->append(buf);
+}
+
+void sinsp_name_resolver::append_host(uint32_t ip, OUT string* res)
+{
+#ifdef HAS_NAME_RESOLVER_THREAD
+	//
+	// The thread only holds the mutex to update the cache, never during a
+	// lookup, but the capture doesn't even wait for that
+	//
+	if(m_thread == NULL || pthread_mutex_trylock(&m_thread->m_mutex) != 0)
+	{
+		append_numeric_host(ip, res);
+		return;
+	}
+
+	unordered_map<uint32_t, host_entry>::iterator it = m_hosts.find(ip);
+
+	if(it != m_hosts.end())
+	{
+		m_lru.splice(m_lru.begin(), m_lru, it->second.m_lru);
+
+		if(!it->second.m_name.empty())
+		{
+			res->append(it->second.m_name);
+			pthread_mutex_unlock(&m_thread->m_mutex);
+			return;
+		}
+	}
+	else if(m_pending.size() < NAME_RESOLVER_MAX_PENDING)
+	{
+		if(m_hosts.size() >= NAME_RESOLVER_CACHE_SIZE)
+		{
+			m_hosts.erase(m_lru.back());
+			m_lru.pop_back();
+		}
+
+		m_lru.push_front(ip);
+		m_hosts[ip].m_lru = m_lru.begin();
+		m_pending.push_back(ip);
+		pthread_cond_signal(&m_thread->m_cond);
+	}
+	else
+	{
+		m_n_drops++;
+	}
+
+	pthread_mutex_unlock(&m_thread->m_mutex);
+#endif
+
+	append_numeric_host(ip, res);
+}
+
+void sinsp_name_resolver::append_port(uint16_t port, uint8_t l4proto, OUT string* res)
+{
+	if(m_services_loaded)
+	{
+		unordered_map<uint32_t, string>::iterator it = m_services.find(((uint32_t)l4proto << 16) | port);
+
+		if(it != m_services.end())
+		{
+			res->append(it->second);
+			return;
+		}
+	}
+
+	char buf[8];
+	snprintf(buf, sizeof(buf), "%u", (unsigned int)port);
+	res->append(buf);
+}
+
+//
+// Parse /etc/services, whose lines are "<name> <port>/<protocol> [aliases]".
+// The first name of a port wins, like with getservbyport().
+//
+void sinsp_name_resolver::load_services()
+{
+	FILE* f = fopen("/etc/services", "r");
+	char line[512];
+	char name[128];
+	char proto[16];
+	unsigned int port;
+
+	if(f == NULL)
+	{
+		return;
+	}
+
+	while(fgets(line, sizeof(line), f) != NULL)
+	{
+		if(sscanf(line, "%127s %u/%15s", name, &port, proto) != 3 ||
+			name[0] == '#' ||
+			port > 65535)
+		{
+			continue;
+		}
+
+		uint32_t l4proto;
+
+		if(strcmp(proto, "tcp") == 0)
+		{
+			l4proto = SCAP_L4_TCP;
+		}
+		else if(strcmp(proto, "udp") == 0)
+		{
+			l4proto = SCAP_L4_UDP;
+		}
+		else
+		{
+			continue;
+		}
+
+		uint32_t key = (l4proto << 16) | port;
+
+		if(m_services.find(key) == m_services.end())
+		{
+			m_services[key] = name;
+		}
+	}
+
+	fclose(f);
+}
+
+void* sinsp_name_resolver::thread_main(void* arg)
+{
+	((sinsp_name_resolver*)arg)->run();
+	return NULL;
+}
+
+void sinsp_name_resolver::run()
+{
+#ifdef HAS_NAME_RESOLVER_THREAD
+	load_services();
+	__sync_synchronize();
+	m_services_loaded = true;
+
+	pthread_mutex_lock(&m_thread->m_mutex);
+
+	while(true)
+	{
+		while(m_pending.empty() && !m_thread->m_stop)
+		{
+			pthread_cond_wait(&m_thread->m_cond, &m_thread->m_mutex);
+		}
+
+		if(m_thread->m_stop)
+		{
+			break;
+		}
+
+		uint32_t ip = m_pending.front();
+		m_pending.pop_front();
+
+		//
+		// The lookup can take seconds, so it's done without the mutex
+		//
+		pthread_mutex_unlock(&m_thread->m_mutex);
+
+		struct sockaddr_in sa;
+		char host[NI_MAXHOST];
+		bool found;
+
+		memset(&sa, 0, sizeof(sa));
+		sa.sin_family = AF_INET;
+		sa.sin_addr.s_addr = ip;
+		found = (getnameinfo((struct sockaddr*)&sa, sizeof(sa), host, sizeof(host), NULL, 0, NI_NAMEREQD) == 0);
+		m_n_lookups++;
+
+		pthread_mutex_lock(&m_thread->m_mutex);
+
+		//
+		// The entry may have been dropped from the cache in the meantime.
+		// If the lookup failed, the name stays empty and the numeric form
+		// is used until the entry is dropped.
+		//
+		unordered_map<uint32_t, host_entry>::iterator it = m_hosts.find(ip);
+
+		if(found && it != m_hosts.end())
+		{
+			it->second.m_name = host;
+		}
+	}
+
+	pthread_mutex_unlock(&m_thread->m_mutex);
+#endif
+}
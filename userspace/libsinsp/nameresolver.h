@@ -0,0 +1,95 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+struct name_resolver_thread;
+
+///////////////////////////////////////////////////////////////////////////////
+// Names of the IPv4 addresses, from reverse DNS, and of the ports, from
+// /etc/services, for the output. The lookups happen in a thread of their
+// own: the capture only looks at the cache, and when a name is not there
+// yet it gets the numeric form and the address is queued for the thread.
+// The cache is bounded by NAME_RESOLVER_CACHE_SIZE addresses, and the least
+// recently used ones are dropped first.
+///////////////////////////////////////////////////////////////////////////////
+class SINSP_PUBLIC sinsp_name_resolver
+{
+public:
+	sinsp_name_resolver();
+	~sinsp_name_resolver();
+
+	//
+	// Start the thread. Returns false if threads are not supported on this
+	// platform, in which case nothing is ever resolved.
+	//
+	bool start();
+	void stop();
+
+	//
+	// Append the name of the address, in network byte order like in the
+	// tuples, or its numeric form. Never blocks.
+	//
+	void append_host(uint32_t ip, OUT string* res);
+
+	//
+	// Append the name of the port, or its number
+	//
+	void append_port(uint16_t port, uint8_t l4proto, OUT string* res);
+
+	uint64_t get_n_lookups()
+	{
+		return m_n_lookups;
+	}
+
+	uint64_t get_n_drops()
+	{
+		return m_n_drops;
+	}
+
+private:
+	struct host_entry
+	{
+		string m_name; // Empty while the lookup is pending, or if it failed
+		list<uint32_t>::iterator m_lru;
+	};
+
+	static void* thread_main(void* arg);
+	void run();
+	void load_services();
+	static void append_numeric_host(uint32_t ip, OUT string* res);
+
+	name_resolver_thread* m_thread;
+
+	//
+	// Protected by the mutex of the thread. The capture only tries to take
+	// it, and uses the numeric form if it's busy.
+	//
+	unordered_map<uint32_t, host_entry> m_hosts;
+	list<uint32_t> m_lru; // Most recently used first
+	deque<uint32_t> m_pending; // Addresses for the thread to resolve
+
+	//
+	// Filled by the thread before m_services_loaded is set, read only after
+	//
+	unordered_map<uint32_t, string> m_services; // Key is l4proto << 16 | port
+	volatile bool m_services_loaded;
+
+	uint64_t m_n_lookups; // Reverse DNS lookups done by the thread
+	uint64_t m_n_drops; // Addresses not queued because the queue was full
+};
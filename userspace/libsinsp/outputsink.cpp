@@ -0,0 +1,56 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _WIN32
+#include <unistd.h>
+#else
+#include <io.h>
+#define isatty _isatty
+#define fileno _fileno
+#endif
+
+#include "sinsp.h"
+#include "sinsp_int.h"
+
+sinsp_output_sink g_output_sink;
+
+//
+// Not a member, so that it's still there when the FILE is flushed at exit,
+// after the destructors of the globals. stdio can't be asked to allocate it,
+// because glibc then ignores the size.
+//
+static char g_output_buffer[SP_OUTPUT_BUFFER_SIZE];
+
+///////////////////////////////////////////////////////////////////////////////
+// sinsp_output_sink implementation
+///////////////////////////////////////////////////////////////////////////////
+sinsp_output_sink::sinsp_output_sink()
+{
+	m_file = stdout;
+	m_line_buffered = false;
+	m_flush_interval = false;
+	m_next_flush_ts = 0;
+}
+
+void sinsp_output_sink::init(FILE* f)
+{
+	m_file = f;
+	m_line_buffered = (isatty(fileno(f)) != 0);
+	setvbuf(f, g_output_buffer, m_line_buffered? _IOLBF : _IOFBF, sizeof(g_output_buffer));
+	m_flush_interval = false;
+}
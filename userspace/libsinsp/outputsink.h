@@ -0,0 +1,90 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+///////////////////////////////////////////////////////////////////////////////
+// Where the event lines of sysdig and of the chisels go. The lines are
+// written to a large stdio buffer, which is flushed when it's full, when
+// flush() is called, and during live captures at least every
+// SP_OUTPUT_FLUSH_INTERVAL_NS, instead of after every line. Only the
+// terminals get a flush at every line. Since the buffer is the one of the
+// FILE, the lines stay in order with what the chisels print from Lua.
+///////////////////////////////////////////////////////////////////////////////
+class SINSP_PUBLIC sinsp_output_sink
+{
+public:
+	sinsp_output_sink();
+
+	//
+	// Set the buffering of f, which must be done before anything is written
+	// to it
+	//
+	void init(FILE* f);
+
+	//
+	// If enable is true, the lines are flushed at least every
+	// SP_OUTPUT_FLUSH_INTERVAL_NS of event time
+	//
+	void set_flush_interval(bool enable)
+	{
+		m_flush_interval = enable && !m_line_buffered;
+		m_next_flush_ts = 0;
+	}
+
+	//
+	// The line and its end stay together when the chisels print from
+	// their own threads
+	//
+	void write_line(const string& line)
+	{
+#ifndef _WIN32
+		flockfile(m_file);
+#endif
+		fwrite(line.c_str(), 1, line.size(), m_file);
+		fputc('\n', m_file);
+#ifndef _WIN32
+		funlockfile(m_file);
+#endif
+	}
+
+	void flush()
+	{
+		fflush(m_file);
+	}
+
+	//
+	// Called after each event
+	//
+	void on_event(uint64_t ts)
+	{
+		if(m_flush_interval && ts >= m_next_flush_ts)
+		{
+			flush();
+			m_next_flush_ts = ts + SP_OUTPUT_FLUSH_INTERVAL_NS;
+		}
+	}
+
+private:
+	FILE* m_file;
+	bool m_line_buffered;
+	bool m_flush_interval;
+	uint64_t m_next_flush_ts;
+};
+
+extern sinsp_output_sink g_output_sink;
@@ -44,6 +44,8 @@ along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
 bool should_drop(sinsp_evt *evt);
 #endif
 
+extern sinsp_evttables g_infotables;
+
 sinsp_parser::sinsp_parser(sinsp *inspector) :
 	m_inspector(inspector),
 	m_tmp_evt(m_inspector),
@@ -52,23 +54,246 @@ sinsp_parser::sinsp_parser(sinsp *inspector) :
 #if !defined (_WIN32) && !defined(__APPLE__)
 	m_sysdig_pid = getpid();
 #endif
+
+	init_dispatch_table();
+
+#ifdef GATHER_INTERNAL_STATS
+	m_stateless_evts = &m_inspector->m_stats.get_metrics_registry().register_counter(internal_metrics::metric_name("parser_stateless_evts","Events parsed on the stateless path"));
+	m_stateful_evts = &m_inspector->m_stats.get_metrics_registry().register_counter(internal_metrics::metric_name("parser_stateful_evts","Events parsed on the full path"));
+#endif
 }
 
 sinsp_parser::~sinsp_parser()
 {
 }
 
+void sinsp_parser::init_dispatch_table()
+{
+	static const struct
+	{
+		uint16_t m_etype;
+		sinsp_parser_fn m_parse;
+	} parsers[] =
+	{
+		{PPME_SYSCALL_OPEN_E, &sinsp_parser::store_event},
+		{PPME_SOCKET_SOCKET_E, &sinsp_parser::store_event},
+		{PPME_SYSCALL_EVENTFD_E, &sinsp_parser::store_event},
+		{PPME_SYSCALL_CHDIR_E, &sinsp_parser::store_event},
+		{PPME_SYSCALL_FCHDIR_E, &sinsp_parser::store_event},
+		{PPME_SYSCALL_CREAT_E, &sinsp_parser::store_event},
+		{PPME_SYSCALL_OPENAT_E, &sinsp_parser::store_event},
+		{PPME_SOCKET_SHUTDOWN_E, &sinsp_parser::store_event},
+		{PPME_SYSCALL_GETRLIMIT_E, &sinsp_parser::store_event},
+		{PPME_SYSCALL_SETRLIMIT_E, &sinsp_parser::store_event},
+		{PPME_SYSCALL_PRLIMIT_E, &sinsp_parser::store_event},
+		{PPME_SOCKET_SENDTO_E, &sinsp_parser::store_event},
+		{PPME_SOCKET_SENDMSG_E, &sinsp_parser::store_event},
+		{PPME_SYSCALL_PREAD_E, &sinsp_parser::store_event},
+		{PPME_SYSCALL_PWRITE_E, &sinsp_parser::store_event},
+		{PPME_SYSCALL_PREADV_E, &sinsp_parser::store_event},
+		{PPME_SYSCALL_PWRITEV_E, &sinsp_parser::store_event},
+		{PPME_SYSCALL_LLSEEK_E, &sinsp_parser::store_event},
+		{PPME_SYSCALL_READ_X, &sinsp_parser::parse_rw_exit},
+		{PPME_SYSCALL_WRITE_X, &sinsp_parser::parse_rw_exit},
+		{PPME_SOCKET_RECV_X, &sinsp_parser::parse_rw_exit},
+		{PPME_SOCKET_SEND_X, &sinsp_parser::parse_rw_exit},
+		{PPME_SOCKET_RECVFROM_X, &sinsp_parser::parse_rw_exit},
+		{PPME_SOCKET_RECVMSG_X, &sinsp_parser::parse_rw_exit},
+		{PPME_SOCKET_SENDTO_X, &sinsp_parser::parse_rw_exit},
+		{PPME_SOCKET_SENDMSG_X, &sinsp_parser::parse_rw_exit},
+		{PPME_SYSCALL_READV_X, &sinsp_parser::parse_rw_exit},
+		{PPME_SYSCALL_WRITEV_X, &sinsp_parser::parse_rw_exit},
+		{PPME_SYSCALL_PREAD_X, &sinsp_parser::parse_rw_exit},
+		{PPME_SYSCALL_PWRITE_X, &sinsp_parser::parse_rw_exit},
+		{PPME_SYSCALL_PREADV_X, &sinsp_parser::parse_rw_exit},
+		{PPME_SYSCALL_PWRITEV_X, &sinsp_parser::parse_rw_exit},
+		{PPME_SYSCALL_OPEN_X, &sinsp_parser::parse_open_openat_creat_exit},
+		{PPME_SYSCALL_CREAT_X, &sinsp_parser::parse_open_openat_creat_exit},
+		{PPME_SYSCALL_OPENAT_X, &sinsp_parser::parse_open_openat_creat_exit},
+		{PPME_SYSCALL_SELECT_E, &sinsp_parser::parse_select_poll_epollwait_enter},
+		{PPME_SYSCALL_POLL_E, &sinsp_parser::parse_select_poll_epollwait_enter},
+		{PPME_SYSCALL_EPOLLWAIT_E, &sinsp_parser::parse_select_poll_epollwait_enter},
+		{PPME_CLONE_X, &sinsp_parser::parse_clone_exit},
+		{PPME_SYSCALL_EXECVE_X, &sinsp_parser::parse_execve_exit},
+		{PPME_PROCEXIT_E, &sinsp_parser::parse_thread_exit},
+		{PPME_SYSCALL_PIPE_X, &sinsp_parser::parse_pipe_exit},
+		{PPME_SOCKET_SOCKET_X, &sinsp_parser::parse_socket_exit},
+		{PPME_SOCKET_BIND_X, &sinsp_parser::parse_bind_exit},
+		{PPME_SOCKET_CONNECT_X, &sinsp_parser::parse_connect_exit},
+		{PPME_SOCKET_ACCEPT_X, &sinsp_parser::parse_accept_exit},
+		{PPME_SOCKET_ACCEPT4_X, &sinsp_parser::parse_accept_exit},
+		{PPME_SYSCALL_CLOSE_E, &sinsp_parser::parse_close_enter},
+		{PPME_SYSCALL_CLOSE_X, &sinsp_parser::parse_close_exit},
+		{PPME_SYSCALL_FCNTL_E, &sinsp_parser::parse_fcntl_enter},
+		{PPME_SYSCALL_FCNTL_X, &sinsp_parser::parse_fcntl_exit},
+		{PPME_SYSCALL_LSEEK_X, &sinsp_parser::parse_lseek_exit},
+		{PPME_SYSCALL_LLSEEK_X, &sinsp_parser::parse_lseek_exit},
+		{PPME_SYSCALL_EVENTFD_X, &sinsp_parser::parse_eventfd_exit},
+		{PPME_SYSCALL_CHDIR_X, &sinsp_parser::parse_chdir_exit},
+		{PPME_SYSCALL_FCHDIR_X, &sinsp_parser::parse_fchdir_exit},
+		{PPME_SYSCALL_GETCWD_X, &sinsp_parser::parse_getcwd_exit},
+		{PPME_SOCKET_SHUTDOWN_X, &sinsp_parser::parse_shutdown_exit},
+		{PPME_SYSCALL_DUP_X, &sinsp_parser::parse_dup_exit},
+		{PPME_SYSCALL_SIGNALFD_X, &sinsp_parser::parse_signalfd_exit},
+		{PPME_SYSCALL_TIMERFD_CREATE_X, &sinsp_parser::parse_timerfd_create_exit},
+		{PPME_SYSCALL_INOTIFY_INIT_X, &sinsp_parser::parse_inotify_init_exit},
+		{PPME_SYSCALL_GETRLIMIT_X, &sinsp_parser::parse_getrlimit_setrlimit_exit},
+		{PPME_SYSCALL_SETRLIMIT_X, &sinsp_parser::parse_getrlimit_setrlimit_exit},
+		{PPME_SYSCALL_PRLIMIT_X, &sinsp_parser::parse_prlimit_exit},
+		{PPME_SOCKET_SOCKETPAIR_X, &sinsp_parser::parse_socketpair_exit},
+		{PPME_SCHEDSWITCH_SUMMARY_E, &sinsp_parser::parse_switch_summary},
+		{PPME_PGFAULT_E, &sinsp_parser::parse_pgfault_summary},
+		{PPME_PROCINFO_E, &sinsp_parser::parse_procinfo},
+		{PPME_PROCSTATE_E, &sinsp_parser::parse_procstate},
+		{PPME_FDSTATE_E, &sinsp_parser::parse_fdstate},
+	};
+	uint32_t j;
+
+	for(j = 0; j < PPM_EVENT_MAX; j++)
+	{
+		const struct ppm_event_info* info = &g_infotables.m_event_info[j];
+		uint32_t flags = 0;
+
+		if(j >= PPME_SCHEDSWITCH_E && j <= PPME_DROP_X)
+		{
+			flags |= DISPATCH_IGNORE;
+		}
+
+		if(j == PPME_SAMPLING_E)
+		{
+			flags |= DISPATCH_IGNORE | DISPATCH_NO_FILTER;
+		}
+
+		if(j == PPME_DROP_E || j == PPME_DROP_X || j == PPME_SAMPLING_E)
+		{
+			flags |= DISPATCH_DROP_MARKER;
+		}
+
+		if(j == PPME_CLONE_X || j == PPME_PROCSTATE_E || j == PPME_FDSTATE_E)
+		{
+			flags |= DISPATCH_NO_PROC_LOOKUP;
+		}
+
+		if(j == PPME_CLONE_E || j == PPME_CLONE_X ||
+			j == PPME_SYSCALL_EXECVE_E || j == PPME_SYSCALL_EXECVE_X ||
+			j == PPME_PROCEXIT_E || j == PPME_PROCEXIT_X ||
+			j == PPME_PROCINFO_E || j == PPME_PROCSTATE_E || j == PPME_FDSTATE_E)
+		{
+			flags |= DISPATCH_LIFECYCLE;
+		}
+
+		if(PPME_IS_EXIT(j))
+		{
+			flags |= DISPATCH_EXIT;
+		}
+
+		if(info->flags & EF_USES_FD)
+		{
+			flags |= DISPATCH_USES_FD;
+		}
+
+		if(info->flags & EF_CREATES_FD)
+		{
+			flags |= DISPATCH_CREATES_FD;
+		}
+
+		if(j == PPME_SYSCALL_PIPE_X || j == PPME_SOCKET_SOCKETPAIR_X)
+		{
+			flags |= DISPATCH_CREATES_FD_PAIR;
+		}
+
+		if(info->flags & EF_MODIFIES_STATE)
+		{
+			flags |= DISPATCH_MODIFIES_STATE;
+		}
+
+		if(info->nparams != 0 &&
+			(strncmp(info->params[0].name, "res", 3) == 0 ||
+			strncmp(info->params[0].name, "fd", 2) == 0))
+		{
+			flags |= DISPATCH_HAS_RES;
+		}
+
+		m_dispatch[j].m_parse = NULL;
+		m_dispatch[j].m_flags = flags;
+	}
+
+	for(j = 0; j < sizeof(parsers) / sizeof(parsers[0]); j++)
+	{
+		m_dispatch[parsers[j].m_etype].m_parse = parsers[j].m_parse;
+	}
+
+	//
+	// The events that the parser doesn't look at, like the generic ones or
+	// the enter of most system calls, only need what the filters and the
+	// formatters read: the thread, the latency and the error code
+	//
+	for(j = 0; j < PPM_EVENT_MAX; j++)
+	{
+		if(m_dispatch[j].m_parse == NULL &&
+			!(m_dispatch[j].m_flags & (DISPATCH_IGNORE | DISPATCH_NO_PROC_LOOKUP | DISPATCH_USES_FD |
+			DISPATCH_CREATES_FD | DISPATCH_MODIFIES_STATE | DISPATCH_NO_FILTER | DISPATCH_DROP_MARKER |
+			DISPATCH_LIFECYCLE)))
+		{
+			m_dispatch[j].m_flags |= DISPATCH_STATELESS;
+		}
+	}
+}
+
+void sinsp_parser::add_event_hook(uint16_t etype, sinsp_event_hook hook, void* arg)
+{
+	event_hook h;
+
+	ASSERT(etype < PPM_EVENT_MAX);
+	h.m_hook = hook;
+	h.m_arg = arg;
+	m_dispatch[etype].m_hooks.push_back(h);
+	m_dispatch[etype].m_flags &= ~DISPATCH_STATELESS;
+}
+
+inline sinsp_string_pool* sinsp_parser::get_string_pool()
+{
+	return &m_inspector->m_thread_manager->m_string_pool;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // PROCESSING ENTRY POINT
 ///////////////////////////////////////////////////////////////////////////////
 void sinsp_parser::process_event(sinsp_evt *evt)
 {
+	sinsp_alloc_scope alloc_scope(SAS_PARSER);
 	uint16_t etype = evt->get_type();
+	const event_dispatch* dispatch;
+
+	ASSERT(etype < PPM_EVENT_MAX);
+	dispatch = &m_dispatch[etype];
+
+	if(dispatch->m_flags & DISPATCH_STATELESS)
+	{
+#ifdef GATHER_INTERNAL_STATS
+		m_stateless_evts->increment();
+#endif
+		process_stateless_event(evt, dispatch);
+		return;
+	}
+
+#ifdef GATHER_INTERNAL_STATS
+	m_stateful_evts->increment();
+#endif
 
 	//
 	// Cleanup the event-related state
 	//
-	reset(evt);
+	reset(evt, dispatch);
+
+	//
+	// The lost events accounting must see the drop markers even when the
+	// filter rejects them
+	//
+	if(dispatch->m_flags & DISPATCH_DROP_MARKER)
+	{
+		parse_drop_marker(evt);
+	}
 
 	//
 	// When debug mode is not enabled, filter out events about sysdig itself
@@ -85,23 +310,47 @@ void sinsp_parser::process_event(sinsp_evt *evt)
 	}
 #endif
 
+#if defined(HAS_FILTERING) && defined(HAS_CAPTURE_FILTERING)
+	//
+	// Sharding. The events of the other shards that change the state are
+	// dropped after parsing them, and the others right away
+	//
+	bool do_shard_later = false;
+
+	if(m_inspector->m_shard_count > 1 && !(dispatch->m_flags & DISPATCH_NO_FILTER))
+	{
+		if(dispatch->m_flags & (DISPATCH_MODIFIES_STATE | DISPATCH_LIFECYCLE))
+		{
+			do_shard_later = true;
+		}
+		else if(!in_shard(evt))
+		{
+			if(evt->m_tinfo != NULL)
+			{
+				evt->m_tinfo->m_lastevent_type = PPM_SC_MAX;
+			}
+
+			evt->m_filtered_out = true;
+			return;
+		}
+	}
+#endif
+
 	//
 	// Filtering
 	//
 #if defined(HAS_FILTERING) && defined(HAS_CAPTURE_FILTERING)
 	bool do_filter_later = false;
 
-	if(m_inspector->m_filter)
+	if(m_inspector->m_filter && !(dispatch->m_flags & DISPATCH_NO_FILTER))
 	{
-		ppm_event_flags eflags = evt->get_flags();
-
-		if(eflags & EF_MODIFIES_STATE)
+		if(dispatch->m_flags & DISPATCH_MODIFIES_STATE)
 		{
 			do_filter_later = true;
 		}
 		else
 		{
-			if(m_inspector->m_filter->run(evt) == false)
+			if(evt->m_batch_rejected || run_filter(evt) == false)
 			{
 				if(evt->m_tinfo != NULL)
 				{
@@ -115,142 +364,94 @@ void sinsp_parser::process_event(sinsp_evt *evt)
 	}
 
 	evt->m_filtered_out = false;
+
+	//
+	// Consistent sampling. Like the filter, it drops the events that don't
+	// change the state before parsing them, and the others after
+	//
+	sinsp_consistent_sampler::result sample_res = sinsp_consistent_sampler::SR_KEEP;
+
+	if(m_inspector->m_sampler != NULL &&
+		!(dispatch->m_flags & (DISPATCH_IGNORE | DISPATCH_NO_FILTER | DISPATCH_LIFECYCLE)))
+	{
+		sample_res = run_sampler(evt, dispatch);
+
+		if(sample_res == sinsp_consistent_sampler::SR_DROP && !(dispatch->m_flags & DISPATCH_MODIFIES_STATE))
+		{
+			if(evt->m_tinfo != NULL)
+			{
+				evt->m_tinfo->m_lastevent_type = PPM_SC_MAX;
+			}
+
+			m_inspector->m_sampler->add(false);
+			evt->m_filtered_out = true;
+			return;
+		}
+	}
 #endif
 
 	//
 	// Route the event to the proper function
 	//
-	switch(etype)
-	{
-	case PPME_SYSCALL_OPEN_E:
-	case PPME_SOCKET_SOCKET_E:
-	case PPME_SYSCALL_EVENTFD_E:
-	case PPME_SYSCALL_CHDIR_E:
-	case PPME_SYSCALL_FCHDIR_E:
-	case PPME_SYSCALL_CREAT_E:
-	case PPME_SYSCALL_OPENAT_E:
-	case PPME_SOCKET_SHUTDOWN_E:
-	case PPME_SYSCALL_GETRLIMIT_E:
-	case PPME_SYSCALL_SETRLIMIT_E:
-	case PPME_SYSCALL_PRLIMIT_E:
-	case PPME_SOCKET_SENDTO_E:
-	case PPME_SOCKET_SENDMSG_E:
-		store_event(evt);
-		break;
-	case PPME_SYSCALL_READ_X:
-	case PPME_SYSCALL_WRITE_X:
-	case PPME_SOCKET_RECV_X:
-	case PPME_SOCKET_SEND_X:
-	case PPME_SOCKET_RECVFROM_X:
-	case PPME_SOCKET_RECVMSG_X:
-	case PPME_SOCKET_SENDTO_X:
-	case PPME_SOCKET_SENDMSG_X:
-	case PPME_SYSCALL_READV_X:
-	case PPME_SYSCALL_WRITEV_X:
-	case PPME_SYSCALL_PREAD_X:
-	case PPME_SYSCALL_PWRITE_X:
-	case PPME_SYSCALL_PREADV_X:
-	case PPME_SYSCALL_PWRITEV_X:
-		parse_rw_exit(evt);
-		break;
-	case PPME_SYSCALL_OPEN_X:
-	case PPME_SYSCALL_CREAT_X:
-	case PPME_SYSCALL_OPENAT_X:
-		parse_open_openat_creat_exit(evt);
-		break;
-	case PPME_SYSCALL_SELECT_E:
-	case PPME_SYSCALL_POLL_E:
-	case PPME_SYSCALL_EPOLLWAIT_E:
-		parse_select_poll_epollwait_enter(evt);
-		break;
-	case PPME_CLONE_X:
-		parse_clone_exit(evt);
-		break;
-	case PPME_SYSCALL_EXECVE_X:
-		parse_execve_exit(evt);
-		break;
-	case PPME_PROCEXIT_E:
-		parse_thread_exit(evt);
-		break;
-	case PPME_SYSCALL_PIPE_X:
-		parse_pipe_exit(evt);
-		break;
-	case PPME_SOCKET_SOCKET_X:
-		parse_socket_exit(evt);
-		break;
-	case PPME_SOCKET_BIND_X:
-		parse_bind_exit(evt);
-		break;
-	case PPME_SOCKET_CONNECT_X:
-		parse_connect_exit(evt);
-		break;
-	case PPME_SOCKET_ACCEPT_X:
-	case PPME_SOCKET_ACCEPT4_X:
-		parse_accept_exit(evt);
-		break;
-	case PPME_SYSCALL_CLOSE_E:
-		parse_close_enter(evt);
-		break;
-	case PPME_SYSCALL_CLOSE_X:
-		parse_close_exit(evt);
-		break;
-	case PPME_SYSCALL_FCNTL_E:
-		parse_fcntl_enter(evt);
-		break;
-	case PPME_SYSCALL_FCNTL_X:
-		parse_fcntl_exit(evt);
-		break;
-	case PPME_SYSCALL_EVENTFD_X :
-		parse_eventfd_exit(evt);
-		break;
-	case PPME_SYSCALL_CHDIR_X:
-		parse_chdir_exit(evt);
-		break;
-	case PPME_SYSCALL_FCHDIR_X:
-		parse_fchdir_exit(evt);
-		break;
-	case PPME_SYSCALL_GETCWD_X:
-		parse_getcwd_exit(evt);
-		break;
-	case PPME_SOCKET_SHUTDOWN_X:
-		parse_shutdown_exit(evt);
-		break;
-	case PPME_SYSCALL_DUP_X:
-		parse_dup_exit(evt);
-		break;
-	case PPME_SYSCALL_SIGNALFD_X:
-		parse_signalfd_exit(evt);
-		break;
-	case PPME_SYSCALL_TIMERFD_CREATE_X:
-		parse_timerfd_create_exit(evt);
-		break;
-	case PPME_SYSCALL_INOTIFY_INIT_X:
-		parse_inotify_init_exit(evt);
-		break;
-	case PPME_SYSCALL_GETRLIMIT_X:
-	case PPME_SYSCALL_SETRLIMIT_X:
-		parse_getrlimit_setrlimit_exit(evt);
-		break;
-	case PPME_SYSCALL_PRLIMIT_X:
-		parse_prlimit_exit(evt);
-		break;
-	case PPME_SOCKET_SOCKETPAIR_X:
-		parse_socketpair_exit(evt);
-		break;
-	default:
-		break;
+	if(dispatch->m_parse != NULL)
+	{
+		(this->*(dispatch->m_parse))(evt);
+
+		//
+		// The parameters rendered before the parsing, e.g. by the filter,
+		// can resolve to the old state
+		//
+		evt->invalidate_rendered_params();
+	}
+
+#if defined(HAS_FILTERING) && defined(HAS_CAPTURE_FILTERING)
+	//
+	// The values that the filter extracted before the parsing can be stale
+	//
+	if(m_inspector->m_filter && !do_filter_later)
+	{
+		m_inspector->m_field_cache->invalidate();
+	}
+#endif
+
+	if(!dispatch->m_hooks.empty())
+	{
+		vector<event_hook>::const_iterator it;
+
+		for(it = dispatch->m_hooks.begin(); it != dispatch->m_hooks.end(); ++it)
+		{
+			it->m_hook(evt, it->m_arg);
+		}
+	}
+
+	//
+	// The stored enter event is not needed anymore once the exit is parsed
+	//
+	if((dispatch->m_flags & DISPATCH_EXIT) && evt->m_tinfo != NULL)
+	{
+		evt->m_tinfo->release_lastevent_data();
+	}
+
+#if defined(HAS_FILTERING) && defined(HAS_CAPTURE_FILTERING)
+	//
+	// After the parsing, so that the clone of a new thread finds the thread
+	// in the table
+	//
+	if(do_shard_later && !in_shard(evt))
+	{
+		evt->m_filtered_out = true;
+		return;
 	}
 
 	//
 	// With some state-changing events like clone, execve and open, we do the
 	// filtering after having updated the state
 	//
-#if defined(HAS_FILTERING) && defined(HAS_CAPTURE_FILTERING)
 	if(do_filter_later)
 	{
 		if(m_inspector->m_filter)
 		{
-			if(m_inspector->m_filter->run(evt) == false)
+			if(evt->m_batch_rejected || run_filter(evt) == false)
 			{
 				evt->m_filtered_out = true;
 				return;
@@ -258,6 +459,138 @@ void sinsp_parser::process_event(sinsp_evt *evt)
 		}
 		evt->m_filtered_out = false;
 	}
+
+	if(m_inspector->m_sampler != NULL &&
+		!(dispatch->m_flags & (DISPATCH_IGNORE | DISPATCH_NO_FILTER | DISPATCH_LIFECYCLE)))
+	{
+		//
+		// The connections that get their tuple from this event, e.g. with
+		// connect or accept, are looked up again now that it's parsed
+		//
+		if(sample_res == sinsp_consistent_sampler::SR_UNKNOWN && evt->m_tinfo != NULL)
+		{
+			int64_t fd = evt->m_tinfo->m_lastevent_fd;
+
+			if((dispatch->m_flags & DISPATCH_CREATES_FD) && (dispatch->m_flags & DISPATCH_EXIT) &&
+				(dispatch->m_flags & DISPATCH_HAS_RES))
+			{
+				fd = *(int64_t *)evt->get_param(0)->m_val;
+			}
+
+			sample_res = m_inspector->m_sampler->check_fd(fd >= 0? evt->m_tinfo->get_fd(fd) : NULL);
+		}
+
+		if(sample_res == sinsp_consistent_sampler::SR_DROP)
+		{
+			m_inspector->m_sampler->add(false);
+			evt->m_filtered_out = true;
+			return;
+		}
+
+		m_inspector->m_sampler->add(true);
+	}
+#endif
+}
+
+//
+// The short version of process_event() for the DISPATCH_STATELESS events.
+// There's no enter event to store or retrieve, no fd to look up, and
+// nothing to parse, so the filter and the sampler run right after the
+// thread is found.
+//
+void sinsp_parser::process_stateless_event(sinsp_evt *evt, const event_dispatch* dispatch)
+{
+	uint32_t dflags = dispatch->m_flags;
+	sinsp_threadinfo* tinfo;
+
+	evt->init();
+	evt->m_fdinfo = NULL;
+	evt->m_errorcode = 0;
+
+	tinfo = evt->get_thread_info(true);
+	evt->m_tinfo = tinfo;
+
+	if(tinfo != NULL)
+	{
+		if(tinfo->m_drop_gen != m_inspector->m_drop_gen)
+		{
+			if(tinfo->m_stale_gen == 0)
+			{
+				tinfo->m_stale_gen = m_inspector->m_drop_gen;
+			}
+
+			tinfo->m_drop_gen = m_inspector->m_drop_gen;
+		}
+
+		if(!(dflags & DISPATCH_EXIT))
+		{
+			tinfo->m_lastevent_fd = -1;
+			tinfo->m_lastevent_type = evt->get_type();
+			tinfo->m_latency = 0;
+			tinfo->m_last_latency_entertime = evt->get_ts();
+			tinfo->m_offcpu = 0;
+			tinfo->m_offcpu_start = 0;
+		}
+		else
+		{
+			if(tinfo->m_last_latency_entertime != 0)
+			{
+				tinfo->m_latency = evt->get_ts() - tinfo->m_last_latency_entertime;
+				ASSERT((int64_t)tinfo->m_latency >= 0);
+			}
+
+			if((dflags & DISPATCH_HAS_RES) && evt->get_type() == tinfo->m_lastevent_type + 1)
+			{
+				int64_t res = evt->get_param_value<int64_t>(0);
+
+				if(res < 0)
+				{
+					evt->m_errorcode = -(int32_t)res;
+				}
+			}
+		}
+	}
+
+#if !defined (_WIN32) && !defined(__APPLE__)
+	if(tinfo != NULL && tinfo->m_pid == m_sysdig_pid &&
+		m_inspector->is_live() && !m_inspector->is_debug_enabled())
+	{
+		evt->m_filtered_out = true;
+		return;
+	}
+#endif
+
+#if defined(HAS_FILTERING) && defined(HAS_CAPTURE_FILTERING)
+	if((m_inspector->m_shard_count > 1 && !in_shard(evt)) ||
+		(m_inspector->m_filter && (evt->m_batch_rejected || run_filter(evt) == false)))
+	{
+		if(tinfo != NULL)
+		{
+			tinfo->m_lastevent_type = PPM_SC_MAX;
+		}
+
+		evt->m_filtered_out = true;
+		return;
+	}
+
+	evt->m_filtered_out = false;
+
+	if(m_inspector->m_sampler != NULL)
+	{
+		if(run_sampler(evt, dispatch) == sinsp_consistent_sampler::SR_DROP)
+		{
+			if(tinfo != NULL)
+			{
+				tinfo->m_lastevent_type = PPM_SC_MAX;
+			}
+
+			m_inspector->m_sampler->add(false);
+			evt->m_filtered_out = true;
+			return;
+		}
+
+		m_inspector->m_sampler->add(true);
+	}
 #endif
 }
 
@@ -265,28 +598,98 @@ void sinsp_parser::process_event(sinsp_evt *evt)
 // HELPERS
 ///////////////////////////////////////////////////////////////////////////////
 
+#if defined(HAS_FILTERING) && defined(HAS_CAPTURE_FILTERING)
+//
+// Run the capture filter, timing it if the profiler is running
+//
+bool sinsp_parser::run_filter(sinsp_evt* evt)
+{
+	sinsp_profiler* prof = m_inspector->m_active_profiler;
+
+	if(prof == NULL)
+	{
+		return m_inspector->m_filter->run(evt);
+	}
+
+	uint64_t start = sinsp_profiler::now();
+	bool res = m_inspector->m_filter->run(evt);
+	prof->m_filter_ticks += sinsp_profiler::now() - start;
+	return res;
+}
+
+//
+// Whether an event is in the shard of the inspector, see sinsp::set_shard().
+// The events of the threads that are not in the table are in the shard of
+// their tid.
+//
+bool sinsp_parser::in_shard(sinsp_evt* evt)
+{
+	sinsp_threadinfo* tinfo = evt->m_tinfo;
+
+	if(tinfo == NULL)
+	{
+		tinfo = m_inspector->get_thread(evt->get_tid());
+	}
+
+	int64_t pid = (tinfo != NULL)? tinfo->m_pid : evt->get_tid();
+
+	return sinsp_consistent_sampler::get_shard(pid, m_inspector->m_shard_count) == m_inspector->m_shard_index;
+}
+
+//
+// Ask the consistent sampler about an event before parsing it. The events
+// that create an fd, and the ones on sockets that are not connected yet, are
+// SR_UNKNOWN until they're parsed.
+//
+sinsp_consistent_sampler::result sinsp_parser::run_sampler(sinsp_evt* evt, const event_dispatch* dispatch)
+{
+	sinsp_consistent_sampler* sampler = m_inspector->m_sampler;
+
+	if(sampler->get_mode() == SSM_PROCESS)
+	{
+		return sampler->check_thread(evt->m_tinfo);
+	}
+
+	//
+	// The fd of accept is the server socket, the event is about the new one
+	//
+	if((dispatch->m_flags & DISPATCH_CREATES_FD) && (dispatch->m_flags & DISPATCH_EXIT))
+	{
+		return sinsp_consistent_sampler::SR_UNKNOWN;
+	}
+
+	return sampler->check_fd(evt->m_fdinfo);
+}
+#endif
+
 //
 // Called before starting the parsing.
 // Returns false in case of issues resetting the state.
 //
-bool sinsp_parser::reset(sinsp_evt *evt)
+bool sinsp_parser::reset(sinsp_evt *evt, const event_dispatch* dispatch)
 {
 	//
 	// Before anything can happen, the event needs to be initialized
 	//
 	evt->init();
 
-	ppm_event_flags eflags = evt->get_flags();
+	uint32_t dflags = dispatch->m_flags;
 	uint16_t etype = evt->get_type();
 
 	evt->m_fdinfo = NULL;
 	evt->m_errorcode = 0;
 
 	//
-	// Ignore scheduler events
+	// Ignore scheduler events. The context switches still tell how long the
+	// threads wait in their system calls.
 	//
-	if(etype >= PPME_SCHEDSWITCH_E && etype <= PPME_DROP_X)
+	if(dflags & DISPATCH_IGNORE)
 	{
+		if(etype == PPME_SCHEDSWITCH_E || etype == PPME_SCHEDSWITCHEX_E)
+		{
+			account_offcpu(evt);
+		}
+
 		return false;
 	}
 
@@ -297,20 +700,12 @@ bool sinsp_parser::reset(sinsp_evt *evt)
 	//
 	// If we're exiting a clone, we don't look for /proc
 	//
-	bool query_os;
-	if(etype == PPME_CLONE_X)
-	{
-		query_os = false;
-	}
-	else
-	{
-		query_os = true;
-	}
+	bool query_os = !(dflags & DISPATCH_NO_PROC_LOOKUP);
 
 	evt->m_tinfo = evt->get_thread_info(query_os);
 	if(!evt->m_tinfo)
 	{
-		if(etype == PPME_CLONE_X)
+		if(!query_os)
 		{
 #ifdef GATHER_INTERNAL_STATS
 			m_inspector->m_thread_manager->m_failed_lookups->decrement();
@@ -324,12 +719,26 @@ bool sinsp_parser::reset(sinsp_evt *evt)
 		return false;
 	}
 
-	if(PPME_IS_ENTER(etype))
+	//
+	// If events were lost since the last one of this thread, its state can
+	// be out of date
+	//
+	if(evt->m_tinfo->m_drop_gen != m_inspector->m_drop_gen)
+	{
+		if(evt->m_tinfo->m_stale_gen == 0)
+		{
+			evt->m_tinfo->m_stale_gen = m_inspector->m_drop_gen;
+		}
+
+		evt->m_tinfo->m_drop_gen = m_inspector->m_drop_gen;
+	}
+
+	if(!(dflags & DISPATCH_EXIT))
 	{
 		evt->m_tinfo->m_lastevent_fd = -1;
 		evt->m_tinfo->m_lastevent_type = etype;
 
-		if(eflags & EF_USES_FD)
+		if(dflags & DISPATCH_USES_FD)
 		{
 			sinsp_evt_param *parinfo;
 
@@ -346,6 +755,8 @@ bool sinsp_parser::reset(sinsp_evt *evt)
 
 		evt->m_tinfo->m_latency = 0;
 		evt->m_tinfo->m_last_latency_entertime = evt->get_ts();
+		evt->m_tinfo->m_offcpu = 0;
+		evt->m_tinfo->m_offcpu_start = 0;
 	}
 	else
 	{
@@ -371,15 +782,9 @@ bool sinsp_parser::reset(sinsp_evt *evt)
 		//
 		// Error detection logic
 		//
-		if(evt->m_info->nparams != 0 &&
-			((evt->m_info->params[0].name[0] == 'r' && evt->m_info->params[0].name[1] == 'e' && evt->m_info->params[0].name[2] == 's') ||
-			(evt->m_info->params[0].name[0] == 'f' && evt->m_info->params[0].name[1] == 'd')))
+		if(dflags & DISPATCH_HAS_RES)
 		{
-			sinsp_evt_param *parinfo;
-
-			parinfo = evt->get_param(0);
-			ASSERT(parinfo->m_len == sizeof(int64_t));
-			int64_t res = *(int64_t *)parinfo->m_val;
+			int64_t res = evt->get_param_value<int64_t>(0);
 
 			if(res < 0)
 			{
@@ -390,7 +795,7 @@ bool sinsp_parser::reset(sinsp_evt *evt)
 		//
 		// Retrieve the fd
 		//
-		if(eflags & EF_USES_FD)
+		if(dflags & DISPATCH_USES_FD)
 		{
 			evt->m_fdinfo = evt->m_tinfo->get_fd(evt->m_tinfo->m_lastevent_fd);
 
@@ -423,7 +828,7 @@ bool sinsp_parser::reset(sinsp_evt *evt)
 			}
 		}
 
-		if(eflags & EF_CREATES_FD)
+		if(dflags & DISPATCH_CREATES_FD)
 		{
 			//
 			// Calculate (and if necessary update) the fd usage ratio
@@ -434,7 +839,7 @@ bool sinsp_parser::reset(sinsp_evt *evt)
 			//
 			// In case of pipe or socketpair, just the first FD is good enough
 			//
-			uint32_t parnum = (etype == PPME_SYSCALL_PIPE_X || etype == PPME_SOCKET_SOCKETPAIR_X)? 1 : 0;
+			uint32_t parnum = (dflags & DISPATCH_CREATES_FD_PAIR)? 1 : 0;
 
 			parinfo = evt->get_param(parnum);
 			ASSERT(parinfo->m_len == sizeof(int64_t));
@@ -504,7 +909,19 @@ bool sinsp_parser::retrieve_enter_event(sinsp_evt *enter_evt, sinsp_evt *exit_ev
 		return false;
 	}
 
-	enter_evt->init(exit_evt->m_tinfo->m_lastevent_data, exit_evt->m_tinfo->m_lastevent_cpuid);
+	uint8_t* enter_data = exit_evt->m_tinfo->m_lastevent_data.get();
+	if(enter_data == NULL)
+	{
+		//
+		// The enter event of this syscall was not stored
+		//
+#ifdef GATHER_INTERNAL_STATS
+		m_inspector->m_stats.m_n_retrieve_drops++;
+#endif
+		return false;
+	}
+
+	enter_evt->init(enter_data, exit_evt->m_tinfo->m_lastevent_cpuid);
 
 	//
 	// Make sure that we're using the right enter event, to prevent inconsistencies when events
@@ -529,6 +946,24 @@ bool sinsp_parser::retrieve_enter_event(sinsp_evt *enter_evt, sinsp_evt *exit_ev
 ///////////////////////////////////////////////////////////////////////////////
 // PARSERS
 ///////////////////////////////////////////////////////////////////////////////
+struct index_ipc_params
+{
+	sinsp_ipc_index* m_index;
+	int64_t m_pid;
+};
+
+static bool index_ipc_fd(int64_t fd, sinsp_fdinfo_t* fdinfo, void* arg)
+{
+	index_ipc_params* params = (index_ipc_params*)arg;
+
+	if(fdinfo->m_type == SCAP_FD_FIFO || fdinfo->m_type == SCAP_FD_UNIX_SOCK)
+	{
+		params->m_index->add(params->m_pid, fd, fdinfo);
+	}
+
+	return false;
+}
+
 void sinsp_parser::parse_clone_exit(sinsp_evt *evt)
 {
 	sinsp_evt_param *parinfo;
@@ -540,9 +975,7 @@ void sinsp_parser::parse_clone_exit(sinsp_evt *evt)
 	//
 	// Validate the return value and get the child tid
 	//
-	parinfo = evt->get_param(0);
-	ASSERT(parinfo->m_len == sizeof(int64_t));
-	childtid = *(int64_t *)parinfo->m_val;
+	childtid = evt->get_param_value<int64_t>(0);
 
 	if(childtid < 0)
 	{
@@ -575,27 +1008,21 @@ void sinsp_parser::parse_clone_exit(sinsp_evt *evt)
 			//
 			// Get the flags, and check if this is a process or a new thread
 			//
-			parinfo = evt->get_param(8);
-			ASSERT(parinfo->m_len == sizeof(int32_t));
-			uint32_t flags = *(int32_t *)parinfo->m_val;
+			uint32_t flags = evt->get_param_value<int32_t>(8);
 
 			if(flags & PPM_CL_CLONE_THREAD)
 			{
 				//
 				// This is a thread, the parent tid is the pid
 				//
-				parinfo = evt->get_param(4);
-				ASSERT(parinfo->m_len == sizeof(int64_t));
-				tid = *(int64_t *)parinfo->m_val;
+				tid = evt->get_param_value<int64_t>(4);
 			}
 			else
 			{
 				//
 				// This is not a thread, the parent tid is ptid
 				//
-				parinfo = evt->get_param(5);
-				ASSERT(parinfo->m_len == sizeof(int64_t));
-				tid = *(int64_t *)parinfo->m_val;
+				tid = evt->get_param_value<int64_t>(5);
 			}
 
 			//
@@ -661,21 +1088,11 @@ void sinsp_parser::parse_clone_exit(sinsp_evt *evt)
 	// Copy the command name from the parent
 	tinfo.m_comm = ptinfo->m_comm;
 
-	// Copy the full executable name from the parent
-	tinfo.m_exe = ptinfo->m_exe;
-
-	// Copy the command arguments from the parent
-	tinfo.m_args = ptinfo->m_args;
-
 	// Copy the pid
-	parinfo = evt->get_param(4);
-	ASSERT(parinfo->m_len == sizeof(int64_t));
-	tinfo.m_pid = *(int64_t *)parinfo->m_val;
+	tinfo.m_pid = evt->get_param_value<int64_t>(4);
 
 	// Get the flags, and check if this is a thread or a new thread
-	parinfo = evt->get_param(8);
-	ASSERT(parinfo->m_len == sizeof(int32_t));
-	tinfo.m_flags = *(int32_t *)parinfo->m_val;
+	tinfo.m_flags = evt->get_param_value<int32_t>(8) & ~PPM_CL_CMDLINE_INHERITED;
 
 	//
 	// If clone()'s PPM_CL_CLONE_THREAD is not set it means that a new
@@ -687,6 +1104,20 @@ void sinsp_parser::parse_clone_exit(sinsp_evt *evt)
 		tinfo.m_pid = childtid;
 	}
 
+	//
+	// Copy the full executable name and the command arguments from the
+	// parent. A new thread uses the ones of its main thread instead. The
+	// ones in the event are not needed, and the driver leaves them out
+	// (PPM_CL_CMDLINE_INHERITED) when the parent didn't exec in the
+	// meantime.
+	//
+	if(!(tinfo.m_flags & PPM_CL_CLONE_THREAD) ||
+		m_inspector->get_thread(tinfo.m_pid, false) == NULL)
+	{
+		tinfo.m_exe = ptinfo->get_exe_owner()->m_exe;
+		tinfo.m_args = ptinfo->get_args_owner()->m_args;
+	}
+
 	//
 	// Copy the fd list
 	// XXX this is a gross oversimplification that will need to be fixed.
@@ -696,6 +1127,10 @@ void sinsp_parser::parse_clone_exit(sinsp_evt *evt)
 	//
 	if(!(tinfo.m_flags & PPM_CL_CLONE_THREAD))
 	{
+		//
+		// The child shares the parent entries until one of the two changes them
+		//
+		ptinfo->get_fd_table()->share();
 		tinfo.m_fdtable = *(ptinfo->get_fd_table());
 
 		//
@@ -703,7 +1138,21 @@ void sinsp_parser::parse_clone_exit(sinsp_evt *evt)
 		// referring to an element in the parent's table.
 		//
 		tinfo.m_fdtable.reset_cache();
+
+		//
+		// The child has its own ends of the parent pipes and unix sockets
+		//
+		index_ipc_params iparams;
+		iparams.m_index = &m_inspector->m_thread_manager->m_ipc_index;
+		iparams.m_pid = tinfo.m_pid;
+		tinfo.m_fdtable.visit(index_ipc_fd, &iparams);
 	}
+
+	//
+	// The child can't know more than the parent about the fds
+	//
+	tinfo.m_stale_gen = ptinfo->m_stale_gen;
+
 	//if((tinfo.m_flags & (PPM_CL_CLONE_FILES)))
 	//{
 	//    tinfo.m_fdtable = ptinfo.m_fdtable;
@@ -714,24 +1163,33 @@ void sinsp_parser::parse_clone_exit(sinsp_evt *evt)
 		tinfo.m_flags |= PPM_CL_CLONE_INVERTED;
 	}
 
-	// Copy the working directory
+	//
+	// Copy the working directory. It's empty when the driver deferred it to
+	// a procinfo event, and it can only be the one of the parent anyway.
+	//
 	parinfo = evt->get_param(6);
-	tinfo.set_cwd(parinfo->m_val, parinfo->m_len);
+	if(parinfo->m_len > 1)
+	{
+		tinfo.set_cwd(parinfo->m_val, parinfo->m_len);
+	}
+	else
+	{
+		tinfo.m_cwd = ptinfo->get_pooled_cwd();
+	}
 
 	// Copy the fdlimit
-	parinfo = evt->get_param(7);
-	ASSERT(parinfo->m_len == sizeof(int64_t));
-	tinfo.m_fdlimit = *(int64_t *)parinfo->m_val;
+	tinfo.m_fdlimit = evt->get_param_value<int64_t>(7);
 
 	// Copy the uid
-	parinfo = evt->get_param(9);
-	ASSERT(parinfo->m_len == sizeof(int32_t));
-	tinfo.m_uid = *(int32_t *)parinfo->m_val;
+	tinfo.m_uid = evt->get_param_value<int32_t>(9);
 
 	// Copy the uid
-	parinfo = evt->get_param(10);
-	ASSERT(parinfo->m_len == sizeof(int32_t));
-	tinfo.m_gid = *(int32_t *)parinfo->m_val;
+	tinfo.m_gid = evt->get_param_value<int32_t>(10);
+
+	//
+	// The child starts in the cgroup of the parent
+	//
+	tinfo.m_container_num = ptinfo->m_container_num;
 
 	//
 	// Initilaize the thread clone time
@@ -752,9 +1210,7 @@ void sinsp_parser::parse_execve_exit(sinsp_evt *evt)
 	int64_t retval;
 
 	// Validate the return value
-	parinfo = evt->get_param(0);
-	ASSERT(parinfo->m_len == sizeof(int64_t));
-	retval = *(int64_t *)parinfo->m_val;
+	retval = evt->get_param_value<int64_t>(0);
 
 	if(retval < 0)
 	{
@@ -776,38 +1232,56 @@ void sinsp_parser::parse_execve_exit(sinsp_evt *evt)
 		return;
 	}
 
-	string prev_comm(evt->m_tinfo->m_comm);
-	string prev_exe(evt->m_tinfo->m_exe);
+	sinsp_pooled_string prev_comm(evt->m_tinfo->m_comm);
+	sinsp_pooled_string prev_exe(evt->m_tinfo->get_exe_owner()->m_exe);
 
 	// Get the command name
 	parinfo = evt->get_param(1);
-	string tmps = parinfo->m_val;
-	tmps = tmps.substr(tmps.rfind("/") + 1);
-	evt->m_tinfo->m_comm = tmps;
+	const char* commbegin = strrchr(parinfo->m_val, '/');
+	commbegin = (commbegin != NULL)? commbegin + 1 : parinfo->m_val;
+	evt->m_tinfo->m_comm.set(get_string_pool(), commbegin);
 
 	//
 	// XXX We should retrieve the full executable name from the arguments that execve receives in the kernel,
 	// but for the moment we don't do it, so we just copy the command name into the exe string
 	//
-	evt->m_tinfo->m_exe = parinfo->m_val;
+	evt->m_tinfo->m_exe.set(get_string_pool(), parinfo->m_val);
 
 	// Get the command arguments
 	parinfo = evt->get_param(2);
 	evt->m_tinfo->set_args(parinfo->m_val, parinfo->m_len);
 
 	// Get the pid
-	parinfo = evt->get_param(4);
-	ASSERT(parinfo->m_len == sizeof(uint64_t));
-	evt->m_tinfo->m_pid = *(uint64_t *)parinfo->m_val;
+	evt->m_tinfo->m_pid = evt->get_param_value<uint64_t>(4);
 
-	// Get the working directory
+	//
+	// Get the working directory. execve doesn't change it, so we keep the
+	// current one if the driver deferred it to a procinfo event.
+	//
 	parinfo = evt->get_param(6);
-	evt->m_tinfo->set_cwd(parinfo->m_val, parinfo->m_len);
+	if(parinfo->m_len > 1)
+	{
+		evt->m_tinfo->set_cwd(parinfo->m_val, parinfo->m_len);
+	}
 
 	// Get the fdlimit
-	parinfo = evt->get_param(7);
-	ASSERT(parinfo->m_len == sizeof(int64_t));
-	evt->m_tinfo->m_fdlimit = *(int64_t *)parinfo->m_val;
+	evt->m_tinfo->m_fdlimit = evt->get_param_value<int64_t>(7);
+
+	//
+	// Container runtimes move the process to the container cgroup between
+	// the clone and the execve, so this is where we find out it's in a
+	// container. The driver doesn't report the cgroup, so we can only do it
+	// when the process is still there to be looked up.
+	//
+	if(m_inspector->m_islive)
+	{
+		char cgroup[SCAP_MAX_PATH_SIZE];
+
+		if(scap_proc_get_cgroup(m_inspector->m_h, evt->get_tid(), cgroup, sizeof(cgroup)) == SCAP_SUCCESS)
+		{
+			evt->m_tinfo->m_container_num = m_inspector->m_container_manager.intern(cgroup);
+		}
+	}
 
 	//
 	// execve starts with a clean fd list, so we get rid of the fd list that clone
@@ -831,11 +1305,19 @@ void sinsp_parser::parse_execve_exit(sinsp_evt *evt)
 	//
 	evt->m_tinfo->m_flags |= PPM_CL_NAME_CHANGED;
 
+	//
+	// And the filter checks on its name, executable, arguments and
+	// container must look at it again
+	//
+	evt->m_tinfo->state_changed();
+
 	//
 	// execve potentially breaks the program chain, and so we need to reflect it in our parents program count.
 	//
 	if((prev_comm != evt->m_tinfo->m_comm) || (prev_exe != evt->m_tinfo->m_exe))
 	{
+		m_inspector->m_thread_manager->m_proc_tree.set_comm(evt->m_tinfo->m_pid, evt->m_tinfo->m_comm);
+
 		if(evt->m_tinfo->m_progid != -1LL)
 		{
 			m_inspector->m_thread_manager->decrement_program_childcount(evt->m_tinfo);
@@ -862,8 +1344,7 @@ void sinsp_parser::parse_open_openat_creat_exit(sinsp_evt *evt)
 	//  uint32_t mode;
 	sinsp_fdinfo_t fdi;
 	sinsp_evt *enter_evt = &m_tmp_evt;
-	string sdir;
-	string tdirstr;
+	const sinsp_pooled_string* dir;
 
 	ASSERT(evt->m_tinfo);
 
@@ -878,9 +1359,7 @@ void sinsp_parser::parse_open_openat_creat_exit(sinsp_evt *evt)
 	//
 	// Check the return value
 	//
-	parinfo = evt->get_param(0);
-	ASSERT(parinfo->m_len == sizeof(int64_t));
-	fd = *(int64_t *)parinfo->m_val;
+	fd = evt->get_param_value<int64_t>(0);
 
 	if(fd < 0)
 	{
@@ -899,11 +1378,9 @@ void sinsp_parser::parse_open_openat_creat_exit(sinsp_evt *evt)
 		name = parinfo->m_val;
 		namelen = parinfo->m_len;
 
-		parinfo = evt->get_param(2);
-		ASSERT(parinfo->m_len == sizeof(uint32_t));
-		flags = *(uint32_t *)parinfo->m_val;
+		flags = evt->get_param_value<uint32_t>(2);
 
-		sdir = evt->m_tinfo->get_cwd();
+		dir = &evt->m_tinfo->get_pooled_cwd();
 	}
 	else if(evt->get_type() == PPME_SYSCALL_CREAT_X)
 	{
@@ -913,7 +1390,7 @@ void sinsp_parser::parse_open_openat_creat_exit(sinsp_evt *evt)
 
 		flags = 0;
 
-		sdir = evt->m_tinfo->get_cwd();
+		dir = &evt->m_tinfo->get_pooled_cwd();
 	}
 	else if(evt->get_type() == PPME_SYSCALL_OPENAT_X)
 	{
@@ -921,13 +1398,9 @@ void sinsp_parser::parse_open_openat_creat_exit(sinsp_evt *evt)
 		name = parinfo->m_val;
 		namelen = parinfo->m_len;
 
-		parinfo = enter_evt->get_param(2);
-		ASSERT(parinfo->m_len == sizeof(uint32_t));
-		flags = *(uint32_t *)parinfo->m_val;
+		flags = enter_evt->get_param_value<uint32_t>(2);
 
-		parinfo = enter_evt->get_param(0);
-		ASSERT(parinfo->m_len == sizeof(int64_t));
-		int64_t dirfd = *(int64_t *)parinfo->m_val;
+		int64_t dirfd = enter_evt->get_param_value<int64_t>(0);
 
 		bool is_absolute = (name[0] == '/');
 
@@ -937,12 +1410,13 @@ void sinsp_parser::parse_open_openat_creat_exit(sinsp_evt *evt)
 			// The path is absoulte.
 			// Some processes (e.g. irqbalance) actually do this: they pass an invalid fd and
 			// and bsolute path, and openat succeeds.
+			// The path cache ignores the directory of the absolute paths.
 			//
-			sdir = ".";
+			dir = &evt->m_tinfo->get_pooled_cwd();
 		}
 		else if(dirfd == PPM_AT_FDCWD)
 		{
-			sdir = evt->m_tinfo->get_cwd();
+			dir = &evt->m_tinfo->get_pooled_cwd();
 		}
 		else
 		{
@@ -951,19 +1425,16 @@ void sinsp_parser::parse_open_openat_creat_exit(sinsp_evt *evt)
 			if(evt->m_fdinfo == NULL)
 			{
 				ASSERT(false);
-				sdir = "<UNKNOWN>";
+				fdi.add_filename(get_string_pool(),
+					"<UNKNOWN>",
+					sizeof("<UNKNOWN>") - 1,
+					name,
+					namelen);
+				dir = NULL;
 			}
 			else
 			{
-				if(evt->m_fdinfo->m_name[evt->m_fdinfo->m_name.length()] == '/')
-				{
-					sdir = evt->m_fdinfo->m_name;
-				}
-				else
-				{
-					tdirstr = evt->m_fdinfo->m_name + '/';
-					sdir = tdirstr;
-				}
+				dir = &evt->m_fdinfo->m_name;
 			}
 		}
 	}
@@ -983,10 +1454,27 @@ void sinsp_parser::parse_open_openat_creat_exit(sinsp_evt *evt)
 	//
 	fdi.m_type = SCAP_FD_FILE;
 	fdi.m_openflags = flags;
-	fdi.add_filename(sdir.c_str(),
-		sdir.length(),
-		name,
-		namelen);
+
+	//
+	// A file opened during the capture starts at offset 0, unless its
+	// writes go to its end
+	//
+	if(!(flags & PPM_O_APPEND))
+	{
+		fdi.m_access.set_offset(0);
+	}
+
+	//
+	// The same files are opened again and again from the same directories,
+	// so their full path is usually in the cache
+	//
+	if(dir != NULL)
+	{
+		fdi.m_name = m_inspector->m_thread_manager->m_path_cache.resolve(get_string_pool(),
+			*dir,
+			name,
+			namelen);
+	}
 
 	//
 	// Add the fd to the table.
@@ -1004,7 +1492,7 @@ inline void sinsp_parser::add_socket(sinsp_evt *evt, int64_t fd, uint32_t domain
 	//
 	// Populate the new fdi
 	//
-	memset(&(fdi.m_sockinfo.m_ipv4info), 0, sizeof(fdi.m_sockinfo.m_ipv4info));
+	memset(&(fdi.m_sockinfo), 0, sizeof(fdi.m_sockinfo));
 	fdi.m_type = SCAP_FD_UNKNOWN;
 	fdi.m_sockinfo.m_ipv4info.m_fields.m_l4proto = SCAP_L4_UNKNOWN;
 
@@ -1014,15 +1502,17 @@ inline void sinsp_parser::add_socket(sinsp_evt *evt, int64_t fd, uint32_t domain
 	}
 	else if(domain == PPM_AF_INET || domain == PPM_AF_INET6)
 	{
+		uint8_t l4proto = SCAP_L4_UNKNOWN;
+
 		fdi.m_type = (domain == PPM_AF_INET)? SCAP_FD_IPV4_SOCK : SCAP_FD_IPV6_SOCK;
 
 		if(protocol == IPPROTO_TCP)
 		{
-			fdi.m_sockinfo.m_ipv4info.m_fields.m_l4proto = SCAP_L4_TCP;
+			l4proto = SCAP_L4_TCP;
 		}
 		else if(protocol == IPPROTO_UDP)
 		{
-			fdi.m_sockinfo.m_ipv4info.m_fields.m_l4proto = SCAP_L4_UDP;
+			l4proto = SCAP_L4_UDP;
 		}
 		else if(protocol == IPPROTO_IP)
 		{
@@ -1033,11 +1523,11 @@ inline void sinsp_parser::add_socket(sinsp_evt *evt, int64_t fd, uint32_t domain
 			//
 			if((type & 0xff) == SOCK_STREAM)
 			{
-				fdi.m_sockinfo.m_ipv4info.m_fields.m_l4proto = SCAP_L4_TCP;
+				l4proto = SCAP_L4_TCP;
 			}
 			else if((type & 0xff) == SOCK_DGRAM)
 			{
-				fdi.m_sockinfo.m_ipv4info.m_fields.m_l4proto = SCAP_L4_UDP;
+				l4proto = SCAP_L4_UDP;
 			}
 			else
 			{
@@ -1046,7 +1536,20 @@ inline void sinsp_parser::add_socket(sinsp_evt *evt, int64_t fd, uint32_t domain
 		}
 		else if(protocol == IPPROTO_ICMP)
 		{
-			fdi.m_sockinfo.m_ipv4info.m_fields.m_l4proto = SCAP_L4_ICMP;
+			l4proto = SCAP_L4_ICMP;
+		}
+
+		//
+		// The IPv6 sockets keep their protocol in the IPv6 tuple, until a
+		// connection with IPv4-mapped addresses turns them into IPv4 ones
+		//
+		if(domain == PPM_AF_INET)
+		{
+			fdi.m_sockinfo.m_ipv4info.m_fields.m_l4proto = l4proto;
+		}
+		else
+		{
+			fdi.m_sockinfo.m_ipv6info.m_fields.m_l4proto = l4proto;
 		}
 	}
 	else
@@ -1077,7 +1580,6 @@ inline void sinsp_parser::add_socket(sinsp_evt *evt, int64_t fd, uint32_t domain
 
 void sinsp_parser::parse_socket_exit(sinsp_evt *evt)
 {
-	sinsp_evt_param *parinfo;
 	int64_t fd;
 	uint32_t domain;
 	uint32_t type;
@@ -1090,9 +1592,7 @@ void sinsp_parser::parse_socket_exit(sinsp_evt *evt)
 	// parameters in one scan. We don't care too much because we assume that we get here
 	// seldom enough that saving few tens of CPU cycles is not important.
 	//
-	parinfo = evt->get_param(0);
-	ASSERT(parinfo->m_len == sizeof(int64_t));
-	fd = *(int64_t *)parinfo->m_val;
+	fd = evt->get_param_value<int64_t>(0);
 
 	if(fd < 0)
 	{
@@ -1113,17 +1613,11 @@ void sinsp_parser::parse_socket_exit(sinsp_evt *evt)
 	//
 	// Extract the arguments
 	//
-	parinfo = enter_evt->get_param(0);
-	ASSERT(parinfo->m_len == sizeof(uint32_t));
-	domain = *(uint32_t *)parinfo->m_val;
+	domain = enter_evt->get_param_value<uint32_t>(0);
 
-	parinfo = enter_evt->get_param(1);
-	ASSERT(parinfo->m_len == sizeof(uint32_t));
-	type = *(uint32_t *)parinfo->m_val;
+	type = enter_evt->get_param_value<uint32_t>(1);
 
-	parinfo = enter_evt->get_param(2);
-	ASSERT(parinfo->m_len == sizeof(uint32_t));
-	protocol = *(uint32_t *)parinfo->m_val;
+	protocol = enter_evt->get_param_value<uint32_t>(2);
 
 	//
 	// Allocate a new fd descriptor, populate it and add it to the thread fd table
@@ -1134,6 +1628,7 @@ void sinsp_parser::parse_socket_exit(sinsp_evt *evt)
 void sinsp_parser::parse_bind_exit(sinsp_evt *evt)
 {
 	const char *parstr;
+	int64_t retval;
 
 	if(evt->m_fdinfo == NULL)
 	{
@@ -1143,7 +1638,46 @@ void sinsp_parser::parse_bind_exit(sinsp_evt *evt)
 	//
 	// Update the name of this socket
 	//
-	evt->m_fdinfo->m_name = evt->get_param_as_str(1, &parstr, sinsp_evt::PF_SIMPLE);
+	evt->m_fdinfo->m_name.set(get_string_pool(), evt->get_param_as_str(1, &parstr, sinsp_evt::PF_SIMPLE));
+
+	retval = evt->get_param_value<int64_t>(0);
+
+	if(retval < 0)
+	{
+		return;
+	}
+
+	//
+	// Keep note of the port, so that the connections that come from /proc
+	// later can be given the right direction
+	//
+	uint8_t* packed_data = (uint8_t*)evt->get_param(1)->m_val;
+	uint32_t addrlen = evt->get_param(1)->m_len;
+	uint16_t port;
+	uint8_t l4proto;
+
+	if(addrlen >= 7 && packed_data[0] == PPM_AF_INET && evt->m_fdinfo->m_type == SCAP_FD_IPV4_SOCK)
+	{
+		port = *(uint16_t*)(packed_data + 5);
+		l4proto = evt->m_fdinfo->m_sockinfo.m_ipv4info.m_fields.m_l4proto;
+	}
+	else if(addrlen >= 19 && packed_data[0] == PPM_AF_INET6 && evt->m_fdinfo->m_type == SCAP_FD_IPV6_SOCK)
+	{
+		port = *(uint16_t*)(packed_data + 17);
+		l4proto = evt->m_fdinfo->m_sockinfo.m_ipv6info.m_fields.m_l4proto;
+	}
+	else
+	{
+		return;
+	}
+
+	if(port != 0)
+	{
+		m_inspector->m_thread_manager->m_server_ports.add(evt->m_tinfo->m_pid,
+			evt->m_tinfo->m_lastevent_fd,
+			l4proto,
+			port);
+	}
 }
 
 void sinsp_parser::parse_connect_exit(sinsp_evt *evt)
@@ -1160,9 +1694,7 @@ void sinsp_parser::parse_connect_exit(sinsp_evt *evt)
 		return;
 	}
 
-	parinfo = evt->get_param(0);
-	ASSERT(parinfo->m_len == sizeof(uint64_t));
-	retval = *(int64_t*)parinfo->m_val;
+	retval = evt->get_param_value<int64_t>(0);
 
 	if(retval < 0)
 	{
@@ -1199,21 +1731,17 @@ void sinsp_parser::parse_connect_exit(sinsp_evt *evt)
 	//
 	if(family == PPM_AF_INET || family == PPM_AF_INET6)
 	{
-		if(family == PPM_AF_INET6)
-		{
-			//
-			// For the moment, we only support IPv4-mapped IPv6 addresses
-			// (http://en.wikipedia.org/wiki/IPv6#IPv4-mapped_IPv6_addresses)
-			//
-			uint8_t* sip = packed_data + 1;
-			uint8_t* dip = packed_data + 19;
-
-			if(!(sinsp_utils::is_ipv4_mapped_ipv6(sip) && sinsp_utils::is_ipv4_mapped_ipv6(dip)))
-			{
-				return;
-			}
+		//
+		// The IPv6 sockets that connect with IPv4-mapped addresses
+		// (http://en.wikipedia.org/wiki/IPv6#IPv4-mapped_IPv6_addresses)
+		// are tracked as IPv4 ones
+		//
+		bool is_ipv6 = (family == PPM_AF_INET6 &&
+			!(ipv6addr_is_ipv4_mapped(packed_data + 1) && ipv6addr_is_ipv4_mapped(packed_data + 19)));
 
-			evt->m_fdinfo->m_type = SCAP_FD_IPV4_SOCK;
+		if(family == PPM_AF_INET6 && !is_ipv6)
+		{
+			set_ipv4_mapped_type(evt->m_fdinfo);
 		}
 
 		//
@@ -1221,26 +1749,48 @@ void sinsp_parser::parse_connect_exit(sinsp_evt *evt)
 		// causes a connect with the wrong socket type to fail.
 		// Assert in debug mode and just keep going in release mode.
 		//
-		ASSERT(evt->m_fdinfo->m_type == SCAP_FD_IPV4_SOCK);
+		ASSERT(evt->m_fdinfo->m_type == (is_ipv6? SCAP_FD_IPV6_SOCK : SCAP_FD_IPV4_SOCK));
 
 #ifndef HAS_ANALYZER
 		//
-		// Update the FD info with this tuple
+		// Update the FD info with this tuple, and record this end in the
+		// connection table, so that the one that accepts it can be found
 		//
-		if(family == PPM_AF_INET)
+		if(is_ipv6)
 		{
-			m_inspector->m_parser->set_ipv4_addresses_and_ports(evt->m_fdinfo, packed_data);
+			m_inspector->m_parser->set_ipv6_addresses_and_ports(evt->m_fdinfo, packed_data);
+
+			m_inspector->m_ipv6_connections->add_connection(evt->m_fdinfo->m_sockinfo.m_ipv6info,
+				evt->m_tinfo->m_pid,
+				evt->m_tinfo->m_tid,
+				evt->m_tinfo->m_lastevent_fd,
+				true,
+				evt->get_ts());
 		}
 		else
 		{
-			m_inspector->m_parser->set_ipv4_mapped_ipv6_addresses_and_ports(evt->m_fdinfo, packed_data);
+			if(family == PPM_AF_INET)
+			{
+				m_inspector->m_parser->set_ipv4_addresses_and_ports(evt->m_fdinfo, packed_data);
+			}
+			else
+			{
+				m_inspector->m_parser->set_ipv4_mapped_ipv6_addresses_and_ports(evt->m_fdinfo, packed_data);
+			}
+
+			m_inspector->m_ipv4_connections->add_connection(evt->m_fdinfo->m_sockinfo.m_ipv4info,
+				evt->m_tinfo->m_pid,
+				evt->m_tinfo->m_tid,
+				evt->m_tinfo->m_lastevent_fd,
+				true,
+				evt->get_ts());
 		}
 #endif
 
 		//
 		// Add the friendly name to the fd info
 		//
-		evt->m_fdinfo->m_name = evt->get_param_as_str(1, &parstr, sinsp_evt::PF_SIMPLE);
+		evt->m_fdinfo->m_name.set(get_string_pool(), evt->get_param_as_str(1, &parstr, sinsp_evt::PF_SIMPLE));
 	}
 	else
 	{
@@ -1257,13 +1807,16 @@ void sinsp_parser::parse_connect_exit(sinsp_evt *evt)
 		//
 		// Add the friendly name to the fd info
 		//
-		evt->m_fdinfo->m_name = evt->get_param_as_str(1, &parstr, sinsp_evt::PF_SIMPLE);
+		evt->m_fdinfo->m_name.set(get_string_pool(), evt->get_param_as_str(1, &parstr, sinsp_evt::PF_SIMPLE));
 
 #ifndef HAS_ANALYZER
 		//
 		// Update the FD with this tuple
 		//
 		m_inspector->m_parser->set_unix_info(evt->m_fdinfo, packed_data);
+		m_inspector->m_thread_manager->m_ipc_index.add(evt->m_tinfo->m_pid,
+			evt->m_tinfo->m_lastevent_fd,
+			evt->m_fdinfo);
 #endif
 	}
 
@@ -1302,9 +1855,7 @@ void sinsp_parser::parse_accept_exit(sinsp_evt *evt)
 	//
 	// Extract the fd
 	//
-	parinfo = evt->get_param(0);
-	ASSERT(parinfo->m_len == sizeof(int64_t));
-	fd = *(int64_t *)parinfo->m_val;
+	fd = evt->get_param_value<int64_t>(0);
 
 	if(fd < 0)
 	{
@@ -1348,18 +1899,21 @@ void sinsp_parser::parse_accept_exit(sinsp_evt *evt)
 	else if(*packed_data == PPM_AF_INET6)
 	{
 		//
-		// We only support IPv4-mapped IPv6 addresses (http://en.wikipedia.org/wiki/IPv6#IPv4-mapped_IPv6_addresses)
-		// for the moment
+		// The connections with IPv4-mapped addresses (http://en.wikipedia.org/wiki/IPv6#IPv4-mapped_IPv6_addresses)
+		// are tracked as IPv4 ones
 		//
-		uint8_t* sip = packed_data + 1;
-		uint8_t* dip = packed_data + 19;
-
-		if(sinsp_utils::is_ipv4_mapped_ipv6(sip) && sinsp_utils::is_ipv4_mapped_ipv6(dip))
+		if(ipv6addr_is_ipv4_mapped(packed_data + 1) && ipv6addr_is_ipv4_mapped(packed_data + 19))
 		{
 			set_ipv4_mapped_ipv6_addresses_and_ports(&fdi, packed_data);
 			fdi.m_type = SCAP_FD_IPV4_SOCK;
 			fdi.m_sockinfo.m_ipv4info.m_fields.m_l4proto = SCAP_L4_TCP;
 		}
+		else
+		{
+			set_ipv6_addresses_and_ports(&fdi, packed_data);
+			fdi.m_type = SCAP_FD_IPV6_SOCK;
+			fdi.m_sockinfo.m_ipv6info.m_fields.m_l4proto = SCAP_L4_TCP;
+		}
 	}
 	else if(*packed_data == PPM_AF_UNIX)
 	{
@@ -1374,7 +1928,7 @@ void sinsp_parser::parse_accept_exit(sinsp_evt *evt)
 		return;
 	}
 
-	fdi.m_name = evt->get_param_as_str(1, &parstr, sinsp_evt::PF_SIMPLE);
+	fdi.m_name.set(get_string_pool(), evt->get_param_as_str(1, &parstr, sinsp_evt::PF_SIMPLE));
 	fdi.m_flags = 0;
 
 	if(m_fd_listener)
@@ -1393,6 +1947,25 @@ void sinsp_parser::parse_accept_exit(sinsp_evt *evt)
 	//
 	evt->m_fdinfo = evt->m_tinfo->add_fd(fd, &fdi);
 	ASSERT(evt->m_fdinfo != NULL);
+
+	if(evt->m_fdinfo != NULL && evt->m_fdinfo->is_ipv4_socket())
+	{
+		m_inspector->m_ipv4_connections->add_connection(evt->m_fdinfo->m_sockinfo.m_ipv4info,
+			evt->m_tinfo->m_pid,
+			evt->m_tinfo->m_tid,
+			fd,
+			false,
+			evt->get_ts());
+	}
+	else if(evt->m_fdinfo != NULL && evt->m_fdinfo->is_ipv6_socket())
+	{
+		m_inspector->m_ipv6_connections->add_connection(evt->m_fdinfo->m_sockinfo.m_ipv6info,
+			evt->m_tinfo->m_pid,
+			evt->m_tinfo->m_tid,
+			fd,
+			false,
+			evt->get_ts());
+	}
 }
 
 void sinsp_parser::parse_close_enter(sinsp_evt *evt)
@@ -1433,6 +2006,16 @@ void sinsp_parser::erase_fd(erase_fd_params* params)
 		return;
 	}
 
+	if(!params->m_inspector->m_state_listeners.empty())
+	{
+		vector<sinsp_state_listener*>::const_iterator it;
+
+		for(it = params->m_inspector->m_state_listeners.begin(); it != params->m_inspector->m_state_listeners.end(); ++it)
+		{
+			(*it)->on_fd_removed(params->m_tinfo, params->m_fd, params->m_fdinfo);
+		}
+	}
+
 	//
 	// Schedule the fd for removal
 	//
@@ -1442,6 +2025,45 @@ void sinsp_parser::erase_fd(erase_fd_params* params)
 		params->m_inspector->m_fds_to_remove->push_back(params->m_fd);
 	}
 
+	//
+	// If the fd was bound to a server port, it isn't anymore
+	//
+	if(params->m_fdinfo->m_type == SCAP_FD_IPV4_SERVSOCK || params->m_fdinfo->m_type == SCAP_FD_IPV6_SERVSOCK ||
+		params->m_fdinfo->m_type == SCAP_FD_IPV4_SOCK || params->m_fdinfo->m_type == SCAP_FD_IPV6_SOCK)
+	{
+		params->m_inspector->m_thread_manager->m_server_ports.remove(params->m_tinfo->m_pid, params->m_fd);
+	}
+	else if(params->m_fdinfo->m_type == SCAP_FD_FIFO || params->m_fdinfo->m_type == SCAP_FD_UNIX_SOCK)
+	{
+		params->m_inspector->m_thread_manager->m_ipc_index.remove(params->m_tinfo->m_pid, params->m_fd);
+	}
+
+	//
+	// Complete the transaction that was going on
+	//
+	if(!params->m_fdinfo->has_no_role())
+	{
+		params->m_inspector->m_transactions->on_close(params->m_tinfo, params->m_fd, params->m_fdinfo);
+	}
+
+	//
+	// Remove this end from the connection table
+	//
+	if(params->m_fdinfo->is_ipv4_socket() &&
+		(params->m_fdinfo->is_role_client() || params->m_fdinfo->is_role_server()))
+	{
+		params->m_inspector->m_ipv4_connections->remove_connection(params->m_fdinfo->m_sockinfo.m_ipv4info,
+			params->m_tinfo->m_pid,
+			params->m_fd);
+	}
+	else if(params->m_fdinfo->is_ipv6_socket() &&
+		(params->m_fdinfo->is_role_client() || params->m_fdinfo->is_role_server()))
+	{
+		params->m_inspector->m_ipv6_connections->remove_connection(params->m_fdinfo->m_sockinfo.m_ipv6info,
+			params->m_tinfo->m_pid,
+			params->m_fd);
+	}
+
 	if(m_fd_listener)
 	{
 		m_fd_listener->on_erase_fd(params);
@@ -1539,7 +2161,7 @@ void sinsp_parser::add_pipe(sinsp_evt *evt, int64_t tid, int64_t fd, uint64_t in
 	// Populate the new fdi
 	//
 	fdi.m_type = SCAP_FD_FIFO;
-	fdi.m_name = "";
+	fdi.m_name.clear();
 	fdi.m_ino = ino;
 
 	//
@@ -1568,27 +2190,26 @@ void sinsp_parser::parse_socketpair_exit(sinsp_evt *evt)
 		return;
 	}
 
-	parinfo = evt->get_param(1);
-	ASSERT(parinfo->m_len == sizeof(int64_t));
-	fd1 = *(int64_t *)parinfo->m_val;
+	fd1 = evt->get_param_value<int64_t>(1);
 
-	parinfo = evt->get_param(2);
-	ASSERT(parinfo->m_len == sizeof(int64_t));
-	fd2 = *(int64_t *)parinfo->m_val;
+	fd2 = evt->get_param_value<int64_t>(2);
 
-	parinfo = evt->get_param(3);
-	ASSERT(parinfo->m_len == sizeof(uint64_t));
-	source_address = *(uint64_t *)parinfo->m_val;
+	source_address = evt->get_param_value<uint64_t>(3);
 
-	parinfo = evt->get_param(4);
-	ASSERT(parinfo->m_len == sizeof(uint64_t));
-	peer_address = *(uint64_t *)parinfo->m_val;
+	peer_address = evt->get_param_value<uint64_t>(4);
 
 	sinsp_fdinfo_t fdi;
 	fdi.m_type = SCAP_FD_UNIX_SOCK;
 	fdi.m_sockinfo.m_unixinfo.m_fields.m_source = source_address;
 	fdi.m_sockinfo.m_unixinfo.m_fields.m_dest = peer_address;
 	evt->m_fdinfo = evt->m_tinfo->add_fd(fd1, &fdi);
+
+	//
+	// The addresses are the ones of the first socket, the second one is
+	// its peer
+	//
+	fdi.m_sockinfo.m_unixinfo.m_fields.m_source = peer_address;
+	fdi.m_sockinfo.m_unixinfo.m_fields.m_dest = source_address;
 	evt->m_tinfo->add_fd(fd2, &fdi);
 }
 
@@ -1611,17 +2232,11 @@ void sinsp_parser::parse_pipe_exit(sinsp_evt *evt)
 		return;
 	}
 
-	parinfo = evt->get_param(1);
-	ASSERT(parinfo->m_len == sizeof(int64_t));
-	fd1 = *(int64_t *)parinfo->m_val;
+	fd1 = evt->get_param_value<int64_t>(1);
 
-	parinfo = evt->get_param(2);
-	ASSERT(parinfo->m_len == sizeof(int64_t));
-	fd2 = *(int64_t *)parinfo->m_val;
+	fd2 = evt->get_param_value<int64_t>(2);
 
-	parinfo = evt->get_param(3);
-	ASSERT(parinfo->m_len == sizeof(uint64_t));
-	ino = *(uint64_t *)parinfo->m_val;
+	ino = evt->get_param_value<uint64_t>(3);
 
 	add_pipe(evt, evt->get_tid(), fd1, ino);
 	add_pipe(evt, evt->get_tid(), fd2, ino);
@@ -1636,7 +2251,7 @@ void sinsp_parser::parse_thread_exit(sinsp_evt *evt)
 	if(evt->m_tinfo)
 	{
 		evt->m_tinfo->m_flags |= PPM_CL_CLOSED;
-		m_inspector->m_tid_to_remove = evt->get_tid();
+		m_inspector->m_tids_to_remove.push_back(evt->get_tid());
 	}
 }
 
@@ -1708,6 +2323,51 @@ bool sinsp_parser::set_ipv4_mapped_ipv6_addresses_and_ports(sinsp_fdinfo_t* fdin
 	return true;
 }
 
+bool sinsp_parser::set_ipv6_addresses_and_ports(sinsp_fdinfo_t* fdinfo, uint8_t* packed_data)
+{
+	ipv6tuple* tuple = &fdinfo->m_sockinfo.m_ipv6info;
+	uint8_t* tsip = packed_data + 1;
+	uint8_t* tdip = packed_data + 19;
+	uint16_t tsport, tdport;
+
+	tsport = *(uint16_t *)(packed_data + 17);
+	tdport = *(uint16_t *)(packed_data + 35);
+
+	if(fdinfo->m_type == SCAP_FD_IPV6_SOCK)
+	{
+		if((tsport == tuple->m_fields.m_sport &&
+			tdport == tuple->m_fields.m_dport &&
+			ipv6addr_equal(tsip, tuple->m_fields.m_sip) &&
+			ipv6addr_equal(tdip, tuple->m_fields.m_dip)) ||
+			(tdport == tuple->m_fields.m_sport &&
+			tsport == tuple->m_fields.m_dport &&
+			ipv6addr_equal(tdip, tuple->m_fields.m_sip) &&
+			ipv6addr_equal(tsip, tuple->m_fields.m_dip))
+			)
+		{
+			return false;
+		}
+	}
+
+	memcpy(tuple->m_fields.m_sip, tsip, sizeof(tuple->m_fields.m_sip));
+	tuple->m_fields.m_sport = tsport;
+	memcpy(tuple->m_fields.m_dip, tdip, sizeof(tuple->m_fields.m_dip));
+	tuple->m_fields.m_dport = tdport;
+
+	return true;
+}
+
+void sinsp_parser::set_ipv4_mapped_type(sinsp_fdinfo_t* fdinfo)
+{
+	if(fdinfo->m_type == SCAP_FD_IPV6_SOCK)
+	{
+		uint8_t l4proto = fdinfo->m_sockinfo.m_ipv6info.m_fields.m_l4proto;
+
+		fdinfo->m_type = SCAP_FD_IPV4_SOCK;
+		fdinfo->m_sockinfo.m_ipv4info.m_fields.m_l4proto = l4proto;
+	}
+}
+
 bool sinsp_parser::set_unix_info(sinsp_fdinfo_t* fdinfo, uint8_t* packed_data)
 {
 	fdinfo->m_sockinfo.m_unixinfo.m_fields.m_source = *(uint64_t *)(packed_data + 1);
@@ -1748,22 +2408,34 @@ bool sinsp_parser::update_fd(sinsp_evt *evt, sinsp_evt_param *parinfo)
 	else if(family == PPM_AF_INET6)
 	{
 		//
-		// For the moment, we only support IPv4-mapped IPv6 addresses
+		// The IPv4-mapped IPv6 addresses
 		// (http://en.wikipedia.org/wiki/IPv6#IPv4-mapped_IPv6_addresses)
+		// are tracked as IPv4 ones
 		//
-		uint8_t* sip = packed_data + 1;
-		uint8_t* dip = packed_data + 19;
-
-		if(!(sinsp_utils::is_ipv4_mapped_ipv6(sip) && sinsp_utils::is_ipv4_mapped_ipv6(dip)))
+		if(ipv6addr_is_ipv4_mapped(packed_data + 1) && ipv6addr_is_ipv4_mapped(packed_data + 19))
 		{
-			return false;
+			set_ipv4_mapped_type(evt->m_fdinfo);
+			evt->m_fdinfo->m_type = SCAP_FD_IPV4_SOCK;
+
+			if(set_ipv4_mapped_ipv6_addresses_and_ports(evt->m_fdinfo, packed_data) == false)
+			{
+				return false;
+			}
 		}
+		else
+		{
+			if(evt->m_fdinfo->m_type == SCAP_FD_IPV6_SERVSOCK)
+			{
+				evt->m_fdinfo->m_sockinfo.m_ipv6info.m_fields.m_l4proto =
+					evt->m_fdinfo->m_sockinfo.m_ipv6serverinfo.m_l4proto;
+			}
 
-		evt->m_fdinfo->m_type = SCAP_FD_IPV4_SOCK;
+			evt->m_fdinfo->m_type = SCAP_FD_IPV6_SOCK;
 
-		if(set_ipv4_mapped_ipv6_addresses_and_ports(evt->m_fdinfo, packed_data) == false)
-		{
-			return false;
+			if(set_ipv6_addresses_and_ports(evt->m_fdinfo, packed_data) == false)
+			{
+				return false;
+			}
 		}
 	}
 
@@ -1772,7 +2444,14 @@ bool sinsp_parser::update_fd(sinsp_evt *evt, sinsp_evt_param *parinfo)
 	// connection is UDP, because TCP would fail if the address is changed in
 	// the middle of a connection.
 	//
-	if(evt->m_fdinfo->m_sockinfo.m_ipv4info.m_fields.m_l4proto == SCAP_L4_UNKNOWN)
+	if(evt->m_fdinfo->m_type == SCAP_FD_IPV6_SOCK)
+	{
+		if(evt->m_fdinfo->m_sockinfo.m_ipv6info.m_fields.m_l4proto == SCAP_L4_UNKNOWN)
+		{
+			evt->m_fdinfo->m_sockinfo.m_ipv6info.m_fields.m_l4proto = SCAP_L4_UDP;
+		}
+	}
+	else if(evt->m_fdinfo->m_sockinfo.m_ipv4info.m_fields.m_l4proto == SCAP_L4_UNKNOWN)
 	{
 		evt->m_fdinfo->m_sockinfo.m_ipv4info.m_fields.m_l4proto = SCAP_L4_UDP;
 	}
@@ -1780,7 +2459,7 @@ bool sinsp_parser::update_fd(sinsp_evt *evt, sinsp_evt_param *parinfo)
 	//
 	// If this is an incomplete tuple, patch it using interface info
 	//
-	m_inspector->m_network_interfaces->update_fd(evt->m_fdinfo);
+	m_inspector->get_ifaddr_list()->update_fd(evt->m_fdinfo);
 
 	return true;
 }
@@ -1798,6 +2477,18 @@ void sinsp_parser::swap_ipv4_addresses(sinsp_fdinfo_t* fdinfo)
 	fdinfo->m_sockinfo.m_ipv4info.m_fields.m_dport = tport;
 }
 
+bool sinsp_parser::same_ipv4_name(sinsp_fdinfo_t* fdinfo, scap_fd_type prev_type, ipv4tuple* prev_tuple)
+{
+	//
+	// A datagram socket gets its tuple with every read and write, almost
+	// always the same one, so the name is formatted and interned again only
+	// when the tuple changes
+	//
+	return prev_type == SCAP_FD_IPV4_SOCK &&
+		fdinfo->m_name.length() != 0 &&
+		memcmp(prev_tuple->m_all, fdinfo->m_sockinfo.m_ipv4info.m_all, sizeof(prev_tuple->m_all)) == 0;
+}
+
 void sinsp_parser::parse_rw_exit(sinsp_evt *evt)
 {
 	sinsp_evt_param *parinfo;
@@ -1814,9 +2505,7 @@ void sinsp_parser::parse_rw_exit(sinsp_evt *evt)
 	//
 	// Extract the return value
 	//
-	parinfo = evt->get_param(0);
-	ASSERT(parinfo->m_len == sizeof(int64_t));
-	retval = *(int64_t *)parinfo->m_val;
+	retval = evt->get_param_value<int64_t>(0);
 
 	//
 	// If the operation was successful, validate that the fd exists
@@ -1824,11 +2513,19 @@ void sinsp_parser::parse_rw_exit(sinsp_evt *evt)
 	if(retval >= 0)
 	{
 		uint16_t etype = evt->get_type();
+		char *data;
+		uint32_t datalen;
+		uint64_t latency = 0;
+
+		//
+		// In the buffer hash mode the data parameter holds a hash, that
+		// the listeners and the decoders can't use
+		//
+		const scap_machine_info* mi = m_inspector->get_source_machine_info(SCAP_TID_SOURCE(tid));
+		bool data_is_hash = (mi != NULL && (mi->flags & SCAP_MI_BUFFER_HASH) != 0);
 
 		if(eflags & EF_READS_FROM_FD)
 		{
-			char *data;
-			uint32_t datalen;
 			int32_t tupleparam = -1;
 
 			if(etype == PPME_SOCKET_RECVFROM_X)
@@ -1848,6 +2545,9 @@ void sinsp_parser::parse_rw_exit(sinsp_evt *evt)
 				// datagram one or because some event was lost),
 				// add it here.
 				//
+				ipv4tuple prev_tuple = evt->m_fdinfo->m_sockinfo.m_ipv4info;
+				scap_fd_type prev_type = evt->m_fdinfo->m_type;
+
 				if(update_fd(evt, evt->get_param(tupleparam)))
 				{
 					const char *parstr;
@@ -1869,15 +2569,18 @@ void sinsp_parser::parse_rw_exit(sinsp_evt *evt)
 							swap_ipv4_addresses(evt->m_fdinfo);
 						}
 
-						sinsp_utils::sockinfo_to_str(&evt->m_fdinfo->m_sockinfo,
-							fdtype, &evt->m_paramstr_storage[0],
-							evt->m_paramstr_storage.size());
+						if(!same_ipv4_name(evt->m_fdinfo, prev_type, &prev_tuple))
+						{
+							sinsp_utils::sockinfo_to_str(&evt->m_fdinfo->m_sockinfo,
+								fdtype, &evt->m_paramstr_storage[0],
+								evt->m_paramstr_storage.size());
 
-						evt->m_fdinfo->m_name = &evt->m_paramstr_storage[0];
+							evt->m_fdinfo->m_name.set(get_string_pool(), &evt->m_paramstr_storage[0]);
+						}
 					}
 					else
 					{
-						evt->m_fdinfo->m_name = evt->get_param_as_str(tupleparam, &parstr, sinsp_evt::PF_SIMPLE);
+						evt->m_fdinfo->m_name.set(get_string_pool(), evt->get_param_as_str(tupleparam, &parstr, sinsp_evt::PF_SIMPLE));
 					}
 				}
 			}
@@ -1894,8 +2597,8 @@ void sinsp_parser::parse_rw_exit(sinsp_evt *evt)
 				parinfo = evt->get_param(1);
 			}
 
-			datalen = parinfo->m_len;
-			data = parinfo->m_val;
+			datalen = data_is_hash ? 0 : parinfo->m_len;
+			data = data_is_hash ? NULL : parinfo->m_val;
 
 			if(m_fd_listener)
 			{
@@ -1904,8 +2607,6 @@ void sinsp_parser::parse_rw_exit(sinsp_evt *evt)
 		}
 		else
 		{
-			char *data;
-			uint32_t datalen;
 			int32_t tupleparam = -1;
 
 			if(etype == PPME_SOCKET_SENDTO_X || etype == PPME_SOCKET_SENDMSG_X)
@@ -1925,6 +2626,9 @@ void sinsp_parser::parse_rw_exit(sinsp_evt *evt)
 					return;
 				}
 
+				ipv4tuple prev_tuple = evt->m_fdinfo->m_sockinfo.m_ipv4info;
+				scap_fd_type prev_type = evt->m_fdinfo->m_type;
+
 				if(update_fd(evt, enter_evt->get_param(tupleparam)))
 				{
 					const char *parstr;
@@ -1946,15 +2650,18 @@ void sinsp_parser::parse_rw_exit(sinsp_evt *evt)
 							swap_ipv4_addresses(evt->m_fdinfo);
 						}
 
-						sinsp_utils::sockinfo_to_str(&evt->m_fdinfo->m_sockinfo,
-							fdtype, &evt->m_paramstr_storage[0],
-							evt->m_paramstr_storage.size());
+						if(!same_ipv4_name(evt->m_fdinfo, prev_type, &prev_tuple))
+						{
+							sinsp_utils::sockinfo_to_str(&evt->m_fdinfo->m_sockinfo,
+								fdtype, &evt->m_paramstr_storage[0],
+								evt->m_paramstr_storage.size());
 
-						evt->m_fdinfo->m_name = &evt->m_paramstr_storage[0];
+							evt->m_fdinfo->m_name.set(get_string_pool(), &evt->m_paramstr_storage[0]);
+						}
 					}
 					else
 					{
-						evt->m_fdinfo->m_name = enter_evt->get_param_as_str(tupleparam, &parstr, sinsp_evt::PF_SIMPLE);
+						evt->m_fdinfo->m_name.set(get_string_pool(), enter_evt->get_param_as_str(tupleparam, &parstr, sinsp_evt::PF_SIMPLE));
 					}
 				}
 			}
@@ -1963,20 +2670,154 @@ void sinsp_parser::parse_rw_exit(sinsp_evt *evt)
 			// Extract the data buffer
 			//
 			parinfo = evt->get_param(1);
-			datalen = parinfo->m_len;
-			data = parinfo->m_val;
+			datalen = data_is_hash ? 0 : parinfo->m_len;
+			data = data_is_hash ? NULL : parinfo->m_val;
 
 			if(m_fd_listener)
 			{
 				m_fd_listener->on_write(evt, tid, evt->m_tinfo->m_lastevent_fd, data, (uint32_t)retval, datalen);
 			}
 		}
+
+		//
+		// Update the I/O counters of the fd and of the thread
+		//
+#ifdef HAS_FILTERING
+		latency = evt->m_tinfo->m_latency;
+#endif
+		evt->m_fdinfo->m_io.add((eflags & EF_READS_FROM_FD) != 0, retval, latency);
+		evt->m_tinfo->m_io.add((eflags & EF_READS_FROM_FD) != 0, retval, latency);
+
+		if(evt->m_fdinfo->m_type == SCAP_FD_FILE)
+		{
+			update_access_pattern(evt, retval);
+		}
+
+		//
+		// Track the request/response transactions of the connections and
+		// decode their application protocol
+		//
+		if(!evt->m_fdinfo->has_no_role())
+		{
+			m_inspector->m_transactions->on_rw(evt,
+				evt->m_tinfo,
+				evt->m_tinfo->m_lastevent_fd,
+				evt->m_fdinfo,
+				(eflags & EF_READS_FROM_FD) != 0,
+				retval);
+
+			m_inspector->m_protocol_decoders->on_rw(evt->m_fdinfo,
+				(eflags & EF_READS_FROM_FD) != 0,
+				data,
+				datalen,
+				retval);
+		}
+	}
+}
+
+//
+// Follow where a successful read or write of len bytes happened in its file
+//
+void sinsp_parser::update_access_pattern(sinsp_evt *evt, uint64_t len)
+{
+	sinsp_access_pattern* access = &evt->m_fdinfo->m_access;
+	sinsp_evt *enter_evt = &m_tmp_evt;
+	int32_t posparam;
+
+	switch(evt->get_type())
+	{
+	case PPME_SYSCALL_PREAD_X:
+	case PPME_SYSCALL_PWRITE_X:
+	case PPME_SYSCALL_PWRITEV_X:
+		posparam = 2;
+		break;
+	case PPME_SYSCALL_PREADV_X:
+		posparam = 1;
+		break;
+	default:
+		if((evt->get_flags() & EF_WRITES_TO_FD) && (evt->m_fdinfo->m_openflags & PPM_O_APPEND))
+		{
+			access->add_append(len);
+		}
+		else
+		{
+			access->add(len);
+		}
+
+		return;
+	}
+
+	//
+	// The position is in the enter event
+	//
+	if(retrieve_enter_event(enter_evt, evt))
+	{
+		access->add_at(true, enter_evt->get_param_value<uint64_t>(posparam), len);
+	}
+	else
+	{
+		access->add_at(false, 0, len);
+	}
+}
+
+void sinsp_parser::parse_lseek_exit(sinsp_evt *evt)
+{
+	sinsp_access_pattern* access;
+	sinsp_evt *enter_evt = &m_tmp_evt;
+	int64_t res;
+
+	if(evt->m_fdinfo == NULL || evt->m_fdinfo->m_type != SCAP_FD_FILE)
+	{
+		return;
+	}
+
+	access = &evt->m_fdinfo->m_access;
+	res = evt->get_param_value<int64_t>(0);
+
+	if(res < 0)
+	{
+		return;
+	}
+
+	//
+	// lseek returns the new offset
+	//
+	if(evt->get_type() == PPME_SYSCALL_LSEEK_X)
+	{
+		access->set_offset(res);
+		return;
+	}
+
+	//
+	// llseek returns 0, the new offset comes from its arguments
+	//
+	if(!retrieve_enter_event(enter_evt, evt))
+	{
+		access->m_offset_known = false;
+		return;
+	}
+
+	uint64_t offset = enter_evt->get_param_value<uint64_t>(1);
+
+	switch(enter_evt->get_param_value<uint8_t>(2))
+	{
+	case PPM_SEEK_SET:
+		access->set_offset(offset);
+		break;
+	case PPM_SEEK_CUR:
+		if(access->m_offset_known)
+		{
+			access->set_offset(access->m_offset + offset);
+		}
+		break;
+	default:
+		access->m_offset_known = false;
+		break;
 	}
 }
 
 void sinsp_parser::parse_eventfd_exit(sinsp_evt *evt)
 {
-	sinsp_evt_param *parinfo;
 	int64_t fd;
 	sinsp_fdinfo_t fdi;
 
@@ -1989,9 +2830,7 @@ void sinsp_parser::parse_eventfd_exit(sinsp_evt *evt)
 		return;
 	}
 
-	parinfo = evt->get_param(0);
-	ASSERT(parinfo->m_len == sizeof(int64_t));
-	fd = *(int64_t *)parinfo->m_val;
+	fd = evt->get_param_value<int64_t>(0);
 
 	if(fd < 0)
 	{
@@ -2005,7 +2844,7 @@ void sinsp_parser::parse_eventfd_exit(sinsp_evt *evt)
 	// Populate the new fdi
 	//
 	fdi.m_type = SCAP_FD_EVENT;
-	fdi.m_name = "";
+	fdi.m_name.clear();
 
 	//
 	// Add the fd to the table.
@@ -2140,15 +2979,12 @@ void sinsp_parser::parse_getcwd_exit(sinsp_evt *evt)
 
 void sinsp_parser::parse_shutdown_exit(sinsp_evt *evt)
 {
-	sinsp_evt_param *parinfo;
 	int64_t retval;
 
 	//
 	// Extract the return value
 	//
-	parinfo = evt->get_param(0);
-	ASSERT(parinfo->m_len == sizeof(int64_t));
-	retval = *(int64_t *)parinfo->m_val;
+	retval = evt->get_param_value<int64_t>(0);
 
 	//
 	// If the operation was successful, do the cleanup
@@ -2221,7 +3057,7 @@ void sinsp_parser::parse_signalfd_exit(sinsp_evt *evt)
 		// Populate the new fdi
 		//
 		fdi.m_type = SCAP_FD_SIGNALFD;
-		fdi.m_name = "";
+		fdi.m_name.clear();
 
 		//
 		// Add the fd to the table.
@@ -2253,7 +3089,7 @@ void sinsp_parser::parse_timerfd_create_exit(sinsp_evt *evt)
 		// Populate the new fdi
 		//
 		fdi.m_type = SCAP_FD_TIMERFD;
-		fdi.m_name = "";
+		fdi.m_name.clear();
 
 		//
 		// Add the fd to the table.
@@ -2285,7 +3121,7 @@ void sinsp_parser::parse_inotify_init_exit(sinsp_evt *evt)
 		// Populate the new fdi
 		//
 		fdi.m_type = SCAP_FD_INOTIFY;
-		fdi.m_name = "";
+		fdi.m_name.clear();
 
 		//
 		// Add the fd to the table.
@@ -2438,7 +3274,11 @@ void sinsp_parser::parse_select_poll_epollwait_enter(sinsp_evt *evt)
 		return;
 	}
 
-	*(uint64_t*)evt->m_tinfo->m_lastevent_data = evt->get_ts();
+	uint8_t* data = evt->m_tinfo->reserve_lastevent_data(sizeof(uint64_t));
+	if(data != NULL)
+	{
+		*(uint64_t*)data = evt->get_ts();
+	}
 }
 
 void sinsp_parser::parse_fcntl_enter(sinsp_evt *evt)
@@ -2497,3 +3337,225 @@ void sinsp_parser::parse_fcntl_exit(sinsp_evt *evt)
 		evt->m_fdinfo = evt->m_tinfo->add_fd(retval, evt->m_fdinfo);
 	}
 }
+
+void sinsp_parser::parse_switch_summary(sinsp_evt *evt)
+{
+	sinsp_threadinfo* tinfo = evt->m_tinfo;
+	uint64_t exectime;
+	uint64_t vcsw;
+	uint64_t ivcsw;
+
+	if(tinfo == NULL)
+	{
+		return;
+	}
+
+	exectime = evt->get_param_value<uint64_t>(0);
+
+	vcsw = evt->get_param_value<uint64_t>(1);
+
+	ivcsw = evt->get_param_value<uint64_t>(2);
+
+	//
+	// The counters in the event are totals since the thread started. The
+	// first summary of a thread only gives us the starting point.
+	//
+	if(tinfo->m_switch_exectime != 0 && exectime >= tinfo->m_switch_exectime)
+	{
+		tinfo->m_switch_exectime_delta = exectime - tinfo->m_switch_exectime;
+		tinfo->m_switch_vcsw_delta = vcsw - tinfo->m_switch_vcsw;
+		tinfo->m_switch_ivcsw_delta = ivcsw - tinfo->m_switch_ivcsw;
+	}
+	else
+	{
+		tinfo->m_switch_exectime_delta = 0;
+		tinfo->m_switch_vcsw_delta = 0;
+		tinfo->m_switch_ivcsw_delta = 0;
+	}
+
+	tinfo->m_switch_exectime = exectime;
+	tinfo->m_switch_vcsw = vcsw;
+	tinfo->m_switch_ivcsw = ivcsw;
+}
+
+//
+// The faults in the event are the ones of the thread since its previous
+// summary. They're added up in the main thread for the whole process.
+//
+void sinsp_parser::parse_pgfault_summary(sinsp_evt *evt)
+{
+	sinsp_threadinfo* tinfo = evt->m_tinfo;
+
+	if(tinfo == NULL)
+	{
+		return;
+	}
+
+	sinsp_threadinfo* mtinfo = tinfo->get_main_thread();
+
+	if(mtinfo == NULL)
+	{
+		return;
+	}
+
+	mtinfo->m_pfmajor += evt->get_param_value<uint64_t>(0);
+	mtinfo->m_pfminor += evt->get_param_value<uint64_t>(1);
+}
+
+//
+// The thread of a switch event goes off CPU, and the one in its next
+// parameter comes back. The time in between is added to the off CPU time of
+// the system call the thread is in, see evt.offcpu.
+//
+void sinsp_parser::account_offcpu(sinsp_evt *evt)
+{
+	uint64_t ts = evt->get_ts();
+	sinsp_threadinfo* tinfo;
+	int64_t next;
+
+	tinfo = m_inspector->get_thread(evt->get_tid(), false);
+	if(tinfo != NULL)
+	{
+		tinfo->m_offcpu_start = ts;
+	}
+
+	next = evt->get_param_value<int64_t>(0);
+
+	tinfo = m_inspector->get_thread(next, false);
+	if(tinfo != NULL && tinfo->m_offcpu_start != 0)
+	{
+		if(ts > tinfo->m_offcpu_start)
+		{
+			tinfo->m_offcpu += ts - tinfo->m_offcpu_start;
+		}
+
+		tinfo->m_offcpu_start = 0;
+	}
+}
+
+void sinsp_parser::parse_procinfo(sinsp_evt *evt)
+{
+	sinsp_evt_param *parinfo;
+
+	//
+	// The args and cwd that the driver moved out of a clone or execve exit
+	// event. They have the same timestamp and come right after it, so the
+	// rest of the thread info is already up to date.
+	//
+	if(!evt->m_tinfo)
+	{
+		return;
+	}
+
+	parinfo = evt->get_param(0);
+	evt->m_tinfo->set_args(parinfo->m_val, parinfo->m_len);
+	evt->m_tinfo->state_changed();
+
+	parinfo = evt->get_param(1);
+	if(parinfo->m_len > 1)
+	{
+		evt->m_tinfo->set_cwd(parinfo->m_val, parinfo->m_len);
+	}
+}
+
+//
+// Copy a string parameter to a fixed size field of a scap_threadinfo
+//
+static void copy_state_string(sinsp_evt_param* parinfo, char* dest, uint32_t size)
+{
+	uint32_t len = (parinfo->m_len < size)? parinfo->m_len : size - 1;
+
+	memcpy(dest, parinfo->m_val, len);
+	dest[len] = 0;
+}
+
+//
+// The state of a thread at the start of the capture, written by the driver
+// instead of scanning /proc. It's stamped when the driver read it, so it's
+// newer than any entry we already have for the thread.
+//
+void sinsp_parser::parse_procstate(sinsp_evt *evt)
+{
+	sinsp_evt_param *parinfo;
+	scap_threadinfo pi;
+
+	pi.tid = *(int64_t *)evt->get_param(0)->m_val;
+	pi.pid = *(int64_t *)evt->get_param(1)->m_val;
+	pi.ptid = *(int64_t *)evt->get_param(2)->m_val;
+	copy_state_string(evt->get_param(3), pi.comm, sizeof(pi.comm));
+	copy_state_string(evt->get_param(4), pi.exe, sizeof(pi.exe));
+
+	parinfo = evt->get_param(5);
+	pi.args_len = (parinfo->m_len < sizeof(pi.args))? parinfo->m_len : sizeof(pi.args);
+	memcpy(pi.args, parinfo->m_val, pi.args_len);
+
+	copy_state_string(evt->get_param(6), pi.cwd, sizeof(pi.cwd));
+
+	pi.fdlimit = evt->get_param_value<int64_t>(7);
+	pi.uid = *(uint32_t *)evt->get_param(8)->m_val;
+	pi.gid = *(uint32_t *)evt->get_param(9)->m_val;
+	pi.flags = *(uint32_t *)evt->get_param(10)->m_val;
+	pi.cgroup[0] = 0;
+	pi.fdlist = NULL;
+
+	if(m_inspector->m_islive)
+	{
+		scap_proc_get_cgroup(m_inspector->m_h, pi.tid, pi.cgroup, sizeof(pi.cgroup));
+	}
+
+	if(m_inspector->get_thread(pi.tid, false) != NULL)
+	{
+		m_inspector->remove_thread(pi.tid);
+	}
+
+	sinsp_threadinfo tinfo(m_inspector);
+	tinfo.init(&pi);
+	m_inspector->add_thread(tinfo);
+}
+
+//
+// An fd of a process at the start of the capture. The tid of the event is
+// the pid of the process, whose procstate event came first.
+//
+void sinsp_parser::parse_fdstate(sinsp_evt *evt)
+{
+	scap_fdinfo fdi;
+
+	if(evt->m_tinfo == NULL)
+	{
+		return;
+	}
+
+	if(scap_fd_from_state_event(evt->m_pevt, &fdi) != SCAP_SUCCESS)
+	{
+		return;
+	}
+
+	evt->m_tinfo->add_fd_from_scap(&fdi);
+}
+
+//
+// Keep the sampling ratio and the drop windows up to date. The driver
+// brackets the periods it drops events in with PPME_DROP_E and PPME_DROP_X,
+// on the CPU that decided to drop. libsinsp announces the ratios set by the
+// backpressure controller with PPME_SAMPLING_E.
+//
+void sinsp_parser::parse_drop_marker(sinsp_evt *evt)
+{
+	sinsp_evt_param *parinfo = evt->get_param(0);
+	ASSERT(parinfo->m_len == sizeof(uint32_t));
+	uint32_t ratio = *(uint32_t *)parinfo->m_val;
+
+	switch(evt->get_type())
+	{
+	case PPME_DROP_E:
+	case PPME_SAMPLING_E:
+		m_inspector->m_sampling_ratio = ratio;
+		break;
+	case PPME_DROP_X:
+		m_inspector->add_drop_window(evt->get_cpuid());
+		break;
+	default:
+		ASSERT(false);
+	}
+}
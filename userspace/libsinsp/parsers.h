@@ -22,6 +22,9 @@ along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
 #pragma once
 
 class sinsp_fd_listener;
+class sinsp_parser;
+
+typedef void (sinsp_parser::*sinsp_parser_fn)(sinsp_evt* evt);
 
 class sinsp_parser
 {
@@ -35,13 +38,59 @@ public:
 	void process_event(sinsp_evt* evt);
 	void erase_fd(erase_fd_params* params);
 
+	//
+	// Call hook for each event of the given type, after it's been parsed
+	//
+	void add_event_hook(uint16_t etype, sinsp_event_hook hook, void* arg);
+
 private:
+	//
+	// What the parsing does for each event type, computed from the event
+	// table when the parser is created
+	//
+	enum dispatch_flags
+	{
+		DISPATCH_IGNORE = (1 << 0), // Scheduler events, that are not about a thread
+		DISPATCH_NO_PROC_LOOKUP = (1 << 1), // Don't look in /proc for a missing thread
+		DISPATCH_EXIT = (1 << 2),
+		DISPATCH_USES_FD = (1 << 3),
+		DISPATCH_CREATES_FD = (1 << 4),
+		DISPATCH_CREATES_FD_PAIR = (1 << 5), // The first created fd is the second parameter
+		DISPATCH_HAS_RES = (1 << 6), // The first parameter is the result or the created fd
+		DISPATCH_MODIFIES_STATE = (1 << 7),
+		DISPATCH_NO_FILTER = (1 << 8), // Markers that the capture filter must not drop
+		DISPATCH_DROP_MARKER = (1 << 9), // Sampling and drop events, parsed even if filtered out
+		DISPATCH_LIFECYCLE = (1 << 10), // Process creation and exit, and state dumps, never sampled out
+		DISPATCH_STATELESS = (1 << 11), // No parser, hook or fd: only the thread and the latency are updated
+	};
+
+	struct event_hook
+	{
+		sinsp_event_hook m_hook;
+		void* m_arg;
+	};
+
+	struct event_dispatch
+	{
+		sinsp_parser_fn m_parse; // NULL if the event type has no parser
+		uint32_t m_flags;
+		vector<event_hook> m_hooks;
+	};
+
+	void init_dispatch_table();
+
 	//
 	// Helpers
 	//
-	bool reset(sinsp_evt *evt);
+	bool reset(sinsp_evt *evt, const event_dispatch* dispatch);
+	void process_stateless_event(sinsp_evt *evt, const event_dispatch* dispatch);
 	void store_event(sinsp_evt* evt);
 	bool retrieve_enter_event(sinsp_evt* enter_evt, sinsp_evt* exit_evt);
+#if defined(HAS_FILTERING) && defined(HAS_CAPTURE_FILTERING)
+	bool run_filter(sinsp_evt* evt);
+	sinsp_consistent_sampler::result run_sampler(sinsp_evt* evt, const event_dispatch* dispatch);
+	bool in_shard(sinsp_evt* evt);
+#endif
 
 	//
 	// Parsers
@@ -75,6 +124,15 @@ private:
 	void parse_select_poll_epollwait_enter(sinsp_evt *evt);
 	void parse_fcntl_enter(sinsp_evt* evt);
 	void parse_fcntl_exit(sinsp_evt* evt);
+	void parse_lseek_exit(sinsp_evt* evt);
+	void update_access_pattern(sinsp_evt* evt, uint64_t len);
+	void parse_switch_summary(sinsp_evt* evt);
+	void parse_pgfault_summary(sinsp_evt* evt);
+	void account_offcpu(sinsp_evt* evt);
+	void parse_procinfo(sinsp_evt* evt);
+	void parse_procstate(sinsp_evt* evt);
+	void parse_fdstate(sinsp_evt* evt);
+	void parse_drop_marker(sinsp_evt* evt);
 
 	inline void add_socket(sinsp_evt* evt, int64_t fd, uint32_t domain, uint32_t type, uint32_t protocol);
 	inline void add_pipe(sinsp_evt *evt, int64_t tid, int64_t fd, uint64_t ino);
@@ -85,8 +143,16 @@ private:
 	// Return false if the update didn't happen because the tuple is identical to the given address
 	bool set_ipv4_mapped_ipv6_addresses_and_ports(sinsp_fdinfo_t* fdinfo, uint8_t* packed_data);
 	// Return false if the update didn't happen because the tuple is identical to the given address
+	bool set_ipv6_addresses_and_ports(sinsp_fdinfo_t* fdinfo, uint8_t* packed_data);
+	// Turn an IPv6 socket that uses IPv4-mapped addresses into an IPv4 one, moving its protocol to the IPv4 tuple
+	void set_ipv4_mapped_type(sinsp_fdinfo_t* fdinfo);
+	// Return false if the update didn't happen because the tuple is identical to the given address
 	bool set_unix_info(sinsp_fdinfo_t* fdinfo, uint8_t* packed_data);
 	void swap_ipv4_addresses(sinsp_fdinfo_t* fdinfo);
+	// True if the IPv4 socket still has the tuple its name was built from
+	bool same_ipv4_name(sinsp_fdinfo_t* fdinfo, scap_fd_type prev_type, ipv4tuple* prev_tuple);
+	// The pool of the thread and fd names
+	inline sinsp_string_pool* get_string_pool();
 
 	//
 	// Pointers to inspector context
@@ -99,11 +165,14 @@ private:
 
 	// Temporary storage to avoid memory allocation
 	sinsp_evt m_tmp_evt;
-	// The transaction table. Key pair is <tid, fd>.
-//	unordered_map<pair<int64_t, int64_t>, sinsp_transactinfo> m_transactable;
 
 	sinsp_fd_listener* m_fd_listener;
 
+	event_dispatch m_dispatch[PPM_EVENT_MAX];
+
+	INTERNAL_COUNTER(m_stateless_evts);
+	INTERNAL_COUNTER(m_stateful_evts);
+
 	friend class sinsp_analyzer;
 	friend class sinsp_analyzer_fd_listener;
 };
@@ -0,0 +1,163 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <time.h>
+#include "sinsp.h"
+#include "sinsp_int.h"
+#include "profiler.h"
+
+sinsp_profiler::sinsp_profiler()
+{
+	m_running = false;
+	clear();
+}
+
+void sinsp_profiler::clear()
+{
+	memset(m_stats, 0, sizeof(m_stats));
+	m_filter_ticks = 0;
+	m_fetch_ticks_per_evt = 0;
+	m_batch_filter_ticks_per_evt = 0;
+	m_elapsed_ticks = 0;
+	m_elapsed_ns = 0;
+	m_start_ticks = now();
+	m_start_ns = get_time_ns();
+}
+
+void sinsp_profiler::start()
+{
+	if(!m_running)
+	{
+		m_start_ticks = now();
+		m_start_ns = get_time_ns();
+		m_running = true;
+	}
+}
+
+void sinsp_profiler::stop()
+{
+	if(m_running)
+	{
+		m_elapsed_ticks += now() - m_start_ticks;
+		m_elapsed_ns += get_time_ns() - m_start_ns;
+		m_running = false;
+	}
+}
+
+uint64_t sinsp_profiler::get_time_ns()
+{
+#ifdef _WIN32
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * ONE_SECOND_IN_NS + tv.tv_usec * 1000;
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * ONE_SECOND_IN_NS + ts.tv_nsec;
+#endif
+}
+
+double sinsp_profiler::get_ns_per_tick()
+{
+	uint64_t ticks = m_elapsed_ticks;
+	uint64_t ns = m_elapsed_ns;
+
+	if(m_running)
+	{
+		ticks += now() - m_start_ticks;
+		ns += get_time_ns() - m_start_ns;
+	}
+
+	if(ticks == 0 || ns == 0)
+	{
+		return 1;
+	}
+
+	return (double)ns / ticks;
+}
+
+void sinsp_profiler::get_stage_total(sinsp_profile_stage stage, OUT stage_stats* res)
+{
+	uint32_t j;
+	uint32_t k;
+
+	memset(res, 0, sizeof(*res));
+
+	for(j = 0; j < PPM_EVENT_MAX; j++)
+	{
+		stage_stats* s = &m_stats[stage][j];
+
+		res->m_n += s->m_n;
+		res->m_ticks += s->m_ticks;
+		if(s->m_max_ticks > res->m_max_ticks)
+		{
+			res->m_max_ticks = s->m_max_ticks;
+		}
+
+		for(k = 0; k < PROFILER_BUCKETS; k++)
+		{
+			res->m_buckets[k] += s->m_buckets[k];
+		}
+	}
+}
+
+uint64_t sinsp_profiler::get_percentile(stage_stats* s, double fraction)
+{
+	uint64_t target = (uint64_t)(s->m_n * fraction);
+	uint64_t cumulative = 0;
+	uint32_t j;
+
+	if(s->m_n == 0)
+	{
+		return 0;
+	}
+
+	for(j = 0; j < PROFILER_BUCKETS - 1; j++)
+	{
+		cumulative += s->m_buckets[j];
+		if(cumulative > target)
+		{
+			return min(((uint64_t)2 << j) - 1, s->m_max_ticks);
+		}
+	}
+
+	return s->m_max_ticks;
+}
+
+const char* sinsp_profiler::get_stage_name(sinsp_profile_stage stage)
+{
+	switch(stage)
+	{
+	case SPS_FETCH:
+		return "fetch";
+	case SPS_CLEANUP:
+		return "cleanup";
+	case SPS_PARSE:
+		return "parse";
+	case SPS_FILTER:
+		return "filter";
+	case SPS_DUMP:
+		return "dump";
+	case SPS_ANALYZER:
+		return "analyzer";
+	default:
+		return "<unknown>";
+	}
+}
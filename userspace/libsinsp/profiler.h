@@ -0,0 +1,171 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+/*!
+  \brief The stages of sinsp::next() that the profiler times
+*/
+enum sinsp_profile_stage
+{
+	SPS_FETCH = 0, ///< Reading the batches of events from libscap, per event.
+	SPS_CLEANUP = 1, ///< Delayed removal of threads and fds, table cleanup.
+	SPS_PARSE = 2, ///< sinsp_parser::process_event(), filter excluded.
+	SPS_FILTER = 3, ///< The capture filter.
+	SPS_DUMP = 4, ///< Writing the event to the trace file.
+	SPS_ANALYZER = 5, ///< The analyzer.
+	SPS_MAX = 6,
+};
+
+//
+// Buckets of the histograms: bucket N counts the times between 2^N and
+// 2^(N+1) - 1 ticks of the clock
+//
+#define PROFILER_BUCKETS 32
+
+///////////////////////////////////////////////////////////////////////////////
+// Latency profiler of the stages of sinsp::next(). When it's enabled, each
+// stage of each event is timed with the TSC where there is one, and the
+// times go into a histogram per stage and event type. The ticks are
+// converted to nanoseconds with the rate measured while the profiler was
+// enabled.
+// The fetch from libscap is done for a batch of events, so its time is
+// split evenly among them.
+///////////////////////////////////////////////////////////////////////////////
+class SINSP_PUBLIC sinsp_profiler
+{
+public:
+	struct stage_stats
+	{
+		uint64_t m_n;
+		uint64_t m_ticks;
+		uint64_t m_max_ticks;
+		uint64_t m_buckets[PROFILER_BUCKETS];
+	};
+
+	sinsp_profiler();
+
+	void clear();
+
+	//
+	// Start and stop the clock, for the calibration of the ticks
+	//
+	void start();
+	void stop();
+
+	bool is_running()
+	{
+		return m_running;
+	}
+
+	//
+	// Current time in ticks
+	//
+	static inline uint64_t now()
+	{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+		uint32_t lo;
+		uint32_t hi;
+
+		__asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+		return ((uint64_t)hi << 32) | lo;
+#else
+		return get_time_ns();
+#endif
+	}
+
+	//
+	// Account the time since *ts to the stage, and move *ts to now
+	//
+	inline void lap(sinsp_profile_stage stage, uint16_t etype, uint64_t* ts)
+	{
+		uint64_t t = now();
+
+		add(stage, etype, t - *ts);
+		*ts = t;
+	}
+
+	void add(sinsp_profile_stage stage, uint16_t etype, uint64_t ticks)
+	{
+		stage_stats* s = &m_stats[stage][etype];
+		uint32_t bucket = 0;
+		uint64_t v = ticks;
+
+		s->m_n++;
+		s->m_ticks += ticks;
+		if(ticks > s->m_max_ticks)
+		{
+			s->m_max_ticks = ticks;
+		}
+
+		while(v > 1 && bucket < PROFILER_BUCKETS - 1)
+		{
+			v >>= 1;
+			bucket++;
+		}
+
+		s->m_buckets[bucket]++;
+	}
+
+	//
+	// Ticks of the filter for the event being parsed. The parser adds to
+	// it, and sinsp::next() moves it to the filter stage.
+	//
+	uint64_t m_filter_ticks;
+
+	//
+	// The time of the last fetch from libscap, and of the conditions of the
+	// filter that are tested on the whole batch, per event of the batch
+	//
+	uint64_t m_fetch_ticks_per_evt;
+	uint64_t m_batch_filter_ticks_per_evt;
+
+	//
+	// Nanoseconds per tick, measured between start() and stop(), or up to
+	// now if the profiler is running
+	//
+	double get_ns_per_tick();
+
+	stage_stats* get_stats(sinsp_profile_stage stage, uint16_t etype)
+	{
+		return &m_stats[stage][etype];
+	}
+
+	//
+	// Sum the stats of a stage over all the event types
+	//
+	void get_stage_total(sinsp_profile_stage stage, OUT stage_stats* res);
+
+	//
+	// The value below which the given fraction of the times are, from the
+	// histogram, in ticks. It's the upper bound of the bucket.
+	//
+	static uint64_t get_percentile(stage_stats* s, double fraction);
+
+	static const char* get_stage_name(sinsp_profile_stage stage);
+
+	static uint64_t get_time_ns();
+
+private:
+	stage_stats m_stats[SPS_MAX][PPM_EVENT_MAX];
+	bool m_running;
+	uint64_t m_start_ticks;
+	uint64_t m_start_ns;
+	uint64_t m_elapsed_ticks; // Of the previous start()/stop() periods
+	uint64_t m_elapsed_ns;
+};
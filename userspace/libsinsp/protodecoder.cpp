@@ -0,0 +1,540 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "sinsp.h"
+#include "sinsp_int.h"
+#include "protodecoder.h"
+
+//
+// Copy up to len bytes of the token at the start of data to dst, with the
+// letters in upper case. Returns false if the token has a character that
+// is not a letter or an underscore, or doesn't fit.
+//
+static bool copy_command(char* dst, uint32_t dstsize, const char* data, uint32_t len)
+{
+	uint32_t j;
+
+	if(len == 0 || len >= dstsize)
+	{
+		return false;
+	}
+
+	for(j = 0; j < len; j++)
+	{
+		char c = data[j];
+
+		if(c >= 'a' && c <= 'z')
+		{
+			c -= 'a' - 'A';
+		}
+		else if(!((c >= 'A' && c <= 'Z') || c == '_'))
+		{
+			return false;
+		}
+
+		dst[j] = c;
+	}
+
+	dst[len] = 0;
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// sinsp_protocol_decoder implementation
+///////////////////////////////////////////////////////////////////////////////
+void sinsp_protocol_decoder::start_request(sinsp_protoinfo* info, const char* cmd)
+{
+	strcpy(info->m_cmd, cmd);
+	info->m_flags = sinsp_protoinfo::PIF_NONE;
+	info->m_status = 0;
+	info->m_pending = 0;
+	info->m_arglen = 0;
+	info->m_arg[0] = 0;
+}
+
+uint32_t sinsp_protocol_decoder::append_arg(sinsp_protoinfo* info, const char* data, uint32_t len, bool truncated)
+{
+	uint32_t j;
+
+	for(j = 0; j < len && j < info->m_pending; j++)
+	{
+		if(is_arg_end(data[j]))
+		{
+			info->m_pending = 0;
+			break;
+		}
+
+		if(info->m_arglen < PROTO_MAX_ARG_LEN - 1)
+		{
+			info->m_arg[info->m_arglen++] = data[j];
+		}
+		else
+		{
+			info->m_flags |= sinsp_protoinfo::PIF_ARG_TRUNCATED;
+		}
+	}
+
+	info->m_arg[info->m_arglen] = 0;
+	info->m_pending -= MIN(j, info->m_pending);
+
+	//
+	// The argument goes on in the next buffer only if this one was
+	// captured entirely and there's still room for it
+	//
+	if(j == len && info->m_pending != 0 && !truncated &&
+		!(info->m_flags & sinsp_protoinfo::PIF_ARG_TRUNCATED))
+	{
+		info->m_state = sinsp_protoinfo::PS_ARG;
+	}
+	else
+	{
+		if(j == len && info->m_pending != 0)
+		{
+			info->m_flags |= sinsp_protoinfo::PIF_ARG_TRUNCATED;
+		}
+
+		info->m_state = sinsp_protoinfo::PS_REQUEST;
+	}
+
+	return j;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// sinsp_http_decoder implementation
+///////////////////////////////////////////////////////////////////////////////
+void sinsp_http_decoder::on_request(sinsp_protoinfo* info, const char* data, uint32_t len, bool truncated)
+{
+	char cmd[PROTO_MAX_CMD_LEN];
+	uint32_t j;
+
+	//
+	// The request line is "<method> <url> HTTP/1.x". Anything that doesn't
+	// start with a method is the body of a previous request.
+	//
+	for(j = 0; j < len && j < PROTO_MAX_CMD_LEN && data[j] != ' '; j++)
+	{
+	}
+
+	if(j == len || data[j] != ' ' || !copy_command(cmd, PROTO_MAX_CMD_LEN, data, j))
+	{
+		return;
+	}
+
+	if(strcmp(cmd, "GET") != 0 &&
+		strcmp(cmd, "POST") != 0 &&
+		strcmp(cmd, "PUT") != 0 &&
+		strcmp(cmd, "DELETE") != 0 &&
+		strcmp(cmd, "HEAD") != 0 &&
+		strcmp(cmd, "OPTIONS") != 0 &&
+		strcmp(cmd, "PATCH") != 0 &&
+		strcmp(cmd, "CONNECT") != 0 &&
+		strcmp(cmd, "TRACE") != 0)
+	{
+		return;
+	}
+
+	start_request(info, cmd);
+	info->m_pending = 0xffffffff;
+	append_arg(info, data + j + 1, len - j - 1, truncated);
+}
+
+void sinsp_http_decoder::on_response(sinsp_protoinfo* info, const char* data, uint32_t len)
+{
+	//
+	// "HTTP/1.x nnn"
+	//
+	if(len < 12 || memcmp(data, "HTTP/1.", sizeof("HTTP/1.") - 1) != 0 || data[8] != ' ')
+	{
+		return;
+	}
+
+	if(data[9] < '0' || data[9] > '9' ||
+		data[10] < '0' || data[10] > '9' ||
+		data[11] < '0' || data[11] > '9')
+	{
+		return;
+	}
+
+	info->m_status = (data[9] - '0') * 100 + (data[10] - '0') * 10 + (data[11] - '0');
+
+	if(info->m_status >= 400)
+	{
+		info->m_flags |= sinsp_protoinfo::PIF_ERROR;
+	}
+
+	info->m_state = sinsp_protoinfo::PS_RESPONSE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// sinsp_redis_decoder implementation
+///////////////////////////////////////////////////////////////////////////////
+
+//
+// Parse the number that follows the type byte of the RESP line at *pos, and
+// move *pos to the start of the next line
+//
+bool sinsp_redis_decoder::parse_line(const char* data, uint32_t len, uint32_t* pos, OUT int64_t* val)
+{
+	uint32_t j = *pos + 1;
+	int64_t res = 0;
+	bool neg = false;
+
+	if(j < len && data[j] == '-')
+	{
+		neg = true;
+		j++;
+	}
+
+	for(; j < len && data[j] >= '0' && data[j] <= '9'; j++)
+	{
+		res = res * 10 + (data[j] - '0');
+	}
+
+	if(j + 1 >= len || data[j] != '\r' || data[j + 1] != '\n')
+	{
+		return false;
+	}
+
+	*pos = j + 2;
+	*val = neg? -res : res;
+	return true;
+}
+
+void sinsp_redis_decoder::on_request(sinsp_protoinfo* info, const char* data, uint32_t len, bool truncated)
+{
+	char cmd[PROTO_MAX_CMD_LEN];
+	uint32_t pos = 0;
+	int64_t nargs;
+	int64_t cmdlen;
+	int64_t arglen;
+	uint32_t j;
+
+	if(len == 0)
+	{
+		return;
+	}
+
+	if(data[0] != '*')
+	{
+		//
+		// Inline command, e.g. "PING\r\n" or "GET key\r\n"
+		//
+		for(j = 0; j < len && !is_arg_end(data[j]); j++)
+		{
+		}
+
+		if(j == len || !copy_command(cmd, PROTO_MAX_CMD_LEN, data, j))
+		{
+			return;
+		}
+
+		start_request(info, cmd);
+
+		if(data[j] == ' ')
+		{
+			info->m_pending = 0xffffffff;
+			append_arg(info, data + j + 1, len - j - 1, truncated);
+		}
+		else
+		{
+			info->m_state = sinsp_protoinfo::PS_REQUEST;
+		}
+
+		return;
+	}
+
+	//
+	// Array of bulk strings: "*<n>\r\n$<len>\r\n<cmd>\r\n$<len>\r\n<key>\r\n..."
+	//
+	if(!parse_line(data, len, &pos, &nargs) || nargs < 1 ||
+		pos >= len || data[pos] != '$' ||
+		!parse_line(data, len, &pos, &cmdlen) ||
+		cmdlen < 0 || pos + cmdlen > len ||
+		!copy_command(cmd, PROTO_MAX_CMD_LEN, data + pos, (uint32_t)cmdlen))
+	{
+		return;
+	}
+
+	start_request(info, cmd);
+	pos += (uint32_t)cmdlen + 2;
+
+	if(nargs < 2)
+	{
+		info->m_state = sinsp_protoinfo::PS_REQUEST;
+		return;
+	}
+
+	if(pos >= len || data[pos] != '$' || !parse_line(data, len, &pos, &arglen) || arglen < 0)
+	{
+		//
+		// The key wasn't captured
+		//
+		info->m_flags |= sinsp_protoinfo::PIF_ARG_TRUNCATED;
+		info->m_state = sinsp_protoinfo::PS_REQUEST;
+		return;
+	}
+
+	info->m_pending = (uint32_t)arglen;
+	append_arg(info, data + pos, len - pos, truncated);
+}
+
+void sinsp_redis_decoder::on_response(sinsp_protoinfo* info, const char* data, uint32_t len)
+{
+	if(len == 0)
+	{
+		return;
+	}
+
+	switch(data[0])
+	{
+	case '-':
+		info->m_flags |= sinsp_protoinfo::PIF_ERROR;
+		break;
+	case '+':
+	case ':':
+	case '$':
+	case '*':
+		break;
+	default:
+		return;
+	}
+
+	info->m_state = sinsp_protoinfo::PS_RESPONSE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// sinsp_mysql_decoder implementation
+///////////////////////////////////////////////////////////////////////////////
+#define MYSQL_HEADER_LEN 4
+
+void sinsp_mysql_decoder::on_request(sinsp_protoinfo* info, const char* data, uint32_t len, bool truncated)
+{
+	const char* cmd;
+	bool has_arg = false;
+
+	//
+	// A command is the first packet of its sequence: 3 bytes of length, the
+	// sequence number 0, and the command byte. The handshake packets have a
+	// non zero sequence number.
+	//
+	if(len <= MYSQL_HEADER_LEN || data[3] != 0)
+	{
+		return;
+	}
+
+	uint32_t plen = (uint8_t)data[0] | ((uint8_t)data[1] << 8) | ((uint8_t)data[2] << 16);
+
+	if(plen == 0)
+	{
+		return;
+	}
+
+	switch((uint8_t)data[4])
+	{
+	case 0x01:
+		cmd = "QUIT";
+		break;
+	case 0x02:
+		cmd = "INIT_DB";
+		has_arg = true;
+		break;
+	case 0x03:
+		cmd = "QUERY";
+		has_arg = true;
+		break;
+	case 0x04:
+		cmd = "FIELD_LIST";
+		has_arg = true;
+		break;
+	case 0x0e:
+		cmd = "PING";
+		break;
+	case 0x16:
+		cmd = "STMT_PREPARE";
+		has_arg = true;
+		break;
+	case 0x17:
+		cmd = "STMT_EXECUTE";
+		break;
+	case 0x19:
+		cmd = "STMT_CLOSE";
+		break;
+	case 0x1a:
+		cmd = "STMT_RESET";
+		break;
+	default:
+		return;
+	}
+
+	start_request(info, cmd);
+
+	if(has_arg)
+	{
+		info->m_pending = plen - 1;
+		append_arg(info, data + MYSQL_HEADER_LEN + 1, len - MYSQL_HEADER_LEN - 1, truncated);
+	}
+	else
+	{
+		info->m_state = sinsp_protoinfo::PS_REQUEST;
+	}
+}
+
+void sinsp_mysql_decoder::on_response(sinsp_protoinfo* info, const char* data, uint32_t len)
+{
+	if(len <= MYSQL_HEADER_LEN)
+	{
+		return;
+	}
+
+	//
+	// An ERR packet is 0xff followed by the error code. Anything else, OK,
+	// EOF or a result set, is a success.
+	//
+	if((uint8_t)data[4] == 0xff)
+	{
+		info->m_flags |= sinsp_protoinfo::PIF_ERROR;
+
+		if(len >= MYSQL_HEADER_LEN + 3)
+		{
+			info->m_status = (uint8_t)data[5] | ((uint8_t)data[6] << 8);
+		}
+	}
+
+	info->m_state = sinsp_protoinfo::PS_RESPONSE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// sinsp_protocol_decoder_table implementation
+///////////////////////////////////////////////////////////////////////////////
+sinsp_protocol_decoder_table::sinsp_protocol_decoder_table()
+{
+	memset(m_decoders, 0, sizeof(m_decoders));
+	m_decoders[SINSP_L7_HTTP] = new sinsp_http_decoder();
+	m_decoders[SINSP_L7_REDIS] = new sinsp_redis_decoder();
+	m_decoders[SINSP_L7_MYSQL] = new sinsp_mysql_decoder();
+
+	memset(m_ports, SINSP_L7_NONE, sizeof(m_ports));
+	m_ports[80] = SINSP_L7_HTTP;
+	m_ports[8080] = SINSP_L7_HTTP;
+	m_ports[6379] = SINSP_L7_REDIS;
+	m_ports[3306] = SINSP_L7_MYSQL;
+}
+
+sinsp_protocol_decoder_table::~sinsp_protocol_decoder_table()
+{
+	uint32_t j;
+
+	for(j = 0; j < SINSP_L7_MAX; j++)
+	{
+		delete m_decoders[j];
+	}
+}
+
+void sinsp_protocol_decoder_table::set_port(uint16_t port, sinsp_l7_proto proto)
+{
+	if(proto >= SINSP_L7_MAX)
+	{
+		throw sinsp_exception("invalid protocol for port " + to_string((long long)port));
+	}
+
+	m_ports[port] = (uint8_t)proto;
+}
+
+const char* sinsp_protocol_decoder_table::get_proto_name(sinsp_l7_proto proto)
+{
+	if(proto >= SINSP_L7_MAX || m_decoders[proto] == NULL)
+	{
+		return "";
+	}
+
+	return m_decoders[proto]->get_name();
+}
+
+void sinsp_protocol_decoder_table::on_rw(sinsp_fdinfo_t* fdinfo, bool is_read, const char* data, uint32_t len, int64_t retval)
+{
+	sinsp_protoinfo* info;
+	uint8_t proto;
+
+	if(fdinfo->m_type == SCAP_FD_IPV4_SOCK && fdinfo->m_sockinfo.m_ipv4info.m_fields.m_l4proto == SCAP_L4_TCP)
+	{
+		proto = m_ports[fdinfo->m_sockinfo.m_ipv4info.m_fields.m_dport];
+	}
+	else if(fdinfo->m_type == SCAP_FD_IPV6_SOCK && fdinfo->m_sockinfo.m_ipv6info.m_fields.m_l4proto == SCAP_L4_TCP)
+	{
+		proto = m_ports[fdinfo->m_sockinfo.m_ipv6info.m_fields.m_dport];
+	}
+	else
+	{
+		return;
+	}
+
+	//
+	// The sockets of the ports without a decoder don't need their cold
+	// state
+	//
+	if(proto == SINSP_L7_NONE && fdinfo->m_cold.get() == NULL)
+	{
+		return;
+	}
+
+	info = &fdinfo->m_cold.get_or_create()->m_protoinfo;
+
+	if(proto != info->m_proto)
+	{
+		info->clear();
+		info->m_proto = proto;
+	}
+
+	if(proto == SINSP_L7_NONE || data == NULL)
+	{
+		return;
+	}
+
+	sinsp_protocol_decoder* decoder = m_decoders[proto];
+	bool is_request = (is_read == fdinfo->is_role_server());
+	bool truncated = (retval > (int64_t)len);
+
+	if(is_request)
+	{
+		if(info->m_state == sinsp_protoinfo::PS_ARG)
+		{
+			decoder->append_arg(info, data, len, truncated);
+		}
+		else
+		{
+			decoder->on_request(info, data, len, truncated);
+		}
+	}
+	else
+	{
+		if(info->m_state == sinsp_protoinfo::PS_ARG)
+		{
+			//
+			// The response started before the end of the argument, so
+			// it was lost
+			//
+			info->m_flags |= sinsp_protoinfo::PIF_ARG_TRUNCATED;
+			info->m_state = sinsp_protoinfo::PS_REQUEST;
+		}
+
+		if(info->m_state == sinsp_protoinfo::PS_REQUEST)
+		{
+			decoder->on_response(info, data, len);
+		}
+	}
+}
@@ -0,0 +1,232 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+/*!
+  \brief The application protocols that can be decoded from the data of
+   the sockets.
+*/
+enum sinsp_l7_proto
+{
+	SINSP_L7_NONE = 0,
+	SINSP_L7_HTTP = 1,
+	SINSP_L7_REDIS = 2,
+	SINSP_L7_MYSQL = 3,
+	SINSP_L7_MAX = 4,
+};
+
+//
+// Summary of the last request/response decoded on a socket. It's part of
+// the fdinfo, so the buffers have a fixed size and the decoders never
+// allocate memory.
+//
+struct sinsp_protoinfo
+{
+	enum state
+	{
+		PS_NONE = 0,
+		PS_ARG = 1, // The argument continues in the next request buffer
+		PS_REQUEST = 2, // Waiting for the response
+		PS_RESPONSE = 3,
+	};
+
+	enum flags
+	{
+		PIF_NONE = 0,
+		PIF_ARG_TRUNCATED = (1 << 0), // The rest of the argument wasn't captured
+		PIF_ERROR = (1 << 1), // The response is an error
+	};
+
+	void clear()
+	{
+		m_state = PS_NONE;
+		m_flags = PIF_NONE;
+		m_status = 0;
+		m_pending = 0;
+		m_cmd[0] = 0;
+		m_arg[0] = 0;
+		m_arglen = 0;
+	}
+
+	uint8_t m_proto; // sinsp_l7_proto
+	uint8_t m_state;
+	uint8_t m_flags;
+	uint8_t m_arglen;
+	uint16_t m_status; // HTTP status code or MySQL error code
+	uint32_t m_pending; // Bytes of the argument still to come, when known
+	char m_cmd[PROTO_MAX_CMD_LEN]; // HTTP method, Redis or MySQL command
+	char m_arg[PROTO_MAX_ARG_LEN]; // URL, Redis key or MySQL query
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Base class of the decoders of an application protocol. A decoder gets the
+// buffers of the sockets that use its protocol, split by direction, and
+// fills their sinsp_protoinfo. The buffers are the ones captured by the
+// driver: when truncated is true, the syscall moved more data than len and
+// the decoder can't expect the rest of a message in the next buffer.
+///////////////////////////////////////////////////////////////////////////////
+class SINSP_PUBLIC sinsp_protocol_decoder
+{
+public:
+	virtual ~sinsp_protocol_decoder()
+	{
+	}
+
+	virtual sinsp_l7_proto get_proto() = 0;
+	virtual const char* get_name() = 0;
+
+	//
+	// Called for a buffer that starts a request, i.e. when the protoinfo is
+	// not in PS_ARG. Leaving the buffer undecoded is fine, e.g. if it's the
+	// body of a larger request.
+	//
+	virtual void on_request(sinsp_protoinfo* info, const char* data, uint32_t len, bool truncated) = 0;
+
+	//
+	// Called for the first response buffer after a decoded request
+	//
+	virtual void on_response(sinsp_protoinfo* info, const char* data, uint32_t len) = 0;
+
+	//
+	// Return true if c terminates the argument of a request. Used to
+	// continue the argument in the next request buffer.
+	//
+	virtual bool is_arg_end(char c)
+	{
+		return false;
+	}
+
+protected:
+	//
+	// Reset the protoinfo for a new request with the given command
+	//
+	void start_request(sinsp_protoinfo* info, const char* cmd);
+
+	//
+	// Copy the argument of a request to the protoinfo, up to len bytes, the
+	// end of the buffer or the terminator. Returns the number of bytes
+	// consumed.
+	//
+	uint32_t append_arg(sinsp_protoinfo* info, const char* data, uint32_t len, bool truncated);
+
+	friend class sinsp_protocol_decoder_table;
+};
+
+class SINSP_PUBLIC sinsp_http_decoder : public sinsp_protocol_decoder
+{
+public:
+	sinsp_l7_proto get_proto()
+	{
+		return SINSP_L7_HTTP;
+	}
+
+	const char* get_name()
+	{
+		return "http";
+	}
+
+	void on_request(sinsp_protoinfo* info, const char* data, uint32_t len, bool truncated);
+	void on_response(sinsp_protoinfo* info, const char* data, uint32_t len);
+
+	bool is_arg_end(char c)
+	{
+		return c == ' ' || c == '\r' || c == '\n';
+	}
+};
+
+class SINSP_PUBLIC sinsp_redis_decoder : public sinsp_protocol_decoder
+{
+public:
+	sinsp_l7_proto get_proto()
+	{
+		return SINSP_L7_REDIS;
+	}
+
+	const char* get_name()
+	{
+		return "redis";
+	}
+
+	void on_request(sinsp_protoinfo* info, const char* data, uint32_t len, bool truncated);
+	void on_response(sinsp_protoinfo* info, const char* data, uint32_t len);
+
+	bool is_arg_end(char c)
+	{
+		return c == ' ' || c == '\r' || c == '\n';
+	}
+
+private:
+	static bool parse_line(const char* data, uint32_t len, uint32_t* pos, OUT int64_t* val);
+};
+
+class SINSP_PUBLIC sinsp_mysql_decoder : public sinsp_protocol_decoder
+{
+public:
+	sinsp_l7_proto get_proto()
+	{
+		return SINSP_L7_MYSQL;
+	}
+
+	const char* get_name()
+	{
+		return "mysql";
+	}
+
+	void on_request(sinsp_protoinfo* info, const char* data, uint32_t len, bool truncated);
+	void on_response(sinsp_protoinfo* info, const char* data, uint32_t len);
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// The protocol decoders and the server ports that they are run for. The
+// lookup is a byte per port, so the sockets with other ports cost a single
+// load on the read/write path.
+///////////////////////////////////////////////////////////////////////////////
+class SINSP_PUBLIC sinsp_protocol_decoder_table
+{
+public:
+	sinsp_protocol_decoder_table();
+	~sinsp_protocol_decoder_table();
+
+	//
+	// Decode the TCP connections with the given server port as proto.
+	// SINSP_L7_NONE stops decoding the port.
+	//
+	void set_port(uint16_t port, sinsp_l7_proto proto);
+
+	sinsp_l7_proto get_port(uint16_t port)
+	{
+		return (sinsp_l7_proto)m_ports[port];
+	}
+
+	//
+	// Called for each successful read or write on a socket with a role.
+	// len is the number of bytes in data, retval the number of bytes that
+	// the syscall moved.
+	//
+	void on_rw(sinsp_fdinfo_t* fdinfo, bool is_read, const char* data, uint32_t len, int64_t retval);
+
+	//
+	// Return the name of the protocol, e.g. "http"
+	//
+	const char* get_proto_name(sinsp_l7_proto proto);
+
+private:
+	sinsp_protocol_decoder* m_decoders[SINSP_L7_MAX];
+	uint8_t m_ports[65536];
+};
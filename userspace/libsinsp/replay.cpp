@@ -0,0 +1,118 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _WIN32
+#include <time.h>
+#endif
+
+#include "sinsp.h"
+#include "sinsp_int.h"
+#include "replay.h"
+
+sinsp_replay_clock::sinsp_replay_clock(double speed)
+{
+	m_speed = speed;
+	m_start_ns = 0;
+	m_first_ts = 0;
+}
+
+//
+// Sleep until the monotonic clock reaches deadline_ns
+//
+static void sleep_until(uint64_t deadline_ns)
+{
+#ifdef _WIN32
+	uint64_t now = sinsp_metrics::get_time_ns();
+
+	if(deadline_ns > now)
+	{
+		Sleep((DWORD)((deadline_ns - now) / 1000000));
+	}
+#else
+	struct timespec ts;
+
+	ts.tv_sec = deadline_ns / ONE_SECOND_IN_NS;
+	ts.tv_nsec = deadline_ns % ONE_SECOND_IN_NS;
+
+	//
+	// An absolute deadline doesn't drift when a signal interrupts the sleep
+	//
+	while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+	{
+	}
+#endif
+}
+
+bool sinsp_replay_clock::wait(uint64_t ts)
+{
+	uint64_t now = sinsp_metrics::get_time_ns();
+	uint64_t due;
+
+	if(m_start_ns == 0)
+	{
+		m_start_ns = now;
+		m_first_ts = ts;
+		return true;
+	}
+
+	//
+	// The events that are out of order are not held back
+	//
+	if(ts <= m_first_ts)
+	{
+		return true;
+	}
+
+	due = m_start_ns + (uint64_t)((double)(ts - m_first_ts) / m_speed);
+
+	if(now + REPLAY_SLACK_NS >= due)
+	{
+		return true;
+	}
+
+	if(due - now > REPLAY_MAX_WAIT_NS)
+	{
+		sleep_until(now + REPLAY_MAX_WAIT_NS);
+		return false;
+	}
+
+	//
+	// The sleep can end late by tens of microseconds, so it ends a bit
+	// early and the rest is spent spinning
+	//
+	if(due - now > REPLAY_SPIN_NS)
+	{
+		sleep_until(due - REPLAY_SPIN_NS);
+	}
+
+	while(sinsp_metrics::get_time_ns() < due)
+	{
+	}
+
+	return true;
+}
+
+uint64_t sinsp_replay_clock::get_ts()
+{
+	if(m_start_ns == 0)
+	{
+		return 0;
+	}
+
+	return m_first_ts + (uint64_t)((double)(sinsp_metrics::get_time_ns() - m_start_ns) * m_speed);
+}
@@ -0,0 +1,65 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+///////////////////////////////////////////////////////////////////////////////
+// Clock that paces the events of a trace file like they were captured, speed
+// times faster. The first event is delivered right away, and each following
+// one when the monotonic clock has advanced by the distance of its timestamp
+// from the first one, divided by the speed. Every event is scheduled from
+// the start of the replay, so the errors don't add up, and a consumer that
+// falls behind gets the events as fast as it can take them until it's back
+// on schedule.
+///////////////////////////////////////////////////////////////////////////////
+class SINSP_PUBLIC sinsp_replay_clock
+{
+public:
+	sinsp_replay_clock(double speed);
+
+	//
+	// Return true if the event with timestamp ts is due. Otherwise wait for
+	// it, for at most REPLAY_MAX_WAIT_NS, and return false if it's still
+	// not due.
+	//
+	bool wait(uint64_t ts);
+
+	//
+	// Start again from the next event, e.g. after a seek
+	//
+	void reset()
+	{
+		m_start_ns = 0;
+	}
+
+	//
+	// The timestamp of the trace that the clock has reached, 0 before the
+	// first event
+	//
+	uint64_t get_ts();
+
+	double get_speed()
+	{
+		return m_speed;
+	}
+
+private:
+	double m_speed;
+	uint64_t m_start_ns; // Monotonic time when the first event was delivered, 0 before it
+	uint64_t m_first_ts; // Timestamp of the first event
+};
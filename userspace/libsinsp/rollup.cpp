@@ -0,0 +1,354 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <json/json.h>
+
+#include "sinsp.h"
+#include "sinsp_int.h"
+#include "fieldaggr.h"
+#include "rollup.h"
+
+static bool group_greater(const sinsp_rollup::group& a, const sinsp_rollup::group& b)
+{
+	return a.second > b.second;
+}
+
+sinsp_rollup::sinsp_rollup(sinsp* inspector)
+{
+	m_inspector = inspector;
+	m_interval_ns = ROLLUP_DEFAULT_INTERVAL_NS;
+	m_cur = 0;
+	m_start_ts = 0;
+	m_interval_end = 0;
+	m_done_start_ts = 0;
+	m_done_end_ts = 0;
+}
+
+sinsp_rollup::~sinsp_rollup()
+{
+	for(uint32_t j = 0; j < m_metrics.size(); j++)
+	{
+		delete m_metrics[j]->m_aggr;
+		delete m_metrics[j];
+	}
+}
+
+uint32_t sinsp_rollup::add_metric(const string& name, const vector<string>& keys, const string& value, const string& op)
+{
+	sinsp_field_aggregator::op aggr_op;
+	double fraction = -1;
+
+	if(find_metric(name) != -1)
+	{
+		throw sinsp_exception("rollup metric " + name + " already exists");
+	}
+
+	if(keys.empty())
+	{
+		throw sinsp_exception("rollup metric " + name + " needs at least one key field");
+	}
+
+	if(op.size() > 1 && op[0] == 'p')
+	{
+		char* end;
+		double pct = strtod(op.c_str() + 1, &end);
+
+		if(*end != 0 || pct <= 0 || pct > 100)
+		{
+			throw sinsp_exception("rollup metric " + name + ": invalid percentile " + op);
+		}
+
+		//
+		// The groups only keep the histogram, the aggregator just computes
+		// the keys and the values
+		//
+		aggr_op = sinsp_field_aggregator::AO_MAX;
+		fraction = pct / 100;
+	}
+	else if(!sinsp_field_aggregator::parse_op(op, &aggr_op))
+	{
+		throw sinsp_exception("rollup metric " + name + ": unknown operation " + op);
+	}
+
+	if(value.empty() && aggr_op != sinsp_field_aggregator::AO_COUNT)
+	{
+		throw sinsp_exception("rollup metric " + name + " needs a value field");
+	}
+
+	sinsp_field_aggregator* aggr = new sinsp_field_aggregator(m_inspector, aggr_op, false);
+
+	try
+	{
+		for(uint32_t j = 0; j < keys.size(); j++)
+		{
+			aggr->add_key(keys[j]);
+		}
+
+		if(!value.empty())
+		{
+			aggr->set_value(value);
+		}
+	}
+	catch(...)
+	{
+		delete aggr;
+		throw;
+	}
+
+	metric* m = new metric;
+
+	m->m_name = name;
+	m->m_aggr = aggr;
+	m->m_fraction = fraction;
+	m->m_n_dropped[0] = 0;
+	m->m_n_dropped[1] = 0;
+
+	m_metrics.push_back(m);
+	return (uint32_t)m_metrics.size() - 1;
+}
+
+int32_t sinsp_rollup::find_metric(const string& name)
+{
+	for(uint32_t j = 0; j < m_metrics.size(); j++)
+	{
+		if(m_metrics[j]->m_name == name)
+		{
+			return (int32_t)j;
+		}
+	}
+
+	return -1;
+}
+
+void sinsp_rollup::process(sinsp_evt* evt)
+{
+	double value;
+
+	for(uint32_t j = 0; j < m_metrics.size(); j++)
+	{
+		metric* m = m_metrics[j];
+
+		if(m->m_fraction < 0)
+		{
+			unordered_map<string, double>* table = &m->m_tables[m_cur];
+
+			if(table->size() >= ROLLUP_MAX_GROUPS)
+			{
+				//
+				// Only the existing groups can still be updated
+				//
+				if(!m->m_aggr->extract(evt, &value))
+				{
+					continue;
+				}
+
+				if(table->find(m->m_aggr->get_extracted_key()) == table->end())
+				{
+					m->m_n_dropped[m_cur]++;
+					continue;
+				}
+			}
+
+			m->m_aggr->process(evt, table);
+			continue;
+		}
+
+		if(!m->m_aggr->extract(evt, &value) || value < 0)
+		{
+			continue;
+		}
+
+		unordered_map<string, sinsp_latency_histogram>* histograms = &m->m_histograms[m_cur];
+		unordered_map<string, sinsp_latency_histogram>::iterator it =
+			histograms->find(m->m_aggr->get_extracted_key());
+
+		if(it == histograms->end())
+		{
+			if(histograms->size() >= ROLLUP_MAX_GROUPS)
+			{
+				m->m_n_dropped[m_cur]++;
+				continue;
+			}
+
+			it = histograms->insert(pair<const string, sinsp_latency_histogram>(m->m_aggr->get_extracted_key(),
+				sinsp_latency_histogram())).first;
+		}
+
+		it->second.add((uint64_t)value);
+	}
+}
+
+void sinsp_rollup::end_interval(uint64_t ts)
+{
+	if(m_start_ts != 0)
+	{
+		flush(m_interval_end);
+	}
+
+	m_start_ts = ts;
+	m_interval_end = ts - ts % m_interval_ns + m_interval_ns;
+}
+
+void sinsp_rollup::flush(uint64_t ts)
+{
+	if(m_start_ts == 0)
+	{
+		return;
+	}
+
+	m_done_start_ts = m_start_ts;
+	m_done_end_ts = ts;
+	m_start_ts = 0;
+	m_interval_end = 0;
+
+	//
+	// Swap the tables, and empty the ones of the interval before the one
+	// that just ended
+	//
+	m_cur ^= 1;
+
+	for(uint32_t j = 0; j < m_metrics.size(); j++)
+	{
+		m_metrics[j]->m_tables[m_cur].clear();
+		m_metrics[j]->m_histograms[m_cur].clear();
+		m_metrics[j]->m_n_dropped[m_cur] = 0;
+	}
+
+	for(uint32_t j = 0; j < m_listeners.size(); j++)
+	{
+		m_listeners[j]->on_rollup(this);
+	}
+}
+
+void sinsp_rollup::reset()
+{
+	for(uint32_t j = 0; j < m_metrics.size(); j++)
+	{
+		for(uint32_t k = 0; k < 2; k++)
+		{
+			m_metrics[j]->m_tables[k].clear();
+			m_metrics[j]->m_histograms[k].clear();
+			m_metrics[j]->m_n_dropped[k] = 0;
+		}
+	}
+
+	m_start_ts = 0;
+	m_interval_end = 0;
+	m_done_start_ts = 0;
+	m_done_end_ts = 0;
+}
+
+void sinsp_rollup::get_groups(uint32_t num, uint32_t n, OUT vector<group>* res)
+{
+	metric* m = m_metrics[num];
+	uint32_t done = m_cur ^ 1;
+	string key;
+
+	res->clear();
+
+	if(m->m_fraction < 0)
+	{
+		unordered_map<string, double>::iterator it;
+
+		res->reserve(m->m_tables[done].size());
+
+		for(it = m->m_tables[done].begin(); it != m->m_tables[done].end(); ++it)
+		{
+			res->push_back(group(it->first, it->second));
+		}
+	}
+	else
+	{
+		unordered_map<string, sinsp_latency_histogram>::iterator it;
+
+		res->reserve(m->m_histograms[done].size());
+
+		for(it = m->m_histograms[done].begin(); it != m->m_histograms[done].end(); ++it)
+		{
+			res->push_back(group(it->first, (double)it->second.get_percentile(m->m_fraction)));
+		}
+	}
+
+	//
+	// Only the first n groups are sorted, and only their keys are rendered
+	//
+	if(n != 0 && n < res->size())
+	{
+		partial_sort(res->begin(), res->begin() + n, res->end(), group_greater);
+		res->resize(n);
+	}
+	else
+	{
+		sort(res->begin(), res->end(), group_greater);
+	}
+
+	for(uint32_t j = 0; j < res->size(); j++)
+	{
+		m->m_aggr->key_to_string(res->at(j).first, &key);
+		res->at(j).first = key;
+	}
+}
+
+string sinsp_rollup::to_json(uint32_t n)
+{
+	Json::Value root;
+	Json::FastWriter writer;
+	vector<group> groups;
+
+	root["start"] = (Json::Value::UInt64)m_done_start_ts;
+	root["end"] = (Json::Value::UInt64)m_done_end_ts;
+
+	Json::Value& metrics = root["metrics"];
+	metrics = Json::Value(Json::objectValue);
+
+	for(uint32_t j = 0; j < m_metrics.size(); j++)
+	{
+		Json::Value jgroups(Json::arrayValue);
+
+		get_groups(j, n, &groups);
+
+		for(uint32_t k = 0; k < groups.size(); k++)
+		{
+			Json::Value jgroup;
+
+			jgroup["key"] = groups[k].first;
+			jgroup["value"] = groups[k].second;
+			jgroups.append(jgroup);
+		}
+
+		metrics[m_metrics[j]->m_name] = jgroups;
+
+		if(get_n_dropped(j) != 0)
+		{
+			root["dropped"][m_metrics[j]->m_name] = (Json::Value::UInt64)get_n_dropped(j);
+		}
+	}
+
+	string res = writer.write(root);
+
+	//
+	// FastWriter ends the document with a newline
+	//
+	if(!res.empty() && res[res.size() - 1] == '\n')
+	{
+		res.resize(res.size() - 1);
+	}
+
+	return res;
+}
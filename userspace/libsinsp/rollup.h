@@ -0,0 +1,198 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+class sinsp_field_aggregator;
+class sinsp_rollup;
+
+/*!
+  \brief Receives the end of the intervals of a \ref sinsp_rollup, see
+   sinsp_rollup::add_listener().
+*/
+class SINSP_PUBLIC sinsp_rollup_listener
+{
+public:
+	virtual ~sinsp_rollup_listener()
+	{
+	}
+
+	/*!
+	  \brief An interval ended. Its groups can be read with
+	   sinsp_rollup::get_groups() until the end of the next one.
+	*/
+	virtual void on_rollup(sinsp_rollup* rollup) = 0;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Metrics computed on the events over fixed intervals, like the per second
+// tables of the chisels, but computed once for all the consumers: the CLI,
+// the chisels and the embedders read the same groups.
+//
+// A metric groups the events by the values of some key fields, like a
+// sinsp_field_aggregator, and computes the sum, count, minimum or maximum of
+// a value field for each group, or one of its percentiles, from a
+// sinsp_latency_histogram per group.
+//
+// The tables are double buffered: the events of an interval go in one set,
+// while the other keeps the groups of the previous interval for the readers.
+// At the end of an interval the two are swapped and the new current set is
+// emptied. The intervals are aligned to multiples of their length, like the
+// ones of the chisels, in event time.
+///////////////////////////////////////////////////////////////////////////////
+class SINSP_PUBLIC sinsp_rollup
+{
+public:
+	typedef pair<string, double> group; // The key, rendered as a string, and the value
+
+	sinsp_rollup(sinsp* inspector);
+	~sinsp_rollup();
+
+	//
+	// Add a metric and return its number. op is sum, count, min, max or
+	// pN, the Nth percentile of the value, e.g. p99 or p99.9. value must
+	// be a numeric field, and is optional for count. The events that don't
+	// have all the key fields are left out. Throws a sinsp_exception if a
+	// field doesn't exist, or if the name is already used. A metric added
+	// in the middle of an interval only gets the events from then on.
+	//
+	uint32_t add_metric(const string& name, const vector<string>& keys, const string& value, const string& op);
+
+	//
+	// Return the number of a metric, or -1 if there's no metric with that
+	// name
+	//
+	int32_t find_metric(const string& name);
+
+	uint32_t get_nmetrics()
+	{
+		return (uint32_t)m_metrics.size();
+	}
+
+	const string& get_metric_name(uint32_t num)
+	{
+		return m_metrics[num]->m_name;
+	}
+
+	void set_interval_ns(uint64_t interval_ns)
+	{
+		m_interval_ns = interval_ns;
+	}
+
+	uint64_t get_interval_ns()
+	{
+		return m_interval_ns;
+	}
+
+	//
+	// The listeners are called at the end of each interval, in the order
+	// they were added. They are not owned by the rollup.
+	//
+	void add_listener(sinsp_rollup_listener* listener)
+	{
+		m_listeners.push_back(listener);
+	}
+
+	//
+	// Called by the inspector for every event, before the filter, to end
+	// the interval when the events go past it
+	//
+	void advance(uint64_t ts)
+	{
+		if(ts >= m_interval_end)
+		{
+			end_interval(ts);
+		}
+	}
+
+	//
+	// Called by the inspector for the events that pass the filter
+	//
+	void process(sinsp_evt* evt);
+
+	//
+	// End the interval now, e.g. at the end of the capture
+	//
+	void flush(uint64_t ts);
+
+	//
+	// Start from scratch, e.g. after a seek
+	//
+	void reset();
+
+	//
+	// The last interval that ended, 0 if none did. The start is the
+	// beginning of the interval, or the first event if the capture started
+	// in the middle of it.
+	//
+	uint64_t get_interval_start_ts()
+	{
+		return m_done_start_ts;
+	}
+
+	uint64_t get_interval_end_ts()
+	{
+		return m_done_end_ts;
+	}
+
+	//
+	// Return the n groups of a metric with the largest values in the last
+	// interval that ended, in decreasing order of value, or all of them
+	// if n is 0
+	//
+	void get_groups(uint32_t num, uint32_t n, OUT vector<group>* res);
+
+	//
+	// Return the number of events of a metric that were left out of the
+	// last interval that ended because it had too many groups
+	//
+	uint64_t get_n_dropped(uint32_t num)
+	{
+		return m_metrics[num]->m_n_dropped[m_cur ^ 1];
+	}
+
+	//
+	// Render the last interval that ended as a JSON object, with the n
+	// largest groups of each metric, and the number of events that each
+	// metric left out if it had too many groups
+	//
+	string to_json(uint32_t n);
+
+private:
+	struct metric
+	{
+		string m_name;
+		sinsp_field_aggregator* m_aggr;
+		double m_fraction; // Of the percentile, negative for the other ops
+		unordered_map<string, double> m_tables[2];
+		unordered_map<string, sinsp_latency_histogram> m_histograms[2];
+		uint64_t m_n_dropped[2]; // Events of new groups left out because the metric had ROLLUP_MAX_GROUPS
+	};
+
+	void end_interval(uint64_t ts);
+
+	sinsp* m_inspector;
+	vector<metric*> m_metrics;
+	vector<sinsp_rollup_listener*> m_listeners;
+	uint64_t m_interval_ns;
+	uint32_t m_cur; // The tables that the events go in
+	uint64_t m_start_ts; // Of the current interval, 0 before the first event
+	uint64_t m_interval_end; // End of the current interval
+	uint64_t m_done_start_ts;
+	uint64_t m_done_end_ts;
+};
@@ -0,0 +1,318 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <fstream>
+#include <json/json.h>
+
+#include "sinsp.h"
+#include "sinsp_int.h"
+#include "filter.h"
+#include "rules.h"
+
+#ifdef HAS_FILTERING
+
+sinsp_rule_engine::sinsp_rule_engine(sinsp* inspector)
+{
+	m_inspector = inspector;
+	m_rules_by_type.resize(PPM_EVENT_MAX);
+	m_min_priority = sinsp_logger::SEV_DEBUG;
+	m_n_alerts = 0;
+}
+
+sinsp_rule_engine::~sinsp_rule_engine()
+{
+	for(uint32_t j = 0; j < m_rules.size(); j++)
+	{
+		delete m_rules[j]->m_compiled_filter;
+		delete m_rules[j]->m_formatter;
+		delete m_rules[j];
+	}
+}
+
+bool sinsp_rule_engine::parse_priority(const string& name, OUT sinsp_logger::severity* res)
+{
+	if(name == "debug")
+	{
+		*res = sinsp_logger::SEV_DEBUG;
+	}
+	else if(name == "info")
+	{
+		*res = sinsp_logger::SEV_INFO;
+	}
+	else if(name == "warning")
+	{
+		*res = sinsp_logger::SEV_WARNING;
+	}
+	else if(name == "error")
+	{
+		*res = sinsp_logger::SEV_ERROR;
+	}
+	else if(name == "critical")
+	{
+		*res = sinsp_logger::SEV_CRITICAL;
+	}
+	else
+	{
+		return false;
+	}
+
+	return true;
+}
+
+const char* sinsp_rule_engine::priority_to_string(sinsp_logger::severity priority)
+{
+	switch(priority)
+	{
+	case sinsp_logger::SEV_DEBUG:
+		return "Debug";
+	case sinsp_logger::SEV_INFO:
+		return "Info";
+	case sinsp_logger::SEV_WARNING:
+		return "Warning";
+	case sinsp_logger::SEV_ERROR:
+		return "Error";
+	case sinsp_logger::SEV_CRITICAL:
+		return "Critical";
+	default:
+		ASSERT(false);
+		return "";
+	}
+}
+
+void sinsp_rule_engine::load_file(const string& filename)
+{
+	ifstream is(filename.c_str());
+
+	if(!is.is_open())
+	{
+		throw sinsp_exception("can't open rule file " + filename);
+	}
+
+	string doc((istreambuf_iterator<char>(is)), istreambuf_iterator<char>());
+
+	load_string(doc, filename);
+}
+
+void sinsp_rule_engine::load_string(const string& doc, const string& source)
+{
+	Json::Reader reader;
+	Json::Value root;
+
+	if(!reader.parse(doc, root))
+	{
+		throw sinsp_exception(source + ": " + reader.getFormattedErrorMessages());
+	}
+
+	const Json::Value& rules = root["rules"];
+
+	if(!rules.isArray())
+	{
+		throw sinsp_exception(source + ": the rules must be in a \"rules\" array");
+	}
+
+	for(uint32_t j = 0; j < rules.size(); j++)
+	{
+		const Json::Value& r = rules[j];
+		sinsp_logger::severity priority = sinsp_logger::SEV_WARNING;
+
+		if(!r.isObject() || !r["name"].isString() || !r["filter"].isString())
+		{
+			throw sinsp_exception(source + ": each rule needs a name and a filter");
+		}
+
+		string name = r["name"].asString();
+
+		if(r.isMember("priority") &&
+			(!r["priority"].isString() || !parse_priority(r["priority"].asString(), &priority)))
+		{
+			throw sinsp_exception(source + ": rule " + name + " has an invalid priority");
+		}
+
+		if((r.isMember("rate") && !r["rate"].isNumeric()) || (r.isMember("burst") && !r["burst"].isNumeric()) ||
+			r.get("rate", 0).asDouble() < 0 || r.get("burst", 0).asDouble() < 0)
+		{
+			throw sinsp_exception(source + ": rule " + name + " has an invalid rate or burst");
+		}
+
+		try
+		{
+			add_rule(name,
+				r["filter"].asString(),
+				r.get("output", DEFAULT_OUTPUT_STR).asString(),
+				priority,
+				r.get("rate", 0).asDouble(),
+				r.get("burst", 0).asDouble());
+		}
+		catch(sinsp_exception& e)
+		{
+			throw sinsp_exception(source + ": rule " + name + ": " + e.what());
+		}
+	}
+}
+
+void sinsp_rule_engine::add_rule(const string& name,
+	const string& filter,
+	const string& output,
+	sinsp_logger::severity priority,
+	double rate,
+	double burst)
+{
+	if(m_rule_names.find(name) != m_rule_names.end())
+	{
+		throw sinsp_exception("there's already a rule named " + name);
+	}
+
+	if(priority < m_min_priority)
+	{
+		return;
+	}
+
+	sinsp_rule* rule = new sinsp_rule;
+
+	rule->m_name = name;
+	rule->m_filter = filter;
+	rule->m_output = output;
+	rule->m_priority = priority;
+	rule->m_rate = rate;
+	rule->m_burst = (burst != 0)? burst : ((rate > 1)? rate : 1);
+	rule->m_nmatches = 0;
+	rule->m_nsuppressed = 0;
+	rule->m_compiled_filter = NULL;
+	rule->m_formatter = NULL;
+	rule->m_tokens = rule->m_burst;
+	rule->m_last_ts = 0;
+
+	try
+	{
+		rule->m_compiled_filter = new sinsp_filter(m_inspector, filter);
+		//
+		// The alert is raised even if the event doesn't have some of the
+		// fields of the output, which are rendered as <NA>
+		//
+		rule->m_formatter = new sinsp_evt_formatter(m_inspector,
+			(output.size() != 0 && output[0] == '*')? output : "*" + output);
+	}
+	catch(...)
+	{
+		delete rule->m_compiled_filter;
+		delete rule;
+		throw;
+	}
+
+	m_rules.push_back(rule);
+	m_rule_names.insert(name);
+	index_rule(rule);
+}
+
+void sinsp_rule_engine::index_rule(sinsp_rule* rule)
+{
+	ppm_evt_mask mask;
+
+	rule->m_compiled_filter->get_evttypes(&mask);
+
+	for(uint32_t j = 0; j < PPM_EVENT_MAX; j++)
+	{
+		if(PPM_EVT_MASK_ISSET(&mask, j))
+		{
+			m_rules_by_type[j].push_back(rule);
+		}
+	}
+}
+
+void sinsp_rule_engine::get_evttypes(OUT ppm_evt_mask* mask)
+{
+	memset(mask, 0, sizeof(*mask));
+
+	for(uint32_t j = 0; j < PPM_EVENT_MAX; j++)
+	{
+		if(!m_rules_by_type[j].empty())
+		{
+			PPM_EVT_MASK_SET(mask, j);
+		}
+	}
+}
+
+uint32_t sinsp_rule_engine::process(sinsp_evt* evt)
+{
+	uint16_t etype = evt->get_type();
+	uint32_t nmatches = 0;
+
+	if(etype >= PPM_EVENT_MAX)
+	{
+		return 0;
+	}
+
+	vector<sinsp_rule*>& rules = m_rules_by_type[etype];
+
+	for(uint32_t j = 0; j < rules.size(); j++)
+	{
+		sinsp_rule* rule = rules[j];
+
+		if(!rule->m_compiled_filter->run(evt))
+		{
+			continue;
+		}
+
+		nmatches++;
+		rule->m_nmatches++;
+
+		//
+		// Token bucket: the rule earns rate alerts per second of event
+		// time, up to burst
+		//
+		if(rule->m_rate != 0)
+		{
+			uint64_t ts = evt->get_ts();
+
+			if(rule->m_last_ts != 0 && ts > rule->m_last_ts)
+			{
+				rule->m_tokens += (double)(ts - rule->m_last_ts) * rule->m_rate / ONE_SECOND_IN_NS;
+
+				if(rule->m_tokens > rule->m_burst)
+				{
+					rule->m_tokens = rule->m_burst;
+				}
+			}
+
+			rule->m_last_ts = ts;
+
+			if(rule->m_tokens < 1)
+			{
+				rule->m_nsuppressed++;
+				continue;
+			}
+
+			rule->m_tokens -= 1;
+		}
+
+		rule->m_formatter->tostring(evt, &m_output_buf);
+
+		m_line = priority_to_string(rule->m_priority);
+		m_line += ' ';
+		m_line += rule->m_name;
+		m_line += ": ";
+		m_line += m_output_buf;
+
+		g_output_sink.write_line(m_line);
+		m_n_alerts++;
+	}
+
+	return nmatches;
+}
+
+#endif // HAS_FILTERING
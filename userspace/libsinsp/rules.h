@@ -0,0 +1,144 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#ifdef HAS_FILTERING
+
+class sinsp_filter;
+class sinsp_evt_formatter;
+
+/*!
+  \brief A rule of a \ref sinsp_rule_engine: the events accepted by the
+   filter raise an alert, rendered with the output format.
+*/
+class SINSP_PUBLIC sinsp_rule
+{
+public:
+	string m_name;
+	string m_filter; ///< The filter, in the sysdig syntax
+	string m_output; ///< The format of the alerts, like the one of sysdig -p
+	sinsp_logger::severity m_priority;
+	double m_rate; ///< Alerts per second that are raised on average, 0 for no limit
+	double m_burst; ///< Alerts that can be raised at once, before the rate applies
+	uint64_t m_nmatches; ///< Events accepted by the filter
+	uint64_t m_nsuppressed; ///< Events accepted by the filter that didn't raise an alert because of the rate
+
+VISIBILITY_PRIVATE
+	sinsp_filter* m_compiled_filter;
+	sinsp_evt_formatter* m_formatter;
+	double m_tokens; // Alerts that can be raised now
+	uint64_t m_last_ts; // Timestamp of the last match, 0 before the first
+
+	friend class sinsp_rule_engine;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Runs a set of rules on the events in one pass. The rules are indexed by the
+// event types that their filter can accept, so an event is only tested by
+// the rules that can match it, and the filters of the same inspector share
+// the results of their common checks and the values of their common fields
+// through the field cache, so a check that many rules have, like
+// container.id!=host, is evaluated once per event. The alerts of a rule are
+// limited with a token bucket in event time, and written to g_output_sink.
+//
+// The rule files are JSON:
+//
+// {"rules": [{"name": "shell_in_container",
+//             "filter": "evt.type=execve and proc.name=bash and container.id!=host",
+//             "output": "%evt.time %proc.name %proc.args",
+//             "priority": "warning",
+//             "rate": 1,
+//             "burst": 10}]}
+//
+// priority is one of debug, info, warning, error and critical, warning by
+// default. rate and burst are optional.
+///////////////////////////////////////////////////////////////////////////////
+class SINSP_PUBLIC sinsp_rule_engine
+{
+public:
+	sinsp_rule_engine(sinsp* inspector);
+	~sinsp_rule_engine();
+
+	//
+	// Add the rules of a file. Throws a sinsp_exception if the file can't
+	// be read, or if a rule is not valid.
+	//
+	void load_file(const string& filename);
+	void load_string(const string& doc, const string& source);
+
+	//
+	// Add a rule. burst is set to the rate, or to 1, if it's 0. Throws a
+	// sinsp_exception if the filter or the output are not valid, or if
+	// there's already a rule with the same name.
+	//
+	void add_rule(const string& name,
+		const string& filter,
+		const string& output,
+		sinsp_logger::severity priority,
+		double rate,
+		double burst);
+
+	//
+	// Leave out the rules with a lower priority. Must be called before the
+	// rules are added.
+	//
+	void set_min_priority(sinsp_logger::severity priority)
+	{
+		m_min_priority = priority;
+	}
+
+	//
+	// Test the event on the rules, and write the alerts. Return the number
+	// of rules that matched, including the ones whose alert was suppressed.
+	//
+	uint32_t process(sinsp_evt* evt);
+
+	//
+	// Return the event types that the rules can match, e.g. for
+	// sinsp::set_evttype_mask()
+	//
+	void get_evttypes(OUT ppm_evt_mask* mask);
+
+	const vector<sinsp_rule*>& get_rules()
+	{
+		return m_rules;
+	}
+
+	uint64_t get_n_alerts()
+	{
+		return m_n_alerts;
+	}
+
+	static bool parse_priority(const string& name, OUT sinsp_logger::severity* res);
+	static const char* priority_to_string(sinsp_logger::severity priority);
+
+private:
+	void index_rule(sinsp_rule* rule);
+
+	sinsp* m_inspector;
+	vector<sinsp_rule*> m_rules;
+	unordered_set<string> m_rule_names;
+	vector<vector<sinsp_rule*> > m_rules_by_type; // Indexed by event type
+	sinsp_logger::severity m_min_priority;
+	uint64_t m_n_alerts;
+	string m_line;
+	string m_output_buf;
+};
+
+#endif // HAS_FILTERING
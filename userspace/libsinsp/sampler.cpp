@@ -0,0 +1,128 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "sinsp.h"
+#include "sinsp_int.h"
+#include "sampler.h"
+
+sinsp_consistent_sampler::sinsp_consistent_sampler(sinsp_sampling_mode mode, uint32_t ratio)
+{
+	ASSERT(mode != SSM_NONE);
+	ASSERT(ratio > 1);
+	m_mode = mode;
+	m_ratio = ratio;
+	m_n_kept = 0;
+	m_n_dropped = 0;
+}
+
+//
+// The finalizer of splitmix64, so that close pids and ports don't end up in
+// the same bucket
+//
+uint64_t sinsp_consistent_sampler::mix(uint64_t v)
+{
+	v = (v ^ (v >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	v = (v ^ (v >> 27)) * 0x94d049bb133111ebULL;
+	return v ^ (v >> 31);
+}
+
+sinsp_consistent_sampler::result sinsp_consistent_sampler::check_thread(sinsp_threadinfo* tinfo)
+{
+	if(tinfo == NULL)
+	{
+		return SR_KEEP;
+	}
+
+	//
+	// The pid, not the tid, so that the threads of a process, which share
+	// their fds, are kept or dropped together
+	//
+	return check_hash(mix((uint64_t)tinfo->m_pid));
+}
+
+sinsp_consistent_sampler::result sinsp_consistent_sampler::check_fd(sinsp_fdinfo_t* fdinfo)
+{
+	uint64_t h1;
+	uint64_t h2;
+	uint8_t l4proto;
+
+	if(fdinfo == NULL)
+	{
+		return SR_KEEP;
+	}
+
+	if(fdinfo->m_type == SCAP_FD_IPV4_SOCK)
+	{
+		ipv4tuple* t = &fdinfo->m_sockinfo.m_ipv4info;
+
+		if(t->m_fields.m_sport == 0 && t->m_fields.m_dport == 0)
+		{
+			return SR_UNKNOWN;
+		}
+
+		h1 = mix(((uint64_t)t->m_fields.m_sip << 16) | t->m_fields.m_sport);
+		h2 = mix(((uint64_t)t->m_fields.m_dip << 16) | t->m_fields.m_dport);
+		l4proto = t->m_fields.m_l4proto;
+	}
+	else if(fdinfo->m_type == SCAP_FD_IPV6_SOCK)
+	{
+		ipv6tuple* t = &fdinfo->m_sockinfo.m_ipv6info;
+		ipv6addr sip;
+		ipv6addr dip;
+
+		if(t->m_fields.m_sport == 0 && t->m_fields.m_dport == 0)
+		{
+			return SR_UNKNOWN;
+		}
+
+		ipv6addr_load(&sip, t->m_fields.m_sip);
+		ipv6addr_load(&dip, t->m_fields.m_dip);
+		h1 = mix(mix(sip.m_q[0] ^ mix(sip.m_q[1])) ^ t->m_fields.m_sport);
+		h2 = mix(mix(dip.m_q[0] ^ mix(dip.m_q[1])) ^ t->m_fields.m_dport);
+		l4proto = t->m_fields.m_l4proto;
+	}
+	else
+	{
+		return SR_KEEP;
+	}
+
+	//
+	// Combine the two ends in order, so that the client and the server see
+	// the same hash
+	//
+	if(h1 > h2)
+	{
+		swap(h1, h2);
+	}
+
+	return check_hash(mix(h1 * 0x9e3779b97f4a7c15ULL ^ h2 ^ l4proto));
+}
+
+sinsp_sampling_mode sinsp_consistent_sampler::parse_mode(const string& mode)
+{
+	if(mode == "connection")
+	{
+		return SSM_CONNECTION;
+	}
+	else if(mode == "process")
+	{
+		return SSM_PROCESS;
+	}
+
+	throw sinsp_exception("invalid sampling mode " + mode + ", must be connection or process");
+}
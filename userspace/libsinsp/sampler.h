@@ -0,0 +1,130 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+/*!
+  \brief What \ref sinsp::set_consistent_sampling() samples.
+*/
+enum sinsp_sampling_mode
+{
+	SSM_NONE = 0, ///< Keep all the events.
+	SSM_CONNECTION = 1, ///< Keep 1 out of N IPv4 and IPv6 connections, by 4-tuple.
+	SSM_PROCESS = 2, ///< Keep 1 out of N processes, with all their threads.
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Consistent sampling: keep all the events of 1 out of every N connections
+// or processes, instead of 1 out of N events, so what is kept can still be
+// followed from beginning to end.
+//
+// The choice is a hash of the connection 4-tuple, which is the same in both
+// directions, or of the process id, modulo N. The hash has no seed, so two
+// captures sampled with the same mode and ratio, e.g. on the two ends of a
+// connection, keep the same connections.
+//
+// The parser asks the sampler about each event, next to the capture filter,
+// and never drops the events that create or end processes, or the state
+// dumps, so the thread table of a sampled capture is complete.
+///////////////////////////////////////////////////////////////////////////////
+class SINSP_PUBLIC sinsp_consistent_sampler
+{
+public:
+	enum result
+	{
+		SR_KEEP,
+		SR_DROP,
+		SR_UNKNOWN, // The fd doesn't have its tuple yet, e.g. before connect is parsed
+	};
+
+	sinsp_consistent_sampler(sinsp_sampling_mode mode, uint32_t ratio);
+
+	sinsp_sampling_mode get_mode()
+	{
+		return m_mode;
+	}
+
+	uint32_t get_ratio()
+	{
+		return m_ratio;
+	}
+
+	//
+	// Whether to keep the events of a process. Threads without a process
+	// are kept.
+	//
+	result check_thread(sinsp_threadinfo* tinfo);
+
+	//
+	// Whether to keep the events on an fd. The fds that are not IPv4 or
+	// IPv6 sockets are kept, and so are the server sockets, whose events
+	// are not about one connection.
+	//
+	result check_fd(sinsp_fdinfo_t* fdinfo);
+
+	void add(bool kept)
+	{
+		if(kept)
+		{
+			m_n_kept++;
+		}
+		else
+		{
+			m_n_dropped++;
+		}
+	}
+
+	uint64_t get_n_kept()
+	{
+		return m_n_kept;
+	}
+
+	uint64_t get_n_dropped()
+	{
+		return m_n_dropped;
+	}
+
+	//
+	// Parse the mode of the --sample option, "connection" or "process".
+	// Throws a sinsp_exception if it's neither.
+	//
+	static sinsp_sampling_mode parse_mode(const string& mode);
+
+	//
+	// The shard of a process out of nshards, for sinsp::set_shard(). It's
+	// the hash of the process sampling, so a process and its threads are
+	// in the same shard.
+	//
+	static uint32_t get_shard(int64_t pid, uint32_t nshards)
+	{
+		return (uint32_t)(mix((uint64_t)pid) % nshards);
+	}
+
+private:
+	result check_hash(uint64_t hash)
+	{
+		return (hash % m_ratio == 0)? SR_KEEP : SR_DROP;
+	}
+
+	static uint64_t mix(uint64_t v);
+
+	sinsp_sampling_mode m_mode;
+	uint32_t m_ratio;
+	uint64_t m_n_kept;
+	uint64_t m_n_dropped;
+};
@@ -28,6 +28,14 @@ along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
 //
 #define SP_EVT_BUF_SIZE 4096
 
+//
+// Size classes of the buffers that keep the enter events of the threads.
+// The smallest one is SP_EVT_BUF_MIN_SIZE bytes, and each of the others is
+// 4 times the previous one, so the biggest is SP_EVT_BUF_SIZE.
+//
+#define SP_EVT_BUF_MIN_SIZE 64
+#define SP_EVT_BUF_NCLASSES 4
+
 //
 // If defined, the filtering system is compiled
 //
@@ -50,11 +58,139 @@ along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
 //
 #define SCAP_TIMEOUT_MS 30
 
+//
+// Maximum number of events that the inspector fetches from libscap at once
+//
+#define SP_SCAP_BATCH_SIZE 256
+
+//
+// Minimum number of events in a batch for the filter to test its raw event
+// checks on the whole batch. The smaller batches, like the single events of
+// the trace files, are only filtered one event at a time.
+//
+#define SP_FILTER_BATCH_MIN_EVTS 16
+
+//
+// Limits of the 'matches' filters. The regular expressions that need more
+// than SP_REGEX_MAX_NFA_STATES automaton states are refused. The
+// deterministic automaton is built lazily while matching, and its cache is
+// emptied when it reaches SP_REGEX_MAX_DFA_STATES states, so that its size
+// stays bounded whatever the strings.
+//
+#define SP_REGEX_MAX_NFA_STATES 16384
+#define SP_REGEX_MAX_DFA_STATES 1024
+
+//
+// Maximum number of events that are passed at once to the on_events()
+// callback of the chisels
+//
+#define SP_CHISEL_EVT_BATCH_SIZE 1024
+
+//
+// Garbage collection work, in KB of allocations, that the Lua state of a
+// chisel with an interval callback gets at the end of each interval
+//
+#define SP_CHISEL_GC_STEP_KB 1024
+
+//
+// How long the thread of a chisel sleeps when its queue is empty, and how
+// long the capture sleeps when the queue is full and it waits for room
+//
+#define SP_CHISEL_QUEUE_EMPTY_WAIT_US 1000
+#define SP_CHISEL_QUEUE_FULL_WAIT_US 100
+
+//
+// Sizes of the sketches of the chisels when they don't give one: the
+// counters of a row and the rows of the Count-Min sketches, and the
+// precision of the HyperLogLog ones
+//
+#define SP_COUNTMIN_DEFAULT_WIDTH 2048
+#define SP_COUNTMIN_DEFAULT_DEPTH 4
+#define SP_HLL_DEFAULT_PRECISION 12
+
+//
+// Size of the stdout buffer of the event lines, and how often it's flushed
+// during live captures when stdout is not a terminal
+//
+#define SP_OUTPUT_BUFFER_SIZE (256 * 1024)
+#define SP_OUTPUT_FLUSH_INTERVAL_NS 100000000LL
+
+//
+// Number of recently looked up threads that are cached for each CPU, and
+// of recently looked up fds that are cached for each fd table. The latter
+// must be a power of 2.
+//
+#define SP_THREAD_CACHE_WAYS 4
+#define SP_FD_CACHE_SIZE 8
+
+//
+// The fds below this number are looked up by index instead of hashing
+//
+#define SP_FDTABLE_DENSE_SIZE 4096
+
+//
+// Max number of fd table snapshots that a forked process can stack before
+// they're merged into one
+//
+#define SP_FDTABLE_MAX_SNAPSHOTS 4
+
+//
+// Size of the chunks of the per-event arena (see sinsp_arena)
+//
+#define SP_ARENA_CHUNK_SIZE 16384
+
+//
+// Minimum size of the buffers that sinsp_evt renders the parameters into
+//
+#define SP_EVT_PARAMSTR_STORAGE_SIZE 1024
+
+//
+// Max number of flags values whose names sinsp_evt keeps
+//
+#define SP_MAX_FLAGSTRS 16384
+
+//
+// Rows of each batch written by sinsp_arrow_writer
+//
+#define SP_ARROW_BATCH_SIZE 65536
+
 //
 // Max size that the thread table can reach
 //
 #define MAX_THREAD_TABLE_SIZE 65536
 
+//
+// Max depth of the process tree that is followed when the processes from
+// /proc are added to it, and max number of processes for which a filter
+// check remembers if one of their ancestors matches
+//
+#define PROC_TREE_MAX_IMPORT_DEPTH 1024
+#define PROC_TREE_ANCESTOR_CACHE_SIZE 4096
+
+//
+// Max number of fds and of server ports that keep a histogram of the
+// latencies of their transactions
+//
+#define MAX_TRANSACTION_TABLE_SIZE 4096
+#define MAX_TRANSACTION_PORTS 1024
+
+//
+// Size of the buffers of the command and of the argument, e.g. the method
+// and the URL of an HTTP request, that the protocol decoders keep for each
+// socket
+//
+#define PROTO_MAX_CMD_LEN 16
+#define PROTO_MAX_ARG_LEN 64
+
+//
+// Max size that the table of the IPv4 connections can reach, how long a
+// connection that is not looked up is kept, and how often the table is
+// scanned for them
+//
+#define MAX_CONNECTION_TABLE_SIZE 65536
+#define DEFAULT_CONNECTION_TIMEOUT_S 300
+#define CONNECTION_SCAN_INTERVAL_S 30
+
 //
 // The time after an inactive thread is removed.
 //
@@ -65,6 +201,34 @@ along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
 //
 #define DEFAULT_INACTIVE_THREAD_SCAN_TIME_S 600
 
+//
+// The threads are kept in a list ordered by last access, to find the
+// inactive ones without scanning the table. A thread that is looked up
+// moves to the end of the list only if it didn't in the last
+// THREAD_LRU_UPDATE_INTERVAL_NS, so that the lookups rarely touch the
+// list. At most INACTIVE_THREADS_PER_EVENT threads are removed for each
+// event.
+//
+#define THREAD_LRU_UPDATE_INTERVAL_NS 1000000000LL
+#define INACTIVE_THREADS_PER_EVENT 16
+
+//
+// The threads that exited are remembered in a ring of SP_THREAD_TOMBSTONES
+// entries, so that the events that arrive up to
+// SP_THREAD_TOMBSTONE_TIMEOUT_NS after their removal can still be resolved.
+// The thread table and its index are shrunk, if they are mostly empty,
+// every SP_THREAD_TABLE_COMPACTION_INTERVAL_NS.
+//
+#define SP_THREAD_TOMBSTONES 4096
+#define SP_THREAD_TOMBSTONE_TIMEOUT_NS 10000000000LL
+#define SP_THREAD_TABLE_COMPACTION_INTERVAL_NS 30000000000LL
+
+//
+// When there's a memory budget and it's exceeded, at most this number of
+// threads are looked at for each event to free their state
+//
+#define MEMORY_EVICTION_SCAN_LENGTH 64
+
 //
 // Enables LUA chisel scripts support
 //
@@ -75,6 +239,82 @@ along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
 //
 #define CHISELS_INSTALLATION_DIR "/share/sysdig/chisels"
 
+//
+// Cache of the descriptions of the chisels, in the home directory, so that
+// listing the chisels doesn't run every script again
+//
+#define CHISEL_CACHE_FILE ".sysdig_chisel_cache"
+
+//
+// Max number of addresses in the cache of the name resolver, and of
+// addresses waiting for its thread
+//
+#define NAME_RESOLVER_CACHE_SIZE 4096
+#define NAME_RESOLVER_MAX_PENDING 256
+
+//
+// Users and groups with an id below this are looked up in an array instead
+// of a hash table
+//
+#define USERGROUP_ARRAY_SIZE 65536
+
+//
+// During live captures, an unknown uid or gid makes the user list be read
+// again in the background, at most this often
+//
+#define USERLIST_REFRESH_INTERVAL_NS 30000000000LL
+
+//
+// The parser time is measured on one event out of this many, see
+// sinsp_metrics
+//
+#define METRICS_PARSER_SAMPLE_RATE 64
+
+//
+// Processes whose cost sinsp_metrics tracks separately. The ones that come
+// after are charged together.
+//
+#define METRICS_MAX_PROCS 4096
+
+//
+// How often the fill level of the driver ring buffers is sampled during live
+// captures, see sinsp_metrics
+//
+#define METRICS_RING_SAMPLE_INTERVAL_NS 100000000
+
+//
+// Limits of the backpressure controller, see sinsp_backpressure. The sampling
+// ratio doubles when a ring is more than BACKPRESSURE_HIGH_FILL_PCT full or
+// the consumer is BACKPRESSURE_MAX_LAG_NS late, and halves after
+// BACKPRESSURE_CALM_CHECKS checks with all the rings below
+// BACKPRESSURE_LOW_FILL_PCT and a quarter of that lag.
+// BACKPRESSURE_MAX_RATIO is the highest ratio that the driver accepts.
+//
+#define BACKPRESSURE_CHECK_INTERVAL_NS 250000000
+#define BACKPRESSURE_HIGH_FILL_PCT 50
+#define BACKPRESSURE_LOW_FILL_PCT 10
+#define BACKPRESSURE_MAX_LAG_NS 1000000000
+#define BACKPRESSURE_CALM_CHECKS 20
+#define BACKPRESSURE_MAX_RATIO 128
+
+//
+// Pacing of the replay of a trace file, see sinsp_replay_clock. The clock
+// waits for an event for at most REPLAY_MAX_WAIT_NS at a time, sleeps until
+// REPLAY_SPIN_NS before it's due and spins for the rest, and delivers the
+// events that are due in less than REPLAY_SLACK_NS right away.
+//
+#define REPLAY_MAX_WAIT_NS 100000000
+#define REPLAY_SPIN_NS 100000
+#define REPLAY_SLACK_NS 10000
+
+//
+// Default length of the intervals of sinsp_rollup, and max number of groups
+// that a metric can have in an interval. The events of the groups beyond
+// that are counted and left out.
+//
+#define ROLLUP_DEFAULT_INTERVAL_NS 1000000000
+#define ROLLUP_MAX_GROUPS 65536
+
 //
 // Default snaplen
 //
@@ -19,6 +19,7 @@ along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <algorithm>
 #ifndef _WIN32
 #include <unistd.h>
 #include <sys/stat.h>
@@ -37,6 +38,12 @@ along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
 #endif
 //#include "drfilterParser.h"
 
+#ifndef _WIN32
+#define sinsp_exchange_ptr(p, v) __sync_lock_test_and_set(p, v)
+#else
+#define sinsp_exchange_ptr(p, v) InterlockedExchangePointer((PVOID volatile*)(p), v)
+#endif
+
 extern sinsp_evttables g_infotables;
 #ifdef HAS_CHISELS
 extern vector<chiseldir_info>* g_chisel_dirs;
@@ -51,10 +58,51 @@ sinsp::sinsp() :
 	m_h = NULL;
 	m_parser = NULL;
 	m_dumper = NULL;
+	m_dump_buffer_size = 0;
+	m_dump_async = false;
+	m_dump_compression_level = 0;
+	m_dump_fold_repeats = false;
+	m_dump_snapshot_interval_ns = 0;
+	m_last_snapshot_ts = 0;
+	m_dump_max_file_size = 0;
+	m_dump_max_file_duration_ns = 0;
+	m_dump_max_files = 0;
+	m_dump_file_seq = 0;
+	m_dump_file_start_ts = 0;
 	m_network_interfaces = NULL;
+	m_userlist_loaded = false;
 	m_parser = new sinsp_parser(this);
 	m_thread_manager = new sinsp_thread_manager(this);
+	m_ipv4_connections = new sinsp_ipv4_connection_manager(this);
+	m_ipv6_connections = new sinsp_ipv6_connection_manager(this);
+	m_transactions = new sinsp_transaction_table(this);
+	m_protocol_decoders = new sinsp_protocol_decoder_table();
+	m_name_resolver = NULL;
+	m_metrics = new sinsp_metrics(this);
+	m_profiler = NULL;
+	m_active_profiler = NULL;
+	m_backpressure = NULL;
+	m_backpressure_enabled = false;
+	m_replay_clock = NULL;
+	m_snapshots = NULL;
+	m_evt_copier = NULL;
+	m_rollup = NULL;
+#ifdef HAS_CHISELS
+	m_chisel_dirs = *g_chisel_dirs;
+#endif
+	m_drop_gen = 0;
+#ifdef HAS_FILTERING
+	m_sampler = NULL;
+	m_shard_index = 0;
+	m_shard_count = 1;
+	m_block_skipping = false;
+	m_skipped_blocks = 0;
+	m_use_capture_index = false;
+	m_block_summarizer = NULL;
+#endif
+	m_sampling_ratio = 1;
 	m_max_thread_table_size = MAX_THREAD_TABLE_SIZE;
+	m_max_memory = 0;
 	m_thread_timeout_ns = DEFAULT_THREAD_TIMEOUT_S * ONE_SECOND_IN_NS;
 	m_inactive_thread_scan_time_ns = DEFAULT_INACTIVE_THREAD_SCAN_TIME_S * ONE_SECOND_IN_NS;
 
@@ -64,16 +112,53 @@ sinsp::sinsp() :
 
 #ifdef HAS_FILTERING
 	m_filter = NULL;
+	m_requested_filter = NULL;
+	m_has_driver_predicate = false;
 	m_firstevent_ts = 0;
+	m_field_cache = new sinsp_field_cache();
+	m_has_evttype_mask = false;
 #endif
 
 	m_fds_to_remove = new vector<int64_t>;
+	m_evt_arena = new sinsp_arena();
+	m_n_flagstrs = 0;
 	m_machine_info = NULL;
 	m_isdropping = false;
 	m_n_proc_lookups = 0;
 	m_max_n_proc_lookups = 0;
 	m_max_n_proc_socket_lookups = 0;
 	m_snaplen = DEFAULT_SNAPLEN;
+	m_tcp_tuple_elision = false;
+	m_buffer_hash_len = 0;
+	m_ring_buf_size = 0;
+	m_lazy_proc_scan = false;
+	m_driver_state_dump = false;
+	m_checkpoint_file = "";
+	m_bpf_engine = false;
+	m_follow_file = false;
+	m_bg_proc_scan = false;
+	m_proc_scan_pending = false;
+	m_wakeup_watermark = 0;
+	m_max_delay_ms = 0;
+	m_sampling_policy_set = false;
+	m_snaplen_policy_set = false;
+	m_syscall_aggr_flags = 0;
+	m_compact_encoding = false;
+	m_exit_only = false;
+	m_switch_summary_ms = 0;
+	m_runq_summary_ms = 0;
+	m_pgfault_summary_ms = 0;
+	m_procinfo_ring_size = 0;
+	m_state_ring_size = 0;
+	m_reader_threads = 0;
+	m_exclude_consumer_cpus = false;
+	m_tap_size = 0;
+	m_fold_repeats = false;
+	m_batch_len = 0;
+	m_batch_pos = 0;
+#ifdef HAS_FILTERING
+	m_batch_prefiltered = false;
+#endif
 	m_buffer_format = sinsp_evt::PF_NORMAL;
 	m_isdebug_enabled = false;
 }
@@ -87,6 +172,12 @@ sinsp::~sinsp()
 		delete m_fds_to_remove;
 	}
 
+	delete m_evt_arena;
+
+#ifdef HAS_FILTERING
+	delete m_field_cache;
+#endif
+
 	if(m_parser)
 	{
 		delete m_parser;
@@ -98,22 +189,146 @@ sinsp::~sinsp()
 		delete m_thread_manager;
 		m_thread_manager = NULL;
 	}
+
+	if(m_ipv4_connections)
+	{
+		delete m_ipv4_connections;
+		m_ipv4_connections = NULL;
+	}
+
+	if(m_ipv6_connections)
+	{
+		delete m_ipv6_connections;
+		m_ipv6_connections = NULL;
+	}
+
+	if(m_transactions)
+	{
+		delete m_transactions;
+		m_transactions = NULL;
+	}
+
+	if(m_protocol_decoders)
+	{
+		delete m_protocol_decoders;
+		m_protocol_decoders = NULL;
+	}
+
+	if(m_name_resolver)
+	{
+		delete m_name_resolver;
+		m_name_resolver = NULL;
+	}
+
+	if(m_metrics)
+	{
+		delete m_metrics;
+		m_metrics = NULL;
+	}
+
+	if(m_profiler)
+	{
+		delete m_profiler;
+		m_profiler = NULL;
+		m_active_profiler = NULL;
+	}
+
+	if(m_backpressure)
+	{
+		delete m_backpressure;
+		m_backpressure = NULL;
+	}
+
+	if(m_replay_clock)
+	{
+		delete m_replay_clock;
+		m_replay_clock = NULL;
+	}
+
+	if(m_snapshots)
+	{
+		delete m_snapshots;
+		m_snapshots = NULL;
+	}
+
+	if(m_evt_copier)
+	{
+		delete m_evt_copier;
+		m_evt_copier = NULL;
+	}
+
+	if(m_rollup)
+	{
+		delete m_rollup;
+		m_rollup = NULL;
+	}
+
+#ifdef HAS_FILTERING
+	if(m_sampler)
+	{
+		delete m_sampler;
+		m_sampler = NULL;
+	}
+
+	if(m_block_summarizer)
+	{
+		delete m_block_summarizer;
+		m_block_summarizer = NULL;
+	}
+#endif
 }
 
 void sinsp::open(uint32_t timeout_ms)
 {
 	char error[SCAP_LASTERR_SIZE];
+	uint32_t flags = m_bpf_engine? SCAP_OPEN_BPF : 0;
 
 	g_logger.log("starting live capture");
 
 	m_islive = true;
-	m_h = scap_open_live(error);
+
+	if(m_driver_state_dump)
+	{
+		flags |= SCAP_OPEN_DRIVER_STATE;
+	}
+	else if(m_lazy_proc_scan)
+	{
+		flags |= SCAP_OPEN_SKIP_PROC_SCAN | (m_bg_proc_scan? SCAP_OPEN_BG_PROC_SCAN : 0);
+	}
+
+	if(m_checkpoint_file.empty() || (flags & (SCAP_OPEN_DRIVER_STATE | SCAP_OPEN_SKIP_PROC_SCAN)))
+	{
+		m_h = scap_open_live_flags(error, m_ring_buf_size, flags);
+	}
+	else
+	{
+		scap_checkpoint_stats stats;
+
+		m_h = scap_open_live_checkpoint(error, m_ring_buf_size, flags, m_checkpoint_file.c_str(), &stats);
+
+		if(m_h != NULL && stats.loaded)
+		{
+			g_logger.format(sinsp_logger::SEV_INFO, "loaded checkpoint %s: %u processes kept, %u scanned, %u removed",
+				m_checkpoint_file.c_str(),
+				stats.n_kept,
+				stats.n_rescanned,
+				stats.n_removed);
+		}
+		else if(m_h != NULL)
+		{
+			g_logger.format(sinsp_logger::SEV_WARNING, "checkpoint %s not used: %s", m_checkpoint_file.c_str(), stats.reason);
+		}
+	}
 
 	if(m_h == NULL)
 	{
 		throw sinsp_exception(error);
 	}
 
+	m_proc_scan_pending = m_lazy_proc_scan && m_bg_proc_scan && !m_driver_state_dump;
+
+	scap_set_empty_buffer_timeout_ms(m_h, timeout_ms);
+
 	init();
 }
 
@@ -129,9 +344,24 @@ void sinsp::open(string filename)
 		return;
 	}
 
-	g_logger.log("starting offline capture");
+	if(filename.compare(0, sizeof(SCAP_REMOTE_PREFIX) - 1, SCAP_REMOTE_PREFIX) == 0)
+	{
+		g_logger.log("waiting for a remote capture on " + filename);
+
+		m_h = scap_open_remote(filename.c_str(), error);
+	}
+	else if(m_follow_file)
+	{
+		g_logger.log("starting offline capture, following the file");
+
+		m_h = scap_open_offline_follow((char *)filename.c_str(), error);
+	}
+	else
+	{
+		g_logger.log("starting offline capture");
 
-	m_h = scap_open_offline((char *)filename.c_str(), error);
+		m_h = scap_open_offline((char *)filename.c_str(), error);
+	}
 
 	if(m_h == NULL)
 	{
@@ -143,10 +373,73 @@ void sinsp::open(string filename)
 	init();
 }
 
+void sinsp::open(const vector<string>& filenames)
+{
+	char error[SCAP_LASTERR_SIZE];
+	vector<const char*> names;
+	uint32_t j;
+
+	if(filenames.size() == 1)
+	{
+		open(filenames[0]);
+		return;
+	}
+
+	if(filenames.size() == 0)
+	{
+		throw sinsp_exception("no capture to open");
+	}
+
+	m_islive = false;
+
+	g_logger.log("starting merged offline capture");
+
+	for(j = 0; j < filenames.size(); j++)
+	{
+		names.push_back(filenames[j].c_str());
+	}
+
+	m_h = scap_open_merge(&names[0], (uint32_t)names.size(), error);
+
+	if(m_h == NULL)
+	{
+		throw sinsp_exception(error);
+	}
+
+	m_filename = filenames[0];
+
+	init();
+}
+
 void sinsp::close()
 {
 	if(m_h)
 	{
+		//
+		// The last metrics, while the driver counters can still be read
+		//
+		m_metrics->write_export_file();
+
+		//
+		// The dropping mode is shared by all the consumers of the driver
+		//
+		if(m_backpressure != NULL && m_islive)
+		{
+			m_backpressure->reset(false);
+		}
+
+		if(m_islive && !m_checkpoint_file.empty())
+		{
+			try
+			{
+				write_checkpoint(m_checkpoint_file);
+			}
+			catch(sinsp_exception& e)
+			{
+				g_logger.format(sinsp_logger::SEV_ERROR, "can't write checkpoint %s: %s", m_checkpoint_file.c_str(), e.what());
+			}
+		}
+
 		scap_close(m_h);
 		m_h = NULL;
 	}
@@ -163,11 +456,17 @@ void sinsp::close()
 		m_network_interfaces = NULL;
 	}
 
+	m_userlist_loaded = false;
+
 #ifdef HAS_FILTERING
 	if(m_filter != NULL)
 	{
 		delete m_filter;
+		m_filter = NULL;
 	}
+
+	delete (string*)sinsp_exchange_ptr(&m_requested_filter, (string*)NULL);
+	m_has_driver_predicate = false;
 #endif
 }
 
@@ -178,523 +477,2850 @@ void sinsp::autodump_start(const string dump_filename)
 		throw sinsp_exception("inspector not opened yet");
 	}
 
-	m_dumper = scap_dump_open(m_h, dump_filename.c_str());
-	if(NULL == m_dumper)
+	m_dump_filename = dump_filename;
+	m_dump_file_seq = 0;
+	m_dump_file_start_ts = 0;
+
+	if(m_dump_max_file_size != 0 || m_dump_max_file_duration_ns != 0)
 	{
-		throw sinsp_exception(scap_getlasterr(m_h));
+		if(dump_filename.compare(0, sizeof(SCAP_REMOTE_PREFIX) - 1, SCAP_REMOTE_PREFIX) == 0)
+		{
+			throw sinsp_exception("a remote capture can't be split in multiple files");
+		}
+
+		m_dumper = scap_dump_open(m_h, get_dump_file_name(0).c_str());
 	}
+	else
+	{
+		m_dumper = scap_dump_open(m_h, dump_filename.c_str());
+	}
+
+	setup_dumper();
 }
 
-void sinsp::autodump_stop()
+void sinsp::autodump_start(const string dump_filename, const set<int64_t>& tids)
 {
+	scap_threadinfo* table;
+
 	if(NULL == m_h)
 	{
 		throw sinsp_exception("inspector not opened yet");
 	}
 
-	if(m_dumper != NULL)
+	if(m_dump_max_file_size != 0 || m_dump_max_file_duration_ns != 0)
 	{
-		scap_dump_close(m_dumper);
-		m_dumper = NULL;
+		throw sinsp_exception("a dump with a partial process table can't be split in multiple files");
 	}
+
+	m_dump_filename = dump_filename;
+	m_dump_file_seq = 0;
+	m_dump_file_start_ts = 0;
+
+	table = m_thread_manager->to_scap_table(&tids);
+	m_dumper = scap_dump_open_ex(m_h, dump_filename.c_str(), table);
+	sinsp_thread_manager::free_scap_table(table);
+
+	setup_dumper();
 }
 
-void sinsp::import_thread_table()
+//
+// Apply the dump settings to the dumper that was just opened
+//
+void sinsp::setup_dumper()
 {
-	scap_threadinfo *pi;
-	scap_threadinfo *tpi;
-	sinsp_threadinfo newti(this);
+	if(NULL == m_dumper)
+	{
+		throw sinsp_exception(scap_getlasterr(m_h));
+	}
 
-	scap_threadinfo *table = scap_get_proc_table(m_h);
+	configure_dumper(m_dumper);
 
-	//
-	// Scan the scap table and add the threads to our list
-	//
-	HASH_ITER(hh, table, pi, tpi)
+	m_last_snapshot_ts = 0;
+}
+
+//
+// The settings shared by the dump of autodump_start() and the ones of
+// sinsp_dump_manager
+//
+void sinsp::configure_dumper(scap_dumper_t* dumper)
+{
+	if(m_dump_buffer_size != 0)
 	{
-		newti.init(pi);
-		m_thread_manager->add_thread(newti, true);
+		if(scap_dump_set_buffering(m_h, dumper, m_dump_buffer_size, m_dump_async) != SCAP_SUCCESS)
+		{
+			throw sinsp_exception(scap_getlasterr(m_h));
+		}
 	}
 
-	//
-	// Scan the list to create the proper parent/child dependencies
-	//
-	threadinfo_map_iterator_t it;
-	for(it = m_thread_manager->m_threadtable.begin();
-		it != m_thread_manager->m_threadtable.end(); ++it)
+	if(m_dump_compression_level != 0)
 	{
-		m_thread_manager->increment_mainthread_childcount(&it->second);
-		m_thread_manager->increment_program_childcount(&it->second);
+		if(scap_dump_set_compression(m_h, dumper, m_dump_compression_level) != SCAP_SUCCESS)
+		{
+			throw sinsp_exception(scap_getlasterr(m_h));
+		}
 	}
 
-	//
-	// Scan the list to fix the direction of the sockets
-	//
-	m_thread_manager->fix_sockets_coming_from_proc();
+	if(m_dump_fold_repeats)
+	{
+		if(scap_dump_set_fold(m_h, dumper, true) != SCAP_SUCCESS)
+		{
+			throw sinsp_exception(scap_getlasterr(m_h));
+		}
+	}
+
+#ifdef HAS_FILTERING
+	get_block_summarizer();
+	scap_dump_set_summary_kinds(dumper, sinsp_block_summarizer::get_kinds());
+#endif
 }
 
-void sinsp::import_ifaddr_list()
+void sinsp::set_dump_buffering(uint32_t buffer_size, bool async)
 {
-	m_network_interfaces = new sinsp_network_interfaces;
-	m_network_interfaces->import_interfaces(scap_get_ifaddr_list(m_h));
+	m_dump_buffer_size = buffer_size;
+	m_dump_async = async;
 }
 
-sinsp_network_interfaces* sinsp::get_ifaddr_list()
+void sinsp::set_dump_compression(int32_t level)
 {
-	return m_network_interfaces;
+	m_dump_compression_level = level;
 }
 
-void sinsp::import_user_list()
+void sinsp::set_dump_fold_repeats(bool enable)
 {
-	uint32_t j;
-	scap_userlist* ul = scap_get_user_list(m_h);
+	m_dump_fold_repeats = enable;
+}
 
-	for(j = 0; j < ul->nusers; j++)
-	{
-		m_userlist[ul->users[j].uid] = &(ul->users[j]);
-	}
+void sinsp::set_dump_snapshot_interval(uint64_t interval_ns)
+{
+	m_dump_snapshot_interval_ns = interval_ns;
+}
 
-	for(j = 0; j < ul->ngroups; j++)
+void sinsp::set_dump_rotation(uint64_t max_file_size, uint64_t max_file_duration_ns, uint32_t max_files)
+{
+	m_dump_max_file_size = max_file_size;
+	m_dump_max_file_duration_ns = max_file_duration_ns;
+	m_dump_max_files = max_files;
+}
+
+void sinsp::get_dump_drops(OUT uint64_t* nevts, OUT uint64_t* nbytes)
+{
+	if(m_dumper == NULL)
 	{
-		m_grouplist[ul->groups[j].gid] = &(ul->groups[j]);
+		*nevts = 0;
+		*nbytes = 0;
+		return;
 	}
+
+	scap_dump_get_drops(m_dumper, nevts, nbytes);
 }
 
-void sinsp::import_ipv4_interface(const sinsp_ipv4_ifinfo& ifinfo)
+string sinsp::get_dump_file_name(uint64_t seq)
 {
-	ASSERT(m_network_interfaces);
-	m_network_interfaces->import_ipv4_interface(ifinfo);
+	return m_dump_filename + to_string((long long unsigned int)seq);
 }
 
-void sinsp::init()
+void sinsp::rotate_dump()
 {
-	//
-	// Retrieve machine information
-	//
-	m_machine_info = scap_get_machine_info(m_h);
-	if(m_machine_info != NULL)
+	string remove_fname;
+	scap_threadinfo* table;
+	int32_t res;
+
+	m_dump_file_seq++;
+
+	if(m_dump_max_files != 0 && m_dump_file_seq >= m_dump_max_files)
 	{
-		m_num_cpus = m_machine_info->num_cpus;
+		remove_fname = get_dump_file_name(m_dump_file_seq - m_dump_max_files);
 	}
-	else
+
+	table = m_thread_manager->to_scap_table();
+	res = scap_dump_rotate(m_h,
+		m_dumper,
+		get_dump_file_name(m_dump_file_seq).c_str(),
+		table,
+		remove_fname.empty()? NULL : remove_fname.c_str());
+
+	sinsp_thread_manager::free_scap_table(table);
+
+	if(res != SCAP_SUCCESS)
 	{
-		ASSERT(false);
-		m_num_cpus = 0;
+		throw sinsp_exception(scap_getlasterr(m_h));
 	}
 
 	//
-	// Reset the thread manager
-	//
-	m_thread_manager->clear();
-
-	//
-	// Basic inits
+	// The new file starts with the tables, no need for a snapshot right away
 	//
-#ifdef GATHER_INTERNAL_STATS
-	m_stats.clear();
-#endif
+	m_dump_file_start_ts = 0;
+	m_last_snapshot_ts = m_lastevent_ts;
+}
 
-	m_tid_to_remove = -1;
-	m_lastevent_ts = 0;
+void sinsp::write_dump_snapshot()
+{
+	scap_threadinfo* table = m_thread_manager->to_scap_table();
+	int32_t res = scap_dump_snapshot(m_h, m_dumper, table);
 
-	import_ifaddr_list();
-	import_thread_table();
-	import_user_list();
+	sinsp_thread_manager::free_scap_table(table);
 
-#ifdef HAS_ANALYZER
-	//
-	// Notify the analyzer that we're starting
-	//
-	if(m_analyzer)
+	if(res != SCAP_SUCCESS)
 	{
-		m_analyzer->on_capture_start();
+		throw sinsp_exception(scap_getlasterr(m_h));
 	}
-#endif
+}
 
-	//
-	// If m_snaplen was modified, we set snaplen now
-	//
-	if (m_snaplen != DEFAULT_SNAPLEN)
+void sinsp::seek(uint64_t ts)
+{
+	uint64_t evtnum;
+	sinsp_evt* evt;
+	int32_t res;
+
+	if(NULL == m_h)
 	{
-		set_snaplen(m_snaplen);
+		throw sinsp_exception("inspector not opened yet");
 	}
-}
 
-bool should_drop(sinsp_evt *evt, bool* stopped, bool* switched);
-
-int32_t sinsp::next(OUT sinsp_evt **evt)
-{
 	//
-	// Get the event from libscap
+	// Forget the events that were fetched before the seek
 	//
-	int32_t res = scap_next(m_h, &(m_evt.m_pevt), &(m_evt.m_cpuid));
-	if(res != SCAP_SUCCESS)
+	m_batch_pos = 0;
+	m_batch_len = 0;
+
+	if(m_replay_clock != NULL)
+	{
+		m_replay_clock->reset();
+	}
+
+	if(m_snapshots != NULL)
+	{
+		m_snapshots->reset();
+	}
+
+	if(m_rollup != NULL)
+	{
+		m_rollup->reset();
+	}
+
+	res = scap_seek_snapshot(m_h, ts, &evtnum);
+	if(res == SCAP_FAILURE)
+	{
+		throw sinsp_exception(scap_getlasterr(m_h));
+	}
+	else if(res == SCAP_NOTFOUND)
 	{
-		if(res == SCAP_TIMEOUT)
+		if(scap_seek_ts(m_h, ts, &evtnum) == SCAP_FAILURE)
 		{
-			*evt = NULL;
-			return res;
+			throw sinsp_exception(scap_getlasterr(m_h));
 		}
-		else if(res == SCAP_EOF)
+
+		return;
+	}
+
+	//
+	// Rebuild the tables from the snapshot, then parse the events up to ts
+	//
+	m_thread_manager->clear();
+	m_ipv4_connections->clear();
+	m_ipv6_connections->clear();
+	m_transactions->clear();
+	import_thread_table();
+
+	while(true)
+	{
+		if(m_batch_pos == m_batch_len)
 		{
-#ifdef HAS_ANALYZER
-			if(m_analyzer)
+			m_batch_pos = 0;
+			m_batch_len = 0;
+
+			res = scap_next_batch(m_h, m_batch_evts, m_batch_cpuids, SP_SCAP_BATCH_SIZE, &m_batch_len);
+			if(res == SCAP_EOF)
 			{
-				m_analyzer->process_event(NULL, sinsp_analyzer::DF_NONE);
+				break;
 			}
+			else if(res != SCAP_SUCCESS)
+			{
+				throw sinsp_exception(scap_getlasterr(m_h));
+			}
+
+#ifdef HAS_FILTERING
+			m_batch_prefiltered = false;
 #endif
 		}
-		else
+
+		if(m_batch_evts[m_batch_pos]->ts >= ts)
 		{
-			throw sinsp_exception(scap_getlasterr(m_h));
+			break;
 		}
 
-		return res;
+		next(&evt);
 	}
+}
 
-	//
-	// Store a couple of values that we'll need later inside the event.
-	//
-	m_evt.m_evtnum = get_num_events();
-	m_lastevent_ts = m_evt.get_ts();
-#ifdef HAS_FILTERING
-	if(m_firstevent_ts == 0)
+void sinsp::get_snapshots(OUT vector<scap_snapshot_info>* snapshots)
+{
+	const scap_snapshot_info* list;
+	uint32_t n;
+
+	if(NULL == m_h)
 	{
-		m_firstevent_ts = m_lastevent_ts;
+		throw sinsp_exception("inspector not opened yet");
 	}
-#endif
 
-#ifndef HAS_ANALYZER
-	//
-	// Deleayed removal of threads from the thread table, so that
-	// things like exit() or close() can be parsed.
-	// We only do this if the analyzer is not enabled, because the analyzer
-	// needs the process at the end of the sample and will take care of deleting
-	// it.
-	//
-	if(m_tid_to_remove != -1)
+	if(scap_get_snapshots(m_h, &list, &n) != SCAP_SUCCESS)
 	{
-		remove_thread(m_tid_to_remove);
-		m_tid_to_remove = -1;
+		throw sinsp_exception(scap_getlasterr(m_h));
 	}
 
-	//
-	// Run the periodic connection and thread table cleanup
-	//
-	m_thread_manager->remove_inactive_threads();
-#endif // HAS_ANALYZER
+	snapshots->assign(list, list + n);
+}
 
-	//
-	// Deleayed removal of the fd, so that
-	// things like exit() or close() can be parsed.
-	//
-	uint32_t nfdr = m_fds_to_remove->size();
+void sinsp::restore_snapshot(const scap_snapshot_info& snapshot)
+{
+	if(NULL == m_h)
+	{
+		throw sinsp_exception("inspector not opened yet");
+	}
 
-	if(nfdr != 0)
+	m_batch_pos = 0;
+	m_batch_len = 0;
+
+	if(m_replay_clock != NULL)
 	{
-		sinsp_threadinfo* ptinfo = get_thread(m_tid_of_fd_to_remove, true);
-		if(!ptinfo)
+		m_replay_clock->reset();
+	}
+
+	if(m_snapshots != NULL)
+	{
+		m_snapshots->reset();
+	}
+
+	if(m_rollup != NULL)
+	{
+		m_rollup->reset();
+	}
+
+	if(scap_restore_snapshot(m_h, &snapshot) != SCAP_SUCCESS)
+	{
+		throw sinsp_exception(scap_getlasterr(m_h));
+	}
+
+	m_thread_manager->clear();
+	m_ipv4_connections->clear();
+	m_ipv6_connections->clear();
+	m_transactions->clear();
+	import_thread_table();
+}
+
+void sinsp::autodump_stop()
+{
+	if(NULL == m_h)
+	{
+		throw sinsp_exception("inspector not opened yet");
+	}
+
+	if(m_dumper != NULL)
+	{
+		scap_dump_close(m_dumper);
+		m_dumper = NULL;
+	}
+}
+
+void sinsp::autodump_append(const string& filename)
+{
+	char error[SCAP_LASTERR_SIZE];
+	scap_t* h;
+	scap_evt* pevent;
+	uint16_t cpuid;
+	int32_t res;
+
+	if(NULL == m_dumper)
+	{
+		throw sinsp_exception("no dump in progress");
+	}
+
+	h = scap_open_offline((char *)filename.c_str(), error);
+	if(h == NULL)
+	{
+		throw sinsp_exception(error);
+	}
+
+	while(true)
+	{
+		res = scap_next(h, &pevent, &cpuid);
+		if(res == SCAP_EOF)
 		{
-			ASSERT(false);
-			return res;
+			break;
 		}
-
-		for(uint32_t j = 0; j < nfdr; j++)
+		else if(res != SCAP_SUCCESS)
 		{
-			ptinfo->remove_fd(m_fds_to_remove->at(j));
+			string err = scap_getlasterr(h);
+			scap_close(h);
+			throw sinsp_exception(err);
 		}
 
-		m_fds_to_remove->clear();
+		if(scap_dump(m_h, m_dumper, pevent, cpuid) != SCAP_SUCCESS)
+		{
+			scap_close(h);
+			throw sinsp_exception(scap_getlasterr(m_h));
+		}
 	}
 
-#ifdef SIMULATE_DROP_MODE
-	bool sd = false;
-	bool sw = false;
+	scap_close(h);
+}
 
-	if(m_analyzer)
+void sinsp::import_thread_table()
+{
+	sinsp_alloc_scope alloc_scope(SAS_THREADS);
+	scap_threadinfo *pi;
+	scap_threadinfo *tpi;
+	sinsp_threadinfo newti(this);
+
+	scap_threadinfo *table = scap_get_proc_table(m_h);
+
+	//
+	// Scan the scap table and add the threads to our list
+	//
+	HASH_ITER(hh, table, pi, tpi)
 	{
-		m_analyzer->m_configuration->set_analyzer_sample_len_ns(500000000);
+		newti.init(pi);
+		m_thread_manager->add_thread(newti, true);
 	}
 
-	sd = should_drop(&m_evt, &m_isdropping, &sw);
-#endif
+	//
+	// Scan the list to create the proper parent/child dependencies
+	//
+	threadinfo_map_iterator_t it;
+	for(it = m_thread_manager->m_threadtable.begin();
+		it != m_thread_manager->m_threadtable.end(); ++it)
+	{
+		m_thread_manager->increment_mainthread_childcount(&it->second);
+		m_thread_manager->increment_program_childcount(&it->second);
+		m_thread_manager->add_to_proc_tree(&it->second);
+		it->second.share_process_info();
+	}
 
 	//
-	// Run the state engine
+	// Scan the list to fix the direction of the sockets
 	//
-#ifdef SIMULATE_DROP_MODE
-	if(!sd || m_isdropping)
+	m_thread_manager->fix_sockets_coming_from_proc();
+}
+
+//
+// Add the threads found by the background /proc scan, once it's done. The
+// ones that are already in the table have been built from the events, and
+// are more recent.
+//
+void sinsp::import_proc_scan()
+{
+	scap_threadinfo *pi;
+	scap_threadinfo *tpi;
+	sinsp_threadinfo newti(this);
+	vector<int64_t> added;
+
+	int32_t res = scap_proc_scan_complete(m_h);
+	if(res == SCAP_TIMEOUT)
 	{
-		m_parser->process_event(&m_evt);
+		return;
 	}
 
-	if(sd && !m_isdropping)
+	m_proc_scan_pending = false;
+
+	if(res != SCAP_SUCCESS)
 	{
-		*evt = NULL;
-		return SCAP_TIMEOUT;
+		if(res == SCAP_FAILURE)
+		{
+			g_logger.log(string("background /proc scan failed: ") + scap_getlasterr(m_h), sinsp_logger::SEV_WARNING, SINSP_LOGGER_SITE);
+		}
+
+		return;
 	}
-#else
-	m_parser->process_event(&m_evt);
-#endif
 
-#if defined(HAS_FILTERING) && defined(HAS_CAPTURE_FILTERING)
-	if(m_evt.m_filtered_out)
+	scap_threadinfo *table = scap_get_proc_table(m_h);
+
+	HASH_ITER(hh, table, pi, tpi)
 	{
-		*evt = &m_evt;
-		return SCAP_TIMEOUT;
+		if(m_thread_manager->get_thread(pi->tid) != NULL)
+		{
+			continue;
+		}
+
+		newti.init(pi);
+		m_thread_manager->add_thread(newti, true);
+		added.push_back(pi->tid);
 	}
-#endif
 
 	//
-	// If needed, dump the event to file
+	// Same as import_thread_table(), for the new threads only
 	//
-	if(NULL != m_dumper)
+	for(vector<int64_t>::iterator it = added.begin(); it != added.end(); ++it)
 	{
-		res = scap_dump(m_h, m_dumper, m_evt.m_pevt, m_evt.m_cpuid);
-		if(SCAP_SUCCESS != res)
+		sinsp_threadinfo* tinfo = m_thread_manager->get_thread(*it);
+		if(tinfo == NULL)
 		{
-			throw sinsp_exception(scap_getlasterr(m_h));
+			continue;
 		}
+
+		m_thread_manager->increment_mainthread_childcount(tinfo);
+		m_thread_manager->increment_program_childcount(tinfo);
+		m_thread_manager->add_to_proc_tree(tinfo);
+		tinfo->share_process_info();
+		tinfo->fix_sockets_coming_from_proc();
+	}
+}
+
+void sinsp::import_ifaddr_list()
+{
+	m_network_interfaces = new sinsp_network_interfaces;
+	m_network_interfaces->import_interfaces(scap_get_ifaddr_list(m_h));
+}
+
+//
+// The interfaces are imported the first time they're needed, which for a
+// trace file without network activity is never
+//
+sinsp_network_interfaces* sinsp::get_ifaddr_list()
+{
+	if(m_network_interfaces == NULL)
+	{
+		import_ifaddr_list();
 	}
 
+	return m_network_interfaces;
+}
+
+//
+// Like the interfaces, the user tables are imported when they're first
+// used
+//
+void sinsp::import_user_list()
+{
+	uint32_t j;
+	scap_userlist* ul = (m_h != NULL)? scap_get_user_list(m_h) : NULL;
+
+	m_userlist_loaded = true;
+	m_userlist.clear();
+	m_grouplist.clear();
+	m_user_array.clear();
+	m_group_array.clear();
+	m_user_misses.clear();
+	m_group_misses.clear();
+
+#ifdef HAS_FILTERING
 	//
-	// Run the analysis engine
+	// The names of the users and groups that the filters kept in the
+	// threads might have changed
 	//
-#ifdef HAS_ANALYZER
-	if(m_analyzer)
+	m_thread_manager->invalidate_check_results();
+#endif
+
+	if(ul == NULL)
 	{
-#ifdef SIMULATE_DROP_MODE
-		if(!sd || m_isdropping || sw)
+		return;
+	}
+
+	for(j = 0; j < ul->nusers; j++)
+	{
+		uint32_t uid = ul->users[j].uid;
+
+		m_userlist[uid] = &(ul->users[j]);
+
+		if(uid < USERGROUP_ARRAY_SIZE)
 		{
-			if(m_isdropping)
+			if(uid >= m_user_array.size())
 			{
-				m_analyzer->process_event(&m_evt, sinsp_analyzer::DF_FORCE_FLUSH);
+				m_user_array.resize(uid + 1, NULL);
 			}
-			else if(sw)
-			{
-				m_analyzer->process_event(&m_evt, sinsp_analyzer::DF_FORCE_FLUSH_BUT_DONT_EMIT);
-			}
-			else
+
+			m_user_array[uid] = &(ul->users[j]);
+		}
+	}
+
+	for(j = 0; j < ul->ngroups; j++)
+	{
+		uint32_t gid = ul->groups[j].gid;
+
+		m_grouplist[gid] = &(ul->groups[j]);
+
+		if(gid < USERGROUP_ARRAY_SIZE)
+		{
+			if(gid >= m_group_array.size())
 			{
-				m_analyzer->process_event(&m_evt, sinsp_analyzer::DF_FORCE_NOFLUSH);
+				m_group_array.resize(gid + 1, NULL);
 			}
+
+			m_group_array[gid] = &(ul->groups[j]);
 		}
-#else // SIMULATE_DROP_MODE
-		m_analyzer->process_event(&m_evt, sinsp_analyzer::DF_NONE);
-#endif // SIMULATE_DROP_MODE
+	}
+}
+
+//
+// Read the user tables again in the background, if they haven't been read
+// recently. Users and groups can be added while the capture runs, e.g. by
+// a container or a directory service.
+//
+void sinsp::request_userlist_refresh()
+{
+	if(!m_islive || m_userlist_refresh_pending)
+	{
+		return;
+	}
+
+	if(m_last_userlist_refresh_ts != 0 &&
+		m_lastevent_ts < m_last_userlist_refresh_ts + USERLIST_REFRESH_INTERVAL_NS)
+	{
+		return;
+	}
+
+	m_last_userlist_refresh_ts = m_lastevent_ts;
+
+	if(scap_refresh_userlist_start(m_h) != SCAP_SUCCESS)
+	{
+		g_logger.log(string("can't refresh the user list: ") + scap_getlasterr(m_h), sinsp_logger::SEV_WARNING, SINSP_LOGGER_SITE);
+		return;
+	}
+
+	m_userlist_refresh_pending = true;
+}
+
+void sinsp::import_userlist_refresh()
+{
+	int32_t res = scap_refresh_userlist_complete(m_h);
+	if(res == SCAP_TIMEOUT)
+	{
+		return;
+	}
+
+	m_userlist_refresh_pending = false;
+
+	if(res != SCAP_SUCCESS)
+	{
+		if(res == SCAP_FAILURE)
+		{
+			g_logger.log(string("user list refresh failed: ") + scap_getlasterr(m_h), sinsp_logger::SEV_WARNING, SINSP_LOGGER_SITE);
+		}
+
+		return;
+	}
+
+	import_user_list();
+}
+
+void sinsp::import_ipv4_interface(const sinsp_ipv4_ifinfo& ifinfo)
+{
+	get_ifaddr_list()->import_ipv4_interface(ifinfo);
+}
+
+//
+// Called at each gap in the events of a CPU
+//
+void sinsp::add_drop_window(uint16_t cpuid)
+{
+	m_drop_gen++;
+
+	if(cpuid < m_cpu_drops.size())
+	{
+		m_cpu_drops[cpuid].m_n_windows++;
+		m_cpu_drops[cpuid].m_after_drop = true;
+	}
+}
+
+//
+// Look for the ring buffers that lost events since the last batch. The
+// first event of the CPU in the next batch is the first after the gap.
+//
+void sinsp::check_cpu_drops()
+{
+	uint32_t ndevs = scap_get_ndevs(m_h);
+	uint32_t j;
+
+	for(j = 0; j < ndevs && j < m_cpu_drops.size(); j++)
+	{
+		scap_stats stats;
+
+		if(scap_get_device_stats(m_h, j, &stats) != SCAP_SUCCESS)
+		{
+			continue;
+		}
+
+		if(stats.n_drops != m_cpu_drops[j].m_n_drops)
+		{
+			m_cpu_drops[j].m_n_drops = stats.n_drops;
+			add_drop_window(j);
+		}
+	}
+}
+
+void sinsp::init()
+{
+	//
+	// Retrieve machine information
+	//
+	m_machine_info = scap_get_machine_info(m_h);
+	if(m_machine_info != NULL)
+	{
+		m_num_cpus = m_machine_info->num_cpus;
+	}
+	else
+	{
+		ASSERT(false);
+		m_num_cpus = 0;
+	}
+
+	//
+	// Reset the thread manager
+	//
+	m_thread_manager->clear();
+	m_ipv4_connections->clear();
+	m_ipv6_connections->clear();
+	m_transactions->clear();
+
+	//
+	// Basic inits
+	//
+#ifdef GATHER_INTERNAL_STATS
+	m_stats.clear();
+#endif
+
+	m_tids_to_remove.clear();
+	m_lastevent_ts = 0;
+	m_batch_len = 0;
+	m_userlist_refresh_pending = false;
+	m_last_userlist_refresh_ts = 0;
+	m_batch_pos = 0;
+
+	if(m_replay_clock != NULL)
+	{
+		m_replay_clock->reset();
+	}
+
+	if(m_snapshots != NULL)
+	{
+		m_snapshots->reset();
+	}
+
+	if(m_rollup != NULL)
+	{
+		m_rollup->reset();
+	}
+
+	sinsp_cpu_drops nodrops = {0, 0, 0, false};
+	m_cpu_drops.assign(max(m_num_cpus, scap_get_ndevs(m_h)), nodrops);
+	m_sampling_ratio = 1;
+
+	if(m_network_interfaces != NULL)
+	{
+		delete m_network_interfaces;
+		m_network_interfaces = NULL;
+	}
+
+	m_userlist_loaded = false;
+	import_thread_table();
+
+#ifdef HAS_ANALYZER
+	//
+	// Notify the analyzer that we're starting
+	//
+	if(m_analyzer)
+	{
+		m_analyzer->on_capture_start();
 	}
 #endif
 
 	//
-	// Update the last event time for this thread
+	// If m_snaplen was modified, we set snaplen now
+	//
+	if (m_snaplen != DEFAULT_SNAPLEN)
+	{
+		set_snaplen(m_snaplen);
+	}
+
+	if(m_tcp_tuple_elision)
+	{
+		set_tcp_tuple_elision(true);
+	}
+
+	if(m_buffer_hash_len != 0)
+	{
+		set_buffer_hash(m_buffer_hash_len);
+	}
+
+	set_driver_excluded_tids();
+
+	if(m_wakeup_watermark != 0)
+	{
+		set_wakeup_watermark(m_wakeup_watermark);
+	}
+
+	if(m_max_delay_ms != 0)
+	{
+		set_max_delay_ms(m_max_delay_ms);
+	}
+
+	if(m_sampling_policy_set && m_islive)
+	{
+		if(scap_set_sampling_policy(m_h, &m_sampling_policy) != SCAP_SUCCESS)
+		{
+			throw sinsp_exception(scap_getlasterr(m_h));
+		}
+	}
+
+	if(m_snaplen_policy_set && m_islive)
+	{
+		if(scap_set_snaplen_policy(m_h, &m_snaplen_policy) != SCAP_SUCCESS)
+		{
+			throw sinsp_exception(scap_getlasterr(m_h));
+		}
+	}
+
+	if(m_syscall_aggr_flags != 0)
+	{
+		//
+		// Trace files contain events, there's nothing to aggregate
+		//
+		if(!m_islive)
+		{
+			m_syscall_aggr_flags = 0;
+		}
+		else if(scap_set_syscall_aggregation(m_h, m_syscall_aggr_flags) != SCAP_SUCCESS)
+		{
+			throw sinsp_exception(scap_getlasterr(m_h));
+		}
+	}
+
+	if(m_compact_encoding)
+	{
+		//
+		// Trace files are always in the normal encoding
+		//
+		if(!m_islive)
+		{
+			m_compact_encoding = false;
+			m_exit_only = false;
+		}
+		else if(scap_set_compact_encoding(m_h, true) != SCAP_SUCCESS)
+		{
+			throw sinsp_exception(scap_getlasterr(m_h));
+		}
+		else if(m_exit_only && scap_set_exit_only(m_h, true) != SCAP_SUCCESS)
+		{
+			throw sinsp_exception(scap_getlasterr(m_h));
+		}
+	}
+
+	if(m_switch_summary_ms != 0 && m_islive)
+	{
+		if(scap_set_switch_summary(m_h, m_switch_summary_ms) != SCAP_SUCCESS)
+		{
+			throw sinsp_exception(scap_getlasterr(m_h));
+		}
+	}
+
+	if(m_runq_summary_ms != 0 && m_islive)
+	{
+		if(scap_set_runq_summary(m_h, m_runq_summary_ms) != SCAP_SUCCESS)
+		{
+			throw sinsp_exception(scap_getlasterr(m_h));
+		}
+	}
+
+	if(m_pgfault_summary_ms != 0 && m_islive)
+	{
+		if(scap_set_pgfault_summary(m_h, m_pgfault_summary_ms) != SCAP_SUCCESS)
+		{
+			throw sinsp_exception(scap_getlasterr(m_h));
+		}
+	}
+
+	if(m_procinfo_ring_size != 0 && m_islive)
+	{
+		if(scap_enable_procinfo_ring(m_h, m_procinfo_ring_size) != SCAP_SUCCESS)
+		{
+			throw sinsp_exception(scap_getlasterr(m_h));
+		}
+	}
+
+	if(m_state_ring_size != 0 && m_islive)
+	{
+		if(scap_enable_state_ring(m_h, m_state_ring_size) != SCAP_SUCCESS)
+		{
+			throw sinsp_exception(scap_getlasterr(m_h));
+		}
+	}
+
+	//
+	// The consumer is pinned before the readers start, so that they follow
+	//
+	if(m_consumer_cpus.size() != 0)
+	{
+		if(scap_set_consumer_cpus(m_h, &m_consumer_cpus[0], (uint32_t)m_consumer_cpus.size(), m_exclude_consumer_cpus && m_islive) != SCAP_SUCCESS)
+		{
+			throw sinsp_exception(scap_getlasterr(m_h));
+		}
+	}
+
+	//
+	// The readers split the rings among them, so they go after everything
+	// that adds rings. On files, they decompress the frames.
+	//
+	if(m_reader_threads != 0)
+	{
+		if(scap_set_reader_threads(m_h, m_reader_threads) != SCAP_SUCCESS)
+		{
+			throw sinsp_exception(scap_getlasterr(m_h));
+		}
+	}
+
+	if(m_tap_name != "")
+	{
+		if(scap_enable_tap(m_h, m_tap_name.c_str(), m_tap_size) != SCAP_SUCCESS)
+		{
+			throw sinsp_exception(scap_getlasterr(m_h));
+		}
+	}
+
+	if(m_fold_repeats)
+	{
+		if(scap_set_fold(m_h, true) != SCAP_SUCCESS)
+		{
+			throw sinsp_exception(scap_getlasterr(m_h));
+		}
+	}
+
+#ifdef HAS_FILTERING
+	//
+	// If the filter or the event types were set before the capture
+	// started, push the event types to the driver now
+	//
+	if(m_filter != NULL || m_has_evttype_mask)
+	{
+		set_filter_event_mask();
+	}
+
+	if(m_filter != NULL)
+	{
+		set_filter_predicate();
+	}
+
+	if(m_filter != NULL && m_block_skipping)
+	{
+		set_block_filter();
+	}
+#endif
+}
+
+bool should_drop(sinsp_evt *evt, bool* stopped, bool* switched);
+
+int32_t sinsp::next(OUT sinsp_evt **evt)
+{
+	int32_t res = SCAP_SUCCESS;
+	sinsp_profiler* prof = m_active_profiler;
+	uint64_t prof_ts = 0;
+	uint16_t prof_etype = 0;
+
+	//
+	// Nothing allocated for the previous event is used anymore
+	//
+	m_evt_arena->reset();
+
+#ifdef HAS_FILTERING
+	m_field_cache->invalidate();
+
+	if(m_requested_filter != NULL)
+	{
+		install_requested_filter();
+	}
+#endif
+
+	//
+	// Get the event from libscap. Events are fetched in batches, to amortize
+	// the cost of merging the per-CPU buffers.
+	//
+	if(m_batch_pos == m_batch_len)
+	{
+		m_batch_pos = 0;
+		m_batch_len = 0;
+
+		if(m_proc_scan_pending)
+		{
+			import_proc_scan();
+		}
+
+		if(m_userlist_refresh_pending)
+		{
+			import_userlist_refresh();
+		}
+
+		m_metrics->check_export();
+
+		if(m_islive)
+		{
+			check_cpu_drops();
+			m_metrics->check_rings();
+
+			if(m_backpressure_enabled)
+			{
+				m_backpressure->check();
+			}
+		}
+
+		if(prof != NULL)
+		{
+			prof_ts = sinsp_profiler::now();
+		}
+
+		res = scap_next_batch(m_h, m_batch_evts, m_batch_cpuids, SP_SCAP_BATCH_SIZE, &m_batch_len);
+		if(res != SCAP_SUCCESS)
+		{
+			if(res == SCAP_TIMEOUT)
+			{
+				*evt = NULL;
+				return res;
+			}
+			else if(res == SCAP_EOF)
+			{
+#ifdef HAS_ANALYZER
+				if(m_analyzer)
+				{
+					m_analyzer->process_event(NULL, sinsp_analyzer::DF_NONE);
+				}
+#endif
+			}
+			else
+			{
+				throw sinsp_exception(scap_getlasterr(m_h));
+			}
+
+			return res;
+		}
+
+		if(prof != NULL)
+		{
+			uint64_t t = sinsp_profiler::now();
+			prof->m_fetch_ticks_per_evt = m_batch_len? (t - prof_ts) / m_batch_len : 0;
+			prof_ts = t;
+		}
+
+#ifdef HAS_FILTERING
+		//
+		// Test the conditions of the filter that don't need the parsing on
+		// the whole batch at once
+		//
+		m_batch_prefiltered = (m_filter != NULL && m_batch_len >= SP_FILTER_BATCH_MIN_EVTS &&
+			m_filter->run_batch(m_batch_evts, m_batch_cpuids, m_batch_len, m_batch_selected));
+#endif
+
+		if(prof != NULL)
+		{
+			prof->m_batch_filter_ticks_per_evt = m_batch_len? (sinsp_profiler::now() - prof_ts) / m_batch_len : 0;
+		}
+	}
+
+	//
+	// Hold the event of a paced replay until it's due
+	//
+	if(m_replay_clock != NULL && !m_islive && !m_replay_clock->wait(m_batch_evts[m_batch_pos]->ts))
+	{
+		*evt = NULL;
+		return SCAP_TIMEOUT;
+	}
+
+	//
+	// A change of the sampling ratio is announced before the events captured
+	// with it
+	//
+	if(m_backpressure != NULL && m_backpressure->has_marker())
+	{
+		m_evt.m_pevt = m_backpressure->get_marker(m_lastevent_ts);
+		m_evt.m_cpuid = 0;
+		m_evt.m_after_drop = false;
+#ifdef HAS_FILTERING
+		m_evt.m_batch_rejected = false;
+#endif
+	}
+	else
+	{
+		m_evt.m_pevt = m_batch_evts[m_batch_pos];
+		m_evt.m_cpuid = m_batch_cpuids[m_batch_pos];
+		m_evt.m_after_drop = false;
+
+		if(m_evt.m_cpuid < m_cpu_drops.size() && m_cpu_drops[m_evt.m_cpuid].m_after_drop)
+		{
+			m_cpu_drops[m_evt.m_cpuid].m_after_drop = false;
+			m_cpu_drops[m_evt.m_cpuid].m_last_window_ts = m_evt.m_pevt->ts;
+			m_evt.m_after_drop = true;
+		}
+#ifdef HAS_FILTERING
+		m_evt.m_batch_rejected = m_batch_prefiltered && !m_batch_selected[m_batch_pos];
+#endif
+		m_batch_pos++;
+	}
+
+	//
+	// Store a couple of values that we'll need later inside the event.
+	//
+	m_evt.m_evtnum = get_num_events();
+	m_lastevent_ts = m_evt.get_ts();
+
+	if(prof != NULL)
+	{
+		prof_etype = m_evt.get_type();
+		prof->add(SPS_FETCH, prof_etype, prof->m_fetch_ticks_per_evt);
+		prof->m_filter_ticks = 0;
+		prof_ts = sinsp_profiler::now();
+	}
+#ifdef HAS_FILTERING
+	if(m_firstevent_ts == 0)
+	{
+		m_firstevent_ts = m_lastevent_ts;
+	}
+#endif
+
+#ifndef HAS_ANALYZER
+	//
+	// Deleayed removal of threads from the thread table, so that
+	// things like exit() or close() can be parsed.
+	// We only do this if the analyzer is not enabled, because the analyzer
+	// needs the process at the end of the sample and will take care of deleting
+	// it.
+	//
+	// Removing a thread can add its main thread to the list.
+	//
+	if(!m_tids_to_remove.empty())
+	{
+		for(uint32_t j = 0; j < m_tids_to_remove.size(); j++)
+		{
+			remove_thread(m_tids_to_remove[j]);
+		}
+
+		m_tids_to_remove.clear();
+	}
+
+	//
+	// Run the periodic connection and thread table cleanup
+	//
+	m_thread_manager->remove_inactive_threads();
+	m_thread_manager->enforce_memory_budget();
+	m_ipv4_connections->remove_expired_connections(m_lastevent_ts);
+	m_ipv6_connections->remove_expired_connections(m_lastevent_ts);
+#else
+	m_tids_to_remove.clear();
+#endif // HAS_ANALYZER
+
+	//
+	// Deleayed removal of the fd, so that
+	// things like exit() or close() can be parsed.
+	//
+	uint32_t nfdr = m_fds_to_remove->size();
+
+	if(nfdr != 0)
+	{
+		sinsp_threadinfo* ptinfo = get_thread(m_tid_of_fd_to_remove, true);
+		if(!ptinfo)
+		{
+			ASSERT(false);
+			return res;
+		}
+
+		for(uint32_t j = 0; j < nfdr; j++)
+		{
+			ptinfo->remove_fd(m_fds_to_remove->at(j));
+		}
+
+		m_fds_to_remove->clear();
+	}
+
+	if(prof != NULL)
+	{
+		prof->lap(SPS_CLEANUP, prof_etype, &prof_ts);
+	}
+
+#ifdef SIMULATE_DROP_MODE
+	bool sd = false;
+	bool sw = false;
+
+	if(m_analyzer)
+	{
+		m_analyzer->m_configuration->set_analyzer_sample_len_ns(500000000);
+	}
+
+	sd = should_drop(&m_evt, &m_isdropping, &sw);
+#endif
+
+	int64_t parse_ns = -1; // Only for the sampled events
+
+	//
+	// Run the state engine
+	//
+#ifdef SIMULATE_DROP_MODE
+	if(!sd || m_isdropping)
+	{
+		m_parser->process_event(&m_evt);
+	}
+
+	if(sd && !m_isdropping)
+	{
+		*evt = NULL;
+		return SCAP_TIMEOUT;
+	}
+#else
+	if(m_metrics->sample_parser())
+	{
+		uint64_t start = sinsp_metrics::get_time_ns();
+		m_parser->process_event(&m_evt);
+		parse_ns = sinsp_metrics::get_time_ns() - start;
+		m_metrics->add_parser_sample(m_evt.get_type(), parse_ns);
+
+		if(m_islive)
+		{
+			m_metrics->add_lag_sample(m_evt.get_cpuid(), m_evt.get_ts());
+		}
+	}
+	else
+	{
+		m_parser->process_event(&m_evt);
+	}
+#endif
+
+	if(prof != NULL)
+	{
+		uint64_t t = sinsp_profiler::now();
+
+		prof->add(SPS_PARSE, prof_etype, t - prof_ts - prof->m_filter_ticks);
+#ifdef HAS_FILTERING
+		if(m_filter != NULL)
+		{
+			prof->add(SPS_FILTER, prof_etype, prof->m_filter_ticks + prof->m_batch_filter_ticks_per_evt);
+		}
+#endif
+		prof_ts = t;
+	}
+
+	m_metrics->on_event(m_evt.get_type(), m_evt.m_pevt->len, m_evt.m_tinfo, parse_ns);
+
+	if(m_snapshots != NULL)
+	{
+		m_snapshots->on_event(m_lastevent_ts);
+	}
+
+	if(m_rollup != NULL)
+	{
+		m_rollup->advance(m_lastevent_ts);
+	}
+
+#if defined(HAS_FILTERING) && defined(HAS_CAPTURE_FILTERING)
+	if(m_filter != NULL)
+	{
+		m_metrics->on_filter(!m_evt.m_filtered_out);
+	}
+
+	if(m_evt.m_filtered_out)
+	{
+		*evt = &m_evt;
+		return SCAP_TIMEOUT;
+	}
+#endif
+
+	if(m_rollup != NULL)
+	{
+		m_rollup->process(&m_evt);
+	}
+
+	//
+	// If needed, dump the event to file
+	//
+	if(NULL != m_dumper)
+	{
+		res = scap_dump(m_h, m_dumper, m_evt.m_pevt, m_evt.m_cpuid);
+		if(SCAP_SUCCESS != res)
+		{
+			throw sinsp_exception(scap_getlasterr(m_h));
+		}
+
+#ifdef HAS_FILTERING
+		m_block_summarizer->add_keys(m_dumper, &m_evt);
+#endif
+
+		if(m_dump_snapshot_interval_ns != 0)
+		{
+			if(m_last_snapshot_ts == 0)
+			{
+				m_last_snapshot_ts = m_lastevent_ts;
+			}
+			else if(m_lastevent_ts >= m_last_snapshot_ts + m_dump_snapshot_interval_ns)
+			{
+				write_dump_snapshot();
+				m_last_snapshot_ts = m_lastevent_ts;
+			}
+		}
+
+		if(m_dump_file_start_ts == 0)
+		{
+			m_dump_file_start_ts = m_lastevent_ts;
+		}
+
+		if((m_dump_max_file_size != 0 && scap_dump_ftell(m_dumper) >= m_dump_max_file_size) ||
+			(m_dump_max_file_duration_ns != 0 && m_lastevent_ts >= m_dump_file_start_ts + m_dump_max_file_duration_ns))
+		{
+			rotate_dump();
+		}
+
+		if(prof != NULL)
+		{
+			prof->lap(SPS_DUMP, prof_etype, &prof_ts);
+		}
+	}
+
+	//
+	// Run the analysis engine
+	//
+#ifdef HAS_ANALYZER
+	if(m_analyzer)
+	{
+#ifdef SIMULATE_DROP_MODE
+		if(!sd || m_isdropping || sw)
+		{
+			if(m_isdropping)
+			{
+				m_analyzer->process_event(&m_evt, sinsp_analyzer::DF_FORCE_FLUSH);
+			}
+			else if(sw)
+			{
+				m_analyzer->process_event(&m_evt, sinsp_analyzer::DF_FORCE_FLUSH_BUT_DONT_EMIT);
+			}
+			else
+			{
+				m_analyzer->process_event(&m_evt, sinsp_analyzer::DF_FORCE_NOFLUSH);
+			}
+		}
+#else // SIMULATE_DROP_MODE
+		m_analyzer->process_event(&m_evt, sinsp_analyzer::DF_NONE);
+#endif // SIMULATE_DROP_MODE
+
+		if(prof != NULL)
+		{
+			prof->lap(SPS_ANALYZER, prof_etype, &prof_ts);
+		}
+	}
+#endif
+
+	//
+	// Update the last event time for this thread
+	//
+	if(m_evt.m_tinfo)
+	{
+		m_evt.m_tinfo->m_prevevent_ts = m_evt.m_tinfo->m_lastevent_ts;
+		m_evt.m_tinfo->m_lastevent_ts = m_lastevent_ts;
+	}
+
+	//
+	// Done
+	//
+	*evt = &m_evt;
+	return res;
+}
+
+uint64_t sinsp::get_num_events()
+{
+	//
+	// libscap already counted the events of the current batch that we
+	// haven't returned yet
+	//
+	return scap_event_get_num(m_h) - (m_batch_len - m_batch_pos);
+}
+
+sinsp_threadinfo* sinsp::get_thread(int64_t tid, bool query_os_if_not_found)
+{
+	sinsp_threadinfo* sinsp_proc = m_thread_manager->get_thread(tid);
+
+	//
+	// A late event of a thread that just exited
+	//
+	if(sinsp_proc == NULL && query_os_if_not_found)
+	{
+		sinsp_proc = m_thread_manager->add_exited_thread(tid);
+	}
+
+	if(sinsp_proc == NULL && query_os_if_not_found)
+	{
+		sinsp_threadinfo newti(this);
+		scap_threadinfo* scap_proc = NULL;
+		m_n_proc_lookups++;
+
+		if(m_n_proc_lookups == m_max_n_proc_socket_lookups)
+		{
+			g_logger.format(sinsp_logger::SEV_INFO, "Reached max socket lookup number");
+		}
+
+		if(m_n_proc_lookups == m_max_n_proc_lookups)
+		{
+			g_logger.format(sinsp_logger::SEV_INFO, "Reached max processs lookup number");
+		}
+
+		if(m_max_n_proc_lookups == 0 || (m_max_n_proc_lookups != 0 &&
+			(m_n_proc_lookups <= m_max_n_proc_lookups)))
+		{
+			bool scan_sockets = true;
+
+			if(m_max_n_proc_socket_lookups == 0 || (m_max_n_proc_socket_lookups != 0 &&
+				(m_n_proc_lookups <= m_max_n_proc_socket_lookups)))
+			{
+				scan_sockets = false;
+			}
+
+			scap_proc = scap_proc_get(m_h, tid, scan_sockets);
+		}
+
+		if(scap_proc)
+		{
+			newti.init(scap_proc);
+			scap_proc_free(m_h, scap_proc);
+		}
+		else
+		{
+			//
+			// Add a fake entry to avoid a continuous lookup
+			//
+			newti.m_tid = tid;
+			newti.m_pid = tid;
+			newti.m_ptid = -1;
+			newti.m_comm.set(&m_thread_manager->m_string_pool, "<NA>", 4);
+			newti.m_exe.set(&m_thread_manager->m_string_pool, "<NA>", 4);
+			newti.m_uid = 0xffffffff;
+			newti.m_gid = 0xffffffff;
+		}
+
+		m_thread_manager->add_thread(newti);
+		sinsp_proc = m_thread_manager->get_thread(tid);
+	}
+
+	return sinsp_proc;
+}
+
+sinsp_threadinfo* sinsp::get_thread(int64_t tid)
+{
+	return get_thread(tid, false);
+}
+
+sinsp_connection* sinsp::get_connection(const ipv4tuple& tuple)
+{
+	return m_ipv4_connections->get_connection(tuple, m_lastevent_ts);
+}
+
+sinsp_connection* sinsp::get_connection(const ipv6tuple& tuple)
+{
+	return m_ipv6_connections->get_connection(tuple, m_lastevent_ts);
+}
+
+sinsp_proc_tree* sinsp::get_proc_tree()
+{
+	return &m_thread_manager->m_proc_tree;
+}
+
+bool sinsp::get_ipc_peer(int64_t pid, int64_t fd, sinsp_fdinfo_t* fdinfo, OUT int64_t* peer_pid, OUT int64_t* peer_fd)
+{
+	return m_thread_manager->m_ipc_index.find_peer(pid, fd, fdinfo, peer_pid, peer_fd);
+}
+
+void sinsp::get_top_fds(sinsp_io_counter counter, uint32_t n, OUT vector<sinsp_io_top_entry>* res)
+{
+	m_thread_manager->get_top_fds(counter, n, res);
+}
+
+void sinsp::get_top_threads(sinsp_io_counter counter, uint32_t n, OUT vector<sinsp_io_top_entry>* res)
+{
+	m_thread_manager->get_top_threads(counter, n, res);
+}
+
+void sinsp::set_protocol_decoder_port(uint16_t port, sinsp_l7_proto proto)
+{
+	m_protocol_decoders->set_port(port, proto);
+}
+
+void sinsp::set_name_resolution(bool enable)
+{
+	if(enable && m_name_resolver == NULL)
+	{
+		m_name_resolver = new sinsp_name_resolver();
+
+		if(!m_name_resolver->start())
+		{
+			delete m_name_resolver;
+			m_name_resolver = NULL;
+			throw sinsp_exception("name resolution is not supported on this platform");
+		}
+	}
+	else if(!enable && m_name_resolver != NULL)
+	{
+		delete m_name_resolver;
+		m_name_resolver = NULL;
+	}
+}
+
+void sinsp::set_metrics_file(const string& filename, uint64_t interval_ms)
+{
+	m_metrics->set_export_file(filename, interval_ms * 1000000);
+}
+
+void sinsp::set_profiling(bool enable)
+{
+	if(enable)
+	{
+		if(m_profiler == NULL)
+		{
+			m_profiler = new sinsp_profiler();
+		}
+
+		m_profiler->start();
+		m_active_profiler = m_profiler;
+	}
+	else if(m_profiler != NULL)
+	{
+		m_profiler->stop();
+		m_active_profiler = NULL;
+	}
+}
+
+void sinsp::set_backpressure(bool enable)
+{
+	if(enable)
+	{
+		if(m_backpressure == NULL)
+		{
+			m_backpressure = new sinsp_backpressure(this);
+		}
+
+		m_backpressure_enabled = true;
+	}
+	else if(m_backpressure != NULL)
+	{
+		m_backpressure_enabled = false;
+
+		if(m_h != NULL && m_islive)
+		{
+			m_backpressure->reset(true);
+		}
+	}
+}
+
+void sinsp::set_replay_speed(double speed)
+{
+	if(speed < 0)
+	{
+		throw sinsp_exception("invalid replay speed");
+	}
+
+	if(m_replay_clock != NULL)
+	{
+		delete m_replay_clock;
+		m_replay_clock = NULL;
+	}
+
+	if(speed != 0)
+	{
+		m_replay_clock = new sinsp_replay_clock(speed);
+	}
+}
+
+uint64_t sinsp::get_replay_ts()
+{
+	if(m_replay_clock == NULL || m_islive)
+	{
+		return 0;
+	}
+
+	return m_replay_clock->get_ts();
+}
+
+void sinsp::set_snapshot_interval_ns(uint64_t interval_ns)
+{
+	if(m_snapshots == NULL)
+	{
+		if(interval_ns == 0)
+		{
+			return;
+		}
+
+		m_snapshots = new sinsp_snapshot_publisher(this);
+	}
+
+	m_snapshots->set_interval_ns(interval_ns);
+}
+
+const sinsp_state_snapshot* sinsp::acquire_snapshot()
+{
+	if(m_snapshots == NULL)
+	{
+		return NULL;
+	}
+
+	return m_snapshots->acquire();
+}
+
+void sinsp::release_snapshot(const sinsp_state_snapshot* snapshot)
+{
+	if(m_snapshots != NULL)
+	{
+		m_snapshots->release(snapshot);
+	}
+}
+
+sinsp_evt_copy* sinsp::copy_event(sinsp_evt* evt)
+{
+	if(m_evt_copier == NULL)
+	{
+		m_evt_copier = new sinsp_evt_copier(this);
+	}
+
+	return m_evt_copier->copy(evt);
+}
+
+void sinsp::release_event_copy(sinsp_evt_copy* copy)
+{
+	ASSERT(m_evt_copier != NULL);
+	m_evt_copier->release(copy);
+}
+
+sinsp_rollup* sinsp::get_rollup()
+{
+	if(m_rollup == NULL)
+	{
+		m_rollup = new sinsp_rollup(this);
+	}
+
+	return m_rollup;
+}
+
+#ifdef HAS_FILTERING
+void sinsp::set_block_skipping(bool enable)
+{
+	m_block_skipping = enable;
+
+	if(m_h != NULL)
+	{
+		set_block_filter();
+	}
+}
+
+void sinsp::set_consistent_sampling(sinsp_sampling_mode mode, uint32_t ratio)
+{
+	if(m_sampler != NULL)
+	{
+		delete m_sampler;
+		m_sampler = NULL;
+	}
+
+	if(mode != SSM_NONE && ratio > 1)
+	{
+		m_sampler = new sinsp_consistent_sampler(mode, ratio);
+	}
+}
+
+void sinsp::set_shard(uint32_t index, uint32_t count)
+{
+	if(count <= 1 || index >= count)
+	{
+		ASSERT(count <= 1);
+		m_shard_index = 0;
+		m_shard_count = 1;
+		return;
+	}
+
+	m_shard_index = index;
+	m_shard_count = count;
+}
+#endif
+
+void sinsp::add_thread(const sinsp_threadinfo& ptinfo)
+{
+	m_thread_manager->add_thread((sinsp_threadinfo&)ptinfo);
+}
+
+void sinsp::remove_thread(int64_t tid)
+{
+	m_thread_manager->remove_thread(tid);
+}
+
+void sinsp::set_snaplen(uint32_t snaplen)
+{
+	//
+	// If set_snaplen is called before opening of the inspector,
+	// we register the value to be set after its initialization.
+	//
+	if (m_h == NULL)
+	{
+		m_snaplen = snaplen;
+		return;
+	}
+
+	//
+	// Setting the snaplen flushes the libscap buffers, which invalidates the
+	// events of the current batch
+	//
+	m_batch_len = 0;
+	m_batch_pos = 0;
+
+	if(scap_set_snaplen(m_h, snaplen) != SCAP_SUCCESS)
+	{
+		//
+		// We know that setting the snaplen on a file doesn't do anything and
+		// we're ok with it.
+		//
+		if(m_islive)
+		{
+			throw sinsp_exception(scap_getlasterr(m_h));
+		}
+	}
+}
+
+void sinsp::set_buffer_hash(uint32_t len)
+{
+	//
+	// Like for the snaplen, the setting is applied when the inspector is
+	// opened
+	//
+	m_buffer_hash_len = len;
+
+	if(m_h == NULL)
+	{
+		return;
+	}
+
+	if(scap_set_buffer_hash(m_h, len) != SCAP_SUCCESS)
+	{
+		//
+		// Trace files already have their data or their hashes
+		//
+		if(m_islive)
+		{
+			throw sinsp_exception(scap_getlasterr(m_h));
+		}
+	}
+}
+
+void sinsp::set_tcp_tuple_elision(bool enable)
+{
+	//
+	// Like for the snaplen, the setting is applied when the inspector is
+	// opened
+	//
+	m_tcp_tuple_elision = enable;
+
+	if(m_h == NULL)
+	{
+		return;
+	}
+
+	if(scap_set_tcp_tuple_elision(m_h, enable) != SCAP_SUCCESS)
+	{
+		//
+		// Trace files already have their tuples
+		//
+		if(m_islive)
+		{
+			throw sinsp_exception(scap_getlasterr(m_h));
+		}
+	}
+}
+
+void sinsp::set_ring_buffer_size(uint32_t size)
+{
+	if(m_h != NULL)
+	{
+		throw sinsp_exception("the ring buffer size must be set before opening the capture");
+	}
+
+	m_ring_buf_size = size;
+}
+
+void sinsp::set_lazy_proc_scan(bool lazy, bool background_scan)
+{
+	if(m_h != NULL)
+	{
+		throw sinsp_exception("the /proc scan mode must be set before opening the capture");
+	}
+
+	m_lazy_proc_scan = lazy;
+	m_bg_proc_scan = background_scan;
+}
+
+void sinsp::set_driver_state_dump(bool enable)
+{
+	if(m_h != NULL)
+	{
+		throw sinsp_exception("the /proc scan mode must be set before opening the capture");
+	}
+
+	m_driver_state_dump = enable;
+}
+
+void sinsp::set_checkpoint_file(const string& filename)
+{
+	if(m_h != NULL)
+	{
+		throw sinsp_exception("the checkpoint file must be set before opening the capture");
+	}
+
+	m_checkpoint_file = filename;
+}
+
+void sinsp::write_checkpoint(const string& filename)
+{
+	if(m_h == NULL)
+	{
+		throw sinsp_exception("inspector not opened yet");
+	}
+
+	scap_threadinfo* table = m_thread_manager->to_scap_table();
+	int32_t res = scap_write_checkpoint(m_h, filename.c_str(), table);
+
+	sinsp_thread_manager::free_scap_table(table);
+
+	if(res != SCAP_SUCCESS)
+	{
+		throw sinsp_exception(scap_getlasterr(m_h));
+	}
+}
+
+void sinsp::set_bpf_engine(bool enable)
+{
+	if(m_h != NULL)
+	{
+		throw sinsp_exception("the capture engine must be set before opening the capture");
+	}
+
+	m_bpf_engine = enable;
+}
+
+void sinsp::set_follow_file(bool follow)
+{
+	if(m_h != NULL)
+	{
+		throw sinsp_exception("the follow mode must be set before opening the capture");
+	}
+
+	m_follow_file = follow;
+}
+
+void sinsp::set_wakeup_watermark(uint32_t watermark)
+{
+	//
+	// If set_wakeup_watermark is called before opening of the inspector,
+	// we register the value to be set after its initialization.
+	//
+	if(m_h == NULL)
+	{
+		m_wakeup_watermark = watermark;
+		return;
+	}
+
+	if(m_islive && scap_set_wakeup_watermark(m_h, watermark) != SCAP_SUCCESS)
+	{
+		throw sinsp_exception(scap_getlasterr(m_h));
+	}
+}
+
+void sinsp::set_max_delay_ms(uint32_t max_delay_ms)
+{
+	if(m_h == NULL)
+	{
+		m_max_delay_ms = max_delay_ms;
+		return;
+	}
+
+	if(m_islive && scap_set_max_delay_ms(m_h, max_delay_ms) != SCAP_SUCCESS)
+	{
+		throw sinsp_exception(scap_getlasterr(m_h));
+	}
+}
+
+void sinsp::set_sampling_policy(const map<uint32_t, uint32_t>& category_ratios, uint32_t adaptive_threshold)
+{
+	uint32_t j;
+
+	if(adaptive_threshold > 100)
+	{
+		throw sinsp_exception("invalid adaptive sampling threshold " + to_string((long long)adaptive_threshold));
+	}
+
+	memset(&m_sampling_policy, 0, sizeof(m_sampling_policy));
+	m_sampling_policy.adaptive_threshold = adaptive_threshold;
+
+	for(j = 0; j < PPM_EVENT_MAX; j++)
+	{
+		const ppm_event_info* einfo = &g_infotables.m_event_info[j];
+		map<uint32_t, uint32_t>::const_iterator it;
+
+		//
+		// Never sample what the state engine needs
+		//
+		if(einfo->category == EC_PROCESS || (einfo->flags & EF_MODIFIES_STATE))
+		{
+			continue;
+		}
+
+		it = category_ratios.find(einfo->category);
+		if(it != category_ratios.end())
+		{
+			m_sampling_policy.ratios[j] = (uint16_t)MIN(it->second, 0xffff);
+		}
+	}
+
+	//
+	// If set_sampling_policy is called before opening of the inspector,
+	// we register the policy to be set after its initialization.
+	//
+	m_sampling_policy_set = true;
+
+	if(m_h == NULL)
+	{
+		return;
+	}
+
+	if(m_islive && scap_set_sampling_policy(m_h, &m_sampling_policy) != SCAP_SUCCESS)
+	{
+		throw sinsp_exception(scap_getlasterr(m_h));
+	}
+}
+
+void sinsp::set_snaplen_policy(const vector<ppm_snaplen_rule>& rules)
+{
+	uint32_t j;
+
+	if(rules.size() > PPM_MAX_SNAPLEN_RULES)
+	{
+		throw sinsp_exception("too many snaplen rules, the maximum is " + to_string((long long)PPM_MAX_SNAPLEN_RULES));
+	}
+
+	memset(&m_snaplen_policy, 0, sizeof(m_snaplen_policy));
+	m_snaplen_policy.n_rules = (uint32_t)rules.size();
+
+	for(j = 0; j < rules.size(); j++)
+	{
+		m_snaplen_policy.rules[j] = rules[j];
+	}
+
+	//
+	// If set_snaplen_policy is called before opening of the inspector,
+	// we register the rules to be set after its initialization.
+	//
+	m_snaplen_policy_set = true;
+
+	if(m_h == NULL)
+	{
+		return;
+	}
+
+	if(m_islive && scap_set_snaplen_policy(m_h, &m_snaplen_policy) != SCAP_SUCCESS)
+	{
+		throw sinsp_exception(scap_getlasterr(m_h));
+	}
+}
+
+void sinsp::stop_capture()
+{
+	if(scap_stop_capture(m_h) != SCAP_SUCCESS)
+	{
+		throw sinsp_exception(scap_getlasterr(m_h));
+	}
+}
+
+void sinsp::start_capture()
+{
+	if(scap_start_capture(m_h) != SCAP_SUCCESS)
+	{
+		throw sinsp_exception(scap_getlasterr(m_h));
+	}
+}
+
+void sinsp::stop_dropping_mode()
+{
+	if(scap_stop_dropping_mode(m_h) != SCAP_SUCCESS)
+	{
+		throw sinsp_exception(scap_getlasterr(m_h));
+	}
+}
+
+void sinsp::start_dropping_mode(uint32_t sampling_ratio)
+{
+	if(m_islive)
+	{
+		if(scap_start_dropping_mode(m_h, sampling_ratio) != SCAP_SUCCESS)
+		{
+			throw sinsp_exception(scap_getlasterr(m_h));
+		}
+	}
+}
+
+#ifdef HAS_FILTERING
+void sinsp::set_filter(string filter)
+{
+	sinsp_filter* new_filter = NULL;
+
+	//
+	// Compile the new filter first, so that the previous one stays if it's
+	// invalid. The filter is only run by next(), so it can be replaced
+	// between two events.
+	//
+	if(!filter.empty())
+	{
+		new_filter = new sinsp_filter(this, filter);
+	}
+
+	if(m_filter != NULL)
+	{
+		delete m_filter;
+	}
+
+	m_filter = new_filter;
+
+	//
+	// The events already fetched were not tested by this filter
+	//
+	m_batch_prefiltered = false;
+
+	if(m_h != NULL)
+	{
+		set_filter_event_mask();
+		set_filter_predicate();
+
+		if(m_block_skipping)
+		{
+			set_block_filter();
+		}
+	}
+}
+
+void sinsp::request_filter(const string& filter)
+{
+	delete (string*)sinsp_exchange_ptr(&m_requested_filter, new string(filter));
+}
+
+void sinsp::install_requested_filter()
+{
+	string* filter = (string*)sinsp_exchange_ptr(&m_requested_filter, (string*)NULL);
+
+	if(filter == NULL)
+	{
+		return;
+	}
+
+	try
+	{
+		set_filter(*filter);
+		g_logger.log("installed the filter '" + *filter + "'", sinsp_logger::SEV_INFO);
+	}
+	catch(sinsp_exception& e)
+	{
+		g_logger.log("can't install the filter '" + *filter + "': " + e.what(), sinsp_logger::SEV_ERROR);
+	}
+
+	delete filter;
+}
+
+void sinsp::set_evttype_mask(const ppm_evt_mask* mask)
+{
+	if(mask != NULL)
+	{
+		m_evttype_mask = *mask;
+		m_has_evttype_mask = true;
+	}
+	else
+	{
+		m_has_evttype_mask = false;
+	}
+
+	if(m_h != NULL)
+	{
+		set_filter_event_mask();
+	}
+}
+
+//
+// Tell the driver to discard the event types that the filter would reject
+// anyway, or that are not in the mask of set_evttype_mask(), so they don't
+// go through the ring buffer and the parsers. State-changing events are
+// always parsed, even when filtered out, so they are always captured.
+//
+void sinsp::set_filter_event_mask()
+{
+#ifdef HAS_CAPTURE_FILTERING
+	uint32_t j;
+	ppm_evt_mask mask;
+
+	if(!m_islive)
+	{
+		return;
+	}
+
+	if(m_filter != NULL)
+	{
+		m_filter->get_evttypes(&mask);
+	}
+	else
+	{
+		memset(&mask, 0xff, sizeof(mask));
+	}
+
+	if(m_has_evttype_mask)
+	{
+		for(j = 0; j < sizeof(mask.mask); j++)
+		{
+			mask.mask[j] &= m_evttype_mask.mask[j];
+		}
+	}
+
+	for(j = 0; j < PPM_EVENT_MAX; j++)
+	{
+		if(g_infotables.m_event_info[j].flags & EF_MODIFIES_STATE)
+		{
+			PPM_EVT_MASK_SET(&mask, j);
+		}
+	}
+
+	//
+	// This is just an optimization, so older drivers that don't support
+	// the event mask are not a reason to fail
+	//
+	if(scap_set_event_mask(m_h, &mask) != SCAP_SUCCESS)
+	{
+		g_logger.log(string("can't set the driver event mask: ") + scap_getlasterr(m_h), sinsp_logger::SEV_WARNING);
+	}
+#endif
+}
+
+//
+// Tell the driver to discard the events whose thread id, process id or
+// return value make the filter reject them, before it fills them
+//
+void sinsp::set_filter_predicate()
+{
+#ifdef HAS_CAPTURE_FILTERING
+	ppm_predicate pred;
+
+	if(!m_islive)
+	{
+		return;
+	}
+
+	if(m_filter != NULL)
+	{
+		m_filter->get_predicate(&pred);
+	}
+	else
+	{
+		pred.n_clauses = 0;
+	}
+
+	//
+	// An empty predicate only matters to remove the one of a previous
+	// filter
+	//
+	if(pred.n_clauses == 0 && !m_has_driver_predicate)
+	{
+		return;
+	}
+
+	//
+	// Like the event mask, this is just an optimization
+	//
+	if(scap_set_predicate(m_h, &pred) != SCAP_SUCCESS)
+	{
+		g_logger.log(string("can't set the driver predicate: ") + scap_getlasterr(m_h), sinsp_logger::SEV_WARNING);
+		return;
+	}
+
+	m_has_driver_predicate = (pred.n_clauses != 0);
+#endif
+}
+
+//
+// Tell the file reader to skip the groups of events that the filter rejects,
+// if set_block_skipping() asked for it
+//
+void sinsp::set_block_filter()
+{
+	int32_t res;
+
+	if(m_islive)
+	{
+		return;
+	}
+
+	m_use_capture_index = false;
+	m_capture_index_evtnums.clear();
+
+	if(m_block_skipping && m_filter != NULL)
+	{
+		sinsp_capture_index index(this);
+
+		if(index.load(m_filename) && index.lookup(m_filter, &m_capture_index_evtnums))
+		{
+			g_logger.log("using " + sinsp_capture_index::get_filename(m_filename) + ", " +
+				to_string((long long unsigned int)m_capture_index_evtnums.size()) + " events match", sinsp_logger::SEV_INFO);
+			m_use_capture_index = true;
+		}
+
+		res = scap_set_block_filter(m_h, block_filter_callback, this);
+	}
+	else
+	{
+		res = scap_set_block_filter(m_h, NULL, NULL);
+	}
+
+	//
+	// Like the driver filters, this is just an optimization
+	//
+	if(res == SCAP_NOTFOUND)
+	{
+		g_logger.log("the trace file has no block summaries, all the events are read", sinsp_logger::SEV_INFO);
+	}
+	else if(res != SCAP_SUCCESS)
+	{
+		g_logger.log(string("can't set the block filter: ") + scap_getlasterr(m_h), sinsp_logger::SEV_WARNING);
+	}
+}
+
+bool sinsp::block_filter_callback(void* context, uint64_t first_evtnum, uint64_t end_evtnum, const scap_block_summary* summary)
+{
+	sinsp* inspector = (sinsp*)context;
+
+	if(summary != NULL && !inspector->m_filter->may_match_block(summary))
+	{
+		inspector->m_skipped_blocks++;
+		return false;
+	}
+
+	//
+	// The group has the events after first_evtnum up to end_evtnum
+	//
+	if(inspector->m_use_capture_index)
+	{
+		const vector<uint64_t>& evtnums = inspector->m_capture_index_evtnums;
+		vector<uint64_t>::const_iterator it = upper_bound(evtnums.begin(), evtnums.end(), first_evtnum);
+
+		if(it == evtnums.end() || *it > end_evtnum)
+		{
+			inspector->m_skipped_blocks++;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+sinsp_block_summarizer* sinsp::get_block_summarizer()
+{
+	if(m_block_summarizer == NULL)
+	{
+		m_block_summarizer = new sinsp_block_summarizer(this);
+	}
+
+	return m_block_summarizer;
+}
+#endif
+
+const scap_machine_info* sinsp::get_machine_info()
+{
+	return m_machine_info;
+}
+
+uint32_t sinsp::get_nsources()
+{
+	return (m_h != NULL)? scap_get_nsources(m_h) : 1;
+}
+
+const scap_machine_info* sinsp::get_source_machine_info(uint32_t source)
+{
+	if(m_h == NULL)
+	{
+		return NULL;
+	}
+
+	return scap_get_source_machine_info(m_h, source);
+}
+
+const unordered_map<uint32_t, scap_userinfo*>* sinsp::get_userlist()
+{
+	if(!m_userlist_loaded)
+	{
+		import_user_list();
+	}
+
+	return &m_userlist;
+}
+
+const unordered_map<uint32_t, scap_groupinfo*>* sinsp::get_grouplist()
+{
+	if(!m_userlist_loaded)
+	{
+		import_user_list();
+	}
+
+	return &m_grouplist;
+}
+
+scap_userinfo* sinsp::get_user(uint32_t uid)
+{
+	if(!m_userlist_loaded)
+	{
+		import_user_list();
+	}
+
+	if(uid < m_user_array.size() && m_user_array[uid] != NULL)
+	{
+		return m_user_array[uid];
+	}
+
+	if(uid >= USERGROUP_ARRAY_SIZE)
+	{
+		unordered_map<uint32_t, scap_userinfo*>::iterator it = m_userlist.find(uid);
+
+		if(it != m_userlist.end())
+		{
+			return it->second;
+		}
+	}
+
+	//
+	// Only the first miss of an id asks for a refresh
+	//
+	if(uid != 0xffffffff && m_user_misses.insert(uid).second)
+	{
+		request_userlist_refresh();
+	}
+
+	return NULL;
+}
+
+scap_groupinfo* sinsp::get_group(uint32_t gid)
+{
+	if(!m_userlist_loaded)
+	{
+		import_user_list();
+	}
+
+	if(gid < m_group_array.size() && m_group_array[gid] != NULL)
+	{
+		return m_group_array[gid];
+	}
+
+	if(gid >= USERGROUP_ARRAY_SIZE)
+	{
+		unordered_map<uint32_t, scap_groupinfo*>::iterator it = m_grouplist.find(gid);
+
+		if(it != m_grouplist.end())
+		{
+			return it->second;
+		}
+	}
+
+	if(gid != 0xffffffff && m_group_misses.insert(gid).second)
+	{
+		request_userlist_refresh();
+	}
+
+	return NULL;
+}
+
+#ifdef HAS_FILTERING
+void sinsp::get_filtercheck_fields_info(OUT vector<const filter_check_info*>* list)
+{
+	sinsp_utils::get_filtercheck_fields_info(list);
+}
+#else
+void sinsp::get_filtercheck_fields_info(OUT vector<const filter_check_info*>* list)
+{
+}
+#endif
+
+uint32_t sinsp::reserve_thread_memory(uint32_t size)
+{
+	return m_thread_privatestate_manager.reserve(size);
+}
+
+void sinsp::get_capture_stats(scap_stats* stats)
+{
+	if(scap_get_stats(m_h, stats) != SCAP_SUCCESS)
+	{
+		throw sinsp_exception(scap_getlasterr(m_h));
+	}
+}
+
+void sinsp::get_device_info(OUT vector<scap_device_info>* devices)
+{
+	uint32_t j;
+
+	devices->clear();
+
+	if(m_h == NULL)
+	{
+		return;
+	}
+
+	for(j = 0; j < scap_get_ndevs(m_h); j++)
+	{
+		scap_device_info info;
+
+		if(scap_get_device_info(m_h, j, &info) != SCAP_SUCCESS)
+		{
+			throw sinsp_exception(scap_getlasterr(m_h));
+		}
+
+		devices->push_back(info);
+	}
+}
+
+void sinsp::get_consumer_placement(OUT scap_consumer_placement* placement)
+{
+	if(m_h == NULL)
+	{
+		placement->cpu = -1;
+		placement->numa_node = -1;
+		placement->ncpus = 0;
+		placement->excluded = false;
+		return;
+	}
+
+	scap_get_consumer_placement(m_h, placement);
+}
+
+void sinsp::set_detailed_stats(bool enable)
+{
+	if(scap_enable_detailed_stats(m_h, enable) != SCAP_SUCCESS)
+	{
+		throw sinsp_exception(scap_getlasterr(m_h));
+	}
+}
+
+void sinsp::get_detailed_stats(int32_t cpuid, OUT ppm_detailed_stats* stats)
+{
+	if(scap_get_detailed_stats(m_h, cpuid, stats) != SCAP_SUCCESS)
+	{
+		throw sinsp_exception(scap_getlasterr(m_h));
+	}
+}
+
+void sinsp::set_syscall_aggregation(bool enable, bool per_process)
+{
+	uint32_t flags = 0;
+
+	if(enable)
+	{
+		flags = PPM_AGGR_ENABLED;
+
+		if(per_process)
+		{
+			flags |= PPM_AGGR_PER_TGID;
+		}
+	}
+
+	//
+	// If set_syscall_aggregation is called before opening of the inspector,
+	// we register the flags to be set after its initialization.
+	//
+	if(m_h == NULL)
+	{
+		m_syscall_aggr_flags = flags;
+		return;
+	}
+
+	if(!m_islive)
+	{
+		throw sinsp_exception("syscall aggregation is only supported on live captures");
+	}
+
+	if(scap_set_syscall_aggregation(m_h, flags) != SCAP_SUCCESS)
+	{
+		m_syscall_aggr_flags = 0;
+		throw sinsp_exception(scap_getlasterr(m_h));
+	}
+
+	m_syscall_aggr_flags = flags;
+}
+
+void sinsp::set_compact_encoding(bool enable)
+{
+	//
+	// If set_compact_encoding is called before opening of the inspector,
+	// we register the value to be set after its initialization.
+	//
+	if(m_h == NULL)
+	{
+		m_compact_encoding = enable;
+		return;
+	}
+
+	if(!m_islive)
+	{
+		throw sinsp_exception("the compact encoding is only supported on live captures");
+	}
+
+	if(scap_set_compact_encoding(m_h, enable) != SCAP_SUCCESS)
+	{
+		throw sinsp_exception(scap_getlasterr(m_h));
+	}
+
+	m_compact_encoding = enable;
+
+	if(!enable)
+	{
+		m_exit_only = false;
+	}
+}
+
+void sinsp::set_exit_only(bool enable)
+{
+	//
+	// Same as set_compact_encoding(), and the enter events need the
+	// compact encoding to travel in the exit ones
+	//
+	if(m_h == NULL)
+	{
+		m_exit_only = enable;
+		if(enable)
+		{
+			m_compact_encoding = true;
+		}
+
+		return;
+	}
+
+	if(!m_islive)
+	{
+		throw sinsp_exception("the exit only mode is only supported on live captures");
+	}
+
+	if(enable && !m_compact_encoding)
+	{
+		set_compact_encoding(true);
+	}
+
+	if(scap_set_exit_only(m_h, enable) != SCAP_SUCCESS)
+	{
+		throw sinsp_exception(scap_getlasterr(m_h));
+	}
+
+	m_exit_only = enable;
+}
+
+void sinsp::set_switch_summary(uint32_t interval_ms)
+{
+	//
+	// If set_switch_summary is called before opening of the inspector,
+	// we register the value to be set after its initialization.
+	//
+	if(m_h == NULL)
+	{
+		m_switch_summary_ms = interval_ms;
+		return;
+	}
+
+	if(!m_islive)
+	{
+		throw sinsp_exception("context switch summaries are only supported on live captures");
+	}
+
+	if(scap_set_switch_summary(m_h, interval_ms) != SCAP_SUCCESS)
+	{
+		throw sinsp_exception(scap_getlasterr(m_h));
+	}
+
+	m_switch_summary_ms = interval_ms;
+}
+
+void sinsp::set_runq_summary(uint32_t interval_ms)
+{
+	//
+	// If set_runq_summary is called before opening of the inspector,
+	// we register the value to be set after its initialization.
+	//
+	if(m_h == NULL)
+	{
+		m_runq_summary_ms = interval_ms;
+		return;
+	}
+
+	if(!m_islive)
+	{
+		throw sinsp_exception("run queue summaries are only supported on live captures");
+	}
+
+	if(scap_set_runq_summary(m_h, interval_ms) != SCAP_SUCCESS)
+	{
+		throw sinsp_exception(scap_getlasterr(m_h));
+	}
+
+	m_runq_summary_ms = interval_ms;
+}
+
+void sinsp::set_pgfault_summary(uint32_t interval_ms)
+{
+	//
+	// If set_pgfault_summary is called before opening of the inspector,
+	// we register the value to be set after its initialization.
 	//
-	if(m_evt.m_tinfo)
+	if(m_h == NULL)
 	{
-		m_evt.m_tinfo->m_prevevent_ts = m_evt.m_tinfo->m_lastevent_ts;
-		m_evt.m_tinfo->m_lastevent_ts = m_lastevent_ts;
+		m_pgfault_summary_ms = interval_ms;
+		return;
 	}
 
-	//
-	// Done
-	//
-	*evt = &m_evt;
-	return res;
-}
+	if(!m_islive)
+	{
+		throw sinsp_exception("page fault summaries are only supported on live captures");
+	}
 
-uint64_t sinsp::get_num_events()
-{
-	return scap_event_get_num(m_h);
+	if(scap_set_pgfault_summary(m_h, interval_ms) != SCAP_SUCCESS)
+	{
+		throw sinsp_exception(scap_getlasterr(m_h));
+	}
+
+	m_pgfault_summary_ms = interval_ms;
 }
 
-sinsp_threadinfo* sinsp::get_thread(int64_t tid, bool query_os_if_not_found)
+void sinsp::set_procinfo_ring(uint32_t ring_size)
 {
-	sinsp_threadinfo* sinsp_proc = m_thread_manager->get_thread(tid);
-
-	if(sinsp_proc == NULL && query_os_if_not_found)
+	//
+	// If set_procinfo_ring is called before opening of the inspector,
+	// we register the value to be set after its initialization.
+	//
+	if(m_h == NULL)
 	{
-		sinsp_threadinfo newti(this);
-		scap_threadinfo* scap_proc = NULL;
-		m_n_proc_lookups++;
-
-		if(m_n_proc_lookups == m_max_n_proc_socket_lookups)
-		{
-			g_logger.format(sinsp_logger::SEV_INFO, "Reached max socket lookup number");
-		}
+		m_procinfo_ring_size = ring_size;
+		return;
+	}
 
-		if(m_n_proc_lookups == m_max_n_proc_lookups)
-		{
-			g_logger.format(sinsp_logger::SEV_INFO, "Reached max processs lookup number");
-		}
+	if(!m_islive)
+	{
+		throw sinsp_exception("the process info ring is only supported on live captures");
+	}
 
-		if(m_max_n_proc_lookups == 0 || (m_max_n_proc_lookups != 0 &&
-			(m_n_proc_lookups <= m_max_n_proc_lookups)))
-		{
-			bool scan_sockets = true;
+	if(scap_enable_procinfo_ring(m_h, ring_size) != SCAP_SUCCESS)
+	{
+		throw sinsp_exception(scap_getlasterr(m_h));
+	}
 
-			if(m_max_n_proc_socket_lookups == 0 || (m_max_n_proc_socket_lookups != 0 &&
-				(m_n_proc_lookups <= m_max_n_proc_socket_lookups)))
-			{
-				scan_sockets = false;
-			}
+	m_procinfo_ring_size = ring_size;
+}
 
-			scap_proc = scap_proc_get(m_h, tid, scan_sockets);
-		}
+void sinsp::set_state_ring(uint32_t ring_size)
+{
+	//
+	// If set_state_ring is called before opening of the inspector,
+	// we register the value to be set after its initialization.
+	//
+	if(m_h == NULL)
+	{
+		m_state_ring_size = ring_size;
+		return;
+	}
 
-		if(scap_proc)
-		{
-			newti.init(scap_proc);
-			scap_proc_free(m_h, scap_proc);
-		}
-		else
-		{
-			//
-			// Add a fake entry to avoid a continuous lookup
-			//
-			newti.m_tid = tid;
-			newti.m_pid = tid;
-			newti.m_ptid = -1;
-			newti.m_comm = "<NA>";
-			newti.m_exe = "<NA>";
-			newti.m_uid = 0xffffffff;
-			newti.m_gid = 0xffffffff;
-		}
+	if(!m_islive)
+	{
+		throw sinsp_exception("the state ring is only supported on live captures");
+	}
 
-		m_thread_manager->add_thread(newti);
-		sinsp_proc = m_thread_manager->get_thread(tid);
+	if(scap_enable_state_ring(m_h, ring_size) != SCAP_SUCCESS)
+	{
+		throw sinsp_exception(scap_getlasterr(m_h));
 	}
 
-	return sinsp_proc;
+	m_state_ring_size = ring_size;
 }
 
-sinsp_threadinfo* sinsp::get_thread(int64_t tid)
+void sinsp::set_reader_threads(uint32_t nthreads)
 {
-	return get_thread(tid, false);
-}
+	//
+	// If set_reader_threads is called before opening of the inspector,
+	// we register the value to be set after its initialization.
+	//
+	if(m_h == NULL)
+	{
+		m_reader_threads = nthreads;
+		return;
+	}
 
-void sinsp::add_thread(const sinsp_threadinfo& ptinfo)
-{
-	m_thread_manager->add_thread((sinsp_threadinfo&)ptinfo);
-}
+	if(scap_set_reader_threads(m_h, nthreads) != SCAP_SUCCESS)
+	{
+		throw sinsp_exception(scap_getlasterr(m_h));
+	}
 
-void sinsp::remove_thread(int64_t tid)
-{
-	m_thread_manager->remove_thread(tid);
+	m_reader_threads = nthreads;
 }
 
-void sinsp::set_snaplen(uint32_t snaplen)
+void sinsp::set_consumer_cpus(const vector<uint32_t>& cpus, bool exclude)
 {
 	//
-	// If set_snaplen is called before opening of the inspector,
-	// we register the value to be set after its initialization.
+	// If set_consumer_cpus is called before opening of the inspector,
+	// we register the values to be set after its initialization.
 	//
-	if (m_h == NULL)
+	if(m_h == NULL)
 	{
-		m_snaplen = snaplen;
+		m_consumer_cpus = cpus;
+		m_exclude_consumer_cpus = exclude;
 		return;
 	}
 
-	if(scap_set_snaplen(m_h, snaplen) != SCAP_SUCCESS)
+	if(exclude && !m_islive)
 	{
-		//
-		// We know that setting the snaplen on a file doesn't do anything and
-		// we're ok with it.
-		//
-		if(m_islive)
-		{
-			throw sinsp_exception(scap_getlasterr(m_h));
-		}
+		throw sinsp_exception("excluding CPUs is only supported on live captures");
 	}
-}
 
-void sinsp::stop_capture()
-{
-	if(scap_stop_capture(m_h) != SCAP_SUCCESS)
+	if(scap_set_consumer_cpus(m_h, cpus.size() != 0? &cpus[0] : NULL, (uint32_t)cpus.size(), exclude) != SCAP_SUCCESS)
 	{
 		throw sinsp_exception(scap_getlasterr(m_h));
 	}
+
+	m_consumer_cpus = cpus;
+	m_exclude_consumer_cpus = exclude;
 }
 
-void sinsp::start_capture()
+void sinsp::set_event_tap(const string& name, uint32_t size)
 {
-	if(scap_start_capture(m_h) != SCAP_SUCCESS)
+	//
+	// If set_event_tap is called before opening of the inspector,
+	// we register the values to be set after its initialization.
+	//
+	if(m_h == NULL)
 	{
-		throw sinsp_exception(scap_getlasterr(m_h));
+		m_tap_name = name;
+		m_tap_size = size;
+		return;
 	}
-}
 
-void sinsp::stop_dropping_mode()
-{
-	if(scap_stop_dropping_mode(m_h) != SCAP_SUCCESS)
+	if(scap_enable_tap(m_h, name.c_str(), size) != SCAP_SUCCESS)
 	{
 		throw sinsp_exception(scap_getlasterr(m_h));
 	}
+
+	m_tap_name = name;
+	m_tap_size = size;
 }
 
-void sinsp::start_dropping_mode(uint32_t sampling_ratio)
+void sinsp::set_fold_repeats(bool enable)
 {
-	if(m_islive)
+	if(m_h != NULL)
 	{
-		if(scap_start_dropping_mode(m_h, sampling_ratio) != SCAP_SUCCESS)
+		if(scap_set_fold(m_h, enable) != SCAP_SUCCESS)
 		{
 			throw sinsp_exception(scap_getlasterr(m_h));
 		}
 	}
+
+	m_fold_repeats = enable;
 }
 
-#ifdef HAS_FILTERING
-void sinsp::set_filter(string filter)
+void sinsp::set_max_memory(uint64_t max_bytes)
 {
-	if(m_filter != NULL)
-	{
-		ASSERT(false);
-		throw sinsp_exception("filter can only be set once");
-	}
+	m_max_memory = max_bytes;
+}
 
-	m_filter = new sinsp_filter(this, filter);
+uint64_t sinsp::get_memory_usage()
+{
+	return m_thread_manager->get_memory_usage();
 }
-#endif
 
-const scap_machine_info* sinsp::get_machine_info()
+uint64_t sinsp::get_evicted_fds()
 {
-	return m_machine_info;
+	return m_thread_manager->get_evicted_fds();
 }
 
-const unordered_map<uint32_t, scap_userinfo*>* sinsp::get_userlist()
+uint64_t sinsp::get_evicted_threads()
 {
-	return &m_userlist;
+	return m_thread_manager->get_evicted_threads();
 }
 
-const unordered_map<uint32_t, scap_groupinfo*>* sinsp::get_grouplist()
+void sinsp::add_event_hook(uint16_t etype, sinsp_event_hook hook, void* arg)
 {
-	return &m_grouplist;
+	if(etype >= PPM_EVENT_MAX)
+	{
+		throw sinsp_exception("invalid event type " + to_string((long long)etype));
+	}
+
+	m_parser->add_event_hook(etype, hook, arg);
 }
 
-#ifdef HAS_FILTERING
-void sinsp::get_filtercheck_fields_info(OUT vector<const filter_check_info*>* list)
+void sinsp::add_category_hook(ppm_event_category category, sinsp_event_hook hook, void* arg)
 {
-	sinsp_utils::get_filtercheck_fields_info(list);
+	uint32_t j;
+
+	for(j = 0; j < PPM_EVENT_MAX; j++)
+	{
+		uint32_t ecat = g_infotables.m_event_info[j].category;
+
+		if(category == EC_INTERNAL? (ecat & EC_INTERNAL) != 0 : (ecat & ~EC_INTERNAL) == (uint32_t)category)
+		{
+			m_parser->add_event_hook((uint16_t)j, hook, arg);
+		}
+	}
 }
-#else
-void sinsp::get_filtercheck_fields_info(OUT vector<const filter_check_info*>* list)
+
+void sinsp::add_state_listener(sinsp_state_listener* listener)
 {
+	m_state_listeners.push_back(listener);
 }
-#endif
 
-uint32_t sinsp::reserve_thread_memory(uint32_t size)
+void sinsp::remove_state_listener(sinsp_state_listener* listener)
 {
-	if(m_h != NULL)
+	vector<sinsp_state_listener*>::iterator it = find(m_state_listeners.begin(), m_state_listeners.end(), listener);
+
+	if(it != m_state_listeners.end())
 	{
-		throw sinsp_exception("reserve_thread_memory can't be called after capture starts");
+		m_state_listeners.erase(it);
 	}
-
-	return m_thread_privatestate_manager.reserve(size);
 }
 
-void sinsp::get_capture_stats(scap_stats* stats)
+void sinsp::get_syscall_aggregation(OUT vector<ppm_syscall_aggr_entry>* entries)
 {
-	if(scap_get_stats(m_h, stats) != SCAP_SUCCESS)
+	uint32_t j;
+	uint32_t k;
+	uint32_t l;
+	map<pair<uint32_t, uint16_t>, uint32_t> positions;
+	map<pair<uint32_t, uint16_t>, uint32_t>::iterator it;
+
+	entries->clear();
+
+	if(!is_syscall_aggregation_enabled() || m_h == NULL)
 	{
-		throw sinsp_exception(scap_getlasterr(m_h));
+		return;
+	}
+
+	for(j = 0; j < scap_get_ndevs(m_h); j++)
+	{
+		const ppm_syscall_aggr_table* table = scap_get_syscall_aggr_table(m_h, j);
+
+		if(table == NULL)
+		{
+			continue;
+		}
+
+		for(k = 0; k < PPM_AGGR_TABLE_SIZE; k++)
+		{
+			const ppm_syscall_aggr_entry* src = &table->entries[k];
+
+			if(!src->used || src->n_calls == 0)
+			{
+				continue;
+			}
+
+			pair<uint32_t, uint16_t> key(src->tgid, src->ppm_sc);
+
+			it = positions.find(key);
+			if(it == positions.end())
+			{
+				positions[key] = (uint32_t)entries->size();
+				entries->push_back(*src);
+				continue;
+			}
+
+			ppm_syscall_aggr_entry* dst = &(*entries)[it->second];
+
+			dst->n_calls += src->n_calls;
+			dst->n_errors += src->n_errors;
+			dst->total_ns += src->total_ns;
+
+			for(l = 0; l < PPM_AGGR_LATENCY_BUCKETS; l++)
+			{
+				dst->latency[l] += src->latency[l];
+			}
+		}
 	}
 }
 
@@ -743,6 +3369,18 @@ void sinsp::set_log_callback(sinsp_logger_callback cb)
 	g_logger.add_callback_log(cb);
 }
 
+void sinsp::set_log_async(bool async)
+{
+	if(async)
+	{
+		g_logger.start_async();
+	}
+	else
+	{
+		g_logger.stop_async();
+	}
+}
+
 sinsp_evttables* sinsp::get_event_info_tables()
 {
 	return &g_infotables;
@@ -761,7 +3399,7 @@ void sinsp::add_chisel_dir(string dirname)
 	strcpy(ncdi.m_dir, dirname.c_str());
 	ncdi.m_need_to_resolve = false;
 
-	g_chisel_dirs->push_back(ncdi);
+	m_chisel_dirs.push_back(ncdi);
 #endif
 }
 
@@ -783,9 +3421,65 @@ bool sinsp::is_live()
 void sinsp::set_debug_mode(bool enable_debug)
 {
 	m_isdebug_enabled = enable_debug;
+
+	if(m_h != NULL)
+	{
+		set_driver_excluded_tids();
+	}
 }
 
 bool sinsp::is_debug_enabled()
 {
 	return m_isdebug_enabled;
 }
+
+void sinsp::set_excluded_tids(const vector<int64_t>& tids)
+{
+	//
+	// Leave room for sysdig itself
+	//
+	if(tids.size() >= PPM_MAX_EXCLUDED_TIDS)
+	{
+		throw sinsp_exception("too many excluded threads, the maximum is " + to_string((long long int)PPM_MAX_EXCLUDED_TIDS - 1));
+	}
+
+	m_excluded_tids = tids;
+
+	if(m_h != NULL)
+	{
+		set_driver_excluded_tids();
+	}
+}
+
+//
+// Push the exclusion list to the driver. Unless we're in debug mode, this
+// includes our own process, so the driver doesn't capture our events and the
+// parser doesn't need to throw them away.
+//
+void sinsp::set_driver_excluded_tids()
+{
+#if !defined(_WIN32) && !defined(__APPLE__)
+	vector<uint64_t> tids;
+
+	if(!m_islive)
+	{
+		return;
+	}
+
+	tids.insert(tids.end(), m_excluded_tids.begin(), m_excluded_tids.end());
+
+	if(!m_isdebug_enabled)
+	{
+		tids.push_back(getpid());
+	}
+
+	//
+	// Drivers that don't support the exclusion list still work, we just
+	// lose the optimization
+	//
+	if(scap_set_excluded_tids(m_h, tids.size() ? &tids[0] : NULL, tids.size()) != SCAP_SUCCESS)
+	{
+		g_logger.log(string("can't set the driver excluded threads: ") + scap_getlasterr(m_h), sinsp_logger::SEV_WARNING);
+	}
+#endif
+}
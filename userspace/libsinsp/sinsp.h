@@ -57,22 +57,24 @@ along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <map>
 #include <queue>
 #include <vector>
 #include <set>
+#include <list>
 
 using namespace std;
 
 #include <scap.h>
 #include "settings.h"
 #include "logger.h"
+#include "outputsink.h"
 #include "event.h"
 #include "filter.h"
 #include "dumper.h"
 #include "stats.h"
 #include "ifinfo.h"
-#include "chisel.h"
 
 #ifndef VISIBILITY_PRIVATE
 #define VISIBILITY_PRIVATE private:
@@ -81,15 +83,38 @@ using namespace std;
 #define ONE_SECOND_IN_NS 1000000000LL
 
 #include "tuples.h"
+#include "strpool.h"
+#include "strmatch.h"
+#include "strregex.h"
+#include "sketches.h"
+#include "protodecoder.h"
 #include "fdinfo.h"
+#include "container.h"
 #include "threadinfo.h"
+#include "connectinfo.h"
+#include "transactinfo.h"
 #include "ifinfo.h"
+#include "nameresolver.h"
+#include "metrics.h"
+#include "profiler.h"
+#include "backpressure.h"
+#include "replay.h"
+#include "snapshot.h"
+#include "rollup.h"
+#include "sampler.h"
+#include "rules.h"
+#include "capindex.h"
+#include "alloc_stats.h"
 #include "eventformatter.h"
+#include "arrowwriter.h"
+#include "chisel.h"
 
 class sinsp_partial_transaction;
+class sinsp_arena;
 class sinsp_parser;
 class sinsp_analyzer;
 class sinsp_filter;
+class sinsp_field_cache;
 
 /*!
   \brief Information about a group of filter/formatting fields.
@@ -128,6 +153,64 @@ struct sinsp_exception : std::exception
 	string m_error_str;
 };
 
+/*!
+  \brief Accounting of the lost events of one CPU.
+*/
+struct sinsp_cpu_drops
+{
+	uint64_t m_n_drops; ///< Events lost because the ring buffer of the CPU was full. Live captures only.
+	uint64_t m_n_windows; ///< Gaps in the events of the CPU, because of full buffers or of the sampling of the driver.
+	uint64_t m_last_window_ts; ///< Timestamp of the first event after the last gap, 0 if there was none.
+	bool m_after_drop; ///< The next event of the CPU is the first after a gap.
+};
+
+/*!
+  \brief Receives the changes of the thread and fd tables of an inspector,
+   see \ref sinsp::add_state_listener(). The methods do nothing by default,
+   override the ones you need. The objects passed to them are the entries
+   of the tables, not copies, and must not be kept after the call returns.
+*/
+class SINSP_PUBLIC sinsp_state_listener
+{
+public:
+	virtual ~sinsp_state_listener()
+	{
+	}
+
+	/*!
+	  \brief A thread was added to the table, from /proc, from the capture
+	   file or because it was created.
+	*/
+	virtual void on_thread_added(sinsp_threadinfo* tinfo)
+	{
+	}
+
+	/*!
+	  \brief A thread is about to be removed from the table. The fds of a
+	   process are removed before its main thread.
+	*/
+	virtual void on_thread_removed(sinsp_threadinfo* tinfo)
+	{
+	}
+
+	/*!
+	  \brief An fd was added to the table of the process of tinfo, when it's
+	   opened or when it's loaded from /proc or from the capture file.
+	*/
+	virtual void on_fd_added(sinsp_threadinfo* tinfo, int64_t fd, sinsp_fdinfo_t* fdinfo)
+	{
+	}
+
+	/*!
+	  \brief An fd is about to be removed from the table of the process of
+	   tinfo, because it was closed, because the process exited or to stay
+	   in the memory budget.
+	*/
+	virtual void on_fd_removed(sinsp_threadinfo* tinfo, int64_t fd, sinsp_fdinfo_t* fdinfo)
+	{
+	}
+};
+
 /*!
   \brief The deafult way an event is converted to string by the library
 */
@@ -166,13 +249,32 @@ public:
 	/*!
 	  \brief Start an event capture from a trace file.
 
-	  \param filename the trace file name.
+	  \param filename the trace file name. A name like "tcp://:7000" waits for
+	   an agent to send its capture with \ref autodump_start(), and reads it
+	   like a file. See scap_open_remote().
 
 	  @throws a sinsp_exception containing the error string is thrown in case
 	   of failure.
 	*/
 	void open(string filename);
 
+	/*!
+	  \brief Start an event capture from several trace files, or remote
+	   captures, read as a single one with the events in timestamp order.
+
+	  \param filenames the names of the files, or of the remote captures
+	   (see \ref open(string)). With only one name, this is the same as
+	   open(string).
+
+	  \note The threads and the FDs of each source are kept apart, and the
+	   thread ids are shown as they were on their machine. The evt.host
+	   field tells the machine of an event. See scap_open_merge().
+
+	  @throws a sinsp_exception containing the error string is thrown in case
+	   of failure.
+	*/
+	void open(const vector<string>& filenames);
+
 	/*!
 	  \brief Ends a capture and release all resources.
 	*/
@@ -222,6 +324,355 @@ public:
 	*/
 	void set_snaplen(uint32_t snaplen);
 
+	/*!
+	  \brief Ask the driver to leave the tuple out of the sendto, recvfrom,
+	   sendmsg and recvmsg events of connected TCP sockets. The tuple of
+	   these sockets can't change after the connect or the accept, and the
+	   fd table already has it, so this only saves the work of the driver.
+
+	  \param enable true to leave the tuples out, false to write them again.
+
+	  \note This function can only be called for live captures. Can be
+	  called before or after \ref open(). The setting is shared by all the
+	  processes capturing at the same time.
+
+	  @throws a sinsp_exception containing the error string is thrown in case
+	   of failure.
+	*/
+	void set_tcp_tuple_elision(bool enable);
+
+	/*!
+	  \brief Ask the driver to store a 64 bit hash of the first len bytes
+	   of the I/O buffers in the events, instead of their first snaplen
+	   bytes. The hash is in evt.buffer_hash, and is enough to tell whether
+	   two reads or writes moved the same data, without the cost of copying
+	   it.
+
+	  \param len the number of bytes of each buffer that are hashed. 0 goes
+	   back to copying the data.
+
+	  \note This function can only be called for live captures. Can be
+	  called before or after \ref open(). The setting is shared by all the
+	  processes capturing at the same time, and the protocol decoders and
+	  the fd listeners don't see any data while it's on.
+
+	  @throws a sinsp_exception containing the error string is thrown in case
+	   of failure.
+	*/
+	void set_buffer_hash(uint32_t len);
+
+	/*!
+	  \brief Set the size of the driver's per-CPU ring buffers.
+
+	  \param size the size of each ring buffer, in bytes. It must be a
+	   multiple of the page size. 0 means use the size currently
+	   configured in the driver.
+
+	  \note This function must be called before \ref open(), and only
+	  affects live captures. Bigger buffers reduce the number of drops
+	  when the consumer can't keep up with event bursts, at the cost of
+	  kernel memory (the buffers are allocated for every CPU).
+	*/
+	void set_ring_buffer_size(uint32_t size);
+
+	/*!
+	  \brief Don't read the whole /proc when opening a live capture. The
+	   threads are looked up in /proc the first time an event refers to them,
+	   so \ref open() returns right away on hosts with many threads and fds.
+	   See scap_open_live_flags().
+
+	  \param lazy true to skip the initial scan of /proc.
+	  \param background_scan if true, /proc is still scanned by a background
+	   thread, and the threads it finds are added to the thread table when
+	   it's done, unless the events already created them.
+
+	  \note This function must be called before \ref open(), and only
+	  affects live captures. Until a thread is looked up, the fds it opened
+	  before the capture started are unknown.
+	*/
+	void set_lazy_proc_scan(bool lazy, bool background_scan);
+
+	/*!
+	  \brief Get the threads and fds that exist when a live capture starts
+	   from the driver instead of /proc. The driver writes their state as
+	   events at the beginning of the capture, stamped like the live events,
+	   so there's no window between the snapshot and the first events. Falls
+	   back to the /proc scan with drivers that can't do it.
+
+	  \note This function must be called before \ref open(), and takes
+	   precedence over \ref set_lazy_proc_scan(). The threads are looked up
+	   in /proc if an event refers to them before their state arrives.
+	*/
+	void set_driver_state_dump(bool enable);
+
+	/*!
+	  \brief Keep the thread and fd tables in a checkpoint file across
+	   restarts. \ref open() starts from the checkpoint, if there's one of
+	   the current boot, and reads from /proc only the processes that have
+	   changed since it was written. \ref close() writes it again.
+
+	  \param filename The checkpoint file, or an empty string to disable it.
+
+	  \note This function must be called before \ref open(), and only
+	   affects live captures that scan /proc, not the ones with
+	   \ref set_lazy_proc_scan() or \ref set_driver_state_dump(). To
+	   survive a crash, call \ref write_checkpoint() every now and then.
+	*/
+	void set_checkpoint_file(const string& filename);
+
+	/*!
+	  \brief Write the thread and fd tables to a checkpoint file now. See
+	   \ref set_checkpoint_file().
+
+	  \param filename The checkpoint file. It's replaced atomically.
+	*/
+	void write_checkpoint(const string& filename);
+
+	/*!
+	  \brief Capture with eBPF programs instead of the sysdig-probe module,
+	   so no module has to be built for the running kernel.
+
+	  \note This function must be called before \ref open(). The programs
+	   only give the generic system call events, without arguments, and
+	   the settings that need the driver fail. See scap_bpf.c.
+	*/
+	void set_bpf_engine(bool enable);
+
+	/*!
+	  \brief Read the trace file passed to \ref open() while another process
+	   is still writing it. \ref next() returns SCAP_TIMEOUT instead of
+	   SCAP_EOF when it gets to the end of the written data, and continues
+	   in the next file of a rotation. See scap_open_offline_follow().
+
+	  \note This function must be called before \ref open(), and only
+	   applies when a single file is opened. Seeking is not supported.
+	*/
+	void set_follow_file(bool follow);
+
+	/*!
+	  \brief Deliver the events of a trace file at the pace they were
+	   captured, speed times faster. 1 replays the file in real time, 0
+	   reads it as fast as possible, which is the default.
+
+	  \note Only applies to trace files, and can be called before or after
+	   \ref open(). While the next event is not due, \ref next() waits for
+	   up to REPLAY_MAX_WAIT_NS and returns SCAP_TIMEOUT with a NULL event.
+	   See \ref get_replay_ts().
+	*/
+	void set_replay_speed(double speed);
+
+	/*!
+	  \brief Return the timestamp of the trace that the replay has reached,
+	   or 0 if the events are not paced or the replay hasn't started. It
+	   keeps advancing between the events, e.g. to run the periodic
+	   actions of the consumers while \ref next() is waiting.
+	*/
+	uint64_t get_replay_ts();
+
+	/*!
+	  \brief Publish a copy of the thread and fd tables each time the events
+	   advance by interval_ns, for the threads that read them while the
+	   capture goes on. 0, the default, stops publishing. The copy costs
+	   about as much as iterating the tables, so the interval should be
+	   in the order of seconds.
+
+	  \note Must be called from the thread that calls \ref next(). See
+	   \ref acquire_snapshot().
+	*/
+	void set_snapshot_interval_ns(uint64_t interval_ns);
+
+	/*!
+	  \brief Get the last published copy of the thread and fd tables. It
+	   stays valid, and unchanged, until it's released, even if newer
+	   copies are published in the meantime.
+
+	  \return The copy, or NULL if none was published yet. It must be
+	   released with \ref release_snapshot().
+
+	  \note Can be called from any thread. It only takes a lock long
+	   enough to count the reference. The capture thread takes the same
+	   lock once per published copy. All the copies must be released
+	   before the inspector is destroyed.
+	*/
+	const sinsp_state_snapshot* acquire_snapshot();
+
+	/*!
+	  \brief Release a copy returned by \ref acquire_snapshot(). A copy that
+	   was superseded is freed when its last reader releases it.
+	*/
+	void release_snapshot(const sinsp_state_snapshot* snapshot);
+
+	/*!
+	  \brief Copy an event returned by \ref next(), with its thread and fd,
+	   so that it can be queued and read later, or from another thread,
+	   without rendering it first.
+
+	  \return The copy. It must be released with \ref release_event_copy().
+
+	  \note Must be called from the thread that calls \ref next(). The
+	   copies are recycled, with their buffers, when they are released, and
+	   the copies of the events of a thread share one copy of it.
+	*/
+	sinsp_evt_copy* copy_event(sinsp_evt* evt);
+
+	/*!
+	  \brief Release a copy returned by \ref copy_event().
+
+	  \note Can be called from any thread. All the copies must be released
+	   before the inspector is destroyed.
+	*/
+	void release_event_copy(sinsp_evt_copy* copy);
+
+	/*!
+	  \brief Return the per interval metrics of the inspector, which are
+	   computed once for all their consumers, e.g. the CLI and the chisels.
+	   See sinsp_rollup::add_metric().
+
+	  \note The rollup is created on the first call, and then gets all the
+	   events that pass the filter. It's owned by the inspector.
+	*/
+	sinsp_rollup* get_rollup();
+
+#ifdef HAS_FILTERING
+	/*!
+	  \brief Keep all the events of 1 out of every ratio connections or
+	   processes, and drop the others like the capture filter does. The
+	   events that create or end processes are always kept. See
+	   sinsp_consistent_sampler.
+
+	  \param mode what is sampled, or SSM_NONE to stop sampling.
+	  \param ratio keep 1 out of ratio connections or processes. A ratio of
+	   1 stops sampling too.
+	*/
+	void set_consistent_sampling(sinsp_sampling_mode mode, uint32_t ratio);
+
+	/*!
+	  \brief Return the sampler set with \ref set_consistent_sampling(), e.g.
+	   to read how many events it dropped, or NULL if there's none.
+	*/
+	sinsp_consistent_sampler* get_consistent_sampler()
+	{
+		return m_sampler;
+	}
+
+	/*!
+	  \brief Split the processes in count shards, by a hash of their pid,
+	   and return only the events of the processes of one shard. The events
+	   of the other processes that change the state, e.g. by creating
+	   processes or fds, are parsed and then dropped, so the thread and fd
+	   tables stay complete, and the others are dropped without being
+	   parsed. count inspectors reading the same file, one per shard,
+	   return each event of a thread exactly once between them.
+
+	  \param index the shard of the inspector, from 0 to count - 1.
+	  \param count the number of shards. 1 stops sharding.
+
+	  \note The fds that a process inherits from a process of another
+	   shard don't have what the skipped events would have told, e.g. the
+	   name of a socket that was resolved by a read.
+	*/
+	void set_shard(uint32_t index, uint32_t count);
+
+	/*!
+	  \brief When reading a trace file, skip the groups of events that the
+	   capture filter rejects entirely, according to the summaries that the
+	   dumper writes in the index of the file, without reading them.
+
+	  \param enable true to skip the groups, false to read all the events.
+
+	  \note If the file has a \ref sinsp_capture_index that can answer the
+	   filter, the groups without the events that it returns are skipped
+	   too.
+	  \note The skipped events are not parsed either, so the state they
+	   change, like the processes they create and the files they open, is
+	   lost, and the events that are read can show stale state. For this
+	   reason, this is off by default. It's silently ignored for the live
+	   captures, and for the files that don't have an index block.
+	*/
+	void set_block_skipping(bool enable);
+
+	/*!
+	  \brief Return the number of groups of events skipped because of
+	   \ref set_block_skipping().
+	*/
+	uint64_t get_skipped_blocks()
+	{
+		return m_skipped_blocks;
+	}
+#endif
+
+	/*!
+	  \brief Set how much data must be in a ring buffer before the driver
+	  wakes up the inspector when it's waiting for events.
+
+	  \param watermark the amount of data, in bytes.
+
+	  \note This function can only be called for live captures. Can be
+	  called before or after \ref open().
+	  \note The default is 1 byte, which delivers events as soon as they
+	  are generated. Bigger values reduce the number of wakeups on
+	  moderately busy systems, but events can wait in the buffers for up
+	  to the \ref open() timeout.
+
+	  @throws a sinsp_exception containing the error string is thrown in case
+	   of failure.
+	*/
+	void set_wakeup_watermark(uint32_t watermark);
+
+	/*!
+	  \brief Set the longest time an event can wait in a driver buffer
+	  that hasn't reached the wakeup watermark.
+
+	  \param max_delay_ms the delay, in milliseconds. 0 means no limit.
+
+	  \note This function can only be called for live captures. Can be
+	  called before or after \ref open().
+	  \note Use it together with a big wakeup watermark to keep the
+	  wakeups low on the busy CPUs while the events of the quiet ones
+	  are still delivered on time.
+
+	  @throws a sinsp_exception containing the error string is thrown in case
+	   of failure.
+	*/
+	void set_max_delay_ms(uint32_t max_delay_ms);
+
+	/*!
+	  \brief Sample the events in the driver, with a separate ratio for
+	  each event category.
+
+	  \param category_ratios maps a \ref ppm_event_category to a ratio N:
+	   1 in N events of that category is kept. The categories that are not
+	   in the map are not sampled. An empty map stops sampling.
+	  \param adaptive_threshold if not zero, the driver samples only while
+	   its buffers are at least this percent full.
+
+	  \note This function can only be called for live captures. Can be
+	  called before or after \ref open().
+	  \note Process events and the events that modify the state are never
+	  sampled, so the state engine stays consistent while data volume drops.
+
+	  @throws a sinsp_exception containing the error string is thrown in case
+	   of failure.
+	*/
+	void set_sampling_policy(const map<uint32_t, uint32_t>& category_ratios, uint32_t adaptive_threshold = 0);
+
+	/*!
+	  \brief Use a different snaplen depending on the event type, the fd
+	  type or the port.
+
+	  \param rules evaluated in order by the driver, the first matching rule
+	   gives the snaplen. If none matches, the one set with
+	   \ref set_snaplen() applies. An empty list removes the rules.
+	   See \ref ppm_snaplen_rule for the matching criteria.
+
+	  \note This function can only be called for live captures. Can be
+	  called before or after \ref open().
+
+	  @throws a sinsp_exception containing the error string is thrown in case
+	   of failure.
+	*/
+	void set_snaplen_policy(const vector<ppm_snaplen_rule>& rules);
+
 	/*!
 	  \brief temporarily pauses event capture.
 
@@ -243,12 +694,47 @@ public:
 
 	  \param filter the filter string. Refer to the filtering language
 	   section in the sysdig website for information about the filtering
-	   syntax.
+	   syntax. An empty string removes the filter.
+
+	  \note Can be called before or after \ref open(), from the thread that
+	   calls \ref next(). During a capture, the new filter replaces the
+	   previous one from the next event on, and the driver event mask and
+	   predicate follow it, without reopening the capture or losing the
+	   thread and fd tables. Use \ref request_filter() from other threads.
 
 	  @throws a sinsp_exception containing the error string is thrown in case
-	   the filter is invalid.
+	   the filter is invalid. The previous filter stays in that case.
 	*/
 	void set_filter(string filter);
+
+	/*!
+	  \brief Ask for the capture filter to be replaced, from any thread.
+	   The filter is compiled and installed like with \ref set_filter()
+	   by the thread that calls \ref next(), before it returns its next
+	   event. If several filters are requested in the meantime, only the
+	   last one is installed.
+
+	  \param filter the filter string, or an empty string to remove the
+	   filter.
+
+	  \note an invalid filter is reported in the library log, and the
+	   previous filter stays.
+	*/
+	void request_filter(const string& filter);
+
+	/*!
+	  \brief Only capture the event types in mask, on top of the ones that
+	   the capture filter can accept and the ones that change the state of
+	   the inspector. This is an optimization for the live captures that
+	   look at some event types only, like the chisels with a filter.
+
+	  \param mask the event types to capture, or NULL to capture all the
+	   event types again.
+
+	  \note the event types that are left out are discarded by the driver,
+	   so they are not saved by \ref autodump_start() either.
+	*/
+	void set_evttype_mask(const ppm_evt_mask* mask);
 #endif
 
 	/*!
@@ -259,6 +745,18 @@ public:
 	*/
 	void set_log_callback(sinsp_logger_callback cb);
 
+	/*!
+	  \brief Write the library log messages, or pass them to the log callback,
+	   from a thread of their own instead of the one that logs them.
+
+	  \param async true to start the thread, false to write the queued
+	   messages and stop it.
+
+	  \note The log callback is then called from that thread. The messages
+	   that don't fit in the queue are dropped.
+	*/
+	void set_log_async(bool async);
+
 	/*!
 	  \brief Start writing the captured events to file.
 
@@ -276,6 +774,32 @@ public:
 	*/
 	void autodump_start(const string dump_filename);
 
+	/*!
+	  \brief Start writing the captured events to file, like
+	   \ref autodump_start(const string), with only some of the processes
+	   in the tables at the beginning of the file.
+
+	  \param dump_filename the destination trace file.
+	  \param tids the threads whose processes are kept, with all their threads
+	   and FDs. The ancestors of the processes are kept too.
+
+	  @throws a sinsp_exception containing the error string is thrown in case
+	   of failure.
+	*/
+	void autodump_start(const string dump_filename, const set<int64_t>& tids);
+
+	/*!
+	  \brief Copy all the events of a trace file to the dump started with
+	   \ref autodump_start(), without parsing them. The tables at the
+	   beginning of the file are not copied.
+
+	  \param filename the trace file to copy.
+
+	  @throws a sinsp_exception containing the error string is thrown in case
+	   of failure.
+	*/
+	void autodump_append(const string& filename);
+
 	/*!
 	  \brief Stops an event dump that was started with \ref autodump_start().
 
@@ -284,6 +808,116 @@ public:
 	*/
 	void autodump_stop();
 
+	/*!
+	  \brief Set how the events of \ref autodump_start() are buffered before
+	   being written. See scap_dump_set_buffering().
+
+	  \param buffer_size the size of the blocks written to the file, in bytes.
+	  \param async if true, the blocks are written by a background thread.
+
+	  \note Applies to the dumps started afterwards.
+	*/
+	void set_dump_buffering(uint32_t buffer_size, bool async);
+
+	/*!
+	  \brief Compress the events of \ref autodump_start(). See
+	   scap_dump_set_compression().
+
+	  \param level the zlib compression level, from 1 to 9. 0 disables the
+	   compression.
+
+	  \note Applies to the dumps started afterwards.
+	*/
+	void set_dump_compression(int32_t level);
+
+	/*!
+	  \brief Fold the runs of identical poll(), epoll_wait(), futex() and
+	   nanosleep() calls in the files written by \ref autodump_start(). See
+	   scap_dump_set_fold().
+
+	  \note Applies to the dumps started afterwards.
+	*/
+	void set_dump_fold_repeats(bool enable);
+
+	/*!
+	  \brief Periodically write the thread and fd tables to the files of
+	   \ref autodump_start(), so that \ref seek() can restore them. See
+	   scap_dump_snapshot().
+
+	  \param interval_ns the minimum time between two snapshots, in
+	   nanoseconds of event time. 0 disables the snapshots.
+
+	  \note Applies to the dumps started afterwards.
+	*/
+	void set_dump_snapshot_interval(uint64_t interval_ns);
+
+	/*!
+	  \brief Split the dumps of \ref autodump_start() in multiple files.
+	   The files are named after the dump file name, followed by a sequence
+	   number starting from 0, and each one starts with the thread table, so
+	   it can be read on its own. See scap_dump_rotate().
+
+	  \param max_file_size switch to a new file when the current one reaches
+	   this size, in bytes. 0 for no size limit.
+	  \param max_file_duration_ns switch to a new file when the current one
+	   spans this time, in nanoseconds of event time. 0 for no time limit.
+	  \param max_files if not 0, only the last max_files files are kept, and
+	   the older ones are deleted.
+
+	  \note Applies to the dumps started afterwards. With both limits set to
+	   0, the dump goes to a single file, with the name given to
+	   \ref autodump_start().
+	*/
+	void set_dump_rotation(uint64_t max_file_size, uint64_t max_file_duration_ns, uint32_t max_files);
+
+	/*!
+	  \brief Get how many events the dump of \ref autodump_start() dropped
+	   because the remote collector couldn't keep up. See
+	   scap_dump_get_drops().
+
+	  \param nevts filled with the number of events dropped.
+	  \param nbytes filled with their size, in bytes.
+	*/
+	void get_dump_drops(OUT uint64_t* nevts, OUT uint64_t* nbytes);
+
+	/*!
+	  \brief Move a trace file capture to the first event that happened at
+	   or after the given time. See scap_seek_ts().
+
+	  \param ts the timestamp, in nanoseconds since epoch.
+
+	  \note If the file has a state snapshot before ts, the thread and fd
+	   tables are loaded from it, and the events between the snapshot and ts
+	   are parsed (but not returned) to bring them up to date. Otherwise they
+	   are not rewound or rebuilt: they contain what was loaded from the file
+	   and seen in the events returned so far. If there are no events after
+	   ts, the next \ref next() call returns SCAP_EOF.
+
+	  @throws a sinsp_exception containing the error string is thrown in case
+	   of failure.
+	*/
+	void seek(uint64_t ts);
+
+	/*!
+	  \brief Fill the given vector with the state snapshots of the trace
+	   file that is open, in file order. See scap_get_snapshots().
+
+	  @throws a sinsp_exception containing the error string is thrown in case
+	   of failure.
+	*/
+	void get_snapshots(OUT vector<scap_snapshot_info>* snapshots);
+
+	/*!
+	  \brief Move a trace file capture right after the given state snapshot,
+	   and load the thread and fd tables from it. See scap_restore_snapshot().
+
+	  \param snapshot one of the entries returned by \ref get_snapshots().
+
+	  @throws a sinsp_exception containing the error string is thrown in case
+	   of failure.
+	*/
+	void restore_snapshot(const scap_snapshot_info& snapshot);
+
 	/*!
 	  \brief Populate the given vector with the full list of filter check fields
 	   that this version of the library supports.
@@ -301,6 +935,22 @@ public:
 	*/
 	const scap_machine_info* get_machine_info();
 
+	/*!
+	  \brief Return the number of sources of the capture: the number of files
+	   of open(const vector<string>&), or 1.
+	*/
+	uint32_t get_nsources();
+
+	/*!
+	  \brief Return the machine information of a source of the capture.
+
+	  \param source the number of the source. The source of a thread is
+	   SCAP_TID_SOURCE() of its id.
+
+	  \return the machine info, or NULL if the source doesn't exist.
+	*/
+	const scap_machine_info* get_source_machine_info(uint32_t source);
+
 	/*!
 	  \brief Look up a thread given its tid and return its information.
 
@@ -339,6 +989,210 @@ public:
 	*/
 	sinsp_threadinfo* get_thread(int64_t tid, bool query_os_if_not_found);
 
+	/*!
+	  \brief Look up the connection with the given IPv4 tuple, i.e. the
+	   processes of this machine that are at its two ends.
+
+	  \param tuple the tuple, with the client as the source and the server
+	   as the destination.
+
+	  \return the \ref sinsp_connection, or NULL if the connection was not
+	   opened while the capture was running, or is not tracked because the
+	   connection table is full.
+	*/
+	sinsp_connection* get_connection(const ipv4tuple& tuple);
+
+	/*!
+	  \brief Look up the connection with the given IPv6 tuple. The IPv6
+	   sockets that use IPv4-mapped addresses are tracked as IPv4 ones.
+	*/
+	sinsp_connection* get_connection(const ipv6tuple& tuple);
+
+	/*!
+	  \brief Find the other end of a pipe or of a unix socket.
+
+	  \param pid the process that owns the FD.
+	  \param fd the FD number.
+	  \param fdinfo the FD, as returned by \ref sinsp_threadinfo::get_fd.
+	  \param peer_pid filled with the process that owns the other end. If
+	   more processes have it, e.g. after a fork(), one that is not pid.
+	  \param peer_fd filled with the FD number of the other end.
+
+	  \return false if the other end is not known, or fdinfo is not a pipe
+	   or a unix socket.
+	*/
+	bool get_ipc_peer(int64_t pid, int64_t fd, sinsp_fdinfo_t* fdinfo, OUT int64_t* peer_pid, OUT int64_t* peer_fd);
+
+	/*!
+	  \brief Return the tree of the processes, to find the ancestors of a
+	   process, e.g. with \ref sinsp_proc_tree::get_ancestor, without
+	   looking up each of them in the thread table.
+
+	  \note The tree is updated by the events, so the returned pointers
+	   are only valid until the next call to \ref next.
+	*/
+	sinsp_proc_tree* get_proc_tree();
+
+	/*!
+	  \brief Return the table of the request/response transactions of the
+	   sockets, with the histograms of their latencies.
+	*/
+	sinsp_transaction_table* get_transactions()
+	{
+		return m_transactions;
+	}
+
+	/*!
+	  \brief Return the FDs that did the most I/O, according to one of the
+	   counters that the parser keeps for each FD.
+
+	  \param counter the counter to rank the FDs by, e.g. IOC_BYTES.
+	  \param n the max number of FDs to return.
+	  \param res filled with the FDs, largest counter first. The FDs with a
+	   0 counter are not included.
+
+	  \note The counters start when the FD is opened, or at the beginning of
+	   the capture for the FDs that were already open. This is a snapshot of
+	   the state, so it can be polled instead of processing the events.
+	*/
+	void get_top_fds(sinsp_io_counter counter, uint32_t n, OUT vector<sinsp_io_top_entry>* res);
+
+	/*!
+	  \brief Like \ref get_top_fds, for the threads, with the I/O they did on
+	   all their FDs.
+	*/
+	void get_top_threads(sinsp_io_counter counter, uint32_t n, OUT vector<sinsp_io_top_entry>* res);
+
+	/*!
+	  \brief Decode the data of the TCP connections with the given server
+	   port as an application protocol. The method and URL of HTTP requests,
+	   the Redis commands and the MySQL commands are then available as the
+	   fd.l7* filter fields.
+
+	  \param port the server port.
+	  \param proto the protocol, or SINSP_L7_NONE to stop decoding the port.
+	   By default, the ports 80 and 8080 are decoded as HTTP, 6379 as Redis
+	   and 3306 as MySQL.
+
+	  \note Only the first snaplen bytes of each buffer are seen by the
+	   decoders, so the arguments of the requests can be truncated.
+
+	  @throws a sinsp_exception containing the error string is thrown in case
+	   of failure.
+	*/
+	void set_protocol_decoder_port(uint16_t port, sinsp_l7_proto proto);
+
+	/*!
+	  \brief Return the protocol decoders and their ports.
+	*/
+	sinsp_protocol_decoder_table* get_protocol_decoders()
+	{
+		return m_protocol_decoders;
+	}
+
+	/*!
+	  \brief Print the addresses and the ports of the IPv4 sockets with
+	   their names in the output, i.e. in fd.name, fd.cip, fd.sip,
+	   fd.cport and fd.sport.
+
+	  \param enable true to resolve the names.
+
+	  \note The names are looked up by a thread of their own, using reverse
+	   DNS and /etc/services, and the output only uses the ones that are
+	   already in its cache: the first events of an address print its
+	   numeric form, and the capture is never slowed down by the lookups.
+	   The filters always see the numeric form.
+	*/
+	void set_name_resolution(bool enable);
+
+	/*!
+	  \brief Return the name resolver, or NULL if name resolution is not
+	   enabled.
+	*/
+	sinsp_name_resolver* get_name_resolver()
+	{
+		return m_name_resolver;
+	}
+
+	/*!
+	  \brief Return the counters about the work of the inspector: events
+	   by type, parser time, capture filter pass rate and size of the
+	   tables. They are always collected.
+	*/
+	sinsp_metrics* get_metrics()
+	{
+		return m_metrics;
+	}
+
+	/*!
+	  \brief Write the metrics to the given file every interval_ms, in the
+	   Prometheus text format, together with the drop counters of the
+	   driver. The file is replaced atomically, and written one last time
+	   when the capture is closed.
+
+	  \param filename the file, or an empty string to stop writing it.
+	  \param interval_ms how often to write the file.
+
+	  \note the file is written by the thread that calls \ref next(), so it
+	   is only updated while the capture is being read.
+	*/
+	void set_metrics_file(const string& filename, uint64_t interval_ms);
+
+	/*!
+	  \brief Start or stop timing the stages of \ref next(): the fetch
+	   from libscap, the table cleanup, the parsing, the capture filter,
+	   the dumper and the analyzer. The times are collected per event type
+	   and keep adding up across the calls.
+
+	  \note profiling adds a few reads of the TSC to each event, nothing
+	   when it's off.
+	*/
+	void set_profiling(bool enable);
+
+	/*!
+	  \brief Return the times collected by the profiler, or NULL if
+	   \ref set_profiling() was never called.
+	*/
+	sinsp_profiler* get_profiler()
+	{
+		return m_profiler;
+	}
+
+	/*!
+	  \brief Start or stop the backpressure controller, which raises the
+	   driver sampling ratio when the ring buffers fill up or the events
+	   are delivered late, and lowers it again when the load falls. Each
+	   change is announced by a "sampling" event with the new ratio, that
+	   the capture filter never drops and that is saved in the trace files.
+
+	  \note This function only has an effect on live captures. Can be
+	   called before or after \ref open(). The manual dropping mode should
+	   not be used at the same time.
+	*/
+	void set_backpressure(bool enable);
+
+	/*!
+	  \brief Return the sampling ratio of the events being parsed: 1 when
+	   every event is captured, N when about one out of N is.
+
+	  \note the ratio is taken from the "sampling" and "drop" events in the
+	   stream, so it's correct for trace files too, and it changes in step
+	   with the events it applies to.
+	*/
+	uint32_t get_sampling_ratio()
+	{
+		return m_sampling_ratio;
+	}
+
+	/*!
+	  \brief Return the lost events accounting of each CPU, indexed by CPU
+	   number.
+	*/
+	const vector<sinsp_cpu_drops>& get_cpu_drops()
+	{
+		return m_cpu_drops;
+	}
+
 	/*!
 	  \brief Return the table with all the machine users.
 
@@ -348,9 +1202,23 @@ public:
 	  \note this call works with file captures as well, because the user
 	   table is stored in the trace files. In that case, the returned
 	   user list is the one of the machine where the capture happened.
+
+	  \note during live captures the table is read again when an unknown
+	   user shows up, which invalidates the returned pointers. Don't keep
+	   them across calls to \ref next().
 	*/
 	const unordered_map<uint32_t, scap_userinfo*>* get_userlist();
 
+	/*!
+	  \brief Look up a user of the machine, faster than with
+	   \ref get_userlist().
+
+	  \return the user information, or NULL if the user is unknown. During
+	   live captures, unknown users make the inspector read the user table
+	   again in the background, so they can be found by a later call.
+	*/
+	scap_userinfo* get_user(uint32_t uid);
+
 	/*!
 	  \brief Return the table with all the machine user groups.
 
@@ -363,6 +1231,23 @@ public:
 	*/
 	const unordered_map<uint32_t, scap_groupinfo*>* get_grouplist();
 
+	/*!
+	  \brief Look up a group of the machine. See \ref get_user().
+	*/
+	scap_groupinfo* get_group(uint32_t gid);
+
+	/*!
+	  \brief Return the containers seen so far in the capture. Each thread
+	   refers to its container with sinsp_threadinfo::m_container_num.
+
+	  \note with file captures, the containers come from the cgroups that
+	   the trace file stores for the processes running when it was taken.
+	*/
+	sinsp_container_manager* get_container_manager()
+	{
+		return &m_container_manager;
+	}
+
 	/*!
 	  \brief Fill the given structure with statistics about the currently
 	   open capture.
@@ -371,6 +1256,321 @@ public:
 	*/
 	void get_capture_stats(scap_stats* stats);
 
+	/*!
+	  \brief Return where the driver allocated the ring buffer of each of
+	   the capture devices. Empty for file captures.
+	*/
+	void get_device_info(OUT vector<scap_device_info>* devices);
+
+	/*!
+	  \brief Return the CPU and the NUMA node the calling thread runs on,
+	   and how the consumer is pinned. See \ref set_consumer_cpus().
+	*/
+	void get_consumer_placement(OUT scap_consumer_placement* placement);
+
+	/*!
+	  \brief Start or stop collecting the detailed driver statistics: per
+	   event type counts, bytes and drops, and filler execution times.
+
+	  \note this call won't work on file captures.
+	*/
+	void set_detailed_stats(bool enable);
+
+	/*!
+	  \brief Fill the given structure with the detailed driver statistics
+	   collected since \ref set_detailed_stats() was called.
+
+	  \param cpuid the CPU to return the statistics for, or -1 to add them
+	   up for all the CPUs.
+
+	  \note this call won't work on file captures.
+	*/
+	void get_detailed_stats(int32_t cpuid, OUT ppm_detailed_stats* stats);
+
+	/*!
+	  \brief Switch the driver to syscall aggregation: instead of sending
+	   events, it counts the system calls and their latency. Use
+	   \ref get_syscall_aggregation() to read the counters.
+
+	  \param enable true to aggregate, false to capture the events again.
+	   Enabling again resets the counters.
+	  \param per_process if true, the counters are kept separately for every
+	   process.
+
+	  \note This function can only be called for live captures. Can be
+	  called before or after \ref open().
+
+	  @throws a sinsp_exception containing the error string is thrown in case
+	   of failure.
+	*/
+	void set_syscall_aggregation(bool enable, bool per_process = false);
+
+	/*!
+	  \brief Return true if the syscall aggregation is on.
+	*/
+	bool is_syscall_aggregation_enabled()
+	{
+		return (m_syscall_aggr_flags & PPM_AGGR_ENABLED) != 0;
+	}
+
+	/*!
+	  \brief Fill the given vector with the syscall aggregation counters,
+	   added up for all the CPUs. There is one entry per system call, or per
+	   process and system call. The counters grow from the moment the
+	   aggregation was enabled.
+	*/
+	void get_syscall_aggregation(OUT vector<ppm_syscall_aggr_entry>* entries);
+
+	/*!
+	  \brief Ask the driver to write the events in the compact encoding,
+	   which takes less space in the ring buffers and reduces the drops.
+	   The events are decoded by libscap, so nothing changes for the
+	   consumers.
+
+	  \param enable true to use the compact encoding, false to go back to
+	   the normal one. The events in the buffers when the encoding changes
+	   are lost.
+
+	  \note This function can only be called for live captures. Can be
+	  called before or after \ref open().
+
+	  @throws a sinsp_exception containing the error string is thrown in case
+	   of failure.
+	*/
+	void set_compact_encoding(bool enable);
+
+	/*!
+	  \brief Ask the driver to write the enter events of the system calls
+	   inside their exit events, with the latency computed in the kernel.
+	   This halves the number of events in the ring buffers. Like for the
+	   compact encoding, which this turns on, libscap expands the events
+	   back, so nothing changes for the consumers.
+
+	  \param enable true to turn the exit only mode on, false to turn it off.
+
+	  \note This function can only be called for live captures. Can be
+	  called before or after \ref open().
+
+	  @throws a sinsp_exception containing the error string is thrown in case
+	   of failure.
+	*/
+	void set_exit_only(bool enable);
+
+	/*!
+	  \brief Replace the per context switch events with periodic
+	   summaries. The thread leaving the CPU gets a switchsum event at most
+	   once per interval, and its thread.exectime, thread.vcsw and
+	   thread.ivcsw fields count what happened since the previous summary.
+
+	  \param interval_ms the minimum time between two summaries of a
+	   thread, in milliseconds. 0 goes back to one event per switch.
+
+	  \note This function can only be called for live captures. Can be
+	  called before or after \ref open(). The setting is shared with the
+	  other processes capturing at the same time.
+
+	  @throws a sinsp_exception containing the error string is thrown in case
+	   of failure.
+	*/
+	void set_switch_summary(uint32_t interval_ms);
+
+	/*!
+	  \brief Measure how long the threads wait for a CPU once they are
+	   runnable. A thread that waited gets a runq event when it leaves the
+	   CPU, at most once per interval, and its thread.runqdelay,
+	   thread.runqwaits and thread.runqmax fields report its waits since
+	   the previous one.
+
+	  \param interval_ms the minimum time between two runq events of a
+	   thread, in milliseconds. 0 disables the measurements.
+
+	  \note This function can only be called for live captures. Can be
+	  called before or after \ref open(). The setting is shared with the
+	  other processes capturing at the same time.
+
+	  @throws a sinsp_exception containing the error string is thrown in case
+	   of failure.
+	*/
+	void set_runq_summary(uint32_t interval_ms);
+
+	/*!
+	  \brief Report the page faults of the threads. A thread that had page
+	   faults gets a pgfault event when it leaves the CPU, at most once per
+	   interval, and its thread.pfmajor and thread.pfminor fields report its
+	   faults since the previous one. proc.pfmajor and proc.pfminor add
+	   them up for each process.
+
+	  \param interval_ms the minimum time between two pgfault events of a
+	   thread, in milliseconds. 0 disables the summaries.
+
+	  \note This function can only be called for live captures. Can be
+	  called before or after \ref open(). The setting is shared with the
+	  other processes capturing at the same time.
+
+	  @throws a sinsp_exception containing the error string is thrown in case
+	   of failure.
+	*/
+	void set_pgfault_summary(uint32_t interval_ms);
+
+	/*!
+	  \brief Move the args and cwd of the clone and execve events to a
+	   separate ring of the given size on each CPU. The parser joins them
+	   back with procinfo events, and when that ring is full only the
+	   args and cwd are lost.
+
+	  \param ring_size the size of the ring of each CPU, in bytes.
+
+	  \note This function can only be called for live captures, once. Can
+	  be called before or after \ref open().
+
+	  @throws a sinsp_exception containing the error string is thrown in case
+	   of failure.
+	*/
+	void set_procinfo_ring(uint32_t ring_size);
+
+	/*!
+	  \brief Send the events that change the thread and fd tables to a
+	   separate ring of the given size on each CPU, so that the drops caused
+	   by a slow consumer never affect the state.
+
+	  \param ring_size the size of the ring of each CPU, in bytes.
+
+	  \note This function can only be called for live captures, once. Can
+	  be called before or after \ref open().
+
+	  @throws a sinsp_exception containing the error string is thrown in case
+	   of failure.
+	*/
+	void set_state_ring(uint32_t ring_size);
+
+	/*!
+	  \brief Read the driver buffers from the given number of threads, each
+	   one owning the buffers of a group of CPUs. With trace files, the
+	   threads decompress the frames of compressed files ahead of the reader.
+	   The events are still parsed by the thread calling \ref next().
+
+	  \note This function can only be called once. Can be called before or
+	  after \ref open(), but after the functions that enable the auxiliary
+	  rings.
+
+	  @throws a sinsp_exception containing the error string is thrown in case
+	   of failure.
+	*/
+	void set_reader_threads(uint32_t nthreads);
+
+	/*!
+	  \brief Pin the thread calling \ref next(), and the reader threads, to
+	   the given CPUs, so that they don't compete with the workload on the
+	   other CPUs or migrate away from their caches.
+
+	  \param cpus the CPU numbers. Empty unpins the consumer.
+	  \param exclude if true, the driver discards the events of those CPUs,
+	   so that the consumer doesn't capture itself. Only for live captures.
+
+	  \note Can be called before or after \ref open(). Call it before
+	  \ref open() for the buffers to be allocated on the NUMA node of the
+	  CPUs, and for the reader threads to run there.
+
+	  @throws a sinsp_exception containing the error string is thrown in case
+	   of failure.
+	*/
+	void set_consumer_cpus(const vector<uint32_t>& cpus, bool exclude);
+
+	/*!
+	  \brief Publish the captured events in a shared memory ring, so that
+	   other processes can read them without opening the driver. See
+	   scap_enable_tap().
+
+	  \param name the name of the shared memory object.
+	  \param size the size of the ring, in bytes.
+
+	  \note Can be called before or after \ref open().
+
+	  @throws a sinsp_exception containing the error string is thrown in case
+	   of failure.
+	*/
+	void set_event_tap(const string& name, uint32_t size);
+
+	/*!
+	  \brief Fold the runs of identical poll(), epoll_wait(), futex() and
+	   nanosleep() calls of each thread in the events returned by
+	   \ref next(). See scap_set_fold(). Each run is replaced by a "repeat"
+	   event, whose evt.count is the number of events it stands for.
+
+	  \note Can be called before or after \ref open().
+
+	  @throws a sinsp_exception containing the error string is thrown in case
+	   of failure.
+	*/
+	void set_fold_repeats(bool enable);
+
+	/*!
+	  \brief Set a budget for the memory used by the thread and fd tables and
+	   by the buffers of the parser. When the usage goes over it, the state
+	   of the least recently active processes is dropped: first their fds,
+	   and then the processes themselves.
+
+	  \param max_bytes the budget, in bytes. 0, the default, means no limit.
+	*/
+	void set_max_memory(uint64_t max_bytes);
+
+	/*!
+	  \brief Return an estimate of the memory used by the thread and fd
+	   tables and by the buffers of the parser, in bytes.
+	*/
+	uint64_t get_memory_usage();
+
+	/*!
+	  \brief Return the number of fds and threads that have been dropped to
+	   stay in the budget set with \ref set_max_memory().
+	*/
+	uint64_t get_evicted_fds();
+	uint64_t get_evicted_threads();
+
+	/*!
+	  \brief Call a function for each event of the given type, after the
+	   library has parsed it and updated the thread and fd tables. It's
+	   called for the events that pass the capture filter, before they're
+	   returned by \ref next(). A type can have more than one hook.
+
+	  \param etype the event type, one of the PPME_* values.
+	  \param hook the function to call.
+	  \param arg passed to the function with each event.
+	*/
+	void add_event_hook(uint16_t etype, sinsp_event_hook hook, void* arg);
+
+	/*!
+	  \brief Like \ref add_event_hook(), for all the event types of the given
+	   category.
+
+	  \param category the category of the event types in the event table,
+	   e.g. EC_NET. The I/O events have categories of their own
+	   (EC_IO_READ, EC_IO_WRITE, EC_IO_OTHER), and the hook can tell a file
+	   from a socket with sinsp_evt::get_category(). EC_INTERNAL selects the
+	   internal events, whatever their category.
+	  \param hook the function to call.
+	  \param arg passed to the function with each event.
+
+	  \note The hook is added to the types that have the category when it's
+	   called, and the events pay nothing for the categories without hooks.
+	*/
+	void add_category_hook(ppm_event_category category, sinsp_event_hook hook, void* arg);
+
+	/*!
+	  \brief Tell listener about the threads and fds that are added to or
+	   removed from the tables. It's called while the library parses the
+	   events, before they're returned by \ref next().
+
+	  \note The listener isn't told about the tables being emptied when the
+	   capture is closed. It isn't owned by the inspector.
+	*/
+	void add_state_listener(sinsp_state_listener* listener);
+
+	/*!
+	  \brief Stop calling a listener added with \ref add_state_listener().
+	*/
+	void remove_state_listener(sinsp_state_listener* listener);
+
 
 #ifdef GATHER_INTERNAL_STATS
 	sinsp_stats get_stats();
@@ -399,7 +1599,7 @@ public:
 	/*!
 	  \brief Add a new directory containing chisels.
 
-	  \note This function is not reentrant.
+	  \note The directory is only searched by the chisels of this inspector.
 	*/
 	void add_chisel_dir(string dirname);
 
@@ -440,6 +1640,21 @@ public:
 	*/
 	bool is_debug_enabled();
 
+	/*!
+	  \brief Set the list of threads whose events are discarded directly
+	  in the driver, before they consume ring buffer space.
+
+	  \param tids the thread ids to exclude. A process id excludes all the
+	   threads of that process.
+
+	  \note Only affects live captures, and can be called before or after
+	  \ref open(). When the debug mode is disabled, sysdig's own process is
+	  excluded as well.
+
+	  @throws a sinsp_exception if the list is too long.
+	*/
+	void set_excluded_tids(const vector<int64_t>& tids);
+
 	//
 	// Misc internal stuff
 	//
@@ -449,9 +1664,18 @@ public:
 	//
 	// Allocates private state in the thread info class.
 	// Returns the ID to use when retrieving the memory area.
-	// Will fail if called after the capture starts.
+	// The threads that exist when it's called after the capture starts
+	// get the area the first time they're asked for it.
 	//
 	uint32_t reserve_thread_memory(uint32_t size);
+	//
+	// The arena for the temporary state of the event being processed.
+	// It's reset before every event.
+	//
+	sinsp_arena* get_evt_arena()
+	{
+		return m_evt_arena;
+	}
 
 VISIBILITY_PRIVATE
 
@@ -462,8 +1686,27 @@ private:
 
 	void init();
 	void import_thread_table();
+	void import_proc_scan();
+	void add_drop_window(uint16_t cpuid);
+	void check_cpu_drops();
+	void write_dump_snapshot();
+	void setup_dumper();
+	void configure_dumper(scap_dumper_t* dumper);
+	void rotate_dump();
+	string get_dump_file_name(uint64_t seq);
 	void import_ifaddr_list();
 	void import_user_list();
+	void request_userlist_refresh();
+	void import_userlist_refresh();
+#ifdef HAS_FILTERING
+	void set_filter_event_mask();
+	void install_requested_filter();
+	void set_filter_predicate();
+	void set_block_filter();
+	static bool block_filter_callback(void* context, uint64_t first_evtnum, uint64_t end_evtnum, const scap_block_summary* summary);
+	sinsp_block_summarizer* get_block_summarizer();
+#endif
+	void set_driver_excluded_tids();
 
 	void add_thread(const sinsp_threadinfo& ptinfo);
 	void remove_thread(int64_t tid);
@@ -473,15 +1716,42 @@ private:
 	bool m_isdebug_enabled;
 	string m_filename;
 	sinsp_evt m_evt;
+	//
+	// The names of the flags values, by symbol table, see
+	// sinsp_evt::get_flags_str()
+	//
+	unordered_map<const struct ppm_name_value*, unordered_map<uint32_t, string> > m_flagstr_tables;
+	uint32_t m_n_flagstrs;
+	string m_flagstr_tmp;
 	string m_lasterr;
-	int64_t m_tid_to_remove;
+	// The threads that exited, removed before the next event
+	vector<int64_t> m_tids_to_remove;
 	int64_t m_tid_of_fd_to_remove;
 	vector<int64_t>* m_fds_to_remove;
+	sinsp_arena* m_evt_arena;
 	uint64_t m_lastevent_ts;
 	// the parsing engine
 	sinsp_parser* m_parser;
 	// the statistics analysis engine
 	scap_dumper_t* m_dumper;
+	//
+	// Buffering of m_dumper. 0 to keep the libscap default
+	//
+	uint32_t m_dump_buffer_size;
+	bool m_dump_async;
+	int32_t m_dump_compression_level;
+	bool m_dump_fold_repeats;
+	uint64_t m_dump_snapshot_interval_ns;
+	uint64_t m_last_snapshot_ts;
+	//
+	// Dump file rotation, see set_dump_rotation()
+	//
+	uint64_t m_dump_max_file_size;
+	uint64_t m_dump_max_file_duration_ns;
+	uint32_t m_dump_max_files;
+	string m_dump_filename;
+	uint64_t m_dump_file_seq;
+	uint64_t m_dump_file_start_ts;
 	const scap_machine_info* m_machine_info;
 	uint32_t m_num_cpus;
 	sinsp_thread_privatestate_manager m_thread_privatestate_manager;
@@ -489,10 +1759,51 @@ private:
 	sinsp_network_interfaces* m_network_interfaces;
 
 	sinsp_thread_manager* m_thread_manager;
+	sinsp_container_manager m_container_manager;
+	sinsp_ipv4_connection_manager* m_ipv4_connections;
+	sinsp_ipv6_connection_manager* m_ipv6_connections;
+	sinsp_transaction_table* m_transactions;
+	sinsp_protocol_decoder_table* m_protocol_decoders;
+	sinsp_name_resolver* m_name_resolver;
+	sinsp_metrics* m_metrics;
+	sinsp_profiler* m_profiler;
+	sinsp_profiler* m_active_profiler; // m_profiler while it's running, NULL otherwise
+	sinsp_backpressure* m_backpressure;
+	bool m_backpressure_enabled;
+	sinsp_replay_clock* m_replay_clock; // Paces the events of a trace file, NULL to read them as fast as possible
+	vector<sinsp_state_listener*> m_state_listeners;
+	sinsp_snapshot_publisher* m_snapshots; // NULL until snapshots are enabled
+	sinsp_evt_copier* m_evt_copier; // NULL until the first call to copy_event()
+	sinsp_rollup* m_rollup; // NULL until get_rollup() is called
+#ifdef HAS_CHISELS
+	vector<chiseldir_info> m_chisel_dirs; // The default ones, plus the ones added with add_chisel_dir()
+	map<string, vector<pair<sinsp_chisel*, int> > > m_chisel_channels; // The chisels subscribed to each channel of chisel.emit(), with the registry reference of their callback
+#endif
+	//
+	// Lost events accounting. m_drop_gen is incremented at each gap in the
+	// events of any CPU, and the threads and fds remember the generation
+	// they were last seen at, to tell if their state can be stale.
+	//
+	uint32_t m_drop_gen;
+	vector<sinsp_cpu_drops> m_cpu_drops;
+	uint32_t m_sampling_ratio;
 
 #ifdef HAS_FILTERING
 	uint64_t m_firstevent_ts;
 	sinsp_filter* m_filter;
+	string* volatile m_requested_filter; // Set by request_filter(), installed by next()
+	bool m_has_driver_predicate; // The driver has the predicate of a previous filter
+	sinsp_consistent_sampler* m_sampler; // NULL unless set_consistent_sampling() was called
+	uint32_t m_shard_index; // See set_shard()
+	uint32_t m_shard_count; // 1 unless set_shard() was called
+	bool m_block_skipping; // Set with set_block_skipping()
+	uint64_t m_skipped_blocks;
+	bool m_use_capture_index; // The filter was looked up in the sinsp_capture_index of the file
+	vector<uint64_t> m_capture_index_evtnums; // The events that the lookup returned
+	sinsp_block_summarizer* m_block_summarizer; // Created with the first dumper
+	sinsp_field_cache* m_field_cache;
+	ppm_evt_mask m_evttype_mask; // Event types set with set_evttype_mask()
+	bool m_has_evttype_mask;
 #endif
 
 	//
@@ -509,11 +1820,127 @@ private:
 	// Saved snaplen
 	//
 	uint32_t m_snaplen;
+	bool m_tcp_tuple_elision;
+	uint32_t m_buffer_hash_len;
+
+	//
+	// Requested ring buffer size, 0 for the driver default
+	//
+	uint32_t m_ring_buf_size;
+	bool m_lazy_proc_scan;
+	bool m_bg_proc_scan;
+	bool m_driver_state_dump;
+	// Checkpoint of the tables loaded by open() and written by close(), empty if none
+	string m_checkpoint_file;
+	bool m_bpf_engine;
+	bool m_follow_file;
+	// true until the background /proc scan has been imported
+	bool m_proc_scan_pending;
+
+	//
+	// Saved wakeup watermark, 0 for the driver default
+	//
+	uint32_t m_wakeup_watermark;
+
+	//
+	// Saved max delay of the events in the driver buffers, 0 for no limit
+	//
+	uint32_t m_max_delay_ms;
+
+	//
+	// Saved sampling policy, applied at open time if m_sampling_policy_set
+	//
+	ppm_sampling_policy m_sampling_policy;
+	bool m_sampling_policy_set;
+
+	//
+	// Saved snaplen rules, applied at open time if m_snaplen_policy_set
+	//
+	ppm_snaplen_policy m_snaplen_policy;
+	bool m_snaplen_policy_set;
+
+	//
+	// PPM_AGGR_* flags of the syscall aggregation, applied at open time
+	//
+	uint32_t m_syscall_aggr_flags;
+
+	//
+	// Compact encoding of the ring buffers, applied at open time
+	//
+	bool m_compact_encoding;
+	bool m_exit_only;
+
+	//
+	// Context switch summary interval, applied at open time
+	//
+	uint32_t m_switch_summary_ms;
+
+	//
+	// Run queue summary interval, applied at open time
+	//
+	uint32_t m_runq_summary_ms;
+
+	//
+	// Page fault summary interval, applied at open time
+	//
+	uint32_t m_pgfault_summary_ms;
+
+	//
+	// Size of the process info rings, applied at open time. 0 if they are off
+	//
+	uint32_t m_procinfo_ring_size;
+
+	//
+	// Size of the state rings, applied at open time. 0 if they are off
+	//
+	uint32_t m_state_ring_size;
+
+	//
+	// Number of reader threads, started at open time. 0 if they are off
+	//
+	uint32_t m_reader_threads;
+
+	//
+	// CPUs the consumer is pinned to at open time. Empty if it's not
+	//
+	vector<uint32_t> m_consumer_cpus;
+	bool m_exclude_consumer_cpus;
+
+	//
+	// Event tap, created at open time. Empty name if it's off
+	//
+	string m_tap_name;
+	uint32_t m_tap_size;
+	bool m_fold_repeats;
+
+	//
+	// Threads excluded by the driver, not including sysdig itself
+	//
+	vector<int64_t> m_excluded_tids;
+
+	//
+	// Events fetched from libscap with scap_next_batch() that haven't
+	// been returned by next() yet
+	//
+	scap_evt* m_batch_evts[SP_SCAP_BATCH_SIZE];
+	uint16_t m_batch_cpuids[SP_SCAP_BATCH_SIZE];
+	uint32_t m_batch_len;
+	uint32_t m_batch_pos;
+#ifdef HAS_FILTERING
+	//
+	// If m_batch_prefiltered is true, the filter has tested the raw events
+	// of the batch with sinsp_filter::run_batch(), and the ones that are 0 in
+	// m_batch_selected are rejected without running the filter on them
+	//
+	uint8_t m_batch_selected[SP_SCAP_BATCH_SIZE];
+	bool m_batch_prefiltered;
+#endif
 
 	//
 	// Some thread table limits
 	//
 	uint32_t m_max_thread_table_size;
+	uint64_t m_max_memory;
 	uint64_t m_thread_timeout_ns;
 	uint64_t m_inactive_thread_scan_time_ns;
 
@@ -527,6 +1954,17 @@ private:
 	//
 	unordered_map<uint32_t, scap_userinfo*> m_userlist;
 	unordered_map<uint32_t, scap_groupinfo*> m_grouplist;
+	// Same as the tables, for the ids below USERGROUP_ARRAY_SIZE
+	vector<scap_userinfo*> m_user_array;
+	vector<scap_groupinfo*> m_group_array;
+	// Ids that weren't found since the tables were last read
+	unordered_set<uint32_t> m_user_misses;
+	unordered_set<uint32_t> m_group_misses;
+	// true while the tables are being read again in the background
+	bool m_userlist_refresh_pending;
+	// false until the tables are first used, see import_user_list()
+	bool m_userlist_loaded;
+	uint64_t m_last_userlist_refresh_ts;
 
 	//
 	// Some dropping infrastructure
@@ -541,10 +1979,17 @@ private:
 	friend class sinsp_fdtable;
 	friend class sinsp_thread_manager;
 	friend class sinsp_dumper;
+	friend class sinsp_dump_manager;
 	friend class sinsp_analyzer_fd_listener;
 	friend class sinsp_chisel;
+	friend class sinsp_filter_check;
+	friend class sinsp_filter;
 
 	template<class TKey,class THash,class TCompare> friend class sinsp_connection_manager;
+	friend class sinsp_transaction_table;
+	friend class sinsp_metrics;
+	friend class sinsp_backpressure;
+	friend class sinsp_snapshot_publisher;
 };
 
 /*@}*/
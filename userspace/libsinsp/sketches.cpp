@@ -0,0 +1,687 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <math.h>
+
+#include "sinsp.h"
+#include "sinsp_int.h"
+#include "sketches.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// sinsp_sketch implementation
+///////////////////////////////////////////////////////////////////////////////
+uint64_t sinsp_sketch::hash(const char* key, uint32_t len)
+{
+	uint64_t res = 0xcbf29ce484222325ULL;
+	uint32_t j;
+
+	//
+	// FNV-1a, followed by the finalizer of MurmurHash3, because the
+	// sketches use the high bits and FNV doesn't mix them well
+	//
+	for(j = 0; j < len; j++)
+	{
+		res ^= (uint8_t)key[j];
+		res *= 0x100000001b3ULL;
+	}
+
+	res ^= res >> 33;
+	res *= 0xff51afd7ed558ccdULL;
+	res ^= res >> 33;
+	res *= 0xc4ceb9fe1a85ec53ULL;
+	res ^= res >> 33;
+
+	return res;
+}
+
+void sinsp_sketch::get_partial(OUT string* res)
+{
+	size_t start = sinsp_partial_buffer::put_header(res);
+
+	serialize(res);
+	sinsp_partial_buffer::put_length(res, start);
+}
+
+bool sinsp_sketch::merge_partial(const char* buf, uint32_t len)
+{
+	sinsp_partial_buffer pbuf(buf, len);
+
+	if(!pbuf.get_header())
+	{
+		return false;
+	}
+
+	switch(m_type)
+	{
+	case ST_TOPK:
+	{
+		sinsp_topk other(1);
+
+		if(!other.deserialize(&pbuf) || !pbuf.at_end())
+		{
+			return false;
+		}
+
+		((sinsp_topk*)this)->merge(other);
+		return true;
+	}
+	case ST_COUNTMIN:
+	{
+		sinsp_countmin other(1, 1);
+
+		if(!other.deserialize(&pbuf) || !pbuf.at_end())
+		{
+			return false;
+		}
+
+		return ((sinsp_countmin*)this)->merge(other);
+	}
+	case ST_HLL:
+	{
+		sinsp_hyperloglog other(4);
+
+		if(!other.deserialize(&pbuf) || !pbuf.at_end())
+		{
+			return false;
+		}
+
+		return ((sinsp_hyperloglog*)this)->merge(other);
+	}
+	default:
+		ASSERT(false);
+		return false;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// sinsp_topk implementation
+///////////////////////////////////////////////////////////////////////////////
+//
+// Order of the entries in get_top()
+//
+static bool topk_entry_greater(const sinsp_topk::entry* a, const sinsp_topk::entry* b)
+{
+	return a->m_count > b->m_count;
+}
+
+//
+// Order of the entries kept by merge()
+//
+static bool topk_count_greater(const sinsp_topk::entry& a, const sinsp_topk::entry& b)
+{
+	return a.m_count > b.m_count;
+}
+
+sinsp_topk::sinsp_topk(uint32_t capacity) : sinsp_sketch(ST_TOPK)
+{
+	if(capacity == 0)
+	{
+		throw sinsp_exception("the capacity of a top-k summary can't be 0");
+	}
+
+	m_capacity = capacity;
+}
+
+void sinsp_topk::swap_entries(uint32_t a, uint32_t b)
+{
+	m_heap[a].m_key.swap(m_heap[b].m_key);
+	swap(m_heap[a].m_count, m_heap[b].m_count);
+	swap(m_heap[a].m_error, m_heap[b].m_error);
+	m_index[m_heap[a].m_key] = a;
+	m_index[m_heap[b].m_key] = b;
+}
+
+void sinsp_topk::sift_up(uint32_t pos)
+{
+	while(pos > 0)
+	{
+		uint32_t parent = (pos - 1) / 2;
+
+		if(m_heap[parent].m_count <= m_heap[pos].m_count)
+		{
+			break;
+		}
+
+		swap_entries(parent, pos);
+		pos = parent;
+	}
+}
+
+void sinsp_topk::sift_down(uint32_t pos)
+{
+	uint32_t size = (uint32_t)m_heap.size();
+
+	while(true)
+	{
+		uint32_t smallest = pos;
+		uint32_t left = pos * 2 + 1;
+		uint32_t right = left + 1;
+
+		if(left < size && m_heap[left].m_count < m_heap[smallest].m_count)
+		{
+			smallest = left;
+		}
+
+		if(right < size && m_heap[right].m_count < m_heap[smallest].m_count)
+		{
+			smallest = right;
+		}
+
+		if(smallest == pos)
+		{
+			break;
+		}
+
+		swap_entries(smallest, pos);
+		pos = smallest;
+	}
+}
+
+void sinsp_topk::add(const char* key, uint32_t len, double weight)
+{
+	unordered_map<string, uint32_t>::iterator it;
+
+	m_keybuf.assign(key, len);
+	it = m_index.find(m_keybuf);
+
+	//
+	// The count of a key only grows, so it can only go down in the heap
+	//
+	if(it != m_index.end())
+	{
+		m_heap[it->second].m_count += weight;
+		sift_down(it->second);
+		return;
+	}
+
+	if(m_heap.size() < m_capacity)
+	{
+		entry e;
+
+		e.m_key = m_keybuf;
+		e.m_count = weight;
+		e.m_error = 0;
+
+		m_heap.push_back(e);
+		m_index[m_keybuf] = (uint32_t)m_heap.size() - 1;
+		sift_up((uint32_t)m_heap.size() - 1);
+		return;
+	}
+
+	//
+	// The summary is full: the new key replaces the one with the smallest
+	// count, which may be the new key's own count that we lost track of
+	//
+	entry* min = &m_heap[0];
+
+	m_index.erase(min->m_key);
+	min->m_key = m_keybuf;
+	min->m_error = min->m_count;
+	min->m_count += weight;
+	m_index[m_keybuf] = 0;
+	sift_down(0);
+}
+
+void sinsp_topk::clear()
+{
+	m_heap.clear();
+	m_index.clear();
+}
+
+void sinsp_topk::serialize(OUT string* res)
+{
+	sinsp_partial_buffer::put(res, (uint8_t)ST_TOPK);
+	sinsp_partial_buffer::put(res, m_capacity);
+	sinsp_partial_buffer::put(res, (uint32_t)m_heap.size());
+
+	for(uint32_t j = 0; j < m_heap.size(); j++)
+	{
+		sinsp_partial_buffer::put_string(res, m_heap[j].m_key);
+		sinsp_partial_buffer::put(res, m_heap[j].m_count);
+		sinsp_partial_buffer::put(res, m_heap[j].m_error);
+	}
+}
+
+//
+// The entries are in heap order in the partial, so they're taken as they are
+//
+bool sinsp_topk::deserialize(sinsp_partial_buffer* buf)
+{
+	uint8_t stype;
+	uint32_t capacity;
+	uint32_t n;
+
+	clear();
+
+	//
+	// Each entry takes at least 20 bytes, so a corrupted count is rejected
+	// before allocating the entries
+	//
+	if(!buf->get(&stype) || stype != ST_TOPK ||
+		!buf->get(&capacity) || capacity == 0 ||
+		!buf->get(&n) || n > capacity || n > buf->remaining() / 20)
+	{
+		return false;
+	}
+
+	m_capacity = capacity;
+	m_heap.resize(n);
+
+	for(uint32_t j = 0; j < n; j++)
+	{
+		if(!buf->get_string(&m_heap[j].m_key) ||
+			!buf->get(&m_heap[j].m_count) ||
+			!buf->get(&m_heap[j].m_error) ||
+			!m_index.insert(pair<string, uint32_t>(m_heap[j].m_key, j)).second)
+		{
+			clear();
+			return false;
+		}
+	}
+
+	for(uint32_t j = n / 2; j-- > 0;)
+	{
+		sift_down(j);
+	}
+
+	return true;
+}
+
+bool sinsp_topk::convert_keys(bool (*convert)(const string& key, uint32_t arg, OUT string* res), uint32_t arg)
+{
+	m_index.clear();
+
+	for(uint32_t j = 0; j < m_heap.size(); j++)
+	{
+		string key;
+
+		if(!convert(m_heap[j].m_key, arg, &key) ||
+			!m_index.insert(pair<string, uint32_t>(key, j)).second)
+		{
+			clear();
+			return false;
+		}
+
+		m_heap[j].m_key.swap(key);
+	}
+
+	return true;
+}
+
+void sinsp_topk::merge(const sinsp_topk& other)
+{
+	double min_this = (m_heap.size() == m_capacity)? m_heap[0].m_count : 0;
+	double min_other = (other.m_heap.size() == other.m_capacity)? other.m_heap[0].m_count : 0;
+	vector<entry> merged;
+	uint32_t j;
+
+	merged.reserve(m_heap.size() + other.m_heap.size());
+
+	for(j = 0; j < m_heap.size(); j++)
+	{
+		unordered_map<string, uint32_t>::const_iterator it = other.m_index.find(m_heap[j].m_key);
+
+		merged.push_back(m_heap[j]);
+
+		if(it != other.m_index.end())
+		{
+			merged.back().m_count += other.m_heap[it->second].m_count;
+			merged.back().m_error += other.m_heap[it->second].m_error;
+		}
+		else
+		{
+			merged.back().m_count += min_other;
+			merged.back().m_error += min_other;
+		}
+	}
+
+	for(j = 0; j < other.m_heap.size(); j++)
+	{
+		if(m_index.find(other.m_heap[j].m_key) == m_index.end())
+		{
+			merged.push_back(other.m_heap[j]);
+			merged.back().m_count += min_this;
+			merged.back().m_error += min_this;
+		}
+	}
+
+	if(merged.size() > m_capacity)
+	{
+		nth_element(merged.begin(), merged.begin() + m_capacity, merged.end(), topk_count_greater);
+		merged.resize(m_capacity);
+	}
+
+	m_heap.swap(merged);
+	m_index.clear();
+
+	for(j = 0; j < m_heap.size(); j++)
+	{
+		m_index[m_heap[j].m_key] = j;
+	}
+
+	for(j = (uint32_t)m_heap.size() / 2; j-- > 0;)
+	{
+		sift_down(j);
+	}
+}
+
+void sinsp_topk::get_top(uint32_t n, OUT vector<const entry*>* res)
+{
+	uint32_t j;
+
+	res->clear();
+	res->reserve(m_heap.size());
+
+	for(j = 0; j < m_heap.size(); j++)
+	{
+		res->push_back(&m_heap[j]);
+	}
+
+	if(n != 0 && n < res->size())
+	{
+		partial_sort(res->begin(), res->begin() + n, res->end(), topk_entry_greater);
+		res->resize(n);
+	}
+	else
+	{
+		sort(res->begin(), res->end(), topk_entry_greater);
+	}
+}
+
+const sinsp_topk::entry* sinsp_topk::find(const string& key)
+{
+	unordered_map<string, uint32_t>::iterator it = m_index.find(key);
+
+	if(it == m_index.end())
+	{
+		return NULL;
+	}
+
+	return &m_heap[it->second];
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// sinsp_countmin implementation
+///////////////////////////////////////////////////////////////////////////////
+sinsp_countmin::sinsp_countmin(uint32_t width, uint32_t depth) : sinsp_sketch(ST_COUNTMIN)
+{
+	if(width == 0 || depth == 0)
+	{
+		throw sinsp_exception("the width and the depth of a Count-Min sketch can't be 0");
+	}
+
+	m_width = width;
+	m_depth = depth;
+	m_counters.assign((size_t)width * depth, 0);
+	m_total = 0;
+}
+
+//
+// The counter of each row comes from the two halves of the hash, as
+// h1 + row * h2, which is as good as a hash per row
+//
+void sinsp_countmin::add(const char* key, uint32_t len, double weight)
+{
+	uint64_t h = hash(key, len);
+	uint32_t h1 = (uint32_t)h;
+	uint32_t h2 = (uint32_t)(h >> 32) | 1;
+	uint32_t j;
+
+	for(j = 0; j < m_depth; j++)
+	{
+		m_counters[(size_t)j * m_width + (h1 + j * h2) % m_width] += weight;
+	}
+
+	m_total += weight;
+}
+
+void sinsp_countmin::clear()
+{
+	fill(m_counters.begin(), m_counters.end(), 0);
+	m_total = 0;
+}
+
+void sinsp_countmin::serialize(OUT string* res)
+{
+	sinsp_partial_buffer::put(res, (uint8_t)ST_COUNTMIN);
+	sinsp_partial_buffer::put(res, m_width);
+	sinsp_partial_buffer::put(res, m_depth);
+	sinsp_partial_buffer::put(res, m_total);
+
+	for(size_t j = 0; j < m_counters.size(); j++)
+	{
+		sinsp_partial_buffer::put(res, m_counters[j]);
+	}
+}
+
+bool sinsp_countmin::deserialize(sinsp_partial_buffer* buf)
+{
+	uint8_t stype;
+	uint32_t width;
+	uint32_t depth;
+	double total;
+
+	if(!buf->get(&stype) || stype != ST_COUNTMIN ||
+		!buf->get(&width) || width == 0 ||
+		!buf->get(&depth) || depth == 0 ||
+		!buf->get(&total) ||
+		(uint64_t)width * depth > buf->remaining() / sizeof(double))
+	{
+		clear();
+		return false;
+	}
+
+	m_width = width;
+	m_depth = depth;
+	m_total = total;
+	m_counters.assign((size_t)width * depth, 0);
+
+	for(size_t j = 0; j < m_counters.size(); j++)
+	{
+		if(!buf->get(&m_counters[j]))
+		{
+			clear();
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool sinsp_countmin::merge(const sinsp_countmin& other)
+{
+	if(other.m_width != m_width || other.m_depth != m_depth)
+	{
+		return false;
+	}
+
+	for(size_t j = 0; j < m_counters.size(); j++)
+	{
+		m_counters[j] += other.m_counters[j];
+	}
+
+	m_total += other.m_total;
+	return true;
+}
+
+double sinsp_countmin::estimate(const char* key, uint32_t len)
+{
+	uint64_t h = hash(key, len);
+	uint32_t h1 = (uint32_t)h;
+	uint32_t h2 = (uint32_t)(h >> 32) | 1;
+	uint32_t j;
+	double res = m_counters[h1 % m_width];
+
+	for(j = 1; j < m_depth; j++)
+	{
+		double c = m_counters[(size_t)j * m_width + (h1 + j * h2) % m_width];
+
+		if(c < res)
+		{
+			res = c;
+		}
+	}
+
+	return res;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// sinsp_hyperloglog implementation
+///////////////////////////////////////////////////////////////////////////////
+sinsp_hyperloglog::sinsp_hyperloglog(uint32_t precision) : sinsp_sketch(ST_HLL)
+{
+	if(precision < 4 || precision > 16)
+	{
+		throw sinsp_exception("the precision of a HyperLogLog sketch must be between 4 and 16");
+	}
+
+	m_precision = precision;
+	m_registers.assign((size_t)1 << precision, 0);
+}
+
+//
+// The first precision bits of the hash select the register, which keeps
+// the largest position of the first 1 in the rest of the bits
+//
+void sinsp_hyperloglog::add(const char* key, uint32_t len, double weight)
+{
+	uint64_t h = hash(key, len);
+	uint32_t reg = (uint32_t)(h >> (64 - m_precision));
+	uint64_t rest = (h << m_precision) | ((uint64_t)1 << (m_precision - 1));
+	uint8_t rank = 1;
+
+	while((rest & 0x8000000000000000ULL) == 0)
+	{
+		rest <<= 1;
+		rank++;
+	}
+
+	if(rank > m_registers[reg])
+	{
+		m_registers[reg] = rank;
+	}
+}
+
+void sinsp_hyperloglog::clear()
+{
+	fill(m_registers.begin(), m_registers.end(), 0);
+}
+
+void sinsp_hyperloglog::serialize(OUT string* res)
+{
+	sinsp_partial_buffer::put(res, (uint8_t)ST_HLL);
+	sinsp_partial_buffer::put(res, m_precision);
+	res->append((const char*)&m_registers[0], m_registers.size());
+}
+
+bool sinsp_hyperloglog::deserialize(sinsp_partial_buffer* buf)
+{
+	uint8_t stype;
+	uint32_t precision;
+
+	if(!buf->get(&stype) || stype != ST_HLL ||
+		!buf->get(&precision) || precision < 4 || precision > 16)
+	{
+		clear();
+		return false;
+	}
+
+	m_precision = precision;
+	m_registers.assign((size_t)1 << precision, 0);
+
+	for(size_t j = 0; j < m_registers.size(); j++)
+	{
+		if(!buf->get(&m_registers[j]))
+		{
+			clear();
+			return false;
+		}
+	}
+
+	return true;
+}
+
+double sinsp_hyperloglog::estimate()
+{
+	double m = (double)m_registers.size();
+	double alpha;
+	double sum = 0;
+	uint32_t nzeros = 0;
+	uint32_t j;
+
+	switch(m_registers.size())
+	{
+	case 16:
+		alpha = 0.673;
+		break;
+	case 32:
+		alpha = 0.697;
+		break;
+	case 64:
+		alpha = 0.709;
+		break;
+	default:
+		alpha = 0.7213 / (1 + 1.079 / m);
+		break;
+	}
+
+	for(j = 0; j < m_registers.size(); j++)
+	{
+		sum += ldexp(1.0, -(int)m_registers[j]);
+
+		if(m_registers[j] == 0)
+		{
+			nzeros++;
+		}
+	}
+
+	double res = alpha * m * m / sum;
+
+	//
+	// For the small counts, linear counting on the empty registers is more
+	// accurate. With 64 bit hashes, there's no correction for the large
+	// counts.
+	//
+	if(res <= 2.5 * m && nzeros != 0)
+	{
+		res = m * log(m / nzeros);
+	}
+
+	return res;
+}
+
+bool sinsp_hyperloglog::merge(const sinsp_hyperloglog& other)
+{
+	uint32_t j;
+
+	if(other.m_precision != m_precision)
+	{
+		return false;
+	}
+
+	for(j = 0; j < m_registers.size(); j++)
+	{
+		if(other.m_registers[j] > m_registers[j])
+		{
+			m_registers[j] = other.m_registers[j];
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,381 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+///////////////////////////////////////////////////////////////////////////////
+// Encoding of the partial aggregates that the nodes of a fleet send to the
+// one that merges them, like the state of a sketch at the end of an
+// interval. The numbers are little endian whatever the host, and strings are
+// their 32 bit length followed by their bytes. A partial starts with the
+// version of the encoding and the length of the rest, see put_header().
+// Reading never goes past the end of the buffer.
+///////////////////////////////////////////////////////////////////////////////
+#define SINSP_PARTIAL_VERSION 1
+
+class SINSP_PUBLIC sinsp_partial_buffer
+{
+public:
+	sinsp_partial_buffer(const char* buf, uint32_t len)
+	{
+		m_pos = buf;
+		m_end = buf + len;
+	}
+
+	//
+	// Read the header of a partial. Return false if it was written with
+	// another version of the encoding, or if the rest of the buffer doesn't
+	// have the length in the header.
+	//
+	bool get_header()
+	{
+		uint8_t version;
+		uint32_t len;
+
+		return get(&version) && version == SINSP_PARTIAL_VERSION &&
+			get(&len) && len == remaining();
+	}
+
+	template<typename T> bool get(OUT T* res)
+	{
+		uint64_t bits = 0;
+
+		if(remaining() < sizeof(T))
+		{
+			return false;
+		}
+
+		for(uint32_t j = 0; j < sizeof(T); j++)
+		{
+			bits |= (uint64_t)(uint8_t)m_pos[j] << (j * 8);
+		}
+
+		from_bits(bits, res);
+		m_pos += sizeof(T);
+		return true;
+	}
+
+	bool get_string(OUT string* res)
+	{
+		uint32_t len;
+
+		if(!get(&len) || remaining() < len)
+		{
+			return false;
+		}
+
+		res->assign(m_pos, len);
+		m_pos += len;
+		return true;
+	}
+
+	uint32_t remaining()
+	{
+		return (uint32_t)(m_end - m_pos);
+	}
+
+	bool at_end()
+	{
+		return m_pos == m_end;
+	}
+
+	//
+	// Start a partial, and return where its content starts. Once it's
+	// complete, put_length() fills the length in the header.
+	//
+	static size_t put_header(OUT string* res)
+	{
+		put(res, (uint8_t)SINSP_PARTIAL_VERSION);
+		put(res, (uint32_t)0);
+		return res->size();
+	}
+
+	static void put_length(OUT string* res, size_t start)
+	{
+		uint32_t len = (uint32_t)(res->size() - start);
+
+		for(uint32_t j = 0; j < sizeof(len); j++)
+		{
+			(*res)[start - sizeof(len) + j] = (char)(len >> (j * 8));
+		}
+	}
+
+	template<typename T> static void put(OUT string* res, T val)
+	{
+		uint64_t bits = to_bits(val);
+
+		for(uint32_t j = 0; j < sizeof(T); j++)
+		{
+			res->push_back((char)(bits >> (j * 8)));
+		}
+	}
+
+	static void put_string(OUT string* res, const string& val)
+	{
+		put(res, (uint32_t)val.size());
+		res->append(val);
+	}
+
+private:
+	template<typename T> static uint64_t to_bits(T val)
+	{
+		return (uint64_t)val;
+	}
+
+	static uint64_t to_bits(double val)
+	{
+		uint64_t res;
+
+		memcpy(&res, &val, sizeof(res));
+		return res;
+	}
+
+	template<typename T> static void from_bits(uint64_t bits, OUT T* res)
+	{
+		*res = (T)bits;
+	}
+
+	static void from_bits(uint64_t bits, OUT double* res)
+	{
+		memcpy(res, &bits, sizeof(*res));
+	}
+
+	const char* m_pos;
+	const char* m_end;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Summaries of streams of keys that use a fixed amount of memory, whatever
+// the number of distinct keys. They are what the chisels use when the keys
+// are too many to be kept, like the connections of a busy server.
+// The keys are strings, and a sketch only keeps their hashes, except for
+// the top-k one.
+///////////////////////////////////////////////////////////////////////////////
+class SINSP_PUBLIC sinsp_sketch
+{
+public:
+	enum type
+	{
+		ST_TOPK,
+		ST_COUNTMIN,
+		ST_HLL,
+	};
+
+	sinsp_sketch(type stype)
+	{
+		m_type = stype;
+	}
+
+	virtual ~sinsp_sketch()
+	{
+	}
+
+	type get_type()
+	{
+		return m_type;
+	}
+
+	//
+	// Add weight occurrences of the len bytes of key
+	//
+	virtual void add(const char* key, uint32_t len, double weight) = 0;
+	virtual void clear() = 0;
+
+	//
+	// Append the state of the sketch to res, that another sketch of the
+	// same type can read with deserialize(). get_partial() adds the header
+	// of a partial, for merge_partial().
+	//
+	virtual void serialize(OUT string* res) = 0;
+	void get_partial(OUT string* res);
+
+	//
+	// Replace the state of the sketch, including its size, with the one in
+	// the buffer. Return false if the buffer doesn't have a sketch of this
+	// type, in which case the sketch is left empty.
+	//
+	virtual bool deserialize(sinsp_partial_buffer* buf) = 0;
+
+	//
+	// Merge a partial written by get_partial() on a sketch of the same
+	// type, e.g. on another host. Return false if the partial is not valid, or if
+	// the sizes of the two sketches don't allow merging them.
+	//
+	bool merge_partial(const char* buf, uint32_t len);
+
+	//
+	// 64 bit hash of the keys, with the bits mixed well enough for the
+	// sketches that split it
+	//
+	static uint64_t hash(const char* key, uint32_t len);
+
+private:
+	type m_type;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// The keys with the largest total weights, with the Space-Saving algorithm:
+// at most capacity keys are counted, and a new key takes the place of the
+// one with the smallest count, starting from that count. The counts are
+// never lower than the real ones, and they are higher by at most the error
+// of each entry. The keys with a weight larger than 1/capacity of the total
+// are always in the summary.
+// The entries are kept in a min-heap on their count, so an update takes
+// O(log(capacity)).
+///////////////////////////////////////////////////////////////////////////////
+class SINSP_PUBLIC sinsp_topk : public sinsp_sketch
+{
+public:
+	typedef struct entry
+	{
+		string m_key;
+		double m_count;
+		double m_error; // Largest part of m_count that may not belong to m_key
+	}entry;
+
+	sinsp_topk(uint32_t capacity);
+
+	void add(const char* key, uint32_t len, double weight);
+
+	void add(const string& key, double weight)
+	{
+		add(key.data(), (uint32_t)key.size(), weight);
+	}
+
+	void clear();
+	void serialize(OUT string* res);
+	bool deserialize(sinsp_partial_buffer* buf);
+
+	//
+	// Add the keys of another summary, e.g. of another host. Like in the
+	// mergeable summaries of Agarwal et al., a key that's missing from a
+	// full summary is counted with the smallest count of that summary, so
+	// the counts are still never lower than the real ones. The capacity is
+	// the one of this summary.
+	//
+	void merge(const sinsp_topk& other);
+
+	//
+	// Replace each key with the one that convert() makes of it, passing it
+	// arg, e.g. to change the byte order of the numbers in the keys. Return
+	// false, leaving the summary empty, if a conversion fails or makes two
+	// keys equal.
+	//
+	bool convert_keys(bool (*convert)(const string& key, uint32_t arg, OUT string* res), uint32_t arg);
+
+	uint32_t size()
+	{
+		return (uint32_t)m_heap.size();
+	}
+
+	uint32_t get_capacity()
+	{
+		return m_capacity;
+	}
+
+	//
+	// Return the n entries with the largest counts, in decreasing order of
+	// count, or all of them if n is 0. The pointers are valid until the
+	// next call to add() or clear().
+	//
+	void get_top(uint32_t n, OUT vector<const entry*>* res);
+
+	//
+	// Return the entry of key, or NULL if the key is not counted
+	//
+	const entry* find(const string& key);
+
+private:
+	void sift_up(uint32_t pos);
+	void sift_down(uint32_t pos);
+	void swap_entries(uint32_t a, uint32_t b);
+
+	uint32_t m_capacity;
+	vector<entry> m_heap; // The entry with the smallest count is m_heap[0]
+	unordered_map<string, uint32_t> m_index; // Key to position in m_heap
+	string m_keybuf; // Key being added, reused to avoid allocations
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Count-Min sketch: an estimate of the total weight of any key, from depth
+// rows of width counters. Each key adds to one counter per row, and the
+// estimate is the smallest of them, which is never lower than the real
+// weight. With probability 1 - e^-depth, it's higher by at most e/width of
+// the total weight.
+///////////////////////////////////////////////////////////////////////////////
+class SINSP_PUBLIC sinsp_countmin : public sinsp_sketch
+{
+public:
+	sinsp_countmin(uint32_t width, uint32_t depth);
+
+	void add(const char* key, uint32_t len, double weight);
+	void clear();
+	void serialize(OUT string* res);
+	bool deserialize(sinsp_partial_buffer* buf);
+	double estimate(const char* key, uint32_t len);
+
+	//
+	// Add the weights of another sketch. Return false if its width or depth
+	// are not the same.
+	//
+	bool merge(const sinsp_countmin& other);
+
+	double get_total()
+	{
+		return m_total;
+	}
+
+private:
+	uint32_t m_width;
+	uint32_t m_depth;
+	vector<double> m_counters; // m_depth rows of m_width counters
+	double m_total;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// HyperLogLog: an estimate of the number of distinct keys, from 2^precision
+// registers of one byte. The standard error is about 1.04 / sqrt(2^precision),
+// i.e. 1.6% with the default precision of 12, which takes 4KB.
+///////////////////////////////////////////////////////////////////////////////
+class SINSP_PUBLIC sinsp_hyperloglog : public sinsp_sketch
+{
+public:
+	//
+	// precision must be between 4 and 16
+	//
+	sinsp_hyperloglog(uint32_t precision);
+
+	//
+	// The weight doesn't matter, the key is counted once
+	//
+	void add(const char* key, uint32_t len, double weight);
+	void clear();
+	void serialize(OUT string* res);
+	bool deserialize(sinsp_partial_buffer* buf);
+	double estimate();
+
+	//
+	// Add the keys of another sketch. Return false if its precision is not
+	// the same.
+	//
+	bool merge(const sinsp_hyperloglog& other);
+
+private:
+	uint32_t m_precision;
+	vector<uint8_t> m_registers;
+};
@@ -0,0 +1,405 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _WIN32
+#include <pthread.h>
+#define HAS_SNAPSHOT_LOCK
+#endif
+#include <algorithm>
+#include "sinsp.h"
+#include "sinsp_int.h"
+#include "snapshot.h"
+
+#ifdef HAS_SNAPSHOT_LOCK
+struct snapshot_lock
+{
+	pthread_mutex_t m_mutex;
+};
+
+#define SNAPSHOT_LOCK(l) pthread_mutex_lock(&(l)->m_mutex)
+#define SNAPSHOT_UNLOCK(l) pthread_mutex_unlock(&(l)->m_mutex)
+#else
+//
+// Without threads the snapshots can only be read by the capture thread
+//
+struct snapshot_lock
+{
+};
+
+#define SNAPSHOT_LOCK(l)
+#define SNAPSHOT_UNLOCK(l)
+#endif
+
+static bool thread_snapshot_cmp(const sinsp_thread_snapshot& a, const sinsp_thread_snapshot& b)
+{
+	return a.m_tid < b.m_tid;
+}
+
+static bool fd_snapshot_cmp(const sinsp_fd_snapshot& a, const sinsp_fd_snapshot& b)
+{
+	return a.m_fd < b.m_fd;
+}
+
+const sinsp_thread_snapshot* sinsp_state_snapshot::find(int64_t tid) const
+{
+	sinsp_thread_snapshot key;
+	vector<sinsp_thread_snapshot>::const_iterator it;
+
+	key.m_tid = tid;
+	it = lower_bound(m_threads.begin(), m_threads.end(), key, thread_snapshot_cmp);
+
+	if(it == m_threads.end() || it->m_tid != tid)
+	{
+		return NULL;
+	}
+
+	return &*it;
+}
+
+sinsp_snapshot_publisher::sinsp_snapshot_publisher(sinsp* inspector)
+{
+	m_inspector = inspector;
+	m_lock = new snapshot_lock;
+#ifdef HAS_SNAPSHOT_LOCK
+	pthread_mutex_init(&m_lock->m_mutex, NULL);
+#endif
+	m_current = NULL;
+	m_interval_ns = 0;
+	m_last_ts = 0;
+	m_n_published = 0;
+}
+
+sinsp_snapshot_publisher::~sinsp_snapshot_publisher()
+{
+	//
+	// The readers must have released their snapshots by now
+	//
+	if(m_current != NULL)
+	{
+		unref(m_current);
+	}
+
+#ifdef HAS_SNAPSHOT_LOCK
+	pthread_mutex_destroy(&m_lock->m_mutex);
+#endif
+	delete m_lock;
+}
+
+static bool add_fd_snapshot(int64_t fd, sinsp_fdinfo_t* fdinfo, void* arg)
+{
+	vector<sinsp_fd_snapshot>* fds = (vector<sinsp_fd_snapshot>*)arg;
+
+	fds->push_back(sinsp_fd_snapshot());
+	fds->back().m_fd = fd;
+	fds->back().m_type = fdinfo->get_typechar();
+	fds->back().m_name = fdinfo->m_name.str();
+	return false;
+}
+
+void sinsp_snapshot_publisher::publish(uint64_t ts)
+{
+	threadinfo_map_t* threads = m_inspector->m_thread_manager->get_threads();
+	threadinfo_map_iterator_t it;
+	sinsp_state_snapshot* snapshot = new sinsp_state_snapshot;
+	sinsp_state_snapshot* old;
+
+	snapshot->m_ts = ts;
+	snapshot->m_refs = 1;
+	snapshot->m_threads.reserve(threads->size());
+
+	//
+	// The copy is made without the lock: nobody else can see it yet
+	//
+	for(it = threads->begin(); it != threads->end(); ++it)
+	{
+		sinsp_threadinfo* tinfo = &it->second;
+
+		snapshot->m_threads.push_back(sinsp_thread_snapshot());
+		sinsp_thread_snapshot* t = &snapshot->m_threads.back();
+
+		t->m_tid = tinfo->m_tid;
+		t->m_pid = tinfo->m_pid;
+		t->m_ptid = tinfo->m_ptid;
+		t->m_comm = tinfo->get_comm();
+		t->m_exe = tinfo->get_exe();
+		t->m_uid = tinfo->m_uid;
+		t->m_gid = tinfo->m_gid;
+		t->m_container_num = tinfo->m_container_num;
+		t->m_lastevent_ts = tinfo->m_lastevent_ts;
+
+		//
+		// The threads that share the table of their process leave the
+		// fds to its entry
+		//
+		if(!(tinfo->m_flags & PPM_CL_CLONE_FILES) || tinfo->is_main_thread())
+		{
+			tinfo->m_fdtable.visit(add_fd_snapshot, &t->m_fds);
+			sort(t->m_fds.begin(), t->m_fds.end(), fd_snapshot_cmp);
+		}
+	}
+
+	sort(snapshot->m_threads.begin(), snapshot->m_threads.end(), thread_snapshot_cmp);
+
+	SNAPSHOT_LOCK(m_lock);
+	old = m_current;
+	m_current = snapshot;
+	SNAPSHOT_UNLOCK(m_lock);
+
+	if(old != NULL)
+	{
+		unref(old);
+	}
+
+	m_last_ts = ts;
+	m_n_published++;
+}
+
+const sinsp_state_snapshot* sinsp_snapshot_publisher::acquire()
+{
+	sinsp_state_snapshot* res;
+
+	SNAPSHOT_LOCK(m_lock);
+	res = m_current;
+	if(res != NULL)
+	{
+		res->m_refs++;
+	}
+	SNAPSHOT_UNLOCK(m_lock);
+
+	return res;
+}
+
+void sinsp_snapshot_publisher::release(const sinsp_state_snapshot* snapshot)
+{
+	if(snapshot != NULL)
+	{
+		unref((sinsp_state_snapshot*)snapshot);
+	}
+}
+
+void sinsp_snapshot_publisher::unref(sinsp_state_snapshot* snapshot)
+{
+	uint32_t refs;
+
+	SNAPSHOT_LOCK(m_lock);
+	refs = --snapshot->m_refs;
+	SNAPSHOT_UNLOCK(m_lock);
+
+	if(refs == 0)
+	{
+		delete snapshot;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// sinsp_evt_copier implementation
+///////////////////////////////////////////////////////////////////////////////
+
+//
+// A thread shared by the copies of its events
+//
+struct sinsp_shared_thread_snapshot
+{
+	sinsp_thread_snapshot m_thread;
+	uint32_t m_refs; // The copier's reference while it's the last copy of the thread, plus the events'
+};
+
+//
+// If the copier has more threads than this, it forgets them all and copies
+// them again
+//
+#define EVT_COPIER_MAX_THREADS 65536
+
+sinsp_evt_copy::sinsp_evt_copy(sinsp* inspector) :
+	m_evt(inspector)
+{
+	m_thread = NULL;
+	m_has_fd = false;
+}
+
+const sinsp_thread_snapshot* sinsp_evt_copy::get_thread() const
+{
+	return (m_thread != NULL)? &m_thread->m_thread : NULL;
+}
+
+sinsp_evt_copier::sinsp_evt_copier(sinsp* inspector)
+{
+	m_inspector = inspector;
+	m_lock = new snapshot_lock;
+#ifdef HAS_SNAPSHOT_LOCK
+	pthread_mutex_init(&m_lock->m_mutex, NULL);
+#endif
+}
+
+sinsp_evt_copier::~sinsp_evt_copier()
+{
+	unordered_map<int64_t, sinsp_shared_thread_snapshot*>::iterator it;
+	uint32_t j;
+
+	//
+	// The copies must have been released by now
+	//
+	for(it = m_threads.begin(); it != m_threads.end(); ++it)
+	{
+		unref(it->second);
+	}
+
+	for(j = 0; j < m_free.size(); j++)
+	{
+		delete m_free[j];
+	}
+
+#ifdef HAS_SNAPSHOT_LOCK
+	pthread_mutex_destroy(&m_lock->m_mutex);
+#endif
+	delete m_lock;
+}
+
+//
+// Return the copy of the thread with a reference for the caller, reusing the
+// last one if the thread didn't change since
+//
+sinsp_shared_thread_snapshot* sinsp_evt_copier::get_thread(sinsp_threadinfo* tinfo)
+{
+	sinsp_shared_thread_snapshot* res;
+	unordered_map<int64_t, sinsp_shared_thread_snapshot*>::iterator it = m_threads.find(tinfo->m_tid);
+
+	if(it != m_threads.end())
+	{
+		sinsp_thread_snapshot* t = &it->second->m_thread;
+
+		if(t->m_pid == tinfo->m_pid &&
+			t->m_ptid == tinfo->m_ptid &&
+			t->m_uid == tinfo->m_uid &&
+			t->m_gid == tinfo->m_gid &&
+			t->m_container_num == tinfo->m_container_num &&
+			t->m_comm == tinfo->get_comm() &&
+			t->m_exe == tinfo->get_exe())
+		{
+			res = it->second;
+
+			SNAPSHOT_LOCK(m_lock);
+			res->m_refs++;
+			SNAPSHOT_UNLOCK(m_lock);
+
+			return res;
+		}
+
+		unref(it->second);
+		m_threads.erase(it);
+	}
+	else if(m_threads.size() >= EVT_COPIER_MAX_THREADS)
+	{
+		for(it = m_threads.begin(); it != m_threads.end(); ++it)
+		{
+			unref(it->second);
+		}
+
+		m_threads.clear();
+	}
+
+	res = new sinsp_shared_thread_snapshot;
+	res->m_thread.m_tid = tinfo->m_tid;
+	res->m_thread.m_pid = tinfo->m_pid;
+	res->m_thread.m_ptid = tinfo->m_ptid;
+	res->m_thread.m_comm = tinfo->get_comm();
+	res->m_thread.m_exe = tinfo->get_exe();
+	res->m_thread.m_uid = tinfo->m_uid;
+	res->m_thread.m_gid = tinfo->m_gid;
+	res->m_thread.m_container_num = tinfo->m_container_num;
+	res->m_thread.m_lastevent_ts = tinfo->m_lastevent_ts;
+
+	//
+	// One reference for m_threads, one for the caller. Nobody else can see
+	// it yet.
+	//
+	res->m_refs = 2;
+	m_threads[tinfo->m_tid] = res;
+	return res;
+}
+
+void sinsp_evt_copier::unref(sinsp_shared_thread_snapshot* thread)
+{
+	uint32_t refs;
+
+	SNAPSHOT_LOCK(m_lock);
+	refs = --thread->m_refs;
+	SNAPSHOT_UNLOCK(m_lock);
+
+	if(refs == 0)
+	{
+		delete thread;
+	}
+}
+
+sinsp_evt_copy* sinsp_evt_copier::copy(sinsp_evt* evt)
+{
+	sinsp_evt_copy* res = NULL;
+	sinsp_threadinfo* tinfo = evt->get_thread_info(false);
+	uint32_t len = evt->m_pevt->len;
+
+	SNAPSHOT_LOCK(m_lock);
+	if(!m_free.empty())
+	{
+		res = m_free.back();
+		m_free.pop_back();
+	}
+	SNAPSHOT_UNLOCK(m_lock);
+
+	if(res == NULL)
+	{
+		res = new sinsp_evt_copy(m_inspector);
+	}
+
+	if(res->m_data.size() < len)
+	{
+		res->m_data.resize(len);
+	}
+
+	memcpy(&res->m_data[0], evt->m_pevt, len);
+	res->m_evt.init(&res->m_data[0], evt->m_cpuid);
+	res->m_evt.m_evtnum = evt->m_evtnum;
+
+	res->m_thread = (tinfo != NULL)? get_thread(tinfo) : NULL;
+
+	res->m_has_fd = (evt->m_fdinfo != NULL && tinfo != NULL);
+	if(res->m_has_fd)
+	{
+		res->m_fd.m_fd = tinfo->m_lastevent_fd;
+		res->m_fd.m_type = evt->m_fdinfo->get_typechar();
+		res->m_fd.m_name.assign(evt->m_fdinfo->m_name.str());
+	}
+
+	return res;
+}
+
+void sinsp_evt_copier::release(sinsp_evt_copy* copy)
+{
+	sinsp_shared_thread_snapshot* thread = copy->m_thread;
+
+	copy->m_thread = NULL;
+
+	if(thread != NULL)
+	{
+		unref(thread);
+	}
+
+	SNAPSHOT_LOCK(m_lock);
+	m_free.push_back(copy);
+	SNAPSHOT_UNLOCK(m_lock);
+}
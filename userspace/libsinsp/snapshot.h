@@ -0,0 +1,248 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+struct snapshot_lock;
+struct sinsp_shared_thread_snapshot;
+
+/*!
+  \brief An fd in a \ref sinsp_state_snapshot.
+*/
+class SINSP_PUBLIC sinsp_fd_snapshot
+{
+public:
+	int64_t m_fd; ///< The fd number
+	char m_type; ///< The fd type, as returned by sinsp_fdinfo::get_typechar()
+	string m_name; ///< The fd name, e.g. the file name or the tuple of a socket
+};
+
+/*!
+  \brief A thread in a \ref sinsp_state_snapshot.
+*/
+class SINSP_PUBLIC sinsp_thread_snapshot
+{
+public:
+	int64_t m_tid; ///< The id of the thread
+	int64_t m_pid; ///< The id of the process containing the thread
+	int64_t m_ptid; ///< The id of the process that started the thread
+	string m_comm; ///< Command name, e.g. "top"
+	string m_exe; ///< Full command name, e.g. "/bin/top"
+	uint32_t m_uid; ///< user id
+	uint32_t m_gid; ///< group id
+	uint32_t m_container_num; ///< Number of the thread's container, see sinsp_container_manager
+	uint64_t m_lastevent_ts; ///< Timestamp of the last event of the thread
+
+	/*!
+	  The fds of the thread, sorted by number. Empty in the threads that
+	  share the fd table of their process: look up the entry of m_pid.
+	*/
+	vector<sinsp_fd_snapshot> m_fds;
+};
+
+/*!
+  \brief A copy of the thread and fd tables of an inspector, taken between
+   two events. It's never modified after it's published, so it can be read
+   from any thread, without locks, while the capture goes on. See
+   \ref sinsp::acquire_snapshot().
+*/
+class SINSP_PUBLIC sinsp_state_snapshot
+{
+public:
+	/*!
+	  \brief Return the timestamp of the last event parsed before the copy.
+	*/
+	uint64_t get_ts() const
+	{
+		return m_ts;
+	}
+
+	/*!
+	  \brief Return the threads, sorted by tid.
+	*/
+	const vector<sinsp_thread_snapshot>& get_threads() const
+	{
+		return m_threads;
+	}
+
+	/*!
+	  \brief Look up a thread by tid.
+
+	  \return Pointer to the thread, or NULL if it wasn't in the table.
+	*/
+	const sinsp_thread_snapshot* find(int64_t tid) const;
+
+VISIBILITY_PRIVATE
+	uint64_t m_ts;
+	vector<sinsp_thread_snapshot> m_threads;
+	uint32_t m_refs; // The publisher's reference while it's current, plus the readers'
+
+	friend class sinsp_snapshot_publisher;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Publishes copies of the thread and fd tables for the readers in other
+// threads. The capture thread makes a new copy when the events have advanced
+// by the interval, without holding the lock, and then swaps it with the
+// current one. The readers only take the lock to count their references, so
+// the capture never waits for a copy to be read, and the superseded copy is
+// freed as soon as its last reader releases it.
+///////////////////////////////////////////////////////////////////////////////
+class SINSP_PUBLIC sinsp_snapshot_publisher
+{
+public:
+	sinsp_snapshot_publisher(sinsp* inspector);
+	~sinsp_snapshot_publisher();
+
+	//
+	// Called by the capture thread after each event. 0 stops publishing.
+	//
+	void set_interval_ns(uint64_t interval_ns)
+	{
+		m_interval_ns = interval_ns;
+	}
+
+	void on_event(uint64_t ts)
+	{
+		if(m_interval_ns != 0 && ts - m_last_ts >= m_interval_ns)
+		{
+			publish(ts);
+		}
+	}
+
+	void publish(uint64_t ts);
+
+	//
+	// Publish again at the next event, e.g. after a seek
+	//
+	void reset()
+	{
+		m_last_ts = 0;
+	}
+
+	//
+	// Can be called from any thread
+	//
+	const sinsp_state_snapshot* acquire();
+	void release(const sinsp_state_snapshot* snapshot);
+
+	uint64_t get_n_published()
+	{
+		return m_n_published;
+	}
+
+private:
+	void unref(sinsp_state_snapshot* snapshot);
+
+	sinsp* m_inspector;
+	snapshot_lock* m_lock;
+	sinsp_state_snapshot* m_current; // NULL until the first copy is published
+	uint64_t m_interval_ns;
+	uint64_t m_last_ts;
+	uint64_t m_n_published;
+};
+
+/*!
+  \brief A copy of an event, of its thread and of its fd, that stays valid
+   after \ref sinsp::next() moves to the next event, and that can be read
+   from any thread. See \ref sinsp::copy_event().
+*/
+class SINSP_PUBLIC sinsp_evt_copy
+{
+public:
+	sinsp_evt_copy(sinsp* inspector);
+
+	/*!
+	  \brief Return the raw event, as returned by the driver.
+	*/
+	scap_evt* get_scap_evt()
+	{
+		return (scap_evt*)&m_data[0];
+	}
+
+	/*!
+	  \brief Return the event, to read its number, timestamp, type, thread
+	   id and parameters, e.g. with \ref sinsp_evt::get_param().
+
+	  \note Only the methods that read the raw event can be used: the
+	   others, like the ones that render the parameters to strings, look
+	   up the tables of the inspector.
+	*/
+	sinsp_evt* get_evt()
+	{
+		return &m_evt;
+	}
+
+	/*!
+	  \brief Return the thread of the event, or NULL if it was unknown. The
+	   copies of the events of a thread share it until the thread changes,
+	   so its m_lastevent_ts is the one of the first of them.
+	*/
+	const sinsp_thread_snapshot* get_thread() const;
+
+	/*!
+	  \brief Return the fd of the event, or NULL if it doesn't have one.
+	*/
+	const sinsp_fd_snapshot* get_fd() const
+	{
+		return m_has_fd? &m_fd : NULL;
+	}
+
+VISIBILITY_PRIVATE
+	vector<uint8_t> m_data; // Kept between the uses of the copy, so it only grows
+	sinsp_evt m_evt; // Points to m_data
+	sinsp_shared_thread_snapshot* m_thread;
+	sinsp_fd_snapshot m_fd;
+	bool m_has_fd;
+
+	friend class sinsp_evt_copier;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Makes the copies of the events. The capture thread fills them, and any
+// thread can release them. The released copies go back to a free list, with
+// their buffers, so once it's warm copying an event is mostly a memcpy.
+//
+// The threads are copied once for all the copies of their events, as long
+// as they don't change, and the copies count their references to them.
+///////////////////////////////////////////////////////////////////////////////
+class SINSP_PUBLIC sinsp_evt_copier
+{
+public:
+	sinsp_evt_copier(sinsp* inspector);
+	~sinsp_evt_copier();
+
+	//
+	// Called by the capture thread
+	//
+	sinsp_evt_copy* copy(sinsp_evt* evt);
+
+	//
+	// Can be called from any thread
+	//
+	void release(sinsp_evt_copy* copy);
+
+private:
+	sinsp_shared_thread_snapshot* get_thread(sinsp_threadinfo* tinfo);
+	void unref(sinsp_shared_thread_snapshot* thread);
+
+	sinsp* m_inspector;
+	snapshot_lock* m_lock;
+	vector<sinsp_evt_copy*> m_free; // Protected by m_lock
+	unordered_map<int64_t, sinsp_shared_thread_snapshot*> m_threads; // Last copy of each thread, only used by the capture thread
+};
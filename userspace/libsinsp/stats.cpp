@@ -40,6 +40,9 @@ void sinsp_stats::clear()
 	m_n_store_drops = 0;
 	m_n_retrieved_evts = 0;
 	m_n_retrieve_drops = 0;
+	m_n_evicted_fds = 0;
+	m_n_evicted_threads = 0;
+	m_memory_usage = 0;
 	m_metrics_registry.clear_all_metrics();
 }
 
@@ -63,12 +66,17 @@ void sinsp_stats::emit(FILE* f)
 	fprintf(f, "store drops: %" PRIu64 "\n", m_n_store_drops);
 	fprintf(f, "retrieved evts: %" PRIu64 "\n", m_n_retrieved_evts);
 	fprintf(f, "retrieve drops: %" PRIu64 "\n", m_n_retrieve_drops);
+	fprintf(f, "evicted fds: %" PRIu64 "\n", m_n_evicted_fds);
+	fprintf(f, "evicted threads: %" PRIu64 "\n", m_n_evicted_threads);
+	fprintf(f, "memory usage: %" PRIu64 "\n", m_memory_usage);
 
 	for(internal_metrics::registry::metric_map_iterator_t it = m_metrics_registry.get_metrics().begin(); it != m_metrics_registry.get_metrics().end(); it++)
 	{
 		fprintf(f, "%s: ", it->first.get_description().c_str());
 		it->second->process(*this);
 	}
+
+	sinsp_alloc_stats::emit(f);
 }
 
 void sinsp_stats::process(internal_metrics::counter& metric)
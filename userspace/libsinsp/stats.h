@@ -52,6 +52,9 @@ public:
 	uint64_t m_n_store_drops;
 	uint64_t m_n_retrieved_evts;
 	uint64_t m_n_retrieve_drops;
+	uint64_t m_n_evicted_fds;
+	uint64_t m_n_evicted_threads;
+	uint64_t m_memory_usage;
 
 private:
 	internal_metrics::registry m_metrics_registry;
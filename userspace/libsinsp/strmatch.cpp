@@ -0,0 +1,281 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "sinsp.h"
+#include "sinsp_int.h"
+
+//
+// Target of the missing transitions of the anchored automaton
+//
+#define SM_DEAD_STATE 0xffffffff
+
+///////////////////////////////////////////////////////////////////////////////
+// sinsp_string_matcher implementation
+///////////////////////////////////////////////////////////////////////////////
+sinsp_string_matcher::sinsp_string_matcher()
+{
+	memset(m_class, 0, sizeof(m_class));
+	m_nclasses = 1;
+	m_compiled = false;
+}
+
+uint32_t sinsp_string_matcher::add(const char* pattern, uint32_t len, bool anchored)
+{
+	ASSERT(!m_compiled);
+
+	m_patterns.push_back(string(pattern, len));
+	m_anchored.push_back(anchored);
+	return (uint32_t)m_patterns.size() - 1;
+}
+
+void sinsp_string_matcher::compile()
+{
+	uint32_t j;
+	uint32_t k;
+
+	ASSERT(!m_compiled);
+
+	//
+	// Class 0 is for the bytes that are in none of the patterns
+	//
+	memset(m_class, 0, sizeof(m_class));
+	m_nclasses = 1;
+
+	for(j = 0; j < m_patterns.size(); j++)
+	{
+		for(k = 0; k < m_patterns[j].length(); k++)
+		{
+			uint8_t c = (uint8_t)m_patterns[j][k];
+
+			if(m_class[c] == 0)
+			{
+				m_class[c] = (uint16_t)m_nclasses++;
+			}
+		}
+	}
+
+	build(&m_prefixes, true);
+	build(&m_infixes, false);
+	m_compiled = true;
+}
+
+void sinsp_string_matcher::build(automaton* a, bool anchored)
+{
+	uint32_t nclasses = m_nclasses;
+	uint32_t j;
+	uint32_t k;
+	uint32_t c;
+	vector<uint32_t> fail;
+	vector<uint32_t> queue;
+
+	a->m_next.assign(nclasses, SM_DEAD_STATE);
+	a->m_out.assign(1, vector<uint32_t>());
+	a->m_empty = true;
+
+	//
+	// The trie of the patterns
+	//
+	for(j = 0; j < m_patterns.size(); j++)
+	{
+		uint32_t state = 0;
+
+		if(m_anchored[j] != anchored)
+		{
+			continue;
+		}
+
+		for(k = 0; k < m_patterns[j].length(); k++)
+		{
+			uint32_t col = m_class[(uint8_t)m_patterns[j][k]];
+
+			if(a->m_next[state * nclasses + col] == SM_DEAD_STATE)
+			{
+				a->m_next[state * nclasses + col] = (uint32_t)a->m_out.size();
+				a->m_next.resize(a->m_next.size() + nclasses, SM_DEAD_STATE);
+				a->m_out.push_back(vector<uint32_t>());
+			}
+
+			state = a->m_next[state * nclasses + col];
+		}
+
+		a->m_out[state].push_back(j);
+		a->m_empty = false;
+	}
+
+	//
+	// For the patterns found anywhere, turn the trie into a DFA: the missing
+	// transitions of each state are the ones of its failure state, which is
+	// the longest proper suffix of the state in the trie. The states are
+	// visited breadth first, so the failure states are complete when they're
+	// used.
+	//
+	if(!anchored)
+	{
+		fail.assign(a->m_out.size(), 0);
+
+		for(c = 0; c < nclasses; c++)
+		{
+			uint32_t child = a->m_next[c];
+
+			if(child == SM_DEAD_STATE)
+			{
+				a->m_next[c] = 0;
+			}
+			else
+			{
+				queue.push_back(child);
+			}
+		}
+
+		for(j = 0; j < queue.size(); j++)
+		{
+			uint32_t state = queue[j];
+
+			a->m_out[state].insert(a->m_out[state].end(),
+				a->m_out[fail[state]].begin(),
+				a->m_out[fail[state]].end());
+
+			for(c = 0; c < nclasses; c++)
+			{
+				uint32_t child = a->m_next[state * nclasses + c];
+				uint32_t ftarget = a->m_next[fail[state] * nclasses + c];
+
+				if(child == SM_DEAD_STATE)
+				{
+					a->m_next[state * nclasses + c] = ftarget;
+				}
+				else
+				{
+					fail[child] = ftarget;
+					queue.push_back(child);
+				}
+			}
+		}
+	}
+
+	a->m_final.assign(a->m_out.size(), 0);
+
+	for(j = 0; j < a->m_out.size(); j++)
+	{
+		if(!a->m_out[j].empty())
+		{
+			a->m_final[j] = 1;
+		}
+	}
+}
+
+bool sinsp_string_matcher::run(automaton* a, bool anchored, const uint8_t* str, uint32_t len)
+{
+	const uint32_t* next = &a->m_next[0];
+	const uint8_t* final = &a->m_final[0];
+	uint32_t nclasses = m_nclasses;
+	uint32_t state = 0;
+	uint32_t j;
+
+	if(a->m_empty)
+	{
+		return false;
+	}
+
+	if(final[0])
+	{
+		return true;
+	}
+
+	for(j = 0; j < len; j++)
+	{
+		state = next[state * nclasses + m_class[str[j]]];
+
+		if(anchored && state == SM_DEAD_STATE)
+		{
+			return false;
+		}
+
+		if(final[state])
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void sinsp_string_matcher::run_all(automaton* a, bool anchored, const uint8_t* str, uint32_t len, vector<uint8_t>* seen)
+{
+	uint32_t nclasses = m_nclasses;
+	uint32_t state = 0;
+	uint32_t j;
+	uint32_t k;
+
+	if(a->m_empty)
+	{
+		return;
+	}
+
+	for(j = 0; ; j++)
+	{
+		if(a->m_final[state])
+		{
+			for(k = 0; k < a->m_out[state].size(); k++)
+			{
+				(*seen)[a->m_out[state][k]] = 1;
+			}
+		}
+
+		if(j == len)
+		{
+			break;
+		}
+
+		state = a->m_next[state * nclasses + m_class[str[j]]];
+
+		if(anchored && state == SM_DEAD_STATE)
+		{
+			break;
+		}
+	}
+}
+
+bool sinsp_string_matcher::match(const char* str, uint32_t len)
+{
+	ASSERT(m_compiled);
+
+	return run(&m_prefixes, true, (const uint8_t*)str, len) ||
+		run(&m_infixes, false, (const uint8_t*)str, len);
+}
+
+void sinsp_string_matcher::match_all(const char* str, uint32_t len, OUT vector<uint32_t>* ids)
+{
+	vector<uint8_t> seen(m_patterns.size(), 0);
+	uint32_t j;
+
+	ASSERT(m_compiled);
+
+	ids->clear();
+
+	run_all(&m_prefixes, true, (const uint8_t*)str, len, &seen);
+	run_all(&m_infixes, false, (const uint8_t*)str, len, &seen);
+
+	for(j = 0; j < seen.size(); j++)
+	{
+		if(seen[j])
+		{
+			ids->push_back(j);
+		}
+	}
+}
@@ -0,0 +1,91 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+///////////////////////////////////////////////////////////////////////////////
+// Matcher of many literal patterns at once. The patterns are either found
+// anywhere in the strings (like 'contains') or only at their start (like
+// 'startswith'). Each string is scanned once, whatever the number of
+// patterns, with an Aho-Corasick automaton turned into a DFA.
+// The bytes that are not in any pattern share one class, so the
+// transition table has one column per distinct pattern byte, plus one.
+///////////////////////////////////////////////////////////////////////////////
+class SINSP_PUBLIC sinsp_string_matcher
+{
+public:
+	sinsp_string_matcher();
+
+	//
+	// Add a pattern. If anchored is true, the pattern only matches at the
+	// start of the strings. Returns the id of the pattern, which is its
+	// position in the order of the add() calls.
+	// The patterns can't be added after compile().
+	//
+	uint32_t add(const char* pattern, uint32_t len, bool anchored);
+
+	//
+	// Build the automata. Must be called before matching.
+	//
+	void compile();
+
+	//
+	// Return true if any of the patterns is in the len bytes of str
+	//
+	bool match(const char* str, uint32_t len);
+
+	//
+	// Return the ids of the patterns that are in the len bytes of str, in
+	// increasing order and without repetitions
+	//
+	void match_all(const char* str, uint32_t len, OUT vector<uint32_t>* ids);
+
+	uint32_t size()
+	{
+		return (uint32_t)m_patterns.size();
+	}
+
+private:
+	//
+	// One automaton for the anchored patterns, and one for the others
+	//
+	struct automaton
+	{
+		automaton()
+		{
+			m_empty = true;
+		}
+
+		vector<uint32_t> m_next; // nstates * nclasses transitions
+		vector<uint8_t> m_final; // 1 for the states where a pattern ends
+		vector<vector<uint32_t> > m_out; // The ids of the patterns that end in each state
+		bool m_empty; // true if the automaton has no patterns
+	};
+
+	void build(automaton* a, bool anchored);
+	bool run(automaton* a, bool anchored, const uint8_t* str, uint32_t len);
+	void run_all(automaton* a, bool anchored, const uint8_t* str, uint32_t len, vector<uint8_t>* seen);
+
+	vector<string> m_patterns;
+	vector<bool> m_anchored;
+	uint16_t m_class[256]; // Byte to transition column
+	uint32_t m_nclasses;
+	automaton m_prefixes;
+	automaton m_infixes;
+	bool m_compiled;
+};
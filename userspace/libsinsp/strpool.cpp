@@ -0,0 +1,304 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include "sinsp.h"
+#include "sinsp_int.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// sinsp_string_pool implementation
+///////////////////////////////////////////////////////////////////////////////
+sinsp_string_pool::sinsp_string_pool()
+{
+	m_nbytes = 0;
+	resize(8);
+}
+
+sinsp_string_pool::~sinsp_string_pool()
+{
+	vector<sinsp_pooled_string_entry*>::iterator it;
+
+	//
+	// The strings that are still referenced outlive the pool, and are freed
+	// by their last reference
+	//
+	for(it = m_entries.begin(); it != m_entries.end(); ++it)
+	{
+		if(*it != NULL)
+		{
+			(*it)->m_pool = NULL;
+		}
+	}
+}
+
+//
+// FNV-1a
+//
+uint64_t sinsp_string_pool::hash(const char* str, uint32_t len)
+{
+	uint64_t res = 0xcbf29ce484222325ULL;
+	uint32_t j;
+
+	for(j = 0; j < len; j++)
+	{
+		res ^= (uint8_t)str[j];
+		res *= 0x100000001b3ULL;
+	}
+
+	return res;
+}
+
+void sinsp_string_pool::resize(uint32_t nbits)
+{
+	vector<sinsp_pooled_string_entry*> old;
+	vector<sinsp_pooled_string_entry*>::iterator it;
+
+	old.swap(m_entries);
+	m_entries.assign((size_t)1 << nbits, NULL);
+	m_mask = ((uint64_t)1 << nbits) - 1;
+	m_shift = 64 - nbits;
+	m_count = 0;
+
+	for(it = old.begin(); it != old.end(); ++it)
+	{
+		if(*it != NULL)
+		{
+			insert(*it);
+		}
+	}
+}
+
+void sinsp_string_pool::insert(sinsp_pooled_string_entry* entry)
+{
+	uint64_t j;
+
+	for(j = get_slot(entry->m_hash); m_entries[j] != NULL; j = (j + 1) & m_mask)
+	{
+	}
+
+	m_entries[j] = entry;
+	m_count++;
+}
+
+sinsp_pooled_string_entry* sinsp_string_pool::intern(const char* str, uint32_t len)
+{
+	uint64_t h = hash(str, len);
+	uint64_t j;
+	sinsp_pooled_string_entry* entry;
+
+	ASSERT(len != 0);
+
+	for(j = get_slot(h); m_entries[j] != NULL; j = (j + 1) & m_mask)
+	{
+		entry = m_entries[j];
+
+		if(entry->m_hash == h &&
+			entry->m_str.length() == len &&
+			memcmp(entry->m_str.c_str(), str, len) == 0)
+		{
+			entry->m_refcount++;
+			return entry;
+		}
+	}
+
+	entry = new sinsp_pooled_string_entry;
+	entry->m_str.assign(str, len);
+	entry->m_hash = h;
+	entry->m_refcount = 1;
+	entry->m_printable = -1;
+	entry->m_pool = this;
+	m_nbytes += len;
+
+	//
+	// Keep the table at most half full, so the runs stay short
+	//
+	if((m_count + 1) * 2 > m_entries.size())
+	{
+		resize(64 - m_shift + 1);
+		insert(entry);
+	}
+	else
+	{
+		m_entries[j] = entry;
+		m_count++;
+	}
+
+	return entry;
+}
+
+void sinsp_string_pool::remove(sinsp_pooled_string_entry* entry)
+{
+	uint64_t j;
+	uint64_t k;
+
+	for(j = get_slot(entry->m_hash); m_entries[j] != entry; j = (j + 1) & m_mask)
+	{
+		if(m_entries[j] == NULL)
+		{
+			ASSERT(false);
+			return;
+		}
+	}
+
+	//
+	// Move back the following entries of the run that can take the free
+	// slot, so that the lookups don't need tombstones
+	//
+	for(k = (j + 1) & m_mask; m_entries[k] != NULL; k = (k + 1) & m_mask)
+	{
+		uint64_t home = get_slot(m_entries[k]->m_hash);
+
+		if(((k - home) & m_mask) >= ((k - j) & m_mask))
+		{
+			m_entries[j] = m_entries[k];
+			j = k;
+		}
+	}
+
+	m_entries[j] = NULL;
+	m_count--;
+	m_nbytes -= entry->m_str.length();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// sinsp_pooled_string implementation
+///////////////////////////////////////////////////////////////////////////////
+const string sinsp_pooled_string::m_empty;
+
+void sinsp_pooled_string::set(sinsp_string_pool* pool, const char* str, uint32_t len)
+{
+	sinsp_pooled_string_entry* entry;
+
+	if(len == 0)
+	{
+		release();
+		return;
+	}
+
+	if(pool != NULL)
+	{
+		if(m_entry != NULL && m_entry->m_pool == pool &&
+			m_entry->m_str.length() == len &&
+			memcmp(m_entry->m_str.c_str(), str, len) == 0)
+		{
+			return;
+		}
+
+		entry = pool->intern(str, len);
+	}
+	else
+	{
+		entry = new sinsp_pooled_string_entry;
+		entry->m_str.assign(str, len);
+		entry->m_hash = 0;
+		entry->m_refcount = 1;
+		entry->m_printable = -1;
+		entry->m_pool = NULL;
+	}
+
+	release();
+	m_entry = entry;
+}
+
+void sinsp_pooled_string::check_printable() const
+{
+	const string& str = m_entry->m_str;
+
+	m_entry->m_printable = (find_if(str.begin(), str.end(), g_invalidchar()) == str.end());
+}
+
+void sinsp_pooled_string::free_entry()
+{
+	if(m_entry->m_pool != NULL)
+	{
+		m_entry->m_pool->remove(m_entry);
+	}
+
+	delete m_entry;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// sinsp_path_cache implementation
+///////////////////////////////////////////////////////////////////////////////
+#define PATH_CACHE_BITS 14
+
+sinsp_path_cache::sinsp_path_cache()
+{
+	m_nbytes = 0;
+}
+
+const sinsp_pooled_string& sinsp_path_cache::resolve(sinsp_string_pool* pool,
+	const sinsp_pooled_string& dir,
+	const char* name,
+	uint32_t namelen)
+{
+	static const sinsp_pooled_string no_dir;
+	const sinsp_pooled_string& kdir = (namelen != 0 && name[0] == '/')? no_dir : dir;
+	uint64_t h;
+	entry* e;
+
+	if(m_entries.size() == 0)
+	{
+		m_entries.resize((size_t)1 << PATH_CACHE_BITS);
+	}
+
+	h = sinsp_string_pool::hash(name, namelen) ^ (kdir.hash() * 0x9E3779B97F4A7C15ULL);
+	e = &m_entries[(h * 0x9E3779B97F4A7C15ULL) >> (64 - PATH_CACHE_BITS)];
+
+	if(!e->m_path.empty() &&
+		e->m_dir == kdir &&
+		e->m_name.length() == namelen &&
+		memcmp(e->m_name.c_str(), name, namelen) == 0)
+	{
+		return e->m_path;
+	}
+
+	char fullpath[SCAP_MAX_PATH_SIZE];
+	const char* sdir;
+	uint32_t sdirlen;
+	char tdir[SCAP_MAX_PATH_SIZE];
+
+	if(kdir.empty())
+	{
+		sdir = "./";
+		sdirlen = 2;
+	}
+	else if(kdir[kdir.length() - 1] == '/' || kdir.length() >= SCAP_MAX_PATH_SIZE - 1)
+	{
+		sdir = kdir.c_str();
+		sdirlen = kdir.length();
+	}
+	else
+	{
+		memcpy(tdir, kdir.c_str(), kdir.length());
+		tdir[kdir.length()] = '/';
+		tdir[kdir.length() + 1] = 0;
+		sdir = tdir;
+		sdirlen = kdir.length() + 1;
+	}
+
+	sinsp_utils::concatenate_paths(fullpath, SCAP_MAX_PATH_SIZE, sdir, sdirlen, name, namelen);
+
+	m_nbytes -= e->m_name.length();
+	e->m_dir = kdir;
+	e->m_name.assign(name, namelen);
+	e->m_path.set(pool, fullpath, strlen(fullpath));
+	m_nbytes += namelen;
+
+	return e->m_path;
+}
@@ -0,0 +1,368 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+class sinsp_string_pool;
+
+//
+// The storage of a string, shared by all the sinsp_pooled_string copies
+// that refer to it
+//
+typedef struct sinsp_pooled_string_entry
+{
+	string m_str;
+	uint64_t m_hash;
+	uint32_t m_refcount;
+	int8_t m_printable; // -1 until is_printable() checks the string
+	sinsp_string_pool* m_pool; // NULL if the string is not in a pool
+}sinsp_pooled_string_entry;
+
+///////////////////////////////////////////////////////////////////////////////
+// Pool of the strings that are repeated a lot in the thread and fd tables,
+// like the process names and the file names. Each string is stored once,
+// and it's freed when the last sinsp_pooled_string that refers to it goes
+// away.
+// The pool is an open addressing table of the entries, like the thread index.
+///////////////////////////////////////////////////////////////////////////////
+class SINSP_PUBLIC sinsp_string_pool
+{
+public:
+	sinsp_string_pool();
+	~sinsp_string_pool();
+
+	//
+	// Return the entry with the given content, with a reference taken for
+	// the caller. len must not be 0.
+	//
+	sinsp_pooled_string_entry* intern(const char* str, uint32_t len);
+
+	//
+	// Called when the last reference to the entry is released
+	//
+	void remove(sinsp_pooled_string_entry* entry);
+
+	uint32_t size()
+	{
+		return m_count;
+	}
+
+	//
+	// Approximate number of bytes used by the pool and its strings
+	//
+	uint64_t get_memory_usage()
+	{
+		return m_entries.size() * sizeof(sinsp_pooled_string_entry*) +
+			m_count * sizeof(sinsp_pooled_string_entry) + m_nbytes;
+	}
+
+	static uint64_t hash(const char* str, uint32_t len);
+
+private:
+
+	uint64_t get_slot(uint64_t hash)
+	{
+		return (hash * 0x9E3779B97F4A7C15ULL) >> m_shift;
+	}
+
+	void insert(sinsp_pooled_string_entry* entry);
+	void resize(uint32_t nbits);
+
+	vector<sinsp_pooled_string_entry*> m_entries; // NULL for the free slots
+	uint64_t m_mask;
+	uint32_t m_shift;
+	uint32_t m_count;
+	uint64_t m_nbytes; // Total length of the strings
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Reference counted immutable string. The copies share the same storage, so
+// copying one never allocates. The strings that are set through a
+// sinsp_string_pool also share it with all the others with the same
+// content in the pool, so comparing two of them is comparing two pointers.
+///////////////////////////////////////////////////////////////////////////////
+class SINSP_PUBLIC sinsp_pooled_string
+{
+public:
+	sinsp_pooled_string()
+	{
+		m_entry = NULL;
+	}
+
+	sinsp_pooled_string(const sinsp_pooled_string& other)
+	{
+		m_entry = other.m_entry;
+		if(m_entry != NULL)
+		{
+			m_entry->m_refcount++;
+		}
+	}
+
+	sinsp_pooled_string(const string& str)
+	{
+		m_entry = NULL;
+		set(NULL, str.c_str(), str.length());
+	}
+
+	sinsp_pooled_string(const char* str)
+	{
+		m_entry = NULL;
+		set(NULL, str, strlen(str));
+	}
+
+	~sinsp_pooled_string()
+	{
+		release();
+	}
+
+	sinsp_pooled_string& operator=(const sinsp_pooled_string& other)
+	{
+		if(other.m_entry != NULL)
+		{
+			other.m_entry->m_refcount++;
+		}
+
+		release();
+		m_entry = other.m_entry;
+		return *this;
+	}
+
+	//
+	// Assigning a plain string doesn't add it to a pool. Use set() for that.
+	//
+	sinsp_pooled_string& operator=(const string& str)
+	{
+		set(NULL, str.c_str(), str.length());
+		return *this;
+	}
+
+	sinsp_pooled_string& operator=(const char* str)
+	{
+		set(NULL, str, strlen(str));
+		return *this;
+	}
+
+	//
+	// Set the content of the string, sharing it with the other strings of
+	// the pool. If pool is NULL, the string gets its own storage.
+	//
+	void set(sinsp_string_pool* pool, const char* str, uint32_t len);
+
+	void set(sinsp_string_pool* pool, const string& str)
+	{
+		set(pool, str.c_str(), str.length());
+	}
+
+	void set(sinsp_string_pool* pool, const char* str)
+	{
+		set(pool, str, strlen(str));
+	}
+
+	void clear()
+	{
+		release();
+	}
+
+	const string& str() const
+	{
+		return (m_entry != NULL)? m_entry->m_str : m_empty;
+	}
+
+	operator const string&() const
+	{
+		return str();
+	}
+
+	const char* c_str() const
+	{
+		return str().c_str();
+	}
+
+	size_t length() const
+	{
+		return str().length();
+	}
+
+	size_t size() const
+	{
+		return str().size();
+	}
+
+	bool empty() const
+	{
+		return m_entry == NULL;
+	}
+
+	//
+	// True if all the characters are printable, i.e. if the string can be
+	// shown as it is. The result is computed once and shared by all the
+	// copies of the string.
+	//
+	bool is_printable() const
+	{
+		if(m_entry == NULL)
+		{
+			return true;
+		}
+
+		if(m_entry->m_printable < 0)
+		{
+			check_printable();
+		}
+
+		return m_entry->m_printable != 0;
+	}
+
+	//
+	// Hash of the content for the strings of a pool, 0 for the others
+	//
+	uint64_t hash() const
+	{
+		return (m_entry != NULL)? m_entry->m_hash : 0;
+	}
+
+	char operator[](size_t pos) const
+	{
+		return str()[pos];
+	}
+
+	bool operator==(const sinsp_pooled_string& other) const
+	{
+		if(m_entry == other.m_entry)
+		{
+			return true;
+		}
+
+		//
+		// The empty strings have no entry, and two strings of the same pool
+		// are equal only if they share it
+		//
+		if(m_entry == NULL || other.m_entry == NULL ||
+			(m_entry->m_pool != NULL && m_entry->m_pool == other.m_entry->m_pool))
+		{
+			return false;
+		}
+
+		return m_entry->m_str == other.m_entry->m_str;
+	}
+
+	bool operator!=(const sinsp_pooled_string& other) const
+	{
+		return !(*this == other);
+	}
+
+	bool operator==(const string& other) const
+	{
+		return str() == other;
+	}
+
+	bool operator!=(const string& other) const
+	{
+		return str() != other;
+	}
+
+	bool operator==(const char* other) const
+	{
+		return str() == other;
+	}
+
+	bool operator!=(const char* other) const
+	{
+		return str() != other;
+	}
+
+private:
+	void release()
+	{
+		if(m_entry != NULL)
+		{
+			if(--m_entry->m_refcount == 0)
+			{
+				free_entry();
+			}
+
+			m_entry = NULL;
+		}
+	}
+
+	void free_entry();
+	void check_printable() const;
+
+	sinsp_pooled_string_entry* m_entry; // NULL for the empty string
+
+	static const string m_empty;
+};
+
+inline bool operator==(const string& a, const sinsp_pooled_string& b)
+{
+	return b == a;
+}
+
+inline bool operator!=(const string& a, const sinsp_pooled_string& b)
+{
+	return b != a;
+}
+
+inline bool operator==(const char* a, const sinsp_pooled_string& b)
+{
+	return b == a;
+}
+
+inline bool operator!=(const char* a, const sinsp_pooled_string& b)
+{
+	return b != a;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Cache of the paths opened relative to a directory, like the cwd of a
+// thread or the fd of openat. The directories are strings of the pool, so
+// a lookup only hashes the relative name, and a hit gives the normalized
+// full path, already in the pool, without building it again.
+// The cache is direct mapped: a new path replaces the one in its slot.
+///////////////////////////////////////////////////////////////////////////////
+class SINSP_PUBLIC sinsp_path_cache
+{
+public:
+	sinsp_path_cache();
+
+	//
+	// Return the full path of name, in the pool. dir is the directory of
+	// the relative names, with or without the trailing slash, and is
+	// ignored for the absolute ones. namelen is the length of name.
+	//
+	const sinsp_pooled_string& resolve(sinsp_string_pool* pool,
+		const sinsp_pooled_string& dir,
+		const char* name,
+		uint32_t namelen);
+
+	uint64_t get_memory_usage()
+	{
+		return m_entries.size() * sizeof(entry) + m_nbytes;
+	}
+
+private:
+	struct entry
+	{
+		sinsp_pooled_string m_dir; // Empty for the absolute names
+		string m_name;
+		sinsp_pooled_string m_path;
+	};
+
+	vector<entry> m_entries; // Allocated at the first lookup
+	uint64_t m_nbytes; // Total length of the names
+};
@@ -0,0 +1,1101 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <ctype.h>
+#include <algorithm>
+
+#include "sinsp.h"
+#include "sinsp_int.h"
+
+//
+// Transition of the deterministic automaton that is not built yet, and
+// transition of the Thompson automaton that is not patched yet
+//
+#define SR_UNKNOWN 0xffffffff
+
+//
+// Limits of the syntax
+//
+#define SR_MAX_DEPTH 256
+#define SR_MAX_REPEAT 1000
+
+//
+// Number of times the cache can be emptied while matching a string before
+// the rest of the string is matched without it
+//
+#define SR_MAX_RESETS_PER_MATCH 2
+
+///////////////////////////////////////////////////////////////////////////////
+// Byte set helpers
+///////////////////////////////////////////////////////////////////////////////
+static inline void sr_set_clear(uint32_t* bits)
+{
+	memset(bits, 0, 8 * sizeof(uint32_t));
+}
+
+static inline void sr_set_add(uint32_t* bits, uint8_t b)
+{
+	bits[b >> 5] |= (1U << (b & 31));
+}
+
+static inline bool sr_set_contains(const uint32_t* bits, uint8_t b)
+{
+	return (bits[b >> 5] & (1U << (b & 31))) != 0;
+}
+
+static inline void sr_set_add_range(uint32_t* bits, uint32_t lo, uint32_t hi)
+{
+	uint32_t b;
+
+	for(b = lo; b <= hi; b++)
+	{
+		sr_set_add(bits, (uint8_t)b);
+	}
+}
+
+static inline void sr_set_invert(uint32_t* bits)
+{
+	uint32_t j;
+
+	for(j = 0; j < 8; j++)
+	{
+		bits[j] = ~bits[j];
+	}
+}
+
+static void sr_set_add_ctype(uint32_t* bits, int (*fn)(int))
+{
+	uint32_t b;
+
+	//
+	// Only ASCII, whatever the locale
+	//
+	for(b = 0; b < 128; b++)
+	{
+		if(fn((int)b))
+		{
+			sr_set_add(bits, (uint8_t)b);
+		}
+	}
+}
+
+static int sr_isword(int c)
+{
+	return isalnum(c) || c == '_';
+}
+
+static const struct
+{
+	const char* m_name;
+	int (*m_fn)(int);
+} sr_named_classes[] =
+{
+	{"alnum", isalnum},
+	{"alpha", isalpha},
+	{"blank", isblank},
+	{"cntrl", iscntrl},
+	{"digit", isdigit},
+	{"graph", isgraph},
+	{"lower", islower},
+	{"print", isprint},
+	{"punct", ispunct},
+	{"space", isspace},
+	{"upper", isupper},
+	{"xdigit", isxdigit},
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// sinsp_regex implementation
+///////////////////////////////////////////////////////////////////////////////
+sinsp_regex::sinsp_regex()
+{
+	m_pos = 0;
+	m_start = 0;
+	memset(m_class, 0, sizeof(m_class));
+	memset(m_class_byte, 0, sizeof(m_class_byte));
+	m_nclasses = 1;
+	m_markgen = 0;
+	m_nresets = 0;
+	m_compiled = false;
+}
+
+void sinsp_regex::compile(const string& pattern)
+{
+	vector<node> nodes;
+	fragment frag;
+	uint32_t root;
+
+	m_pattern = pattern;
+	m_pos = 0;
+	m_sets.clear();
+	m_states.clear();
+	m_compiled = false;
+
+	root = parse_alternation(&nodes, 0);
+
+	//
+	// parse_alternation() only stops before the end at a ')'
+	//
+	if(m_pos < m_pattern.size())
+	{
+		error("unmatched )");
+	}
+
+	emit(nodes, root, &frag);
+	patch(frag.m_outs, add_state(RO_MATCH, 0, SR_UNKNOWN, SR_UNKNOWN));
+	m_start = frag.m_start;
+
+	build_classes();
+
+	m_mark.assign(m_states.size(), 0);
+	m_markgen = 0;
+
+	next_mark();
+	m_restart.clear();
+	add_closure(m_start, false, false, &m_restart);
+	sort(m_restart.begin(), m_restart.end());
+
+	reset_cache();
+	m_compiled = true;
+}
+
+void sinsp_regex::error(const string& msg)
+{
+	throw sinsp_exception("invalid regular expression '" + m_pattern + "': " + msg +
+		" at pos " + to_string((long long) m_pos));
+}
+
+uint32_t sinsp_regex::add_node(vector<node>* nodes, node_type type, uint32_t left, uint32_t right)
+{
+	node n;
+
+	n.m_type = type;
+	n.m_set = 0;
+	n.m_left = left;
+	n.m_right = right;
+	n.m_min = 0;
+	n.m_max = 0;
+
+	nodes->push_back(n);
+	return (uint32_t)nodes->size() - 1;
+}
+
+uint32_t sinsp_regex::add_set(const byte_set& set)
+{
+	m_sets.push_back(set);
+	return (uint32_t)m_sets.size() - 1;
+}
+
+uint32_t sinsp_regex::parse_alternation(vector<node>* nodes, uint32_t depth)
+{
+	uint32_t res;
+
+	if(depth > SR_MAX_DEPTH)
+	{
+		error("too many nested groups");
+	}
+
+	res = parse_concatenation(nodes, depth);
+
+	while(m_pos < m_pattern.size() && m_pattern[m_pos] == '|')
+	{
+		uint32_t right;
+
+		m_pos++;
+		right = parse_concatenation(nodes, depth);
+		res = add_node(nodes, RN_ALT, res, right);
+	}
+
+	return res;
+}
+
+uint32_t sinsp_regex::parse_concatenation(vector<node>* nodes, uint32_t depth)
+{
+	uint32_t res = 0;
+	bool empty = true;
+
+	while(m_pos < m_pattern.size() && m_pattern[m_pos] != '|' && m_pattern[m_pos] != ')')
+	{
+		uint32_t n = parse_repetition(nodes, depth);
+
+		res = empty? n : add_node(nodes, RN_CAT, res, n);
+		empty = false;
+	}
+
+	if(empty)
+	{
+		res = add_node(nodes, RN_EMPTY, 0, 0);
+	}
+
+	return res;
+}
+
+bool sinsp_regex::parse_count(int32_t* res)
+{
+	uint32_t start = m_pos;
+
+	*res = 0;
+
+	while(m_pos < m_pattern.size() && isdigit((int)(uint8_t)m_pattern[m_pos]))
+	{
+		*res = *res * 10 + (m_pattern[m_pos] - '0');
+
+		if(*res > SR_MAX_REPEAT)
+		{
+			error("repetition count too large");
+		}
+
+		m_pos++;
+	}
+
+	return m_pos != start;
+}
+
+uint32_t sinsp_regex::parse_repetition(vector<node>* nodes, uint32_t depth)
+{
+	uint32_t res = parse_atom(nodes, depth);
+	uint32_t nrepeats = 0;
+
+	while(m_pos < m_pattern.size())
+	{
+		char c = m_pattern[m_pos];
+		int32_t min;
+		int32_t max;
+		uint32_t n;
+
+		if(c == '*')
+		{
+			min = 0;
+			max = -1;
+		}
+		else if(c == '+')
+		{
+			min = 1;
+			max = -1;
+		}
+		else if(c == '?')
+		{
+			min = 0;
+			max = 1;
+		}
+		else if(c == '{')
+		{
+			m_pos++;
+
+			if(!parse_count(&min))
+			{
+				error("invalid repetition count");
+			}
+
+			max = min;
+
+			if(m_pos < m_pattern.size() && m_pattern[m_pos] == ',')
+			{
+				m_pos++;
+
+				if(m_pos < m_pattern.size() && m_pattern[m_pos] == '}')
+				{
+					max = -1;
+				}
+				else if(!parse_count(&max) || max < min)
+				{
+					error("invalid repetition count");
+				}
+			}
+
+			if(m_pos >= m_pattern.size() || m_pattern[m_pos] != '}')
+			{
+				error("missing }");
+			}
+		}
+		else
+		{
+			break;
+		}
+
+		m_pos++;
+
+		if(++nrepeats > SR_MAX_DEPTH)
+		{
+			error("too many repetition operators");
+		}
+
+		n = add_node(nodes, RN_REPEAT, res, 0);
+		(*nodes)[n].m_min = min;
+		(*nodes)[n].m_max = max;
+		res = n;
+	}
+
+	return res;
+}
+
+uint32_t sinsp_regex::parse_atom(vector<node>* nodes, uint32_t depth)
+{
+	byte_set set;
+	uint8_t byte;
+	uint32_t res;
+
+	ASSERT(m_pos < m_pattern.size());
+
+	switch(m_pattern[m_pos])
+	{
+	case '(':
+		m_pos++;
+		res = parse_alternation(nodes, depth + 1);
+
+		if(m_pos >= m_pattern.size() || m_pattern[m_pos] != ')')
+		{
+			error("missing )");
+		}
+
+		m_pos++;
+		return res;
+	case '^':
+		m_pos++;
+		return add_node(nodes, RN_BOL, 0, 0);
+	case '$':
+		m_pos++;
+		return add_node(nodes, RN_EOL, 0, 0);
+	case '*':
+	case '+':
+	case '?':
+	case '{':
+		error("nothing to repeat");
+		return 0;
+	case '[':
+		m_pos++;
+		parse_bracket(&set);
+		break;
+	case '.':
+		m_pos++;
+		memset(set.m_bits, 0xff, sizeof(set.m_bits));
+		break;
+	case '\\':
+		m_pos++;
+
+		if(m_pos >= m_pattern.size())
+		{
+			error("trailing \\");
+		}
+
+		if(parse_escape(&set, &byte))
+		{
+			sr_set_clear(set.m_bits);
+			sr_set_add(set.m_bits, byte);
+		}
+		break;
+	default:
+		sr_set_clear(set.m_bits);
+		sr_set_add(set.m_bits, (uint8_t)m_pattern[m_pos]);
+		m_pos++;
+		break;
+	}
+
+	res = add_node(nodes, RN_SET, 0, 0);
+	(*nodes)[res].m_set = add_set(set);
+	return res;
+}
+
+//
+// Parse the escape sequence after a '\'. Returns true and sets byte if it's
+// a single byte, or returns false and sets set if it's a class.
+//
+bool sinsp_regex::parse_escape(byte_set* set, uint8_t* byte)
+{
+	char c = m_pattern[m_pos++];
+	uint32_t j;
+
+	switch(c)
+	{
+	case 'd':
+	case 'D':
+	case 'w':
+	case 'W':
+	case 's':
+	case 'S':
+		sr_set_clear(set->m_bits);
+
+		if(c == 'd' || c == 'D')
+		{
+			sr_set_add_ctype(set->m_bits, isdigit);
+		}
+		else if(c == 'w' || c == 'W')
+		{
+			sr_set_add_ctype(set->m_bits, sr_isword);
+		}
+		else
+		{
+			sr_set_add_ctype(set->m_bits, isspace);
+		}
+
+		if(isupper((int)c))
+		{
+			sr_set_invert(set->m_bits);
+		}
+
+		return false;
+	case 'n':
+		*byte = '\n';
+		return true;
+	case 't':
+		*byte = '\t';
+		return true;
+	case 'r':
+		*byte = '\r';
+		return true;
+	case 'f':
+		*byte = '\f';
+		return true;
+	case 'v':
+		*byte = '\v';
+		return true;
+	case 'x':
+		*byte = 0;
+
+		for(j = 0; j < 2; j++)
+		{
+			if(m_pos >= m_pattern.size() || !isxdigit((int)(uint8_t)m_pattern[m_pos]))
+			{
+				error("invalid \\x escape");
+			}
+
+			c = m_pattern[m_pos++];
+			*byte = (uint8_t)(*byte * 16 + (isdigit((int)c)? c - '0' : tolower((int)c) - 'a' + 10));
+		}
+
+		return true;
+	default:
+		if(isalnum((int)(uint8_t)c))
+		{
+			m_pos--;
+			error("unsupported escape sequence");
+		}
+
+		*byte = (uint8_t)c;
+		return true;
+	}
+}
+
+//
+// Parse a bracket expression, after the '['
+//
+void sinsp_regex::parse_bracket(byte_set* set)
+{
+	bool negate = false;
+	bool first = true;
+
+	sr_set_clear(set->m_bits);
+
+	if(m_pos < m_pattern.size() && m_pattern[m_pos] == '^')
+	{
+		negate = true;
+		m_pos++;
+	}
+
+	while(true)
+	{
+		byte_set esc;
+		uint8_t lo;
+		uint8_t hi;
+		uint32_t j;
+		char c;
+
+		if(m_pos >= m_pattern.size())
+		{
+			error("missing ]");
+		}
+
+		c = m_pattern[m_pos];
+
+		//
+		// A ']' at the start is a literal
+		//
+		if(c == ']' && !first)
+		{
+			m_pos++;
+			break;
+		}
+
+		first = false;
+
+		if(c == '[' && m_pos + 1 < m_pattern.size() && m_pattern[m_pos + 1] == ':')
+		{
+			size_t end = m_pattern.find(":]", m_pos + 2);
+			string name;
+
+			if(end == string::npos)
+			{
+				error("missing :]");
+			}
+
+			name = m_pattern.substr(m_pos + 2, end - m_pos - 2);
+
+			for(j = 0; j < sizeof(sr_named_classes) / sizeof(sr_named_classes[0]); j++)
+			{
+				if(name == sr_named_classes[j].m_name)
+				{
+					sr_set_add_ctype(set->m_bits, sr_named_classes[j].m_fn);
+					break;
+				}
+			}
+
+			if(j == sizeof(sr_named_classes) / sizeof(sr_named_classes[0]))
+			{
+				error("unknown class " + name);
+			}
+
+			m_pos = (uint32_t)end + 2;
+			continue;
+		}
+
+		if(c == '\\')
+		{
+			m_pos++;
+
+			if(m_pos >= m_pattern.size())
+			{
+				error("missing ]");
+			}
+
+			if(!parse_escape(&esc, &lo))
+			{
+				for(j = 0; j < 8; j++)
+				{
+					set->m_bits[j] |= esc.m_bits[j];
+				}
+
+				continue;
+			}
+		}
+		else
+		{
+			lo = (uint8_t)c;
+			m_pos++;
+		}
+
+		if(m_pos + 1 < m_pattern.size() && m_pattern[m_pos] == '-' && m_pattern[m_pos + 1] != ']')
+		{
+			m_pos++;
+			c = m_pattern[m_pos++];
+
+			if(c == '\\')
+			{
+				if(m_pos >= m_pattern.size() || !parse_escape(&esc, &hi))
+				{
+					error("invalid range");
+				}
+			}
+			else
+			{
+				hi = (uint8_t)c;
+			}
+
+			if(hi < lo)
+			{
+				error("invalid range");
+			}
+
+			sr_set_add_range(set->m_bits, lo, hi);
+		}
+		else
+		{
+			sr_set_add(set->m_bits, lo);
+		}
+	}
+
+	if(negate)
+	{
+		sr_set_invert(set->m_bits);
+	}
+}
+
+uint32_t sinsp_regex::add_state(nfa_op op, uint32_t set, uint32_t out, uint32_t out1)
+{
+	nfa_state s;
+
+	//
+	// The bounded repetitions copy their expression, so a short expression
+	// can still be huge
+	//
+	if(m_states.size() >= SP_REGEX_MAX_NFA_STATES)
+	{
+		throw sinsp_exception("invalid regular expression '" + m_pattern + "': too large");
+	}
+
+	s.m_op = op;
+	s.m_set = set;
+	s.m_out = out;
+	s.m_out1 = out1;
+
+	m_states.push_back(s);
+	return (uint32_t)m_states.size() - 1;
+}
+
+void sinsp_regex::patch(const vector<uint32_t>& outs, uint32_t target)
+{
+	uint32_t j;
+
+	for(j = 0; j < outs.size(); j++)
+	{
+		if(outs[j] & 1)
+		{
+			m_states[outs[j] >> 1].m_out1 = target;
+		}
+		else
+		{
+			m_states[outs[j] >> 1].m_out = target;
+		}
+	}
+}
+
+void sinsp_regex::emit(const vector<node>& nodes, uint32_t n, fragment* res)
+{
+	const node& nd = nodes[n];
+	vector<uint32_t> parts;
+	fragment left;
+	fragment right;
+	uint32_t s;
+	int32_t j;
+
+	switch(nd.m_type)
+	{
+	case RN_SET:
+	case RN_EMPTY:
+	case RN_BOL:
+	case RN_EOL:
+		if(nd.m_type == RN_SET)
+		{
+			s = add_state(RO_BYTE, nd.m_set, SR_UNKNOWN, SR_UNKNOWN);
+		}
+		else
+		{
+			s = add_state((nd.m_type == RN_EMPTY)? RO_JMP : ((nd.m_type == RN_BOL)? RO_BOL : RO_EOL),
+				0, SR_UNKNOWN, SR_UNKNOWN);
+		}
+
+		res->m_start = s;
+		res->m_outs.assign(1, s * 2);
+		break;
+	case RN_CAT:
+	case RN_ALT:
+		//
+		// The long sequences and lists of alternatives are deep on the left
+		// side, so they're walked without recursion
+		//
+		for(s = n; nodes[s].m_type == nd.m_type; s = nodes[s].m_left)
+		{
+			parts.push_back(nodes[s].m_right);
+		}
+
+		emit(nodes, s, res);
+
+		for(j = (int32_t)parts.size() - 1; j >= 0; j--)
+		{
+			emit(nodes, parts[j], &right);
+
+			if(nd.m_type == RN_CAT)
+			{
+				patch(res->m_outs, right.m_start);
+				res->m_outs = right.m_outs;
+			}
+			else
+			{
+				res->m_start = add_state(RO_SPLIT, 0, res->m_start, right.m_start);
+				res->m_outs.insert(res->m_outs.end(), right.m_outs.begin(), right.m_outs.end());
+			}
+		}
+		break;
+	case RN_REPEAT:
+		//
+		// The mandatory copies, then either a loop or the optional copies
+		//
+		s = add_state(RO_JMP, 0, SR_UNKNOWN, SR_UNKNOWN);
+		res->m_start = s;
+		res->m_outs.assign(1, s * 2);
+
+		for(j = 0; j < nd.m_min; j++)
+		{
+			emit(nodes, nd.m_left, &left);
+			patch(res->m_outs, left.m_start);
+			res->m_outs = left.m_outs;
+		}
+
+		if(nd.m_max == -1)
+		{
+			emit(nodes, nd.m_left, &left);
+			s = add_state(RO_SPLIT, 0, left.m_start, SR_UNKNOWN);
+			patch(left.m_outs, s);
+			patch(res->m_outs, s);
+			res->m_outs.assign(1, s * 2 + 1);
+		}
+		else
+		{
+			for(j = nd.m_min; j < nd.m_max; j++)
+			{
+				emit(nodes, nd.m_left, &left);
+				s = add_state(RO_SPLIT, 0, left.m_start, SR_UNKNOWN);
+				patch(res->m_outs, s);
+				res->m_outs = left.m_outs;
+				res->m_outs.push_back(s * 2 + 1);
+			}
+		}
+		break;
+	default:
+		ASSERT(false);
+		break;
+	}
+}
+
+//
+// Split the bytes in classes that no set of the expression tells apart, so
+// the transition table has one column per class instead of one per byte
+//
+void sinsp_regex::build_classes()
+{
+	uint8_t refined[256];
+	int32_t remap[2][256];
+	uint32_t j;
+	uint32_t b;
+
+	memset(m_class, 0, sizeof(m_class));
+	m_nclasses = 1;
+
+	for(j = 0; j < m_sets.size(); j++)
+	{
+		uint32_t nclasses = 0;
+
+		memset(remap, 0xff, sizeof(remap));
+
+		for(b = 0; b < 256; b++)
+		{
+			int32_t* slot = &remap[sr_set_contains(m_sets[j].m_bits, (uint8_t)b)? 1 : 0][m_class[b]];
+
+			if(*slot == -1)
+			{
+				*slot = nclasses++;
+			}
+
+			refined[b] = (uint8_t)*slot;
+		}
+
+		memcpy(m_class, refined, sizeof(m_class));
+		m_nclasses = nclasses;
+	}
+
+	for(b = 0; b < 256; b++)
+	{
+		m_class_byte[m_class[b]] = (uint8_t)b;
+	}
+}
+
+void sinsp_regex::next_mark()
+{
+	if(++m_markgen == 0)
+	{
+		m_mark.assign(m_mark.size(), 0);
+		m_markgen = 1;
+	}
+}
+
+//
+// Add to res the states that are reachable from s without consuming a byte,
+// and that aren't marked yet. The '^' are crossed only if at_begin, the '$'
+// only if at_end; otherwise the '$' are kept in the set.
+//
+void sinsp_regex::add_closure(uint32_t s, bool at_begin, bool at_end, vector<uint32_t>* res)
+{
+	vector<uint32_t> stack;
+
+	stack.push_back(s);
+
+	while(!stack.empty())
+	{
+		s = stack.back();
+		stack.pop_back();
+
+		if(m_mark[s] == m_markgen)
+		{
+			continue;
+		}
+
+		m_mark[s] = m_markgen;
+
+		switch(m_states[s].m_op)
+		{
+		case RO_SPLIT:
+			stack.push_back(m_states[s].m_out1);
+			stack.push_back(m_states[s].m_out);
+			break;
+		case RO_JMP:
+			stack.push_back(m_states[s].m_out);
+			break;
+		case RO_BOL:
+			if(at_begin)
+			{
+				stack.push_back(m_states[s].m_out);
+			}
+			break;
+		case RO_EOL:
+			if(at_end)
+			{
+				stack.push_back(m_states[s].m_out);
+			}
+			else
+			{
+				res->push_back(s);
+			}
+			break;
+		default:
+			res->push_back(s);
+			break;
+		}
+	}
+}
+
+//
+// Return true if the expression matches when the string ends in nfa
+//
+bool sinsp_regex::matches_at_end(const vector<uint32_t>& nfa, bool at_begin)
+{
+	vector<uint32_t> end_states;
+	uint32_t j;
+
+	next_mark();
+
+	for(j = 0; j < nfa.size(); j++)
+	{
+		uint32_t s = nfa[j];
+
+		if(m_states[s].m_op == RO_MATCH)
+		{
+			return true;
+		}
+		else if(m_states[s].m_op == RO_EOL)
+		{
+			add_closure(m_states[s].m_out, at_begin, true, &end_states);
+		}
+	}
+
+	for(j = 0; j < end_states.size(); j++)
+	{
+		if(m_states[end_states[j]].m_op == RO_MATCH)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+//
+// Set dst to the states that follow the ones of src after byte b, sorted
+//
+void sinsp_regex::step(const vector<uint32_t>& src, uint8_t b, vector<uint32_t>* dst)
+{
+	uint32_t j;
+
+	dst->clear();
+	next_mark();
+
+	for(j = 0; j < src.size(); j++)
+	{
+		const nfa_state& s = m_states[src[j]];
+
+		if(s.m_op == RO_BYTE && sr_set_contains(m_sets[s.m_set].m_bits, b))
+		{
+			add_closure(s.m_out, false, false, dst);
+		}
+	}
+
+	//
+	// A match can also start at the next byte
+	//
+	for(j = 0; j < m_restart.size(); j++)
+	{
+		if(m_mark[m_restart[j]] != m_markgen)
+		{
+			m_mark[m_restart[j]] = m_markgen;
+			dst->push_back(m_restart[j]);
+		}
+	}
+
+	sort(dst->begin(), dst->end());
+}
+
+uint32_t sinsp_regex::add_dfa_state(vector<uint32_t>* nfa, bool at_begin)
+{
+	uint32_t id = (uint32_t)m_dfa.size();
+	uint32_t j;
+
+	m_dfa.push_back(dfa_state());
+	dfa_state* ds = &m_dfa.back();
+
+	ds->m_nfa.swap(*nfa);
+	ds->m_match = false;
+	ds->m_dead = ds->m_nfa.empty();
+
+	for(j = 0; j < ds->m_nfa.size(); j++)
+	{
+		if(m_states[ds->m_nfa[j]].m_op == RO_MATCH)
+		{
+			ds->m_match = true;
+		}
+	}
+
+	ds->m_match_at_end = matches_at_end(ds->m_nfa, at_begin);
+
+	//
+	// The start state crosses the '^', so it's never shared with the others
+	//
+	if(!at_begin)
+	{
+		m_dfa_ids[ds->m_nfa] = id;
+	}
+
+	m_next.resize(m_next.size() + m_nclasses, SR_UNKNOWN);
+	return id;
+}
+
+uint32_t sinsp_regex::add_transition(uint32_t from, uint32_t cls)
+{
+	vector<uint32_t> nfa;
+	map<vector<uint32_t>, uint32_t>::iterator it;
+	uint32_t id;
+
+	step(m_dfa[from].m_nfa, m_class_byte[cls], &nfa);
+
+	it = m_dfa_ids.find(nfa);
+	if(it != m_dfa_ids.end())
+	{
+		id = it->second;
+	}
+	else if(m_dfa.size() >= SP_REGEX_MAX_DFA_STATES)
+	{
+		//
+		// The cache is full: start over, from the target state. The
+		// transition isn't recorded, since its source is gone.
+		//
+		reset_cache();
+		return add_dfa_state(&nfa, false);
+	}
+	else
+	{
+		id = add_dfa_state(&nfa, false);
+	}
+
+	m_next[from * m_nclasses + cls] = id;
+	return id;
+}
+
+void sinsp_regex::reset_cache()
+{
+	vector<uint32_t> nfa;
+
+	m_dfa.clear();
+	m_next.clear();
+	m_dfa_ids.clear();
+	m_nresets++;
+
+	next_mark();
+	add_closure(m_start, true, false, &nfa);
+	sort(nfa.begin(), nfa.end());
+	add_dfa_state(&nfa, true);
+}
+
+//
+// Continue the match of the len bytes of s from the states in cur, without
+// building the deterministic states
+//
+bool sinsp_regex::match_nfa(const uint8_t* s, uint32_t len, vector<uint32_t>* cur)
+{
+	vector<uint32_t> next;
+	uint32_t j;
+	uint32_t k;
+
+	for(j = 0; j < len; j++)
+	{
+		step(*cur, s[j], &next);
+		cur->swap(next);
+
+		for(k = 0; k < cur->size(); k++)
+		{
+			if(m_states[(*cur)[k]].m_op == RO_MATCH)
+			{
+				return true;
+			}
+		}
+
+		if(cur->empty())
+		{
+			return false;
+		}
+	}
+
+	return matches_at_end(*cur, false);
+}
+
+bool sinsp_regex::match(const char* str, uint32_t len)
+{
+	const uint8_t* s = (const uint8_t*)str;
+	uint32_t nresets = m_nresets;
+	uint32_t state = 0;
+	uint32_t j;
+
+	ASSERT(m_compiled);
+
+	if(m_dfa[0].m_match)
+	{
+		return true;
+	}
+
+	for(j = 0; j < len; j++)
+	{
+		uint32_t cls = m_class[s[j]];
+		uint32_t next = m_next[state * m_nclasses + cls];
+
+		if(next == SR_UNKNOWN)
+		{
+			//
+			// If this string keeps filling the cache, the states are not
+			// reused, and building them costs more than following the
+			// Thompson automaton directly
+			//
+			if(m_nresets - nresets >= SR_MAX_RESETS_PER_MATCH)
+			{
+				vector<uint32_t> cur = m_dfa[state].m_nfa;
+
+				return match_nfa(s + j, len - j, &cur);
+			}
+
+			next = add_transition(state, cls);
+		}
+
+		state = next;
+
+		if(m_dfa[state].m_match)
+		{
+			return true;
+		}
+		else if(m_dfa[state].m_dead)
+		{
+			return false;
+		}
+	}
+
+	return m_dfa[state].m_match_at_end;
+}
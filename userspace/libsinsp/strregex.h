@@ -0,0 +1,179 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+///////////////////////////////////////////////////////////////////////////////
+// Regular expression of the 'matches' filters. The syntax is a subset of the
+// POSIX extended one: literals, '.', bracket expressions (with ranges,
+// negation and the [:class:] names), '*', '+', '?', '{m,n}', '|', groups,
+// '^', '$' and the \d \w \s escapes, with their negations.
+// The expression is turned into a Thompson automaton when it's compiled, and
+// a deterministic automaton is built from it lazily while matching. Each
+// byte of the strings is looked at once, so the matching time is linear in
+// their length, whatever the expression; there's no backtracking. The
+// states of the deterministic automaton are cached, and the cache is
+// emptied when it grows too large. The rest of a string that keeps filling
+// it is matched with the Thompson automaton alone.
+///////////////////////////////////////////////////////////////////////////////
+class SINSP_PUBLIC sinsp_regex
+{
+public:
+	sinsp_regex();
+
+	//
+	// Compile the expression. Throws a sinsp_exception if it's not valid.
+	//
+	void compile(const string& pattern);
+
+	//
+	// Return true if the expression matches somewhere in the len bytes of
+	// str, like grep -E does
+	//
+	bool match(const char* str, uint32_t len);
+
+	const string& get_pattern()
+	{
+		return m_pattern;
+	}
+
+private:
+	struct byte_set
+	{
+		uint32_t m_bits[8];
+	};
+
+	//
+	// Node of the syntax tree, which is only kept while compiling
+	//
+	enum node_type
+	{
+		RN_SET, // One byte of m_sets[m_set]
+		RN_EMPTY,
+		RN_CAT,
+		RN_ALT,
+		RN_REPEAT, // Between m_min and m_max repetitions, m_max is -1 if there's no limit
+		RN_BOL,
+		RN_EOL,
+	};
+
+	struct node
+	{
+		node_type m_type;
+		uint32_t m_set;
+		uint32_t m_left;
+		uint32_t m_right;
+		int32_t m_min;
+		int32_t m_max;
+	};
+
+	//
+	// State of the Thompson automaton
+	//
+	enum nfa_op
+	{
+		RO_BYTE, // Consume a byte of m_sets[m_set] and go to m_out
+		RO_SPLIT, // Go to m_out and m_out1
+		RO_JMP, // Go to m_out
+		RO_BOL, // Go to m_out at the start of the string
+		RO_EOL, // Go to m_out at the end of the string
+		RO_MATCH,
+	};
+
+	struct nfa_state
+	{
+		nfa_op m_op;
+		uint32_t m_set;
+		uint32_t m_out;
+		uint32_t m_out1;
+	};
+
+	//
+	// Piece of the Thompson automaton while it's built. m_outs are its
+	// dangling transitions, as state * 2 for m_out and state * 2 + 1 for
+	// m_out1.
+	//
+	struct fragment
+	{
+		uint32_t m_start;
+		vector<uint32_t> m_outs;
+	};
+
+	//
+	// State of the deterministic automaton, which is a set of states of
+	// the Thompson one
+	//
+	struct dfa_state
+	{
+		vector<uint32_t> m_nfa; // Sorted, only the RO_BYTE, RO_EOL and RO_MATCH states
+		bool m_match; // The expression matched before reaching this state
+		bool m_match_at_end; // The expression matches if the string ends here
+		bool m_dead; // No match is possible from this state
+	};
+
+	//
+	// Parsing
+	//
+	uint32_t parse_alternation(vector<node>* nodes, uint32_t depth);
+	uint32_t parse_concatenation(vector<node>* nodes, uint32_t depth);
+	uint32_t parse_repetition(vector<node>* nodes, uint32_t depth);
+	uint32_t parse_atom(vector<node>* nodes, uint32_t depth);
+	void parse_bracket(byte_set* set);
+	bool parse_escape(byte_set* set, uint8_t* byte);
+	bool parse_count(int32_t* res);
+	uint32_t add_node(vector<node>* nodes, node_type type, uint32_t left, uint32_t right);
+	uint32_t add_set(const byte_set& set);
+	void error(const string& msg);
+
+	//
+	// Thompson automaton
+	//
+	void emit(const vector<node>& nodes, uint32_t n, fragment* res);
+	uint32_t add_state(nfa_op op, uint32_t set, uint32_t out, uint32_t out1);
+	void patch(const vector<uint32_t>& outs, uint32_t target);
+	void build_classes();
+
+	//
+	// Deterministic automaton
+	//
+	void add_closure(uint32_t s, bool at_begin, bool at_end, vector<uint32_t>* res);
+	bool matches_at_end(const vector<uint32_t>& nfa, bool at_begin);
+	void step(const vector<uint32_t>& src, uint8_t b, vector<uint32_t>* dst);
+	uint32_t add_dfa_state(vector<uint32_t>* nfa, bool at_begin);
+	uint32_t add_transition(uint32_t from, uint32_t cls);
+	void next_mark();
+	void reset_cache();
+	bool match_nfa(const uint8_t* s, uint32_t len, vector<uint32_t>* cur);
+
+	string m_pattern;
+	uint32_t m_pos; // Parsing position in m_pattern
+	vector<byte_set> m_sets;
+	vector<nfa_state> m_states;
+	uint32_t m_start;
+	vector<uint32_t> m_restart; // Closure of m_start, for the matches that start after the first byte
+	uint8_t m_class[256]; // Byte to transition column
+	uint32_t m_nclasses;
+	uint8_t m_class_byte[256]; // One byte of each class
+	vector<dfa_state> m_dfa; // m_dfa[0] is the state at the start of the strings
+	vector<uint32_t> m_next; // m_dfa.size() * m_nclasses transitions, SR_UNKNOWN if not built yet
+	map<vector<uint32_t>, uint32_t> m_dfa_ids;
+	vector<uint32_t> m_mark; // Closure visit marks
+	uint32_t m_markgen;
+	uint32_t m_nresets; // Number of times the cache was emptied
+	bool m_compiled;
+};
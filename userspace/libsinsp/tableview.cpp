@@ -0,0 +1,376 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <json/json.h>
+
+#include "sinsp.h"
+#include "sinsp_int.h"
+#include "fieldaggr.h"
+#include "tableview.h"
+
+//
+// Width of the value column, like the extend_string() of the Lua chisels it
+// doesn't truncate
+//
+#define TABLE_VIEW_VALUE_WIDTH 10
+
+///////////////////////////////////////////////////////////////////////////////
+// sinsp_table_view implementation
+///////////////////////////////////////////////////////////////////////////////
+sinsp_table_view::sinsp_table_view(sinsp_field_aggregator* aggr, bool json, bool incremental)
+{
+	m_aggr = aggr;
+	m_json = json;
+	m_incremental = incremental;
+	m_top_number = 0;
+	m_units = TU_NONE;
+	m_rendered = false;
+}
+
+bool sinsp_table_view::parse_units(const string& name, OUT units* res)
+{
+	if(name == "none")
+	{
+		*res = TU_NONE;
+	}
+	else if(name == "bytes")
+	{
+		*res = TU_BYTES;
+	}
+	else if(name == "time")
+	{
+		*res = TU_TIME;
+	}
+	else if(name == "timepct")
+	{
+		*res = TU_TIMEPCT;
+	}
+	else
+	{
+		return false;
+	}
+
+	return true;
+}
+
+void sinsp_table_view::set_key(const string& fldname, const string& desc)
+{
+	m_key_fld = fldname;
+	m_key_desc = desc;
+}
+
+void sinsp_table_view::set_value(const string& fldname, const string& desc, units value_units)
+{
+	m_value_fld = fldname;
+	m_value_desc = desc;
+	m_units = value_units;
+}
+
+void sinsp_table_view::reset()
+{
+	m_rendered = false;
+	m_lines.clear();
+	m_rows.clear();
+}
+
+void sinsp_table_view::render(uint64_t ts, uint64_t delta, OUT string* res)
+{
+	vector<const sinsp_field_aggregator::entry*> top;
+
+	m_aggr->get_top(m_top_number, &top);
+	res->clear();
+
+	if(m_json)
+	{
+		render_json(top, ts, res);
+	}
+	else
+	{
+		render_text(top, delta, res);
+	}
+
+	m_rendered = true;
+}
+
+//
+// Same formats as format_bytes() and format_time_interval() in common.lua
+//
+void sinsp_table_view::format_value(double value, uint64_t delta, OUT string* res)
+{
+	char buf[64];
+	uint64_t v = (value > 0)? (uint64_t)value : 0;
+	const uint64_t one_s = ONE_SECOND_IN_NS;
+
+	switch(m_units)
+	{
+	case TU_BYTES:
+		if(value > 1024.0 * 1024 * 1024 * 1024 * 1024)
+		{
+			snprintf(buf, sizeof(buf), "%.2fP", value / (1024.0 * 1024 * 1024 * 1024 * 1024));
+		}
+		else if(value > 1024.0 * 1024 * 1024 * 1024)
+		{
+			snprintf(buf, sizeof(buf), "%.2fT", value / (1024.0 * 1024 * 1024 * 1024));
+		}
+		else if(value > 1024.0 * 1024 * 1024)
+		{
+			snprintf(buf, sizeof(buf), "%.2fG", value / (1024.0 * 1024 * 1024));
+		}
+		else if(value > 1024.0 * 1024)
+		{
+			snprintf(buf, sizeof(buf), "%.2fM", value / (1024.0 * 1024));
+		}
+		else if(value > 1024)
+		{
+			snprintf(buf, sizeof(buf), "%.2fKB", value / 1024);
+		}
+		else
+		{
+			snprintf(buf, sizeof(buf), "%" PRIu64 "B", v);
+		}
+		break;
+	case TU_TIME:
+		if(v >= one_s)
+		{
+			snprintf(buf, sizeof(buf), "%" PRIu64 ".%02" PRIu64 "s", v / one_s, (v % one_s) / 10000000);
+		}
+		else if(v >= one_s / 100)
+		{
+			snprintf(buf, sizeof(buf), "%" PRIu64 "ms", v / 1000000);
+		}
+		else if(v >= one_s / 1000)
+		{
+			snprintf(buf, sizeof(buf), "%" PRIu64 ".%02" PRIu64 "ms", v / 1000000, (v % 1000000) / 10000);
+		}
+		else if(v >= one_s / 100000)
+		{
+			snprintf(buf, sizeof(buf), "%" PRIu64 "us", v / 1000);
+		}
+		else if(v >= one_s / 1000000)
+		{
+			snprintf(buf, sizeof(buf), "%" PRIu64 ".%02" PRIu64 "us", v / 1000, (v % 1000) / 10);
+		}
+		else
+		{
+			snprintf(buf, sizeof(buf), "%" PRIu64 "ns", v);
+		}
+		break;
+	case TU_TIMEPCT:
+		if(delta != 0)
+		{
+			snprintf(buf, sizeof(buf), "%.2f%%", value / delta * 100);
+		}
+		else
+		{
+			snprintf(buf, sizeof(buf), "0.00%%");
+		}
+		break;
+	default:
+		snprintf(buf, sizeof(buf), "%.14g", value);
+		break;
+	}
+
+	res->assign(buf);
+
+	if(res->size() < TABLE_VIEW_VALUE_WIDTH)
+	{
+		res->append(TABLE_VIEW_VALUE_WIDTH - res->size(), ' ');
+	}
+}
+
+void sinsp_table_view::render_text(const vector<const pair<const string, double>*>& top, uint64_t delta, OUT string* res)
+{
+	vector<string> lines;
+	string line;
+	char buf[32];
+	uint32_t j;
+
+	line = m_value_desc;
+	if(line.size() < TABLE_VIEW_VALUE_WIDTH)
+	{
+		line.append(TABLE_VIEW_VALUE_WIDTH - line.size(), ' ');
+	}
+	line += m_key_desc;
+	lines.push_back(line);
+	lines.push_back("------------------------------");
+
+	for(j = 0; j < top.size(); j++)
+	{
+		format_value(top[j]->second, delta, &line);
+		m_aggr->key_to_string(top[j]->first, &m_keystr);
+		line += m_keystr;
+		lines.push_back(line);
+	}
+
+	if(!m_incremental)
+	{
+		for(j = 0; j < lines.size(); j++)
+		{
+			res->append(lines[j]);
+			res->push_back('\n');
+		}
+
+		return;
+	}
+
+	//
+	// Clear the screen the first time, then only rewrite the lines that
+	// changed and blank the ones that are no longer used
+	//
+	if(!m_rendered)
+	{
+		res->append("\x1b[2J");
+		m_lines.clear();
+	}
+
+	for(j = 0; j < lines.size(); j++)
+	{
+		if(j < m_lines.size() && m_lines[j] == lines[j])
+		{
+			continue;
+		}
+
+		snprintf(buf, sizeof(buf), "\x1b[%u;1H", j + 1);
+		res->append(buf);
+		res->append(lines[j]);
+		res->append("\x1b[K");
+	}
+
+	for(; j < m_lines.size(); j++)
+	{
+		snprintf(buf, sizeof(buf), "\x1b[%u;1H\x1b[2K", j + 1);
+		res->append(buf);
+	}
+
+	m_lines.swap(lines);
+}
+
+//
+// Numeric and boolean keys of one field are json numbers and booleans, like
+// the keys of chisel.get_aggregation() are for the Lua chisels
+//
+static Json::Value key_to_json(sinsp_field_aggregator* aggr, const string& key, vector<sinsp_field_value>* vals, string* keystr)
+{
+	aggr->get_key_values(key, vals);
+
+	if(vals->size() == 1)
+	{
+		switch(vals->at(0).m_kind)
+		{
+		case SFV_INT:
+			return Json::Value((Json::Value::Int64)vals->at(0).m_int);
+		case SFV_UINT:
+			return Json::Value((Json::Value::UInt64)vals->at(0).m_uint);
+		case SFV_BOOL:
+			return Json::Value(vals->at(0).m_uint != 0);
+		default:
+			break;
+		}
+	}
+
+	aggr->key_to_string(key, keystr);
+	return Json::Value(*keystr);
+}
+
+//
+// A full document is {ts, data: [[key, value], ...], info: [columns]}. The
+// incremental ones that follow are {ts, delta: true, data, removed: [keys]},
+// with only the rows that changed in data.
+//
+void sinsp_table_view::render_json(const vector<const pair<const string, double>*>& top, uint64_t ts, OUT string* res)
+{
+	Json::Value root;
+	Json::FastWriter writer;
+	Json::Value& data = root["data"];
+	bool delta = m_incremental && m_rendered;
+	uint32_t j;
+
+	root["ts"] = to_string((long long unsigned int)ts);
+	data = Json::Value(Json::arrayValue);
+
+	if(delta)
+	{
+		unordered_map<string, double> rows;
+
+		root["delta"] = true;
+
+		for(j = 0; j < top.size(); j++)
+		{
+			unordered_map<string, double>::iterator it = m_rows.find(top[j]->first);
+
+			if(it == m_rows.end() || it->second != top[j]->second)
+			{
+				Json::Value row(Json::arrayValue);
+
+				row.append(key_to_json(m_aggr, top[j]->first, &m_vals, &m_keystr));
+				row.append(top[j]->second);
+				data.append(row);
+			}
+
+			if(it != m_rows.end())
+			{
+				m_rows.erase(it);
+			}
+
+			rows[top[j]->first] = top[j]->second;
+		}
+
+		Json::Value& removed = root["removed"];
+		removed = Json::Value(Json::arrayValue);
+
+		for(unordered_map<string, double>::iterator it = m_rows.begin(); it != m_rows.end(); ++it)
+		{
+			removed.append(key_to_json(m_aggr, it->first, &m_vals, &m_keystr));
+		}
+
+		m_rows.swap(rows);
+	}
+	else
+	{
+		m_rows.clear();
+
+		for(j = 0; j < top.size(); j++)
+		{
+			Json::Value row(Json::arrayValue);
+
+			row.append(key_to_json(m_aggr, top[j]->first, &m_vals, &m_keystr));
+			row.append(top[j]->second);
+			data.append(row);
+
+			if(m_incremental)
+			{
+				m_rows[top[j]->first] = top[j]->second;
+			}
+		}
+
+		Json::Value& info = root["info"];
+		Json::Value col;
+
+		col["name"] = m_key_fld;
+		col["desc"] = m_key_desc;
+		col["is_key"] = true;
+		info.append(col);
+
+		col["name"] = m_value_fld;
+		col["desc"] = m_value_desc;
+		col["is_key"] = false;
+		info.append(col);
+	}
+
+	res->assign(writer.write(root));
+}
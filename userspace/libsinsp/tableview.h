@@ -0,0 +1,93 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+class sinsp_field_aggregator;
+
+///////////////////////////////////////////////////////////////////////////////
+// Renders the groups of a sinsp_field_aggregator as the table of the table
+// chisels: a value column and a key column, sorted by value, as text or
+// json. The Lua side only describes the columns.
+//
+// In incremental mode, for the live captures that redraw the table at each
+// interval, only what changed since the previous render is output: the text
+// lines that differ are rewritten in place with ANSI escapes, and the json
+// documents after the first one only have the rows that are new or whose
+// value changed, plus the keys of the rows that went away.
+///////////////////////////////////////////////////////////////////////////////
+class SINSP_PUBLIC sinsp_table_view
+{
+public:
+	enum units
+	{
+		TU_NONE,
+		TU_BYTES,
+		TU_TIME,
+		TU_TIMEPCT,
+	};
+
+	sinsp_table_view(sinsp_field_aggregator* aggr, bool json, bool incremental);
+
+	//
+	// Return false if name is not one of none, bytes, time and timepct
+	//
+	static bool parse_units(const string& name, OUT units* res);
+
+	void set_key(const string& fldname, const string& desc);
+	void set_value(const string& fldname, const string& desc, units value_units);
+
+	//
+	// Show the n groups with the largest values, all of them if n is 0
+	//
+	void set_top_number(uint32_t n)
+	{
+		m_top_number = n;
+	}
+
+	//
+	// Render the current groups of the aggregator. delta is the duration of
+	// the interval, for TU_TIMEPCT.
+	//
+	void render(uint64_t ts, uint64_t delta, OUT string* res);
+
+	//
+	// Make the next render a full one, e.g. after the screen was cleared
+	//
+	void reset();
+
+private:
+	void format_value(double value, uint64_t delta, OUT string* res);
+	void render_text(const vector<const pair<const string, double>*>& top, uint64_t delta, OUT string* res);
+	void render_json(const vector<const pair<const string, double>*>& top, uint64_t ts, OUT string* res);
+
+	sinsp_field_aggregator* m_aggr;
+	bool m_json;
+	bool m_incremental;
+	uint32_t m_top_number;
+	string m_key_fld;
+	string m_key_desc;
+	string m_value_fld;
+	string m_value_desc;
+	units m_units;
+	bool m_rendered; // Something was output since the last reset()
+	vector<string> m_lines; // The text lines on the screen
+	unordered_map<string, double> m_rows; // The json rows of the consumer, by key
+	vector<sinsp_field_value> m_vals;
+	string m_keystr;
+};
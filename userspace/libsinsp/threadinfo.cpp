@@ -32,6 +32,151 @@ static void copy_ipv6_address(uint32_t* dest, uint32_t* src)
 	dest[3] = src[3];
 }
 
+static void free_scap_proc(scap_threadinfo* pi)
+{
+	scap_fdinfo* fdi;
+	scap_fdinfo* tfdi;
+
+	HASH_ITER(hh, pi->fdlist, fdi, tfdi)
+	{
+		HASH_DEL(pi->fdlist, fdi);
+		free(fdi);
+	}
+
+	free(pi);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// sinsp_evt_buffer_pool implementation
+///////////////////////////////////////////////////////////////////////////////
+sinsp_evt_buffer_pool::sinsp_evt_buffer_pool()
+{
+	m_nbytes = 0;
+}
+
+sinsp_evt_buffer_pool::~sinsp_evt_buffer_pool()
+{
+	uint32_t j;
+
+	for(j = 0; j < SP_EVT_BUF_NCLASSES; j++)
+	{
+		vector<uint8_t*>::iterator it;
+
+		for(it = m_free_lists[j].begin(); it != m_free_lists[j].end(); ++it)
+		{
+			delete[] *it;
+		}
+	}
+}
+
+uint8_t* sinsp_evt_buffer_pool::alloc(uint32_t size, OUT uint32_t* sclass)
+{
+	uint32_t j;
+
+	for(j = 0; j < SP_EVT_BUF_NCLASSES; j++)
+	{
+		if(size <= get_class_size(j))
+		{
+			*sclass = j;
+
+			if(m_free_lists[j].empty())
+			{
+				m_nbytes += get_class_size(j);
+				return new uint8_t[get_class_size(j)];
+			}
+
+			uint8_t* res = m_free_lists[j].back();
+			m_free_lists[j].pop_back();
+			return res;
+		}
+	}
+
+	return NULL;
+}
+
+void sinsp_evt_buffer_pool::free(uint8_t* buf, uint32_t sclass)
+{
+	ASSERT(sclass < SP_EVT_BUF_NCLASSES);
+	m_free_lists[sclass].push_back(buf);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// sinsp_evt_buffer implementation
+///////////////////////////////////////////////////////////////////////////////
+sinsp_evt_buffer::sinsp_evt_buffer()
+{
+	m_data = NULL;
+	m_size = 0;
+	m_sclass = 0;
+	m_pool = NULL;
+}
+
+sinsp_evt_buffer::sinsp_evt_buffer(const sinsp_evt_buffer& other)
+{
+	m_data = NULL;
+	m_size = 0;
+	m_sclass = 0;
+	m_pool = NULL;
+	*this = other;
+}
+
+sinsp_evt_buffer::~sinsp_evt_buffer()
+{
+	release();
+}
+
+sinsp_evt_buffer& sinsp_evt_buffer::operator=(const sinsp_evt_buffer& other)
+{
+	if(this == &other)
+	{
+		return *this;
+	}
+
+	if(other.m_data == NULL)
+	{
+		release();
+	}
+	else if(reserve(other.m_pool, other.m_size) != NULL)
+	{
+		memcpy(m_data, other.m_data, other.m_size);
+	}
+
+	return *this;
+}
+
+uint8_t* sinsp_evt_buffer::reserve(sinsp_evt_buffer_pool* pool, uint32_t size)
+{
+	if(m_data != NULL)
+	{
+		if(pool == m_pool && size <= sinsp_evt_buffer_pool::get_class_size(m_sclass))
+		{
+			m_size = size;
+			return m_data;
+		}
+
+		release();
+	}
+
+	m_data = pool->alloc(size, &m_sclass);
+	if(m_data != NULL)
+	{
+		m_size = size;
+		m_pool = pool;
+	}
+
+	return m_data;
+}
+
+void sinsp_evt_buffer::release()
+{
+	if(m_data != NULL)
+	{
+		m_pool->free(m_data, m_sclass);
+		m_data = NULL;
+		m_size = 0;
+	}
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // sinsp_threadinfo implementation
 ///////////////////////////////////////////////////////////////////////////////
@@ -64,12 +209,34 @@ void sinsp_threadinfo::init()
 	m_nchilds = 0;
 	m_fdlimit = -1;
 	m_fd_usage_pct = 0;
+	m_container_num = SINSP_HOST_CONTAINER_NUM;
 	m_main_thread = NULL;
 	m_main_program_thread = NULL;
+	m_parent_thread = NULL;
+	m_parent_tid = -1;
+	m_parent_generation = 0;
+	m_lru_prev = NULL;
+	m_lru_next = NULL;
+	m_lru_ts = 0;
+	m_drop_gen = (m_inspector != NULL)? m_inspector->m_drop_gen : 0;
+	m_stale_gen = 0;
 	m_lastevent_fd = 0;
+	m_switch_exectime = 0;
+	m_switch_vcsw = 0;
+	m_switch_ivcsw = 0;
+	m_switch_exectime_delta = 0;
+	m_switch_vcsw_delta = 0;
+	m_switch_ivcsw_delta = 0;
+	m_pfmajor = 0;
+	m_pfminor = 0;
+	m_io.clear();
 #ifdef HAS_FILTERING
 	m_last_latency_entertime = 0;
 	m_latency = 0;
+	m_offcpu = 0;
+	m_offcpu_start = 0;
+	m_check_results.clear();
+	m_state_gen = 0;
 #endif
 	m_ainfo = NULL;
 }
@@ -97,12 +264,14 @@ void sinsp_threadinfo::fix_sockets_coming_from_proc()
 {
 	unordered_map<int64_t, sinsp_fdinfo_t>::iterator it;
 
+	m_fdtable.unshare();
+
 	for(it = m_fdtable.m_table.begin(); it != m_fdtable.m_table.end(); it++)
 	{
 		if(it->second.m_type == SCAP_FD_IPV4_SOCK)
 		{
-			if(m_inspector->m_thread_manager->m_server_ports.find(it->second.m_sockinfo.m_ipv4info.m_fields.m_sport) !=
-				m_inspector->m_thread_manager->m_server_ports.end())
+			if(m_inspector->m_thread_manager->m_server_ports.contains(it->second.m_sockinfo.m_ipv4info.m_fields.m_l4proto,
+				it->second.m_sockinfo.m_ipv4info.m_fields.m_sport))
 			{
 				uint32_t tip;
 				uint16_t tport;
@@ -115,7 +284,7 @@ void sinsp_threadinfo::fix_sockets_coming_from_proc()
 				it->second.m_sockinfo.m_ipv4info.m_fields.m_sport = it->second.m_sockinfo.m_ipv4info.m_fields.m_dport;
 				it->second.m_sockinfo.m_ipv4info.m_fields.m_dport = tport;
 
-				it->second.m_name = ipv4tuple_to_string(&it->second.m_sockinfo.m_ipv4info);
+				it->second.m_name.set(get_string_pool(), ipv4tuple_to_string(&it->second.m_sockinfo.m_ipv4info));
 
 				it->second.set_role_server();
 			}
@@ -131,8 +300,8 @@ void sinsp_threadinfo::init(const scap_threadinfo* pi)
 {
 	scap_fdinfo *fdi;
 	scap_fdinfo *tfdi;
-	sinsp_fdinfo_t newfdi;
-	string tcomm(pi->comm);
+	sinsp_string_pool* pool = get_string_pool();
+	size_t commlen = strlen(pi->comm);
 
 	init();
 
@@ -140,21 +309,19 @@ void sinsp_threadinfo::init(const scap_threadinfo* pi)
 	m_pid = pi->pid;
 	m_ptid = pi->ptid;
 
-	m_comm = pi->comm;
+	m_comm.set(pool, pi->comm, commlen);
 
-	if(tcomm == "" || tcomm[tcomm.length() - 1] == '/')
+	if(commlen == 0 || pi->comm[commlen - 1] == '/')
 	{
-		string ts(pi->exe);
+		const char* commbegin = strrchr(pi->exe, '/');
 
-		size_t commbegin = ts.rfind('/');
-
-		if(commbegin != string::npos)
+		if(commbegin != NULL)
 		{
-			m_comm = ts.substr(commbegin + 1);
+			m_comm.set(pool, commbegin + 1, strlen(commbegin + 1));
 		}
 	}
 
-	m_exe = pi->exe;
+	m_exe.set(pool, pi->exe, strlen(pi->exe));
 	set_args(pi->args, pi->args_len);
 	set_cwd(pi->cwd, strlen(pi->cwd));
 	m_flags |= pi->flags;
@@ -162,140 +329,389 @@ void sinsp_threadinfo::init(const scap_threadinfo* pi)
 	m_fdlimit = pi->fdlimit;
 	m_uid = pi->uid;
 	m_gid = pi->gid;
+	m_container_num = m_inspector->m_container_manager.intern(pi->cgroup);
 
 	HASH_ITER(hh, pi->fdlist, fdi, tfdi)
 	{
-		bool do_add = true;
+		add_fd_from_scap(fdi);
+	}
+}
+
+//
+// Add an fd of the scap representation, from /proc or from the driver, to
+// the fd table. Returns NULL if the fd type is not supported.
+//
+sinsp_fdinfo_t* sinsp_threadinfo::add_fd_from_scap(scap_fdinfo* fdi)
+{
+	sinsp_fdinfo_t newfdi;
+	sinsp_string_pool* pool = get_string_pool();
 
-		newfdi.m_type = fdi->type;
-		newfdi.m_openflags = 0;
-		newfdi.m_type = fdi->type;
-		newfdi.m_flags = sinsp_fdinfo_t::FLAGS_FROM_PROC;
-		newfdi.m_ino = fdi->ino;
+	newfdi.m_type = fdi->type;
+	newfdi.m_openflags = 0;
+	newfdi.m_flags = sinsp_fdinfo_t::FLAGS_FROM_PROC;
+	newfdi.m_ino = fdi->ino;
 
-		switch(newfdi.m_type)
+	switch(newfdi.m_type)
+	{
+	case SCAP_FD_IPV4_SOCK:
+		newfdi.m_sockinfo.m_ipv4info.m_fields.m_sip = fdi->info.ipv4info.sip;
+		newfdi.m_sockinfo.m_ipv4info.m_fields.m_dip = fdi->info.ipv4info.dip;
+		newfdi.m_sockinfo.m_ipv4info.m_fields.m_sport = fdi->info.ipv4info.sport;
+		newfdi.m_sockinfo.m_ipv4info.m_fields.m_dport = fdi->info.ipv4info.dport;
+		newfdi.m_sockinfo.m_ipv4info.m_fields.m_l4proto = fdi->info.ipv4info.l4proto;
+		m_inspector->get_ifaddr_list()->update_fd(&newfdi);
+		newfdi.m_name.set(pool, ipv4tuple_to_string(&newfdi.m_sockinfo.m_ipv4info));
+		break;
+	case SCAP_FD_IPV4_SERVSOCK:
+		newfdi.m_sockinfo.m_ipv4serverinfo.m_ip = fdi->info.ipv4serverinfo.ip;
+		newfdi.m_sockinfo.m_ipv4serverinfo.m_port = fdi->info.ipv4serverinfo.port;
+		newfdi.m_sockinfo.m_ipv4serverinfo.m_l4proto = fdi->info.ipv4serverinfo.l4proto;
+		newfdi.m_name.set(pool, ipv4serveraddr_to_string(&newfdi.m_sockinfo.m_ipv4serverinfo));
+		
+		//
+		// We keep note of all the host bound server ports.
+		// We'll need them later when patching connections direction.
+		//
+		m_inspector->m_thread_manager->m_server_ports.add(m_pid,
+			fdi->fd,
+			newfdi.m_sockinfo.m_ipv4serverinfo.m_l4proto,
+			newfdi.m_sockinfo.m_ipv4serverinfo.m_port);
+
+		break;
+	case SCAP_FD_IPV6_SOCK:
+		if(sinsp_utils::is_ipv4_mapped_ipv6((uint8_t*)&fdi->info.ipv6info.sip) && 
+			sinsp_utils::is_ipv4_mapped_ipv6((uint8_t*)&fdi->info.ipv6info.dip))
 		{
-		case SCAP_FD_IPV4_SOCK:
-			newfdi.m_sockinfo.m_ipv4info.m_fields.m_sip = fdi->info.ipv4info.sip;
-			newfdi.m_sockinfo.m_ipv4info.m_fields.m_dip = fdi->info.ipv4info.dip;
-			newfdi.m_sockinfo.m_ipv4info.m_fields.m_sport = fdi->info.ipv4info.sport;
-			newfdi.m_sockinfo.m_ipv4info.m_fields.m_dport = fdi->info.ipv4info.dport;
-			newfdi.m_sockinfo.m_ipv4info.m_fields.m_l4proto = fdi->info.ipv4info.l4proto;
-			m_inspector->m_network_interfaces->update_fd(&newfdi);
-			newfdi.m_name = ipv4tuple_to_string(&newfdi.m_sockinfo.m_ipv4info);
-			break;
-		case SCAP_FD_IPV4_SERVSOCK:
-			newfdi.m_sockinfo.m_ipv4serverinfo.m_ip = fdi->info.ipv4serverinfo.ip;
-			newfdi.m_sockinfo.m_ipv4serverinfo.m_port = fdi->info.ipv4serverinfo.port;
-			newfdi.m_sockinfo.m_ipv4serverinfo.m_l4proto = fdi->info.ipv4serverinfo.l4proto;
-			newfdi.m_name = ipv4serveraddr_to_string(&newfdi.m_sockinfo.m_ipv4serverinfo);
-			
 			//
-			// We keep note of all the host bound server ports.
-			// We'll need them later when patching connections direction.
+			// This is an IPv4-mapped IPv6 addresses (http://en.wikipedia.org/wiki/IPv6#IPv4-mapped_IPv6_addresses).
+			// Convert it into the IPv4 representation.
 			//
-			m_inspector->m_thread_manager->m_server_ports.insert(newfdi.m_sockinfo.m_ipv4serverinfo.m_port);
+			newfdi.m_type = SCAP_FD_IPV4_SOCK;
+			newfdi.m_sockinfo.m_ipv4info.m_fields.m_sip = fdi->info.ipv6info.sip[3];
+			newfdi.m_sockinfo.m_ipv4info.m_fields.m_dip = fdi->info.ipv6info.dip[3];
+			newfdi.m_sockinfo.m_ipv4info.m_fields.m_sport = fdi->info.ipv6info.sport;
+			newfdi.m_sockinfo.m_ipv4info.m_fields.m_dport = fdi->info.ipv6info.dport;
+			newfdi.m_sockinfo.m_ipv4info.m_fields.m_l4proto = fdi->info.ipv6info.l4proto;
+			m_inspector->get_ifaddr_list()->update_fd(&newfdi);
+			newfdi.m_name.set(pool, ipv4tuple_to_string(&newfdi.m_sockinfo.m_ipv4info));
+		}
+		else
+		{
+			copy_ipv6_address(newfdi.m_sockinfo.m_ipv6info.m_fields.m_sip, fdi->info.ipv6info.sip);
+			copy_ipv6_address(newfdi.m_sockinfo.m_ipv6info.m_fields.m_dip, fdi->info.ipv6info.dip);
+			newfdi.m_sockinfo.m_ipv6info.m_fields.m_sport = fdi->info.ipv6info.sport;
+			newfdi.m_sockinfo.m_ipv6info.m_fields.m_dport = fdi->info.ipv6info.dport;
+			newfdi.m_sockinfo.m_ipv6info.m_fields.m_l4proto = fdi->info.ipv6info.l4proto;
+			newfdi.m_name.set(pool, ipv6tuple_to_string(&newfdi.m_sockinfo.m_ipv6info));
+		}
+		break;
+	case SCAP_FD_IPV6_SERVSOCK:
+		copy_ipv6_address(newfdi.m_sockinfo.m_ipv6serverinfo.m_ip, fdi->info.ipv6serverinfo.ip);
+		newfdi.m_sockinfo.m_ipv6serverinfo.m_port = fdi->info.ipv6serverinfo.port;
+		newfdi.m_sockinfo.m_ipv6serverinfo.m_l4proto = fdi->info.ipv6serverinfo.l4proto;
+		newfdi.m_name.set(pool, ipv6serveraddr_to_string(&newfdi.m_sockinfo.m_ipv6serverinfo));
+
+		//
+		// We keep note of all the host bound server ports.
+		// We'll need them later when patching connections direction.
+		//
+		m_inspector->m_thread_manager->m_server_ports.add(m_pid,
+			fdi->fd,
+			newfdi.m_sockinfo.m_ipv6serverinfo.m_l4proto,
+			newfdi.m_sockinfo.m_ipv6serverinfo.m_port);
+
+		break;
+	case SCAP_FD_UNIX_SOCK:
+		newfdi.m_sockinfo.m_unixinfo.m_fields.m_source = fdi->info.unix_socket_info.source;
+		newfdi.m_sockinfo.m_unixinfo.m_fields.m_dest = fdi->info.unix_socket_info.destination;
+		newfdi.m_name.set(pool, fdi->info.unix_socket_info.fname, strlen(fdi->info.unix_socket_info.fname));
+		if(newfdi.m_name.empty())
+		{
+			newfdi.set_role_client();
+		}
+		else
+		{
+			newfdi.set_role_server();
+		}
+		break;
+	case SCAP_FD_FIFO:
+	case SCAP_FD_FILE:
+	case SCAP_FD_DIRECTORY:
+	case SCAP_FD_UNSUPPORTED:
+	case SCAP_FD_SIGNALFD:
+	case SCAP_FD_EVENTPOLL:
+	case SCAP_FD_EVENT:
+	case SCAP_FD_INOTIFY:
+	case SCAP_FD_TIMERFD:
+		newfdi.m_name.set(pool, fdi->info.fname, strlen(fdi->info.fname));
+		break;
+	default:
+		ASSERT(false);
+		return NULL;
+	}
+
+	sinsp_fdinfo_t* added = m_fdtable.add(fdi->fd, &newfdi);
+
+	if(newfdi.m_type == SCAP_FD_FIFO || newfdi.m_type == SCAP_FD_UNIX_SOCK)
+	{
+		m_inspector->m_thread_manager->m_ipc_index.add(m_pid, fdi->fd, added);
+	}
+
+	return added;
+}
+
+//
+// The reverse of init(): build the scap representation of this thread, with
+// its fd table. The result is allocated with malloc() and must be freed with
+// sinsp_thread_manager::free_scap_table().
+//
+scap_threadinfo* sinsp_threadinfo::to_scap()
+{
+	unordered_map<int64_t, sinsp_fdinfo_t>::iterator it;
+	scap_threadinfo* pi;
+	scap_fdinfo* fdi;
+	int32_t uth_status = SCAP_SUCCESS;
+
+	pi = (scap_threadinfo*)calloc(1, sizeof(scap_threadinfo));
+	if(pi == NULL)
+	{
+		throw sinsp_exception("memory allocation error in sinsp_threadinfo::to_scap");
+	}
+
+	pi->tid = m_tid;
+	pi->pid = m_pid;
+	pi->ptid = m_ptid;
+	strncpy(pi->comm, m_comm.c_str(), SCAP_MAX_PATH_SIZE - 1);
+	strncpy(pi->exe, get_exe().c_str(), SCAP_MAX_PATH_SIZE - 1);
+	strncpy(pi->cwd, m_cwd.c_str(), SCAP_MAX_PATH_SIZE - 1);
+
+	//
+	// The arguments are stored one after the other, each with its
+	// terminator, like we keep them. The ones that don't fit are left out.
+	//
+	const sinsp_pooled_string& args = get_raw_args();
+	size_t argslen = args.length();
+
+	if(argslen != 0 && args[argslen - 1] != 0)
+	{
+		argslen++;
+	}
 
+	if(argslen > SCAP_MAX_PATH_SIZE)
+	{
+		argslen = SCAP_MAX_PATH_SIZE;
+
+		while(argslen > 0 && args[argslen - 1] != 0)
+		{
+			argslen--;
+		}
+	}
+
+	memcpy(pi->args, args.c_str(), argslen);
+	pi->args_len = argslen;
+
+	pi->fdlimit = m_fdlimit;
+	pi->flags = m_flags;
+	pi->uid = m_uid;
+	pi->gid = m_gid;
+	if(m_container_num != SINSP_HOST_CONTAINER_NUM)
+	{
+		strncpy(pi->cgroup, m_inspector->m_container_manager.get(m_container_num).m_cgroup.c_str(), SCAP_MAX_PATH_SIZE - 1);
+	}
+	pi->fdlist = NULL;
+
+	m_fdtable.unshare();
+
+	for(it = m_fdtable.m_table.begin(); it != m_fdtable.m_table.end(); ++it)
+	{
+		sinsp_fdinfo_t* tfdi = &it->second;
+
+		if(tfdi->m_type == SCAP_FD_UNINITIALIZED || tfdi->m_type == SCAP_FD_UNKNOWN)
+		{
+			continue;
+		}
+
+		fdi = (scap_fdinfo*)calloc(1, sizeof(scap_fdinfo));
+		if(fdi == NULL)
+		{
+			free_scap_proc(pi);
+			throw sinsp_exception("memory allocation error in sinsp_threadinfo::to_scap");
+		}
+
+		fdi->fd = it->first;
+		fdi->ino = tfdi->m_ino;
+		fdi->type = tfdi->m_type;
+
+		switch(tfdi->m_type)
+		{
+		case SCAP_FD_IPV4_SOCK:
+			fdi->info.ipv4info.sip = tfdi->m_sockinfo.m_ipv4info.m_fields.m_sip;
+			fdi->info.ipv4info.dip = tfdi->m_sockinfo.m_ipv4info.m_fields.m_dip;
+			fdi->info.ipv4info.sport = tfdi->m_sockinfo.m_ipv4info.m_fields.m_sport;
+			fdi->info.ipv4info.dport = tfdi->m_sockinfo.m_ipv4info.m_fields.m_dport;
+			fdi->info.ipv4info.l4proto = tfdi->m_sockinfo.m_ipv4info.m_fields.m_l4proto;
+			break;
+		case SCAP_FD_IPV4_SERVSOCK:
+			fdi->info.ipv4serverinfo.ip = tfdi->m_sockinfo.m_ipv4serverinfo.m_ip;
+			fdi->info.ipv4serverinfo.port = tfdi->m_sockinfo.m_ipv4serverinfo.m_port;
+			fdi->info.ipv4serverinfo.l4proto = tfdi->m_sockinfo.m_ipv4serverinfo.m_l4proto;
 			break;
 		case SCAP_FD_IPV6_SOCK:
-			if(sinsp_utils::is_ipv4_mapped_ipv6((uint8_t*)&fdi->info.ipv6info.sip) && 
-				sinsp_utils::is_ipv4_mapped_ipv6((uint8_t*)&fdi->info.ipv6info.dip))
-			{
-				//
-				// This is an IPv4-mapped IPv6 addresses (http://en.wikipedia.org/wiki/IPv6#IPv4-mapped_IPv6_addresses).
-				// Convert it into the IPv4 representation.
-				//
-				newfdi.m_type = SCAP_FD_IPV4_SOCK;
-				newfdi.m_sockinfo.m_ipv4info.m_fields.m_sip = fdi->info.ipv6info.sip[3];
-				newfdi.m_sockinfo.m_ipv4info.m_fields.m_dip = fdi->info.ipv6info.dip[3];
-				newfdi.m_sockinfo.m_ipv4info.m_fields.m_sport = fdi->info.ipv6info.sport;
-				newfdi.m_sockinfo.m_ipv4info.m_fields.m_dport = fdi->info.ipv6info.dport;
-				newfdi.m_sockinfo.m_ipv4info.m_fields.m_l4proto = fdi->info.ipv6info.l4proto;
-				m_inspector->m_network_interfaces->update_fd(&newfdi);
-				newfdi.m_name = ipv4tuple_to_string(&newfdi.m_sockinfo.m_ipv4info);
-			}
-			else
-			{
-				copy_ipv6_address(newfdi.m_sockinfo.m_ipv6info.m_fields.m_sip, fdi->info.ipv6info.sip);
-				copy_ipv6_address(newfdi.m_sockinfo.m_ipv6info.m_fields.m_dip, fdi->info.ipv6info.dip);
-				newfdi.m_sockinfo.m_ipv6info.m_fields.m_sport = fdi->info.ipv6info.sport;
-				newfdi.m_sockinfo.m_ipv6info.m_fields.m_dport = fdi->info.ipv6info.dport;
-				newfdi.m_sockinfo.m_ipv6info.m_fields.m_l4proto = fdi->info.ipv6info.l4proto;
-				newfdi.m_name = ipv6tuple_to_string(&newfdi.m_sockinfo.m_ipv6info);
-			}
+			copy_ipv6_address(fdi->info.ipv6info.sip, tfdi->m_sockinfo.m_ipv6info.m_fields.m_sip);
+			copy_ipv6_address(fdi->info.ipv6info.dip, tfdi->m_sockinfo.m_ipv6info.m_fields.m_dip);
+			fdi->info.ipv6info.sport = tfdi->m_sockinfo.m_ipv6info.m_fields.m_sport;
+			fdi->info.ipv6info.dport = tfdi->m_sockinfo.m_ipv6info.m_fields.m_dport;
+			fdi->info.ipv6info.l4proto = tfdi->m_sockinfo.m_ipv6info.m_fields.m_l4proto;
 			break;
 		case SCAP_FD_IPV6_SERVSOCK:
-			copy_ipv6_address(newfdi.m_sockinfo.m_ipv6serverinfo.m_ip, fdi->info.ipv6serverinfo.ip);
-			newfdi.m_sockinfo.m_ipv6serverinfo.m_port = fdi->info.ipv6serverinfo.port;
-			newfdi.m_sockinfo.m_ipv6serverinfo.m_l4proto = fdi->info.ipv6serverinfo.l4proto;
-			newfdi.m_name = ipv6serveraddr_to_string(&newfdi.m_sockinfo.m_ipv6serverinfo);
-
-			//
-			// We keep note of all the host bound server ports.
-			// We'll need them later when patching connections direction.
-			//
-			m_inspector->m_thread_manager->m_server_ports.insert(newfdi.m_sockinfo.m_ipv6serverinfo.m_port);
-
+			copy_ipv6_address(fdi->info.ipv6serverinfo.ip, tfdi->m_sockinfo.m_ipv6serverinfo.m_ip);
+			fdi->info.ipv6serverinfo.port = tfdi->m_sockinfo.m_ipv6serverinfo.m_port;
+			fdi->info.ipv6serverinfo.l4proto = tfdi->m_sockinfo.m_ipv6serverinfo.m_l4proto;
 			break;
 		case SCAP_FD_UNIX_SOCK:
-			newfdi.m_sockinfo.m_unixinfo.m_fields.m_source = fdi->info.unix_socket_info.source;
-			newfdi.m_sockinfo.m_unixinfo.m_fields.m_dest = fdi->info.unix_socket_info.destination;
-			newfdi.m_name = fdi->info.unix_socket_info.fname;
-			if(newfdi.m_name.empty())
-			{
-				newfdi.set_role_client();
-			}
-			else
-			{
-				newfdi.set_role_server();
-			}
-			break;
-		case SCAP_FD_FIFO:
-		case SCAP_FD_FILE:
-		case SCAP_FD_DIRECTORY:
-		case SCAP_FD_UNSUPPORTED:
-		case SCAP_FD_SIGNALFD:
-		case SCAP_FD_EVENTPOLL:
-		case SCAP_FD_EVENT:
-		case SCAP_FD_INOTIFY:
-		case SCAP_FD_TIMERFD:
-			newfdi.m_name = fdi->info.fname;
+			fdi->info.unix_socket_info.source = tfdi->m_sockinfo.m_unixinfo.m_fields.m_source;
+			fdi->info.unix_socket_info.destination = tfdi->m_sockinfo.m_unixinfo.m_fields.m_dest;
+			strncpy(fdi->info.unix_socket_info.fname, tfdi->m_name.c_str(), SCAP_MAX_PATH_SIZE - 1);
 			break;
 		default:
-			ASSERT(false);
-			do_add = false;
+			strncpy(fdi->info.fname, tfdi->m_name.c_str(), SCAP_MAX_PATH_SIZE - 1);
 			break;
 		}
 
-		if(do_add)
+		HASH_ADD_INT64(pi->fdlist, fd, fdi);
+		if(uth_status != SCAP_SUCCESS)
 		{
-			m_fdtable.add(fdi->fd, &newfdi);
+			free(fdi);
+			free_scap_proc(pi);
+			throw sinsp_exception("fd table allocation error in sinsp_threadinfo::to_scap");
 		}
 	}
+
+	return pi;
 }
 
-string sinsp_threadinfo::get_comm()
+const string& sinsp_threadinfo::get_comm()
 {
 	return m_comm;
 }
 
-string sinsp_threadinfo::get_exe()
+const string& sinsp_threadinfo::get_exe()
 {
-	return m_exe;
+	return get_exe_owner()->m_exe;
 }
 
-void sinsp_threadinfo::set_args(const char* args, size_t len)
+//
+// The arguments are kept in one string, shared by all the processes with the
+// same command line, and they are only split for the ones that need them
+//
+const vector<sinsp_pooled_string>& sinsp_threadinfo::get_args()
+{
+	sinsp_threadinfo* owner = get_args_owner();
+
+	if(owner->m_split_args_src != owner->m_args)
+	{
+		sinsp_string_pool* pool = get_string_pool();
+		const char* args = owner->m_args.c_str();
+		size_t len = owner->m_args.length();
+		size_t offset = 0;
+
+		owner->m_split_args.clear();
+
+		while(offset < len)
+		{
+			size_t arglen = strnlen(args + offset, len - offset);
+
+			owner->m_split_args.push_back(sinsp_pooled_string());
+			owner->m_split_args.back().set(pool, args + offset, arglen);
+			offset += arglen + 1;
+		}
+
+		owner->m_split_args_src = owner->m_args;
+	}
+
+	return owner->m_split_args;
+}
+
+const sinsp_pooled_string& sinsp_threadinfo::get_raw_args()
+{
+	return get_args_owner()->m_args;
+}
+
+//
+// The thread that holds the executable name of this thread's process:
+// either this one, or the main thread if the name is shared
+//
+sinsp_threadinfo* sinsp_threadinfo::get_exe_owner()
+{
+	if(m_exe.empty() && (m_flags & PPM_CL_CLONE_THREAD))
+	{
+		sinsp_threadinfo* ptinfo = get_main_thread();
+
+		if(ptinfo != NULL)
+		{
+			return ptinfo;
+		}
+	}
+
+	return this;
+}
+
+sinsp_threadinfo* sinsp_threadinfo::get_args_owner()
+{
+	if(m_args.empty() && m_exe.empty() && (m_flags & PPM_CL_CLONE_THREAD))
+	{
+		sinsp_threadinfo* ptinfo = get_main_thread();
+
+		if(ptinfo != NULL)
+		{
+			return ptinfo;
+		}
+	}
+
+	return this;
+}
+
+//
+// NULL for the threads that don't belong to an inspector, whose strings are
+// not shared
+//
+sinsp_string_pool* sinsp_threadinfo::get_string_pool()
+{
+	if(m_inspector == NULL || m_inspector->m_thread_manager == NULL)
+	{
+		return NULL;
+	}
+
+	return &m_inspector->m_thread_manager->m_string_pool;
+}
+
+//
+// The threads of a process keep a reference on the main thread, which
+// holds the executable name and the arguments for all of them.
+//
+void sinsp_threadinfo::share_process_info()
 {
-	m_args.clear();
+	if(!(m_flags & PPM_CL_CLONE_THREAD) || is_main_thread())
+	{
+		return;
+	}
 
-	size_t offset = 0;
-	while(offset < len)
+	sinsp_threadinfo* ptinfo = m_inspector->get_thread(m_pid, false);
+
+	if(ptinfo != NULL && ptinfo->m_exe == m_exe && ptinfo->m_args == m_args)
 	{
-		m_args.push_back(args + offset);
-		offset += m_args.back().length() + 1;
+		m_exe.clear();
+		m_args.clear();
+		m_split_args_src.clear();
+		vector<sinsp_pooled_string>().swap(m_split_args);
 	}
 }
 
+void sinsp_threadinfo::set_args(const char* args, size_t len)
+{
+	m_args.set(get_string_pool(), args, (uint32_t)len);
+}
+
 bool sinsp_threadinfo::is_main_thread()
 {
 	return m_tid == m_pid;
@@ -340,7 +756,24 @@ sinsp_threadinfo* sinsp_threadinfo::get_main_thread()
 
 sinsp_threadinfo* sinsp_threadinfo::get_parent_thread()
 {
-	return m_inspector->get_thread(m_ptid, false);
+	uint64_t generation = m_inspector->m_thread_manager->get_generation();
+
+	//
+	// The result of the last lookup holds until the thread is reparented or
+	// the thread table changes
+	//
+	if(m_parent_generation != generation || m_parent_tid != m_ptid)
+	{
+		m_parent_thread = m_inspector->get_thread(m_ptid, false);
+		m_parent_tid = m_ptid;
+		m_parent_generation = generation;
+	}
+	else if(m_parent_thread != NULL)
+	{
+		m_inspector->m_thread_manager->touch(m_parent_thread);
+	}
+
+	return m_parent_thread;
 }
 
 sinsp_fdtable* sinsp_threadinfo::get_fd_table()
@@ -368,6 +801,30 @@ sinsp_fdinfo_t* sinsp_threadinfo::add_fd(int64_t fd, sinsp_fdinfo_t *fdinfo)
 {
 	sinsp_fdinfo_t* res = get_fd_table()->add(fd, fdinfo);
 
+	if(m_inspector != NULL)
+	{
+		res->m_drop_gen = m_inspector->m_drop_gen;
+	}
+
+	//
+	// Keep the pipes and the unix sockets indexed, so that their peers can
+	// be found
+	//
+	if(m_inspector != NULL)
+	{
+		m_inspector->m_thread_manager->m_ipc_index.add(m_pid, fd, res);
+
+		if(!m_inspector->m_state_listeners.empty())
+		{
+			vector<sinsp_state_listener*>::const_iterator it;
+
+			for(it = m_inspector->m_state_listeners.begin(); it != m_inspector->m_state_listeners.end(); ++it)
+			{
+				(*it)->on_fd_added(this, fd, res);
+			}
+		}
+	}
+
 	//
 	// Update the last event fd. It's needed by the filtering engine
 	//
@@ -402,53 +859,40 @@ sinsp_fdinfo_t* sinsp_threadinfo::get_fd(int64_t fd)
 	return NULL;
 }
 
-bool sinsp_threadinfo::is_bound_to_port(uint16_t number)
+static bool fd_bound_to_port(int64_t fd, sinsp_fdinfo_t* fdinfo, void* arg)
 {
-	unordered_map<int64_t, sinsp_fdinfo_t>::iterator it;
-
-	sinsp_fdtable* fdt = get_fd_table();
+	uint16_t number = *(uint16_t*)arg;
 
-	for(it = fdt->m_table.begin(); 
-		it != fdt->m_table.end(); ++it)
+	if(fdinfo->m_type == SCAP_FD_IPV4_SOCK)
 	{
-		if(it->second.m_type == SCAP_FD_IPV4_SOCK)
-		{
-			if(it->second.m_sockinfo.m_ipv4info.m_fields.m_dport == number)
-			{
-				return true;
-			}
-		}
-		else if(it->second.m_type == SCAP_FD_IPV4_SERVSOCK)
-		{
-			if(it->second.m_sockinfo.m_ipv4serverinfo.m_port == number)
-			{
-				return true;
-			}
-		}
+		return fdinfo->m_sockinfo.m_ipv4info.m_fields.m_dport == number;
+	}
+	else if(fdinfo->m_type == SCAP_FD_IPV4_SERVSOCK)
+	{
+		return fdinfo->m_sockinfo.m_ipv4serverinfo.m_port == number;
 	}
 
 	return false;
 }
 
-bool sinsp_threadinfo::uses_client_port(uint16_t number)
+bool sinsp_threadinfo::is_bound_to_port(uint16_t number)
 {
-	unordered_map<int64_t, sinsp_fdinfo_t>::iterator it;
-
 	sinsp_fdtable* fdt = get_fd_table();
 
-	for(it = fdt->m_table.begin(); 
-		it != fdt->m_table.end(); ++it)
-	{
-		if(it->second.m_type == SCAP_FD_IPV4_SOCK)
-		{
-			if(it->second.m_sockinfo.m_ipv4info.m_fields.m_sport == number)
-			{
-				return true;
-			}
-		}
-	}
+	return fdt->visit(fd_bound_to_port, &number);
+}
 
-	return false;
+static bool fd_uses_client_port(int64_t fd, sinsp_fdinfo_t* fdinfo, void* arg)
+{
+	return fdinfo->m_type == SCAP_FD_IPV4_SOCK &&
+		fdinfo->m_sockinfo.m_ipv4info.m_fields.m_sport == *(uint16_t*)arg;
+}
+
+bool sinsp_threadinfo::uses_client_port(uint16_t number)
+{
+	sinsp_fdtable* fdt = get_fd_table();
+
+	return fdt->visit(fd_uses_client_port, &number);
 }
 
 void sinsp_threadinfo::store_event(sinsp_evt *evt)
@@ -460,7 +904,8 @@ void sinsp_threadinfo::store_event(sinsp_evt *evt)
 	//
 	elen = scap_event_getlen(evt->m_pevt);
 
-	if(elen > SP_EVT_BUF_SIZE)
+	uint8_t* data = reserve_lastevent_data(elen);
+	if(data == NULL)
 	{
 		ASSERT(false);
 		return;
@@ -469,10 +914,20 @@ void sinsp_threadinfo::store_event(sinsp_evt *evt)
 	//
 	// Copy the data
 	//
-	memcpy(m_lastevent_data, evt->m_pevt, elen);
+	memcpy(data, evt->m_pevt, elen);
 	m_lastevent_cpuid = evt->get_cpuid();
 }
 
+uint8_t* sinsp_threadinfo::reserve_lastevent_data(uint32_t size)
+{
+	return m_lastevent_data.reserve(&m_inspector->m_thread_manager->m_evt_buffer_pool, size);
+}
+
+void sinsp_threadinfo::release_lastevent_data()
+{
+	m_lastevent_data.release();
+}
+
 bool sinsp_threadinfo::is_lastevent_data_valid()
 {
 	return (m_lastevent_cpuid != (uint16_t) - 1);
@@ -502,7 +957,27 @@ sinsp_threadinfo* sinsp_threadinfo::get_cwd_root()
 	}
 }
 
-string sinsp_threadinfo::get_cwd()
+const string& sinsp_threadinfo::get_cwd()
+{
+	static const string default_cwd("./");
+	sinsp_threadinfo* tinfo = get_cwd_root();
+
+	if(tinfo)
+	{
+		return tinfo->m_cwd.str();
+	}
+	else
+	{
+		ASSERT(false);
+		return default_cwd;
+	}
+}
+
+//
+// Same as get_cwd(), without leaving the string pool. If the cwd is
+// unknown, the relative paths are resolved against an empty directory.
+//
+const sinsp_pooled_string& sinsp_threadinfo::get_pooled_cwd()
 {
 	sinsp_threadinfo* tinfo = get_cwd_root();
 
@@ -513,7 +988,7 @@ string sinsp_threadinfo::get_cwd()
 	else
 	{
 		ASSERT(false);
-		return "./";
+		return m_cwd;
 	}
 }
 
@@ -524,19 +999,27 @@ void sinsp_threadinfo::set_cwd(const char* cwd, uint32_t cwdlen)
 
 	if(tinfo)
 	{
+		uint32_t len;
+
 		sinsp_utils::concatenate_paths(tpath, 
-			SCAP_MAX_PATH_SIZE, 
+			SCAP_MAX_PATH_SIZE - 1, 
 			(char*)tinfo->m_cwd.c_str(), 
 			tinfo->m_cwd.size(), 
 			cwd, 
 			cwdlen);
 
-		tinfo->m_cwd = tpath;
+		len = strlen(tpath);
 
-		if(tinfo->m_cwd[tinfo->m_cwd.size() - 1] != '/')
+		if(len == 0 || tpath[len - 1] != '/')
 		{
-			tinfo->m_cwd += '/';
+			tpath[len++] = '/';
+			tpath[len] = 0;
 		}
+
+		//
+		// All the threads in the same directory share its string
+		//
+		tinfo->m_cwd.set(get_string_pool(), tpath, len);
 	}
 	else
 	{
@@ -546,15 +1029,23 @@ void sinsp_threadinfo::set_cwd(const char* cwd, uint32_t cwdlen)
 
 void sinsp_threadinfo::allocate_private_state()
 {
-	uint32_t j = 0;
+	m_private_state.clear();
+	add_private_state();
+}
+
+//
+// Allocate the areas that were reserved after the ones the thread has, e.g.
+// by a filter compiled during the capture
+//
+void sinsp_threadinfo::add_private_state()
+{
+	uint32_t j;
 
 	if(m_inspector != NULL)
 	{
-		m_private_state.clear();
-
 		vector<uint32_t>* sizes = &m_inspector->m_thread_privatestate_manager.m_memory_sizes;
-	
-		for(j = 0; j < sizes->size(); j++)
+
+		for(j = (uint32_t)m_private_state.size(); j < sizes->size(); j++)
 		{
 			void* newbuf = malloc(sizes->at(j));
 			memset(newbuf, 0, sizes->at(j));
@@ -563,12 +1054,32 @@ void sinsp_threadinfo::allocate_private_state()
 	}
 }
 
+//
+// Called when the name, the executable, the arguments, the user or the
+// container of the thread change, so that the filter checks recompute the
+// results they keep in m_check_results
+//
+void sinsp_threadinfo::state_changed()
+{
+#ifdef HAS_FILTERING
+	if(m_inspector != NULL && m_inspector->m_thread_manager != NULL)
+	{
+		m_state_gen = m_inspector->m_thread_manager->next_state_generation();
+	}
+#endif
+}
+
 void* sinsp_threadinfo::get_private_state(uint32_t id)
 {
 	if(id >= m_private_state.size())
 	{
-		ASSERT(false);
-		throw sinsp_exception("invalid thread state ID" + to_string((long long) id));
+		add_private_state();
+
+		if(id >= m_private_state.size())
+		{
+			ASSERT(false);
+			throw sinsp_exception("invalid thread state ID" + to_string((long long) id));
+		}
 	}
 
 	return m_private_state[id];
@@ -576,200 +1087,973 @@ void* sinsp_threadinfo::get_private_state(uint32_t id)
 
 
 ///////////////////////////////////////////////////////////////////////////////
-// sinsp_thread_manager implementation
+// sinsp_thread_index implementation
 ///////////////////////////////////////////////////////////////////////////////
-sinsp_thread_manager::sinsp_thread_manager(sinsp* inspector)
+sinsp_thread_index::sinsp_thread_index()
 {
-	m_inspector = inspector;
-	m_listener = NULL;
-	clear();
+	m_n_resizes = 0;
+	resize(8);
 }
 
-void sinsp_thread_manager::clear()
+void sinsp_thread_index::resize(uint32_t nbits)
 {
-	m_threadtable.clear();
-	m_last_tid = 0;
-	m_last_tinfo = NULL;
-	m_last_flush_time_ns = 0;
-	m_n_drops = 0;
+	vector<entry> old;
+	vector<entry>::iterator it;
+	entry empty = {0, NULL};
 
-#ifdef GATHER_INTERNAL_STATS
-	m_failed_lookups = &m_inspector->m_stats.get_metrics_registry().register_counter(internal_metrics::metric_name("thread_failed_lookups","Failed thread lookups"));
-	m_cached_lookups = &m_inspector->m_stats.get_metrics_registry().register_counter(internal_metrics::metric_name("thread_cached_lookups","Cached thread lookups"));
-	m_non_cached_lookups = &m_inspector->m_stats.get_metrics_registry().register_counter(internal_metrics::metric_name("thread_non_cached_lookups","Non cached thread lookups"));
-	m_added_threads = &m_inspector->m_stats.get_metrics_registry().register_counter(internal_metrics::metric_name("thread_added","Number of added threads"));
-	m_removed_threads = &m_inspector->m_stats.get_metrics_registry().register_counter(internal_metrics::metric_name("thread_removed","Removed threads"));
-#endif
+	old.swap(m_entries);
+	m_entries.assign((size_t)1 << nbits, empty);
+	m_mask = ((uint64_t)1 << nbits) - 1;
+	m_shift = 64 - nbits;
+	m_count = 0;
+
+	for(it = old.begin(); it != old.end(); ++it)
+	{
+		if(it->m_tinfo != NULL)
+		{
+			insert(it->m_tid, it->m_tinfo);
+		}
+	}
 }
 
-void sinsp_thread_manager::set_listener(sinsp_threadtable_listener* listener)
+void sinsp_thread_index::insert(int64_t tid, sinsp_threadinfo* tinfo)
 {
-	m_listener = listener;
+	uint64_t j;
+
+	//
+	// Keep the table at most half full, so the runs stay short
+	//
+	if((m_count + 1) * 2 > m_entries.size())
+	{
+		resize(64 - m_shift + 1);
+		m_n_resizes++;
+	}
+
+	for(j = get_slot(tid); m_entries[j].m_tinfo != NULL; j = (j + 1) & m_mask)
+	{
+		if(m_entries[j].m_tid == tid)
+		{
+			m_entries[j].m_tinfo = tinfo;
+			return;
+		}
+	}
+
+	m_entries[j].m_tid = tid;
+	m_entries[j].m_tinfo = tinfo;
+	m_count++;
 }
 
-sinsp_threadinfo* sinsp_thread_manager::get_thread(int64_t tid)
+void sinsp_thread_index::erase(int64_t tid)
 {
-	threadinfo_map_iterator_t it;
+	uint64_t j;
+	uint64_t k;
+
+	for(j = get_slot(tid); m_entries[j].m_tid != tid; j = (j + 1) & m_mask)
+	{
+		if(m_entries[j].m_tinfo == NULL)
+		{
+			return;
+		}
+	}
+
+	if(m_entries[j].m_tinfo == NULL)
+	{
+		return;
+	}
 
 	//
-	// Try looking up in our simple cache
+	// Move back the following entries of the run that can take the free
+	// slot, so that the lookups don't need tombstones
 	//
-	if(m_last_tinfo && tid == m_last_tid)
+	for(k = (j + 1) & m_mask; m_entries[k].m_tinfo != NULL; k = (k + 1) & m_mask)
 	{
-#ifdef GATHER_INTERNAL_STATS
-		m_cached_lookups->increment();
-#endif
-		m_last_tinfo->m_lastaccess_ts = m_inspector->m_lastevent_ts;
-		return m_last_tinfo;
+		uint64_t home = get_slot(m_entries[k].m_tid);
+
+		if(((k - home) & m_mask) >= ((k - j) & m_mask))
+		{
+			m_entries[j] = m_entries[k];
+			j = k;
+		}
 	}
 
+	m_entries[j].m_tinfo = NULL;
+	m_count--;
+}
+
+void sinsp_thread_index::clear()
+{
+	resize(8);
+}
+
+bool sinsp_thread_index::shrink()
+{
+	uint32_t nbits = 8;
+
 	//
-	// Caching failed, do a real lookup
+	// Down to a quarter full, so that it doesn't grow back right away, and
+	// only if it's at most an eighth full
 	//
-	it = m_threadtable.find(tid);
-	
-	if(it != m_threadtable.end())
+	while(((uint64_t)1 << nbits) < (uint64_t)m_count * 4)
 	{
-#ifdef GATHER_INTERNAL_STATS
-		m_non_cached_lookups->increment();
-#endif
-		m_last_tid = tid;
-		m_last_tinfo = &(it->second);
-		m_last_tinfo->m_lastaccess_ts = m_inspector->m_lastevent_ts;
-		return &(it->second);
+		nbits++;
 	}
-	else
+
+	if(nbits + 1 >= 64 - m_shift)
 	{
-#ifdef GATHER_INTERNAL_STATS
-		m_failed_lookups->increment();
-#endif
-		return NULL;
+		return false;
 	}
+
+	resize(nbits);
+	m_n_resizes++;
+	return true;
 }
 
-void sinsp_thread_manager::increment_mainthread_childcount(sinsp_threadinfo* threadinfo)
+///////////////////////////////////////////////////////////////////////////////
+// sinsp_thread_tombstones implementation
+///////////////////////////////////////////////////////////////////////////////
+sinsp_thread_tombstones::sinsp_thread_tombstones(uint32_t size)
 {
-	if(threadinfo->m_flags & PPM_CL_CLONE_THREAD)
+	m_ring.resize(size);
+	m_index.rehash(size);
+	clear();
+}
+
+void sinsp_thread_tombstones::release(uint32_t pos)
+{
+	entry& e = m_ring[pos];
+
+	if(e.m_tid != -1)
 	{
-		//
-		// Increment the refcount of the main thread so it won't
-		// be deleted (if it calls pthread_exit()) until we are done
-		//
-		ASSERT(threadinfo->m_pid != threadinfo->m_tid);
-		sinsp_threadinfo* main_thread = m_inspector->get_thread(threadinfo->m_pid, false);
-		if(main_thread)
-		{
-			++main_thread->m_nchilds;
-		}
-		else
-		{
-			ASSERT(false);
-		}
+		m_index.erase(e.m_tid);
+		e.m_tid = -1;
+		e.m_comm.clear();
+		e.m_exe.clear();
 	}
 }
 
-void sinsp_thread_manager::increment_program_childcount(sinsp_threadinfo* threadinfo)
+void sinsp_thread_tombstones::add(sinsp_threadinfo* tinfo, uint64_t ts)
 {
-	if(threadinfo->is_main_thread())
+	erase(tinfo->m_tid);
+	release(m_next);
+
+	entry& e = m_ring[m_next];
+
+	e.m_tid = tinfo->m_tid;
+	e.m_pid = tinfo->m_pid;
+	e.m_ptid = tinfo->m_ptid;
+	e.m_uid = tinfo->m_uid;
+	e.m_gid = tinfo->m_gid;
+	e.m_exit_ts = ts;
+	e.m_comm = tinfo->m_comm;
+	e.m_exe = tinfo->m_exe;
+
+	m_index[e.m_tid] = m_next;
+	m_next = (m_next + 1) % m_ring.size();
+}
+
+void sinsp_thread_tombstones::erase(int64_t tid)
+{
+	unordered_map<int64_t, uint32_t>::iterator it = m_index.find(tid);
+
+	if(it != m_index.end())
 	{
-		sinsp_threadinfo* parent_thread = m_inspector->get_thread(threadinfo->m_ptid, false);
+		release(it->second);
+	}
+}
 
-		if(parent_thread)
-		{
-			if((parent_thread->m_comm == threadinfo->m_comm) &&
-				(parent_thread->m_exe == threadinfo->m_exe))
-			{
-				threadinfo->m_progid = parent_thread->m_tid;
-				++parent_thread->m_nchilds;
-				increment_program_childcount(parent_thread);
-			}
-		}
+void sinsp_thread_tombstones::clear()
+{
+	vector<entry>::iterator it;
+
+	for(it = m_ring.begin(); it != m_ring.end(); ++it)
+	{
+		it->m_tid = -1;
+		it->m_comm.clear();
+		it->m_exe.clear();
 	}
+
+	m_index.clear();
+	m_next = 0;
 }
 
-// Don't set level, it's for internal use
-void sinsp_thread_manager::decrement_program_childcount(sinsp_threadinfo* threadinfo, uint32_t level)
+///////////////////////////////////////////////////////////////////////////////
+// sinsp_server_ports implementation
+///////////////////////////////////////////////////////////////////////////////
+sinsp_server_ports::sinsp_server_ports()
 {
-	if(threadinfo->is_main_thread())
+	clear();
+}
+
+void sinsp_server_ports::add(int64_t pid, int64_t fd, uint8_t l4proto, uint16_t port)
+{
+	if(l4proto > SCAP_L4_RAW)
 	{
-		ASSERT(threadinfo->m_pid != threadinfo->m_progid);
+		return;
+	}
 
-		sinsp_threadinfo* prog_thread = m_inspector->get_thread(threadinfo->m_progid, false);
+	uint32_t key = ((uint32_t)l4proto << 16) | port;
+	pair<int64_t, int64_t> sock(pid, fd);
+	map<pair<int64_t, int64_t>, uint32_t>::iterator it = m_sockets.find(sock);
 
-		if(prog_thread)
+	if(it != m_sockets.end())
+	{
+		if(it->second == key)
 		{
-			if(prog_thread->m_nchilds > 0)
-			{
-				--prog_thread->m_nchilds;
-				decrement_program_childcount(prog_thread, level + 1);
-			}
-			else
-			{
-				ASSERT(false);
-			}
+			return;
 		}
 
-		if(level == 0)
-		{
-			threadinfo->m_progid = -1LL;
-			threadinfo->m_main_program_thread = NULL;
-		}
+		remove(pid, fd);
+	}
+
+	m_sockets[sock] = key;
+
+	if(m_refcounts[key]++ == 0)
+	{
+		m_bitmap[l4proto][port >> 5] |= (1U << (port & 31));
 	}
 }
 
-void sinsp_thread_manager::add_thread(sinsp_threadinfo& threadinfo, bool from_scap_proctable)
+void sinsp_server_ports::remove(int64_t pid, int64_t fd)
 {
-#ifdef GATHER_INTERNAL_STATS
-	m_added_threads->increment();
-#endif
+	map<pair<int64_t, int64_t>, uint32_t>::iterator it = m_sockets.find(pair<int64_t, int64_t>(pid, fd));
 
-	if(m_threadtable.size() >= m_inspector->m_max_thread_table_size)
+	if(it == m_sockets.end())
 	{
-		m_n_drops++;
 		return;
 	}
 
-	if(!from_scap_proctable)
-	{
-		increment_mainthread_childcount(&threadinfo);
-		increment_program_childcount(&threadinfo);
-	}
+	uint32_t key = it->second;
+	unordered_map<uint32_t, uint32_t>::iterator rit = m_refcounts.find(key);
 
-	sinsp_threadinfo& newentry = (m_threadtable[threadinfo.m_tid] = threadinfo);
-	newentry.allocate_private_state();
-	if(m_listener)
+	m_sockets.erase(it);
+
+	ASSERT(rit != m_refcounts.end());
+	if(rit != m_refcounts.end() && --rit->second == 0)
 	{
-		m_listener->on_thread_created(&newentry);
+		uint8_t l4proto = (uint8_t)(key >> 16);
+		uint16_t port = (uint16_t)key;
+
+		m_bitmap[l4proto][port >> 5] &= ~(1U << (port & 31));
+		m_refcounts.erase(rit);
 	}
 }
 
-void sinsp_thread_manager::remove_thread(int64_t tid)
+void sinsp_server_ports::clear()
 {
-	remove_thread(m_threadtable.find(tid));
+	memset(m_bitmap, 0, sizeof(m_bitmap));
+	m_refcounts.clear();
+	m_sockets.clear();
 }
 
-void sinsp_thread_manager::remove_thread(threadinfo_map_iterator_t it)
+///////////////////////////////////////////////////////////////////////////////
+// sinsp_ipc_index implementation
+///////////////////////////////////////////////////////////////////////////////
+void sinsp_ipc_index::add(int64_t pid, int64_t fd, sinsp_fdinfo_t* fdinfo)
 {
-	if(it == m_threadtable.end())
+	uint64_t key;
+
+	if(fdinfo->m_type == SCAP_FD_FIFO && fdinfo->m_ino != 0)
 	{
-		//
-		// Looks like there's no thread to remove.
-		// Either the thread creation event was dropped or our logic doesn't support the
-		// call that created this thread. The assertion will detect it, while in release mode we just
-		// keep going.
-		//
-#ifdef GATHER_INTERNAL_STATS
-		m_failed_lookups->increment();
-#endif
+		key = fdinfo->m_ino;
+	}
+	else if(fdinfo->m_type == SCAP_FD_UNIX_SOCK && fdinfo->m_sockinfo.m_unixinfo.m_fields.m_source != 0)
+	{
+		key = fdinfo->m_sockinfo.m_unixinfo.m_fields.m_source;
+	}
+	else
+	{
+		remove(pid, fd);
 		return;
 	}
-	else if(it->second.m_nchilds == 0)
+
+	uint64_t fdkey = get_fd_key(pid, fd);
+	unordered_map<uint64_t, uint64_t>::iterator it = m_fds.find(fdkey);
+
+	if(it != m_fds.end())
 	{
-		//
-		// Decrement the refcount of the main thread/program because
-		// this reference is gone
-		//
-		if(it->second.m_flags & PPM_CL_CLONE_THREAD)
+		if(it->second == key)
+		{
+			return;
+		}
+
+		remove(pid, fd);
+	}
+
+	m_fds[fdkey] = key;
+	m_ends.insert(pair<uint64_t, uint64_t>(key, fdkey));
+}
+
+void sinsp_ipc_index::remove(int64_t pid, int64_t fd)
+{
+	uint64_t fdkey = get_fd_key(pid, fd);
+	unordered_map<uint64_t, uint64_t>::iterator it = m_fds.find(fdkey);
+
+	if(it == m_fds.end())
+	{
+		return;
+	}
+
+	pair<unordered_multimap<uint64_t, uint64_t>::iterator, unordered_multimap<uint64_t, uint64_t>::iterator> range =
+		m_ends.equal_range(it->second);
+
+	for(unordered_multimap<uint64_t, uint64_t>::iterator eit = range.first; eit != range.second; ++eit)
+	{
+		if(eit->second == fdkey)
+		{
+			m_ends.erase(eit);
+			break;
+		}
+	}
+
+	m_fds.erase(it);
+}
+
+bool sinsp_ipc_index::find_peer(int64_t pid, int64_t fd, sinsp_fdinfo_t* fdinfo, OUT int64_t* peer_pid, OUT int64_t* peer_fd)
+{
+	uint64_t key;
+	uint64_t fdkey = get_fd_key(pid, fd);
+	bool found = false;
+
+	if(fdinfo->m_type == SCAP_FD_FIFO)
+	{
+		key = fdinfo->m_ino;
+	}
+	else if(fdinfo->m_type == SCAP_FD_UNIX_SOCK)
+	{
+		key = fdinfo->m_sockinfo.m_unixinfo.m_fields.m_dest;
+	}
+	else
+	{
+		return false;
+	}
+
+	if(key == 0)
+	{
+		return false;
+	}
+
+	pair<unordered_multimap<uint64_t, uint64_t>::iterator, unordered_multimap<uint64_t, uint64_t>::iterator> range =
+		m_ends.equal_range(key);
+
+	for(unordered_multimap<uint64_t, uint64_t>::iterator it = range.first; it != range.second; ++it)
+	{
+		if(it->second == fdkey)
+		{
+			continue;
+		}
+
+		*peer_pid = (int64_t)(it->second >> 32);
+		*peer_fd = (int64_t)(int32_t)(uint32_t)it->second;
+		found = true;
+
+		if(*peer_pid != pid)
+		{
+			break;
+		}
+	}
+
+	return found;
+}
+
+void sinsp_ipc_index::clear()
+{
+	m_ends.clear();
+	m_fds.clear();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// sinsp_proc_tree implementation
+///////////////////////////////////////////////////////////////////////////////
+sinsp_proc_tree::sinsp_proc_tree()
+{
+	m_next_id = 0;
+	m_generation = 0;
+	m_nnodes = 0;
+}
+
+sinsp_proc_tree::~sinsp_proc_tree()
+{
+	clear();
+}
+
+void sinsp_proc_tree::add(int64_t pid, int64_t ppid, const sinsp_pooled_string& comm)
+{
+	sinsp_proc_tree_node* parent = (ppid != pid)? get_node(ppid) : NULL;
+	sinsp_proc_tree_node* node = new sinsp_proc_tree_node();
+
+	remove(pid);
+
+	node->m_pid = pid;
+	node->m_id = m_next_id++;
+	node->m_parent = parent;
+	node->m_nchildren = 0;
+	node->m_alive = true;
+	node->m_comm = comm;
+
+	if(parent == NULL)
+	{
+		node->m_depth = 0;
+		node->m_jump = node;
+	}
+	else
+	{
+		sinsp_proc_tree_node* jump = parent->m_jump;
+
+		//
+		// If the parent and its jump pointer skip the same number of
+		// levels, this node skips both, otherwise it points to its parent
+		//
+		node->m_depth = parent->m_depth + 1;
+
+		if(parent->m_depth - jump->m_depth == jump->m_depth - jump->m_jump->m_depth)
+		{
+			node->m_jump = jump->m_jump;
+		}
+		else
+		{
+			node->m_jump = parent;
+		}
+
+		parent->m_nchildren++;
+	}
+
+	m_procs[pid] = node;
+	m_nnodes++;
+}
+
+void sinsp_proc_tree::remove(int64_t pid)
+{
+	unordered_map<int64_t, sinsp_proc_tree_node*>::iterator it = m_procs.find(pid);
+
+	if(it == m_procs.end())
+	{
+		return;
+	}
+
+	sinsp_proc_tree_node* node = it->second;
+
+	m_procs.erase(it);
+	node->m_alive = false;
+	release(node);
+}
+
+//
+// Free the nodes of the exited processes that are nobody's ancestor anymore,
+// going up the tree
+//
+void sinsp_proc_tree::release(sinsp_proc_tree_node* node)
+{
+	while(node != NULL && !node->m_alive && node->m_nchildren == 0)
+	{
+		sinsp_proc_tree_node* parent = node->m_parent;
+
+		if(parent != NULL)
+		{
+			ASSERT(parent->m_nchildren > 0);
+			parent->m_nchildren--;
+		}
+
+		delete node;
+		m_nnodes--;
+		node = parent;
+	}
+}
+
+void sinsp_proc_tree::set_comm(int64_t pid, const sinsp_pooled_string& comm)
+{
+	sinsp_proc_tree_node* node = get_node(pid);
+
+	if(node != NULL)
+	{
+		node->m_comm = comm;
+		m_generation++;
+	}
+}
+
+sinsp_proc_tree_node* sinsp_proc_tree::get_ancestor(sinsp_proc_tree_node* node, uint32_t level)
+{
+	if(level > node->m_depth)
+	{
+		return NULL;
+	}
+
+	uint32_t depth = node->m_depth - level;
+
+	while(node->m_depth > depth)
+	{
+		if(node->m_jump->m_depth >= depth)
+		{
+			node = node->m_jump;
+		}
+		else
+		{
+			node = node->m_parent;
+		}
+	}
+
+	return node;
+}
+
+bool sinsp_proc_tree::is_descendant(sinsp_proc_tree_node* node, sinsp_proc_tree_node* ancestor)
+{
+	if(ancestor->m_depth >= node->m_depth)
+	{
+		return false;
+	}
+
+	return get_ancestor(node, node->m_depth - ancestor->m_depth) == ancestor;
+}
+
+void sinsp_proc_tree::clear()
+{
+	unordered_map<int64_t, sinsp_proc_tree_node*>::iterator it;
+	vector<sinsp_proc_tree_node*> nodes;
+
+	for(it = m_procs.begin(); it != m_procs.end(); ++it)
+	{
+		nodes.push_back(it->second);
+	}
+
+	m_procs.clear();
+
+	for(vector<sinsp_proc_tree_node*>::iterator nit = nodes.begin(); nit != nodes.end(); ++nit)
+	{
+		(*nit)->m_alive = false;
+		release(*nit);
+	}
+
+	ASSERT(m_nnodes == 0);
+	m_generation++;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// sinsp_thread_manager implementation
+///////////////////////////////////////////////////////////////////////////////
+sinsp_thread_manager::sinsp_thread_manager(sinsp* inspector) :
+	m_tombstones(SP_THREAD_TOMBSTONES)
+{
+	m_inspector = inspector;
+	m_listener = NULL;
+	m_n_fd_entries = 0;
+	m_generation = 0;
+	//
+	// The empty results in the threads, 0, are older than the epoch
+	//
+	m_state_generation = 1;
+	m_check_results_epoch = 1;
+	clear();
+}
+
+void sinsp_thread_manager::clear()
+{
+	m_threadtable.clear();
+	m_threadindex.clear();
+	m_tombstones.clear();
+	m_thread_cache.clear();
+	m_server_ports.clear();
+	m_ipc_index.clear();
+	m_proc_tree.clear();
+	m_generation++;
+	m_lru_head = NULL;
+	m_lru_tail = NULL;
+	m_last_flush_time_ns = 0;
+	m_n_drops = 0;
+	m_n_evicted_fds = 0;
+	m_n_evicted_threads = 0;
+	m_n_table_rehashes = 0;
+	m_n_compactions = 0;
+	m_n_tombstone_hits = 0;
+	m_last_compaction_ts = 0;
+
+#ifdef GATHER_INTERNAL_STATS
+	m_failed_lookups = &m_inspector->m_stats.get_metrics_registry().register_counter(internal_metrics::metric_name("thread_failed_lookups","Failed thread lookups"));
+	m_cached_lookups = &m_inspector->m_stats.get_metrics_registry().register_counter(internal_metrics::metric_name("thread_cached_lookups","Cached thread lookups"));
+	m_non_cached_lookups = &m_inspector->m_stats.get_metrics_registry().register_counter(internal_metrics::metric_name("thread_non_cached_lookups","Non cached thread lookups"));
+	m_added_threads = &m_inspector->m_stats.get_metrics_registry().register_counter(internal_metrics::metric_name("thread_added","Number of added threads"));
+	m_removed_threads = &m_inspector->m_stats.get_metrics_registry().register_counter(internal_metrics::metric_name("thread_removed","Removed threads"));
+	m_fd_cached_lookups = &m_inspector->m_stats.get_metrics_registry().register_counter(internal_metrics::metric_name("fd_cached_lookups","Cached fd lookups"));
+	m_fd_non_cached_lookups = &m_inspector->m_stats.get_metrics_registry().register_counter(internal_metrics::metric_name("fd_non_cached_lookups","Non cached fd lookups"));
+#endif
+}
+
+void sinsp_thread_manager::set_listener(sinsp_threadtable_listener* listener)
+{
+	m_listener = listener;
+}
+
+//
+// Called for every lookup: the list is updated only once in a while
+//
+inline void sinsp_thread_manager::touch(sinsp_threadinfo* tinfo)
+{
+	uint64_t ts = m_inspector->m_lastevent_ts;
+
+	tinfo->m_lastaccess_ts = ts;
+
+	if(ts > tinfo->m_lru_ts + THREAD_LRU_UPDATE_INTERVAL_NS)
+	{
+		lru_remove(tinfo);
+		lru_push(tinfo, ts);
+	}
+}
+
+sinsp_threadinfo* sinsp_thread_manager::get_thread(int64_t tid)
+{
+	sinsp_threadinfo* tinfo;
+	uint32_t j;
+
+	//
+	// Try looking up in the cache of the CPU of the event being processed
+	//
+	size_t cpuid = m_inspector->m_evt.get_cpuid();
+
+	if((cpuid + 1) * SP_THREAD_CACHE_WAYS > m_thread_cache.size())
+	{
+		thread_cache_entry empty = {0, NULL};
+		m_thread_cache.resize((cpuid + 1) * SP_THREAD_CACHE_WAYS, empty);
+	}
+
+	thread_cache_entry* cache = &m_thread_cache[cpuid * SP_THREAD_CACHE_WAYS];
+
+	for(j = 0; j < SP_THREAD_CACHE_WAYS; j++)
+	{
+		if(cache[j].m_tinfo != NULL && cache[j].m_tid == tid)
+		{
+#ifdef GATHER_INTERNAL_STATS
+			m_cached_lookups->increment();
+#endif
+			thread_cache_entry hit = cache[j];
+
+			for(; j > 0; j--)
+			{
+				cache[j] = cache[j - 1];
+			}
+
+			cache[0] = hit;
+			touch(hit.m_tinfo);
+			return hit.m_tinfo;
+		}
+	}
+
+	//
+	// Caching failed, do a real lookup
+	//
+	tinfo = m_threadindex.find(tid);
+
+	if(tinfo != NULL)
+	{
+#ifdef GATHER_INTERNAL_STATS
+		m_non_cached_lookups->increment();
+#endif
+		for(j = SP_THREAD_CACHE_WAYS - 1; j > 0; j--)
+		{
+			cache[j] = cache[j - 1];
+		}
+
+		cache[0].m_tid = tid;
+		cache[0].m_tinfo = tinfo;
+		touch(tinfo);
+		return tinfo;
+	}
+	else
+	{
+#ifdef GATHER_INTERNAL_STATS
+		m_failed_lookups->increment();
+#endif
+		return NULL;
+	}
+}
+
+//
+// Called before a thread is removed from the table
+//
+void sinsp_thread_manager::remove_from_cache(sinsp_threadinfo* tinfo)
+{
+	vector<thread_cache_entry>::iterator it;
+
+	m_generation++;
+
+	for(it = m_thread_cache.begin(); it != m_thread_cache.end(); ++it)
+	{
+		if(it->m_tinfo == tinfo)
+		{
+			it->m_tinfo = NULL;
+		}
+	}
+}
+
+void sinsp_thread_manager::lru_push(sinsp_threadinfo* tinfo, uint64_t ts)
+{
+	tinfo->m_lru_ts = ts;
+	tinfo->m_lru_prev = m_lru_tail;
+	tinfo->m_lru_next = NULL;
+
+	if(m_lru_tail != NULL)
+	{
+		m_lru_tail->m_lru_next = tinfo;
+	}
+	else
+	{
+		m_lru_head = tinfo;
+	}
+
+	m_lru_tail = tinfo;
+}
+
+void sinsp_thread_manager::lru_remove(sinsp_threadinfo* tinfo)
+{
+	if(tinfo->m_lru_prev != NULL)
+	{
+		tinfo->m_lru_prev->m_lru_next = tinfo->m_lru_next;
+	}
+	else
+	{
+		m_lru_head = tinfo->m_lru_next;
+	}
+
+	if(tinfo->m_lru_next != NULL)
+	{
+		tinfo->m_lru_next->m_lru_prev = tinfo->m_lru_prev;
+	}
+	else
+	{
+		m_lru_tail = tinfo->m_lru_prev;
+	}
+
+	tinfo->m_lru_prev = NULL;
+	tinfo->m_lru_next = NULL;
+}
+
+void sinsp_thread_manager::increment_mainthread_childcount(sinsp_threadinfo* threadinfo)
+{
+	if(threadinfo->m_flags & PPM_CL_CLONE_THREAD)
+	{
+		//
+		// Increment the refcount of the main thread so it won't
+		// be deleted (if it calls pthread_exit()) until we are done
+		//
+		ASSERT(threadinfo->m_pid != threadinfo->m_tid);
+		sinsp_threadinfo* main_thread = m_inspector->get_thread(threadinfo->m_pid, false);
+		if(main_thread)
+		{
+			++main_thread->m_nchilds;
+		}
+		else
+		{
+			ASSERT(false);
+		}
+	}
+}
+
+void sinsp_thread_manager::increment_program_childcount(sinsp_threadinfo* threadinfo)
+{
+	if(threadinfo->is_main_thread())
+	{
+		sinsp_threadinfo* parent_thread = m_inspector->get_thread(threadinfo->m_ptid, false);
+
+		if(parent_thread)
+		{
+			if((parent_thread->m_comm == threadinfo->m_comm) &&
+				(parent_thread->get_exe_owner()->m_exe == threadinfo->get_exe_owner()->m_exe))
+			{
+				threadinfo->m_progid = parent_thread->m_tid;
+				++parent_thread->m_nchilds;
+				increment_program_childcount(parent_thread);
+			}
+		}
+	}
+}
+
+// Don't set level, it's for internal use
+void sinsp_thread_manager::decrement_program_childcount(sinsp_threadinfo* threadinfo, uint32_t level)
+{
+	if(threadinfo->is_main_thread())
+	{
+		ASSERT(threadinfo->m_pid != threadinfo->m_progid);
+
+		sinsp_threadinfo* prog_thread = m_inspector->get_thread(threadinfo->m_progid, false);
+
+		if(prog_thread)
+		{
+			if(prog_thread->m_nchilds > 0)
+			{
+				--prog_thread->m_nchilds;
+				decrement_program_childcount(prog_thread, level + 1);
+			}
+			else
+			{
+				ASSERT(false);
+			}
+		}
+
+		if(level == 0)
+		{
+			threadinfo->m_progid = -1LL;
+			threadinfo->m_main_program_thread = NULL;
+		}
+	}
+}
+
+void sinsp_thread_manager::add_thread(sinsp_threadinfo& threadinfo, bool from_scap_proctable)
+{
+	sinsp_alloc_scope alloc_scope(SAS_THREADS);
+
+#ifdef GATHER_INTERNAL_STATS
+	m_added_threads->increment();
+#endif
+
+	if(m_threadtable.size() >= m_inspector->m_max_thread_table_size)
+	{
+		m_n_drops++;
+		return;
+	}
+
+	if(!from_scap_proctable)
+	{
+		increment_mainthread_childcount(&threadinfo);
+		increment_program_childcount(&threadinfo);
+	}
+
+	//
+	// The copy overwrites the list links of an existing entry
+	//
+	sinsp_threadinfo* oldentry = m_threadindex.find(threadinfo.m_tid);
+	if(oldentry != NULL)
+	{
+		lru_remove(oldentry);
+	}
+
+	//
+	// A new thread with the tid of one that exited
+	//
+	m_tombstones.erase(threadinfo.m_tid);
+
+	size_t nbuckets = m_threadtable.bucket_count();
+	sinsp_threadinfo& newentry = (m_threadtable[threadinfo.m_tid] = threadinfo);
+
+	if(m_threadtable.bucket_count() != nbuckets)
+	{
+		m_n_table_rehashes++;
+	}
+	m_threadindex.insert(threadinfo.m_tid, &newentry);
+	m_generation++;
+	lru_push(&newentry, m_inspector->m_lastevent_ts);
+
+	//
+	// The threads from /proc are added to the process tree once they are
+	// all in the table
+	//
+	if(!from_scap_proctable && newentry.is_main_thread())
+	{
+		sinsp_threadinfo* ptinfo = m_threadindex.find(newentry.m_ptid);
+
+		m_proc_tree.add(newentry.m_pid,
+			(ptinfo != NULL)? ptinfo->m_pid : newentry.m_ptid,
+			newentry.m_comm);
+	}
+	newentry.allocate_private_state();
+	if(m_listener)
+	{
+		m_listener->on_thread_created(&newentry);
+	}
+
+	if(!m_inspector->m_state_listeners.empty())
+	{
+		vector<sinsp_state_listener*>::const_iterator sit;
+
+		for(sit = m_inspector->m_state_listeners.begin(); sit != m_inspector->m_state_listeners.end(); ++sit)
+		{
+			(*sit)->on_thread_added(&newentry);
+		}
+	}
+}
+
+void sinsp_thread_manager::add_to_proc_tree(sinsp_threadinfo* tinfo)
+{
+	vector<sinsp_threadinfo*> chain;
+
+	//
+	// Go up to the first ancestor that is already in the tree, then add the
+	// ones below it starting from the top. The depth is bounded, in case
+	// the parent links that come from /proc have a loop.
+	//
+	while(tinfo != NULL &&
+		tinfo->is_main_thread() &&
+		!m_proc_tree.contains(tinfo->m_pid) &&
+		chain.size() < PROC_TREE_MAX_IMPORT_DEPTH)
+	{
+		chain.push_back(tinfo);
+
+		if(tinfo->m_ptid == tinfo->m_pid)
+		{
+			break;
+		}
+
+		tinfo = m_threadindex.find(tinfo->m_ptid);
+		if(tinfo != NULL && !tinfo->is_main_thread())
+		{
+			tinfo = m_threadindex.find(tinfo->m_pid);
+		}
+	}
+
+	for(vector<sinsp_threadinfo*>::reverse_iterator it = chain.rbegin(); it != chain.rend(); ++it)
+	{
+		if(!m_proc_tree.contains((*it)->m_pid))
+		{
+			m_proc_tree.add((*it)->m_pid, (*it)->m_ptid, (*it)->m_comm);
+		}
+	}
+}
+
+void sinsp_thread_manager::remove_thread(int64_t tid)
+{
+	remove_thread(m_threadtable.find(tid));
+}
+
+//
+// The fds can be shared with other processes, so the listeners get a copy
+//
+bool sinsp_thread_manager::erase_fd_visitor(int64_t fd, sinsp_fdinfo_t* fdinfo, void* arg)
+{
+	erase_fd_params* eparams = (erase_fd_params*)arg;
+	sinsp_fdinfo_t fdcopy = *fdinfo;
+
+	//
+	// The canceled fd should always be deleted immediately, so if it appears
+	// here it means we have a problem.
+	//
+	ASSERT(fd != CANCELED_FD_NUMBER);
+	eparams->m_fd = fd;
+	eparams->m_fdinfo = &fdcopy;
+
+	eparams->m_inspector->m_parser->erase_fd(eparams);
+	return false;
+}
+
+void sinsp_thread_manager::remove_thread(threadinfo_map_iterator_t it)
+{
+	sinsp_alloc_scope alloc_scope(SAS_THREADS);
+
+	if(it == m_threadtable.end())
+	{
+		//
+		// Looks like there's no thread to remove.
+		// Either the thread creation event was dropped or our logic doesn't support the
+		// call that created this thread. The assertion will detect it, while in release mode we just
+		// keep going.
+		//
+#ifdef GATHER_INTERNAL_STATS
+		m_failed_lookups->increment();
+#endif
+		return;
+	}
+	else if(it->second.m_nchilds == 0)
+	{
+		//
+		// Decrement the refcount of the main thread/program because
+		// this reference is gone
+		//
+		if(it->second.m_flags & PPM_CL_CLONE_THREAD)
 		{
 			ASSERT(it->second.m_pid != it->second.m_tid);
 			sinsp_threadinfo* main_thread = m_inspector->get_thread(it->second.m_pid, false);
@@ -777,6 +2061,16 @@ void sinsp_thread_manager::remove_thread(threadinfo_map_iterator_t it)
 			{
 				ASSERT(main_thread->m_nchilds);
 				--main_thread->m_nchilds;
+
+				//
+				// A main thread that exited before its threads goes
+				// with the last of them, instead of waiting for the
+				// inactive thread scan
+				//
+				if(main_thread->m_nchilds == 0 && (main_thread->m_flags & PPM_CL_CLOSED))
+				{
+					m_inspector->m_tids_to_remove.push_back(main_thread->m_tid);
+				}
 			}
 			else
 			{
@@ -793,8 +2087,7 @@ void sinsp_thread_manager::remove_thread(threadinfo_map_iterator_t it)
 		//
 		if(it->second.m_pid == it->second.m_tid)
 		{
-			unordered_map<int64_t, sinsp_fdinfo_t> fdtable = it->second.get_fd_table()->m_table;
-			unordered_map<int64_t, sinsp_fdinfo_t>::iterator fdit;
+			m_proc_tree.remove(it->second.m_pid);
 
 			erase_fd_params eparams;
 			eparams.m_remove_from_table = false;
@@ -802,31 +2095,36 @@ void sinsp_thread_manager::remove_thread(threadinfo_map_iterator_t it)
 			eparams.m_tinfo = &(it->second);
 			eparams.m_ts = m_inspector->m_lastevent_ts;
 
-			for(fdit = fdtable.begin(); fdit != fdtable.end(); ++fdit)
-			{
-				eparams.m_fd = fdit->first;
+			it->second.get_fd_table()->visit(erase_fd_visitor, &eparams);
+		}
 
-				//
-				// The canceled fd should always be deleted immediately, so if it appears
-				// here it means we have a problem.
-				//
-				ASSERT(eparams.m_fd != CANCELED_FD_NUMBER);
-				eparams.m_fdinfo = &(fdit->second);
+		if(!m_inspector->m_state_listeners.empty())
+		{
+			vector<sinsp_state_listener*>::const_iterator sit;
 
-				m_inspector->m_parser->erase_fd(&eparams);
+			for(sit = m_inspector->m_state_listeners.begin(); sit != m_inspector->m_state_listeners.end(); ++sit)
+			{
+				(*sit)->on_thread_removed(&it->second);
 			}
 		}
 
 		//
-		// Reset the cache
+		// A thread that is already there was added back from its
+		// tombstone, which keeps the time it exited
 		//
-		m_last_tid = 0;
-		m_last_tinfo = NULL;
+		if((it->second.m_flags & PPM_CL_CLOSED) && m_tombstones.find(it->first) == NULL)
+		{
+			m_tombstones.add(&it->second, m_inspector->m_lastevent_ts);
+		}
+
+		remove_from_cache(&it->second);
+		lru_remove(&it->second);
 
 #ifdef GATHER_INTERNAL_STATS
 		m_removed_threads->increment();
 #endif
 
+		m_threadindex.erase(it->first);
 		m_threadtable.erase(it);
 	}
 }
@@ -838,32 +2136,337 @@ void sinsp_thread_manager::remove_inactive_threads()
 		m_last_flush_time_ns = m_inspector->m_lastevent_ts;
 	}
 
-	if(m_inspector->m_lastevent_ts > 
-		m_last_flush_time_ns + m_inspector->m_inactive_thread_scan_time_ns)
+	//
+	// Nothing is removed during the first scan interval, so that the threads
+	// that came from /proc have the time to be looked up
+	//
+	uint64_t ts = m_inspector->m_lastevent_ts;
+
+	if(m_last_compaction_ts == 0)
+	{
+		m_last_compaction_ts = ts;
+	}
+	else if(ts > m_last_compaction_ts + SP_THREAD_TABLE_COMPACTION_INTERVAL_NS)
+	{
+		compact();
+		m_last_compaction_ts = ts;
+	}
+
+	if(ts <= m_last_flush_time_ns + m_inspector->m_inactive_thread_scan_time_ns)
 	{
-		m_last_flush_time_ns = m_inspector->m_lastevent_ts;
+		return;
+	}
+
+	//
+	// Only the head of the list can have expired, and the check stops at the
+	// first thread that hasn't. m_lru_ts lags behind m_lastaccess_ts by at most
+	// THREAD_LRU_UPDATE_INTERVAL_NS, so a thread seen as expired by m_lru_ts
+	// may still be active: it goes back in the list.
+	//
+	uint32_t j;
+
+	for(j = 0; j < INACTIVE_THREADS_PER_EVENT && m_lru_head != NULL; j++)
+	{
+		sinsp_threadinfo* tinfo = m_lru_head;
 
-		for(threadinfo_map_iterator_t it = m_threadtable.begin(); it != m_threadtable.end();)
+		if(ts <= tinfo->m_lru_ts + m_inspector->m_thread_timeout_ns)
 		{
-			if(it->second.m_nchilds == 0 &&
-				m_inspector->m_lastevent_ts > 
-				it->second.m_lastaccess_ts + m_inspector->m_thread_timeout_ns)
-			{
-				//
-				// Reset the cache
-				//
-				m_last_tid = 0;
-				m_last_tinfo = NULL;
+			break;
+		}
+
+		lru_remove(tinfo);
+
+		if(tinfo->m_nchilds == 0 &&
+			ts > tinfo->m_lastaccess_ts + m_inspector->m_thread_timeout_ns)
+		{
+			remove_from_cache(tinfo);
 
 #ifdef GATHER_INTERNAL_STATS
-				m_removed_threads->increment();
+			m_removed_threads->increment();
 #endif
-				m_threadtable.erase(it++);
-			}
-			else
-			{
-				++it;
-			}
+			int64_t tid = tinfo->m_tid;
+			m_threadindex.erase(tid);
+			m_threadtable.erase(tid);
+		}
+		else
+		{
+			//
+			// Threads with children are checked again after another timeout
+			//
+			lru_push(tinfo, (tinfo->m_nchilds == 0)? tinfo->m_lastaccess_ts : ts);
+		}
+	}
+}
+
+void sinsp_thread_manager::compact()
+{
+	bool shrunk = m_threadindex.shrink();
+
+	//
+	// Same rule as the index for the buckets of the table. Rehashing
+	// doesn't move the entries, so the pointers to them stay valid.
+	//
+	size_t nbuckets = m_threadtable.bucket_count();
+	size_t needed = (size_t)(m_threadtable.size() / m_threadtable.max_load_factor()) + 1;
+
+	if(nbuckets > 256 && nbuckets > needed * 8)
+	{
+		m_threadtable.rehash(needed * 4);
+
+		if(m_threadtable.bucket_count() < nbuckets)
+		{
+			m_n_table_rehashes++;
+			shrunk = true;
+		}
+	}
+
+	if(shrunk)
+	{
+		m_n_compactions++;
+	}
+}
+
+sinsp_threadinfo* sinsp_thread_manager::add_exited_thread(int64_t tid)
+{
+	sinsp_thread_tombstones::entry* e = m_tombstones.find(tid);
+
+	if(e == NULL || m_inspector->m_lastevent_ts > e->m_exit_ts + SP_THREAD_TOMBSTONE_TIMEOUT_NS)
+	{
+		return NULL;
+	}
+
+	sinsp_threadinfo newti(m_inspector);
+	uint64_t exit_ts = e->m_exit_ts;
+
+	newti.m_tid = e->m_tid;
+	newti.m_pid = e->m_pid;
+	newti.m_ptid = e->m_ptid;
+	newti.m_uid = e->m_uid;
+	newti.m_gid = e->m_gid;
+	newti.m_comm = e->m_comm;
+	newti.m_exe = e->m_exe;
+	newti.m_flags = PPM_CL_CLOSED;
+
+	//
+	// It's not in the process tree, and doesn't count as a child of its
+	// process
+	//
+	add_thread(newti, true);
+
+	sinsp_threadinfo* tinfo = get_thread(tid);
+	if(tinfo == NULL)
+	{
+		return NULL;
+	}
+
+	m_tombstones.add(tinfo, exit_ts);
+	m_inspector->m_tids_to_remove.push_back(tid);
+	m_n_tombstone_hits++;
+	return tinfo;
+}
+
+uint64_t sinsp_thread_manager::get_memory_usage()
+{
+	uint64_t res = m_threadtable.size() * sizeof(sinsp_threadinfo);
+
+	if(m_n_fd_entries > 0)
+	{
+		res += m_n_fd_entries * sizeof(sinsp_fdinfo_t);
+	}
+
+	return res + m_string_pool.get_memory_usage() + m_path_cache.get_memory_usage() +
+		m_evt_buffer_pool.get_memory_usage();
+}
+
+//
+// The top entries are kept in a heap of at most n entries, with the
+// smallest on top, so that ranking the table doesn't copy the entries that
+// don't make it
+//
+struct io_top_params
+{
+	sinsp_io_counter m_counter;
+	uint32_t m_n;
+	vector<sinsp_io_top_entry>* m_res;
+	sinsp_threadinfo* m_tinfo;
+};
+
+struct io_top_greater
+{
+	io_top_greater(sinsp_io_counter counter) :
+		m_counter(counter)
+	{
+	}
+
+	bool operator()(const sinsp_io_top_entry& a, const sinsp_io_top_entry& b) const
+	{
+		return a.m_counters.get(m_counter) > b.m_counters.get(m_counter);
+	}
+
+	sinsp_io_counter m_counter;
+};
+
+static void io_top_add(io_top_params* params, const sinsp_io_counters& counters, int64_t tid, int64_t pid, int64_t fd, const string& name)
+{
+	vector<sinsp_io_top_entry>* res = params->m_res;
+	uint64_t val = counters.get(params->m_counter);
+
+	if(val == 0 || params->m_n == 0)
+	{
+		return;
+	}
+
+	if(res->size() == params->m_n)
+	{
+		if(val <= res->front().m_counters.get(params->m_counter))
+		{
+			return;
+		}
+
+		pop_heap(res->begin(), res->end(), io_top_greater(params->m_counter));
+		res->pop_back();
+	}
+
+	res->push_back(sinsp_io_top_entry());
+	sinsp_io_top_entry& entry = res->back();
+	entry.m_tid = tid;
+	entry.m_pid = pid;
+	entry.m_fd = fd;
+	entry.m_name = name;
+	entry.m_counters = counters;
+	push_heap(res->begin(), res->end(), io_top_greater(params->m_counter));
+}
+
+static bool io_top_fd_visitor(int64_t fd, sinsp_fdinfo_t* fdinfo, void* arg)
+{
+	io_top_params* params = (io_top_params*)arg;
+
+	io_top_add(params, fdinfo->m_io, params->m_tinfo->m_tid, params->m_tinfo->m_pid, fd, fdinfo->m_name.str());
+	return false;
+}
+
+void sinsp_thread_manager::get_top_fds(sinsp_io_counter counter, uint32_t n, OUT vector<sinsp_io_top_entry>* res)
+{
+	io_top_params params;
+	params.m_counter = counter;
+	params.m_n = n;
+	params.m_res = res;
+
+	res->clear();
+
+	//
+	// Only the main threads have their own fd table
+	//
+	for(threadinfo_map_iterator_t it = m_threadtable.begin(); it != m_threadtable.end(); ++it)
+	{
+		params.m_tinfo = &it->second;
+		it->second.m_fdtable.visit(io_top_fd_visitor, &params);
+	}
+
+	sort_heap(res->begin(), res->end(), io_top_greater(counter));
+}
+
+void sinsp_thread_manager::get_top_threads(sinsp_io_counter counter, uint32_t n, OUT vector<sinsp_io_top_entry>* res)
+{
+	io_top_params params;
+	params.m_counter = counter;
+	params.m_n = n;
+	params.m_res = res;
+
+	res->clear();
+
+	for(threadinfo_map_iterator_t it = m_threadtable.begin(); it != m_threadtable.end(); ++it)
+	{
+		io_top_add(&params, it->second.m_io, it->second.m_tid, it->second.m_pid, -1, it->second.get_comm());
+	}
+
+	sort_heap(res->begin(), res->end(), io_top_greater(counter));
+}
+
+//
+// Drop the fds of a process, as if they had been closed
+//
+void sinsp_thread_manager::evict_fds(sinsp_threadinfo* tinfo)
+{
+	erase_fd_params eparams;
+	eparams.m_remove_from_table = false;
+	eparams.m_inspector = m_inspector;
+	eparams.m_tinfo = tinfo;
+	eparams.m_ts = m_inspector->m_lastevent_ts;
+
+	m_n_evicted_fds += tinfo->m_fdtable.size();
+	tinfo->m_fdtable.visit(erase_fd_visitor, &eparams);
+	tinfo->m_fdtable.clear();
+}
+
+//
+// When the memory used goes over the budget, drop the state of the least
+// recently active threads, starting from the fds. It's done incrementally,
+// scanning at most MEMORY_EVICTION_SCAN_LENGTH threads for each event. The
+// threads that were active in the last THREAD_LRU_UPDATE_INTERVAL_NS are
+// never dropped.
+//
+void sinsp_thread_manager::enforce_memory_budget()
+{
+	uint64_t max_memory = m_inspector->m_max_memory;
+	uint64_t ts = m_inspector->m_lastevent_ts;
+	sinsp_threadinfo* tinfo;
+	sinsp_threadinfo* next;
+	uint32_t j;
+
+	if(max_memory == 0 || get_memory_usage() <= max_memory)
+	{
+		return;
+	}
+
+	//
+	// The threads that have fds waiting to be removed must keep them
+	//
+	int64_t busy_tid = m_inspector->m_fds_to_remove->empty()? -1 : m_inspector->m_tid_of_fd_to_remove;
+
+	for(j = 0, tinfo = m_lru_head; j < MEMORY_EVICTION_SCAN_LENGTH && tinfo != NULL; j++, tinfo = tinfo->m_lru_next)
+	{
+		if(ts <= tinfo->m_lru_ts + THREAD_LRU_UPDATE_INTERVAL_NS)
+		{
+			return;
+		}
+
+		if(tinfo->m_fdtable.empty() || tinfo->m_tid == busy_tid)
+		{
+			continue;
+		}
+
+		evict_fds(tinfo);
+
+		if(get_memory_usage() <= max_memory)
+		{
+			return;
+		}
+	}
+
+	//
+	// Removing the fds was not enough
+	//
+	for(j = 0, tinfo = m_lru_head; j < MEMORY_EVICTION_SCAN_LENGTH && tinfo != NULL; j++, tinfo = next)
+	{
+		next = tinfo->m_lru_next;
+
+		if(ts <= tinfo->m_lru_ts + THREAD_LRU_UPDATE_INTERVAL_NS)
+		{
+			return;
+		}
+
+		if(tinfo->m_nchilds != 0 || tinfo->m_tid == busy_tid)
+		{
+			continue;
+		}
+
+		m_n_evicted_threads++;
+		remove_thread(tinfo->m_tid);
+
+		if(get_memory_usage() <= max_memory)
+		{
+			return;
 		}
 	}
 }
@@ -878,6 +2481,76 @@ void sinsp_thread_manager::fix_sockets_coming_from_proc()
 	}
 }
 
+//
+// Build a table in the format of scap_get_proc_table() from the threads we
+// are tracking
+//
+//
+// With tids, only the processes of those threads, and their ancestors, are
+// in the table, with all their threads
+//
+scap_threadinfo* sinsp_thread_manager::to_scap_table(const set<int64_t>* tids)
+{
+	threadinfo_map_iterator_t it;
+	scap_threadinfo* table = NULL;
+	scap_threadinfo* pi;
+	int32_t uth_status = SCAP_SUCCESS;
+	set<int64_t> pids;
+
+	if(tids != NULL)
+	{
+		for(set<int64_t>::const_iterator tit = tids->begin(); tit != tids->end(); ++tit)
+		{
+			it = m_threadtable.find(*tit);
+
+			while(it != m_threadtable.end() && pids.insert(it->second.m_pid).second)
+			{
+				it = m_threadtable.find(it->second.m_ptid);
+			}
+		}
+	}
+
+	for(it = m_threadtable.begin(); it != m_threadtable.end(); ++it)
+	{
+		if(tids != NULL && pids.find(it->second.m_pid) == pids.end())
+		{
+			continue;
+		}
+
+		try
+		{
+			pi = it->second.to_scap();
+		}
+		catch(...)
+		{
+			free_scap_table(table);
+			throw;
+		}
+
+		HASH_ADD_INT64(table, tid, pi);
+		if(uth_status != SCAP_SUCCESS)
+		{
+			free_scap_proc(pi);
+			free_scap_table(table);
+			throw sinsp_exception("process table allocation error in sinsp_thread_manager::to_scap_table");
+		}
+	}
+
+	return table;
+}
+
+void sinsp_thread_manager::free_scap_table(scap_threadinfo* table)
+{
+	scap_threadinfo* pi;
+	scap_threadinfo* tpi;
+
+	HASH_ITER(hh, table, pi, tpi)
+	{
+		HASH_DEL(table, pi);
+		free_scap_proc(pi);
+	}
+}
+
 
 void sinsp_thread_manager::update_statistics()
 {
@@ -889,5 +2562,9 @@ void sinsp_thread_manager::update_statistics()
 	{
 		m_inspector->m_stats.m_n_fds += it->second.get_fd_table()->size();
 	}
+
+	m_inspector->m_stats.m_n_evicted_fds = m_n_evicted_fds;
+	m_inspector->m_stats.m_n_evicted_threads = m_n_evicted_threads;
+	m_inspector->m_stats.m_memory_usage = get_memory_usage();
 #endif
 }
@@ -36,6 +36,67 @@ typedef struct erase_fd_params
 	uint64_t m_ts;
 }erase_fd_params;
 
+///////////////////////////////////////////////////////////////////////////////
+// Free lists of the buffers that keep the enter events, one per size class
+// (see SP_EVT_BUF_MIN_SIZE). Each inspector has its own.
+///////////////////////////////////////////////////////////////////////////////
+class sinsp_evt_buffer_pool
+{
+public:
+	sinsp_evt_buffer_pool();
+	~sinsp_evt_buffer_pool();
+	uint8_t* alloc(uint32_t size, OUT uint32_t* sclass);
+	void free(uint8_t* buf, uint32_t sclass);
+
+	static uint32_t get_class_size(uint32_t sclass)
+	{
+		return SP_EVT_BUF_MIN_SIZE << (2 * sclass);
+	}
+
+	//
+	// Bytes of all the buffers allocated by the pool, in use or free
+	//
+	uint64_t get_memory_usage()
+	{
+		return m_nbytes;
+	}
+
+private:
+	vector<uint8_t*> m_free_lists[SP_EVT_BUF_NCLASSES];
+	uint64_t m_nbytes;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// A buffer taken from a sinsp_evt_buffer_pool, given back when released or
+// destroyed. Copies get their own buffer with the same content.
+///////////////////////////////////////////////////////////////////////////////
+class SINSP_PUBLIC sinsp_evt_buffer
+{
+public:
+	sinsp_evt_buffer();
+	sinsp_evt_buffer(const sinsp_evt_buffer& other);
+	~sinsp_evt_buffer();
+	sinsp_evt_buffer& operator=(const sinsp_evt_buffer& other);
+
+	//
+	// Make sure the buffer can hold size bytes. The content is not preserved.
+	// Returns NULL if size is bigger than SP_EVT_BUF_SIZE
+	//
+	uint8_t* reserve(sinsp_evt_buffer_pool* pool, uint32_t size);
+	void release();
+
+	uint8_t* get()
+	{
+		return m_data;
+	}
+
+private:
+	uint8_t* m_data;
+	uint32_t m_size;
+	uint32_t m_sclass;
+	sinsp_evt_buffer_pool* m_pool;
+};
+
 /** @defgroup state State management 
  *  @{
  */
@@ -61,17 +122,32 @@ public:
 	/*!
 	  \brief Return the name of the process containing this thread, e.g. "top".
 	*/
-	string get_comm();
+	const string& get_comm();
 
 	/*!
 	  \brief Return the full name of the process containing this thread, e.g. "/bin/top".
 	*/
-	string get_exe();
+	const string& get_exe();
+
+	/*!
+	  \brief Return the command line arguments of the process containing this thread.
+
+	  \note The arguments are split the first time they are requested
+	   after an execve.
+	*/
+	const vector<sinsp_pooled_string>& get_args();
+
+	/*!
+	  \brief Return the command line arguments of the process containing
+	   this thread, as they come from the kernel: each one followed by a
+	   NUL character.
+	*/
+	const sinsp_pooled_string& get_raw_args();
 
 	/*!
 	  \brief Return the working directory of the process containing this thread.
 	*/
-	string get_cwd();
+	const string& get_cwd();
 
 	/*!
 	  \brief Return true if this is a process' main thread.
@@ -103,6 +179,26 @@ public:
 	*/
 	bool is_bound_to_port(uint16_t number);
 
+	/*!
+	  \brief Return true if events of the capture were lost since this
+	   thread was first seen, so that its state can be out of date.
+	   Staleness is conservative: any lost event, on any CPU, between two
+	   events of the thread counts.
+	*/
+	bool is_stale()
+	{
+		return m_stale_gen != 0;
+	}
+
+	/*!
+	  \brief Return true if the given FD of this thread was opened before
+	   events were lost, so that it could have been closed or replaced.
+	*/
+	bool is_fd_stale(sinsp_fdinfo_t* fdinfo)
+	{
+		return m_stale_gen != 0 && fdinfo->m_drop_gen < m_stale_gen;
+	}
+
 	/*!
 	  \brief Return true if this thread has a client socket open on the given port.
 	*/
@@ -117,14 +213,15 @@ public:
 	int64_t m_pid; ///< The id of the process containing this thread. In single thread threads, this is equal to tid.
 	int64_t m_ptid; ///< The id of the process that started this thread.
 	int64_t m_progid; ///< Main program id. If this process is part of a logical group of processes (e.g. it's one of the apache processes), the tid of the process that is the head of this group.
-	string m_comm; ///< Command name (e.g. "top")
-	string m_exe; ///< Full command name (e.g. "/bin/top")
-	vector<string> m_args; ///< Command line arguments (e.g. "-d1")
+	sinsp_pooled_string m_comm; ///< Command name (e.g. "top")
+	sinsp_pooled_string m_exe; ///< Full command name (e.g. "/bin/top"). Empty in the threads that share it with their main thread: use \ref get_exe.
+	sinsp_pooled_string m_args; ///< Command line arguments (e.g. "-d1"), each followed by a NUL character. Empty in the threads that share them with their main thread: use \ref get_args or \ref get_raw_args.
 	uint32_t m_flags; ///< The thread flags. See the PPM_CL_* declarations in ppm_events_public.h.
 	int64_t m_fdlimit;  ///< The maximum number of FDs this thread can open
 	uint32_t m_fd_usage_pct; ///< The ratio between open FDs and maximum available FDs for this thread
 	uint32_t m_uid; ///< user id
 	uint32_t m_gid; ///< group id
+	uint32_t m_container_num; ///< Number of the thread's container, see sinsp_container_manager
 	uint64_t m_nchilds; ///< When this is 0 the process can be deleted
 
 	//
@@ -136,6 +233,24 @@ public:
 	uint64_t m_lastaccess_ts;  ///< The last time this thread was looked up. Used when cleaning up the table. 
 	uint64_t m_clone_ts;  ///< When the clone that started this process happened.
 
+	//
+	// Context switch summaries
+	//
+	uint64_t m_switch_exectime; ///< Total CPU time of the thread in its last switch summary. 0 if no summary was seen.
+	uint64_t m_switch_vcsw; ///< Voluntary context switches of the thread in its last switch summary.
+	uint64_t m_switch_ivcsw; ///< Involuntary context switches of the thread in its last switch summary.
+	uint64_t m_switch_exectime_delta; ///< CPU time between the last two switch summaries.
+	uint64_t m_switch_vcsw_delta; ///< Voluntary context switches between the last two switch summaries.
+	uint64_t m_switch_ivcsw_delta; ///< Involuntary context switches between the last two switch summaries.
+
+	//
+	// Page fault summaries
+	//
+	uint64_t m_pfmajor; ///< Major page faults of the process in the pgfault events of its threads. Only kept in the main thread.
+	uint64_t m_pfminor; ///< Minor page faults of the process in the pgfault events of its threads. Only kept in the main thread.
+
+	sinsp_io_counters m_io; ///< Reads and writes of this thread, on all its FDs.
+
 	thread_analyzer_info* m_ainfo;
 
 #ifdef HAS_FILTERING
@@ -144,6 +259,18 @@ public:
 	//
 	uint64_t m_last_latency_entertime;
 	uint64_t m_latency;
+	uint64_t m_offcpu; // Time spent switched out since the last syscall enter
+	uint64_t m_offcpu_start; // When the thread was switched out, 0 if it's running
+
+	//
+	// Results of the filter checks that only depend on the state of the
+	// thread (see sinsp_filter_check::is_thread_state()), by their slot in
+	// the sinsp_field_cache. Each one is the state generation it was
+	// computed at, shifted left by one, with the result in the low bit. It's
+	// valid if it's not older than m_state_gen.
+	//
+	vector<uint64_t> m_check_results;
+	uint64_t m_state_gen; ///< Generation of the last change of the state of the thread, see sinsp_thread_manager::next_state_generation()
 #endif
 
 	//
@@ -154,17 +281,28 @@ public:
 VISIBILITY_PRIVATE
 	void init();
 	void init(const scap_threadinfo* pi);
+	sinsp_fdinfo_t* add_fd_from_scap(scap_fdinfo* fdi);
+	scap_threadinfo* to_scap();
 	void fix_sockets_coming_from_proc();
 	sinsp_fdinfo_t* add_fd(int64_t fd, sinsp_fdinfo_t *fdinfo);
 	void remove_fd(int64_t fd);
 	sinsp_fdtable* get_fd_table();
 	void set_cwd(const char *cwd, uint32_t cwdlen);
 	sinsp_threadinfo* get_cwd_root();
+	const sinsp_pooled_string& get_pooled_cwd();
 	void set_args(const char* args, size_t len);
+	sinsp_string_pool* get_string_pool();
+	sinsp_threadinfo* get_exe_owner();
+	sinsp_threadinfo* get_args_owner();
 	void store_event(sinsp_evt *evt);
+	uint8_t* reserve_lastevent_data(uint32_t size);
+	void release_lastevent_data();
+	void share_process_info();
 	bool is_lastevent_data_valid();
 	void set_lastevent_data_validity(bool isvalid);
 	void allocate_private_state();
+	void add_private_state();
+	void state_changed();
 
 	//  void push_fdop(sinsp_fdop* op);
 	// the queue of recent fd operations
@@ -175,10 +313,20 @@ VISIBILITY_PRIVATE
 	// parent thread info
 	//
 	sinsp_fdtable m_fdtable; // The fd table of this thread
-	string m_cwd; // current working directory
+	sinsp_pooled_string m_cwd; // current working directory, with the trailing slash
+	vector<sinsp_pooled_string> m_split_args; // m_args split by get_args()
+	sinsp_pooled_string m_split_args_src; // The m_args that m_split_args comes from
 	sinsp_threadinfo* m_main_thread;
 	sinsp_threadinfo* m_main_program_thread;
-	uint8_t m_lastevent_data[SP_EVT_BUF_SIZE]; // Used by some event parsers to store the last enter event
+	sinsp_threadinfo* m_parent_thread; // Result of the last get_parent_thread() lookup
+	int64_t m_parent_tid; // The m_ptid of that lookup
+	uint64_t m_parent_generation; // The thread table generation of that lookup
+	sinsp_threadinfo* m_lru_prev; // Position in the thread manager list ordered by access
+	sinsp_threadinfo* m_lru_next;
+	uint64_t m_lru_ts; // m_lastaccess_ts when the thread was moved in the list
+	uint32_t m_drop_gen; // sinsp::m_drop_gen at the last event of this thread
+	uint32_t m_stale_gen; // The first sinsp::m_drop_gen this thread missed, 0 if none
+	sinsp_evt_buffer m_lastevent_data; // Used by some event parsers to store the last enter event, until the exit arrives
 	vector<void*> m_private_state;
 
 	uint16_t m_lastevent_type;
@@ -193,6 +341,7 @@ VISIBILITY_PRIVATE
 	friend class sinsp_thread_manager;
 	friend class sinsp_transaction_table;
 	friend class thread_analyzer_info;
+	friend class sinsp_snapshot_publisher;
 };
 
 /*@}*/
@@ -227,6 +376,306 @@ private:
 	friend class sinsp_threadinfo;
 };
 
+///////////////////////////////////////////////////////////////////////////////
+// Open addressing index of the thread table, from the tid to the entry in the
+// map. The map entries never move, so the index only changes when threads are
+// added or removed.
+///////////////////////////////////////////////////////////////////////////////
+class sinsp_thread_index
+{
+public:
+	sinsp_thread_index();
+
+	sinsp_threadinfo* find(int64_t tid)
+	{
+		uint64_t j;
+
+		for(j = get_slot(tid); m_entries[j].m_tinfo != NULL; j = (j + 1) & m_mask)
+		{
+			if(m_entries[j].m_tid == tid)
+			{
+				return m_entries[j].m_tinfo;
+			}
+		}
+
+		return NULL;
+	}
+
+	// If the tid is already present, the entry is replaced
+	void insert(int64_t tid, sinsp_threadinfo* tinfo);
+	void erase(int64_t tid);
+	void clear();
+
+	//
+	// Give back the slots left by a burst of threads that are gone. Return
+	// true if the table got smaller.
+	//
+	bool shrink();
+
+	uint32_t capacity()
+	{
+		return m_entries.size();
+	}
+
+	// Number of times the table was resized, up or down
+	uint64_t get_n_resizes()
+	{
+		return m_n_resizes;
+	}
+
+private:
+	struct entry
+	{
+		int64_t m_tid;
+		sinsp_threadinfo* m_tinfo; // NULL for the free slots
+	};
+
+	uint64_t get_slot(int64_t tid)
+	{
+		// Fibonacci hashing, so that close tids don't end up in the same run
+		return ((uint64_t)tid * 0x9E3779B97F4A7C15ULL) >> m_shift;
+	}
+
+	void resize(uint32_t nbits);
+
+	vector<entry> m_entries;
+	uint64_t m_mask;
+	uint32_t m_shift;
+	uint32_t m_count;
+	uint64_t m_n_resizes;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// The threads that were removed from the table after they exited, with what
+// it takes to resolve the events that come after that, e.g. from the other
+// CPUs, without looking for them in /proc, where they are gone. The entries
+// are in a ring of fixed size, the newest one replacing the oldest, so the
+// memory doesn't depend on how many processes come and go.
+///////////////////////////////////////////////////////////////////////////////
+class sinsp_thread_tombstones
+{
+public:
+	struct entry
+	{
+		int64_t m_tid; // -1 for the free slots
+		int64_t m_pid;
+		int64_t m_ptid;
+		uint32_t m_uid;
+		uint32_t m_gid;
+		uint64_t m_exit_ts;
+		sinsp_pooled_string m_comm;
+		sinsp_pooled_string m_exe;
+	};
+
+	sinsp_thread_tombstones(uint32_t size);
+
+	void add(sinsp_threadinfo* tinfo, uint64_t ts);
+
+	entry* find(int64_t tid)
+	{
+		unordered_map<int64_t, uint32_t>::iterator it = m_index.find(tid);
+		return (it != m_index.end())? &m_ring[it->second] : NULL;
+	}
+
+	// Forget tid, e.g. when a new thread gets it
+	void erase(int64_t tid);
+	void clear();
+
+	uint32_t size()
+	{
+		return m_index.size();
+	}
+
+private:
+	void release(uint32_t pos);
+
+	vector<entry> m_ring;
+	uint32_t m_next; // Slot of the next entry, the oldest one
+	unordered_map<int64_t, uint32_t> m_index; // Position in the ring of each tid
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// The ports that the sockets of this machine are bound to as servers, with
+// a bitmap for each l4 protocol, so that checking a port is a single bit
+// test. A port is counted once for each socket bound to it, i.e. each fd of
+// a process, and it's cleared when the last of them is closed.
+///////////////////////////////////////////////////////////////////////////////
+class sinsp_server_ports
+{
+public:
+	sinsp_server_ports();
+
+	//
+	// Record that the fd of the process pid is bound to port. An fd that
+	// was already bound to another port is moved to the new one.
+	//
+	void add(int64_t pid, int64_t fd, uint8_t l4proto, uint16_t port);
+
+	//
+	// Forget the port of the fd of the process pid, if it has one
+	//
+	void remove(int64_t pid, int64_t fd);
+
+	void clear();
+
+	bool contains(uint8_t l4proto, uint16_t port)
+	{
+		if(l4proto > SCAP_L4_RAW)
+		{
+			return false;
+		}
+
+		return (m_bitmap[l4proto][port >> 5] >> (port & 31)) & 1;
+	}
+
+private:
+	uint32_t m_bitmap[SCAP_L4_RAW + 1][65536 / 32];
+	unordered_map<uint32_t, uint32_t> m_refcounts; // Sockets bound to each (l4proto << 16 | port)
+	map<pair<int64_t, int64_t>, uint32_t> m_sockets; // (l4proto << 16 | port) of each (pid, fd)
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Index of the pipes and unix sockets of this machine, so that the other
+// end of one can be found without scanning all the fd tables. The pipe ends
+// are indexed by their inode, which both ends share, and the unix sockets
+// by their kernel address, which is the destination of their peer.
+///////////////////////////////////////////////////////////////////////////////
+class sinsp_ipc_index
+{
+public:
+	//
+	// Record the fd of the process pid. An fd that is not a pipe or a unix
+	// socket with a known address is removed instead, since a new fd can
+	// take the number of an indexed one, e.g. with dup2().
+	//
+	void add(int64_t pid, int64_t fd, sinsp_fdinfo_t* fdinfo);
+
+	//
+	// Forget the fd of the process pid, if it's indexed
+	//
+	void remove(int64_t pid, int64_t fd);
+
+	//
+	// Find the other end of the pipe or unix socket fdinfo, which is the fd
+	// of the process pid. The ends in other processes come first, since
+	// after a fork() the parent often still has both ends of a pipe open.
+	//
+	bool find_peer(int64_t pid, int64_t fd, sinsp_fdinfo_t* fdinfo, OUT int64_t* peer_pid, OUT int64_t* peer_fd);
+
+	void clear();
+
+	size_t size()
+	{
+		return m_fds.size();
+	}
+
+private:
+	static uint64_t get_fd_key(int64_t pid, int64_t fd)
+	{
+		return ((uint64_t)pid << 32) | (uint32_t)fd;
+	}
+
+	unordered_multimap<uint64_t, uint64_t> m_ends; // fd key of the ends with each inode or address
+	unordered_map<uint64_t, uint64_t> m_fds; // Inode or address of each fd key, pid << 32 | fd
+};
+
+//
+// A process in the sinsp_proc_tree
+//
+struct sinsp_proc_tree_node
+{
+	int64_t m_pid;
+	uint64_t m_id; // Unique for the life of the tree, since the pids are reused
+	sinsp_proc_tree_node* m_parent; // NULL if the parent is not known
+	sinsp_proc_tree_node* m_jump; // Ancestor to skip to when going up the tree
+	uint32_t m_depth; // 0 for the roots
+	uint32_t m_nchildren;
+	bool m_alive;
+	sinsp_pooled_string m_comm; // Name of the process, or that it had when it exited
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// The tree of the processes, for the ancestor queries. A process is linked
+// to its parent when it's created, and it stays linked to it: the exited
+// processes stay in the tree until their last child is gone, so the
+// ancestors of a process don't change during its life.
+// Since the processes are always added as leaves, each node has a jump
+// pointer to an ancestor, placed like in a skew-binary list, so any
+// ancestor of a node is found in O(log depth) steps.
+///////////////////////////////////////////////////////////////////////////////
+class SINSP_PUBLIC sinsp_proc_tree
+{
+public:
+	sinsp_proc_tree();
+	~sinsp_proc_tree();
+
+	//
+	// Add the process pid, child of the process ppid, or a root if ppid is
+	// not in the tree. A process that had the same pid is considered gone.
+	//
+	void add(int64_t pid, int64_t ppid, const sinsp_pooled_string& comm);
+
+	//
+	// The process exited
+	//
+	void remove(int64_t pid);
+
+	//
+	// The process changed its name, e.g. with execve()
+	//
+	void set_comm(int64_t pid, const sinsp_pooled_string& comm);
+
+	//
+	// Return the running process pid, or NULL if it's not in the tree
+	//
+	sinsp_proc_tree_node* get_node(int64_t pid)
+	{
+		unordered_map<int64_t, sinsp_proc_tree_node*>::iterator it = m_procs.find(pid);
+		return (it != m_procs.end())? it->second : NULL;
+	}
+
+	bool contains(int64_t pid)
+	{
+		return m_procs.find(pid) != m_procs.end();
+	}
+
+	//
+	// Return the ancestor of node that is level generations above it, i.e.
+	// the node itself for 0 and its parent for 1, or NULL if the tree is
+	// not that deep
+	//
+	static sinsp_proc_tree_node* get_ancestor(sinsp_proc_tree_node* node, uint32_t level);
+
+	//
+	// Return true if ancestor is a proper ancestor of node
+	//
+	static bool is_descendant(sinsp_proc_tree_node* node, sinsp_proc_tree_node* ancestor);
+
+	//
+	// Changes every time a process changes its name. The ancestors of a
+	// process never change, but their names can.
+	//
+	uint64_t get_generation()
+	{
+		return m_generation;
+	}
+
+	void clear();
+
+	uint32_t size()
+	{
+		return m_nnodes;
+	}
+
+private:
+	void release(sinsp_proc_tree_node* node);
+
+	unordered_map<int64_t, sinsp_proc_tree_node*> m_procs; // The running processes
+	uint64_t m_next_id;
+	uint64_t m_generation;
+	uint32_t m_nnodes; // Including the exited processes that are still ancestors
+};
+
 ///////////////////////////////////////////////////////////////////////////////
 // This class manages the thread table
 ///////////////////////////////////////////////////////////////////////////////
@@ -242,7 +691,26 @@ public:
 	void remove_thread(int64_t tid);
 	void remove_thread(threadinfo_map_iterator_t it);
 	void remove_inactive_threads();
+	void enforce_memory_budget();
+
+	//
+	// Add the thread tid back from its tombstone, if it exited less than
+	// SP_THREAD_TOMBSTONE_TIMEOUT_NS ago, so that a late event can be
+	// resolved. It's removed again after the event. Return NULL if there's
+	// no tombstone.
+	//
+	sinsp_threadinfo* add_exited_thread(int64_t tid);
+
+	//
+	// Give the memory of a burst of threads that are gone back to the
+	// system: the buckets of the table and the slots of the index, which
+	// don't shrink by themselves. Done every
+	// SP_THREAD_TABLE_COMPACTION_INTERVAL_NS by remove_inactive_threads().
+	//
+	void compact();
 	void fix_sockets_coming_from_proc();
+	scap_threadinfo* to_scap_table(const set<int64_t>* tids = NULL);
+	static void free_scap_table(scap_threadinfo* table);
 
 	uint32_t get_thread_count()
 	{
@@ -251,26 +719,179 @@ public:
 
 	void update_statistics();
 
+	//
+	// Approximate number of bytes used by the threads, their fds and the
+	// buffers of their events
+	//
+	uint64_t get_memory_usage();
+
+	//
+	// Return the n fds, or threads, with the largest value of the counter,
+	// largest first. The entries with a 0 value are never returned.
+	//
+	void get_top_fds(sinsp_io_counter counter, uint32_t n, OUT vector<sinsp_io_top_entry>* res);
+	void get_top_threads(sinsp_io_counter counter, uint32_t n, OUT vector<sinsp_io_top_entry>* res);
+
+	//
+	// Number of entries of all the fd tables
+	//
+	uint64_t get_fd_count()
+	{
+		return (m_n_fd_entries > 0)? m_n_fd_entries : 0;
+	}
+
+	uint64_t get_evicted_fds()
+	{
+		return m_n_evicted_fds;
+	}
+
+	uint64_t get_evicted_threads()
+	{
+		return m_n_evicted_threads;
+	}
+
+	//
+	// Buckets of the table and slots of the index, which stay allocated
+	// after the threads are gone, until compact()
+	//
+	uint64_t get_table_capacity()
+	{
+		return m_threadtable.bucket_count() + m_threadindex.capacity();
+	}
+
+	// Times the table or the index were resized, up or down
+	uint64_t get_table_resizes()
+	{
+		return m_n_table_rehashes + m_threadindex.get_n_resizes();
+	}
+
+	uint64_t get_compactions()
+	{
+		return m_n_compactions;
+	}
+
+	uint32_t get_tombstone_count()
+	{
+		return m_tombstones.size();
+	}
+
+	// Late events resolved from the tombstones
+	uint64_t get_tombstone_hits()
+	{
+		return m_n_tombstone_hits;
+	}
+
+	//
+	// Entries must not be added or removed through the returned map, as
+	// the index wouldn't see them
+	//
 	threadinfo_map_t* get_threads()
 	{
 		return &m_threadtable;
 	}
 
-	set<uint16_t> m_server_ports;
+	//
+	// Changes every time a thread is added to the table or removed from it.
+	// The pointers to the threads that were looked up are valid as long as
+	// it doesn't change.
+	//
+	uint64_t get_generation()
+	{
+		return m_generation;
+	}
+
+	//
+	// Generations of the state of the threads that the filter checks keep
+	// their results for, see sinsp_threadinfo::m_check_results. Every
+	// change of that state takes a new one.
+	//
+	uint64_t next_state_generation()
+	{
+		return ++m_state_generation;
+	}
+
+	uint64_t get_state_generation()
+	{
+		return m_state_generation;
+	}
+
+	//
+	// Forget the results kept in all the threads, e.g. when the user table
+	// changes. The ones older than get_check_results_epoch() are invalid.
+	//
+	void invalidate_check_results()
+	{
+		m_check_results_epoch = ++m_state_generation;
+	}
+
+	uint64_t get_check_results_epoch()
+	{
+		return m_check_results_epoch;
+	}
+
+	sinsp_server_ports m_server_ports;
+	sinsp_ipc_index m_ipc_index;
+	sinsp_proc_tree m_proc_tree;
+
+	//
+	// Add the process of tinfo to the process tree, after its ancestors if
+	// they are not there yet. Used for the threads that come from /proc,
+	// which are not in parent-child order.
+	//
+	void add_to_proc_tree(sinsp_threadinfo* tinfo);
 
 private:
 	void increment_mainthread_childcount(sinsp_threadinfo* threadinfo);
 	void increment_program_childcount(sinsp_threadinfo* threadinfo);
+	void remove_from_cache(sinsp_threadinfo* tinfo);
+	void lru_push(sinsp_threadinfo* tinfo, uint64_t ts);
+	void lru_remove(sinsp_threadinfo* tinfo);
+	inline void touch(sinsp_threadinfo* tinfo);
+	static bool erase_fd_visitor(int64_t fd, sinsp_fdinfo_t* fdinfo, void* arg);
+	void evict_fds(sinsp_threadinfo* tinfo);
 	// Don't set level, it's for internal use
 	void decrement_program_childcount(sinsp_threadinfo* threadinfo, uint32_t level = 0);
 
 	sinsp* m_inspector;
+	// Declared before the table, so it's destroyed after the entries give their buffers back
+	sinsp_evt_buffer_pool m_evt_buffer_pool;
+	// The names of the threads and of their fds
+	sinsp_string_pool m_string_pool;
+	// The full paths of the files opened relative to the cwds and the dirfds
+	sinsp_path_cache m_path_cache;
 	threadinfo_map_t m_threadtable;
-	int64_t m_last_tid;
-	sinsp_threadinfo* m_last_tinfo;
+	sinsp_thread_index m_threadindex;
+	// Declared after the string pool, whose strings it refers to
+	sinsp_thread_tombstones m_tombstones;
+	//
+	// Recently looked up threads, SP_THREAD_CACHE_WAYS for each CPU, most
+	// recent first. The events of a CPU mostly come from a few threads.
+	//
+	struct thread_cache_entry
+	{
+		int64_t m_tid;
+		sinsp_threadinfo* m_tinfo;
+	};
+	vector<thread_cache_entry> m_thread_cache;
+
+	//
+	// The threads, least recently accessed first
+	//
+	sinsp_threadinfo* m_lru_head;
+	sinsp_threadinfo* m_lru_tail;
 	uint64_t m_last_flush_time_ns;
 	uint32_t m_n_drops;
 	uint32_t m_n_proc_lookups;
+	int64_t m_n_fd_entries; // Entries of all the fd tables and their snapshots
+	uint64_t m_generation;
+	uint64_t m_state_generation;
+	uint64_t m_check_results_epoch;
+	uint64_t m_n_evicted_fds;
+	uint64_t m_n_evicted_threads;
+	uint64_t m_n_table_rehashes;
+	uint64_t m_n_compactions;
+	uint64_t m_n_tombstone_hits;
+	uint64_t m_last_compaction_ts;
 
 	sinsp_threadtable_listener* m_listener;
 
@@ -279,9 +900,12 @@ private:
 	INTERNAL_COUNTER(m_non_cached_lookups);
 	INTERNAL_COUNTER(m_added_threads);
 	INTERNAL_COUNTER(m_removed_threads);
+	INTERNAL_COUNTER(m_fd_cached_lookups);
+	INTERNAL_COUNTER(m_fd_non_cached_lookups);
 
 	friend class sinsp_parser;
 	friend class sinsp_analyzer;
 	friend class sinsp;
 	friend class sinsp_threadinfo;
+	friend class sinsp_fdtable;
 };
@@ -0,0 +1,421 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "sinsp.h"
+#include "sinsp_int.h"
+#include "transactinfo.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// sinsp_latency_histogram implementation
+///////////////////////////////////////////////////////////////////////////////
+sinsp_latency_histogram::sinsp_latency_histogram()
+{
+	clear();
+}
+
+//
+// The latencies below 2^LATENCY_HISTOGRAM_SUBBUCKET_BITS have a bucket each.
+// The larger ones are split by the position of their highest bit, and then
+// by the bits that follow it.
+//
+uint32_t sinsp_latency_histogram::get_bucket(uint64_t latency)
+{
+	const uint32_t nsub = 1 << LATENCY_HISTOGRAM_SUBBUCKET_BITS;
+	uint32_t msb = 0;
+	uint64_t v = latency;
+
+	if(latency < nsub)
+	{
+		return (uint32_t)latency;
+	}
+
+	if(v >> 32) { v >>= 32; msb += 32; }
+	if(v >> 16) { v >>= 16; msb += 16; }
+	if(v >> 8) { v >>= 8; msb += 8; }
+	if(v >> 4) { v >>= 4; msb += 4; }
+	if(v >> 2) { v >>= 2; msb += 2; }
+	if(v >> 1) { msb += 1; }
+
+	uint32_t shift = msb - LATENCY_HISTOGRAM_SUBBUCKET_BITS;
+	uint32_t sub = (uint32_t)(latency >> shift) & (nsub - 1);
+
+	return (shift + 1) * nsub + sub;
+}
+
+uint64_t sinsp_latency_histogram::get_bucket_top(uint32_t bucket)
+{
+	const uint32_t nsub = 1 << LATENCY_HISTOGRAM_SUBBUCKET_BITS;
+
+	if(bucket < nsub)
+	{
+		return bucket;
+	}
+
+	uint32_t shift = bucket / nsub - 1;
+	uint64_t bottom = (uint64_t)(nsub + bucket % nsub) << shift;
+
+	return bottom + (((uint64_t)1 << shift) - 1);
+}
+
+void sinsp_latency_histogram::add(uint64_t latency)
+{
+	m_buckets[get_bucket(latency)]++;
+	m_count++;
+	m_total += latency;
+
+	if(latency > m_max)
+	{
+		m_max = latency;
+	}
+}
+
+void sinsp_latency_histogram::clear()
+{
+	memset(m_buckets, 0, sizeof(m_buckets));
+	m_count = 0;
+	m_total = 0;
+	m_max = 0;
+}
+
+void sinsp_latency_histogram::merge(const sinsp_latency_histogram& other)
+{
+	for(uint32_t j = 0; j < LATENCY_HISTOGRAM_NBUCKETS; j++)
+	{
+		m_buckets[j] += other.m_buckets[j];
+	}
+
+	m_count += other.m_count;
+	m_total += other.m_total;
+
+	if(other.m_max > m_max)
+	{
+		m_max = other.m_max;
+	}
+}
+
+void sinsp_latency_histogram::serialize(OUT string* res)
+{
+	uint32_t nbuckets = 0;
+	uint32_t j;
+
+	for(j = 0; j < LATENCY_HISTOGRAM_NBUCKETS; j++)
+	{
+		if(m_buckets[j] != 0)
+		{
+			nbuckets++;
+		}
+	}
+
+	size_t start = sinsp_partial_buffer::put_header(res);
+
+	sinsp_partial_buffer::put(res, m_count);
+	sinsp_partial_buffer::put(res, m_total);
+	sinsp_partial_buffer::put(res, m_max);
+	sinsp_partial_buffer::put(res, nbuckets);
+
+	for(j = 0; j < LATENCY_HISTOGRAM_NBUCKETS; j++)
+	{
+		if(m_buckets[j] != 0)
+		{
+			sinsp_partial_buffer::put(res, (uint16_t)j);
+			sinsp_partial_buffer::put(res, m_buckets[j]);
+		}
+	}
+
+	sinsp_partial_buffer::put_length(res, start);
+}
+
+bool sinsp_latency_histogram::merge_partial(const char* buf, uint32_t len)
+{
+	sinsp_partial_buffer pbuf(buf, len);
+	sinsp_latency_histogram other;
+	uint32_t nbuckets;
+
+	if(!pbuf.get_header() ||
+		!pbuf.get(&other.m_count) ||
+		!pbuf.get(&other.m_total) ||
+		!pbuf.get(&other.m_max) ||
+		!pbuf.get(&nbuckets))
+	{
+		return false;
+	}
+
+	for(uint32_t j = 0; j < nbuckets; j++)
+	{
+		uint16_t bucket;
+		uint32_t count;
+
+		if(!pbuf.get(&bucket) || bucket >= LATENCY_HISTOGRAM_NBUCKETS || !pbuf.get(&count))
+		{
+			return false;
+		}
+
+		other.m_buckets[bucket] += count;
+	}
+
+	if(!pbuf.at_end())
+	{
+		return false;
+	}
+
+	merge(other);
+	return true;
+}
+
+uint64_t sinsp_latency_histogram::get_percentile(double fraction)
+{
+	uint64_t target;
+	uint64_t sum = 0;
+	uint32_t j;
+
+	if(m_count == 0)
+	{
+		return 0;
+	}
+
+	target = (uint64_t)(fraction * m_count + 0.5);
+	if(target == 0)
+	{
+		target = 1;
+	}
+
+	for(j = 0; j < LATENCY_HISTOGRAM_NBUCKETS; j++)
+	{
+		sum += m_buckets[j];
+
+		if(sum >= target)
+		{
+			return min(get_bucket_top(j), m_max);
+		}
+	}
+
+	return m_max;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// sinsp_transaction_table implementation
+///////////////////////////////////////////////////////////////////////////////
+sinsp_transaction_table::sinsp_transaction_table(sinsp* inspector)
+{
+	m_inspector = inspector;
+	m_n_drops = 0;
+	clear();
+}
+
+//
+// The server port is the destination one, whatever the end the fd is
+//
+bool sinsp_transaction_table::get_port_key(sinsp_fdinfo_t* fdinfo, OUT uint32_t* key)
+{
+	uint32_t is_server = fdinfo->is_role_server()? 1 : 0;
+
+	if(fdinfo->m_type == SCAP_FD_IPV4_SOCK)
+	{
+		*key = (is_server << 24) |
+			((uint32_t)fdinfo->m_sockinfo.m_ipv4info.m_fields.m_l4proto << 16) |
+			fdinfo->m_sockinfo.m_ipv4info.m_fields.m_dport;
+		return true;
+	}
+	else if(fdinfo->m_type == SCAP_FD_IPV6_SOCK)
+	{
+		*key = (is_server << 24) |
+			((uint32_t)fdinfo->m_sockinfo.m_ipv6info.m_fields.m_l4proto << 16) |
+			fdinfo->m_sockinfo.m_ipv6info.m_fields.m_dport;
+		return true;
+	}
+
+	return false;
+}
+
+void sinsp_transaction_table::complete(sinsp_threadinfo* tinfo, int64_t fd, sinsp_fdinfo_t* fdinfo)
+{
+	sinsp_fdinfo_cold* cold = fdinfo->m_cold.get();
+	uint64_t latency = cold->m_trans_end_ts - cold->m_trans_start_ts;
+	uint64_t fdkey = ((uint64_t)tinfo->m_pid << 32) | (uint32_t)fd;
+	uint32_t portkey;
+
+	cold->m_trans_count++;
+
+	unordered_map<uint64_t, sinsp_latency_histogram>::iterator it = m_fd_histograms.find(fdkey);
+
+	if(it != m_fd_histograms.end())
+	{
+		it->second.add(latency);
+	}
+	else if(m_fd_histograms.size() < MAX_TRANSACTION_TABLE_SIZE)
+	{
+		m_fd_histograms[fdkey].add(latency);
+	}
+	else
+	{
+		m_n_drops++;
+	}
+
+	if(get_port_key(fdinfo, &portkey))
+	{
+		unordered_map<uint32_t, sinsp_latency_histogram>::iterator pit = m_port_histograms.find(portkey);
+
+		if(pit != m_port_histograms.end())
+		{
+			pit->second.add(latency);
+		}
+		else if(m_port_histograms.size() < MAX_TRANSACTION_PORTS)
+		{
+			m_port_histograms[portkey].add(latency);
+		}
+		else
+		{
+			m_n_drops++;
+		}
+	}
+
+	m_last_evtnum = m_inspector->m_evt.get_num();
+	m_last_pid = tinfo->m_pid;
+	m_last_fd = fd;
+	m_last_latency = latency;
+}
+
+void sinsp_transaction_table::on_rw(sinsp_evt* evt, sinsp_threadinfo* tinfo, int64_t fd, sinsp_fdinfo_t* fdinfo, bool is_read, int64_t len)
+{
+	bool is_request;
+
+	if(len <= 0)
+	{
+		return;
+	}
+
+	if(fdinfo->is_role_server())
+	{
+		is_request = is_read;
+	}
+	else if(fdinfo->is_role_client())
+	{
+		is_request = !is_read;
+	}
+	else
+	{
+		return;
+	}
+
+	uint64_t ts = evt->get_ts();
+	sinsp_fdinfo_cold* cold;
+
+	if(is_request)
+	{
+		cold = fdinfo->m_cold.get_or_create();
+
+		if(cold->m_trans_state == TS_RESPONSE)
+		{
+			complete(tinfo, fd, fdinfo);
+			cold->m_trans_state = TS_NONE;
+		}
+
+		if(cold->m_trans_state == TS_NONE)
+		{
+			cold->m_trans_state = TS_REQUEST;
+			cold->m_trans_start_ts = ts;
+		}
+	}
+	else
+	{
+		//
+		// A response without a request is the end of a transaction that
+		// started before the capture
+		//
+		cold = fdinfo->m_cold.get();
+
+		if(cold != NULL && cold->m_trans_state != TS_NONE)
+		{
+			cold->m_trans_state = TS_RESPONSE;
+			cold->m_trans_end_ts = ts;
+		}
+	}
+}
+
+void sinsp_transaction_table::on_close(sinsp_threadinfo* tinfo, int64_t fd, sinsp_fdinfo_t* fdinfo)
+{
+	sinsp_fdinfo_cold* cold = fdinfo->m_cold.get();
+
+	if(cold != NULL)
+	{
+		if(cold->m_trans_state == TS_RESPONSE)
+		{
+			complete(tinfo, fd, fdinfo);
+		}
+
+		cold->m_trans_state = TS_NONE;
+	}
+
+	if(!m_fd_histograms.empty())
+	{
+		m_fd_histograms.erase(((uint64_t)tinfo->m_pid << 32) | (uint32_t)fd);
+	}
+}
+
+bool sinsp_transaction_table::get_completed_latency(uint64_t evtnum, int64_t pid, int64_t fd, OUT uint64_t* latency)
+{
+	if(evtnum != m_last_evtnum || pid != m_last_pid || fd != m_last_fd)
+	{
+		return false;
+	}
+
+	*latency = m_last_latency;
+	return true;
+}
+
+sinsp_latency_histogram* sinsp_transaction_table::get_fd_histogram(int64_t pid, int64_t fd)
+{
+	unordered_map<uint64_t, sinsp_latency_histogram>::iterator it =
+		m_fd_histograms.find(((uint64_t)pid << 32) | (uint32_t)fd);
+
+	if(it == m_fd_histograms.end())
+	{
+		return NULL;
+	}
+
+	return &it->second;
+}
+
+sinsp_latency_histogram* sinsp_transaction_table::get_port_histogram(sinsp_fdinfo_t* fdinfo)
+{
+	uint32_t portkey;
+
+	if(!get_port_key(fdinfo, &portkey))
+	{
+		return NULL;
+	}
+
+	unordered_map<uint32_t, sinsp_latency_histogram>::iterator it = m_port_histograms.find(portkey);
+
+	if(it == m_port_histograms.end())
+	{
+		return NULL;
+	}
+
+	return &it->second;
+}
+
+void sinsp_transaction_table::clear()
+{
+	m_fd_histograms.clear();
+	m_port_histograms.clear();
+	m_last_evtnum = 0;
+	m_last_pid = -1;
+	m_last_fd = -1;
+	m_last_latency = 0;
+}
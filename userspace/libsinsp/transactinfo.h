@@ -0,0 +1,158 @@
+/*
+Copyright (C) 2013-2014 Draios inc.
+
+This file is part of sysdig.
+
+sysdig is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+sysdig is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+//
+// Number of sub-buckets of each power of 2 in the latency histograms, as a
+// number of bits. With 2 bits, a latency is known within 25%.
+//
+#define LATENCY_HISTOGRAM_SUBBUCKET_BITS 2
+#define LATENCY_HISTOGRAM_NBUCKETS ((64 - LATENCY_HISTOGRAM_SUBBUCKET_BITS + 1) << LATENCY_HISTOGRAM_SUBBUCKET_BITS)
+
+///////////////////////////////////////////////////////////////////////////////
+// Histogram of latencies in nanoseconds with a fixed size, in the style of
+// HDR histograms: the buckets are linear within each power of 2, so the
+// relative error of the percentiles is the same from nanoseconds to hours.
+///////////////////////////////////////////////////////////////////////////////
+class SINSP_PUBLIC sinsp_latency_histogram
+{
+public:
+	sinsp_latency_histogram();
+
+	void add(uint64_t latency);
+	void clear();
+
+	//
+	// Add the latencies of another histogram, e.g. of another host
+	//
+	void merge(const sinsp_latency_histogram& other);
+
+	//
+	// Append the histogram to res as a partial, with only the buckets that
+	// are not empty, and merge one. merge_partial() returns false if the
+	// partial is not valid.
+	//
+	void serialize(OUT string* res);
+	bool merge_partial(const char* buf, uint32_t len);
+
+	//
+	// Return the latency below which the given fraction (e.g. 0.99) of the
+	// latencies are, as the top of its bucket, or 0 if the histogram is
+	// empty
+	//
+	uint64_t get_percentile(double fraction);
+
+	uint64_t get_count()
+	{
+		return m_count;
+	}
+
+	uint64_t get_total()
+	{
+		return m_total;
+	}
+
+	uint64_t get_max()
+	{
+		return m_max;
+	}
+
+private:
+	static uint32_t get_bucket(uint64_t latency);
+	static uint64_t get_bucket_top(uint32_t bucket);
+
+	uint32_t m_buckets[LATENCY_HISTOGRAM_NBUCKETS];
+	uint64_t m_count;
+	uint64_t m_total;
+	uint64_t m_max;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Detection of the request/response transactions on the sockets, from the
+// direction of the data. For the server end of a connection, a transaction
+// starts with the first read after a write and ends with the last write
+// before the next read, and the other way around for the client end. A
+// transaction is complete when the next one starts or the fd is closed, and
+// its latency goes in the histogram of the fd and in the one of the server
+// port of the connection.
+// The state of the current transaction is in the fdinfo. The fds with a
+// histogram are at most MAX_TRANSACTION_TABLE_SIZE, and the ports
+// MAX_TRANSACTION_PORTS: the transactions that don't fit are only counted
+// where they do.
+///////////////////////////////////////////////////////////////////////////////
+class SINSP_PUBLIC sinsp_transaction_table
+{
+public:
+	sinsp_transaction_table(sinsp* inspector);
+
+	//
+	// Called for each successful read or write of len bytes on a socket
+	//
+	void on_rw(sinsp_evt* evt, sinsp_threadinfo* tinfo, int64_t fd, sinsp_fdinfo_t* fdinfo, bool is_read, int64_t len);
+
+	//
+	// Called when the fd is closed, to complete its current transaction
+	//
+	void on_close(sinsp_threadinfo* tinfo, int64_t fd, sinsp_fdinfo_t* fdinfo);
+
+	//
+	// Return the latency of the transaction that the event with the given
+	// number completed on the fd of the process pid, or false if it didn't
+	// complete one
+	//
+	bool get_completed_latency(uint64_t evtnum, int64_t pid, int64_t fd, OUT uint64_t* latency);
+
+	//
+	// Return the histogram of the fd of the process pid, or NULL
+	//
+	sinsp_latency_histogram* get_fd_histogram(int64_t pid, int64_t fd);
+
+	//
+	// Return the histogram of the transactions of the server port of
+	// fdinfo, seen from the same end as fdinfo, or NULL
+	//
+	sinsp_latency_histogram* get_port_histogram(sinsp_fdinfo_t* fdinfo);
+
+	void clear();
+
+	uint64_t get_n_drops()
+	{
+		return m_n_drops;
+	}
+
+private:
+	enum state
+	{
+		TS_NONE = 0,
+		TS_REQUEST = 1,
+		TS_RESPONSE = 2,
+	};
+
+	static bool get_port_key(sinsp_fdinfo_t* fdinfo, OUT uint32_t* key);
+	void complete(sinsp_threadinfo* tinfo, int64_t fd, sinsp_fdinfo_t* fdinfo);
+
+	sinsp* m_inspector;
+	unordered_map<uint64_t, sinsp_latency_histogram> m_fd_histograms; // Key is pid << 32 | fd
+	unordered_map<uint32_t, sinsp_latency_histogram> m_port_histograms; // Key is is_server << 24 | l4proto << 16 | port
+	uint64_t m_last_evtnum; // Event that completed the last transaction
+	int64_t m_last_pid; // Process and fd of the last transaction
+	int64_t m_last_fd;
+	uint64_t m_last_latency;
+	uint64_t m_n_drops;
+};
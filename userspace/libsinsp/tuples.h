@@ -54,6 +54,88 @@ typedef union _ipv6tuple
 	uint8_t m_all[37]; ///< The fields as a raw array ob bytes. Used for hasing.
 } ipv6tuple;
 
+/*!
+	\brief An IPv6 address as two 64-bit words, so that comparing or hashing
+	 it, or telling if it's an IPv4-mapped one (::ffff:a.b.c.d), takes two
+	 operations instead of one per byte.
+*/
+typedef union _ipv6addr
+{
+	uint32_t m_b[4]; ///< The address as in the tuples, in network byte order.
+	uint64_t m_q[2]; ///< The address as two words, for comparing and hashing.
+} ipv6addr;
+
+//
+// The addresses in the tuples and in the event parameters are not 8-byte
+// aligned, so they are loaded with memcpy, which the compiler turns into two
+// 64-bit loads
+//
+inline void ipv6addr_load(ipv6addr* dst, const void* src)
+{
+	memcpy(dst->m_q, src, sizeof(dst->m_q));
+}
+
+inline bool ipv6addr_equal(const void* a, const void* b)
+{
+	ipv6addr wa;
+	ipv6addr wb;
+
+	ipv6addr_load(&wa, a);
+	ipv6addr_load(&wb, b);
+	return ((wa.m_q[0] ^ wb.m_q[0]) | (wa.m_q[1] ^ wb.m_q[1])) == 0;
+}
+
+//
+// True for ::ffff:a.b.c.d, i.e. 80 zero bits followed by 16 one bits
+//
+inline bool ipv6addr_is_ipv4_mapped(const void* a)
+{
+	static const uint8_t mapped_prefix[4] = {0, 0, 0xff, 0xff};
+	ipv6addr wa;
+	uint32_t prefix;
+
+	ipv6addr_load(&wa, a);
+	memcpy(&prefix, mapped_prefix, sizeof(prefix));
+	return wa.m_q[0] == 0 && wa.m_b[2] == prefix;
+}
+
+//
+// Compare two IPv6 tuples without looking at the padding after m_l4proto
+//
+inline bool ipv6tuple_equal(const ipv6tuple* a, const ipv6tuple* b)
+{
+	return ipv6addr_equal(a->m_fields.m_sip, b->m_fields.m_sip) &&
+		ipv6addr_equal(a->m_fields.m_dip, b->m_fields.m_dip) &&
+		a->m_fields.m_sport == b->m_fields.m_sport &&
+		a->m_fields.m_dport == b->m_fields.m_dport &&
+		a->m_fields.m_l4proto == b->m_fields.m_l4proto;
+}
+
+//
+// Hash an IPv6 tuple a word at a time, instead of the 37 rounds of hashing
+// its bytes
+//
+inline size_t ipv6tuple_hash(const ipv6tuple* t)
+{
+	const uint64_t mul = 0x9e3779b97f4a7c15ULL;
+	ipv6addr sip;
+	ipv6addr dip;
+	uint64_t res;
+
+	ipv6addr_load(&sip, t->m_fields.m_sip);
+	ipv6addr_load(&dip, t->m_fields.m_dip);
+
+	res = sip.m_q[0] * mul;
+	res = (res ^ sip.m_q[1]) * mul;
+	res = (res ^ dip.m_q[0]) * mul;
+	res = (res ^ dip.m_q[1]) * mul;
+	res = (res ^ (((uint64_t)t->m_fields.m_sport << 24) |
+		((uint64_t)t->m_fields.m_dport << 8) |
+		t->m_fields.m_l4proto)) * mul;
+
+	return (size_t)(res ^ (res >> 32));
+}
+
 /*!
 	\brief An IPv4 server address. 
 */
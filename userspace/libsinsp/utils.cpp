@@ -86,6 +86,7 @@ sinsp_initializer::sinsp_initializer()
 	//
 	g_infotables.m_event_info = scap_get_event_info_table();
 	g_infotables.m_syscall_info_table = scap_get_syscall_info_table();
+	g_infotables.init_param_offsets();
 
 	//
 	// Init the logger
@@ -358,140 +359,248 @@ const char* sinsp_utils::signal_to_str(uint8_t code)
 	}
 }
 
-bool sinsp_utils::sockinfo_to_str(sinsp_sockinfo* sinfo, scap_fd_type stype, char* targetbuf, uint32_t targetbuf_size)
+char* sinsp_utils::ipv4_to_str(const uint8_t* addr, char* dst)
 {
-	if(stype == SCAP_FD_IPV4_SOCK)
+	uint32_t j;
+
+	for(j = 0; j < 4; j++)
 	{
-		uint8_t* sb = (uint8_t*)&sinfo->m_ipv4info.m_fields.m_sip;
-		uint8_t* db = (uint8_t*)&sinfo->m_ipv4info.m_fields.m_dip;
+		uint32_t b = addr[j];
 
-		if(sinfo->m_ipv4info.m_fields.m_l4proto == SCAP_L4_TCP ||
-			sinfo->m_ipv4info.m_fields.m_l4proto == SCAP_L4_UDP)
+		if(j != 0)
 		{
-			snprintf(targetbuf,
-				targetbuf_size,
-				"%u.%u.%u.%u:%u->%u.%u.%u.%u:%u",
-				(unsigned int)(uint8_t)sb[0],
-				(unsigned int)(uint8_t)sb[1],
-				(unsigned int)(uint8_t)sb[2],
-				(unsigned int)(uint8_t)sb[3],
-				(unsigned int)sinfo->m_ipv4info.m_fields.m_sport,
-				(unsigned int)(uint8_t)db[0],
-				(unsigned int)(uint8_t)db[1],
-				(unsigned int)(uint8_t)db[2],
-				(unsigned int)(uint8_t)db[3],
-				(unsigned int)sinfo->m_ipv4info.m_fields.m_dport);
+			*dst++ = '.';
 		}
-		else if(sinfo->m_ipv4info.m_fields.m_l4proto == SCAP_L4_ICMP ||
-			sinfo->m_ipv4info.m_fields.m_l4proto == SCAP_L4_RAW)
+
+		if(b >= 100)
 		{
-			snprintf(targetbuf,
-				targetbuf_size,
-				"%u.%u.%u.%u->%u.%u.%u.%u",
-				(unsigned int)(uint8_t)sb[0],
-				(unsigned int)(uint8_t)sb[1],
-				(unsigned int)(uint8_t)sb[2],
-				(unsigned int)(uint8_t)sb[3],
-				(unsigned int)(uint8_t)db[0],
-				(unsigned int)(uint8_t)db[1],
-				(unsigned int)(uint8_t)db[2],
-				(unsigned int)(uint8_t)db[3]);
+			*dst++ = '0' + b / 100;
+			b %= 100;
+			*dst++ = '0' + b / 10;
 		}
-		else
+		else if(b >= 10)
 		{
-			snprintf(targetbuf,
-				targetbuf_size,
-				"<unknown>");
+			*dst++ = '0' + b / 10;
 		}
+
+		*dst++ = '0' + b % 10;
 	}
-	else if(stype == SCAP_FD_IPV6_SOCK)
+
+	*dst = 0;
+	return dst;
+}
+
+char* sinsp_utils::ipv6_to_str(const uint8_t* addr, char* dst)
+{
+	static const char hexdigits[] = "0123456789abcdef";
+	uint16_t words[8];
+	int32_t best_base = -1;
+	int32_t best_len = 0;
+	int32_t cur_base = -1;
+	int32_t cur_len = 0;
+	int32_t j;
+
+	//
+	// Find the longest run of zero words, which is written as "::". Same
+	// rules as inet_ntop(): the first of the longest runs, and only if it's
+	// at least two words long.
+	//
+	for(j = 0; j < 8; j++)
 	{
-		uint8_t* sip6 = (uint8_t*)sinfo->m_ipv6info.m_fields.m_sip;
-		uint8_t* dip6 = (uint8_t*)sinfo->m_ipv6info.m_fields.m_dip;
-		uint8_t* sip = ((uint8_t*)(sinfo->m_ipv6info.m_fields.m_sip)) + 12;
-		uint8_t* dip = ((uint8_t*)(sinfo->m_ipv6info.m_fields.m_dip)) + 12;
+		words[j] = (addr[j * 2] << 8) | addr[j * 2 + 1];
 
-		if(sinfo->m_ipv6info.m_fields.m_l4proto == SCAP_L4_TCP ||
-			sinfo->m_ipv6info.m_fields.m_l4proto == SCAP_L4_UDP)
+		if(words[j] == 0)
 		{
-			if(sinsp_utils::is_ipv4_mapped_ipv6(sip6) && sinsp_utils::is_ipv4_mapped_ipv6(dip6))
+			if(cur_base == -1)
 			{
-				snprintf(targetbuf,
-							targetbuf_size,
-							"%u.%u.%u.%u:%u->%u.%u.%u.%u:%u",
-							(unsigned int)sip[0],
-							(unsigned int)sip[1],
-							(unsigned int)sip[2],
-							(unsigned int)sip[3],
-							(unsigned int)sinfo->m_ipv4info.m_fields.m_sport,
-							(unsigned int)dip[0],
-							(unsigned int)dip[1],
-							(unsigned int)dip[2],
-							(unsigned int)dip[3],
-							(unsigned int)sinfo->m_ipv4info.m_fields.m_dport);
-				return true;
+				cur_base = j;
+				cur_len = 0;
 			}
-			else
+
+			cur_len++;
+
+			if(cur_len > best_len)
 			{
-				char srcstr[INET6_ADDRSTRLEN];
-				char dststr[INET6_ADDRSTRLEN];
-				if(inet_ntop(AF_INET6, sip6, srcstr, sizeof(srcstr)) && 
-					inet_ntop(AF_INET6, sip6, dststr, sizeof(dststr)))
-				{
-					snprintf(targetbuf,
-								targetbuf_size,
-								"%s:%u->%s:%u",
-								srcstr,
-								(unsigned int)sinfo->m_ipv4info.m_fields.m_sport,
-								dststr,
-								(unsigned int)sinfo->m_ipv4info.m_fields.m_dport);
-					return true;
-				}
+				best_base = cur_base;
+				best_len = cur_len;
 			}
 		}
-		else if(sinfo->m_ipv6info.m_fields.m_l4proto == SCAP_L4_ICMP)
+		else
+		{
+			cur_base = -1;
+		}
+	}
+
+	if(best_len < 2)
+	{
+		best_base = -1;
+	}
+
+	for(j = 0; j < 8; j++)
+	{
+		if(best_base != -1 && j >= best_base && j < best_base + best_len)
 		{
-			if(sinsp_utils::is_ipv4_mapped_ipv6(sip6) && sinsp_utils::is_ipv4_mapped_ipv6(dip6))
+			if(j == best_base)
 			{
-				snprintf(targetbuf,
-					targetbuf_size,
-					"%u.%u.%u.%u->%u.%u.%u.%u",
-					(unsigned int)sip[0],
-					(unsigned int)sip[1],
-					(unsigned int)sip[2],
-					(unsigned int)sip[3],
-					(unsigned int)dip[0],
-					(unsigned int)dip[1],
-					(unsigned int)dip[2],
-					(unsigned int)dip[3]);
-
-				return true;
+				*dst++ = ':';
 			}
-			else
-			{
-				char srcstr[INET6_ADDRSTRLEN];
-				char dststr[INET6_ADDRSTRLEN];
-				if(inet_ntop(AF_INET6, sip6, srcstr, sizeof(srcstr)) && 
-					inet_ntop(AF_INET6, sip6, dststr, sizeof(dststr)))
-				{
-					snprintf(targetbuf,
-						targetbuf_size,
-						"%s->%s",
-						srcstr,
-						dststr);
 
-					return true;
-				}
-			}
+			continue;
 		}
-		else
+
+		if(j != 0)
+		{
+			*dst++ = ':';
+		}
+
+		//
+		// IPv4-compatible and IPv4-mapped addresses end with the dotted quad
+		//
+		if(j == 6 && best_base == 0 && (best_len == 6 || (best_len == 5 && words[5] == 0xffff)))
+		{
+			return ipv4_to_str(addr + 12, dst);
+		}
+
+		uint16_t w = words[j];
+
+		if(w >= 0x1000)
 		{
-			snprintf(targetbuf,
-				targetbuf_size,
-				"<unknown>");
+			*dst++ = hexdigits[w >> 12];
 		}
+		if(w >= 0x100)
+		{
+			*dst++ = hexdigits[(w >> 8) & 0xf];
+		}
+		if(w >= 0x10)
+		{
+			*dst++ = hexdigits[(w >> 4) & 0xf];
+		}
+
+		*dst++ = hexdigits[w & 0xf];
+	}
+
+	if(best_base != -1 && best_base + best_len == 8)
+	{
+		*dst++ = ':';
+	}
+
+	*dst = 0;
+	return dst;
+}
+
+char* sinsp_utils::port_to_str(uint16_t port, char* dst)
+{
+	char tmp[5];
+	uint32_t len = 0;
+
+	do
+	{
+		tmp[len++] = '0' + port % 10;
+		port /= 10;
+	}
+	while(port != 0);
+
+	while(len != 0)
+	{
+		*dst++ = tmp[--len];
+	}
+
+	*dst = 0;
+	return dst;
+}
+
+//
+// Write "sip:sport->dip:dport", or "sip->dip" if the ports are NULL, and
+// return the terminator
+//
+static char* socktuple_to_str(char* dst, bool ipv6,
+	const uint8_t* sip, const uint16_t* sport,
+	const uint8_t* dip, const uint16_t* dport)
+{
+	dst = ipv6? sinsp_utils::ipv6_to_str(sip, dst) : sinsp_utils::ipv4_to_str(sip, dst);
+
+	if(sport != NULL)
+	{
+		*dst++ = ':';
+		dst = sinsp_utils::port_to_str(*sport, dst);
+	}
+
+	*dst++ = '-';
+	*dst++ = '>';
+
+	dst = ipv6? sinsp_utils::ipv6_to_str(dip, dst) : sinsp_utils::ipv4_to_str(dip, dst);
+
+	if(dport != NULL)
+	{
+		*dst++ = ':';
+		dst = sinsp_utils::port_to_str(*dport, dst);
 	}
 
+	return dst;
+}
+
+bool sinsp_utils::sockinfo_to_str(sinsp_sockinfo* sinfo, scap_fd_type stype, char* targetbuf, uint32_t targetbuf_size)
+{
+	char buf[2 * (INET6_ADDRSTRLEN + 6) + 2];
+	char* end = buf;
+
+	ASSERT(targetbuf_size != 0);
+
+	if(stype == SCAP_FD_IPV4_SOCK)
+	{
+		ipv4tuple* t = &sinfo->m_ipv4info;
+		uint8_t* sip = (uint8_t*)&t->m_fields.m_sip;
+		uint8_t* dip = (uint8_t*)&t->m_fields.m_dip;
+
+		if(t->m_fields.m_l4proto == SCAP_L4_TCP ||
+			t->m_fields.m_l4proto == SCAP_L4_UDP)
+		{
+			end = socktuple_to_str(buf, false, sip, &t->m_fields.m_sport, dip, &t->m_fields.m_dport);
+		}
+		else if(t->m_fields.m_l4proto == SCAP_L4_ICMP ||
+			t->m_fields.m_l4proto == SCAP_L4_RAW)
+		{
+			end = socktuple_to_str(buf, false, sip, NULL, dip, NULL);
+		}
+	}
+	else if(stype == SCAP_FD_IPV6_SOCK)
+	{
+		ipv6tuple* t = &sinfo->m_ipv6info;
+		uint8_t* sip6 = (uint8_t*)t->m_fields.m_sip;
+		uint8_t* dip6 = (uint8_t*)t->m_fields.m_dip;
+		bool mapped = sinsp_utils::is_ipv4_mapped_ipv6(sip6) && sinsp_utils::is_ipv4_mapped_ipv6(dip6);
+
+		//
+		// The IPv4-mapped addresses are shown as plain IPv4 ones
+		//
+		if(mapped)
+		{
+			sip6 += 12;
+			dip6 += 12;
+		}
+
+		if(t->m_fields.m_l4proto == SCAP_L4_TCP ||
+			t->m_fields.m_l4proto == SCAP_L4_UDP)
+		{
+			end = socktuple_to_str(buf, !mapped, sip6, &t->m_fields.m_sport, dip6, &t->m_fields.m_dport);
+		}
+		else if(t->m_fields.m_l4proto == SCAP_L4_ICMP)
+		{
+			end = socktuple_to_str(buf, !mapped, sip6, NULL, dip6, NULL);
+		}
+	}
+
+	if(end == buf)
+	{
+		strncpy(targetbuf, "<unknown>", targetbuf_size);
+		targetbuf[targetbuf_size - 1] = 0;
+		return true;
+	}
+
+	uint32_t len = MIN((uint32_t)(end - buf), targetbuf_size - 1);
+	memcpy(targetbuf, buf, len);
+	targetbuf[len] = 0;
+
 	return true;
 }
 
@@ -670,16 +779,7 @@ bool sinsp_utils::concatenate_paths(char* target,
 
 bool sinsp_utils::is_ipv4_mapped_ipv6(uint8_t* paddr)
 {
-	if(paddr[0] == 0 && paddr[1] == 0 && paddr[2] == 0 && paddr[3] == 0 && paddr[4] == 0 && 
-		paddr[5] == 0 && paddr[6] == 0 && paddr[7] == 0 && paddr[8] == 0 && paddr[9] == 0 && 
-		paddr[10] == 0xff && paddr[11] == 0xff)
-	{
-		return true;
-	}
-	else
-	{
-		return false;
-	}
+	return ipv6addr_is_ipv4_mapped(paddr);
 }
 
 const struct ppm_param_info* sinsp_utils::find_longest_matching_evt_param(string name)
@@ -791,75 +891,44 @@ string sinsp_gethostname()
 ///////////////////////////////////////////////////////////////////////////////
 string ipv4tuple_to_string(ipv4tuple* tuple)
 {
-	char buf[50];
-	sprintf(buf, 
-		"%d.%d.%d.%d:%d->%d.%d.%d.%d:%d", 
-		(tuple->m_fields.m_sip & 0xFF),
-		((tuple->m_fields.m_sip & 0xFF00) >> 8),
-		((tuple->m_fields.m_sip & 0xFF0000) >> 16),
-		((tuple->m_fields.m_sip & 0xFF000000) >> 24),
-		tuple->m_fields.m_sport,
-		(tuple->m_fields.m_dip & 0xFF),
-		((tuple->m_fields.m_dip & 0xFF00) >> 8),
-		((tuple->m_fields.m_dip & 0xFF0000) >> 16),
-		((tuple->m_fields.m_dip & 0xFF000000) >> 24),
-		tuple->m_fields.m_dport);
-	return string(buf);
+	char buf[2 * (16 + 6) + 2];
+	char* end = socktuple_to_str(buf, false,
+		(uint8_t*)&tuple->m_fields.m_sip, &tuple->m_fields.m_sport,
+		(uint8_t*)&tuple->m_fields.m_dip, &tuple->m_fields.m_dport);
+
+	return string(buf, end - buf);
 }
 
 string ipv6tuple_to_string(_ipv6tuple* tuple)
 {
-	char source_address[100];
-	char destination_address[100];
-	char buf[200];
+	char buf[2 * (INET6_ADDRSTRLEN + 6) + 2];
+	char* end = socktuple_to_str(buf, true,
+		(uint8_t*)tuple->m_fields.m_sip, &tuple->m_fields.m_sport,
+		(uint8_t*)tuple->m_fields.m_dip, &tuple->m_fields.m_dport);
 
-	if(NULL == inet_ntop(AF_INET6, tuple->m_fields.m_sip, source_address, 100))
-	{
-		return string();
-	}
-
-	if(NULL == inet_ntop(AF_INET6, tuple->m_fields.m_dip, destination_address, 100))
-	{
-		return string();
-	}
-	
-	snprintf(buf,200,"%s:%u->%s:%u",
-		source_address,
-		tuple->m_fields.m_sport,
-		destination_address,
-		tuple->m_fields.m_dport);
-	
-	return string(buf);
+	return string(buf, end - buf);
 }
 
 string ipv4serveraddr_to_string(ipv4serverinfo* addr)
 {
-	char buf[50];
-	sprintf(buf, 
-		"%d.%d.%d.%d:%d", 
-		(addr->m_ip & 0xFF),
-		((addr->m_ip & 0xFF00) >> 8),
-		((addr->m_ip & 0xFF0000) >> 16),
-		((addr->m_ip & 0xFF000000) >> 24),
-		addr->m_port);
-	return string(buf);
+	char buf[16 + 6];
+	char* end = sinsp_utils::ipv4_to_str((uint8_t*)&addr->m_ip, buf);
+
+	*end++ = ':';
+	end = sinsp_utils::port_to_str(addr->m_port, end);
+
+	return string(buf, end - buf);
 }
 
 string ipv6serveraddr_to_string(ipv6serverinfo* addr)
 {
-	char address[100];
-	char buf[200];
+	char buf[INET6_ADDRSTRLEN + 6];
+	char* end = sinsp_utils::ipv6_to_str((uint8_t*)addr->m_ip, buf);
 
-	if(NULL == inet_ntop(AF_INET6, addr->m_ip, address, 100))
-	{
-		return string();
-	}
+	*end++ = ':';
+	end = sinsp_utils::port_to_str(addr->m_port, end);
 
-	snprintf(buf,200,"%s:%u",
-		address,
-		addr->m_port);
-	
-	return string(buf);
+	return string(buf, end - buf);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -879,6 +948,57 @@ vector<string> sinsp_split(const string &s, char delim)
 	return res;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// sinsp_arena implementation
+///////////////////////////////////////////////////////////////////////////////
+sinsp_arena::sinsp_arena()
+{
+	chunk c;
+
+	c.m_data = new char[SP_ARENA_CHUNK_SIZE];
+	c.m_size = SP_ARENA_CHUNK_SIZE;
+	m_chunks.push_back(c);
+	reset();
+}
+
+sinsp_arena::~sinsp_arena()
+{
+	vector<chunk>::iterator it;
+
+	for(it = m_chunks.begin(); it != m_chunks.end(); ++it)
+	{
+		delete[] it->m_data;
+	}
+}
+
+void* sinsp_arena::alloc_slow(uint32_t size)
+{
+	//
+	// Move to the next chunk that was already allocated by a previous event,
+	// or add a new one. The big allocations get a chunk of their own size.
+	//
+	while(++m_cur < m_chunks.size())
+	{
+		if(size <= m_chunks[m_cur].m_size)
+		{
+			break;
+		}
+	}
+
+	if(m_cur == m_chunks.size())
+	{
+		chunk c;
+
+		c.m_size = MAX(size, SP_ARENA_CHUNK_SIZE);
+		c.m_data = new char[c.m_size];
+		m_chunks.push_back(c);
+	}
+
+	m_pos = m_chunks[m_cur].m_data + size;
+	m_end = m_chunks[m_cur].m_data + m_chunks[m_cur].m_size;
+	return m_chunks[m_cur].m_data;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // sinsp_numparser implementation
 ///////////////////////////////////////////////////////////////////////////////
@@ -54,6 +54,17 @@ public:
 	//
 	static bool sockinfo_to_str(sinsp_sockinfo* sinfo, scap_fd_type stype, char* targetbuf, uint32_t targetbuf_size);
 
+	//
+	// Format an address or a port without going through snprintf, with the
+	// same output as inet_ntop() and %u. The text is NUL terminated and the
+	// returned pointer is the terminator, so that the calls can be chained.
+	// dst must have room for 16 bytes (IPv4), INET6_ADDRSTRLEN bytes (IPv6)
+	// or 6 bytes (port).
+	//
+	static char* ipv4_to_str(const uint8_t* addr, char* dst);
+	static char* ipv6_to_str(const uint8_t* addr, char* dst);
+	static char* port_to_str(uint16_t port, char* dst);
+
 	//
 	// Concatenate two paths and puts the result in "target".
 	// If path2 is relative, the concatenation happens and the result is true.
@@ -125,6 +136,66 @@ string ipv6serveraddr_to_string(ipv6serverinfo* addr);
 ///////////////////////////////////////////////////////////////////////////////
 vector<string> sinsp_split(const string &s, char delim);
 
+///////////////////////////////////////////////////////////////////////////////
+// Bump allocator for the temporary state of an event. The inspector resets
+// it before every event, so nothing is freed individually. The chunks are
+// kept across resets: once the arena has grown to what the events need, the
+// allocations don't touch the heap anymore.
+// Anything that must outlive the event has to be copied out of the arena.
+///////////////////////////////////////////////////////////////////////////////
+class sinsp_arena
+{
+public:
+	sinsp_arena();
+	~sinsp_arena();
+
+	void* alloc(uint32_t size)
+	{
+		size = (size + 7) & ~7;
+
+		if(size <= (uint32_t)(m_end - m_pos))
+		{
+			void* res = m_pos;
+			m_pos += size;
+			return res;
+		}
+
+		return alloc_slow(size);
+	}
+
+	//
+	// Return a NUL terminated copy of the given string
+	//
+	char* copy(const char* str, uint32_t len)
+	{
+		char* res = (char*)alloc(len + 1);
+		memcpy(res, str, len);
+		res[len] = 0;
+		return res;
+	}
+
+	void reset()
+	{
+		m_cur = 0;
+		m_pos = m_chunks[0].m_data;
+		m_end = m_pos + m_chunks[0].m_size;
+	}
+
+private:
+	struct chunk
+	{
+		char* m_data;
+		uint32_t m_size;
+	};
+
+	void* alloc_slow(uint32_t size);
+
+	vector<chunk> m_chunks;
+	uint32_t m_cur; // The chunk that m_pos points to
+	char* m_pos;
+	char* m_end;
+};
+
 ///////////////////////////////////////////////////////////////////////////////
 // number parser
 ///////////////////////////////////////////////////////////////////////////////
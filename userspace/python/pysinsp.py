@@ -0,0 +1,363 @@
+#
+# Copyright (C) 2013-2014 Draios inc.
+#
+# This file is part of sysdig.
+#
+# sysdig is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License version 2 as
+# published by the Free Software Foundation.
+#
+# sysdig is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+"""
+Read the events of sysdig trace files, or of a live capture, into NumPy
+arrays or Arrow record batches.
+
+The events are filtered and their fields extracted by libsinsp, through the
+batch C interface of capi.h. libsinsp writes each batch straight into the
+NumPy arrays of the batch, so the numbers are never copied.
+
+    import pysinsp
+
+    with pysinsp.Capture("trace.scap", ["evt.num", "proc.name", "evt.rawres"],
+                         filter="evt.type=read") as cap:
+        for batch in cap:
+            print(batch.nrows, batch["evt.rawres"].sum())
+
+        # or, with pyarrow
+        table = pyarrow.Table.from_batches(cap.arrow_batches())
+
+The module loads libsinspcapi.so, built with -DBUILD_PYTHON_BINDINGS=ON,
+from $PYSINSP_LIB, from its own directory or from the library path.
+"""
+
+import ctypes
+import ctypes.util
+import os
+
+import numpy as np
+
+#
+# Return values and field kinds, as in capi.h
+#
+SUCCESS = 0
+FAILURE = 1
+TIMEOUT = 2
+EOF = 3
+
+INT = 0
+UINT = 1
+BOOL = 2
+IPV4 = 3
+STRING = 4
+BINARY = 5
+
+_NUMPY_TYPES = {
+    INT: np.int64,
+    UINT: np.uint64,
+    BOOL: np.bool_,
+    IPV4: np.uint32,
+}
+
+
+class SinspError(Exception):
+    pass
+
+
+class _Column(ctypes.Structure):
+    _fields_ = [
+        ("m_values", ctypes.c_void_p),
+        ("m_offsets", ctypes.c_void_p),
+        ("m_lengths", ctypes.c_void_p),
+        ("m_present", ctypes.c_void_p),
+    ]
+
+
+class _Batch(ctypes.Structure):
+    _fields_ = [
+        ("m_max_rows", ctypes.c_uint32),
+        ("m_columns", ctypes.POINTER(_Column)),
+        ("m_arena", ctypes.c_void_p),
+        ("m_arena_size", ctypes.c_uint32),
+        ("m_nrows", ctypes.c_uint32),
+        ("m_arena_len", ctypes.c_uint32),
+    ]
+
+
+def _load_library():
+    path = os.environ.get("PYSINSP_LIB")
+
+    if path is None:
+        path = os.path.join(os.path.dirname(os.path.abspath(__file__)), "libsinspcapi.so")
+        if not os.path.exists(path):
+            path = ctypes.util.find_library("sinspcapi")
+            if path is None:
+                raise SinspError("libsinspcapi.so not found, set PYSINSP_LIB")
+
+    lib = ctypes.CDLL(path)
+
+    lib.sinsp_capi_open.restype = ctypes.c_void_p
+    lib.sinsp_capi_open.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_uint32]
+    lib.sinsp_capi_close.restype = None
+    lib.sinsp_capi_close.argtypes = [ctypes.c_void_p]
+    lib.sinsp_capi_getlasterr.restype = ctypes.c_char_p
+    lib.sinsp_capi_getlasterr.argtypes = [ctypes.c_void_p]
+    lib.sinsp_capi_set_filter.restype = ctypes.c_int32
+    lib.sinsp_capi_set_filter.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
+    lib.sinsp_capi_set_fields.restype = ctypes.c_int32
+    lib.sinsp_capi_set_fields.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
+    lib.sinsp_capi_get_nfields.restype = ctypes.c_uint32
+    lib.sinsp_capi_get_nfields.argtypes = [ctypes.c_void_p]
+    lib.sinsp_capi_get_field_kind.restype = ctypes.c_int32
+    lib.sinsp_capi_get_field_kind.argtypes = [ctypes.c_void_p, ctypes.c_uint32]
+    lib.sinsp_capi_next_batch.restype = ctypes.c_int32
+    lib.sinsp_capi_next_batch.argtypes = [ctypes.c_void_p, ctypes.POINTER(_Batch)]
+
+    return lib
+
+
+_lib = None
+
+
+def _get_library():
+    global _lib
+
+    if _lib is None:
+        _lib = _load_library()
+
+    return _lib
+
+
+def _address(array):
+    return array.ctypes.data_as(ctypes.c_void_p)
+
+
+class Batch(object):
+    """
+    The fields of a group of events, one column per field.
+
+    batch[name] is the NumPy array of a numeric field. The string fields
+    are stored in the arena of the batch, see strings() and raw().
+    present(name) tells which events have the field.
+    """
+
+    def __init__(self, names, kinds, nrows, values, offsets, lengths, present, arena):
+        self.names = names
+        self.kinds = kinds
+        self.nrows = nrows
+        self._index = dict((name, j) for j, name in enumerate(names))
+        self._values = values
+        self._offsets = offsets
+        self._lengths = lengths
+        self._present = present
+        self._arena = arena
+
+    def __len__(self):
+        return self.nrows
+
+    def kind(self, name):
+        return self.kinds[self._index[name]]
+
+    def present(self, name):
+        return self._present[self._index[name]][:self.nrows].view(np.bool_)
+
+    def __getitem__(self, name):
+        j = self._index[name]
+        kind = self.kinds[j]
+
+        if kind in (STRING, BINARY):
+            return np.array(self.strings(name), dtype=object)
+
+        values = self._values[j][:self.nrows]
+
+        if kind == UINT:
+            return values.view(np.uint64)
+        elif kind == BOOL:
+            return values != 0
+        elif kind == IPV4:
+            return values.astype(np.uint32)
+
+        return values
+
+    def raw(self, name):
+        """
+        The offsets and the lengths in the arena of the values of a string
+        field, and the arena.
+        """
+        j = self._index[name]
+        return (self._offsets[j][:self.nrows], self._lengths[j][:self.nrows], self._arena)
+
+    def strings(self, name):
+        """
+        The values of a string field, as a list with None for the events
+        that don't have it. The binary ones are bytes.
+        """
+        offsets, lengths, arena = self.raw(name)
+        present = self.present(name)
+        data = arena.tobytes()
+        decode = self.kind(name) == STRING
+        res = []
+
+        for offset, length, has in zip(offsets.tolist(), lengths.tolist(), present.tolist()):
+            if not has:
+                res.append(None)
+            elif decode:
+                res.append(data[offset:offset + length].decode("utf-8", "replace"))
+            else:
+                res.append(data[offset:offset + length])
+
+        return res
+
+    def to_arrow(self):
+        """
+        Convert the batch to a pyarrow.RecordBatch. The numbers are passed to
+        Arrow without copies, the strings are gathered out of the arena.
+        """
+        import pyarrow as pa
+
+        arrays = []
+        n = self.nrows
+
+        for j, name in enumerate(self.names):
+            kind = self.kinds[j]
+            present = self.present(name)
+            valid = np.packbits(present, bitorder="little")
+
+            if kind in (STRING, BINARY):
+                starts = self._offsets[j][:n].astype(np.int64)
+                lengths = self._lengths[j][:n].astype(np.int64)
+                offsets = np.zeros(n + 1, dtype=np.int32)
+                np.cumsum(lengths, out=offsets[1:])
+                index = np.repeat(starts - offsets[:-1], lengths) + np.arange(offsets[-1])
+                data = self._arena[index]
+                atype = pa.string() if kind == STRING else pa.binary()
+
+                arrays.append(pa.Array.from_buffers(atype, n,
+                    [pa.py_buffer(valid), pa.py_buffer(offsets), pa.py_buffer(data)]))
+            else:
+                arrays.append(pa.array(self[name], mask=~present))
+
+        return pa.RecordBatch.from_arrays(arrays, self.names)
+
+
+class Capture(object):
+    """
+    A trace file, or a live capture if filename is None.
+
+    fields are the names of the fields, as in sysdig -p, and filter is a
+    sysdig filter. Iterating yields Batch objects of up to batch_size
+    events. arena_size is the space of the strings of a batch: a batch ends
+    earlier when it's full.
+    """
+
+    def __init__(self, filename, fields, filter=None, batch_size=65536, arena_size=16 * 1024 * 1024):
+        self._lib = _get_library()
+        self._handle = None
+
+        error = ctypes.create_string_buffer(256)
+        fname = filename.encode() if filename is not None else None
+
+        self._handle = self._lib.sinsp_capi_open(fname, error, len(error))
+        if not self._handle:
+            raise SinspError(error.value.decode())
+
+        if filter is not None:
+            self._check(self._lib.sinsp_capi_set_filter(self._handle, filter.encode()))
+
+        self._check(self._lib.sinsp_capi_set_fields(self._handle, ",".join(fields).encode()))
+
+        nfields = self._lib.sinsp_capi_get_nfields(self._handle)
+
+        self.fields = list(fields)
+        self.kinds = [self._lib.sinsp_capi_get_field_kind(self._handle, j) for j in range(nfields)]
+        self.live = filename is None
+        self._batch_size = batch_size
+        self._arena_size = arena_size
+
+    def _check(self, res):
+        if res == FAILURE:
+            raise SinspError(self._lib.sinsp_capi_getlasterr(self._handle).decode())
+
+        return res
+
+    def close(self):
+        if self._handle:
+            self._lib.sinsp_capi_close(self._handle)
+            self._handle = None
+
+    def __del__(self):
+        self.close()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+    def next_batch(self):
+        """
+        Return the next batch, None at the end of the file. A live capture
+        can return an empty batch when no event came.
+        """
+        n = self._batch_size
+        nfields = len(self.kinds)
+        columns = (_Column * nfields)()
+        values = [None] * nfields
+        offsets = [None] * nfields
+        lengths = [None] * nfields
+        present = [np.empty(n, dtype=np.uint8) for j in range(nfields)]
+        arena = np.empty(self._arena_size, dtype=np.uint8)
+
+        #
+        # The arrays are new for every batch, since the previous ones can
+        # still be in use by the caller
+        #
+        for j, kind in enumerate(self.kinds):
+            if kind in (STRING, BINARY):
+                offsets[j] = np.empty(n, dtype=np.uint32)
+                lengths[j] = np.empty(n, dtype=np.uint32)
+                columns[j].m_offsets = _address(offsets[j])
+                columns[j].m_lengths = _address(lengths[j])
+            else:
+                values[j] = np.empty(n, dtype=np.int64)
+                columns[j].m_values = _address(values[j])
+
+            columns[j].m_present = _address(present[j])
+
+        batch = _Batch()
+        batch.m_max_rows = n
+        batch.m_columns = columns
+        batch.m_arena = _address(arena)
+        batch.m_arena_size = self._arena_size
+
+        res = self._check(self._lib.sinsp_capi_next_batch(self._handle, ctypes.byref(batch)))
+
+        if res == EOF:
+            return None
+
+        return Batch(self.fields, self.kinds, batch.m_nrows, values, offsets, lengths, present,
+                     arena[:batch.m_arena_len])
+
+    def __iter__(self):
+        while True:
+            batch = self.next_batch()
+
+            if batch is None:
+                return
+
+            if batch.nrows != 0:
+                yield batch
+
+    def arrow_batches(self):
+        """
+        Iterate the events as pyarrow.RecordBatch objects.
+        """
+        for batch in self:
+            yield batch.to_arrow()
@@ -0,0 +1,85 @@
+--[[
+Copyright (C) 2013-2014 Draios inc.
+ 
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+--]]
+
+-- The number of items to show
+HOW_MANY = 10
+
+-- Chisel description
+description = "Splits the time spent in system calls into the time the threads were blocked or waiting for a CPU, and the time they were running, by wait reason. The reason is the type of the FD of the call (file, ipv4, pipe...), or the name of the call for the ones without an FD (futex, nanosleep...). Shows the " .. HOW_MANY .. " reasons with the most blocked time. Needs the context switch events, so it doesn't work with captures taken with --switch-summary.";
+short_description = "Blocked time of system calls by wait reason";
+category = "Performance";
+
+-- Chisel argument list
+args = {}
+
+require "common"
+
+reasons = {}
+
+-- Initialization callback
+function on_init()
+	-- Request the fields
+	fevtype = chisel.request_field("evt.type")
+	ffdtype = chisel.request_field("fd.type")
+	foffcpu = chisel.request_field("evt.offcpu")
+	foncpu = chisel.request_field("evt.oncpu")
+
+	-- The switches are accounted by libsinsp before the filter
+	chisel.set_filter("evt.dir=<")
+
+	return true
+end
+
+-- Event parsing callback
+function on_event()
+	offcpu = evt.field(foffcpu)
+
+	if offcpu == nil then
+		return true
+	end
+
+	reason = evt.field(ffdtype)
+	if reason == nil then
+		reason = evt.field(fevtype)
+	end
+
+	entry = reasons[reason]
+	if entry == nil then
+		entry = {0, 0, 0}
+		reasons[reason] = entry
+	end
+
+	entry[1] = entry[1] + offcpu
+	entry[2] = entry[2] + evt.field(foncpu)
+	entry[3] = entry[3] + 1
+
+	return true
+end
+
+-- Interval callback, emits the ourput
+function on_capture_end()
+	print(extend_string("Blocked", 10) .. extend_string("Running", 10) .. extend_string("Calls", 10) .. "Reason")
+	print("------------------------------------------------------------")
+
+	for k, v in pairs_top_by_val(reasons, HOW_MANY, function(t, a, b) return t[b][1] < t[a][1] end) do
+		print(extend_string(format_time_interval(v[1]), 10) ..
+			extend_string(format_time_interval(v[2]), 10) ..
+			extend_string(tostring(v[3]), 10) .. k)
+	end
+
+	return true
+end
@@ -28,6 +28,20 @@ function extend_string(s, newlen)
 	return s
 end
 
+--[[ 
+Adds the values of table src to the values with the same key in table dst.
+Used by the on_merge() of the chisels that group values by key.
+]]--
+function add_table_values(dst, src)
+	for k, v in pairs(src) do
+		if dst[k] == nil then
+			dst[k] = v
+		else
+			dst[k] = dst[k] + v
+		end
+	end
+end
+
 --[[ 
 convert a number into a byte representation.
 E.g. 1230 becomes 1.23K
@@ -0,0 +1,146 @@
+--[[
+Copyright (C) 2013-2014 Draios inc.
+ 
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+--]]
+
+--[[ 
+Typed access to the event fields through the LuaJIT FFI. The values are
+read in their native types, without becoming Lua strings, and the calls
+can be compiled by the JIT. Usage:
+
+	fieldvalue = require "fieldvalue"
+	fbytes = chisel.request_field("evt.rawarg.res")
+	vbytes = fieldvalue.new()
+	...
+	if fieldvalue.get(fbytes, vbytes) then
+		tot = tot + vbytes.m_num
+	end
+
+m_num has the value of the numeric fields as a Lua number, m_int and m_uint
+as 64 bit integers. The strings are in m_buf and m_len, use ffi.string() to
+turn them into Lua strings.
+
+fieldvalue.get_ts(), get_num(), get_cpuid() and get_type() are the FFI
+versions of the evt functions with the same names, and return the same
+values.
+
+A chisel can also receive the events in batches, with the values of the
+fields that it requested already extracted, by having an on_events()
+callback instead of on_event(). The batch has one row per event that passed
+the chisel filter, with one value per field, in the order of the
+chisel.request_field() calls. The fields that an event doesn't have are
+SFV_NONE. The batch is only valid during the callback, and evt.field()
+can't be used in it.
+
+	function on_events(batch, nevts, nfields)
+		local vals = fieldvalue.batch(batch)
+
+		for j = 0, nevts - 1 do
+			local vbytes = vals[j * nfields]
+
+			if vbytes.m_kind ~= fieldvalue.SFV_NONE then
+				tot = tot + vbytes.m_num
+			end
+		end
+	end
+
+The batches are passed before on_interval() and on_capture_end(), so the
+chisel has seen all the events before those are called.
+]]--
+
+local ffi = require("ffi")
+
+ffi.cdef[[
+typedef struct sinsp_field_value
+{
+	uint32_t m_type;
+	uint32_t m_kind;
+	int64_t m_int;
+	uint64_t m_uint;
+	double m_num;
+	const char* m_buf;
+	uint32_t m_len;
+}sinsp_field_value;
+]]
+
+local extract = ffi.cast("int32_t (*)(void*, void*, sinsp_field_value*)", chisel.get_ffi_fn("field_value"))
+local evt_get_ts = ffi.cast("uint64_t (*)(void*)", chisel.get_ffi_fn("evt_get_ts"))
+local evt_get_num = ffi.cast("uint64_t (*)(void*)", chisel.get_ffi_fn("evt_get_num"))
+local evt_get_cpuid = ffi.cast("int32_t (*)(void*)", chisel.get_ffi_fn("evt_get_cpuid"))
+local evt_get_type = ffi.cast("const char* (*)(void*)", chisel.get_ffi_fn("evt_get_type"))
+
+local fieldvalue = {}
+
+fieldvalue.SFV_INT = 0
+fieldvalue.SFV_UINT = 1
+fieldvalue.SFV_BOOL = 2
+fieldvalue.SFV_IPV4 = 3
+fieldvalue.SFV_BUF = 4
+fieldvalue.SFV_NONE = 5
+
+--[[ 
+Allocate a value to pass to fieldvalue.get()
+]]--
+function fieldvalue.new()
+	return ffi.new("sinsp_field_value")
+end
+
+--[[ 
+Fill val with the value of the field of the current event, for a field
+returned by chisel.request_field(). Returns false if the event doesn't have
+the field.
+]]--
+function fieldvalue.get(fld, val)
+	return extract(fld, sievt, val) ~= 0
+end
+
+--[[ 
+Return the timestamp of the current event, as seconds and nanoseconds
+]]--
+function fieldvalue.get_ts()
+	local ts = evt_get_ts(sievt)
+	return tonumber(ts / 1000000000), tonumber(ts % 1000000000)
+end
+
+--[[ 
+Return the number of the current event
+]]--
+function fieldvalue.get_num()
+	return tonumber(evt_get_num(sievt))
+end
+
+--[[ 
+Return the CPU of the current event
+]]--
+function fieldvalue.get_cpuid()
+	return evt_get_cpuid(sievt)
+end
+
+--[[ 
+Return the name of the type of the current event
+]]--
+function fieldvalue.get_type()
+	return ffi.string(evt_get_type(sievt))
+end
+
+--[[ 
+Return the values of the batch passed to on_events(), as an array that
+starts at 0
+]]--
+function fieldvalue.batch(batch)
+	return ffi.cast("sinsp_field_value*", batch)
+end
+
+return fieldvalue
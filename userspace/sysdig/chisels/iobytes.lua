@@ -25,6 +25,8 @@ args =
 {
 }
 
+fieldvalue = require "fieldvalue"
+
 tot = 0
 totin = 0
 totout = 0
@@ -35,6 +37,8 @@ function on_init()
 	fbytes = chisel.request_field("evt.rawarg.res")
 	ftime = chisel.request_field("evt.time.s")
 	fisread = chisel.request_field("evt.is_io_read")
+	vbytes = fieldvalue.new()
+	visread = fieldvalue.new()
 
 	-- set the filter
 	chisel.set_filter("evt.is_io=true")
@@ -46,13 +50,11 @@ end
 
 -- Event parsing callback
 function on_event()
-	bytes = evt.field(fbytes)
-	isread = evt.field(fisread)
-
-	if bytes ~= nil and bytes > 0 then
+	if fieldvalue.get(fbytes, vbytes) and vbytes.m_num > 0 then
+		bytes = vbytes.m_num
 		tot = tot + bytes
 		
-		if isread then
+		if fieldvalue.get(fisread, visread) and visread.m_uint ~= 0 then
 			totin = totin + bytes
 		else
 			totout = totout + bytes
@@ -0,0 +1,134 @@
+--[[
+Copyright (C) 2013-2014 Draios inc.
+ 
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+--]]
+
+-- Chisel description
+description = "For the files with the most reads and writes, shows how much of them is sequential, i.e. starts where the previous read or write of the FD ended, and their sizes. The files opened before the capture are only followed once the offset of their FD is known, e.g. after an lseek, or for pread and pwrite.";
+short_description = "File I/O access patterns";
+category = "I/O";
+
+-- Chisel argument list
+args = 
+{
+}
+
+require "common"
+
+-- The number of files to show
+TOP_NUMBER = 10
+
+-- The size classes, as in fd.iosizes
+SIZE_NAMES = {"<1K", "<4K", "<16K", "<64K", "<256K", "<1M", "<4M", ">=4M"}
+
+files = {}
+
+-- Initialization callback
+function on_init()
+	-- Request the fields
+	fname = chisel.request_field("fd.name")
+	fbytes = chisel.request_field("evt.rawarg.res")
+	fioseq = chisel.request_field("fd.ioseq")
+
+	-- set the filter
+	chisel.set_filter("evt.is_io=true and evt.dir=< and fd.type=file")
+
+	chisel.set_interval_s(1)
+
+	return true
+end
+
+function size_class(bytes)
+	local limit = 1024
+	local j = 1
+
+	while j < #SIZE_NAMES and bytes >= limit do
+		limit = limit * 4
+		j = j + 1
+	end
+
+	return j
+end
+
+-- Event parsing callback
+function on_event()
+	local bytes = evt.field(fbytes)
+
+	if bytes == nil or bytes < 0 then
+		return true
+	end
+
+	local name = evt.field(fname)
+	local f = files[name]
+
+	if f == nil then
+		f = {ops = 0, seq = 0, rand = 0, bytes = 0, sizes = {}}
+		files[name] = f
+	end
+
+	f.ops = f.ops + 1
+	f.bytes = f.bytes + bytes
+
+	local seq = evt.field(fioseq)
+	if seq == true then
+		f.seq = f.seq + 1
+	elseif seq == false then
+		f.rand = f.rand + 1
+	end
+
+	local c = size_class(bytes)
+	f.sizes[c] = (f.sizes[c] or 0) + 1
+
+	return true
+end
+
+function print_files()
+	print(extend_string("Ops", 9) .. extend_string("Seq%", 6) .. extend_string("Bytes", 10) .. extend_string("Sizes", 32) .. "File")
+	print("--------------------------------------------------------------------------------")
+
+	for name, f in pairs_top_by_val(files, TOP_NUMBER, function(t, a, b) return t[b].ops < t[a].ops end) do
+		local pct = "-"
+		if f.seq + f.rand > 0 then
+			pct = string.format("%d", f.seq * 100 / (f.seq + f.rand))
+		end
+
+		local sizes = ""
+		for j = 1, #SIZE_NAMES do
+			if f.sizes[j] ~= nil then
+				sizes = sizes .. SIZE_NAMES[j] .. ":" .. f.sizes[j] .. " "
+			end
+		end
+
+		print(extend_string(tostring(f.ops), 9) ..
+			extend_string(pct, 6) ..
+			extend_string(format_bytes(f.bytes), 10) ..
+			extend_string(sizes, 32) .. name)
+	end
+
+	files = {}
+end
+
+function on_interval(delta)
+	print_files()
+	return true
+end
+
+function on_capture_end()
+	if next(files) ~= nil then
+		print_files()
+	end
+
+	return true
+end
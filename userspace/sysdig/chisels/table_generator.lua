@@ -64,10 +64,16 @@ args =
 require "common"
 terminal = require "ansiterminal"
 
-grtable = {}
+grtable = nil
+grview = nil
 filter = ""
 islive = false
 
+-- In live captures, which can run forever, the table keeps at most this
+-- number of keys per interval: the ones with the smallest values make room
+-- for the new ones
+LIVE_MAX_GROUPS = 65536
+
 vizinfo = 
 {
 	key_fld = "",
@@ -108,10 +114,6 @@ function on_set_arg(name, val)
 end
 
 function on_init()
-	-- Request the fields we need
-	fkey = chisel.request_field(vizinfo.key_fld)
-	fvalue = chisel.request_field(vizinfo.value_fld)
-
 	-- set the filter
 	if filter ~= "" then
 		chisel.set_filter(filter)
@@ -124,10 +126,29 @@ function on_capture_start()
 	islive = sysdig.is_live()
 	vizinfo.output_format = sysdig.get_output_format()
 
+	-- The table is filled in C++ with the sum of the positive values
+	-- for each key, without an on_event() callback. When the driver
+	-- samples the events, the sums are scaled up by the sampling ratio.
+	local max_groups = nil
+	if islive then
+		max_groups = LIVE_MAX_GROUPS
+	end
+	grtable = chisel.add_aggregation(vizinfo.key_fld, vizinfo.value_fld, "sum", true, max_groups, true)
+
+	-- The table is rendered in C++ too. In live captures, the intervals
+	-- after the first one only redraw the lines that changed, or only
+	-- have the rows that changed in json
+	grview = chisel.add_table_view(grtable,
+		{
+			{name = vizinfo.key_fld, desc = vizinfo.key_desc, is_key = true},
+			{name = vizinfo.value_fld, desc = vizinfo.value_desc, units = vizinfo.value_units}
+		},
+		vizinfo.top_number,
+		islive)
+
 	if islive then
 		chisel.set_interval_s(1)
 		if vizinfo.output_format ~= "json" then
-			terminal.clearscreen()
 			terminal.hidecursor()
 		end
 	end
@@ -135,34 +156,23 @@ function on_capture_start()
 	return true
 end
 
-function on_event()
-	key = evt.field(fkey)
-	value = evt.field(fvalue)
-
-	if key ~= nil and value ~= nil and value > 0 then
-		entryval = grtable[key]
-
-		if entryval == nil then
-			grtable[key] = value
-		else
-			grtable[key] = grtable[key] + value
-		end
-	end
+function on_interval(ts_s, ts_ns, delta)	
+	io.write(chisel.render_table_view(grview, ts_s, 0, delta))
+	io.flush()
 
+	-- Clear the table
+	chisel.clear_aggregation(grtable)
+	
 	return true
 end
 
-function on_interval(ts_s, ts_ns, delta)	
-	if vizinfo.output_format ~= "json" then
-		terminal.clearscreen()
-		terminal.goto(0, 0)
-	end
-	
-	print_sorted_table(grtable, ts_s, 0, delta, vizinfo)
+-- With --parallel, the table of the other parts of the file is added to
+-- ours in C++, so there's nothing to pass along
+function on_segment_end()
+	return {}
+end
 
-	-- Clear the table
-	grtable = {}
-	
+function on_merge(segtable)
 	return true
 end
 
@@ -174,7 +184,7 @@ function on_capture_end(ts_s, ts_ns, delta)
 		return true
 	end
 	
-	print_sorted_table(grtable, ts_s, 0, delta, vizinfo)
+	io.write(chisel.render_table_view(grview, ts_s, 0, delta))
 	
 	return true
 end
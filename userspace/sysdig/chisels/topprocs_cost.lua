@@ -0,0 +1,69 @@
+--[[
+Copyright (C) 2013-2014 Draios inc.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+--]]
+
+-- The number of items to show
+TOP_NUMBER = 30
+
+-- Chisel description
+description = "At the end of the capture, show the top " .. TOP_NUMBER .. " processes and event types by what it cost sysdig to observe them: the events, the bytes captured and the time spent parsing and filtering them. The time is extrapolated from a sample of the events. The chisel filter doesn't apply, everything that sysdig read is counted. Use it to decide what to exclude in the driver."
+short_description = "Processes that are the most expensive to observe"
+category = "Performance"
+
+-- Chisel argument list
+args = {}
+
+require "common"
+
+-- Initialization callback
+function on_init()
+	return true
+end
+
+function print_costs(costs, title, keyfn)
+	local times = {}
+	local total_ns = 0
+
+	for i, c in ipairs(costs) do
+		times[i] = c.time_ns
+		total_ns = total_ns + c.time_ns
+	end
+
+	print(extend_string("Time", 12) .. extend_string("%Time", 8) .. extend_string("Events", 12) .. extend_string("Bytes", 12) .. title)
+	print("------------------------------------------------------------------------------")
+
+	for i, t in pairs_top_by_val(times, TOP_NUMBER, function(t, a, b) return t[b] < t[a] end) do
+		local c = costs[i]
+		local pct = 0
+
+		if total_ns > 0 then
+			pct = t * 100 / total_ns
+		end
+
+		print(extend_string(format_time_interval(t), 12) ..
+			extend_string(string.format("%.1f", pct), 8) ..
+			extend_string(c.events, 12) ..
+			extend_string(format_bytes(c.bytes), 12) ..
+			keyfn(c))
+	end
+end
+
+function on_capture_end(ts_s, ts_ns, delta)
+	print_costs(sysdig.get_proc_costs(), "Process", function(c) return c.name .. " (" .. c.pid .. ")" end)
+	print("")
+	print_costs(sysdig.get_evttype_costs(), "Event Type", function(c) return c.dir .. " " .. c.name end)
+	return true
+end
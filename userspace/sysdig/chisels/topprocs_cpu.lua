@@ -125,6 +125,17 @@ function on_interval(ts_s, ts_ns, delta)
 	return true
 end
 
+-- With --parallel, return the table of the part of the file we processed
+function on_segment_end()
+	return grtable
+end
+
+-- With --parallel, add the table of another part of the file to ours
+function on_merge(segtable)
+	add_table_values(grtable, segtable)
+	return true
+end
+
 function on_capture_end(ts_s, ts_ns, delta)
 	if islive then
 		terminal.clearscreen()
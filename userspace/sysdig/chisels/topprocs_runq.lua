@@ -0,0 +1,50 @@
+--[[
+Copyright (C) 2013-2014 Draios inc.
+ 
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+--]]
+
+-- The number of items to show
+TOP_NUMBER = 10
+
+-- How often the driver reports the waits of each thread, in milliseconds
+RUNQ_SUMMARY_MS = 1000
+
+-- Chisel description
+description = "Show the top " .. TOP_NUMBER .. " processes in terms of time spent runnable, waiting for a CPU. On live captures, the chisel turns on the run queue measurements of the driver. Trace files need to be captured with --runq-summary."
+short_description = "Top processes by run queue delay"
+category = "CPU Usage"
+
+-- Chisel argument list
+args = {}
+
+-- Argument notification callback
+function on_set_arg(name, val)
+	return false
+end
+
+-- Initialization callback
+function on_init()
+	sysdig.set_runq_summary(RUNQ_SUMMARY_MS)
+
+	chisel.exec("table_generator", 
+		"proc.name",
+		"Process",
+		"thread.runqdelay",
+		"Run Queue Delay",
+		"evt.type=runq", 
+		"" .. TOP_NUMBER,
+		"time")
+	return true
+end
@@ -0,0 +1,98 @@
+--[[
+Copyright (C) 2013-2014 Draios inc.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+--]]
+
+-- The number of items to show
+TOP_NUMBER = 30
+
+-- Chisel description
+description = "Every second, show the top " .. TOP_NUMBER .. " system calls by number of calls, with their errors and time spent. The counters are kept in the driver, which doesn't send the system call events to sysdig, so this has a much lower overhead than topscalls and topscalls_time. Live captures only."
+short_description = "Top system calls, counted in the driver"
+category = "Performance"
+
+-- Chisel argument list
+args = {}
+
+require "common"
+terminal = require "ansiterminal"
+
+prev = {}
+
+-- Initialization callback
+function on_init()
+	sysdig.set_syscall_aggregation(false)
+	return true
+end
+
+function on_capture_start()
+	if not sysdig.is_live() then
+		print("topscalls_aggr works on live captures only")
+		return false
+	end
+
+	chisel.set_interval_s(1)
+	terminal.clearscreen()
+	terminal.hidecursor()
+	return true
+end
+
+function on_interval(ts_s, ts_ns, delta)
+	local cur = {}
+	local deltas = {}
+
+	-- The driver counters only grow, compute what happened in the last interval
+	for i, e in ipairs(sysdig.get_syscall_aggregation()) do
+		cur[e.name] = e
+		local p = prev[e.name]
+
+		if p == nil then
+			p = {calls = 0, errors = 0, time_ns = 0}
+		end
+
+		if e.calls > p.calls then
+			deltas[e.name] = {calls = e.calls - p.calls, errors = e.errors - p.errors, time_ns = e.time_ns - p.time_ns}
+		end
+	end
+
+	prev = cur
+
+	local counts = {}
+	for k, v in pairs(deltas) do
+		counts[k] = v.calls
+	end
+
+	terminal.clearscreen()
+	terminal.goto(0, 0)
+
+	print(extend_string("Calls", 12) .. extend_string("Errors", 12) .. extend_string("Time", 12) .. "System Call")
+	print("------------------------------------------------------")
+
+	for k, v in pairs_top_by_val(counts, TOP_NUMBER, function(t, a, b) return t[b] < t[a] end) do
+		print(extend_string(v, 12) ..
+			extend_string(deltas[k].errors, 12) ..
+			extend_string(format_time_interval(deltas[k].time_ns), 12) ..
+			k)
+	end
+
+	return true
+end
+
+function on_capture_end(ts_s, ts_ns, delta)
+	terminal.clearscreen()
+	terminal.goto(0, 0)
+	terminal.showcursor()
+	return true
+end
@@ -36,6 +36,8 @@ along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
 #else
 #include <unistd.h>
 #include <getopt.h>
+#include <sys/time.h>
+#include <pthread.h>
 #endif
 
 bool ctrl_c_pressed = false;
@@ -45,6 +47,37 @@ vector<sinsp_chisel*> g_chisels;
 
 static void usage();
 
+//
+// Prints the groups of the --rollup metrics at the end of each interval
+//
+class rollup_printer : public sinsp_rollup_listener
+{
+public:
+	void on_rollup(sinsp_rollup* rollup)
+	{
+		g_output_sink.write_line(rollup->to_json(0));
+	}
+};
+
+static rollup_printer g_rollup_printer;
+static bool g_rollup_enabled = false;
+
+//
+// The rules of --rules. When there are rules, their alerts are printed
+// instead of the events.
+//
+#ifdef HAS_FILTERING
+static sinsp_rule_engine* g_rule_engine = NULL;
+#endif
+
+//
+// The flight recorder of -w with --trigger, that writes the events only
+// around the matches
+//
+#ifdef HAS_FILTERING
+static sinsp_dumper* g_flight_recorder = NULL;
+#endif
+
 //
 // Helper functions
 //
@@ -82,57 +115,303 @@ static void usage()
 "                    end-of-lines. This is useful to only display human-readable\n"
 "                    data.\n"
 " -a, --abstime      Show absolute event timestamps\n"
+" --arrow=<file>     Write the events to <file> in the Apache Arrow IPC stream\n"
+"                    format instead of printing them, with a column for each\n"
+"                    field of --arrow-fields. The numbers and timestamps keep\n"
+"                    their type, and the names of the processes, fds and\n"
+"                    event types are dictionary encoded.\n"
+" --arrow-fields=<fields>\n"
+"                    The comma separated fields that --arrow writes, e.g.\n"
+"                    evt.rawtime,proc.name,fd.name. By default: evt.num,\n"
+"                    evt.rawtime, evt.cpu, proc.name, thread.tid, evt.dir,\n"
+"                    evt.type, evt.rawres, fd.name and evt.args.\n"
+" -B <bytes>, --bufsize=<bytes>\n"
+"                    Set the size of each per-CPU capture ring buffer. Must be\n"
+"                    a multiple of the page size. Bigger buffers reduce event\n"
+"                    drops during bursts.\n"
+" --backpressure     Raise the sampling ratio of the driver when its buffers\n"
+"                    fill up or the events are processed late, and lower it\n"
+"                    when the load falls. Every change is shown as a\n"
+"                    'sampling' event with the new ratio.\n"
+" --bpf              Capture with eBPF programs instead of the sysdig-probe\n"
+"                    module, which doesn't need to be loaded. The events are\n"
+"                    the generic system call events, without arguments, and\n"
+"                    the options that need the driver are not available.\n"
+" --buffer-hash=<bytes>\n"
+"                    Have the driver store a 64 bit hash of the first <bytes>\n"
+"                    bytes of the I/O buffers in the events, instead of the\n"
+"                    first snaplen bytes of data. The hash is in\n"
+"                    evt.buffer_hash, and tells whether reads or writes moved\n"
+"                    the same data without copying it.\n"
+" --build-index=<fields>\n"
+"                    Read the file given with -r and write an index of the\n"
+"                    comma separated <fields>, e.g. proc.pid,fd.name, in\n"
+"                    <file>.idx. --skip-scan uses it when the filter is an '='\n"
+"                    or 'in' check on these fields, or 'and' and 'or' of them.\n"
+" --checkpoint=<file>\n"
+"                    Keep the process and fd tables of live captures in <file>\n"
+"                    across restarts. The capture starts from the tables of the\n"
+"                    last run and reads from /proc only the processes that have\n"
+"                    changed since, and writes them back at the end.\n"
+" --compact          Have the driver store the events in a compact encoding.\n"
+"                    More events fit in the ring buffers, which reduces drops,\n"
+"                    at the cost of a little more CPU to decode them.\n"
+" --consumer-cpus=<cpus>\n"
+"                    Run sysdig, and its reader threads, on the given CPUs,\n"
+"                    e.g. 2,4-7, instead of letting it move around the CPUs\n"
+"                    of the workload. Its buffers are allocated on their NUMA\n"
+"                    node. With -v, the stats at the end tell where it ran.\n"
+" --exclude-consumer-cpus\n"
+"                    Used with --consumer-cpus, have the driver discard the\n"
+"                    events of those CPUs, so that sysdig doesn't capture\n"
+"                    itself.\n"
 #ifdef HAS_CHISELS
 " -c <chiselname> <chiselargs>, --chisel  <chiselname> <chiselargs>\n"
 "                    run the specified chisel. If the chisel require arguments,\n"
 "                    they must be specified in the command line after the name.\n"
 " -cl, --list-chisels\n"
-#endif
 "                    lists the available chisels. Looks for chisels in .,\n"
 "                    ./chisels, ~/.chisels and /usr/share/sysdig/chisels.\n"
+" --chisel-threads=<n>\n"
+"                    Run the Lua callbacks of each chisel in its own thread,\n"
+"                    behind a queue of <n> batches of events, so that slow\n"
+"                    chisels don't delay the capture. The filters and the\n"
+"                    aggregations of the chisels still run in the capture.\n"
+"                    The chisels with an on_event() callback can't do this,\n"
+"                    because it needs the current event.\n"
+" --chisel-drop      Used with --chisel-threads, drop the batches of events\n"
+"                    that don't fit in the queue of a chisel instead of\n"
+"                    waiting. -v prints how many were dropped.\n"
+#endif
+" -C <file_size>, --file-size=<file_size>\n"
+"                    Used with -w, switch to a new trace file when the current\n"
+"                    one is larger than <file_size> MB. The files are named\n"
+"                    after <writefile>, followed by a sequence number starting\n"
+"                    from 0, and each one can be read on its own.\n"
 " -d, --displayflt   Make the given filter a display one\n"
 "                    Setting this option causes the events to be filtered\n"
 "                    after being parsed by the state system. Events are\n"
 "                    normally filtered before being analyzed, which is more\n"
 "                    efficient, but can cause state (e.g. FD names) to be lost\n"
 " -D, --debug        Capture events about sysdig itself\n"
+" --exit-only        Have the driver write the enter event of each system call\n"
+"                    together with its exit event. Implies --compact. The\n"
+"                    output doesn't change, but half as many events go\n"
+"                    through the ring buffers.\n"
+" --filter-explain   Print how the filter is run, i.e. the event types that it\n"
+"                    accepts and its checks in the order they are evaluated,\n"
+"                    and exit.\n"
+" --fold             Replace the runs of identical poll, epoll_wait, select,\n"
+"                    futex and nanosleep calls of each thread with a single\n"
+"                    'repeat' event, whose evt.count is the number of events\n"
+"                    it stands for. Applies to what is shown and to the\n"
+"                    files written with -w.\n"
+" --follow           Used with -r, keep reading the file while another sysdig\n"
+"                    is writing it, instead of stopping at its end. If the\n"
+"                    file is one of a rotation (see -C and -G), like\n"
+"                    trace.scap0, continue with the next ones as they are\n"
+"                    written. Use -W generously on the writer, the files\n"
+"                    must not be deleted before they are read.\n"
+" --from=<ts>        Used with -r, skip the events before the absolute time\n"
+"                    <ts>, in the s.ns format of '-t a' or in nanoseconds.\n"
+"                    Files written by sysdig have an index that makes this\n"
+"                    instant.\n"
+" -G <num_seconds>, --seconds=<num_seconds>\n"
+"                    Used with -w, switch to a new trace file every\n"
+"                    <num_seconds> seconds. See -C for the file names.\n"
 " -h, --help         Print this page\n"
 #ifdef HAS_CHISELS
 " -i <chiselname>, --chisel-info <chiselname>\n"
 "                    Get a longer description and the arguments associated with\n"
 "                    a chisel found in the -cl option list.\n"
 #endif
-" -j, --json         Emit output as json\n"
+" -j, --json         Emit output as json, one object per event, with a member\n"
+"                    for each field of the output format.\n"
 " -l, --list         List the fields that can be used for filtering and output\n"
 "                    formatting. Use -lv to get additional information for each\n"
 "                    field.\n"
 " -L, --list-events  List the events that the engine supports\n"
+" --max-memory=<MB>  Keep the memory used by the process and fd tables under\n"
+"                    <MB> megabytes, by dropping the state of the processes\n"
+"                    that have been inactive for the longest time.\n"
+" --metrics-file=<file>\n"
+"                    Write the internal metrics of sysdig (events by type,\n"
+"                    parser time, filter pass rate, table sizes and driver\n"
+"                    drops) to <file> every few seconds, in the Prometheus\n"
+"                    text format.\n"
 " -n <num>, --numevents=<num>\n"
 "                    Stop capturing after <num> events\n"
+" --parallel=<n>     Used with -r and -c, split the file at its state snapshots\n"
+"                    (see --state-snapshots) in up to <n> parts and run the\n"
+"                    chisels on each part in a separate thread. Only the\n"
+"                    chisels that can merge their results, like the ones\n"
+"                    based on table_generator, support this. Used with -r\n"
+"                    and -w, filter the file in parallel the same way, and\n"
+"                    keep only the processes that have events in the tables\n"
+"                    of the new file.\n"
 " -p <output_format>, --print=<output_format>\n"
 "                    Specify the format to be used when printing the events.\n"
 "                    See the examples section below for more info.\n"
+" --proc-scan=<mode> How the process and fd tables are built when a live\n"
+"                    capture starts. 'full' (the default) reads all of /proc\n"
+"                    first. 'lazy' starts right away and reads the processes\n"
+"                    from /proc when their first event arrives. 'background'\n"
+"                    is like lazy, but also reads all of /proc in a separate\n"
+"                    thread to fill the tables. 'driver' makes the driver\n"
+"                    write the tables as events at the start of the capture.\n"
+" --procinfo-ring=<size>\n"
+"                    Move the args and cwd of the clone and execve events to a\n"
+"                    separate ring of <size> bytes per CPU, so that bursts of\n"
+"                    process creations don't cause drops of the other events.\n"
+"                    When that ring is full, only the args and cwd are lost.\n"
+" --profile          Time the stages of the processing of each event (reading\n"
+"                    from the driver or the file, table cleanup, parsing,\n"
+"                    filtering, writing with -w) and print a summary per stage\n"
+"                    and per event type when the capture ends. If sysdig was\n"
+"                    built with SINSP_ALLOC_STATS, the heap allocations of\n"
+"                    each part of the library are printed too.\n"
 " -q, --quiet        Don't print events on the screen.\n"
 "                    Useful when dumping to disk.\n"
 " -r <readfile>, --read=<readfile>\n"
-"                    Read the events from <readfile>.\n"
-" -S, --summary      print the event summary (i.e. the list of the top events)\n"
-"                    when the capture ends.\n"
+"                    Read the events from <readfile>. With tcp://[host]:port,\n"
+"                    wait for a sysdig started with -w tcp://... to connect\n"
+"                    and read the capture it sends. With more than one -r,\n"
+"                    the captures are read together, in timestamp order, and\n"
+"                    evt.host tells the machine of each event.\n"
+" --reader-threads=<n>\n"
+"                    Read the driver buffers from <n> threads, each one\n"
+"                    handling a group of CPUs, instead of the main thread.\n"
+"                    Helps on machines with many CPUs. With -r, decompress\n"
+"                    the frames of files written with -z from <n> threads,\n"
+"                    ahead of the one that parses the events.\n"
+" --replay=<speed>   Used with -r, deliver the events at the pace they were\n"
+"                    captured, <speed> times faster: 1 replays the file in\n"
+"                    real time, 10 ten times faster, 0.5 at half speed. The\n"
+"                    intervals of the chisels follow the replay.\n"
+" --rules=<file>     Test the events on the rules of <file>, and print the\n"
+"                    alerts of the rules that match instead of the events.\n"
+"                    Can be repeated. A rule file is a JSON document like\n"
+"                    {\"rules\": [{\"name\": \"shell\", \"filter\": \"evt.type=execve\n"
+"                    and proc.name=bash\", \"output\": \"%%proc.cmdline\",\n"
+"                    \"priority\": \"warning\", \"rate\": 1, \"burst\": 10}]}\n"
+"                    where output, priority (debug, info, warning, error or\n"
+"                    critical), and the alerts per second and the burst of\n"
+"                    the rate limit are optional.\n"
+" --resolve-names    Print the IPv4 addresses and ports of the sockets with\n"
+"                    their names, from reverse DNS and /etc/services. The\n"
+"                    names are looked up in the background, so an address is\n"
+"                    printed as a number until its name is known.\n"
+" --rollup=<op>:<value>:<keys>\n"
+"                    At the end of each interval, print a JSON line with the\n"
+"                    groups of the events by the comma separated <keys>\n"
+"                    fields, and the <op> of the <value> field for each\n"
+"                    group: sum, count, min, max, or a percentile like p99.\n"
+"                    <value> can be empty for count. Can be repeated, and\n"
+"                    all the metrics go in the same line, e.g.\n"
+"                    --rollup=count::evt.type\n"
+"                    --rollup=p99:evt.latency:proc.name\n"
+" --rollup-interval=<ms>\n"
+"                    Length of the intervals of --rollup, 1000 by default.\n"
+" --sample=<mode>:<n>\n"
+"                    Keep all the events of 1 out of every <n> connections\n"
+"                    (<mode> connection) or processes (<mode> process) and\n"
+"                    drop the others, e.g. to write a smaller capture with -w\n"
+"                    where the kept connections are complete. The choice\n"
+"                    is a hash of the 4-tuple or of the pid, so two sysdigs\n"
+"                    with the same option keep the same connections. The\n"
+"                    process creation and exit events are always kept.\n"
+" --shards=<n>       Used with -r and -c, split the processes of the file in <n>\n"
+"                    groups by a hash of their pid, and run the chisels on\n"
+"                    each group in a separate thread. Each thread reads the\n"
+"                    whole file and keeps the whole process and fd tables, but\n"
+"                    only parses the events that change them and the events\n"
+"                    of its processes. Unlike --parallel, the file doesn't\n"
+"                    need state snapshots. The chisels must support merging\n"
+"                    their results, like for --parallel.\n"
+" --skip-scan        Used with -r and a filter, skip the groups of events that\n"
+"                    the filter rejects entirely, according to the summaries\n"
+"                    in the index of the file, or that <file>.idx has no event\n"
+"                    for (see --build-index), without reading them. The state\n"
+"                    changes in the skipped groups are lost too, e.g. the\n"
+"                    names of the files they open. -v prints how many groups\n"
+"                    were skipped.\n"
+" -S, --summary      print the event summary (i.e. the list of the top events,\n"
+"                    with their size and their average latency) when the\n"
+"                    capture ends. For live captures, this also includes the\n"
+"                    per event type counters and the filler execution times\n"
+"                    measured by the driver.\n"
+" --summary-interval=<s>\n"
+"                    Implies -S. Also print the summary of the events of\n"
+"                    the last <s> seconds every <s> seconds.\n"
 " -s <len>, --snaplen=<len>\n"
 "                    Capture the first <len> bytes of each I/O buffer.\n"
 "                    By default, the first 80 bytes are captured. Use this\n"
 "                    option with caution, it can generate huge trace files.\n"
+" --state-ring=<size>\n"
+"                    Send the events that change the process and fd tables\n"
+"                    (open, close, clone, execve...) to a separate ring of\n"
+"                    <size> bytes per CPU, so that when the capture can't keep\n"
+"                    up only the other events are dropped.\n"
+" --runq-summary=<ms>\n"
+"                    Measure how long the threads wait for a CPU once they are\n"
+"                    runnable. A thread that waited gets a runq event when it\n"
+"                    leaves the CPU, at most once every <ms> milliseconds.\n"
+"                    thread.runqdelay, thread.runqwaits and thread.runqmax\n"
+"                    report its waits since the previous one.\n"
+" --pgfault-summary=<ms>\n"
+"                    Report the page faults of the threads. A thread that had\n"
+"                    faults gets a pgfault event when it leaves the CPU, at\n"
+"                    most once every <ms> milliseconds. thread.pfmajor and\n"
+"                    thread.pfminor report its faults since the previous one,\n"
+"                    proc.pfmajor and proc.pfminor the totals of its process.\n"
+" --state-snapshots=<sec>\n"
+"                    Used with -w, save the process and fd tables in the trace\n"
+"                    file every <sec> seconds, so that --from can restore them\n"
+"                    instead of starting from the tables at the file start.\n"
+" --switch-summary=<ms>\n"
+"                    Instead of one switch event per context switch, emit a\n"
+"                    switchsum event when a thread leaves the CPU, at most once\n"
+"                    every <ms> milliseconds per thread. thread.exectime,\n"
+"                    thread.vcsw and thread.ivcsw report what happened since\n"
+"                    the previous summary of the thread.\n"
+" --tap=<name>       Publish every captured event in the shared memory ring\n"
+"                    <name>, so that other tools can read them without opening\n"
+"                    the driver. Only the user running sysdig can read it.\n"
+"                    Slow readers lose events, the capture never waits for\n"
+"                    them.\n"
+" --tcp-tuple-elision\n"
+"                    Have the driver leave the tuple out of the send and\n"
+"                    receive events of connected TCP sockets, and take it\n"
+"                    from the connect or the accept of the socket instead.\n"
 " -t <timetype>, --timetype=<timetype>\n"
 "                    Change the way event time is diplayed. Accepted values are\n"
 "                    h for human-readable string, a for abosulte timestamp from\n"
 "                    epoch, r for relative time from the beginning of the\n"
 "                    capture, and d for delta between event enter and exit.\n"
+" --trigger=<filter> Used with -w, keep the last events in memory instead of\n"
+"                    writing them, and write them when an event matches\n"
+"                    <filter>, with the events that follow. Each match writes\n"
+"                    a new file, <writefile>0, <writefile>1, and so on.\n"
+" --trigger-window=<before>:<after>[:<MB>]\n"
+"                    Used with --trigger, the seconds of events written before\n"
+"                    and after a match, 10:10 by default, and the memory for\n"
+"                    the events before, compressed, 64 MB by default. With 0\n"
+"                    seconds before, only the memory limits the events kept.\n"
 " -v, --verbose      Verbose output.\n"
 " -w <writefile>, --write=<writefile>\n"
-"                    Write the captured events to <writefile>.\n"
+"                    Write the captured events to <writefile>. With\n"
+"                    tcp://host:port, send them to a sysdig reading with\n"
+"                    -r tcp://... on that host. When the network can't keep\n"
+"                    up, whole blocks of events are dropped, and counted with\n"
+"                    -v.\n"
+" -W <num_files>, --limit=<num_files>\n"
+"                    Used with -C or -G, only keep the last <num_files> trace\n"
+"                    files, deleting the oldest one when a new one is created.\n"
 " -x, --print-hex    Print data buffers in hex.\n"
 " -X, --print-hex-ascii\n"
 "                    Print data buffers in hex and ASCII.\n"
+" -z, --compress     Used with -w, compress the events of the trace file.\n"
+"                    -r reads compressed files like uncompressed ones.\n"
 "\n"
 "Output format:\n\n"
 "By default, sysdig prints the information for each captured event on a single\n"
@@ -163,51 +442,268 @@ static void usage()
     );
 }
 
+//
+// Print the nentries event types with the most calls. With interval, print
+// the counts since the previous periodic print instead of the totals.
+//
 void print_summary_table(sinsp* inspector,
-						 vector<summary_table_entry>* summary_table,
-						 uint32_t nentries)
+						 summary_table* table,
+						 uint32_t nentries,
+						 bool interval)
 {
 	sinsp_evttables* einfo = inspector->get_event_info_tables();
+	vector<pair<uint64_t, uint32_t> > ids;
+	summary_counters delta;
+	uint32_t j;
 
-	cout << "----------------------\n";
-	string tstr = string("Event");
-	tstr.resize(16, ' ');
-	tstr += "#Calls\n";
-	cout << tstr;
-	cout << "----------------------\n";
+	for(j = 0; j < SUMMARY_TABLE_SIZE; j++)
+	{
+		uint64_t n = table->m_totals[j].m_ncalls - (interval? table->m_printed[j].m_ncalls : 0);
+
+		if(n != 0)
+		{
+			ids.push_back(pair<uint64_t, uint32_t>(n, j));
+		}
+	}
+
+	sort(ids.begin(), ids.end(), greater<pair<uint64_t, uint32_t> >());
 
-	sort(summary_table->begin(), summary_table->end(),
-		summary_table_entry_rsort_comparer());
+	printf("------------------------------------------------------\n");
+	printf("%-18s%-12s%-14s%s\n", "Event", "#Calls", "Bytes", "Avg Latency ns");
+	printf("------------------------------------------------------\n");
 
-	for(uint32_t j = 0; j < nentries; j++)
+	for(j = 0; j < ids.size() && j < nentries; j++)
 	{
-		summary_table_entry* e = &summary_table->at(j);
+		uint32_t id = ids[j].second;
+		summary_counters* c = &table->m_totals[id];
+		const char* name;
+		bool is_enter;
 
-		if(e->m_ncalls == 0)
+		if(interval)
 		{
-			break;
+			delta.m_ncalls = c->m_ncalls - table->m_printed[id].m_ncalls;
+			delta.m_bytes = c->m_bytes - table->m_printed[id].m_bytes;
+			delta.m_latency_ns = c->m_latency_ns - table->m_printed[id].m_latency_ns;
+			delta.m_nlatency = c->m_nlatency - table->m_printed[id].m_nlatency;
+			c = &delta;
+		}
+
+		if(id >= PPM_EVENT_MAX)
+		{
+			name = einfo->m_syscall_info_table[(id - PPM_EVENT_MAX) / 2].name;
+			is_enter = ((id - PPM_EVENT_MAX) % 2 == 0);
 		}
+		else
+		{
+			name = einfo->m_event_info[id].name;
+			is_enter = PPME_IS_ENTER(id);
+		}
+
+		printf("%s%-16s%-12" PRIu64 "%-14" PRIu64 "%" PRIu64 "\n",
+			is_enter? "> ": "< ",
+			name,
+			c->m_ncalls,
+			c->m_bytes,
+			c->m_nlatency? c->m_latency_ns / c->m_nlatency : 0);
+	}
+
+	if(interval)
+	{
+		memcpy(table->m_printed, table->m_totals, sizeof(table->m_printed));
+	}
+
+	fflush(stdout);
+}
+
+//
+// Print the per event type statistics collected by the driver, and the
+// histogram of the filler execution times
+//
+void print_driver_stats(sinsp* inspector, uint32_t nentries)
+{
+	ppm_detailed_stats stats;
+	sinsp_evttables* einfo = inspector->get_event_info_tables();
+	vector<pair<uint64_t, uint32_t> > types;
+	uint32_t j;
+
+	try
+	{
+		inspector->get_detailed_stats(-1, &stats);
+	}
+	catch(const sinsp_exception& e)
+	{
+		cerr << e.what() << endl;
+		return;
+	}
+
+	for(j = 0; j < PPM_EVENT_MAX; j++)
+	{
+		uint64_t n = stats.evts[j].n_evts + stats.evts[j].n_drops;
+
+		if(n != 0)
+		{
+			types.push_back(pair<uint64_t, uint32_t>(n, j));
+		}
+	}
+
+	sort(types.begin(), types.end(), greater<pair<uint64_t, uint32_t> >());
+
+	cout << "--------------------------------------------------------------------------------\n";
+	string tstr = string("Driver Event");
+	tstr.resize(18, ' ');
+	printf("%s%-12s%-14s%-12s%-16s%s\n", tstr.c_str(), "#Evts", "Bytes", "Drops", "Avg Filler ns", "Avg Record ns");
+	cout << "--------------------------------------------------------------------------------\n";
+
+	for(j = 0; j < types.size() && j < nentries; j++)
+	{
+		uint32_t etype = types[j].second;
+		ppm_evt_type_stats* es = &stats.evts[etype];
+
+		tstr = einfo->m_event_info[etype].name;
+		tstr.resize(16, ' ');
+
+		printf("%s%s%-12" PRIu64 "%-14" PRIu64 "%-12" PRIu64 "%-16" PRIu64 "%" PRIu64 "\n",
+			(PPME_IS_ENTER(etype))? "> ": "< ",
+			tstr.c_str(),
+			es->n_evts,
+			es->n_bytes,
+			es->n_drops,
+			(es->n_evts + es->n_drops)? es->filler_ns / (es->n_evts + es->n_drops) : 0,
+			(es->n_evts + es->n_drops)? es->record_ns / (es->n_evts + es->n_drops) : 0);
+	}
+
+	cout << "----------------------\n";
+	cout << "Filler ns       #Evts\n";
+	cout << "----------------------\n";
 
-		if(e->m_is_unsupported_syscall)
+	for(j = 0; j < PPM_FILLER_LATENCY_BUCKETS; j++)
+	{
+		char range[32];
+
+		if(stats.filler_latency[j] == 0)
 		{
-			tstr = einfo->m_syscall_info_table[e->m_id / 2].name;
-			tstr.resize(16, ' ');
+			continue;
+		}
 
-			printf("%s%s%" PRIu64 "\n",
-				(PPME_IS_ENTER(e->m_id))? "> ": "< ",
-				tstr.c_str(),
-				e->m_ncalls);
+		if(j == PPM_FILLER_LATENCY_BUCKETS - 1)
+		{
+			snprintf(range, sizeof(range), ">= %" PRIu64, (uint64_t)1 << j);
 		}
 		else
 		{
-			tstr = einfo->m_event_info[e->m_id].name;
-			tstr.resize(16, ' ');
+			snprintf(range, sizeof(range), "< %" PRIu64, (uint64_t)1 << (j + 1));
+		}
+
+		tstr = range;
+		tstr.resize(16, ' ');
+
+		printf("%s%" PRIu64 "\n", tstr.c_str(), stats.filler_latency[j]);
+	}
+}
+
+//
+// Print the times of the stages of the event processing, and the event
+// types that took the most time
+//
+void print_profile(sinsp* inspector, uint32_t nentries)
+{
+	sinsp_profiler* prof = inspector->get_profiler();
+	sinsp_evttables* einfo = inspector->get_event_info_tables();
+	vector<pair<uint64_t, uint32_t> > types;
+	double ns_per_tick;
+	uint32_t j;
+	uint32_t k;
+
+	if(prof == NULL)
+	{
+		return;
+	}
+
+	inspector->set_profiling(false);
+	ns_per_tick = prof->get_ns_per_tick();
+
+	cout << "--------------------------------------------------------------------------\n";
+	printf("%-12s%-12s%-12s%-10s%-10s%-10s%s\n", "Stage", "#Evts", "Total ms", "Avg ns", "p50 ns", "p99 ns", "Max ns");
+	cout << "--------------------------------------------------------------------------\n";
+
+	for(j = 0; j < SPS_MAX; j++)
+	{
+		sinsp_profiler::stage_stats total;
+
+		prof->get_stage_total((sinsp_profile_stage)j, &total);
+		if(total.m_n == 0)
+		{
+			continue;
+		}
+
+		printf("%-12s%-12" PRIu64 "%-12.1f%-10.0f%-10.0f%-10.0f%.0f\n",
+			sinsp_profiler::get_stage_name((sinsp_profile_stage)j),
+			total.m_n,
+			total.m_ticks * ns_per_tick / 1000000,
+			total.m_ticks * ns_per_tick / total.m_n,
+			sinsp_profiler::get_percentile(&total, 0.5) * ns_per_tick,
+			sinsp_profiler::get_percentile(&total, 0.99) * ns_per_tick,
+			total.m_max_ticks * ns_per_tick);
+	}
+
+	//
+	// The event types by total time over all the stages
+	//
+	for(j = 0; j < PPM_EVENT_MAX; j++)
+	{
+		uint64_t ticks = 0;
+
+		for(k = 0; k < SPS_MAX; k++)
+		{
+			ticks += prof->get_stats((sinsp_profile_stage)k, j)->m_ticks;
+		}
+
+		if(ticks != 0)
+		{
+			types.push_back(pair<uint64_t, uint32_t>(ticks, j));
+		}
+	}
+
+	sort(types.begin(), types.end(), greater<pair<uint64_t, uint32_t> >());
+
+	cout << "--------------------------------------------------------------------------\n";
+	string tstr = string("Event");
+	tstr.resize(18, ' ');
+	printf("%s%-12s%-12s", tstr.c_str(), "#Evts", "Total ms");
+	for(k = 0; k < SPS_MAX; k++)
+	{
+		printf("%-9s", sinsp_profiler::get_stage_name((sinsp_profile_stage)k));
+	}
+	printf("(avg ns)\n");
+	cout << "--------------------------------------------------------------------------\n";
 
-			printf("%s%s%" PRIu64 "\n",
-				(PPME_IS_ENTER(e->m_id))? "> ": "< ",
-				tstr.c_str(),
-				e->m_ncalls);
+	for(j = 0; j < types.size() && j < nentries; j++)
+	{
+		uint32_t etype = types[j].second;
+		uint64_t nevts = prof->get_stats(SPS_FETCH, etype)->m_n;
+
+		tstr = einfo->m_event_info[etype].name;
+		tstr.resize(16, ' ');
+
+		printf("%s%s%-12" PRIu64 "%-12.1f",
+			(PPME_IS_ENTER(etype))? "> ": "< ",
+			tstr.c_str(),
+			nevts,
+			types[j].first * ns_per_tick / 1000000);
+
+		for(k = 0; k < SPS_MAX; k++)
+		{
+			sinsp_profiler::stage_stats* s = prof->get_stats((sinsp_profile_stage)k, etype);
+			printf("%-9.0f", s->m_n? s->m_ticks * ns_per_tick / s->m_n : 0);
 		}
+
+		printf("\n");
+	}
+
+	if(sinsp_alloc_stats::is_enabled())
+	{
+		cout << "--------------------------------------------------------------------------\n";
+		sinsp_alloc_stats::emit(stdout);
 	}
 }
 
@@ -242,6 +738,50 @@ static void chisels_on_capture_start()
 #endif
 }
 
+//
+// When only the chisels and the rules look at the events, let the driver
+// discard the event types that none of them needs
+//
+static void set_chisels_evttype_mask(sinsp* inspector)
+{
+#ifdef HAS_CHISELS
+	ppm_evt_mask mask;
+	bool has_rules = false;
+
+#ifdef HAS_FILTERING
+	has_rules = (g_rule_engine != NULL);
+#endif
+
+	if((g_chisels.empty() && !has_rules) || !inspector->is_live())
+	{
+		return;
+	}
+
+	memset(&mask, 0, sizeof(mask));
+
+	for(uint32_t j = 0; j < g_chisels.size(); j++)
+	{
+		g_chisels[j]->get_evttypes(&mask);
+	}
+
+#ifdef HAS_FILTERING
+	if(g_rule_engine != NULL)
+	{
+		ppm_evt_mask rules_mask;
+
+		g_rule_engine->get_evttypes(&rules_mask);
+
+		for(uint32_t j = 0; j < sizeof(mask.mask); j++)
+		{
+			mask.mask[j] |= rules_mask.mask[j];
+		}
+	}
+#endif
+
+	inspector->set_evttype_mask(&mask);
+#endif
+}
+
 static void chisels_on_capture_end()
 {
 #ifdef HAS_CHISELS
@@ -264,6 +804,36 @@ static void chisels_do_timeout(sinsp_evt* ev)
 #endif
 }
 
+static void chisels_do_timeout_at(uint64_t ts)
+{
+#ifdef HAS_CHISELS
+	for(vector<sinsp_chisel*>::iterator it = g_chisels.begin();
+		it != g_chisels.end(); ++it)
+	{
+		(*it)->do_timeout_at(ts);
+	}
+#endif
+}
+
+//
+// Without events, for example when the driver aggregates the system calls,
+// the chisel intervals are driven by the wall clock
+//
+static void chisels_do_timeout_now()
+{
+	uint64_t ts;
+#ifdef _WIN32
+	ts = (uint64_t)time(NULL) * ONE_SECOND_IN_NS;
+#else
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	ts = (uint64_t)tv.tv_sec * ONE_SECOND_IN_NS + (uint64_t)tv.tv_usec * 1000;
+#endif
+
+	chisels_do_timeout_at(ts);
+}
+
 
 //
 // Event processing loop
@@ -273,8 +843,11 @@ captureinfo do_inspect(sinsp* inspector,
 					   bool quiet,
 					   bool absolute_times,
 					   sinsp_filter* display_filter,
-					   vector<summary_table_entry>* summary_table,
-					   sinsp_evt_formatter* formatter)
+					   summary_table* summary,
+					   uint64_t summary_interval_ns,
+					   sinsp_evt_formatter* formatter,
+					   sinsp_evt_json_formatter* json_formatter,
+					   sinsp_arrow_writer* arrow_writer)
 {
 	captureinfo retval;
 	int32_t res;
@@ -282,8 +855,15 @@ captureinfo do_inspect(sinsp* inspector,
 	uint64_t ts;
 	uint64_t deltats = 0;
 	uint64_t firstts = 0;
+	uint64_t next_summary_ts = 0;
 	string line;
 
+	//
+	// When reading a file, the lines are only flushed when the buffer is
+	// full, so they reach the output in big writes
+	//
+	g_output_sink.set_flush_interval(inspector->is_live());
+
 	//
 	// Loop through the events
 	//
@@ -304,6 +884,8 @@ captureinfo do_inspect(sinsp* inspector,
 
 		if(res == SCAP_TIMEOUT)
 		{
+			g_output_sink.flush();
+
 			if(ev != NULL && ev->is_filtered_out())
 			{
 				//
@@ -312,6 +894,18 @@ captureinfo do_inspect(sinsp* inspector,
 				//
 				chisels_do_timeout(ev);
 			}
+			else if(ev == NULL && inspector->is_syscall_aggregation_enabled())
+			{
+				chisels_do_timeout_now();
+			}
+			else if(ev == NULL && inspector->get_replay_ts() != 0)
+			{
+				//
+				// A paced replay is waiting for the next event, the
+				// intervals follow the replay clock
+				//
+				chisels_do_timeout_at(inspector->get_replay_ts());
+			}
 			continue;
 		}
 		else if(res == SCAP_EOF)
@@ -342,6 +936,19 @@ captureinfo do_inspect(sinsp* inspector,
 			firstts = ts;
 		}
 		deltats = ts - firstts;
+		g_output_sink.on_event(ts);
+
+#ifdef HAS_FILTERING
+		if(g_rule_engine != NULL)
+		{
+			g_rule_engine->process(ev);
+		}
+
+		if(g_flight_recorder != NULL)
+		{
+			g_flight_recorder->dump(ev);
+		}
+#endif
 
 		//
 		// If there are chisels to run, run them
@@ -361,27 +968,25 @@ captureinfo do_inspect(sinsp* inspector,
 #endif
 		{
 			//
-			// If we're supposed to summarize, increase the count for this event
+			// If we're supposed to summarize, count this event, and print the
+			// table if an interval ended
 			//
-			if(summary_table != NULL)
+			if(summary != NULL)
 			{
-				uint16_t etype = ev->get_type();
+				summary->add(ev);
 
-				if(etype == PPME_GENERIC_E)
+				if(summary_interval_ns != 0)
 				{
-					sinsp_evt_param *parinfo = ev->get_param(0);
-					uint16_t id = *(int16_t *)parinfo->m_val;
-					((*summary_table)[PPM_EVENT_MAX + id * 2]).m_ncalls++;
-				}
-				else if(etype == PPME_GENERIC_X)
-				{
-					sinsp_evt_param *parinfo = ev->get_param(0);
-					uint16_t id = *(int16_t *)parinfo->m_val;
-					((*summary_table)[PPM_EVENT_MAX + id * 2 + 1]).m_ncalls++;
-				}
-				else
-				{
-					((*summary_table)[etype]).m_ncalls++;
+					if(next_summary_ts == 0)
+					{
+						next_summary_ts = ts - ts % summary_interval_ns + summary_interval_ns;
+					}
+					else if(ts >= next_summary_ts)
+					{
+						g_output_sink.flush();
+						print_summary_table(inspector, summary, 100, true);
+						next_summary_ts = ts - ts % summary_interval_ns + summary_interval_ns;
+					}
 				}
 			}
 
@@ -394,6 +999,13 @@ captureinfo do_inspect(sinsp* inspector,
 				continue;
 			}
 
+#ifdef HAS_FILTERING
+			if(g_rule_engine != NULL)
+			{
+				continue;
+			}
+#endif
+
 			//
 			// Output the line
 			//
@@ -405,109 +1017,1229 @@ captureinfo do_inspect(sinsp* inspector,
 				}
 			}
 
-			if(formatter->tostring(ev, &line))
+			if(arrow_writer != NULL)
+			{
+				arrow_writer->write(ev);
+			}
+			else if(json_formatter != NULL)
 			{
-				cout << line << endl;
+				if(json_formatter->tostring(ev, &line))
+				{
+					g_output_sink.write_line(line);
+				}
+			}
+			else if(formatter->tostring(ev, &line))
+			{
+				g_output_sink.write_line(line);
 			}
 		}
 	}
 
+	//
+	// Print the interval that was in progress
+	//
+	if(g_rollup_enabled)
+	{
+		inspector->get_rollup()->flush(firstts + deltats);
+	}
+
+	g_output_sink.flush();
 	retval.m_time = deltats;
 	return retval;
 }
 
+#if defined(HAS_CHISELS) && !defined(_WIN32)
 //
-// MAIN
+// A part of a trace file processed by --parallel. It starts after a state
+// snapshot and has its own inspector, and its own chisels or its own
+// output file.
 //
-int main(int argc, char **argv)
+struct segment_info
 {
-	int res = EXIT_SUCCESS;
-	sinsp* inspector = NULL;
-	string infile;
-	string outfile;
-	int op;
-	uint64_t cnt = -1;
-	bool quiet = false;
-	bool absolute_times = false;
-	bool is_filter_display = false;
-	bool verbose = false;
-	bool list_flds = false;
-	sinsp_evt::param_fmt event_buffer_format = sinsp_evt::PF_NORMAL;
-	sinsp_filter* display_filter = NULL;
-	double duration = 1;
-	captureinfo cinfo;
-	string output_format;
-	uint32_t snaplen = 0;
-	int long_index = 0;
-	int32_t n_filterargs = 0;
-	int cflag = 0;
-	string cname;
-	vector<summary_table_entry>* summary_table = NULL;
-	string timefmt = "%evt.time";
+	sinsp* m_inspector;
+	bool m_owns_inspector; // m_inspector and m_chisels are freed with the segment
+	vector<sinsp_chisel*> m_chisels;
+	uint64_t m_end_evtnum; // Number of the last event of the segment, 0 to read up to the end of the file
+	uint64_t m_nevts;
+	string m_dump_fname; // The events that pass the filter, with -w
+	set<int64_t> m_tids; // The threads of those events
+	string m_error;
+	pthread_t m_thread;
+	bool m_running;
+};
+
+static void* segment_thread(void* arg)
+{
+	segment_info* si = (segment_info*)arg;
+	int32_t res;
+	sinsp_evt* ev;
 
-	static struct option long_options[] =
+	try
 	{
-		{"print-ascii", no_argument, 0, 'A' },
-		{"abstimes", no_argument, 0, 'a' },
-#ifdef HAS_CHISELS
-		{"chisel", required_argument, 0, 'c' },
-		{"list-chisels", no_argument, &cflag, 1 },
-#endif
-		{"displayflt", no_argument, 0, 'd' },
-		{"debug", no_argument, 0, 'D'},
-		{"help", no_argument, 0, 'h' },
-#ifdef HAS_CHISELS
-		{"chisel-info", required_argument, 0, 'i' },
-#endif
-		{"json", no_argument, 0, 'j' },
-		{"list", no_argument, 0, 'l' },
-		{"list-events", no_argument, 0, 'L' },
-		{"numevents", required_argument, 0, 'n' },
-		{"print", required_argument, 0, 'p' },
-		{"quiet", no_argument, 0, 'q' },
+		while(!ctrl_c_pressed)
+		{
+			res = si->m_inspector->next(&ev);
+
+			if(res == SCAP_EOF)
+			{
+				break;
+			}
+			else if(res != SCAP_SUCCESS && res != SCAP_TIMEOUT)
+			{
+				throw sinsp_exception(si->m_inspector->getlasterr().c_str());
+			}
+
+			if(ev == NULL)
+			{
+				continue;
+			}
+
+			if(si->m_end_evtnum != 0 && ev->get_num() > si->m_end_evtnum)
+			{
+				break;
+			}
+
+			if(res == SCAP_TIMEOUT)
+			{
+				continue;
+			}
+
+			si->m_nevts++;
+
+			if(!si->m_dump_fname.empty())
+			{
+				si->m_tids.insert(ev->get_tid());
+			}
+
+			for(vector<sinsp_chisel*>::iterator it = si->m_chisels.begin(); it != si->m_chisels.end(); ++it)
+			{
+				(*it)->run(ev);
+			}
+		}
+	}
+	catch(sinsp_exception& e)
+	{
+		si->m_error = e.what();
+	}
+
+	return NULL;
+}
+
+//
+// Wait for the segment threads and free everything but the inspectors and the
+// chisels that belong to the caller. The output files of the segments are
+// removed.
+//
+static void free_segments(vector<segment_info*>* segments)
+{
+	for(uint32_t j = 0; j < segments->size(); j++)
+	{
+		segment_info* si = segments->at(j);
+
+		if(si->m_running)
+		{
+			pthread_join(si->m_thread, NULL);
+		}
+
+		if(si->m_owns_inspector)
+		{
+			for(uint32_t k = 0; k < si->m_chisels.size(); k++)
+			{
+				delete si->m_chisels[k];
+			}
+
+			delete si->m_inspector;
+		}
+
+		if(!si->m_dump_fname.empty())
+		{
+			remove(si->m_dump_fname.c_str());
+		}
+
+		delete si;
+	}
+
+	segments->clear();
+}
+
+//
+// Run the first segment in this thread and the others in their own threads,
+// and return the number of events that passed the filter
+//
+static uint64_t run_segments(vector<segment_info*>* segments)
+{
+	uint64_t nevts = 0;
+	uint32_t j;
+
+	for(j = 1; j < segments->size(); j++)
+	{
+		if(pthread_create(&segments->at(j)->m_thread, NULL, segment_thread, segments->at(j)) != 0)
+		{
+			throw sinsp_exception("error creating the segment threads");
+		}
+
+		segments->at(j)->m_running = true;
+	}
+
+	segment_thread(segments->at(0));
+
+	for(j = 1; j < segments->size(); j++)
+	{
+		pthread_join(segments->at(j)->m_thread, NULL);
+		segments->at(j)->m_running = false;
+	}
+
+	for(j = 0; j < segments->size(); j++)
+	{
+		if(segments->at(j)->m_error != "")
+		{
+			throw sinsp_exception(segments->at(j)->m_error);
+		}
+
+		nevts += segments->at(j)->m_nevts;
+	}
+
+	return nevts;
+}
+
+//
+// The state snapshots where the segments after the first one start. The file
+// is written with snapshots at regular intervals, so taking every
+// (nsnapshots / nsegments)th one gives parts of similar duration
+//
+static void get_segment_starts(sinsp* inspector, uint32_t nsegments, OUT vector<scap_snapshot_info>* starts)
+{
+	vector<scap_snapshot_info> snapshots;
+	uint64_t start_evtnum = 0;
+
+	inspector->get_snapshots(&snapshots);
+
+	for(uint32_t j = 1; j < nsegments && !snapshots.empty(); j++)
+	{
+		const scap_snapshot_info& snapshot = snapshots[(uint64_t)j * snapshots.size() / nsegments];
+
+		if(snapshot.evtnum <= start_evtnum)
+		{
+			continue;
+		}
+
+		start_evtnum = snapshot.evtnum;
+		starts->push_back(snapshot);
+	}
+}
+
+//
+// Split a trace file at its state snapshots into up to nsegments parts, and
+// run the chisels on each of them in a separate thread. inspector, with
+// g_chisels, handles the first part, and the chisels of the other parts are
+// then merged into g_chisels.
+//
+static captureinfo do_inspect_segments(sinsp* inspector,
+	string infile,
+	uint32_t nsegments,
+	string filter,
+	vector<pair<string, vector<string> > >* chisel_cmds)
+{
+	captureinfo retval;
+	vector<scap_snapshot_info> starts;
+	vector<segment_info*> segments;
+	uint32_t j;
+	uint32_t k;
+
+	for(j = 0; j < g_chisels.size(); j++)
+	{
+		if(!g_chisels[j]->can_merge())
+		{
+			throw sinsp_exception("chisel " + chisel_cmds->at(j).first + " doesn't support --parallel");
+		}
+	}
+
+	get_segment_starts(inspector, nsegments, &starts);
+
+	segments.push_back(new segment_info());
+	segments[0]->m_inspector = inspector;
+	segments[0]->m_owns_inspector = false;
+	segments[0]->m_chisels = g_chisels;
+	segments[0]->m_end_evtnum = 0;
+	segments[0]->m_nevts = 0;
+	segments[0]->m_running = false;
+
+	try
+	{
+		for(j = 0; j < starts.size(); j++)
+		{
+			const scap_snapshot_info& snapshot = starts[j];
+			segment_info* si;
+
+			segments.back()->m_end_evtnum = snapshot.evtnum;
+
+			si = new segment_info();
+			si->m_inspector = NULL;
+			si->m_owns_inspector = true;
+			si->m_end_evtnum = 0;
+			si->m_nevts = 0;
+			si->m_running = false;
+			segments.push_back(si);
+
+			si->m_inspector = new sinsp();
+			si->m_inspector->set_buffer_format(inspector->get_buffer_format());
+			si->m_inspector->open(infile);
+			si->m_inspector->restore_snapshot(snapshot);
+
+			if(filter != "")
+			{
+				si->m_inspector->set_filter(filter);
+			}
+
+			for(k = 0; k < chisel_cmds->size(); k++)
+			{
+				sinsp_chisel* ch = new sinsp_chisel(si->m_inspector, chisel_cmds->at(k).first);
+				si->m_chisels.push_back(ch);
+				ch->set_args(&chisel_cmds->at(k).second);
+				ch->on_init();
+				ch->on_capture_start();
+			}
+		}
+
+		retval.m_nevts = run_segments(&segments);
+
+		//
+		// The segments are merged in file order, so the chisels see the
+		// results in the same order as if they had processed the whole file
+		//
+		for(j = 1; j < segments.size(); j++)
+		{
+			for(k = 0; k < g_chisels.size(); k++)
+			{
+				g_chisels[k]->merge(segments[j]->m_chisels[k]);
+			}
+		}
+
+		chisels_on_capture_end();
+	}
+	catch(...)
+	{
+		//
+		// Stop the threads that are still running
+		//
+		ctrl_c_pressed = true;
+		free_segments(&segments);
+		throw;
+	}
+
+	free_segments(&segments);
+	return retval;
+}
+
+#ifdef HAS_FILTERING
+//
+// Split the processes of a trace file in nshards shards, and run the chisels
+// on each of them in a separate thread. All the threads read the whole file,
+// but each one parses only the events of its processes and the ones that
+// change the state, see sinsp::set_shard(). Like in do_inspect_segments(),
+// inspector and g_chisels handle the first shard, and the chisels of the
+// other shards are then merged into g_chisels.
+//
+static captureinfo do_inspect_shards(sinsp* inspector,
+	string infile,
+	uint32_t nshards,
+	string filter,
+	vector<pair<string, vector<string> > >* chisel_cmds)
+{
+	captureinfo retval;
+	vector<segment_info*> shards;
+	uint32_t j;
+	uint32_t k;
+
+	for(j = 0; j < g_chisels.size(); j++)
+	{
+		if(!g_chisels[j]->can_merge())
+		{
+			throw sinsp_exception("chisel " + chisel_cmds->at(j).first + " doesn't support --shards");
+		}
+	}
+
+	inspector->set_shard(0, nshards);
+
+	shards.push_back(new segment_info());
+	shards[0]->m_inspector = inspector;
+	shards[0]->m_owns_inspector = false;
+	shards[0]->m_chisels = g_chisels;
+	shards[0]->m_end_evtnum = 0;
+	shards[0]->m_nevts = 0;
+	shards[0]->m_running = false;
+
+	try
+	{
+		for(j = 1; j < nshards; j++)
+		{
+			segment_info* si = new segment_info();
+
+			si->m_inspector = NULL;
+			si->m_owns_inspector = true;
+			si->m_end_evtnum = 0;
+			si->m_nevts = 0;
+			si->m_running = false;
+			shards.push_back(si);
+
+			si->m_inspector = new sinsp();
+			si->m_inspector->set_buffer_format(inspector->get_buffer_format());
+			si->m_inspector->open(infile);
+			si->m_inspector->set_shard(j, nshards);
+
+			if(filter != "")
+			{
+				si->m_inspector->set_filter(filter);
+			}
+
+			for(k = 0; k < chisel_cmds->size(); k++)
+			{
+				sinsp_chisel* ch = new sinsp_chisel(si->m_inspector, chisel_cmds->at(k).first);
+				si->m_chisels.push_back(ch);
+				ch->set_args(&chisel_cmds->at(k).second);
+				ch->on_init();
+				ch->on_capture_start();
+			}
+		}
+
+		retval.m_nevts = run_segments(&shards);
+
+		for(j = 1; j < shards.size(); j++)
+		{
+			for(k = 0; k < g_chisels.size(); k++)
+			{
+				g_chisels[k]->merge(shards[j]->m_chisels[k]);
+			}
+		}
+
+		chisels_on_capture_end();
+	}
+	catch(...)
+	{
+		ctrl_c_pressed = true;
+		free_segments(&shards);
+		throw;
+	}
+
+	free_segments(&shards);
+	return retval;
+}
+#endif // HAS_FILTERING
+
+//
+// Write the events of a trace file that pass the filter to a new file, with
+// the segments of the file filtered in parallel like in do_inspect_segments().
+// Each segment writes its events to a file of its own, and the new file gets
+// them in file order, after the tables of the processes that have events.
+//
+static captureinfo do_trim_segments(sinsp* inspector,
+	string infile,
+	string outfile,
+	uint32_t nsegments,
+	string filter)
+{
+	captureinfo retval;
+	vector<scap_snapshot_info> starts;
+	vector<segment_info*> segments;
+	set<int64_t> tids;
+	uint32_t j;
+
+	get_segment_starts(inspector, nsegments, &starts);
+
+	try
+	{
+		for(j = 0; j <= starts.size(); j++)
+		{
+			segment_info* si = new segment_info();
+			string segfilter = filter;
+			char fname[32];
+
+			si->m_inspector = NULL;
+			si->m_owns_inspector = true;
+			si->m_end_evtnum = (j < starts.size())? starts[j].evtnum : 0;
+			si->m_nevts = 0;
+			si->m_running = false;
+			segments.push_back(si);
+
+			si->m_inspector = new sinsp();
+			si->m_inspector->open(infile);
+
+			if(j != 0)
+			{
+				si->m_inspector->restore_snapshot(starts[j - 1]);
+			}
+
+			//
+			// The segment reads the first event of the next one before
+			// stopping, and that event must not go to its file
+			//
+			if(si->m_end_evtnum != 0)
+			{
+				snprintf(fname, sizeof(fname), "%" PRIu64, si->m_end_evtnum);
+				segfilter = (filter == "")?
+					string("evt.num<=") + fname :
+					"(" + filter + ") and evt.num<=" + fname;
+			}
+
+			if(segfilter != "")
+			{
+				si->m_inspector->set_filter(segfilter);
+			}
+
+			snprintf(fname, sizeof(fname), ".part%u", j);
+			si->m_dump_fname = outfile + fname;
+			si->m_inspector->autodump_start(si->m_dump_fname);
+		}
+
+		retval.m_nevts = run_segments(&segments);
+
+		for(j = 0; j < segments.size(); j++)
+		{
+			segments[j]->m_inspector->autodump_stop();
+			tids.insert(segments[j]->m_tids.begin(), segments[j]->m_tids.end());
+		}
+
+		//
+		// inspector hasn't read any event, so its tables are the ones at the
+		// beginning of the file
+		//
+		inspector->autodump_start(outfile, tids);
+
+		for(j = 0; j < segments.size(); j++)
+		{
+			inspector->autodump_append(segments[j]->m_dump_fname);
+		}
+	}
+	catch(...)
+	{
+		ctrl_c_pressed = true;
+		free_segments(&segments);
+		throw;
+	}
+
+	free_segments(&segments);
+	return retval;
+}
+#endif // defined(HAS_CHISELS) && !defined(_WIN32)
+
+//
+// Parse a timestamp in nanoseconds, or in seconds with up to 9 decimals
+//
+static bool parse_timestamp(const char* str, OUT uint64_t* ts)
+{
+	uint64_t s = 0;
+	uint64_t ns = 0;
+	uint32_t ndigits = 0;
+	const char* p;
+
+	for(p = str; *p >= '0' && *p <= '9'; p++)
+	{
+		s = s * 10 + (*p - '0');
+	}
+
+	if(p == str)
+	{
+		return false;
+	}
+
+	if(*p == '\0')
+	{
+		*ts = s;
+		return true;
+	}
+
+	if(*p != '.')
+	{
+		return false;
+	}
+
+	for(p++; *p >= '0' && *p <= '9' && ndigits < 9; p++, ndigits++)
+	{
+		ns = ns * 10 + (*p - '0');
+	}
+
+	if(*p != '\0')
+	{
+		return false;
+	}
+
+	for(; ndigits < 9; ndigits++)
+	{
+		ns *= 10;
+	}
+
+	*ts = s * 1000000000 + ns;
+	return true;
+}
+
+//
+// Parse a list of CPUs like the ones of taskset, e.g. 2,4-7
+//
+static bool parse_cpu_list(const char* str, OUT vector<uint32_t>* cpus)
+{
+	const char* p = str;
+
+	cpus->clear();
+
+	while(true)
+	{
+		char* end;
+		unsigned long first = strtoul(p, &end, 10);
+		unsigned long last = first;
+
+		if(end == p)
+		{
+			return false;
+		}
+
+		p = end;
+
+		if(*p == '-')
+		{
+			last = strtoul(p + 1, &end, 10);
+
+			if(end == p + 1 || last < first)
+			{
+				return false;
+			}
+
+			p = end;
+		}
+
+		for(; first <= last; first++)
+		{
+			cpus->push_back((uint32_t)first);
+		}
+
+		if(*p == '\0')
+		{
+			return true;
+		}
+
+		if(*p++ != ',')
+		{
+			return false;
+		}
+	}
+}
+
+#ifdef HAS_FILTERING
+//
+// Read a trace file and write the index of the given fields, see
+// sinsp_capture_index
+//
+static void build_capture_index(const string& infile, const string& fields)
+{
+	sinsp inspector;
+	sinsp_capture_index index(&inspector);
+	sinsp_evt* ev;
+	size_t start = 0;
+
+	while(start <= fields.size())
+	{
+		size_t comma = fields.find(',', start);
+		if(comma == string::npos)
+		{
+			comma = fields.size();
+		}
+
+		if(comma > start)
+		{
+			index.add_field(fields.substr(start, comma - start));
+		}
+
+		start = comma + 1;
+	}
+
+	inspector.open(infile);
+
+	while(true)
+	{
+		int32_t res = inspector.next(&ev);
+
+		if(res == SCAP_TIMEOUT)
+		{
+			continue;
+		}
+		else if(res == SCAP_EOF)
+		{
+			break;
+		}
+		else if(res != SCAP_SUCCESS)
+		{
+			throw sinsp_exception(inspector.getlasterr());
+		}
+
+		index.add(ev);
+	}
+
+	inspector.close();
+	index.write(infile);
+}
+#endif // HAS_FILTERING
+
+//
+// MAIN
+//
+int main(int argc, char **argv)
+{
+	int res = EXIT_SUCCESS;
+	sinsp* inspector = NULL;
+	string infile;
+	vector<string> infiles;
+	string outfile;
+	int op;
+	uint64_t cnt = -1;
+	bool quiet = false;
+	bool absolute_times = false;
+	bool is_filter_display = false;
+	bool verbose = false;
+	bool compress = false;
+	bool list_flds = false;
+	bool filter_explain = false;
+	bool fold = false;
+	bool follow = false;
+	bool resolve_names = false;
+	bool profile = false;
+	bool backpressure = false;
+	string build_index;
+	sinsp_evt::param_fmt event_buffer_format = sinsp_evt::PF_NORMAL;
+	sinsp_filter* display_filter = NULL;
+	sinsp_evt_json_formatter* json_formatter = NULL;
+	sinsp_arrow_writer* arrow_writer = NULL;
+	string arrow_file;
+	string arrow_fields = DEFAULT_ARROW_FIELDS;
+	double duration = 1;
+	captureinfo cinfo;
+	string output_format;
+	uint32_t snaplen = 0;
+	uint32_t ring_buf_size = 0;
+	int long_index = 0;
+	int32_t n_filterargs = 0;
+	int cflag = 0;
+	int compact_flag = 0;
+	int bpf_flag = 0;
+	int exit_only_flag = 0;
+	int tcp_tuple_elision_flag = 0;
+	uint32_t switch_summary_ms = 0;
+	uint32_t buffer_hash_len = 0;
+	uint32_t runq_summary_ms = 0;
+	uint32_t pgfault_summary_ms = 0;
+	uint32_t procinfo_ring_size = 0;
+	bool lazy_proc_scan = false;
+	bool bg_proc_scan = false;
+	bool driver_state_dump = false;
+	string checkpoint_file;
+	uint32_t state_ring_size = 0;
+	uint32_t reader_threads = 0;
+	vector<uint32_t> consumer_cpus;
+	bool exclude_consumer_cpus = false;
+	double replay_speed = 0;
+	vector<string> rollups;
+	vector<string> rule_files;
+	string sample;
+	bool skip_scan = false;
+	string trigger;
+	uint64_t trigger_before_s = 10;
+	uint64_t trigger_after_s = 10;
+	uint64_t trigger_mb = 64;
+	uint64_t rollup_interval_ms = 0;
+	uint64_t max_memory_mb = 0;
+	string metrics_file;
+	string tap_name;
+	uint64_t from_ts = 0;
+	uint32_t snapshot_interval = 0;
+	uint64_t rotate_file_size = 0;
+	uint64_t rotate_duration = 0;
+	uint32_t rotate_max_files = 0;
+	uint32_t nsegments = 1;
+	uint32_t nshards = 1;
+	uint32_t chisel_queue_len = 0;
+	bool chisel_drop = false;
+	string filter;
+#ifdef HAS_CHISELS
+	vector<pair<string, vector<string> > > chisel_cmds;
+#endif
+	string cname;
+	summary_table* summary = NULL;
+	uint64_t summary_interval_ns = 0;
+	bool detailed_stats = false;
+	string timefmt = "%evt.time";
+
+	static struct option long_options[] =
+	{
+		{"print-ascii", no_argument, 0, 'A' },
+		{"abstimes", no_argument, 0, 'a' },
+		{"arrow", required_argument, 0, 0 },
+		{"arrow-fields", required_argument, 0, 0 },
+		{"bufsize", required_argument, 0, 'B' },
+		{"backpressure", no_argument, 0, 0 },
+		{"bpf", no_argument, &bpf_flag, 1 },
+		{"buffer-hash", required_argument, 0, 0 },
+		{"build-index", required_argument, 0, 0 },
+		{"checkpoint", required_argument, 0, 0 },
+		{"compact", no_argument, &compact_flag, 1 },
+		{"exit-only", no_argument, &exit_only_flag, 1 },
+#ifdef HAS_CHISELS
+		{"chisel", required_argument, 0, 'c' },
+		{"chisel-drop", no_argument, 0, 0 },
+		{"chisel-threads", required_argument, 0, 0 },
+		{"list-chisels", no_argument, &cflag, 1 },
+#endif
+		{"file-size", required_argument, 0, 'C' },
+		{"displayflt", no_argument, 0, 'd' },
+		{"debug", no_argument, 0, 'D'},
+		{"filter-explain", no_argument, 0, 0 },
+		{"fold", no_argument, 0, 0 },
+		{"follow", no_argument, 0, 0 },
+		{"from", required_argument, 0, 0 },
+		{"seconds", required_argument, 0, 'G' },
+		{"help", no_argument, 0, 'h' },
+#ifdef HAS_CHISELS
+		{"chisel-info", required_argument, 0, 'i' },
+#endif
+		{"json", no_argument, 0, 'j' },
+		{"list", no_argument, 0, 'l' },
+		{"list-events", no_argument, 0, 'L' },
+		{"max-memory", required_argument, 0, 0 },
+		{"metrics-file", required_argument, 0, 0 },
+		{"numevents", required_argument, 0, 'n' },
+		{"parallel", required_argument, 0, 0 },
+		{"shards", required_argument, 0, 0 },
+		{"print", required_argument, 0, 'p' },
+		{"proc-scan", required_argument, 0, 0 },
+		{"procinfo-ring", required_argument, 0, 0 },
+		{"profile", no_argument, 0, 0 },
+		{"quiet", no_argument, 0, 'q' },
 		{"readfile", required_argument, 0, 'r' },
+		{"reader-threads", required_argument, 0, 0 },
+		{"replay", required_argument, 0, 0 },
+		{"resolve-names", no_argument, 0, 0 },
+		{"rollup", required_argument, 0, 0 },
+		{"rules", required_argument, 0, 0 },
+		{"rollup-interval", required_argument, 0, 0 },
+		{"runq-summary", required_argument, 0, 0 },
+		{"pgfault-summary", required_argument, 0, 0 },
+		{"sample", required_argument, 0, 0 },
+		{"skip-scan", no_argument, 0, 0 },
 		{"snaplen", required_argument, 0, 's' },
 		{"summary", no_argument, 0, 'S' },
+		{"summary-interval", required_argument, 0, 0 },
+		{"state-ring", required_argument, 0, 0 },
+		{"state-snapshots", required_argument, 0, 0 },
+		{"switch-summary", required_argument, 0, 0 },
+		{"tap", required_argument, 0, 0 },
+		{"tcp-tuple-elision", no_argument, &tcp_tuple_elision_flag, 1 },
 		{"timetype", required_argument, 0, 't' },
+		{"trigger", required_argument, 0, 0 },
+		{"trigger-window", required_argument, 0, 0 },
 		{"verbose", no_argument, 0, 'v' },
 		{"writefile", required_argument, 0, 'w' },
+		{"limit", required_argument, 0, 'W' },
 		{"print-hex", no_argument, 0, 'x'},
 		{"print-hex-ascii", no_argument, 0, 'X'},
+		{"compress", no_argument, 0, 'z' },
+		{"consumer-cpus", required_argument, 0, 0 },
+		{"exclude-consumer-cpus", no_argument, 0, 0 },
 		{0, 0, 0, 0}
 	};
 
 	output_format = "*%evt.num <TIME> %evt.cpu %proc.name (%thread.tid) %evt.dir %evt.type %evt.args";
 //	output_format = DEFAULT_OUTPUT_STR;
 
-	try
-	{
-		inspector = new sinsp();
+	//
+	// Buffer stdout, unless it's a terminal. This must come before anything
+	// is printed.
+	//
+	g_output_sink.init(stdout);
+
+	try
+	{
+		inspector = new sinsp();
+
+#ifdef HAS_CHISELS
+		inspector->add_chisel_dir(SYSDIG_INSTALLATION_DIR CHISELS_INSTALLATION_DIR);
+#endif
+
+		//
+		// Parse the args
+		//
+		while((op = getopt_long(argc, argv, "AaB:c:C:dDG:hi:jlLn:p:qr:Ss:t:vw:W:xXz", long_options, &long_index)) != -1)
+		{
+			switch(op)
+			{
+			case 'A':
+				if(event_buffer_format != sinsp_evt::PF_NORMAL)
+				{
+					fprintf(stderr, "you cannot specify more than one output format\n");
+					delete inspector;
+					return EXIT_SUCCESS;
+				}
+
+				event_buffer_format = sinsp_evt::PF_EOLS;
+				break;
+			case 'a':
+				absolute_times = true;
+				break;
+			case 'B':
+				ring_buf_size = atoi(optarg);
+				if(ring_buf_size == 0)
+				{
+					throw sinsp_exception(string("invalid buffer size ") + optarg);
+				}
+				break;
+			case 0:
+				if(string(long_options[long_index].name) == "filter-explain")
+				{
+					filter_explain = true;
+					break;
+				}
+
+				if(string(long_options[long_index].name) == "fold")
+				{
+					fold = true;
+					break;
+				}
+
+				if(string(long_options[long_index].name) == "follow")
+				{
+					follow = true;
+					break;
+				}
+
+				if(string(long_options[long_index].name) == "resolve-names")
+				{
+					resolve_names = true;
+					break;
+				}
+
+				if(string(long_options[long_index].name) == "profile")
+				{
+					profile = true;
+					break;
+				}
+
+				if(string(long_options[long_index].name) == "backpressure")
+				{
+					backpressure = true;
+					break;
+				}
+
+				if(string(long_options[long_index].name) == "build-index")
+				{
+					build_index = optarg;
+					break;
+				}
+
+				if(string(long_options[long_index].name) == "checkpoint")
+				{
+					checkpoint_file = optarg;
+					break;
+				}
+
+				if(string(long_options[long_index].name) == "buffer-hash")
+				{
+					buffer_hash_len = atoi(optarg);
+					if(buffer_hash_len == 0)
+					{
+						throw sinsp_exception(string("invalid buffer hash length ") + optarg);
+					}
+
+					break;
+				}
+
+				if(string(long_options[long_index].name) == "switch-summary")
+				{
+					switch_summary_ms = atoi(optarg);
+					if(switch_summary_ms == 0)
+					{
+						throw sinsp_exception(string("invalid switch summary interval ") + optarg);
+					}
+
+					break;
+				}
+
+				if(string(long_options[long_index].name) == "runq-summary")
+				{
+					runq_summary_ms = atoi(optarg);
+					if(runq_summary_ms == 0)
+					{
+						throw sinsp_exception(string("invalid run queue summary interval ") + optarg);
+					}
+
+					break;
+				}
+
+				if(string(long_options[long_index].name) == "pgfault-summary")
+				{
+					pgfault_summary_ms = atoi(optarg);
+					if(pgfault_summary_ms == 0)
+					{
+						throw sinsp_exception(string("invalid page fault summary interval ") + optarg);
+					}
+
+					break;
+				}
+
+				if(string(long_options[long_index].name) == "proc-scan")
+				{
+					if(string(optarg) == "full")
+					{
+						lazy_proc_scan = false;
+						bg_proc_scan = false;
+					}
+					else if(string(optarg) == "lazy")
+					{
+						lazy_proc_scan = true;
+						bg_proc_scan = false;
+					}
+					else if(string(optarg) == "background")
+					{
+						lazy_proc_scan = true;
+						bg_proc_scan = true;
+					}
+					else if(string(optarg) == "driver")
+					{
+						driver_state_dump = true;
+					}
+					else
+					{
+						throw sinsp_exception(string("invalid /proc scan mode ") + optarg);
+					}
+
+					break;
+				}
+
+				if(string(long_options[long_index].name) == "procinfo-ring")
+				{
+					procinfo_ring_size = atoi(optarg);
+					if(procinfo_ring_size == 0)
+					{
+						throw sinsp_exception(string("invalid process info ring size ") + optarg);
+					}
+
+					break;
+				}
+
+				if(string(long_options[long_index].name) == "state-ring")
+				{
+					state_ring_size = atoi(optarg);
+					if(state_ring_size == 0)
+					{
+						throw sinsp_exception(string("invalid state ring size ") + optarg);
+					}
+
+					break;
+				}
+
+				if(string(long_options[long_index].name) == "metrics-file")
+				{
+					metrics_file = optarg;
+					break;
+				}
+
+				if(string(long_options[long_index].name) == "max-memory")
+				{
+					max_memory_mb = atoll(optarg);
+					if(max_memory_mb == 0)
+					{
+						throw sinsp_exception(string("invalid memory budget ") + optarg);
+					}
+
+					break;
+				}
+
+				if(string(long_options[long_index].name) == "tap")
+				{
+					tap_name = optarg;
+					break;
+				}
+
+				if(string(long_options[long_index].name) == "arrow")
+				{
+					arrow_file = optarg;
+					break;
+				}
+
+				if(string(long_options[long_index].name) == "arrow-fields")
+				{
+					arrow_fields = optarg;
+					break;
+				}
+
+				if(string(long_options[long_index].name) == "from")
+				{
+					if(!parse_timestamp(optarg, &from_ts))
+					{
+						throw sinsp_exception(string("invalid timestamp ") + optarg);
+					}
+
+					break;
+				}
+
+				if(string(long_options[long_index].name) == "parallel")
+				{
+					nsegments = atoi(optarg);
+					if(nsegments == 0)
+					{
+						throw sinsp_exception(string("invalid number of parts ") + optarg);
+					}
+
+					break;
+				}
+
+				if(string(long_options[long_index].name) == "shards")
+				{
+					nshards = atoi(optarg);
+					if(nshards == 0)
+					{
+						throw sinsp_exception(string("invalid number of shards ") + optarg);
+					}
+
+					break;
+				}
+
+				if(string(long_options[long_index].name) == "state-snapshots")
+				{
+					snapshot_interval = atoi(optarg);
+					if(snapshot_interval == 0)
+					{
+						throw sinsp_exception(string("invalid snapshot interval ") + optarg);
+					}
+
+					break;
+				}
+
+				if(string(long_options[long_index].name) == "chisel-threads")
+				{
+					chisel_queue_len = atoi(optarg);
+					if(chisel_queue_len == 0)
+					{
+						throw sinsp_exception(string("invalid chisel queue length ") + optarg);
+					}
+
+					break;
+				}
+
+				if(string(long_options[long_index].name) == "chisel-drop")
+				{
+					chisel_drop = true;
+					break;
+				}
+
+				if(string(long_options[long_index].name) == "consumer-cpus")
+				{
+					if(!parse_cpu_list(optarg, &consumer_cpus))
+					{
+						throw sinsp_exception(string("invalid CPU list ") + optarg);
+					}
+
+					break;
+				}
+
+				if(string(long_options[long_index].name) == "exclude-consumer-cpus")
+				{
+					exclude_consumer_cpus = true;
+					break;
+				}
+
+				if(string(long_options[long_index].name) == "reader-threads")
+				{
+					reader_threads = atoi(optarg);
+					if(reader_threads == 0)
+					{
+						throw sinsp_exception(string("invalid number of reader threads ") + optarg);
+					}
+
+					break;
+				}
+
+				if(string(long_options[long_index].name) == "replay")
+				{
+					replay_speed = atof(optarg);
+					if(replay_speed <= 0)
+					{
+						throw sinsp_exception(string("invalid replay speed ") + optarg);
+					}
+
+					break;
+				}
+
+				if(string(long_options[long_index].name) == "summary-interval")
+				{
+					summary_interval_ns = strtoull(optarg, NULL, 10) * ONE_SECOND_IN_NS;
+					if(summary_interval_ns == 0)
+					{
+						throw sinsp_exception(string("invalid summary interval ") + optarg);
+					}
+
+					if(summary == NULL)
+					{
+						summary = new summary_table;
+					}
+
+					break;
+				}
+
+				if(string(long_options[long_index].name) == "rules")
+				{
+					rule_files.push_back(optarg);
+					break;
+				}
+
+				if(string(long_options[long_index].name) == "sample")
+				{
+					sample = optarg;
+					break;
+				}
+
+				if(string(long_options[long_index].name) == "skip-scan")
+				{
+					skip_scan = true;
+					break;
+				}
+
+				if(string(long_options[long_index].name) == "trigger")
+				{
+					trigger = optarg;
+					break;
+				}
+
+				if(string(long_options[long_index].name) == "trigger-window")
+				{
+					int before = 0;
+					int after = 0;
+					int mb = (int)trigger_mb;
+
+					if(sscanf(optarg, "%d:%d:%d", &before, &after, &mb) < 2 ||
+						before < 0 || after < 0 || mb <= 0)
+					{
+						throw sinsp_exception(string("invalid --trigger-window ") + optarg);
+					}
 
-#ifdef HAS_CHISELS
-		inspector->add_chisel_dir(SYSDIG_INSTALLATION_DIR CHISELS_INSTALLATION_DIR);
-#endif
+					trigger_before_s = before;
+					trigger_after_s = after;
+					trigger_mb = mb;
+					break;
+				}
 
-		//
-		// Parse the args
-		//
-		while((op = getopt_long(argc, argv, "Aac:dDhi:jlLn:p:qr:Ss:t:vw:xX", long_options, &long_index)) != -1)
-		{
-			switch(op)
-			{
-			case 'A':
-				if(event_buffer_format != sinsp_evt::PF_NORMAL)
+				if(string(long_options[long_index].name) == "rollup")
 				{
-					fprintf(stderr, "you cannot specify more than one output format\n");
-					delete inspector;
-					return EXIT_SUCCESS;
+					rollups.push_back(optarg);
+					break;
+				}
+
+				if(string(long_options[long_index].name) == "rollup-interval")
+				{
+					rollup_interval_ms = strtoull(optarg, NULL, 10);
+					if(rollup_interval_ms == 0)
+					{
+						throw sinsp_exception(string("invalid rollup interval ") + optarg);
+					}
+
+					break;
 				}
 
-				event_buffer_format = sinsp_evt::PF_EOLS;
-				break;
-			case 'a':
-				absolute_times = true;
-				break;
-			case 0:
 				if(cflag != 1 && cflag != 2)
 				{
 					break;
@@ -536,7 +2268,7 @@ int main(int argc, char **argv)
 					if(cflag == 1)
 					{
 						vector<chisel_desc> chlist;
-						sinsp_chisel::get_chisel_list(&chlist);
+						sinsp_chisel::get_chisel_list(&chlist, inspector);
 						list_chisels(&chlist);
 						delete inspector;
 						return EXIT_SUCCESS;
@@ -560,6 +2292,7 @@ int main(int argc, char **argv)
 					ch->set_args(&args);
 
 					g_chisels.push_back(ch);
+					chisel_cmds.push_back(make_pair(string(optarg), args));
 				}
 #endif
 				break;
@@ -574,7 +2307,7 @@ int main(int argc, char **argv)
 
 					vector<chisel_desc> chlist;
 
-					sinsp_chisel::get_chisel_list(&chlist);
+					sinsp_chisel::get_chisel_list(&chlist, inspector);
 
 					for(uint32_t j = 0; j < chlist.size(); j++)
 					{
@@ -591,12 +2324,28 @@ int main(int argc, char **argv)
 				break;
 #endif
 
+			case 'C':
+				rotate_file_size = atoi(optarg);
+				if(rotate_file_size == 0)
+				{
+					throw sinsp_exception(string("invalid file size ") + optarg);
+				}
+
+				rotate_file_size *= 1000000;
+				break;
 			case 'd':
 				is_filter_display = true;
 				break;
-			case 'j':
-				throw sinsp_exception("json output not yet implemented");
+			case 'G':
+				rotate_duration = atoi(optarg);
+				if(rotate_duration == 0)
+				{
+					throw sinsp_exception(string("invalid number of seconds ") + optarg);
+				}
 
+				rotate_duration *= ONE_SECOND_IN_NS;
+				break;
+			case 'j':
 				if(event_buffer_format != sinsp_evt::PF_NORMAL)
 				{
 					fprintf(stderr, "you cannot specify more than one output format\n");
@@ -647,19 +2396,13 @@ int main(int argc, char **argv)
 				quiet = true;
 				break;
 			case 'r':
-				infile = optarg;
+				infiles.push_back(optarg);
+				infile = infiles[0];
 				break;
 			case 'S':
-				summary_table = new vector<summary_table_entry>;
-
-				for(uint32_t j = 0; j < PPM_EVENT_MAX; j++)
-				{
-					summary_table->push_back(summary_table_entry(j, false));
-				}
-
-				for(uint32_t j = 0; j < PPM_SC_MAX * 2; j++)
+				if(summary == NULL)
 				{
-					summary_table->push_back(summary_table_entry(j, true));
+					summary = new summary_table;
 				}
 
 				break;
@@ -695,6 +2438,13 @@ int main(int argc, char **argv)
 				outfile = optarg;
 				quiet = true;
 				break;
+			case 'W':
+				rotate_max_files = atoi(optarg);
+				if(rotate_max_files == 0)
+				{
+					throw sinsp_exception(string("invalid number of files ") + optarg);
+				}
+				break;
 			case 'x':
 				if(event_buffer_format != sinsp_evt::PF_NORMAL)
 				{
@@ -713,111 +2463,403 @@ int main(int argc, char **argv)
 					return EXIT_SUCCESS;
 				}
 
-				event_buffer_format = sinsp_evt::PF_HEXASCII;
-				break;
-			default:
-				break;
+				event_buffer_format = sinsp_evt::PF_HEXASCII;
+				break;
+			case 'z':
+				compress = true;
+				break;
+			default:
+				break;
+			}
+		}
+
+		inspector->set_buffer_format(event_buffer_format);
+
+		//
+		// If -l was specified, print the fields and exit
+		//
+		if(list_flds)
+		{
+			if(verbose)
+			{
+				//
+				// -ll shows the fields verbosely, i.e. with more information
+				// like the type
+				//
+				list_fields(true);
+			}
+			else
+			{
+				list_fields(false);
+			}
+
+			res = EXIT_SUCCESS;
+			goto exit;
+		}
+
+		//
+		// the filter is at the end of the command line
+		//
+		if(optind + n_filterargs < argc)
+		{
+	#ifdef HAS_FILTERING
+			for(int32_t j = optind + n_filterargs; j < argc; j++)
+			{
+				filter += argv[j];
+				if(j < argc)
+				{
+					filter += " ";
+				}
+			}
+
+			try
+			{
+				if(filter_explain)
+				{
+					sinsp_filter explained_filter(inspector, filter);
+
+					printf("%s", explained_filter.explain().c_str());
+					res = EXIT_SUCCESS;
+					goto exit;
+				}
+
+				if(is_filter_display)
+				{
+					display_filter = new sinsp_filter(inspector, filter);
+				}
+				else
+				{
+					inspector->set_filter(filter);
+				}
+			}
+			catch(sinsp_exception e)
+			{
+				cerr << e.what() << endl;
+				res = EXIT_FAILURE;
+				goto exit;
+			}
+	#else
+			fprintf(stderr, "filtering not compiled.\n");
+			res = EXIT_FAILURE;
+			goto exit;
+	#endif
+		}
+
+		if(filter_explain && filter == "")
+		{
+			fprintf(stderr, "--filter-explain needs a filter\n");
+			res = EXIT_FAILURE;
+			goto exit;
+		}
+
+		//
+		// Set the CRTL+C signal
+		//
+		if(signal(SIGINT, signal_callback) == SIG_ERR)
+		{
+			fprintf(stderr, "An error occurred while setting a signal handler.\n");
+			res = EXIT_FAILURE;
+			goto exit;
+		}
+
+		//
+		// Insert the right time format based on the -t flag
+		//
+		replace_in_place(output_format, "<TIME>", timefmt);
+
+		//
+		// Create the event formatter
+		//
+		sinsp_evt_formatter formatter(inspector, output_format);
+
+		if(event_buffer_format == sinsp_evt::PF_JSON)
+		{
+			json_formatter = new sinsp_evt_json_formatter(inspector, output_format);
+		}
+
+		if(arrow_file != "")
+		{
+			arrow_writer = new sinsp_arrow_writer(inspector, arrow_fields, arrow_file);
+		}
+
+		initialize_chisels();
+
+		//
+		// Launch the capture
+		//
+		bool open_success = true;
+
+		if(ring_buf_size != 0)
+		{
+			inspector->set_ring_buffer_size(ring_buf_size);
+		}
+
+		if(lazy_proc_scan)
+		{
+			inspector->set_lazy_proc_scan(true, bg_proc_scan);
+		}
+
+		if(driver_state_dump)
+		{
+			inspector->set_driver_state_dump(true);
+		}
+
+		if(!checkpoint_file.empty())
+		{
+			inspector->set_checkpoint_file(checkpoint_file);
+		}
+
+		if(bpf_flag)
+		{
+			inspector->set_bpf_engine(true);
+		}
+
+		if(compact_flag)
+		{
+			inspector->set_compact_encoding(true);
+		}
+
+		if(exit_only_flag)
+		{
+			inspector->set_exit_only(true);
+		}
+
+		if(tcp_tuple_elision_flag)
+		{
+			inspector->set_tcp_tuple_elision(true);
+		}
+
+		if(buffer_hash_len != 0)
+		{
+			inspector->set_buffer_hash(buffer_hash_len);
+		}
+
+		if(switch_summary_ms != 0)
+		{
+			inspector->set_switch_summary(switch_summary_ms);
+		}
+
+		if(runq_summary_ms != 0)
+		{
+			inspector->set_runq_summary(runq_summary_ms);
+		}
+
+		if(pgfault_summary_ms != 0)
+		{
+			inspector->set_pgfault_summary(pgfault_summary_ms);
+		}
+
+		if(procinfo_ring_size != 0)
+		{
+			inspector->set_procinfo_ring(procinfo_ring_size);
+		}
+
+		if(state_ring_size != 0)
+		{
+			inspector->set_state_ring(state_ring_size);
+		}
+
+		if(consumer_cpus.size() != 0)
+		{
+			inspector->set_consumer_cpus(consumer_cpus, exclude_consumer_cpus);
+		}
+		else if(exclude_consumer_cpus)
+		{
+			throw sinsp_exception("--exclude-consumer-cpus requires --consumer-cpus");
+		}
+
+		if(reader_threads != 0)
+		{
+			inspector->set_reader_threads(reader_threads);
+		}
+
+		if(tap_name != "")
+		{
+			inspector->set_event_tap(tap_name, TAP_SIZE);
+		}
+
+		if(fold)
+		{
+			inspector->set_fold_repeats(true);
+		}
+
+		if(resolve_names)
+		{
+			inspector->set_name_resolution(true);
+		}
+
+		if(profile)
+		{
+			inspector->set_profiling(true);
+		}
+
+		if(backpressure)
+		{
+			inspector->set_backpressure(true);
+		}
+
+		if(max_memory_mb != 0)
+		{
+			inspector->set_max_memory(max_memory_mb * 1024 * 1024);
+		}
+
+		if(metrics_file != "")
+		{
+			inspector->set_metrics_file(metrics_file, METRICS_FILE_INTERVAL_MS);
+		}
+
+		if(!rollups.empty())
+		{
+			sinsp_rollup* rollup = inspector->get_rollup();
+
+			if(nsegments > 1)
+			{
+				throw sinsp_exception("--rollup can't be used with --parallel");
+			}
+
+			for(uint32_t j = 0; j < rollups.size(); j++)
+			{
+				size_t p1 = rollups[j].find(':');
+				size_t p2 = (p1 == string::npos)? string::npos : rollups[j].find(':', p1 + 1);
+				vector<string> keys;
+
+				if(p2 == string::npos)
+				{
+					throw sinsp_exception("invalid rollup " + rollups[j] + ", the format is <op>:<value>:<keys>");
+				}
+
+				string keylist = rollups[j].substr(p2 + 1);
+				size_t start = 0;
+
+				while(start <= keylist.size())
+				{
+					size_t end = keylist.find(',', start);
+
+					if(end == string::npos)
+					{
+						end = keylist.size();
+					}
+
+					if(end > start)
+					{
+						keys.push_back(keylist.substr(start, end - start));
+					}
+
+					start = end + 1;
+				}
+
+				rollup->add_metric(rollups[j],
+					keys,
+					rollups[j].substr(p1 + 1, p2 - p1 - 1),
+					rollups[j].substr(0, p1));
 			}
-		}
 
-		inspector->set_buffer_format(event_buffer_format);
+			if(rollup_interval_ms != 0)
+			{
+				rollup->set_interval_ns(rollup_interval_ms * 1000000);
+			}
 
-		//
-		// If -l was specified, print the fields and exit
-		//
-		if(list_flds)
+			rollup->add_listener(&g_rollup_printer);
+			g_rollup_enabled = true;
+		}
+
+		if(!rule_files.empty())
 		{
-			if(verbose)
+#ifdef HAS_FILTERING
+			if(nsegments > 1)
 			{
-				//
-				// -ll shows the fields verbosely, i.e. with more information
-				// like the type
-				//
-				list_fields(true);
+				throw sinsp_exception("--rules can't be used with --parallel");
 			}
-			else
+
+			g_rule_engine = new sinsp_rule_engine(inspector);
+
+			for(uint32_t j = 0; j < rule_files.size(); j++)
 			{
-				list_fields(false);
+				g_rule_engine->load_file(rule_files[j]);
 			}
-
-			res = EXIT_SUCCESS;
-			goto exit;
+#else
+			throw sinsp_exception("--rules requires filtering support");
+#endif
 		}
 
-		//
-		// the filter is at the end of the command line
-		//
-		if(optind + n_filterargs < argc)
+		if(sample != "")
 		{
-	#ifdef HAS_FILTERING
-			string filter;
+#ifdef HAS_FILTERING
+			size_t colon = sample.find(':');
+			int ratio = (colon != string::npos)? atoi(sample.c_str() + colon + 1) : 0;
 
-			for(int32_t j = optind + n_filterargs; j < argc; j++)
+			if(ratio < 1)
 			{
-				filter += argv[j];
-				if(j < argc)
-				{
-					filter += " ";
-				}
+				throw sinsp_exception("invalid --sample " + sample + ", must be <mode>:<n>");
 			}
 
-			try
+			if(nsegments > 1)
 			{
-				if(is_filter_display)
-				{
-					display_filter = new sinsp_filter(inspector, filter);
-				}
-				else
-				{
-					inspector->set_filter(filter);
-				}
+				throw sinsp_exception("--sample can't be used with --parallel");
 			}
-			catch(sinsp_exception e)
+
+			inspector->set_consistent_sampling(sinsp_consistent_sampler::parse_mode(sample.substr(0, colon)),
+				(uint32_t)ratio);
+#else
+			throw sinsp_exception("--sample requires filtering support");
+#endif
+		}
+
+		if(build_index != "")
+		{
+#ifdef HAS_FILTERING
+			if(infiles.size() != 1)
 			{
-				cerr << e.what() << endl;
-				res = EXIT_FAILURE;
-				goto exit;
+				throw sinsp_exception("--build-index requires exactly one -r");
 			}
-	#else
-			fprintf(stderr, "filtering not compiled.\n");
-			res = EXIT_FAILURE;
+
+			build_capture_index(infile, build_index);
 			goto exit;
-	#endif
+#else
+			throw sinsp_exception("--build-index requires filtering support");
+#endif
 		}
 
-		//
-		// Set the CRTL+C signal
-		//
-		if(signal(SIGINT, signal_callback) == SIG_ERR)
+		if(skip_scan)
 		{
-			fprintf(stderr, "An error occurred while setting a signal handler.\n");
-			res = EXIT_FAILURE;
-			goto exit;
+#ifdef HAS_FILTERING
+			inspector->set_block_skipping(true);
+#else
+			throw sinsp_exception("--skip-scan requires filtering support");
+#endif
 		}
 
-		//
-		// Insert the right time format based on the -t flag
-		//
-		replace_in_place(output_format, "<TIME>", timefmt);
-
-		//
-		// Create the event formatter
-		//
-		sinsp_evt_formatter formatter(inspector, output_format);
-
-		initialize_chisels();
-
-		//
-		// Launch the capture
-		//
-		bool open_success = true;
-
 		if(infile != "")
 		{
 			//
 			// We have a file to open
 			//
-			inspector->open(infile);
+			if(infiles.size() > 1 && (from_ts != 0 || nsegments > 1))
+			{
+				throw sinsp_exception("--from and --parallel can't be used with more than one -r");
+			}
+
+			if(follow)
+			{
+				if(infiles.size() > 1 || from_ts != 0 || nsegments > 1)
+				{
+					throw sinsp_exception("--follow can't be used with more than one -r, --from or --parallel");
+				}
+
+				inspector->set_follow_file(true);
+			}
+
+			if(replay_speed != 0)
+			{
+				inspector->set_replay_speed(replay_speed);
+			}
+
+			inspector->open(infiles);
+
+			if(from_ts != 0)
+			{
+				inspector->seek(from_ts);
+			}
 		}
 		else
 		{
@@ -880,9 +2922,76 @@ int main(int argc, char **argv)
 			inspector->set_snaplen(snaplen);
 		}
 
+		//
+		// With the summary, also ask the driver for the per event type stats.
+		// Older drivers don't support them, and we just go without.
+		//
+		if(summary != NULL && inspector->is_live())
+		{
+			try
+			{
+				inspector->set_detailed_stats(true);
+				detailed_stats = true;
+			}
+			catch(const sinsp_exception&)
+			{
+			}
+		}
+
 		if(outfile != "")
 		{
-			inspector->autodump_start(outfile);
+			//
+			// Keep the disk writes out of the event loop
+			//
+#ifndef _WIN32
+			inspector->set_dump_buffering(DUMP_BUFFER_SIZE, true);
+#endif
+			if(compress)
+			{
+				inspector->set_dump_compression(DUMP_COMPRESSION_LEVEL);
+			}
+
+			if(fold)
+			{
+				inspector->set_dump_fold_repeats(true);
+			}
+
+			if(snapshot_interval != 0)
+			{
+				inspector->set_dump_snapshot_interval((uint64_t)snapshot_interval * ONE_SECOND_IN_NS);
+			}
+
+			if(rotate_file_size != 0 || rotate_duration != 0)
+			{
+				inspector->set_dump_rotation(rotate_file_size, rotate_duration, rotate_max_files);
+			}
+
+			//
+			// With --parallel, the file is written once all the segments
+			// are filtered
+			//
+			if(trigger != "")
+			{
+#ifdef HAS_FILTERING
+				if(nsegments > 1 || rotate_file_size != 0 || rotate_duration != 0)
+				{
+					throw sinsp_exception("--trigger can't be used with --parallel, -C or -G");
+				}
+
+				g_flight_recorder = new sinsp_dumper(inspector);
+				g_flight_recorder->open_flight_recorder(outfile,
+					trigger,
+					trigger_mb * 1024 * 1024,
+					trigger_before_s * ONE_SECOND_IN_NS,
+					trigger_after_s * ONE_SECOND_IN_NS);
+#else
+				throw sinsp_exception("--trigger requires filtering support");
+#endif
+			}
+			else if(nsegments <= 1)
+			{
+				inspector->autodump_start(outfile);
+			}
 		}
 
 		duration = ((double)clock()) / CLOCKS_PER_SEC;
@@ -892,13 +3001,111 @@ int main(int argc, char **argv)
 		//
 		chisels_on_capture_start();
 
-		cinfo = do_inspect(inspector,
-			cnt,
-			quiet,
-			absolute_times,
-			display_filter,
-			summary_table,
-			&formatter);
+		//
+		// The trace file, the summary and the rollups need all the events
+		//
+		if(outfile == "" && summary == NULL && rollups.empty())
+		{
+			set_chisels_evttype_mask(inspector);
+		}
+
+		if(nsegments > 1 && nshards > 1)
+		{
+			throw sinsp_exception("--shards can't be used with --parallel");
+		}
+
+		if(nsegments > 1 && outfile != "")
+		{
+#if defined(HAS_CHISELS) && !defined(_WIN32)
+			if(infiles.size() != 1 || !g_chisels.empty() || from_ts != 0 || cnt != (uint64_t)-1 ||
+				is_filter_display || snapshot_interval != 0 || rotate_file_size != 0 || rotate_duration != 0 ||
+				outfile == "-" || outfile.compare(0, sizeof(SCAP_REMOTE_PREFIX) - 1, SCAP_REMOTE_PREFIX) == 0)
+			{
+				throw sinsp_exception("--parallel with -w requires one -r and a file to write, and can't be used with -c, -d, -n, -C, -G, --from or --state-snapshots");
+			}
+
+			cinfo = do_trim_segments(inspector,
+				infile,
+				outfile,
+				nsegments,
+				filter);
+#else
+			throw sinsp_exception("--parallel is not supported on this platform");
+#endif
+		}
+		else if(nsegments > 1)
+		{
+#if defined(HAS_CHISELS) && !defined(_WIN32)
+			if(infile == "" || g_chisels.empty() || from_ts != 0 || cnt != (uint64_t)-1 ||
+				chisel_queue_len != 0)
+			{
+				throw sinsp_exception("--parallel requires -r and -c or -w, and can't be used with -n, --from or --chisel-threads");
+			}
+
+			cinfo = do_inspect_segments(inspector,
+				infile,
+				nsegments,
+				is_filter_display? "" : filter,
+				&chisel_cmds);
+#else
+			throw sinsp_exception("--parallel is not supported on this platform");
+#endif
+		}
+		else if(nshards > 1)
+		{
+#if defined(HAS_CHISELS) && defined(HAS_FILTERING) && !defined(_WIN32)
+			if(infiles.size() != 1 || g_chisels.empty() || outfile != "" || from_ts != 0 ||
+				cnt != (uint64_t)-1 || follow || chisel_queue_len != 0 || sample != "" || !rollups.empty() ||
+				!rule_files.empty())
+			{
+				throw sinsp_exception("--shards requires one -r and -c, and can't be used with -w, -n, --from, --follow, --chisel-threads, --sample, --rollup or --rules");
+			}
+
+			cinfo = do_inspect_shards(inspector,
+				infile,
+				nshards,
+				is_filter_display? "" : filter,
+				&chisel_cmds);
+#else
+			throw sinsp_exception("--shards is not supported on this platform");
+#endif
+		}
+		else
+		{
+#ifdef HAS_CHISELS
+			if(chisel_queue_len != 0)
+			{
+				for(vector<sinsp_chisel*>::iterator it = g_chisels.begin(); it != g_chisels.end(); ++it)
+				{
+					if(!(*it)->start_thread(chisel_queue_len, chisel_drop))
+					{
+						fprintf(stderr, "chisel %s runs in the capture thread\n", (*it)->get_filename().c_str());
+					}
+				}
+			}
+#endif
+
+			cinfo = do_inspect(inspector,
+				cnt,
+				quiet,
+				absolute_times,
+				display_filter,
+				summary,
+				summary_interval_ns,
+				&formatter,
+				json_formatter,
+				arrow_writer);
+		}
+
+		if(arrow_writer != NULL)
+		{
+			arrow_writer->close();
+
+			if(verbose)
+			{
+				fprintf(stderr, "Rows written to %s: %" PRIu64 "\n", arrow_file.c_str(), arrow_writer->get_nrows());
+			}
+		}
 
 		duration = ((double)clock()) / CLOCKS_PER_SEC - duration;
 
@@ -907,14 +3114,90 @@ int main(int argc, char **argv)
 
 		if(verbose)
 		{
-			fprintf(stderr, "Driver Events:%" PRIu64 "\nDriver Drops:%" PRIu64 "\n",
+			fprintf(stderr, "Driver Events:%" PRIu64 "\nDriver Drops:%" PRIu64 "\nDriver Copied Bytes:%" PRIu64 "\n",
 				cstats.n_evts,
-				cstats.n_drops);
+				cstats.n_drops,
+				cstats.n_copy_bytes);
+
+			vector<scap_device_info> devices;
+			inspector->get_device_info(&devices);
+
+			for(vector<scap_device_info>::iterator it = devices.begin(); it != devices.end(); ++it)
+			{
+				fprintf(stderr, "Ring CPU %u: %u bytes, node %d%s%s\n",
+					it->cpuid,
+					it->buffer_size,
+					it->numa_node,
+					it->node_local? " (local)" : "",
+					it->contiguous? " (contiguous)" : "");
+			}
+
+			scap_consumer_placement placement;
+			inspector->get_consumer_placement(&placement);
+
+			fprintf(stderr, "Consumer: CPU %d, node %d", placement.cpu, placement.numa_node);
+
+			if(placement.ncpus != 0)
+			{
+				fprintf(stderr, ", pinned to %u CPUs%s",
+					placement.ncpus,
+					placement.excluded? " (excluded from the capture)" : "");
+			}
+
+			fprintf(stderr, "\n");
 
 			fprintf(stderr, "Elapsed time: %.3lf, Captured Events: %" PRIu64 ", %.2lf eps\n",
 				duration,
 				cinfo.m_nevts,
 				(double)cinfo.m_nevts / duration);
+
+			if(outfile.compare(0, sizeof(SCAP_REMOTE_PREFIX) - 1, SCAP_REMOTE_PREFIX) == 0)
+			{
+				uint64_t dump_drops;
+				uint64_t dump_drop_bytes;
+
+				inspector->get_dump_drops(&dump_drops, &dump_drop_bytes);
+
+				fprintf(stderr, "Remote Drops:%" PRIu64 "\nRemote Dropped Bytes:%" PRIu64 "\n",
+					dump_drops,
+					dump_drop_bytes);
+			}
+
+#ifdef HAS_CHISELS
+			for(vector<sinsp_chisel*>::iterator it = g_chisels.begin(); it != g_chisels.end(); ++it)
+			{
+				chisel_lua_stats lstats;
+				(*it)->get_lua_stats(&lstats);
+
+				//
+				// The chisels that are not Lua scripts have no state
+				//
+				if(lstats.m_mem_bytes == 0)
+				{
+					continue;
+				}
+
+				fprintf(stderr, "Chisel %s: Lua memory %" PRIu64 " KB (max %" PRIu64 " KB), %" PRIu64 " GC steps, %" PRIu64 " GC cycles\n",
+					(*it)->get_filename().c_str(),
+					lstats.m_mem_bytes / 1024,
+					lstats.m_max_mem_bytes / 1024,
+					lstats.m_ngc_steps,
+					lstats.m_ngc_cycles);
+
+				chisel_thread_stats tstats;
+
+				if((*it)->get_thread_stats(&tstats))
+				{
+					fprintf(stderr, "Chisel %s: %" PRIu64 " batches queued, %" PRIu64 " dropped (%" PRIu64 " events), %" PRIu64 " waits, max queue depth %u\n",
+						(*it)->get_filename().c_str(),
+						tstats.m_nbatches,
+						tstats.m_ndropped_batches,
+						tstats.m_ndropped_evts,
+						tstats.m_nwaits,
+						tstats.m_max_depth);
+				}
+			}
+#endif
 		}
 	}
 	catch(sinsp_exception e)
@@ -932,13 +3215,68 @@ exit:
 	//
 	// If there's a summary table, sort and print it
 	//
-	if(summary_table != NULL)
+	if(summary != NULL)
 	{
-		print_summary_table(inspector, summary_table, 100);
+		print_summary_table(inspector, summary, 100, false);
+		delete summary;
+	}
+
+	if(detailed_stats)
+	{
+		print_driver_stats(inspector, 100);
+	}
+
+	if(profile)
+	{
+		print_profile(inspector, 30);
 	}
 
 	free_chisels();
 
+#ifdef HAS_FILTERING
+	if(g_rule_engine)
+	{
+		const vector<sinsp_rule*>& rules = g_rule_engine->get_rules();
+
+		for(uint32_t j = 0; j < rules.size(); j++)
+		{
+			if(rules[j]->m_nsuppressed != 0)
+			{
+				fprintf(stderr, "rule %s: %" PRIu64 " alerts suppressed by the rate limit\n",
+					rules[j]->m_name.c_str(),
+					rules[j]->m_nsuppressed);
+			}
+		}
+
+		delete g_rule_engine;
+	}
+
+	if(g_flight_recorder)
+	{
+		if(verbose)
+		{
+			fprintf(stderr, "%" PRIu64 " trigger files written\n", g_flight_recorder->get_ntriggers());
+		}
+
+		delete g_flight_recorder;
+	}
+
+	if(skip_scan && verbose)
+	{
+		fprintf(stderr, "%" PRIu64 " groups of events skipped\n", inspector->get_skipped_blocks());
+	}
+#endif
+
+	if(json_formatter)
+	{
+		delete json_formatter;
+	}
+
+	if(arrow_writer)
+	{
+		delete arrow_writer;
+	}
+
 	if(inspector)
 	{
 		delete inspector;
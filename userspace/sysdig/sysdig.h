@@ -20,6 +20,31 @@ along with sysdig.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "config.h"
 
+//
+// Size of the shared memory ring of --tap
+//
+#define TAP_SIZE (16 * 1024 * 1024)
+
+//
+// How often the file of --metrics-file is written
+//
+#define METRICS_FILE_INTERVAL_MS 10000
+
+//
+// Fields written by --arrow when --arrow-fields isn't given
+//
+#define DEFAULT_ARROW_FIELDS "evt.num,evt.rawtime,evt.cpu,proc.name,thread.tid,evt.dir,evt.type,evt.rawres,fd.name,evt.args"
+
+//
+// Size of each of the two blocks -w writes the events in
+//
+#define DUMP_BUFFER_SIZE (8 * 1024 * 1024)
+
+//
+// zlib level of -z. The fastest one already gives most of the size reduction
+//
+#define DUMP_COMPRESSION_LEVEL 1
+
 //
 // ASSERT implementation
 //
@@ -46,29 +71,72 @@ public:
 };
 
 //
-// Summary table entry
+// Counters of an event type in the summary table
 //
-class summary_table_entry
+typedef struct summary_counters
+{
+	uint64_t m_ncalls;
+	uint64_t m_bytes; // Size of the events
+	uint64_t m_latency_ns; // Total time between the enter events and the exit ones
+	uint64_t m_nlatency; // Exit events that have a latency
+}summary_counters;
+
+//
+// The summary table of -S: the counters of each event type, followed by the
+// ones of the enter and exit events of each system call that is only captured
+// as a generic event. With --summary-interval, the table is also printed
+// periodically, with the difference from the previous print.
+//
+#define SUMMARY_TABLE_SIZE (PPM_EVENT_MAX + PPM_SC_MAX * 2)
+
+class summary_table
 {
 public:
-	summary_table_entry(uint16_t id, bool is_unsupported_syscall)
+	summary_table()
 	{
-		m_id = id;
-		m_ncalls = 0;
-		m_is_unsupported_syscall = is_unsupported_syscall;
+		memset(m_totals, 0, sizeof(m_totals));
+		memset(m_printed, 0, sizeof(m_printed));
 	}
 
-	uint16_t m_id;
-	uint64_t m_ncalls;
-	bool m_is_unsupported_syscall;
-};
-
-struct summary_table_entry_rsort_comparer
-{
-    bool operator() (const summary_table_entry& first, const summary_table_entry& second) const 
+	void add(sinsp_evt* ev)
 	{
-		return first.m_ncalls > second.m_ncalls;
+		uint16_t etype = ev->get_type();
+		uint32_t id = etype;
+
+		if(etype == PPME_GENERIC_E || etype == PPME_GENERIC_X)
+		{
+			sinsp_evt_param *parinfo = ev->get_param(0);
+			uint16_t sc = *(uint16_t *)parinfo->m_val;
+
+			if(sc >= PPM_SC_MAX)
+			{
+				return;
+			}
+
+			id = PPM_EVENT_MAX + sc * 2 + (etype == PPME_GENERIC_X);
+		}
+
+		summary_counters* c = &m_totals[id];
+
+		c->m_ncalls++;
+		c->m_bytes += ev->get_len();
+
+#ifdef HAS_FILTERING
+		if(PPME_IS_EXIT(etype))
+		{
+			sinsp_threadinfo* tinfo = ev->get_thread_info();
+
+			if(tinfo != NULL && tinfo->m_latency != 0)
+			{
+				c->m_latency_ns += tinfo->m_latency;
+				c->m_nlatency++;
+			}
+		}
+#endif
 	}
+
+	summary_counters m_totals[SUMMARY_TABLE_SIZE];
+	summary_counters m_printed[SUMMARY_TABLE_SIZE]; // m_totals at the last periodic print
 };
 
 //